@@ -18,15 +18,41 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "configfile.h"
+#include "endian_magic.h"
 #include "entrytracker.h"
 #include "messagebus.h"
 #include "util.h"
 
 #include "adsb_icao.h"
 
-kis_adsb_icao::kis_adsb_icao() {
+#define ICAO_BIN_MAGIC          "KISICAO1"
+#define ICAO_BIN_HEADER_LEN     12
+#define ICAO_BIN_RECORD_LEN     8
+
+namespace {
+
+uint32_t icao_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return kis_letoh32(v);
+}
+
+}
+
+kis_adsb_icao::kis_adsb_icao() :
+    db_loaded{false},
+    zmfile{nullptr},
+    bin_map{nullptr},
+    bin_len{0},
+    bin_count{0} {
+
     mutex.set_name("kis_adsb_icao");
 
     auto entrytracker = Globalreg::fetch_mandatory_global_as<entry_tracker>();
@@ -79,25 +105,159 @@ kis_adsb_icao::kis_adsb_icao() {
 
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("icao_lookup", true) == false) {
         _MSG_INFO("Disabling ADSB ICAO lookup");
+        db_loaded = true;
         return;
     }
 
+    auto binname =
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("icaobinfile",
+                "%S/kismet/kismet_adsb_icao.bin");
+
+    binfile =
+        Globalreg::globalreg->kismet_config->expand_log_path(binname, "", "", 0, 1);
+
     auto fname = 
         Globalreg::globalreg->kismet_config->fetch_opt_dfl("icaofile", 
                 "%S/kismet/kismet_adsb_icao.txt.gz");
 
-    auto expanded =
+    txtfile =
         Globalreg::globalreg->kismet_config->expand_log_path(fname, "", "", 0, 1);
+}
+
+kis_adsb_icao::~kis_adsb_icao() {
+    if (bin_map != nullptr)
+        munmap(const_cast<uint8_t *>(bin_map), bin_len);
+
+    if (zmfile != nullptr)
+        gzclose(zmfile);
+}
+
+bool kis_adsb_icao::open_binary(const std::string& in_path) {
+    int fd = open(in_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    // No binary table is normal for source builds, fall back to the text db
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < ICAO_BIN_HEADER_LEN) {
+        _MSG_ERROR("Invalid ADSB ICAO table {}, falling back to the text ICAO db", in_path);
+        close(fd);
+        return false;
+    }
+
+    auto base = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        _MSG_ERROR("Could not map ADSB ICAO table {}: {}", in_path, kis_strerror_r(errno));
+        return false;
+    }
+
+    auto map = static_cast<const uint8_t *>(base);
+    auto count = icao_read32(map + 8);
+
+    if (memcmp(map, ICAO_BIN_MAGIC, 8) != 0 ||
+            ICAO_BIN_HEADER_LEN + (uint64_t) count * ICAO_BIN_RECORD_LEN > (uint64_t) sb.st_size) {
+        _MSG_ERROR("Invalid ADSB ICAO table {}, falling back to the text ICAO db", in_path);
+        munmap(base, sb.st_size);
+        return false;
+    }
+
+    bin_map = map;
+    bin_len = sb.st_size;
+    bin_count = count;
+
+    _MSG_INFO("Using ADSB ICAO table {}, {} records", in_path, bin_count);
+
+    return true;
+}
+
+void kis_adsb_icao::load_db() {
+    kis_lock_guard<kis_mutex> lk(mutex, "adsb icao load_db");
+
+    if (db_loaded)
+        return;
+
+    db_loaded = true;
 
-    if ((zmfile = gzopen(expanded.c_str(), "r")) == nullptr) {
+    if (open_binary(binfile))
+        return;
+
+    if ((zmfile = gzopen(txtfile.c_str(), "r")) == nullptr) {
         _MSG_ERROR("Could not open ICAO database {}, ADSB ICAO lookup will not be available.",
-                expanded);
+                txtfile);
         return;
     }
 
     index();
 }
 
+std::shared_ptr<tracked_adsb_icao> kis_adsb_icao::lookup_binary(uint32_t icao) {
+    auto records = bin_map + ICAO_BIN_HEADER_LEN;
+
+    // Binary search for the first record >= icao
+    uint32_t lo = 0, hi = bin_count;
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+
+        if (icao_read32(records + (size_t) mid * ICAO_BIN_RECORD_LEN) < icao)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == bin_count || icao_read32(records + (size_t) lo * ICAO_BIN_RECORD_LEN) != icao)
+        return unknown_icao;
+
+    size_t offt = icao_read32(records + (size_t) lo * ICAO_BIN_RECORD_LEN + 4);
+
+    if (offt >= bin_len)
+        return unknown_icao;
+
+    char atype = bin_map[offt++];
+    std::string fields[4];
+
+    for (unsigned int i = 0; i < 4; i++) {
+        auto start = reinterpret_cast<const char *>(bin_map + offt);
+        auto end = static_cast<const char *>(memchr(start, 0, bin_len - offt));
+
+        if (end == nullptr)
+            return unknown_icao;
+
+        fields[i] = std::string(start, end - start);
+        offt += (end - start) + 1;
+    }
+
+    return make_record(icao, fields[0], fields[1], fields[2], fields[3], atype);
+}
+
+std::shared_ptr<tracked_adsb_icao> kis_adsb_icao::make_record(uint32_t icao,
+        const std::string& regid, const std::string& model_type, const std::string& model,
+        const std::string& owner, char atype) {
+    auto icao_rec =
+        std::make_shared<tracked_adsb_icao>(icao_id);
+    icao_rec->set_icao(icao);
+    icao_rec->set_regid(munge_to_printable(regid));
+    icao_rec->set_model_type(munge_to_printable(model_type));
+    icao_rec->set_model(munge_to_printable(model));
+    icao_rec->set_owner(munge_to_printable(owner));
+
+    auto atype_l = atype_map.find(atype);
+
+    if (atype_l == atype_map.end()) {
+        icao_rec->set_atype(atype_map['U']);
+        icao_rec->set_atype_short('U');
+    } else {
+        icao_rec->set_atype(atype_l->second);
+        icao_rec->set_atype_short(atype);
+    }
+
+    return icao_rec;
+}
+
 void kis_adsb_icao::index() {
     char buf[2048];
     int line = 0;
@@ -162,17 +322,25 @@ std::shared_ptr<tracked_adsb_icao> kis_adsb_icao::lookup_icao(uint32_t icao) {
     int matched = -1;
     char buf[2048];
 
-    if (zmfile == nullptr) {
-        return unknown_icao;
-    }
-
     {
         kis_lock_guard<kis_mutex> lk(mutex, "adsb icao lookup");
 
+        if (!db_loaded)
+            load_db();
+
+        if (zmfile == nullptr && bin_map == nullptr)
+            return unknown_icao;
+
         auto cached = icao_map.find(icao);
         if (cached != icao_map.end())
             return cached->second;
 
+        if (bin_map != nullptr) {
+            auto icao_rec = lookup_binary(icao);
+            icao_map[icao] = icao_rec;
+            return icao_rec;
+        }
+
         for (unsigned int x = 0; x < index_vec.size(); x++) {
             if (icao > index_vec[x].icao) {
                 matched = x;
@@ -217,23 +385,8 @@ std::shared_ptr<tracked_adsb_icao> kis_adsb_icao::lookup_icao(uint32_t icao) {
                     return unknown_icao;
                 }
 
-                auto icao_rec = 
-                    std::make_shared<tracked_adsb_icao>(icao_id);
-                icao_rec->set_icao(icao);
-                icao_rec->set_regid(munge_to_printable(fields[1]));
-                icao_rec->set_model_type(munge_to_printable(fields[2]));
-                icao_rec->set_model(munge_to_printable(fields[3]));
-                icao_rec->set_owner(munge_to_printable(fields[4]));
-
-                auto atype_l = atype_map.find(fields[5][0]);
-
-                if (atype_l == atype_map.end()) {
-                    icao_rec->set_atype(atype_map['U']);
-                    icao_rec->set_atype_short('U');
-                } else {
-                    icao_rec->set_atype(atype_l->second);
-                    icao_rec->set_atype_short(fields[5][0]);
-                }
+                auto icao_rec = make_record(icao, fields[1], fields[2], fields[3],
+                        fields[4], fields[5][0]);
 
                 icao_map[icao] = icao_rec;
                 return icao_rec;
@@ -105,9 +105,16 @@ protected:
     std::shared_ptr<tracker_element_uint8> atype_short;
 };
 
+// ICAO records are looked up in a sorted binary table mapped into memory, generated
+// from the text db by 'tools/create_icao_db.py --binary'; if there is no binary table
+// we fall back to indexing and seeking through the gzipped text db.
+//
+// Most servers never see ADSB, so the db isn't opened, or indexed, until the first
+// lookup.
 class kis_adsb_icao {
 public:
     kis_adsb_icao();
+    ~kis_adsb_icao();
 
     void index();
 
@@ -131,11 +138,29 @@ public:
     };
 
 protected:
+    void load_db();
+
+    bool open_binary(const std::string& in_path);
+    std::shared_ptr<tracked_adsb_icao> lookup_binary(uint32_t icao);
+
+    std::shared_ptr<tracked_adsb_icao> make_record(uint32_t icao, const std::string& regid,
+            const std::string& model_type, const std::string& model, const std::string& owner,
+            char atype);
+
     kis_mutex mutex;
     std::map<char, std::shared_ptr<tracker_element_string>> atype_map;
 
+    bool db_loaded;
+    std::string binfile;
+    std::string txtfile;
+
     gzFile zmfile;
 
+    // Mapped binary table
+    const uint8_t *bin_map;
+    size_t bin_len;
+    uint32_t bin_count;
+
     int icao_id;
     int icao_type_id;
     std::shared_ptr<tracked_adsb_icao> unknown_icao;
@@ -0,0 +1,242 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "adsb_modes.h"
+
+namespace {
+
+// Mode-S parity generator polynomial
+constexpr uint32_t modes_crc_poly = 0xFFF409;
+
+struct modes_crc_table {
+    constexpr modes_crc_table() : t{} {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i << 16;
+
+            for (unsigned int b = 0; b < 8; b++) {
+                if (c & 0x800000)
+                    c = (c << 1) ^ modes_crc_poly;
+                else
+                    c <<= 1;
+            }
+
+            t[i] = c & 0xFFFFFF;
+        }
+    }
+
+    uint32_t t[256];
+};
+
+constexpr modes_crc_table crc_table;
+
+// Latitudes at which the number of longitude zones drops, from NL 59 down to NL 2
+constexpr double cpr_nl_lat[] = {
+    10.47047130, 14.82817437, 18.18626357, 21.02939493, 23.54504487, 25.82924707,
+    27.93898710, 29.91135686, 31.77209708, 33.53993436, 35.22899598, 36.85025108,
+    38.41241892, 39.92256684, 41.38651832, 42.80914012, 44.19454951, 45.54626723,
+    46.86733252, 48.16039128, 49.42776439, 50.67150166, 51.89342469, 53.09516153,
+    54.27817472, 55.44378444, 56.59318756, 57.72747354, 58.84763776, 59.95459277,
+    61.04917774, 62.13216659, 63.20427479, 64.26616523, 65.31845310, 66.36171008,
+    67.39646774, 68.42322022, 69.44242631, 70.45451075, 71.45986473, 72.45884545,
+    73.45177442, 74.43893416, 75.42056257, 76.39684391, 77.36789461, 78.33374083,
+    79.29428225, 80.24923213, 81.19801349, 82.13956981, 83.07199445, 83.99173563,
+    84.89166191, 85.75541621, 86.53536998, 87.00000000
+};
+
+const char modes_charset[] =
+    "?ABCDEFGHIJKLMNOPQRSTUVWXYZ????? ???????????????0123456789??????";
+
+uint32_t frame_parity(const uint8_t *data, size_t len) {
+    return ((uint32_t) data[len - 3] << 16) | ((uint32_t) data[len - 2] << 8) | data[len - 1];
+}
+
+void decode_callsign(const uint8_t *me, adsb_modes_message& msg) {
+    // 8 6-bit characters following the type code
+    uint64_t bits = 0;
+
+    for (unsigned int i = 1; i < 7; i++)
+        bits = (bits << 8) | me[i];
+
+    std::string cs;
+
+    for (int c = 7; c >= 0; c--)
+        cs += modes_charset[(bits >> (c * 6)) & 0x3F];
+
+    auto first = cs.find_first_not_of(' ');
+
+    if (first == std::string::npos)
+        return;
+
+    msg.callsign = cs.substr(first, cs.find_last_not_of(' ') - first + 1);
+    msg.has_callsign = true;
+}
+
+void decode_airborne_position(const uint8_t *me, unsigned int tc, adsb_modes_message& msg) {
+    // Barometric altitude is only encoded in 25ft steps when the Q bit is set; GNSS
+    // heights in TC 20-22 aren't what the rest of the records hold
+    if (tc <= 18 && (me[1] & 0x01)) {
+        int n = ((me[1] >> 1) << 4) | (me[2] >> 4);
+        msg.altitude = n * 25 - 1000;
+        msg.has_altitude = true;
+    }
+
+    msg.cpr_odd = (me[2] & 0x04) != 0;
+    msg.raw_lat = ((uint32_t) (me[2] & 0x03) << 15) | ((uint32_t) me[3] << 7) | (me[4] >> 1);
+    msg.raw_lon = ((uint32_t) (me[4] & 0x01) << 16) | ((uint32_t) me[5] << 8) | me[6];
+    msg.has_position = true;
+}
+
+void decode_velocity(const uint8_t *me, adsb_modes_message& msg) {
+    unsigned int st = me[0] & 0x07;
+
+    if (st == 1 || st == 2) {
+        // Ground speed as east/west and north/south components; 0 is unavailable
+        int ew = ((me[1] & 0x03) << 8) | me[2];
+        int ns = ((me[3] & 0x7F) << 3) | (me[4] >> 5);
+
+        if (ew == 0 || ns == 0)
+            return;
+
+        ew -= 1;
+        ns -= 1;
+
+        // Supersonic
+        if (st == 2) {
+            ew *= 4;
+            ns *= 4;
+        }
+
+        if (me[1] & 0x04)
+            ew = -ew;
+
+        if (me[3] & 0x80)
+            ns = -ns;
+
+        msg.speed = sqrt((double) ew * ew + (double) ns * ns);
+        msg.has_speed = true;
+
+        msg.heading = atan2(ew, ns) * 180 / M_PI;
+
+        if (msg.heading < 0)
+            msg.heading += 360;
+
+        msg.has_heading = true;
+    } else if (st == 3 || st == 4) {
+        // Airspeed, with the magnetic heading if it's available
+        if (me[1] & 0x04) {
+            msg.heading = (((me[1] & 0x03) << 8) | me[2]) * 360.0 / 1024;
+            msg.has_heading = true;
+        }
+    }
+}
+
+}
+
+uint32_t adsb_modes_crc24(const uint8_t *in_data, size_t in_len) {
+    uint32_t crc = 0;
+
+    for (size_t i = 0; i < in_len; i++)
+        crc = ((crc << 8) ^ crc_table.t[((crc >> 16) ^ in_data[i]) & 0xFF]) & 0xFFFFFF;
+
+    return crc;
+}
+
+bool adsb_modes_decode(const uint8_t *in_data, size_t in_len, adsb_modes_message& msg) {
+    msg.reset();
+
+    if (in_len != ADSB_MODES_SHORT_LEN && in_len != ADSB_MODES_LONG_LEN)
+        return false;
+
+    msg.df = in_data[0] >> 3;
+
+    if (msg.df == 11) {
+        if (in_len != ADSB_MODES_SHORT_LEN)
+            return false;
+
+        // All-call replies overlay the interrogator ID on the parity, so anything in
+        // the low 7 bits is allowed
+        auto syndrome = adsb_modes_crc24(in_data, in_len - 3) ^ frame_parity(in_data, in_len);
+
+        if (syndrome & ~0x7FU)
+            return false;
+
+        msg.crc_valid = true;
+        msg.icao = ((uint32_t) in_data[1] << 16) | ((uint32_t) in_data[2] << 8) | in_data[3];
+
+        return true;
+    }
+
+    if (msg.df != 17 && msg.df != 18)
+        return false;
+
+    if (in_len != ADSB_MODES_LONG_LEN)
+        return false;
+
+    // DF18 carries ADS-B with an ICAO address only in control field 0
+    if (msg.df == 18 && (in_data[0] & 0x07) != 0)
+        return false;
+
+    if (adsb_modes_crc24(in_data, in_len - 3) != frame_parity(in_data, in_len))
+        return false;
+
+    msg.crc_valid = true;
+    msg.icao = ((uint32_t) in_data[1] << 16) | ((uint32_t) in_data[2] << 8) | in_data[3];
+
+    auto me = in_data + 4;
+    unsigned int tc = me[0] >> 3;
+
+    if (tc >= 1 && tc <= 4)
+        decode_callsign(me, msg);
+    else if ((tc >= 9 && tc <= 18) || (tc >= 20 && tc <= 22))
+        decode_airborne_position(me, tc, msg);
+    else if (tc == 19)
+        decode_velocity(me, msg);
+
+    return true;
+}
+
+int adsb_cpr_nl(double lat) {
+    if (lat < 0)
+        lat = -lat;
+
+    auto n = std::upper_bound(std::begin(cpr_nl_lat), std::end(cpr_nl_lat), lat) -
+        std::begin(cpr_nl_lat);
+
+    return 59 - n;
+}
+
+std::string kis_adsb_packinfo::frame_hex() const {
+    static const char hexdigits[] = "0123456789abcdef";
+
+    std::string ret;
+    ret.reserve(len * 2);
+
+    for (size_t i = 0; i < len; i++) {
+        ret += hexdigits[frame[i] >> 4];
+        ret += hexdigits[frame[i] & 0x0F];
+    }
+
+    return ret;
+}
+
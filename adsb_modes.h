@@ -0,0 +1,126 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __ADSB_MODES_H__
+#define __ADSB_MODES_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "packet.h"
+
+// Native decoding of Mode-S frames, so binary ADS-B sources (Beast feeds, the ADSB
+// proxy) don't go through JSON.  Only the frames which identify an aircraft and the
+// extended squitters which carry its identity, position and velocity are decoded:
+//
+//  DF11        All-call reply; the ICAO address
+//  DF17, DF18  Extended squitter; callsign (TC 1-4), altitude and CPR position
+//              (TC 9-18, 20-22), speed and heading (TC 19)
+//
+// Units match the JSON records of the rtladsb capture: altitude in feet, speed in
+// knots, heading in degrees.
+
+#define ADSB_MODES_SHORT_LEN        7
+#define ADSB_MODES_LONG_LEN         14
+
+struct adsb_modes_message {
+    adsb_modes_message() {
+        reset();
+    }
+
+    void reset() {
+        df = 0;
+        icao = 0;
+        crc_valid = false;
+        has_callsign = false;
+        callsign.clear();
+        has_altitude = false;
+        altitude = 0;
+        has_position = false;
+        cpr_odd = false;
+        raw_lat = raw_lon = 0;
+        has_speed = false;
+        speed = 0;
+        has_heading = false;
+        heading = 0;
+    }
+
+    unsigned int df;
+    uint32_t icao;
+    bool crc_valid;
+
+    bool has_callsign;
+    std::string callsign;
+
+    bool has_altitude;
+    int altitude;
+
+    bool has_position;
+    bool cpr_odd;
+    uint32_t raw_lat, raw_lon;
+
+    bool has_speed;
+    double speed;
+
+    bool has_heading;
+    double heading;
+};
+
+// Mode-S CRC-24 of a frame, not including the parity bits at the end of it
+uint32_t adsb_modes_crc24(const uint8_t *in_data, size_t in_len);
+
+// Decode a short (7 byte) or long (14 byte) frame; returns false if the frame isn't
+// one we decode or fails its CRC
+bool adsb_modes_decode(const uint8_t *in_data, size_t in_len, adsb_modes_message& msg);
+
+// CPR number of longitude zones at a latitude, from the precomputed transition
+// latitudes of 1090-WP-9-14
+int adsb_cpr_nl(double lat);
+
+// Raw Mode-S frame and the decoded message, added by binary ADS-B sources in place of
+// a JSON record
+class kis_adsb_packinfo : public packet_component {
+public:
+    kis_adsb_packinfo() :
+        len{0} { }
+
+    void reset() {
+        len = 0;
+        msg.reset();
+    }
+
+    void set_frame(const uint8_t *in_data, size_t in_len) {
+        len = std::min(in_len, sizeof(frame));
+        memcpy(frame, in_data, len);
+    }
+
+    std::string frame_hex() const;
+
+    uint8_t frame[ADSB_MODES_LONG_LEN];
+    size_t len;
+
+    adsb_modes_message msg;
+};
+
+#endif
+
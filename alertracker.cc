@@ -30,11 +30,28 @@
 #include "kis_databaselogfile.h"
 #include "trackedelement_workers.h"
 
-alert_tracker::alert_tracker() : lifetime_global() {
+alert_tracker::alert_tracker() : 
+    lifetime_global(),
+    alert_strand{Globalreg::globalreg->io.get_executor()} {
     alert_mutex.set_name("alertracker");
 
 	next_alert_id = 0;
 
+    for (auto& m : alert_enabled_map)
+        m = 0;
+
+    alert_epoch = std::chrono::steady_clock::now();
+
+    for (auto& l : alert_limits) {
+        l.rate.state = 0;
+        l.rate.capacity = 0;
+        l.rate.period_ms = 1;
+        l.burst.state = 0;
+        l.burst.capacity = 0;
+        l.burst.period_ms = 1;
+        l.suppressed = 0;
+    }
+
     packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
     entrytracker = Globalreg::fetch_mandatory_global_as<entry_tracker>();
     eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
@@ -77,6 +94,8 @@ alert_tracker::alert_tracker() : lifetime_global() {
     pack_comp_gps =
 		packetchain->register_packet_component("GPS");
 
+    pack_tag_alert = packetchain->register_packet_tag("ALERT");
+
 	// Register a KISMET alert type with no rate restrictions
     alert_ref_kismet =
 		register_alert("KISMET", 
@@ -99,7 +118,10 @@ alert_tracker::alert_tracker() : lifetime_global() {
                 }));
 
     httpd->register_route("/alerts/definitions", {"GET", "POST"}, httpd->RO_ROLE, {}, 
-            std::make_shared<kis_net_web_tracked_endpoint>(alert_defs_vec, alert_mutex));
+            std::make_shared<kis_net_web_tracked_endpoint>(alert_defs_vec, alert_mutex,
+                [this](std::shared_ptr<tracker_element>) {
+                    sync_suppressed();
+                }));
 
     httpd->register_route("/alerts/all_alerts", {"GET", "POST"}, httpd->RO_ROLE, {}, 
             std::make_shared<kis_net_web_tracked_endpoint>(alert_backlog_vec, alert_mutex));
@@ -261,10 +283,22 @@ int alert_tracker::register_alert(std::string in_header, std::string in_class,
     arec->set_limit_burst(in_burst);
     arec->set_phy(in_phy);
     arec->set_time_last(0);
+    arec->set_packet_tag(packetchain->register_packet_tag(fmt::format("ALERT_{}", arec->get_header())));
 
     alert_name_map.insert(std::make_pair(arec->get_header(), arec->get_alert_ref()));
     alert_ref_map.insert(std::make_pair(arec->get_alert_ref(), arec));
 
+    // Alerts limited to 0 are squelched and can never be raised
+    if (in_rate != 0 && arec->get_alert_ref() < KIS_ALERT_FAST_REFS) {
+        auto& limits = alert_limits[arec->get_alert_ref()];
+
+        init_alert_bucket(limits.rate, in_rate, in_unit);
+        init_alert_bucket(limits.burst, in_burst, in_burstunit);
+
+        alert_enabled_map[arec->get_alert_ref() / 64].fetch_or(1ULL << (arec->get_alert_ref() % 64),
+                std::memory_order_release);
+    }
+
     alert_defs_vec->push_back(arec);
 
     return arec->get_alert_ref();
@@ -314,7 +348,97 @@ int alert_tracker::check_times(shared_alert_def arec) {
     return 0;
 }
 
+void alert_tracker::init_alert_bucket(alert_bucket& bucket, int in_limit, alert_time_unit in_unit) {
+    auto limit = std::min(std::max(in_limit, 0), KIS_ALERT_MAX_TOKENS);
+
+    // Buckets start full
+    bucket.capacity = (uint64_t) limit * 256;
+    bucket.period_ms = (uint64_t) alert_time_unit_conv[in_unit] * 1000;
+    bucket.state = (alert_now_ms() << 24) | bucket.capacity;
+}
+
+bool alert_tracker::take_alert_token(alert_bucket& bucket, uint64_t now_ms, bool consume) {
+    auto state = bucket.state.load(std::memory_order_relaxed);
+
+    while (true) {
+        auto last_ms = state >> 24;
+        auto tokens = state & 0xFFFFFF;
+
+        // Refill for the time since the bucket was last filled, only moving the fill time
+        // on by the time the added tokens account for so slow rates still accumulate
+        if (now_ms > last_ms) {
+            auto elapsed = std::min(now_ms - last_ms, bucket.period_ms);
+            auto added = elapsed * bucket.capacity / bucket.period_ms;
+
+            if (tokens + added >= bucket.capacity) {
+                tokens = bucket.capacity;
+                last_ms = now_ms;
+            } else {
+                tokens += added;
+                last_ms += added * bucket.period_ms / bucket.capacity;
+            }
+        }
+
+        if (tokens < 256)
+            return false;
+
+        if (!consume)
+            return true;
+
+        if (bucket.state.compare_exchange_weak(state, (last_ms << 24) | (tokens - 256),
+                    std::memory_order_relaxed))
+            return true;
+    }
+}
+
+void alert_tracker::return_alert_token(alert_bucket& bucket) {
+    auto state = bucket.state.load(std::memory_order_relaxed);
+
+    while (true) {
+        auto tokens = std::min((state & 0xFFFFFF) + 256, bucket.capacity);
+
+        if (bucket.state.compare_exchange_weak(state, (state & ~0xFFFFFFULL) | tokens,
+                    std::memory_order_relaxed))
+            return;
+    }
+}
+
+bool alert_tracker::check_alert_limits(int in_ref, bool consume) {
+    auto& limits = alert_limits[in_ref];
+    auto now_ms = alert_now_ms();
+
+    if (take_alert_token(limits.burst, now_ms, consume)) {
+        if (take_alert_token(limits.rate, now_ms, consume))
+            return true;
+
+        if (consume)
+            return_alert_token(limits.burst);
+    }
+
+    // Only alerts which were actually raised count as suppressed, not the checks for
+    // whether one could be
+    if (consume)
+        limits.suppressed.fetch_add(1, std::memory_order_relaxed);
+
+    return false;
+}
+
+void alert_tracker::sync_suppressed() {
+    for (const auto& ari : alert_ref_map) {
+        if (ari.first >= KIS_ALERT_FAST_REFS)
+            continue;
+
+        ari.second->set_suppressed(alert_limits[ari.first].suppressed.load(std::memory_order_relaxed));
+    }
+}
+
 int alert_tracker::potential_alert(int in_ref) {
+    if (!alert_enabled(in_ref))
+        return 0;
+
+    if (in_ref < KIS_ALERT_FAST_REFS)
+        return check_alert_limits(in_ref, false);
+
     kis_lock_guard<kis_mutex> lk(alert_mutex, "alert_tracker potential_alert");
 
     std::map<int, shared_alert_def>::iterator aritr = alert_ref_map.find(in_ref);
@@ -331,28 +455,39 @@ int alert_tracker::raise_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
         mac_addr bssid, mac_addr source, mac_addr dest, 
         mac_addr other, std::string in_channel, std::string in_text) {
 
-    kis_unique_lock<kis_mutex> lock(alert_mutex, std::defer_lock, "alert_tracker raise_alert");
+    // Alerts which failed to register have no definition to raise
+    if (in_ref < 0)
+        return -1;
 
-    lock.lock();
+    shared_alert_def arec;
+    bool limited = false;
 
-    std::map<int, shared_alert_def>::iterator aritr = alert_ref_map.find(in_ref);
+    {
+        kis_lock_guard<kis_mutex> lk(alert_mutex, "alert_tracker raise_alert");
 
-    if (aritr == alert_ref_map.end())
-        return -1;
+        auto aritr = alert_ref_map.find(in_ref);
 
-    shared_alert_def arec = aritr->second;
+        if (aritr == alert_ref_map.end())
+            return -1;
+
+        arec = aritr->second;
+
+        // Alerts past the lock-free references are limited by their definition
+        if (in_ref >= KIS_ALERT_FAST_REFS)
+            limited = check_times(arec) != 1;
+    }
 
     if (in_pack != nullptr) {
-        in_pack->tag_map["ALERT"] = true;
-        in_pack->tag_map[fmt::format("ALERT_{}", arec->get_header())] = true;
+        in_pack->tag(pack_tag_alert);
+        in_pack->tag(arec->get_packet_tag());
     }
 
+    if (in_ref < KIS_ALERT_FAST_REFS)
+        limited = !alert_enabled(in_ref) || !check_alert_limits(in_ref, true);
 
-    if (check_times(arec) != 1)
+    if (limited)
         return 0;
 
-    lock.unlock();
-
     auto info = std::make_shared<kis_alert_info>();
 
     info->header = arec->get_header();
@@ -374,27 +509,7 @@ int alert_tracker::raise_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
     if (gpstracker != nullptr)
         info->gps = gpstracker->get_best_location();
 
-    // Increment and set the timers
-    arec->inc_burst_sent(1);
-    arec->inc_total_sent(1);
-    arec->set_time_last(ts_to_double(info->tm));
-
-    lock.lock();
-
-    auto alert_t = std::make_shared<tracked_alert>(alert_entry_id, info);
-
-    alert_backlog_vec->push_back(alert_t);
-    if ((int) alert_backlog_vec->size() > num_backlog) 
-        alert_backlog_vec->erase(alert_backlog_vec->begin());
-
-    // Publish an alert to the eventbus
-    auto event = eventbus->get_eventbus_event(alert_event());
-    event->get_event_content()->insert(alert_event(), alert_t);
-    eventbus->publish(event);
-
-    lock.unlock();
-
-    // Try to get the existing alert info
+    // Attach it to the packet while the packet is still in the chain
     if (in_pack != NULL)  {
         auto acomp = in_pack->fetch<kis_alert_component>(pack_comp_alert);
 
@@ -404,7 +519,6 @@ int alert_tracker::raise_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
             in_pack->insert(pack_comp_alert, acomp);
         }
 
-        // Attach it to the packet
         acomp->alert_vec.push_back(info);
 
         // Also get GPS
@@ -412,6 +526,43 @@ int alert_tracker::raise_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
         info->gps = pack_gpsinfo;
     }
 
+    boost::asio::post(alert_strand, 
+            [this, in_ref, in_pack, info]() {
+                deliver_alert(in_ref, in_pack, info);
+            });
+
+	return 1;
+}
+
+void alert_tracker::deliver_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
+        std::shared_ptr<kis_alert_info> info) {
+    kis_unique_lock<kis_mutex> lock(alert_mutex, "alert_tracker deliver_alert");
+
+    auto aritr = alert_ref_map.find(in_ref);
+
+    if (aritr != alert_ref_map.end()) {
+        auto arec = aritr->second;
+
+        // Increment and set the timers; the lock-free limits keep their own burst counts
+        if (in_ref >= KIS_ALERT_FAST_REFS)
+            arec->inc_burst_sent(1);
+        arec->inc_total_sent(1);
+        arec->set_time_last(ts_to_double(info->tm));
+    }
+
+    auto alert_t = std::make_shared<tracked_alert>(alert_entry_id, info);
+
+    alert_backlog_vec->push_back(alert_t);
+    if ((int) alert_backlog_vec->size() > num_backlog) 
+        alert_backlog_vec->erase(alert_backlog_vec->begin());
+
+    // Publish an alert to the eventbus
+    auto event = eventbus->get_eventbus_event(alert_event());
+    event->get_event_content()->insert(alert_event(), alert_t);
+    eventbus->publish(event);
+
+    lock.unlock();
+
 #ifdef PRELUDE
     // Send alert to Prelude
     if (prelude_alerts)
@@ -421,8 +572,6 @@ int alert_tracker::raise_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
 
 	// Send the text info
 	_MSG(info->header + " " + info->text, MSGFLAG_ALERT);
-
-	return 1;
 }
 
 int alert_tracker::raise_one_shot(std::string in_header, std::string in_class, 
@@ -869,7 +1018,9 @@ void alert_tracker::alert_dt_endpoint(std::shared_ptr<kis_net_beast_httpd_connec
     std::ostream os(&con->response_stream());
 
     auto summary_vec = std::vector<SharedElementSummary>{};
-    auto rename_map = Globalreg::new_from_pool<tracker_element_serializer::rename_map>();
+
+    tracker_element_summary_arena arena;
+    auto rename_map = arena.make_rename_map();
 
     auto search_term = std::string{};
 
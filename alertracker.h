@@ -23,6 +23,8 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <atomic>
+#include <chrono>
 #include <list>
 #include <map>
 #include <vector>
@@ -46,6 +48,13 @@
 #define PRELUDE_ANALYZER_MANUFACTURER "https://www.kismetwireless.net"
 #endif
 
+// Alert references with a lock-free enabled bit and rate limit; any later ones are
+// always checked under the alert lock
+#define KIS_ALERT_FAST_REFS     1024
+
+// Largest rate or burst a lock-free rate limit can hold; larger limits are clamped
+#define KIS_ALERT_MAX_TOKENS    0xFFFF
+
 // Alert severity categories
 enum class kis_alert_severity {
     info = 0,
@@ -351,6 +360,7 @@ public:
             __ImportField(burst_sent, p);
             __ImportField(total_sent, p);
             __ImportField(time_last, p);
+            __ImportField(suppressed, p);
 
             reserve_fields(nullptr);
         }
@@ -387,9 +397,14 @@ public:
 
     __Proxy(time_last, double, double, double, time_last);
 
+    __Proxy(suppressed, uint64_t, uint64_t, uint64_t, suppressed);
+
     int get_alert_ref() { return alert_ref; }
     void set_alert_ref(int in_ref) { alert_ref = in_ref; }
 
+    int get_packet_tag() { return packet_tag; }
+    void set_packet_tag(int in_tag) { packet_tag = in_tag; }
+
 protected:
     virtual void register_fields() override {
         tracker_component::register_fields();
@@ -410,11 +425,16 @@ protected:
         register_field("kismet.alert.definition.total_sent", "Total alerts sent", &total_sent);
         register_field("kismet.alert.definition.time_last", 
                 "Timestamp of last alert (sec.us)", &time_last);
+        register_field("kismet.alert.definition.suppressed", 
+                "Alerts suppressed by the rate limits", &suppressed);
     }
 
     // Non-exposed internal reference
     int alert_ref;
 
+    // Non-exposed ALERT_[header] packet tag
+    int packet_tag = -1;
+
     // Alert type and description
     std::shared_ptr<tracker_element_string> header;
     std::shared_ptr<tracker_element_string> alertclass;
@@ -437,6 +457,9 @@ protected:
     // Timestamp of the last time
     std::shared_ptr<tracker_element_double> time_last;
 
+    // Number of alerts of this type dropped by the rate limits
+    std::shared_ptr<tracker_element_uint64> suppressed;
+
 };
 
 typedef std::shared_ptr<tracked_alert_definition> shared_alert_def;
@@ -490,6 +513,19 @@ public:
     // Will an alert succeed?
     int potential_alert(int in_ref);
 
+    // Is an alert registered with a non-zero rate; this never takes the alert lock, so
+    // packet handlers can skip the checks of disabled alerts for free.  Rate limits
+    // still need potential_alert
+    bool alert_enabled(int in_ref) const {
+        if (in_ref < 0)
+            return false;
+
+        if (in_ref >= KIS_ALERT_FAST_REFS)
+            return true;
+
+        return (alert_enabled_map[in_ref / 64].load(std::memory_order_relaxed) >> (in_ref % 64)) & 1;
+    }
+
     // Raise an alert ...
     int raise_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
                    mac_addr bssid, mac_addr source, mac_addr dest, mac_addr other,
@@ -535,17 +571,69 @@ protected:
 
     int alert_vec_id, alert_entry_id, alert_timestamp_id, alert_def_id;
 
-    // Check and age times
+    // Check and age times, for alerts past the lock-free references
     int check_times(shared_alert_def arec);
 
+    // Lock-free token bucket.  The state packs the milliseconds since alert_epoch the
+    // bucket was last filled to (upper 40 bits) and the tokens, in 1/256ths of an alert
+    // (lower 24 bits); the bucket refills from empty to capacity over period_ms
+    struct alert_bucket {
+        std::atomic<uint64_t> state;
+        uint64_t capacity;
+        uint64_t period_ms;
+    };
+
+    // Lock-free rate limits of an alert; an alert takes a token from both buckets
+    struct alert_limiter {
+        alert_bucket rate;
+        alert_bucket burst;
+        std::atomic<uint64_t> suppressed;
+    };
+
+    void init_alert_bucket(alert_bucket& bucket, int in_limit, alert_time_unit in_unit);
+
+    // Take a token from a bucket, or only check that there is one
+    bool take_alert_token(alert_bucket& bucket, uint64_t now_ms, bool consume);
+    void return_alert_token(alert_bucket& bucket);
+
+    uint64_t alert_now_ms() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - alert_epoch).count();
+    }
+
+    // Pass the rate limits of a lock-free alert; when consuming (raising the alert), counts
+    // it as suppressed when it doesn't
+    bool check_alert_limits(int in_ref, bool consume);
+
+    // Record a raised alert in its definition and the backlog, and send it on; runs on
+    // the alert strand so the packet threads never wait on the alert lock
+    void deliver_alert(int in_ref, std::shared_ptr<kis_packet> in_pack,
+            std::shared_ptr<kis_alert_info> info);
+
+    // Copy the suppressed counts into the definitions; must be called under the alert lock
+    void sync_suppressed();
+
 	// Parse a foo/bar rate/unit option
 	int parse_rate_unit(std::string in_ru, alert_time_unit *ret_unit, int *ret_rate);
 
     int pack_comp_alert, pack_comp_gps;
+
+    // Packet tag for every packet which raised an alert
+    int pack_tag_alert;
     int alert_ref_kismet;
 
     int next_alert_id;
 
+    // Enabled alerts by reference, see alert_enabled
+    std::atomic<uint64_t> alert_enabled_map[KIS_ALERT_FAST_REFS / 64];
+
+    // Rate limits by reference, set up before the enabled bit is set
+    std::chrono::steady_clock::time_point alert_epoch;
+    alert_limiter alert_limits[KIS_ALERT_FAST_REFS];
+
+    // Raised alerts are delivered in order on the alert strand
+    boost::asio::strand<boost::asio::io_context::executor_type> alert_strand;
+
     // Internal C++ mapping
     std::map<std::string, int> alert_name_map;
     std::map<int, shared_alert_def> alert_ref_map;
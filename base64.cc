@@ -18,81 +18,97 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <string.h>
 
 #include "base64.h"
 
 const std::string base64::b64_values{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
 
+namespace {
+    // Value of each base64 character, or -1
+    struct base64_decode_table {
+        signed char values[256];
+
+        base64_decode_table(const std::string& chars) {
+            memset(values, -1, sizeof(values));
+
+            for (size_t i = 0; i < chars.length(); i++)
+                values[(unsigned char) chars[i]] = i;
+        }
+    };
+}
+
 std::string base64::decode(const std::string& in_str) {
-    auto len = in_str.size();
-    int i = 0, j = 0, n = 0;
-    unsigned char c4[4], c3[3];
+    static const base64_decode_table table(b64_values);
 
     std::string ret;
+    ret.reserve((in_str.size() / 4) * 3 + 3);
 
-    ret.reserve(len * 0.75);
+    uint32_t group = 0;
+    int n = 0;
 
-    while (len-- && (in_str[n] != '=') && is_base64(in_str[n])) {
-        c4[i++] = in_str[n++];
+    // Decode up to the padding, or the first character which isn't base64
+    for (const auto& c : in_str) {
+        auto v = table.values[(unsigned char) c];
 
-        if (i ==4) {
-            for (i = 0; i < 4; i++)
-                c4[i] = b64_values.find(c4[i]);
+        if (v < 0)
+            break;
 
-            c3[0] = (c4[0] << 2) + ((c4[1] & 0x30) >> 4);
-            c3[1] = ((c4[1] & 0xf) << 4) + ((c4[2] & 0x3c) >> 2);
-            c3[2] = ((c4[2] & 0x3) << 6) + c4[3];
+        group = (group << 6) | v;
 
-            for (i = 0; (i < 3); i++)
-                ret += c3[i];
+        if (++n == 4) {
+            ret += (char) (group >> 16);
+            ret += (char) (group >> 8);
+            ret += (char) group;
 
-            i = 0;
+            group = 0;
+            n = 0;
         }
     }
 
-    if (i) {
-        for (j = i; j < 4; j++)
-            c4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            c4[j] = b64_values.find(c4[j]);
+    // A partial group of n characters holds n - 1 bytes
+    if (n > 1) {
+        group <<= 6 * (4 - n);
 
-        c3[0] = (c4[0] << 2) + ((c4[1] & 0x30) >> 4);
-        c3[1] = ((c4[1] & 0xf) << 4) + ((c4[2] & 0x3c) >> 2);
-        c3[2] = ((c4[2] & 0x3) << 6) + c4[3];
+        ret += (char) (group >> 16);
 
-        for (j = 0; (j < i - 1); j++) 
-            ret += c3[j];
+        if (n > 2)
+            ret += (char) (group >> 8);
     }
 
     return ret;
 }
 
 std::string base64::encode(const std::string& in_str) {
-	std::stringstream ss;
-	size_t pos;
-
-	for (pos = 0; pos < in_str.length(); pos += 3) {
-		ss << b64_values[in_str[pos] >> 2];
-
-		if (pos + 1 < in_str.length()) {
-			ss << b64_values[((in_str[pos] & 0x03) << 4) | ((in_str[pos + 1] & 0xf0) >> 4)];
-		} else {
-			ss << b64_values[((in_str[pos] & 0x03) << 4)];
-		}
-
-		if (pos + 2 < in_str.length()) {
-			ss << b64_values[((in_str[pos + 1] & 0x0f) << 2) | ((in_str[pos + 2] & 0xc0) >> 6)];
-			ss << b64_values[in_str[pos + 2] & 0x3f];
-		} else if (pos + 1 < in_str.length()) {
-			ss << b64_values[((in_str[pos + 1] & 0x0f) << 2)];
-			ss << '=';
-		} else {
-			ss << "==";
-		}
-	}
-
-	return ss.str();
+    auto in = (const unsigned char *) in_str.data();
+    auto len = in_str.length();
+
+    std::string ret;
+    ret.reserve(((len + 2) / 3) * 4);
+
+    size_t pos;
+
+    for (pos = 0; pos + 3 <= len; pos += 3) {
+        uint32_t group = (in[pos] << 16) | (in[pos + 1] << 8) | in[pos + 2];
+
+        ret += b64_values[(group >> 18) & 0x3f];
+        ret += b64_values[(group >> 12) & 0x3f];
+        ret += b64_values[(group >> 6) & 0x3f];
+        ret += b64_values[group & 0x3f];
+    }
+
+    if (pos + 1 == len) {
+        ret += b64_values[in[pos] >> 2];
+        ret += b64_values[(in[pos] & 0x03) << 4];
+        ret += "==";
+    } else if (pos + 2 == len) {
+        ret += b64_values[in[pos] >> 2];
+        ret += b64_values[((in[pos] & 0x03) << 4) | (in[pos + 1] >> 4)];
+        ret += b64_values[(in[pos + 1] & 0x0f) << 2];
+        ret += '=';
+    }
+
+    return ret;
 }
 
@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <time.h>
 
 #ifdef HAVE_CAPABILITY
 #include <sys/capability.h>
@@ -51,9 +52,13 @@
 #include <linux/sched.h>
 #include <sched.h>
 #include <sys/mount.h>
+#include <sys/eventfd.h>
 #endif
 
+#include <zlib.h>
+
 #include "capture_framework.h"
+#include "kis_external_compress.h"
 #include "kis_external_packet.h"
 #include "kis_endian.h"
 #include "remote_announcement.h"
@@ -63,6 +68,11 @@
 
 int unshare(int);
 
+static int cf_batch_flush(kis_capture_handler_t *caph);
+static long cf_batch_age(kis_capture_handler_t *caph);
+static void cf_out_ringbuf_wake(kis_capture_handler_t *caph);
+static uint8_t *cf_pack_newsource(kis_capture_handler_t *caph, const char *uuid, size_t *len);
+
 uint32_t adler32_append_csum(uint8_t *in_buf, size_t in_len, uint32_t cs) {
     size_t i;
     uint32_t ls1 = cs & 0xFFFF;
@@ -414,6 +424,10 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->out_fd = -1;
     ch->tcp_fd = -1;
 
+    ch->remote_session = NULL;
+    ch->remote_uuid = NULL;
+    ch->out_frame_remaining = 0;
+
     /* Disable retry by default */
     ch->remote_retry = 0;
 
@@ -429,6 +443,20 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->in_ringbuf = NULL;
     ch->out_ringbuf = NULL;
 
+    ch->batch_reports = 0;
+    ch->batch_buf = NULL;
+    ch->batch_len = 0;
+    ch->batch_count = 0;
+    ch->batch_seqno = 0;
+
+    ch->compress_reports = 0;
+    ch->compress_restart = 0;
+    ch->compress_zs = NULL;
+
+    ch->shm_fd = -1;
+    memset(&ch->shm_map, 0, sizeof(kis_external_shm_map_t));
+    ch->shm_reports = 0;
+
     ch->ipc_list = NULL;
 
     pthread_mutexattr_init(&mutexattr);
@@ -438,6 +466,30 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     pthread_cond_init(&(ch->out_ringbuf_flush_cond), NULL);
     pthread_mutex_init(&(ch->out_ringbuf_flush_cond_mutex), NULL);
 
+    ch->out_wake_armed = 0;
+
+#ifdef SYS_LINUX
+    ch->out_wake_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ch->out_wake_fd[1] = ch->out_wake_fd[0];
+
+    if (ch->out_wake_fd[0] < 0) {
+        fprintf(stderr, "FATAL: Could not allocate eventfd: %s\n", strerror(errno));
+        free(ch->capsource_type);
+        free(ch);
+        return NULL;
+    }
+#else
+    if (pipe(ch->out_wake_fd) < 0) {
+        fprintf(stderr, "FATAL: Could not allocate wakeup pipe: %s\n", strerror(errno));
+        free(ch->capsource_type);
+        free(ch);
+        return NULL;
+    }
+
+    fcntl(ch->out_wake_fd[0], F_SETFL, fcntl(ch->out_wake_fd[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(ch->out_wake_fd[1], F_SETFL, fcntl(ch->out_wake_fd[1], F_GETFL, 0) | O_NONBLOCK);
+#endif
+
     ch->shutdown = 0;
     ch->spindown = 0;
 
@@ -454,6 +506,10 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
 
     ch->spectrumconfig_cb = NULL;
 
+    ch->filter_cb = NULL;
+    ch->filter_snaplen = 0;
+    ch->filter_data_payload = -1;
+
     ch->capture_cb = NULL;
 
     ch->userdata = NULL;
@@ -514,12 +570,39 @@ void cf_handler_free(kis_capture_handler_t *caph) {
     if (caph->tcp_fd >= 0)
         close(caph->tcp_fd);
 
+    if (caph->remote_session != NULL)
+        free(caph->remote_session);
+
+    if (caph->remote_uuid != NULL)
+        free(caph->remote_uuid);
+
+    if (caph->out_wake_fd[0] >= 0)
+        close(caph->out_wake_fd[0]);
+
+    if (caph->out_wake_fd[1] >= 0 && caph->out_wake_fd[1] != caph->out_wake_fd[0])
+        close(caph->out_wake_fd[1]);
+
     if (caph->in_ringbuf != NULL)
         kis_simple_ringbuf_free(caph->in_ringbuf);
 
     if (caph->out_ringbuf != NULL)
         kis_simple_ringbuf_free(caph->out_ringbuf);
 
+    if (caph->batch_buf != NULL)
+        free(caph->batch_buf);
+
+    if (caph->compress_zs != NULL) {
+        deflateEnd(caph->compress_zs);
+        free(caph->compress_zs);
+    }
+
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    kis_external_shm_unmap(&caph->shm_map);
+#endif
+
+    if (caph->shm_fd >= 0)
+        close(caph->shm_fd);
+
     for (szi = 0; szi < caph->channel_hop_list_sz; szi++) {
         if (caph->channel_hop_list[szi] != NULL)
             free(caph->channel_hop_list[szi]);
@@ -816,6 +899,7 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
         { "apikey", required_argument, 0, 16},
         { "endpoint", required_argument, 0, 17},
         { "ssl-certificate", required_argument, 0, 18},
+        { "shm-fd", required_argument, 0, 19},
         { "help", no_argument, 0, 'h'},
         { 0, 0, 0, 0 }
     };
@@ -853,6 +937,12 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
                 goto cleanup;
             }
             caph->use_ipc = 1;
+        } else if (r == 19) {
+            if (sscanf(optarg, "%d", &(caph->shm_fd)) != 1) {
+                fprintf(stderr, "FATAL: Unable to parse shared memory file descriptor\n");
+                ret = -1;
+                goto cleanup;
+            }
         } else if (r == 3) {
             if (sscanf(optarg, "%512[^:]:%u", parse_hname, &parse_port) != 2) {
                 fprintf(stderr, "FATAL: Expected host:port for --connect\n");
@@ -1072,6 +1162,22 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
         goto cleanup;
     }
 
+    /* The shared memory ring is optional; without it everything goes over the pipe */
+    if (caph->shm_fd >= 0) {
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+        if (kis_external_shm_map(caph->shm_fd, &caph->shm_map) < 0 ||
+                caph->shm_map.header->signature != KIS_EXTERNAL_SHM_SIG ||
+                caph->shm_map.header->version != KIS_EXTERNAL_SHM_VERSION) {
+            kis_external_shm_unmap(&caph->shm_map);
+            close(caph->shm_fd);
+            caph->shm_fd = -1;
+        }
+#else
+        close(caph->shm_fd);
+        caph->shm_fd = -1;
+#endif
+    }
+
 cleanup:
     if (gps_arg != NULL)
         free(gps_arg);
@@ -1196,6 +1302,12 @@ void cf_handler_set_unknown_cb(kis_capture_handler_t *capf, cf_callback_unknown
     pthread_mutex_unlock(&(capf->handler_lock));
 }
 
+void cf_handler_set_filter_cb(kis_capture_handler_t *capf, cf_callback_filter cb) {
+    pthread_mutex_lock(&(capf->handler_lock));
+    capf->filter_cb = cb;
+    pthread_mutex_unlock(&(capf->handler_lock));
+}
+
 void cf_handler_set_chantranslate_cb(kis_capture_handler_t *capf, 
         cf_callback_chantranslate cb) {
     pthread_mutex_lock(&(capf->handler_lock));
@@ -1389,11 +1501,86 @@ int cf_handler_launch_capture_thread(kis_capture_handler_t *caph) {
 }
 
 void cf_handler_wait_ringbuffer(kis_capture_handler_t *caph) {
-    pthread_cond_wait(&(caph->out_ringbuf_flush_cond),
-            &(caph->out_ringbuf_flush_cond_mutex));
+    struct timespec ts;
+
+    /* The IO loop signals every time it drains some of the buffer without taking
+     * the lock, so a signal can land before we start waiting; the timeout keeps
+     * that from stalling the capture */
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    ts.tv_nsec += 100000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&(caph->out_ringbuf_flush_cond_mutex));
+    pthread_cond_timedwait(&(caph->out_ringbuf_flush_cond),
+            &(caph->out_ringbuf_flush_cond_mutex), &ts);
     pthread_mutex_unlock(&(caph->out_ringbuf_flush_cond_mutex));
 }
 
+/* Wake the IO loop if it's waiting with nothing to write; called by writers after
+ * they've queued data in the output buffer */
+static void cf_out_ringbuf_wake(kis_capture_handler_t *caph) {
+    uint64_t one = 1;
+    ssize_t r;
+
+    if (!(caph->use_tcp || caph->use_ipc))
+        return;
+
+    /* Pairs with the fence in the IO loop:  either it sees the data we've written,
+     * or we see that it's waiting */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&caph->out_wake_armed, __ATOMIC_RELAXED) == 0)
+        return;
+
+    if (__atomic_exchange_n(&caph->out_wake_armed, 0, __ATOMIC_RELAXED) == 0)
+        return;
+
+    /* A full eventfd or pipe is already a pending wakeup */
+    r = write(caph->out_wake_fd[1], &one, sizeof(one));
+    (void) r;
+}
+
+/* Monotonic time in nanoseconds */
+static uint64_t cf_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* Sleep until an absolute monotonic deadline, so time spent tuning and waking up
+ * doesn't accumulate into the hop interval */
+static void cf_sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec ts;
+
+#ifdef SYS_LINUX
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+#else
+    uint64_t now_ns = cf_monotonic_ns();
+
+    if (now_ns >= deadline_ns)
+        return;
+
+    ts.tv_sec = (deadline_ns - now_ns) / 1000000000ULL;
+    ts.tv_nsec = (deadline_ns - now_ns) % 1000000000ULL;
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+#endif
+}
+
+/* How often the hopping thread reports the measured hopping to the server */
+#define CF_HOP_REPORT_NS    10000000000ULL
+
 /* Internal capture thread which drives channel hopping
  */
 void *cf_int_chanhop_thread(void *arg) {
@@ -1405,9 +1592,17 @@ void *cf_int_chanhop_thread(void *arg) {
 
     size_t hoppos;
     
-    /* How long we're waiting until the next time */
-    unsigned int wait_sec = 0;
-    unsigned int wait_usec = 0;
+    /* Hops are scheduled against absolute deadlines one interval apart */
+    uint64_t interval_ns = 0;
+    uint64_t deadline_ns;
+
+    /* Measured hopping for the current report; dwell is the time from one completed
+     * channel change to the next, tune the time spent in the channel control callback */
+    uint64_t now_ns, tune_start_ns, tuned_ns, last_tuned_ns = 0;
+    uint64_t report_start_ns;
+    unsigned int report_hops = 0;
+    uint64_t report_dwell_ns = 0, report_max_dwell_ns = 0;
+    uint64_t report_tune_ns = 0, report_max_tune_ns = 0;
 
     char errstr[STATUS_MAX];
     
@@ -1420,6 +1615,7 @@ void *cf_int_chanhop_thread(void *arg) {
     caph->hopping_running = 1;
     pthread_mutex_unlock(&(caph->handler_lock));
 
+    deadline_ns = report_start_ns = cf_monotonic_ns();
 
     while (1) {
         pthread_mutex_lock(&(caph->handler_lock));
@@ -1431,21 +1627,24 @@ void *cf_int_chanhop_thread(void *arg) {
             return NULL;
         }
        
-        wait_usec = 1000000L / caph->channel_hop_rate;
-
-        if (wait_usec < 50000) {
-            wait_sec = 0;
-            wait_usec = 50000;
-        } else if (wait_usec > 1000000L) {
-            wait_sec = wait_usec / 1000000L;
-            wait_usec = wait_usec % 1000000L;
-        }
+        interval_ns = (uint64_t) (1000000000.0 / caph->channel_hop_rate);
+
+        if (interval_ns < 50000000ULL)
+            interval_ns = 50000000ULL;
 
         pthread_mutex_unlock(&(caph->handler_lock));
 
-        /* Sleep until the next wakeup */
-        sleep(wait_sec);
-        usleep(wait_usec);
+        /* Sleep until the next hop; if a slow channel change or a stall has put us
+         * more than a whole hop behind, start over from now instead of firing the
+         * missed hops back to back */
+        deadline_ns += interval_ns;
+
+        now_ns = cf_monotonic_ns();
+
+        if (now_ns > deadline_ns + interval_ns)
+            deadline_ns = now_ns;
+
+        cf_sleep_until_ns(deadline_ns);
 
         pthread_mutex_lock(&caph->handler_lock);
 
@@ -1456,10 +1655,46 @@ void *cf_int_chanhop_thread(void *arg) {
             return NULL;
         }
 
+        tune_start_ns = cf_monotonic_ns();
+
         errstr[0] = 0;
-        if ((r = (caph->chancontrol_cb)(caph, 0, 
-                    caph->custom_channel_hop_list[hoppos % caph->channel_hop_list_sz], 
-                    errstr)) < 0) {
+        r = (caph->chancontrol_cb)(caph, 0, 
+                caph->custom_channel_hop_list[hoppos % caph->channel_hop_list_sz], 
+                errstr);
+
+        tuned_ns = cf_monotonic_ns();
+
+        if (r > 0) {
+            if (last_tuned_ns != 0) {
+                report_hops++;
+                report_dwell_ns += tuned_ns - last_tuned_ns;
+                if (tuned_ns - last_tuned_ns > report_max_dwell_ns)
+                    report_max_dwell_ns = tuned_ns - last_tuned_ns;
+                report_tune_ns += tuned_ns - tune_start_ns;
+                if (tuned_ns - tune_start_ns > report_max_tune_ns)
+                    report_max_tune_ns = tuned_ns - tune_start_ns;
+            }
+
+            last_tuned_ns = tuned_ns;
+        }
+
+        if (tuned_ns - report_start_ns >= CF_HOP_REPORT_NS) {
+            if (report_hops != 0)
+                cf_send_hopreport(caph, report_hops,
+                        (double) (tuned_ns - report_start_ns) / 1e9,
+                        (double) interval_ns / 1e9,
+                        (double) report_dwell_ns / report_hops / 1e9,
+                        (double) report_max_dwell_ns / 1e9,
+                        (double) report_tune_ns / report_hops / 1e9,
+                        (double) report_max_tune_ns / 1e9);
+
+            report_start_ns = tuned_ns;
+            report_hops = 0;
+            report_dwell_ns = report_max_dwell_ns = 0;
+            report_tune_ns = report_max_tune_ns = 0;
+        }
+
+        if (r < 0) {
             fprintf(stderr, "FATAL:  Datasource channel control callback failed.\n");
             cf_send_error(caph, 0, errstr);
             caph->hopping_running = 0;
@@ -1743,6 +1978,14 @@ int cf_dispatch_rx_content(kis_capture_handler_t *caph, const char *command,
 
             goto finish;
         }
+    } else if (strncasecmp(command, "KDSOPENSOURCE", 32) == 0 && 
+            caph->remote_session != NULL && caph->capture_running) {
+        /* Kismet only opens a remote source which is already capturing when it could
+         * not resume it after we reconnected; start over with a fresh capture process */
+        fprintf(stderr, "INFO: Kismet could not resume the capture, restarting it\n");
+        cf_handler_shutdown(caph);
+        cbret = 1;
+        goto finish;
     } else if (strncasecmp(command, "KDSOPENSOURCE", 32) == 0) {
         if (caph->open_cb == NULL) {
             if (caph->verbose)
@@ -1772,6 +2015,17 @@ int cf_dispatch_rx_content(kis_capture_handler_t *caph, const char *command,
                 goto finish;
             }
             
+            /* Newer Kismet servers take multiple data reports per frame, and
+             * compressed frames */
+            pthread_mutex_lock(&(caph->out_ringbuf_lock));
+            caph->batch_reports = open_cmd->has_batch_reports && open_cmd->batch_reports;
+            caph->compress_reports = caph->batch_reports && open_cmd->has_compression &&
+                open_cmd->compression == KIS_EXTERNAL_COMPRESS_VERSION;
+            caph->compress_restart = 1;
+            caph->shm_reports = caph->batch_reports && caph->shm_map.header != NULL &&
+                open_cmd->has_shm_ring && open_cmd->shm_ring == KIS_EXTERNAL_SHM_VERSION;
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
             msgstr[0] = 0;
             cbret = (*(caph->open_cb))(caph,
                     seqno, open_cmd->definition,
@@ -1969,6 +2223,95 @@ int cf_dispatch_rx_content(kis_capture_handler_t *caph, const char *command,
 
             kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
 
+            goto finish;
+        } else if (conf_cmd->filter != NULL) {
+            cf_bpf_insn_t *insns = NULL;
+            size_t insns_len = 0;
+            uint8_t *bpf;
+
+            if (conf_cmd->filter->has_bpf)
+                insns_len = conf_cmd->filter->bpf.len / 8;
+
+            if (insns_len * 8 != (conf_cmd->filter->has_bpf ? conf_cmd->filter->bpf.len : 0)) {
+                cf_send_configresp(caph, seqno, 0, "Invalid capture filter program", NULL);
+                cbret = 0;
+
+                kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
+                goto finish;
+            }
+
+            if (insns_len > 0 && caph->filter_cb == NULL) {
+                if (caph->verbose)
+                    fprintf(stderr, "ERROR:  Source does not support capture filters\n");
+
+                cf_send_configresp(caph, seqno, 0, "Source does not support capture filters", NULL);
+                cbret = 0;
+
+                kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
+                goto finish;
+            }
+
+            msgstr[0] = 0;
+            cbret = 1;
+
+            if (caph->filter_cb != NULL) {
+                if (insns_len > 0) {
+                    insns = (cf_bpf_insn_t *) malloc(sizeof(cf_bpf_insn_t) * insns_len);
+
+                    if (insns == NULL) {
+                        fprintf(stderr, "FATAL:  Unable to allocate capture filter\n");
+                        cbret = -1;
+
+                        kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
+                        goto finish;
+                    }
+
+                    bpf = conf_cmd->filter->bpf.data;
+
+                    for (szi = 0; szi < insns_len; szi++) {
+                        insns[szi].code = (bpf[0] << 8) | bpf[1];
+                        insns[szi].jt = bpf[2];
+                        insns[szi].jf = bpf[3];
+                        insns[szi].k = ((uint32_t) bpf[4] << 24) | (bpf[5] << 16) | 
+                            (bpf[6] << 8) | bpf[7];
+                        bpf += 8;
+                    }
+                }
+
+                cbret = (*(caph->filter_cb))(caph, seqno, insns, insns_len, msgstr);
+
+                if (insns != NULL)
+                    free(insns);
+
+                if (caph->verbose && strlen(msgstr) > 0) {
+                    if (cbret >= 0)
+                        fprintf(stderr, "INFO: %s\n", msgstr);
+                    else
+                        fprintf(stderr, "ERROR: %s\n", msgstr);
+                }
+            }
+
+            /* Truncation is applied as packets are sent, so it works on any source */
+            if (cbret >= 0) {
+                __atomic_store_n(&caph->filter_snaplen, 
+                        conf_cmd->filter->has_snaplen ? conf_cmd->filter->snaplen : 0,
+                        __ATOMIC_RELAXED);
+                __atomic_store_n(&caph->filter_data_payload, 
+                        conf_cmd->filter->has_data_payload ? 
+                        (int) conf_cmd->filter->data_payload : -1,
+                        __ATOMIC_RELAXED);
+            }
+
+            cf_send_configresp(caph, seqno, cbret >= 0, msgstr, NULL);
+
+            /* A filter the source couldn't install doesn't stop the capture */
+            cbret = 0;
+
+            kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
             goto finish;
         }
     } else {
@@ -2141,10 +2484,86 @@ int cf_handle_rb_rx_data(kis_capture_handler_t *caph) {
     return cbret;
 }
 
-int cf_handler_tcp_remote_connect(kis_capture_handler_t *caph) {
+/* Open a TCP connection to the remote Kismet server, returning the connected socket
+ * or -1 with the reason in errstr */
+static int cf_tcp_connect_socket(kis_capture_handler_t *caph, char *errstr) {
     struct hostent *connect_host;
     struct sockaddr_in client_sock, local_sock;
     int client_fd;
+
+    if ((connect_host = gethostbyname(caph->remote_host)) == NULL) {
+        snprintf(errstr, STATUS_MAX, "Could not resolve hostname for remote connection to '%s'",
+                caph->remote_host);
+        return -1;
+    }
+
+    memset(&client_sock, 0, sizeof(client_sock));
+    client_sock.sin_family = connect_host->h_addrtype;
+    memcpy((char *) &(client_sock.sin_addr.s_addr), connect_host->h_addr_list[0],
+            connect_host->h_length);
+    client_sock.sin_port = htons(caph->remote_port);
+
+    if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        snprintf(errstr, STATUS_MAX, "Could not connect to remote host '%s:%u': %s",
+                caph->remote_host, caph->remote_port, strerror(errno));
+        return -1;
+    }
+
+    memset(&local_sock, 0, sizeof(local_sock));
+    local_sock.sin_family = AF_INET;
+    local_sock.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_sock.sin_port = htons(0);
+
+    if (bind(client_fd, (struct sockaddr *) &local_sock, sizeof(local_sock)) < 0) {
+        snprintf(errstr, STATUS_MAX, "Could not connect to remote host '%s:%u': %s",
+                caph->remote_host, caph->remote_port, strerror(errno));
+        close(client_fd);
+        return -1;
+    }
+
+    if (connect(client_fd, (struct sockaddr *) &client_sock, sizeof(client_sock)) < 0) {
+        if (errno != EINPROGRESS) {
+            snprintf(errstr, STATUS_MAX, "Could not connect to remote host '%s:%u': %s",
+                    caph->remote_host, caph->remote_port, strerror(errno));
+            close(client_fd);
+            return -1;
+        }
+    }
+
+    return client_fd;
+}
+
+/* Pick a random session token for resuming the source on a new connection */
+static char *cf_new_session_token(void) {
+    uint8_t rnd[16];
+    char *token;
+    ssize_t r = 0;
+    int fd;
+    size_t i;
+
+    if ((fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+        r = read(fd, rnd, sizeof(rnd));
+        close(fd);
+    }
+
+    if (r != (ssize_t) sizeof(rnd)) {
+        srand(time(NULL) ^ getpid());
+
+        for (i = 0; i < sizeof(rnd); i++)
+            rnd[i] = rand() & 0xFF;
+    }
+
+    if ((token = (char *) malloc(sizeof(rnd) * 2 + 1)) == NULL)
+        return NULL;
+
+    for (i = 0; i < sizeof(rnd); i++)
+        snprintf(token + (i * 2), 3, "%02x", rnd[i]);
+
+    return token;
+}
+
+int cf_handler_tcp_remote_connect(kis_capture_handler_t *caph) {
+    int client_fd;
     int sock_flags;
 
     char msgstr[STATUS_MAX];
@@ -2220,9 +2639,8 @@ int cf_handler_tcp_remote_connect(kis_capture_handler_t *caph) {
         return -1;
     }
 
-    if ((connect_host = gethostbyname(caph->remote_host)) == NULL) {
-        fprintf(stderr, "FATAL - Could not resolve hostname for remote connection to '%s'\n",
-                caph->remote_host);
+    if ((client_fd = cf_tcp_connect_socket(caph, msgstr)) < 0) {
+        fprintf(stderr, "FATAL - %s\n", msgstr);
 
         if (uuid)
             free(uuid);
@@ -2230,70 +2648,166 @@ int cf_handler_tcp_remote_connect(kis_capture_handler_t *caph) {
         return -1;
     }
 
-    memset(&client_sock, 0, sizeof(client_sock));
-    client_sock.sin_family = connect_host->h_addrtype;
-    memcpy((char *) &(client_sock.sin_addr.s_addr), connect_host->h_addr_list[0],
-            connect_host->h_length);
-    client_sock.sin_port = htons(caph->remote_port);
+    sock_flags = fcntl(client_fd, F_GETFL, 0);
+    fcntl(client_fd, F_SETFL, sock_flags | O_NONBLOCK | FD_CLOEXEC);
 
-    if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        fprintf(stderr, "FATAL - Could not connect to remote host '%s:%u': %s\n",
-                caph->remote_host, caph->remote_port, strerror(errno));
+    caph->tcp_fd = client_fd;
 
-        if (uuid)
-            free(uuid);
+    fprintf(stderr, "INFO: Connected to '%s:%u'...\n", caph->remote_host, caph->remote_port);
 
-        return -1;
-    }
+    /* Keep how we announced ourselves, to resume the source if the connection drops */
+    if (caph->remote_uuid != NULL)
+        free(caph->remote_uuid);
+    caph->remote_uuid = uuid;
 
-    memset(&local_sock, 0, sizeof(local_sock));
-    local_sock.sin_family = AF_INET;
-    local_sock.sin_addr.s_addr = htonl(INADDR_ANY);
-    local_sock.sin_port = htons(0);
+    if (caph->remote_session == NULL)
+        caph->remote_session = cf_new_session_token();
 
-    if (bind(client_fd, (struct sockaddr *) &local_sock, sizeof(local_sock)) < 0) {
-        fprintf(stderr, "FATAL - Could not connect to remote host '%s:%u': %s\n",
-                caph->remote_host, caph->remote_port, strerror(errno));
-        close(client_fd);
+    /* Send the NEWSOURCE command to the Kismet server */
+    cf_send_newsource(caph, uuid);
 
-        if (uuid)
-            free(uuid);
+    return 1;
+}
+
+/* Send a NEWSOURCE resuming our session directly on a new connection, ahead of
+ * anything waiting in the output buffer */
+static int cf_send_tcp_resume_newsource(kis_capture_handler_t *caph, int fd) {
+    kismet_external_frame_v2_t *frame;
+    uint8_t *data, *frame_buf;
+    size_t data_len, frame_len, sent = 0;
+    ssize_t r;
+    uint32_t seqno;
+
+    if ((data = cf_pack_newsource(caph, caph->remote_uuid, &data_len)) == NULL)
+        return -1;
 
+    frame_len = sizeof(kismet_external_frame_v2_t) + data_len;
+
+    if ((frame_buf = (uint8_t *) malloc(frame_len)) == NULL) {
+        free(data);
         return -1;
     }
 
-    if (connect(client_fd, (struct sockaddr *) &client_sock, sizeof(client_sock)) < 0) {
-        if (errno != EINPROGRESS) {
-            fprintf(stderr, "FATAL - Could not connect to remote host '%s:%u': %s\n",
-                    caph->remote_host, caph->remote_port, strerror(errno));
+    pthread_mutex_lock(&(caph->handler_lock));
+    if (++caph->seqno == 0)
+        caph->seqno = 1;
+    seqno = caph->seqno;
+    pthread_mutex_unlock(&(caph->handler_lock));
 
-            close(client_fd);
+    frame = (kismet_external_frame_v2_t *) frame_buf;
 
-            if (uuid)
-                free(uuid);
+    frame->signature = htonl(KIS_EXTERNAL_PROTO_SIG);
+    frame->data_sz = htonl(data_len);
+    frame->v2_sentinel = htons(KIS_EXTERNAL_V2_SIG);
+    frame->frame_version = htons(2);
+    frame->seqno = htonl(seqno);
+    memset(frame->command, 0, sizeof(frame->command));
+    strncpy(frame->command, "KDSNEWSOURCE", 32);
+    memcpy(frame->data, data, data_len);
 
-            return -1;
-        }
-    }
+    free(data);
 
-    sock_flags = fcntl(client_fd, F_GETFL, 0);
-    fcntl(client_fd, F_SETFL, sock_flags | O_NONBLOCK | FD_CLOEXEC);
+    /* The socket is still blocking */
+    while (sent < frame_len) {
+        r = send(fd, frame_buf + sent, frame_len - sent, 0);
 
-    caph->tcp_fd = client_fd;
+        if (r < 0 && errno == EINTR)
+            continue;
 
-    fprintf(stderr, "INFO: Connected to '%s:%u'...\n", caph->remote_host, caph->remote_port);
+        if (r <= 0) {
+            free(frame_buf);
+            return -1;
+        }
 
-    /* Send the NEWSOURCE command to the Kismet server */
-    cf_send_newsource(caph, uuid);
+        sent += r;
+    }
 
-    if (uuid)
-        free(uuid);
+    free(frame_buf);
 
     return 1;
 }
 
-#ifdef HAVE_LIBWEBSOCKETS
-void ws_connect_attempt(kis_capture_handler_t *caph) {
+int cf_handler_tcp_resume(kis_capture_handler_t *caph) {
+    char msgstr[STATUS_MAX];
+    time_t start;
+    int fd, running;
+    int sock_flags;
+
+    if (caph->remote_host == NULL || !caph->use_tcp || !caph->remote_retry ||
+            caph->remote_session == NULL)
+        return 0;
+
+    pthread_mutex_lock(&(caph->handler_lock));
+    running = caph->capture_running && !caph->shutdown && !caph->spindown;
+    pthread_mutex_unlock(&(caph->handler_lock));
+
+    /* Only a running capture has anything worth resuming */
+    if (!running)
+        return 0;
+
+    if (caph->tcp_fd >= 0) {
+        close(caph->tcp_fd);
+        caph->tcp_fd = -1;
+    }
+
+    /* The rest of a frame cut off by the lost connection can't be completed on a new
+     * one, and neither can a partial command from Kismet; we're the only reader of both
+     * buffers */
+    if (caph->out_frame_remaining != 0) {
+        kis_simple_ringbuf_read(caph->out_ringbuf, NULL, caph->out_frame_remaining);
+        caph->out_frame_remaining = 0;
+        pthread_cond_broadcast(&(caph->out_ringbuf_flush_cond));
+    }
+
+    kis_simple_ringbuf_clear(caph->in_ringbuf);
+
+    msgstr[0] = 0;
+
+    fprintf(stderr, "INFO: Lost connection to '%s:%u', trying to resume the capture for "
+            "%d seconds\n", caph->remote_host, caph->remote_port, CAP_FRAMEWORK_RESUME_WINDOW);
+
+    start = time(0);
+
+    while (time(0) - start < CAP_FRAMEWORK_RESUME_WINDOW) {
+        if (caph->shutdown)
+            return -1;
+
+        if ((fd = cf_tcp_connect_socket(caph, msgstr)) < 0) {
+            sleep(1);
+            continue;
+        }
+
+        if (cf_send_tcp_resume_newsource(caph, fd) < 0) {
+            snprintf(msgstr, STATUS_MAX, "Could not send to remote host '%s:%u': %s",
+                    caph->remote_host, caph->remote_port, strerror(errno));
+            close(fd);
+            sleep(1);
+            continue;
+        }
+
+        sock_flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, sock_flags | O_NONBLOCK | FD_CLOEXEC);
+
+        caph->tcp_fd = fd;
+
+        pthread_mutex_lock(&(caph->handler_lock));
+        caph->last_ping = time(0);
+        pthread_mutex_unlock(&(caph->handler_lock));
+
+        fprintf(stderr, "INFO: Reconnected to '%s:%u', resuming capture...\n",
+                caph->remote_host, caph->remote_port);
+
+        return 1;
+    }
+
+    fprintf(stderr, "FATAL: Could not resume the capture on '%s:%u' within %d seconds: %s\n",
+            caph->remote_host, caph->remote_port, CAP_FRAMEWORK_RESUME_WINDOW, msgstr);
+
+    return -1;
+}
+
+#ifdef HAVE_LIBWEBSOCKETS
+void ws_connect_attempt(kis_capture_handler_t *caph) {
     char msgstr[STATUS_MAX];
     int cbret;
     cf_params_interface_t *cpi;
@@ -2418,6 +2932,19 @@ int ws_remotecap_broker(struct lws *wsi, enum lws_callback_reasons reason,
 
             lws_ring_consume_single_tail(caph->lwsring, &caph->lwstail, 1);
 
+            /* Queue any batched data reports once everything ahead of them has been
+             * written, or once they've waited long enough */
+            if (caph->batch_count != 0 &&
+                    (lws_ring_get_element(caph->lwsring, &caph->lwstail) == NULL ||
+                     cf_batch_age(caph) >= CAP_FRAMEWORK_BATCH_DELAY_US)) {
+                if (cf_batch_flush(caph) < 0) {
+                    caph->shutdown = 1;
+                    lws_cancel_service(caph->lwscontext);
+                    pthread_mutex_unlock(&caph->out_ringbuf_lock);
+                    return -1;
+                }
+            }
+
             if (lws_ring_get_element(caph->lwsring, &caph->lwstail)) {
                 lws_callback_on_writable(wsi);
             } else if (caph->spindown) {
@@ -2467,12 +2994,47 @@ static void ws_destroy_msg(void *in_msg) {
 }
 #endif
 
+/* Consume what was written to a remote Kismet server from the output buffer, keeping
+ * track of how much of the frame at the head is still unsent; every frame is complete
+ * in the buffer before we see any of it, so its header is always there to peek */
+static void cf_out_ringbuf_consume(kis_capture_handler_t *caph, size_t len) {
+    kismet_external_frame_v2_t frame;
+    size_t chunk;
+
+    while (len > 0) {
+        if (caph->out_frame_remaining == 0) {
+            if (kis_simple_ringbuf_peek(caph->out_ringbuf, &frame, 
+                        sizeof(kismet_external_frame_t)) != sizeof(kismet_external_frame_t))
+                break;
+
+            if (ntohs(frame.v2_sentinel) == KIS_EXTERNAL_V2_SIG)
+                caph->out_frame_remaining = 
+                    sizeof(kismet_external_frame_v2_t) + ntohl(frame.data_sz);
+            else
+                caph->out_frame_remaining = 
+                    sizeof(kismet_external_frame_t) + ntohl(frame.data_sz);
+        }
+
+        chunk = len < caph->out_frame_remaining ? len : caph->out_frame_remaining;
+
+        kis_simple_ringbuf_read(caph->out_ringbuf, NULL, chunk);
+
+        caph->out_frame_remaining -= chunk;
+        len -= chunk;
+    }
+
+    /* Whatever's left over isn't framed; consume it anyway */
+    if (len > 0)
+        kis_simple_ringbuf_read(caph->out_ringbuf, NULL, len);
+}
+
 int cf_handler_loop(kis_capture_handler_t *caph) {
     fd_set rset, wset;
     int max_fd;
     int read_fd, write_fd;
     struct timeval tm;
     int spindown;
+    int resumed;
     int ret;
     int rv = 0;
     cf_ipc_t *ipc_iter = NULL;
@@ -2527,9 +3089,17 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             }
 
             if (caph->last_ping != 0 && time(NULL) - caph->last_ping > 15) {
+                pthread_mutex_unlock(&(caph->handler_lock));
+
+                /* A connection which silently went away can still be resumed */
+                if (caph->tcp_fd >= 0 && cf_handler_tcp_resume(caph) > 0) {
+                    read_fd = caph->tcp_fd;
+                    write_fd = caph->tcp_fd;
+                    continue;
+                }
+
                 fprintf(stderr, "FATAL: Capture source %u did not get PING from Kismet for "
                         "over 15 seconds; shutting down\n", getpid());
-                pthread_mutex_unlock(&(caph->handler_lock));
                 rv = -1;
                 break;
             }
@@ -2567,24 +3137,50 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             if (spindown == 0) {
                 /* Only set rset if we're not spinning down */
                 FD_SET(read_fd, &rset);
-                max_fd = read_fd;
+                if (max_fd < read_fd)
+                    max_fd = read_fd;
             }
 
-            /* Inspect the write buffer - do we have data? */
+            FD_SET(caph->out_wake_fd[0], &rset);
+            if (max_fd < caph->out_wake_fd[0])
+                max_fd = caph->out_wake_fd[0];
+
+            /* Send any batched data reports once the buffer has drained, or once
+             * they've waited long enough; the batch belongs to the writers, so this
+             * is the only part of the output we need the lock for */
             pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
+            if (caph->batch_count != 0 &&
+                    (kis_simple_ringbuf_used(caph->out_ringbuf) == 0 ||
+                     cf_batch_age(caph) >= CAP_FRAMEWORK_BATCH_DELAY_US)) {
+                if (cf_batch_flush(caph) < 0) {
+                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                    rv = -1;
+                    break;
+                }
+            }
+
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+            /* Inspect the write buffer - do we have data?  If not, ask the writers
+             * to wake us, and look again in case something was written before they
+             * could see that */
+            if (kis_simple_ringbuf_used(caph->out_ringbuf) == 0) {
+                __atomic_store_n(&caph->out_wake_armed, 1, __ATOMIC_RELAXED);
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            }
+
             if (kis_simple_ringbuf_used(caph->out_ringbuf) != 0) {
+                __atomic_store_n(&caph->out_wake_armed, 0, __ATOMIC_RELAXED);
+
                 FD_SET(write_fd, &wset);
                 if (max_fd < write_fd)
                     max_fd = write_fd;
             } else if (spindown != 0) {
-                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
                 rv = 0;
                 break;
             }
 
-            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-
             tm.tv_sec = 0;
             tm.tv_usec = 500000;
 
@@ -2599,6 +3195,12 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             if (ret == 0)
                 continue;
 
+            if (FD_ISSET(caph->out_wake_fd[0], &rset)) {
+                uint64_t wake_cnt;
+
+                while (read(caph->out_wake_fd[0], &wake_cnt, sizeof(wake_cnt)) > 0)
+                    ;
+            }
 
             pthread_mutex_lock(&caph->handler_lock);
 
@@ -2681,6 +3283,8 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             pthread_mutex_unlock(&caph->handler_lock);
 
             if (FD_ISSET(read_fd, &rset)) {
+                resumed = 0;
+
                 while (kis_simple_ringbuf_available(caph->in_ringbuf)) {
                     /* We use a fixed-length read buffer for simplicity, and we shouldn't
                      * ever have too many incoming packets queued because the datasource
@@ -2707,6 +3311,14 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
 
                     if (amt_read <= 0) {
                         if (errno != EINTR && errno != EAGAIN) {
+                            /* Try to pick up where we left off on a new connection */
+                            if (caph->tcp_fd >= 0 && cf_handler_tcp_resume(caph) > 0) {
+                                read_fd = caph->tcp_fd;
+                                write_fd = caph->tcp_fd;
+                                resumed = 1;
+                                break;
+                            }
+
                             /* Bail entirely */
                             if (amt_read == 0) {
                                 fprintf(stderr, "FATAL: Remote side closed read pipe\n");
@@ -2738,24 +3350,25 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
                         cf_handler_spindown(caph);
                     }
                 }
+
+                if (resumed)
+                    continue;
             }
 
             if (FD_ISSET(write_fd, &wset)) {
-                /* We can write data - lock the ring buffer mutex and write out
-                 * whatever we can; we peek the ringbuffer and then flag off what
-                 * we've successfully written out */
+                /* We can write data - we're the only reader of the ring buffer, so
+                 * write out whatever is contiguous without holding up the writers;
+                 * we peek the ringbuffer and then flag off what we've successfully 
+                 * written out, and anything wrapped around the end of the buffer 
+                 * goes on the next pass */
                 ssize_t written_sz;
                 size_t peeked_sz;
                 uint8_t *peek_buf = NULL;
 
-                pthread_mutex_lock(&(caph->out_ringbuf_lock));
-
-                peeked_sz = kis_simple_ringbuf_peek_zc(caph->out_ringbuf, (void **) &peek_buf, 0);
+                peeked_sz = kis_simple_ringbuf_peek_contig(caph->out_ringbuf, (void **) &peek_buf);
 
                 /* Don't know how we'd get here... */
                 if (peeked_sz == 0) {
-                    kis_simple_ringbuf_peek_free(caph->out_ringbuf, peek_buf);
-                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
                     continue;
                 }
 
@@ -2769,22 +3382,26 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
 
                 if (written_sz < 0) {
                     if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
-                        kis_simple_ringbuf_peek_free(caph->out_ringbuf, peek_buf);
-                        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                        if (caph->tcp_fd >= 0 && cf_handler_tcp_resume(caph) > 0) {
+                            read_fd = caph->tcp_fd;
+                            write_fd = caph->tcp_fd;
+                            continue;
+                        }
+
                         fprintf(stderr, "FATAL:  Error during write(): %s\n", strerror(errno));
                         rv = -1;
                         break;
                     }
-                }
-
-                /* Flag it as consumed */
-                kis_simple_ringbuf_read(caph->out_ringbuf, NULL, (size_t) written_sz);
 
-                /* Get rid of the peek */
-                kis_simple_ringbuf_peek_free(caph->out_ringbuf, peek_buf);
+                    continue;
+                }
 
-                /* Unlock */
-                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                /* Flag it as consumed; on tcp, keep track of where the frames end in
+                 * case we need to resume on a new connection */
+                if (caph->tcp_fd >= 0)
+                    cf_out_ringbuf_consume(caph, (size_t) written_sz);
+                else
+                    kis_simple_ringbuf_read(caph->out_ringbuf, NULL, (size_t) written_sz);
 
                 /* Signal to any waiting IO that the buffer has some
                  * headroom */
@@ -2848,6 +3465,8 @@ int cf_send_rb_raw_bytes(kis_capture_handler_t *caph, uint8_t *data, size_t len)
 
     pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
+    cf_out_ringbuf_wake(caph);
+
     return 1;
 }
 
@@ -2917,10 +3536,19 @@ int cf_send_rb_packet(kis_capture_handler_t *caph, const char *command, uint32_t
     /* Buffer holding all of it */
     uint8_t *send_buffer;
 
+    int r;
+
     /* Directly inject into the ringbuffer with a zero-copy */
 
     pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
+    /* Keep any batched data reports ahead of this packet */
+    if ((r = cf_batch_flush(caph)) <= 0) {
+        free(data);
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        return r;
+    }
+
     rs_sz = kis_simple_ringbuf_reserve(caph->out_ringbuf, (void **) &send_buffer, 
             len + sizeof(kismet_external_frame_v2_t));
 
@@ -2928,6 +3556,8 @@ int cf_send_rb_packet(kis_capture_handler_t *caph, const char *command, uint32_t
         // fprintf(stderr, "DEBUG - insufficient size in outgoing buffer for %lu\n", len);
         free(data);
         pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        /* The batch may have gone out ahead of us */
+        cf_out_ringbuf_wake(caph);
         return 0;
     }
 
@@ -2951,6 +3581,8 @@ int cf_send_rb_packet(kis_capture_handler_t *caph, const char *command, uint32_t
 
     pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
+    cf_out_ringbuf_wake(caph);
+
     free(data);
 
     return rs_sz;
@@ -2968,6 +3600,13 @@ int cf_send_ws_packet(kis_capture_handler_t *caph, const char *command, uint32_t
 
     pthread_mutex_lock(&caph->out_ringbuf_lock);
 
+    /* Keep any batched data reports ahead of this packet */
+    if ((n = cf_batch_flush(caph)) <= 0) {
+        free(data);
+        pthread_mutex_unlock(&caph->out_ringbuf_lock);
+        return n;
+    }
+
     n = lws_ring_get_count_free_elements(caph->lwsring);
     if (n == 0) {
         free(data);
@@ -3094,6 +3733,36 @@ int cf_send_warning(kis_capture_handler_t *caph, const char *warning) {
     return cf_send_packet(caph, "KDSWARNINGREPORT", buf, len);
 }
 
+int cf_send_hopreport(kis_capture_handler_t *caph, unsigned int hops, double interval,
+        double target_dwell, double mean_dwell, double max_dwell,
+        double mean_tune, double max_tune) {
+    KismetDatasource__HopReport kehop;
+    uint8_t *buf;
+    size_t len;
+
+    kismet_datasource__hop_report__init(&kehop);
+
+    kehop.hops = hops;
+    kehop.interval = interval;
+    kehop.target_dwell = target_dwell;
+    kehop.mean_dwell = mean_dwell;
+    kehop.max_dwell = max_dwell;
+    kehop.has_mean_tune = 1;
+    kehop.mean_tune = mean_tune;
+    kehop.has_max_tune = 1;
+    kehop.max_tune = max_tune;
+
+    len = kismet_datasource__hop_report__get_packed_size(&kehop);
+    buf = (uint8_t *) malloc(len);
+
+    if (buf == NULL)
+        return -1;
+
+    kismet_datasource__hop_report__pack(&kehop, buf);
+
+    return cf_send_packet(caph, "KDSHOPREPORT", buf, len);
+}
+
 int cf_send_error(kis_capture_handler_t *caph, uint32_t in_seqno, const char *msg) {
     KismetDatasource__ErrorReport keerror;
     KismetDatasource__SubSuccess kesuccess;
@@ -3471,6 +4140,475 @@ int cf_send_openresp(kis_capture_handler_t *caph, uint32_t seq, unsigned int suc
     return cf_send_packet(caph, "KDSOPENSOURCEREPORT", buf, buf_len);
 }
 
+static size_t cf_varint_len(uint32_t v) {
+    size_t l = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        l++;
+    }
+
+    return l;
+}
+
+static size_t cf_varint_encode(uint8_t *buf, uint32_t v) {
+    size_t l = 0;
+
+    while (v >= 0x80) {
+        buf[l++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+
+    buf[l++] = v;
+
+    return l;
+}
+
+/* Microseconds since the first report in the pending batch */
+static long cf_batch_age(kis_capture_handler_t *caph) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (now.tv_sec - caph->batch_start.tv_sec) * 1000000L +
+        (now.tv_usec - caph->batch_start.tv_usec);
+}
+
+/* Is there nothing waiting to be written?  Must be called with out_ringbuf_lock held */
+static int cf_output_idle(kis_capture_handler_t *caph) {
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    if (caph->shm_reports)
+        return __atomic_load_n(&caph->shm_map.header->tail, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&caph->shm_map.header->head, __ATOMIC_RELAXED);
+#endif
+
+    if (caph->use_tcp || caph->use_ipc)
+        return kis_simple_ringbuf_used(caph->out_ringbuf) == 0;
+#ifdef HAVE_LIBWEBSOCKETS
+    else if (caph->use_ws)
+        return lws_ring_get_element(caph->lwsring, &caph->lwstail) == NULL;
+#endif
+
+    return 1;
+}
+
+/* Write a frame into the shared memory ring.  Must be called with out_ringbuf_lock
+ * held.
+ *
+ * Returns:
+ *  0   The ring is full
+ *  1   Success
+ */
+static int cf_send_shm(kis_capture_handler_t *caph, const char *command,
+        uint32_t seqno, uint8_t *data, size_t len) {
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    kismet_external_frame_v2_t *frame;
+
+    frame = (kismet_external_frame_v2_t *) kis_external_shm_reserve(&caph->shm_map,
+            len + sizeof(kismet_external_frame_v2_t));
+
+    if (frame == NULL)
+        return 0;
+
+    frame->signature = htonl(KIS_EXTERNAL_PROTO_SIG);
+    frame->data_sz = htonl(len);
+
+    frame->v2_sentinel = htons(KIS_EXTERNAL_V2_SIG);
+    frame->frame_version = htons(2);
+
+    frame->seqno = htonl(seqno);
+
+    strncpy(frame->command, command, 32);
+
+    memcpy(frame->data, data, len);
+
+    kis_external_shm_commit(&caph->shm_map, len + sizeof(kismet_external_frame_v2_t));
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Queue a frame through the deflate stream as a KDSCOMPRESSED frame.  The stream can't
+ * be rewound, so room for the frame is found before compressing.  Must be called with
+ * out_ringbuf_lock held.
+ *
+ * Returns as cf_batch_flush
+ */
+static int cf_send_compressed(kis_capture_handler_t *caph, const char *command,
+        uint32_t seqno, uint8_t *data, size_t len) {
+    kismet_external_frame_v2_t inner;
+    kismet_external_frame_v2_t *frame;
+    z_stream *zs;
+    size_t bound;
+    size_t out_len;
+
+    uint8_t *send_buffer = NULL;
+    size_t rs_sz = 0;
+
+#ifdef HAVE_LIBWEBSOCKETS
+    struct cf_ws_msg wsmsg;
+#endif
+
+    if (caph->compress_zs == NULL) {
+        caph->compress_zs = (z_stream *) calloc(1, sizeof(z_stream));
+
+        if (caph->compress_zs == NULL) {
+            fprintf(stderr, "FATAL: Failed to allocate compression stream\n");
+            return -1;
+        }
+
+        if (deflateInit2(caph->compress_zs, KIS_EXTERNAL_COMPRESS_LEVEL, Z_DEFLATED,
+                    KIS_EXTERNAL_COMPRESS_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "FATAL: Failed to initialize compression stream\n");
+            free(caph->compress_zs);
+            caph->compress_zs = NULL;
+            return -1;
+        }
+
+        caph->compress_restart = 1;
+    }
+
+    zs = caph->compress_zs;
+
+    /* Flags, the deflated frame, and the sync flush */
+    bound = sizeof(kismet_external_frame_v2_t) + 1 +
+        deflateBound(zs, sizeof(kismet_external_frame_v2_t) + len) + 16;
+
+    if (caph->use_tcp || caph->use_ipc) {
+        rs_sz = kis_simple_ringbuf_reserve(caph->out_ringbuf, (void **) &send_buffer, bound);
+
+        if (rs_sz != bound)
+            return 0;
+
+        frame = (kismet_external_frame_v2_t *) send_buffer;
+#ifdef HAVE_LIBWEBSOCKETS
+    } else if (caph->use_ws) {
+        if (lws_ring_get_count_free_elements(caph->lwsring) == 0)
+            return 0;
+
+        wsmsg.payload = (char *) malloc(LWS_PRE + bound);
+        if (wsmsg.payload == NULL) {
+            fprintf(stderr, "FATAL: Failed to allocate ws buffer\n");
+            return -1;
+        }
+
+        frame = (kismet_external_frame_v2_t *) (wsmsg.payload + LWS_PRE);
+#endif
+    } else {
+        return -1;
+    }
+
+    if (caph->compress_restart) {
+        deflateReset(zs);
+        deflateSetDictionary(zs, kis_external_compress_dict, sizeof(kis_external_compress_dict));
+        frame->data[0] = KIS_EXTERNAL_COMPRESS_FLAG_RESTART;
+        caph->compress_restart = 0;
+    } else {
+        frame->data[0] = 0;
+    }
+
+    inner.signature = htonl(KIS_EXTERNAL_PROTO_SIG);
+    inner.data_sz = htonl(len);
+    inner.v2_sentinel = htons(KIS_EXTERNAL_V2_SIG);
+    inner.frame_version = htons(2);
+    inner.seqno = htonl(seqno);
+    memset(inner.command, 0, sizeof(inner.command));
+    strncpy(inner.command, command, 32);
+
+    zs->next_out = frame->data + 1;
+    zs->avail_out = bound - sizeof(kismet_external_frame_v2_t) - 1;
+
+    zs->next_in = (Bytef *) &inner;
+    zs->avail_in = sizeof(kismet_external_frame_v2_t);
+
+    if (deflate(zs, Z_NO_FLUSH) != Z_OK)
+        goto compress_fail;
+
+    zs->next_in = (Bytef *) data;
+    zs->avail_in = len;
+
+    if (deflate(zs, Z_SYNC_FLUSH) != Z_OK || zs->avail_in != 0 || zs->avail_out == 0)
+        goto compress_fail;
+
+    out_len = bound - sizeof(kismet_external_frame_v2_t) - zs->avail_out;
+
+    frame->signature = htonl(KIS_EXTERNAL_PROTO_SIG);
+    frame->data_sz = htonl(out_len);
+
+    frame->v2_sentinel = htons(KIS_EXTERNAL_V2_SIG);
+    frame->frame_version = htons(2);
+
+    frame->seqno = htonl(seqno);
+
+    strncpy(frame->command, "KDSCOMPRESSED", 32);
+
+    if (caph->use_tcp || caph->use_ipc) {
+        kis_simple_ringbuf_commit(caph->out_ringbuf, send_buffer,
+                sizeof(kismet_external_frame_v2_t) + out_len);
+#ifdef HAVE_LIBWEBSOCKETS
+    } else if (caph->use_ws) {
+        wsmsg.len = sizeof(kismet_external_frame_v2_t) + out_len;
+
+        if (lws_ring_insert(caph->lwsring, &wsmsg, 1) != 1) {
+            free(wsmsg.payload);
+            fprintf(stderr, "FATAL:  Failed to queue ws message\n");
+            lws_cancel_service(caph->lwscontext);
+            return -1;
+        }
+#endif
+    }
+
+    return 1;
+
+compress_fail:
+    /* The stream is no longer in step with Kismet's */
+    fprintf(stderr, "FATAL: Failed to compress data report\n");
+
+    if (caph->use_tcp || caph->use_ipc) {
+        kis_simple_ringbuf_reserve_free(caph->out_ringbuf, send_buffer);
+#ifdef HAVE_LIBWEBSOCKETS
+    } else if (caph->use_ws) {
+        free(wsmsg.payload);
+#endif
+    }
+
+    return -1;
+}
+
+/* Queue the pending batch of data reports as a single KDSDATAREPORTBATCH frame; a
+ * batch of one is sent as a plain KDSDATAREPORT.  Either is compressed when Kismet
+ * asked for it.  Must be called with out_ringbuf_lock held; websocket callers must
+ * request a writable callback afterwards.
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0   Insufficient space in buffer, the batch is still pending
+ *  1   Success, or no pending batch
+ */
+static int cf_batch_flush(kis_capture_handler_t *caph) {
+    kismet_external_frame_v2_t *frame;
+    const char *command;
+    uint8_t *data;
+    size_t len;
+
+    uint8_t *send_buffer = NULL;
+    size_t rs_sz = 0;
+
+#ifdef HAVE_LIBWEBSOCKETS
+    struct cf_ws_msg wsmsg;
+#endif
+
+    if (caph->batch_count == 0)
+        return 1;
+
+    if (caph->batch_count == 1) {
+        /* Skip the field tag and length of the only report */
+        command = "KDSDATAREPORT";
+        data = caph->batch_buf + 1;
+
+        while (*data & 0x80)
+            data++;
+        data++;
+
+        len = caph->batch_len - (data - caph->batch_buf);
+    } else {
+        command = "KDSDATAREPORTBATCH";
+        data = caph->batch_buf;
+        len = caph->batch_len;
+    }
+
+    /* A full ring falls through to the pipe, so the capture never waits on Kismet
+     * draining it */
+    if (caph->shm_reports && cf_send_shm(caph, command, caph->batch_seqno, data, len) > 0) {
+        caph->batch_len = 0;
+        caph->batch_count = 0;
+        return 1;
+    }
+
+    if (caph->compress_reports) {
+        int r;
+
+        if ((r = cf_send_compressed(caph, command, caph->batch_seqno, data, len)) > 0) {
+            caph->batch_len = 0;
+            caph->batch_count = 0;
+        }
+
+        return r;
+    }
+
+    if (caph->use_tcp || caph->use_ipc) {
+        rs_sz = kis_simple_ringbuf_reserve(caph->out_ringbuf, (void **) &send_buffer,
+                len + sizeof(kismet_external_frame_v2_t));
+
+        if (rs_sz != len + sizeof(kismet_external_frame_v2_t))
+            return 0;
+
+        frame = (kismet_external_frame_v2_t *) send_buffer;
+#ifdef HAVE_LIBWEBSOCKETS
+    } else if (caph->use_ws) {
+        if (lws_ring_get_count_free_elements(caph->lwsring) == 0)
+            return 0;
+
+        wsmsg.payload = (char *) malloc(LWS_PRE + len + sizeof(kismet_external_frame_v2_t));
+        if (wsmsg.payload == NULL) {
+            fprintf(stderr, "FATAL: Failed to allocate ws buffer\n");
+            return -1;
+        }
+
+        wsmsg.len = len + sizeof(kismet_external_frame_v2_t);
+
+        frame = (kismet_external_frame_v2_t *) (wsmsg.payload + LWS_PRE);
+#endif
+    } else {
+        return -1;
+    }
+
+    frame->signature = htonl(KIS_EXTERNAL_PROTO_SIG);
+    frame->data_sz = htonl(len);
+
+    frame->v2_sentinel = htons(KIS_EXTERNAL_V2_SIG);
+    frame->frame_version = htons(2);
+
+    frame->seqno = htonl(caph->batch_seqno);
+
+    strncpy(frame->command, command, 32);
+
+    memcpy(frame->data, data, len);
+
+    if (caph->use_tcp || caph->use_ipc) {
+        kis_simple_ringbuf_commit(caph->out_ringbuf, send_buffer, rs_sz);
+#ifdef HAVE_LIBWEBSOCKETS
+    } else if (caph->use_ws) {
+        if (lws_ring_insert(caph->lwsring, &wsmsg, 1) != 1) {
+            free(wsmsg.payload);
+            fprintf(stderr, "FATAL:  Failed to queue ws message\n");
+            lws_cancel_service(caph->lwscontext);
+            return -1;
+        }
+#endif
+    }
+
+    caph->batch_len = 0;
+    caph->batch_count = 0;
+
+    return 1;
+}
+
+/* Add a data report to the pending batch; the batch is sent as soon as nothing else is
+ * waiting to be written, so batches only build up while the output is busy.  The
+ * report must fit in an empty batch.  Must be called with out_ringbuf_lock held.
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+static int cf_batch_append(kis_capture_handler_t *caph,
+        KismetDatasource__DataReport *report, size_t len, uint32_t seqno) {
+    int r;
+
+    if (caph->batch_buf == NULL) {
+        caph->batch_buf = (uint8_t *) malloc(CAP_FRAMEWORK_BATCH_SZ);
+
+        if (caph->batch_buf == NULL) {
+            fprintf(stderr, "FATAL: Failed to allocate data report batch\n");
+            return -1;
+        }
+    }
+
+    if (caph->batch_len + 1 + cf_varint_len(len) + len > CAP_FRAMEWORK_BATCH_SZ) {
+        if ((r = cf_batch_flush(caph)) <= 0)
+            return r;
+    }
+
+    if (caph->batch_count == 0) {
+        caph->batch_seqno = seqno;
+        gettimeofday(&caph->batch_start, NULL);
+    }
+
+    /* DataReportBatch field 1, length delimited */
+    caph->batch_buf[caph->batch_len++] = 0x0A;
+    caph->batch_len += cf_varint_encode(caph->batch_buf + caph->batch_len, len);
+
+    kismet_datasource__data_report__pack(report, caph->batch_buf + caph->batch_len);
+    caph->batch_len += len;
+    caph->batch_count++;
+
+    if (caph->batch_count >= CAP_FRAMEWORK_BATCH_MAX || cf_output_idle(caph) ||
+            cf_batch_age(caph) >= CAP_FRAMEWORK_BATCH_DELAY_US) {
+        if (cf_batch_flush(caph) < 0)
+            return -1;
+    }
+
+    return 1;
+}
+
+/* Link types the data frame truncation understands */
+#define CF_DLT_IEEE802_11           105
+#define CF_DLT_IEEE802_11_RADIO     127
+#define CF_DLT_PPI                  192
+
+/* How much of a packet to send, under the truncation Kismet has pushed */
+static uint32_t cf_filter_caplen(kis_capture_handler_t *caph, uint32_t dlt, 
+        uint32_t packet_sz, const uint8_t *pack) {
+    unsigned int snaplen = __atomic_load_n(&caph->filter_snaplen, __ATOMIC_RELAXED);
+    int data_payload = __atomic_load_n(&caph->filter_data_payload, __ATOMIC_RELAXED);
+    uint32_t caplen = packet_sz;
+    size_t offt, hdr_len;
+
+    if (snaplen != 0 && caplen > snaplen)
+        caplen = snaplen;
+
+    if (data_payload < 0)
+        return caplen;
+
+    /* Find the 802.11 frame behind any radio header */
+    if (dlt == CF_DLT_IEEE802_11) {
+        offt = 0;
+    } else if (dlt == CF_DLT_IEEE802_11_RADIO || dlt == CF_DLT_PPI) {
+        if (packet_sz < 4)
+            return caplen;
+
+        offt = pack[2] | (pack[3] << 8);
+    } else {
+        return caplen;
+    }
+
+    if (packet_sz < offt + 24)
+        return caplen;
+
+    /* Only data frames are cut down to their headers */
+    if (((pack[offt] >> 2) & 0x03) != 0x02)
+        return caplen;
+
+    hdr_len = 24;
+
+    /* Four addresses when going to and from the DS */
+    if ((pack[offt + 1] & 0x03) == 0x03)
+        hdr_len += 6;
+
+    /* QoS control, and HT control when the order bit is set */
+    if (pack[offt] & 0x80) {
+        hdr_len += 2;
+
+        if (pack[offt + 1] & 0x80)
+            hdr_len += 4;
+    }
+
+    /* Kismet needs the whole of any unencrypted EAPOL frame to track handshakes */
+    if (!(pack[offt + 1] & 0x40) && packet_sz >= offt + hdr_len + 8 &&
+            pack[offt + hdr_len] == 0xAA && pack[offt + hdr_len + 1] == 0xAA &&
+            pack[offt + hdr_len + 6] == 0x88 && pack[offt + hdr_len + 7] == 0x8E)
+        return caplen;
+
+    if (offt + hdr_len + data_payload < caplen)
+        caplen = offt + hdr_len + data_payload;
+
+    return caplen;
+}
+
 int cf_send_data(kis_capture_handler_t *caph,
         KismetExternal__MsgbusMessage *kv_message,
         KismetDatasource__SubSignal *kv_signal,
@@ -3482,6 +4620,7 @@ int cf_send_data(kis_capture_handler_t *caph,
     uint8_t *send_buffer;
     size_t buf_len = 0;
     uint32_t seqno;
+    int r;
 
     KismetDatasource__DataReport kedata;
     KismetDatasource__SubPacket kepkt;
@@ -3519,16 +4658,57 @@ int cf_send_data(kis_capture_handler_t *caph,
     }
 
     if (packet_sz > 0 && pack != NULL) {
+        uint32_t caplen = cf_filter_caplen(caph, dlt, packet_sz, pack);
+
         kepkt.time_sec = ts.tv_sec;
         kepkt.time_usec = ts.tv_usec;
         kepkt.dlt = dlt;
-        kepkt.size = packet_sz;
-        kepkt.data.len = packet_sz;
+        kepkt.size = caplen;
+        kepkt.data.len = caplen;
         kepkt.data.data = pack;
 
+        if (caplen != packet_sz) {
+            kepkt.has_cap_size = 1;
+            kepkt.cap_size = packet_sz;
+        }
+
         kedata.packet = &kepkt;
     }
 
+    buf_len = kismet_datasource__data_report__get_packed_size(&kedata);
+
+    if (caph->batch_reports &&
+            1 + cf_varint_len(buf_len) + buf_len <= CAP_FRAMEWORK_BATCH_SZ) {
+        /* Lock the handler and get the next sequence number */
+        pthread_mutex_lock(&(caph->handler_lock));
+        if (++caph->seqno == 0)
+            caph->seqno = 1;
+        seqno = caph->seqno;
+        pthread_mutex_unlock(&(caph->handler_lock));
+
+        pthread_mutex_lock(&(caph->out_ringbuf_lock));
+        r = cf_batch_append(caph, &kedata, buf_len, seqno);
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+        cf_out_ringbuf_wake(caph);
+
+        if (kegps.name != NULL)
+            free(kegps.name);
+        if (kegps.type != NULL)
+            free(kegps.type);
+
+#ifdef HAVE_LIBWEBSOCKETS
+        if (caph->use_ws) {
+            pthread_mutex_lock(&caph->handler_lock);
+            if (caph->lwsclientwsi != NULL)
+                lws_callback_on_writable(caph->lwsclientwsi);
+            pthread_mutex_unlock(&caph->handler_lock);
+        }
+#endif
+
+        return r;
+    }
+
     if (caph->use_tcp || caph->use_ipc) {
         /* Shortcut internal state tests to use an optimized streaming method to write to 
          * the tcp/ipc ringbuffer using a protobuf_c buffer writer.
@@ -3545,7 +4725,11 @@ int cf_send_data(kis_capture_handler_t *caph,
         /* Reserve the buffer space and assemble the packet header just like cf_rb_send_packet */
         pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
-        buf_len = kismet_datasource__data_report__get_packed_size(&kedata);
+        /* Keep any batched data reports ahead of this one */
+        if ((r = cf_batch_flush(caph)) <= 0) {
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            return r;
+        }
 
         rs_sz = kis_simple_ringbuf_reserve(caph->out_ringbuf, (void **) &send_buffer, 
                 buf_len + sizeof(kismet_external_frame_v2_t));
@@ -3553,6 +4737,8 @@ int cf_send_data(kis_capture_handler_t *caph,
         if (rs_sz != buf_len + sizeof(kismet_external_frame_v2_t)) {
             // fprintf(stderr, "DEBUG - insufficient size in outgoing buffer for %lu\n", buf_len);
             pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            /* The batch may have gone out ahead of us */
+            cf_out_ringbuf_wake(caph);
             return 0;
         }
 
@@ -3576,6 +4762,8 @@ int cf_send_data(kis_capture_handler_t *caph,
 
         pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
+        cf_out_ringbuf_wake(caph);
+
         if (kegps.name != NULL)
             free(kegps.name);
         if (kegps.type != NULL)
@@ -3586,9 +4774,7 @@ int cf_send_data(kis_capture_handler_t *caph,
         /* Otherwise we need to use our legacy mode of serializing the packet into a temp
          * buffer then putting that into the websocket ring */
         uint8_t *buf;
-        size_t buf_len;
 
-        buf_len = kismet_datasource__data_report__get_packed_size(&kedata);
         buf = (uint8_t *) malloc(buf_len);
 
         if (buf == NULL) {
@@ -3757,12 +4943,11 @@ int cf_send_configresp(kis_capture_handler_t *caph, unsigned int seqno,
     return cf_send_packet(caph, "KDSCONFIGUREREPORT", buf, buf_len);
 }
 
-int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid) {
+/* Pack a NEWSOURCE announcing our source, and our session token if we have one */
+static uint8_t *cf_pack_newsource(kis_capture_handler_t *caph, const char *uuid, size_t *len) {
     KismetDatasource__NewSource kesrc;
 
     uint8_t *buf;
-    size_t buf_len;
-    
 
     kismet_datasource__new_source__init(&kesrc);
 
@@ -3770,21 +4955,27 @@ int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid) {
     kesrc.sourcetype = caph->capsource_type;
     if (uuid != NULL)
         kesrc.uuid = strdup(uuid);
+    kesrc.session = caph->remote_session;
 
-    buf_len = kismet_datasource__new_source__get_packed_size(&kesrc);
-    buf = (uint8_t *) malloc(buf_len);
+    *len = kismet_datasource__new_source__get_packed_size(&kesrc);
+    buf = (uint8_t *) malloc(*len);
 
-    if (buf == NULL) {
-        if (uuid != NULL)
-            free(kesrc.uuid);
-        return -1;
-    }
-
-    kismet_datasource__new_source__pack(&kesrc, buf);
+    if (buf != NULL)
+        kismet_datasource__new_source__pack(&kesrc, buf);
 
     if (uuid != NULL)
         free(kesrc.uuid);
 
+    return buf;
+}
+
+int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid) {
+    uint8_t *buf;
+    size_t buf_len;
+
+    if ((buf = cf_pack_newsource(caph, uuid, &buf_len)) == NULL)
+        return -1;
+
     return cf_send_packet(caph, "KDSNEWSOURCE", buf, buf_len);
 }
 
@@ -57,6 +57,7 @@
 #include <libwebsockets.h>
 #endif
 
+#include "kis_external_shm.h"
 #include "simple_ringbuf_c.h"
 
 #include "protobuf_c/kismet.pb-c.h"
@@ -88,6 +89,17 @@ struct cf_ws_msg {
 #define CAP_FRAMEWORK_RINGBUF_OUT_SZ    (1024 * 1024 * 4)
 #define CAP_FRAMEWORK_WS_BUF_SZ         (1024 * 4)
 
+/* Data reports are batched into one frame up to this many bytes or reports, while
+ * the output is busy, and held for no longer than the batch delay.  Kismet refuses
+ * frames of 16k or more, so batches stay under that with room for the header */
+#define CAP_FRAMEWORK_BATCH_SZ          (1024 * 15)
+#define CAP_FRAMEWORK_BATCH_MAX         256
+#define CAP_FRAMEWORK_BATCH_DELAY_US    5000
+
+/* A remote capture which loses its TCP connection keeps capturing into the output
+ * buffer and tries to reconnect and resume for this many seconds before giving up */
+#define CAP_FRAMEWORK_RESUME_WINDOW     30
+
 /* List devices callback
  * Called to list devices available
  *
@@ -201,6 +213,33 @@ typedef int (*cf_callback_chancontrol)(kis_capture_handler_t *, uint32_t seqno,
  */
 typedef void (*cf_callback_chanfree)(void *);
 
+/* BPF instruction pushed by Kismet, laid out like a classic struct bpf_insn */
+typedef struct {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+} cf_bpf_insn_t;
+
+/* Capture filter callback
+ * Called in response to a FILTER block in a CONFIGURE command, to install a BPF
+ * program on the capture.  The program replaces any program pushed before; when
+ * insns_len is 0 the pushed program is removed, and the source should go back to
+ * whatever filter it set up itself.
+ *
+ * Truncation in the same command is handled by the framework and does not need
+ * support from the source.
+ *
+ * msg is allocated by the framework and can hold up to STATUS_MAX characters.  It 
+ * will be transmitted along with the success or failure value.
+ *
+ * Returns:
+ * -1   Unable to install the filter; the source keeps running
+ *  1+  Success
+ */
+typedef int (*cf_callback_filter)(kis_capture_handler_t *, uint32_t seqno,
+        const cf_bpf_insn_t *insns, size_t insns_len, char *msg);
+
 /* Unknown frame callback
  * Called when an unknown frame is received on the protocol
  *
@@ -328,6 +367,15 @@ struct kis_capture_handler {
     /* TCP client connection */
     int tcp_fd;
 
+    /* Session token and UUID sent in NEWSOURCE, kept to resume the source on a new
+     * connection; only set for TCP remote captures */
+    char *remote_session;
+    char *remote_uuid;
+
+    /* Unsent bytes of the frame at the head of the output buffer, so a frame cut off
+     * by a lost connection can be dropped before resuming */
+    size_t out_frame_remaining;
+
     /* Die when we hit the end of our write buffer */
     int spindown;
 
@@ -342,13 +390,43 @@ struct kis_capture_handler {
 #endif
 
 
-    /* Lock for output buffer or output ws ring */
+    /* Lock for writers to the output buffer or output ws ring; the output buffer is
+     * drained by the IO loop without it, since the ring buffer is safe for one reader
+     * and one writer */
     pthread_mutex_t out_ringbuf_lock;
 
+    /* Pending batch of data reports, as an encoded DataReportBatch; only used when
+     * Kismet asks for batches when opening the source.  Protected by out_ringbuf_lock */
+    int batch_reports;
+    uint8_t *batch_buf;
+    size_t batch_len;
+    unsigned int batch_count;
+    uint32_t batch_seqno;
+    struct timeval batch_start;
+
+    /* Deflate stream for compressed data reports, when Kismet asks for them; restarted
+     * whenever the source is opened.  Protected by out_ringbuf_lock */
+    int compress_reports;
+    int compress_restart;
+    struct z_stream_s *compress_zs;
+
+    /* Shared memory ring passed by Kismet with --shm-fd, and whether Kismet asked for 
+     * data reports to be sent through it when opening the source.  Protected by 
+     * out_ringbuf_lock */
+    int shm_fd;
+    kis_external_shm_map_t shm_map;
+    int shm_reports;
+
     /* conditional waiter for ringbuf flushing data */
     pthread_cond_t out_ringbuf_flush_cond;
     pthread_mutex_t out_ringbuf_flush_cond_mutex;
 
+    /* Wakeup for the IO loop when data is written to an empty output buffer; an
+     * eventfd on Linux, otherwise a pipe.  out_wake_armed is set by the IO loop
+     * before it waits with nothing to write, so writers only signal it then */
+    int out_wake_fd[2];
+    int out_wake_armed;
+
     /* Are we shutting down? */
     int shutdown;
     pthread_mutex_t handler_lock;
@@ -368,6 +446,14 @@ struct kis_capture_handler {
 
     cf_callback_spectrumconfig spectrumconfig_cb;
 
+    cf_callback_filter filter_cb;
+
+    /* Truncation pushed by Kismet:  snaplen for all packets (0 for none), and bytes
+     * of 802.11 data payload to keep after the headers (-1 for all); read by the
+     * capture thread without locking */
+    unsigned int filter_snaplen;
+    int filter_data_payload;
+
     /* Arbitrary data blob for capture specific content */
     void *userdata;
 
@@ -620,8 +706,8 @@ void cf_handler_set_hop_shuffle_spacing(kis_capture_handler_t *capf, int spacing
 
 /* Parse command line options
  *
- * Parse command line for --in-fd, --out-fd, --connect, --source, --host, and populate
- * the caph config.
+ * Parse command line for --in-fd, --out-fd, --shm-fd, --connect, --source, --host, 
+ * and populate the caph config.
  * 
  * Returns:
  * -1   Missing in-fd/out-fd or --connect, or unknown argument, caller should print
@@ -652,6 +738,8 @@ void cf_handler_set_spectrumconfig_cb(kis_capture_handler_t *capf,
 
 void cf_handler_set_unknown_cb(kis_capture_handler_t *capf, cf_callback_unknown cb);
 
+void cf_handler_set_filter_cb(kis_capture_handler_t *capf, cf_callback_filter cb);
+
 /* Set the capture function, which runs inside its own thread */
 void cf_handler_set_capture_cb(kis_capture_handler_t *capf, cf_callback_capture cb);
 
@@ -696,6 +784,18 @@ int cf_handle_rb_rx_data(kis_capture_handler_t *caph);
  */
 int cf_handler_tcp_remote_connect(kis_capture_handler_t *caph);
 
+/* Reconnect a TCP remote capture which lost its connection while capturing, and ask
+ * Kismet to resume the existing source; the capture thread keeps filling the output
+ * buffer meanwhile, and whatever it holds is sent once resumed.  Called by the
+ * capture loop.
+ *
+ * Returns:
+ * -1   Could not reconnect within the resume window, process should exit
+ *  0   The connection can't be resumed
+ *  1   Reconnected, caph->tcp_fd is the new connection
+ */
+int cf_handler_tcp_resume(kis_capture_handler_t *caph);
+
 /* Connect to a websocket endpoint, if remote connection in ws mode;
  * this should not be needed by capture tools using the framework, the 
  * capture loop will be managed directly via cf_handler_remote_capture
@@ -787,6 +887,18 @@ int cf_send_message(kis_capture_handler_t *caph, const char *message,
  */
 int cf_send_warning(kis_capture_handler_t *caph, const char *warning);
 
+/* Send a HOPREPORT of the measured channel hopping over the last report interval;
+ * times are in seconds.  Sent by the hopping thread.
+ *
+ * Returns:
+ * -1   An error occurred writing the frame
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+int cf_send_hopreport(kis_capture_handler_t *caph, unsigned int hops, double interval,
+        double target_dwell, double mean_dwell, double max_dwell,
+        double mean_tune, double max_tune);
+
 /* Send an ERROR
  * Can be called from any thread
  *
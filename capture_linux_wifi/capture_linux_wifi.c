@@ -95,6 +95,16 @@
 
 #define MAX_PACKET_LEN  8192
 
+/* Default kernel capture ring, in kilobytes, and how long the kernel may hold a
+ * partial ring block, in milliseconds.  Libpcap maps the ring with TPACKET_V3 and
+ * the kernel fills it a block at a time, so a busy monitor interface needs room
+ * to absorb bursts while we're sending the previous block to Kismet */
+#define DEFAULT_PCAP_BUFFER_KB  8192
+#define DEFAULT_PCAP_TIMEOUT_MS 20
+
+/* How often to report kernel drops, in seconds, when statistics are enabled */
+#define PCAP_STATS_INTERVAL     10
+
 // BPF program to parse radiotap and 802.11, and pass management and eapol ONLY
 struct bpf_insn rt_pgm[] = {
     // 00 LDB [3]      a = pkt[3] second half of length
@@ -411,6 +421,19 @@ typedef struct {
     unsigned long channel_set_ns_avg;
     unsigned int channel_set_ns_count;
 
+    /* Kernel capture ring size in kilobytes, and block timeout in ms */
+    unsigned int pcap_buffer_kb;
+    unsigned int pcap_timeout_ms;
+
+    /* Last reported kernel drop count, and when we last checked it */
+    unsigned int pcap_last_drop;
+    time_t pcap_last_stats;
+
+    /* Filter installed when the source was opened, restored when Kismet removes a
+     * filter it pushed */
+    struct bpf_insn *base_filter;
+    unsigned int base_filter_len;
+
 } local_wifi_t;
 
 /* Linux Wi-Fi Channels:
@@ -1135,6 +1158,87 @@ int populate_chanlist(kis_capture_handler_t *caph, char *interface, char *msg,
     return 1;
 }
 
+/* Install a filter while opening the source, and remember it */
+int set_base_filter(local_wifi_t *local_wifi, struct bpf_program *bpf) {
+    if (pcap_setfilter(local_wifi->pd, bpf) < 0)
+        return -1;
+
+    if (local_wifi->base_filter != NULL)
+        free(local_wifi->base_filter);
+
+    local_wifi->base_filter_len = 0;
+    local_wifi->base_filter = 
+        (struct bpf_insn *) malloc(sizeof(struct bpf_insn) * bpf->bf_len);
+
+    if (local_wifi->base_filter != NULL) {
+        memcpy(local_wifi->base_filter, bpf->bf_insns, sizeof(struct bpf_insn) * bpf->bf_len);
+        local_wifi->base_filter_len = bpf->bf_len;
+    }
+
+    return 0;
+}
+
+/* Filter callback; install a filter pushed by Kismet, or go back to the filter we
+ * opened with when it's removed */
+int filter_callback(kis_capture_handler_t *caph, uint32_t seqno, 
+        const cf_bpf_insn_t *insns, size_t insns_len, char *msg) {
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    struct bpf_program bpf;
+    struct bpf_insn accept_all = BPF_STMT(BPF_RET | BPF_K, MAX_PACKET_LEN);
+    size_t i;
+    int r;
+
+    if (local_wifi->pd == NULL) {
+        snprintf(msg, STATUS_MAX, "%s capture is not open", local_wifi->name);
+        return -1;
+    }
+
+    if (insns_len == 0) {
+        if (local_wifi->base_filter_len > 0) {
+            bpf.bf_len = local_wifi->base_filter_len;
+            bpf.bf_insns = local_wifi->base_filter;
+        } else {
+            bpf.bf_len = 1;
+            bpf.bf_insns = &accept_all;
+        }
+    } else {
+        bpf.bf_len = insns_len;
+        bpf.bf_insns = (struct bpf_insn *) malloc(sizeof(struct bpf_insn) * insns_len);
+
+        if (bpf.bf_insns == NULL) {
+            snprintf(msg, STATUS_MAX, "%s could not allocate capture filter", local_wifi->name);
+            return -1;
+        }
+
+        for (i = 0; i < insns_len; i++) {
+            bpf.bf_insns[i].code = insns[i].code;
+            bpf.bf_insns[i].jt = insns[i].jt;
+            bpf.bf_insns[i].jf = insns[i].jf;
+            bpf.bf_insns[i].k = insns[i].k;
+        }
+
+        if (!bpf_validate(bpf.bf_insns, bpf.bf_len)) {
+            snprintf(msg, STATUS_MAX, "%s capture filter from Kismet is not a valid BPF "
+                    "program", local_wifi->name);
+            free(bpf.bf_insns);
+            return -1;
+        }
+    }
+
+    r = pcap_setfilter(local_wifi->pd, &bpf);
+
+    if (r < 0) {
+        snprintf(msg, STATUS_MAX, "%s %s/%s unable to install capture filter from Kismet: %s",
+                local_wifi->name, local_wifi->interface, local_wifi->cap_interface,
+                pcap_geterr(local_wifi->pd));
+    }
+
+    if (insns_len > 0)
+        free(bpf.bf_insns);
+
+    return r < 0 ? -1 : 1;
+}
+
 /* Channel control callback; actually set a channel.  Determines if our
  * custom channel needs a VHT frequency set. */
 int chancontrol_callback(kis_capture_handler_t *caph, uint32_t seqno, void *privchan,
@@ -1755,6 +1859,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
     char driver[32] = "";
 
     char *localchanstr = NULL;
+    char *optstr = NULL;
     local_channel_t *localchan = NULL;
 
     int filter_locals = 0;
@@ -1844,6 +1949,41 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         }
     }
 
+    /* Size of the kernel capture ring, in kilobytes */
+    if ((placeholder_len =
+                cf_find_flag(&placeholder, "pcap_buffer", definition)) > 0) {
+        optstr = strndup(placeholder, placeholder_len);
+
+        if (sscanf(optstr, "%u", &local_wifi->pcap_buffer_kb) != 1 ||
+                local_wifi->pcap_buffer_kb < 256) {
+            snprintf(msg, STATUS_MAX, "%s invalid pcap_buffer= option '%s', expected "
+                    "a size in kilobytes of at least 256", local_wifi->name, optstr);
+            free(optstr);
+            return -1;
+        }
+
+        free(optstr);
+        optstr = NULL;
+    }
+
+    /* How long the kernel holds a partially filled ring block before handing it
+     * to us, in milliseconds */
+    if ((placeholder_len =
+                cf_find_flag(&placeholder, "pcap_timeout", definition)) > 0) {
+        optstr = strndup(placeholder, placeholder_len);
+
+        if (sscanf(optstr, "%u", &local_wifi->pcap_timeout_ms) != 1 ||
+                local_wifi->pcap_timeout_ms == 0) {
+            snprintf(msg, STATUS_MAX, "%s invalid pcap_timeout= option '%s', expected "
+                    "a time in milliseconds", local_wifi->name, optstr);
+            free(optstr);
+            return -1;
+        }
+
+        free(optstr);
+        optstr = NULL;
+    }
+
     /* Do we filter packets for wardrive mode to mgmt only? */
     if ((placeholder_len = 
                 cf_find_flag(&placeholder, "filter_mgmt", definition)) > 0) {
@@ -2879,22 +3019,52 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
 
     (*ret_interface)->hardware = strdup(driver);
 
-    /* Open the pcap */
-    local_wifi->pd = pcap_open_live(local_wifi->cap_interface, 
-            MAX_PACKET_LEN, 1, 1000, pcap_errstr);
+    /* Open the pcap.  Libpcap captures through a TPACKET_V3 mmap ring, which the
+     * kernel fills a block of packets at a time; each dispatch then hands us every
+     * packet in the block straight from the ring, and they're batched into
+     * multi-packet reports to Kismet as they're sent.  Immediate mode is
+     * deliberately not used, because it makes libpcap fall back to a
+     * packet-at-a-time TPACKET_V2 ring. */
+    local_wifi->pd = pcap_create(local_wifi->cap_interface, pcap_errstr);
 
-    if (local_wifi->pd == NULL || strlen(pcap_errstr) != 0) {
+    if (local_wifi->pd == NULL) {
         snprintf(msg, STATUS_MAX, "%s could not open capture interface '%s' on '%s' "
                 "as a pcap capture: %s", local_wifi->name, local_wifi->cap_interface, 
                 local_wifi->interface, pcap_errstr);
         return -1;
     }
 
+    pcap_set_snaplen(local_wifi->pd, MAX_PACKET_LEN);
+    pcap_set_promisc(local_wifi->pd, 1);
+    pcap_set_timeout(local_wifi->pd, local_wifi->pcap_timeout_ms);
+    pcap_set_buffer_size(local_wifi->pd, local_wifi->pcap_buffer_kb * 1024);
+
+    ret = pcap_activate(local_wifi->pd);
+
+    if (ret < 0) {
+        snprintf(msg, STATUS_MAX, "%s could not open capture interface '%s' on '%s' "
+                "as a pcap capture: %s", local_wifi->name, local_wifi->cap_interface, 
+                local_wifi->interface, 
+                ret == PCAP_ERROR ? pcap_geterr(local_wifi->pd) : pcap_statustostr(ret));
+        pcap_close(local_wifi->pd);
+        local_wifi->pd = NULL;
+        return -1;
+    }
+
+    local_wifi->pcap_last_drop = 0;
+    local_wifi->pcap_last_stats = time(0);
+
+    if (local_wifi->base_filter != NULL) {
+        free(local_wifi->base_filter);
+        local_wifi->base_filter = NULL;
+        local_wifi->base_filter_len = 0;
+    }
+
     if (local_wifi->wardrive_filter) {
         if (pcap_datalink(local_wifi->pd) == DLT_IEEE802_11_RADIO) {
             bpf.bf_len = rt_pgm_len;
             bpf.bf_insns = rt_pgm;
-            if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+            if (set_base_filter(local_wifi, &bpf) < 0) {
                 snprintf(errstr, STATUS_MAX, "%s unable to install management packet filter: %s",
                          local_wifi->name, pcap_geterr(local_wifi->pd));
                 cf_send_message(caph, errstr, MSGFLAG_ERROR);
@@ -2902,7 +3072,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         } else if (pcap_datalink(local_wifi->pd) == DLT_IEEE802_11) {
             bpf.bf_len = dot11_pgm_len;
             bpf.bf_insns = dot11_pgm;
-            if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+            if (set_base_filter(local_wifi, &bpf) < 0) {
                 snprintf(errstr, STATUS_MAX, "%s unable to install management packet filter: %s",
                          local_wifi->name, pcap_geterr(local_wifi->pd));
                 cf_send_message(caph, errstr, MSGFLAG_ERROR);
@@ -2917,7 +3087,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         if (pcap_datalink(local_wifi->pd) == DLT_IEEE802_11_RADIO) {
             bpf.bf_len = rt_pgm_crop_data_len;
             bpf.bf_insns = rt_pgm_crop_data;
-            if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+            if (set_base_filter(local_wifi, &bpf) < 0) {
                 snprintf(errstr, STATUS_MAX, "%s unable to install data packet filter: %s",
                          local_wifi->name, pcap_geterr(local_wifi->pd));
                 cf_send_message(caph, errstr, MSGFLAG_ERROR);
@@ -2943,7 +3113,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
                         local_wifi->name, pcap_geterr(local_wifi->pd));
                 cf_send_message(caph, errstr, MSGFLAG_INFO);
             } else {
-                if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+                if (set_base_filter(local_wifi, &bpf) < 0) {
                     snprintf(errstr, STATUS_MAX, "%s unable to assign filter to exclude other "
                             "local interfaces: %s",
                             local_wifi->name, pcap_geterr(local_wifi->pd));
@@ -2961,7 +3131,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
                         local_wifi->name, pcap_geterr(local_wifi->pd));
                 cf_send_message(caph, errstr, MSGFLAG_INFO);
             } else {
-                if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+                if (set_base_filter(local_wifi, &bpf) < 0) {
                     snprintf(errstr, STATUS_MAX, "%s unable to assign filter to exclude "
                             "local interfaces: %s",
                             local_wifi->name, pcap_geterr(local_wifi->pd));
@@ -2986,7 +3156,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
                         local_wifi->name, pcap_geterr(local_wifi->pd));
                 cf_send_message(caph, errstr, MSGFLAG_INFO);
             } else {
-                if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+                if (set_base_filter(local_wifi, &bpf) < 0) {
                     snprintf(errstr, STATUS_MAX, "%s unable to assign filter to exclude "
                             "specific addresses: %s",
                             local_wifi->name, pcap_geterr(local_wifi->pd));
@@ -3217,11 +3387,43 @@ void capture_thread(kis_capture_handler_t *caph) {
     char iferrstr[STATUS_MAX];
     int ifflags = 0, ifret;
 
+    struct pcap_stat ps;
+    time_t now;
+    int ret;
+
     /* Simple capture thread: since we don't care about blocking and 
      * channel control is managed by the channel hopping thread, all we have
-     * to do is enter a blocking pcap loop */
+     * to do is dispatch each block of packets as the kernel fills it */
+
+    while (1) {
+        ret = pcap_dispatch(local_wifi->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+
+        if (ret < 0)
+            break;
+
+        if (!local_wifi->verbose_statistics)
+            continue;
 
-    pcap_loop(local_wifi->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+        now = time(0);
+
+        if (now - local_wifi->pcap_last_stats < PCAP_STATS_INTERVAL)
+            continue;
+
+        local_wifi->pcap_last_stats = now;
+
+        if (pcap_stats(local_wifi->pd, &ps) < 0)
+            continue;
+
+        /* Drops are cumulative since the interface was opened */
+        if (ps.ps_drop != local_wifi->pcap_last_drop) {
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "%s %s/%s kernel dropped %u packets in the "
+                    "last %d seconds; consider a larger pcap_buffer= option",
+                    local_wifi->name, local_wifi->interface, local_wifi->cap_interface,
+                    ps.ps_drop - local_wifi->pcap_last_drop, PCAP_STATS_INTERVAL);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+            local_wifi->pcap_last_drop = ps.ps_drop;
+        }
+    }
 
     pcap_errstr = pcap_geterr(local_wifi->pd);
 
@@ -3274,6 +3476,12 @@ int main(int argc, char *argv[]) {
         .verbose_statistics = 0,
         .channel_set_ns_avg = 0,
         .channel_set_ns_count = 0,
+        .pcap_buffer_kb = DEFAULT_PCAP_BUFFER_KB,
+        .pcap_timeout_ms = DEFAULT_PCAP_TIMEOUT_MS,
+        .pcap_last_drop = 0,
+        .pcap_last_stats = 0,
+        .base_filter = NULL,
+        .base_filter_len = 0,
     };
 
 #ifdef HAVE_LIBNM
@@ -3311,6 +3519,9 @@ int main(int argc, char *argv[]) {
     /* Set the control cb */
     cf_handler_set_chancontrol_cb(caph, chancontrol_callback);
 
+    /* Set the filter cb */
+    cf_handler_set_filter_cb(caph, filter_callback);
+
     /* Set the capture thread */
     cf_handler_set_capture_cb(caph, capture_thread);
 
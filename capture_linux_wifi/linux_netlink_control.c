@@ -40,6 +40,7 @@
 
 #include "nl80211.h"
 #include <net/if.h>
+#include <sys/socket.h>
 #endif
 
 #include <dirent.h>
@@ -84,6 +85,50 @@ static int nl80211_ack_cb(struct nl_msg *msg, void *arg) {
     *ret = 0;
     return NL_STOP;
 }
+
+/* Send a command without asking for an ack, for the channel changes made on every hop.
+ * nl80211 runs the command inside the send, so a failure is already queued on the
+ * socket when the send returns; a non-blocking read picks it up, and a success costs
+ * no reply and no wait.  Returns 0 or a negative error. */
+static int nl80211_send_noack(struct nl_sock *nl_sock, struct nl_msg *msg) {
+    struct nlmsghdr *hdr;
+    char buf[1024];
+    ssize_t len;
+    int ret;
+
+#if defined(HAVE_LIBNL10)
+    nl_auto_complete(nl_sock, msg);
+#else
+    nl_complete_msg(nl_sock, msg);
+#endif
+
+    nlmsg_hdr(msg)->nlmsg_flags &= ~NLM_F_ACK;
+
+    if ((ret = nl_send(nl_sock, msg)) < 0)
+        return ret;
+
+    len = recv(nl_socket_get_fd(nl_sock), buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        return -errno;
+    }
+
+    /* The error echoes the request, which can be truncated; only the header matters */
+    for (hdr = (struct nlmsghdr *) buf; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+        if (hdr->nlmsg_type == NLMSG_ERROR &&
+                hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+            struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(hdr);
+
+            if (err->error != 0)
+                return err->error;
+        }
+    }
+
+    return 0;
+}
 #endif
 
 unsigned int mac80211_chan_to_freq(unsigned int in_chan) {
@@ -404,10 +449,8 @@ int mac80211_set_channel_cache(int ifindex, void *nl_sock,
     NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, mac80211_chan_to_freq(channel));
     NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_CHANNEL_TYPE, chmode);
 
-    if ((ret = nl_send_auto_complete(nl_sock, msg)) >= 0) {
-        if ((ret = nl_wait_for_ack(nl_sock)) < 0) 
-            goto nla_put_failure;
-    }
+    if ((ret = nl80211_send_noack(nl_sock, msg)) < 0)
+        goto nla_put_failure;
 
     nlmsg_free(msg);
 
@@ -512,10 +555,8 @@ int mac80211_set_frequency_cache(int ifindex, void *nl_sock, int nl80211_id,
         NLA_PUT_U32(msg, NL80211_ATTR_CENTER_FREQ1, mac80211_chan_to_freq(center_freq1));
     }
 
-    if ((ret = nl_send_auto_complete(nl_sock, msg)) >= 0) {
-        if ((ret = nl_wait_for_ack(nl_sock)) < 0) 
-            goto nla_put_failure;
-    }
+    if ((ret = nl80211_send_noack(nl_sock, msg)) < 0)
+        goto nla_put_failure;
 
     nlmsg_free(msg);
 
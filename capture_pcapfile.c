@@ -45,6 +45,13 @@
  * We parse additional options from the source definition itself, such as a DLT
  * override, once we open the protocol
  *
+ * Regular pcap and pcapng files are mapped into memory and walked block by block in
+ * place, instead of being copied through libpcap one packet at a time; the kernel is
+ * told the file is read sequentially, and the next chunk is requested ahead of the
+ * reader while the pages behind it are released.  Packets are sent with cf_send_data,
+ * which batches them when Kismet supports batched reports.  Anything which can't be
+ * mapped, like a fifo, is read with libpcap.
+ *
  */
 
 #include <pcap.h>
@@ -59,6 +66,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <unistd.h>
 #include <errno.h>
@@ -78,8 +86,156 @@ typedef struct {
     struct timeval last_ts;
 
     unsigned int pps_throttle;
+
+    /* Memory-mapped capture file, when it could be mapped */
+    uint8_t *map;
+    size_t map_len;
+    int map_format;
 } local_pcap_t;
 
+#define PCAPFILE_MAP_NONE       0
+#define PCAPFILE_MAP_PCAP       1
+#define PCAPFILE_MAP_PCAPNG     2
+
+/* Mapped files are prefetched and released in chunks of this size */
+#define PCAPFILE_MAP_CHUNK      (4 * 1024 * 1024)
+
+/* Largest packet we accept from a mapped file before calling it corrupt */
+#define PCAPFILE_MAP_MAX_PACKET (256 * 1024)
+
+#define PCAPNG_SHB_TYPE         0x0A0D0D0A
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_IDB_TYPE         0x00000001
+#define PCAPNG_PB_TYPE          0x00000002
+#define PCAPNG_SPB_TYPE         0x00000003
+#define PCAPNG_EPB_TYPE         0x00000006
+
+/* Interfaces of the current pcapng section */
+typedef struct {
+    int dlt;
+    /* Timestamp units per second, and offset in seconds */
+    uint64_t ts_units;
+    int64_t ts_offset;
+} pcapng_interface_t;
+
+void pcapfile_unmap(local_pcap_t *local_pcap) {
+    if (local_pcap->map != NULL)
+        munmap(local_pcap->map, local_pcap->map_len);
+
+    local_pcap->map = NULL;
+    local_pcap->map_len = 0;
+    local_pcap->map_format = PCAPFILE_MAP_NONE;
+}
+
+uint16_t pcapfile_get16(const uint8_t *p, int swapped) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped ? (uint16_t) ((v >> 8) | (v << 8)) : v;
+}
+
+uint32_t pcapfile_get32(const uint8_t *p, int swapped) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+
+    if (swapped)
+        v = ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v >> 8) & 0xFF00) | (v >> 24);
+
+    return v;
+}
+
+uint64_t pcapfile_get64(const uint8_t *p, int swapped) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+
+    if (swapped)
+        v = ((uint64_t) pcapfile_get32((const uint8_t *) &v, 1) << 32) |
+            pcapfile_get32((const uint8_t *) &v + 4, 1);
+
+    return v;
+}
+
+/* Map a regular pcap or pcapng file and find its link type; returns 1 when the file is
+ * mapped, or 0 to read it with libpcap */
+int pcapfile_map(local_pcap_t *local_pcap, const char *fname) {
+    struct stat sbuf;
+    int fd;
+    void *map;
+    uint32_t magic;
+
+    pcapfile_unmap(local_pcap);
+
+    if ((fd = open(fname, O_RDONLY)) < 0)
+        return 0;
+
+    if (fstat(fd, &sbuf) < 0 || !S_ISREG(sbuf.st_mode) || sbuf.st_size < 24 ||
+            (uint64_t) sbuf.st_size > (uint64_t) SIZE_MAX) {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return 0;
+
+    local_pcap->map = (uint8_t *) map;
+    local_pcap->map_len = sbuf.st_size;
+
+    memcpy(&magic, local_pcap->map, sizeof(magic));
+
+    if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 ||
+            magic == 0xa1b23c4d || magic == 0x4d3cb2a1) {
+        local_pcap->map_format = PCAPFILE_MAP_PCAP;
+        local_pcap->datalink_type =
+            pcapfile_get32(local_pcap->map + 20, magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) & 0x0FFFFFFF;
+    } else if (magic == PCAPNG_SHB_TYPE) {
+        size_t offt = 0;
+        int swapped = 0;
+
+        local_pcap->map_format = PCAPFILE_MAP_PCAPNG;
+        local_pcap->datalink_type = -1;
+
+        /* The source takes the link type of the first interface */
+        while (offt + 12 <= local_pcap->map_len) {
+            uint32_t block_type = pcapfile_get32(local_pcap->map + offt, 0);
+            uint32_t block_len;
+
+            if (block_type == PCAPNG_SHB_TYPE) {
+                swapped = pcapfile_get32(local_pcap->map + offt + 8, 0) != PCAPNG_BYTE_ORDER_MAGIC;
+            } else {
+                block_type = pcapfile_get32(local_pcap->map + offt, swapped);
+            }
+
+            block_len = pcapfile_get32(local_pcap->map + offt + 4, swapped);
+
+            if (block_len < 12 || block_len > local_pcap->map_len - offt)
+                break;
+
+            if (block_type == PCAPNG_IDB_TYPE && block_len >= 20) {
+                local_pcap->datalink_type = pcapfile_get16(local_pcap->map + offt + 8, swapped);
+                break;
+            }
+
+            offt += block_len;
+        }
+
+        if (local_pcap->datalink_type < 0) {
+            pcapfile_unmap(local_pcap);
+            return 0;
+        }
+    } else {
+        pcapfile_unmap(local_pcap);
+        return 0;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(local_pcap->map, local_pcap->map_len, MADV_SEQUENTIAL);
+#endif
+
+    return 1;
+}
+
 int probe_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         char *msg, char **uuid, KismetExternal__Command *frame,
         cf_params_interface_t **ret_interface, 
@@ -179,6 +335,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         local_pcap->pd = NULL;
     }
 
+    pcapfile_unmap(local_pcap);
+
     if ((placeholder_len = cf_parse_interface(&placeholder, definition)) <= 0) {
         /* What was not an error during probe definitely is an error during open */
         snprintf(msg, STATUS_MAX, "Unable to find PCAP file name in definition");
@@ -198,13 +356,16 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
      * open a fifo during probe and then cause a glitch, but we could open it during
      * normal operation */
 
-    local_pcap->pd = pcap_open_offline(pcapfname, errstr);
-    if (strlen(errstr) > 0) {
-        snprintf(msg, STATUS_MAX, "%s", errstr);
-        return -1;
+    if (!pcapfile_map(local_pcap, pcapfname)) {
+        local_pcap->pd = pcap_open_offline(pcapfname, errstr);
+        if (strlen(errstr) > 0) {
+            snprintf(msg, STATUS_MAX, "%s", errstr);
+            return -1;
+        }
+
+        local_pcap->datalink_type = pcap_datalink(local_pcap->pd);
     }
 
-    local_pcap->datalink_type = pcap_datalink(local_pcap->pd);
     *dlt = local_pcap->datalink_type;
 
     /* Kluge a UUID out of the name */
@@ -238,9 +399,10 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
     return 1;
 }
 
-void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
-        const u_char *data)  {
-    kis_capture_handler_t *caph = (kis_capture_handler_t *) user;
+/* Delay a packet for realtime or throttled playback, and send it; returns -1 if the
+ * packet could not be sent */
+int pcapfile_send_packet(kis_capture_handler_t *caph, struct timeval ts, int dlt,
+        uint32_t caplen, const uint8_t *data) {
     local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
     int ret;
     unsigned long delay_usec = 0;
@@ -256,23 +418,23 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
             delay_usec = 0;
         } else {
             /* Catch corrupt pcaps w/ inconsistent times */
-            if (header->ts.tv_sec < local_pcap->last_ts.tv_sec) {
+            if (ts.tv_sec < local_pcap->last_ts.tv_sec) {
                 delay_usec = 0;
             } else {
-                delay_usec = (header->ts.tv_sec - local_pcap->last_ts.tv_sec) * 1000000L;
+                delay_usec = (ts.tv_sec - local_pcap->last_ts.tv_sec) * 1000000L;
             }
 
-            if (header->ts.tv_usec < local_pcap->last_ts.tv_usec) {
+            if (ts.tv_usec < local_pcap->last_ts.tv_usec) {
                 delay_usec += (1000000L - local_pcap->last_ts.tv_usec) + 
-                    header->ts.tv_usec;
+                    ts.tv_usec;
             } else {
-                delay_usec += header->ts.tv_usec - local_pcap->last_ts.tv_usec;
+                delay_usec += ts.tv_usec - local_pcap->last_ts.tv_usec;
             }
 
         }
 
-        local_pcap->last_ts.tv_sec = header->ts.tv_sec;
-        local_pcap->last_ts.tv_usec = header->ts.tv_usec;
+        local_pcap->last_ts.tv_sec = ts.tv_sec;
+        local_pcap->last_ts.tv_usec = ts.tv_usec;
 
         if (delay_usec != 0) {
             usleep(delay_usec);
@@ -293,21 +455,263 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
     while (1) {
         if ((ret = cf_send_data(caph, 
                         NULL, NULL, NULL,
-                        header->ts, 
-                        local_pcap->datalink_type,
-                        header->caplen, (uint8_t *) data)) < 0) {
-            pcap_breakloop(local_pcap->pd);
+                        ts, dlt, caplen, (uint8_t *) data)) < 0) {
             cf_send_error(caph, 0, "unable to send DATA frame");
             cf_handler_spindown(caph);
+            return -1;
         } else if (ret == 0) {
             /* Go into a wait for the write buffer to get flushed */
-            // fprintf(stderr, "debug - pcapfile - dispatch_cb - no room in write buffer - waiting for it to have more space\n");
             cf_handler_wait_ringbuffer(caph);
             continue;
         } else {
             break;
         }
     }
+
+    return 1;
+}
+
+void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
+        const u_char *data)  {
+    kis_capture_handler_t *caph = (kis_capture_handler_t *) user;
+    local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
+
+    if (pcapfile_send_packet(caph, header->ts, local_pcap->datalink_type,
+                header->caplen, data) < 0)
+        pcap_breakloop(local_pcap->pd);
+}
+
+/* Keep the chunk after the read position coming in from disk, and drop the chunks
+ * behind it, so a large file doesn't fill memory */
+void pcapfile_map_advance(local_pcap_t *local_pcap, size_t offt, size_t *next_chunk) {
+    size_t chunk_start;
+
+    if (offt < *next_chunk)
+        return;
+
+    chunk_start = offt - (offt % PCAPFILE_MAP_CHUNK);
+    *next_chunk = chunk_start + PCAPFILE_MAP_CHUNK;
+
+#ifdef MADV_WILLNEED
+    if (*next_chunk < local_pcap->map_len) {
+        size_t len = local_pcap->map_len - *next_chunk;
+
+        if (len > PCAPFILE_MAP_CHUNK)
+            len = PCAPFILE_MAP_CHUNK;
+
+        madvise(local_pcap->map + *next_chunk, len, MADV_WILLNEED);
+    }
+#endif
+
+#ifdef MADV_DONTNEED
+    if (chunk_start >= PCAPFILE_MAP_CHUNK)
+        madvise(local_pcap->map + chunk_start - PCAPFILE_MAP_CHUNK, PCAPFILE_MAP_CHUNK, MADV_DONTNEED);
+#endif
+}
+
+/* Read a mapped pcap file; returns 1 at the end of the file, 0 if the file is corrupt,
+ * and -1 if a packet could not be sent */
+int pcapfile_map_read_pcap(kis_capture_handler_t *caph, char *errstr, size_t errstr_len) {
+    local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
+    uint32_t magic;
+    int swapped, nsec;
+    size_t offt = 24;
+    size_t next_chunk = 0;
+    struct timeval ts;
+    uint32_t caplen;
+
+    memcpy(&magic, local_pcap->map, sizeof(magic));
+    swapped = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    nsec = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+
+    while (offt + 16 <= local_pcap->map_len) {
+        pcapfile_map_advance(local_pcap, offt, &next_chunk);
+
+        ts.tv_sec = pcapfile_get32(local_pcap->map + offt, swapped);
+        ts.tv_usec = pcapfile_get32(local_pcap->map + offt + 4, swapped);
+        caplen = pcapfile_get32(local_pcap->map + offt + 8, swapped);
+
+        if (nsec)
+            ts.tv_usec /= 1000;
+
+        if (caplen > PCAPFILE_MAP_MAX_PACKET || caplen > local_pcap->map_len - offt - 16) {
+            snprintf(errstr, errstr_len, "corrupt packet record at offset %lu",
+                    (unsigned long) offt);
+            return 0;
+        }
+
+        if (pcapfile_send_packet(caph, ts, local_pcap->datalink_type, caplen,
+                    local_pcap->map + offt + 16) < 0)
+            return -1;
+
+        offt += 16 + caplen;
+    }
+
+    return 1;
+}
+
+/* Read a mapped pcapng file; returns as pcapfile_map_read_pcap */
+int pcapfile_map_read_pcapng(kis_capture_handler_t *caph, char *errstr, size_t errstr_len) {
+    local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
+    size_t offt = 0;
+    size_t next_chunk = 0;
+    int swapped = 0;
+    int ret = 1;
+
+    pcapng_interface_t *interfaces = NULL;
+    unsigned int num_interfaces = 0;
+
+    struct timeval ts = {0, 0};
+
+    while (offt + 12 <= local_pcap->map_len) {
+        const uint8_t *block = local_pcap->map + offt;
+        uint32_t block_type, block_len;
+
+        pcapfile_map_advance(local_pcap, offt, &next_chunk);
+
+        block_type = pcapfile_get32(block, 0);
+
+        if (block_type == PCAPNG_SHB_TYPE) {
+            uint32_t bom = pcapfile_get32(block + 8, 0);
+
+            if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+                swapped = 0;
+            } else if (pcapfile_get32(block + 8, 1) == PCAPNG_BYTE_ORDER_MAGIC) {
+                swapped = 1;
+            } else {
+                snprintf(errstr, errstr_len, "corrupt section header at offset %lu",
+                        (unsigned long) offt);
+                ret = 0;
+                break;
+            }
+
+            /* Interfaces are numbered within a section */
+            num_interfaces = 0;
+        } else {
+            block_type = pcapfile_get32(block, swapped);
+        }
+
+        block_len = pcapfile_get32(block + 4, swapped);
+
+        if (block_len < 12 || (block_len % 4) != 0 || block_len > local_pcap->map_len - offt) {
+            snprintf(errstr, errstr_len, "corrupt block at offset %lu", (unsigned long) offt);
+            ret = 0;
+            break;
+        }
+
+        if (block_type == PCAPNG_IDB_TYPE && block_len >= 20) {
+            pcapng_interface_t *intf;
+            size_t opt = 16;
+
+            intf = (pcapng_interface_t *) realloc(interfaces,
+                    sizeof(pcapng_interface_t) * (num_interfaces + 1));
+
+            if (intf == NULL) {
+                snprintf(errstr, errstr_len, "out of memory");
+                ret = 0;
+                break;
+            }
+
+            interfaces = intf;
+            intf = &interfaces[num_interfaces++];
+
+            intf->dlt = pcapfile_get16(block + 8, swapped);
+            intf->ts_units = 1000000;
+            intf->ts_offset = 0;
+
+            while (opt + 4 <= block_len - 4) {
+                uint16_t opt_code = pcapfile_get16(block + opt, swapped);
+                uint16_t opt_len = pcapfile_get16(block + opt + 2, swapped);
+
+                if (opt_code == 0 || opt + 4 + opt_len > block_len - 4)
+                    break;
+
+                if (opt_code == 9 && opt_len == 1) {
+                    /* if_tsresol, a power of 10, or of 2 with the high bit set */
+                    uint8_t res = block[opt + 4];
+                    unsigned int i;
+
+                    intf->ts_units = 1;
+
+                    if (res & 0x80) {
+                        intf->ts_units <<= (res & 0x7F) > 63 ? 63 : (res & 0x7F);
+                    } else {
+                        for (i = 0; i < res && i < 19; i++)
+                            intf->ts_units *= 10;
+                    }
+                } else if (opt_code == 14 && opt_len == 8) {
+                    /* if_tsoffset, in seconds */
+                    intf->ts_offset = (int64_t) pcapfile_get64(block + opt + 4, swapped);
+                }
+
+                opt += 4 + ((opt_len + 3) & ~3);
+            }
+        } else if ((block_type == PCAPNG_EPB_TYPE || block_type == PCAPNG_PB_TYPE) &&
+                block_len >= 32) {
+            uint32_t intf_num, caplen;
+            uint64_t ts_raw, ts_sec, ts_frac;
+            pcapng_interface_t *intf;
+
+            if (block_type == PCAPNG_EPB_TYPE)
+                intf_num = pcapfile_get32(block + 8, swapped);
+            else
+                intf_num = pcapfile_get16(block + 8, swapped);
+
+            caplen = pcapfile_get32(block + 20, swapped);
+
+            if (intf_num >= num_interfaces || caplen > PCAPFILE_MAP_MAX_PACKET ||
+                    caplen > block_len - 32) {
+                snprintf(errstr, errstr_len, "corrupt packet block at offset %lu",
+                        (unsigned long) offt);
+                ret = 0;
+                break;
+            }
+
+            intf = &interfaces[intf_num];
+
+            ts_raw = ((uint64_t) pcapfile_get32(block + 12, swapped) << 32) |
+                pcapfile_get32(block + 16, swapped);
+
+            ts_sec = ts_raw / intf->ts_units;
+            ts_frac = ts_raw % intf->ts_units;
+
+            ts.tv_sec = ts_sec + intf->ts_offset;
+
+            if (intf->ts_units == 1000000)
+                ts.tv_usec = ts_frac;
+            else
+                ts.tv_usec = (long) ((double) ts_frac * 1000000.0 / (double) intf->ts_units);
+
+            if (pcapfile_send_packet(caph, ts, intf->dlt, caplen, block + 28) < 0) {
+                ret = -1;
+                break;
+            }
+        } else if (block_type == PCAPNG_SPB_TYPE && block_len >= 16) {
+            uint32_t caplen = pcapfile_get32(block + 8, swapped);
+
+            /* Simple packets have no timestamp, so they take the last one seen */
+            if (caplen > block_len - 16)
+                caplen = block_len - 16;
+
+            if (num_interfaces == 0 || caplen > PCAPFILE_MAP_MAX_PACKET) {
+                snprintf(errstr, errstr_len, "corrupt packet block at offset %lu",
+                        (unsigned long) offt);
+                ret = 0;
+                break;
+            }
+
+            if (pcapfile_send_packet(caph, ts, interfaces[0].dlt, caplen, block + 12) < 0) {
+                ret = -1;
+                break;
+            }
+        }
+
+        offt += block_len;
+    }
+
+    free(interfaces);
+
+    return ret;
 }
 
 void capture_thread(kis_capture_handler_t *caph) {
@@ -315,15 +719,33 @@ void capture_thread(kis_capture_handler_t *caph) {
     char errstr[PCAP_ERRBUF_SIZE];
     char *pcap_errstr;
 
-    pcap_loop(local_pcap->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+    if (local_pcap->map != NULL) {
+        char maperr[PCAP_ERRBUF_SIZE] = "";
+        int r;
 
-    pcap_errstr = pcap_geterr(local_pcap->pd);
+        if (local_pcap->map_format == PCAPFILE_MAP_PCAPNG)
+            r = pcapfile_map_read_pcapng(caph, maperr, PCAP_ERRBUF_SIZE);
+        else
+            r = pcapfile_map_read_pcap(caph, maperr, PCAP_ERRBUF_SIZE);
 
-    snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
-            local_pcap->pcapfname, 
-            strlen(pcap_errstr) == 0 ? "end of pcapfile reached" : pcap_errstr );
+        if (r >= 0) {
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
+                    local_pcap->pcapfname, 
+                    r == 1 ? "end of pcapfile reached" : maperr);
 
-    cf_send_message(caph, errstr, MSGFLAG_INFO);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+        }
+    } else {
+        pcap_loop(local_pcap->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+
+        pcap_errstr = pcap_geterr(local_pcap->pd);
+
+        snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
+                local_pcap->pcapfname, 
+                strlen(pcap_errstr) == 0 ? "end of pcapfile reached" : pcap_errstr );
+
+        cf_send_message(caph, errstr, MSGFLAG_INFO);
+    }
 
     /* Instead of dying, spin forever in a sleep loop */
     while (1) {
@@ -343,6 +765,9 @@ int main(int argc, char *argv[]) {
         .last_ts.tv_sec = 0,
         .last_ts.tv_usec = 0,
         .pps_throttle = 0,
+        .map = NULL,
+        .map_len = 0,
+        .map_format = PCAPFILE_MAP_NONE,
     };
 
 #if 0
@@ -16,13 +16,14 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <algorithm>
+
 #include "util.h"
 
 #include "channeltracker2.h"
 #include "json_adapter.h"
 #include "devicetracker.h"
 #include "devicetracker_component.h"
-#include "devicetracker_view_workers.h"
 #include "packinfo_signal.h"
 
 channel_tracker_v2::channel_tracker_v2() :
@@ -34,6 +35,9 @@ channel_tracker_v2::channel_tracker_v2() :
     // after the last time we see it
     device_decay = 30;
 
+    decay_wheel.resize(device_decay + 1);
+    decay_wheel_time = 0;
+
     auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
 
     timetracker =
@@ -105,80 +109,128 @@ void channel_tracker_v2::trigger_deferred_startup() {
     gather_devices_event(0);
 }
 
-class channeltracker_v2_device_worker : public device_tracker_view_worker {
-public:
-    channeltracker_v2_device_worker(channel_tracker_v2 *channelv2) {
-        this->channelv2 = channelv2;
-        stime = time(0);
-    }
+int channel_tracker_v2::gather_devices_event(int event_id __attribute__((unused))) {
+    kis_lock_guard<kis_mutex> lk(lock, "channel_tracker_v2 gather_devices_event");
 
-    virtual ~channeltracker_v2_device_worker() { }
+    time_t now = Globalreg::globalreg->last_tv_sec;
 
-    // Count all the devices.  We use a filter worker but 'match' on all
-    // and count them into our local map
-    virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override {
-        auto freq = device->get_frequency();
-        if (freq == 0)
-            return false;
+    expire_device_activity(now);
 
-        auto i = device_count.find(freq);
+    for (const auto& i : device_counts) {
+        auto imi = frequency_map->find(i.first);
 
-        if (i != device_count.end()) {
-            if (device->get_last_time() > (stime - channelv2->device_decay))
-                i->second++;
+        if (imi == frequency_map->end()) {
+            auto freq_channel = entrytracker->get_shared_instance_as<channel_tracker_v2_channel>(channel_entry_id);
+            frequency_map->insert(i.first, freq_channel);
+            freq_channel->set_frequency(i.first);
+            freq_channel->get_device_rrd()->add_sample(i.second, now);
         } else {
-            if (device->get_last_time() > (stime - channelv2->device_decay))
-                device_count[freq] = 1;
-            else
-                device_count[freq] = 0;
+            auto freq_channel = static_cast<channel_tracker_v2_channel *>(imi->second.get());
+            freq_channel->get_device_rrd()->add_sample(i.second, now);
         }
+    }
 
-        return false;
+    return 1;
+}
+
+void channel_tracker_v2::update_device_activity(const std::shared_ptr<kis_tracked_device_base>& device) {
+    auto freq = device->get_frequency();
+    if (freq == 0)
+        return;
+
+    auto last_time = device->get_last_time();
+
+    auto ai = active_devices.find(device->get_key());
+
+    if (ai == active_devices.end()) {
+        if (last_time + device_decay <= decay_wheel_time)
+            return;
+
+        active_devices[device->get_key()] = device_activity{freq, last_time};
+        device_counts[freq]++;
+
+        decay_wheel[(last_time + device_decay) % decay_wheel.size()].push_back(device->get_key());
+
+        return;
     }
 
-    // Send it back to our channel tracker
-    virtual void finalize() override {
-        channelv2->update_device_counts(device_count, stime);
+    // Devices which change frequency move their count with them
+    if (ai->second.frequency != freq) {
+        device_counts[ai->second.frequency]--;
+        device_counts[freq]++;
+        ai->second.frequency = freq;
     }
 
-protected:
-    channel_tracker_v2 *channelv2;
+    if (last_time > ai->second.last_time)
+        ai->second.last_time = last_time;
+}
 
-    std::unordered_map<double, unsigned int> device_count;
+void channel_tracker_v2::expire_device_activity(time_t now) {
+    if (decay_wheel_time == 0 || now < decay_wheel_time)
+        decay_wheel_time = now - 1;
 
-    time_t stime;
-};
+    // A clock jump past the whole wheel only needs each slot once
+    if (now - decay_wheel_time > (time_t) decay_wheel.size())
+        decay_wheel_time = now - decay_wheel.size();
 
+    std::vector<device_key> slot;
 
-int channel_tracker_v2::gather_devices_event(int event_id __attribute__((unused))) {
-    channeltracker_v2_device_worker worker(this);
-    devicetracker->do_readonly_device_work(worker);
+    for (time_t t = decay_wheel_time + 1; t <= now; t++) {
+        slot.clear();
+        slot.swap(decay_wheel[t % decay_wheel.size()]);
 
-    return 1;
+        for (const auto& k : slot) {
+            auto ai = active_devices.find(k);
+
+            if (ai == active_devices.end())
+                continue;
+
+            // Seen again since it was filed; file it for its new expiry
+            auto expiry = std::min(ai->second.last_time, now) + device_decay;
+
+            if (expiry > now) {
+                decay_wheel[expiry % decay_wheel.size()].push_back(k);
+                continue;
+            }
+
+            device_counts[ai->second.frequency]--;
+            active_devices.erase(ai);
+        }
+    }
+
+    decay_wheel_time = now;
 }
 
-void channel_tracker_v2::update_device_counts(std::unordered_map<double, unsigned int> in_counts, time_t ts) {
-    kis_lock_guard<kis_mutex> lk(lock, "channel_tracker_v2 update_device_counts");
+std::map<std::string, channel_tracker_v2::channel_activity> channel_tracker_v2::get_channel_activity() {
+    kis_lock_guard<kis_mutex> lk(lock, "channel_tracker_v2 get_channel_activity");
 
-    frequency_map->clear();
+    std::map<std::string, channel_activity> ret;
 
-    for (const auto& i : in_counts) {
-        auto imi = frequency_map->find(i.first);
+    time_t now = Globalreg::globalreg->last_tv_sec;
 
-        // _MSG_DEBUG("Freq {} devices {}", i.first, i.second);
+    for (const auto& ci : *channel_map) {
+        auto chan = static_cast<channel_tracker_v2_channel *>(ci.second.get());
 
-        // Make a frequency
-        if (imi == frequency_map->end()) {
-            auto freq_channel = entrytracker->get_shared_instance_as<channel_tracker_v2_channel>(channel_entry_id);
-            frequency_map->insert(i.first, freq_channel);
-            freq_channel->set_frequency(i.first);
-            freq_channel->get_device_rrd()->add_sample(i.second, ts);
-        } else {
-            auto freq_channel = static_cast<channel_tracker_v2_channel *>(imi->second.get());
-            freq_channel->get_device_rrd()->add_sample(i.second, ts);
+        channel_activity act{0, 0};
+
+        // The per-second slots of the RRD are only current if we've seen something
+        // in the past minute
+        auto rrd = chan->get_packets_rrd();
+        if (now - rrd->get_last_time() < 60) {
+            for (const auto& s : *rrd->get_minute_vec())
+                act.packets += s;
         }
 
+        if (chan->get_frequency() != 0) {
+            auto di = device_counts.find(chan->get_frequency());
+            if (di != device_counts.end())
+                act.devices = di->second;
+        }
+
+        ret[ci.first] = act;
     }
+
+    return ret;
 }
 
 int channel_tracker_v2::packet_chain_handler(CHAINCALL_PARMS) {
@@ -188,6 +240,12 @@ int channel_tracker_v2::packet_chain_handler(CHAINCALL_PARMS) {
 
     auto l1info = in_pack->fetch<kis_layer1_packinfo>(cv2->pack_comp_l1data);
 	auto common = in_pack->fetch<kis_common_info>(cv2->pack_comp_common);
+    auto devinfo = in_pack->fetch<kis_tracked_device_info>(cv2->pack_comp_device);
+
+    if (devinfo != nullptr) {
+        for (const auto& d : devinfo->devrefs)
+            cv2->update_device_activity(d.second);
+    }
 
     // Nothing to do with no l1info
     if (l1info == nullptr)
@@ -231,6 +289,7 @@ int channel_tracker_v2::packet_chain_handler(CHAINCALL_PARMS) {
                     cv2->entrytracker->get_shared_instance_as<channel_tracker_v2_channel>(cv2->channel_entry_id);
 
                 chan_channel->set_channel(common->channel);
+                chan_channel->set_frequency(l1info->freq_khz);
                 cv2->channel_map->insert(common->channel, chan_channel);
 
                 chan_channel->get_signal_data()->append_signal(*l1info, false, 0);
@@ -243,6 +302,9 @@ int channel_tracker_v2::packet_chain_handler(CHAINCALL_PARMS) {
             } else {
                 auto chan_channel = static_cast<channel_tracker_v2_channel *>(smi->second.get());
 
+                if (chan_channel->get_frequency() == 0)
+                    chan_channel->set_frequency(l1info->freq_khz);
+
                 chan_channel->get_signal_data()->append_signal(*l1info, false, 0);
                 chan_channel->get_packets_rrd()->add_sample(1, Globalreg::globalreg->last_tv_sec);
 
@@ -24,6 +24,7 @@
 #include <map>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
@@ -152,9 +153,19 @@ public:
 
     virtual void trigger_deferred_startup() override;
 
-    // Update device counts - kept public so that the worker can access it
+    // Number of seconds a device counts as active on a frequency after we last saw it
     int device_decay;
-    void update_device_counts(std::unordered_map<double, unsigned int> in_counts, time_t in_ts);
+
+    // Recent activity on a named channel
+    struct channel_activity {
+        // Packets seen in the past minute
+        uint64_t packets;
+        // Devices currently active on the frequency of the channel
+        unsigned int devices;
+    };
+
+    // Activity of every named channel we've seen, used to plan channel hopping
+    std::map<std::string, channel_activity> get_channel_activity();
 
 protected:
     kis_mutex lock;
@@ -180,7 +191,29 @@ protected:
     int timer_id;
     int gather_devices_event(int event_id);
 
+    // Count a device seen in a packet as active on its current frequency
+    void update_device_activity(const std::shared_ptr<kis_tracked_device_base>& device);
+
+    // Expire devices which have gone quiet from the per-frequency counts
+    void expire_device_activity(time_t now);
+
+    // Active device count per frequency, kept current as packets are seen instead of
+    // by scanning every device each second
+    std::unordered_map<double, unsigned int> device_counts;
+
+    struct device_activity {
+        double frequency;
+        time_t last_time;
+    };
+
+    // Frequency and last activity of every device currently counted
+    robin_hood::unordered_flat_map<device_key, device_activity> active_devices;
 
+    // Timeout wheel of device_decay + 1 one-second slots; a device is filed in the
+    // slot of the second it would expire at.  Devices seen again since they were
+    // filed are re-filed when their slot comes up instead of on every packet.
+    std::vector<std::vector<device_key>> decay_wheel;
+    time_t decay_wheel_time;
 };
 
 #endif
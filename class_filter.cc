@@ -142,6 +142,8 @@ class_filter_mac_addr::class_filter_mac_addr(const std::string& in_id, const std
                 [this, seturl](std::shared_ptr<kis_net_beast_httpd_connection> con) {
                     return remove_endp_handler(con);
                 }, mutex));
+
+    build_filter_tables();
 }
 
 class_filter_mac_addr::~class_filter_mac_addr() {
@@ -149,9 +151,32 @@ class_filter_mac_addr::~class_filter_mac_addr() {
         eventbus->remove_listener(eb_id);
 }
 
+void class_filter_mac_addr::build_filter_tables() {
+    auto tables = std::make_shared<std::unordered_map<int, mac_filter_table>>();
+
+    for (const auto& pi : phy_mac_filter_map)
+        (*tables)[pi.first] = mac_filter_table(pi.second);
+
+    std::atomic_store(&phy_filter_tables,
+            std::shared_ptr<const std::unordered_map<int, mac_filter_table>>(tables));
+}
+
 void class_filter_mac_addr::set_filter(mac_addr in_mac, const std::string& in_phy, bool value) {
     kis_lock_guard<kis_mutex> lk(mutex, "class_filter_mac_addr set_filter");
 
+    set_filter_entry(in_mac, in_phy, value);
+    build_filter_tables();
+}
+
+void class_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& in_phy) {
+    kis_lock_guard<kis_mutex> lk(mutex, "class_filter_mac_addr remove_filter");
+
+    remove_filter_entry(in_mac, in_phy);
+    build_filter_tables();
+}
+
+void class_filter_mac_addr::set_filter_entry(mac_addr in_mac, const std::string& in_phy, bool value) {
+
     // Build the tracked version of the record, building any containers we need along the way, this
     // always gets built even for unknown phys
     auto tracked_phy_key = filter_phy_block->find(in_phy);
@@ -187,9 +212,7 @@ void class_filter_mac_addr::set_filter(mac_addr in_mac, const std::string& in_ph
     phy_mac_filter_map[phy->fetch_phy_id()][in_mac] = value;
 }
 
-void class_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& in_phy) {
-    kis_lock_guard<kis_mutex> lk(mutex, "class_filter_mac_addr remove_filter");
-
+void class_filter_mac_addr::remove_filter_entry(mac_addr in_mac, const std::string& in_phy) {
     // Remove it from the tracked version we display
     auto tracked_phy_key = filter_phy_block->find(in_phy);
     if (tracked_phy_key != filter_phy_block->end()) {
@@ -256,6 +279,8 @@ void class_filter_mac_addr::update_phy_map(std::shared_ptr<eventbus_event> evt)
 
     // Purge the unknown record
     unknown_phy_mac_filter_map.erase(unknown_key);
+
+    build_filter_tables();
 }
 
 void class_filter_mac_addr::edit_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
@@ -270,6 +295,10 @@ void class_filter_mac_addr::edit_endp_handler(std::shared_ptr<kis_net_beast_http
             return;
         }
 
+        // Check every address before changing any filter, then rebuild the filter tables
+        // once for the whole set, since a set may be a large block list
+        std::vector<std::pair<mac_addr, bool>> filters;
+
         for (const auto& i : filter.items()) {
             mac_addr m(i.key());
             bool v = i.value();
@@ -277,10 +306,16 @@ void class_filter_mac_addr::edit_endp_handler(std::shared_ptr<kis_net_beast_http
             if (m.state.error) 
                 throw std::runtime_error(fmt::format("Invalid MAC address: '{}'", con->escape_html(i.key())));
 
-            auto phy_k = con->uri_params().find(":phyname");
-            set_filter(m, phy_k->second, v);
+            filters.push_back(std::make_pair(m, v));
         }
 
+        auto phy_k = con->uri_params().find(":phyname");
+
+        for (const auto& f : filters)
+            set_filter_entry(f.first, phy_k->second, f.second);
+
+        build_filter_tables();
+
         stream << "Set filter\n";
         return;
     } catch (const std::exception& e) {
@@ -305,16 +340,24 @@ void class_filter_mac_addr::remove_endp_handler(std::shared_ptr<kis_net_beast_ht
             return;
         }
 
+        std::vector<mac_addr> filters;
+
         for (const auto& i : filter) {
             mac_addr m(i.get<std::string>());
 
             if (m.state.error) 
                 throw std::runtime_error(fmt::format("Invalid MAC address: '{}'", con->escape_html(i)));
 
-            auto phy_k = con->uri_params().find(":phyname");
-            remove_filter(m, phy_k->second);
+            filters.push_back(m);
         }
 
+        auto phy_k = con->uri_params().find(":phyname");
+
+        for (const auto& m : filters)
+            remove_filter_entry(m, phy_k->second);
+
+        build_filter_tables();
+
         stream << "Removed filter\n";
         return;
 
@@ -329,19 +372,19 @@ void class_filter_mac_addr::remove_endp_handler(std::shared_ptr<kis_net_beast_ht
 }
 
 bool class_filter_mac_addr::filter(mac_addr mac, unsigned int phy) {
-    kis_lock_guard<kis_mutex> lk(mutex, "class_filter_mac_addr filter");
+    auto tables = std::atomic_load(&phy_filter_tables);
 
-    auto pi = phy_mac_filter_map.find(phy);
+    auto pi = tables->find(phy);
 
-    if (pi == phy_mac_filter_map.end())
+    if (pi == tables->end())
         return get_filter_default();
 
-    auto si = pi->second.find(mac);
+    bool value;
 
-    if (si == pi->second.end())
+    if (!pi->second.find(mac, value))
         return get_filter_default();
 
-    return si->second;
+    return value;
 }
 
 std::shared_ptr<tracker_element_map> class_filter_mac_addr::self_endp_handler() {
@@ -24,6 +24,7 @@
 #include "trackedcomponent.h"
 #include "eventbus.h"
 #include "kis_net_beast_httpd.h"
+#include "mac_filter_table.h"
 
 // Common class-based filter mechanism which can be used in multiple locations;
 // implements basic default behavior and REST endpoints.
@@ -126,12 +127,24 @@ protected:
 	// Nested phy types
     int filter_sub_mac_id, filter_sub_value_id;
 
-	// Internal fast lookup tables per-phy we use for actual filtering
+	// Internal lookup tables per-phy the filter tables are built from
 	std::map<int, std::map<mac_addr, bool>> phy_mac_filter_map;
 
 	// Internal unknown phy map for filters registered before we had a phy ID
 	std::map<std::string, std::map<mac_addr, bool>> unknown_phy_mac_filter_map;
 
+    // Filter tables per-phy used for the actual filtering; rebuilt and swapped whenever
+    // the filters change, so filtering never takes the filter lock
+    std::shared_ptr<const std::unordered_map<int, mac_filter_table>> phy_filter_tables;
+
+    // Rebuild the filter tables; must be called under the filter lock
+    void build_filter_tables();
+
+    // Set or remove a filter without rebuilding the filter tables; must be called under
+    // the filter lock
+    void set_filter_entry(mac_addr in_mac, const std::string& in_phy, bool value);
+    void remove_filter_entry(mac_addr in_mac, const std::string& in_phy);
+
     // Address management endpoint keyed on path
     void edit_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
     void remove_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
@@ -0,0 +1,365 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <type_traits>
+#include <unordered_map>
+
+#include "columnar_adapter.h"
+#include "entrytracker.h"
+#include "json_adapter.h"
+#include "kis_mem_account.h"
+
+namespace {
+
+using columnar_adapter::column_type;
+
+template<typename T>
+void append_le(std::string& out, T v) {
+    using bits_t = typename std::conditional<sizeof(T) == 1, uint8_t,
+          typename std::conditional<sizeof(T) == 2, uint16_t,
+          typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type;
+
+    bits_t u;
+    memcpy(&u, &v, sizeof(T));
+
+    for (size_t i = 0; i < sizeof(T); i++)
+        out.push_back(static_cast<char>((static_cast<uint64_t>(u) >> (8 * i)) & 0xFF));
+}
+
+void append_str(std::string& out, const std::string& s) {
+    append_le<uint32_t>(out, s.length());
+    out.append(s);
+}
+
+// Column type for a (non-alias) element
+column_type element_column_type(const shared_tracker_element& e) {
+    switch (e->get_type()) {
+        case tracker_type::tracker_uint8:
+            return column_type::col_uint8;
+        case tracker_type::tracker_int8:
+            return column_type::col_int8;
+        case tracker_type::tracker_uint16:
+            return column_type::col_uint16;
+        case tracker_type::tracker_int16:
+            return column_type::col_int16;
+        case tracker_type::tracker_uint32:
+            return column_type::col_uint32;
+        case tracker_type::tracker_int32:
+            return column_type::col_int32;
+        case tracker_type::tracker_uint64:
+            return column_type::col_uint64;
+        case tracker_type::tracker_int64:
+            return column_type::col_int64;
+        case tracker_type::tracker_float:
+            return column_type::col_float;
+        case tracker_type::tracker_double:
+            return column_type::col_double;
+        default:
+            break;
+    }
+
+    if (e->is_stringable())
+        return column_type::col_string;
+
+    return column_type::col_json;
+}
+
+template<class E>
+typename std::remove_reference<decltype(std::declval<E>().get())>::type numeric_value(const shared_tracker_element& e) {
+    return static_cast<E *>(e.get())->get();
+}
+
+class table_builder {
+public:
+    table_builder(std::shared_ptr<tracker_element_serializer::rename_map> name_map) :
+        name_map{name_map},
+        n_rows{0},
+        acct{kis_mem_account::fetch_counter("serializer", "columnar table")},
+        acct_bytes{0} {
+
+        if (acct != nullptr)
+            acct->add(0);
+    }
+
+    ~table_builder() {
+        if (acct != nullptr)
+            acct->remove(acct_bytes);
+    }
+
+    void add_row(shared_tracker_element row) {
+        if (row == nullptr)
+            return;
+
+        serializer_scope s(row, name_map);
+
+        if (row->get_type() == tracker_type::tracker_alias) {
+            row = static_cast<tracker_element_alias *>(row.get())->get();
+
+            if (row == nullptr)
+                return;
+        }
+
+        switch (row->get_type()) {
+            case tracker_type::tracker_summary_mapvec:
+                for (const auto& i : *static_cast<tracker_element_mapvec *>(row.get()))
+                    add_field_cell(i);
+                break;
+            case tracker_type::tracker_map:
+                static_cast<tracker_element_map *>(row.get())->for_each_field([this](const auto& i) {
+                        add_field_cell(i.second);
+                    });
+                break;
+            case tracker_type::tracker_string_map:
+                for (const auto& i : *static_cast<tracker_element_string_map *>(row.get()))
+                    add_named_cell(i.first, i.second);
+                break;
+            default:
+                // Already in the scope of the row
+                add_value(column_for("value", element_column_type(row)), row);
+                break;
+        }
+
+        n_rows++;
+
+        if (n_rows % 1024 == 0)
+            update_accounting();
+    }
+
+    void write(std::ostream& stream) {
+        update_accounting();
+
+        std::string header{"KCOL"};
+        header.push_back(1);
+        header.append(3, 0);
+        append_le<uint32_t>(header, n_rows);
+        append_le<uint32_t>(header, columns.size());
+        stream.write(header.data(), header.length());
+
+        for (auto& c : columns) {
+            auto name = c.name.substr(0, 65535);
+
+            c.present.resize((n_rows + 7) / 8, 0);
+
+            std::string col_header;
+            append_le<uint16_t>(col_header, name.length());
+            col_header.append(name);
+            col_header.push_back(static_cast<char>(c.type));
+            append_le<uint32_t>(col_header, c.present.size() + c.data.length());
+
+            stream.write(col_header.data(), col_header.length());
+            stream.write(reinterpret_cast<const char *>(c.present.data()), c.present.size());
+            stream.write(c.data.data(), c.data.length());
+        }
+    }
+
+protected:
+    struct column {
+        std::string name;
+        column_type type;
+        std::vector<uint8_t> present;
+        std::string data;
+    };
+
+    column& column_for(const std::string& name, column_type type) {
+        auto k = named_columns.find(std::make_pair(name, type));
+
+        if (k != named_columns.end())
+            return columns[k->second];
+
+        columns.push_back(column{name, type, {}, {}});
+        named_columns[std::make_pair(name, type)] = columns.size() - 1;
+
+        return columns.back();
+    }
+
+    // Cells of field-keyed records; unrenamed fields are resolved by id so that the
+    // name is only looked up once per column
+    void add_field_cell(const shared_tracker_element& cell) {
+        if (cell == nullptr)
+            return;
+
+        if (name_map != nullptr) {
+            auto nmi = name_map->find(cell);
+            if (nmi != name_map->end() && nmi->second->rename.length() != 0) {
+                add_named_cell(nmi->second->rename, cell);
+                return;
+            }
+        }
+
+        if (cell->get_type() == tracker_type::tracker_placeholder_missing)
+            return;
+
+        if (cell->get_type() == tracker_type::tracker_alias) {
+            auto alias_name = static_cast<tracker_element_alias *>(cell.get())->get_alias_name();
+
+            if (alias_name.length() == 0)
+                alias_name = Globalreg::globalreg->entrytracker->get_field_name(cell->get_id());
+
+            add_named_cell(alias_name, cell);
+            return;
+        }
+
+        auto type = element_column_type(cell);
+        auto id_key = (static_cast<uint64_t>(static_cast<uint32_t>(cell->get_id())) << 8) |
+            static_cast<uint8_t>(type);
+
+        auto k = id_columns.find(id_key);
+
+        if (k == id_columns.end()) {
+            auto& c = column_for(Globalreg::globalreg->entrytracker->get_field_name(cell->get_id()), type);
+            k = id_columns.emplace(id_key, &c - columns.data()).first;
+        }
+
+        add_scoped_value(columns[k->second], cell);
+    }
+
+    void add_named_cell(const std::string& name, shared_tracker_element cell) {
+        if (cell == nullptr)
+            return;
+
+        if (cell->get_type() == tracker_type::tracker_placeholder_missing)
+            return;
+
+        auto target = cell;
+
+        if (target->get_type() == tracker_type::tracker_alias) {
+            target = static_cast<tracker_element_alias *>(target.get())->get();
+
+            if (target == nullptr || target->get_type() == tracker_type::tracker_placeholder_missing)
+                return;
+        }
+
+        add_scoped_value(column_for(name, element_column_type(target)), cell);
+    }
+
+    void add_scoped_value(column& c, const shared_tracker_element& cell) {
+        // The JSON packer manages the serialization scope itself
+        if (c.type == column_type::col_json) {
+            add_value(c, cell);
+            return;
+        }
+
+        serializer_scope s(cell, name_map);
+        add_value(c, cell);
+    }
+
+    void add_value(column& c, shared_tracker_element e) {
+        if (c.type != column_type::col_json && e->get_type() == tracker_type::tracker_alias)
+            e = static_cast<tracker_element_alias *>(e.get())->get();
+
+        if (c.present.size() <= n_rows / 8)
+            c.present.resize((n_rows / 8) + 1, 0);
+        c.present[n_rows / 8] |= (1 << (n_rows % 8));
+
+        switch (c.type) {
+            case column_type::col_uint8:
+                append_le(c.data, numeric_value<tracker_element_uint8>(e));
+                break;
+            case column_type::col_int8:
+                append_le(c.data, numeric_value<tracker_element_int8>(e));
+                break;
+            case column_type::col_uint16:
+                append_le(c.data, numeric_value<tracker_element_uint16>(e));
+                break;
+            case column_type::col_int16:
+                append_le(c.data, numeric_value<tracker_element_int16>(e));
+                break;
+            case column_type::col_uint32:
+                append_le(c.data, numeric_value<tracker_element_uint32>(e));
+                break;
+            case column_type::col_int32:
+                append_le(c.data, numeric_value<tracker_element_int32>(e));
+                break;
+            case column_type::col_uint64:
+                append_le(c.data, numeric_value<tracker_element_uint64>(e));
+                break;
+            case column_type::col_int64:
+                append_le(c.data, numeric_value<tracker_element_int64>(e));
+                break;
+            case column_type::col_float:
+                append_le(c.data, numeric_value<tracker_element_float>(e));
+                break;
+            case column_type::col_double:
+                append_le(c.data, numeric_value<tracker_element_double>(e));
+                break;
+            case column_type::col_string:
+                append_str(c.data, e->as_string());
+                break;
+            case column_type::col_json: {
+                std::stringstream ss;
+                json_adapter::pack(ss, e, name_map);
+                append_str(c.data, ss.str());
+                break;
+            }
+        }
+    }
+
+    // Column buffers are accounted as the table grows, when accounting is enabled
+    void update_accounting() {
+        if (acct == nullptr)
+            return;
+
+        int64_t sz = 0;
+
+        for (const auto& c : columns)
+            sz += sizeof(column) + c.name.capacity() + c.present.capacity() + c.data.capacity();
+
+        acct->resize(sz - acct_bytes);
+        acct_bytes = sz;
+    }
+
+    std::shared_ptr<tracker_element_serializer::rename_map> name_map;
+
+    uint32_t n_rows;
+
+    kis_mem_counter *acct;
+    int64_t acct_bytes;
+
+    std::vector<column> columns;
+    std::map<std::pair<std::string, column_type>, size_t> named_columns;
+    std::unordered_map<uint64_t, size_t> id_columns;
+};
+
+}
+
+int columnar_adapter::serializer::serialize(shared_tracker_element in_elem, std::ostream &stream,
+        std::shared_ptr<rename_map> name_map) {
+    table_builder table(name_map);
+
+    if (in_elem == nullptr) {
+        table.write(stream);
+        return 0;
+    }
+
+    if (in_elem->get_type() == tracker_type::tracker_vector) {
+        for (const auto& i : *(std::static_pointer_cast<tracker_element_vector>(in_elem)))
+            table.add_row(i);
+    } else {
+        table.add_row(in_elem);
+    }
+
+    table.write(stream);
+
+    return 0;
+}
+
@@ -0,0 +1,93 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __COLUMNAR_ADAPTER_H__
+#define __COLUMNAR_ADAPTER_H__
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "trackedelement.h"
+
+// Binary columnar serialization adapter, intended for bulk exports of summarized
+// records such as the device lists, where the per-object keys of JSON make up most
+// of the output.
+//
+// A top-level vector is serialized as a table with one row per element; any other
+// element is serialized as a table of a single row.  Field maps (including summarized
+// records) and string maps contribute one column per field; any other row is a single
+// column named 'value'.
+//
+// All integers are little-endian.  The output is:
+//
+//   "KCOL"            magic
+//   uint8_t           version (1)
+//   uint8_t[3]        reserved
+//   uint32_t          number of rows
+//   uint32_t          number of columns
+//
+// followed by each column:
+//
+//   uint16_t          name length
+//   char[]            name (the renamed name, if the field was renamed in the summary)
+//   uint8_t           column type, from column_type
+//   uint32_t          column data length, so unknown columns can be skipped
+//   uint8_t[]         presence bitmap, (rows + 7) / 8 bytes, row N in bit (N % 8) of byte
+//                     (N / 8); missing fields and placeholders are not present
+//   ...               values of the present rows, in row order
+//
+// Numeric values are stored at their native width; float and double are IEEE754.
+// String values (including MAC addresses, UUIDs, and keys, in their normal text form)
+// are a uint32_t length followed by the bytes.  Complex values such as nested maps are
+// stored the same way as strings, holding the JSON serialization of the value.
+//
+// A field which holds different types across rows generates a column for each type.
+namespace columnar_adapter {
+
+enum class column_type : uint8_t {
+    col_uint8 = 1,
+    col_int8 = 2,
+    col_uint16 = 3,
+    col_int16 = 4,
+    col_uint32 = 5,
+    col_int32 = 6,
+    col_uint64 = 7,
+    col_int64 = 8,
+    col_float = 9,
+    col_double = 10,
+
+    col_string = 16,
+    col_json = 17,
+};
+
+class serializer : public tracker_element_serializer {
+public:
+    serializer() :
+        tracker_element_serializer() { }
+
+    virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
+            std::shared_ptr<rename_map> name_map = nullptr) override;
+};
+
+}
+
+#endif
+
@@ -538,8 +538,215 @@ uint32_t crc32_16bytes_prefetch(const void* data, size_t length, uint32_t previo
 #endif
 
 
-/// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
-uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
+// hardware CRC32 kernels, selected at runtime by crc32_fast
+//
+// - x86-64: PCLMULQDQ folding of 64 byte blocks, per Intel's "Fast CRC Computation
+//   for Generic Polynomials Using PCLMULQDQ Instruction" (as used by zlib and Linux)
+// - ARMv8:  the CRC32 instructions, which implement this polynomial directly
+//
+// both produce the same CRC as the table-driven algorithms above
+static uint32_t crc32_table_fast(const void* data, size_t length, uint32_t previousCrc32);
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32_HW_PCLMUL
+#include <immintrin.h>
+
+namespace
+{
+  /// fold constants for the reflected polynomial
+  alignas(16) const uint64_t PclmulK1K2[2] = { 0x0154442bd4, 0x01c6e41596 };
+  alignas(16) const uint64_t PclmulK3K4[2] = { 0x01751997d0, 0x00ccaa009e };
+  alignas(16) const uint64_t PclmulK5K0[2] = { 0x0163cd6124, 0x0000000000 };
+  alignas(16) const uint64_t PclmulPoly[2] = { 0x01db710641, 0x01f7011641 };
+
+  /// fold a buffer of at least 64 bytes (and a multiple of 16) into the raw crc register
+  __attribute__((target("pclmul,sse4.1")))
+  uint32_t crc32_pclmul_fold(const uint8_t* buf, size_t len, uint32_t crc)
+  {
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*) (buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*) (buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*) (buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*) (buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+
+    x0 = _mm_load_si128((const __m128i*) PclmulK1K2);
+
+    buf += 64;
+    len -= 64;
+
+    // fold 4 blocks of 128 bits at a time
+    while (len >= 64)
+    {
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+      x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+      x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+      x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+      x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+      y5 = _mm_loadu_si128((const __m128i*) (buf + 0x00));
+      y6 = _mm_loadu_si128((const __m128i*) (buf + 0x10));
+      y7 = _mm_loadu_si128((const __m128i*) (buf + 0x20));
+      y8 = _mm_loadu_si128((const __m128i*) (buf + 0x30));
+
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+      x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+      x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+      x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+      buf += 64;
+      len -= 64;
+    }
+
+    // fold the 4 blocks into one
+    x0 = _mm_load_si128((const __m128i*) PclmulK3K4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // fold any remaining single blocks
+    while (len >= 16)
+    {
+      x2 = _mm_loadu_si128((const __m128i*) buf);
+
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+      buf += 16;
+      len -= 16;
+    }
+
+    // fold 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*) PclmulK5K0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*) PclmulPoly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+  }
+
+  uint32_t crc32_pclmul(const void* data, size_t length, uint32_t previousCrc32)
+  {
+    // short buffers aren't worth setting up the folding for
+    if (length < 64)
+      return crc32_table_fast(data, length, previousCrc32);
+
+    const uint8_t* current = (const uint8_t*) data;
+    size_t folded = length & ~(size_t) 15;
+
+    uint32_t crc = ~crc32_pclmul_fold(current, folded, ~previousCrc32);
+
+    return crc32_table_fast(current + folded, length - folded, crc);
+  }
+
+  bool crc32_pclmul_available()
+  {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  }
+}
+#endif
+
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__)) && \
+  (defined(__linux__) || defined(__APPLE__))
+#define CRC32_HW_ARMV8
+#include <string.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+namespace
+{
+  // the instructions are emitted directly so the rest of the build doesn't need to
+  // target a CPU with the CRC extension
+  inline uint32_t crc32_armv8_byte(uint32_t crc, uint8_t value)
+  {
+    __asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1" : "+r"(crc) : "r"(value));
+    return crc;
+  }
+
+  inline uint32_t crc32_armv8_dword(uint32_t crc, uint64_t value)
+  {
+    __asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %x1" : "+r"(crc) : "r"(value));
+    return crc;
+  }
+
+  uint32_t crc32_armv8(const void* data, size_t length, uint32_t previousCrc32)
+  {
+    uint32_t crc = ~previousCrc32;
+    const uint8_t* current = (const uint8_t*) data;
+
+    // align to 8 bytes
+    while (length > 0 && ((uintptr_t) current & 7) != 0)
+    {
+      crc = crc32_armv8_byte(crc, *current++);
+      length--;
+    }
+
+    while (length >= 8)
+    {
+      uint64_t value;
+      memcpy(&value, current, 8);
+      crc = crc32_armv8_dword(crc, value);
+      current += 8;
+      length  -= 8;
+    }
+
+    while (length-- != 0)
+      crc = crc32_armv8_byte(crc, *current++);
+
+    return ~crc;
+  }
+
+  bool crc32_armv8_available()
+  {
+#ifdef __linux__
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    // every Apple ARM CPU has the CRC extension
+    return true;
+#endif
+  }
+}
+#endif
+
+/// compute CRC32 using the table-driven algorithm selected by flags (CRC32_USE_LOOKUP_...)
+static uint32_t crc32_table_fast(const void* data, size_t length, uint32_t previousCrc32)
 {
 #ifdef CRC32_USE_LOOKUP_TABLE_SLICING_BY_16
   return crc32_16bytes (data, length, previousCrc32);
@@ -555,6 +762,49 @@ uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
 }
 
 
+/// pick the fastest CRC32 this CPU supports
+static uint32_t (*crc32_select())(const void*, size_t, uint32_t)
+{
+#ifdef CRC32_HW_PCLMUL
+  if (crc32_pclmul_available())
+    return crc32_pclmul;
+#endif
+
+#ifdef CRC32_HW_ARMV8
+  if (crc32_armv8_available())
+    return crc32_armv8;
+#endif
+
+  return crc32_table_fast;
+}
+
+
+/// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
+uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
+{
+  static uint32_t (* const crc32_impl)(const void*, size_t, uint32_t) = crc32_select();
+
+  return crc32_impl(data, length, previousCrc32);
+}
+
+
+/// name of the algorithm used by crc32_fast
+const char* crc32_fast_name()
+{
+#ifdef CRC32_HW_PCLMUL
+  if (crc32_pclmul_available())
+    return "pclmul";
+#endif
+
+#ifdef CRC32_HW_ARMV8
+  if (crc32_armv8_available())
+    return "armv8-crc";
+#endif
+
+  return "table";
+}
+
+
 /// merge two CRC32 such that result = crc32(dataB, lengthB, crc32(dataA, lengthA))
 uint32_t crc32_combine(uint32_t crcA, uint32_t crcB, size_t lengthB)
 {
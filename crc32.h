@@ -39,9 +39,13 @@
 // size_t
 #include <cstddef>
 
-// crc32_fast selects the fastest algorithm depending on flags (CRC32_USE_LOOKUP_...)
+// crc32_fast selects the CRC32 instructions of the CPU when it has them (PCLMULQDQ on
+// x86-64, the CRC extension on ARMv8), and otherwise the fastest table algorithm
+// depending on flags (CRC32_USE_LOOKUP_...)
 /// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
 uint32_t crc32_fast    (const void* data, size_t length, uint32_t previousCrc32 = 0);
+/// name of the algorithm crc32_fast uses on this CPU
+const char* crc32_fast_name();
 
 /// merge two CRC32 such that result = crc32(dataB, lengthB, crc32(dataA, lengthA))
 uint32_t crc32_combine (uint32_t crcA, uint32_t crcB, size_t lengthB);
@@ -0,0 +1,317 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "adsb_modes.h"
+#include "datasource_beast.h"
+#include "messagebus.h"
+#include "packetchain.h"
+#include "util.h"
+
+#define BEAST_DEFAULT_PORT          30005
+
+#define BEAST_ESCAPE                0x1a
+#define BEAST_TYPE_MODEAC           '1'
+#define BEAST_TYPE_MODES_SHORT      '2'
+#define BEAST_TYPE_MODES_LONG       '3'
+
+// 6 bytes of MLAT timestamp and 1 byte of signal level lead every frame
+#define BEAST_HEADER_LEN            7
+
+kis_datasource_beast::kis_datasource_beast(shared_datasource_builder in_builder) :
+    kis_datasource(in_builder),
+    stopping{false},
+    frame_escape{false},
+    frame_type{0},
+    frame_len{0} {
+
+    // We don't have a capture binary, the feed is read in-process
+    set_int_source_hardware("beast");
+
+    pack_comp_adsb = packetchain->register_packet_component("ADSB");
+
+    frame_buf.reserve(BEAST_HEADER_LEN + ADSB_MODES_LONG_LEN);
+}
+
+kis_datasource_beast::~kis_datasource_beast() {
+    stop_feed();
+}
+
+void kis_datasource_beast::open_interface(std::string in_definition, unsigned int in_transaction,
+        open_callback_t in_cb) {
+    stop_feed();
+
+    kis_unique_lock<kis_mutex> lock(ext_mutex, "beast open_interface");
+
+    if (in_transaction == 0)
+        in_transaction = next_transaction++;
+
+    lock.unlock();
+
+    auto fail = [&](const std::string& reason) {
+        set_int_source_error(true);
+        set_int_source_error_reason(reason);
+
+        if (in_cb != nullptr)
+            in_cb(in_transaction, false, reason);
+    };
+
+    set_int_source_definition(in_definition);
+
+    if (!parse_source_definition(in_definition)) {
+        fail("Malformed source config");
+        return;
+    }
+
+    auto host = get_source_interface();
+    unsigned int port = BEAST_DEFAULT_PORT;
+
+    if (get_definition_opt("port") != "" &&
+            (sscanf(get_definition_opt("port").c_str(), "%u", &port) != 1 ||
+             port == 0 || port > 65535)) {
+        fail(fmt::format("Invalid Beast port '{}'", get_definition_opt("port")));
+        return;
+    }
+
+    set_int_source_cap_interface(fmt::format("{}:{}", host, port));
+
+    struct addrinfo hints;
+    struct addrinfo *result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    auto r = getaddrinfo(host.c_str(), fmt::format("{}", port).c_str(), &hints, &result);
+
+    if (r != 0) {
+        fail(fmt::format("Unable to resolve Beast host '{}': {}", host, gai_strerror(r)));
+        return;
+    }
+
+    int fd = -1;
+    std::string error;
+
+    for (auto ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+
+        if (fd < 0) {
+            error = kis_strerror_r(errno);
+            continue;
+        }
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+
+        error = kis_strerror_r(errno);
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        fail(fmt::format("Unable to connect to Beast feed {}:{}: {}", host, port, error));
+        return;
+    }
+
+    // Derive a consistent UUID from the feed address
+    if (!local_uuid) {
+        auto uuidstr = fmt::format("{:08X}-0000-0000-0000-0000{:08X}",
+                adler32_checksum("kismet_beast"),
+                adler32_checksum(fmt::format("{}:{}", host, port)));
+        uuid u(uuidstr);
+
+        set_source_uuid(u);
+        set_source_key(adler32_checksum(u.uuid_to_string()));
+    }
+
+    set_int_source_retry_attempts(0);
+    set_int_source_error(false);
+    set_int_source_error_reason("");
+    set_int_source_running(true);
+
+    _MSG_INFO("Reading Mode-S Beast feed from {}:{}", host, port);
+
+    stopping = false;
+    frame_escape = false;
+    frame_len = 0;
+    frame_buf.clear();
+
+    feed = std::thread([this, fd]() {
+            thread_set_process_name("BEAST");
+            feed_thread(fd);
+        });
+
+    if (in_cb != nullptr)
+        in_cb(in_transaction, true, "Source opened");
+}
+
+void kis_datasource_beast::close_external_impl() {
+    stop_feed();
+    kis_datasource::close_external_impl();
+}
+
+void kis_datasource_beast::stop_feed() {
+    stopping = true;
+
+    if (feed.joinable()) {
+        if (feed.get_id() == std::this_thread::get_id())
+            feed.detach();
+        else
+            feed.join();
+    }
+}
+
+void kis_datasource_beast::feed_thread(int in_fd) {
+    uint8_t buf[8192];
+    std::string error;
+
+    while (!stopping) {
+        struct pollfd pfd;
+
+        pfd.fd = in_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        // Wake up periodically to see if we've been closed
+        auto r = poll(&pfd, 1, 500);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            error = kis_strerror_r(errno);
+            break;
+        }
+
+        if (r == 0)
+            continue;
+
+        auto len = recv(in_fd, buf, sizeof(buf), 0);
+
+        if (len < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            error = kis_strerror_r(errno);
+            break;
+        }
+
+        if (len == 0) {
+            error = "connection closed";
+            break;
+        }
+
+        parse_feed(buf, len);
+    }
+
+    close(in_fd);
+
+    if (stopping)
+        return;
+
+    // Let the datasource retry reconnect us
+    handle_error(fmt::format("Beast feed {} disconnected: {}", get_source_cap_interface(), error));
+}
+
+void kis_datasource_beast::parse_feed(const uint8_t *in_data, size_t in_len) {
+    for (size_t i = 0; i < in_len; i++) {
+        auto c = in_data[i];
+
+        if (frame_escape) {
+            frame_escape = false;
+
+            if (c != BEAST_ESCAPE) {
+                // An escape followed by anything else starts a new frame; frames we
+                // don't know the length of are skipped up to the next one
+                frame_type = c;
+                frame_buf.clear();
+
+                if (c == BEAST_TYPE_MODEAC)
+                    frame_len = BEAST_HEADER_LEN + 2;
+                else if (c == BEAST_TYPE_MODES_SHORT)
+                    frame_len = BEAST_HEADER_LEN + ADSB_MODES_SHORT_LEN;
+                else if (c == BEAST_TYPE_MODES_LONG)
+                    frame_len = BEAST_HEADER_LEN + ADSB_MODES_LONG_LEN;
+                else
+                    frame_len = 0;
+
+                continue;
+            }
+        } else if (c == BEAST_ESCAPE) {
+            frame_escape = true;
+            continue;
+        }
+
+        if (frame_len == 0)
+            continue;
+
+        frame_buf.push_back(c);
+
+        if (frame_buf.size() == frame_len) {
+            handle_frame(frame_type, frame_buf.data(), frame_buf.size());
+            frame_len = 0;
+        }
+    }
+}
+
+void kis_datasource_beast::handle_frame(uint8_t in_type, const uint8_t *in_data, size_t in_len) {
+    if (in_type != BEAST_TYPE_MODES_SHORT && in_type != BEAST_TYPE_MODES_LONG)
+        return;
+
+    auto adsbinfo = std::make_shared<kis_adsb_packinfo>();
+
+    adsbinfo->set_frame(in_data + BEAST_HEADER_LEN, in_len - BEAST_HEADER_LEN);
+
+    // Frames which fail their CRC are noise, don't send them down the chain
+    if (!adsb_modes_decode(adsbinfo->frame, adsbinfo->len, adsbinfo->msg))
+        return;
+
+    auto packet = packetchain->generate_packet();
+    gettimeofday(&(packet->ts), NULL);
+
+    packet->insert(pack_comp_adsb, adsbinfo);
+
+    // Signal is the square root of the power, scaled to 255
+    auto signal = in_data[BEAST_HEADER_LEN - 1];
+
+    if (signal > 0) {
+        auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+
+        l1info->signal_type = kis_l1_signal_type_dbm;
+        l1info->signal_dbm = 20 * log10(signal / 255.0);
+        l1info->freq_khz = 1090000;
+
+        packet->insert(pack_comp_l1info, l1info);
+    }
+
+    handle_rx_packet(packet);
+}
@@ -0,0 +1,125 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DATASOURCE_BEAST_H__
+#define __DATASOURCE_BEAST_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "kis_datasource.h"
+
+class kis_datasource_beast;
+typedef std::shared_ptr<kis_datasource_beast> shared_datasource_beast;
+
+// In-process client for the Beast binary output of dump1090, readsb, and similar
+// Mode-S receivers.
+//
+// Frames are read from the feed in a thread of the server and decoded directly into an
+// ADSB packet component, without a capture binary or a JSON record in between.  Mode-S
+// short and long frames are decoded; Mode-A/C replies and status frames are skipped.
+//
+// The interface is the host running the receiver, and 'port=' selects the Beast output
+// port if it isn't the default of 30005:
+//
+//    source=127.0.0.1:type=beast
+//    source=adsb.local:type=beast,port=30105,name=roof
+//
+// If the feed disconnects the source reports an error and is re-opened by the normal
+// datasource retry.
+class kis_datasource_beast : public kis_datasource {
+public:
+    kis_datasource_beast(shared_datasource_builder in_builder);
+    virtual ~kis_datasource_beast();
+
+    virtual void open_interface(std::string in_definition, unsigned int in_transaction,
+            open_callback_t in_cb) override;
+
+protected:
+    virtual void close_external_impl() override;
+
+    void stop_feed();
+
+    void feed_thread(int in_fd);
+
+    // Unescape and split the Beast stream into frames; partial frames are kept for the
+    // next read
+    void parse_feed(const uint8_t *in_data, size_t in_len);
+
+    void handle_frame(uint8_t in_type, const uint8_t *in_data, size_t in_len);
+
+    std::thread feed;
+    std::atomic<bool> stopping;
+
+    int pack_comp_adsb;
+
+    // Beast framing state
+    bool frame_escape;
+    uint8_t frame_type;
+    size_t frame_len;
+    std::vector<uint8_t> frame_buf;
+};
+
+class datasource_beast_builder : public kis_datasource_builder {
+public:
+    datasource_beast_builder() :
+        kis_datasource_builder() {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_beast_builder(int in_id) :
+        kis_datasource_builder(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_beast_builder(int in_id, std::shared_ptr<tracker_element_map> e) :
+        kis_datasource_builder(in_id, e) {
+        register_fields();
+        reserve_fields(e);
+        initialize();
+    }
+
+    virtual ~datasource_beast_builder() { }
+
+    virtual shared_datasource build_datasource(shared_datasource_builder in_sh_this) override {
+        return shared_datasource_beast(new kis_datasource_beast(in_sh_this));
+    }
+
+    virtual void initialize() override {
+        set_source_type("beast");
+        set_source_description("Mode-S Beast binary feed from dump1090 or readsb");
+
+        // A host name can't be probed or listed, the feed is only used with type=beast
+        set_probe_capable(false);
+        set_list_capable(false);
+        set_local_capable(true);
+        set_remote_capable(false);
+        set_passive_capable(false);
+        set_tune_capable(false);
+        set_hop_capable(false);
+    }
+};
+
+#endif
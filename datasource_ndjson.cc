@@ -0,0 +1,398 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "datasource_ndjson.h"
+#include "messagebus.h"
+#include "packetchain.h"
+#include "util.h"
+
+// Datagrams read per call, and the size of each
+#define NDJSON_UDP_BATCH            32
+#define NDJSON_UDP_MAX              65536
+
+// Bytes read from a TCP sender per call
+#define NDJSON_TCP_READ             262144
+
+kis_datasource_ndjson::kis_datasource_ndjson(shared_datasource_builder in_builder) :
+    kis_datasource(in_builder),
+    stopping{false},
+    listen_fd{-1},
+    tcp{false},
+    max_record{1024 * 1024},
+    num_records{0},
+    num_invalid{0} {
+
+    // Records are received in-process
+    set_int_source_hardware("ndjson");
+}
+
+kis_datasource_ndjson::~kis_datasource_ndjson() {
+    stop_listener();
+}
+
+void kis_datasource_ndjson::open_interface(std::string in_definition, unsigned int in_transaction,
+        open_callback_t in_cb) {
+    stop_listener();
+
+    kis_unique_lock<kis_mutex> lock(ext_mutex, "ndjson open_interface");
+
+    if (in_transaction == 0)
+        in_transaction = next_transaction++;
+
+    lock.unlock();
+
+    auto fail = [&](const std::string& reason) {
+        set_int_source_error(true);
+        set_int_source_error_reason(reason);
+
+        if (in_cb != nullptr)
+            in_cb(in_transaction, false, reason);
+    };
+
+    set_int_source_definition(in_definition);
+
+    if (!parse_source_definition(in_definition)) {
+        fail("Malformed source config");
+        return;
+    }
+
+    set_int_source_cap_interface(get_source_interface());
+
+    auto proto = str_lower(get_definition_opt("proto"));
+
+    if (proto == "" || proto == "udp") {
+        tcp = false;
+    } else if (proto == "tcp") {
+        tcp = true;
+    } else {
+        fail(fmt::format("Unknown ndjson protocol '{}', expected udp or tcp", proto));
+        return;
+    }
+
+    auto port = get_definition_opt("port");
+
+    if (port == "") {
+        fail("ndjson source needs a port=... option");
+        return;
+    }
+
+    auto listen = get_definition_opt("listen");
+
+    if (listen == "")
+        listen = "127.0.0.1";
+
+    format = get_definition_opt("format");
+
+    if (format == "")
+        format = "RTL433";
+
+    max_record = string_to_n_dfl<size_t>(get_definition_opt("max_record"), 1024 * 1024);
+
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+
+    auto r = getaddrinfo(listen.c_str(), port.c_str(), &hints, &res);
+
+    if (r != 0) {
+        fail(fmt::format("Invalid ndjson listen address {}:{}: {}", listen, port, gai_strerror(r)));
+        return;
+    }
+
+    listen_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+
+    if (listen_fd < 0) {
+        freeaddrinfo(res);
+        fail(fmt::format("Could not create ndjson socket: {}", kis_strerror_r(errno)));
+        return;
+    }
+
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(listen_fd, res->ai_addr, res->ai_addrlen) < 0 ||
+            (tcp && ::listen(listen_fd, 16) < 0)) {
+        auto err = errno;
+        freeaddrinfo(res);
+        close(listen_fd);
+        listen_fd = -1;
+        fail(fmt::format("Could not listen on {}:{}: {}", listen, port, kis_strerror_r(err)));
+        return;
+    }
+
+    freeaddrinfo(res);
+
+    if (!local_uuid) {
+        auto uuidstr = fmt::format("{:08X}-0000-0000-0000-0000{:08X}",
+                adler32_checksum("kismet_ndjson"),
+                adler32_checksum(fmt::format("{}:{}:{}", tcp ? "tcp" : "udp", listen, port)));
+        uuid u(uuidstr);
+
+        set_source_uuid(u);
+        set_source_key(adler32_checksum(u.uuid_to_string()));
+    }
+
+    set_int_source_retry_attempts(0);
+    set_int_source_error(false);
+    set_int_source_error_reason("");
+    set_int_source_warning("");
+    set_int_source_running(true);
+
+    _MSG_INFO("ndjson source '{}' receiving {} records on {} {}:{}", get_source_name(),
+            format, tcp ? "TCP" : "UDP", listen, port);
+
+    stopping = false;
+    num_records = 0;
+    num_invalid = 0;
+
+    listener = std::thread([this]() {
+            thread_set_process_name("NDJSON");
+            listener_thread();
+        });
+
+    if (in_cb != nullptr)
+        in_cb(in_transaction, true, "Source opened");
+}
+
+void kis_datasource_ndjson::close_external_impl() {
+    stop_listener();
+    kis_datasource::close_external_impl();
+}
+
+void kis_datasource_ndjson::stop_listener() {
+    stopping = true;
+
+    if (listener.joinable()) {
+        if (listener.get_id() == std::this_thread::get_id())
+            listener.detach();
+        else
+            listener.join();
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+void kis_datasource_ndjson::handle_record(const char *data, size_t len) {
+    // Trim the line ending and any whitespace around the record
+    while (len > 0 && isspace(data[len - 1]))
+        len--;
+
+    while (len > 0 && isspace(data[0])) {
+        data++;
+        len--;
+    }
+
+    if (len == 0)
+        return;
+
+    // Records are only parsed by the phys, so this only catches the obvious garbage
+    if (data[0] != '{' || len > max_record) {
+        if (num_invalid++ == 0)
+            _MSG_ERROR("ndjson source '{}' received a record which isn't a JSON object, "
+                    "invalid records will be discarded", get_source_name());
+        return;
+    }
+
+    auto packet = packetchain->generate_packet();
+
+    packet->ts = read_ts;
+
+    auto jsoninfo = packetchain->new_packet_component<kis_json_packinfo>();
+    jsoninfo->type = format;
+    jsoninfo->json_string.assign(data, len);
+    packet->insert(pack_comp_json, jsoninfo);
+
+    num_records++;
+
+    handle_rx_packet(packet);
+}
+
+size_t kis_datasource_ndjson::handle_records(const char *data, size_t len, bool in_final) {
+    size_t pos = 0;
+
+    // memchr is vectorized by the C library, so long records are scanned a vector at
+    // a time
+    while (pos < len) {
+        auto nl = static_cast<const char *>(memchr(data + pos, '\n', len - pos));
+
+        if (nl == nullptr) {
+            if (!in_final)
+                break;
+
+            handle_record(data + pos, len - pos);
+            pos = len;
+            break;
+        }
+
+        handle_record(data + pos, nl - (data + pos));
+        pos = (nl - data) + 1;
+    }
+
+    return pos;
+}
+
+void kis_datasource_ndjson::listener_thread() {
+    struct tcp_sender {
+        int fd;
+        std::string buf;
+        size_t used;
+    };
+
+    std::vector<tcp_sender> senders;
+    std::vector<struct pollfd> pfds;
+
+#if defined(SYS_LINUX)
+    std::vector<char> dgrams(tcp ? 0 : NDJSON_UDP_BATCH * NDJSON_UDP_MAX);
+    std::vector<struct iovec> iovs(NDJSON_UDP_BATCH);
+    std::vector<struct mmsghdr> msgs(NDJSON_UDP_BATCH);
+
+    if (!tcp) {
+        for (size_t i = 0; i < NDJSON_UDP_BATCH; i++) {
+            iovs[i].iov_base = &dgrams[i * NDJSON_UDP_MAX];
+            iovs[i].iov_len = NDJSON_UDP_MAX;
+
+            memset(&msgs[i], 0, sizeof(struct mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+#else
+    std::vector<char> dgrams(tcp ? 0 : NDJSON_UDP_MAX);
+#endif
+
+    auto drop_sender = [&](size_t i) {
+        close(senders[i].fd);
+        senders.erase(senders.begin() + i);
+    };
+
+    while (!stopping) {
+        // Leave the records in the socket while the packet chain catches up; TCP
+        // senders are held back, UDP records are dropped by the kernel once the socket
+        // buffer is full
+        if (packetchain->queue_congested() || get_source_paused()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        pfds.resize(senders.size() + 1);
+
+        pfds[0].fd = listen_fd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+
+        for (size_t i = 0; i < senders.size(); i++) {
+            pfds[i + 1].fd = senders[i].fd;
+            pfds[i + 1].events = POLLIN;
+            pfds[i + 1].revents = 0;
+        }
+
+        // Wake up periodically to notice the source closing
+        if (poll(pfds.data(), pfds.size(), 500) <= 0)
+            continue;
+
+        gettimeofday(&read_ts, nullptr);
+
+        if (!tcp) {
+            if (!(pfds[0].revents & POLLIN))
+                continue;
+
+#if defined(SYS_LINUX)
+            auto n = recvmmsg(listen_fd, msgs.data(), NDJSON_UDP_BATCH, MSG_DONTWAIT, nullptr);
+
+            for (int i = 0; i < n; i++)
+                handle_records(&dgrams[i * NDJSON_UDP_MAX], msgs[i].msg_len, true);
+#else
+            auto n = recv(listen_fd, dgrams.data(), dgrams.size(), MSG_DONTWAIT);
+
+            if (n > 0)
+                handle_records(dgrams.data(), n, true);
+#endif
+
+            continue;
+        }
+
+        // Walk the senders backwards so a dropped sender doesn't shift the ones left
+        for (size_t i = senders.size(); i > 0; i--) {
+            auto& s = senders[i - 1];
+
+            if (pfds[i].revents == 0)
+                continue;
+
+            if (s.buf.size() < s.used + NDJSON_TCP_READ)
+                s.buf.resize(s.used + NDJSON_TCP_READ);
+
+            auto n = read(s.fd, &s.buf[s.used], NDJSON_TCP_READ);
+
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                    continue;
+
+                // Anything left is the last record of the sender
+                handle_records(s.buf.data(), s.used, true);
+                drop_sender(i - 1);
+                continue;
+            }
+
+            s.used += n;
+
+            auto consumed = handle_records(s.buf.data(), s.used, false);
+
+            if (consumed != 0) {
+                memmove(&s.buf[0], &s.buf[consumed], s.used - consumed);
+                s.used -= consumed;
+            }
+
+            if (s.used > max_record) {
+                _MSG_ERROR("ndjson source '{}' dropping a TCP sender which sent a record over "
+                        "{} bytes", get_source_name(), max_record);
+                num_invalid++;
+                drop_sender(i - 1);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            auto fd = accept(listen_fd, nullptr, nullptr);
+
+            if (fd >= 0) {
+                fcntl(fd, F_SETFD, fcntl(fd, F_GETFD, 0) | FD_CLOEXEC);
+                senders.push_back(tcp_sender{fd, std::string(), 0});
+            }
+        }
+    }
+
+    for (const auto& s : senders)
+        close(s.fd);
+}
@@ -0,0 +1,131 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef __DATASOURCE_NDJSON_H__
+#define __DATASOURCE_NDJSON_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kis_datasource.h"
+
+class kis_datasource_ndjson;
+typedef std::shared_ptr<kis_datasource_ndjson> shared_datasource_ndjson;
+
+// Newline-delimited JSON ingest, for decoders which can write their records to a
+// socket (such as rtl_433 -F json, or a script feeding a third-party decoder).  The
+// source listens on a UDP or TCP port in the server, and every line is handed to the
+// phys as a JSON record of the 'format' type, without the round trip through a capture
+// binary and a protobuf report per record.
+//
+// Each read is split into records in place, so a datagram or read of many records
+// costs one system call; the document of a record is parsed once, by the first phy
+// which looks at it.  TCP senders are not read while the packet chain is congested,
+// so they are held back by TCP flow control instead of having records dropped.
+//
+//    source=rtl433-net:type=ndjson,proto=udp,listen=0.0.0.0,port=9433,format=RTL433
+//    source=meters:type=ndjson,proto=tcp,port=9434,format=RTLamr
+class kis_datasource_ndjson : public kis_datasource {
+public:
+    kis_datasource_ndjson(shared_datasource_builder in_builder);
+    virtual ~kis_datasource_ndjson();
+
+    virtual void open_interface(std::string in_definition, unsigned int in_transaction,
+            open_callback_t in_cb) override;
+
+protected:
+    virtual void close_external_impl() override;
+
+    void stop_listener();
+
+    void listener_thread();
+
+    // Split a read into records; returns the bytes consumed, a partial record at the
+    // end is left for the next read
+    size_t handle_records(const char *data, size_t len, bool in_final);
+
+    void handle_record(const char *data, size_t len);
+
+    std::thread listener;
+    std::atomic<bool> stopping;
+
+    int listen_fd;
+    bool tcp;
+
+    // JSON type handed to the phys
+    std::string format;
+
+    // Records longer than this are discarded, and a TCP sender sending one is dropped
+    size_t max_record;
+
+    struct timeval read_ts;
+
+    uint64_t num_records;
+    uint64_t num_invalid;
+};
+
+class datasource_ndjson_builder : public kis_datasource_builder {
+public:
+    datasource_ndjson_builder() :
+        kis_datasource_builder() {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_ndjson_builder(int in_id) :
+        kis_datasource_builder(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_ndjson_builder(int in_id, std::shared_ptr<tracker_element_map> e) :
+        kis_datasource_builder(in_id, e) {
+        register_fields();
+        reserve_fields(e);
+        initialize();
+    }
+
+    virtual ~datasource_ndjson_builder() { }
+
+    virtual shared_datasource build_datasource(shared_datasource_builder in_sh_this) override {
+        return shared_datasource_ndjson(new kis_datasource_ndjson(in_sh_this));
+    }
+
+    virtual void initialize() override {
+        set_source_type("ndjson");
+        set_source_description("Newline-delimited JSON records from a UDP or TCP socket");
+
+        set_probe_capable(false);
+        set_list_capable(false);
+        set_local_capable(true);
+        set_remote_capable(false);
+        set_passive_capable(false);
+        set_tune_capable(false);
+        set_hop_capable(false);
+    }
+};
+
+#endif
+
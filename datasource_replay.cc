@@ -0,0 +1,746 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "datasource_replay.h"
+#include "gpstracker.h"
+#include "kismetdb_codec.h"
+#include "kismetdb_manifest.h"
+#include "kismetdb_segments.h"
+#include "messagebus.h"
+#include "sqlite3_cpp11.h"
+#include "util.h"
+
+#define REPLAY_REPORT_INTERVAL      10
+
+#define PCAP_MAGIC_USEC             0xa1b2c3d4
+#define PCAP_MAGIC_NSEC             0xa1b23c4d
+#define PCAPNG_SHB                  0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER           0x1a2b3c4d
+#define PCAPNG_IDB                  1
+#define PCAPNG_PB                   2
+#define PCAPNG_SPB                  3
+#define PCAPNG_EPB                  6
+#define PCAPNG_OPT_IF_TSRESOL       9
+
+namespace {
+
+// A file mapped into memory; packets referencing the mapping keep it alive
+struct replay_mapping {
+    replay_mapping(void *in_base, size_t in_len) :
+        base{static_cast<const char *>(in_base)},
+        len{in_len} { }
+
+    ~replay_mapping() {
+        munmap(const_cast<char *>(base), len);
+    }
+
+    const char *base;
+    size_t len;
+};
+
+std::shared_ptr<replay_mapping> map_file(const std::string& path, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        error = kis_strerror_r(errno);
+        return nullptr;
+    }
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0) {
+        error = kis_strerror_r(errno);
+        close(fd);
+        return nullptr;
+    }
+
+    if (sb.st_size == 0) {
+        error = "empty file";
+        close(fd);
+        return nullptr;
+    }
+
+    auto base = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    auto e = errno;
+
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        error = kis_strerror_r(e);
+        return nullptr;
+    }
+
+    // Logs are read once, front to back
+    madvise(base, sb.st_size, MADV_SEQUENTIAL);
+
+    return std::make_shared<replay_mapping>(base, sb.st_size);
+}
+
+uint16_t read16(const char *p, bool swap) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+uint32_t read32(const char *p, bool swap) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+}
+
+kis_datasource_replay::kis_datasource_replay(shared_datasource_builder in_builder) :
+    kis_datasource(in_builder),
+    stopping{false},
+    speed{0},
+    pace_anchored{false},
+    replay_packets{0},
+    replay_bytes{0} {
+
+    // We don't have a capture binary, packets are read in-process
+    set_int_source_hardware("replay");
+}
+
+kis_datasource_replay::~kis_datasource_replay() {
+    stop_replay();
+}
+
+void kis_datasource_replay::open_interface(std::string in_definition, unsigned int in_transaction,
+        open_callback_t in_cb) {
+    stop_replay();
+
+    kis_unique_lock<kis_mutex> lock(ext_mutex, "replay open_interface");
+
+    if (in_transaction == 0)
+        in_transaction = next_transaction++;
+
+    lock.unlock();
+
+    auto fail = [&](const std::string& reason) {
+        set_int_source_error(true);
+        set_int_source_error_reason(reason);
+
+        if (in_cb != nullptr)
+            in_cb(in_transaction, false, reason);
+    };
+
+    set_int_source_definition(in_definition);
+
+    if (!parse_source_definition(in_definition)) {
+        fail("Malformed source config");
+        return;
+    }
+
+    auto path = get_source_interface();
+
+    set_int_source_cap_interface(path);
+
+    if (get_definition_opt_bool("realtime", false)) {
+        speed = 1;
+    } else if (get_definition_opt("speed") != "" && get_definition_opt("speed") != "max") {
+        speed = get_definition_opt_double("speed", 0);
+
+        if (speed <= 0) {
+            fail(fmt::format("Invalid replay speed '{}', expected a multiple of the original "
+                        "speed or 'max'", get_definition_opt("speed")));
+            return;
+        }
+    } else {
+        speed = 0;
+    }
+
+    std::vector<std::string> files;
+
+    if (kismetdb_is_manifest(path)) {
+        try {
+            for (const auto& e : kismetdb_read_manifest(path))
+                files.push_back(kismetdb_manifest_file(path, e));
+        } catch (const std::runtime_error& e) {
+            fail(e.what());
+            return;
+        }
+
+        if (files.size() == 0) {
+            fail(fmt::format("Manifest '{}' lists no kismetdb files", path));
+            return;
+        }
+    } else {
+        files.push_back(path);
+    }
+
+    if (access(files[0].c_str(), R_OK) < 0) {
+        fail(fmt::format("Unable to read '{}': {}", files[0], kis_strerror_r(errno)));
+        return;
+    }
+
+    // Derive a consistent UUID from the log, the same way the pcapfile tool does
+    if (!local_uuid) {
+        auto uuidstr = fmt::format("{:08X}-0000-0000-0000-0000{:08X}",
+                adler32_checksum("kismet_replay"), adler32_checksum(path));
+        uuid u(uuidstr);
+
+        set_source_uuid(u);
+        set_source_key(adler32_checksum(u.uuid_to_string()));
+    }
+
+    set_int_source_retry_attempts(0);
+    set_int_source_error(false);
+    set_int_source_error_reason("");
+    set_int_source_running(true);
+
+    if (speed == 0)
+        _MSG_INFO("Replaying '{}' as fast as packets can be processed", path);
+    else
+        _MSG_INFO("Replaying '{}' at {}x the original speed", path, speed);
+
+    stopping = false;
+    pace_anchored = false;
+    replay_packets = 0;
+    replay_bytes = 0;
+    replay_start = last_report = std::chrono::steady_clock::now();
+
+    replay = std::thread([this, files]() {
+            thread_set_process_name("REPLAY");
+            replay_thread(files);
+        });
+
+    if (in_cb != nullptr)
+        in_cb(in_transaction, true, "Source opened");
+}
+
+void kis_datasource_replay::close_external_impl() {
+    stop_replay();
+    kis_datasource::close_external_impl();
+}
+
+void kis_datasource_replay::stop_replay() {
+    stopping = true;
+
+    if (replay.joinable()) {
+        if (replay.get_id() == std::this_thread::get_id())
+            replay.detach();
+        else
+            replay.join();
+    }
+}
+
+void kis_datasource_replay::replay_thread(std::vector<std::string> in_files) {
+    for (const auto& f : in_files) {
+        if (stopping)
+            break;
+
+        std::string error;
+
+        if (!replay_file(f, error))
+            _MSG_ERROR("Replay source '{}' could not read '{}': {}", get_source_name(), f, error);
+    }
+
+    if (stopping)
+        return;
+
+    report_throughput(true);
+
+    set_int_source_running(false);
+}
+
+bool kis_datasource_replay::replay_file(const std::string& in_path, std::string& error) {
+    char magic[16];
+
+    auto f = fopen(in_path.c_str(), "rb");
+
+    if (f == nullptr) {
+        error = kis_strerror_r(errno);
+        return false;
+    }
+
+    auto r = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+
+    if (r == sizeof(magic) && memcmp(magic, "SQLite format 3", 16) == 0)
+        return replay_kismetdb(in_path, error);
+
+    return replay_pcap(in_path, error);
+}
+
+bool kis_datasource_replay::replay_pcap(const std::string& in_path, std::string& error) {
+    auto map = map_file(in_path, error);
+
+    if (map == nullptr)
+        return false;
+
+    auto base = map->base;
+    auto len = map->len;
+
+    if (len < 24) {
+        error = "file too short to be a pcap or pcapng file";
+        return false;
+    }
+
+    auto magic = read32(base, false);
+
+    if (magic != PCAPNG_SHB) {
+        bool swap, nsec;
+
+        if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+            swap = false;
+        } else if (__builtin_bswap32(magic) == PCAP_MAGIC_USEC ||
+                __builtin_bswap32(magic) == PCAP_MAGIC_NSEC) {
+            swap = true;
+        } else {
+            error = "not a pcap, pcapng, or kismetdb file";
+            return false;
+        }
+
+        nsec = read32(base, swap) == PCAP_MAGIC_NSEC;
+
+        // The upper bits of the link type carry the FCS length
+        uint32_t dlt = read32(base + 20, swap) & 0x0FFFFFFF;
+
+        set_int_source_dlt(dlt);
+
+        size_t offt = 24;
+
+        while (offt + 16 <= len) {
+            auto caplen = read32(base + offt + 8, swap);
+
+            if (offt + 16 + caplen > len) {
+                _MSG_ERROR("Replay source '{}' found a truncated packet at the end of '{}'",
+                        get_source_name(), in_path);
+                break;
+            }
+
+            struct timeval ts;
+            ts.tv_sec = read32(base + offt, swap);
+            ts.tv_usec = read32(base + offt + 4, swap);
+
+            if (nsec)
+                ts.tv_usec /= 1000;
+
+            if (!replay_packet(ts, dlt, nonstd::string_view(base + offt + 16, caplen), map,
+                        read32(base + offt + 12, swap), nullptr, nullptr))
+                break;
+
+            offt += 16 + caplen;
+        }
+
+        return true;
+    }
+
+    struct pcapng_interface {
+        uint32_t dlt;
+        uint32_t snaplen;
+        // Timestamp units per second
+        uint64_t resolution;
+    };
+
+    std::vector<pcapng_interface> interfaces;
+    bool swap = false;
+    struct timeval last_ts{0, 0};
+
+    size_t offt = 0;
+
+    while (offt + 12 <= len) {
+        auto block = base + offt;
+
+        // Each section sets the byte order of the blocks in it, and starts a new
+        // list of interfaces
+        if (read32(block, false) == PCAPNG_SHB) {
+            auto bom = read32(block + 8, false);
+
+            if (bom == PCAPNG_BYTE_ORDER) {
+                swap = false;
+            } else if (__builtin_bswap32(bom) == PCAPNG_BYTE_ORDER) {
+                swap = true;
+            } else {
+                error = "corrupt pcapng section header";
+                return false;
+            }
+
+            interfaces.clear();
+        }
+
+        auto block_type = read32(block, swap);
+        auto block_len = read32(block + 4, swap);
+
+        if (block_len < 12 || (block_len % 4) != 0 || offt + block_len > len) {
+            _MSG_ERROR("Replay source '{}' found a truncated or corrupt block in '{}'",
+                    get_source_name(), in_path);
+            break;
+        }
+
+        auto body = block + 8;
+        size_t body_len = block_len - 12;
+
+        const char *data = nullptr;
+        uint32_t caplen = 0, original_len = 0, ifnum = 0;
+        uint64_t ts_units = 0;
+        bool has_ts = true;
+
+        if (block_type == PCAPNG_IDB && body_len >= 8) {
+            pcapng_interface intf{read16(body, swap), read32(body + 4, swap), 1000000};
+
+            size_t opt_offt = 8;
+
+            while (opt_offt + 4 <= body_len) {
+                auto opt_code = read16(body + opt_offt, swap);
+                auto opt_len = read16(body + opt_offt + 2, swap);
+
+                if (opt_code == 0 || opt_offt + 4 + opt_len > body_len)
+                    break;
+
+                if (opt_code == PCAPNG_OPT_IF_TSRESOL && opt_len >= 1) {
+                    uint8_t res = body[opt_offt + 4];
+
+                    // Negative powers of 10, or of 2 with the high bit set
+                    intf.resolution = 1;
+
+                    if (res & 0x80) {
+                        intf.resolution <<= std::min(res & 0x7F, 63);
+                    } else {
+                        for (unsigned int i = 0; i < std::min(res, (uint8_t) 19); i++)
+                            intf.resolution *= 10;
+                    }
+                }
+
+                opt_offt += 4 + ((opt_len + 3) & ~3);
+            }
+
+            interfaces.push_back(intf);
+
+            if (interfaces.size() == 1)
+                set_int_source_dlt(intf.dlt);
+        } else if (block_type == PCAPNG_EPB && body_len >= 20) {
+            ifnum = read32(body, swap);
+            ts_units = ((uint64_t) read32(body + 4, swap) << 32) | read32(body + 8, swap);
+            caplen = read32(body + 12, swap);
+            original_len = read32(body + 16, swap);
+
+            if (caplen <= body_len - 20)
+                data = body + 20;
+        } else if (block_type == PCAPNG_PB && body_len >= 20) {
+            ifnum = read16(body, swap);
+            ts_units = ((uint64_t) read32(body + 4, swap) << 32) | read32(body + 8, swap);
+            caplen = read32(body + 12, swap);
+            original_len = read32(body + 16, swap);
+
+            if (caplen <= body_len - 20)
+                data = body + 20;
+        } else if (block_type == PCAPNG_SPB && body_len >= 4 && interfaces.size() > 0) {
+            // Simple packets have no timestamp and are always from the first interface;
+            // the captured length is what fits in the block
+            original_len = read32(body, swap);
+            caplen = std::min((size_t) original_len, body_len - 4);
+
+            if (interfaces[0].snaplen != 0)
+                caplen = std::min(caplen, interfaces[0].snaplen);
+
+            data = body + 4;
+            has_ts = false;
+        }
+
+        if (data != nullptr && ifnum < interfaces.size()) {
+            struct timeval ts = last_ts;
+
+            if (has_ts) {
+                auto res = interfaces[ifnum].resolution;
+                ts.tv_sec = ts_units / res;
+                ts.tv_usec = (uint64_t) ((double) (ts_units % res) * 1000000 / res);
+                last_ts = ts;
+            }
+
+            if (!replay_packet(ts, interfaces[ifnum].dlt, nonstd::string_view(data, caplen), map,
+                        original_len, nullptr, nullptr))
+                break;
+        }
+
+        offt += block_len;
+    }
+
+    return true;
+}
+
+bool kis_datasource_replay::replay_kismetdb(const std::string& in_path, std::string& error) {
+    using namespace kissqlite3;
+
+    sqlite3 *db = nullptr;
+
+    if (sqlite3_open_v2(in_path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        error = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return false;
+    }
+
+    // Let sqlite read the database pages through a mapping too
+    sqlite3_exec(db, "PRAGMA mmap_size=1073741824", NULL, NULL, NULL);
+
+    try {
+        int db_version = 0;
+
+        auto version_query = _SELECT(db, "KISMET", {"db_version"});
+        auto version_ret = version_query.begin();
+
+        if (version_ret != version_query.end())
+            db_version = sqlite3_column_as<int>(*version_ret, 0);
+
+        if (db_version < 5)
+            throw std::runtime_error(fmt::format("unsupported kismetdb version {}", db_version));
+
+        std::list<std::string> fields{"ts_sec", "ts_usec", "dlt", "packet", "frequency",
+            "lat", "lon", "alt", "signal"};
+
+        if (db_version >= 9) {
+            fields.push_back("segment");
+            fields.push_back("segment_offset");
+            fields.push_back("packet_len");
+        }
+
+        if (db_version >= 10) {
+            fields.push_back("codec");
+            fields.push_back("codec_dict");
+            fields.push_back("stored_len");
+        }
+
+        kismetdb_packet_decompressor decompressor;
+
+        if (db_version >= 10) {
+            auto dict_query = _SELECT(db, "packet_dictionaries", {"id", "dictionary"});
+
+            for (auto d : dict_query)
+                decompressor.add_dictionary(sqlite3_column_as<unsigned int>(d, 0),
+                        sqlite3_column_as<std::string>(d, 1));
+        }
+
+        auto segment_dir = kismetdb_segment_dir(in_path);
+        std::shared_ptr<replay_mapping> segment_map;
+        uint32_t segment_num = 0;
+
+        // Packets are replayed in the order they were logged
+        auto packet_query = _SELECT(db, "packets", fields);
+
+        for (auto p : packet_query) {
+            if (stopping)
+                break;
+
+            nonstd::string_view data;
+            std::shared_ptr<void> owner;
+
+            if (db_version >= 9 && sqlite3_column_type(p.get(), 9) != SQLITE_NULL) {
+                auto segment = sqlite3_column_as<unsigned int>(p, 9);
+                auto offset = sqlite3_column_as<std::uint64_t>(p, 10);
+                auto stored_len = sqlite3_column_as<std::uint64_t>(p, db_version >= 10 ? 14 : 11);
+
+                // Segments still being written can have grown since they were mapped
+                if (segment_map == nullptr || segment != segment_num ||
+                        offset + stored_len > segment_map->len) {
+                    std::string map_error;
+
+                    segment_map = map_file(kismetdb_segment_path(segment_dir, segment), map_error);
+
+                    if (segment_map == nullptr)
+                        throw std::runtime_error(fmt::format("unable to map packet segment {}: {}",
+                                    segment, map_error));
+
+                    segment_num = segment;
+                }
+
+                if (offset + stored_len > segment_map->len)
+                    throw std::runtime_error(fmt::format("packet past the end of segment {}",
+                                segment));
+
+                data = nonstd::string_view(segment_map->base + offset, stored_len);
+                owner = segment_map;
+            } else {
+                auto packet = std::make_shared<std::string>(sqlite3_column_as<std::string>(p, 3));
+                data = nonstd::string_view(*packet);
+                owner = packet;
+            }
+
+            if (db_version >= 10 && sqlite3_column_as<int>(p, 12) != KISMETDB_CODEC_RAW) {
+                auto packet = std::make_shared<std::string>(
+                        decompressor.decompress(sqlite3_column_as<int>(p, 12),
+                            sqlite3_column_as<unsigned int>(p, 13), std::string(data),
+                            sqlite3_column_as<std::uint64_t>(p, 11)));
+                data = nonstd::string_view(*packet);
+                owner = packet;
+            }
+
+            struct timeval ts;
+            ts.tv_sec = sqlite3_column_as<std::uint64_t>(p, 0);
+            ts.tv_usec = sqlite3_column_as<std::uint64_t>(p, 1);
+
+            std::shared_ptr<kis_layer1_packinfo> l1info;
+
+            auto freq = sqlite3_column_as<double>(p, 4);
+            auto signal = sqlite3_column_as<int>(p, 8);
+
+            if (freq != 0 || signal != 0) {
+                l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+                l1info->freq_khz = freq;
+
+                if (signal != 0) {
+                    l1info->signal_type = kis_l1_signal_type_dbm;
+                    l1info->signal_dbm = signal;
+                }
+            }
+
+            std::shared_ptr<kis_gps_packinfo> gpsinfo;
+
+            auto lat = sqlite3_column_as<double>(p, 5);
+            auto lon = sqlite3_column_as<double>(p, 6);
+
+            if (lat != 0 || lon != 0) {
+                gpsinfo = packetchain->new_packet_component<kis_gps_packinfo>();
+                gpsinfo->lat = lat;
+                gpsinfo->lon = lon;
+                gpsinfo->alt = sqlite3_column_as<double>(p, 7);
+                gpsinfo->fix = gpsinfo->alt != 0 ? 3 : 2;
+                gpsinfo->tv = ts;
+                gpsinfo->gpsname = "replay";
+            }
+
+            if (!replay_packet(ts, sqlite3_column_as<unsigned int>(p, 2), data, owner,
+                        data.length(), l1info, gpsinfo))
+                break;
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
+        sqlite3_close(db);
+        return false;
+    }
+
+    sqlite3_close(db);
+
+    return true;
+}
+
+bool kis_datasource_replay::replay_packet(const struct timeval& in_ts, uint32_t in_dlt,
+        const nonstd::string_view& in_data, std::shared_ptr<void> in_owner,
+        size_t in_original_len, std::shared_ptr<kis_layer1_packinfo> in_l1info,
+        std::shared_ptr<kis_gps_packinfo> in_gpsinfo) {
+
+    // Hold the replay while the source is paused instead of discarding the log
+    if (get_source_paused()) {
+        while (get_source_paused() && !stopping)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        pace_anchored = false;
+    }
+
+    if (speed > 0) {
+        if (!pace_anchored) {
+            pace_anchored = true;
+            pace_ts = in_ts;
+            pace_start = std::chrono::steady_clock::now();
+        }
+
+        double offset = (in_ts.tv_sec - pace_ts.tv_sec) +
+            (double) (in_ts.tv_usec - pace_ts.tv_usec) / 1000000;
+
+        // Packets out of order in the log go out right away
+        if (offset > 0) {
+            auto target = pace_start +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(offset / speed));
+
+            // Sleep in slices so long gaps in the log don't hold up closing the source
+            while (!stopping) {
+                auto now = std::chrono::steady_clock::now();
+
+                if (now >= target)
+                    break;
+
+                std::this_thread::sleep_for(std::min(
+                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(target - now),
+                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::milliseconds(100))));
+            }
+        }
+    }
+
+    // Wait for the packet chain to catch up rather than have it drop packets
+    while (packetchain->queue_congested() && !stopping)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    if (stopping)
+        return false;
+
+    auto packet = packetchain->generate_packet();
+
+    packet->ts = in_ts;
+    packet->original_len = in_original_len;
+    packet->set_data_ref(in_data, in_owner);
+
+    auto datachunk = packetchain->new_packet_component<kis_datachunk>();
+
+    if (get_source_override_linktype())
+        datachunk->dlt = get_source_override_linktype();
+    else
+        datachunk->dlt = in_dlt;
+
+    datachunk->set_data(packet->data);
+
+    packet->insert(pack_comp_linkframe, datachunk);
+
+    if (in_l1info != nullptr)
+        packet->insert(pack_comp_l1info, in_l1info);
+
+    if (in_gpsinfo != nullptr)
+        packet->insert(pack_comp_gps, in_gpsinfo);
+
+    get_source_packet_size_rrd()->add_sample(in_data.length(), Globalreg::globalreg->last_tv_sec);
+
+    handle_rx_packet(packet);
+
+    replay_packets++;
+    replay_bytes += in_data.length();
+
+    if ((replay_packets % 1024) == 0 &&
+            std::chrono::steady_clock::now() - last_report >=
+            std::chrono::seconds(REPLAY_REPORT_INTERVAL))
+        report_throughput(false);
+
+    return true;
+}
+
+void kis_datasource_replay::report_throughput(bool in_final) {
+    auto now = std::chrono::steady_clock::now();
+
+    last_report = now;
+
+    double elapsed = std::chrono::duration<double>(now - replay_start).count();
+    double mbytes = (double) replay_bytes / (1024 * 1024);
+
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    _MSG_INFO("Replay source '{}' {} {} packets, {:.1f} MB in {:.1f} seconds "
+            "({:.0f} packets/sec, {:.1f} MB/sec)", get_source_name(),
+            in_final ? "finished," : "has replayed", replay_packets, mbytes, elapsed,
+            replay_packets / elapsed, mbytes / elapsed);
+}
@@ -0,0 +1,153 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DATASOURCE_REPLAY_H__
+#define __DATASOURCE_REPLAY_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "kis_datasource.h"
+
+class kis_datasource_replay;
+typedef std::shared_ptr<kis_datasource_replay> shared_datasource_replay;
+
+// In-process replay of pcap, pcapng, and kismetdb logs.
+//
+// The pcapfile and kismetdb sources read the log in a capture tool and send every
+// packet to the server over IPC.  The replay source reads the log in a thread of the
+// server and hands the packets straight to the packet chain.  Pcap and pcapng files,
+// and the packet segments of a kismetdb log, are mapped into memory and the packets
+// reference the mapping instead of being copied; packets stored in the kismetdb
+// database itself are copied out of sqlite, and compressed packets are decompressed.
+//
+// By default the log is replayed as fast as the packet chain can take it; the replay
+// waits whenever the packet processing or logging queues back up, instead of having
+// packets dropped.  'realtime=true' replays with the timing of the original capture,
+// and 'speed=N' replays N times faster than the original.  The throughput is reported
+// every 10 seconds and when the replay finishes.
+//
+// The log may be the manifest of a rolling kismetdb log, in which case each file of
+// the log is replayed in order:
+//
+//    source=/path/to/capture.pcapng:type=replay
+//    source=/path/to/Kismet-xyz.manifest:type=replay,speed=10
+class kis_datasource_replay : public kis_datasource {
+public:
+    kis_datasource_replay(shared_datasource_builder in_builder);
+    virtual ~kis_datasource_replay();
+
+    virtual void open_interface(std::string in_definition, unsigned int in_transaction,
+            open_callback_t in_cb) override;
+
+    // Don't replay the log again once it finishes unless we're told to
+    virtual std::string override_default_option(std::string in_opt) override {
+        if (in_opt == "retry")
+            return "false";
+
+        return "";
+    }
+
+protected:
+    virtual void close_external_impl() override;
+
+    void stop_replay();
+
+    void replay_thread(std::vector<std::string> in_files);
+
+    // Replay one file of the log; returns false and sets error if the file can't be
+    // read at all
+    bool replay_file(const std::string& in_path, std::string& error);
+    bool replay_pcap(const std::string& in_path, std::string& error);
+    bool replay_kismetdb(const std::string& in_path, std::string& error);
+
+    // Pace a packet to the replay speed, wait for room in the packet chain, and inject
+    // it; returns false once the replay has been stopped
+    bool replay_packet(const struct timeval& in_ts, uint32_t in_dlt,
+            const nonstd::string_view& in_data, std::shared_ptr<void> in_owner,
+            size_t in_original_len, std::shared_ptr<kis_layer1_packinfo> in_l1info,
+            std::shared_ptr<kis_gps_packinfo> in_gpsinfo);
+
+    void report_throughput(bool in_final);
+
+    std::thread replay;
+    std::atomic<bool> stopping;
+
+    // Replay speed relative to the original capture, or 0 for as fast as possible
+    double speed;
+
+    // Pacing is anchored to the first packet, and again after a pause
+    bool pace_anchored;
+    struct timeval pace_ts;
+    std::chrono::steady_clock::time_point pace_start;
+
+    uint64_t replay_packets;
+    uint64_t replay_bytes;
+    std::chrono::steady_clock::time_point replay_start;
+    std::chrono::steady_clock::time_point last_report;
+};
+
+class datasource_replay_builder : public kis_datasource_builder {
+public:
+    datasource_replay_builder() :
+        kis_datasource_builder() {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_replay_builder(int in_id) :
+        kis_datasource_builder(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_replay_builder(int in_id, std::shared_ptr<tracker_element_map> e) :
+        kis_datasource_builder(in_id, e) {
+        register_fields();
+        reserve_fields(e);
+        initialize();
+    }
+
+    virtual ~datasource_replay_builder() { }
+
+    virtual shared_datasource build_datasource(shared_datasource_builder in_sh_this) override {
+        return shared_datasource_replay(new kis_datasource_replay(in_sh_this));
+    }
+
+    virtual void initialize() override {
+        set_source_type("replay");
+        set_source_description("In-process replay of a pcap, pcapng, or kismetdb log");
+
+        // Replay is only used when asked for with type=replay, the pcapfile and
+        // kismetdb sources still claim logs when probing
+        set_probe_capable(false);
+        set_list_capable(false);
+        set_local_capable(true);
+        set_remote_capable(false);
+        set_passive_capable(false);
+        set_tune_capable(false);
+        set_hop_capable(false);
+    }
+};
+
+#endif
@@ -16,12 +16,66 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <zlib.h>
+
+#include <thread>
+
+#include "configfile.h"
 #include "datasourcetracker.h"
 #include "datasource_virtual.h"
 #include "datasource_scan.h"
 #include "json_adapter.h"
 #include "packet.h"
 
+// Reports injected between checks of the packet chain
+#define SCAN_BULK_BATCH         256
+
+namespace {
+    // Decompress a gzip or zlib body, up to in_max bytes
+    std::string inflate_body(const std::string& in, size_t in_max) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+
+        // 15 bits of window, + 32 to detect a gzip or zlib header
+        if (inflateInit2(&zs, 15 + 32) != Z_OK)
+            throw std::runtime_error("could not initialize zlib");
+
+        std::string out;
+        char buf[65536];
+
+        zs.next_in = (Bytef *) in.data();
+        zs.avail_in = in.length();
+
+        int r;
+
+        do {
+            zs.next_out = (Bytef *) buf;
+            zs.avail_out = sizeof(buf);
+
+            r = inflate(&zs, Z_NO_FLUSH);
+
+            if (r != Z_OK && r != Z_STREAM_END) {
+                inflateEnd(&zs);
+                throw std::runtime_error("invalid compressed body");
+            }
+
+            out.append(buf, sizeof(buf) - zs.avail_out);
+
+            if (out.length() > in_max) {
+                inflateEnd(&zs);
+                throw std::runtime_error("decompressed body too large");
+            }
+        } while (r != Z_STREAM_END && (zs.avail_in != 0 || zs.avail_out == 0));
+
+        inflateEnd(&zs);
+
+        if (r != Z_STREAM_END)
+            throw std::runtime_error("truncated compressed body");
+
+        return out;
+    }
+}
+
 datasource_scan_source::datasource_scan_source(const std::string& uri, const std::string& source_type,
         const std::string& json_component_type) :
     endpoint_uri{uri},
@@ -46,6 +100,9 @@ datasource_scan_source::datasource_scan_source(const std::string& uri, const std
     pack_comp_devicetag = 
         packetchain->register_packet_component("DEVICETAG");
 
+    bulk_max_sz = 
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("scan_report_bulk_max_mb", 16) * 1024 * 1024;
+
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
     httpd->register_route(endpoint_uri, {"POST"}, "scanreport", {},
@@ -53,15 +110,156 @@ datasource_scan_source::datasource_scan_source(const std::string& uri, const std
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
                     return scan_result_endp_handler(con);
                 }));
+
+    httpd->register_route(endpoint_uri + "_bulk", {"POST"}, "scanreport", {},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    return scan_bulk_endp_handler(con);
+                }));
+
+    httpd->set_route_body_limit(endpoint_uri + "_bulk", bulk_max_sz);
 }
 
 datasource_scan_source::~datasource_scan_source() {
 
 }
 
+std::shared_ptr<kis_datasource> datasource_scan_source::find_virtual_source(const uuid& src_uuid,
+        const std::string& name) {
+    kis_lock_guard<kis_mutex> lk(mutex, "scan find_virtual_source");
+
+    // Look up the source by either the uuid provided or the uuid we made based on the name
+    auto virtual_source = datasourcetracker->find_datasource(src_uuid);
+
+    if (virtual_source == nullptr) {
+        auto virtual_builder = Globalreg::fetch_mandatory_global_as<datasource_virtual_builder>();
+
+        virtual_source = virtual_builder->build_datasource(virtual_builder);
+
+        auto vs_cast = std::static_pointer_cast<kis_datasource_virtual>(virtual_source);
+
+        vs_cast->set_virtual_hardware(virtual_source_type);
+
+        virtual_source->set_source_uuid(src_uuid);
+        virtual_source->set_source_key(adler32_checksum(src_uuid.uuid_to_string()));
+        virtual_source->set_source_name(name);
+
+        datasourcetracker->merge_source(virtual_source);
+    } else if (virtual_source->get_source_name() != name) {
+        // Update the name
+        virtual_source->set_source_name(name);
+    }
+
+    return virtual_source;
+}
+
+std::shared_ptr<kis_datasource> datasource_scan_source::find_virtual_source(const nlohmann::json& header) {
+    auto uuid_s = header.at("source_uuid").get<std::string>();
+    uuid src_uuid{uuid_s};
+
+    if (src_uuid.error)
+        throw std::runtime_error("invalid source uuid");
+
+    return find_virtual_source(src_uuid, header.at("source_name").get<std::string>());
+}
+
+void datasource_scan_source::inject_report(std::shared_ptr<kis_datasource> virtual_source,
+        nlohmann::json&& r) {
+    if (!r.is_object() || !validate_report(r))
+        throw std::runtime_error("invalid report");
+
+    // TS is optional
+    uint64_t ts_s = r.value("timestamp", 0);
+
+    auto packet = packetchain->generate_packet();
+
+    // Timestamp based on packet data, or now
+    if (ts_s != 0) {
+        packet->ts.tv_sec = ts_s;
+        packet->ts.tv_usec = 0;
+    } else {
+        gettimeofday(&packet->ts, nullptr);
+    }
+
+    // Extract any tags
+    auto tags_j = r["tags"];
+    if (tags_j.is_object()) {
+        auto tagsinfo = std::make_shared<kis_devicetag_packetinfo>();
+
+        for (const auto& i : tags_j.items()) {
+            tagsinfo->tagmap[i.key()] = i.value();
+        }
+
+        packet->insert(pack_comp_devicetag, tagsinfo);
+    }
+
+    double lat = r.value("lat", (double) 0);
+    double lon = r.value("lon", (double) 0);
+    double alt = r.value("alt", (double) 0);
+    double speed = r.value("speed", (double) 0);
+
+    if (lat != 0 && lon != 0) {
+        auto gpsinfo = std::make_shared<kis_gps_packinfo>();
+
+        gpsinfo->lat = lat;
+        gpsinfo->lon = lon;
+
+        if (alt != 0)
+            gpsinfo->fix = 3;
+        else
+            gpsinfo->fix = 2;
+
+        gpsinfo->alt = alt;
+        gpsinfo->speed = speed;
+
+        packet->insert(pack_comp_gps, gpsinfo);
+    }
+
+    std::shared_ptr<kis_layer1_packinfo> l1info;
+
+    if (!r["signal"].is_null()) {
+        if (l1info == nullptr)
+            l1info = std::make_shared<kis_layer1_packinfo>();
+
+        l1info->signal_dbm = r["signal"];
+        l1info->signal_type = kis_l1_signal_type_dbm;
+    }
+
+    if (!r["freqkhz"].is_null()) {
+        if (l1info == nullptr)
+            l1info = std::make_shared<kis_layer1_packinfo>();
+
+        l1info->freq_khz = r["freqkhz"];
+    }
+
+    if (!r["channel"].is_null()) {
+        if (l1info == nullptr)
+            l1info = std::make_shared<kis_layer1_packinfo>();
+
+        l1info->channel = r["channel"];
+    }
+
+    if (l1info != nullptr)
+        packet->insert(pack_comp_l1info, l1info);
+
+    // Hand the parsed record to the packet, so the classifier doesn't parse it again
+    auto jsoninfo = std::make_shared<kis_json_packinfo>();
+    jsoninfo->type = json_component_type;
+    jsoninfo->set_document(std::move(r));
+
+    packet->insert(pack_comp_json, jsoninfo);
+
+    auto srcinfo = std::make_shared<packetchain_comp_datasource>();
+    srcinfo->ref_source = virtual_source.get();
+    packet->insert(pack_comp_datasrc, srcinfo);
+
+    packetchain->process_packet(packet);
+
+    virtual_source->inc_source_num_packets(1);
+}
+
 void datasource_scan_source::scan_result_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
     std::ostream stream(&con->response_stream());
-    std::shared_ptr<kis_packet> packet;
 
     if (con->json() == nullptr) { 
         con->set_status(500);
@@ -72,12 +270,9 @@ void datasource_scan_source::scan_result_endp_handler(std::shared_ptr<kis_net_be
     try {
         std::shared_ptr<kis_datasource> virtual_source;
 
-        auto uuid_s = con->json()["source_uuid"].get<std::string>();
-        uuid src_uuid{uuid_s};
-
-        std::string name = con->json()["source_name"].get<std::string>();
-
-        if (src_uuid.error) {
+        try {
+            virtual_source = find_virtual_source(con->json());
+        } catch (const std::runtime_error& e) {
             con->set_status(500);
             stream << "{\"status\": \"invalid source uuid\", \"success\": false}\n";
             return;
@@ -88,141 +283,140 @@ void datasource_scan_source::scan_result_endp_handler(std::shared_ptr<kis_net_be
         if (!reports_j.is_array()) {
             con->set_status(500);
             stream << "{\"status\": \"expected 'reports' array\", \"success\": false}\n";
+            return;
         }
 
-        // Look up the source by either the uuid provided or the uuid we made based on the name
-        virtual_source = datasourcetracker->find_datasource(src_uuid);
+        for (auto& r : reports_j)
+            inject_report(virtual_source, std::move(r));
 
-        if (virtual_source == nullptr) {
-            auto virtual_builder = Globalreg::fetch_mandatory_global_as<datasource_virtual_builder>();
-
-            virtual_source = virtual_builder->build_datasource(virtual_builder);
+        stream << "{\"status\": \"Scan report accepted\", \"success\": true}\n";
+        return;
 
-            auto vs_cast = std::static_pointer_cast<kis_datasource_virtual>(virtual_source);
+    } catch (const std::exception& e) {
+        con->set_status(500);
+        stream << "{\"status\": \"" << e.what() << "\", \"success\": false}\n";
+        return;
+    }
 
-            vs_cast->set_virtual_hardware(virtual_source_type);
+    con->set_status(500);
+    stream << "{\"status\": \"unhandled request\", \"success\": false}\n";
+}
 
-            virtual_source->set_source_uuid(src_uuid);
-            virtual_source->set_source_key(adler32_checksum(src_uuid.uuid_to_string()));
-            virtual_source->set_source_name(name);
+void datasource_scan_source::scan_bulk_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::ostream stream(&con->response_stream());
 
-            datasourcetracker->merge_source(virtual_source);
-        } else {
-            // Update the name
-            virtual_source->set_source_name(name);
-        }
+    auto& req = con->request();
 
-        for (auto r : reports_j) {
-            if (!validate_report(r)) {
-                throw std::runtime_error("invalid report");
-            }
+    std::string body;
+    std::string content_type;
 
-            // TS is optional
-            uint64_t ts_s = r.value("timestamp", 0);
+    auto ct_h = req.find(boost::beast::http::field::content_type);
+    if (ct_h != req.end())
+        content_type = str_lower(std::string(ct_h->value().substr(0, ct_h->value().find(';'))));
 
-            packet = packetchain->generate_packet();
+    bool msgpack = content_type == "application/msgpack" || content_type == "application/x-msgpack";
+    bool ndjson = content_type == "application/x-ndjson" || content_type == "application/jsonl";
 
-            // Timestamp based on packet data, or now
-            if (ts_s != 0) {
-                packet->ts.tv_sec = ts_s;
-                packet->ts.tv_usec = 0;
-            } else {
-                gettimeofday(&packet->ts, nullptr);
-            }
+    uint64_t accepted = 0, rejected = 0;
+    std::shared_ptr<kis_datasource> virtual_source;
 
-            // Re-pack the submitted record into json for this packet
-            auto jsoninfo = std::make_shared<kis_json_packinfo>();
-            jsoninfo->type = json_component_type;
+    // Reports are injected in batches, holding the uploader while the packet chain is
+    // congested instead of having the reports dropped
+    auto inject = [&](nlohmann::json&& r) {
+        if (virtual_source == nullptr) {
+            rejected++;
+            return;
+        }
 
-            std::stringstream s;
-            s << r;
-            jsoninfo->json_string = s.str();
+        if ((accepted + rejected) % SCAN_BULK_BATCH == 0) {
+            while (packetchain->queue_congested())
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
 
-            packet->insert(pack_comp_json, jsoninfo);
+        try {
+            inject_report(virtual_source, std::move(r));
+            accepted++;
+        } catch (const std::exception& e) {
+            rejected++;
+        }
+    };
 
-            // Extract any tags
-            auto tags_j = r["tags"];
-            if (!tags_j.is_object()) {
-                auto tagsinfo = std::make_shared<kis_devicetag_packetinfo>();
+    // A batch of one source is an object of the source and its reports, as for a
+    // single scan report
+    auto handle_batch = [&](nlohmann::json& batch) {
+        virtual_source = find_virtual_source(batch);
 
-                for (const auto& i : tags_j.items()) {
-                    tagsinfo->tagmap[i.key()] = i.value();
-                }
+        auto& reports_j = batch["reports"];
 
-                packet->insert(pack_comp_devicetag, tagsinfo);
-            }
+        if (!reports_j.is_array())
+            throw std::runtime_error("expected 'reports' array");
 
-            double lat = r.value("lat", (double) 0);
-            double lon = r.value("lon", (double) 0);
-            double alt = r.value("alt", (double) 0);
-            double speed = r.value("speed", (double) 0);
+        for (auto& r : reports_j)
+            inject(std::move(r));
+    };
 
-            if (lat != 0 && lon != 0) {
-                auto gpsinfo = std::make_shared<kis_gps_packinfo>();
+    try {
+        auto ce_h = req.find(boost::beast::http::field::content_encoding);
 
-                gpsinfo->lat = lat;
-                gpsinfo->lon = lon;
-                
-                if (alt != 0)
-                    gpsinfo->fix = 3;
-                else
-                    gpsinfo->fix = 2;
+        if (ce_h != req.end() && boost::beast::iequals(ce_h->value(), "gzip"))
+            body = inflate_body(req.body(), bulk_max_sz);
+        else
+            body = std::move(req.body());
 
-                gpsinfo->alt = alt;
-                gpsinfo->speed = speed;
+        if (ndjson) {
+            // A line with a source_uuid starts the reports of that source, every other
+            // line is a report
+            size_t pos = 0;
 
-                packet->insert(pack_comp_gps, gpsinfo);
-            }
+            while (pos < body.length()) {
+                auto nl = body.find('\n', pos);
 
-            std::shared_ptr<kis_layer1_packinfo> l1info;
+                if (nl == std::string::npos)
+                    nl = body.length();
 
-            if (!r["signal"].is_null()) {
-                if (l1info == nullptr)
-                    l1info = std::make_shared<kis_layer1_packinfo>();
+                auto line = nonstd::string_view(body).substr(pos, nl - pos);
+                pos = nl + 1;
 
-                l1info->signal_dbm = r["signal"];
-                l1info->signal_type = kis_l1_signal_type_dbm;
-            }
+                if (line.find_first_not_of(" \t\r") == nonstd::string_view::npos)
+                    continue;
 
-            if (!r["freqkhz"].is_null()) {
-                if (l1info == nullptr)
-                    l1info = std::make_shared<kis_layer1_packinfo>();
+                auto r = nlohmann::json::parse(line.begin(), line.end(), nullptr, false);
 
-                l1info->freq_khz = r["freqkhz"];
-            }
+                if (r.is_discarded() || !r.is_object()) {
+                    rejected++;
+                    continue;
+                }
 
-            if (!r["channel"].is_null()) {
-                if (l1info == nullptr)
-                    l1info = std::make_shared<kis_layer1_packinfo>();
+                if (r.contains("source_uuid")) {
+                    virtual_source = find_virtual_source(r);
+                    continue;
+                }
 
-                l1info->channel = r["channel"];
+                inject(std::move(r));
             }
+        } else {
+            nlohmann::json j;
 
-            if (l1info != nullptr)
-                packet->insert(pack_comp_l1info, l1info);
-
-            auto srcinfo = std::make_shared<packetchain_comp_datasource>();
-            srcinfo->ref_source = virtual_source.get();
-            packet->insert(pack_comp_datasrc, srcinfo);
-
-            packetchain->process_packet(packet);
-
-            // Null out our local packet, it's destroyed by packetchain
-            packet = nullptr;
+            if (msgpack)
+                j = nlohmann::json::from_msgpack(body);
+            else
+                j = nlohmann::json::parse(body);
 
-            virtual_source->inc_source_num_packets(1);
+            // Upload gateways can send the batches of many sources at once
+            if (j.is_array()) {
+                for (auto& b : j)
+                    handle_batch(b);
+            } else {
+                handle_batch(j);
+            }
         }
-
-        stream << "{\"status\": \"Scan report accepted\", \"success\": true}\n";
-        return;
-
     } catch (const std::exception& e) {
-        con->set_status(500);
-        stream << "{\"status\": \"" << e.what() << "\", \"success\": false}\n";
+        con->set_status(400);
+        stream << nlohmann::json{{"status", e.what()}, {"success", false},
+            {"accepted", accepted}, {"rejected", rejected}} << "\n";
         return;
     }
 
-    con->set_status(500);
-    stream << "{\"status\": \"unhandled request\", \"success\": false}\n";
+    stream << nlohmann::json{{"status", "Scan reports accepted"}, {"success", true},
+        {"accepted", accepted}, {"rejected", rejected}} << "\n";
 }
-
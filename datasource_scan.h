@@ -45,14 +45,27 @@ protected:
     std::shared_ptr<datasource_tracker> datasourcetracker;
     std::shared_ptr<packet_chain> packetchain;
 
+    size_t bulk_max_sz;
+
     void scan_result_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
 
+    // Bulk reports, as a JSON object or array of source batches, msgpack of the same,
+    // or NDJSON of source lines each followed by their reports; bodies can be gzipped
+    void scan_bulk_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
+    // Find or create the virtual source of a report batch
+    std::shared_ptr<kis_datasource> find_virtual_source(const uuid& src_uuid, const std::string& name);
+    std::shared_ptr<kis_datasource> find_virtual_source(const nlohmann::json& header);
+
+    // Turn a report into a packet of the virtual source; throws on an invalid report
+    void inject_report(std::shared_ptr<kis_datasource> virtual_source, nlohmann::json&& report);
+
     int pack_comp_common, pack_comp_json, pack_comp_datasrc, pack_comp_gps,
         pack_comp_l1info, pack_comp_devicetag;
 
     // Validation function; can either return 'false' for generic error, or throw a specific error
     // exception to be returned to the submitter
-    bool validate_report(nlohmann::json& report) { return true; }
+    bool validate_report(const nlohmann::json& report) { return true; }
 };
 
 #endif /* ifndef DATASOURCE_SCAN_H__ */
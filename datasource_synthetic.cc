@@ -0,0 +1,827 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "adsb_modes.h"
+#include "datasource_synthetic.h"
+#include "messagebus.h"
+#include "phy_btle.h"
+#include "util.h"
+
+#ifndef KDLT_BLUETOOTH_LE_LL
+#define KDLT_BLUETOOTH_LE_LL        251
+#endif
+
+#define SYNTHETIC_REPORT_INTERVAL   10
+
+// Packets generated between checks of the clock
+#define SYNTHETIC_BURST             256
+
+// Fraction of the target rate the source has to reach before it's reported
+#define SYNTHETIC_SUSTAIN           0.95
+
+namespace {
+
+// splitmix64; small, fast, and the same sequence on every platform
+uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+void append8(std::string& frame, uint8_t v) {
+    frame += (char) v;
+}
+
+void append16le(std::string& frame, uint16_t v) {
+    frame += (char) (v & 0xFF);
+    frame += (char) (v >> 8);
+}
+
+void append_mac(std::string& frame, const uint8_t *mac) {
+    frame.append((const char *) mac, 6);
+}
+
+void append_ie(std::string& frame, uint8_t tag, const std::string& content) {
+    append8(frame, tag);
+    append8(frame, content.length());
+    frame += content;
+}
+
+const uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+const std::string wifi_rates{"\x82\x84\x8b\x96\x0c\x12\x18\x24", 8};
+
+// RSN with CCMP for the group and pairwise ciphers, and PSK
+const std::string wifi_rsn{"\x01\x00\x00\x0f\xac\x04\x01\x00\x00\x0f\xac\x04"
+    "\x01\x00\x00\x0f\xac\x02\x00\x00", 20};
+
+const struct {
+    unsigned int channel;
+    unsigned int freq_mhz;
+} wifi_channels[] = {
+    {1, 2412}, {6, 2437}, {11, 2462}, {36, 5180}, {40, 5200}, {44, 5220},
+    {48, 5240}, {149, 5745}, {153, 5765}, {157, 5785}, {161, 5805},
+};
+
+const unsigned int btle_adv_freqs[] = {2402, 2426, 2480};
+
+// OUIs of the fixed populations
+const uint8_t population_ouis[][3] = {
+    {0x00, 0x0F, 0x61},     // probe, unused; probing clients are randomized
+    {0x00, 0x1A, 0x11},     // beacon
+    {0x00, 0x26, 0xBB},     // data
+    {0x00, 0x00, 0x00},     // adsb, unused
+    {0x00, 0x00, 0x00},     // btle, unused
+};
+
+// 6-bit Mode-S character of a callsign character
+uint8_t modes_char(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 1;
+
+    if (c >= '0' && c <= '9')
+        return c - '0' + 48;
+
+    return 32;
+}
+
+double cpr_mod(double x, double y) {
+    return x - y * floor(x / y);
+}
+
+}
+
+kis_datasource_synthetic::kis_datasource_synthetic(shared_datasource_builder in_builder) :
+    kis_datasource(in_builder),
+    stopping{false},
+    mix_total{0},
+    rate{0},
+    packet_limit{0},
+    seed{1},
+    random_state{1},
+    probe_macs{0},
+    aps{0},
+    clients{0},
+    aircraft{0},
+    btle_devices{0},
+    center_lat{0},
+    center_lon{0},
+    seqno{0},
+    gen_packets{0},
+    gen_bytes{0},
+    interval_packets{0},
+    interval_dropped{0},
+    interval_congested{0},
+    rate_warning{false} {
+
+    // Packets are generated in-process
+    set_int_source_hardware("synthetic");
+
+    pack_comp_adsb = packetchain->register_packet_component("ADSB");
+}
+
+kis_datasource_synthetic::~kis_datasource_synthetic() {
+    stop_generator();
+}
+
+void kis_datasource_synthetic::open_interface(std::string in_definition, unsigned int in_transaction,
+        open_callback_t in_cb) {
+    stop_generator();
+
+    kis_unique_lock<kis_mutex> lock(ext_mutex, "synthetic open_interface");
+
+    if (in_transaction == 0)
+        in_transaction = next_transaction++;
+
+    lock.unlock();
+
+    auto fail = [&](const std::string& reason) {
+        set_int_source_error(true);
+        set_int_source_error_reason(reason);
+
+        if (in_cb != nullptr)
+            in_cb(in_transaction, false, reason);
+    };
+
+    set_int_source_definition(in_definition);
+
+    if (!parse_source_definition(in_definition)) {
+        fail("Malformed source config");
+        return;
+    }
+
+    set_int_source_cap_interface(get_source_interface());
+
+    // Numeric options, with their defaults
+    auto opt_n = [&](const std::string& opt, uint64_t dfl) -> uint64_t {
+        auto v = get_definition_opt(opt);
+
+        if (v == "")
+            return dfl;
+
+        return string_to_n<uint64_t>(v);
+    };
+
+    try {
+        if (get_definition_opt("rate") == "max") {
+            rate = 0;
+        } else {
+            rate = opt_n("rate", 1000);
+        }
+
+        packet_limit = opt_n("packets", 0);
+        seed = opt_n("seed", 1);
+        probe_macs = opt_n("probe_macs", 100000);
+        aps = opt_n("aps", 100);
+        clients = opt_n("clients", 10);
+        aircraft = opt_n("aircraft", 100);
+        btle_devices = opt_n("btle_devices", 1000);
+    } catch (const std::exception& e) {
+        fail("Invalid synthetic source option, expected a number");
+        return;
+    }
+
+    center_lat = get_definition_opt_double("lat", 0);
+    center_lon = get_definition_opt_double("lon", 0);
+
+    if (center_lat < -80 || center_lat > 80 || center_lon < -180 || center_lon > 180) {
+        fail(fmt::format("Invalid synthetic source location {},{}", center_lat, center_lon));
+        return;
+    }
+
+    auto mixdef = get_definition_opt("mix");
+
+    if (mixdef == "")
+        mixdef = "probe:30,beacon:10,data:50,adsb:5,btle:5";
+
+    mix.clear();
+    mix_total = 0;
+
+    for (const auto& m : str_tokenize(mixdef, ",")) {
+        auto kv = str_tokenize(m, ":");
+        frame_kind kind;
+
+        if (kv.size() != 2) {
+            fail(fmt::format("Invalid synthetic mix '{}', expected kind:weight", m));
+            return;
+        }
+
+        auto k = str_lower(kv[0]);
+
+        if (k == "probe") {
+            kind = frame_kind::probe;
+        } else if (k == "beacon") {
+            kind = frame_kind::beacon;
+        } else if (k == "data") {
+            kind = frame_kind::data;
+        } else if (k == "adsb") {
+            kind = frame_kind::adsb;
+        } else if (k == "btle") {
+            kind = frame_kind::btle;
+        } else {
+            fail(fmt::format("Unknown synthetic frame kind '{}', expected probe, beacon, "
+                        "data, adsb, or btle", kv[0]));
+            return;
+        }
+
+        auto weight = string_to_n_dfl<unsigned int>(kv[1], 0);
+
+        if (weight == 0)
+            continue;
+
+        mix_total += weight;
+        mix.push_back(std::make_pair(kind, mix_total));
+    }
+
+    if (mix_total == 0) {
+        fail("Synthetic mix generates no frames");
+        return;
+    }
+
+    // Beacons and data need somewhere to come from
+    if (aps == 0)
+        aps = 1;
+    if (clients == 0)
+        clients = 1;
+    if (aircraft == 0)
+        aircraft = 1;
+    if (btle_devices == 0)
+        btle_devices = 1;
+
+    if (!local_uuid) {
+        auto uuidstr = fmt::format("{:08X}-0000-0000-0000-0000{:08X}",
+                adler32_checksum("kismet_synthetic"), adler32_checksum(get_source_interface()));
+        uuid u(uuidstr);
+
+        set_source_uuid(u);
+        set_source_key(adler32_checksum(u.uuid_to_string()));
+    }
+
+    set_int_source_retry_attempts(0);
+    set_int_source_error(false);
+    set_int_source_error_reason("");
+    set_int_source_warning("");
+    set_int_source_running(true);
+
+    if (rate == 0)
+        _MSG_INFO("Synthetic source '{}' generating as fast as packets can be processed, "
+                "seed {}", get_source_name(), seed);
+    else
+        _MSG_INFO("Synthetic source '{}' generating {:.0f} packets/sec, seed {}",
+                get_source_name(), rate, seed);
+
+    stopping = false;
+    random_state = seed;
+    seqno = 0;
+    gen_packets = 0;
+    gen_bytes = 0;
+    gen_start = interval_start = std::chrono::steady_clock::now();
+    interval_packets = 0;
+    interval_dropped = get_source_num_dropped_packets();
+    interval_congested = std::chrono::steady_clock::duration::zero();
+    rate_warning = false;
+
+    generator = std::thread([this]() {
+            thread_set_process_name("SYNTHETIC");
+            generator_thread();
+        });
+
+    if (in_cb != nullptr)
+        in_cb(in_transaction, true, "Source opened");
+}
+
+void kis_datasource_synthetic::close_external_impl() {
+    stop_generator();
+    kis_datasource::close_external_impl();
+}
+
+void kis_datasource_synthetic::stop_generator() {
+    stopping = true;
+
+    if (generator.joinable()) {
+        if (generator.get_id() == std::this_thread::get_id())
+            generator.detach();
+        else
+            generator.join();
+    }
+}
+
+uint64_t kis_datasource_synthetic::next_random() {
+    random_state += 0x9E3779B97F4A7C15ULL;
+    return mix64(random_state);
+}
+
+void kis_datasource_synthetic::population_mac(uint8_t *in_mac, frame_kind in_kind, uint64_t in_n,
+        bool in_local) {
+    auto k = static_cast<unsigned int>(in_kind);
+    auto h = mix64(seed ^ ((uint64_t) k << 56));
+
+    // The member number is xored with a constant of the run, so the MACs of a
+    // population are unique but don't count up
+    uint32_t n = (uint32_t) in_n ^ (uint32_t) h;
+
+    if (in_local) {
+        in_mac[0] = ((h >> 32) & 0xFC) | 0x02;
+        in_mac[1] = (h >> 40) & 0xFF;
+        in_mac[2] = (n >> 24) & 0xFF;
+    } else {
+        in_mac[0] = population_ouis[k][0];
+        in_mac[1] = population_ouis[k][1];
+        in_mac[2] = population_ouis[k][2];
+    }
+
+    in_mac[3] = (n >> 16) & 0xFF;
+    in_mac[4] = (n >> 8) & 0xFF;
+    in_mac[5] = n & 0xFF;
+}
+
+void kis_datasource_synthetic::generator_thread() {
+    while (!stopping) {
+        if (packet_limit != 0 && gen_packets >= packet_limit)
+            break;
+
+        // Hold the generator while the source is paused; the pause isn't counted
+        // against the rate
+        if (get_source_paused()) {
+            while (get_source_paused() && !stopping)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            interval_start = std::chrono::steady_clock::now();
+            interval_packets = 0;
+            interval_dropped = get_source_num_dropped_packets();
+            interval_congested = std::chrono::steady_clock::duration::zero();
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - interval_start >= std::chrono::seconds(SYNTHETIC_REPORT_INTERVAL)) {
+            report_rate(false);
+            continue;
+        }
+
+        uint64_t burst = SYNTHETIC_BURST;
+
+        if (rate > 0) {
+            // Packets due since the start of the interval; a paced source never waits on
+            // the packet chain, a congested chain drops them and the source reports it
+            double elapsed = std::chrono::duration<double>(now - interval_start).count();
+            auto due = (uint64_t) (elapsed * rate);
+
+            if (due <= interval_packets) {
+                auto wait = std::chrono::duration<double>((interval_packets + 1 - due) / rate);
+
+                std::this_thread::sleep_for(std::min(
+                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait),
+                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::milliseconds(1))));
+                continue;
+            }
+
+            burst = std::min(burst, due - interval_packets);
+        } else if (packetchain->queue_congested()) {
+            // Wait for the packet chain to catch up rather than have it drop packets
+            while (packetchain->queue_congested() && !stopping)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            interval_congested += std::chrono::steady_clock::now() - now;
+            continue;
+        }
+
+        for (uint64_t i = 0; i < burst && !stopping; i++) {
+            if (packet_limit != 0 && gen_packets >= packet_limit)
+                break;
+
+            generate_packet();
+        }
+    }
+
+    if (stopping)
+        return;
+
+    report_rate(true);
+
+    set_int_source_running(false);
+}
+
+void kis_datasource_synthetic::generate_packet() {
+    auto pick = random_below(mix_total);
+    auto kind = mix[0].first;
+
+    for (const auto& m : mix) {
+        if (pick < m.second) {
+            kind = m.first;
+            break;
+        }
+    }
+
+    auto packet = packetchain->generate_packet();
+
+    gettimeofday(&(packet->ts), NULL);
+
+    switch (kind) {
+        case frame_kind::probe:
+            generate_probe(packet);
+            break;
+        case frame_kind::beacon:
+            generate_beacon(packet);
+            break;
+        case frame_kind::data:
+            generate_data(packet);
+            break;
+        case frame_kind::adsb:
+            generate_adsb(packet);
+            break;
+        case frame_kind::btle:
+            generate_btle(packet);
+            break;
+    }
+
+    if (kind != frame_kind::adsb) {
+        packet->original_len = frame.length();
+        packet->set_data(frame);
+
+        auto datachunk = packetchain->new_packet_component<kis_datachunk>();
+
+        datachunk->dlt = kind == frame_kind::btle ? KDLT_BLUETOOTH_LE_LL : KDLT_IEEE802_11;
+        datachunk->set_data(packet->data);
+
+        packet->insert(pack_comp_linkframe, datachunk);
+    }
+
+    get_source_packet_size_rrd()->add_sample(frame.length(), Globalreg::globalreg->last_tv_sec);
+
+    handle_rx_packet(packet);
+
+    gen_packets++;
+    gen_bytes += frame.length();
+    interval_packets++;
+}
+
+void kis_datasource_synthetic::generate_probe(std::shared_ptr<kis_packet> packet) {
+    uint8_t mac[6];
+
+    if (probe_macs == 0)
+        population_mac(mac, frame_kind::probe, next_random(), true);
+    else
+        population_mac(mac, frame_kind::probe, random_below(probe_macs), true);
+
+    frame.clear();
+
+    append16le(frame, 0x0040);
+    append16le(frame, 0);
+    append_mac(frame, broadcast_mac);
+    append_mac(frame, mac);
+    append_mac(frame, broadcast_mac);
+    append16le(frame, (seqno++ & 0xFFF) << 4);
+
+    // Most probes are broadcast, some look for one of the networks
+    if (random_below(4) == 0)
+        append_ie(frame, 0, fmt::format("synthetic-{}", random_below(aps)));
+    else
+        append_ie(frame, 0, "");
+
+    append_ie(frame, 1, wifi_rates);
+
+    const auto& chan = wifi_channels[random_below(sizeof(wifi_channels) / sizeof(wifi_channels[0]))];
+
+    auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+    l1info->freq_khz = chan.freq_mhz * 1000;
+    l1info->signal_type = kis_l1_signal_type_dbm;
+    l1info->signal_dbm = -90 + (int) random_below(60);
+    packet->insert(pack_comp_l1info, l1info);
+}
+
+void kis_datasource_synthetic::generate_beacon(std::shared_ptr<kis_packet> packet) {
+    auto ap = random_below(aps);
+
+    uint8_t bssid[6];
+    population_mac(bssid, frame_kind::beacon, ap, false);
+
+    // Each AP stays on its channel
+    const auto& chan = wifi_channels[mix64(seed ^ ap) %
+        (sizeof(wifi_channels) / sizeof(wifi_channels[0]))];
+
+    frame.clear();
+
+    append16le(frame, 0x0080);
+    append16le(frame, 0);
+    append_mac(frame, broadcast_mac);
+    append_mac(frame, bssid);
+    append_mac(frame, bssid);
+    append16le(frame, (seqno++ & 0xFFF) << 4);
+
+    uint64_t tsf = gen_packets * 1024;
+    for (unsigned int i = 0; i < 8; i++)
+        append8(frame, (tsf >> (i * 8)) & 0xFF);
+
+    append16le(frame, 0x0064);
+    append16le(frame, 0x0411);
+
+    append_ie(frame, 0, fmt::format("synthetic-{}", ap));
+    append_ie(frame, 1, wifi_rates);
+    append_ie(frame, 3, std::string(1, (char) chan.channel));
+    append_ie(frame, 48, wifi_rsn);
+
+    auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+    l1info->freq_khz = chan.freq_mhz * 1000;
+    l1info->signal_type = kis_l1_signal_type_dbm;
+    l1info->signal_dbm = -90 + (int) (mix64(seed ^ ap) >> 32) % 60;
+    packet->insert(pack_comp_l1info, l1info);
+}
+
+void kis_datasource_synthetic::generate_data(std::shared_ptr<kis_packet> packet) {
+    auto ap = random_below(aps);
+    auto client = random_below(clients);
+
+    uint8_t bssid[6], client_mac[6];
+    population_mac(bssid, frame_kind::beacon, ap, false);
+    population_mac(client_mac, frame_kind::data, ap * clients + client, false);
+
+    const auto& chan = wifi_channels[mix64(seed ^ ap) %
+        (sizeof(wifi_channels) / sizeof(wifi_channels[0]))];
+
+    bool to_ds = random_below(2) == 0;
+
+    frame.clear();
+
+    // Protected data, to or from the AP
+    append8(frame, 0x08);
+    append8(frame, to_ds ? 0x41 : 0x42);
+    append16le(frame, 0);
+
+    if (to_ds) {
+        append_mac(frame, bssid);
+        append_mac(frame, client_mac);
+        append_mac(frame, bssid);
+    } else {
+        append_mac(frame, client_mac);
+        append_mac(frame, bssid);
+        append_mac(frame, bssid);
+    }
+
+    append16le(frame, (seqno++ & 0xFFF) << 4);
+
+    // CCMP header, with the packet number and the extended IV bit
+    auto pn = gen_packets;
+    append8(frame, pn & 0xFF);
+    append8(frame, (pn >> 8) & 0xFF);
+    append8(frame, 0);
+    append8(frame, 0x20);
+    for (unsigned int i = 2; i < 6; i++)
+        append8(frame, (pn >> (i * 8)) & 0xFF);
+
+    // Encrypted payload and MIC
+    auto payload_len = 40 + random_below(1460) + 8;
+
+    for (uint64_t i = 0; i < payload_len; i += 8) {
+        auto r = next_random();
+
+        for (unsigned int b = 0; b < 8 && i + b < payload_len; b++)
+            append8(frame, (r >> (b * 8)) & 0xFF);
+    }
+
+    auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+    l1info->freq_khz = chan.freq_mhz * 1000;
+    l1info->signal_type = kis_l1_signal_type_dbm;
+    l1info->signal_dbm = -90 + (int) random_below(60);
+    packet->insert(pack_comp_l1info, l1info);
+}
+
+void kis_datasource_synthetic::generate_adsb(std::shared_ptr<kis_packet> packet) {
+    auto n = random_below(aircraft);
+    auto h = mix64(seed ^ (n << 8) ^ 0xAD5B);
+
+    uint32_t icao = 0x400000 + (n & 0x3FFFFF);
+
+    // Each aircraft flies a straight line from its start, at the time of the generated
+    // stream rather than the clock, so the tracks are the same every run
+    double t = gen_packets / (rate > 0 ? rate : 10000.0);
+    double heading = (h >> 48) % 360;
+    double speed = 150 + (h >> 40) % 350;
+    double dist = speed * t / 3600 / 60;
+
+    double lat = center_lat + ((h & 0xFFFF) / 65535.0 - 0.5) * 2 + dist * cos(heading * M_PI / 180);
+    double lon = center_lon + (((h >> 16) & 0xFFFF) / 65535.0 - 0.5) * 2 +
+        dist * sin(heading * M_PI / 180) / cos(lat * M_PI / 180);
+
+    lat = std::max(-85.0, std::min(85.0, lat));
+    lon = cpr_mod(lon + 180, 360) - 180;
+
+    int alt = 1000 + ((h >> 32) % 390) * 100;
+
+    uint8_t msg[ADSB_MODES_LONG_LEN];
+    memset(msg, 0, sizeof(msg));
+
+    msg[0] = (17 << 3) | 5;
+    msg[1] = (icao >> 16) & 0xFF;
+    msg[2] = (icao >> 8) & 0xFF;
+    msg[3] = icao & 0xFF;
+
+    auto me = msg + 4;
+    auto type = random_below(10);
+
+    if (type < 2) {
+        // Identification
+        auto callsign = fmt::format("SYN{:04} ", n % 10000);
+        uint64_t bits = 0;
+
+        for (const auto& c : callsign)
+            bits = (bits << 6) | modes_char(c);
+
+        me[0] = 4 << 3;
+        for (unsigned int i = 0; i < 6; i++)
+            me[1 + i] = (bits >> ((5 - i) * 8)) & 0xFF;
+    } else if (type < 7) {
+        // Airborne position with barometric altitude, even and odd CPR frames
+        bool odd = random_below(2);
+        unsigned int alt_n = (alt + 1000) / 25;
+
+        me[0] = 11 << 3;
+        me[1] = ((alt_n >> 4) << 1) | 0x01;
+        me[2] = (alt_n & 0x0F) << 4;
+
+        if (odd)
+            me[2] |= 0x04;
+
+        double dlat = 360.0 / (60 - odd);
+        auto yz = (uint32_t) floor(131072 * cpr_mod(lat, dlat) / dlat + 0.5);
+        double rlat = dlat * (yz / 131072.0 + floor(lat / dlat));
+        double dlon = 360.0 / std::max(adsb_cpr_nl(rlat) - (int) odd, 1);
+        auto xz = (uint32_t) floor(131072 * cpr_mod(lon, dlon) / dlon + 0.5);
+
+        yz &= 0x1FFFF;
+        xz &= 0x1FFFF;
+
+        me[2] |= (yz >> 15) & 0x03;
+        me[3] = (yz >> 7) & 0xFF;
+        me[4] = ((yz & 0x7F) << 1) | ((xz >> 16) & 0x01);
+        me[5] = (xz >> 8) & 0xFF;
+        me[6] = xz & 0xFF;
+    } else {
+        // Ground speed as east/west and north/south components
+        double ew = speed * sin(heading * M_PI / 180);
+        double ns = speed * cos(heading * M_PI / 180);
+
+        unsigned int ew_v = std::min((unsigned int) fabs(ew) + 1, 1023U);
+        unsigned int ns_v = std::min((unsigned int) fabs(ns) + 1, 1023U);
+
+        me[0] = (19 << 3) | 1;
+        me[1] = (ew < 0 ? 0x04 : 0) | ((ew_v >> 8) & 0x03);
+        me[2] = ew_v & 0xFF;
+        me[3] = (ns < 0 ? 0x80 : 0) | ((ns_v >> 3) & 0x7F);
+        me[4] = (ns_v & 0x07) << 5;
+    }
+
+    auto crc = adsb_modes_crc24(msg, ADSB_MODES_LONG_LEN - 3);
+    msg[11] = (crc >> 16) & 0xFF;
+    msg[12] = (crc >> 8) & 0xFF;
+    msg[13] = crc & 0xFF;
+
+    frame.assign((const char *) msg, sizeof(msg));
+
+    auto adsbinfo = std::make_shared<kis_adsb_packinfo>();
+    adsbinfo->set_frame(msg, sizeof(msg));
+    adsb_modes_decode(adsbinfo->frame, adsbinfo->len, adsbinfo->msg);
+
+    packet->insert(pack_comp_adsb, adsbinfo);
+
+    auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+    l1info->freq_khz = 1090000;
+    l1info->signal_type = kis_l1_signal_type_dbm;
+    l1info->signal_dbm = -90 + (int) random_below(60);
+    packet->insert(pack_comp_l1info, l1info);
+}
+
+void kis_datasource_synthetic::generate_btle(std::shared_ptr<kis_packet> packet) {
+    auto n = random_below(btle_devices);
+
+    // Random static address, sent least significant byte first
+    uint8_t addr[6];
+    population_mac(addr, frame_kind::btle, n, true);
+    addr[0] |= 0xC0;
+
+    std::string adv;
+
+    append8(adv, 2);
+    append8(adv, 0x01);
+    append8(adv, 0x06);
+
+    auto name = fmt::format("SYN-{:04X}", n & 0xFFFF);
+    append8(adv, name.length() + 1);
+    append8(adv, 0x09);
+    adv += name;
+
+    // Manufacturer data with a rolling counter, like the beacons of most devices
+    append8(adv, 5);
+    append8(adv, 0xFF);
+    append16le(adv, 0xFFFF);
+    append16le(adv, gen_packets & 0xFFFF);
+
+    frame.clear();
+
+    // Advertising access address
+    frame.append("\xd6\xbe\x89\x8e", 4);
+
+    // ADV_IND with a random address
+    append8(frame, 0x40);
+    append8(frame, 6 + adv.length());
+
+    for (int i = 5; i >= 0; i--)
+        append8(frame, addr[i]);
+
+    frame += adv;
+
+    auto crc = kis_btle_phy::calc_btle_crc_reflected(0xAAAAAA, frame.data() + 4,
+            frame.length() - 4);
+
+    append8(frame, crc & 0xFF);
+    append8(frame, (crc >> 8) & 0xFF);
+    append8(frame, (crc >> 16) & 0xFF);
+
+    auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+    l1info->freq_khz = btle_adv_freqs[random_below(3)] * 1000;
+    l1info->signal_type = kis_l1_signal_type_dbm;
+    l1info->signal_dbm = -100 + (int) random_below(60);
+    packet->insert(pack_comp_l1info, l1info);
+}
+
+void kis_datasource_synthetic::report_rate(bool in_final) {
+    auto now = std::chrono::steady_clock::now();
+
+    double elapsed = std::chrono::duration<double>(now - interval_start).count();
+    double achieved = elapsed > 0 ? interval_packets / elapsed : 0;
+
+    auto dropped = get_source_num_dropped_packets();
+    auto interval_drops = dropped - interval_dropped;
+
+    std::string warning;
+
+    // A short final interval doesn't say much about the rate
+    if (rate > 0 && elapsed >= 1 && achieved < rate * SYNTHETIC_SUSTAIN)
+        warning = fmt::format("could not sustain {:.0f} packets/sec, generated {:.0f} "
+                "packets/sec", rate, achieved);
+
+    if (interval_drops != 0) {
+        if (warning.length() != 0)
+            warning += "; ";
+
+        warning += fmt::format("the packet chain dropped {} packets in {:.0f} seconds",
+                interval_drops, elapsed);
+    }
+
+    if (warning.length() != 0) {
+        _MSG_ERROR("Synthetic source '{}' {}", get_source_name(), warning);
+        set_int_source_warning(fmt::format("Synthetic source {}", warning));
+        rate_warning = true;
+    } else if (rate_warning) {
+        _MSG_INFO("Synthetic source '{}' is sustaining {:.0f} packets/sec again",
+                get_source_name(), achieved);
+        set_int_source_warning("");
+        rate_warning = false;
+    }
+
+    if (rate == 0 && elapsed > 0 && interval_congested > std::chrono::steady_clock::duration::zero())
+        _MSG_INFO("Synthetic source '{}' generated {:.0f} packets/sec, waiting on the "
+                "packet chain {:.0f}% of the time", get_source_name(), achieved,
+                100 * std::chrono::duration<double>(interval_congested).count() / elapsed);
+
+    if (in_final) {
+        double total = std::chrono::duration<double>(now - gen_start).count();
+        double mbytes = (double) gen_bytes / (1024 * 1024);
+
+        if (total <= 0)
+            total = 1;
+
+        _MSG_INFO("Synthetic source '{}' finished, {} packets, {:.1f} MB in {:.1f} seconds "
+                "({:.0f} packets/sec, {:.1f} MB/sec)", get_source_name(), gen_packets,
+                mbytes, total, gen_packets / total, mbytes / total);
+    }
+
+    interval_start = now;
+    interval_packets = 0;
+    interval_dropped = dropped;
+    interval_congested = std::chrono::steady_clock::duration::zero();
+}
@@ -0,0 +1,196 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DATASOURCE_SYNTHETIC_H__
+#define __DATASOURCE_SYNTHETIC_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kis_datasource.h"
+
+class kis_datasource_synthetic;
+typedef std::shared_ptr<kis_datasource_synthetic> shared_datasource_synthetic;
+
+// Synthetic traffic generator, for stress-testing the scaling of Kismet without a
+// capture of the environment.
+//
+// The source generates a weighted mix of frames in a thread of the server and hands
+// them straight to the packet chain, like the replay source:
+//
+//  probe   802.11 probe requests from a pool of randomized (locally administered) MACs
+//  beacon  802.11 beacons from a population of access points
+//  data    Protected 802.11 data between the access points and their clients
+//  adsb    ADS-B identification, position, and velocity squitters from aircraft
+//  btle    BTLE advertisements from a population of devices
+//
+// The frames are generated from a seeded random sequence, so two runs with the same
+// options generate the same traffic.  'rate=N' generates N packets per second, and
+// the source reports every 10 seconds when it can't sustain the rate, or when the
+// packet chain drops its packets; 'rate=max' generates as fast as the packet chain
+// accepts them.  'packets=N' stops after N packets, which ends a benchmark run.
+//
+// The mix is a quoted list of kinds and weights:
+//
+//    source=stadium:type=synthetic,rate=50000,probe_macs=2000000,mix="probe:70,data:30"
+//    source=airport:type=synthetic,rate=max,packets=10000000,mix="adsb:1",aircraft=5000
+class kis_datasource_synthetic : public kis_datasource {
+public:
+    kis_datasource_synthetic(shared_datasource_builder in_builder);
+    virtual ~kis_datasource_synthetic();
+
+    virtual void open_interface(std::string in_definition, unsigned int in_transaction,
+            open_callback_t in_cb) override;
+
+    // Don't start generating again once a fixed number of packets is done
+    virtual std::string override_default_option(std::string in_opt) override {
+        if (in_opt == "retry")
+            return "false";
+
+        return "";
+    }
+
+protected:
+    enum class frame_kind {
+        probe, beacon, data, adsb, btle
+    };
+
+    virtual void close_external_impl() override;
+
+    void stop_generator();
+
+    void generator_thread();
+
+    // Generate one frame of the mix and inject it
+    void generate_packet();
+
+    void generate_probe(std::shared_ptr<kis_packet> packet);
+    void generate_beacon(std::shared_ptr<kis_packet> packet);
+    void generate_data(std::shared_ptr<kis_packet> packet);
+    void generate_adsb(std::shared_ptr<kis_packet> packet);
+    void generate_btle(std::shared_ptr<kis_packet> packet);
+
+    // Check the rate of the last report interval
+    void report_rate(bool in_final);
+
+    // Deterministic random sequence
+    uint64_t next_random();
+    uint64_t random_below(uint64_t in_max) {
+        return in_max == 0 ? 0 : next_random() % in_max;
+    }
+
+    // Stable MAC of the nth member of a population; locally administered MACs are
+    // randomized client MACs, the others have a fixed OUI per population
+    void population_mac(uint8_t *in_mac, frame_kind in_kind, uint64_t in_n, bool in_local);
+
+    std::thread generator;
+    std::atomic<bool> stopping;
+
+    // Mix of frames, as cumulative weights
+    std::vector<std::pair<frame_kind, unsigned int>> mix;
+    unsigned int mix_total;
+
+    // Target packets per second, or 0 for as fast as the packet chain accepts them
+    double rate;
+
+    // Stop after this many packets, or 0 to run until closed
+    uint64_t packet_limit;
+
+    uint64_t seed;
+    uint64_t random_state;
+
+    // Population sizes; a probe pool of 0 randomizes every probe
+    uint64_t probe_macs;
+    uint64_t aps;
+    uint64_t clients;
+    uint64_t aircraft;
+    uint64_t btle_devices;
+
+    // Aircraft are placed around this location
+    double center_lat, center_lon;
+
+    uint16_t seqno;
+
+    int pack_comp_adsb;
+
+    // Frames are built here and copied into the packet
+    std::string frame;
+
+    uint64_t gen_packets;
+    uint64_t gen_bytes;
+    std::chrono::steady_clock::time_point gen_start;
+
+    // Rate of the current report interval; pacing restarts at each interval, so the
+    // generator never tries to catch up a backlog from an earlier interval
+    std::chrono::steady_clock::time_point interval_start;
+    uint64_t interval_packets;
+    uint64_t interval_dropped;
+    std::chrono::steady_clock::duration interval_congested;
+    bool rate_warning;
+};
+
+class datasource_synthetic_builder : public kis_datasource_builder {
+public:
+    datasource_synthetic_builder() :
+        kis_datasource_builder() {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_synthetic_builder(int in_id) :
+        kis_datasource_builder(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_synthetic_builder(int in_id, std::shared_ptr<tracker_element_map> e) :
+        kis_datasource_builder(in_id, e) {
+        register_fields();
+        reserve_fields(e);
+        initialize();
+    }
+
+    virtual ~datasource_synthetic_builder() { }
+
+    virtual shared_datasource build_datasource(shared_datasource_builder in_sh_this) override {
+        return shared_datasource_synthetic(new kis_datasource_synthetic(in_sh_this));
+    }
+
+    virtual void initialize() override {
+        set_source_type("synthetic");
+        set_source_description("Synthetic traffic generator for load testing");
+
+        set_probe_capable(false);
+        set_list_capable(false);
+        set_local_capable(true);
+        set_remote_capable(false);
+        set_passive_capable(false);
+        set_tune_capable(false);
+        set_hop_capable(false);
+    }
+};
+
+#endif
+
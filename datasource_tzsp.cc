@@ -16,67 +16,512 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <pcap/pcap.h>
+
 #include "configfile.h"
 #include "datasourcetracker.h"
 #include "datasource_virtual.h"
 #include "datasource_tzsp.h"
+#include "messagebus.h"
+#include "packetchain.h"
+#include "timetracker.h"
+#include "util.h"
 
 tzsp_source::tzsp_source() :
-    lifetime_global() {
+    lifetime_global(),
+    stopping{false},
+    expire_timer_id{-1},
+    num_malformed{0},
+    last_malformed{0} {
+
+    tzsp_mutex.set_name("tzsp_source");
 
     packetchain =
         Globalreg::fetch_mandatory_global_as<packet_chain>();
     datasourcetracker =
         Globalreg::fetch_mandatory_global_as<datasource_tracker>();
-    pollabletracker =
-        Globalreg::fetch_mandatory_global_as<pollable_tracker>();
+    timetracker =
+        Globalreg::fetch_mandatory_global_as<time_tracker>();
 
-	pack_comp_common = packetchain->register_packet_component("COMMON");
-	pack_comp_linkframe = packetchain->register_packet_component("LINKFRAME");
+    pack_comp_linkframe = packetchain->register_packet_component("LINKFRAME");
     pack_comp_l1info = packetchain->register_packet_component("RADIODATA");
-	pack_comp_datasrc = packetchain->register_packet_component("KISDATASRC");
 
     auto enable_tzsp = 
         Globalreg::globalreg->kismet_config->fetch_opt_bool("tzsp_enable", false);
 
-    if (enable_tzsp) {
-        auto tzsp_listen =
-            Globalreg::globalreg->kismet_config->fetch_opt_dfl("tzsp_listen", "127.0.0.1");
+    if (!enable_tzsp) {
+        _MSG_INFO("TZSP datasource / listener disabled, set tzsp_enable=true in your config to turn it on.");
+        return;
+    }
+
+    auto tzsp_listen =
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("tzsp_listen", "127.0.0.1");
 
-        auto tzsp_port =
-            Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_listen_port", 37008);
+    auto tzsp_port =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_listen_port", 37008);
 
-        auto tzsp_filter =
-            Globalreg::globalreg->kismet_config->fetch_opt_vec("tzsp_allowed");
+    allowed_senders =
+        Globalreg::globalreg->kismet_config->fetch_opt_vec("tzsp_allowed");
 
-        auto tzsp_buffer_sz =
-            Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_buffer_kb", 64);
+    auto tzsp_buffer_sz =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_buffer_kb", 64);
 
-        tzsp_listener = std::make_shared<udp_dgram_server>();
+    auto num_sockets =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_sockets", 1);
 
-        tzsp_listener->configure_server(tzsp_port, tzsp_listen, tzsp_filter, std::chrono::seconds(60), 
-                4096, tzsp_buffer_sz);
+    batch_sz =
+        std::max(1U, Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_batch", 32));
 
-        pollabletracker->register_pollable(tzsp_listener);
+    sender_timeout =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_timeout", 60);
 
-    } else {
-        _MSG_INFO("TZSP datasource / listener disabled, set tzsp_enable=true in your config to turn it on.");
+    // Large enough for any 802.11 frame and the TZSP tags
+    max_frame_sz = 16384;
+
+    if (num_sockets == 0)
+        num_sockets = std::max(1U, std::thread::hardware_concurrency());
+
+#ifndef SO_REUSEPORT
+    if (num_sockets > 1) {
+        _MSG_INFO("TZSP listener can only use one socket on this platform, SO_REUSEPORT is "
+                "not available.");
+        num_sockets = 1;
+    }
+#endif
+
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+
+    auto r = getaddrinfo(tzsp_listen.c_str(), fmt::format("{}", tzsp_port).c_str(), &hints, &res);
+
+    if (r != 0) {
+        _MSG_ERROR("TZSP listener could not parse the listen address '{}': {}",
+                tzsp_listen, gai_strerror(r));
         return;
     }
 
+    for (unsigned int i = 0; i < num_sockets; i++) {
+        auto fd = bind_socket(res, num_sockets > 1);
+
+        if (fd < 0)
+            break;
+
+        if (tzsp_buffer_sz != 0) {
+            int bufsz = tzsp_buffer_sz * 1024;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+        }
+
+        auto rx = std::make_shared<tzsp_receiver>();
+        rx->fd = fd;
+        receivers.push_back(rx);
+    }
+
+    freeaddrinfo(res);
+
+    if (receivers.size() == 0)
+        return;
+
+    for (const auto& rx : receivers)
+        rx->thread = std::thread([this, rx]() {
+                thread_set_process_name("tzsp");
+                receive_thread(rx);
+            });
+
+    expire_timer_id =
+        timetracker->register_timer(std::chrono::seconds(10), true, 
+                [this](int) -> int {
+                    expire_senders();
+                    return 1;
+                });
+
+    _MSG_INFO("TZSP listening on {}:{} with {} socket{}", tzsp_listen, tzsp_port,
+            receivers.size(), receivers.size() == 1 ? "" : "s");
 }
 
 tzsp_source::~tzsp_source() {
-    pollabletracker->remove_pollable(tzsp_listener);
-
     Globalreg::globalreg->remove_global(global_name());
 
-    if (tzsp_io_thread.joinable())
-        tzsp_io_thread.join();
+    if (expire_timer_id >= 0)
+        timetracker->remove_timer(expire_timer_id);
+
+    stopping = true;
+
+    for (const auto& rx : receivers) {
+        if (rx->thread.joinable())
+            rx->thread.join();
+
+        close(rx->fd);
+    }
 }
 
-void tzsp_source::tzsp_io() {
-    bool first = true;
+int tzsp_source::bind_socket(const struct addrinfo *in_addr, bool in_reuse) {
+    int fd = socket(in_addr->ai_family, in_addr->ai_socktype | SOCK_CLOEXEC,
+            in_addr->ai_protocol);
+
+    if (fd < 0) {
+        _MSG_ERROR("TZSP listener could not create a socket: {}", kis_strerror_r(errno));
+        return -1;
+    }
+
+#ifdef SO_REUSEPORT
+    if (in_reuse) {
+        int one = 1;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            _MSG_ERROR("TZSP listener could not set SO_REUSEPORT: {}", kis_strerror_r(errno));
+            close(fd);
+            return -1;
+        }
+    }
+#endif
 
+    if (bind(fd, in_addr->ai_addr, in_addr->ai_addrlen) < 0) {
+        _MSG_ERROR("TZSP listener could not bind: {}", kis_strerror_r(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void tzsp_source::receive_thread(std::shared_ptr<tzsp_receiver> rx) {
+    std::vector<uint8_t> buf(batch_sz * max_frame_sz);
+    std::vector<struct sockaddr_storage> addrs(batch_sz);
+    std::vector<struct iovec> iovs(batch_sz);
+
+#if defined(SYS_LINUX)
+    std::vector<struct mmsghdr> msgs(batch_sz);
+
+    for (size_t i = 0; i < batch_sz; i++) {
+        iovs[i].iov_base = &buf[i * max_frame_sz];
+        iovs[i].iov_len = max_frame_sz;
+
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
+#else
+    struct msghdr msg;
+
+    iovs[0].iov_base = &buf[0];
+    iovs[0].iov_len = max_frame_sz;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iovs[0];
+    msg.msg_iovlen = 1;
+    msg.msg_name = &addrs[0];
+#endif
+
+    struct timeval ts;
+
+    while (!stopping) {
+        struct pollfd pfd;
+
+        pfd.fd = rx->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        // Wake up periodically to notice shutdown
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+
+#if defined(SYS_LINUX)
+        for (size_t i = 0; i < batch_sz; i++) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            msgs[i].msg_hdr.msg_flags = 0;
+        }
+
+        auto n = recvmmsg(rx->fd, msgs.data(), batch_sz, MSG_DONTWAIT, nullptr);
+#else
+        msg.msg_namelen = sizeof(struct sockaddr_storage);
+        msg.msg_flags = 0;
+
+        auto n = recvmsg(rx->fd, &msg, MSG_DONTWAIT);
+#endif
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue;
+
+            _MSG_ERROR("TZSP listener failed to receive: {}", kis_strerror_r(errno));
+            break;
+        }
+
+        gettimeofday(&ts, nullptr);
+
+#if defined(SYS_LINUX)
+        for (int i = 0; i < n; i++)
+            handle_datagram(*rx, &addrs[i], msgs[i].msg_hdr.msg_namelen,
+                    &buf[i * max_frame_sz], msgs[i].msg_len,
+                    msgs[i].msg_hdr.msg_flags & MSG_TRUNC, ts);
+#else
+        handle_datagram(*rx, &addrs[0], msg.msg_namelen, &buf[0], n,
+                msg.msg_flags & MSG_TRUNC, ts);
+#endif
+    }
+}
+
+uint64_t tzsp_source::address_hash(const struct sockaddr_storage *sockaddr, socklen_t addrsize) {
+    const uint8_t *addr = nullptr;
+    size_t len = 0;
+
+    // Senders are identified by address; the source port of a sender can change
+    if (sockaddr->ss_family == AF_INET && addrsize >= sizeof(struct sockaddr_in)) {
+        auto in4 = reinterpret_cast<const struct sockaddr_in *>(sockaddr);
+        addr = reinterpret_cast<const uint8_t *>(&in4->sin_addr);
+        len = sizeof(in4->sin_addr);
+    } else if (sockaddr->ss_family == AF_INET6 && addrsize >= sizeof(struct sockaddr_in6)) {
+        auto in6 = reinterpret_cast<const struct sockaddr_in6 *>(sockaddr);
+        addr = reinterpret_cast<const uint8_t *>(&in6->sin6_addr);
+        len = sizeof(in6->sin6_addr);
+    }
+
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL ^ sockaddr->ss_family;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= addr[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
 }
 
+std::shared_ptr<tzsp_source::tzsp_sender> tzsp_source::find_sender(uint64_t in_hash,
+        const struct sockaddr_storage *sockaddr, socklen_t addrsize) {
+    kis_lock_guard<kis_mutex> lk(tzsp_mutex, "tzsp find_sender");
+
+    auto s = tzsp_source_map.find(in_hash);
+
+    if (s != tzsp_source_map.end())
+        return s->second;
+
+    char host[NI_MAXHOST];
+
+    if (getnameinfo(reinterpret_cast<const struct sockaddr *>(sockaddr), addrsize,
+                host, sizeof(host), nullptr, 0, NI_NUMERICHOST) != 0)
+        snprintf(host, sizeof(host), "unknown-%016lx", (unsigned long) in_hash);
+
+    auto sender = std::make_shared<tzsp_sender>();
+    sender->address = host;
+    sender->last_seen = 0;
+    sender->open = false;
+
+    bool allowed = allowed_senders.size() == 0 ||
+        std::find(allowed_senders.begin(), allowed_senders.end(), sender->address) !=
+        allowed_senders.end();
+
+    if (!allowed) {
+        _MSG_ERROR("TZSP listener ignoring frames from {}, which is not in tzsp_allowed",
+                sender->address);
+    } else {
+        auto virtual_builder = Globalreg::fetch_mandatory_global_as<datasource_virtual_builder>();
+
+        sender->source = std::static_pointer_cast<kis_datasource_virtual>(
+                virtual_builder->build_datasource(virtual_builder));
+
+        auto uuidstr = fmt::format("{:08X}-0000-0000-0000-0000{:08X}",
+                adler32_checksum("kismet_tzsp"), adler32_checksum(sender->address));
+        uuid u(uuidstr);
+
+        sender->source->set_virtual_hardware("tzsp");
+        sender->source->set_source_uuid(u);
+        sender->source->set_source_key(adler32_checksum(u.uuid_to_string()));
+        sender->source->set_source_name(fmt::format("tzsp-{}", sender->address));
+
+        datasourcetracker->merge_source(sender->source);
+
+        _MSG_INFO("TZSP listener receiving frames from new sender {}", sender->address);
+    }
+
+    tzsp_source_map[in_hash] = sender;
+
+    return sender;
+}
+
+void tzsp_source::handle_datagram(tzsp_receiver& rx, const struct sockaddr_storage *sockaddr,
+        socklen_t addrsize, const uint8_t *data, size_t len, bool truncated,
+        const struct timeval& ts) {
+
+    if (truncated || len < sizeof(tzsp_header)) {
+        num_malformed++;
+        return;
+    }
+
+    auto hdr = reinterpret_cast<const tzsp_header *>(data);
+
+    if (hdr->tzsp_version != TZSP_VERSION) {
+        num_malformed++;
+        return;
+    }
+
+    // Only frames received or sent by the sensor carry a frame
+    if (hdr->tzsp_type != TZSP_PACKET_RECEIVED && hdr->tzsp_type != TZSP_PACKET_TRANSMIT)
+        return;
+
+    unsigned int dlt;
+
+    switch (ntohs(hdr->tzsp_encapsulation)) {
+        case TZSP_DLT_ETHERNET:
+            dlt = DLT_EN10MB;
+            break;
+        case TZSP_DLT_IEEE80211:
+            dlt = DLT_IEEE802_11;
+            break;
+        default:
+            // There are no decoders for the Prism and AVS headers
+            return;
+    }
+
+    bool have_rssi = false, fcs_error = false;
+    int rssi = 0, channel = 0;
+
+    size_t pos = sizeof(tzsp_header);
+    bool ended = false;
+
+    while (pos < len) {
+        auto tag = data[pos++];
+
+        if (tag == TZSP_TAG_PADDING)
+            continue;
+
+        if (tag == TZSP_TAG_END) {
+            ended = true;
+            break;
+        }
+
+        if (pos >= len)
+            break;
+
+        size_t taglen = data[pos++];
+
+        if (pos + taglen > len)
+            break;
+
+        switch (tag) {
+            case TZSP_TAG_RSSI:
+                if (taglen >= 1) {
+                    rssi = (int8_t) data[pos];
+                    have_rssi = true;
+                }
+                break;
+            case TZSP_TAG_FCS_ERROR:
+                if (taglen >= 1)
+                    fcs_error = data[pos] != 0;
+                break;
+            case TZSP_TAG_RX_CHANNEL:
+                if (taglen >= 1)
+                    channel = data[pos];
+                break;
+        }
+
+        pos += taglen;
+    }
+
+    if (!ended) {
+        num_malformed++;
+        return;
+    }
+
+    auto hash = address_hash(sockaddr, addrsize);
+
+    std::shared_ptr<tzsp_sender> sender;
+
+    auto si = rx.senders.find(hash);
+
+    if (si != rx.senders.end()) {
+        sender = si->second;
+    } else {
+        sender = find_sender(hash, sockaddr, addrsize);
+        rx.senders[hash] = sender;
+    }
+
+    if (sender->source == nullptr)
+        return;
+
+    sender->last_seen = ts.tv_sec;
+
+    if (!sender->open.exchange(true))
+        sender->source->open_virtual_interface();
+
+    auto packet = packetchain->generate_packet();
+
+    packet->ts = ts;
+    packet->original_len = len - pos;
+    packet->set_data(reinterpret_cast<const char *>(data + pos), len - pos);
+
+    if (fcs_error)
+        packet->error = 1;
+
+    auto datachunk = packetchain->new_packet_component<kis_datachunk>();
+    datachunk->dlt = dlt;
+    datachunk->set_data(packet->data);
+    packet->insert(pack_comp_linkframe, datachunk);
+
+    if (have_rssi || channel != 0) {
+        auto l1info = packetchain->new_packet_component<kis_layer1_packinfo>();
+
+        if (have_rssi) {
+            l1info->signal_type = kis_l1_signal_type_dbm;
+            l1info->signal_dbm = rssi;
+        }
+
+        if (channel != 0) {
+            l1info->channel = fmt::format("{}", channel);
+
+            if (channel == 14)
+                l1info->freq_khz = 2484000;
+            else if (channel < 14)
+                l1info->freq_khz = (2407 + channel * 5) * 1000;
+            else
+                l1info->freq_khz = (5000 + channel * 5) * 1000;
+        }
+
+        packet->insert(pack_comp_l1info, l1info);
+    }
+
+    sender->source->inject_virtual_packet(packet);
+}
+
+void tzsp_source::expire_senders() {
+    kis_lock_guard<kis_mutex> lk(tzsp_mutex, "tzsp expire_senders");
+
+    auto malformed = num_malformed.load();
+
+    if (malformed != last_malformed) {
+        _MSG_ERROR("TZSP listener dropped {} malformed or truncated datagrams in the last "
+                "10 seconds", malformed - last_malformed);
+        last_malformed = malformed;
+    }
+
+    if (sender_timeout == 0)
+        return;
+
+    auto now = (time_t) Globalreg::globalreg->last_tv_sec;
+
+    for (const auto& s : tzsp_source_map) {
+        if (s.second->source == nullptr || !s.second->open)
+            continue;
+
+        if (now - s.second->last_seen > sender_timeout) {
+            s.second->open = false;
+            s.second->source->close_virtual_interface();
+
+            _MSG_INFO("TZSP sender {} has not sent a frame in {} seconds, closing its source",
+                    s.second->address, sender_timeout);
+        }
+    }
+}
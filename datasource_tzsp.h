@@ -21,17 +21,29 @@
 
 #include "config.h"
 
+#include <atomic>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netdb.h>
+#include <sys/socket.h>
+
 #include "globalregistry.h"
+#include "datasource_virtual.h"
 #include "kis_datasource.h"
-#include "udpserver.h"
+#include "kis_mutex.h"
 
 // TZSP per-frame header
 typedef struct {
     uint8_t tzsp_version;
     uint8_t tzsp_type;
-    uint8_t tzsp_encapsulation;
+    uint16_t tzsp_encapsulation;
 } __attribute__((packed)) tzsp_header;
 
+#define TZSP_VERSION                0x01
+
 #define TZSP_PACKET_RECEIVED        0x00
 #define TZSP_PACKET_TRANSMIT        0x01
 #define TZSP_PACKET_RESERVED        0x02
@@ -44,13 +56,6 @@ typedef struct {
 #define TZSP_DLT_PRISM              0x77
 #define TZSP_DLT_AVS                0x7F
 
-// TZSP tagged records
-typedef struct {
-    uint8_t tagno;
-    uint8_t taglen;
-    char *data;
-} __attribute__((packed)) tzsp_tag_t;
-
 #define TZSP_TAG_PADDING            0x00
 #define TZSP_TAG_END                0x01
 #define TZSP_TAG_RSSI               0x0A
@@ -65,6 +70,16 @@ typedef struct {
 #define TZSP_TAG_RX_FRAMELEN        0x29
 #define TZSP_TAG_RX_RADIO_SERIAL    0x3C
 
+// TZSP listener, for access points and sensors which stream captured frames as TZSP
+// datagrams.  Each sender gets a virtual datasource, named for its address.
+//
+// The listener binds tzsp_sockets sockets to the same port with SO_REUSEPORT, each
+// with its own receive thread; the kernel spreads the senders across the sockets by
+// their address, so the senders of one socket are always handled by the same thread.
+// On Linux each thread receives up to tzsp_batch datagrams per recvmmsg() call.  The
+// virtual source of a sender is cached by each receiver under the hash of the sender
+// address, so the shared map of senders is only locked the first time a receiver
+// sees a sender.
 class tzsp_source : public lifetime_global {
 public:
     static std::string global_name() { return "tzsp_source"; }
@@ -83,23 +98,66 @@ public:
     virtual ~tzsp_source();
 
 protected:
-    std::shared_ptr<udp_dgram_server> tzsp_listener;
+    struct tzsp_sender {
+        std::string address;
+
+        // Null when the sender isn't allowed, so its datagrams are dropped without
+        // checking it again
+        std::shared_ptr<kis_datasource_virtual> source;
+
+        std::atomic<time_t> last_seen;
+        std::atomic<bool> open;
+    };
+
+    struct tzsp_receiver {
+        int fd;
+        std::thread thread;
+
+        // Senders seen by this receiver, by address hash; only used by the receive thread
+        std::unordered_map<uint64_t, std::shared_ptr<tzsp_sender>> senders;
+    };
+
+    // Bind one of the listening sockets
+    int bind_socket(const struct addrinfo *in_addr, bool in_reuse);
+
+    void receive_thread(std::shared_ptr<tzsp_receiver> rx);
+
+    // Decode a datagram and inject its frame from the source of the sender
+    void handle_datagram(tzsp_receiver& rx, const struct sockaddr_storage *sockaddr,
+            socklen_t addrsize, const uint8_t *data, size_t len, bool truncated,
+            const struct timeval& ts);
+
+    // Find or create the sender of an address
+    std::shared_ptr<tzsp_sender> find_sender(uint64_t in_hash,
+            const struct sockaddr_storage *sockaddr, socklen_t addrsize);
+
+    static uint64_t address_hash(const struct sockaddr_storage *sockaddr, socklen_t addrsize);
+
+    // Close the sources of senders which have gone quiet
+    void expire_senders();
 
     std::shared_ptr<packet_chain> packetchain;
     std::shared_ptr<datasource_tracker> datasourcetracker;
-    std::shared_ptr<pollable_tracker> pollabletracker;
+    std::shared_ptr<time_tracker> timetracker;
+
+    int pack_comp_linkframe, pack_comp_l1info;
+
+    std::vector<std::shared_ptr<tzsp_receiver>> receivers;
+    std::atomic<bool> stopping;
 
-    int pack_comp_common, pack_comp_linkframe, pack_comp_l1info, pack_comp_datasrc;
+    size_t batch_sz;
+    size_t max_frame_sz;
+    time_t sender_timeout;
 
-    // datagram callback for new data; auto-allocates a source for a new remote sensor
-    void udp_datagram(const struct sockaddr_storage *sockaddr, size_t addrsize,
-            uint32_t hash, const char *data, size_t len);
+    std::vector<std::string> allowed_senders;
 
-    // datagram callback for a closed or timed-out remote tzsp sensor, flags the virtual source as closed
-    void udp_cancel(uint32_t hash, bool timeout, const std::string& reason);
+    kis_mutex tzsp_mutex;
+    std::map<uint64_t, std::shared_ptr<tzsp_sender>> tzsp_source_map;
 
-    std::map<uint32_t, std::shared_ptr<kis_datasource>> tzsp_source_map;
+    int expire_timer_id;
 
+    std::atomic<uint64_t> num_malformed;
+    uint64_t last_malformed;
 };
 
 #endif /* ifndef DATASOURCE_TZSP_H */
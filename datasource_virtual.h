@@ -55,6 +55,11 @@ public:
     void close_virtual_interface() {
         set_int_source_running(false);
     }
+
+    // Inject a packet seen by the virtual source
+    void inject_virtual_packet(std::shared_ptr<kis_packet> in_packet) {
+        handle_rx_packet(in_packet);
+    }
     
 };
 
@@ -21,8 +21,11 @@
 #include <string.h>
 #include <getopt.h>
 
+#include <set>
+
 #include "alertracker.h"
 #include "base64.h"
+#include "channeltracker2.h"
 #include "configfile.h"
 #include "datasourcetracker.h"
 #include "endian_magic.h"
@@ -188,11 +191,10 @@ void datasource_tracker_source_probe::probe_sources(std::function<void (unsigned
     for (const auto& i : build_map) {
         // Set up the cancellation timer
         int cancel_timer = 
-            timetracker->register_timer(std::chrono::seconds(10), false, 
-                    [self = shared_from_this()] (int) -> int {
+            timetracker->defer_task(std::chrono::seconds(10), 
+                    [self = shared_from_this()] () {
                         _MSG_ERROR("Datasource {} cancelling source probe due to timeout", self->definition);
                         self->cancel();
-                        return 0;
                     });
 
         // Log the cancellation timer
@@ -343,18 +345,17 @@ void datasource_tracker_source_list::list_sources(std::shared_ptr<datasource_tra
         cancel();
 
     cancel_event_id = 
-        timetracker->register_timer(std::chrono::seconds(5), false, 
-            [self = shared_from_this()] (int) mutable -> int {
+        timetracker->defer_task(std::chrono::seconds(5), 
+            [self = shared_from_this()] () mutable {
                 self->cancel();
-
-                return 0;
             });
 }
 
 
 datasource_tracker::datasource_tracker() :
     remotecap_enabled{false},
-    remotecap_port{0} {
+    remotecap_port{0},
+    hop_planner_timer{-1} {
 
     dst_lock.set_name("datasourcetracker");
 
@@ -393,6 +394,9 @@ datasource_tracker::~datasource_tracker() {
     if (completion_cleanup_id >= 0)
         timetracker->remove_timer(completion_cleanup_id);
 
+    if (hop_planner_timer >= 0)
+        timetracker->remove_timer(hop_planner_timer);
+
     if (database_log_timer >= 0) {
         timetracker->remove_timer(database_log_timer);
         databaselog_write_datasources();
@@ -476,6 +480,25 @@ void datasource_tracker::trigger_deferred_startup() {
         config_defaults->set_split_same_sources(true);
     }
 
+    if (Globalreg::globalreg->kismet_config->fetch_opt_bool("channel_hop_planner", false)) {
+        auto interval =
+            std::max(Globalreg::globalreg->kismet_config->fetch_opt_uint("channel_hop_planner_interval", 30),
+                    (unsigned int) 5);
+        hop_planner_max_weight =
+            std::max(Globalreg::globalreg->kismet_config->fetch_opt_uint("channel_hop_planner_max_weight", 4),
+                    (unsigned int) 1);
+
+        _MSG_INFO("Planning channel hopping across sources every {} seconds, busy channels "
+                "get up to {}x the dwell time", interval, hop_planner_max_weight);
+
+        hop_planner_timer =
+            timetracker->register_timer(SERVER_TIMESLICES_SEC * interval, NULL, 1,
+                    [this](int) -> int {
+                        plan_channel_hopping();
+                        return 1;
+                    });
+    }
+
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("randomized_hopping", true)) {
         _MSG("Enabling channel list shuffling to optimize overlaps", MSGFLAG_INFO);
         config_defaults->set_random_channel_order(true);
@@ -511,6 +534,9 @@ void datasource_tracker::trigger_deferred_startup() {
     config_defaults->set_remote_cap_port(remotecap_port);
 
     config_defaults->set_remote_cap_timestamp(Globalreg::globalreg->kismet_config->fetch_opt_bool("override_remote_timestamp", true));
+    config_defaults->set_remote_cap_compression(Globalreg::globalreg->kismet_config->fetch_opt_bool("remote_capture_compression", true));
+    config_defaults->set_remote_cap_resume(Globalreg::globalreg->kismet_config->fetch_opt_as<uint32_t>("remote_capture_resume", 30));
+    config_defaults->set_local_cap_shm(Globalreg::globalreg->kismet_config->fetch_opt_bool("local_capture_shm", false));
 
     // Register js module for UI
     std::shared_ptr<kis_httpd_registry> httpregistry = 
@@ -779,6 +805,56 @@ void datasource_tracker::trigger_deferred_startup() {
                     }
                 }));
 
+    httpd->register_route("/datasource/by-uuid/:uuid/set_capture_filter", {"POST"}, httpd->LOGON_ROLE, {"cmd"},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) -> std::shared_ptr<tracker_element> {
+                    auto ds_uuid = string_to_n<uuid>(con->uri_params()[":uuid"]);
+                    
+                    if (ds_uuid.error)
+                        throw std::runtime_error("invalid uuid");
+
+                    auto ds = find_datasource(ds_uuid);
+                    
+                    if (ds == nullptr)
+                        throw std::runtime_error("no such datasource");
+
+                    std::string filter;
+                    unsigned int snaplen = 0;
+                    int data_payload = -1;
+
+                    if (!con->json()["filter"].is_null())
+                        filter = con->json()["filter"].get<std::string>();
+
+                    if (!con->json()["snaplen"].is_null())
+                        snaplen = con->json()["snaplen"].get<unsigned int>();
+
+                    if (!con->json()["data_payload"].is_null())
+                        data_payload = con->json()["data_payload"].get<int>();
+
+                    bool set_success = false;
+                    std::string set_error;
+                    auto set_promise = std::promise<void>();
+                    auto set_ft = set_promise.get_future();
+
+                    _MSG_INFO("Source '{}' ({}) setting capture filter '{}'",
+                            ds->get_source_name(), ds->get_source_uuid(), filter);
+
+                    ds->set_capture_filter(filter, snaplen, data_payload, 0,
+                            [&set_success, &set_error, &set_promise](unsigned int, bool success, 
+                                std::string e) mutable {
+                            set_success = success;
+                            set_error = e;
+                            set_promise.set_value();
+                            });
+
+                    set_ft.wait();
+
+                    if (!set_success)
+                        throw std::runtime_error(set_error);
+
+                    return ds;
+                }));
+
     httpd->register_route("/datasource/by-uuid/:uuid/set_hop", {"GET", "POST"}, httpd->LOGON_ROLE, {"cmd"},
             std::make_shared<kis_net_web_tracked_endpoint>(
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) -> std::shared_ptr<tracker_element> {
@@ -948,6 +1024,10 @@ void datasource_tracker::trigger_deferred_startup() {
                             nullptr, nullptr,
                             1024*512);
 
+                    auto filter_k = con->http_variables().find("filter");
+                    if (filter_k != con->http_variables().end())
+                        pcapng->set_bpf_filter(filter_k->second);
+
                     con->clear_timeout();
                     con->set_target_file("kismet-all-packets.pcapng");
                     con->set_closure_cb([pcapng]() { pcapng->stop_stream("http connection lost"); });
@@ -991,6 +1071,10 @@ void datasource_tracker::trigger_deferred_startup() {
                             nullptr,
                             1024*512);
 
+                    auto filter_k = con->http_variables().find("filter");
+                    if (filter_k != con->http_variables().end())
+                        pcapng->set_bpf_filter(filter_k->second);
+
                     con->clear_timeout();
                     con->set_target_file(fmt::format("kismet-datasource-{}-{}.pcapng", 
                                 ds->get_source_name(), dsuuid));
@@ -1050,7 +1134,7 @@ void datasource_tracker::trigger_deferred_startup() {
                 ds_bridge->bridged_ds = 
                     std::make_shared<dst_incoming_remote>(
                             [this, ds_bridge, ws] (dst_incoming_remote *initiator, std::string in_type, 
-                                std::string in_def, uuid in_uuid) {
+                                std::string in_def, uuid in_uuid, std::string in_session) {
 
                             kis_lock_guard<kis_mutex> lk(ds_bridge->mutex, "dst websocket completion");
 
@@ -1060,7 +1144,7 @@ void datasource_tracker::trigger_deferred_startup() {
 
                             auto new_ds = 
                                 datasourcetracker->open_remote_datasource(initiator, in_type, in_def, 
-                                    in_uuid, false);
+                                    in_uuid, in_session, false);
 
                             // _MSG_DEBUG("reassigning old ds");
                             ds_bridge->bridged_ds = new_ds;
@@ -1136,6 +1220,110 @@ void datasource_tracker::trigger_deferred_startup() {
         return;
     }
 
+    // Sources without a type are normally probed by launching the capture tool of every
+    // type which can probe; with many sources that's a tool launch per type per source.
+    // One listing of the local interfaces, which launches each tool once, resolves the
+    // type of most of them at once and only the rest are probed.
+    unsigned int n_auto = 0;
+
+    for (const auto& s : src_vec) {
+        auto cpos = s.find(":");
+
+        if (cpos == std::string::npos) {
+            n_auto++;
+            continue;
+        }
+
+        std::vector<opt_pair> opt_vec;
+        string_to_opts(s.substr(cpos + 1), ",", &opt_vec);
+
+        auto type = str_lower(fetch_opt("type", &opt_vec));
+
+        if (type == "")
+            n_auto++;
+    }
+
+    if (n_auto > 1 &&
+            Globalreg::globalreg->kismet_config->fetch_opt_bool("source_startup_list", true)) {
+        _MSG_INFO("Listing local interfaces to find the type of {} data sources", n_auto);
+
+        list_interfaces([this, src_vec](std::vector<shared_interface> interfaces) {
+                launch_startup_sources(resolve_source_types(src_vec, interfaces));
+            });
+
+        return;
+    }
+
+    launch_startup_sources(src_vec);
+}
+
+std::vector<std::string> datasource_tracker::resolve_source_types(const std::vector<std::string>& in_sources,
+        const std::vector<shared_interface>& in_interfaces) {
+    // Types of each listed interface; an interface listed by more than one type is left
+    // for the probe to decide
+    std::map<std::string, std::string> interface_types;
+    std::set<std::string> ambiguous;
+
+    for (const auto& i : in_interfaces) {
+        if (i->get_prototype() == nullptr)
+            continue;
+
+        auto type = i->get_prototype()->get_source_type();
+
+        for (const auto& name : {i->get_interface(), i->get_cap_interface()}) {
+            if (name.length() == 0)
+                continue;
+
+            auto ti = interface_types.find(name);
+
+            if (ti == interface_types.end())
+                interface_types[name] = type;
+            else if (ti->second != type)
+                ambiguous.insert(name);
+        }
+    }
+
+    std::vector<std::string> resolved;
+    unsigned int n_resolved = 0;
+
+    for (const auto& s : in_sources) {
+        auto cpos = s.find(":");
+        auto interface = s.substr(0, cpos);
+
+        if (cpos != std::string::npos) {
+            std::vector<opt_pair> opt_vec;
+            string_to_opts(s.substr(cpos + 1), ",", &opt_vec);
+
+            auto type = str_lower(fetch_opt("type", &opt_vec));
+
+            if (type != "") {
+                resolved.push_back(s);
+                continue;
+            }
+        }
+
+        auto ti = interface_types.find(interface);
+
+        if (ti == interface_types.end() || ambiguous.find(interface) != ambiguous.end()) {
+            resolved.push_back(s);
+            continue;
+        }
+
+        n_resolved++;
+
+        if (cpos == std::string::npos)
+            resolved.push_back(fmt::format("{}:type={}", s, ti->second));
+        else
+            resolved.push_back(fmt::format("{},type={}", s, ti->second));
+    }
+
+    _MSG_INFO("Found the type of {} of {} data sources from the interface list, probing the rest",
+            n_resolved, in_sources.size());
+
+    return resolved;
+}
+
+void datasource_tracker::launch_startup_sources(const std::vector<std::string>& src_vec) {
     auto stagger_thresh = 
         Globalreg::globalreg->kismet_config->fetch_opt_uint("source_stagger_threshold", 16);
     auto simul_open = 
@@ -1208,8 +1396,6 @@ void datasource_tracker::trigger_deferred_startup() {
                 }, this, work_vec, group_number);
                 launch_t.detach();
     }
-
-    return;
 }
 
 void datasource_tracker::trigger_deferred_shutdown() {
@@ -1531,8 +1717,7 @@ void datasource_tracker::merge_source(shared_datasource in_source) {
     calculate_source_hopping(in_source);
 
     if (database_log_enabled) {
-        std::shared_ptr<kis_database_logfile> dbf =
-            Globalreg::fetch_global_as<kis_database_logfile>("DATABASELOG");
+        auto dbf = Globalreg::fetch_global_handle<kis_database_logfile>();
 
         if (dbf != NULL) {
             dbf->log_datasource(in_source);
@@ -1666,7 +1851,7 @@ void datasource_tracker::schedule_cleanup() {
         return;
 
     completion_cleanup_id = 
-        timetracker->register_timer(1, NULL, 0, [this] (int) -> int {
+        timetracker->defer_task(time_tracker::slice(1), [this] () {
             kis_unique_lock<kis_mutex> lock(dst_lock, std::defer_lock, "dst schedule_cleanup lambda");
            
             lock.lock();
@@ -1688,15 +1873,13 @@ void datasource_tracker::schedule_cleanup() {
             d_pcv.clear();
             d_lcv.clear();
             d_bsv.clear();
-
-            return 0;
         });
 
 }
 
 std::shared_ptr<kis_datasource> datasource_tracker::open_remote_datasource(dst_incoming_remote *incoming,
         const std::string& in_type, const std::string& in_definition, const uuid& in_uuid,
-        bool connect_tcp) {
+        const std::string& in_session, bool connect_tcp) {
 
     shared_datasource merge_target_device;
      
@@ -1715,6 +1898,20 @@ std::shared_ptr<kis_datasource> datasource_tracker::open_remote_datasource(dst_i
     }
 
     if (merge_target_device != NULL) {
+        // A capture which lost its connection picks up where it left off, with its
+        // channel and hopping intact and whatever it buffered in the meantime
+        lock.unlock();
+
+        if (merge_target_device->resume_remote(incoming, in_session)) {
+            _MSG_INFO("Remote source {} ({}) resumed", 
+                    merge_target_device->get_source_name(),
+                    merge_target_device->get_source_uuid());
+
+            return merge_target_device;
+        }
+
+        lock.lock();
+
         if (merge_target_device->get_source_running()) {
             _MSG_ERROR("Incoming remote connection for source '{}' matches existing source '{}', "
                     "which is still running.  The running instance will be closed; make sure "
@@ -1734,7 +1931,7 @@ std::shared_ptr<kis_datasource> datasource_tracker::open_remote_datasource(dst_i
         // Explicitly unlock our mutex before running a thread
         lock.unlock();
 
-        merge_target_device->connect_remote(in_definition, incoming, connect_tcp,
+        merge_target_device->connect_remote(in_definition, incoming, in_session, connect_tcp,
                 [this, merge_target_device](unsigned int, bool success, std::string msg) {
                     if (success) {
                         _MSG_INFO("Remote source {} ({}) reconnected", 
@@ -1766,7 +1963,7 @@ std::shared_ptr<kis_datasource> datasource_tracker::open_remote_datasource(dst_i
 
             // Make a data source from the builder
             shared_datasource ds = b->build_datasource(b);
-            ds->connect_remote(in_definition, incoming, connect_tcp,
+            ds->connect_remote(in_definition, incoming, in_session, connect_tcp,
                 [this, ds](unsigned int, bool success, std::string msg) {
                     if (success) {
                         _MSG_INFO("New remote source {} ({}) connected", ds->get_source_name(),
@@ -1924,6 +2121,208 @@ void datasource_tracker::calculate_source_hopping(shared_datasource in_ds) {
     }
 }
 
+// Name the channel tracker records for a hop channel; hop channels carry width
+// suffixes ("6HT40+", "36VHT80") which the tracked channel doesn't, but 6GHz
+// channels keep their band ("1W6e")
+std::string datasource_tracker::hop_planner_base_channel(const std::string& in_chan) {
+    size_t n = 0;
+
+    while (n < in_chan.length() && isdigit(in_chan[n]))
+        n++;
+
+    if (n == 0)
+        return in_chan;
+
+    auto base = in_chan.substr(0, n);
+
+    if (in_chan.find("W6e") != std::string::npos)
+        base += "W6e";
+
+    return base;
+}
+
+void datasource_tracker::replan_channel_hopping() {
+    if (hop_planner_timer < 0)
+        return;
+
+    plan_channel_hopping();
+}
+
+void datasource_tracker::plan_channel_hopping() {
+    if (!config_defaults->get_hop())
+        return;
+
+    auto chantracker = Globalreg::fetch_global_handle<channel_tracker_v2>();
+
+    if (chantracker == nullptr)
+        return;
+
+    struct hop_plan_group {
+        std::string type;
+        std::vector<std::string> channels;
+        std::vector<shared_datasource> sources;
+    };
+
+    // Sources of the same type hopping the same channels share one plan and split
+    // it, the same as when they're opened
+    std::map<std::string, hop_plan_group> groups;
+
+    std::shared_ptr<tracker_element_vector> immutable_copy;
+
+    {
+        kis_lock_guard<kis_mutex> lk(dst_lock, "dst plan_channel_hopping");
+        immutable_copy = std::make_shared<tracker_element_vector>(datasource_vec);
+    }
+
+    for (const auto& i : *immutable_copy) {
+        auto ds = std::static_pointer_cast<kis_datasource>(i);
+
+        // Locked sources, and sources told not to hop, are left alone
+        if (!ds->get_source_running() || !ds->get_source_hopping())
+            continue;
+
+        if (!ds->get_source_builder()->get_tune_capable() ||
+                !ds->get_source_builder()->get_hop_capable() ||
+                !ds->get_definition_opt_bool("channel_hop", true))
+            continue;
+
+        // The hop list holds the repeats of the last plan; each channel once is
+        // the list we plan from
+        std::vector<std::string> channels;
+
+        for (const auto& c : *ds->get_source_hop_vec()) {
+            if (std::find(channels.begin(), channels.end(), c) == channels.end())
+                channels.push_back(c);
+        }
+
+        if (channels.size() < 2)
+            continue;
+
+        auto sorted_channels = channels;
+        std::sort(sorted_channels.begin(), sorted_channels.end());
+
+        auto key = fmt::format("{}/{}", ds->get_source_builder()->get_source_type(),
+                config_defaults->get_split_same_sources() ? "" : ds->get_source_uuid().as_string());
+
+        for (const auto& c : sorted_channels)
+            key += "/" + c;
+
+        auto& group = groups[key];
+
+        if (group.sources.size() == 0) {
+            group.type = ds->get_source_builder()->get_source_type();
+            group.channels = channels;
+        }
+
+        group.sources.push_back(ds);
+    }
+
+    if (groups.size() == 0)
+        return;
+
+    // Activity by the channel names used in the hop lists
+    std::map<std::string, channel_tracker_v2::channel_activity> activity;
+
+    for (const auto& a : chantracker->get_channel_activity()) {
+        auto& act = activity[hop_planner_base_channel(a.first)];
+        act.packets += a.second.packets;
+        act.devices += a.second.devices;
+    }
+
+    for (auto& gi : groups) {
+        auto& group = gi.second;
+
+        std::vector<channel_tracker_v2::channel_activity> chan_activity;
+        uint64_t max_packets = 0;
+        unsigned int max_devices = 0;
+
+        for (const auto& c : group.channels) {
+            channel_tracker_v2::channel_activity act{0, 0};
+
+            auto ai = activity.find(hop_planner_base_channel(c));
+            if (ai != activity.end())
+                act = ai->second;
+
+            max_packets = std::max(max_packets, act.packets);
+            max_devices = std::max(max_devices, act.devices);
+
+            chan_activity.push_back(act);
+        }
+
+        // Every channel keeps at least one slot so that channels which become busy
+        // are still found; busy channels get up to max_weight slots, scored by
+        // their share of the active devices and of the packets
+        std::vector<unsigned int> weights;
+        unsigned int total_weight = 0;
+
+        for (const auto& act : chan_activity) {
+            double score = 0;
+            unsigned int nscores = 0;
+
+            if (max_devices > 0) {
+                score += (double) act.devices / max_devices;
+                nscores++;
+            }
+
+            if (max_packets > 0) {
+                score += (double) act.packets / max_packets;
+                nscores++;
+            }
+
+            if (nscores > 0)
+                score /= nscores;
+
+            unsigned int w = 1 + std::lround(score * (hop_planner_max_weight - 1));
+
+            weights.push_back(w);
+            total_weight += w;
+        }
+
+        // Smooth weighted round-robin, which spreads the repeats of a busy channel
+        // evenly through the hop list instead of dwelling on it all at once
+        std::vector<std::string> plan;
+        std::vector<long> current(weights.size(), 0);
+
+        for (unsigned int slot = 0; slot < total_weight; slot++) {
+            size_t best = 0;
+
+            for (size_t w = 0; w < weights.size(); w++) {
+                current[w] += weights[w];
+
+                if (current[w] > current[best])
+                    best = w;
+            }
+
+            current[best] -= total_weight;
+            plan.push_back(group.channels[best]);
+        }
+
+        bool replanned = false;
+
+        for (size_t si = 0; si < group.sources.size(); si++) {
+            auto ds = group.sources[si];
+
+            unsigned int offt = (plan.size() / group.sources.size()) * si;
+
+            auto hop_vec = ds->get_source_hop_vec();
+            std::vector<std::string> cur_plan(hop_vec->begin(), hop_vec->end());
+
+            if (cur_plan == plan && ds->get_source_hop_offset() == offt)
+                continue;
+
+            ds->set_channel_hop(ds->get_source_hop_rate(), plan, ds->get_source_hop_shuffle(),
+                    offt, 0, nullptr);
+
+            replanned = true;
+        }
+
+        if (replanned)
+            _MSG_INFO("Re-planned channel hopping for {} '{}' source(s); {} channels "
+                    "weighted as {} hops", group.sources.size(), group.type,
+                    group.channels.size(), plan.size());
+    }
+}
+
 double datasource_tracker::string_to_rate(std::string in_str, double in_default) {
     double v, dv;
 
@@ -1965,12 +2364,11 @@ dst_incoming_remote::dst_incoming_remote(callback_t in_cb) :
     cb = in_cb;
 
     timerid =
-        timetracker->register_timer(std::chrono::seconds(5), 0,
-            [this] (int) -> int {
+        timetracker->defer_task(std::chrono::seconds(5),
+            [this] () {
             _MSG_ERROR("Incoming connection on remote capture socket, but remote side did "
                     "not initiate a datasource connection.");
                 close_external();
-                return 0;
             });
 }
 
@@ -2028,7 +2426,7 @@ void dst_incoming_remote::handle_packet_newsource(uint32_t in_seqno,
     }
 
     if (cb != NULL) {
-        cb(this, c.sourcetype(), c.definition(), c.uuid());
+        cb(this, c.sourcetype(), c.definition(), c.uuid(), c.session());
     }
 
     kill();
@@ -2073,8 +2471,10 @@ void datasource_tracker_remote_server::handle_accept(const boost::system::error_
         // Bind a new incoming remote which will pivot to the proper data source type
         auto remote = 
             std::make_shared<dst_incoming_remote>([this] (dst_incoming_remote *initiator, 
-                        std::string in_type, std::string in_def, uuid in_uuid) {
-                    datasourcetracker->open_remote_datasource(initiator, in_type, in_def, in_uuid, true);
+                        std::string in_type, std::string in_def, uuid in_uuid,
+                        std::string in_session) {
+                    datasourcetracker->open_remote_datasource(initiator, in_type, in_def, in_uuid,
+                            in_session, true);
                     });
 
         remote->attach_tcp_socket(socket);
@@ -250,6 +250,9 @@ public:
     __Proxy(remote_cap_port, uint32_t, uint32_t, uint32_t, remote_cap_port);
 
     __Proxy(remote_cap_timestamp, uint8_t, bool, bool, remote_cap_timestamp);
+    __Proxy(remote_cap_compression, uint8_t, bool, bool, remote_cap_compression);
+    __Proxy(remote_cap_resume, uint32_t, uint32_t, uint32_t, remote_cap_resume);
+    __Proxy(local_cap_shm, uint8_t, bool, bool, local_cap_shm);
 
 protected:
     virtual void register_fields() override {
@@ -278,6 +281,15 @@ protected:
         register_field("kismet.datasourcetracker.default.remote_cap_timestamp",
                 "overwrite remote capture timestamp with server timestamp",
                 &remote_cap_timestamp);
+        register_field("kismet.datasourcetracker.default.remote_cap_compression",
+                "compress data reports from remote capture",
+                &remote_cap_compression);
+        register_field("kismet.datasourcetracker.default.remote_cap_resume",
+                "seconds to wait for a remote capture to resume after losing its connection",
+                &remote_cap_resume);
+        register_field("kismet.datasourcetracker.default.local_cap_shm",
+                "read data reports from local capture through shared memory",
+                &local_cap_shm);
     }
 
     // Double hoprate per second
@@ -299,6 +311,9 @@ protected:
     std::shared_ptr<tracker_element_string> remote_cap_listen;
     std::shared_ptr<tracker_element_uint32> remote_cap_port;
     std::shared_ptr<tracker_element_uint8> remote_cap_timestamp;
+    std::shared_ptr<tracker_element_uint8> remote_cap_compression;
+    std::shared_ptr<tracker_element_uint32> remote_cap_resume;
+    std::shared_ptr<tracker_element_uint8> local_cap_shm;
 
 };
 
@@ -361,10 +376,11 @@ public:
     // Remove a data source by UUID; stop it if necessary
     bool remove_datasource(const uuid& in_uuid);
 
-    // Try to instantiate a remote data source
+    // Try to instantiate a remote data source, or resume a known remote source whose
+    // connection was lost when the session token matches
     std::shared_ptr<kis_datasource> open_remote_datasource(dst_incoming_remote *incoming, 
             const std::string& in_type, const std::string& in_definition, const uuid& in_uuid,
-            bool connect_tcp);
+            const std::string& in_session, bool connect_tcp);
 
     // Find a datasource
     shared_datasource find_datasource(const uuid& in_uuid);
@@ -387,6 +403,14 @@ public:
     // Merge a source into the source list, preserving UUID and source number
     virtual void merge_source(shared_datasource in_source);
 
+    // Re-plan the hop lists now instead of at the next planner interval, when a
+    // source has been locked or returned to hopping; does nothing when the planner
+    // is disabled
+    void replan_channel_hopping();
+
+    // Name the channel tracker records for a hop channel
+    static std::string hop_planner_base_channel(const std::string& in_chan);
+
     // Remote capture info
     bool remote_enabled() const {
         return remotecap_enabled;
@@ -463,10 +487,24 @@ protected:
 
     std::shared_ptr<datasource_tracker_defaults> config_defaults;
 
+    // Fill in the type of startup sources from a listing of the local interfaces, so
+    // that they don't each need to be probed
+    std::vector<std::string> resolve_source_types(const std::vector<std::string>& in_sources,
+            const std::vector<shared_interface>& in_interfaces);
+
+    // Open the startup sources, staggering them when there are many
+    void launch_startup_sources(const std::vector<std::string>& src_vec);
+
     // Re-assign channel hopping because we've opened a new source
     // and want to do channel split
     void calculate_source_hopping(shared_datasource in_ds);
 
+    // Channel hopping planner; periodically re-weights the hop lists of all the
+    // hopping sources so busier channels get more of the dwell time
+    int hop_planner_timer;
+    unsigned int hop_planner_max_weight;
+    void plan_channel_hopping();
+
     // Datasource logging
     int database_log_timer;
     bool database_log_enabled;
@@ -487,11 +525,12 @@ struct dst_websocket_ds_bridge {
 
 // Intermediary buffer handler which is responsible for parsing the incoming
 // simple packet protocol enough to get a NEWSOURCE command; The resulting source
-// type, definition, uuid, and rbufhandler is passed to the callback function; the cb
+// type, definition, uuid, session, and rbufhandler is passed to the callback function; the cb
 // is responsible for looking up the type, closing the connection if it is invalid, etc.
 class dst_incoming_remote : public kis_datasource {
 public:
-    using callback_t = std::function<void (dst_incoming_remote *, std::string, std::string, uuid)>;
+    using callback_t = std::function<void (dst_incoming_remote *, std::string, std::string, uuid,
+          std::string)>;
 
     dst_incoming_remote(callback_t in_cb);
     ~dst_incoming_remote();
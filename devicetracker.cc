@@ -52,6 +52,7 @@
 #include "messagebus.h"
 #include "packet.h"
 #include "packetchain.h"
+#include "packet_filter.h"
 #include "pcapng_stream_futurebuf.h"
 #include "util.h"
 #include "zstr.hpp"
@@ -77,6 +78,8 @@ device_tracker::device_tracker() :
 	eventbus =
 		Globalreg::fetch_mandatory_global_as<event_bus>();
 
+    new_device_chan = eventbus->register_channel(event_new_device());
+
     alertracker =
         Globalreg::fetch_mandatory_global_as<alert_tracker>();
 
@@ -86,6 +89,25 @@ device_tracker::device_tracker() :
     streamtracker =
         Globalreg::fetch_mandatory_global_as<stream_tracker>();
 
+    // Per-device RRDs can drop their day of history to save RAM; the builders have to
+    // be registered before the first device registers the fields
+    if (!Globalreg::globalreg->kismet_config->fetch_opt_bool("track_device_rrd_day", true)) {
+        _MSG("Not tracking a day of per-device packet history to save RAM", MSGFLAG_INFO);
+
+        const std::vector<std::pair<std::string, std::string>> rrd_fields = {
+            {"kismet.device.base.packets.rrd", "packet rate rrd"},
+            {"kismet.device.base.datasize.rrd", "packet size rrd"},
+            {"kismet.device.base.rx_packets.rrd", "received packet rate rrd"},
+            {"kismet.device.base.tx_packets.rrd", "transmitted packet rate rrd"},
+        };
+
+        for (const auto& f : rrd_fields) {
+            auto builder = std::make_shared<kis_tracked_compact_rrd<>>();
+            builder->set_day_history(false);
+            entrytracker->register_field(f.first, builder, f.second);
+        }
+    }
+
     device_base_id =
         entrytracker->register_field("kismet.device.base", 
                 tracker_element_factory<kis_tracked_device_base>(),
@@ -126,10 +148,12 @@ device_tracker::device_tracker() :
                 tracker_element_factory<tracker_element_uint64>(),
                 "Datatable records draw ID");
 
-    // Generate the system-wide packet RRD
-    packets_rrd = 
-        entrytracker->register_and_get_field_as<kis_tracked_rrd<>>("kismet.device.packets_rrd",
+    // Generate the system-wide packet RRD; it shares the field of the per-device RRD
+    // but is added to by every packet thread, so it accumulates without a lock
+    auto packets_rrd_id =
+        entrytracker->register_field("kismet.device.packets_rrd",
             tracker_element_factory<kis_tracked_rrd<>>(), "Packets seen RRD");
+    packets_rrd = std::make_shared<kis_tracked_atomic_rrd<>>(packets_rrd_id);
 
 	num_packets = num_datapackets = num_errorpackets =
 		num_filterpackets = 0;
@@ -179,9 +203,70 @@ device_tracker::device_tracker() :
         packetchain->register_handler([this](std::shared_ptr<kis_packet> in_packet) -> int {
             for (const auto& e : in_packet->process_complete_events)
                 eventbus->publish(e);
+
+            for (const auto& d : in_packet->new_devices)
+                batch_new_device(std::static_pointer_cast<kis_tracked_device_base>(d));
+
             return 1;
         }, CHAINPOS_TRACKER, 0x7FFFFFFF);
 
+    packet_expression_filter =
+        std::make_shared<packet_filter_expression>("pipeline", 
+                "Packets filtered before classification");
+
+    auto packet_filter_dfl =
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("packet_filter_default", "pass");
+
+    if (packet_filter_dfl == "pass" || packet_filter_dfl == "false") {
+        packet_expression_filter->set_filter_default(false);
+    } else if (packet_filter_dfl == "block" || packet_filter_dfl == "true") {
+        packet_expression_filter->set_filter_default(true);
+    } else {
+        _MSG_ERROR("Couldn't parse 'packet_filter_default', expected 'pass' or 'block', filter "
+                "defaulting to 'pass'.");
+    }
+
+    for (const auto& pfi : Globalreg::globalreg->kismet_config->fetch_opt_vec("packet_filter")) {
+        // expression,value; the value never has a comma, the expression may
+        auto comma = pfi.rfind(',');
+
+        if (comma == std::string::npos) {
+            _MSG_ERROR("Skipping invalid packet_filter option '{}', expected expression,filtertype.", pfi);
+            continue;
+        }
+
+        auto filter_tok = pfi.substr(comma + 1);
+        bool filter_opt = false;
+
+        if (filter_tok == "pass" || filter_tok == "false") {
+            filter_opt = false;
+        } else if (filter_tok == "block" || filter_tok == "true") {
+            filter_opt = true;
+        } else {
+            _MSG_ERROR("Skipping invalid packet_filter option '{}', expected expression,filtertype "
+                    "but got an error parsing '{}' as a filter block or pass.", pfi, filter_tok);
+            continue;
+        }
+
+        try {
+            packet_expression_filter->add_rule(pfi.substr(0, comma), filter_opt);
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("Skipping invalid packet_filter option '{}': {}", pfi, e.what());
+        }
+    }
+
+    // Filter before any phy classifies the packet
+    packetchain_filter_id =
+        packetchain->register_handler([this](std::shared_ptr<kis_packet> in_packet) -> int {
+            if (in_packet->error || in_packet->filtered)
+                return 1;
+
+            if (packet_expression_filter->filter_packet(in_packet))
+                in_packet->filtered = 1;
+
+            return 1;
+        }, CHAINPOS_CLASSIFIER, -1000);
+
     if (!Globalreg::globalreg->kismet_config->fetch_opt_bool("track_device_rrds", true)) {
         _MSG("Not tracking historical packet data to save RAM", MSGFLAG_INFO);
         ram_no_rrd = true;
@@ -224,7 +309,7 @@ device_tracker::device_tracker() :
                     }
 
                     // Don't even attempt to log if we're not logging
-                    auto dbf = Globalreg::fetch_global_as<kis_database_logfile>();
+                    auto dbf = Globalreg::fetch_global_handle<kis_database_logfile>();
                     if (dbf == nullptr)
                         return 1;
 
@@ -249,8 +334,6 @@ device_tracker::device_tracker() :
     last_devicelist_saved = 0;
 #endif
 
-    last_database_logged = 0;
-
     // Preload the vector for speed
     unsigned int preload_sz = 
         Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_device_presize", 1000);
@@ -274,6 +357,12 @@ device_tracker::device_tracker() :
 
         _MSG(ss.str(), MSGFLAG_INFO);
 
+        // Devices are only checked for idle timeout when they're due, from a wheel with 
+        // a slot per reaping interval
+        idle_wheel = 
+            std::make_unique<device_timeout_wheel>(60, std::max(device_idle_expiration, 0),
+                    (time_t) Globalreg::globalreg->last_tv_sec);
+
 		// Schedule device idle reaping every minute
         device_idle_timer =
             timetracker->register_timer(std::chrono::seconds(60), 1,
@@ -285,6 +374,15 @@ device_tracker::device_tracker() :
         device_idle_timer = -1;
     }
 
+    snapshot_max_age =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_filter_snapshot_age", 2);
+
+	device_work_threads =
+		Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_device_work_threads", 0);
+
+	if (device_work_threads == 0)
+		device_work_threads = std::thread::hardware_concurrency();
+
 	max_num_devices =
 		Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_max_devices", 0);
 
@@ -358,13 +456,23 @@ device_tracker::device_tracker() :
                     if (devkey.get_error())
                         throw std::runtime_error("invalid device key");
 
+                    // Serialize a snapshot of a live device, so that the devicelist
+                    // is only held while the device is copied
+                    kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), 
+                            "device_tracker /devices/by-key/device");
+
                     auto dev = fetch_device(devkey);
 
-                    if (dev == nullptr)
+                    if (dev != nullptr)
+                        return tracker_element_snapshot(dev);
+
+                    auto cold_dev = fetch_cold_device(devkey);
+
+                    if (cold_dev == nullptr)
                         throw std::runtime_error("nonexistent device key");
 
-                    return dev;
-                }, get_devicelist_mutex()));
+                    return cold_dev;
+                }));
 
     httpd->register_route("/devices/by-mac/:mac/devices", {"GET", "POST"}, httpd->RO_ROLE, {},
             std::make_shared<kis_net_web_tracked_endpoint>(
@@ -377,9 +485,8 @@ device_tracker::device_tracker() :
 
                     auto devvec = std::make_shared<tracker_element_vector>();
 
-                    const auto mmp = tracked_mac_multimap.equal_range(mac);
-                    for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi)
-                        devvec->push_back(mmpi->second);
+                    for (const auto& d : device_index.find_mac(mac))
+                        devvec->push_back(d);
 
                     return devvec;
                 }, get_devicelist_mutex()));
@@ -398,14 +505,92 @@ device_tracker::device_tracker() :
                         ts = tv;
                     }
 
-                    auto ts_worker = device_tracker_view_function_worker(
-                        [ts](std::shared_ptr<kis_tracked_device_base> d) -> bool {
-                            if (d->get_last_time() <= ts)
-                                return false;
-                            return true;
-                        });
+                    // Devices seen after the timestamp, from the last-seen index of 
+                    // the view of all devices
+                    return all_view->devices_seen_since(ts + 1);
+                }, get_devicelist_mutex()));
+
+    httpd->register_route("/devices/bbox/:minlat/:minlon/:maxlat/:maxlon/devices", 
+            {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](shared_con con) -> std::shared_ptr<tracker_element> {
+                    auto min_lat = string_to_n<double>(con->uri_params().find(":minlat")->second);
+                    auto min_lon = string_to_n<double>(con->uri_params().find(":minlon")->second);
+                    auto max_lat = string_to_n<double>(con->uri_params().find(":maxlat")->second);
+                    auto max_lon = string_to_n<double>(con->uri_params().find(":maxlon")->second);
+
+                    if (min_lat > max_lat)
+                        std::swap(min_lat, max_lat);
+
+                    auto devvec = std::make_shared<tracker_element_vector>();
+
+                    // Candidates come from the spatial index cells under the box, then
+                    // are checked against the exact average location; a box with
+                    // min_lon > max_lon crosses the antimeridian
+                    for (const auto& d : device_index.find_bbox(min_lat, min_lon, max_lat, max_lon)) {
+                        if (!d->has_location())
+                            continue;
+
+                        const auto& acc = d->get_location()->get_accumulator();
+
+                        if (acc.num_avg == 0)
+                            continue;
+
+                        auto lat = acc.avg_lat();
+                        auto lon = acc.avg_lon();
+
+                        if (lat < min_lat || lat > max_lat)
+                            continue;
 
-                    return do_readonly_device_work(ts_worker);
+                        if (min_lon <= max_lon) {
+                            if (lon < min_lon || lon > max_lon)
+                                continue;
+                        } else if (lon < min_lon && lon > max_lon) {
+                            continue;
+                        }
+
+                        devvec->push_back(d);
+                    }
+
+                    return devvec;
+                }, get_devicelist_mutex()));
+
+    httpd->register_route("/devices/modified-since/:generation/devices", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](shared_con con) -> std::shared_ptr<tracker_element> {
+                    auto gen_k = con->uri_params().find(":generation");
+                    auto since = string_to_n<uint64_t>(gen_k->second);
+
+                    // Advance the generation before collecting the changes, so that anything
+                    // modified while we're serializing is reported to the next request
+                    auto next_gen = std::make_shared<tracker_element_uint64>();
+                    next_gen->set(tracker_component::advance_generation());
+
+                    auto devvec = std::make_shared<tracker_element_vector>();
+
+                    for (const auto& d : *immutable_tracked_vec) {
+                        if (d == nullptr)
+                            continue;
+
+                        auto dev = std::static_pointer_cast<kis_tracked_device_base>(d);
+                        auto mod = dev->modified_since(since);
+
+                        if (mod == nullptr)
+                            continue;
+
+                        // Always identify the device by key
+                        auto key = dev->get_tracker_key();
+                        if (std::find(mod->begin(), mod->end(), key) == mod->end())
+                            mod->get().insert(mod->begin(), key);
+
+                        devvec->push_back(mod);
+                    }
+
+                    auto wrapper = std::make_shared<tracker_element_string_map>();
+                    wrapper->insert("kismet.devicelist.generation", next_gen);
+                    wrapper->insert("kismet.devicelist.devices", devvec);
+
+                    return wrapper;
                 }, get_devicelist_mutex()));
 
     httpd->register_route("/devices/by-key/:key/set_name", {"POST"}, httpd->LOGON_ROLE, {"cmd"},
@@ -479,6 +664,10 @@ device_tracker::device_tracker() :
                             nullptr,
                             1024*512);
         
+                    auto filter_k = con->http_variables().find("filter");
+                    if (filter_k != con->http_variables().end())
+                        pcapng->set_bpf_filter(filter_k->second);
+
                     con->clear_timeout();
                     con->set_target_file(fmt::format("kismet-device-{}.pcapng", devkey));
                     con->set_closure_cb([pcapng]() { pcapng->stop_stream("http connection lost"); });
@@ -722,11 +911,10 @@ device_tracker::device_tracker() :
                                                 } else if (!dev_m.error()) {
                                                     kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "ws monitor timer serialize lambda");
 
-                                                    const auto mmp = tracked_mac_multimap.equal_range(dev_m);
-                                                    for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
-                                                        if (mmpi->second->get_mod_time() > last_tm) {
+                                                    for (const auto& d : device_index.find_mac(dev_m)) {
+                                                        if (d->get_mod_time() > last_tm) {
                                                             std::stringstream ss;
-                                                            entrytracker->serialize_with_json_summary(format_t, ss, mmpi->second, json);
+                                                            entrytracker->serialize_with_json_summary(format_t, ss, d, json);
                                                             auto data = ss.str();
                                                             ws->write(data);
                                                         }
@@ -795,6 +983,111 @@ device_tracker::device_tracker() :
     database_open("");
     database_upgrade_db();
 
+    cold_device_age =
+        Globalreg::globalreg->kismet_config->fetch_opt_int("tracker_cold_device_age", 0);
+    cold_device_timer = -1;
+
+    if (cold_device_age > 0 && !database_valid()) {
+        _MSG_ERROR("Cold device storage requires the device tracker database, devices will "
+                "not be moved to cold storage.");
+        cold_device_age = 0;
+    }
+
+    if (cold_device_age > 0) {
+        _MSG_INFO("Moving tracked devices which have been inactive for more than {} seconds "
+                "to cold storage in {}", cold_device_age, ds_dbfile);
+        _MSG_INFO("Devices restored from cold storage keep their first time, packet counts, "
+                "name, and tags, but not their per-phy records, location, or history.");
+
+        // Cold stubs only live in RAM, so records left from a previous run can never
+        // be reloaded
+        {
+            kis_lock_guard<kis_mutex> lk(ds_mutex);
+            sqlite3_exec(db, "DELETE FROM device_cold_storage",
+                    [] (void *, int, char **, char **) -> int { return 0; }, NULL, NULL);
+        }
+
+        cold_wheel =
+            std::make_unique<device_timeout_wheel>(60, cold_device_age,
+                    (time_t) Globalreg::globalreg->last_tv_sec);
+
+        cold_device_timer =
+            timetracker->register_timer(std::chrono::seconds(60), 1,
+                [this](int eventid) -> int {
+                    timetracker_event(eventid);
+                    return 1;
+                });
+    }
+
+    seenby_buffers_mutex.set_name("device_tracker seenby_buffers");
+
+    seenby_coalesce_ms =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_seenby_coalesce_ms", 250);
+    seenby_flush_timer = -1;
+
+    if (seenby_coalesce_ms > 0)
+        seenby_flush_timer =
+            timetracker->register_timer(std::max<int>(1, seenby_coalesce_ms * SERVER_TIMESLICES_SEC / 1000),
+                nullptr, 1, [this](int) -> int {
+                    flush_seenby_buffers();
+                    return 1;
+                });
+
+    new_device_batches_mutex.set_name("device_tracker new_device_batches");
+
+    new_device_batch_ms =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_new_device_batch_ms", 100);
+    new_device_batch_timer = -1;
+
+    if (new_device_batch_ms > 0)
+        new_device_batch_timer =
+            timetracker->register_timer(std::max<int>(1, new_device_batch_ms * SERVER_TIMESLICES_SEC / 1000),
+                nullptr, 1, [this](int) -> int {
+                    flush_new_device_batches();
+                    return 1;
+                });
+
+    snapshot_file =
+        Globalreg::globalreg->kismet_config->fetch_opt_path("tracker_snapshot_file", "");
+    snapshot_timer = -1;
+
+    if (snapshot_file.length() != 0) {
+        if (device_snap.open(snapshot_file))
+            _MSG_INFO("Restoring {} devices from the device snapshot {} as they are seen again",
+                    device_snap.size(), snapshot_file);
+
+        auto snaprate =
+            Globalreg::globalreg->kismet_config->fetch_opt_uint("tracker_snapshot_rate", 300);
+
+        if (snaprate > 0) {
+            _MSG_INFO("Saving a snapshot of the tracked devices to {} every {} seconds",
+                    snapshot_file, snaprate);
+
+            snapshot_timer =
+                timetracker->register_timer(std::chrono::seconds(snaprate), 1,
+                    [this](int) -> int {
+                        // Write the snapshot in its own thread, skipping this interval if
+                        // the last one is still being written
+                        std::thread t([this] {
+                            std::unique_lock<std::mutex> lk(snapshot_write_mutex, std::try_to_lock);
+
+                            if (!lk.owns_lock()) {
+                                _MSG_ERROR("Attempting to save the device snapshot, but the last "
+                                        "snapshot is still being written.  Try increasing the "
+                                        "delay in 'tracker_snapshot_rate' in kismet_memory.conf");
+                                return;
+                            }
+
+                            write_device_snapshot();
+                        });
+
+                        t.detach();
+
+                        return 1;
+                    });
+        }
+    }
+
     new_datasource_evt_id = 
         eventbus->register_listener(datasource_tracker::event_new_datasource(),
                 [this](std::shared_ptr<eventbus_event> evt) {
@@ -802,9 +1095,9 @@ device_tracker::device_tracker() :
                 });
 
     new_device_evt_id = 
-        eventbus->register_listener(device_tracker::event_new_device(),
+        eventbus->register_listener(device_tracker::event_new_device_batch(),
                 [this](std::shared_ptr<eventbus_event> evt) {
-                    handle_new_device_event(evt);
+                    handle_new_device_batch_event(evt);
                 });
 
     devicefound_timeout =
@@ -894,13 +1187,18 @@ device_tracker::~device_tracker() {
     if (packetchain != nullptr) {
         packetchain->remove_handler(packetchain_common_id, CHAINPOS_TRACKER);
         packetchain->remove_handler(packetchain_tracking_done_id, CHAINPOS_TRACKER);
+        packetchain->remove_handler(packetchain_filter_id, CHAINPOS_CLASSIFIER);
     }
 
     auto timetracker = Globalreg::fetch_global_as<time_tracker>();
     if (timetracker != nullptr) {
         timetracker->remove_timer(device_idle_timer);
         timetracker->remove_timer(max_devices_timer);
+        timetracker->remove_timer(cold_device_timer);
+        timetracker->remove_timer(snapshot_timer);
         timetracker->remove_timer(device_storage_timer);
+        timetracker->remove_timer(seenby_flush_timer);
+        timetracker->remove_timer(new_device_batch_timer);
     }
 
     // TODO broken for now
@@ -913,7 +1211,7 @@ device_tracker::~device_tracker() {
         delete(p.second);
 
     immutable_tracked_vec->clear();
-    tracked_mac_multimap.clear();
+    device_index.clear();
 }
 
 void device_tracker::macdevice_timer_event() {
@@ -979,9 +1277,7 @@ std::string device_tracker::fetch_phy_name(int in_phy) {
 }
 
 int device_tracker::fetch_num_devices() {
-    kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker fetch_num_devices");
-
-    return tracked_map.size();
+    return device_index.size();
 }
 
 int device_tracker::fetch_num_packets() {
@@ -1040,37 +1336,26 @@ void device_tracker::update_full_refresh() {
     full_refresh_time = (time_t) Globalreg::globalreg->last_tv_sec;
 }
 
+// The device index has its own shard locks, so key and MAC lookups don't need to 
+// hold the device list
 std::shared_ptr<kis_tracked_device_base> device_tracker::fetch_device(device_key in_key) {
-    kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker fetch_device");
-
-	device_itr i = tracked_map.find(in_key);
-
-	if (i != tracked_map.end())
-		return i->second;
-
-	return NULL;
+    return device_index.find(in_key);
 }
 
 std::shared_ptr<kis_tracked_device_base> device_tracker::fetch_device_nr(device_key in_key) {
-	device_itr i = tracked_map.find(in_key);
+    return device_index.find(in_key);
+}
 
-	if (i != tracked_map.end())
-		return i->second;
+std::shared_ptr<kis_tracked_device_base> device_tracker::fetch_device_by_internal_id_nr(uint64_t in_id) {
+    if (in_id >= immutable_tracked_vec->size())
+        return nullptr;
 
-	return NULL;
+    return std::static_pointer_cast<kis_tracked_device_base>(*(immutable_tracked_vec->begin() + in_id));
 }
 
 // Fetch one or more devices by mac address or mac mask
 std::vector<std::shared_ptr<kis_tracked_device_base>> device_tracker::fetch_devices(mac_addr in_mac) {
-    kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker fetch_device mac");
-    std::vector<std::shared_ptr<kis_tracked_device_base>> ret;
-   
-    const auto mmp = tracked_mac_multimap.equal_range(in_mac);
-    for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
-        ret.push_back(mmpi->second);
-    }
-
-    return ret;
+    return device_index.find_mac(in_mac);
 }
 
 int device_tracker::common_tracker(std::shared_ptr<kis_packet> in_pack) {
@@ -1139,6 +1424,192 @@ int device_tracker::common_tracker(std::shared_ptr<kis_packet> in_pack) {
 	return 1;
 }
 
+void device_tracker::coalesce_seenby(std::shared_ptr<kis_tracked_device_base> device,
+        kis_datasource *source, time_t tv_sec, int frequency,
+        packinfo_sig_combo *siginfo, bool update_rrd) {
+
+    thread_local seenby_buffer *local_buffer = nullptr;
+
+    if (local_buffer == nullptr) {
+        auto slot = thread_buffer_slot();
+
+        kis_lock_guard<kis_mutex> lk(seenby_buffers_mutex, "device_tracker coalesce_seenby");
+
+        if (seenby_buffers.size() <= slot)
+            seenby_buffers.resize(slot + 1);
+
+        if (seenby_buffers[slot] == nullptr) {
+            auto b = std::make_unique<seenby_buffer>();
+            b->mutex.set_name("device_tracker seenby_buffer");
+            b->last_flush = std::chrono::steady_clock::now();
+            seenby_buffers[slot] = std::move(b);
+        }
+
+        local_buffer = seenby_buffers[slot].get();
+    }
+
+    kis_lock_guard<kis_mutex> lk(local_buffer->mutex, "device_tracker coalesce_seenby");
+
+    auto di = local_buffer->deltas.find(std::make_pair(device.get(), source));
+
+    if (di == local_buffer->deltas.end()) {
+        auto sbi = device->get_seenby_map()->find(source->get_source_key());
+
+        // New seenby records are made right away, so the seenby views see them
+        if (sbi == device->get_seenby_map()->end()) {
+            device->inc_seenby_count(source, tv_sec, frequency, siginfo, update_rrd);
+            return;
+        }
+
+        seenby_delta d;
+        d.device = device;
+        d.seenby = std::static_pointer_cast<kis_tracked_seenby_data>(sbi->second);
+        d.ts = tv_sec;
+        d.packets = 0;
+        d.update_rrd = update_rrd;
+
+        di = local_buffer->deltas.emplace(std::make_pair(device.get(), source), std::move(d)).first;
+    }
+
+    auto& d = di->second;
+
+    // Deltas only span one second, so the times and signal rrd come out as they would
+    // per packet
+    if (d.packets != 0 && (d.ts != tv_sec || d.update_rrd != update_rrd ||
+                (siginfo != nullptr && !d.signal.add(*siginfo)))) {
+        apply_seenby_delta(d);
+
+        d.ts = tv_sec;
+        d.update_rrd = update_rrd;
+
+        if (siginfo != nullptr)
+            d.signal.add(*siginfo);
+    } else if (d.packets == 0 && siginfo != nullptr) {
+        d.signal.add(*siginfo);
+    }
+
+    d.packets++;
+
+    if (frequency > 0) {
+        auto fi = std::find_if(d.frequencies.begin(), d.frequencies.end(),
+                [frequency](const std::pair<int, uint64_t>& f) { return f.first == frequency; });
+
+        if (fi == d.frequencies.end())
+            d.frequencies.push_back(std::make_pair(frequency, 1));
+        else
+            fi->second++;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (now - local_buffer->last_flush >= std::chrono::milliseconds(seenby_coalesce_ms))
+        flush_seenby_buffer(*local_buffer);
+}
+
+void device_tracker::apply_seenby_delta(seenby_delta& delta) {
+    if (delta.packets == 0)
+        return;
+
+    delta.seenby->set_last_time(delta.ts);
+    delta.seenby->set_num_packets(delta.seenby->get_num_packets() + delta.packets);
+
+    for (const auto& f : delta.frequencies)
+        delta.seenby->inc_frequency_count(f.first, f.second);
+
+    if (!delta.signal.empty())
+        delta.seenby->get_signal_data()->append_signal(delta.signal, delta.update_rrd, delta.ts);
+
+    delta.packets = 0;
+    delta.frequencies.clear();
+    delta.signal.reset();
+}
+
+void device_tracker::flush_seenby_buffer(seenby_buffer& buffer) {
+    for (auto& d : buffer.deltas)
+        apply_seenby_delta(d.second);
+
+    // Dropping the deltas releases the devices they hold
+    buffer.deltas.clear();
+    buffer.last_flush = std::chrono::steady_clock::now();
+}
+
+void device_tracker::flush_seenby_buffers() {
+    kis_lock_guard<kis_mutex> list_lk(get_devicelist_mutex(), "device_tracker flush_seenby_buffers");
+    kis_lock_guard<kis_mutex> lk(seenby_buffers_mutex, "device_tracker flush_seenby_buffers");
+
+    for (auto& b : seenby_buffers) {
+        if (b == nullptr)
+            continue;
+
+        kis_lock_guard<kis_mutex> blk(b->mutex, "device_tracker flush_seenby_buffers");
+        flush_seenby_buffer(*b);
+    }
+}
+
+void device_tracker::batch_new_device(std::shared_ptr<kis_tracked_device_base> device) {
+    if (eventbus->has_listeners(new_device_chan)) {
+        auto evt = eventbus->get_eventbus_event(event_new_device());
+        evt->get_event_content()->insert(event_new_device(), device);
+        eventbus->publish(evt);
+    }
+
+    thread_local new_device_batch *local_batch = nullptr;
+
+    if (local_batch == nullptr) {
+        auto slot = thread_buffer_slot();
+
+        kis_lock_guard<kis_mutex> lk(new_device_batches_mutex, "device_tracker batch_new_device");
+
+        if (new_device_batches.size() <= slot)
+            new_device_batches.resize(slot + 1);
+
+        if (new_device_batches[slot] == nullptr) {
+            auto b = std::make_unique<new_device_batch>();
+            b->mutex.set_name("device_tracker new_device_batch");
+            b->devices = std::make_shared<tracker_element_vector>();
+            b->last_flush = std::chrono::steady_clock::now();
+            new_device_batches[slot] = std::move(b);
+        }
+
+        local_batch = new_device_batches[slot].get();
+    }
+
+    kis_lock_guard<kis_mutex> lk(local_batch->mutex, "device_tracker batch_new_device");
+
+    local_batch->devices->push_back(device);
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (now - local_batch->last_flush >= std::chrono::milliseconds(new_device_batch_ms))
+        flush_new_device_batch(*local_batch);
+}
+
+void device_tracker::flush_new_device_batch(new_device_batch& batch) {
+    batch.last_flush = std::chrono::steady_clock::now();
+
+    if (batch.devices->size() == 0)
+        return;
+
+    // The published vector belongs to the event from here on
+    auto evt = eventbus->get_eventbus_event(event_new_device_batch());
+    evt->get_event_content()->insert(event_new_device_batch(), batch.devices);
+    eventbus->publish(evt);
+
+    batch.devices = std::make_shared<tracker_element_vector>();
+}
+
+void device_tracker::flush_new_device_batches() {
+    kis_lock_guard<kis_mutex> lk(new_device_batches_mutex, "device_tracker flush_new_device_batches");
+
+    for (auto& b : new_device_batches) {
+        if (b == nullptr)
+            continue;
+
+        kis_lock_guard<kis_mutex> blk(b->mutex, "device_tracker flush_new_device_batches");
+        flush_new_device_batch(*b);
+    }
+}
+
 // This function handles populating the base common info about a device, transforming a 
 // kis_common_info record into a full kis_tracked_device_base (or updating an existing
 // kis_tracked_device_base record); 
@@ -1200,6 +1671,12 @@ std::shared_ptr<kis_tracked_device_base>
         load_stored_username(device);
         load_stored_tags(device);
 
+        if (device_snap.size() != 0)
+            restore_snapshot_device(device);
+
+        if (cold_wheel != nullptr)
+            restore_cold_device(device);
+
         new_device = true;
     }
 
@@ -1247,8 +1724,10 @@ std::shared_ptr<kis_tracked_device_base>
 
     }
 
-    if (device->get_last_time() < in_pack->ts.tv_sec)
+    if (device->get_last_time() < in_pack->ts.tv_sec) {
         device->set_last_time(in_pack->ts.tv_sec);
+        touch_view_device(device);
+    }
 
     if (in_flags & UCD_UPDATE_PACKETS) {
         device->inc_packets();
@@ -1341,25 +1820,30 @@ std::shared_ptr<kis_tracked_device_base>
                     pack_gpsinfo->alt, pack_gpsinfo->fix, pack_gpsinfo->speed,
                     pack_gpsinfo->heading);
 
+            // Follow the average location in the spatial index; the average only
+            // moves here, and this runs at most once a second per device
+            const auto& acc = devloc->get_accumulator();
+            device_index.update_location(device, acc.avg_lat(), acc.avg_lon());
+
             // Throttle history cloud to one update per second to prevent floods of
             // data from swamping the cloud
             if (track_history_cloud && pack_gpsinfo->fix >= 2) {
-                auto histloc = Globalreg::new_from_pool<kis_historic_location>();
+                kis_location_sample histloc;
 
-                histloc->set_lat(pack_gpsinfo->lat);
-                histloc->set_lon(pack_gpsinfo->lon);
-                histloc->set_alt(pack_gpsinfo->alt);
-                histloc->set_speed(pack_gpsinfo->speed);
-                histloc->set_heading(pack_gpsinfo->heading);
+                histloc.lat = pack_gpsinfo->lat;
+                histloc.lon = pack_gpsinfo->lon;
+                histloc.alt = pack_gpsinfo->alt;
+                histloc.speed = pack_gpsinfo->speed;
+                histloc.heading = pack_gpsinfo->heading;
 
-                histloc->set_time_sec(in_pack->ts.tv_sec);
+                histloc.time_sec = in_pack->ts.tv_sec;
 
                 if (pack_l1info != NULL) {
-                    histloc->set_frequency(pack_l1info->freq_khz);
+                    histloc.frequency = pack_l1info->freq_khz;
                     if (pack_l1info->signal_dbm != 0)
-                        histloc->set_signal(pack_l1info->signal_dbm);
+                        histloc.signal = pack_l1info->signal_dbm;
                     else
-                        histloc->set_signal(pack_l1info->signal_rssi);
+                        histloc.signal = pack_l1info->signal_rssi;
                 }
 
                 device->get_location_cloud()->add_sample(histloc);
@@ -1376,25 +1860,28 @@ std::shared_ptr<kis_tracked_device_base>
 	if ((in_flags & UCD_UPDATE_SEENBY) && pack_datasrc != NULL) {
         double f = -1;
 
-        packinfo_sig_combo *sc = NULL;
-
         if (pack_l1info != NULL)
             f = pack_l1info->freq_khz;
 
         if (track_persource_history) {
             // Only populate signal, frequency map, etc per-source if we're tracking that
-            auto sc = std::make_shared<packinfo_sig_combo>(pack_l1info, pack_gpsinfo);
-            device->inc_seenby_count(pack_datasrc->ref_source, in_pack->ts.tv_sec, f, 
-                    sc.get(), !ram_no_rrd);
+            packinfo_sig_combo sc(pack_l1info, pack_gpsinfo);
+
+            if (seenby_coalesce_ms > 0 && !new_device)
+                coalesce_seenby(device, pack_datasrc->ref_source, in_pack->ts.tv_sec, f, 
+                        &sc, !ram_no_rrd);
+            else
+                device->inc_seenby_count(pack_datasrc->ref_source, in_pack->ts.tv_sec, f, 
+                        &sc, !ram_no_rrd);
+        } else if (seenby_coalesce_ms > 0 && !new_device) {
+            coalesce_seenby(device, pack_datasrc->ref_source, in_pack->ts.tv_sec, 0, 
+                    nullptr, false);
         } else {
             device->inc_seenby_count(pack_datasrc->ref_source, in_pack->ts.tv_sec, 0, 0, false);
         }
 
         if (map_seenby_views)
             update_view_device(device);
-
-        if (sc != NULL)
-            delete(sc);
 	}
 
     if (pack_common != NULL)
@@ -1408,25 +1895,24 @@ std::shared_ptr<kis_tracked_device_base>
 
     if (new_device) {
         // Add the new device to the list
-        tracked_map[key] = device;
+        device_index.insert(device);
 
         immutable_tracked_vec->push_back(device);
 
-        auto mm_pair = std::make_pair(in_mac, device);
-        tracked_mac_multimap.insert(mm_pair);
+        if (idle_wheel != nullptr)
+            idle_wheel->schedule(device, device->get_last_time() + device_idle_expiration + 1);
+
+        if (cold_wheel != nullptr)
+            cold_wheel->schedule(device, device->get_last_time() + cold_device_age + 1);
 
         // If we have no packet info, add it to the device list immediately,
-        // otherwise, flag the packet to trigger a new device event at the
-        // end of the packet processing stage of the chain
+        // otherwise, flag the packet to batch the new device at the end of the
+        // packet processing stage of the chain
         if (in_pack == nullptr) {
             new_view_device(device);
-            auto evt = eventbus->get_eventbus_event(event_new_device());
-            evt->get_event_content()->insert(event_new_device(), device);
-            eventbus->publish(evt);
+            batch_new_device(device);
         } else {
-            auto evt = eventbus->get_eventbus_event(event_new_device());
-            evt->get_event_content()->insert(event_new_device(), device);
-            in_pack->process_complete_events.push_back(evt);
+            in_pack->new_devices.push_back(device);
         }
 
 #if 0
@@ -1444,6 +1930,12 @@ bool devicetracker_sort_internal_id(std::shared_ptr<kis_tracked_device_base> a,
 	return a->get_kis_internal_id() < b->get_kis_internal_id();
 }
 
+std::shared_ptr<tracker_element_vector> device_tracker::do_device_work(device_tracker_view_worker& worker, 
+        std::shared_ptr<tracker_element_vector> vec) {
+
+    return all_view->do_device_work(worker, vec);
+}
+
 std::shared_ptr<tracker_element_vector> device_tracker::do_readonly_device_work(device_tracker_view_worker& worker, 
         std::shared_ptr<tracker_element_vector> vec) {
 
@@ -1477,40 +1969,33 @@ void device_tracker::timetracker_event(int eventid) {
         time_t ts_now = Globalreg::globalreg->last_tv_sec;
         bool purged = false;
 
-        // Reset the smart pointer of any devices we're dropping from the device list
-        for (size_t pi = 0; pi < immutable_tracked_vec->size(); pi++) {
-            auto d = std::static_pointer_cast<kis_tracked_device_base>(*(immutable_tracked_vec->begin() + pi));
-
-            if (d == nullptr)
+        // Only the devices due for a check come out of the wheel; anything seen since it
+        // was scheduled goes back in, due from its new last time
+        for (const auto& d : idle_wheel->expire(ts_now)) {
+            // Already removed from tracking
+            if (device_index.find(d->get_key()) != d)
                 continue;
 
-            if (ts_now - d->get_last_time() > device_idle_expiration &&
-                (d->get_packets() < device_idle_min_packets ||
-                 device_idle_min_packets <= 0)) {
-
-                device_itr mi = tracked_map.find(d->get_key());
-                if (mi != tracked_map.end())
-                    tracked_map.erase(mi);
-
-                // Erase it from the multimap
-                auto mmp = tracked_mac_multimap.equal_range(d->get_macaddr());
+            // Devices with enough packets are never eligible for removal, and packet counts
+            // only grow, so they never need to be checked again
+            if (device_idle_min_packets > 0 && d->get_packets() >= device_idle_min_packets)
+                continue;
 
-                for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
-                    if (mmpi->second->get_key() == d->get_key()) {
-                        tracked_mac_multimap.erase(mmpi);
-                        break;
-                    }
-                }
+            if (ts_now - d->get_last_time() <= device_idle_expiration) {
+                idle_wheel->schedule(d, d->get_last_time() + device_idle_expiration + 1);
+                continue;
+            }
 
-                // Forget it from any views
-                remove_view_device(d);
+            device_index.erase(d);
 
-                // Forget the immutable vec pointer to it
-                (immutable_tracked_vec->begin() + pi)->reset();
+            // Forget it from any views
+            remove_view_device(d);
 
-                purged = true;
+            // Forget the immutable vec pointer to it; the internal id is the position in
+            // the vector
+            (immutable_tracked_vec->begin() + d->get_kis_internal_id())->reset();
 
-            }
+            purged = true;
         }
 
         if (purged)
@@ -1524,7 +2009,7 @@ void device_tracker::timetracker_event(int eventid) {
             return;
 
 		// Do nothing if the number of devices is less than the max
-		if (tracked_map.size() <= max_num_devices)
+		if (device_index.size() <= max_num_devices)
             return;
 
         // Now this gets expensive; clone the immutable vec, sort it, and then we start
@@ -1540,19 +2025,7 @@ void device_tracker::timetracker_event(int eventid) {
         for (auto i = sorted_vec.begin() + max_num_devices; i != sorted_vec.end(); ++i) {
             auto d = std::static_pointer_cast<kis_tracked_device_base>(*i);
 
-            device_itr mi = tracked_map.find(d->get_key());
-            if (mi != tracked_map.end())
-                tracked_map.erase(mi);
-
-            // Erase it from the multimap
-            auto mmp = tracked_mac_multimap.equal_range(d->get_macaddr());
-
-            for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
-                if (mmpi->second->get_key() == d->get_key()) {
-                    tracked_mac_multimap.erase(mmpi);
-                    break;
-                }
-            }
+            device_index.erase(d);
 
             // Forget it from the immutable vec, but keep its
             // position; we need to have vecpos = devid
@@ -1562,7 +2035,10 @@ void device_tracker::timetracker_event(int eventid) {
         // Do an update since we're trimming something
         update_full_refresh();
 
-	}
+	} else if (eventid == cold_device_timer) {
+        kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker timetracker_event cold_device_timer");
+        evict_cold_devices(Globalreg::globalreg->last_tv_sec);
+    }
 }
 
 void device_tracker::usage(const char *name __attribute__((unused))) {
@@ -1652,7 +2128,27 @@ int device_tracker::database_upgrade_db() {
         }
     }
 
-    database_set_db_version(4);
+    if (dbv < 5) {
+        // Full records of devices moved to cold storage, as JSON
+        sql = 
+            "CREATE TABLE device_cold_storage ("
+            "key TEXT, "
+            "record TEXT, "
+            "UNIQUE(key) ON CONFLICT REPLACE)";
+
+        r = sqlite3_exec(db, sql.c_str(),
+                [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+        if (r != SQLITE_OK) {
+            _MSG("device_tracker unable to create device_cold_storage table in " + ds_dbfile + ": " +
+                    std::string(sErrMsg), MSGFLAG_ERROR);
+            sqlite3_close(db);
+            db = NULL;
+            return -1;
+        }
+    }
+
+    database_set_db_version(5);
 
     return 0;
 }
@@ -1670,11 +2166,19 @@ void device_tracker::add_device(std::shared_ptr<kis_tracked_device_base> device)
     // in it's numbered slot
     device->set_kis_internal_id(immutable_tracked_vec->size());
 
-    tracked_map[device->get_key()] = device;
+    device_index.insert(device);
     immutable_tracked_vec->push_back(device);
 
-    auto mm_pair = std::make_pair(device->get_macaddr(), device);
-    tracked_mac_multimap.emplace(mm_pair);
+    if (device->has_location() && device->get_location()->has_avg_loc()) {
+        const auto& acc = device->get_location()->get_accumulator();
+        device_index.update_location(device, acc.avg_lat(), acc.avg_lon());
+    }
+
+    if (idle_wheel != nullptr)
+        idle_wheel->schedule(device, device->get_last_time() + device_idle_expiration + 1);
+
+    if (cold_wheel != nullptr)
+        cold_wheel->schedule(device, device->get_last_time() + cold_device_age + 1);
 }
 
 bool device_tracker::add_view(std::shared_ptr<device_tracker_view> in_view) {
@@ -1711,6 +2215,8 @@ void device_tracker::remove_view(const std::string& in_id) {
 void device_tracker::new_view_device(std::shared_ptr<kis_tracked_device_base> in_device) {
     kis_lock_guard<kis_mutex> lk(devicelist_mutex);
 
+    in_device->update_view_inputs();
+
     for (const auto& i : *view_vec) {
         auto vi = static_cast<device_tracker_view *>(i.get());
         vi->new_device(in_device);
@@ -1720,6 +2226,11 @@ void device_tracker::new_view_device(std::shared_ptr<kis_tracked_device_base> in
 void device_tracker::update_view_device(std::shared_ptr<kis_tracked_device_base> in_device) {
     kis_lock_guard<kis_mutex> lk(devicelist_mutex);
 
+    // Membership can only change when something views filter on has changed; steady
+    // traffic from a known device skips the per-view callbacks entirely
+    if (!in_device->update_view_inputs())
+        return;
+
     for (const auto& i : *view_vec) {
         auto vi = static_cast<device_tracker_view *>(i.get());
         vi->update_device(in_device);
@@ -1735,6 +2246,15 @@ void device_tracker::remove_view_device(std::shared_ptr<kis_tracked_device_base>
     }
 }
 
+void device_tracker::touch_view_device(std::shared_ptr<kis_tracked_device_base> in_device) {
+    kis_lock_guard<kis_mutex> lk(devicelist_mutex);
+
+    for (const auto& i : *view_vec) {
+        auto vi = static_cast<device_tracker_view *>(i.get());
+        vi->touch_device(in_device);
+    }
+}
+
 std::shared_ptr<device_tracker_view> device_tracker::get_phy_view(int in_phyid) {
     kis_lock_guard<kis_mutex> lk(devicelist_mutex);
 
@@ -1745,8 +2265,8 @@ std::shared_ptr<device_tracker_view> device_tracker::get_phy_view(int in_phyid)
     return nullptr;
 }
 
-void device_tracker::databaselog_write_devices() {
-    auto dbf = Globalreg::fetch_global_as<kis_database_logfile>();
+void device_tracker::databaselog_write_devices(bool force) {
+    auto dbf = Globalreg::fetch_global_handle<kis_database_logfile>();
     
     if (dbf == nullptr)
         return;
@@ -1754,27 +2274,60 @@ void device_tracker::databaselog_write_devices() {
     if (!dbf->is_enabled())
         return;
 
-    device_tracker_view_function_worker worker([this, dbf](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
-            if (dev->get_mod_time() >= last_database_logged) {
-                dbf->log_device(dev);
-            }
+    databaselog_logging = true;
 
-            return false;
-        });
+    // Only devices which have changed enough since they were last logged are written
+    std::vector<std::shared_ptr<kis_tracked_device_base>> changed;
 
-    // Remember the time BEFORE we spend time looking at all the devices
-    uint64_t log_time = Globalreg::globalreg->last_tv_sec;
+    {
+        kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker databaselog_write_devices");
 
-    databaselog_logging = true;
+        for (const auto& i : *immutable_tracked_vec) {
+            if (i == nullptr)
+                continue;
 
-    // Explicitly use the non-ro worker, because we're phasing out the RO version because of too much contention
-    do_device_work(worker);
+            auto dev = std::static_pointer_cast<kis_tracked_device_base>(i);
 
-    databaselog_logging = false;
+            if (dbf->device_needs_log(dev, force))
+                changed.push_back(dev);
+        }
+    }
+
+    // Snapshot in batches, releasing the devicelist between batches so packet 
+    // processing isn't held for the whole pass; the snapshots are serialized and 
+    // written after the lock is released
+    const size_t batch_sz = 1024;
+    std::vector<kis_database_logfile::device_record> records;
+    records.reserve(batch_sz);
+
+    for (size_t b = 0; b < changed.size(); b += batch_sz) {
+        auto e = std::min(changed.size(), b + batch_sz);
 
-    // Then update the log; we might catch a few high-change devices twice, but this is
-    // safer by far
-    last_database_logged = log_time;
+        {
+            kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker databaselog_write_devices");
+
+            for (size_t i = b; i < e; i++) {
+                records.emplace_back();
+
+                if (!dbf->prepare_device_record(changed[i], records.back()))
+                    records.pop_back();
+            }
+        }
+
+        for (auto r = records.begin(); r != records.end(); ) {
+            if (dbf->serialize_device_record(*r))
+                ++r;
+            else
+                r = records.erase(r);
+        }
+
+        if (dbf->log_device_records(records) < 0)
+            break;
+
+        records.clear();
+    }
+
+    databaselog_logging = false;
 }
 
 void device_tracker::load_stored_username(std::shared_ptr<kis_tracked_device_base> in_dev) {
@@ -1788,34 +2341,30 @@ void device_tracker::load_stored_username(std::shared_ptr<kis_tracked_device_bas
     // Lock the device itself
     // auto devlocker = devicelist_range_scope_locker(shared_from_this(), in_dev);
 
-    std::string sql;
     std::string keystring = in_dev->get_key().as_string();
 
     int r;
-    sqlite3_stmt *stmt = NULL;
-    const char *pz = NULL;
 
-    sql = 
-        "SELECT name FROM device_names WHERE key = ? ";
+    // Run for every new device, so the statement comes from the cache
+    std::shared_ptr<sqlite3_stmt> stmt;
 
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &stmt, &pz);
-
-    if (r != SQLITE_OK) {
+    try {
+        stmt = ds_stmts.prepare("SELECT name FROM device_names WHERE key = ?");
+    } catch (const std::runtime_error& e) {
         _MSG("device_tracker unable to prepare database query for stored devicename in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+                ds_dbfile + ":" + std::string(e.what()), MSGFLAG_ERROR);
         return;
     }
 
-    sqlite3_reset(stmt);
-    sqlite3_bind_text(stmt, 1, keystring.c_str(), keystring.length(), 0);
+    sqlite3_bind_text(stmt.get(), 1, keystring.c_str(), keystring.length(), 0);
 
     while (1) {
-        r = sqlite3_step(stmt);
+        r = sqlite3_step(stmt.get());
 
         if (r == SQLITE_ROW) {
             const unsigned char *rowstr;
 
-            rowstr = (const unsigned char *) sqlite3_column_text(stmt, 0);
+            rowstr = (const unsigned char *) sqlite3_column_text(stmt.get(), 0);
 
             in_dev->set_username(std::string((const char *) rowstr));
 
@@ -1827,8 +2376,6 @@ void device_tracker::load_stored_username(std::shared_ptr<kis_tracked_device_bas
             break;
         }
     }
-
-    sqlite3_finalize(stmt);
 }
 
 void device_tracker::load_stored_tags(std::shared_ptr<kis_tracked_device_base> in_dev) {
@@ -1842,36 +2389,32 @@ void device_tracker::load_stored_tags(std::shared_ptr<kis_tracked_device_base> i
     // Lock the device itself
     // auto devlocker = devicelist_range_scope_locker(shared_from_this(), in_dev);
 
-    std::string sql;
     std::string keystring = in_dev->get_key().as_string();
 
     int r;
-    sqlite3_stmt *stmt = NULL;
-    const char *pz = NULL;
 
-    sql = 
-        "SELECT tag, content FROM device_tags WHERE key = ?";
+    // Run for every new device, so the statement comes from the cache
+    std::shared_ptr<sqlite3_stmt> stmt;
 
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &stmt, &pz);
-
-    if (r != SQLITE_OK) {
+    try {
+        stmt = ds_stmts.prepare("SELECT tag, content FROM device_tags WHERE key = ?");
+    } catch (const std::runtime_error& e) {
         _MSG("device_tracker unable to prepare database query for stored devicetag in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+                ds_dbfile + ":" + std::string(e.what()), MSGFLAG_ERROR);
         return;
     }
 
-    sqlite3_reset(stmt);
-    sqlite3_bind_text(stmt, 1, keystring.c_str(), keystring.length(), 0);
+    sqlite3_bind_text(stmt.get(), 1, keystring.c_str(), keystring.length(), 0);
 
     while (1) {
-        r = sqlite3_step(stmt);
+        r = sqlite3_step(stmt.get());
 
         if (r == SQLITE_ROW) {
             const unsigned char *tagstr;
             const unsigned char *contentstr;
 
-            tagstr = (const unsigned char *) sqlite3_column_text(stmt, 0);
-            contentstr = (const unsigned char *) sqlite3_column_text(stmt, 1);
+            tagstr = (const unsigned char *) sqlite3_column_text(stmt.get(), 0);
+            contentstr = (const unsigned char *) sqlite3_column_text(stmt.get(), 1);
 
             auto tagc = std::make_shared<tracker_element_string>();
             tagc->set(std::string((const char *) contentstr));
@@ -1885,8 +2428,320 @@ void device_tracker::load_stored_tags(std::shared_ptr<kis_tracked_device_base> i
             break;
         }
     }
+}
+
+void device_tracker::evict_cold_devices(time_t ts_now) {
+    std::vector<std::shared_ptr<kis_tracked_device_base>> evict;
+
+    for (const auto& d : cold_wheel->expire(ts_now)) {
+        // Already removed from tracking
+        if (device_index.find(d->get_key()) != d)
+            continue;
+
+        if (ts_now - d->get_last_time() <= cold_device_age) {
+            cold_wheel->schedule(d, d->get_last_time() + cold_device_age + 1);
+            continue;
+        }
+
+        evict.push_back(d);
+    }
+
+    if (evict.size() == 0)
+        return;
+
+    kis_lock_guard<kis_mutex> lk(ds_mutex);
+
+    if (!database_valid())
+        return;
+
+    // Store the whole pass as one batch; if it can't be stored, every device in it stays
+    // resident and is tried again on a later pass
+    try {
+        kissqlite3::batch_insert batch(db, ds_stmts, "device_cold_storage", {"key", "record"});
+
+        for (const auto& d : evict) {
+            std::stringstream ss;
+            json_adapter::pack(ss, d, nullptr);
+
+            batch.add({d->get_key().as_string(), ss.str()});
+        }
+
+        batch.commit();
+    } catch (const std::runtime_error& e) {
+        _MSG_ERROR("device_tracker unable to store cold devices in {}: {}", ds_dbfile, e.what());
+
+        for (const auto& d : evict)
+            cold_wheel->schedule(d, ts_now + cold_device_age);
+
+        return;
+    }
+
+    for (const auto& d : evict) {
+        cold_devices[d->get_key()] = cold_device_stub{
+            d->get_macaddr(), d->get_phyid(), d->get_first_time(), d->get_last_time(),
+            d->get_packets(), d->get_tx_packets(), d->get_rx_packets(), d->get_llc_packets(),
+            d->get_error_packets(), d->get_data_packets(), d->get_crypt_packets(),
+            d->get_filter_packets(), d->get_datasize()
+        };
+
+        device_index.erase(d);
+
+        remove_view_device(d);
+
+        (immutable_tracked_vec->begin() + d->get_kis_internal_id())->reset();
+    }
+
+    update_full_refresh();
+}
+
+void device_tracker::apply_device_stub(std::shared_ptr<kis_tracked_device_base> in_dev,
+        const cold_device_stub& stub) {
+    in_dev->set_first_time(stub.first_time);
+    in_dev->set_packets(stub.packets);
+    in_dev->set_tx_packets(stub.tx_packets);
+    in_dev->set_rx_packets(stub.rx_packets);
+    in_dev->set_llc_packets(stub.llc_packets);
+    in_dev->set_error_packets(stub.error_packets);
+    in_dev->set_data_packets(stub.data_packets);
+    in_dev->set_crypt_packets(stub.crypt_packets);
+    in_dev->set_filter_packets(stub.filter_packets);
+    in_dev->set_datasize(stub.datasize);
+}
+
+// Only the stub is restored; the stored record is a generic tree of the serialized 
+// device, which can't be turned back into the phy sub-records, so the phy rebuilds 
+// them from the packets it sees from now on.
+void device_tracker::restore_cold_device(std::shared_ptr<kis_tracked_device_base> in_dev) {
+    auto stub_k = cold_devices.find(in_dev->get_key());
+
+    if (stub_k == cold_devices.end())
+        return;
+
+    apply_device_stub(in_dev, stub_k->second);
+
+    cold_devices.erase(stub_k);
+
+    kis_lock_guard<kis_mutex> lk(ds_mutex);
+
+    if (!database_valid())
+        return;
+
+    std::string keystring = in_dev->get_key().as_string();
+
+    std::shared_ptr<sqlite3_stmt> stmt;
+
+    try {
+        stmt = ds_stmts.prepare("DELETE FROM device_cold_storage WHERE key = ?");
+    } catch (const std::runtime_error& e) {
+        _MSG_ERROR("device_tracker unable to prepare database delete for cold device in {}: {}",
+                ds_dbfile, e.what());
+        return;
+    }
+
+    sqlite3_bind_text(stmt.get(), 1, keystring.c_str(), keystring.length(), 0);
+    sqlite3_step(stmt.get());
+}
+
+namespace {
+    // Stored records are re-served as a generic tree with the original field names
+    std::shared_ptr<tracker_element> json_to_tracker_element(const nlohmann::json& json) {
+        switch (json.type()) {
+            case nlohmann::json::value_t::object: {
+                auto m = std::make_shared<tracker_element_string_map>();
+                for (const auto& i : json.items())
+                    m->insert(i.key(), json_to_tracker_element(i.value()));
+                return m;
+            }
+            case nlohmann::json::value_t::array: {
+                auto v = std::make_shared<tracker_element_vector>();
+                for (const auto& i : json)
+                    v->push_back(json_to_tracker_element(i));
+                return v;
+            }
+            case nlohmann::json::value_t::string:
+                return std::make_shared<tracker_element_string>(0, json.get<std::string>());
+            case nlohmann::json::value_t::boolean:
+                return std::make_shared<tracker_element_uint8>(0, json.get<bool>());
+            case nlohmann::json::value_t::number_unsigned:
+                return std::make_shared<tracker_element_uint64>(0, json.get<uint64_t>());
+            case nlohmann::json::value_t::number_integer:
+                return std::make_shared<tracker_element_int64>(0, json.get<int64_t>());
+            case nlohmann::json::value_t::number_float:
+                return std::make_shared<tracker_element_double>(0, json.get<double>());
+            default:
+                return std::make_shared<tracker_element_string_map>();
+        }
+    }
+}
+
+std::shared_ptr<tracker_element> device_tracker::fetch_cold_device(const device_key& in_key) {
+    std::string keystring = in_key.as_string();
+    std::string record;
+
+    if (cold_devices.find(in_key) == cold_devices.end()) {
+        if (!device_snap.fetch_record(in_key, record))
+            return nullptr;
+    } else {
+        kis_lock_guard<kis_mutex> lk(ds_mutex);
+
+        if (!database_valid())
+            return nullptr;
+
+        std::shared_ptr<sqlite3_stmt> stmt;
+
+        try {
+            stmt = ds_stmts.prepare("SELECT record FROM device_cold_storage WHERE key = ?");
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("device_tracker unable to prepare database query for cold device in {}: {}",
+                    ds_dbfile, e.what());
+            return nullptr;
+        }
+
+        sqlite3_bind_text(stmt.get(), 1, keystring.c_str(), keystring.length(), 0);
+
+        if (sqlite3_step(stmt.get()) == SQLITE_ROW)
+            record = std::string((const char *) sqlite3_column_text(stmt.get(), 0));
+    }
+
+    if (record.length() == 0)
+        return nullptr;
+
+    try {
+        return json_to_tracker_element(nlohmann::json::parse(record));
+    } catch (const std::exception& e) {
+        _MSG_ERROR("device_tracker unable to parse stored cold device {}: {}", keystring, e.what());
+    }
+
+    return nullptr;
+}
+
+void device_tracker::restore_snapshot_device(std::shared_ptr<kis_tracked_device_base> in_dev) {
+    device_snapshot_entry e;
 
-    sqlite3_finalize(stmt);
+    if (!device_snap.take(in_dev->get_key(), e))
+        return;
+
+    apply_device_stub(in_dev, cold_device_stub{
+            in_dev->get_macaddr(), in_dev->get_phyid(), (time_t) e.first_time, (time_t) e.last_time,
+            e.packets, e.tx_packets, e.rx_packets, e.llc_packets, e.error_packets,
+            e.data_packets, e.crypt_packets, e.filter_packets, e.datasize
+        });
+}
+
+void device_tracker::snapshot_write_devices() {
+    if (snapshot_file.length() == 0)
+        return;
+
+    std::lock_guard<std::mutex> lk(snapshot_write_mutex);
+
+    write_device_snapshot();
+}
+
+void device_tracker::write_device_snapshot() {
+    auto entry_of = [](const device_key& key, time_t first_time, time_t last_time,
+            uint64_t packets, uint64_t tx_packets, uint64_t rx_packets, uint64_t llc_packets,
+            uint64_t error_packets, uint64_t data_packets, uint64_t crypt_packets,
+            uint64_t filter_packets, uint64_t datasize) {
+        device_snapshot_entry e;
+        memset(&e, 0, sizeof(device_snapshot_entry));
+
+        e.spkey = key.get_spkey();
+        e.dkey = key.get_dkey();
+        e.first_time = first_time;
+        e.last_time = last_time;
+        e.packets = packets;
+        e.tx_packets = tx_packets;
+        e.rx_packets = rx_packets;
+        e.llc_packets = llc_packets;
+        e.error_packets = error_packets;
+        e.data_packets = data_packets;
+        e.crypt_packets = crypt_packets;
+        e.filter_packets = filter_packets;
+        e.datasize = datasize;
+        e.flags = DEVICE_SNAPSHOT_FLAG_LIVE;
+
+        return e;
+    };
+
+    device_snapshot_writer writer;
+
+    if (!writer.open(snapshot_file))
+        return;
+
+    std::vector<std::shared_ptr<kis_tracked_device_base>> devices;
+    std::vector<device_snapshot_entry> cold;
+
+    {
+        kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker write_device_snapshot");
+
+        devices.reserve(immutable_tracked_vec->size());
+
+        for (const auto& i : *immutable_tracked_vec) {
+            if (i != nullptr)
+                devices.push_back(std::static_pointer_cast<kis_tracked_device_base>(i));
+        }
+
+        // Cold devices keep their counts, their full records are only in the tracker
+        // database, which is cleared at startup
+        for (const auto& c : cold_devices)
+            cold.push_back(entry_of(c.first, c.second.first_time, c.second.last_time,
+                        c.second.packets, c.second.tx_packets, c.second.rx_packets,
+                        c.second.llc_packets, c.second.error_packets, c.second.data_packets,
+                        c.second.crypt_packets, c.second.filter_packets, c.second.datasize));
+    }
+
+    // Serialize in batches, releasing the devicelist between batches so packet 
+    // processing isn't held for the whole snapshot, and write each batch after the
+    // lock is released
+    const size_t batch_sz = 1024;
+    std::vector<std::pair<device_snapshot_entry, std::string>> batch;
+    batch.reserve(batch_sz);
+
+    for (size_t b = 0; b < devices.size(); b += batch_sz) {
+        auto end = std::min(devices.size(), b + batch_sz);
+
+        {
+            kis_lock_guard<kis_mutex> lk(get_devicelist_mutex(), "device_tracker write_device_snapshot");
+
+            for (size_t i = b; i < end; i++) {
+                const auto& d = devices[i];
+
+                std::stringstream ss;
+                json_adapter::pack(ss, d, nullptr);
+
+                batch.emplace_back(entry_of(d->get_key(), d->get_first_time(), d->get_last_time(),
+                            d->get_packets(), d->get_tx_packets(), d->get_rx_packets(),
+                            d->get_llc_packets(), d->get_error_packets(), d->get_data_packets(),
+                            d->get_crypt_packets(), d->get_filter_packets(), d->get_datasize()),
+                        ss.str());
+            }
+        }
+
+        for (const auto& r : batch) {
+            if (!writer.add(r.first, r.second))
+                return;
+        }
+
+        batch.clear();
+    }
+
+    for (const auto& c : cold) {
+        if (!writer.add(c, ""))
+            return;
+    }
+
+    // Devices from the last snapshot which haven't been seen again are kept until they
+    // would have timed out
+    time_t min_last = 0;
+
+    if (device_idle_expiration > 0)
+        min_last = Globalreg::globalreg->last_tv_sec - device_idle_expiration;
+
+    auto live = writer.size();
+
+    if (device_snap.replace(writer, min_last))
+        _MSG_DEBUG("Saved a snapshot of {} devices ({} not seen since the last start) to {}",
+                device_snap.size(), device_snap.size() - live, snapshot_file);
 }
 
 void device_tracker::set_device_user_name(std::shared_ptr<kis_tracked_device_base> in_dev,
@@ -1902,39 +2757,25 @@ void device_tracker::set_device_user_name(std::shared_ptr<kis_tracked_device_bas
         return;
     }
 
-    std::string sql;
-
-    int r;
-    sqlite3_stmt *stmt = NULL;
-    const char *pz = NULL;
-
     std::string keystring = in_dev->get_key().as_string();
 
-    sql = 
-        "INSERT INTO device_names "
-        "(key, name) "
-        "VALUES (?, ?)";
+    // Only lock the database while we're inserting
+    kis_lock_guard<kis_mutex> dlk(ds_mutex);
 
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &stmt, &pz);
+    std::shared_ptr<sqlite3_stmt> stmt;
 
-    if (r != SQLITE_OK) {
+    try {
+        stmt = ds_stmts.prepare("INSERT INTO device_names (key, name) VALUES (?, ?)");
+    } catch (const std::runtime_error& e) {
         _MSG("device_tracker unable to prepare database insert for device name in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+                ds_dbfile + ":" + std::string(e.what()), MSGFLAG_ERROR);
         return;
     }
- 
-    sqlite3_reset(stmt);
 
-    sqlite3_bind_text(stmt, 1, keystring.c_str(), keystring.length(), 0);
-    sqlite3_bind_text(stmt, 2, in_username.c_str(), in_username.length(), 0);
+    sqlite3_bind_text(stmt.get(), 1, keystring.c_str(), keystring.length(), 0);
+    sqlite3_bind_text(stmt.get(), 2, in_username.c_str(), in_username.length(), 0);
 
-    // Only lock the database while we're inserting
-    {
-        kis_lock_guard<kis_mutex> lk(ds_mutex);
-        sqlite3_step(stmt);
-    }
-
-    sqlite3_finalize(stmt);
+    sqlite3_step(stmt.get());
 
     return;
 }
@@ -1962,40 +2803,26 @@ void device_tracker::set_device_tag(std::shared_ptr<kis_tracked_device_base> in_
         return;
     }
 
-    std::string sql;
-
-    int r;
-    sqlite3_stmt *stmt = NULL;
-    const char *pz = NULL;
-
     std::string keystring = in_dev->get_key().as_string();
 
-    sql = 
-        "INSERT INTO device_tags "
-        "(key, tag, content) "
-        "VALUES (?, ?, ?)";
+    // Only lock the database while we're inserting
+    kis_lock_guard<kis_mutex> dlk(ds_mutex);
 
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &stmt, &pz);
+    std::shared_ptr<sqlite3_stmt> stmt;
 
-    if (r != SQLITE_OK) {
+    try {
+        stmt = ds_stmts.prepare("INSERT INTO device_tags (key, tag, content) VALUES (?, ?, ?)");
+    } catch (const std::runtime_error& e) {
         _MSG("device_tracker unable to prepare database insert for device tags in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+                ds_dbfile + ":" + std::string(e.what()), MSGFLAG_ERROR);
         return;
     }
- 
-    sqlite3_reset(stmt);
-
-    sqlite3_bind_text(stmt, 1, keystring.c_str(), keystring.length(), 0);
-    sqlite3_bind_text(stmt, 2, in_tag.c_str(), in_tag.length(), 0);
-    sqlite3_bind_text(stmt, 3, in_content.c_str(), in_content.length(), 0);
 
-    // Only lock the database while we're inserting
-    {
-        kis_lock_guard<kis_mutex> lk(ds_mutex);
-        sqlite3_step(stmt);
-    }
+    sqlite3_bind_text(stmt.get(), 1, keystring.c_str(), keystring.length(), 0);
+    sqlite3_bind_text(stmt.get(), 2, in_tag.c_str(), in_tag.length(), 0);
+    sqlite3_bind_text(stmt.get(), 3, in_content.c_str(), in_content.length(), 0);
 
-    sqlite3_finalize(stmt);
+    sqlite3_step(stmt.get());
 
     return;
 }
@@ -2031,13 +2858,26 @@ void device_tracker::handle_new_datasource_event(std::shared_ptr<eventbus_event>
     }
 }
 
-void device_tracker::handle_new_device_event(std::shared_ptr<eventbus_event> evt) {
-    auto device_k = evt->get_event_content()->find(device_tracker::event_new_device());
+void device_tracker::handle_new_device_batch_event(std::shared_ptr<eventbus_event> evt) {
+    auto batch_k = evt->get_event_content()->find(device_tracker::event_new_device_batch());
 
-    if (device_k == evt->get_event_content()->end())
+    if (batch_k == evt->get_event_content()->end())
         return;
 
-    new_view_device(std::static_pointer_cast<kis_tracked_device_base>(device_k->second));
+    auto devices = std::static_pointer_cast<tracker_element_vector>(batch_k->second);
+
+    // Take the device list once for the whole batch
+    kis_lock_guard<kis_mutex> lk(devicelist_mutex, "device_tracker handle_new_device_batch_event");
+
+    for (const auto& d : *devices) {
+        auto device = std::static_pointer_cast<kis_tracked_device_base>(d);
+
+        // Removed from tracking while it waited in the batch
+        if (device_index.find(device->get_key()) != device)
+            continue;
+
+        new_view_device(device);
+    }
 }
 
 std::shared_ptr<tracker_element_string> device_tracker::get_cached_devicetype(const std::string& type) {
@@ -22,6 +22,8 @@
 #include "config.h"
 
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <stdio.h>
 #include <time.h>
 #include <list>
@@ -52,6 +54,8 @@
 #include "timetracker.h"
 #include "kis_net_beast_httpd.h"
 #include "devicetracker_view.h"
+#include "devicetracker_index.h"
+#include "devicetracker_snapshot.h"
 #include "devicetracker_view_workers.h"
 #include "kis_database.h"
 #include "eventbus.h"
@@ -63,6 +67,7 @@
 
 class kis_phy_handler;
 class kis_packet;
+class packet_filter_expression;
 
 class device_tracker : public lifetime_global, public kis_database, 
     public deferred_startup, public std::enable_shared_from_this<device_tracker> {
@@ -102,6 +107,11 @@ public:
         return "NEW_DEVICE";
     }
 
+    // New devices found while processing packets, published together in a vector
+    static std::string event_new_device_batch() {
+        return "NEW_DEVICE_BATCH";
+    }
+
     std::string fetch_phy_name(int in_phy);
 
 	int fetch_num_devices();
@@ -125,6 +135,20 @@ public:
     // lock to be safely used
     std::shared_ptr<kis_tracked_device_base> fetch_device_nr(device_key in_key);
 
+    // Look up a device by internal id, without lock - must be called under the device list lock
+    std::shared_ptr<kis_tracked_device_base> fetch_device_by_internal_id_nr(uint64_t in_id);
+
+    // Maximum age, in seconds, of the device snapshots read-only view workers match against;
+    // 0 disables snapshots
+    unsigned int get_snapshot_max_age() const {
+        return snapshot_max_age;
+    }
+
+    // Number of threads device work with a thread-safe worker is split across
+    unsigned int get_device_work_threads() const {
+        return device_work_threads;
+    }
+
     // Do work on all devices, this applies to the 'all' device view
     std::shared_ptr<tracker_element_vector> do_device_work(device_tracker_view_worker& worker);
     std::shared_ptr<tracker_element_vector> do_readonly_device_work(device_tracker_view_worker& worker);
@@ -204,7 +228,7 @@ public:
     void lock_devicelist();
     void unlock_devicelist();
 
-    std::shared_ptr<kis_tracked_rrd<> > get_packets_rrd() {
+    std::shared_ptr<kis_tracked_atomic_rrd<> > get_packets_rrd() {
         return packets_rrd;
     }
 
@@ -212,7 +236,13 @@ public:
     virtual int database_upgrade_db() override;
 
     // Store all devices to the database
-    virtual void databaselog_write_devices();
+    // Log changed devices to the kismetdb log; forcing logs every device with any
+    // change, regardless of the log thresholds
+    virtual void databaselog_write_devices(bool force = false);
+
+    // Write the snapshot of the tracked devices restored on the next start, if one is
+    // configured; waits for a snapshot already being written
+    void snapshot_write_devices();
 
     // View API
     virtual bool add_view(std::shared_ptr<device_tracker_view> in_view);
@@ -221,6 +251,7 @@ public:
     virtual void new_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
     virtual void update_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
     virtual void remove_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
+    virtual void touch_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
 
     // Get phy views
     std::shared_ptr<device_tracker_view> get_phy_view(int in_phy);
@@ -251,7 +282,11 @@ protected:
 
     unsigned long new_datasource_evt_id, new_device_evt_id;
 
-    int packetchain_common_id, packetchain_tracking_done_id;
+    int packetchain_common_id, packetchain_tracking_done_id, packetchain_filter_id;
+
+    // Expression filter checked before the phys classify packets, so filtered packets
+    // skip device tracking
+    std::shared_ptr<packet_filter_expression> packet_expression_filter;
 
     std::shared_ptr<device_tracker_view> all_view;
 
@@ -283,18 +318,61 @@ protected:
 	std::map<int, std::atomic<int>> phy_filterpackets;
 
     // Total packet history
-    std::shared_ptr<kis_tracked_rrd<> > packets_rrd;
+    std::shared_ptr<kis_tracked_atomic_rrd<> > packets_rrd;
 
     // Timeout of idle devices
     int device_idle_expiration;
     int device_idle_timer;
 
+    // Devices by when they're next due for an idle check
+    std::unique_ptr<device_timeout_wheel> idle_wheel;
+
     // Minimum number of packets a device may have to be eligible for
     // being timed out
     unsigned int device_idle_min_packets;
 
     // Maximum number of devices
     unsigned int max_num_devices;
+
+    // Devices idle past the cold age are serialized to the tracker database and only a
+    // stub of their identity and counters is kept in RAM; a device seen again is rebuilt
+    // from its stub, and the full stored record is available by key over REST as a
+    // generic tree.  The phy sub-records (and location and history) are not rebuilt;
+    // a restored device only regains them as the phy sees it again, so cold storage is 
+    // off unless tracker_cold_device_age is set.
+    struct cold_device_stub {
+        mac_addr macaddr;
+        int phyid;
+        time_t first_time;
+        time_t last_time;
+        uint64_t packets;
+        uint64_t tx_packets;
+        uint64_t rx_packets;
+        uint64_t llc_packets;
+        uint64_t error_packets;
+        uint64_t data_packets;
+        uint64_t crypt_packets;
+        uint64_t filter_packets;
+        uint64_t datasize;
+    };
+
+    int cold_device_age;
+    int cold_device_timer;
+    std::unique_ptr<device_timeout_wheel> cold_wheel;
+    robin_hood::unordered_flat_map<device_key, cold_device_stub> cold_devices;
+
+    // Snapshot of the devices from the last run, and where to write the next one; the
+    // write mutex serializes the periodic and shutdown snapshots
+    std::string snapshot_file;
+    int snapshot_timer;
+    device_snapshot device_snap;
+    std::mutex snapshot_write_mutex;
+
+    // Maximum age of the device snapshots used by read-only view workers, in seconds
+    unsigned int snapshot_max_age;
+
+    // Threads used for device work with thread-safe workers
+    unsigned int device_work_threads;
     int max_devices_timer;
 
     // Timer event for storing devices
@@ -306,6 +384,90 @@ protected:
     bool track_history_cloud;
     bool track_persource_history;
 
+    // Seenby updates are folded per device and source in a buffer of each packet thread,
+    // and applied in one batch under the device list lock every seenby_coalesce_ms; a
+    // device heard by many sources otherwise updates every seenby record, its frequency
+    // map, and its signal rrd for each packet.  Deltas are split by second, so the times,
+    // counts, and per-second signal peaks applied are the same as updating per packet.
+    struct seenby_delta {
+        // Held so the device, and with it the key, can't be reused while pending
+        std::shared_ptr<kis_tracked_device_base> device;
+        std::shared_ptr<kis_tracked_seenby_data> seenby;
+
+        time_t ts;
+        uint64_t packets;
+        bool update_rrd;
+
+        std::vector<std::pair<int, uint64_t>> frequencies;
+        kis_signal_summary signal;
+    };
+
+    struct seenby_key_hash {
+        size_t operator()(const std::pair<const void *, const void *>& k) const {
+            return std::hash<const void *>()(k.first) ^ (std::hash<const void *>()(k.second) << 1);
+        }
+    };
+
+    struct seenby_buffer {
+        kis_mutex mutex;
+        std::unordered_map<std::pair<const void *, const void *>, seenby_delta, seenby_key_hash> deltas;
+        std::chrono::steady_clock::time_point last_flush;
+    };
+
+    unsigned int seenby_coalesce_ms;
+    int seenby_flush_timer;
+
+    // Each packet thread has its own buffer, after one shared by every other thread;
+    // the pool of packet threads is fixed, so the buffers are never released
+    kis_mutex seenby_buffers_mutex;
+    std::vector<std::unique_ptr<seenby_buffer>> seenby_buffers;
+
+    // Fold a packet into the buffer of this thread; the device list must be locked
+    void coalesce_seenby(std::shared_ptr<kis_tracked_device_base> device,
+            kis_datasource *source, time_t tv_sec, int frequency,
+            packinfo_sig_combo *siginfo, bool update_rrd);
+
+    // The device list and the buffer must be locked
+    void apply_seenby_delta(seenby_delta& delta);
+    void flush_seenby_buffer(seenby_buffer& buffer);
+
+    // Apply the buffers of every thread, including threads which have gone quiet
+    void flush_seenby_buffers();
+
+    // Devices created by packets are collected in a batch of each packet thread when
+    // tracking of the packet is done, and published as one NEW_DEVICE_BATCH event every
+    // new_device_batch_ms; a burst of new devices, such as randomized MACs, otherwise
+    // publishes and dispatches an event per device.  Single NEW_DEVICE events are only
+    // built while something is listening for them.
+    struct new_device_batch {
+        kis_mutex mutex;
+        std::shared_ptr<tracker_element_vector> devices;
+        std::chrono::steady_clock::time_point last_flush;
+    };
+
+    unsigned int new_device_batch_ms;
+    int new_device_batch_timer;
+    int new_device_chan;
+
+    // Held per packet thread, after one shared by every other thread, as the seenby
+    // buffers are
+    kis_mutex new_device_batches_mutex;
+    std::vector<std::unique_ptr<new_device_batch>> new_device_batches;
+
+    // Buffer slot of the calling thread
+    static size_t thread_buffer_slot() {
+        return static_cast<size_t>(packet_chain::get_packet_thread_index() + 1);
+    }
+
+    // Add a new device to the batch of this thread
+    void batch_new_device(std::shared_ptr<kis_tracked_device_base> device);
+
+    // The batch must be locked
+    void flush_new_device_batch(new_device_batch& batch);
+
+    // Publish the batches of every thread, including threads which have gone quiet
+    void flush_new_device_batches();
+
 	// Common device component
 	int devcomp_ref_common;
 
@@ -336,13 +498,12 @@ protected:
     // Signal threshold
     int device_location_signal_threshold;
 
-	// Tracked devices
-    device_map_t tracked_map;
-
-    // MAC address lookups are incredibly expensive from the webui if we don't
-    // track by map; in theory multiple objects in different PHYs could have the
-    // same MAC so it's not a simple 1:1 map
-    std::multimap<mac_addr, std::shared_ptr<kis_tracked_device_base> > tracked_mac_multimap;
+	// Tracked devices, indexed by key and by MAC address; MAC address lookups are 
+    // incredibly expensive from the webui if we don't track by map, and in theory 
+    // multiple objects in different PHYs could have the same MAC so it's not a simple
+    // 1:1 map.  The index is sharded with its own locks, so lookups don't need the 
+    // device list mutex.
+    device_tracker_index device_index;
 
     // Immutable vector, one entry per device; may never be sorted.  Devices
     // which are removed are set to 'null'.  Each position corresponds to the
@@ -362,6 +523,9 @@ protected:
     // Multikey endpoint
     std::shared_ptr<tracker_element> multikey_endp_handler(shared_con con, bool as_object);
 
+    // Optional last_time cutoff of the multimac and multikey requests, or 0
+    time_t multi_endp_last_time(shared_con con);
+
 	// Registered PHY types
 	int next_phy_id;
     robin_hood::unordered_node_map<int, kis_phy_handler *> phy_handler_map;
@@ -375,7 +539,6 @@ protected:
 
     // If we log devices to the kismet database...
     int databaselog_timer;
-    time_t last_database_logged;
     std::atomic<bool> databaselog_logging;
 
     // Do we constrain memory by not tracking RRD data?
@@ -384,8 +547,8 @@ protected:
     // Handle new datasources and create endpoints for them
     void handle_new_datasource_event(std::shared_ptr<eventbus_event> evt);
 
-    // Handle a new device & add it to views, trigger alerts, etc
-    void handle_new_device_event(std::shared_ptr<eventbus_event> evt);
+    // Handle a batch of new devices & add them to views, trigger alerts, etc
+    void handle_new_device_batch_event(std::shared_ptr<eventbus_event> evt);
 
     // Insert a device directly into the records
     void add_device(std::shared_ptr<kis_tracked_device_base> device);
@@ -396,6 +559,27 @@ protected:
     // Load stored tags
     void load_stored_tags(std::shared_ptr<kis_tracked_device_base> in_dev);
 
+    // Move idle devices from the wheel into cold storage, must be called under the
+    // devicelist lock
+    void evict_cold_devices(time_t ts_now);
+
+    // Restore the first time and counters of a device from its cold stub, if it has one,
+    // and drop the stored record; the phy records of the stored device are lost
+    void restore_cold_device(std::shared_ptr<kis_tracked_device_base> in_dev);
+
+    // Restore the first time and counters of a device from the snapshot of the last run,
+    // if it was in it
+    void restore_snapshot_device(std::shared_ptr<kis_tracked_device_base> in_dev);
+
+    void apply_device_stub(std::shared_ptr<kis_tracked_device_base> in_dev,
+            const cold_device_stub& in_stub);
+
+    void write_device_snapshot();
+
+    // Stored record of a cold device, or of a device from the snapshot which hasn't been
+    // seen again, as a generic element tree, or nullptr
+    std::shared_ptr<tracker_element> fetch_cold_device(const device_key& in_key);
+
     // Cached device type map
     std::map<std::string, std::shared_ptr<tracker_element_string>> device_type_cache;
     kis_mutex device_type_cache_mutex;
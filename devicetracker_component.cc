@@ -290,6 +290,129 @@ void kis_tracked_signal_data::append_signal(const packinfo_sig_combo& in, bool u
     }
 }
 
+void kis_tracked_signal_data::append_signal(const kis_signal_summary& in, bool update_rrd, time_t rrd_ts) {
+    if (!in.any)
+        return;
+
+    // A record keeps the first signal type it sees
+    if (in.sig_type != 0 && (sig_type == 0 || sig_type == in.sig_type)) {
+        if (sig_type == 0) {
+            signal_type->set(in.sig_type == 1 ? "dbm" : "rssi");
+            sig_type = in.sig_type;
+        }
+
+        if (in.last_signal != 0) {
+            last_signal->set(in.last_signal);
+
+            if (min_signal->get() == 0 || min_signal->get() > in.min_signal)
+                min_signal->set(in.min_signal);
+
+            if (max_signal->get() == 0 || max_signal->get() < in.max_signal) {
+                max_signal->set(in.max_signal);
+
+                if (in.peak_loc)
+                    get_peak_loc()->set(in.peak_lat, in.peak_lon, in.peak_alt, in.peak_fix);
+            }
+
+            // The signal rrd keeps the peak of each second, which is the peak of the run
+            if (update_rrd)
+                get_signal_min_rrd()->add_sample(in.max_signal, rrd_ts);
+        }
+
+        if (in.last_noise != 0) {
+            last_noise->set(in.last_noise);
+
+            if (min_noise->get() == 0 || min_noise->get() > in.min_noise)
+                min_noise->set(in.min_noise);
+
+            if (max_noise->get() == 0 || max_noise->get() < in.max_noise)
+                max_noise->set(in.max_noise);
+        }
+    }
+
+    (*carrierset) |= in.carrierset;
+    (*encodingset) |= in.encodingset;
+
+    if ((*maxseenrate) < in.maxseenrate)
+        maxseenrate->set(in.maxseenrate);
+}
+
+void kis_signal_summary::reset() {
+    any = false;
+    sig_type = 0;
+    last_signal = min_signal = max_signal = 0;
+    last_noise = min_noise = max_noise = 0;
+    peak_loc = false;
+    peak_lat = peak_lon = peak_alt = 0;
+    peak_fix = 0;
+    carrierset = encodingset = 0;
+    maxseenrate = 0;
+}
+
+bool kis_signal_summary::add(const packinfo_sig_combo& in) {
+    if (in.lay1 == nullptr)
+        return true;
+
+    int type = 0;
+    int32_t signal = 0, noise = 0;
+
+    if (in.lay1->signal_type == kis_l1_signal_type_dbm) {
+        type = 1;
+        signal = in.lay1->signal_dbm;
+        noise = in.lay1->noise_dbm;
+    } else if (in.lay1->signal_type == kis_l1_signal_type_rssi) {
+        type = 2;
+        signal = in.lay1->signal_rssi;
+        noise = in.lay1->noise_rssi;
+    }
+
+    if (type != 0 && sig_type != 0 && type != sig_type)
+        return false;
+
+    any = true;
+
+    if (type != 0) {
+        sig_type = type;
+
+        if (signal != 0) {
+            last_signal = signal;
+
+            if (min_signal == 0 || min_signal > signal)
+                min_signal = signal;
+
+            if (max_signal == 0 || max_signal < signal) {
+                max_signal = signal;
+
+                if (in.gps != nullptr) {
+                    peak_loc = true;
+                    peak_lat = in.gps->lat;
+                    peak_lon = in.gps->lon;
+                    peak_alt = in.gps->alt;
+                    peak_fix = in.gps->fix;
+                }
+            }
+        }
+
+        if (noise != 0) {
+            last_noise = noise;
+
+            if (min_noise == 0 || min_noise > noise)
+                min_noise = noise;
+
+            if (max_noise == 0 || max_noise < noise)
+                max_noise = noise;
+        }
+    }
+
+    carrierset |= (uint64_t) in.lay1->carrier;
+    encodingset |= (uint64_t) in.lay1->encoding;
+
+    if (maxseenrate < in.lay1->datarate)
+        maxseenrate = in.lay1->datarate;
+
+    return true;
+}
+
 void kis_tracked_signal_data::register_fields() {
     tracker_component::register_fields();
 
@@ -354,14 +477,14 @@ kis_tracked_seenby_data::kis_tracked_seenby_data(const kis_tracked_seenby_data *
     }
 
 
-void kis_tracked_seenby_data::inc_frequency_count(int frequency) {
+void kis_tracked_seenby_data::inc_frequency_count(int frequency, uint64_t count) {
     auto m = get_tracker_freq_khz_map();
     auto i = m->find(frequency);
 
     if (i == m->end()) {
-        m->insert(frequency, 1);
+        m->insert(frequency, count);
     } else {
-        i->second += 1;
+        i->second += count;
     }
 }
 
@@ -459,35 +582,35 @@ void kis_tracked_device_base::register_fields() {
     register_field("kismet.device.base.crypt", "printable encryption type", &crypt_string);
     register_field("kismet.device.base.basic_crypt_set", 
             "bitset of basic encryption", &basic_crypt_set);
-    register_field("kismet.device.base.first_time", "first time seen time_t", &first_time);
-    register_field("kismet.device.base.last_time", "last time seen time_t", &last_time);
-    register_field("kismet.device.base.mod_time", 
+    register_inline_field("kismet.device.base.first_time", "first time seen time_t", &first_time);
+    register_inline_field("kismet.device.base.last_time", "last time seen time_t", &last_time);
+    register_inline_field("kismet.device.base.mod_time", 
             "timestamp of last seen time (local clock)", &mod_time);
-    register_field("kismet.device.base.packets.total", "total packets seen of all types", &packets);
-    register_field("kismet.device.base.packets.rx_total", "total transmitted packets seen of all types", &rx_packets);
-    register_field("kismet.device.base.packets.tx_total", "total received packets (addressed to this device) seen of all types", &tx_packets);
-    register_field("kismet.device.base.packets.llc", "observed protocol control packets", &llc_packets);
-    register_field("kismet.device.base.packets.error", "corrupt/error packets", &error_packets);
-    register_field("kismet.device.base.packets.data", "data packets", &data_packets);
-    register_field("kismet.device.base.packets.crypt", "data packets using encryption", &crypt_packets);
-    register_field("kismet.device.base.packets.filtered", "packets dropped by filter", &filter_packets);
-    register_field("kismet.device.base.datasize", "transmitted data in bytes", &datasize);
+    register_inline_field("kismet.device.base.packets.total", "total packets seen of all types", &packets);
+    register_inline_field("kismet.device.base.packets.rx_total", "total transmitted packets seen of all types", &rx_packets);
+    register_inline_field("kismet.device.base.packets.tx_total", "total received packets (addressed to this device) seen of all types", &tx_packets);
+    register_inline_field("kismet.device.base.packets.llc", "observed protocol control packets", &llc_packets);
+    register_inline_field("kismet.device.base.packets.error", "corrupt/error packets", &error_packets);
+    register_inline_field("kismet.device.base.packets.data", "data packets", &data_packets);
+    register_inline_field("kismet.device.base.packets.crypt", "data packets using encryption", &crypt_packets);
+    register_inline_field("kismet.device.base.packets.filtered", "packets dropped by filter", &filter_packets);
+    register_inline_field("kismet.device.base.datasize", "transmitted data in bytes", &datasize);
     
     packets_rrd_id =
-        register_dynamic_field<kis_tracked_rrd<>>("kismet.device.base.packets.rrd", "packet rate rrd");
+        register_dynamic_field<kis_tracked_compact_rrd<>>("kismet.device.base.packets.rrd", "packet rate rrd");
     data_rrd_id =
-        register_dynamic_field<kis_tracked_rrd<>>("kismet.device.base.datasize.rrd", "packet size rrd");
+        register_dynamic_field<kis_tracked_compact_rrd<>>("kismet.device.base.datasize.rrd", "packet size rrd");
     packets_rx_rrd_id =
-        register_dynamic_field<kis_tracked_rrd<>>("kismet.device.base.rx_packets.rrd", "received packet rate rrd");
+        register_dynamic_field<kis_tracked_compact_rrd<>>("kismet.device.base.rx_packets.rrd", "received packet rate rrd");
     packets_tx_rrd_id =
-        register_dynamic_field<kis_tracked_rrd<>>("kismet.device.base.tx_packets.rrd", "transmitted packet rate rrd");
+        register_dynamic_field<kis_tracked_compact_rrd<>>("kismet.device.base.tx_packets.rrd", "transmitted packet rate rrd");
 
     signal_data_id =
         register_dynamic_field("kismet.device.base.signal", "signal data", &signal_data);
 
     register_field("kismet.device.base.freq_khz_map", "packets seen per frequency (khz)", &freq_khz_map);
     register_field("kismet.device.base.channel", "channel (phy specific)", &channel);
-    register_field("kismet.device.base.frequency", "frequency", &frequency);
+    register_inline_field("kismet.device.base.frequency", "frequency", &frequency);
     register_field("kismet.device.base.manuf", "manufacturer name", &manuf);
     register_field("kismet.device.base.num_alerts", "number of alerts on this device", &alert);
     
@@ -83,6 +83,43 @@ protected:
     std::shared_ptr<tracker_element_uint64> ip_gateway;
 };
 
+// Signal of a run of packets within the same second, folded together so it can be
+// appended to a signal record at once; the record ends up as if each packet had been
+// appended in turn.  A run only holds one signal type, as a record only keeps the first
+// type it sees.
+class kis_signal_summary {
+public:
+    kis_signal_summary() {
+        reset();
+    }
+
+    void reset();
+
+    // Fold in a packet; false if the packet carries the other signal type, in which case
+    // the summary has to be appended and reset first
+    bool add(const packinfo_sig_combo& in);
+
+    bool empty() const {
+        return !any;
+    }
+
+    bool any;
+
+    // 0 for no signal yet, 1 for dbm, 2 for rssi, matching kis_tracked_signal_data
+    int sig_type;
+
+    int32_t last_signal, min_signal, max_signal;
+    int32_t last_noise, min_noise, max_noise;
+
+    // Location of the strongest signal
+    bool peak_loc;
+    double peak_lat, peak_lon, peak_alt;
+    int peak_fix;
+
+    uint64_t carrierset, encodingset;
+    double maxseenrate;
+};
+
 // Component-tracker based signal data
 // TODO operator overloading once rssi/dbm fixed upstream
 class kis_tracked_signal_data : public tracker_component {
@@ -100,6 +137,7 @@ public:
 
     void append_signal(const kis_layer1_packinfo& lay1, bool update_rrd, time_t rrd_ts);
     void append_signal(const packinfo_sig_combo& in, bool update_rrd, time_t rrd_ts);
+    void append_signal(const kis_signal_summary& in, bool update_rrd, time_t rrd_ts);
 
     __ProxyGet(signal_type, std::string, std::string, signal_type);
 
@@ -169,7 +207,7 @@ public:
     __ProxyFullyDynamicTrackable(freq_khz_map, tracker_element_double_map_double, freq_khz_map_id);
     __ProxyFullyDynamicTrackable(signal_data, kis_tracked_signal_data, signal_data_id);
 
-    void inc_frequency_count(int frequency);
+    void inc_frequency_count(int frequency, uint64_t count = 1);
 
 protected:
     virtual void register_fields() override;
@@ -305,6 +343,11 @@ protected:
 #define KIS_DEVICE_BASICCRYPT_WEAKCRYPT	(1 << 4)
 #define KIS_DEVICE_BASICCRYPT_DECRYPTED	(1 << 5)
 
+class kis_tracked_device_base;
+
+// Devices in a view ordered by last time seen
+using device_view_time_index_t = std::multimap<time_t, std::shared_ptr<kis_tracked_device_base>>;
+
 // Base of all device tracking under the new trackerentry system
 class kis_tracked_device_base : public tracker_component {
 public:
@@ -340,21 +383,9 @@ public:
             __ImportField(basic_type_set,p );
             __ImportField(crypt_string, p);
             __ImportField(basic_crypt_set, p);
-            __ImportField(first_time, p);
-            __ImportField(last_time, p);
-            __ImportField(mod_time, p);
 
-            __ImportField(packets, p);
-            __ImportField(rx_packets, p);
-            __ImportField(tx_packets, p);
-            __ImportField(llc_packets, p);
-            __ImportField(error_packets, p);
-            __ImportField(data_packets, p);
-            __ImportField(crypt_packets, p);
-            __ImportField(filter_packets, p);
 
 
-            __ImportField(datasize, p);
 
             __ImportId(packets_rrd_id, p);
             __ImportId(data_rrd_id, p);
@@ -363,7 +394,6 @@ public:
             __ImportId(packets_rx_rrd_id, p);
 
             __ImportField(channel, p);
-            __ImportField(frequency, p);
 
             __ImportId(signal_data_id, p);
 
@@ -406,6 +436,8 @@ public:
         return r;
     }
 
+    __InlineFields
+
     __Proxy(key, device_key, device_key, device_key, key);
     __ProxyL(macaddr, mac_addr, mac_addr, mac_addr, macaddr,
             [this](mac_addr m) -> bool {
@@ -502,52 +534,59 @@ public:
     __Proxy(basic_crypt_set, uint64_t, uint64_t, uint64_t, basic_crypt_set);
     void add_basic_crypt(uint64_t in) { (*basic_crypt_set) |= in; }
 
-    __Proxy(first_time, uint64_t, time_t, time_t, first_time);
-    __Proxy(last_time, uint64_t, time_t, time_t, last_time);
+    __ProxyInline(first_time, uint64_t, time_t, time_t, first_time);
+    __ProxyInline(last_time, uint64_t, time_t, time_t, last_time);
 
     // Simple management of last modified time
-    __Proxy(mod_time, uint64_t, time_t, time_t, mod_time);
+    __ProxyInline(mod_time, uint64_t, time_t, time_t, mod_time);
     void update_modtime() {
         set_mod_time(Globalreg::globalreg->last_tv_sec);
+        mod_generation++;
+    }
+
+    // Number of updates to the device, for consumers which care how much a device
+    // has changed instead of when
+    uint64_t get_mod_generation() const {
+        return mod_generation;
     }
 
-    __Proxy(packets, uint64_t, uint64_t, uint64_t, packets);
-    __ProxyIncDec(packets, uint64_t, uint64_t, packets);
+    __ProxyInline(packets, uint64_t, uint64_t, uint64_t, packets);
+    __ProxyInlineIncDec(packets, uint64_t, uint64_t, packets);
 
-    __Proxy(tx_packets, uint64_t, uint64_t, uint64_t, tx_packets);
-    __ProxyIncDec(tx_packets, uint64_t, uint64_t, tx_packets);
+    __ProxyInline(tx_packets, uint64_t, uint64_t, uint64_t, tx_packets);
+    __ProxyInlineIncDec(tx_packets, uint64_t, uint64_t, tx_packets);
 
-    __Proxy(rx_packets, uint64_t, uint64_t, uint64_t, rx_packets);
-    __ProxyIncDec(rx_packets, uint64_t, uint64_t, rx_packets);
+    __ProxyInline(rx_packets, uint64_t, uint64_t, uint64_t, rx_packets);
+    __ProxyInlineIncDec(rx_packets, uint64_t, uint64_t, rx_packets);
 
-    __Proxy(llc_packets, uint64_t, uint64_t, uint64_t, llc_packets);
-    __ProxyIncDec(llc_packets, uint64_t, uint64_t, llc_packets);
+    __ProxyInline(llc_packets, uint64_t, uint64_t, uint64_t, llc_packets);
+    __ProxyInlineIncDec(llc_packets, uint64_t, uint64_t, llc_packets);
 
-    __Proxy(error_packets, uint64_t, uint64_t, uint64_t, error_packets);
-    __ProxyIncDec(error_packets, uint64_t, uint64_t, error_packets);
+    __ProxyInline(error_packets, uint64_t, uint64_t, uint64_t, error_packets);
+    __ProxyInlineIncDec(error_packets, uint64_t, uint64_t, error_packets);
 
-    __Proxy(data_packets, uint64_t, uint64_t, uint64_t, data_packets);
-    __ProxyIncDec(data_packets, uint64_t, uint64_t, data_packets);
+    __ProxyInline(data_packets, uint64_t, uint64_t, uint64_t, data_packets);
+    __ProxyInlineIncDec(data_packets, uint64_t, uint64_t, data_packets);
 
-    __Proxy(crypt_packets, uint64_t, uint64_t, uint64_t, crypt_packets);
-    __ProxyIncDec(crypt_packets, uint64_t, uint64_t, crypt_packets);
+    __ProxyInline(crypt_packets, uint64_t, uint64_t, uint64_t, crypt_packets);
+    __ProxyInlineIncDec(crypt_packets, uint64_t, uint64_t, crypt_packets);
 
-    __Proxy(filter_packets, uint64_t, uint64_t, uint64_t, filter_packets);
-    __ProxyIncDec(filter_packets, uint64_t, uint64_t, filter_packets);
+    __ProxyInline(filter_packets, uint64_t, uint64_t, uint64_t, filter_packets);
+    __ProxyInlineIncDec(filter_packets, uint64_t, uint64_t, filter_packets);
 
-    __Proxy(datasize, uint64_t, uint64_t, uint64_t, datasize);
-    __ProxyIncDec(datasize, uint64_t, uint64_t, datasize);
+    __ProxyInline(datasize, uint64_t, uint64_t, uint64_t, datasize);
+    __ProxyInlineIncDec(datasize, uint64_t, uint64_t, datasize);
 
-    typedef kis_tracked_rrd<> rrdt;
-    __ProxyFullyDynamicTrackable(packets_rrd, kis_tracked_rrd<>, packets_rrd_id);
-    __ProxyFullyDynamicTrackable(tx_packets_rrd, kis_tracked_rrd<>, packets_tx_rrd_id);
-    __ProxyFullyDynamicTrackable(rx_packets_rrd, kis_tracked_rrd<>, packets_rx_rrd_id);
+    typedef kis_tracked_compact_rrd<> rrdt;
+    __ProxyFullyDynamicTrackable(packets_rrd, rrdt, packets_rrd_id);
+    __ProxyFullyDynamicTrackable(tx_packets_rrd, rrdt, packets_tx_rrd_id);
+    __ProxyFullyDynamicTrackable(rx_packets_rrd, rrdt, packets_rx_rrd_id);
 
     __ProxyFullyDynamicTrackable(location, kis_tracked_location, location_id);
     __ProxyFullyDynamicTrackable(data_rrd, rrdt, data_rrd_id);
 
     __Proxy(channel, std::string, std::string, std::string, channel);
-    __Proxy(frequency, double, double, double, frequency);
+    __ProxyInline(frequency, double, double, double, frequency);
 
     __ProxyTrackable(manuf, tracker_element_string, manuf);
     __Proxy(manuf, std::string, std::string, std::string, manuf);
@@ -587,10 +626,105 @@ public:
     // Optional location cloud
     __ProxyFullyDynamicTrackable(location_cloud, kis_location_rrd, location_cloud_id);
 
+    // Non-exported phy state which phy-specific views filter on, such as the 802.11 device
+    // type set; phys set it before asking for a view update
+    void set_phy_view_inputs(uint64_t in_inputs) {
+        view_inputs_phy = in_inputs;
+    }
+
+    // Record the current view inputs; returns true if they changed since the last time
+    // views evaluated this device, so unchanged devices can skip the view callbacks
+    bool update_view_inputs() {
+        view_inputs cur{get_basic_type_set(), phy_id, seenby_map->size(), type_string.get(), 
+            view_inputs_phy};
+
+        if (cur == last_view_inputs)
+            return false;
+
+        last_view_inputs = cur;
+        return true;
+    }
+
+    // Position of the device in a view it belongs to: the index in the view device
+    // vector and the entry in the view time index.  Views keep these on the device
+    // instead of in a map of their own, so membership checks and removals don't cost
+    // a lookup or a search per view.  Only views touch these, under the device list lock.
+    struct view_slot {
+        unsigned int view_num;
+        size_t list_pos;
+        device_view_time_index_t::iterator time_pos;
+    };
+
+    view_slot *find_view_slot(unsigned int in_view_num) {
+        if ((view_bits & view_bit(in_view_num)) == 0)
+            return nullptr;
+
+        for (auto& s : view_slots) {
+            if (s.view_num == in_view_num)
+                return &s;
+        }
+
+        return nullptr;
+    }
+
+    view_slot& add_view_slot(unsigned int in_view_num, size_t in_list_pos,
+            device_view_time_index_t::iterator in_time_pos) {
+        view_bits |= view_bit(in_view_num);
+        view_slots.push_back(view_slot{in_view_num, in_list_pos, in_time_pos});
+        return view_slots.back();
+    }
+
+    void remove_view_slot(unsigned int in_view_num) {
+        bool shared_bit = false;
+
+        for (size_t s = 0; s < view_slots.size(); ) {
+            if (view_slots[s].view_num == in_view_num) {
+                view_slots[s] = view_slots.back();
+                view_slots.pop_back();
+                continue;
+            }
+
+            if (view_bit(view_slots[s].view_num) == view_bit(in_view_num))
+                shared_bit = true;
+
+            s++;
+        }
+
+        if (!shared_bit)
+            view_bits &= ~view_bit(in_view_num);
+    }
+
 protected:
     virtual void register_fields() override;
     virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override;
 
+    // Views past the 64th share bits; the bit only rules a view out, the slots decide
+    static uint64_t view_bit(unsigned int in_view_num) {
+        return 1ULL << (in_view_num % 64);
+    }
+
+    uint64_t view_bits = 0;
+    std::vector<view_slot> view_slots;
+
+    // Everything the tracker and phy views decide membership on; type strings are
+    // shared from the tracker cache, so the pointer changes whenever the type does
+    struct view_inputs {
+        uint64_t basic_type_set;
+        int phy_id;
+        size_t num_seenby;
+        const void *type_string;
+        uint64_t phy_inputs;
+
+        bool operator==(const view_inputs& v) const {
+            return basic_type_set == v.basic_type_set && phy_id == v.phy_id &&
+                num_seenby == v.num_seenby && type_string == v.type_string &&
+                phy_inputs == v.phy_inputs;
+        }
+    };
+
+    view_inputs last_view_inputs{0, -1, 0, nullptr, 0};
+    uint64_t view_inputs_phy = 0;
+
     // Unique, meaningless, incremental ID.  Practically, this is the order
     // in which kismet saw devices; it has no purpose other than a sorting
     // key which will always preserve order - time, etc, will not.  Used for breaking
@@ -633,22 +767,23 @@ protected:
     // Bitset of basic phy-neutral crypt options
     std::shared_ptr<tracker_element_uint64> basic_crypt_set;
 
-    // First and last seen
-    std::shared_ptr<tracker_element_uint64> first_time;
-    std::shared_ptr<tracker_element_uint64> last_time;
-    std::shared_ptr<tracker_element_uint64> mod_time;
+    // First and last seen, stored inline
+    uint64_t first_time = 0;
+    uint64_t last_time = 0;
+    uint64_t mod_time = 0;
+    uint64_t mod_generation = 0;
 
-    // Packet counts
-    std::shared_ptr<tracker_element_uint64> packets;
-    std::shared_ptr<tracker_element_uint64> rx_packets;
-    std::shared_ptr<tracker_element_uint64> tx_packets;
-    std::shared_ptr<tracker_element_uint64> llc_packets;
-    std::shared_ptr<tracker_element_uint64> error_packets;
-    std::shared_ptr<tracker_element_uint64> data_packets;
-    std::shared_ptr<tracker_element_uint64> crypt_packets;
-    std::shared_ptr<tracker_element_uint64> filter_packets;
+    // Packet counts, stored inline
+    uint64_t packets = 0;
+    uint64_t rx_packets = 0;
+    uint64_t tx_packets = 0;
+    uint64_t llc_packets = 0;
+    uint64_t error_packets = 0;
+    uint64_t data_packets = 0;
+    uint64_t crypt_packets = 0;
+    uint64_t filter_packets = 0;
 
-    std::shared_ptr<tracker_element_uint64> datasize;
+    uint64_t datasize = 0;
 
     // Packets and data RRDs
     uint16_t packets_rrd_id;
@@ -659,7 +794,7 @@ protected:
 
 	// Channel and frequency as per PHY type
     std::shared_ptr<tracker_element_string> channel;
-    std::shared_ptr<tracker_element_double> frequency;
+    double frequency = 0;
 
     // Signal data
     uint16_t signal_data_id;
@@ -47,6 +47,26 @@
 #include "json_adapter.h"
 #include "base64.h"
 
+// Optional 'last_time' cutoff of the multi-device requests; only devices seen after
+// it are returned.  Negative values are relative to the current time, the same as 
+// the last-time endpoint.  Returns 0 when there is no cutoff.
+time_t device_tracker::multi_endp_last_time(shared_con con) {
+    const auto& lt = con->json()["last_time"];
+
+    if (lt.is_null())
+        return 0;
+
+    if (!lt.is_number())
+        throw std::runtime_error("Expected a timestamp for 'last_time'");
+
+    auto tv = lt.get<int64_t>();
+
+    if (tv < 0)
+        return (time_t) Globalreg::globalreg->last_tv_sec + tv;
+
+    return (time_t) tv;
+}
+
 std::shared_ptr<tracker_element> device_tracker::multimac_endp_handler(shared_con con) {
     auto ret_devices = std::make_shared<tracker_element_vector>();
     auto macs = std::vector<mac_addr>{};
@@ -54,6 +74,10 @@ std::shared_ptr<tracker_element> device_tracker::multimac_endp_handler(shared_co
     if (con->json()["devices"].is_null())
         throw std::runtime_error("Missing 'devices' key in command dictionary");
 
+    auto last_time = multi_endp_last_time(con);
+
+    macs.reserve(con->json()["devices"].size());
+
     for (const auto& m : con->json()["devices"]) {
         mac_addr ma{m.get<std::string>()};
 
@@ -64,19 +88,17 @@ std::shared_ptr<tracker_element> device_tracker::multimac_endp_handler(shared_co
         macs.push_back(ma);
     }
 
-    // Duplicate the mac index so that we're 'immune' to things changing it under us; because we
-    // may have quite a number of devices in our query list, this is safest.
-    kis_unique_lock<kis_mutex> devlist_locker(get_devicelist_mutex(), std::defer_lock, "multimac_endp_handler");
-    devlist_locker.lock();
-    auto immutable_copy = 
-        std::multimap<mac_addr, std::shared_ptr<kis_tracked_device_base>>{tracked_mac_multimap};
-    devlist_locker.unlock();
-
-    // Pull all the devices out of the list
-    for (auto m : macs) {
-        const auto& mi = immutable_copy.equal_range(m);
-        for (auto msi = mi.first; msi != mi.second; ++msi)
-            ret_devices->push_back(msi->second);
+    // Pull all the devices out of the index in one batch, which takes each shard lock 
+    // once instead of once per MAC; large results are serialized in parallel segments
+    auto devices = device_index.find_macs(macs);
+
+    ret_devices->reserve(devices.size());
+
+    for (const auto& d : devices) {
+        if (last_time != 0 && d->get_last_time() <= last_time)
+            continue;
+
+        ret_devices->push_back(d);
     }
 
     return ret_devices;
@@ -122,6 +144,10 @@ std::shared_ptr<tracker_element> device_tracker::multikey_endp_handler(shared_co
     if (con->json()["devices"].is_null())
         throw std::runtime_error("Missing 'devices' key in command dictionary");
 
+    auto last_time = multi_endp_last_time(con);
+
+    keys.reserve(con->json()["devices"].size());
+
     for (const auto& k : con->json()["devices"]) {
         device_key ka{k.get<std::string>()};
 
@@ -132,14 +158,24 @@ std::shared_ptr<tracker_element> device_tracker::multikey_endp_handler(shared_co
         keys.push_back(ka);
     }
 
-    for (auto k : keys) { 
-        auto d = fetch_device(k);
+    // Resolve every key in one batch, which takes each shard lock once; the devices
+    // come back in the order of the keys
+    auto devices = device_index.find_keys(keys);
+
+    if (!as_object)
+        ret_devices_vec->reserve(devices.size());
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        const auto& d = devices[i];
 
         if (d == nullptr)
             continue;
 
+        if (last_time != 0 && d->get_last_time() <= last_time)
+            continue;
+
         if (as_object)
-            ret_devices_obj->insert(k, d);
+            ret_devices_obj->insert(keys[i], d);
         else
             ret_devices_vec->push_back(d);
     }
@@ -0,0 +1,454 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "devicetracker_index.h"
+
+bool device_tracker_index::insert(const device_t& device) {
+    auto& ks = shard_for(device->get_key());
+
+    {
+        kis_lock_guard<kis_mutex> lk(ks.mutex, "device_tracker_index insert");
+
+        if (!ks.devices.emplace(device->get_key(), device).second)
+            return false;
+    }
+
+    n_devices++;
+
+    auto& ms = shard_for(device->get_macaddr());
+    kis_lock_guard<kis_mutex> lk(ms.mutex, "device_tracker_index insert mac");
+
+    auto mi = ms.keys.find(device->get_macaddr().longmac);
+
+    if (mi == ms.keys.end())
+        ms.keys.emplace(device->get_macaddr().longmac, mac_keys{device->get_key(), {}});
+    else
+        mi->second.more.push_back(device->get_key());
+
+    return true;
+}
+
+void device_tracker_index::erase(const device_t& device) {
+    auto& ks = shard_for(device->get_key());
+
+    {
+        kis_lock_guard<kis_mutex> lk(ks.mutex, "device_tracker_index erase");
+
+        auto ki = ks.devices.find(device->get_key());
+
+        if (ki == ks.devices.end())
+            return;
+
+        ks.devices.erase(ki);
+    }
+
+    n_devices--;
+
+    spatial.erase(device->get_key());
+
+    auto& ms = shard_for(device->get_macaddr());
+    kis_lock_guard<kis_mutex> lk(ms.mutex, "device_tracker_index erase mac");
+
+    auto mi = ms.keys.find(device->get_macaddr().longmac);
+
+    if (mi == ms.keys.end())
+        return;
+
+    auto& mk = mi->second;
+
+    if (mk.first == device->get_key()) {
+        if (mk.more.size() == 0) {
+            ms.keys.erase(mi);
+            return;
+        }
+
+        mk.first = mk.more.back();
+        mk.more.pop_back();
+        return;
+    }
+
+    for (auto ki = mk.more.begin(); ki != mk.more.end(); ++ki) {
+        if (*ki == device->get_key()) {
+            mk.more.erase(ki);
+            break;
+        }
+    }
+}
+
+void device_tracker_index::clear() {
+    for (auto& ks : key_shards) {
+        kis_lock_guard<kis_mutex> lk(ks.mutex, "device_tracker_index clear");
+        ks.devices.clear();
+    }
+
+    for (auto& ms : mac_shards) {
+        kis_lock_guard<kis_mutex> lk(ms.mutex, "device_tracker_index clear mac");
+        ms.keys.clear();
+    }
+
+    spatial.clear();
+
+    n_devices = 0;
+}
+
+std::vector<device_tracker_index::device_t> device_tracker_index::find_bbox(double min_lat, 
+        double min_lon, double max_lat, double max_lon) {
+    std::vector<device_t> ret;
+
+    for (const auto& k : spatial.find_bbox(min_lat, min_lon, max_lat, max_lon)) {
+        auto d = find(k);
+
+        if (d != nullptr)
+            ret.push_back(d);
+    }
+
+    return ret;
+}
+
+int32_t device_spatial_index::cell_lat(double lat) {
+    return (int32_t) floor(std::min(std::max(lat, -90.0), 90.0) / cell_deg);
+}
+
+int32_t device_spatial_index::cell_lon(double lon) {
+    return (int32_t) floor(std::min(std::max(lon, -180.0), 180.0) / cell_deg);
+}
+
+void device_spatial_index::update(const device_key& key, double lat, double lon) {
+    auto cell = cell_id(cell_lat(lat), cell_lon(lon));
+
+    kis_lock_guard<kis_mutex> lk(mutex, "device_spatial_index update");
+
+    auto di = device_cells.find(key);
+
+    if (di != device_cells.end()) {
+        if (di->second == cell)
+            return;
+
+        auto ci = cells.find(di->second);
+
+        if (ci != cells.end()) {
+            auto& keys = ci->second;
+            auto ki = std::find(keys.begin(), keys.end(), key);
+
+            if (ki != keys.end()) {
+                *ki = keys.back();
+                keys.pop_back();
+            }
+
+            if (keys.size() == 0)
+                cells.erase(ci);
+        }
+
+        di->second = cell;
+    } else {
+        device_cells.emplace(key, cell);
+    }
+
+    cells[cell].push_back(key);
+}
+
+void device_spatial_index::erase(const device_key& key) {
+    kis_lock_guard<kis_mutex> lk(mutex, "device_spatial_index erase");
+
+    auto di = device_cells.find(key);
+
+    if (di == device_cells.end())
+        return;
+
+    auto ci = cells.find(di->second);
+
+    if (ci != cells.end()) {
+        auto& keys = ci->second;
+        auto ki = std::find(keys.begin(), keys.end(), key);
+
+        if (ki != keys.end()) {
+            *ki = keys.back();
+            keys.pop_back();
+        }
+
+        if (keys.size() == 0)
+            cells.erase(ci);
+    }
+
+    device_cells.erase(di);
+}
+
+void device_spatial_index::clear() {
+    kis_lock_guard<kis_mutex> lk(mutex, "device_spatial_index clear");
+    cells.clear();
+    device_cells.clear();
+}
+
+std::vector<device_key> device_spatial_index::find_bbox(double min_lat, double min_lon,
+        double max_lat, double max_lon) {
+    std::vector<device_key> ret;
+
+    if (min_lat > max_lat)
+        std::swap(min_lat, max_lat);
+
+    int32_t lat_lo = cell_lat(min_lat), lat_hi = cell_lat(max_lat);
+    int32_t lon_lo = cell_lon(min_lon), lon_hi = cell_lon(max_lon);
+
+    // Across the antimeridian the longitude range wraps
+    bool wrap = min_lon > max_lon;
+
+    auto lon_in = [&](int32_t c) -> bool {
+        if (wrap)
+            return c >= lon_lo || c <= lon_hi;
+        return c >= lon_lo && c <= lon_hi;
+    };
+
+    uint64_t n_lat = (uint64_t) (lat_hi - lat_lo) + 1;
+    uint64_t n_lon = wrap ? 
+        (uint64_t) (cell_lon(180) - lon_lo) + (lon_hi - cell_lon(-180)) + 2 :
+        (uint64_t) (lon_hi - lon_lo) + 1;
+
+    kis_lock_guard<kis_mutex> lk(mutex, "device_spatial_index find_bbox");
+
+    if (n_lat * n_lon <= cells.size()) {
+        for (int32_t la = lat_lo; la <= lat_hi; la++) {
+            for (uint64_t lo = 0; lo < n_lon; lo++) {
+                int32_t c = lon_lo + lo;
+
+                if (wrap && c > cell_lon(180))
+                    c = cell_lon(-180) + (c - cell_lon(180) - 1);
+
+                auto ci = cells.find(cell_id(la, c));
+
+                if (ci != cells.end())
+                    ret.insert(ret.end(), ci->second.begin(), ci->second.end());
+            }
+        }
+    } else {
+        for (const auto& ci : cells) {
+            int32_t la = (int32_t) (uint32_t) (ci.first >> 32);
+            int32_t lo = (int32_t) (uint32_t) (ci.first & 0xFFFFFFFF);
+
+            if (la >= lat_lo && la <= lat_hi && lon_in(lo))
+                ret.insert(ret.end(), ci.second.begin(), ci.second.end());
+        }
+    }
+
+    return ret;
+}
+
+device_tracker_index::device_t device_tracker_index::find(const device_key& key) {
+    auto& ks = shard_for(key);
+    kis_lock_guard<kis_mutex> lk(ks.mutex, "device_tracker_index find");
+
+    auto ki = ks.devices.find(key);
+
+    if (ki == ks.devices.end())
+        return nullptr;
+
+    return ki->second;
+}
+
+std::vector<device_tracker_index::device_t> device_tracker_index::find_mac(const mac_addr& mac) {
+    std::vector<device_key> keys;
+
+    auto collect = [&keys](const mac_keys& mk) {
+        keys.push_back(mk.first);
+        keys.insert(keys.end(), mk.more.begin(), mk.more.end());
+    };
+
+    if (mac.maskbits < 64) {
+        // A MAC mask can match devices in any shard
+        auto mask = mac.maskbits == 0 ? 0 : ((uint64_t) -1) << (64 - mac.maskbits);
+
+        for (auto& ms : mac_shards) {
+            kis_lock_guard<kis_mutex> lk(ms.mutex, "device_tracker_index find_mac");
+
+            for (const auto& mi : ms.keys) {
+                if ((mi.first & mask) == (mac.longmac & mask))
+                    collect(mi.second);
+            }
+        }
+    } else {
+        auto& ms = shard_for(mac);
+        kis_lock_guard<kis_mutex> lk(ms.mutex, "device_tracker_index find_mac");
+
+        auto mi = ms.keys.find(mac.longmac);
+
+        if (mi != ms.keys.end())
+            collect(mi->second);
+    }
+
+    // Resolve the keys after the MAC shard is released, so only one shard lock is ever
+    // held at a time
+    std::vector<device_t> ret;
+    ret.reserve(keys.size());
+
+    for (const auto& k : keys) {
+        auto d = find(k);
+
+        if (d != nullptr)
+            ret.push_back(d);
+    }
+
+    return ret;
+}
+
+std::vector<device_tracker_index::device_t> device_tracker_index::find_keys(const std::vector<device_key>& keys) {
+    std::vector<device_t> ret(keys.size());
+
+    // Group the positions of the keys by shard, then visit each shard once
+    std::array<std::vector<size_t>, num_shards> by_shard;
+
+    for (size_t i = 0; i < keys.size(); i++)
+        by_shard[shard_of(std::hash<device_key>{}(keys[i]))].push_back(i);
+
+    for (size_t s = 0; s < num_shards; s++) {
+        if (by_shard[s].size() == 0)
+            continue;
+
+        auto& ks = key_shards[s];
+        kis_lock_guard<kis_mutex> lk(ks.mutex, "device_tracker_index find_keys");
+
+        for (auto i : by_shard[s]) {
+            auto ki = ks.devices.find(keys[i]);
+
+            if (ki != ks.devices.end())
+                ret[i] = ki->second;
+        }
+    }
+
+    return ret;
+}
+
+std::vector<device_tracker_index::device_t> device_tracker_index::find_macs(const std::vector<mac_addr>& macs) {
+    std::vector<device_key> keys;
+    std::array<std::vector<size_t>, num_shards> by_shard;
+
+    // Masks have to scan every shard, so they go through find_mac; their devices are
+    // resolved again below, which only costs a key lookup
+    for (size_t i = 0; i < macs.size(); i++) {
+        if (macs[i].maskbits < 64) {
+            for (const auto& d : find_mac(macs[i]))
+                keys.push_back(d->get_key());
+            continue;
+        }
+
+        by_shard[shard_of(macs[i].longmac)].push_back(i);
+    }
+
+    for (size_t s = 0; s < num_shards; s++) {
+        if (by_shard[s].size() == 0)
+            continue;
+
+        auto& ms = mac_shards[s];
+        kis_lock_guard<kis_mutex> lk(ms.mutex, "device_tracker_index find_macs");
+
+        for (auto i : by_shard[s]) {
+            auto mi = ms.keys.find(macs[i].longmac);
+
+            if (mi == ms.keys.end())
+                continue;
+
+            keys.push_back(mi->second.first);
+            keys.insert(keys.end(), mi->second.more.begin(), mi->second.more.end());
+        }
+    }
+
+    // Resolve the keys after the MAC shards are released, so only one shard lock is 
+    // ever held at a time
+    robin_hood::unordered_flat_set<device_key> seen;
+    std::vector<device_t> ret;
+    ret.reserve(keys.size());
+
+    for (const auto& d : find_keys(keys)) {
+        if (d == nullptr || !seen.insert(d->get_key()).second)
+            continue;
+
+        ret.push_back(d);
+    }
+
+    return ret;
+}
+
+void device_tracker_index::for_each(const std::function<void (const device_t&)>& fn) {
+    // Always lock the shards in the same order
+    for (auto& ks : key_shards)
+        ks.mutex.lock();
+
+    try {
+        for (auto& ks : key_shards)
+            for (const auto& d : ks.devices)
+                fn(d.second);
+    } catch (...) {
+        for (auto& ks : key_shards)
+            ks.mutex.unlock();
+        throw;
+    }
+
+    for (auto& ks : key_shards)
+        ks.mutex.unlock();
+}
+
+device_timeout_wheel::device_timeout_wheel(time_t granularity, time_t horizon, time_t now) :
+    granularity{granularity},
+    cursor{now / granularity} {
+
+    slots.resize((horizon / granularity) + 2);
+}
+
+void device_timeout_wheel::schedule(const device_t& device, time_t due) {
+    auto slot_time = (due + granularity - 1) / granularity;
+    auto n_slots = static_cast<time_t>(slots.size());
+
+    // Anything already due goes in the next slot; anything past the end of the wheel
+    // goes in the last slot, and is re-scheduled when it comes due
+    if (slot_time < cursor)
+        slot_time = cursor;
+    else if (slot_time >= cursor + n_slots)
+        slot_time = cursor + n_slots - 1;
+
+    slots[slot_time % n_slots].push_back(device);
+}
+
+std::vector<device_timeout_wheel::device_t> device_timeout_wheel::expire(time_t now) {
+    std::vector<device_t> ret;
+
+    auto now_slot = now / granularity;
+    auto n_slots = static_cast<time_t>(slots.size());
+
+    // If the clock jumped more than a full turn, every slot is due
+    if (now_slot - cursor >= n_slots)
+        cursor = now_slot - n_slots + 1;
+
+    for (; cursor <= now_slot; cursor++) {
+        auto& slot = slots[cursor % n_slots];
+
+        for (const auto& w : slot) {
+            auto d = w.lock();
+
+            if (d != nullptr)
+                ret.push_back(d);
+        }
+
+        slot.clear();
+    }
+
+    return ret;
+}
@@ -0,0 +1,210 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DEVICETRACKER_INDEX_H__
+#define __DEVICETRACKER_INDEX_H__
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "devicetracker_component.h"
+#include "kis_mutex.h"
+#include "macaddr.h"
+#include "robin_hood.h"
+#include "trackedelement.h"
+
+// Index of devices by the grid cell of their average location, so that devices in a
+// map viewport are found by visiting the cells under it instead of every device.
+//
+// Cells are fixed squares of cell_deg degrees.  Each device is filed in exactly one
+// cell, and only moves when its average location crosses into another cell, so the
+// per-packet location update is usually a single lookup.  A query visits whichever
+// is smaller, the cells under the box or the occupied cells, so a zoomed out view
+// over a dense area doesn't walk millions of empty cells.
+//
+// Cells are coarser than the query, so callers must check the exact location of the
+// candidates returned.  The index has its own lock.
+class device_spatial_index {
+public:
+    static constexpr double cell_deg = 0.01;
+
+    device_spatial_index() { }
+
+    // File a device under the cell containing lat, lon
+    void update(const device_key& key, double lat, double lon);
+
+    void erase(const device_key& key);
+
+    void clear();
+
+    // Keys of every device in a cell overlapping the box; boxes crossing the 
+    // antimeridian have min_lon > max_lon
+    std::vector<device_key> find_bbox(double min_lat, double min_lon, 
+            double max_lat, double max_lon);
+
+protected:
+    static int32_t cell_lat(double lat);
+    static int32_t cell_lon(double lon);
+
+    static uint64_t cell_id(int32_t clat, int32_t clon) {
+        return ((uint64_t) (uint32_t) clat << 32) | (uint32_t) clon;
+    }
+
+    kis_mutex mutex;
+
+    robin_hood::unordered_flat_map<uint64_t, std::vector<device_key>> cells;
+    robin_hood::unordered_flat_map<device_key, uint64_t> device_cells;
+};
+
+// Index of tracked devices by device key and by MAC address, split into shards 
+// which each have their own lock, so that looking up or adding unrelated devices
+// doesn't contend on a single lock.  Devices are sharded by key in the key index,
+// and by MAC in the MAC index.
+//
+// The index only protects itself; the device list mutex still protects the device
+// records.  Shard locks are only ever taken after the device list mutex, never while
+// waiting for it.
+class device_tracker_index {
+public:
+    using device_t = std::shared_ptr<kis_tracked_device_base>;
+
+    static constexpr size_t num_shards = 16;
+
+    device_tracker_index() :
+        n_devices{0} { }
+
+    // Add a device under its key and MAC; returns false if a device already exists
+    // with the same key
+    bool insert(const device_t& device);
+
+    // Remove a device from the key and MAC indexes
+    void erase(const device_t& device);
+
+    void clear();
+
+    device_t find(const device_key& key);
+
+    // Find all devices matching a MAC address or MAC mask; masked lookups have to
+    // scan every shard
+    std::vector<device_t> find_mac(const mac_addr& mac);
+
+    // Find a batch of devices by key, taking the lock of each shard once for all the
+    // keys in it.  The devices are returned in the order of the keys, with nullptr for
+    // keys which aren't tracked.
+    std::vector<device_t> find_keys(const std::vector<device_key>& keys);
+
+    // Find all devices matching a batch of MAC addresses or masks, taking the lock of
+    // each shard once for all the unmasked MACs in it; each device is returned once,
+    // in no particular order
+    std::vector<device_t> find_macs(const std::vector<mac_addr>& macs);
+
+    size_t size() const {
+        return n_devices;
+    }
+
+    // Call fn on every device, with every shard locked for the duration so that
+    // the index can't change during iteration
+    void for_each(const std::function<void (const device_t&)>& fn);
+
+    // Re-file a device in the spatial index from its average location
+    void update_location(const device_t& device, double lat, double lon) {
+        spatial.update(device->get_key(), lat, lon);
+    }
+
+    // Devices which may be inside a geographic bounding box
+    std::vector<device_t> find_bbox(double min_lat, double min_lon, 
+            double max_lat, double max_lon);
+
+protected:
+    struct key_shard {
+        kis_mutex mutex;
+        robin_hood::unordered_node_map<device_key, device_t> devices;
+    };
+
+    // Nearly every MAC belongs to a single device, so the first key is kept inline and
+    // only MACs shared by devices in several phys allocate
+    struct mac_keys {
+        device_key first;
+        std::vector<device_key> more;
+    };
+
+    struct mac_shard {
+        kis_mutex mutex;
+        robin_hood::unordered_flat_map<uint64_t, mac_keys> keys;
+    };
+
+    // MAC hashes don't mix the high bits, which select the shard
+    static size_t shard_of(uint64_t h) {
+        return ((h * 0x9E3779B97F4A7C15ULL) >> 60) % num_shards;
+    }
+
+    key_shard& shard_for(const device_key& key) {
+        return key_shards[shard_of(std::hash<device_key>{}(key))];
+    }
+
+    mac_shard& shard_for(const mac_addr& mac) {
+        return mac_shards[shard_of(mac.longmac)];
+    }
+
+    std::array<key_shard, num_shards> key_shards;
+    std::array<mac_shard, num_shards> mac_shards;
+
+    device_spatial_index spatial;
+
+    std::atomic<size_t> n_devices;
+};
+
+// Timing wheel of devices by the time they are next due for a timeout check, so that
+// expiring devices only visits the devices which are due instead of every device.
+//
+// Deadlines are never more than the horizon ahead, so a single wheel of horizon / 
+// granularity slots covers every deadline and no overflow levels are needed.  Devices
+// are not re-bucketed on every update; when a slot comes due the caller re-checks each
+// device and re-schedules it from its current activity, which costs nothing in the 
+// packet path.
+//
+// The wheel holds weak references, so devices removed by other means simply fall out.
+// Not thread safe; must be protected by the device list mutex.
+class device_timeout_wheel {
+public:
+    using device_t = std::shared_ptr<kis_tracked_device_base>;
+
+    device_timeout_wheel(time_t granularity, time_t horizon, time_t now);
+
+    // Schedule a device to be returned by expire() once due has passed
+    void schedule(const device_t& device, time_t due);
+
+    // Remove and return every device in the slots due by now
+    std::vector<device_t> expire(time_t now);
+
+protected:
+    time_t granularity;
+
+    std::vector<std::vector<std::weak_ptr<kis_tracked_device_base>>> slots;
+
+    // Slot time, in units of granularity, of the next slot to expire
+    time_t cursor;
+};
+
+#endif
+
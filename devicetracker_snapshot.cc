@@ -0,0 +1,331 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "devicetracker_snapshot.h"
+#include "messagebus.h"
+#include "util.h"
+
+namespace {
+    bool entry_before(const device_snapshot_entry& a, const device_snapshot_entry& b) {
+        if (a.spkey != b.spkey)
+            return a.spkey < b.spkey;
+        return a.dkey < b.dkey;
+    }
+
+    void put64(uint8_t *out, uint64_t v) {
+        memcpy(out, &v, sizeof(uint64_t));
+    }
+
+    uint64_t get64(const uint8_t *in) {
+        uint64_t v;
+        memcpy(&v, in, sizeof(uint64_t));
+        return v;
+    }
+}
+
+device_snapshot_writer::device_snapshot_writer() :
+    fp{nullptr},
+    offset{0} { }
+
+device_snapshot_writer::~device_snapshot_writer() {
+    abort();
+}
+
+bool device_snapshot_writer::open(const std::string& in_path) {
+    abort();
+
+    path = in_path;
+    tmp_path = in_path + ".tmp";
+
+    fp = fopen(tmp_path.c_str(), "wb");
+
+    if (fp == nullptr) {
+        _MSG_ERROR("Unable to open device snapshot '{}' for writing: {}", tmp_path,
+                kis_strerror_r(errno));
+        return false;
+    }
+
+    // The header is filled in once the index is written
+    uint8_t header[DEVICE_SNAPSHOT_HEADER_LEN] = {0};
+
+    if (fwrite(header, DEVICE_SNAPSHOT_HEADER_LEN, 1, fp) != 1) {
+        _MSG_ERROR("Unable to write device snapshot '{}': {}", tmp_path, kis_strerror_r(errno));
+        abort();
+        return false;
+    }
+
+    offset = DEVICE_SNAPSHOT_HEADER_LEN;
+    index.clear();
+
+    return true;
+}
+
+bool device_snapshot_writer::add(device_snapshot_entry in_entry, const std::string& in_record) {
+    if (fp == nullptr)
+        return false;
+
+    in_entry.record_offset = offset;
+    in_entry.record_len = in_record.length();
+
+    if (in_record.length() != 0 && fwrite(in_record.data(), in_record.length(), 1, fp) != 1) {
+        _MSG_ERROR("Unable to write device snapshot '{}': {}", tmp_path, kis_strerror_r(errno));
+        abort();
+        return false;
+    }
+
+    offset += in_record.length();
+    index.push_back(in_entry);
+
+    return true;
+}
+
+bool device_snapshot_writer::commit() {
+    if (fp == nullptr)
+        return false;
+
+    std::sort(index.begin(), index.end(), entry_before);
+
+    // Align the index so that the mapped entries can be read in place
+    uint8_t pad[8] = {0};
+    size_t padlen = (8 - (offset % 8)) % 8;
+
+    uint8_t header[DEVICE_SNAPSHOT_HEADER_LEN] = {0};
+    memcpy(header, DEVICE_SNAPSHOT_MAGIC, 8);
+    put64(header + 8, index.size());
+    put64(header + 16, offset + padlen);
+    put64(header + 24, time(0));
+
+    bool ok =
+        (padlen == 0 || fwrite(pad, padlen, 1, fp) == 1) &&
+        (index.size() == 0 ||
+         fwrite(index.data(), sizeof(device_snapshot_entry), index.size(), fp) == index.size()) &&
+        fseek(fp, 0, SEEK_SET) == 0 &&
+        fwrite(header, DEVICE_SNAPSHOT_HEADER_LEN, 1, fp) == 1 &&
+        fflush(fp) == 0 &&
+        fsync(fileno(fp)) == 0;
+
+    if (!ok) {
+        _MSG_ERROR("Unable to write device snapshot '{}': {}", tmp_path, kis_strerror_r(errno));
+        abort();
+        return false;
+    }
+
+    fclose(fp);
+    fp = nullptr;
+
+    if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        _MSG_ERROR("Unable to replace device snapshot '{}': {}", path, kis_strerror_r(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void device_snapshot_writer::abort() {
+    if (fp == nullptr)
+        return;
+
+    fclose(fp);
+    fp = nullptr;
+
+    unlink(tmp_path.c_str());
+}
+
+device_snapshot::device_snapshot() :
+    map_base{nullptr},
+    map_len{0},
+    index_offset{0},
+    count{0} {
+    mutex.set_name("device_snapshot");
+}
+
+device_snapshot::~device_snapshot() {
+    unmap();
+}
+
+bool device_snapshot::open(const std::string& in_path) {
+    kis_lock_guard<kis_mutex> lk(mutex, "device_snapshot open");
+
+    return map(in_path, false);
+}
+
+bool device_snapshot::map(const std::string& in_path, bool in_same_run) {
+    unmap();
+
+    int fd = ::open(in_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    // No snapshot is normal for the first run
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < DEVICE_SNAPSHOT_HEADER_LEN) {
+        _MSG_ERROR("Invalid device snapshot '{}', ignoring it", in_path);
+        close(fd);
+        return false;
+    }
+
+    auto base = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        _MSG_ERROR("Could not map device snapshot '{}': {}", in_path, kis_strerror_r(errno));
+        return false;
+    }
+
+    auto map = static_cast<const uint8_t *>(base);
+    size_t len = sb.st_size;
+
+    auto n = get64(map + 8);
+    auto idx = get64(map + 16);
+
+    if (memcmp(map, DEVICE_SNAPSHOT_MAGIC, 8) != 0 || idx % 8 != 0 || idx > len ||
+            n > (len - idx) / sizeof(device_snapshot_entry)) {
+        _MSG_ERROR("Invalid device snapshot '{}', ignoring it", in_path);
+        munmap(base, len);
+        return false;
+    }
+
+    map_base = map;
+    map_len = len;
+    index_offset = idx;
+    count = n;
+
+    taken.assign(count, false);
+
+    for (size_t i = 0; i < count; i++) {
+        auto e = entry(i);
+
+        // Records which run past the end of the file are treated as counts only
+        if (e->record_offset > len || e->record_len > len - e->record_offset)
+            taken[i] = true;
+
+        // Devices which were live when we wrote the snapshot are already tracked
+        if (in_same_run && (e->flags & DEVICE_SNAPSHOT_FLAG_LIVE))
+            taken[i] = true;
+    }
+
+    return true;
+}
+
+void device_snapshot::unmap() {
+    if (map_base != nullptr)
+        munmap(const_cast<uint8_t *>(map_base), map_len);
+
+    map_base = nullptr;
+    map_len = 0;
+    index_offset = 0;
+    count = 0;
+    taken.clear();
+}
+
+size_t device_snapshot::find(const device_key& in_key) const {
+    device_snapshot_entry k;
+    k.spkey = in_key.get_spkey();
+    k.dkey = in_key.get_dkey();
+
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+
+        if (entry_before(*entry(mid), k))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == count || entry(lo)->spkey != k.spkey || entry(lo)->dkey != k.dkey)
+        return count;
+
+    return lo;
+}
+
+bool device_snapshot::take(const device_key& in_key, device_snapshot_entry& ret_entry) {
+    kis_lock_guard<kis_mutex> lk(mutex, "device_snapshot take");
+
+    auto pos = find(in_key);
+
+    if (pos == count || taken[pos])
+        return false;
+
+    taken[pos] = true;
+    ret_entry = *entry(pos);
+
+    return true;
+}
+
+bool device_snapshot::fetch_record(const device_key& in_key, std::string& ret_record) {
+    kis_lock_guard<kis_mutex> lk(mutex, "device_snapshot fetch_record");
+
+    auto pos = find(in_key);
+
+    if (pos == count || taken[pos])
+        return false;
+
+    auto e = entry(pos);
+
+    if (e->record_len == 0)
+        return false;
+
+    ret_record.assign(reinterpret_cast<const char *>(map_base + e->record_offset), e->record_len);
+
+    return true;
+}
+
+bool device_snapshot::replace(device_snapshot_writer& in_writer, time_t in_min_last) {
+    kis_lock_guard<kis_mutex> lk(mutex, "device_snapshot replace");
+
+    for (size_t i = 0; i < count; i++) {
+        if (taken[i])
+            continue;
+
+        auto e = *entry(i);
+
+        if (e.last_time < in_min_last)
+            continue;
+
+        e.flags &= ~DEVICE_SNAPSHOT_FLAG_LIVE;
+
+        std::string record;
+
+        if (e.record_len != 0)
+            record.assign(reinterpret_cast<const char *>(map_base + e.record_offset), e.record_len);
+
+        if (!in_writer.add(e, record))
+            return false;
+    }
+
+    if (!in_writer.commit())
+        return false;
+
+    return map(in_writer.path, true);
+}
+
@@ -0,0 +1,164 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DEVICETRACKER_SNAPSHOT_H__
+#define __DEVICETRACKER_SNAPSHOT_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "kis_mutex.h"
+#include "trackedelement.h"
+
+// Snapshot of the tracked devices, so that a restarted server picks up where the last
+// one left off.
+//
+// The snapshot is a single file, written next to a temporary copy and renamed into
+// place so a crash mid-write leaves the previous snapshot intact:
+//
+//   header    magic, number of devices, offset of the index
+//   records   the full JSON record of each device, back to back
+//   index     one fixed size entry per device, sorted by device key, holding the
+//             timestamps and packet counts of the device and the location of its
+//             record
+//
+// The snapshot is mapped, not read, when the server starts, so loading costs nothing
+// no matter how many devices it holds.  Devices are inflated one at a time: a device
+// which is seen again resumes with the first time and packet counts of its entry, and
+// the full record of any device in the snapshot is available by key until then.
+//
+// Entries are in host byte order; a snapshot is only meant to be read by the server
+// which wrote it.
+
+#define DEVICE_SNAPSHOT_MAGIC           "KISDSNP1"
+#define DEVICE_SNAPSHOT_HEADER_LEN      32
+
+struct device_snapshot_entry {
+    uint64_t spkey;
+    uint64_t dkey;
+
+    int64_t first_time;
+    int64_t last_time;
+
+    uint64_t packets;
+    uint64_t tx_packets;
+    uint64_t rx_packets;
+    uint64_t llc_packets;
+    uint64_t error_packets;
+    uint64_t data_packets;
+    uint64_t crypt_packets;
+    uint64_t filter_packets;
+    uint64_t datasize;
+
+    uint64_t record_offset;
+    uint32_t record_len;
+
+    // Set on devices which were live in the server which wrote the snapshot
+    uint32_t flags;
+};
+
+#define DEVICE_SNAPSHOT_FLAG_LIVE       1
+
+static_assert(sizeof(device_snapshot_entry) == 120, "device snapshot entry is not packed");
+
+// Writes a new snapshot to a temporary file; nothing replaces the existing snapshot
+// until the mapped snapshot commits it
+class device_snapshot_writer {
+public:
+    device_snapshot_writer();
+    ~device_snapshot_writer();
+
+    bool open(const std::string& in_path);
+
+    // Add a device and its full record; an empty record stores the counts only
+    bool add(device_snapshot_entry in_entry, const std::string& in_record);
+
+    size_t size() const {
+        return index.size();
+    }
+
+protected:
+    friend class device_snapshot;
+
+    bool commit();
+    void abort();
+
+    std::string path;
+    std::string tmp_path;
+
+    FILE *fp;
+    uint64_t offset;
+
+    std::vector<device_snapshot_entry> index;
+};
+
+class device_snapshot {
+public:
+    device_snapshot();
+    ~device_snapshot();
+
+    // Map a snapshot written by an earlier run; returns false if there is no usable
+    // snapshot at the path
+    bool open(const std::string& in_path);
+
+    // Number of devices in the mapped snapshot
+    size_t size() const {
+        return count;
+    }
+
+    // Take the entry of a device which is being tracked again.  Each entry is only
+    // taken once, a device which times out and comes back doesn't pick up its old
+    // counts a second time.
+    bool take(const device_key& in_key, device_snapshot_entry& ret_entry);
+
+    // Full record of a device which hasn't been seen again yet
+    bool fetch_record(const device_key& in_key, std::string& ret_record);
+
+    // Copy the devices which haven't been seen again and which were last seen at or
+    // after min_last into a new snapshot, replace the snapshot on disk with it, and map
+    // the new snapshot in place of the old one
+    bool replace(device_snapshot_writer& in_writer, time_t in_min_last);
+
+protected:
+    bool map(const std::string& in_path, bool in_same_run);
+    void unmap();
+
+    // Index of the entry for a key, or count
+    size_t find(const device_key& in_key) const;
+
+    const device_snapshot_entry *entry(size_t in_pos) const {
+        return reinterpret_cast<const device_snapshot_entry *>(map_base + index_offset) + in_pos;
+    }
+
+    kis_mutex mutex;
+
+    const uint8_t *map_base;
+    size_t map_len;
+    uint64_t index_offset;
+    size_t count;
+
+    std::vector<bool> taken;
+};
+
+#endif
+
@@ -20,6 +20,7 @@
 
 #ifdef HAVE_CPP17_PARALLEL
 #include <execution>
+#include <future>
 #endif
 
 #include "devicetracker_view.h"
@@ -34,7 +35,8 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
         new_device_cb in_new_cb, updated_device_cb in_update_cb) :
     tracker_component{},
     new_cb {in_new_cb},
-    update_cb {in_update_cb} {
+    update_cb {in_update_cb},
+    view_num {allocate_view_num()} {
 
     devicetracker = Globalreg::fetch_mandatory_global_as<device_tracker>();
 
@@ -72,7 +74,8 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
         new_device_cb in_new_cb, updated_device_cb in_update_cb) :
     tracker_component{},
     new_cb {in_new_cb},
-    update_cb {in_update_cb} {
+    update_cb {in_update_cb},
+    view_num {allocate_view_num()} {
 
     devicetracker = Globalreg::fetch_mandatory_global_as<device_tracker>();
 
@@ -97,6 +100,51 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
     register_urls(ss.str());
 }
 
+device_tracker_view::~device_tracker_view() {
+    // Devices outlive the view, and the view number goes to the next view
+    kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), "~device_tracker_view");
+
+    for (const auto& d : *device_list)
+        std::static_pointer_cast<kis_tracked_device_base>(d)->remove_view_slot(view_num);
+
+    release_view_num(view_num);
+}
+
+namespace {
+    struct view_num_allocator {
+        kis_mutex mutex;
+        std::vector<bool> used;
+    };
+
+    view_num_allocator& view_nums() {
+        static view_num_allocator allocator;
+        return allocator;
+    }
+}
+
+unsigned int device_tracker_view::allocate_view_num() {
+    auto& a = view_nums();
+    kis_lock_guard<kis_mutex> lk(a.mutex, "device_tracker_view allocate_view_num");
+
+    for (size_t i = 0; i < a.used.size(); i++) {
+        if (!a.used[i]) {
+            a.used[i] = true;
+            return i;
+        }
+    }
+
+    a.used.push_back(true);
+    return a.used.size() - 1;
+}
+
+void device_tracker_view::release_view_num(unsigned int in_num) {
+    auto& a = view_nums();
+    kis_lock_guard<kis_mutex> lk(a.mutex, "device_tracker_view release_view_num");
+
+    if (in_num < a.used.size())
+        a.used[in_num] = false;
+}
+
 void device_tracker_view::register_urls(const std::string& in_id) { 
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
@@ -104,8 +152,10 @@ void device_tracker_view::register_urls(const std::string& in_id) {
     httpd->register_route(uri, {"GET", "POST"}, httpd->RO_ROLE, {},
             std::make_shared<kis_net_web_function_endpoint>(
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    // Locks the device list itself, around everything but the
+                    // read-only filters
                     return device_endpoint_handler(con);
-                }, devicetracker->get_devicelist_mutex()));
+                }));
 
     uri = fmt::format("/devices/views/{}/last-time/:timestamp/devices", in_id);
     httpd->register_route(uri, {"GET", "POST"}, httpd->RO_ROLE, {},
@@ -207,8 +257,7 @@ void device_tracker_view::register_urls(const std::string& in_id) {
                                                     auto mvec = devicetracker->fetch_devices(dev_m);
 
                                                     for (const auto& i : mvec) {
-                                                        auto pk = device_presence_map.find(i->get_key());
-                                                        if (pk == device_presence_map.end() || pk->second == false)
+                                                        if (i->find_view_slot(view_num) == nullptr)
                                                             continue;
 
                                                         if (i->get_mod_time() > last_tm) {
@@ -246,6 +295,124 @@ void device_tracker_view::register_urls(const std::string& in_id) {
                     timetracker->remove_timer(t.second);
 
                 }));
+
+    // Subscriptions to the changes in the view; every interval, subscribers get the 
+    // devices seen since the previous interval, from the last-seen index, and the keys of
+    // any devices removed from the view.  Devices seen during the second of an interval
+    // boundary may be repeated in the next interval.
+    uri = fmt::format("/devices/views/{}/deltas", in_id);
+    httpd->register_websocket_route(uri, httpd->RO_ROLE, {"ws"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+
+                std::unordered_map<unsigned int, int> sub_timer_map;
+                auto timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
+
+                auto ws = 
+                    std::make_shared<kis_net_web_websocket_endpoint>(con,
+                        [this, timetracker, &sub_timer_map](std::shared_ptr<kis_net_web_websocket_endpoint> ws,
+                            boost::beast::flat_buffer& buf, bool text) {
+
+                        if (!text) {
+                            ws->close();
+                            return;
+                        }
+
+                        try {
+                            auto json = nlohmann::json::parse(boost::beast::buffers_to_string(buf.data()));
+
+                            auto cancel_j = json["cancel"];
+                            if (cancel_j.is_number()) {
+                                auto st_v = sub_timer_map.find(cancel_j);
+                                if (st_v != sub_timer_map.end()) {
+                                    timetracker->remove_timer(st_v->second);
+                                    sub_timer_map.erase(st_v);
+                                }
+                            }
+
+                            auto sub_j = json["subscribe"];
+                            if (!sub_j.is_number())
+                                return;
+
+                            unsigned int sub_id = sub_j;
+                            unsigned int rate = json.value("rate", 1);
+
+                            if (rate == 0)
+                                rate = 1;
+
+                            // Only the field summary of the request applies to the devices
+                            nlohmann::json summary_json;
+                            summary_json["fields"] = json.value("fields", nlohmann::json::array_t{});
+
+                            auto st_v = sub_timer_map.find(sub_id);
+                            if (st_v != sub_timer_map.end())
+                                timetracker->remove_timer(st_v->second);
+
+                            auto since = 
+                                std::make_shared<time_t>(json.value("since", (time_t) Globalreg::globalreg->last_tv_sec));
+
+                            auto tid = 
+                                timetracker->register_timer(std::chrono::seconds(rate), true,
+                                        [this, ws, sub_id, summary_json, since](int) -> int {
+                                            kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), 
+                                                    "view ws deltas");
+
+                                            time_t now = Globalreg::globalreg->last_tv_sec;
+
+                                            auto changed = devices_seen_since(*since);
+                                            auto removed = devices_removed_since(*since);
+
+                                            *since = now;
+
+                                            if (changed->size() == 0 && removed.size() == 0)
+                                                return 1;
+
+                                            std::stringstream ss;
+
+                                            ss << "{\"kismet.devicedelta.request\": " << sub_id << 
+                                                ", \"kismet.devicedelta.timestamp\": " << now << 
+                                                ", \"kismet.devicedelta.removed\": [";
+
+                                            bool first = true;
+                                            for (const auto& k : removed) {
+                                                if (!first)
+                                                    ss << ", ";
+                                                first = false;
+                                                ss << "\"" << k.as_string() << "\"";
+                                            }
+
+                                            ss << "], \"kismet.devicedelta.devices\": ";
+
+                                            Globalreg::globalreg->entrytracker->serialize_with_json_summary("json",
+                                                    ss, changed, summary_json);
+
+                                            ss << "}";
+
+                                            ws->write(ss.str());
+
+                                            return 1;
+                                        });
+
+                            sub_timer_map[sub_id] = tid;
+
+                        } catch (const std::exception& e) {
+                            _MSG_ERROR("Invalid device delta subscription: {}", e.what());
+                            return;
+                        }
+                    });
+
+                ws->text();
+
+                try {
+                    ws->handle_request(con);
+                } catch (const std::exception& e) {
+                    ;
+                }
+
+                for (const auto t : sub_timer_map)
+                    timetracker->remove_timer(t.second);
+
+                }));
 }
 
 void device_tracker_view::pre_serialize() {
@@ -284,25 +451,24 @@ std::shared_ptr<tracker_element_vector> device_tracker_view::do_device_work(devi
     ret->reserve(devices->size());
 
     // Lock the whole device list for the duration; we may already hold this lock if we're inside the webserver
-    // but that's OK
+    // but that's OK.  Parallel workers run under the lock held by this thread.
     kis_lock_guard<kis_mutex> dev_lg(devicetracker->get_devicelist_mutex(), 
             "device_tracker_view do_device_work");
 
-    std::for_each(devices->begin(), devices->end(),
-            [&](shared_tracker_element val) {
-
-            if (val == nullptr)
-                return;
+    auto matched = match_devices(worker, devices->size(), 
+            [&](size_t i) -> bool {
+                const auto& val = (*devices)[i];
 
-            auto dev = std::static_pointer_cast<kis_tracked_device_base>(val);
-
-            bool m;
-            m = worker.match_device(dev);
+                if (val == nullptr)
+                    return false;
 
-            if (m) 
-                ret->push_back(dev);
+                return worker.match_device(std::static_pointer_cast<kis_tracked_device_base>(val));
+            });
 
-        });
+    for (size_t i = 0; i < devices->size(); i++) {
+        if (matched[i])
+            ret->push_back((*devices)[i]);
+    }
 
     worker.set_matched_devices(ret);
 
@@ -314,50 +480,177 @@ std::shared_ptr<tracker_element_vector> device_tracker_view::do_device_work(devi
 std::shared_ptr<tracker_element_vector> device_tracker_view::do_readonly_device_work(device_tracker_view_worker& worker,
         std::shared_ptr<tracker_element_vector> devices) {
 
-    // read-only workers are currently disabled because it may not be reasonable to solve conflicts
-    // at the per-device level, use the locked worker.
+    // Read-only workers which only search field values run against a snapshot of those
+    // fields, so they don't hold the device list while they work; anything else uses
+    // the locked worker, since it may not be reasonable to resolve conflicts at the 
+    // per-device level.
+    auto fields = worker.snapshot_fields();
 
-    return do_device_work(worker, devices);
+    if (fields.size() == 0)
+        return do_device_work(worker, devices);
+
+    auto snap = fetch_snapshot(fields);
+
+    if (snap == nullptr)
+        return do_device_work(worker, devices);
+
+    std::vector<int> field_pos;
+    for (const auto& f : fields)
+        field_pos.push_back(snap->field_pos(f));
 
-#if 0
     auto ret = std::make_shared<tracker_element_vector>();
     ret->reserve(devices->size());
 
-    kis_lock_guard<kis_mutex> ul_devlist(devicetracker->get_devicelist_mutex(), 
-            "device_tracker_view do_readonly_device_work");
+    // Devices added since the snapshot was taken are matched live, under lock, afterwards
+    std::vector<const device_snapshot_record *> records(devices->size(), nullptr);
+    std::vector<size_t> live;
 
-    std::for_each(devices->begin(), devices->end(),
-            [&](shared_tracker_element val) {
+    for (size_t i = 0; i < devices->size(); i++) {
+        const auto& val = (*devices)[i];
 
-            if (val == nullptr)
-                return;
+        if (val == nullptr)
+            continue;
 
-            auto dev = std::static_pointer_cast<kis_tracked_device_base>(val);
+        records[i] = snap->find(static_cast<kis_tracked_device_base *>(val.get()));
 
-            auto m = worker.match_device(dev);
+        if (records[i] == nullptr)
+            live.push_back(i);
+    }
 
-            if (m) 
-                ret->push_back(dev);
+    auto matched = match_devices(worker, devices->size(),
+            [&](size_t i) -> bool {
+                if (records[i] == nullptr)
+                    return false;
+
+                return worker.match_snapshot(*records[i], field_pos);
+            });
 
-        });
+    if (live.size() > 0) {
+        kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), 
+                "device_tracker_view do_readonly_device_work");
+
+        for (auto i : live)
+            matched[i] = worker.match_device(std::static_pointer_cast<kis_tracked_device_base>((*devices)[i]));
+    }
+
+    for (size_t i = 0; i < devices->size(); i++) {
+        if (matched[i])
+            ret->push_back((*devices)[i]);
+    }
 
     worker.set_matched_devices(ret);
 
     worker.finalize();
 
     return ret;
-#endif
+}
+
+std::vector<char> device_tracker_view::match_devices(device_tracker_view_worker& worker, size_t n,
+        const std::function<bool (size_t)>& match) {
+    std::vector<char> matched(n, 0);
+
+    auto n_threads = devicetracker->get_device_work_threads();
+
+    // Small lists aren't worth starting threads for
+    if (!worker.is_thread_safe() || n_threads <= 1 || n < 2048) {
+        for (size_t i = 0; i < n; i++)
+            matched[i] = match(i);
+
+        return matched;
+    }
+
+    // Split the list into contiguous segments, one per thread, with this thread taking
+    // the first; each segment only writes its own match results
+    auto n_segments = std::min<size_t>(n_threads, n / 1024);
+    auto segment_sz = (n + n_segments - 1) / n_segments;
+
+    std::vector<std::future<void>> segments;
+
+    for (size_t s = 1; s < n_segments; s++) {
+        auto start = s * segment_sz;
+        auto end = std::min(n, start + segment_sz);
+
+        segments.push_back(std::async(std::launch::async, [&matched, &match, start, end]() {
+                    for (auto i = start; i < end; i++)
+                        matched[i] = match(i);
+                    }));
+    }
+
+    for (size_t i = 0; i < std::min(n, segment_sz); i++)
+        matched[i] = match(i);
+
+    // Re-throws anything thrown by a worker thread
+    for (auto& s : segments)
+        s.get();
+
+    return matched;
+}
+
+std::shared_ptr<const device_tracker_view_snapshot> 
+    device_tracker_view::fetch_snapshot(const std::vector<device_snapshot_field>& fields) {
+
+    auto max_age = devicetracker->get_snapshot_max_age();
+
+    if (max_age == 0)
+        return nullptr;
+
+    auto now = (time_t) Globalreg::globalreg->last_tv_sec;
+
+    // Snapshot fields are the union of the fields recently searched, so that alternating 
+    // searches share a snapshot; start over if the field list grows too large
+    std::vector<device_snapshot_field> snap_fields;
+
+    {
+        kis_lock_guard<kis_mutex> lk(snapshot_mutex, "device_tracker_view fetch_snapshot");
+
+        if (snapshot != nullptr) {
+            bool complete = true;
+
+            for (const auto& f : fields) {
+                if (snapshot->field_pos(f) < 0) {
+                    complete = false;
+                    break;
+                }
+            }
+
+            if (complete && now - snapshot->get_ts() <= (time_t) max_age)
+                return snapshot;
+
+            if (snapshot->get_fields().size() + fields.size() <= 32)
+                snap_fields = snapshot->get_fields();
+        }
+    }
+
+    for (const auto& f : fields) {
+        if (std::find(snap_fields.begin(), snap_fields.end(), f) == snap_fields.end())
+            snap_fields.push_back(f);
+    }
+
+    // The snapshot lock is never held while waiting for the device list, since we may be
+    // called with the device list already locked
+    std::shared_ptr<const device_tracker_view_snapshot> snap;
+
+    {
+        kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), 
+                "device_tracker_view fetch_snapshot build");
+        snap = std::make_shared<device_tracker_view_snapshot>(snap_fields, device_list);
+    }
+
+    kis_lock_guard<kis_mutex> lk(snapshot_mutex, "device_tracker_view fetch_snapshot");
+    snapshot = snap;
+
+    return snap;
 }
 
 std::shared_ptr<kis_tracked_device_base> device_tracker_view::fetch_device(device_key in_key) {
     kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), "device_tracker_view fetch_device");
 
-    auto present_itr = device_presence_map.find(in_key);
+    auto device = devicetracker->fetch_device(in_key);
 
-    if (present_itr == device_presence_map.end() || present_itr->second == false)
+    if (device == nullptr || device->find_view_slot(view_num) == nullptr)
         return nullptr;
 
-    return devicetracker->fetch_device(in_key);
+    return device;
 }
 
 void device_tracker_view::new_device(std::shared_ptr<kis_tracked_device_base> device) {
@@ -366,12 +659,8 @@ void device_tracker_view::new_device(std::shared_ptr<kis_tracked_device_base> de
         // kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex());
 
         if (new_cb(device)) {
-            auto dpmi = device_presence_map.find(device->get_key());
-
-            if (dpmi == device_presence_map.end()) {
-                device_presence_map[device->get_key()] = true;
-                device_list->push_back(device);
-            }
+            if (device->find_view_slot(view_num) == nullptr)
+                index_device(device);
 
             list_sz->set(device_list->size());
         }
@@ -388,27 +677,19 @@ void device_tracker_view::update_device(std::shared_ptr<kis_tracked_device_base>
     
     bool retain = update_cb(device);
 
-    auto dpmi = device_presence_map.find(device->get_key());
+    auto slot = device->find_view_slot(view_num);
 
     // If we're adding the device (or keeping it) and we don't have it tracked,
-    // add it and record it in the presence map
-    if (retain && dpmi == device_presence_map.end()) {
-        device_list->push_back(device);
-        device_presence_map[device->get_key()] = true;
+    // add it to the list and the device
+    if (retain && slot == nullptr) {
+        index_device(device);
         list_sz->set(device_list->size());
         return;
     }
 
-    // if we're removing the device, find it in the vector and remove it, and remove
-    // it from the presence map; this is expensive
-    if (!retain && dpmi != device_presence_map.end()) {
-        for (auto di = device_list->begin(); di != device_list->end(); ++di) {
-            if (*di == device) {
-                device_list->erase(di);
-                break;
-            }
-        }
-        device_presence_map.erase(dpmi);
+    // If we're removing the device, drop it from the list and the device
+    if (!retain && slot != nullptr) {
+        unindex_device(device, slot);
         list_sz->set(device_list->size());
         return;
     }
@@ -418,32 +699,127 @@ void device_tracker_view::remove_device(std::shared_ptr<kis_tracked_device_base>
     // Only called under guard from devicetracker
     // kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex());
 
-    auto di = device_presence_map.find(device->get_key());
+    auto slot = device->find_view_slot(view_num);
+
+    if (slot != nullptr) {
+        unindex_device(device, slot);
+        list_sz->set(device_list->size());
+    }
+}
+
+void device_tracker_view::touch_device(std::shared_ptr<kis_tracked_device_base> device) {
+    // Only called under guard from devicetracker
 
-    if (di != device_presence_map.end()) {
-        device_presence_map.erase(di);
+    auto slot = device->find_view_slot(view_num);
 
-        for (auto vi = device_list->begin(); vi != device_list->end(); ++vi) {
-            if (*vi == device) {
-                device_list->erase(vi);
-                break;
-            }
+    if (slot == nullptr || slot->time_pos->first == device->get_last_time())
+        return;
+
+    // Re-key the existing node instead of allocating a new one
+    auto node = time_index.extract(slot->time_pos);
+    node.key() = device->get_last_time();
+    slot->time_pos = time_index.insert(std::move(node));
+}
+
+void device_tracker_view::index_device(const std::shared_ptr<kis_tracked_device_base>& device) {
+    device->add_view_slot(view_num, device_list->size(),
+            time_index.emplace(device->get_last_time(), device));
+    device_list->push_back(device);
+
+    auto& bitmap = phy_index[device->get_phyid()];
+    auto id = device->get_kis_internal_id();
+
+    if (bitmap.size() <= id / 64)
+        bitmap.resize((id / 64) + 1, 0);
+
+    bitmap[id / 64] |= (1ULL << (id % 64));
+}
+
+void device_tracker_view::unindex_device(const std::shared_ptr<kis_tracked_device_base>& device,
+        kis_tracked_device_base::view_slot *slot) {
+    auto& list = device_list->get();
+    auto pos = slot->list_pos;
+
+    if (pos != list.size() - 1) {
+        auto moved = std::static_pointer_cast<kis_tracked_device_base>(list.back());
+        list[pos] = moved;
+        moved->find_view_slot(view_num)->list_pos = pos;
+    }
+
+    list.pop_back();
+
+    time_index.erase(slot->time_pos);
+    device->remove_view_slot(view_num);
+
+    // Keep removals long enough for any reasonable delta interval to pick them up
+    time_t now = Globalreg::globalreg->last_tv_sec;
+
+    removed_log.emplace_back(now, device->get_key());
+
+    while (removed_log.size() > 0 && 
+            (removed_log.front().first < now - 300 || removed_log.size() > 65536))
+        removed_log.pop_front();
+
+    auto pi = phy_index.find(device->get_phyid());
+    auto id = device->get_kis_internal_id();
+
+    if (pi != phy_index.end() && pi->second.size() > id / 64)
+        pi->second[id / 64] &= ~(1ULL << (id % 64));
+}
+
+std::shared_ptr<tracker_element_vector> device_tracker_view::devices_seen_since(time_t ts) {
+    auto ret = std::make_shared<tracker_element_vector>();
+
+    for (auto ti = time_index.lower_bound(ts); ti != time_index.end(); ++ti)
+        ret->push_back(ti->second);
+
+    return ret;
+}
+
+std::vector<device_key> device_tracker_view::devices_removed_since(time_t ts) {
+    std::vector<device_key> ret;
+
+    auto ri = std::lower_bound(removed_log.begin(), removed_log.end(), ts,
+            [](const std::pair<time_t, device_key>& r, time_t t) { return r.first < t; });
+
+    for (; ri != removed_log.end(); ++ri)
+        ret.push_back(ri->second);
+
+    return ret;
+}
+
+std::shared_ptr<tracker_element_vector> device_tracker_view::devices_by_phy(int phy_id) {
+    auto ret = std::make_shared<tracker_element_vector>();
+
+    auto pi = phy_index.find(phy_id);
+
+    if (pi == phy_index.end())
+        return ret;
+
+    for (size_t w = 0; w < pi->second.size(); w++) {
+        auto bits = pi->second[w];
+
+        while (bits != 0) {
+            auto b = __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            auto dev = devicetracker->fetch_device_by_internal_id_nr((w * 64) + b);
+
+            if (dev != nullptr)
+                ret->push_back(dev);
         }
-        
-        list_sz->set(device_list->size());
     }
+
+    return ret;
 }
 
 void device_tracker_view::add_device_direct(std::shared_ptr<kis_tracked_device_base> device) {
     kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex());
 
-    auto di = device_presence_map.find(device->get_key());
-
-    if (di != device_presence_map.end())
+    if (device->find_view_slot(view_num) != nullptr)
         return;
 
-    device_presence_map[device->get_key()] = true;
-    device_list->push_back(device);
+    index_device(device);
 
     list_sz->set(device_list->size());
 }
@@ -451,18 +827,10 @@ void device_tracker_view::add_device_direct(std::shared_ptr<kis_tracked_device_b
 void device_tracker_view::remove_device_direct(std::shared_ptr<kis_tracked_device_base> device) {
     kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex());
 
-    auto di = device_presence_map.find(device->get_key());
-
-    if (di != device_presence_map.end()) {
-        device_presence_map.erase(di);
+    auto slot = device->find_view_slot(view_num);
 
-        for (auto vi = device_list->begin(); vi != device_list->end(); ++vi) {
-            if (*vi == device) {
-                device_list->erase(vi);
-                break;
-            }
-        }
-        
+    if (slot != nullptr) {
+        unindex_device(device, slot);
         list_sz->set(device_list->size());
     }
 }
@@ -485,15 +853,8 @@ device_tracker_view::device_time_endpoint(std::shared_ptr<kis_net_beast_httpd_co
     // Regular expression terms, if any
     auto regex = con->json()["regex"];
 
-    auto worker = 
-        device_tracker_view_function_worker([&](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
-                if (dev->get_last_time() < ts)
-                    return false;
-
-                return true;
-                });
-
-    auto next_work_vec = do_device_work(worker);
+    // Called under the device list lock by the endpoint
+    auto next_work_vec = devices_seen_since(ts);
 
     // Apply a regex filter
     if (!regex.is_null()) {
@@ -515,15 +876,21 @@ device_tracker_view::device_time_endpoint(std::shared_ptr<kis_net_beast_httpd_co
 void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
     std::ostream os(&con->response_stream());
 
-    // Summarization vector based on simplification part of shared data
-    auto summary_vec = std::vector<SharedElementSummary>{};
+    // Summarization vector based on simplification part of shared data, compiled once
+    // per unique field list
+    auto summary_vec = std::make_shared<const std::vector<SharedElementSummary>>();
 
-    // Rename cache generated by summarization
-    auto rename_map = Globalreg::new_from_pool<tracker_element_serializer::rename_map>();
+    // Summarized devices and the rename cache generated by summarization are allocated 
+    // from a request arena and released together
+    tracker_element_summary_arena arena;
+    auto rename_map = arena.make_rename_map();
 
     // Timestamp limitation
     time_t timestamp_min = 0;
 
+    // Phy limitation, if any
+    int phy_id = KIS_PHY_ANY;
+
     // String search term, if any
     auto search_term = std::string{};
 
@@ -536,6 +903,9 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
     // Regular expression terms, if any
     auto regex = con->json()["regex"];
 
+    // Filter expression, if any
+    auto filter = con->json()["filter"];
+
     // Wrapper, if any, we insert under
     std::shared_ptr<tracker_element_string_map> wrapper_elem;
 
@@ -560,18 +930,7 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
         // If the json has a 'fields' record, derive the fields simplification
         auto fields = con->json().value("fields", nlohmann::json::array_t{});
 
-        for (const auto& i : fields) {
-            if (i.is_string()) {
-                summary_vec.push_back(std::make_shared<tracker_element_summary>(i.get<std::string>()));
-            } else if (i.is_array()) {
-                if (i.size() != 2) 
-                    throw std::runtime_error("Invalid field map, expected [field, rename]");
-
-                summary_vec.push_back(std::make_shared<tracker_element_summary>(i[0].get<std::string>(), i[1].get<std::string>()));
-            } else {
-                throw std::runtime_error("Invalid field map, exected field or [field, rename]");
-            }
-        }
+        summary_vec = Globalreg::globalreg->entrytracker->compile_summary(fields, con->json_member_key("fields"));
 
         // Capture timestamp and negative-offset timestamp
         uint64_t raw_ts = con->json().value("last_time", 0);
@@ -579,9 +938,20 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
             timestamp_min = time(0) + raw_ts;
         else
             timestamp_min = raw_ts;
+
+        auto phyname = con->json().value("phyname", "");
+        if (phyname.length() > 0) {
+            auto phy = devicetracker->fetch_phy_handler_by_name(phyname);
+
+            if (phy == nullptr)
+                throw std::runtime_error("unknown phy");
+
+            phy_id = phy->fetch_phy_id();
+        }
     } catch (const std::runtime_error& e) {
         con->set_status(400);
         os << "Invalid request: " << e.what() << "\n";
+        return;
     }
 
     // Input fields from variables
@@ -616,7 +986,7 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
 
             // Search every field we return
             if (search_term.length() != 0) 
-                for (const auto& svi : summary_vec)
+                for (const auto& svi : *summary_vec)
                     search_paths.push_back(svi->resolved_path);
 
             // We only allow ordering by a single column, we don't do sub-ordering;
@@ -680,25 +1050,42 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
     // Next vector we do work on
     auto next_work_vec = std::make_shared<tracker_element_vector>();
 
-    // Copy the entire vector list, under lock, to the next work vector; this makes it an independent copy
-    // we can sort and manipulate
-    next_work_vec->set(device_list->begin(), device_list->end());
-    total_sz_elem->set(next_work_vec->size());
+    // Devices are serialized directly under the device list lock, so buffer the response 
+    // instead of waiting on the client with the lock held
+    future_chainbuf::unthrottled_scope ut(con->response_stream());
 
-    // If we have a time filter, apply that first, it's the fastest.
+    kis_unique_lock<kis_mutex> devlist_locker(devicetracker->get_devicelist_mutex(), std::defer_lock,
+            "device_tracker_view device_endpoint_handler");
+    devlist_locker.lock();
+
+    total_sz_elem->set(device_list->size());
+
+    // Time and phy filters come from the secondary indexes, so only the matching devices 
+    // are visited; otherwise copy the entire vector list, under lock, to the next work 
+    // vector.  Either way the next work vector is an independent copy we can sort and 
+    // manipulate.
     if (timestamp_min > 0) {
-        auto worker = 
-            device_tracker_view_function_worker([timestamp_min] (std::shared_ptr<kis_tracked_device_base> dev) -> bool {
-                if (dev->get_last_time() < timestamp_min)
-                    return false;
-                return true;
-            });
+        next_work_vec = devices_seen_since(timestamp_min);
 
-        // Do the work and copy the vector
-        auto ts_vec = do_readonly_device_work(worker, next_work_vec);
-        next_work_vec->set(ts_vec->begin(), ts_vec->end());
+        if (phy_id != KIS_PHY_ANY) {
+            auto phy_vec = std::make_shared<tracker_element_vector>();
+
+            for (const auto& d : *next_work_vec) 
+                if (static_cast<kis_tracked_device_base *>(d.get())->get_phyid() == phy_id)
+                    phy_vec->push_back(d);
+
+            next_work_vec = phy_vec;
+        }
+    } else if (phy_id != KIS_PHY_ANY) {
+        next_work_vec = devices_by_phy(phy_id);
+    } else {
+        next_work_vec->set(device_list->begin(), device_list->end());
     }
 
+    // The string and regex filters match against a snapshot of the devices, so release
+    // the device list while they run
+    devlist_locker.unlock();
+
     // Apply a string filter
     if (search_term.length() > 0 && search_paths.size() > 0) {
         auto worker =
@@ -722,6 +1109,20 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
         }
     }
 
+    // Apply a compiled filter expression; identical expressions are only compiled once
+    if (!filter.is_null()) {
+        try {
+            auto worker = device_tracker_view_filter_worker(filter);
+            next_work_vec = do_readonly_device_work(worker, next_work_vec);
+        } catch (const std::exception& e) {
+            con->set_status(400);
+            os << "Invalid filter: " << e.what() << "\n";
+            return;
+        }
+    }
+
+    devlist_locker.lock();
+
     // Apply the filtered length
     filtered_sz_elem->set(next_work_vec->size());
 
@@ -769,12 +1170,23 @@ void device_tracker_view::device_endpoint_handler(std::shared_ptr<kis_net_beast_
             });
     }
 
+    // Without a wrapper, serializers can emit the summarized fields directly from
+    // the devices
+    if (transmit == nullptr && summary_vec->size() != 0) {
+        auto slice_vec = std::make_shared<tracker_element_vector>();
+        slice_vec->set(si, ei);
+
+        Globalreg::globalreg->entrytracker->serialize_summary(static_cast<std::string>(con->uri()), 
+                os, slice_vec, *summary_vec);
+        return;
+    }
+
     // Summarize into the output element
     auto final_devices_vec = std::make_shared<tracker_element_vector>();
 
     for (auto i = si; i != ei; ++i) {
         final_devices_vec->push_back(*i);
-        output_devices_elem->push_back(summarize_tracker_element(*i, summary_vec, rename_map));
+        output_devices_elem->push_back(summarize_tracker_element(*i, *summary_vec, rename_map));
     }
 
     // If the transmit wasn't assigned to a wrapper...
@@ -21,7 +21,9 @@
 
 #include "config.h"
 
+#include <deque>
 #include <functional>
+#include <map>
 #include <unordered_map>
 
 #include "uuid.h"
@@ -40,8 +42,8 @@
 // add_device_direct and addRemoveDirect, depending on how the view population code is written.
 //
 // Views are best suited to long-term alternate representations of data, such as 'all access points',
-// 'all devices of a given phy type', and so on.  The vector-backed system is not well optimized
-// for frequent eviction of devices from the view.
+// 'all devices of a given phy type', and so on.  Devices are removed from the view vector by
+// moving the last device into their place, so the order of the vector is not meaningful.
 //
 // Views live under the devices tree in:
 // /devices/view/[view id]/...
@@ -61,8 +63,7 @@ public:
     // The updated device callback is called whenever a change event occurs.  Change events
     // are triggered by specific code, make sure you've integrated a change trigger for
     // the filtering you're performing.
-    // Returning 'false' removes the device from the list.  This is expensive, so 
-    // removing devices from filtering should be a relatively rare event
+    // Returning 'false' removes the device from the list.
     
     using new_device_cb = std::function<bool (std::shared_ptr<kis_tracked_device_base>)>;
     using updated_device_cb = std::function<bool (std::shared_ptr<kis_tracked_device_base>)>;
@@ -77,7 +78,7 @@ public:
             const std::vector<std::string>& in_aux_path, 
             new_device_cb in_new_cb, updated_device_cb in_upd_cb);
 
-    virtual ~device_tracker_view() { }
+    virtual ~device_tracker_view();
 
     __ProxyGet(view_id, std::string, std::string, view_id);
     __ProxyGet(view_description, std::string, std::string, view_description);
@@ -96,7 +97,9 @@ public:
     // must not call this on a vector which can be altered in another thread.
     virtual std::shared_ptr<tracker_element_vector> do_device_work(device_tracker_view_worker& worker,
             std::shared_ptr<tracker_element_vector> vec);
-    // Do read-only work; this MAY NOT modify devices in the worker!
+    // Do read-only work; this MAY NOT modify devices in the worker!  Workers which can match
+    // against a snapshot of the device fields are run against a recent snapshot without
+    // locking the devices.
     virtual std::shared_ptr<tracker_element_vector> do_readonly_device_work(device_tracker_view_worker& worker,
             std::shared_ptr<tracker_element_vector> vec);
 
@@ -114,6 +117,19 @@ public:
 	// Look for an existing device record under read-only shared lock
     std::shared_ptr<kis_tracked_device_base> fetch_device(device_key in_key);
 
+    // Devices in the view last seen at or after a given time, oldest first, from the 
+    // last-seen index; the cost is proportional to the number of matching devices, not
+    // the size of the view.  Must be called under the device list lock.
+    std::shared_ptr<tracker_element_vector> devices_seen_since(time_t ts);
+
+    // Devices in the view of a given phy, from the phy index.  Must be called under the
+    // device list lock.
+    std::shared_ptr<tracker_element_vector> devices_by_phy(int phy_id);
+
+    // Keys of devices removed from the view at or after a given time, as far back as the
+    // removal log goes.  Must be called under the device list lock.
+    std::vector<device_key> devices_removed_since(time_t ts);
+
 protected:
     std::shared_ptr<device_tracker> devicetracker;
 
@@ -138,8 +154,45 @@ protected:
 
     // Main vector of devices
     std::shared_ptr<tracker_element_vector> device_list;
-    // Map of device presence in our list for fast reference during updates
-    std::unordered_map<device_key, bool> device_presence_map;
+    // Devices in our list ordered by last time seen
+    using time_index_t = device_view_time_index_t;
+    time_index_t time_index;
+
+    // Number of this view in the view slots of the devices; membership in the view is
+    // tracked on the devices themselves, with their position in the device list and
+    // time index, so a view holds no per-device map of its own
+    unsigned int view_num;
+
+    // View numbers are reused once a view is gone, which keeps them small and the
+    // device membership bits distinct
+    static unsigned int allocate_view_num();
+    static void release_view_num(unsigned int in_num);
+
+    // Bitmaps of the devices in our list for each phy, by device internal id
+    std::unordered_map<int, std::vector<uint64_t>> phy_index;
+
+    // Recently removed devices, oldest first, for delta subscribers
+    std::deque<std::pair<time_t, device_key>> removed_log;
+
+    // Add a device to the list and the secondary indexes, or remove it; removal moves
+    // the last device of the list into the hole instead of shifting the list down
+    void index_device(const std::shared_ptr<kis_tracked_device_base>& device);
+    void unindex_device(const std::shared_ptr<kis_tracked_device_base>& device,
+            kis_tracked_device_base::view_slot *slot);
+
+    // Most recent snapshot of the searched fields of the device list, for read-only workers
+    kis_mutex snapshot_mutex;
+    std::shared_ptr<const device_tracker_view_snapshot> snapshot;
+
+    // Evaluate match for the first n devices of a list, splitting the list across the device 
+    // work threads if the worker is thread-safe; returns the match of each device, in order
+    std::vector<char> match_devices(device_tracker_view_worker& worker, size_t n,
+            const std::function<bool (size_t)>& match);
+
+    // Fetch a snapshot holding at least the requested fields, re-using the current snapshot 
+    // if it is recent enough.  Returns nullptr if snapshots are disabled.
+    std::shared_ptr<const device_tracker_view_snapshot> 
+        fetch_snapshot(const std::vector<device_snapshot_field>& fields);
 
     void device_endpoint_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
     std::shared_ptr<tracker_element> device_time_endpoint(std::shared_ptr<kis_net_beast_httpd_connection> con);
@@ -158,6 +211,10 @@ protected:
     // device record.
     virtual void remove_device(std::shared_ptr<kis_tracked_device_base> device);
 
+    // Called when the last time seen of a device changes, to keep the time index ordered;
+    // this should only be called by devicetracker itself.
+    virtual void touch_device(std::shared_ptr<kis_tracked_device_base> device);
+
 };
 
 #endif
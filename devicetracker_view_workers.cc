@@ -25,13 +25,99 @@
 #include "kis_mutex.h"
 #include "kismet_algorithm.h"
 
+device_tracker_view_snapshot::device_tracker_view_snapshot(const std::vector<device_snapshot_field>& fields,
+        const std::shared_ptr<tracker_element_vector>& devices) :
+    ts{(time_t) Globalreg::globalreg->last_tv_sec},
+    fields{fields} {
+
+    records.reserve(devices->size());
+    record_map.reserve(devices->size());
+
+    for (const auto& d : *devices) {
+        if (d == nullptr)
+            continue;
+
+        device_snapshot_record record;
+        record.device = std::static_pointer_cast<kis_tracked_device_base>(d);
+        record.values.resize(fields.size());
+
+        for (size_t fi = 0; fi < fields.size(); fi++) {
+            if (fields[fi].multi) {
+                for (const auto& e : get_tracker_element_multi_path(fields[fi].path, record.device))
+                    capture(e, record.values[fi]);
+            } else {
+                capture(get_tracker_element_path(fields[fi].resolved_path, record.device), 
+                        record.values[fi]);
+            }
+        }
+
+        record_map[record.device.get()] = records.size();
+        records.push_back(std::move(record));
+    }
+}
+
+void device_tracker_view_snapshot::capture(const shared_tracker_element& elem,
+        std::vector<device_snapshot_value>& values) {
+    if (elem == nullptr)
+        return;
+
+    device_snapshot_value v;
+    v.type = elem->get_type();
+    v.has_xform = false;
+
+    switch (v.type) {
+        case tracker_type::tracker_string:
+            v.str = get_tracker_value<std::string>(elem);
+            break;
+        case tracker_type::tracker_byte_array:
+            v.str = std::static_pointer_cast<tracker_element_byte_array>(elem)->get();
+            break;
+        case tracker_type::tracker_mac_addr:
+            v.mac = get_tracker_value<mac_addr>(elem);
+            v.str = v.mac.mac_to_string();
+            break;
+        case tracker_type::tracker_uuid:
+            v.str = get_tracker_value<uuid>(elem).uuid_to_string();
+            v.has_xform = Globalreg::globalreg->entrytracker->search_xform(elem, v.xform);
+            break;
+        default:
+            v.has_xform = Globalreg::globalreg->entrytracker->search_xform(elem, v.xform);
+
+            // Nothing searchable
+            if (!v.has_xform)
+                return;
+            break;
+    }
+
+    values.push_back(std::move(v));
+}
+
+int device_tracker_view_snapshot::field_pos(const device_snapshot_field& field) const {
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i] == field)
+            return i;
+    }
+
+    return -1;
+}
+
+const device_snapshot_record *device_tracker_view_snapshot::find(const kis_tracked_device_base *device) const {
+    auto ri = record_map.find(device);
+
+    if (ri == record_map.end())
+        return nullptr;
+
+    return &records[ri->second];
+}
+
 void device_tracker_view_worker::set_matched_devices(std::shared_ptr<tracker_element_vector> devs) {
     kis_lock_guard<kis_mutex> lk(mutex);
     matched = devs;
 }
 
-device_tracker_view_function_worker::device_tracker_view_function_worker(filter_cb cb) :
-    filter {cb} { }
+device_tracker_view_function_worker::device_tracker_view_function_worker(filter_cb cb, bool thread_safe) :
+    filter {cb},
+    thread_safe {thread_safe} { }
 
 bool device_tracker_view_function_worker::match_device(std::shared_ptr<kis_tracked_device_base> device) {
     return filter(device);
@@ -67,6 +153,12 @@ device_tracker_view_regex_worker::pcre_filter::~pcre_filter() {
         pcre_free(study);
 }
 
+bool device_tracker_view_regex_worker::pcre_filter::match(const std::string& val) const {
+    int ovector[128];
+
+    return pcre_exec(re, study, val.c_str(), val.length(), 0, 0, ovector, 128) >= 0;
+}
+
 #elif defined(HAVE_LIBPCRE2)
 
 device_tracker_view_regex_worker::pcre_filter::pcre_filter(const std::string& in_target,
@@ -98,6 +190,16 @@ device_tracker_view_regex_worker::pcre_filter::~pcre_filter() {
         pcre2_code_free(re);
 }
 
+bool device_tracker_view_regex_worker::pcre_filter::match(const std::string& val) const {
+    // Filters are shared between workers and worker threads, so each thread matches with 
+    // its own match data
+    thread_local std::unique_ptr<pcre2_match_data, decltype(&pcre2_match_data_free)> 
+        thread_match_data{pcre2_match_data_create(1, nullptr), pcre2_match_data_free};
+
+    return pcre2_match(re, (PCRE2_SPTR8) val.c_str(), val.length(), 
+            0, 0, thread_match_data.get(), NULL) >= 0;
+}
+
 #endif
 
 device_tracker_view_regex_worker::device_tracker_view_regex_worker(const std::vector<std::shared_ptr<device_tracker_view_regex_worker::pcre_filter>>& in_filter_vec) {
@@ -172,20 +274,8 @@ bool device_tracker_view_regex_worker::match_device(std::shared_ptr<kis_tracked_
                     break;
             }
 
-            int rc;
-
-#if defined(HAVE_LIBPCRE1)
-            int ovector[128];
-
-            rc = pcre_exec(i->re, i->study, val.c_str(), val.length(), 0, 0, ovector, 128);
-#else
-
-            rc = pcre2_match(i->re, (PCRE2_SPTR8) val.c_str(), val.length(), 
-                    0, 0, i->match_data, NULL);
-
-#endif
             // Stop matching as soon as we find a hit
-            if (rc >= 0) {
+            if (i->match(val)) {
                 matched = true;
                 break;
             }
@@ -201,6 +291,42 @@ bool device_tracker_view_regex_worker::match_device(std::shared_ptr<kis_tracked_
     return false;
 }
 
+std::vector<device_snapshot_field> device_tracker_view_regex_worker::snapshot_fields() const {
+    std::vector<device_snapshot_field> ret;
+
+#if defined(HAVE_LIBPCRE1) || defined(HAVE_LIBPCRE2)
+    for (const auto& i : filter_vec)
+        ret.push_back(device_snapshot_field(i->target));
+#endif
+
+    return ret;
+}
+
+bool device_tracker_view_regex_worker::match_snapshot(const device_snapshot_record& record,
+        const std::vector<int>& field_pos) {
+#if defined(HAVE_LIBPCRE1) || defined(HAVE_LIBPCRE2)
+    for (size_t i = 0; i < filter_vec.size(); i++) {
+        for (const auto& v : record.values[field_pos[i]]) {
+            switch (v.type) {
+                case tracker_type::tracker_string:
+                case tracker_type::tracker_mac_addr:
+                case tracker_type::tracker_uuid:
+                case tracker_type::tracker_byte_array:
+                    if (filter_vec[i]->match(v.str))
+                        return true;
+                    break;
+                default:
+                    if (v.has_xform && filter_vec[i]->match(v.xform))
+                        return true;
+                    break;
+            }
+        }
+    }
+#endif
+
+    return false;
+}
+
 device_tracker_view_stringmatch_worker::device_tracker_view_stringmatch_worker(const std::string& in_query,
         const std::vector<std::vector<int>>& in_paths) :
     query { in_query },
@@ -253,6 +379,36 @@ bool device_tracker_view_stringmatch_worker::match_device(std::shared_ptr<kis_tr
     return false;
 }
 
+std::vector<device_snapshot_field> device_tracker_view_stringmatch_worker::snapshot_fields() const {
+    return std::vector<device_snapshot_field>(fieldpaths.begin(), fieldpaths.end());
+}
+
+bool device_tracker_view_stringmatch_worker::match_snapshot(const device_snapshot_record& record,
+        const std::vector<int>& field_pos) {
+    for (auto p : field_pos) {
+        for (const auto& v : record.values[p]) {
+            switch (v.type) {
+                case tracker_type::tracker_string:
+                case tracker_type::tracker_byte_array:
+                    if (v.str.find(query) != std::string::npos)
+                        return true;
+                    break;
+                case tracker_type::tracker_mac_addr:
+                    if (mac_query_term_len != 0 && 
+                            v.mac.partial_search(mac_query_term, mac_query_term_len))
+                        return true;
+                    break;
+                default:
+                    if (v.has_xform && v.xform.find(query) != std::string::npos)
+                        return true;
+                    break;
+            }
+        }
+    }
+
+    return false;
+}
+
 device_tracker_view_icasestringmatch_worker::device_tracker_view_icasestringmatch_worker(const std::string& in_query,
         const std::vector<std::vector<int>>& in_paths) :
     query { in_query },
@@ -262,17 +418,17 @@ device_tracker_view_icasestringmatch_worker::device_tracker_view_icasestringmatc
     mac_addr::prepare_search_term(query, mac_query_term, mac_query_term_len);
 }
 
+static bool icasesearch(const std::string& haystack, const std::string& needle) {
+    auto pos = std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(),
+            [](char ch1, char ch2) -> bool { 
+                return std::toupper(ch1) == std::toupper(ch2);
+            });
+    return (pos != haystack.end());
+}
+
 bool device_tracker_view_icasestringmatch_worker::match_device(std::shared_ptr<kis_tracked_device_base> device) {
     bool matched = false;
 
-    auto icasesearch = [](const std::string& haystack, const std::string& needle) -> bool {
-        auto pos = std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(),
-                [](char ch1, char ch2) -> bool { 
-                    return std::toupper(ch1) == std::toupper(ch2);
-                });
-        return (pos != haystack.end());
-    };
-
     for (const auto& i : fieldpaths) {
         auto field = get_tracker_element_path(i, device);
         std::string val;
@@ -311,4 +467,342 @@ bool device_tracker_view_icasestringmatch_worker::match_device(std::shared_ptr<k
     return false;
 }
 
+std::vector<device_snapshot_field> device_tracker_view_icasestringmatch_worker::snapshot_fields() const {
+    return std::vector<device_snapshot_field>(fieldpaths.begin(), fieldpaths.end());
+}
 
+bool device_tracker_view_icasestringmatch_worker::match_snapshot(const device_snapshot_record& record,
+        const std::vector<int>& field_pos) {
+    for (auto p : field_pos) {
+        for (const auto& v : record.values[p]) {
+            switch (v.type) {
+                case tracker_type::tracker_string:
+                case tracker_type::tracker_byte_array:
+                    if (icasesearch(v.str, query))
+                        return true;
+                    break;
+                case tracker_type::tracker_mac_addr:
+                    if (mac_query_term_len != 0 && 
+                            v.mac.partial_search(mac_query_term, mac_query_term_len))
+                        return true;
+                    break;
+                default:
+                    if (v.has_xform && icasesearch(v.xform, query))
+                        return true;
+                    break;
+            }
+        }
+    }
+
+    return false;
+}
+
+namespace {
+
+bool filter_string(shared_tracker_element e, std::string& val) {
+    if (e->get_type() == tracker_type::tracker_alias)
+        e = static_cast<tracker_element_alias *>(e.get())->get();
+
+    if (e == nullptr)
+        return false;
+
+    switch (e->get_type()) {
+        case tracker_type::tracker_string:
+            val = get_tracker_value<std::string>(e);
+            return true;
+        case tracker_type::tracker_byte_array:
+            val = std::static_pointer_cast<tracker_element_byte_array>(e)->get();
+            return true;
+        case tracker_type::tracker_mac_addr:
+            val = get_tracker_value<mac_addr>(e).mac_to_string();
+            return true;
+        case tracker_type::tracker_uuid:
+            val = get_tracker_value<uuid>(e).uuid_to_string();
+            return true;
+        default:
+            break;
+    }
+
+    if (!e->is_stringable())
+        return false;
+
+    val = e->as_string();
+    return true;
+}
+
+bool filter_number(shared_tracker_element e, double& val) {
+    if (e->get_type() == tracker_type::tracker_alias)
+        e = static_cast<tracker_element_alias *>(e.get())->get();
+
+    if (e == nullptr)
+        return false;
+
+    switch (e->get_type()) {
+        case tracker_type::tracker_uint8:
+            val = static_cast<tracker_element_uint8 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_int8:
+            val = static_cast<tracker_element_int8 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_uint16:
+            val = static_cast<tracker_element_uint16 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_int16:
+            val = static_cast<tracker_element_int16 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_uint32:
+            val = static_cast<tracker_element_uint32 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_int32:
+            val = static_cast<tracker_element_int32 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_uint64:
+            val = static_cast<tracker_element_uint64 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_int64:
+            val = static_cast<tracker_element_int64 *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_float:
+            val = static_cast<tracker_element_float *>(e.get())->get();
+            return true;
+        case tracker_type::tracker_double:
+            val = static_cast<tracker_element_double *>(e.get())->get();
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
+std::shared_ptr<const device_filter_expression> device_filter_expression::compile(const nlohmann::json& expr) {
+    static kis_mutex cache_mutex{"device_filter_expression cache"};
+    static robin_hood::unordered_node_map<std::string, std::shared_ptr<const device_filter_expression>> cache;
+
+    auto key = expr.dump();
+
+    {
+        kis_lock_guard<kis_mutex> lk(cache_mutex, "device_filter_expression compile");
+        auto ci = cache.find(key);
+        if (ci != cache.end())
+            return ci->second;
+    }
+
+    auto compiled = std::make_shared<const device_filter_expression>(expr);
+
+    // Fields which aren't registered yet may be later, so only cache fully resolved 
+    // expressions
+    if (!compiled->is_resolved())
+        return compiled;
+
+    kis_lock_guard<kis_mutex> lk(cache_mutex, "device_filter_expression compile");
+
+    // Expressions come from clients; don't let unique expressions grow the cache forever
+    if (cache.size() >= 256)
+        cache.clear();
+
+    cache[key] = compiled;
+
+    return compiled;
+}
+
+device_filter_expression::device_filter_expression(const nlohmann::json& expr) :
+    root{parse(expr)} { 
+    resolved = node_resolved(root);
+}
+
+bool device_filter_expression::node_resolved(const filter_node& node) {
+    for (auto p : node.path)
+        if (p < 0)
+            return false;
+
+    for (const auto& c : node.children)
+        if (!node_resolved(c))
+            return false;
+
+    return true;
+}
+
+device_filter_expression::filter_node device_filter_expression::parse(const nlohmann::json& expr) {
+    static const std::map<std::string, filter_op> op_map = {
+        {"and", filter_op::op_and}, {"or", filter_op::op_or}, {"not", filter_op::op_not},
+        {"exists", filter_op::op_exists},
+        {"==", filter_op::op_eq}, {"!=", filter_op::op_ne}, 
+        {"<", filter_op::op_lt}, {"<=", filter_op::op_le}, 
+        {">", filter_op::op_gt}, {">=", filter_op::op_ge},
+        {"prefix", filter_op::op_prefix}, {"contains", filter_op::op_contains}, 
+        {"icontains", filter_op::op_icontains}, {"regex", filter_op::op_regex},
+    };
+
+    if (!expr.is_array() || expr.size() < 2 || !expr[0].is_string())
+        throw std::runtime_error("expected [operator, ...] filter expression");
+
+    auto oi = op_map.find(expr[0].get<std::string>());
+
+    if (oi == op_map.end())
+        throw std::runtime_error(fmt::format("unknown filter operator '{}'", expr[0].get<std::string>()));
+
+    filter_node node;
+    node.op = oi->second;
+    node.numeric = false;
+    node.num_value = 0;
+
+    switch (node.op) {
+        case filter_op::op_and:
+        case filter_op::op_or:
+            for (size_t i = 1; i < expr.size(); i++)
+                node.children.push_back(parse(expr[i]));
+            return node;
+        case filter_op::op_not:
+            if (expr.size() != 2)
+                throw std::runtime_error("expected [\"not\", expression] filter expression");
+            node.children.push_back(parse(expr[1]));
+            return node;
+        default:
+            break;
+    }
+
+    if (!expr[1].is_string())
+        throw std::runtime_error("expected field path in filter expression");
+
+    node.path = tracker_element_summary(expr[1].get<std::string>()).resolved_path;
+
+    if (node.op == filter_op::op_exists) {
+        if (expr.size() != 2)
+            throw std::runtime_error("expected [\"exists\", field] filter expression");
+        return node;
+    }
+
+    if (expr.size() != 3)
+        throw std::runtime_error("expected [operator, field, value] filter expression");
+
+    if (expr[2].is_number()) {
+        node.numeric = true;
+        node.num_value = expr[2].get<double>();
+    } else if (expr[2].is_string()) {
+        node.str_value = expr[2].get<std::string>();
+    } else {
+        throw std::runtime_error("expected string or numeric value in filter expression");
+    }
+
+    switch (node.op) {
+        case filter_op::op_prefix:
+        case filter_op::op_contains:
+        case filter_op::op_icontains:
+        case filter_op::op_regex:
+            if (node.numeric)
+                throw std::runtime_error("expected string value in filter expression");
+            break;
+        default:
+            break;
+    }
+
+    if (node.op == filter_op::op_regex) {
+#if defined(HAVE_LIBPCRE1) || defined(HAVE_LIBPCRE2)
+        node.regex = 
+            std::make_shared<device_tracker_view_regex_worker::pcre_filter>(expr[1].get<std::string>(), 
+                    node.str_value);
+#else
+        throw std::runtime_error("Kismet was not compiled with PCRE support");
+#endif
+    }
+
+    return node;
+}
+
+bool device_filter_expression::match(const std::shared_ptr<kis_tracked_device_base>& device) const {
+    return match_node(root, device);
+}
+
+bool device_filter_expression::match_node(const filter_node& node, 
+        const std::shared_ptr<kis_tracked_device_base>& device) {
+    switch (node.op) {
+        case filter_op::op_and:
+            for (const auto& c : node.children)
+                if (!match_node(c, device))
+                    return false;
+            return true;
+        case filter_op::op_or:
+            for (const auto& c : node.children)
+                if (match_node(c, device))
+                    return true;
+            return false;
+        case filter_op::op_not:
+            return !match_node(node.children[0], device);
+        default:
+            break;
+    }
+
+    auto field = get_tracker_element_path(node.path, device);
+
+    if (field == nullptr || field->get_type() == tracker_type::tracker_placeholder_missing)
+        return false;
+
+    if (node.op == filter_op::op_exists)
+        return true;
+
+    if (node.numeric) {
+        double v;
+
+        if (!filter_number(field, v))
+            return false;
+
+        switch (node.op) {
+            case filter_op::op_eq:
+                return v == node.num_value;
+            case filter_op::op_ne:
+                return v != node.num_value;
+            case filter_op::op_lt:
+                return v < node.num_value;
+            case filter_op::op_le:
+                return v <= node.num_value;
+            case filter_op::op_gt:
+                return v > node.num_value;
+            case filter_op::op_ge:
+                return v >= node.num_value;
+            default:
+                return false;
+        }
+    }
+
+    std::string v;
+
+    if (!filter_string(field, v))
+        return false;
+
+    switch (node.op) {
+        case filter_op::op_eq:
+            return v == node.str_value;
+        case filter_op::op_ne:
+            return v != node.str_value;
+        case filter_op::op_lt:
+            return v < node.str_value;
+        case filter_op::op_le:
+            return v <= node.str_value;
+        case filter_op::op_gt:
+            return v > node.str_value;
+        case filter_op::op_ge:
+            return v >= node.str_value;
+        case filter_op::op_prefix:
+            return v.compare(0, node.str_value.length(), node.str_value) == 0;
+        case filter_op::op_contains:
+            return v.find(node.str_value) != std::string::npos;
+        case filter_op::op_icontains:
+            return icasesearch(v, node.str_value);
+        case filter_op::op_regex:
+#if defined(HAVE_LIBPCRE1) || defined(HAVE_LIBPCRE2)
+            return node.regex->match(v);
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+device_tracker_view_filter_worker::device_tracker_view_filter_worker(const nlohmann::json& expr) :
+    expression{device_filter_expression::compile(expr)} { }
+
+bool device_tracker_view_filter_worker::match_device(std::shared_ptr<kis_tracked_device_base> device) {
+    return expression->match(device);
+}
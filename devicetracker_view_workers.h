@@ -24,6 +24,8 @@
 #include <functional>
 
 #include "kis_mutex.h"
+#include "macaddr.h"
+#include "robin_hood.h"
 #include "uuid.h"
 #include "trackedelement.h"
 #include "trackedcomponent.h"
@@ -38,6 +40,80 @@
 #include <pcre2.h>
 #endif
 
+// Field a read-only worker searches, as captured in a device snapshot
+struct device_snapshot_field {
+    device_snapshot_field(const std::string& path) :
+        multi{true},
+        path{path} { }
+
+    device_snapshot_field(const std::vector<int>& resolved_path) :
+        multi{false},
+        resolved_path{resolved_path} { }
+
+    bool operator==(const device_snapshot_field& f) const {
+        return multi == f.multi && path == f.path && resolved_path == f.resolved_path;
+    }
+
+    // Multi-paths are string paths which may descend into vectors and maps, as 
+    // get_tracker_element_multi_path; others are resolved single paths
+    bool multi;
+    std::string path;
+    std::vector<int> resolved_path;
+};
+
+// Searchable value of a field in a device snapshot
+struct device_snapshot_value {
+    tracker_type type;
+
+    // Native string form of string, byte array, MAC, and UUID fields
+    std::string str;
+    mac_addr mac;
+
+    // Search transform of the field, if one is registered
+    bool has_xform;
+    std::string xform;
+};
+
+struct device_snapshot_record {
+    std::shared_ptr<kis_tracked_device_base> device;
+
+    // Values of each snapshot field, in snapshot field order; multi-path fields
+    // can have any number of values
+    std::vector<std::vector<device_snapshot_value>> values;
+};
+
+// Immutable copy of the searchable fields of a list of devices, so that read-only 
+// workers can match without locking the live devices.  Snapshots must be built 
+// under the device list lock, and are never modified once built.
+class device_tracker_view_snapshot {
+public:
+    device_tracker_view_snapshot(const std::vector<device_snapshot_field>& fields, 
+            const std::shared_ptr<tracker_element_vector>& devices);
+
+    time_t get_ts() const {
+        return ts;
+    }
+
+    const std::vector<device_snapshot_field>& get_fields() const {
+        return fields;
+    }
+
+    // Position of a field in the snapshot records, or -1 if it was not captured
+    int field_pos(const device_snapshot_field& field) const;
+
+    // Snapshot of a device, or nullptr if the device was not in the list when 
+    // the snapshot was taken
+    const device_snapshot_record *find(const kis_tracked_device_base *device) const;
+
+protected:
+    void capture(const shared_tracker_element& elem, std::vector<device_snapshot_value>& values);
+
+    time_t ts;
+    std::vector<device_snapshot_field> fields;
+    std::vector<device_snapshot_record> records;
+    robin_hood::unordered_flat_map<const kis_tracked_device_base *, size_t> record_map;
+};
+
 class device_tracker_view_worker {
 public:
     device_tracker_view_worker() {
@@ -52,6 +128,25 @@ public:
 
     virtual void finalize() { }
 
+    // Workers which can match devices from multiple threads at once may have the device
+    // list split across the device work threads
+    virtual bool is_thread_safe() const {
+        return false;
+    }
+
+    // Fields a read-only worker needs to match against a snapshot instead of the live
+    // devices; workers which return no fields always match the live devices
+    virtual std::vector<device_snapshot_field> snapshot_fields() const {
+        return {};
+    }
+
+    // Match a device snapshot; field_pos holds the position in the snapshot of each 
+    // field returned by snapshot_fields()
+    virtual bool match_snapshot(const device_snapshot_record& record, 
+            const std::vector<int>& field_pos) {
+        return false;
+    }
+
 protected:
     friend class device_tracker_view;
 
@@ -65,9 +160,12 @@ class device_tracker_view_function_worker : public device_tracker_view_worker {
 public:
     using filter_cb = std::function<bool (std::shared_ptr<kis_tracked_device_base>)>;
 
-    device_tracker_view_function_worker(filter_cb cb);
+    // Callbacks which are safe to call from multiple threads at once can set thread_safe
+    // to allow parallel matching
+    device_tracker_view_function_worker(filter_cb cb, bool thread_safe = false);
     device_tracker_view_function_worker(const device_tracker_view_function_worker& w) {
         filter = w.filter;
+        thread_safe = w.thread_safe;
         matched = w.matched;
     }
 
@@ -75,8 +173,13 @@ public:
 
     virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override;
 
+    virtual bool is_thread_safe() const override {
+        return thread_safe;
+    }
+
 protected:
     filter_cb filter;
+    bool thread_safe;
 };
 
 // Field:Regex matcher
@@ -87,6 +190,9 @@ public:
         pcre_filter(const std::string& target, const std::string& in_regex);
         ~pcre_filter();
 
+        // Safe to call from multiple threads at once
+        bool match(const std::string& val) const;
+
         std::string target;
         pcre *re;
         pcre_extra *study;
@@ -94,6 +200,9 @@ public:
         pcre_filter(const std::string& target, const std::string& in_regex);
         ~pcre_filter();
 
+        // Safe to call from multiple threads at once
+        bool match(const std::string& val) const;
+
         std::string target;
 
         pcre2_code *re;
@@ -122,6 +231,14 @@ public:
 
     virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override;
 
+    virtual bool is_thread_safe() const override {
+        return true;
+    }
+
+    virtual std::vector<device_snapshot_field> snapshot_fields() const override;
+    virtual bool match_snapshot(const device_snapshot_record& record, 
+            const std::vector<int>& field_pos) override;
+
 protected:
     std::vector<std::shared_ptr<device_tracker_view_regex_worker::pcre_filter>> filter_vec;
 
@@ -146,6 +263,14 @@ public:
 
     virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override;
 
+    virtual bool is_thread_safe() const override {
+        return true;
+    }
+
+    virtual std::vector<device_snapshot_field> snapshot_fields() const override;
+    virtual bool match_snapshot(const device_snapshot_record& record, 
+            const std::vector<int>& field_pos) override;
+
 protected:
     std::string query;
     std::vector<std::vector<int>> fieldpaths;
@@ -173,6 +298,14 @@ public:
 
     virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override;
 
+    virtual bool is_thread_safe() const override {
+        return true;
+    }
+
+    virtual std::vector<device_snapshot_field> snapshot_fields() const override;
+    virtual bool match_snapshot(const device_snapshot_record& record, 
+            const std::vector<int>& field_pos) override;
+
 protected:
     std::string query;
     std::vector<std::vector<int>> fieldpaths;
@@ -181,4 +314,80 @@ protected:
     unsigned int mac_query_term_len;
 };
 
+// Compiled filter expression, evaluated against resolved field paths.  Expressions are
+// JSON arrays of [operator, ...]:
+//
+//   ["and", expr, expr, ...], ["or", expr, expr, ...], ["not", expr]
+//   ["exists", field]
+//   ["==", field, value], ["!=", ...], ["<", ...], ["<=", ...], [">", ...], [">=", ...]
+//   ["prefix", field, string], ["contains", field, string], ["icontains", field, string]
+//   ["regex", field, pcre]
+//
+// Numeric values are compared numerically against numeric fields; string values are
+// compared against the string form of the field.  Missing fields never match.
+class device_filter_expression {
+public:
+    // Compile an expression, re-using the cached compilation of an identical expression.
+    // std::runtime_error may be thrown if there is a parsing failure
+    static std::shared_ptr<const device_filter_expression> compile(const nlohmann::json& expr);
+
+    device_filter_expression(const nlohmann::json& expr);
+
+    bool match(const std::shared_ptr<kis_tracked_device_base>& device) const;
+
+    // Are all of the field paths in the expression registered?
+    bool is_resolved() const {
+        return resolved;
+    }
+
+protected:
+    enum class filter_op {
+        op_and, op_or, op_not, op_exists,
+        op_eq, op_ne, op_lt, op_le, op_gt, op_ge,
+        op_prefix, op_contains, op_icontains, op_regex
+    };
+
+    struct filter_node {
+        filter_op op;
+        std::vector<filter_node> children;
+
+        std::vector<int> path;
+
+        bool numeric;
+        double num_value;
+        std::string str_value;
+
+        std::shared_ptr<device_tracker_view_regex_worker::pcre_filter> regex;
+    };
+
+    static filter_node parse(const nlohmann::json& expr);
+    static bool node_resolved(const filter_node& node);
+    static bool match_node(const filter_node& node, const std::shared_ptr<kis_tracked_device_base>& device);
+
+    filter_node root;
+    bool resolved;
+};
+
+// Filter devices by a compiled filter expression
+class device_tracker_view_filter_worker : public device_tracker_view_worker {
+public:
+    // std::runtime_error may be thrown if there is a parsing failure
+    device_tracker_view_filter_worker(const nlohmann::json& expr);
+    device_tracker_view_filter_worker(const device_tracker_view_filter_worker& w) {
+        expression = w.expression;
+        matched = w.matched;
+    }
+
+    virtual ~device_tracker_view_filter_worker() { }
+
+    virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override;
+
+    virtual bool is_thread_safe() const override {
+        return true;
+    }
+
+protected:
+    std::shared_ptr<const device_filter_expression> expression;
+};
+
 #endif
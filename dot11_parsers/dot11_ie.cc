@@ -31,10 +31,33 @@ void dot11_ie::parse(std::shared_ptr<kaitai::kstream> p_io) {
     }
 }
 
+bool dot11_ie::parse(nonstd::string_view in_buf) {
+    m_tags = Globalreg::new_from_pool<shared_ie_tag_vector>();
+    m_tags_map = Globalreg::new_from_pool<shared_ie_tag_map>();
+
+    dot11_ie_view view(in_buf);
+
+    for (const auto& v : view) {
+        auto t = Globalreg::new_from_pool<dot11_ie_tag>();
+        t->parse(v.num, v.data);
+        m_tags->push_back(t);
+        (*m_tags_map)[t->tag_num()] = t;
+    }
+
+    return !view.truncated();
+}
+
 void dot11_ie::dot11_ie_tag::parse(std::shared_ptr<kaitai::kstream> p_io) {
     m_tag_num = p_io->read_u1();
     m_tag_len = p_io->read_u1();
     m_tag_data = p_io->read_bytes(tag_len());
+    m_tag_view = nonstd::string_view(m_tag_data.data(), m_tag_data.length());
     m_tag_data_stream.reset(new kaitai::kstream(m_tag_data));
 }
 
+void dot11_ie::dot11_ie_tag::parse(uint8_t in_num, nonstd::string_view in_data) {
+    m_tag_num = in_num;
+    m_tag_len = in_data.length();
+    m_tag_view = in_data;
+}
+
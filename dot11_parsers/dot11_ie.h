@@ -21,8 +21,10 @@
 
 /* Parse a dot11 ie stream into individual objects.
  *
- * This uses the kaitai stream buffer from the kaitai runtime as it is a 
- * solid implementation of buffer-bounded operations and data extraction.
+ * The tags are normally split directly out of the frame; each tag references its
+ * data in the packet and only builds a kaitai stream for the tag parsers when one
+ * is asked for.  Parsing through the kaitai stream buffer copies every tag, and
+ * is kept for validating the in-place parser (dot11_legacy_ie_parser).
  *
  * Much of this is modeled on how kaitai generates parsers.
  *
@@ -34,6 +36,95 @@
 #include <unordered_map>
 #include <kaitai/kaitaistream.h>
 #include "multi_constexpr.h"
+#include "string_view.hpp"
+
+// Bounds-checked walk of the IE tags in a buffer, without copying or allocating
+//
+//    for (auto t : dot11_ie_view(data)) { ... }
+//
+// The walk stops at the first tag which runs past the end of the buffer; truncated()
+// reports if the buffer ended inside a tag.
+class dot11_ie_view {
+public:
+    struct tag {
+        uint8_t num;
+        nonstd::string_view data;
+    };
+
+    class iterator {
+    public:
+        iterator(nonstd::string_view in_buf) :
+            buf{in_buf} {
+            next();
+        }
+
+        const tag& operator*() const { return cur; }
+        const tag *operator->() const { return &cur; }
+
+        iterator& operator++() {
+            next();
+            return *this;
+        }
+
+        bool operator!=(const iterator& rhs) const {
+            return valid != rhs.valid || buf.data() != rhs.buf.data();
+        }
+
+    protected:
+        void next() {
+            valid = buf.length() >= 2 && (size_t) (uint8_t) buf[1] + 2 <= buf.length();
+
+            if (!valid) {
+                buf = nonstd::string_view{};
+                return;
+            }
+
+            cur.num = (uint8_t) buf[0];
+            cur.data = buf.substr(2, (uint8_t) buf[1]);
+            buf.remove_prefix(2 + cur.data.length());
+        }
+
+        nonstd::string_view buf;
+        tag cur;
+        bool valid;
+    };
+
+    dot11_ie_view(nonstd::string_view in_buf) :
+        buf{in_buf} { }
+
+    iterator begin() const { return iterator(buf); }
+    iterator end() const { return iterator(nonstd::string_view{}); }
+
+    bool truncated() const {
+        auto b = buf;
+
+        while (b.length() >= 2) {
+            size_t l = (size_t) (uint8_t) b[1] + 2;
+
+            if (l > b.length())
+                return true;
+
+            b.remove_prefix(l);
+        }
+
+        return b.length() != 0;
+    }
+
+    // Vendor OUI and OUI type of an IE 150 or IE 221 vendor tag, as the kaitai vendor
+    // parsers report them; false if the tag is too short for an OUI
+    static bool vendor_oui(nonstd::string_view in_data, uint32_t& oui, uint8_t& oui_type) {
+        if (in_data.length() < 3)
+            return false;
+
+        oui = ((uint8_t) in_data[0] << 16) + ((uint8_t) in_data[1] << 8) + (uint8_t) in_data[2];
+        oui_type = in_data.length() > 3 ? (uint8_t) in_data[3] : 0;
+
+        return true;
+    }
+
+protected:
+    nonstd::string_view buf;
+};
 
 class dot11_ie {
 public:
@@ -51,6 +142,10 @@ public:
 
     void parse(std::shared_ptr<kaitai::kstream> p_io);
 
+    // Split the tags out of the frame in place; the tags reference the buffer, which
+    // must outlive them.  Returns false if the last tag is truncated.
+    bool parse(nonstd::string_view in_buf);
+
     std::shared_ptr<shared_ie_tag_vector> tags() const {
         return m_tags;
     }
@@ -75,6 +170,7 @@ public:
         ~dot11_ie_tag() { }
 
         void parse(std::shared_ptr<kaitai::kstream> p_io);
+        void parse(uint8_t in_num, nonstd::string_view in_data);
 
         constexpr17 uint8_t tag_num() const {
             return m_tag_num;
@@ -85,10 +181,19 @@ public:
         }
 
         std::string tag_data() const {
-            return m_tag_data;
+            return std::string(m_tag_view.data(), m_tag_view.length());
+        }
+
+        // Tag data without copying it
+        nonstd::string_view tag_data_view() const {
+            return m_tag_view;
         }
 
+        // Stream for the kaitai tag parsers, built the first time it's needed
         std::shared_ptr<kaitai::kstream> tag_data_stream() const {
+            if (m_tag_data_stream == nullptr)
+                m_tag_data_stream.reset(new kaitai::kstream(tag_data()));
+
             return m_tag_data_stream;
         }
 
@@ -96,14 +201,17 @@ public:
             m_tag_num = 0;
             m_tag_len = 0;
             m_tag_data = "";
+            m_tag_view = nonstd::string_view{};
             m_tag_data_stream.reset();
         }
 
     protected:
         uint8_t m_tag_num;
         uint8_t m_tag_len;
+        // Only holds the data when parsed from a kaitai stream
         std::string m_tag_data;
-        std::shared_ptr<kaitai::kstream> m_tag_data_stream;
+        nonstd::string_view m_tag_view;
+        mutable std::shared_ptr<kaitai::kstream> m_tag_data_stream;
     };
 
 };
@@ -16,19 +16,24 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <algorithm>
+#include <set>
+
+#include "channeltracker2.h"
 #include "configfile.h"
 #include "datasourcetracker.h"
 #include "devicetracker.h"
 #include "dot11_ssidscan.h"
 #include "entrytracker.h"
+#include "phy_80211.h"
 
-dot11_ssid_scan::dot11_ssid_scan() {
+dot11_ssid_scan::dot11_ssid_scan() :
+    replan_pending{false} {
     mutex.set_name("dot11_ssid_scan");
 
     timetracker = 
         Globalreg::fetch_mandatory_global_as<time_tracker>();
-    hopping_mode_end_timer = -1;
-    capture_mode_end_timer = -1;
+    schedule_timer = -1;
 
     auto entrytracker = 
         Globalreg::fetch_mandatory_global_as<entry_tracker>();
@@ -43,6 +48,9 @@ dot11_ssid_scan::dot11_ssid_scan() {
     databaselog =
         Globalreg::fetch_mandatory_global_as<kis_database_logfile>();
 
+    // The dot11 phy registers its device record before we're created
+    dot11_device_entry_id = entrytracker->get_field_id("dot11.device");
+
     // We aren't a tracked component so we register our sub elements directly
     ssidscan_enabled =
         entrytracker->register_and_get_field_as<tracker_element_uint8>("dot11.ssidscan.enabled",
@@ -59,11 +67,6 @@ dot11_ssid_scan::dot11_ssid_scan() {
                 tracker_element_factory<tracker_element_vector>(),
                 "Usable datasource pool (UUIDs)");
 
-    ssidscan_datasources =
-        entrytracker->register_and_get_field_as<tracker_element_vector>("dot11.ssidscan.datasources",
-                tracker_element_factory<tracker_element_vector>(),
-                "Active datasource pool");
-
     ignore_after_handshake =
         entrytracker->register_and_get_field_as<tracker_element_uint8>("dot11.ssidscan.ignore_after_handshake",
             tracker_element_factory<tracker_element_uint8>(),
@@ -89,18 +92,28 @@ dot11_ssid_scan::dot11_ssid_scan() {
             tracker_element_factory<tracker_element_uint8>(),
             "Automatically configure log filters to pass target devices");
 
+    sighting_window =
+        entrytracker->register_and_get_field_as<tracker_element_uint32>("dot11.ssidscan.sighting_window",
+            tracker_element_factory<tracker_element_uint32>(),
+            "Seconds a sighting of a target keeps its channel a candidate for locking");
+
     auto config = Globalreg::globalreg->kismet_config;
 
     ssidscan_enabled->set(config->fetch_opt_bool("dot11_ssidscan_enabled", false));
 
     for (auto s : config->fetch_opt_vec("dot11_ssidscan_ssid")) {
-        target_ssids->push_back(s);
+        try {
+            target_regexes.push_back(std::regex(s));
+            target_ssids->push_back(s);
+        } catch (const std::regex_error& e) {
+            _MSG_ERROR("Ignoring invalid dot11_ssidscan_ssid '{}': {}", s, e.what());
+        }
     }
 
     for (auto hu : config->fetch_opt_vec("dot11_ssidscan_datasource")) {
         auto hu_uuid = 
-            std::make_shared<tracker_element_uuid>(uuid(hu));
-        ssidscan_datasources->push_back(hu_uuid);
+            std::make_shared<tracker_element_uuid>(0, uuid(hu));
+        ssidscan_datasources_uuids->push_back(hu_uuid);
     }
 
     ignore_after_handshake->set(config->fetch_opt_bool("dot11_ssidscan_ignore_after_handshake", true));
@@ -110,6 +123,7 @@ dot11_ssid_scan::dot11_ssid_scan() {
 
     min_scan_seconds->set(config->fetch_opt_uint("dot11_ssidscan_minimum_hop", 30));
     max_contend_cap_seconds->set(config->fetch_opt_uint("dot11_ssidscan_maximum_lock", 30));
+    sighting_window->set(std::max(1U, config->fetch_opt_uint("dot11_ssidscan_sighting_window", 120)));
 
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
@@ -122,9 +136,10 @@ dot11_ssid_scan::dot11_ssid_scan() {
     status_map->insert(filter_logs);
     status_map->insert(min_scan_seconds);
     status_map->insert(max_contend_cap_seconds);
+    status_map->insert(sighting_window);
 
     httpd->register_route("/phy/phy80211/ssidscan/status", {"GET", "POST"}, httpd->RO_ROLE, {},
-            std::make_shared<kis_net_web_tracked_endpoint>(status_map, &mutex));
+            std::make_shared<kis_net_web_tracked_endpoint>(status_map, mutex));
 
     httpd->register_route("/phy/phy80211/ssidscan/config", {"POST"}, httpd->LOGON_ROLE, {"cmd"},
             std::make_shared<kis_net_web_function_endpoint>(
@@ -132,12 +147,18 @@ dot11_ssid_scan::dot11_ssid_scan() {
                     return config_endp_handler(con);
                 }));
 
-    // Make the views with no completion functions, we maintain them manually
+    // The target view matches devices advertising a target SSID; the completed view
+    // has no completion functions, we maintain it manually
     target_devices_view =
         std::make_shared<device_tracker_view>(
                 "phydot11_ssidscan_targets",
                 "Devices matching ssid scan targets",
-                nullptr, nullptr);
+                [this](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
+                    return match_target_device(dev);
+                },
+                [this](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
+                    return match_target_device(dev);
+                });
     devicetracker->add_view(target_devices_view);
 
     completed_device_view =
@@ -148,59 +169,475 @@ dot11_ssid_scan::dot11_ssid_scan() {
     devicetracker->add_view(completed_device_view);
 
     eventbus_id =
-        eventbus->register_listener("NEW_DATASOURCE",
+        eventbus->register_listener(datasource_tracker::event_new_datasource(),
                 [this](std::shared_ptr<eventbus_event> evt) { handle_eventbus_evt(evt); });
 
+    schedule_timer =
+        timetracker->register_timer(std::chrono::seconds(1), true, 
+                [this](int) -> int {
+                    schedule_sources();
+                    return 1;
+                });
 }
 
 dot11_ssid_scan::~dot11_ssid_scan() {
-    eventbus->remove_listener(eventbus_id);
-    timetracker->remove_timer(hopping_mode_end_timer);
-    timetracker->remove_timer(capture_mode_end_timer);
+    Globalreg::globalreg->remove_global(global_name());
 
+    eventbus->remove_listener(eventbus_id);
+    timetracker->remove_timer(schedule_timer);
 }
 
 void dot11_ssid_scan::handle_eventbus_evt(std::shared_ptr<eventbus_event> evt) {
-    auto source_evt = 
-        std::static_pointer_cast<datasource_tracker::event_new_datasource>(evt);
+    auto ds_k = evt->get_event_content()->find(datasource_tracker::event_new_datasource());
+
+    if (ds_k == evt->get_event_content()->end())
+        return;
+
+    auto datasource = std::static_pointer_cast<kis_datasource>(ds_k->second);
+
+    // A new or re-opened source starts hopping with the channels it was given, so
+    // it starts over with its minimum scan time
+    kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan new datasource");
+    source_schedule_map.erase(datasource->get_source_uuid());
+    previous_datasource_hop_map.erase(datasource->get_source_uuid());
+}
+
+bool dot11_ssid_scan::ssid_matches(const std::string& in_ssid) {
+    for (const auto& r : target_regexes) {
+        if (std::regex_search(in_ssid, r))
+            return true;
+    }
+
+    return false;
+}
+
+bool dot11_ssid_scan::match_target_device(std::shared_ptr<kis_tracked_device_base> dev) {
+    if (target_regexes.size() == 0)
+        return false;
+
+    auto dot11 = dev->get_sub_as<dot11_tracked_device>(dot11_device_entry_id);
+
+    if (dot11 == nullptr || !dot11->has_advertised_ssid_map())
+        return false;
+
+    bool matched = false;
+
+    for (const auto& s : *dot11->get_advertised_ssid_map()) {
+        auto ssid = std::static_pointer_cast<dot11_advertised_ssid>(s.second);
+
+        if (ssid_matches(ssid->get_ssid())) {
+            matched = true;
+            break;
+        }
+    }
+
+    if (!matched)
+        return false;
+
+    kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan match_target_device");
+
+    if (target_map.find(dev->get_macaddr()) == target_map.end()) {
+        _MSG_INFO("SSID scan found target network {} on channel {}", 
+                dev->get_macaddr(), dev->get_channel());
+
+        target_map[dev->get_macaddr()] = 
+            target_device{dev, dev->get_channel(), dev->get_last_time(), false};
+    }
+
+    return true;
+}
+
+bool dot11_ssid_scan::device_handshake_complete(std::shared_ptr<dot11_tracked_device> dot11) {
+    if (dot11->get_pmkid_present())
+        return true;
+
+    if (!dot11->has_wpa_key_map())
+        return false;
+
+    // Message 2 carries the client nonce and MIC; with the AP nonce from message 1
+    // or 3 it's enough to work with
+    for (const auto& k : *dot11->get_wpa_key_map()) {
+        auto keys = std::static_pointer_cast<tracker_element_vector>(k.second);
+        uint8_t keymask = 0;
+
+        for (const auto& ki : *keys) 
+            keymask |= (1 << static_cast<dot11_tracked_eapol *>(ki.get())->get_eapol_msg_num());
+
+        if ((keymask & (1 << 2)) && (keymask & ((1 << 1) | (1 << 3))))
+            return true;
+    }
+
+    return false;
+}
+
+void dot11_ssid_scan::refresh_targets() {
+    auto devicetracker = Globalreg::fetch_global_as<device_tracker>();
+
+    if (devicetracker == nullptr)
+        return;
+
+    // Same order as the view callbacks, device list first
+    kis_lock_guard<kis_mutex> dev_lk(devicetracker->get_devicelist_mutex(), 
+            "dot11_ssid_scan refresh_targets");
+    kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan refresh_targets");
+
+    for (auto ti = target_map.begin(); ti != target_map.end(); ) {
+        auto dev = ti->second.device.lock();
+
+        if (dev == nullptr) {
+            ti = target_map.erase(ti);
+            continue;
+        }
+
+        ti->second.channel = dev->get_channel();
+        ti->second.last_time = dev->get_last_time();
+
+        if (!ti->second.completed && ignore_after_handshake->get()) {
+            auto dot11 = dev->get_sub_as<dot11_tracked_device>(dot11_device_entry_id);
+
+            if (dot11 != nullptr && device_handshake_complete(dot11)) {
+                _MSG_INFO("SSID scan captured a handshake for target network {}, no longer "
+                        "scheduling captures for it", dev->get_macaddr());
+                ti->second.completed = true;
+                completed_device_view->add_device_direct(dev);
+            }
+        }
+
+        ++ti;
+    }
+}
+
+std::map<std::string, double> dot11_ssid_scan::score_channels(time_t now) {
+    std::map<std::string, double> scores;
+
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan score_channels");
+
+        double window = sighting_window->get();
+
+        // Recent sightings count the most, fading out over the sighting window
+        for (const auto& t : target_map) {
+            if (t.second.completed || t.second.channel.length() == 0)
+                continue;
+
+            double age = now - t.second.last_time;
+
+            if (age < 0)
+                age = 0;
+
+            if (age >= window)
+                continue;
+
+            scores[datasource_tracker::hop_planner_base_channel(t.second.channel)] += 
+                1.0 - (age / window);
+        }
+    }
+
+    if (scores.size() == 0)
+        return scores;
+
+    // Of the channels with targets, busier channels are more likely to have clients
+    // associating, which is when the handshake we want is sent
+    auto chantracker = Globalreg::fetch_global_as<channel_tracker_v2>();
+
+    if (chantracker == nullptr)
+        return scores;
+
+    std::map<std::string, unsigned int> devices;
+    unsigned int max_devices = 0;
+
+    for (const auto& a : chantracker->get_channel_activity()) {
+        auto& d = devices[datasource_tracker::hop_planner_base_channel(a.first)];
+        d += a.second.devices;
+        max_devices = std::max(max_devices, d);
+    }
+
+    if (max_devices == 0)
+        return scores;
+
+    for (auto& s : scores) {
+        auto di = devices.find(s.first);
+
+        if (di != devices.end())
+            s.second *= 1.0 + ((double) di->second / max_devices);
+    }
+
+    return scores;
+}
+
+void dot11_ssid_scan::schedule_sources() {
+    auto datasourcetracker = Globalreg::fetch_global_as<datasource_tracker>();
+
+    if (datasourcetracker == nullptr)
+        return;
+
+    // Re-plan once the sources have acknowledged the last round of changes, so the
+    // planner sees the sources we locked as locked
+    if (replan_pending.exchange(false))
+        datasourcetracker->replan_channel_hopping();
+
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan schedule_sources");
+        if (!ssidscan_enabled->get())
+            return;
+    }
+
+    refresh_targets();
+
+    auto now = time(0);
+    auto scores = score_channels(now);
+
+    // Resolve the pool; every source which can hop when no sources are configured
+    std::vector<uuid> pool_uuids;
+
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan schedule_sources");
+
+        for (const auto& u : *ssidscan_datasources_uuids) 
+            pool_uuids.push_back(std::static_pointer_cast<tracker_element_uuid>(u)->get());
+    }
+
+    std::vector<shared_datasource> pool;
+
+    if (pool_uuids.size() == 0) {
+        class pool_worker : public datasource_tracker_worker {
+        public:
+            pool_worker(std::vector<shared_datasource>& pool) :
+                pool{pool} { }
+
+            virtual void handle_datasource(std::shared_ptr<kis_datasource> in_src) override {
+                pool.push_back(in_src);
+            }
+
+            std::vector<shared_datasource>& pool;
+        };
+
+        pool_worker worker(pool);
+        datasourcetracker->iterate_datasources(&worker);
+    } else {
+        for (const auto& u : pool_uuids) {
+            auto ds = datasourcetracker->find_datasource(u);
+
+            if (ds != nullptr)
+                pool.push_back(ds);
+        }
+    }
+
+    pool.erase(std::remove_if(pool.begin(), pool.end(), 
+                [](const shared_datasource& ds) {
+                    return !ds->get_source_running() || 
+                        !ds->get_source_builder()->get_tune_capable() ||
+                        !ds->get_source_builder()->get_hop_capable();
+                }), pool.end());
+
+    std::vector<std::pair<shared_datasource, std::string>> lock_sources;
+    std::vector<shared_datasource> release_sources;
+
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan schedule_sources");
+
+        // Forget sources which have left the pool
+        for (auto si = source_schedule_map.begin(); si != source_schedule_map.end(); ) {
+            auto pi = std::find_if(pool.begin(), pool.end(), 
+                    [&si](const shared_datasource& ds) {
+                        return ds->get_source_uuid() == si->first;
+                    });
+
+            if (pi == pool.end()) {
+                previous_datasource_hop_map.erase(si->first);
+                si = source_schedule_map.erase(si);
+            } else {
+                ++si;
+            }
+        }
+
+        // Each source in the pool dwells on a different channel
+        std::set<std::string> dwelling;
+
+        for (const auto& s : source_schedule_map) {
+            if (s.second.dwell_start != 0)
+                dwelling.insert(s.second.dwell_channel);
+        }
+
+        for (const auto& ds : pool) {
+            auto si = source_schedule_map.find(ds->get_source_uuid());
+
+            if (si == source_schedule_map.end())
+                si = source_schedule_map.insert(std::make_pair(ds->get_source_uuid(),
+                            source_schedule{now, 0, ""})).first;
+
+            auto& sched = si->second;
+
+            if (sched.dwell_start != 0) {
+                // Release once the targets on the channel are captured or haven't been
+                // seen in the sighting window, or when we've dwelled long enough
+                bool expired = now - sched.dwell_start >= (time_t) max_contend_cap_seconds->get();
+
+                if (expired || scores.find(sched.dwell_channel) == scores.end()) {
+                    if (expired)
+                        _MSG_INFO("SSID scan returning source '{}' to hopping, no handshake "
+                                "was seen on channel {} within {} seconds", ds->get_source_name(),
+                                sched.dwell_channel, max_contend_cap_seconds->get());
+                    else
+                        _MSG_INFO("SSID scan returning source '{}' to hopping, no targets "
+                                "left to capture on channel {}", ds->get_source_name(),
+                                sched.dwell_channel);
+
+                    dwelling.erase(sched.dwell_channel);
+                    sched.dwell_start = 0;
+                    sched.dwell_channel = "";
+                    sched.hop_start = now;
+
+                    release_sources.push_back(ds);
+                }
+
+                continue;
+            }
+
+            // Sources the user has locked are left alone
+            if (!ds->get_source_hopping()) {
+                sched.hop_start = now;
+                continue;
+            }
+
+            if (now - sched.hop_start < (time_t) min_scan_seconds->get())
+                continue;
+
+            std::string best_chan;
+            std::string best_base;
+            double best_score = 0;
+
+            for (const auto& c : *ds->get_source_hop_vec()) {
+                auto base = datasource_tracker::hop_planner_base_channel(c);
+
+                if (dwelling.find(base) != dwelling.end())
+                    continue;
+
+                auto sc = scores.find(base);
+
+                if (sc != scores.end() && sc->second > best_score) {
+                    best_score = sc->second;
+                    best_chan = c;
+                    best_base = base;
+                }
+            }
+
+            if (best_chan.length() == 0)
+                continue;
 
+            dwelling.insert(best_base);
+            sched.dwell_start = now;
+            sched.dwell_channel = best_base;
+
+            lock_sources.push_back(std::make_pair(ds, best_chan));
+        }
+    }
+
+    for (const auto& ds : release_sources)
+        release_source(ds);
+
+    for (const auto& l : lock_sources)
+        lock_source(l.first, l.second);
+}
+
+void dot11_ssid_scan::lock_source(std::shared_ptr<kis_datasource> source, 
+        const std::string& in_channel) {
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan lock_source");
+
+        auto hop_vec = source->get_source_hop_vec();
+
+        previous_datasource_hop_map[source->get_source_uuid()] = 
+            datasource_state{source->get_source_hop_rate(), 
+                std::vector<std::string>(hop_vec->begin(), hop_vec->end()),
+                source->get_source_hop_shuffle(), source->get_source_hop_offset()};
+    }
+
+    _MSG_INFO("SSID scan locking source '{}' to channel {} to capture target networks",
+            source->get_source_name(), in_channel);
+
+    auto name = source->get_source_name();
+
+    source->set_channel(in_channel, 0, 
+            [this, name](unsigned int, bool success, std::string msg) {
+                if (!success)
+                    _MSG_ERROR("SSID scan could not lock source '{}': {}", name, msg);
+
+                replan_pending = true;
+            });
+}
+
+void dot11_ssid_scan::release_source(std::shared_ptr<kis_datasource> source) {
+    datasource_state state;
+
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan release_source");
+
+        auto si = previous_datasource_hop_map.find(source->get_source_uuid());
+
+        if (si == previous_datasource_hop_map.end())
+            return;
+
+        state = si->second;
+        previous_datasource_hop_map.erase(si);
+    }
+
+    auto name = source->get_source_name();
+
+    source->set_channel_hop(state.hop_rate, state.source_hop_vec, state.hop_shuffle,
+            state.hop_offset, 0,
+            [this, name](unsigned int, bool success, std::string msg) {
+                if (!success)
+                    _MSG_ERROR("SSID scan could not return source '{}' to hopping: {}", name, msg);
+
+                replan_pending = true;
+            });
 }
 
 void dot11_ssid_scan::config_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
     std::ostream stream(&con->response_stream());
 
-    if (!con->json()["ssidscan_enabled"].isNull()) {
-        auto enabled = con->json()["ssidscan_enabled"].asBool();
+    auto& json = con->json();
 
-        if (enabled != ssidscan_enabled->get()) {
+    if (json.contains("ssidscan_enabled") && !json["ssidscan_enabled"].is_null()) {
+        auto enabled = json["ssidscan_enabled"].get<bool>();
+
+        if (enabled != (bool) ssidscan_enabled->get()) {
             if (enabled) {
                 _MSG_INFO("Enabling ssidscan module, this will change the behavior of datasources and logs.");
                 enable_ssidscan();
             } else {
-                _MSG_INFO("Disabling ssidscan module, data sources may remain in unexpected states.");
+                _MSG_INFO("Disabling ssidscan module, returning datasources to hopping.");
                 disable_ssidscan();
             }
         }
     }
 
-    if (!con->json()["ignore_after_handshake"].isNull())
-        ignore_after_handshake->set(con->json()["ignore_after_handshake"].asBool());
+    kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan config_endp_handler");
+
+    if (json.contains("ignore_after_handshake") && !json["ignore_after_handshake"].is_null())
+        ignore_after_handshake->set(json["ignore_after_handshake"].get<bool>());
+
+    if (json.contains("max_capture_seconds") && !json["max_capture_seconds"].is_null()) 
+        max_contend_cap_seconds->set(json["max_capture_seconds"].get<unsigned int>());
 
-    if (!con->json()["max_capture_seconds"].isNull()) 
-        max_contend_cap_seconds->set(con->json()["max_capture_seconds"].asBool());
+    if (json.contains("min_scan_seconds") && !json["min_scan_seconds"].is_null()) 
+        min_scan_seconds->set(json["min_scan_seconds"].get<unsigned int>());
 
-    if (!con->json()["min_scan_seconds"].isNull()) 
-        min_scan_seconds->set(con->json()["min_scan_seconds"].asBool());
+    if (json.contains("sighting_window") && !json["sighting_window"].is_null()) 
+        sighting_window->set(std::max(1U, json["sighting_window"].get<unsigned int>()));
 
-    if (con->json()["restrict_log_filters"].isNull()) {
-        auto enabled = con->json()["restrict_log_filters"].asBool();
+    if (json.contains("restrict_log_filters") && !json["restrict_log_filters"].is_null()) {
+        auto enabled = json["restrict_log_filters"].get<bool>();
 
-        if (enabled != filter_logs->get()) {
+        if (enabled != (bool) filter_logs->get()) {
             filter_logs->set(enabled);
 
             // TODO set filters for all existing devices
         } 
     }
+
+    stream << "OK\n";
 }
 
 bool dot11_ssid_scan::enable_ssidscan() {
@@ -208,15 +645,39 @@ bool dot11_ssid_scan::enable_ssidscan() {
 
     ssidscan_enabled->set(true);
 
+    // Every source starts with its minimum scan time
+    source_schedule_map.clear();
 
-    return false;
+    return true;
 }
 
 bool dot11_ssid_scan::disable_ssidscan() {
-    kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan disable_ssidscan");
+    auto datasourcetracker = Globalreg::fetch_global_as<datasource_tracker>();
 
-    ssidscan_enabled->set(true);
+    std::vector<uuid> locked;
 
-    return false;
-}
+    {
+        kis_lock_guard<kis_mutex> lk(mutex, "dot11_ssid_scan disable_ssidscan");
 
+        ssidscan_enabled->set(false);
+
+        for (const auto& s : source_schedule_map) {
+            if (s.second.dwell_start != 0)
+                locked.push_back(s.first);
+        }
+
+        source_schedule_map.clear();
+    }
+
+    if (datasourcetracker == nullptr)
+        return true;
+
+    for (const auto& u : locked) {
+        auto ds = datasourcetracker->find_datasource(u);
+
+        if (ds != nullptr)
+            release_source(ds);
+    }
+
+    return true;
+}
@@ -21,25 +21,36 @@
 
 #include "config.h"
 
+#include <atomic>
+#include <map>
+#include <regex>
+#include <vector>
+
 #include "devicetracker_view.h"
 #include "eventbus.h"
 #include "globalregistry.h"
+#include "kis_datasource.h"
 #include "kis_databaselogfile.h"
 #include "timetracker.h"
 #include "trackedelement.h"
 #include "trackedcomponent.h"
 
+class dot11_tracked_device;
+
 /* SSID scan mode
  *
  * 1.  Take a list of SSIDs (or SSID regexes), and optionally a list of 
- *     hopping and locking sources
+ *     datasources to use
  * 2.  Channel hop looking for devices advertising the SSID
- * 3.  Lock a source to the channel, set a log filter to enable logging the 
- *     target bssid device and packets, and capture data about the target 
+ * 3.  Lock a source to the channel where targets were most recently seen, 
+ *     weighted by how busy the channel is, and capture data about the target 
  *     bssid until a WPA handshake is seen or the maximum lock time has
  *     expired
  * 4.  Continue hopping
  *
+ * Sources in the pool dwell on different channels, and the channel hop planner
+ * re-plans the sources still hopping whenever one is locked or released.
+ *
  *
  * Configuration options:
  *
@@ -49,11 +60,9 @@
  * Target SSIDs
  * multiple/vector: dot11_ssidscan_ssid=....(regex) 
  *
- * Datasource UUIDs to use for hopping
- * multiple/vector: dot11_ssidscan_hop_datasource=...
- *
- * Datasource UUIDs to use for locking
- * multiple/vector: dot11_ssidscan_lock_datasource=...
+ * Datasource UUIDs to use; when none are given, every source which can hop
+ * is used
+ * multiple/vector: dot11_ssidscan_datasource=...
  *
  * Block initial logging of devices & packets and only log ours
  * bool: dot11_ssidscan_block_logging=true
@@ -71,6 +80,9 @@
  * capture a handshake
  * uint: dot11_ssidscan_maximum_lock=123
  *
+ * How long a sighting of a target keeps its channel worth dwelling on
+ * uint: dot11_ssidscan_sighting_window=123
+ *
  *
  * Endpoints
  * GET  AUTH /phy/phy80211/ssidscan/status.json
@@ -106,9 +118,8 @@ protected:
     // Target SSIDs
     std::shared_ptr<tracker_element_vector_string> target_ssids;
 
-    // Datasources we use; wanted UUIDs and actual sources
+    // Datasources we use, by UUID
     std::shared_ptr<tracker_element_vector> ssidscan_datasources_uuids;
-    std::shared_ptr<tracker_element_vector> ssidscan_datasources;
 
     // Do we ignore a target bssid after we think we got a handshake?
     std::shared_ptr<tracker_element_uint8> ignore_after_handshake;
@@ -129,6 +140,13 @@ protected:
     // and just manipulate the sources
     std::shared_ptr<tracker_element_uint8> filter_logs;
 
+    // Seconds a sighting of a target counts towards dwelling on its channel
+    std::shared_ptr<tracker_element_uint32> sighting_window;
+
+    // Compiled target_ssids
+    std::vector<std::regex> target_regexes;
+    bool ssid_matches(const std::string& in_ssid);
+
     // Configure set endp
     void config_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
 
@@ -140,15 +158,48 @@ protected:
     // seen a wpa handshake
     std::shared_ptr<device_tracker_view> completed_device_view;
 
-    std::shared_ptr<time_tracker> timetracker;
-    int hopping_mode_end_timer;
-    int capture_mode_end_timer;
+    // View callbacks; called with the device list locked
+    bool match_target_device(std::shared_ptr<kis_tracked_device_base> dev);
+
+    // Target devices, and where and when we last saw them
+    struct target_device {
+        std::weak_ptr<kis_tracked_device_base> device;
+        std::string channel;
+        time_t last_time;
+        bool completed;
+    };
+    std::map<mac_addr, target_device> target_map;
+
+    int dot11_device_entry_id;
+
+    // Refresh the target records from the devices; takes the device list lock
+    void refresh_targets();
 
-    struct source_timers {
-        time_t end_hop_time;
-        time_t end_dwell_time;
+    // A handshake we can use, or a PMKID
+    bool device_handshake_complete(std::shared_ptr<dot11_tracked_device> dot11);
+
+    std::shared_ptr<time_tracker> timetracker;
+    int schedule_timer;
+
+    // Lock and release pool sources; runs every second
+    void schedule_sources();
+
+    // Score of the channels worth dwelling on, by base channel name
+    std::map<std::string, double> score_channels(time_t now);
+
+    // Per-source scheduling state
+    struct source_schedule {
+        // When the source last started hopping
+        time_t hop_start;
+        // When the source was locked, and the channel it's dwelling on, or 0 if
+        // it's hopping
+        time_t dwell_start;
+        std::string dwell_channel;
     };
-    std::map<int, source_timers> source_id_timer_map;
+    std::map<uuid, source_schedule> source_schedule_map;
+
+    // Sources were locked or released, and the hop planner has to spread the rest
+    std::atomic<bool> replan_pending;
 
     // event_bus subscription for new datasources
     std::shared_ptr<event_bus> eventbus;
@@ -164,16 +215,18 @@ protected:
 
     // Original state for interfaces
     struct datasource_state {
-        bool hopping;
-        std::shared_ptr<tracker_element_vector> source_hop_vec;
-        std::string source_channel;
+        double hop_rate;
+        std::vector<std::string> source_hop_vec;
+        bool hop_shuffle;
+        unsigned int hop_offset;
     };
     std::map<uuid, datasource_state> previous_datasource_hop_map;
 
+    void lock_source(std::shared_ptr<kis_datasource> source, const std::string& in_channel);
+    void release_source(std::shared_ptr<kis_datasource> source);
+
     bool enable_ssidscan();
     bool disable_ssidscan();
-
-
 };
 
 #endif /* ifndef PHY_80211_SSIDSCAN */
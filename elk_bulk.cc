@@ -0,0 +1,475 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+#include "boost/asio.hpp"
+#include "boost/beast.hpp"
+
+#include "base64.h"
+#include "elk_bulk.h"
+#include "fmt.h"
+#include "nlohmann/json.hpp"
+
+// Shortest backoff after the cluster rejects a request; it doubles on each retry
+#define ELK_BULK_BACKOFF_MS     250
+
+// A connection to the cluster, and the buffer its batches are compressed into
+struct elk_bulk_connection {
+    elk_bulk_connection(int gzip_level) :
+        resolver{ioc},
+        stream{ioc},
+        connected{false},
+        zs_active{false} {
+
+        memset(&zs, 0, sizeof(z_stream));
+
+        // A window of 15 bits plus 16 writes a gzip header and trailer
+        if (gzip_level > 0 &&
+                deflateInit2(&zs, gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+            zs_active = true;
+    }
+
+    ~elk_bulk_connection() {
+        close();
+
+        if (zs_active)
+            deflateEnd(&zs);
+    }
+
+    void close() {
+        if (connected) {
+            boost::system::error_code ec;
+            stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            stream.close();
+        }
+
+        connected = false;
+    }
+
+    // Compress a body into the compressed buffer; throws std::runtime_error
+    const std::string& compress(const std::string& body) {
+        deflateReset(&zs);
+
+        compressed.resize(deflateBound(&zs, body.length()));
+
+        zs.next_in = (Bytef *) body.data();
+        zs.avail_in = body.length();
+        zs.next_out = (Bytef *) &compressed[0];
+        zs.avail_out = compressed.length();
+
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+            throw std::runtime_error("unable to compress bulk request");
+
+        compressed.resize(zs.total_out);
+
+        return compressed;
+    }
+
+    boost::asio::io_context ioc;
+    boost::asio::ip::tcp::resolver resolver;
+    boost::beast::tcp_stream stream;
+    bool connected;
+
+    z_stream zs;
+    bool zs_active;
+    std::string compressed;
+};
+
+elk_bulk_client::elk_bulk_client(const elk_bulk_config& config) :
+    config{config},
+    in_flight{0},
+    running{false},
+    stopping{false},
+    abandon{false},
+    docs_indexed{0},
+    docs_failed{0},
+    batches_sent{0},
+    retries{0},
+    bytes_sent{0} {
+
+    if (this->config.connections == 0)
+        this->config.connections = 1;
+
+    if (this->config.queue_batches == 0)
+        this->config.queue_batches = this->config.connections * 2;
+}
+
+elk_bulk_client::~elk_bulk_client() {
+    stop();
+}
+
+void elk_bulk_client::start() {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (running)
+        return;
+
+    auto url = config.url;
+
+    if (url.find("https://") == 0)
+        throw std::runtime_error(fmt::format("unable to use '{}', HTTPS is not supported; use a "
+                    "plain HTTP address or a local proxy", url));
+
+    if (url.find("http://") == 0)
+        url = url.substr(7);
+    else if (url.find("://") != std::string::npos)
+        throw std::runtime_error(fmt::format("unable to use '{}', expected http://host:port",
+                    config.url));
+
+    auto path_pos = url.find('/');
+
+    if (path_pos != std::string::npos) {
+        path = url.substr(path_pos);
+        url = url.substr(0, path_pos);
+
+        while (path.length() > 0 && path.back() == '/')
+            path.pop_back();
+    }
+
+    auto port_pos = url.rfind(':');
+
+    if (port_pos != std::string::npos && url.find(']', port_pos) == std::string::npos) {
+        port = url.substr(port_pos + 1);
+        host = url.substr(0, port_pos);
+    } else {
+        port = "80";
+        host = url;
+    }
+
+    // Bracketed IPv6 addresses are resolved without the brackets
+    if (host.length() > 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.length() - 2);
+
+    if (host.length() == 0)
+        throw std::runtime_error(fmt::format("unable to use '{}', expected http://host:port",
+                    config.url));
+
+    if (config.api_key.length() > 0)
+        authorization = fmt::format("ApiKey {}", config.api_key);
+    else if (config.auth.length() > 0)
+        authorization = fmt::format("Basic {}", base64::encode(config.auth));
+
+    running = true;
+    stopping = false;
+    abandon = false;
+
+    for (unsigned int i = 0; i < config.connections; i++)
+        workers.push_back(std::thread([this]() { worker(); }));
+}
+
+void elk_bulk_client::stop(std::chrono::seconds grace) {
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+
+        if (!running)
+            return;
+
+        queue_batch(lk);
+
+        stopping = true;
+    }
+
+    work_cond.notify_all();
+
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+
+        if (!idle_cond.wait_for(lk, grace, [this]() { return queue.size() == 0 && in_flight == 0; })) {
+            abandon = true;
+
+            for (const auto& b : queue)
+                docs_failed += b->offsets.size();
+
+            queue.clear();
+        }
+    }
+
+    work_cond.notify_all();
+    space_cond.notify_all();
+
+    for (auto& w : workers)
+        w.join();
+
+    workers.clear();
+
+    std::lock_guard<std::mutex> lk(mutex);
+    running = false;
+}
+
+void elk_bulk_client::add(const std::string& index, const std::string& document,
+        const std::string& id) {
+    auto len = document.length();
+
+    // Each document must be a single line
+    while (len > 0 && document[len - 1] == '\n')
+        len--;
+
+    if (len == 0)
+        return;
+
+    std::unique_lock<std::mutex> lk(mutex);
+
+    if (!running || stopping)
+        throw std::runtime_error("bulk client is not running");
+
+    if (current == nullptr)
+        current = std::make_shared<bulk_batch>();
+
+    current->offsets.push_back(current->body.length());
+
+    current->body += "{\"index\":{\"_index\":\"";
+    current->body += index;
+
+    if (id.length() > 0) {
+        current->body += "\",\"_id\":\"";
+        current->body += id;
+    }
+
+    current->body += "\"}}\n";
+    current->body.append(document, 0, len);
+    current->body += '\n';
+
+    if (current->offsets.size() >= config.batch_docs || current->body.length() >= config.batch_bytes)
+        queue_batch(lk);
+}
+
+void elk_bulk_client::flush() {
+    std::unique_lock<std::mutex> lk(mutex);
+
+    if (!running)
+        return;
+
+    queue_batch(lk);
+
+    idle_cond.wait(lk, [this]() { return (queue.size() == 0 && in_flight == 0) || abandon; });
+}
+
+void elk_bulk_client::queue_batch(std::unique_lock<std::mutex>& lk) {
+    space_cond.wait(lk, [this]() { return queue.size() < config.queue_batches || abandon; });
+
+    // Another caller may have queued the batch while this one waited
+    if (current == nullptr || current->offsets.size() == 0 || abandon)
+        return;
+
+    queue.push_back(current);
+    current = nullptr;
+
+    work_cond.notify_one();
+}
+
+void elk_bulk_client::worker() {
+    elk_bulk_connection conn(config.gzip_level);
+
+    while (1) {
+        std::shared_ptr<bulk_batch> batch;
+
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+
+            work_cond.wait(lk, [this]() { return queue.size() > 0 || stopping; });
+
+            if (queue.size() == 0)
+                break;
+
+            batch = queue.front();
+            queue.pop_front();
+            in_flight++;
+        }
+
+        space_cond.notify_all();
+
+        send_batch(batch, conn);
+
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            in_flight--;
+        }
+
+        idle_cond.notify_all();
+    }
+}
+
+void elk_bulk_client::send_batch(std::shared_ptr<bulk_batch> batch, elk_bulk_connection& conn) {
+    namespace http = boost::beast::http;
+
+    thread_local std::mt19937 rng(std::random_device{}());
+
+    unsigned int attempt = 0;
+
+    while (batch != nullptr && batch->offsets.size() > 0) {
+        if (attempt > 0) {
+            retries++;
+
+            // Exponential backoff with jitter, so connections backing off at the same time
+            // don't all come back at once
+            auto backoff = std::min(config.max_backoff,
+                    std::chrono::milliseconds(ELK_BULK_BACKOFF_MS << std::min(attempt - 1, 10U)));
+            std::uniform_int_distribution<long> jitter(backoff.count() / 2, backoff.count());
+
+            std::unique_lock<std::mutex> lk(mutex);
+            work_cond.wait_for(lk, std::chrono::milliseconds(jitter(rng)),
+                    [this]() { return abandon.load(); });
+        }
+
+        attempt++;
+
+        if (abandon) {
+            docs_failed += batch->offsets.size();
+            return;
+        }
+
+        http::response<http::string_body> res;
+        size_t body_len = 0;
+
+        try {
+            if (!conn.connected) {
+                auto endpoints = conn.resolver.resolve(host, port);
+                conn.stream.expires_after(config.timeout);
+                conn.stream.connect(endpoints);
+                conn.connected = true;
+            }
+
+            http::request<http::string_body> req{http::verb::post, path + "/_bulk", 11};
+            req.set(http::field::host, host);
+            req.set(http::field::user_agent, "Kismet");
+            req.set(http::field::content_type, "application/x-ndjson");
+            req.keep_alive(true);
+
+            if (authorization.length() > 0)
+                req.set(http::field::authorization, authorization);
+
+            if (conn.zs_active) {
+                req.set(http::field::content_encoding, "gzip");
+                req.body() = conn.compress(batch->body);
+            } else {
+                req.body() = batch->body;
+            }
+
+            body_len = req.body().length();
+            req.prepare_payload();
+
+            conn.stream.expires_after(config.timeout);
+            http::write(conn.stream, req);
+
+            // Bulk responses have an item for every document, and can be large
+            boost::beast::flat_buffer buffer;
+            http::response_parser<http::string_body> parser;
+            parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+
+            http::read(conn.stream, buffer, parser);
+
+            res = parser.release();
+
+            if (!res.keep_alive())
+                conn.close();
+        } catch (const std::exception& e) {
+            conn.close();
+            report_error(fmt::format("Unable to send bulk request to {}: {}", config.url, e.what()));
+            continue;
+        }
+
+        batches_sent++;
+        bytes_sent += body_len;
+
+        auto status = res.result_int();
+
+        // The cluster, or a proxy in front of it, is overloaded; send it all again
+        if (status == 429 || status == 502 || status == 503 || status == 504)
+            continue;
+
+        if (status < 200 || status >= 300) {
+            docs_failed += batch->offsets.size();
+            report_error(fmt::format("{} rejected a bulk request: {} {}", config.url, status,
+                        res.body().substr(0, 512)));
+            return;
+        }
+
+        nlohmann::json response;
+
+        try {
+            response = nlohmann::json::parse(res.body());
+        } catch (const std::exception& e) {
+            docs_indexed += batch->offsets.size();
+            report_error(fmt::format("Unable to parse the bulk response of {}: {}", config.url, e.what()));
+            return;
+        }
+
+        if (!response.value("errors", false)) {
+            docs_indexed += batch->offsets.size();
+            return;
+        }
+
+        // Items are in the order of the documents; documents the cluster had no room for
+        // are sent again, and other errors are final
+        const auto& items = response["items"];
+
+        auto retry = std::make_shared<bulk_batch>();
+        std::string first_error;
+        uint64_t n_failed = 0;
+
+        for (size_t i = 0; i < batch->offsets.size(); i++) {
+            int item_status = 200;
+
+            if (items.is_array() && i < items.size() && items[i].is_object() && items[i].size() > 0) {
+                const auto& r = items[i].begin().value();
+
+                if (r.is_object()) {
+                    item_status = r.value("status", 200);
+
+                    if (item_status >= 300 && item_status != 429 && first_error.length() == 0 &&
+                            r.contains("error"))
+                        first_error = r["error"].dump();
+                }
+            }
+
+            if (item_status == 429) {
+                auto end = i + 1 < batch->offsets.size() ? batch->offsets[i + 1] : batch->body.length();
+
+                retry->offsets.push_back(retry->body.length());
+                retry->body.append(batch->body, batch->offsets[i], end - batch->offsets[i]);
+            } else if (item_status >= 300) {
+                n_failed++;
+            } else {
+                docs_indexed++;
+            }
+        }
+
+        if (n_failed > 0) {
+            docs_failed += n_failed;
+            report_error(fmt::format("{} rejected {} documents of a bulk request: {}", config.url,
+                        n_failed, first_error.substr(0, 512)));
+        }
+
+        batch = retry;
+    }
+}
+
+void elk_bulk_client::report_error(const std::string& error) {
+    if (config.error_cb != nullptr)
+        config.error_cb(error);
+}
+
@@ -0,0 +1,164 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __ELK_BULK_H__
+#define __ELK_BULK_H__
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bulk indexing client for Elasticsearch and OpenSearch.
+//
+// Documents are appended to a batch of '_bulk' index actions, and a full batch is
+// handed to a pool of connections; each connection compresses its batch with gzip and
+// posts it over a keep-alive HTTP connection, so several batches are in flight at once.
+// Only a few batches are queued; adding documents blocks while they are all waiting,
+// so memory stays bounded when the cluster can't keep up.
+//
+// When the cluster pushes back, either by rejecting the whole request (429, or a 502,
+// 503 or 504 from a proxy in front of it) or by rejecting some of the documents in a
+// batch with a 429, the rejected documents are sent again after an exponential
+// backoff.  Other rejected documents are counted as failed and reported.
+//
+// Only plain HTTP is supported; a TLS cluster can be reached through a local proxy.
+//
+// The bulk code is shared with the log tools and does not depend on the rest of the
+// server.
+
+struct elk_bulk_config {
+    elk_bulk_config() :
+        connections{4},
+        batch_docs{2000},
+        batch_bytes{4 * 1024 * 1024},
+        queue_batches{0},
+        gzip_level{1},
+        timeout{std::chrono::seconds(60)},
+        max_backoff{std::chrono::seconds(30)} { }
+
+    // http://host[:port][/path] of the cluster
+    std::string url;
+
+    // user:password for basic authentication, or an API key
+    std::string auth;
+    std::string api_key;
+
+    unsigned int connections;
+
+    // A batch is sent once it has either many documents or bytes of actions
+    size_t batch_docs;
+    size_t batch_bytes;
+
+    // Full batches waiting for a connection; by default twice the connections
+    size_t queue_batches;
+
+    // Zlib level the batches are compressed with, or 0 to send them uncompressed
+    int gzip_level;
+
+    std::chrono::seconds timeout;
+    std::chrono::milliseconds max_backoff;
+
+    // Errors reported by the cluster, or by connecting to it
+    std::function<void (const std::string&)> error_cb;
+};
+
+struct elk_bulk_connection;
+
+class elk_bulk_client {
+public:
+    elk_bulk_client(const elk_bulk_config& config);
+    ~elk_bulk_client();
+
+    // Check the URL and start the connections; throws std::runtime_error
+    void start();
+
+    // Send everything added and stop the connections.  If the cluster can't take the
+    // remaining batches within the grace time, they are dropped and counted as failed
+    void stop(std::chrono::seconds grace = std::chrono::seconds(30));
+
+    // Add a document, a JSON object on a single line, to an index; documents with an id
+    // replace the earlier document with the same id.  Blocks while the queue is full
+    void add(const std::string& index, const std::string& document, const std::string& id = "");
+
+    // Send the partial batch and wait until everything added has been sent
+    void flush();
+
+    uint64_t get_docs_indexed() const { return docs_indexed; }
+    uint64_t get_docs_failed() const { return docs_failed; }
+    uint64_t get_batches_sent() const { return batches_sent; }
+    uint64_t get_retries() const { return retries; }
+    uint64_t get_bytes_sent() const { return bytes_sent; }
+
+protected:
+    struct bulk_batch {
+        // Action and document lines, and the offset of the action of each document
+        std::string body;
+        std::vector<size_t> offsets;
+    };
+
+    void queue_batch(std::unique_lock<std::mutex>& lk);
+
+    void worker();
+
+    // Send a batch until the cluster has taken it, retrying rejected documents
+    void send_batch(std::shared_ptr<bulk_batch> batch, elk_bulk_connection& conn);
+
+    void report_error(const std::string& error);
+
+    elk_bulk_config config;
+
+    std::string host;
+    std::string port;
+    std::string path;
+    std::string authorization;
+
+    std::mutex mutex;
+    std::condition_variable work_cond;
+    std::condition_variable space_cond;
+    std::condition_variable idle_cond;
+
+    std::shared_ptr<bulk_batch> current;
+    std::list<std::shared_ptr<bulk_batch>> queue;
+    size_t in_flight;
+
+    bool running;
+    bool stopping;
+    std::atomic<bool> abandon;
+
+    std::vector<std::thread> workers;
+
+    std::atomic<uint64_t> docs_indexed;
+    std::atomic<uint64_t> docs_failed;
+    std::atomic<uint64_t> batches_sent;
+    std::atomic<uint64_t> retries;
+    std::atomic<uint64_t> bytes_sent;
+};
+
+#endif
+
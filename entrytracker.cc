@@ -27,10 +27,14 @@
 
 entry_tracker::entry_tracker() {
     entry_mutex.set_name("entry_tracker");
-    // serializer_mutex.set_name("entry_tracker_serializer");
+    summary_mutex.set_name("entry_tracker summary");
 
     next_field_num = 1;
 
+    field_id_table.reset(new std::atomic<reserved_field *>[65536]());
+    field_generation = 0;
+    serializer_map = std::make_shared<serializer_table>();
+
     Globalreg::enable_pool_type<tracker_element_alias>([](auto *a) { a->reset(); });
     Globalreg::enable_pool_type<tracker_element_string>([](auto *s) { s->reset(); });
     Globalreg::enable_pool_type<tracker_element_byte_array>([](auto *b) { b->reset(); });
@@ -91,18 +95,23 @@ void entry_tracker::tracked_fields_endp_handler(std::shared_ptr<kis_net_beast_ht
     stream << "<table padding=\"5\">";
     stream << "<tr><td><b>Name</b></td><td><b>ID</b></td><td><b>Type</b></td><td><b>Description</b></td></tr>";
 
-    for (auto i : field_id_map) {
+    for (int id = 1; id < next_field_num && id < 65536; id++) {
+        auto f = find_field(static_cast<uint16_t>(id));
+
+        if (f == nullptr)
+            continue;
+
         stream << "<tr>";
 
-        stream << "<td>" << i.second->field_name << "</td>";
+        stream << "<td>" << f->field_name << "</td>";
 
-        stream << "<td>" << i.first << "</td>";
+        stream << "<td>" << f->field_id << "</td>";
 
         stream << "<td>" << 
-            i.second->builder->get_type_as_string() << "/" << 
-            i.second->builder->get_signature() << "</td>"; 
+            f->builder->get_type_as_string() << "/" << 
+            f->builder->get_signature() << "</td>"; 
 
-        stream << "<td>" << i.second->field_description << "</td>";
+        stream << "<td>" << f->field_description << "</td>";
 
         stream << "</tr>";
 
@@ -113,9 +122,36 @@ void entry_tracker::tracked_fields_endp_handler(std::shared_ptr<kis_net_beast_ht
 }
 
 
+entry_tracker::reserved_field *entry_tracker::add_field(const std::string& in_name,
+        std::shared_ptr<tracker_element> in_builder,
+        const std::string& in_desc) {
+    auto definition = std::make_shared<reserved_field>();
+    definition->field_id = next_field_num++;
+    definition->field_name = in_name;
+    definition->field_description = in_desc;
+    definition->builder = in_builder;
+    definition->builder->set_id(definition->field_id);
+
+    field_name_map[in_name] = definition;
+
+    field_id_table[definition->field_id].store(definition.get(), std::memory_order_release);
+
+    last_registration = std::chrono::steady_clock::now();
+    field_generation.fetch_add(1, std::memory_order_release);
+
+    return definition.get();
+}
+
 int entry_tracker::register_field(const std::string& in_name,
         std::shared_ptr<tracker_element> in_builder,
         const std::string& in_desc) {
+    // Components register their fields every time one is built; fields already in the
+    // name snapshot are registered without the lock
+    auto field = find_snapshot_field(in_name);
+
+    if (field != nullptr && field->builder->get_signature() == in_builder->get_signature())
+        return field->field_id;
+
     kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker register_field");
 
     // std::string lname = str_lower(in_name);
@@ -133,22 +169,17 @@ int entry_tracker::register_field(const std::string& in_name,
         return field_iter->second->field_id;
     }
 
-    auto definition = std::make_shared<reserved_field>();
-    definition->field_id = next_field_num++;
-    definition->field_name = in_name;
-    definition->field_description = in_desc;
-    definition->builder = in_builder;
-    definition->builder->set_id(definition->field_id);
-
-    field_name_map[in_name] = definition;
-    field_id_map[definition->field_id] = definition;
-
-    return definition->field_id;
+    return add_field(in_name, in_builder, in_desc)->field_id;
 }
 
 std::shared_ptr<tracker_element> entry_tracker::register_and_get_field(const std::string& in_name,
         std::shared_ptr<tracker_element> in_builder,
         const std::string& in_desc) {
+    auto field = find_snapshot_field(in_name);
+
+    if (field != nullptr && field->builder->get_signature() == in_builder->get_signature())
+        return field->builder->clone_type();
+
     kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker register_and_get_field");
 
     // std::string lname = str_lower(in_name);
@@ -166,147 +197,196 @@ std::shared_ptr<tracker_element> entry_tracker::register_and_get_field(const std
         return field_iter->second->builder->clone_type();
     }
 
-    auto definition = std::make_shared<reserved_field>();
-    definition->field_id = next_field_num++;
-    definition->field_name = in_name;
-    definition->field_description = in_desc;
-    definition->builder = in_builder;
-    definition->builder->set_id(definition->field_id);
+    return add_field(in_name, in_builder, in_desc)->builder->clone_type();
+}
 
-    field_name_map[in_name] = definition;
-    field_id_map[definition->field_id] = definition;
+entry_tracker::reserved_field *entry_tracker::find_snapshot_field(const std::string& in_name) {
+    auto snapshot = std::atomic_load(&name_snapshot);
+
+    if (snapshot == nullptr)
+        return nullptr;
+
+    auto i = snapshot->fields.find(in_name);
 
-    return definition->builder->clone_type();
+    if (i == snapshot->fields.end())
+        return nullptr;
+
+    return i->second;
 }
 
+entry_tracker::reserved_field *entry_tracker::find_field(const std::string& in_name) {
+    auto snapshot = std::atomic_load(&name_snapshot);
 
-uint16_t entry_tracker::get_field_id(const std::string& in_name) {
-    kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker get_field_id");
+    // Fields never change once registered, so anything in the snapshot is current even
+    // when newer fields have been registered since
+    if (snapshot != nullptr) {
+        auto i = snapshot->fields.find(in_name);
 
-    // std::string mod_name = str_lower(in_name);
+        if (i != snapshot->fields.end())
+            return i->second;
+
+        if (snapshot->generation == field_generation.load(std::memory_order_acquire))
+            return nullptr;
+    }
+
+    kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker find_field");
+
+    reserved_field *field = nullptr;
 
     auto iter = field_name_map.find(in_name);
-    if (iter == field_name_map.end()) 
+    if (iter != field_name_map.end()) 
+        field = iter->second.get();
+
+    // Rebuild the snapshot once registrations have settled, instead of copying the names
+    // for every field registered at startup
+    if (std::chrono::steady_clock::now() - last_registration > std::chrono::seconds(1)) {
+        auto generation = field_generation.load(std::memory_order_acquire);
+
+        snapshot = std::atomic_load(&name_snapshot);
+
+        if (snapshot == nullptr || snapshot->generation != generation) {
+            auto rebuilt = std::make_shared<field_name_snapshot>();
+
+            rebuilt->generation = generation;
+            rebuilt->fields.reserve(field_name_map.size());
+
+            for (const auto& f : field_name_map)
+                rebuilt->fields[f.first] = f.second.get();
+
+            std::atomic_store(&name_snapshot, std::shared_ptr<const field_name_snapshot>(rebuilt));
+        }
+    }
+
+    return field;
+}
+
+uint16_t entry_tracker::get_field_id(const std::string& in_name) {
+    // std::string mod_name = str_lower(in_name);
+
+    auto field = find_field(in_name);
+    if (field == nullptr) 
         return -1;
 
-    return iter->second->field_id;
+    return field->field_id;
 }
 
 std::string entry_tracker::get_field_name(uint16_t in_id) {
-    kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker get_field_name");
-
-    auto iter = field_id_map.find(in_id);
-    if (iter == field_id_map.end()) 
+    auto field = find_field(in_id);
+    if (field == nullptr) 
         return "field.unknown.not.registered";
 
-    return iter->second->field_name;
+    return field->field_name;
 }
 
 std::string entry_tracker::get_field_description(uint16_t in_id) {
-    kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker get_field_description");
-
-    auto iter = field_id_map.find(in_id);
+    auto field = find_field(in_id);
 
-    if (iter == field_id_map.end()) {
+    if (field == nullptr) {
         return "untracked field, description not available";
     }
 
-    return iter->second->field_description;
+    return field->field_description;
 }
 
 std::shared_ptr<tracker_element> entry_tracker::get_shared_instance(uint16_t in_id) {
-    kis_unique_lock<kis_mutex> lock(entry_mutex, std::defer_lock, "entry_tracker get_shared_instance id");
+    auto field = find_field(in_id);
 
-    lock.lock();
-    auto iter = field_id_map.find(in_id);
-    lock.unlock();
-
-    if (iter == field_id_map.end()) 
+    if (field == nullptr) 
         return nullptr;
 
-    return iter->second->builder->clone_type();
+    return field->builder->clone_type();
 }
 
 std::shared_ptr<tracker_element> entry_tracker::get_shared_instance(const std::string& in_name) {
-    kis_unique_lock<kis_mutex> lock(entry_mutex, std::defer_lock, "entry_tracker get_shared_instance name");
+    auto field = find_field(in_name);
 
-    lock.lock();
-    auto iter = field_name_map.find(in_name);
-    lock.unlock();
-
-    if (iter == field_name_map.end()) 
+    if (field == nullptr) 
         return nullptr;
 
-    return iter->second->builder->clone_type();
+    return field->builder->clone_type();
 }
 
 void entry_tracker::register_serializer(const std::string& in_name, 
         std::shared_ptr<tracker_element_serializer> in_ser) {
-    // kis_lock_guard<kis_mutex> lk(serializer_mutex, "entry_tracker register_serializer");
+    kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker register_serializer");
+
+    auto current = std::atomic_load(&serializer_map);
     
-    if (serializer_map.find(in_name) != serializer_map.end()) {
+    if (current->find(in_name) != current->end()) {
         _MSG_ERROR("Attempted to register two serializers to type {}", in_name);
         return;
     }
 
-    serializer_map[in_name] = in_ser;
+    auto updated = std::make_shared<serializer_table>(*current);
+    (*updated)[in_name] = in_ser;
+
+    std::atomic_store(&serializer_map, std::shared_ptr<const serializer_table>(updated));
 }
 
 void entry_tracker::remove_serializer(const std::string& in_name) {
-    // kis_lock_guard<kis_mutex> lk(serializer_mutex, "entry_tracker remove_serializer");
+    kis_lock_guard<kis_mutex> lk(entry_mutex, "entry_tracker remove_serializer");
 
-    auto i = serializer_map.find(in_name);
+    auto current = std::atomic_load(&serializer_map);
 
-    if (i != serializer_map.end()) {
-        serializer_map.erase(i);
-    }
+    if (current->find(in_name) == current->end())
+        return;
+
+    auto updated = std::make_shared<serializer_table>(*current);
+    updated->erase(in_name);
+
+    std::atomic_store(&serializer_map, std::shared_ptr<const serializer_table>(updated));
 }
 
 bool entry_tracker::can_serialize(const std::string& in_name) {
-    // kis_lock_guard<kis_mutex> lk(serializer_mutex, "entry_tracker can_serialize");
+    auto serializers = std::atomic_load(&serializer_map);
 
-    auto i = serializer_map.find(in_name);
+    auto i = serializers->find(in_name);
 
-    if (i != serializer_map.end()) {
+    if (i != serializers->end()) {
         return true;
     }
 
     return false;
 }
 
-int entry_tracker::serialize(const std::string& in_name, std::ostream &stream,
-        shared_tracker_element e,
-        std::shared_ptr<tracker_element_serializer::rename_map> name_map) {
-
-    // kis_unique_lock<kis_mutex> lock(serializer_mutex, std::defer_lock, "entry_tracker serialize");
+std::shared_ptr<tracker_element_serializer> entry_tracker::find_serializer(const std::string& in_name) {
+    auto serializers = std::atomic_load(&serializer_map);
 
-    // lock.lock();
     auto dpos = in_name.find_last_of(".");
+
     if (dpos == std::string::npos) {
-        auto i = serializer_map.find(in_name);
+        auto i = serializers->find(in_name);
 
-        if (i == serializer_map.end()) 
-            return -1;
-        // lock.unlock();
+        if (i == serializers->end())
+            return nullptr;
 
-        return i->second->serialize(e, stream, name_map);
-    } else {
-        auto i = serializer_map.find(in_name.substr(dpos + 1, in_name.length()));
+        return i->second;
+    }
 
-        if (i == serializer_map.end()) 
-            return -1;
-        // lock.unlock();
+    auto i = serializers->find(in_name.substr(dpos + 1, in_name.length()));
 
-        return i->second->serialize(e, stream, name_map);
+    if (i == serializers->end())
+        return nullptr;
 
-    }
+    return i->second;
+}
 
-    return -1;
+int entry_tracker::serialize(const std::string& in_name, std::ostream &stream,
+        shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map) {
+
+    auto ser = find_serializer(in_name);
+
+    if (ser == nullptr)
+        return -1;
+
+    return ser->serialize(e, stream, name_map);
 }
 
 int entry_tracker::serialize_with_json_summary(const std::string& type, std::ostream& stream, 
         shared_tracker_element elem, const nlohmann::json& json_summary) {
-    auto name_map = Globalreg::new_from_pool<tracker_element_serializer::rename_map>();
+    tracker_element_summary_arena arena;
+    auto name_map = arena.make_rename_map();
 
     auto sumelem = 
         summarize_tracker_element_with_json(elem, json_summary, name_map);
@@ -314,6 +394,76 @@ int entry_tracker::serialize_with_json_summary(const std::string& type, std::ost
     return serialize(type, stream, sumelem, name_map);
 }
 
+std::shared_ptr<const std::vector<SharedElementSummary>> 
+    entry_tracker::compile_summary(const nlohmann::json& fields) {
+    return compile_summary(fields, "");
+}
+
+std::shared_ptr<const std::vector<SharedElementSummary>> 
+    entry_tracker::compile_summary(const nlohmann::json& fields, const std::string& in_key) {
+
+    if (fields.is_null() || !fields.is_array() || fields.size() == 0)
+        return std::make_shared<const std::vector<SharedElementSummary>>();
+
+    // Keys from request text are prefixed so they can't collide with serialized fields
+    auto key = in_key.length() != 0 ? "r" + in_key : fields.dump();
+
+    {
+        kis_lock_guard<kis_mutex> lk(summary_mutex, "entry_tracker compile_summary");
+        auto ci = summary_cache.find(key);
+        if (ci != summary_cache.end())
+            return ci->second;
+    }
+
+    auto summary = std::make_shared<std::vector<SharedElementSummary>>();
+    bool resolved = true;
+
+    for (const auto& i : fields) {
+        if (i.is_string()) {
+            summary->push_back(std::make_shared<tracker_element_summary>(i.get<std::string>()));
+        } else if (i.is_array()) {
+            if (i.size() != 2) 
+                throw std::runtime_error("Invalid field map, expected [field, rename]");
+
+            summary->push_back(std::make_shared<tracker_element_summary>(i[0].get<std::string>(), 
+                        i[1].get<std::string>()));
+        } else {
+            throw std::runtime_error("Invalid field map, exected field or [field, rename]");
+        }
+
+        for (const auto& p : summary->back()->resolved_path) {
+            if (p < 0)
+                resolved = false;
+        }
+    }
+
+    // Fields which aren't registered yet may be later, so only cache fully resolved 
+    // summaries
+    if (resolved) {
+        kis_lock_guard<kis_mutex> lk(summary_mutex, "entry_tracker compile_summary");
+
+        // Field lists come from clients; don't let unique lists grow the cache forever
+        if (summary_cache.size() >= 256)
+            summary_cache.clear();
+
+        summary_cache[key] = summary;
+    }
+
+    return summary;
+}
+
+int entry_tracker::serialize_summary(const std::string& type, std::ostream& stream,
+        std::shared_ptr<tracker_element_vector> elem,
+        const std::vector<SharedElementSummary>& summary) {
+
+    auto ser = find_serializer(type);
+
+    if (ser == nullptr)
+        return -1;
+
+    return ser->serialize_summary(elem, summary, stream);
+}
+
 void entry_tracker::register_search_xform(uint16_t in_field_id, std::function<void (std::shared_ptr<tracker_element>,
             std::string& mapped_str)> in_xform) {
 
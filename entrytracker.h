@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <string>
@@ -38,6 +40,11 @@
 class kis_net_beast_httpd_connection;
 
 // Allocate and track named fields and give each one a custom int
+//
+// Fields are registered at startup and when plugins and phys load, and are never
+// removed; looking them up happens on every request.  Lookups by id use a dense table
+// and lookups by name use a published snapshot of the registered names, so neither takes
+// the registration lock.
 class entry_tracker : public lifetime_global, public deferred_startup {
 public:
     static std::string global_name() { return "ENTRYTRACKER"; }
@@ -105,13 +112,9 @@ public:
 
     // Serializer manipulation
     //
-    // These ARE NOT THREAD SAFE.  
-    // 
-    // Registering and removing serializers MUST NOT BE DONE while other threads may be able
-    // to call can_serialize or serialize.
-    //
-    // Serialization registration must happen at the startup of the system and may not happen later
-    // in operation.
+    // Registering a serializer publishes a new copy of the serializer table; serializing
+    // uses the published table and takes no locks.  Serializers should still be registered
+    // at the startup of the system.
 
     void register_serializer(const std::string& type, std::shared_ptr<tracker_element_serializer> in_ser);
     void remove_serializer(const std::string& type);
@@ -124,6 +127,22 @@ public:
     int serialize_with_json_summary(const std::string& type, std::ostream& stream, shared_tracker_element elem,
             const nlohmann::json& json_summary);
 
+    // Compile a json field list, in the form of the 'fields' element of an endpoint request,
+    // into a summary.  Compiled summaries are cached by field list, so clients polling the
+    // same fields don't resolve the field paths on every request.  Throws std::runtime_error
+    // on an invalid field list.
+    std::shared_ptr<const std::vector<SharedElementSummary>> compile_summary(const nlohmann::json& fields);
+    // Compile with a cache key the caller already has, like the text of the field list
+    // from the request; an empty key falls back to the serialized fields
+    std::shared_ptr<const std::vector<SharedElementSummary>> compile_summary(const nlohmann::json& fields,
+            const std::string& key);
+
+    // Serialize a vector of records summarized by a compiled summary; serializers which
+    // support it emit the summarized fields directly from the records
+    int serialize_summary(const std::string& type, std::ostream& stream,
+            std::shared_ptr<tracker_element_vector> elem,
+            const std::vector<SharedElementSummary>& summary);
+
     // Optional per-field-id transforms for search functions, must use the search workers or be called
     // manually
     void register_search_xform(uint16_t in_field_id, std::function<void (std::shared_ptr<tracker_element>,
@@ -135,7 +154,13 @@ public:
 
 protected:
     kis_mutex entry_mutex;
-    // kis_mutex serializer_mutex;
+
+    // Find a serializer by type or by the extension of a path
+    std::shared_ptr<tracker_element_serializer> find_serializer(const std::string& type);
+
+    // Compiled summaries by serialized field list
+    kis_mutex summary_mutex;
+    robin_hood::unordered_node_map<std::string, std::shared_ptr<const std::vector<SharedElementSummary>>> summary_cache;
 
     int next_field_num;
 
@@ -151,9 +176,40 @@ protected:
         std::shared_ptr<tracker_element> builder;
     };
 
+    // Registered fields by name, under entry_mutex; this owns the fields, which are never
+    // removed, so the lock-free tables below hold plain pointers to them
     robin_hood::unordered_node_map<std::string, std::shared_ptr<reserved_field> > field_name_map;
-    robin_hood::unordered_node_map<uint16_t, std::shared_ptr<reserved_field> > field_id_map;
-    robin_hood::unordered_node_map<std::string, std::shared_ptr<tracker_element_serializer> > serializer_map;
+
+    // Registered fields by id; ids are 16 bits, so the table covers every possible id
+    std::unique_ptr<std::atomic<reserved_field *>[]> field_id_table;
+
+    // Published snapshot of the field names.  Fields registered since the snapshot was
+    // built are found under entry_mutex; registrations come in bursts, so the snapshot is
+    // only rebuilt once a lookup misses and the last burst has settled
+    struct field_name_snapshot {
+        uint64_t generation;
+        robin_hood::unordered_flat_map<std::string, reserved_field *> fields;
+    };
+
+    std::shared_ptr<const field_name_snapshot> name_snapshot;
+    std::atomic<uint64_t> field_generation;
+    std::chrono::steady_clock::time_point last_registration;
+
+    reserved_field *find_field(const std::string& in_name);
+    // Only the published snapshot, which may not have the newest fields
+    reserved_field *find_snapshot_field(const std::string& in_name);
+    reserved_field *find_field(uint16_t in_id) {
+        return field_id_table[in_id].load(std::memory_order_acquire);
+    }
+
+    // Record a new field; entry_mutex must be held
+    reserved_field *add_field(const std::string& in_name, std::shared_ptr<tracker_element> in_builder,
+            const std::string& in_desc);
+
+    // Serializers by type; replaced as a whole when serializers are added or removed
+    using serializer_table =
+        robin_hood::unordered_node_map<std::string, std::shared_ptr<tracker_element_serializer>>;
+    std::shared_ptr<const serializer_table> serializer_map;
 
     // Field IDs to optional search xform function
     robin_hood::unordered_node_map<uint16_t, std::function<void (std::shared_ptr<tracker_element>, 
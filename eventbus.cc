@@ -16,20 +16,27 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <chrono>
+
 #include "eventbus.h"
 #include "kis_net_beast_httpd.h"
+#include "msgpack_adapter.h"
 
 event_bus::event_bus() :
     lifetime_global(),
     deferred_startup() {
 
-    mutex.set_name("event_bus");
     handler_mutex.set_name("event_bus_handler");
 
     Globalreg::enable_pool_type<eventbus_event>([](auto *a) { a->reset(); });
 
     next_cbl_id = 1;
 
+    for (auto& c : channel_listener_count)
+        c = 0;
+    all_listener_count = 0;
+    shared_listener_count = 0;
+
     shutdown = false;
 
     eventbus_event_id = 
@@ -37,35 +44,74 @@ event_bus::event_bus() :
                 tracker_element_factory<eventbus_event>(),
                 "Eventbus event");
 
-    event_cl.lock();
-
-    event_dispatch_t =
-        std::thread([this]() {
-                thread_set_process_name("eventbus");
-                event_queue_dispatcher();
-            });
-
+    listener_entry_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.eventbus.listener",
+                tracker_element_factory<tracked_eventbus_listener>(),
+                "Eventbus listener");
+
+    listener_vec_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.eventbus.listeners",
+                tracker_element_factory<tracker_element_vector>(),
+                "Eventbus listeners");
+
+    // The channel lanes and the shared lane; all are created before any thread 
+    // starts so the dispatchers never see the vector change
+    for (unsigned int i = 0; i <= EVENTBUS_SHARED_LANE; i++)
+        dispatch_lanes.push_back(std::unique_ptr<dispatch_lane>(new dispatch_lane()));
+
+    for (unsigned int i = 0; i <= EVENTBUS_SHARED_LANE; i++) {
+        dispatch_lanes[i]->dispatch_t =
+            std::thread([this, i]() {
+                    thread_set_process_name(fmt::format("eventbus{}", i));
+                    event_queue_dispatcher(i);
+                });
+    }
 }
 
 event_bus::~event_bus() {
     shutdown = true;
 
-    event_cl.unlock(0);
-    event_dispatch_t.join();
+    // A null event wakes up the lane for shutdown
+    for (const auto& l : dispatch_lanes)
+        l->queue.enqueue(nullptr);
+
+    for (const auto& l : dispatch_lanes) {
+        if (l->dispatch_t.joinable())
+            l->dispatch_t.join();
+    }
 }
 
 void event_bus::trigger_deferred_startup() {
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
+    httpd->register_route("/eventbus/listeners", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection>) -> std::shared_ptr<tracker_element> {
+                    return listener_summary();
+                }));
+
     httpd->register_websocket_route("/eventbus/events", httpd->RO_ROLE, {"ws"},
             std::make_shared<kis_net_web_function_endpoint>(
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
 
                 std::unordered_map<std::string, unsigned long> reg_map;
 
+                // Clients may switch the session to msgpack framing by sending 
+                // {"BINARY": true}; events are then sent as binary frames of 
+                // {"fields": {id: name, ...}, "event": content}, where plain fields 
+                // are keyed by id and the dictionary carries only the field names not 
+                // yet sent in this session, and is omitted when there are none.
+                struct ws_session {
+                    kis_mutex mutex;
+                    bool binary = false;
+                    msgpack_adapter::field_dictionary fields;
+                };
+
+                auto session = std::make_shared<ws_session>();
+
                 auto ws = 
                     std::make_shared<kis_net_web_websocket_endpoint>(con, 
-                        [this, &reg_map](std::shared_ptr<kis_net_web_websocket_endpoint> ws,
+                        [this, &reg_map, session](std::shared_ptr<kis_net_web_websocket_endpoint> ws,
                             boost::beast::flat_buffer& buf, bool text) mutable {
 
                             if (!text) {
@@ -84,6 +130,11 @@ void event_bus::trigger_deferred_startup() {
                                 return;
                             }
 
+                            if (json["BINARY"].is_boolean()) {
+                                kis_lock_guard<kis_mutex> lk(session->mutex, "eventbus ws binary");
+                                session->binary = json["BINARY"].get<bool>();
+                            }
+
                             if (!json["SUBSCRIBE"].is_null()) {
                                 auto e_k = reg_map.find(json["SUBSCRIBE"].get<std::string>());
                                 if (e_k != reg_map.end()) {
@@ -93,7 +144,42 @@ void event_bus::trigger_deferred_startup() {
 
                                 auto id = 
                                     register_listener(json["SUBSCRIBE"].get<std::string>(), 
-                                            [ws, json](std::shared_ptr<eventbus_event> evt) {
+                                            [ws, json, session](std::shared_ptr<eventbus_event> evt) {
+                                                kis_unique_lock<kis_mutex> lk(session->mutex, 
+                                                        "eventbus ws event");
+
+                                                if (session->binary) {
+                                                    tracker_element_summary_arena arena;
+                                                    auto name_map = arena.make_rename_map();
+                                                    auto sumelem = 
+                                                        summarize_tracker_element_with_json(evt->get_event_content(),
+                                                                json, name_map);
+
+                                                    std::string content;
+                                                    msgpack_adapter::pack(content, sumelem, name_map, 
+                                                            &session->fields);
+
+                                                    std::string frame;
+
+                                                    if (session->fields.has_pending()) {
+                                                        msgpack_adapter::pack_map_header(frame, 2);
+                                                        msgpack_adapter::pack_str(frame, "fields");
+                                                        session->fields.pack_pending(frame);
+                                                    } else {
+                                                        msgpack_adapter::pack_map_header(frame, 1);
+                                                    }
+
+                                                    msgpack_adapter::pack_str(frame, "event");
+                                                    frame.append(content);
+
+                                                    // Written under the session lock so that the 
+                                                    // dictionaries reach the client in order
+                                                    ws->write_binary(frame);
+                                                    return;
+                                                }
+
+                                                lk.unlock();
+
                                                 std::stringstream os;
                                                 Globalreg::globalreg->entrytracker->serialize_with_json_summary("json", os, 
                                                         evt->get_event_content(), json);
@@ -136,74 +222,143 @@ std::shared_ptr<eventbus_event> event_bus::get_eventbus_event(const std::string&
     return evt;
 }
 
-void event_bus::event_queue_dispatcher() {
-    //kis_unique_lock<kis_mutex> lock(mutex, std::defer_lock, "event_bus event_queue_dispatcher");
-    std::unique_lock<kis_mutex> lock(mutex, std::defer_lock);
+void event_bus::event_queue_dispatcher(size_t lane_id) {
+    auto lane = dispatch_lanes[lane_id].get();
 
     while (!shutdown && 
             !Globalreg::globalreg->spindown && 
             !Globalreg::globalreg->fatal_condition &&
             !Globalreg::globalreg->complete) {
 
-        // Lock while we examine the queue
-        lock.lock();
         std::shared_ptr<eventbus_event> e;
-        if (event_queue.size() > 0) {
-            e = event_queue.front();
-            event_queue.pop();
-        }
-        lock.unlock();
 
-        if (e != nullptr) {
-            // Lock the handler mutex while we're processing an event
-            // kis_unique_lock<kis_mutex> rl(handler_mutex, std::defer_lock, "event_bus dispatch");
-            std::unique_lock<kis_mutex> rl(handler_mutex, std::defer_lock);
+        lane->queue.wait_dequeue(e);
 
-            rl.lock();
+        if (e == nullptr)
+            break;
 
-            auto ch_listeners = callback_table.find(e->get_event_id());
-            auto ch_all_listeners = callback_table.find("*");
+        lane->backlog--;
 
-            if (ch_listeners == callback_table.end() && ch_all_listeners == callback_table.end()) {
-                continue;
-            }
+        // Lock the handler mutex while we're finding the listeners
+        // kis_unique_lock<kis_mutex> rl(handler_mutex, std::defer_lock, "event_bus dispatch");
+        std::unique_lock<kis_mutex> rl(handler_mutex, std::defer_lock);
 
-            // Copy into a workvec in case one of the event handlers removes itself from the events
-            // in the future
-            std::vector<std::shared_ptr<callback_listener>> workvec;
+        rl.lock();
 
-            if (ch_listeners != callback_table.end()) {
-                for (const auto& cbl : ch_listeners->second)  {
+        auto ch_listeners = callback_table.find(e->get_event_id());
+        auto ch_all_listeners = callback_table.find("*");
+
+        if (ch_listeners == callback_table.end() && ch_all_listeners == callback_table.end()) {
+            continue;
+        }
+
+        // Copy into a workvec in case one of the event handlers removes itself from the events
+        // in the future; only the listeners pinned to this lane are called
+        std::vector<std::shared_ptr<callback_listener>> workvec;
+
+        if (ch_listeners != callback_table.end()) {
+            for (const auto& cbl : ch_listeners->second)  {
+                if (cbl->lane == lane_id)
                     workvec.push_back(cbl);
-                }
             }
+        }
 
-            if (ch_all_listeners != callback_table.end()) {
-                for (const auto& cbl : ch_all_listeners->second) {
+        if (ch_all_listeners != callback_table.end()) {
+            for (const auto& cbl : ch_all_listeners->second) {
+                if (cbl->lane == lane_id)
                     workvec.push_back(cbl);
-                }
             }
+        }
 
-            rl.unlock();
+        rl.unlock();
 
-            for (const auto& cbl : workvec) {
-                try {
-                    cbl->cb(e);
-                } catch (const std::exception& e) {
-                    _MSG_ERROR("Error in eventbus handler: {}", e.what());
-                }
+        for (const auto& cbl : workvec) {
+            auto start = std::chrono::steady_clock::now();
+
+            try {
+                cbl->cb(e);
+            } catch (const std::exception& e) {
+                _MSG_ERROR("Error in eventbus handler: {}", e.what());
             }
 
-            // Loop for more events
-            continue;
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            cbl->calls++;
+            cbl->total_ns += ns;
+
+            // Only updated from the lane of the listener
+            if (ns > cbl->max_ns)
+                cbl->max_ns = ns;
+        }
+    }
+}
+
+std::shared_ptr<tracker_element_vector> event_bus::listener_summary() {
+    auto ret = std::make_shared<tracker_element_vector>(listener_vec_id);
+
+    std::lock_guard<kis_mutex> lk(handler_mutex);
+
+    for (const auto& i : callback_id_table) {
+        const auto& cbl = i.second;
+
+        auto t = std::make_shared<tracked_eventbus_listener>(listener_entry_id);
+
+        std::string channels;
+
+        for (const auto& c : cbl->channels) {
+            if (channels.length() != 0)
+                channels += ",";
+            channels += c;
         }
 
-        // Reset the lock
-        event_cl.lock();
+        uint64_t backlog = dispatch_lanes[cbl->lane]->backlog;
+
+        uint64_t calls = cbl->calls;
 
-        // Wait until new events
-        event_cl.block_until();
+        t->set_listener_id(cbl->id);
+        t->set_channels(channels);
+        t->set_calls(calls);
+        t->set_avg_ns(calls == 0 ? 0 : cbl->total_ns / calls);
+        t->set_max_ns(cbl->max_ns);
+        t->set_backlog(backlog);
+
+        ret->push_back(t);
     }
+
+    return ret;
+}
+
+int event_bus::register_channel(const std::string& channel) {
+    std::lock_guard<kis_mutex> lk(handler_mutex);
+    return register_channel_locked(channel);
+}
+
+int event_bus::register_channel_locked(const std::string& channel) {
+    auto ci = channel_id_map.find(channel);
+
+    if (ci != channel_id_map.end())
+        return ci->second;
+
+    if (channel_id_map.size() >= EVENTBUS_MAX_CHANNELS)
+        return -1;
+
+    auto id = (int) channel_id_map.size();
+    channel_id_map[channel] = id;
+
+    return id;
+}
+
+void event_bus::adjust_listener_count(const std::string& channel, int delta) {
+    if (channel == "*") {
+        all_listener_count += delta;
+        return;
+    }
+
+    auto id = register_channel_locked(channel);
+
+    if (id >= 0)
+        channel_listener_count[id] += delta;
 }
 
 unsigned long event_bus::register_listener(const std::string& channel, cb_func cb) {
@@ -218,8 +373,12 @@ unsigned long event_bus::register_listener(const std::list<std::string>& channel
 
     for (auto i : channels) {
         callback_table[i].push_back(cbl);
+        adjust_listener_count(i, 1);
     }
 
+    if (cbl->lane == EVENTBUS_SHARED_LANE)
+        shared_listener_count++;
+
     callback_id_table[cbl->id] = cbl;
 
     return cbl->id;
@@ -241,11 +400,15 @@ void event_bus::remove_listener(unsigned long id) {
         for (auto cbi = callback_table[c].begin(); cbi != callback_table[c].end(); ++cbi) {
             if ((*cbi)->id == id) {
                 callback_table[c].erase(cbi);
+                adjust_listener_count(c, -1);
                 break;
             }
         }
     }
 
+    if (cbl->second->lane == EVENTBUS_SHARED_LANE)
+        shared_listener_count--;
+
     // Remove from CBL ID table
     callback_id_table.erase(cbl);
 }
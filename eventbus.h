@@ -41,10 +41,10 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <functional>
 #include <list>
 #include <memory>
-#include <queue>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -54,6 +54,25 @@
 #include "kis_mutex.h"
 #include "trackedcomponent.h"
 
+#include "moodycamel/blockingconcurrentqueue.h"
+
+// Events are dispatched on several lanes, each with its own queue and thread, so that
+// a slow listener only holds up the channels which share its lane.  Every channel is
+// always dispatched on the same lane, so events on a channel stay in order.
+//
+// Each listener is called from exactly one lane.  Listeners of "*", or of channels
+// which hash to different lanes, are called from an additional shared lane which
+// receives a copy of every event while any such listener exists, so they can't stall
+// the channel lanes.  A listener still sees the events of each channel in order, and
+// a shared listener sees all its events in publish order, but events on different
+// channels may reach a listener on a channel lane in a different order than they
+// reach a listener on the shared lane.
+#define EVENTBUS_DISPATCH_LANES     4
+#define EVENTBUS_SHARED_LANE        EVENTBUS_DISPATCH_LANES
+
+// Channels which can be given an integer ID for has_listeners
+#define EVENTBUS_MAX_CHANNELS       1024
+
 // Most basic event bus event that all other events are derived from
 class eventbus_event : public tracker_component {
 public:
@@ -100,6 +119,66 @@ protected:
     }
 };
 
+// Dispatch statistics of an event bus listener
+class tracked_eventbus_listener : public tracker_component {
+public:
+    tracked_eventbus_listener() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_eventbus_listener(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_eventbus_listener(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_eventbus_listener");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(listener_id, uint64_t, uint64_t, uint64_t, listener_id);
+    __Proxy(channels, std::string, std::string, std::string, channels);
+    __Proxy(calls, uint64_t, uint64_t, uint64_t, calls);
+    __Proxy(avg_ns, uint64_t, uint64_t, uint64_t, avg_ns);
+    __Proxy(max_ns, uint64_t, uint64_t, uint64_t, max_ns);
+    __Proxy(backlog, uint64_t, uint64_t, uint64_t, backlog);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.eventbus.listener.id", "Listener ID", &listener_id);
+        register_field("kismet.eventbus.listener.channels", "Subscribed channels", &channels);
+        register_field("kismet.eventbus.listener.calls", "Number of events delivered", &calls);
+        register_field("kismet.eventbus.listener.avg_ns", "Average call latency (ns)", &avg_ns);
+        register_field("kismet.eventbus.listener.max_ns", "Maximum call latency (ns)", &max_ns);
+        register_field("kismet.eventbus.listener.backlog", 
+                "Events queued on the dispatch lane of the listener", &backlog);
+    }
+
+    std::shared_ptr<tracker_element_uint64> listener_id;
+    std::shared_ptr<tracker_element_string> channels;
+    std::shared_ptr<tracker_element_uint64> calls;
+    std::shared_ptr<tracker_element_uint64> avg_ns;
+    std::shared_ptr<tracker_element_uint64> max_ns;
+    std::shared_ptr<tracker_element_uint64> backlog;
+};
+
 class event_bus : public lifetime_global, public deferred_startup {
 public:
     using cb_func = std::function<void (std::shared_ptr<eventbus_event>)>;
@@ -128,25 +207,49 @@ public:
 
     std::shared_ptr<eventbus_event> get_eventbus_event(const std::string& type);
 
+    // Integer ID of a channel, for checking for listeners without a lookup; returns
+    // -1 if there are too many channels to track
+    int register_channel(const std::string& channel);
+
+    // Producers of frequent events can skip building them when nothing is 
+    // listening on the channel, or on all channels; unknown channels are always
+    // assumed to have listeners
+    bool has_listeners(int channel_id) const {
+        if (channel_id < 0 || channel_id >= EVENTBUS_MAX_CHANNELS)
+            return true;
+
+        return all_listener_count.load(std::memory_order_relaxed) > 0 ||
+            channel_listener_count[channel_id].load(std::memory_order_relaxed) > 0;
+    }
+
     template<typename T>
     void publish(T event) {
-        // kis_lock_guard<kis_mutex> lk(mutex, "eventbus publish");
-        std::lock_guard<kis_mutex> lk(mutex);
-
         auto evt_cast = 
             std::static_pointer_cast<eventbus_event>(event);
 
-        event_queue.push(evt_cast);
-        event_cl.unlock(1);
+        auto& lane = dispatch_lanes[lane_of(evt_cast->get_event_id())];
+
+        lane->backlog++;
+        lane->queue.enqueue(evt_cast);
+
+        if (shared_listener_count.load(std::memory_order_relaxed) > 0) {
+            auto& shared = dispatch_lanes[EVENTBUS_SHARED_LANE];
+
+            shared->backlog++;
+            shared->queue.enqueue(evt_cast);
+        }
     }
 
+    // Dispatch statistics of every listener
+    std::shared_ptr<tracker_element_vector> listener_summary();
+
 protected:
-    // We need 2 mutexes - we have to block removing a callback while we're dispatching
-    // an event, because we need to not lock up the entire event bus while we're 
-    // sending out events
-    kis_mutex mutex, handler_mutex;
+    // Protects the listener tables; dispatch copies the listeners of an event out
+    // so that listeners can be removed while events are being sent
+    kis_mutex handler_mutex;
 
     int eventbus_event_id;
+    int listener_entry_id, listener_vec_id;
 
     unsigned long next_cbl_id;
 
@@ -154,24 +257,71 @@ protected:
         callback_listener(const std::list<std::string>& channels, cb_func cb, unsigned long id) :
             cb{cb},
             channels{channels},
-            id{id} { }
+            id{id},
+            lane{lane_of_listener(channels)} { }
 
         cb_func cb;
         std::list<std::string> channels;
         unsigned long id;
+
+        // The only lane which calls this listener, so the statistics below are 
+        // only written by one thread
+        size_t lane;
+
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
     };
 
     // Map of event IDs to listener objects
     std::unordered_map<std::string, std::vector<std::shared_ptr<callback_listener>>> callback_table;
     std::unordered_map<unsigned long, std::shared_ptr<callback_listener>> callback_id_table;
 
-    // Event pool and handler thread
-    std::queue<std::shared_ptr<eventbus_event>> event_queue;
-    std::thread event_dispatch_t;
-    conditional_locker<int> event_cl;
+    // Channel IDs and the number of listeners on each channel and on all channels,
+    // changed under the handler mutex
+    std::unordered_map<std::string, int> channel_id_map;
+    std::atomic<unsigned int> channel_listener_count[EVENTBUS_MAX_CHANNELS];
+    std::atomic<unsigned int> all_listener_count;
+
+    // Listeners on the shared lane; publish only copies events to the shared lane
+    // while there are any
+    std::atomic<unsigned int> shared_listener_count;
+
+    int register_channel_locked(const std::string& channel);
+    void adjust_listener_count(const std::string& channel, int delta);
+
+    struct dispatch_lane {
+        dispatch_lane() :
+            backlog{0} { }
+
+        moodycamel::BlockingConcurrentQueue<std::shared_ptr<eventbus_event>> queue;
+        std::atomic<uint64_t> backlog;
+        std::thread dispatch_t;
+    };
+
+    static size_t lane_of(const std::string& channel) {
+        return std::hash<std::string>{}(channel) % EVENTBUS_DISPATCH_LANES;
+    }
+
+    static size_t lane_of_listener(const std::list<std::string>& channels) {
+        size_t lane = EVENTBUS_SHARED_LANE;
+
+        for (const auto& c : channels) {
+            if (c == "*")
+                return EVENTBUS_SHARED_LANE;
+
+            if (lane == EVENTBUS_SHARED_LANE)
+                lane = lane_of(c);
+            else if (lane != lane_of(c))
+                return EVENTBUS_SHARED_LANE;
+        }
+
+        return lane;
+    }
+
+    std::vector<std::unique_ptr<dispatch_lane>> dispatch_lanes;
     std::atomic<bool> shutdown;
-    void event_queue_dispatcher();
-    
+    void event_queue_dispatcher(size_t lane_id);
 };
 
 #endif
@@ -25,11 +25,14 @@
 #include <string>
 #include <mutex>
 #include <future>
+#include <initializer_list>
+#include <limits>
 #include <list>
 
 #include <stdlib.h>
 #include <string.h>
 
+#include "kis_mem_account.h"
 #include "messagebus.h"
 
 // Future chainbuf, based on stringbuf
@@ -41,28 +44,48 @@
 //
 // Once in packet mode it can not be set to stream mode
 //
+// In stream mode the put area of the stream is pointed directly at the free space of
+// the last chunk, so stream output is written straight into the chunks and only calls
+// back into the buffer (and takes the lock) when a sync-sized region fills.
+//
 // Offers two blocking interfaces:
 // wait() - waits until data is *present in the buffer*, should be called by the consumer
 // wait_write() - waits until the buffer *has flushed data*, should be called by a producer
 //  looking to throttle size buffer size.
+//
+// Stream producers can also be throttled automatically with set_high_water(); once more 
+// than the high water mark is buffered, stream writes block until the consumer drains
+// it, so a fast producer never holds the whole output in memory.  Producers holding a
+// lock suspend the mark with an unthrottled_scope.
 class future_chainbuf : public std::stringbuf {
 protected:
     class data_chunk {
     public:
-        data_chunk(size_t sz):
+        data_chunk(size_t sz, kis_mem_counter *acct):
             sz_{sz},
             start_{0},
-            end_{0} {
+            end_{0},
+            acct_{acct},
+            wrapped_{false} {
             chunk_ = std::shared_ptr<char>(new char[sz], std::default_delete<char[]>());
+
+            if (acct_ != nullptr)
+                acct_->add(sz_ + sizeof(data_chunk));
         }
 
+        // Chunks wrapping data from elsewhere aren't counted, and are never reused
         data_chunk(std::shared_ptr<char> data, size_t sz) :
             chunk_{data},
             sz_{sz},
             start_{0},
-            end_{sz} { }
+            end_{sz},
+            acct_{nullptr},
+            wrapped_{true} { }
 
-        ~data_chunk() { }
+        ~data_chunk() { 
+            if (acct_ != nullptr)
+                acct_->remove(sz_ + sizeof(data_chunk));
+        }
 
         size_t write(const char *data, size_t len) {
             size_t write_sz = std::min(sz_ - end_, len);
@@ -107,6 +130,8 @@ protected:
         std::shared_ptr<char> chunk_;
         size_t sz_;
         size_t start_, end_;
+        kis_mem_counter *acct_;
+        bool wrapped_;
     };
 
 public:
@@ -118,7 +143,10 @@ public:
         write_waiting_{false},
         complete_{false},
         cancel_{false},
-        packet_{false} { }
+        packet_{false},
+        high_water_sz_{0},
+        put_chunk_{nullptr},
+        acct_{kis_mem_account::fetch_counter("chainbuf", "chunk")} { }
         
     future_chainbuf(size_t chunk_sz, size_t sync_sz = 1024) :
         chunk_sz_{chunk_sz},
@@ -128,7 +156,10 @@ public:
         write_waiting_{false},
         complete_{false},
         cancel_{false},
-        packet_{false} { }
+        packet_{false},
+        high_water_sz_{0},
+        put_chunk_{nullptr},
+        acct_{kis_mem_account::fetch_counter("chainbuf", "chunk")} { }
 
     ~future_chainbuf() {
         cancel();
@@ -164,12 +195,12 @@ public:
         while (consumed_sz < sz && consumed_sz < total_sz_) {
             size_t consumed_chunk_sz;
 
-            consumed_chunk_sz = target->consume(sz);
+            consumed_chunk_sz = target->consume(sz - consumed_sz);
             consumed_sz += consumed_chunk_sz;
 
             if (target->exhausted()) {
                 if (chunk_list_.size() == 1) {
-                    if (packet_) {
+                    if (packet_ || target->wrapped_) {
                         chunk_list_.pop_front();
                         delete target;
                         target = nullptr;
@@ -191,12 +222,7 @@ public:
         else
             total_sz_-= consumed_sz;
 
-        try {
-            if (write_waiting_)
-                write_wait_promise_.set_value();
-        } catch (const std::future_error& e) {
-            ;
-        }
+        release_write_wait();
     }
 
     void put_data(const char *data, size_t sz) {
@@ -213,12 +239,15 @@ public:
             throw std::runtime_error("can't put char* in packet mode");
         }
 
+        commit_put_area();
+
         data_chunk *target;
 
-        if (chunk_list_.size() != 0) {
+        // Committing the put area may have filled the last chunk
+        if (chunk_list_.size() != 0 && chunk_list_.back()->available() != 0) {
             target = chunk_list_.back();
         } else {
-            target = new data_chunk(chunk_sz_);
+            target = new data_chunk(chunk_sz_, acct_);
             chunk_list_.push_back(target);
         }
 
@@ -231,7 +260,7 @@ public:
             written_sz += written_chunk_sz;
 
             if (target->available() == 0) {
-                target = new data_chunk(chunk_sz_);
+                target = new data_chunk(chunk_sz_, acct_);
                 chunk_list_.push_back(target);
             }
         }
@@ -255,6 +284,8 @@ public:
             return;
         }
 
+        commit_put_area();
+
         if (packet_) {
             data_chunk *target = new data_chunk(data, sz);
             chunk_list_.push_back(target);
@@ -269,10 +300,11 @@ public:
 
         data_chunk *target;
 
-        if (chunk_list_.size() != 0) {
+        // Committing the put area may have filled the last chunk
+        if (chunk_list_.size() != 0 && chunk_list_.back()->available() != 0) {
             target = chunk_list_.back();
         } else {
-            target = new data_chunk(chunk_sz_);
+            target = new data_chunk(chunk_sz_, acct_);
             chunk_list_.push_back(target);
         }
 
@@ -285,7 +317,7 @@ public:
             written_sz += written_chunk_sz;
 
             if (target->available() == 0) {
-                target = new data_chunk(chunk_sz_);
+                target = new data_chunk(chunk_sz_, acct_);
                 chunk_list_.push_back(target);
             }
         }
@@ -299,14 +331,104 @@ public:
 
     }
 
+    // Append a shared buffer without copying it, in stream mode; the buffer is held
+    // until the consumer has sent it.  Used to forward content which arrives already in
+    // a buffer of its own.
+    void put_shared(std::shared_ptr<char> data, size_t sz) {
+        if (sz == 0)
+            return;
+
+        mutex_.lock();
+
+        if (!running()) {
+            mutex_.unlock();
+            return;
+        }
+
+        if (packet_) {
+            mutex_.unlock();
+            throw std::runtime_error("can't put shared buffers in packet mode");
+        }
+
+        commit_put_area();
+
+        chunk_list_.push_back(new data_chunk(data, sz));
+        total_sz_ += sz;
+
+        mutex_.unlock();
+
+        sync();
+    }
+
+    // Append several shared buffers at once without copying them, in packet mode.  Used
+    // to assemble a block from a small header, a payload owned by someone else, and a 
+    // trailer; the consumer always sees the parts in order and the producer only takes
+    // the lock and wakes the consumer once.  Empty parts are skipped.
+    void put_gather(std::initializer_list<std::pair<std::shared_ptr<char>, size_t>> parts) {
+        mutex_.lock();
+
+        if (!running()) {
+            mutex_.unlock();
+            return;
+        }
+
+        if (!packet_) {
+            mutex_.unlock();
+            throw std::runtime_error("can't gather buffers in stream mode");
+        }
+
+        for (const auto& p : parts) {
+            if (p.second == 0)
+                continue;
+
+            chunk_list_.push_back(new data_chunk(p.first, p.second));
+            total_sz_ += p.second;
+        }
+
+        mutex_.unlock();
+
+        sync();
+    }
+
+    // Copy up to sz bytes from the front of the buffer, across chunks, without consuming
+    // them; lets a consumer combine many small packet mode chunks into a single write
+    size_t gather(char *data, size_t sz) {
+        const std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        size_t gathered_sz = 0;
+
+        for (auto c : chunk_list_) {
+            if (gathered_sz >= sz)
+                break;
+
+            size_t chunk_sz = std::min(c->used(), sz - gathered_sz);
+
+            memcpy(data + gathered_sz, c->content(), chunk_sz);
+            gathered_sz += chunk_sz;
+        }
+
+        return gathered_sz;
+    }
+
     virtual std::streamsize xsputn(const char_type *s, std::streamsize n) override {
         if (packet_)
             throw std::runtime_error("cannot use stream methods in packet mode");
 
+        // Copy directly into the chunk if it fits in the put area
+        if (epptr() - pptr() >= n) {
+            memcpy(pptr(), s, n);
+            pbump(n);
+            return n;
+        }
+
         put_data(s, n);
 
-        if (size() > sync_sz_)
-            sync();
+        {
+            const std::lock_guard<std::recursive_mutex> lock(mutex_);
+            open_put_area();
+        }
+
+        throttle();
 
         return n;
     }
@@ -315,20 +437,46 @@ public:
         if (packet_)
             throw std::runtime_error("cannot use stream methods in packet mode");
 
-        put_data((char *) &ch, 1);
+        {
+            const std::lock_guard<std::recursive_mutex> lock(mutex_);
 
-        if (size() > sync_sz_)
-            sync();
+            commit_put_area();
+
+            if (!running())
+                return ch;
+
+            open_put_area();
+
+            if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+        }
+
+        // The put area spans at most the sync size, so filling it is our cue to 
+        // hand the data to the consumer
+        sync();
+        throttle();
 
         return ch;
     }
 
     int sync() override {
         const std::lock_guard<std::recursive_mutex> lock(mutex_);
-        try {
-            wait_promise_.set_value();
-        } catch (const std::future_error& e) {
-            ;
+
+        // Publish anything written directly into the put area, and continue in
+        // the same chunk
+        if (put_chunk_ != nullptr) {
+            commit_put_area();
+            open_put_area();
+        }
+
+        if (waiting_) {
+            try {
+                wait_promise_.set_value();
+            } catch (const std::future_error& e) {
+                ;
+            }
         }
 
         waiting_ = false;
@@ -336,6 +484,96 @@ public:
         return 1;
     }
 
+    // Move the content of another stream mode buffer to the end of this one without
+    // copying it; used to assemble output generated in independent segments.  The 
+    // other buffer is left empty.
+    void splice(future_chainbuf& other) {
+        if (packet_ || other.packet_)
+            throw std::runtime_error("can't splice buffers in packet mode");
+
+        {
+            std::lock(mutex_, other.mutex_);
+            const std::lock_guard<std::recursive_mutex> lock(mutex_, std::adopt_lock);
+            const std::lock_guard<std::recursive_mutex> other_lock(other.mutex_, std::adopt_lock);
+
+            if (!running())
+                return;
+
+            commit_put_area();
+            other.commit_put_area();
+
+            // Chunks are only ever appended to at the end of the list, so cap the 
+            // last chunk where its content ends before anything follows it
+            if (chunk_list_.size() != 0) {
+                auto last = chunk_list_.back();
+
+                if (last->used() == 0) {
+                    chunk_list_.pop_back();
+                    delete last;
+                } else {
+                    last->sz_ = last->end_;
+                }
+            }
+
+            for (auto c : other.chunk_list_) {
+                if (c->used() == 0) {
+                    delete c;
+                    continue;
+                }
+
+                c->sz_ = c->end_;
+                chunk_list_.push_back(c);
+            }
+
+            total_sz_ += other.total_sz_;
+
+            other.chunk_list_.clear();
+            other.total_sz_ = 0;
+        }
+
+        sync();
+        throttle();
+    }
+
+    // Block stream writes while more than sz bytes are buffered, or 0 to never block
+    void set_high_water(size_t sz) {
+        high_water_sz_ = sz;
+    }
+
+    // Suspend the high water mark for the life of the scope; producers writing while 
+    // they hold a lock other threads need buffer their output instead of waiting on 
+    // the consumer with the lock held
+    class unthrottled_scope {
+    public:
+        unthrottled_scope(future_chainbuf& buf, bool enable = true) :
+            buf{buf},
+            enabled{enable},
+            high_water_sz{0} {
+            if (enabled)
+                high_water_sz = buf.high_water_sz_.exchange(0);
+        }
+
+        unthrottled_scope(const unthrottled_scope&) = delete;
+        unthrottled_scope& operator=(const unthrottled_scope&) = delete;
+
+        ~unthrottled_scope() {
+            if (enabled)
+                buf.high_water_sz_ = high_water_sz;
+        }
+
+    protected:
+        future_chainbuf& buf;
+        bool enabled;
+        size_t high_water_sz;
+    };
+
+    // Account the chunks allocated from now on under another category, such as
+    // serializer buffers
+    void set_mem_account(const std::string& category, const std::string& name) {
+        const std::lock_guard<std::recursive_mutex> lock(mutex_);
+        acct_ = kis_mem_account::fetch_counter(category, name);
+    }
+
     bool running() const {
         return (!complete_ && !cancel_);
     }
@@ -351,10 +589,13 @@ public:
         if (waiting_)
             throw std::runtime_error("reset futurechainbuf while waiting");
 
+        setp(nullptr, nullptr);
+        put_chunk_ = nullptr;
+
         for (auto c : chunk_list_)
             delete c;
         chunk_list_.clear();
-        chunk_list_.push_front(new data_chunk(chunk_sz_));
+        chunk_list_.push_front(new data_chunk(chunk_sz_, acct_));
 
         total_sz_ = 0;
         complete_ = false;
@@ -365,13 +606,16 @@ public:
     void cancel() {
         mutex_.lock();
         cancel_ = true;
+        release_write_wait();
         mutex_.unlock();
         sync();
     }
 
     void complete() {
         mutex_.lock();
+        commit_put_area();
         complete_ = true;
+        release_write_wait();
         mutex_.unlock();
         sync();
     }
@@ -400,6 +644,13 @@ public:
     }
 
     size_t wait_write() {
+        return wait_drain(std::numeric_limits<size_t>::max());
+    }
+
+    // Wait until the consumer has flushed data, unless no more than sz bytes are
+    // already buffered; checked under the lock, so a consumer which has already 
+    // drained the buffer can't leave us waiting
+    size_t wait_drain(size_t sz) {
         std::unique_lock<std::recursive_mutex> lk(mutex_);
 
         if (write_waiting_)
@@ -408,6 +659,9 @@ public:
         if (!running())
             return total_sz_;
 
+        if (sz != std::numeric_limits<size_t>::max() && total_sz_ <= sz)
+            return total_sz_;
+
         write_waiting_ = true;
         write_wait_promise_ = std::promise<void>();
         auto ft = write_wait_promise_.get_future();
@@ -418,7 +672,95 @@ public:
         return total_sz_;
     }
 
+    // As wait_drain, giving up after a timeout
+    size_t wait_drain_for(size_t sz, const std::chrono::milliseconds& timeout) {
+        std::unique_lock<std::recursive_mutex> lk(mutex_);
+
+        if (write_waiting_)
+            throw std::runtime_error("future_stream already blocking for write");
+
+        if (!running())
+            return total_sz_;
+
+        if (total_sz_ <= sz)
+            return total_sz_;
+
+        write_waiting_ = true;
+        write_wait_promise_ = std::promise<void>();
+        auto ft = write_wait_promise_.get_future();
+        lk.unlock();
+
+        if (ft.wait_for(timeout) == std::future_status::timeout) {
+            lk.lock();
+            write_waiting_ = false;
+        }
+
+        return total_sz_;
+    }
+
 protected:
+    // Move anything written into the put area to the chunk it points into; must
+    // be called with the mutex held
+    void commit_put_area() {
+        if (put_chunk_ != nullptr) {
+            size_t written = pptr() - pbase();
+            put_chunk_->end_ += written;
+            total_sz_ += written;
+            put_chunk_ = nullptr;
+        }
+
+        setp(nullptr, nullptr);
+    }
+
+    // Point the put area at the free space in the last chunk, up to the sync size;
+    // must be called with the mutex held
+    void open_put_area() {
+        if (packet_ || !running() || put_chunk_ != nullptr)
+            return;
+
+        data_chunk *target;
+
+        if (chunk_list_.size() != 0 && chunk_list_.back()->available() != 0) {
+            target = chunk_list_.back();
+        } else {
+            target = new data_chunk(chunk_sz_, acct_);
+            chunk_list_.push_back(target);
+        }
+
+        char *start = target->chunk_.get() + target->end_;
+        size_t len = std::min(target->available(), std::max(static_cast<size_t>(sync_sz_), 
+                    static_cast<size_t>(1)));
+
+        setp(start, start + len);
+        put_chunk_ = target;
+    }
+
+    // Wake a producer blocked in wait_write; must be called with the mutex held
+    void release_write_wait() {
+        if (!write_waiting_)
+            return;
+
+        try {
+            write_wait_promise_.set_value();
+        } catch (const std::future_error& e) {
+            ;
+        }
+
+        write_waiting_ = false;
+    }
+
+    // Block a stream producer while the buffer is over the high water mark
+    void throttle() {
+        if (high_water_sz_ == 0)
+            return;
+
+        while (running() && size() > high_water_sz_) {
+            // Make sure the consumer knows there's data before we wait on it
+            sync();
+            wait_drain(high_water_sz_);
+        }
+    }
+
     std::recursive_mutex mutex_;
 
     std::list<data_chunk *> chunk_list_;
@@ -438,6 +780,16 @@ protected:
 
     std::atomic<bool> packet_;
 
+    std::atomic<size_t> high_water_sz_;
+
+    // Chunk the stream put area currently points into, if any; this is always the last
+    // chunk, and the put area always starts at the end of the chunk content, so the 
+    // consumer never reaches it until it's committed.  A chunk is only exhausted (and 
+    // recycled by the consumer) once the put area in it is full and committed.
+    data_chunk *put_chunk_;
+
+    // Allocation accounting of the chunks allocated from now on, when enabled
+    kis_mem_counter *acct_;
 };
 
 
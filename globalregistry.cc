@@ -18,8 +18,10 @@
 
 #include "config.h"
 
+#include <cxxabi.h>
 #include <unistd.h>
 #include "globalregistry.h"
+#include "messagebus.h"
 #include "util.h"
 #include "macaddr.h"
 #include "trackedelement.h"
@@ -30,6 +32,10 @@ global_registry::global_registry() {
     ext_mutex.set_name("globalreg_ext_mutex");
     lifetime_mutex.set_name("globalreg_lifetime_mutex");
     deferred_mutex.set_name("globalreg_deferred_mutex");
+    startup_mutex.set_name("globalreg_startup_mutex");
+
+    startup_reported = false;
+    startup_begin = startup_last = std::chrono::steady_clock::now();
 
 	fatal_condition = false;
 	spindown = false;
@@ -131,6 +137,12 @@ int global_registry::insert_global(int in_ref, std::shared_ptr<void> in_data) {
 void global_registry::remove_global(int in_ref) {
     kis_lock_guard<kis_mutex> lk(ext_mutex, "global_registry remove_global");
 
+    auto hi = ext_handle_clear_map.find(in_ref);
+    if (hi != ext_handle_clear_map.end()) {
+        hi->second();
+        ext_handle_clear_map.erase(hi);
+    }
+
     if (ext_data_map.find(in_ref) != ext_data_map.end()) {
         ext_data_map.erase(ext_data_map.find(in_ref));
     }
@@ -139,6 +151,9 @@ void global_registry::remove_global(int in_ref) {
 int global_registry::insert_global(std::string in_name, std::shared_ptr<void> in_data) {
 	int ref = register_global(in_name);
 
+    // Globals are inserted once they're constructed
+    startup_mark(in_name);
+
 	return insert_global(ref, in_data);
 }
 
@@ -211,6 +226,11 @@ void global_registry::start_deferred() {
     
     for (auto i : deferred_vec) {
         i->trigger_deferred_startup();
+
+        auto& d = *i;
+        auto name = abi::__cxa_demangle(typeid(d).name(), nullptr, nullptr, nullptr);
+        startup_mark(fmt::format("{} deferred startup", name != nullptr ? name : typeid(d).name()));
+        free(name);
     }
 }
 
@@ -223,6 +243,49 @@ void global_registry::shutdown_deferred() {
     deferred_vec.clear();
 }
 
+void global_registry::startup_mark(const std::string& in_step) {
+    kis_lock_guard<kis_mutex> lk(startup_mutex, "global_registry startup_mark");
+
+    if (startup_reported)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    startup_steps.push_back(std::make_pair(in_step,
+                std::chrono::duration<double>(now - startup_last).count()));
+    startup_last = now;
+}
+
+void global_registry::report_startup_profile(bool in_detail) {
+    kis_unique_lock<kis_mutex> lk(startup_mutex, "global_registry report_startup_profile");
+
+    if (startup_reported)
+        return;
+
+    startup_reported = true;
+
+    auto total = std::chrono::duration<double>(startup_last - startup_begin).count();
+
+    auto steps = std::move(startup_steps);
+    startup_steps.clear();
+
+    lk.unlock();
+
+    if (!in_detail) {
+        _MSG_INFO("Startup took {:.3f} seconds", total);
+        return;
+    }
+
+    _MSG_INFO("Startup took {:.3f} seconds:", total);
+
+    // Steps under a millisecond are only noise
+    for (const auto& s : steps) {
+        if (s.second < 0.001)
+            continue;
+
+        _MSG_INFO("    {:>8.3f}s  {}", s.second, s.first);
+    }
+}
+
 std::atomic<unsigned long> Globalreg::n_tracked_fields;
 std::atomic<unsigned long> Globalreg::n_tracked_components;
 std::atomic<unsigned long> Globalreg::n_tracked_http_connections;
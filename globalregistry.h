@@ -22,6 +22,9 @@
 #include "config.h"
 
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <unistd.h>
 #include <memory>
 #include <typeinfo>
@@ -58,6 +61,8 @@ class kis_manuf;
 class entry_tracker;
 // HTTP server
 class kis_net_beast_httpd;
+// IO thread pools
+class kis_io_pool;
 
 #define KISMET_INSTANCE_SERVER	0
 #define KISMET_INSTANCE_DRONE	1
@@ -140,6 +145,21 @@ public:
 
 class tracker_element_uuid;
 
+namespace Globalreg {
+    // Typed handle to a global, set when a global of that type is inserted and cleared
+    // when it's removed.  Fetching a global through its handle is a single atomic load
+    // instead of a locked lookup by name and a shared_ptr copy, for the code which
+    // needs a global for every packet or request.  The handle doesn't hold a reference;
+    // the registry does, until the global is removed at shutdown.
+    template<typename T>
+    struct global_handle {
+        static std::atomic<T *> ptr;
+    };
+
+    template<typename T>
+    std::atomic<T *> global_handle<T>::ptr{nullptr};
+}
+
 class global_registry {
 public:
 	// argc and argv for modules to allow overrides
@@ -236,6 +256,28 @@ public:
     void remove_global(int in_ref);
     void remove_global(std::string in_name);
 
+    // Insert a global and set the typed handle for its type
+    template<typename T>
+    int insert_global(std::string in_name, std::shared_ptr<T> in_data) {
+        int ref = register_global(in_name);
+
+        insert_global(in_name, std::static_pointer_cast<void>(in_data));
+
+        auto ptr = in_data.get();
+        Globalreg::global_handle<T>::ptr.store(ptr, std::memory_order_release);
+
+        kis_lock_guard<kis_mutex> lk(ext_mutex, "global_registry insert_global handle");
+
+        // Only clear the handle if it still refers to this global
+        ext_handle_clear_map[ref] = [ptr]() {
+            auto expected = ptr;
+            Globalreg::global_handle<T>::ptr.compare_exchange_strong(expected, nullptr,
+                    std::memory_order_acq_rel);
+        };
+
+        return 1;
+    }
+
     // Add a CLI extension
     typedef void (*usage_func)(const char *);
     void RegisterUsageFunc(usage_func in_cli);
@@ -255,15 +297,33 @@ public:
     void start_deferred();
     void shutdown_deferred();
 
-    // Global ASIO contexts and IO threads
+    // Startup profile.  Each step is timed from the end of the previous one; globals
+    // mark a step when they're inserted, deferred startups when they're triggered, and
+    // the server marks the steps in between.  Marks after the profile is reported are
+    // ignored.
+    void startup_mark(const std::string& in_step);
+    void report_startup_profile(bool in_detail);
+
+    // Global ASIO contexts.  The thread counts are only a concurrency hint to ASIO; the
+    // threads running each context are an adaptive pool, started once the server is up
     const int n_io_threads = static_cast<int>(std::thread::hardware_concurrency() * 4);
     boost::asio::io_context io{n_io_threads};
 
+    // Web server accept and websocket IO have their own context, so that bursts of
+    // web clients don't delay datasource and external IPC IO on the main context
+    const int n_http_io_threads = static_cast<int>(std::max(2U, std::thread::hardware_concurrency()));
+    boost::asio::io_context http_io{n_http_io_threads};
+
+    std::shared_ptr<kis_io_pool> io_pool;
+    std::shared_ptr<kis_io_pool> http_io_pool;
+
     kis_mutex ext_mutex;
     // Exernal global references, string to intid
     std::map<std::string, int> ext_name_map;
     // External globals
     std::map<int, std::shared_ptr<void> > ext_data_map;
+    // Clear the typed handle of each global inserted with one
+    std::map<int, std::function<void ()>> ext_handle_clear_map;
     std::atomic<int> next_ext_ref;
 
     kis_mutex lifetime_mutex;
@@ -275,6 +335,11 @@ public:
 
     kis_mutex pool_map_mutex;
     robin_hood::unordered_map<size_t, std::shared_ptr<void>> object_pool_map;
+
+    kis_mutex startup_mutex;
+    bool startup_reported;
+    std::chrono::steady_clock::time_point startup_begin, startup_last;
+    std::vector<std::pair<std::string, double>> startup_steps;
 };
 
 namespace Globalreg {
@@ -326,6 +391,30 @@ namespace Globalreg {
         return fetch_mandatory_global_as<T>(Globalreg::globalreg, in_name);
     }
 
+    // Fetch a global through its typed handle, without a lock or a reference, or nullptr
+    // if it doesn't exist.  Globals inserted without a type, such as by name from a
+    // plugin, are found by name instead.
+    template<typename T>
+    T *fetch_global_handle() {
+        auto r = global_handle<T>::ptr.load(std::memory_order_acquire);
+
+        if (r != nullptr)
+            return r;
+
+        return fetch_global_as<T>(globalreg, T::global_name()).get();
+    }
+
+    template<typename T>
+    T *fetch_mandatory_global_handle() {
+        auto r = fetch_global_handle<T>();
+
+        if (r == nullptr)
+            throw std::runtime_error(fmt::format("Unable to find '{}' in the global registry, "
+                        "code initialization may be out of order.", T::global_name()));
+
+        return r;
+    }
+
     template<typename T>
     std::shared_ptr<T> fetch_mandatory_global_as() {
         return fetch_mandatory_global_as<T>(Globalreg::globalreg, T::global_name());
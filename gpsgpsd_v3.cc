@@ -18,8 +18,10 @@
 
 #include "config.h"
 
+#include <stdlib.h>
 #include <time.h>
 #include <future>
+#include <string_view>
 
 #include "gpsgpsd_v3.h"
 #include "gpstracker.h"
@@ -29,6 +31,187 @@
 
 #include "fmt_asio.h"
 
+namespace {
+    // gpsd reports are flat JSON objects, one per line, at up to 10Hz or more; rather
+    // than decoding each report into a json tree, walk the top-level fields of the line
+    // in place.  Nested objects and arrays (like the satellites of a SKY report) are
+    // skipped without being decoded, and strings are not unescaped.
+    class gpsd_json_scanner {
+    public:
+        gpsd_json_scanner(const std::string& in_line) :
+            line{in_line},
+            pos{0},
+            first{true},
+            done{false},
+            err{false} {
+
+            skip_ws();
+
+            if (pos >= line.length() || line[pos] != '{')
+                fail();
+            else
+                pos++;
+        }
+
+        // Advance to the next field; false at the end of the object or on an error
+        bool next_field() {
+            if (done)
+                return false;
+
+            skip_ws();
+
+            if (pos < line.length() && line[pos] == '}') {
+                done = true;
+                return false;
+            }
+
+            if (!first) {
+                if (pos >= line.length() || line[pos] != ',')
+                    return fail();
+                pos++;
+                skip_ws();
+            }
+
+            first = false;
+
+            auto key_start = pos;
+
+            if (!skip_string())
+                return fail();
+
+            key_ = std::string_view(line.data() + key_start + 1, pos - key_start - 2);
+
+            skip_ws();
+
+            if (pos >= line.length() || line[pos] != ':')
+                return fail();
+            pos++;
+
+            skip_ws();
+
+            value_start = pos;
+
+            if (!skip_value())
+                return fail();
+
+            value_end = pos;
+
+            return true;
+        }
+
+        std::string_view key() const {
+            return key_;
+        }
+
+        bool is_number() const {
+            auto c = line[value_start];
+            return c == '-' || (c >= '0' && c <= '9');
+        }
+
+        // Numeric value of the field, or 0
+        double number() const {
+            if (!is_number())
+                return 0;
+
+            // Numbers always end in a delimiter within the line, so the string is
+            // parsed where it lies
+            return strtod(line.c_str() + value_start, nullptr);
+        }
+
+        // String value of the field without its quotes, or empty
+        std::string_view string() const {
+            if (line[value_start] != '"')
+                return std::string_view();
+
+            return std::string_view(line.data() + value_start + 1, value_end - value_start - 2);
+        }
+
+        bool error() const {
+            return err;
+        }
+
+    protected:
+        bool fail() {
+            done = true;
+            err = true;
+            return false;
+        }
+
+        void skip_ws() {
+            while (pos < line.length() && (line[pos] == ' ' || line[pos] == '\t' ||
+                        line[pos] == '\r' || line[pos] == '\n'))
+                pos++;
+        }
+
+        bool skip_string() {
+            if (pos >= line.length() || line[pos] != '"')
+                return false;
+
+            for (pos++; pos < line.length(); pos++) {
+                if (line[pos] == '\\') {
+                    pos++;
+                } else if (line[pos] == '"') {
+                    pos++;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool skip_value() {
+            if (pos >= line.length())
+                return false;
+
+            if (line[pos] == '"')
+                return skip_string();
+
+            if (line[pos] == '{' || line[pos] == '[') {
+                unsigned int depth = 0;
+
+                while (pos < line.length()) {
+                    auto c = line[pos];
+
+                    if (c == '"') {
+                        if (!skip_string())
+                            return false;
+                        continue;
+                    }
+
+                    if (c == '{' || c == '[') {
+                        depth++;
+                    } else if (c == '}' || c == ']') {
+                        if (--depth == 0) {
+                            pos++;
+                            return true;
+                        }
+                    }
+
+                    pos++;
+                }
+
+                return false;
+            }
+
+            // Numbers, true, false, and null run to the next delimiter
+            auto start = pos;
+
+            while (pos < line.length() && line[pos] != ',' && line[pos] != '}' &&
+                    line[pos] != ']' && line[pos] != ' ')
+                pos++;
+
+            return pos != start;
+        }
+
+        const std::string& line;
+        size_t pos;
+        bool first, done, err;
+
+        std::string_view key_;
+        size_t value_start, value_end;
+    };
+}
+
 kis_gps_gpsd_v3::kis_gps_gpsd_v3(shared_gps_builder in_builder) : 
     kis_gps(in_builder),
     resolver{Globalreg::globalreg->io},
@@ -264,10 +447,12 @@ void kis_gps_gpsd_v3::handle_read(const boost::system::error_code& error, std::s
         return;
     }
 
-    // Pull the buffer
-    std::string line;
+    // Pull the buffer; the line is read into the same string every time, which keeps
+    // its capacity between reports
     std::istream is(&in_buf);
-    std::getline(is, line);
+    std::getline(is, in_line);
+
+    const auto& line = in_line;
 
     // Ignore blank lines from gpsd
     if (line.empty()) {
@@ -303,17 +488,26 @@ void kis_gps_gpsd_v3::handle_read(const boost::system::error_code& error, std::s
     // We don't know what we're going to get from GPSD.  If it starts with 
     // { then it probably is json, try to parse it
     if (line[0] == '{') {
-        nlohmann::json json;
+        gpsd_json_scanner json(line);
 
-        try {
-            std::stringstream ss(line);
-            ss >> json;
+        // gpsd leads every report with the class; reports we don't use, like the
+        // verbose SKY reports, are dropped as soon as the class is known
+        std::string_view msg_class;
 
-            std::string msg_class = json["class"];
+        while (msg_class.length() == 0 && json.next_field()) {
+            if (json.key() == "class")
+                msg_class = json.string();
+        }
 
-            if (msg_class == "VERSION") {
-                std::string version  = munge_to_printable(json["release"]);
+        if (msg_class == "VERSION") {
+            std::string version;
 
+            while (json.next_field()) {
+                if (json.key() == "release")
+                    version = munge_to_printable(std::string(json.string()));
+            }
+
+            if (!json.error()) {
                 _MSG_INFO("(GPS) Connected to a JSON-enabled GPSD ({}), enabling JSON mode", version);
 
                 // Set JSON mode
@@ -322,102 +516,79 @@ void kis_gps_gpsd_v3::handle_read(const boost::system::error_code& error, std::s
                 si_units = 1;
 
                 write_gpsd("?WATCH={\"json\":true};\n");
-            } else if (msg_class == "TPV") {
-                new_location->fix = json.value("mode", 0);
+            }
+        } else if (msg_class == "TPV") {
+            double mode = 0, alt = 0, epx = 0, epy = 0, epv = 0;
+            double lat = 0, lon = 0, track = 0, magtrack = 0, speed = 0;
+
+            while (json.next_field()) {
+                auto k = json.key();
+
+                if (k == "mode")
+                    mode = json.number();
+                else if (k == "alt")
+                    alt = json.number();
+                else if (k == "epx")
+                    epx = json.number();
+                else if (k == "epy")
+                    epy = json.number();
+                else if (k == "epv")
+                    epv = json.number();
+                else if (k == "lat")
+                    lat = json.number();
+                else if (k == "lon")
+                    lon = json.number();
+                else if (k == "track")
+                    track = json.number();
+                else if (k == "magtrack")
+                    magtrack = json.number();
+                else if (k == "speed")
+                    speed = json.number();
+            }
+
+            if (!json.error()) {
+                new_location->fix = (int) mode;
                 set_fix = true;
 
                 // If we have a valid alt, use it
                 if (set_fix && new_location->fix > 2) {
-                    new_location->alt = json.value("alt", (double) 0);
+                    new_location->alt = alt;
                     set_alt = true;
                 } 
 
-                new_location->error_x = json.value("epx", (double) 0);
-                new_location->error_y = json.value("epy", (double) 0);
-                new_location->error_v = json.value("epv", (double) 0);
-
+                new_location->error_x = epx;
+                new_location->error_y = epy;
+                new_location->error_v = epv;
 
                 if (set_fix && new_location->fix >= 2) {
-                    new_location->lat = json.value("lat", (double) 0);
-                    new_location->lon = json.value("lon", (double) 0);
+                    new_location->lat = lat;
+                    new_location->lon = lon;
 
                     if (new_location->lat != 0 && new_location->lon != 0)
                         set_lat_lon = true;
 
-                    new_location->heading = json.value("track", (double) 0);
+                    new_location->heading = track;
                     if (new_location->heading != 0)
                         set_heading = true;
 
-                    new_location->magheading = json.value("magtrack", (double) 0);
+                    new_location->magheading = magtrack;
                     if (new_location->magheading != 0)
                         set_magheading = true;
 
-                    new_location->speed = json.value("speed", (double) 0) * 3.6;
+                    new_location->speed = speed * 3.6;
                 }
-            } else if (msg_class == "ATT") {
-                auto heading_j = json["heading"];
-                if (heading_j.is_number()) {
+            }
+        } else if (msg_class == "ATT") {
+            while (json.next_field()) {
+                if (json.key() == "heading" && json.is_number()) {
                     last_att_heading_time = time(0);
-                    last_att_heading = heading_j;
+                    last_att_heading = json.number();
                 }
-#if 0
-            } else if (msg_class == "SKY") {
-                GPSCore::sat_pos sp;
-                struct JSON_value *v = NULL, *s = NULL;
-
-                gps_connected = 1;
-
-                v = JSON_dict_get_value(json, "satellites", err);
-
-                if (err.length() == 0 && v != NULL) {
-                    sat_pos_map.clear();
-
-                    if (v->value.tok_type == JSON_arrstart) {
-                        for (unsigned int z = 0; z < v->value_array.size(); z++) {
-                            float prn, ele, az, snr;
-                            int valid = 1;
-
-                            s = v->value_array[z];
-
-                            // If we're not a dictionary in the sat array, skip
-                            if (s->value.tok_type != JSON_start) {
-                                continue;
-                            }
-
-                            prn = JSON_dict_get_number(s, "PRN", err);
-                            if (err.length() != 0) 
-                                valid = 0;
-
-                            ele = JSON_dict_get_number(s, "el", err);
-                            if (err.length() != 0)
-                                valid = 0;
-
-                            az = JSON_dict_get_number(s, "az", err);
-                            if (err.length() != 0)
-                                valid = 0;
-
-                            snr = JSON_dict_get_number(s, "ss", err);
-                            if (err.length() != 0)
-                                valid = 0;
-
-                            if (valid) {
-                                sp.prn = prn;
-                                sp.elevation = ele;
-                                sp.azimuth = az;
-                                sp.snr = snr;
-
-                                sat_pos_map[prn] = sp;
-                            }
-                        }
-
-                    }
-
-                }
-#endif
             }
+        }
 
-        } catch (std::exception& e) {
-            _MSG_ERROR("(GPS) Received an invalid JSON record from GPSD {}:{} - '{}'", host, port, e.what());
+        if (json.error()) {
+            _MSG_ERROR("(GPS) Received an invalid JSON record from GPSD {}:{}", host, port);
             close_impl();
             handle_error();
             return;
@@ -676,11 +847,11 @@ void kis_gps_gpsd_v3::handle_read(const boost::system::error_code& error, std::s
             }
         }
 
-        // Sync w/ the tracked fields
-        update_locations();
-
         gps_last_location = gps_location;
         gps_location = new_location;
+
+        // Sync w/ the tracked fields and publish the new fix
+        update_locations();
     }
 
     lk.unlock();
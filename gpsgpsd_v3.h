@@ -70,6 +70,9 @@ protected:
     boost::asio::strand<boost::asio::io_context::executor_type> strand_;
     boost::asio::streambuf in_buf{4096};
 
+    // Current line from gpsd, reused between reads
+    std::string in_line;
+
     std::string host, port;
 
     // Last time we got data, to allow us to reset the connection if we 
@@ -35,7 +35,8 @@
 #include "kis_databaselogfile.h"
 
 gps_tracker::gps_tracker() :
-    lifetime_global() {
+    lifetime_global(),
+    publish_pending{false} {
 
     gpsmanager_mutex.set_name("gps_tracker");
 
@@ -60,6 +61,7 @@ gps_tracker::~gps_tracker() {
 void gps_tracker::trigger_deferred_startup() {
     timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
     eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
+    event_gps_location_chan = eventbus->register_channel(event_gps_location());
 
     tracked_uuid_addition_id = 
         Globalreg::globalreg->entrytracker->register_field("kismet.common.location.gps_uuid", 
@@ -236,6 +238,12 @@ void gps_tracker::trigger_deferred_startup() {
     event_timer_id = 
         timetracker->register_timer(std::chrono::seconds(1), true, 
                 [this](int) -> int {
+                    // Drivers only publish on a new fix, so expire stale ones here
+                    publish_location();
+
+                    if (!eventbus->has_listeners(event_gps_location_chan))
+                        return 1;
+
                     kis_lock_guard<kis_mutex> lk(gpsmanager_mutex, "gps_tracker location event");
 
                     auto loctrip = Globalreg::new_from_pool<kis_tracked_location_full>();
@@ -373,6 +381,8 @@ std::shared_ptr<kis_gps> gps_tracker::create_gps(std::string in_definition) {
                 return ga->get_gps_priority() < gb->get_gps_priority();
             });
 
+    queue_publish_location();
+
     return gps;
 }
 
@@ -418,6 +428,8 @@ bool gps_tracker::remove_gps(uuid in_uuid) {
         if (gps->get_gps_uuid() == in_uuid) {
             gps_instances_vec->erase(gps_instances_vec->begin() + i);
 
+            queue_publish_location();
+
             return true;
         }
     }
@@ -458,11 +470,28 @@ std::shared_ptr<kis_gps> gps_tracker::find_gps_by_name(const std::string& in_nam
     return nullptr;
 }
 
-std::shared_ptr<kis_gps_packinfo> gps_tracker::get_best_location() {
-    kis_lock_guard<kis_mutex> lk(gpsmanager_mutex, "get_best_location");
+void gps_tracker::queue_publish_location() {
+    // Drivers call this holding their own locks, so the GPS list is never walked 
+    // here; one rebuild covers every update queued before it runs
+    if (publish_pending.exchange(true))
+        return;
 
-    if (gps_instances_vec == nullptr)
-        return nullptr;
+    boost::asio::post(Globalreg::globalreg->io, 
+            []() {
+                auto gpstracker = Globalreg::fetch_global_as<gps_tracker>();
+
+                if (gpstracker == nullptr)
+                    return;
+
+                gpstracker->publish_pending = false;
+                gpstracker->publish_location();
+            });
+}
+
+void gps_tracker::publish_location() {
+    kis_lock_guard<kis_mutex> lk(gpsmanager_mutex, "publish_location");
+
+    std::shared_ptr<kis_gps_packinfo> best;
 
     // Iterate 
     for (const auto& d : *gps_instances_vec) {
@@ -472,11 +501,12 @@ std::shared_ptr<kis_gps_packinfo> gps_tracker::get_best_location() {
             continue;
 
         if (gps->get_location_valid()) {
-            return gps->get_location();
+            best = gps->get_location();
+            break;
         }
     }
 
-    return nullptr;
+    std::atomic_store(&best_location, best);
 }
 
 int gps_tracker::kis_gpspack_hook(CHAINCALL_PARMS) {
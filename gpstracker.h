@@ -137,6 +137,7 @@ public:
     // Name of GPS that created us
     std::string gpsname;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_gps_packinfo, packet_slot::gps)
 
 // Packet component used to tell other components NOT to include gps info
 // from the live GPS
@@ -188,8 +189,15 @@ public:
     // Set a primary GPS
     bool set_primary_gps(uuid in_uuid);
 
-    // get the best location (as in the 'best' gps devices first)
-    std::shared_ptr<kis_gps_packinfo> get_best_location();
+    // get the best location (as in the 'best' gps devices first); this is the
+    // published snapshot and takes no locks
+    std::shared_ptr<kis_gps_packinfo> get_best_location() {
+        return std::atomic_load(&best_location);
+    }
+
+    // Re-publish the best location; GPS drivers call this when they get a new fix.
+    // Updates are coalesced and the snapshot is rebuilt from the IO pool.
+    void queue_publish_location();
 
     // Populate packets that don't have a GPS location
     static int kis_gpspack_hook(CHAINCALL_PARMS);
@@ -199,6 +207,15 @@ public:
 protected:
     kis_mutex gpsmanager_mutex;
 
+    // The current best location, as an immutable snapshot which packets reference
+    // directly.  Fixes change a few times a second while packets look them up tens
+    // of thousands of times, so the lookup is an atomic load and only the publisher
+    // walks the GPS list.
+    std::shared_ptr<kis_gps_packinfo> best_location;
+    std::atomic<bool> publish_pending;
+
+    void publish_location();
+
     std::shared_ptr<tracker_element_vector> gps_prototypes_vec;
 
     // GPS instances, as a vector, sorted by priority; we don't mind doing a 
@@ -221,6 +238,7 @@ protected:
     std::shared_ptr<time_tracker> timetracker;
     int event_timer_id;
     std::shared_ptr<event_bus> eventbus;
+    int event_gps_location_chan;
 };
 
 #endif
@@ -27,6 +27,8 @@
 #include <string>
 #include <math.h>
 #include <cmath>
+#include <future>
+#include <thread>
 
 #include "globalregistry.h"
 #include "trackedelement.h"
@@ -34,14 +36,24 @@
 #include "entrytracker.h"
 #include "uuid.h"
 #include "devicetracker_component.h"
+#include "future_chainbuf.h"
 #include "json_adapter.h"
+#include "string_scan.h"
 
 /* sanitize_extra_space and sanitize_string taken from nlohmann's jsonhpp library,
    Copyright 2013-2015 Niels Lohmann. and under the MIT license */
 std::size_t json_adapter::sanitize_extra_space(const std::string& s) noexcept {
     std::size_t result = 0;
 
-    for (const auto& c : s) {
+    const auto data = s.data();
+    const auto len = s.length();
+
+    // Only the bytes between the runs which need no escaping are examined; most
+    // strings are a single run
+    for (auto i = json_plain_span(data, len); i < len; 
+            i += 1 + json_plain_span(data + i + 1, len - i - 1)) {
+        const auto c = data[i];
+
         switch (c) {
             case '"':
             case '\\':
@@ -81,7 +93,22 @@ std::string json_adapter::sanitize_string(const std::string& s) noexcept {
     std::string result(s.size() + space, '\\');
     std::size_t pos = 0;
 
-    for (const auto& c : s) {
+    const auto data = s.data();
+    const auto len = s.length();
+    std::size_t i = 0;
+
+    while (true) {
+        // copy the run which needs no escaping whole
+        const auto run = json_plain_span(data + i, len - i);
+        memcpy(&result[pos], data + i, run);
+        pos += run;
+        i += run;
+
+        if (i >= len)
+            break;
+
+        const auto c = data[i++];
+
         switch (c) {
             // quotation mark (0x22)
             case '"':
@@ -141,19 +168,11 @@ std::string json_adapter::sanitize_string(const std::string& s) noexcept {
 
             default:
                 {
-                    if (c >= 0x00 and c <= 0x1f)
-                    {
-                        // print character c as \uxxxx
-                        sprintf(&result[pos + 1], "u%04x", int(c));
-                        pos += 6;
-                        // overwrite trailing null character
-                        result[pos] = '\\';
-                    }
-                    else
-                    {
-                        // all other characters are added as-is
-                        result[pos++] = c;
-                    }
+                    // the other control characters; print character c as \uxxxx
+                    sprintf(&result[pos + 1], "u%04x", int(c));
+                    pos += 6;
+                    // overwrite trailing null character
+                    result[pos] = '\\';
                     break;
                 }
         }
@@ -162,10 +181,77 @@ std::string json_adapter::sanitize_string(const std::string& s) noexcept {
     return result;
 }
 
+json_adapter::key_cache::key_cache(permuter_t permuter) :
+    permuter{permuter} {
+    mutex.set_name("json_adapter key_cache");
+
+    for (auto& p : pages)
+        p = nullptr;
+}
+
+json_adapter::key_cache::~key_cache() {
+    for (auto& p : pages) {
+        auto page = p.load();
+
+        if (page == nullptr)
+            continue;
+
+        for (auto& k : page->keys)
+            delete k.load();
+
+        delete page;
+    }
+}
+
+const std::string& json_adapter::key_cache::build_key(uint16_t field_id) {
+    kis_lock_guard<kis_mutex> lk(mutex, "key_cache build_key");
+
+    auto page = pages[field_id >> page_bits].load(std::memory_order_relaxed);
+
+    if (page == nullptr) {
+        page = new key_page();
+        pages[field_id >> page_bits].store(page, std::memory_order_release);
+    }
+
+    auto k = page->keys[field_id & page_mask].load(std::memory_order_relaxed);
+    if (k != nullptr)
+        return *k;
+
+    auto name = Globalreg::globalreg->entrytracker->get_field_name(field_id);
+    auto key = fmt::format("\"{}\": ", sanitize_string(permute(name)));
+
+    // Fields can be registered after we first see their id; don't cache the 
+    // placeholder name
+    if (Globalreg::globalreg->entrytracker->get_field_id(name) != field_id)
+        return unknown_keys.emplace(field_id, key).first->second;
+
+    k = new std::string(key);
+    page->keys[field_id & page_mask].store(k, std::memory_order_release);
+
+    return *k;
+}
+
+json_adapter::key_cache& json_adapter::plain_keys() {
+    static key_cache keys;
+    return keys;
+}
+
+json_adapter::key_cache& json_adapter::underscore_keys() {
+    static key_cache keys([](const std::string& s) {
+            return multi_replace_all(s, ".", "_");
+            });
+    return keys;
+}
+
+void json_adapter::pack(std::ostream &stream, shared_tracker_element e, 
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map,
+        bool prettyprint, unsigned int depth) {
+    pack(stream, e, name_map, prettyprint, depth, plain_keys());
+}
+
 void json_adapter::pack(std::ostream &stream, shared_tracker_element e, 
         std::shared_ptr<tracker_element_serializer::rename_map> name_map,
-        bool prettyprint, unsigned int depth,
-        std::function<std::string (const std::string&)> name_permuter) {
+        bool prettyprint, unsigned int depth, key_cache& keys) {
 
     std::string indent;
     std::string ppendl;
@@ -200,7 +286,15 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
         }
     }
 
-    if (e->is_stringable()) {
+    if (e->get_type() == tracker_type::tracker_mac_addr) {
+        // Macs never need escaping, so they're formatted straight into the stream
+        char macbuf[mac_addr::format_max + 1];
+        auto len = static_cast<tracker_element_mac_addr *>(e.get())->get().format_to(macbuf);
+
+        stream << "\"";
+        stream.write(macbuf, len);
+        stream << "\"";
+    } else if (e->is_stringable()) {
         if (e->needs_quotes())
             stream << "\"" << sanitize_string(e->as_string()) << "\"";
         else
@@ -223,7 +317,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     if (prettyprint)
                         stream << indent;
 
-                    json_adapter::pack(stream, i, name_map, prettyprint, depth + 1, name_permuter);
+                    json_adapter::pack(stream, i, name_map, prettyprint, depth + 1, keys);
                 }
                 stream << ppendl << indent << "]";
                 break;
@@ -277,11 +371,11 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     stream << ppendl << indent << "{" << ppendl;
 
                 prepend_comma = false;
-                for (auto i : *static_cast<tracker_element_map *>(e.get())) {
+                static_cast<tracker_element_map *>(e.get())->for_each_field([&](const auto& i) {
                     bool named = false;
 
                     if (i.second == NULL)
-                        continue;
+                        return;
 
                     if (prepend_comma) {
                         stream << "," << ppendl;
@@ -301,6 +395,15 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                             }
                         }
 
+                        // Plain field names come pre-formed from the key cache
+                        if (!named && !prettyprint &&
+                                i.second->get_type() != tracker_type::tracker_placeholder_missing &&
+                                i.second->get_type() != tracker_type::tracker_alias) {
+                            stream << indent << keys.key(i.first);
+                            json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
+                            return;
+                        }
+
                         if (!named) {
                             if (i.second == NULL) {
                                 tname = Globalreg::globalreg->entrytracker->get_field_name(i.first);
@@ -319,7 +422,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                             }
                         }
 
-                        tname = json_adapter::sanitize_string(name_permuter(tname));
+                        tname = json_adapter::sanitize_string(keys.permute(tname));
 
                         if (prettyprint) {
                             stream << indent << "\"description." << tname << "\": ";
@@ -335,9 +438,8 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                         stream << indent << "\"" << tname << "\": ";
                     }
 
-                    json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
-
-                }
+                    json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
+                });
 
                 if (as_vector || as_key_vector)
                     stream << ppendl << indent << "]";
@@ -372,7 +474,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -409,7 +511,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -446,7 +548,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -482,7 +584,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -527,7 +629,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -570,7 +672,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream, i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -654,7 +756,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                     }
 
                     if (!as_key_vector) {
-                        json_adapter::pack(stream,i.second, name_map, prettyprint, depth + 1, name_permuter);
+                        json_adapter::pack(stream,i.second, name_map, prettyprint, depth + 1, keys);
                     }
                 }
 
@@ -701,6 +803,14 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                         }
                     }
 
+                    if (!named && !prettyprint &&
+                            i->get_type() != tracker_type::tracker_placeholder_missing &&
+                            i->get_type() != tracker_type::tracker_alias) {
+                        stream << indent << keys.key(i->get_id());
+                        json_adapter::pack(stream, i, name_map, prettyprint, depth + 1, keys);
+                        continue;
+                    }
+
                     if (!named) {
                         if (i->get_type() == tracker_type::tracker_placeholder_missing) {
                             tname = static_cast<tracker_element_placeholder *>(i.get())->get_name();
@@ -715,7 +825,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
                             tname = Globalreg::globalreg->entrytracker->get_field_name(i->get_id());
                     }
 
-                    tname = json_adapter::sanitize_string(name_permuter(tname));
+                    tname = json_adapter::sanitize_string(keys.permute(tname));
 
                     if (prettyprint) {
                         stream << indent << "\"description." << tname << "\": ";
@@ -730,7 +840,7 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
 
                     stream << indent << "\"" << tname << "\": ";
 
-                    json_adapter::pack(stream, i, name_map, prettyprint, depth + 1, name_permuter);
+                    json_adapter::pack(stream, i, name_map, prettyprint, depth + 1, keys);
                 }
 
                 stream << ppendl << indent << "}";
@@ -742,3 +852,217 @@ void json_adapter::pack(std::ostream &stream, shared_tracker_element e,
     }
 }
 
+void json_adapter::pack_summary(std::ostream &stream, shared_tracker_element e,
+        const std::vector<SharedElementSummary>& summary, key_cache& keys) {
+
+    // Only field maps can be summarized directly; anything else goes through the
+    // normal summarization
+    if (e == nullptr || e->get_type() != tracker_type::tracker_map) {
+        auto name_map = Globalreg::new_from_pool<tracker_element_serializer::rename_map>();
+        pack(stream, summarize_tracker_element(e, summary, name_map), name_map, false, 0, keys);
+        return;
+    }
+
+    serializer_scope s(e, nullptr);
+
+    std::vector<shared_tracker_element> inter;
+
+    bool prepend_comma = false;
+
+    stream << "{";
+
+    for (const auto& si : summary) {
+        if (si->resolved_path.size() == 0)
+            continue;
+
+        // Descend the path, pre-serializing the intermediate records before looking
+        // inside them, the same as the serializer does for a summarized path
+        shared_tracker_element f = e;
+        inter.clear();
+
+        for (const auto& p : si->resolved_path) {
+            if (f->get_type() == tracker_type::tracker_alias) {
+                f = static_cast<tracker_element_alias *>(f.get())->get();
+
+                if (f == nullptr)
+                    break;
+            }
+
+            if (p < 0 || f->get_type() != tracker_type::tracker_map) {
+                f = nullptr;
+                break;
+            }
+
+            if (f != e) {
+                f->pre_serialize();
+                inter.push_back(f);
+            }
+
+            f = static_cast<tracker_element_map *>(f.get())->get_sub(p);
+
+            if (f == nullptr)
+                break;
+        }
+
+        if (prepend_comma)
+            stream << ",";
+        prepend_comma = true;
+
+        if (f == nullptr) {
+            // Missing fields are reported as 0, under the rename or the name of the
+            // last field in the path
+            auto tname = si->rename;
+
+            if (tname.length() == 0)
+                tname = Globalreg::globalreg->entrytracker->get_field_name(si->resolved_path.back());
+
+            stream << "\"" << sanitize_string(keys.permute(tname)) << "\": 0";
+        } else if (si->rename.length() != 0) {
+            stream << "\"" << sanitize_string(keys.permute(si->rename)) << "\": ";
+            pack(stream, f, nullptr, false, 0, keys);
+        } else if (f->get_type() == tracker_type::tracker_alias) {
+            auto tname = static_cast<tracker_element_alias *>(f.get())->get_alias_name();
+
+            if (tname.length() == 0)
+                tname = Globalreg::globalreg->entrytracker->get_field_name(f->get_id());
+
+            stream << "\"" << sanitize_string(keys.permute(tname)) << "\": ";
+            pack(stream, f, nullptr, false, 0, keys);
+        } else {
+            stream << keys.key(f->get_id());
+            pack(stream, f, nullptr, false, 0, keys);
+        }
+
+        for (auto i = inter.rbegin(); i != inter.rend(); ++i)
+            (*i)->post_serialize();
+    }
+
+    stream << "}";
+}
+
+void json_adapter::pack_summary_vector(std::ostream &stream, std::shared_ptr<tracker_element_vector> in_vec,
+        const std::vector<SharedElementSummary>& summary, key_cache& keys) {
+
+    stream << "[";
+
+    pack_segments(stream, in_vec->get(), ",",
+            [&summary, &keys](std::ostream& os, const shared_tracker_element& e) {
+                json_adapter::pack_summary(os, e, summary, keys);
+            });
+
+    stream << "]";
+}
+
+namespace {
+    std::atomic<unsigned int> parallel_workers{0};
+
+    // Vectors smaller than this aren't worth splitting, and no segment is smaller
+    // than the minimum segment size
+    const size_t parallel_min_elements = 1024;
+    const size_t parallel_min_segment = 256;
+}
+
+void json_adapter::set_parallel_workers(unsigned int workers) {
+    parallel_workers = workers;
+}
+
+unsigned int json_adapter::get_parallel_workers() {
+    auto workers = parallel_workers.load();
+
+    if (workers == 0)
+        workers = std::thread::hardware_concurrency();
+
+    if (workers == 0)
+        workers = 1;
+
+    return workers;
+}
+
+void json_adapter::pack_segments(std::ostream& stream, const tracker_element_vector::vector_t& v,
+        const std::string& separator,
+        const std::function<void (std::ostream&, const shared_tracker_element&)>& packer) {
+
+    auto workers = get_parallel_workers();
+
+    if (workers < 2 || v.size() < parallel_min_elements ||
+            !tracker_element_serializer::parallel_allowed()) {
+        bool prepend_sep = false;
+
+        for (const auto& i : v) {
+            if (i == nullptr)
+                continue;
+
+            if (prepend_sep)
+                stream << separator;
+            prepend_sep = true;
+
+            packer(stream, i);
+        }
+
+        return;
+    }
+
+    auto n_segments = std::min<size_t>(workers, v.size() / parallel_min_segment);
+    auto segment_len = (v.size() + n_segments - 1) / n_segments;
+
+    struct segment {
+        future_chainbuf buf{64 * 1024, 64 * 1024};
+        bool written{false};
+        std::future<void> done;
+    };
+
+    std::vector<std::unique_ptr<segment>> segments;
+
+    for (size_t sn = 0; sn < n_segments; sn++) {
+        auto start = std::min(v.size(), sn * segment_len);
+        auto end = std::min(v.size(), start + segment_len);
+
+        segments.push_back(std::unique_ptr<segment>(new segment()));
+        auto seg = segments.back().get();
+        seg->buf.set_mem_account("serializer", "json segment");
+
+        seg->done = std::async(std::launch::async, [seg, &v, &separator, &packer, start, end]() {
+                std::ostream os(&seg->buf);
+
+                for (auto i = start; i < end; i++) {
+                    if (v[i] == nullptr)
+                        continue;
+
+                    if (seg->written)
+                        os << separator;
+                    seg->written = true;
+
+                    packer(os, v[i]);
+                }
+
+                os.flush();
+            });
+    }
+
+    auto out_buf = dynamic_cast<future_chainbuf *>(stream.rdbuf());
+    bool prepend_sep = false;
+
+    for (auto& seg : segments) {
+        seg->done.get();
+
+        if (!seg->written)
+            continue;
+
+        if (prepend_sep)
+            stream << separator;
+        prepend_sep = true;
+
+        if (out_buf != nullptr) {
+            out_buf->splice(seg->buf);
+            continue;
+        }
+
+        char *data;
+        size_t sz;
+
+        while ((sz = seg->buf.get(&data)) > 0) {
+            stream.write(data, sz);
+            seg->buf.consume(sz);
+        }
+    }
+}
@@ -21,7 +21,12 @@
 
 #include "config.h"
 
+#include <atomic>
+#include <functional>
+#include <map>
+
 #include "globalregistry.h"
+#include "kis_mutex.h"
 #include "trackedelement.h"
 #include "devicetracker_component.h"
 
@@ -30,13 +35,102 @@
 // buffer_handler_ostream_buf or similar
 namespace json_adapter {
 
+// Object keys for registered fields, by field id, with the name permutation, escaping,
+// and quoting already applied, so that writing the key of a field is a single copy.
+// Field names never change once registered, so each key is built once and then read
+// without locking.
+class key_cache {
+public:
+    using permuter_t = std::function<std::string (const std::string&)>;
+
+    key_cache(permuter_t permuter = nullptr);
+    ~key_cache();
+
+    // Serialized key for a field, as '"name": '
+    const std::string& key(uint16_t field_id) {
+        auto page = pages[field_id >> page_bits].load(std::memory_order_acquire);
+
+        if (page != nullptr) {
+            auto k = page->keys[field_id & page_mask].load(std::memory_order_acquire);
+            if (k != nullptr)
+                return *k;
+        }
+
+        return build_key(field_id);
+    }
+
+    // Apply the name permutation to a name which isn't cached
+    std::string permute(const std::string& name) const {
+        if (permuter == nullptr)
+            return name;
+        return permuter(name);
+    }
+
+protected:
+    static constexpr unsigned int page_bits = 8;
+    static constexpr unsigned int page_mask = (1 << page_bits) - 1;
+    static constexpr unsigned int n_pages = 65536 >> page_bits;
+
+    struct key_page {
+        key_page() {
+            for (auto& k : keys)
+                k = nullptr;
+        }
+
+        std::atomic<const std::string *> keys[1 << page_bits];
+    };
+
+    const std::string& build_key(uint16_t field_id);
+
+    permuter_t permuter;
+
+    kis_mutex mutex;
+    std::atomic<key_page *> pages[n_pages];
+
+    // Keys for fields which weren't registered yet when first seen, by id; these aren't 
+    // cached in the pages, so the field name is picked up once it is registered, but 
+    // are kept for the life of the cache since callers hold references to them
+    std::map<uint16_t, std::string> unknown_keys;
+};
+
+// Shared key caches for the plain field names, and for field names with dots converted
+// to underscores
+key_cache& plain_keys();
+key_cache& underscore_keys();
+
 // Basic packer with some defaulted options - prettyprint and depth used for
 // recursive indenting and prettifying the output
 void pack(std::ostream &stream, shared_tracker_element e,
         std::shared_ptr<tracker_element_serializer::rename_map> name_map = nullptr,
-        bool prettyprint = false, unsigned int depth = 0,
-        std::function<std::string (const std::string&)> name_permuter = 
-            [](const std::string& s) -> std::string { return s; });
+        bool prettyprint = false, unsigned int depth = 0);
+
+// Packer with the keys formed from a specific key cache
+void pack(std::ostream &stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map,
+        bool prettyprint, unsigned int depth, key_cache& keys);
+
+// Pack a record summarized by a compiled summary, writing the summarized fields
+// directly from the record instead of building a summarized copy
+void pack_summary(std::ostream &stream, shared_tracker_element e,
+        const std::vector<SharedElementSummary>& summary, key_cache& keys);
+
+// Pack a vector of summarized records as a JSON array
+void pack_summary_vector(std::ostream &stream, std::shared_ptr<tracker_element_vector> in_vec,
+        const std::vector<SharedElementSummary>& summary, key_cache& keys);
+
+// Number of threads used to serialize large vectors, 0 for one per core; set from
+// httpd_serialize_threads
+void set_parallel_workers(unsigned int workers);
+unsigned int get_parallel_workers();
+
+// Pack the non-null members of a vector with the packer function, in order, with the 
+// separator between them.  Under a tracker_element_serializer::parallel_scope, large 
+// vectors are split into segments which are packed in parallel and then assembled in 
+// order; when the stream is a future_chainbuf, the segments are spliced in without 
+// copying.
+void pack_segments(std::ostream& stream, const tracker_element_vector::vector_t& v,
+        const std::string& separator,
+        const std::function<void (std::ostream&, const shared_tracker_element&)>& packer);
 
 std::string sanitize_string(const std::string& in) noexcept;
 std::size_t sanitize_extra_space(const std::string& in) noexcept;
@@ -48,9 +142,25 @@ public:
 
     virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
             std::shared_ptr<rename_map> name_map = nullptr) override {
+        if (in_elem != nullptr && in_elem->get_type() == tracker_type::tracker_vector) {
+            stream << "[";
+            pack_segments(stream, std::static_pointer_cast<tracker_element_vector>(in_elem)->get(), ",",
+                    [name_map](std::ostream& os, const shared_tracker_element& e) {
+                        pack(os, e, name_map, false, 1);
+                    });
+            stream << "]";
+            return 0;
+        }
+
         pack(stream, in_elem, name_map);
         return 0;
     }
+
+    virtual int serialize_summary(std::shared_ptr<tracker_element_vector> in_vec,
+            const std::vector<SharedElementSummary>& summary, std::ostream& stream) override {
+        pack_summary_vector(stream, in_vec, summary, plain_keys());
+        return 0;
+    }
 };
 
 };
@@ -64,10 +174,25 @@ public:
 
     virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
             std::shared_ptr<rename_map> name_map = nullptr) override {
-        json_adapter::pack(stream, in_elem, name_map, false, 0,
-                           [](const std::string& s) { 
-                               return multi_replace_all(s, ".", "_");
-                           });
+        if (in_elem != nullptr && in_elem->get_type() == tracker_type::tracker_vector) {
+            stream << "[";
+            json_adapter::pack_segments(stream, 
+                    std::static_pointer_cast<tracker_element_vector>(in_elem)->get(), ",",
+                    [name_map](std::ostream& os, const shared_tracker_element& e) {
+                        json_adapter::pack(os, e, name_map, false, 1, json_adapter::underscore_keys());
+                    });
+            stream << "]";
+            return 0;
+        }
+
+        json_adapter::pack(stream, in_elem, name_map, false, 0, 
+                json_adapter::underscore_keys());
+        return 0;
+    }
+
+    virtual int serialize_summary(std::shared_ptr<tracker_element_vector> in_vec,
+            const std::vector<SharedElementSummary>& summary, std::ostream& stream) override {
+        json_adapter::pack_summary_vector(stream, in_vec, summary, json_adapter::underscore_keys());
         return 0;
     }
 };
@@ -83,6 +208,10 @@ public:
 // require loading the entire object into RAM.
 // 2. To avoid conflicts with the ELK interpretation of field names, all 
 // dots are converted to underscores
+//
+// Packing keeps no state in the serializer, so it isn't locked; an HTTP response 
+// waiting on a slow client mustn't hold up loggers serializing under the device list
+// lock.
 namespace ek_json_adapter {
 
 class serializer : public tracker_element_serializer {
@@ -92,29 +221,32 @@ public:
 
     virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
             std::shared_ptr<rename_map> name_map = nullptr) override {
-        kis_lock_guard<kis_mutex> lk(mutex, "ek_json serialize");
-
         if (in_elem->get_type() == tracker_type::tracker_vector) {
-            for (auto i : *(std::static_pointer_cast<tracker_element_vector>(in_elem))) {
-                if (i == nullptr)
-                    continue;
-
-                json_adapter::pack(stream, i, name_map, false, 0,
-                        [](const std::string& s) { 
-                            return multi_replace_all(s, ".", "_");
-                        });
-                stream << "\n";
-            }
-        } else {
-            json_adapter::pack(stream, in_elem, name_map, false, 0,
-                    [](const std::string& s) { 
-                    return multi_replace_all(s, ".", "_");
+            json_adapter::pack_segments(stream, 
+                    std::static_pointer_cast<tracker_element_vector>(in_elem)->get(), "",
+                    [name_map](std::ostream& os, const shared_tracker_element& e) {
+                        json_adapter::pack(os, e, name_map, false, 0, json_adapter::underscore_keys());
+                        os << "\n";
                     });
+        } else {
+            json_adapter::pack(stream, in_elem, name_map, false, 0, 
+                    json_adapter::underscore_keys());
             stream << "\n";
         }
 
         return 0;
     }
+
+    virtual int serialize_summary(std::shared_ptr<tracker_element_vector> in_vec,
+            const std::vector<SharedElementSummary>& summary, std::ostream& stream) override {
+        json_adapter::pack_segments(stream, in_vec->get(), "",
+                [&summary](std::ostream& os, const shared_tracker_element& e) {
+                    json_adapter::pack_summary(os, e, summary, json_adapter::underscore_keys());
+                    os << "\n";
+                });
+
+        return 0;
+    }
 };
 
 }
@@ -130,8 +262,6 @@ public:
 
     virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
             std::shared_ptr<rename_map> name_map = nullptr) override {
-        kis_lock_guard<kis_mutex> lk(mutex, "it_json serialize");
-
         if (in_elem->get_type() == tracker_type::tracker_vector) {
             for (auto i : *(std::static_pointer_cast<tracker_element_vector>(in_elem))) {
                 json_adapter::pack(stream, i, name_map);
@@ -144,6 +274,16 @@ public:
 
         return 1;
     }
+
+    virtual int serialize_summary(std::shared_ptr<tracker_element_vector> in_vec,
+            const std::vector<SharedElementSummary>& summary, std::ostream& stream) override {
+        for (auto i : *in_vec) {
+            json_adapter::pack_summary(stream, i, summary, json_adapter::plain_keys());
+            stream << "\n";
+        }
+
+        return 1;
+    }
 };
 
 }
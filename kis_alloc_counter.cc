@@ -0,0 +1,166 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Counting replacements for the global allocation operators.  This is only linked
+// into the benchmark binary (kismet_bench); the server uses the normal allocator and
+// kis_alloc_count() resolves to nullptr.
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+// Declared weak in kis_benchmark.h; defined here without the header so the definition
+// is a strong one
+uint64_t kis_alloc_count();
+
+namespace {
+    // Counters are spread over cache lines by thread, so counting doesn't serialize
+    // the packet threads on a single atomic
+    constexpr unsigned int n_shards = 64;
+
+    struct alignas(64) alloc_shard {
+        std::atomic<uint64_t> count;
+    };
+
+    alloc_shard shards[n_shards];
+    std::atomic<unsigned int> next_shard{0};
+
+    inline void count_alloc() {
+        static thread_local unsigned int shard = next_shard++ % n_shards;
+        shards[shard].count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void *counted_alloc(std::size_t sz) {
+        count_alloc();
+
+        if (sz == 0)
+            sz = 1;
+
+        auto p = malloc(sz);
+
+        if (p == nullptr)
+            throw std::bad_alloc();
+
+        return p;
+    }
+
+#if defined(__cpp_aligned_new)
+    inline void *counted_alloc_aligned(std::size_t sz, std::align_val_t al) {
+        count_alloc();
+
+        auto align = static_cast<std::size_t>(al);
+
+        if (align < sizeof(void *))
+            align = sizeof(void *);
+
+        // aligned_alloc requires a size which is a multiple of the alignment
+        sz = ((sz + align - 1) / align) * align;
+
+        if (sz == 0)
+            sz = align;
+
+        auto p = aligned_alloc(align, sz);
+
+        if (p == nullptr)
+            throw std::bad_alloc();
+
+        return p;
+    }
+#endif
+}
+
+uint64_t kis_alloc_count() {
+    uint64_t c = 0;
+
+    for (const auto& s : shards)
+        c += s.count.load(std::memory_order_relaxed);
+
+    return c;
+}
+
+void *operator new(std::size_t sz) {
+    return counted_alloc(sz);
+}
+
+void *operator new[](std::size_t sz) {
+    return counted_alloc(sz);
+}
+
+void *operator new(std::size_t sz, const std::nothrow_t&) noexcept {
+    try {
+        return counted_alloc(sz);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t sz, const std::nothrow_t&) noexcept {
+    try {
+        return counted_alloc(sz);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+#if defined(__cpp_aligned_new)
+void *operator new(std::size_t sz, std::align_val_t al) {
+    return counted_alloc_aligned(sz, al);
+}
+
+void *operator new[](std::size_t sz, std::align_val_t al) {
+    return counted_alloc_aligned(sz, al);
+}
+#endif
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    free(p);
+}
+
+#if defined(__cpp_aligned_new)
+void operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+    free(p);
+}
+#endif
@@ -0,0 +1,308 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "configfile.h"
+#include "globalregistry.h"
+#include "kis_async_writer.h"
+#include "messagebus.h"
+#include "util.h"
+
+// Alignment of the buffers and of direct writes; covers the logical block size of
+// any disk we're likely to see
+#define KIS_ASYNC_WRITER_ALIGN      4096
+
+kis_async_writer::kis_async_writer() :
+    fd{-1},
+    direct{false},
+    align{1},
+    flush_sz{0},
+    max_pending{0},
+    interval{1},
+    pending{nullptr},
+    pending_len{0},
+    disk{nullptr},
+    disk_len{0},
+    disk_offset{0},
+    stopping{false},
+    failed{false},
+    written{0} { }
+
+kis_async_writer::~kis_async_writer() {
+    close();
+}
+
+bool kis_async_writer::open(const std::string& in_path, std::string& error) {
+    close();
+
+    path = in_path;
+
+    auto config = Globalreg::globalreg->kismet_config;
+
+    flush_sz =
+        std::max(config->fetch_opt_uint("log_write_buffer_flush", 256), (unsigned int) 64) * 1024;
+    max_pending =
+        std::max((size_t) config->fetch_opt_uint("log_write_buffer", 4096) * 1024, flush_sz * 2);
+    interval = std::max(config->fetch_opt_uint("log_write_interval", 1), (unsigned int) 1);
+
+    // Keep the buffers a whole number of blocks
+    max_pending = (max_pending + KIS_ASYNC_WRITER_ALIGN - 1) & ~((size_t) KIS_ASYNC_WRITER_ALIGN - 1);
+
+    direct = false;
+    align = 1;
+
+#if defined(SYS_LINUX) && defined(O_DIRECT)
+    if (config->fetch_opt_bool("log_direct_io", true)) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+
+        if (fd >= 0) {
+            direct = true;
+            align = KIS_ASYNC_WRITER_ALIGN;
+        } else if (errno != EINVAL) {
+            error = kis_strerror_r(errno);
+            return false;
+        }
+    }
+#endif
+
+    // Filesystems like tmpfs refuse O_DIRECT with EINVAL
+    if (fd < 0) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0) {
+            error = kis_strerror_r(errno);
+            return false;
+        }
+    }
+
+    void *p = nullptr;
+
+    if (posix_memalign(&p, KIS_ASYNC_WRITER_ALIGN, max_pending) != 0) {
+        ::close(fd);
+        fd = -1;
+        error = "unable to allocate log buffer";
+        return false;
+    }
+
+    pending = static_cast<char *>(p);
+
+    // Room for the pending records, the carried tail of the last write, and the
+    // padding of a final partial block
+    if (posix_memalign(&p, KIS_ASYNC_WRITER_ALIGN, max_pending + (2 * KIS_ASYNC_WRITER_ALIGN)) != 0) {
+        free(pending);
+        pending = nullptr;
+        ::close(fd);
+        fd = -1;
+        error = "unable to allocate log buffer";
+        return false;
+    }
+
+    disk = static_cast<char *>(p);
+
+    pending_len = 0;
+    disk_len = 0;
+    disk_offset = 0;
+    stopping = false;
+    failed = false;
+    written = 0;
+
+    writer = std::thread([this]() {
+            thread_set_process_name("LOGWRITER");
+            writer_thread();
+        });
+
+    return true;
+}
+
+void kis_async_writer::close() {
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+
+        if (fd < 0)
+            return;
+
+        stopping = true;
+    }
+
+    writer_cv.notify_all();
+    space_cv.notify_all();
+
+    if (writer.joinable())
+        writer.join();
+
+    ::close(fd);
+    fd = -1;
+
+    free(pending);
+    pending = nullptr;
+
+    free(disk);
+    disk = nullptr;
+}
+
+void kis_async_writer::write(const char *data, size_t len) {
+    write(data, len, nullptr, 0);
+}
+
+void kis_async_writer::write(const char *data1, size_t len1, const char *data2, size_t len2) {
+    std::unique_lock<std::mutex> lk(mutex);
+
+    if (fd < 0 || stopping || failed)
+        return;
+
+    // Wait for room for the whole record, unless it's larger than the buffer could
+    // ever hold; then it goes in as room is made
+    size_t len = std::min(len1 + len2, max_pending);
+
+    while (!stopping && !failed && pending_len + len > max_pending) {
+        writer_cv.notify_one();
+        space_cv.wait(lk);
+    }
+
+    append(lk, data1, len1);
+    append(lk, data2, len2);
+
+    if (pending_len >= flush_sz)
+        writer_cv.notify_one();
+}
+
+void kis_async_writer::append(std::unique_lock<std::mutex>& lk, const char *data, size_t len) {
+    while (len > 0) {
+        if (stopping || failed)
+            return;
+
+        size_t append_sz = std::min(len, max_pending - pending_len);
+
+        if (append_sz == 0) {
+            writer_cv.notify_one();
+            space_cv.wait(lk);
+            continue;
+        }
+
+        memcpy(pending + pending_len, data, append_sz);
+        pending_len += append_sz;
+        data += append_sz;
+        len -= append_sz;
+    }
+}
+
+void kis_async_writer::writer_thread() {
+    std::unique_lock<std::mutex> lk(mutex);
+
+    while (true) {
+        writer_cv.wait_for(lk, std::chrono::seconds(interval),
+                [this]() { return stopping || pending_len >= flush_sz; });
+
+        bool last = stopping;
+
+        // Anything short of a full flush is the interval (or the close) catching up
+        // with a slow log, so write all of it
+        bool partial = last || pending_len < flush_sz;
+
+        if (pending_len == 0 && !last)
+            continue;
+
+        if (failed) {
+            pending_len = 0;
+            space_cv.notify_all();
+
+            if (last)
+                break;
+
+            continue;
+        }
+
+        memcpy(disk + disk_len, pending, pending_len);
+        disk_len += pending_len;
+        pending_len = 0;
+
+        space_cv.notify_all();
+
+        lk.unlock();
+
+        if (!write_disk(partial)) {
+            auto e = errno;
+
+            failed = true;
+            _MSG_ERROR("Failed to write log '{}': {}.  Further records for this log will "
+                    "be discarded.", path, kis_strerror_r(e));
+        }
+
+        lk.lock();
+
+        if (last)
+            break;
+
+        // Wake anyone who was waiting for room when the write failed
+        if (failed)
+            space_cv.notify_all();
+    }
+}
+
+bool kis_async_writer::write_disk(bool partial) {
+    if (disk_len == 0)
+        return true;
+
+    // Only whole blocks can be written directly; the tail is carried over to the
+    // next write, or written padded out to a block and trimmed from the file
+    size_t full_sz = disk_len - (disk_len % align);
+    size_t write_sz = full_sz;
+
+    if (partial && full_sz < disk_len) {
+        write_sz = full_sz + align;
+        memset(disk + disk_len, 0, write_sz - disk_len);
+    }
+
+    size_t offt = 0;
+
+    while (offt < write_sz) {
+        auto r = pwrite(fd, disk + offt, write_sz - offt, disk_offset + offt);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        offt += r;
+    }
+
+    if (write_sz > disk_len) {
+        if (ftruncate(fd, disk_offset + disk_len) < 0)
+            return false;
+    }
+
+    written = disk_offset + disk_len;
+
+    if (full_sz > 0) {
+        memmove(disk, disk + full_sz, disk_len - full_sz);
+        disk_offset += full_sz;
+        disk_len -= full_sz;
+    }
+
+    return true;
+}
+
@@ -0,0 +1,117 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_ASYNC_WRITER_H__
+#define __KIS_ASYNC_WRITER_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Buffered, asynchronous writer for the streaming log files.
+//
+// Log handlers in the packet chain append their formatted records to a memory buffer,
+// which only takes a short lock and a copy; a writer thread moves the buffer to disk in
+// large writes once it holds log_write_buffer_flush kilobytes, or every
+// log_write_interval seconds, so several logs don't each add a disk write to every
+// packet.  When the disk can't keep up and log_write_buffer kilobytes are waiting,
+// records are held until the writer has caught up instead of being lost.
+//
+// On Linux the file is opened with O_DIRECT (log_direct_io) when the filesystem allows
+// it, so the logs don't push everything else out of the page cache; the writes are then
+// kept aligned to the block size and a partial block written on an interval flush is
+// rewritten with the rest of its content on the next one.  Filesystems which refuse
+// O_DIRECT are written normally.
+class kis_async_writer {
+public:
+    kis_async_writer();
+    ~kis_async_writer();
+
+    // Create or truncate a file and start the writer; returns false and sets error if
+    // the file can't be opened
+    bool open(const std::string& in_path, std::string& error);
+
+    // Write everything buffered and close the file
+    void close();
+
+    bool is_open() const { return fd >= 0; }
+
+    // Append a record, waiting while the buffer is full; records are written in the
+    // order they are appended, and are discarded once the file has failed
+    void write(const char *data, size_t len);
+
+    void write(const std::string& data) {
+        write(data.data(), data.length());
+    }
+
+    // Append the parts of a record, without any other record between them
+    void write(const char *data1, size_t len1, const char *data2, size_t len2);
+
+    uint64_t get_written() const { return written; }
+
+protected:
+    void writer_thread();
+
+    // Write the disk buffer; with partial, a final unaligned block is written too
+    bool write_disk(bool partial);
+
+    // Append to the pending buffer; must be called with the lock held
+    void append(std::unique_lock<std::mutex>& lk, const char *data, size_t len);
+
+    std::string path;
+    int fd;
+
+    bool direct;
+    size_t align;
+
+    size_t flush_sz;
+    size_t max_pending;
+    unsigned int interval;
+
+    std::mutex mutex;
+    std::condition_variable writer_cv;
+    std::condition_variable space_cv;
+
+    // Records waiting for the writer
+    char *pending;
+    size_t pending_len;
+
+    // Content being written by the writer thread; starts with the unaligned tail of
+    // the previous write when writing directly
+    char *disk;
+    size_t disk_len;
+
+    // File offset of the start of the disk buffer
+    off_t disk_offset;
+
+    bool stopping;
+    std::atomic<bool> failed;
+    std::atomic<uint64_t> written;
+
+    std::thread writer;
+};
+
+#endif
+
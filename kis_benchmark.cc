@@ -0,0 +1,346 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "configfile.h"
+#include "datasourcetracker.h"
+#include "devicetracker.h"
+#include "fmt.h"
+#include "kis_benchmark.h"
+#include "messagebus.h"
+#include "timetracker.h"
+#include "util.h"
+
+kis_benchmark::kis_benchmark() :
+    lifetime_global(),
+    postcap_id{-1},
+    tracker_id{-1},
+    timer_id{-1},
+    populate_timer_id{-1},
+    packets_in{0},
+    packets_out{0},
+    started{false},
+    last_packet_ns{0},
+    start_allocs{0},
+    idle_checks{0},
+    last_packets_out{0},
+    reported{false} {
+
+    packetchain = Globalreg::fetch_mandatory_global_handle<packet_chain>();
+
+    report_path = Globalreg::globalreg->kismet_config->fetch_opt("benchmark_report");
+
+    // Counted ahead of every other postcap handler, and after every other tracker
+    // handler, so the rate covers the whole pipeline up to logging
+    postcap_id =
+        packetchain->register_handler([this](std::shared_ptr<kis_packet>) -> int {
+                if (!started.load(std::memory_order_relaxed) && !started.exchange(true)) {
+                    first_packet = std::chrono::steady_clock::now();
+                    start_allocs = kis_alloc_count != nullptr ? kis_alloc_count() : 0;
+                }
+
+                packets_in.fetch_add(1, std::memory_order_relaxed);
+                return 1;
+            }, CHAINPOS_POSTCAP, -100000);
+
+    tracker_id =
+        packetchain->register_handler([this](std::shared_ptr<kis_packet>) -> int {
+                packets_out.fetch_add(1, std::memory_order_relaxed);
+                last_packet_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count(),
+                        std::memory_order_relaxed);
+                return 1;
+            }, CHAINPOS_TRACKER, 100000);
+
+    auto timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
+
+    timer_id =
+        timetracker->register_timer(std::chrono::seconds(1), 1, [this](int) -> int {
+                if (reported || !check_complete())
+                    return 1;
+
+                reported = true;
+
+                report();
+
+                Globalreg::globalreg->spindown = true;
+
+                return 0;
+            });
+
+    // Populated once the rest of the server is up, so every device view sees them
+    if (Globalreg::globalreg->kismet_config->fetch_opt_uint("benchmark_devices", 0) > 0) {
+        populate_timer_id =
+            timetracker->register_timer(std::chrono::seconds(1), 0, [this](int) -> int {
+                    populate_timer_id = -1;
+                    populate_devices();
+                    return 0;
+                });
+    }
+
+    _MSG_INFO("Benchmark mode enabled; Kismet will report the packet pipeline performance "
+            "and exit once all sources have finished.");
+
+    if (kis_alloc_count == nullptr)
+        _MSG_INFO("Allocation counting is only available in kismet_bench; allocations per "
+                "packet will not be reported.");
+}
+
+kis_benchmark::~kis_benchmark() {
+    auto timetracker = Globalreg::fetch_global_as<time_tracker>();
+
+    if (timetracker != nullptr && timer_id >= 0)
+        timetracker->remove_timer(timer_id);
+
+    if (timetracker != nullptr && populate_timer_id >= 0)
+        timetracker->remove_timer(populate_timer_id);
+
+    if (postcap_id >= 0)
+        packetchain->remove_handler(postcap_id, CHAINPOS_POSTCAP);
+
+    if (tracker_id >= 0)
+        packetchain->remove_handler(tracker_id, CHAINPOS_TRACKER);
+}
+
+void kis_benchmark::populate_devices() {
+    auto devicetracker = Globalreg::fetch_mandatory_global_as<device_tracker>();
+
+    auto n_devices = Globalreg::globalreg->kismet_config->fetch_opt_uint("benchmark_devices", 0);
+    auto phy_opts = 
+        str_tokenize(Globalreg::globalreg->kismet_config->fetch_opt_dfl("benchmark_device_phys",
+                    "IEEE802.11:70,BTLE:20,Bluetooth:10"), ",");
+
+    std::vector<std::pair<kis_phy_handler *, unsigned int>> phys;
+    unsigned int total_weight = 0;
+
+    for (const auto& p : phy_opts) {
+        auto pw = str_tokenize(p, ":");
+
+        if (pw.size() == 0)
+            continue;
+
+        auto name = str_strip(pw[0]);
+
+        unsigned int weight = 1;
+
+        if (pw.size() > 1) {
+            try {
+                weight = string_to_n<unsigned int>(str_strip(pw[1]));
+            } catch (const std::exception& e) {
+                _MSG_ERROR("Benchmark could not parse the weight of '{}' in "
+                        "benchmark_device_phys, expected phy:weight", p);
+                continue;
+            }
+        }
+
+        auto phy = devicetracker->fetch_phy_handler_by_name(name);
+
+        if (phy == nullptr) {
+            _MSG_ERROR("Benchmark can not create devices for unknown phy '{}'", name);
+            continue;
+        }
+
+        if (weight == 0)
+            continue;
+
+        phys.push_back(std::make_pair(phy, weight));
+        total_weight += weight;
+    }
+
+    if (phys.size() == 0) {
+        _MSG_ERROR("Benchmark has no phys to create synthetic devices for; check "
+                "benchmark_device_phys");
+        return;
+    }
+
+    auto pack_comp_common = packetchain->register_packet_component("COMMON");
+
+    const std::vector<std::pair<std::string, double>> channels = {
+        {"1", 2412000}, {"6", 2437000}, {"11", 2462000}, {"36", 5180000}, {"149", 5745000},
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long n = 0;
+
+    for (const auto& p : phys) {
+        unsigned long n_phy = (unsigned long) n_devices * p.second / total_weight;
+
+        for (unsigned long i = 0; i < n_phy; i++, n++) {
+            auto packet = packetchain->generate_packet();
+
+            gettimeofday(&packet->ts, nullptr);
+
+            auto common = packet->fetch_or_add<kis_common_info>(pack_comp_common);
+
+            // Locally administered addresses, unique across the whole population
+            mac_addr mac(fmt::format("02:BE:{:02X}:{:02X}:{:02X}:{:02X}",
+                        (n >> 24) & 0xFF, (n >> 16) & 0xFF, (n >> 8) & 0xFF, n & 0xFF));
+
+            const auto& chan = channels[n % channels.size()];
+
+            common->type = packet_basic_mgmt;
+            common->phyid = p.first->fetch_phy_id();
+            common->source = mac;
+            common->transmitter = mac;
+            common->channel = chan.first;
+            common->freq_khz = chan.second;
+            common->datasize = 100 + (n % 1400);
+
+            devicetracker->update_common_device(common, mac, p.first, packet,
+                    (UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS), "Synthetic");
+        }
+    }
+
+    _MSG_INFO("Benchmark created {} synthetic devices across {} phys in {:.1f} seconds", n,
+            phys.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+bool kis_benchmark::check_complete() {
+    auto datasourcetracker = Globalreg::fetch_global_as<datasource_tracker>();
+
+    if (datasourcetracker == nullptr)
+        return false;
+
+    class benchmark_source_worker : public datasource_tracker_worker {
+    public:
+        virtual void handle_datasource(std::shared_ptr<kis_datasource> in_src) override {
+            n_sources++;
+
+            if (in_src->get_source_running())
+                n_running++;
+            else if (in_src->get_source_error())
+                n_error++;
+        }
+
+        unsigned int n_sources = 0;
+        unsigned int n_running = 0;
+        unsigned int n_error = 0;
+    };
+
+    benchmark_source_worker worker;
+    datasourcetracker->iterate_datasources(&worker);
+
+    // Every source failed to open; there's nothing to measure
+    if (worker.n_sources > 0 && worker.n_error == worker.n_sources && !started) {
+        _MSG_FATAL("Benchmark sources could not be opened; check the capture paths "
+                "passed with -c.");
+        Globalreg::globalreg->fatal_condition = 1;
+        return false;
+    }
+
+    if (!started || worker.n_running > 0) {
+        idle_checks = 0;
+        return false;
+    }
+
+    // Packets taken from a queue are still in their handlers until the finished count
+    // stops moving
+    auto out = packets_out.load();
+
+    if (!packetchain->queues_idle() || out != last_packets_out) {
+        last_packets_out = out;
+        idle_checks = 0;
+        return false;
+    }
+
+    return ++idle_checks >= 2;
+}
+
+void kis_benchmark::report() {
+    auto in = packets_in.load();
+    auto out = packets_out.load();
+
+    auto last = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(last_packet_ns.load()));
+    double elapsed = std::chrono::duration<double>(last - first_packet).count();
+
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    double rate = out / elapsed;
+
+    struct rusage ru;
+    long peak_rss_kb = 0;
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        peak_rss_kb = ru.ru_maxrss;
+
+    bool have_allocs = kis_alloc_count != nullptr;
+    double allocs_per_packet = 0;
+
+    if (have_allocs && in > 0)
+        allocs_per_packet = (double) (kis_alloc_count() - start_allocs) / in;
+
+    _MSG_INFO("Benchmark: {} packets in, {} through the tracker in {:.3f} seconds, "
+            "{:.0f} packets/sec, using {} packet threads", in, out, elapsed, rate,
+            packetchain->get_n_packet_threads());
+
+    if (have_allocs)
+        _MSG_INFO("Benchmark: {:.1f} allocations per packet", allocs_per_packet);
+
+    _MSG_INFO("Benchmark: peak RSS {:.1f} MB", peak_rss_kb / 1024.0f);
+
+    std::string stages_json;
+
+    for (int c = CHAINPOS_POSTCAP; c <= CHAINPOS_LOGGING; c++) {
+        auto h = packetchain->get_stage_latency(c);
+
+        if (h == nullptr || h->count() == 0)
+            continue;
+
+        _MSG_INFO("Benchmark: stage {:<12} {:>8} samples, p50 {} ns, p90 {} ns, p99 {} ns, "
+                "max {} ns", packet_chain::chain_name(c), h->count(), h->percentile(50),
+                h->percentile(90), h->percentile(99), h->max());
+
+        stages_json += fmt::format("{}{{\"stage\":\"{}\",\"samples\":{},\"p50_ns\":{},"
+                "\"p90_ns\":{},\"p99_ns\":{},\"max_ns\":{}}}",
+                stages_json.length() ? "," : "", packet_chain::chain_name(c), h->count(),
+                h->percentile(50), h->percentile(90), h->percentile(99), h->max());
+    }
+
+    if (packetchain->get_stage_latency(CHAINPOS_POSTCAP) == nullptr)
+        _MSG_INFO("Benchmark: stage latency is only recorded when packet_handler_timing "
+                "is enabled");
+
+    if (report_path.length() == 0)
+        return;
+
+    auto f = fopen(report_path.c_str(), "w");
+
+    if (f == nullptr) {
+        _MSG_ERROR("Benchmark could not write the report to '{}': {}", report_path,
+                kis_strerror_r(errno));
+        return;
+    }
+
+    fmt::print(f, "{{\"packets_in\":{},\"packets_out\":{},\"seconds\":{:.6f},"
+            "\"packets_per_sec\":{:.1f},\"packet_threads\":{},\"allocs_per_packet\":{},"
+            "\"peak_rss_kb\":{},\"stages\":[{}]}}\n",
+            in, out, elapsed, rate, packetchain->get_n_packet_threads(),
+            have_allocs ? fmt::format("{:.2f}", allocs_per_packet) : "null",
+            peak_rss_kb, stages_json);
+
+    fclose(f);
+
+    _MSG_INFO("Benchmark report written to '{}'", report_path);
+}
+
@@ -0,0 +1,98 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_BENCHMARK_H__
+#define __KIS_BENCHMARK_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "globalregistry.h"
+#include "packetchain.h"
+
+// Allocations made by the process so far; only defined when the counting allocator
+// (kis_alloc_counter.cc) is linked in, as it is in kismet_bench
+uint64_t kis_alloc_count() __attribute__((weak));
+
+// Packet pipeline benchmark.
+//
+// Runs when benchmark=true, typically through the benchmark override config and replay
+// sources, which feed recorded pcapng and kismetdb captures through the full packet
+// chain as fast as it will take them.  Once every source has finished and the packet
+// and logging queues have drained, it reports the packet rate, the per-packet latency
+// of each stage, the allocations per packet, and the peak RSS, and shuts Kismet down.
+//
+// For load testing the REST API, it can also fill the device tracker with a synthetic
+// population of devices across a mix of phys; with no sources, Kismet keeps running
+// for the load tool (tools/kismet_rest_bench) until it is stopped.
+class kis_benchmark : public lifetime_global {
+public:
+    static std::string global_name() { return "BENCHMARK"; }
+
+    static std::shared_ptr<kis_benchmark> create_benchmark() {
+        std::shared_ptr<kis_benchmark> mon(new kis_benchmark());
+        Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->insert_global(global_name(), mon);
+        return mon;
+    }
+
+private:
+    kis_benchmark();
+
+public:
+    virtual ~kis_benchmark();
+
+protected:
+    // Are the sources finished and the pipeline drained
+    bool check_complete();
+
+    void report();
+
+    // Create benchmark_devices synthetic devices, split across the phys in
+    // benchmark_device_phys by weight
+    void populate_devices();
+
+    packet_chain *packetchain;
+
+    int postcap_id, tracker_id;
+    int timer_id, populate_timer_id;
+
+    // Path of a JSON copy of the report, if any
+    std::string report_path;
+
+    // Packets which have entered and finished the pipeline, the times of the first and
+    // the most recent, and the allocation count when the first arrived
+    std::atomic<uint64_t> packets_in, packets_out;
+    std::atomic<bool> started;
+    std::chrono::steady_clock::time_point first_packet;
+    std::atomic<int64_t> last_packet_ns;
+    uint64_t start_allocs;
+
+    // Number of checks the pipeline has been idle with no new packets
+    unsigned int idle_checks;
+    uint64_t last_packets_out;
+
+    bool reported;
+};
+
+#endif
+
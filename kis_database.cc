@@ -32,6 +32,8 @@ kis_database::kis_database(std::string in_module_name) :
 kis_database::~kis_database() {
     kis_lock_guard<kis_mutex> lk(ds_mutex);
 
+    ds_stmts.clear();
+
     if (db != NULL) {
         sqlite3_close(db);
         db = NULL;
@@ -68,6 +70,8 @@ bool kis_database::database_open(std::string in_file_path, int in_flags) {
         return false;
     }
 
+    database_configure_connection();
+
     // Do we have a KISMET table?  If not, this is probably a new database.
     bool k_t_exists = false;
 
@@ -98,12 +102,16 @@ bool kis_database::database_open(std::string in_file_path, int in_flags) {
             return false;
     }
 
+    ds_stmts.set_db(db);
+
     return true;
 }
 
 void kis_database::database_close() {
     kis_lock_guard<kis_mutex> lk(ds_mutex, "database_close");
 
+    ds_stmts.set_db(nullptr);
+
     if (db != NULL) {
         sqlite3_close(db);
     }
@@ -31,6 +31,7 @@
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
+#include "sqlite3_cpp11.h"
 
 /* Kismet Databases
  *
@@ -78,6 +79,10 @@ public:
     virtual int database_upgrade_db() = 0;
 
 protected:
+    // Configure a freshly opened connection before any tables are created, for
+    // settings like the page size which can't change once the database has content
+    virtual void database_configure_connection() { }
+
     virtual bool database_create_master_table();
 
     // Force-set db version, to be called after upgrading the db or
@@ -92,6 +97,10 @@ protected:
     kis_mutex ds_mutex;
 
     sqlite3 *db;
+
+    // Prepared statements of queries which are run repeatedly, only valid while the
+    // database is
+    kissqlite3::stmt_cache ds_stmts;
 };
 
 /* Dynamic database query binder */
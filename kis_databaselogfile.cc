@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "globalregistry.h"
@@ -38,7 +39,7 @@ kis_database_logfile::kis_database_logfile():
 
     transaction_mutex.set_name("kis_database_logfile_transaction");
 
-    std::shared_ptr<packet_chain> packetchain =
+    packetchain =
         Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
 
     pack_comp_device = packetchain->register_packet_component("DEVICE");
@@ -59,6 +60,117 @@ kis_database_logfile::kis_database_logfile():
 
     message_evt_id = 0;
     alert_evt_id = 0;
+
+    packet_writer_running = false;
+    packet_rows_queued = 0;
+
+    packet_segments_enabled = false;
+    packet_segment_size = 0;
+    packet_segments_expire = false;
+
+    packet_dict_samples = 0;
+    packet_dict_size = 0;
+
+    packet_index_mode = "close";
+    packet_indexes_built = false;
+    pcap_explain = true;
+    pcap_stream_backlog = 1024*512;
+
+    readers_enabled = false;
+    reader_pool_size = 4;
+    reader_query_timeout = 60;
+    pcap_query_timeout = 0;
+
+    device_log_mutex.set_name("kis_database_logfile_device_log");
+    device_log_generations = 1;
+    device_log_max_interval = 0;
+    device_log_format = "json";
+
+    checkpoint_running = false;
+
+    rotate_size = 0;
+    rotate_interval = 0;
+    rotate_packets = 0;
+    rotate_mutex.set_name("kis_database_logfile_rotate");
+    rotate_number = 0;
+    rotate_prepared = false;
+    rotate_next_db = nullptr;
+    rotate_finishing = false;
+    rotate_file_packets = 0;
+    rotate_file_bytes = 0;
+    manifest_mutex.set_name("kis_database_logfile_manifest");
+
+    auto entrytracker = Globalreg::fetch_mandatory_global_as<entry_tracker>();
+
+    writer_rows_queued =
+        entrytracker->register_and_get_field_as<tracker_element_uint64>("kismet.kismetdb.packet_writer.rows_queued",
+                tracker_element_factory<tracker_element_uint64>(),
+                "packet rows queued for the kismetdb writer");
+    writer_rows_written =
+        entrytracker->register_and_get_field_as<tracker_element_uint64>("kismet.kismetdb.packet_writer.rows_written",
+                tracker_element_factory<tracker_element_uint64>(),
+                "packet rows written by the kismetdb writer");
+    writer_commits =
+        entrytracker->register_and_get_field_as<tracker_element_uint64>("kismet.kismetdb.packet_writer.commits",
+                tracker_element_factory<tracker_element_uint64>(),
+                "kismetdb transactions committed");
+    writer_commit_interval =
+        entrytracker->register_and_get_field_as<tracker_element_uint32>("kismet.kismetdb.packet_writer.commit_interval",
+                tracker_element_factory<tracker_element_uint32>(),
+                "current kismetdb commit interval, in seconds");
+    writer_rows_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<>>("kismet.kismetdb.packet_writer.rows_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "packet rows written rrd");
+    writer_backlog_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(
+                "kismet.kismetdb.packet_writer.backlog_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "largest packet writer backlog rrd");
+    writer_commit_time_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(
+                "kismet.kismetdb.packet_writer.commit_time_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "longest kismetdb commit, in milliseconds, rrd");
+    writer_rotations =
+        entrytracker->register_and_get_field_as<tracker_element_uint64>("kismet.kismetdb.packet_writer.rotations",
+                tracker_element_factory<tracker_element_uint64>(),
+                "kismetdb log files started by rotation");
+
+    writer_stats_map = std::make_shared<tracker_element_map>();
+    writer_stats_map->insert(writer_rows_queued);
+    writer_stats_map->insert(writer_rows_written);
+    writer_stats_map->insert(writer_commits);
+    writer_stats_map->insert(writer_commit_interval);
+    writer_stats_map->insert(writer_rows_rrd);
+    writer_stats_map->insert(writer_backlog_rrd);
+    writer_stats_map->insert(writer_commit_time_rrd);
+    writer_stats_map->insert(writer_rotations);
+
+    checkpoint_count =
+        entrytracker->register_and_get_field_as<tracker_element_uint64>("kismet.kismetdb.checkpoint.count",
+                tracker_element_factory<tracker_element_uint64>(),
+                "kismetdb WAL checkpoints run");
+    checkpoint_busy =
+        entrytracker->register_and_get_field_as<tracker_element_uint64>("kismet.kismetdb.checkpoint.busy",
+                tracker_element_factory<tracker_element_uint64>(),
+                "kismetdb WAL checkpoints which could not get the checkpoint lock");
+    checkpoint_time_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(
+                "kismet.kismetdb.checkpoint.time_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "longest kismetdb WAL checkpoint, in milliseconds, rrd");
+    checkpoint_wal_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(
+                "kismet.kismetdb.checkpoint.wal_frames_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "largest kismetdb WAL size at checkpoint, in pages, rrd");
+
+    checkpoint_stats_map = std::make_shared<tracker_element_map>();
+    checkpoint_stats_map->insert(checkpoint_count);
+    checkpoint_stats_map->insert(checkpoint_busy);
+    checkpoint_stats_map->insert(checkpoint_time_rrd);
+    checkpoint_stats_map->insert(checkpoint_wal_rrd);
 }
 
 kis_database_logfile::~kis_database_logfile() {
@@ -82,6 +194,107 @@ bool kis_database_logfile::open_log(std::string in_path) {
     auto timetracker = 
         Globalreg::fetch_mandatory_global_as<time_tracker>("TIMETRACKER");
 
+    if (!load_db_profile()) {
+        Globalreg::globalreg->fatal_condition = true;
+        return false;
+    }
+
+    packet_segments_enabled =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_packet_segments", false);
+    packet_segment_size = 
+        std::max(1UL, Globalreg::globalreg->kismet_config->fetch_opt_ulong("kis_log_packet_segment_size", 256)) * 
+        1024 * 1024;
+
+    packet_index_mode =
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("kis_log_packet_indexes", "close"));
+
+    if (packet_index_mode != "close" && packet_index_mode != "query" && packet_index_mode != "none") {
+        _MSG_FATAL("Unknown kis_log_packet_indexes '{}', expected close, query, or none", packet_index_mode);
+        Globalreg::globalreg->fatal_condition = true;
+        return false;
+    }
+
+    packet_indexes_built = false;
+
+    pcap_explain =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_pcap_explain", true);
+    pcap_stream_backlog = 
+        std::max(64U, Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_pcap_buffer", 512)) * 1024;
+
+    reader_pool_size =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_db_readers", 4);
+    reader_query_timeout =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_db_query_timeout", 60);
+    pcap_query_timeout =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_pcap_timeout", 0);
+
+    device_log_generations =
+        std::max(1U, Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_device_generations", 1));
+    device_log_max_interval =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_device_max_interval", 300);
+    device_log_format =
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("kis_log_device_format", "json"));
+
+    if (device_log_format != "json" && device_log_format != "msgpack") {
+        _MSG_FATAL("Unknown kis_log_device_format '{}', expected json or msgpack", device_log_format);
+        Globalreg::globalreg->fatal_condition = true;
+        return false;
+    }
+
+    {
+        kis_lock_guard<kis_mutex> lk(device_log_mutex, "kismetdb open_log");
+        device_log_states.clear();
+    }
+
+    auto compression =
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("kis_log_packet_compression", "none"));
+
+    if (compression == "deflate") {
+        packet_compressor = std::make_shared<kismetdb_packet_compressor>(
+                std::min(9, std::max(1, 
+                        Globalreg::globalreg->kismet_config->fetch_opt_int("kis_log_packet_compression_level", 3))));
+
+        if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_packet_dictionary", true)) {
+            packet_dict_samples = 
+                Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_packet_dictionary_samples", 2048);
+            packet_dict_size =
+                std::min(32768U, 
+                        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_packet_dictionary_size", 4096));
+        } else {
+            packet_dict_samples = 0;
+            packet_dict_size = 0;
+        }
+
+        packet_dict_training.clear();
+    } else if (compression == "none") {
+        packet_compressor.reset();
+    } else {
+        _MSG_FATAL("Unknown kis_log_packet_compression '{}', expected none or deflate", compression);
+        Globalreg::globalreg->fatal_condition = true;
+        return false;
+    }
+
+    rotate_size = 
+        Globalreg::globalreg->kismet_config->fetch_opt_ulong("kis_log_rotate_size", 0) * 1024 * 1024;
+    rotate_interval =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_rotate_interval", 0);
+    rotate_packets =
+        Globalreg::globalreg->kismet_config->fetch_opt_ulong("kis_log_rotate_packets", 0);
+
+    if (rotation_enabled() &&
+            Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_ephemeral_dangerous", false)) {
+        _MSG_INFO("Ephemeral kismetdb logs are not rotated");
+        rotate_size = 0;
+        rotate_interval = 0;
+        rotate_packets = 0;
+    }
+
+    if (packet_segments_enabled &&
+            Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_ephemeral_dangerous", false)) {
+        _MSG_INFO("Ephemeral kismetdb logs keep packets in the log instead of in packet segments");
+        packet_segments_enabled = false;
+    }
+
     bool dbr = database_open(in_path, SQLITE_OPEN_FULLMUTEX);
 
     if (!dbr) {
@@ -99,26 +312,86 @@ bool kis_database_logfile::open_log(std::string in_path) {
         return false;
     }
 
-    sqlite3_exec(db, "PRAGMA journal_mode=PERSIST", NULL, NULL, NULL);
-    
-    // Go into transactional mode where we only commit every 10 seconds
-    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    if (packet_segments_enabled) {
+        packet_segments = std::make_shared<kismetdb_segment_writer>(ds_dbfile, packet_segment_size);
 
-    transaction_timer = 
-        timetracker->register_timer(SERVER_TIMESLICES_SEC * 10, NULL, 1,
-            [this](int) -> int {
+        try {
+            packet_segments->open();
+        } catch (const std::runtime_error& e) {
+            _MSG_FATAL("Unable to open kismetdb packet segments: {}", e.what());
+            Globalreg::globalreg->fatal_condition = true;
+            return false;
+        }
 
-            // local_locker dblock(&ds_mutex, "kismetdb transaction_timer");
+        _MSG_INFO("Saving packet contents to segment files in '{}'", packet_segments->get_dir());
+    }
 
-            in_transaction_sync = true;
+    if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_heatmap", false)) {
+        if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_ephemeral_dangerous", false)) {
+            _MSG_INFO("Ephemeral kismetdb logs do not build a heat map");
+        } else {
+            // One heat map covers every file of a rolling log
+            heatmap = std::make_shared<kismetdb_heatmap>(kismetdb_heatmap_path(in_path),
+                    Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_heatmap_min_zoom", 4),
+                    Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_heatmap_max_zoom", 17),
+                    Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_heatmap_devices", true));
+
+            try {
+                heatmap->open();
+                heatmap->set_progress(kismetdb_heatmap_source(ds_dbfile), KISMETDB_HEATMAP_PROGRESS_LIVE);
+                _MSG_INFO("Building signal heat map tiles in '{}' for zoom levels {} to {}",
+                        heatmap->get_path(), heatmap->get_min_zoom(), heatmap->get_max_zoom());
+            } catch (const std::runtime_error& e) {
+                _MSG_ERROR("Unable to open the kismetdb heat map, heat map tiles will not be "
+                        "built: {}", e.what());
+                heatmap.reset();
+            }
+        }
+    }
 
-            sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
-            sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    rotate_base_path = in_path;
+    rotate_number = 0;
+    rotate_opened = std::chrono::steady_clock::now();
+    rotate_file_packets = 0;
+    rotate_file_bytes = 0;
 
-            in_transaction_sync = false;
+    if (rotation_enabled()) {
+        manifest_path = kismetdb_manifest_path(in_path);
 
-            return 1;
-        });
+        {
+            kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb open_log");
+            manifest.clear();
+            manifest.push_back(kismetdb_manifest_entry{in_path, 0, 0, 0, true});
+        }
+
+        write_manifest();
+
+        _MSG_INFO("Rotating the kismetdb log every {}, {}, or {}; the log files are listed in '{}'",
+                rotate_size != 0 ? fmt::format("{}MB", rotate_size / 1024 / 1024) : "(no size limit)",
+                rotate_interval != 0 ? fmt::format("{} seconds", rotate_interval) : "(no time limit)",
+                rotate_packets != 0 ? fmt::format("{} packets", rotate_packets) : "(no packet limit)",
+                manifest_path);
+
+        prepare_rotation();
+    }
+
+    // Go into transactional mode where we only commit every 10 seconds; the packet
+    // writer owns the commit cycle
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    packet_write_batch =
+        std::max((size_t) 1, (size_t) Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_packet_batch", 1024));
+    packet_write_backlog =
+        std::max(packet_write_batch, 
+                (size_t) Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_packet_backlog", 65536));
+    packet_commit_interval =
+        std::max(1U, Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_commit_interval", 10));
+    packet_commit_max_interval =
+        std::max(packet_commit_interval,
+                Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_commit_max_interval", 30));
+
+    start_packet_writer();
+    start_checkpoint_runner();
 
 
     set_int_log_path(in_path);
@@ -129,6 +402,11 @@ bool kis_database_logfile::open_log(std::string in_path) {
         _MSG_INFO("KISMETDB LOG IS IN EPHEMERAL MODE.  LOG WILL *** NOT *** BE PRESERVED WHEN "
                 "KISMET EXITS.");
         unlink(in_path.c_str());
+    } else {
+        // An unlinked log can't be opened again, so an ephemeral log is only read
+        // through the connection of the writer
+        readers_enabled = true;
+        readers.open(ds_dbfile, reader_pool_size);
     }
 
     packet_timeout =
@@ -138,6 +416,7 @@ bool kis_database_logfile::open_log(std::string in_path) {
         packet_timeout_timer = 
             timetracker->register_timer(SERVER_TIMESLICES_SEC * 15, NULL, 1,
                     [this](int) -> int {
+                    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
 
                     auto pkt_delete = 
                         fmt::format("DELETE FROM packets WHERE ts_sec < {}",
@@ -149,6 +428,8 @@ bool kis_database_logfile::open_log(std::string in_path) {
                     sqlite3_exec(db, pkt_delete.c_str(), NULL, NULL, NULL);
                     sqlite3_exec(db, data_delete.c_str(), NULL, NULL, NULL);
 
+                    packet_segments_expire = true;
+
                     return 1;
                     });
     } else {
@@ -162,6 +443,7 @@ bool kis_database_logfile::open_log(std::string in_path) {
         device_timeout_timer = 
             timetracker->register_timer(SERVER_TIMESLICES_SEC * 60, NULL, 1,
                     [this](int) -> int {
+                    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
 
                     auto pkt_delete = 
                         fmt::format("DELETE FROM devices WHERE last_time < {}",
@@ -182,6 +464,7 @@ bool kis_database_logfile::open_log(std::string in_path) {
         message_timeout_timer = 
             timetracker->register_timer(SERVER_TIMESLICES_SEC * 60, NULL, 1,
                     [this](int) -> int {
+                    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
 
                     auto pkt_delete = 
                         fmt::format("DELETE FROM messages WHERE ts_sec < {}",
@@ -202,6 +485,7 @@ bool kis_database_logfile::open_log(std::string in_path) {
         alert_timeout_timer = 
             timetracker->register_timer(SERVER_TIMESLICES_SEC * 60, NULL, 1,
                     [this](int) -> int {
+                    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
 
                     auto pkt_delete = 
                         fmt::format("DELETE FROM alerts WHERE ts_sec < {}",
@@ -222,6 +506,7 @@ bool kis_database_logfile::open_log(std::string in_path) {
         snapshot_timeout_timer = 
             timetracker->register_timer(SERVER_TIMESLICES_SEC * 60, NULL, 1,
                     [this](int) -> int {
+                    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
 
                     auto pkt_delete = 
                         fmt::format("DELETE FROM snapshots WHERE ts_sec < {}",
@@ -249,6 +534,30 @@ bool kis_database_logfile::open_log(std::string in_path) {
                     return packet_drop_endpoint_handler(con);
                 }));
 
+    httpd->register_route("/logging/kismetdb/packet_writer", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(writer_stats_map, writer_stats_mutex));
+
+    httpd->register_route("/logging/kismetdb/checkpoints", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(checkpoint_stats_map, checkpoint_stats_mutex));
+
+    httpd->register_route("/logging/kismetdb/heatmap/:zoom/:x/:y", {"GET", "POST"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    return heatmap_endp_handler(con, "");
+                }));
+
+    httpd->register_route("/logging/kismetdb/heatmap/by-mac/:mac/:zoom/:x/:y", {"GET", "POST"},
+            httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    mac_addr mac(con->uri_params()[":mac"]);
+
+                    if (mac.state.error)
+                        throw std::runtime_error("invalid mac address");
+
+                    return heatmap_endp_handler(con, mac.mac_to_string());
+                }));
+
     httpd->register_route("/poi/create_poi", {"POST"}, httpd->LOGON_ROLE, {"cmd"},
             std::make_shared<kis_net_web_function_endpoint>(
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
@@ -402,8 +711,6 @@ bool kis_database_logfile::open_log(std::string in_path) {
     // Register the log after we have all the filters set and the mutex unlocked
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_packets", true)) {
         _MSG("Saving packets to the Kismet database log.", MSGFLAG_INFO);
-        std::shared_ptr<packet_chain> packetchain =
-            Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
 
         auto this_ref = shared_from_this();
         packet_handler_id = 
@@ -429,7 +736,6 @@ void kis_database_logfile::close_log() {
         Globalreg::fetch_global_as<time_tracker>();
 
     if (timetracker != NULL) {
-        timetracker->remove_timer(transaction_timer);
         timetracker->remove_timer(packet_timeout_timer);
         timetracker->remove_timer(alert_timeout_timer);
         timetracker->remove_timer(device_timeout_timer);
@@ -451,14 +757,61 @@ void kis_database_logfile::close_log() {
     set_int_log_open(false);
     db_enabled = false;
 
+    // Readers would keep the journal from being switched back
+    readers_enabled = false;
+    readers.close();
+
+    // Flush the queued packets and the writer
+    stop_packet_writer();
+    stop_checkpoint_runner();
+
+    // Drop the unused next file of a rolling log, and wait for the last rotated file
+    // to be finished
+    discard_rotation();
+
+    if (rotate_finish_thread.joinable())
+        rotate_finish_thread.join();
+
+    if (packet_segments != nullptr) {
+        packet_segments->sync();
+        packet_segments->close();
+        packet_segments.reset();
+    }
+
+    if (heatmap != nullptr) {
+        try {
+            heatmap->flush();
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("Unable to update the kismetdb heat map: {}", e.what());
+        }
+
+        heatmap->close();
+        heatmap.reset();
+    }
+
     // End the transaction
     sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
 
+    if (packet_index_mode == "close" && db != nullptr) {
+        _MSG_INFO("Indexing packets in the kismetdb log...");
+        build_packet_indexes();
+    }
+
     sqlite3_exec(db, "PRAGMA journal_mode=DELETE", NULL, NULL, NULL);
     sqlite3_exec(db, "BEGIN_EXCLUSIVE", NULL, NULL, NULL);
     sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
 
     database_close();
+
+    if (rotation_enabled()) {
+        {
+            kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb close_log");
+            for (auto& m : manifest)
+                m.active = false;
+        }
+
+        write_manifest();
+    }
 }
 
 int kis_database_logfile::database_upgrade_db() {
@@ -548,7 +901,14 @@ int kis_database_logfile::database_upgrade_db() {
         "datarate REAL, " // datarate, if known
 
         "hash INT, " // crc32 hash
-        "packetid INT " // packet id (shared with duplicate packets)
+        "packetid INT, " // packet id (shared with duplicate packets)
+
+        "segment INT, " // Segment file and offset of the packet when the packet
+        "segment_offset INT, " // bytes are logged to segments instead of the table
+
+        "codec INT, " // Packet content codec and dictionary, see kismetdb_codec.h
+        "codec_dict INT, "
+        "stored_len INT " // Length of the packet content as stored
         ")";
 
     r = sqlite3_exec(db, sql.c_str(),
@@ -561,6 +921,23 @@ int kis_database_logfile::database_upgrade_db() {
         return -1;
     }
 
+    sql =
+        "CREATE TABLE packet_dictionaries ("
+        "id INT PRIMARY KEY, "
+        "codec INT, "
+        "dictionary BLOB"
+        ")";
+
+    r = sqlite3_exec(db, sql.c_str(),
+            [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+    if (r != SQLITE_OK) {
+        _MSG("Kismet log was unable to create packet_dictionaries table in " + ds_dbfile + ": " +
+                std::string(sErrMsg), MSGFLAG_ERROR);
+        close_log();
+        return -1;
+    }
+
     sql =
         "CREATE TABLE data ("
 
@@ -706,6 +1083,9 @@ void kis_database_logfile::handle_message(std::shared_ptr<tracked_message> msg)
     if (!db_enabled)
         return;
 
+    // The database connection is swapped when the log rotates
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
     int r;
     std::string sql;
     sqlite3_stmt *msg_stmt;
@@ -775,50 +1155,124 @@ int kis_database_logfile::log_device(std::shared_ptr<kis_tracked_device_base> d)
     if (!db_enabled)
         return 0;
 
-    std::string sql;
-
-    std::string phystring;
-    std::string macstring;
-    std::string typestring;
-    std::string keystring;
-
     if (d == nullptr)
         return 0;
 
-    if (device_mac_filter->filter(d->get_macaddr(), d->get_phyid()))
+    std::vector<device_record> records(1);
+
+    // We don't have to lock because we're called by a device worker, which locks
+    if (!build_device_record(d, records[0]))
         return 0;
 
-    phystring = d->get_phyname();
-    macstring = d->get_macaddr().mac_to_string();
-    typestring = d->get_type_string();
-    keystring = d->get_key().as_string();
+    return log_device_records(records);
+}
+
+bool kis_database_logfile::device_needs_log(std::shared_ptr<kis_tracked_device_base> d, bool force) {
+    auto generation = d->get_mod_generation();
 
-    int spos = 1;
+    kis_lock_guard<kis_mutex> lk(device_log_mutex, "kismetdb device_needs_log");
 
-    std::stringstream sstr;
+    auto si = device_log_states.find(d->get_key());
 
-    // We don't have to lock because we're called by a device worker, which locks
+    if (si == device_log_states.end())
+        return true;
+
+    if (generation == si->second.generation)
+        return false;
+
+    if (force || generation - si->second.generation >= device_log_generations)
+        return true;
+
+    time_t now = Globalreg::globalreg->last_tv_sec;
+
+    return now - si->second.logged >= (time_t) device_log_max_interval;
+}
+
+bool kis_database_logfile::build_device_record(std::shared_ptr<kis_tracked_device_base> d,
+        device_record& record) {
+    if (!prepare_device_record(d, record))
+        return false;
+
+    return serialize_device_record(record);
+}
+
+bool kis_database_logfile::prepare_device_record(std::shared_ptr<kis_tracked_device_base> d,
+        device_record& record) {
+    if (device_mac_filter->filter(d->get_macaddr(), d->get_phyid()))
+        return false;
+
+    record.snapshot = tracker_element_snapshot(d);
+
+    if (record.snapshot == nullptr) {
+        _MSG_ERROR("Failure serializing device key {} to the kisdatabaselog", d->get_key());
+        return false;
+    }
 
-#if 0
     {
-        kis_lock_guard<kis_mutex> lg_dl(devicetracker->get_devicelist_mutex(), "database_logfile::log_device");
-        int r = Globalreg::globalreg->entrytracker->serialize("json", sstr, d, nullptr);
+        kis_lock_guard<kis_mutex> lk(device_log_mutex, "kismetdb prepare_device_record");
+        device_log_states[d->get_key()] = 
+            device_log_state{d->get_mod_generation(), Globalreg::globalreg->last_tv_sec};
+    }
 
-        if (r < 0) {
-            _MSG_ERROR("Failure serializing device key {} to the kisdatabaselog", d->get_key());
-            return 0;
-        }
+    record.first_time = d->get_first_time();
+    record.last_time = d->get_last_time();
+    record.key = d->get_key().as_string();
+    record.phyname = d->get_phyname();
+    record.macaddr = d->get_macaddr().mac_to_string();
+    record.strongest_signal = d->get_signal_data()->get_max_signal();
+
+    if (d->has_location() && (d->get_location()->has_min_loc() &&
+                              d->get_location()->has_max_loc() &&
+                              d->get_location()->has_avg_loc())) {
+        const auto& acc = d->get_location()->get_accumulator();
+
+        record.min_lat = acc.min_lat;
+        record.min_lon = acc.min_lon;
+        record.max_lat = acc.max_lat;
+        record.max_lon = acc.max_lon;
+        record.avg_lat = acc.avg_lat();
+        record.avg_lon = acc.avg_lon();
+    } else {
+        // Empty location
+        record.min_lat = record.min_lon = 0;
+        record.max_lat = record.max_lon = 0;
+        record.avg_lat = record.avg_lon = 0;
     }
-#endif
 
-    int r = Globalreg::globalreg->entrytracker->serialize("json", sstr, d, nullptr);
+    record.datasize = d->get_datasize();
+    record.type = d->get_type_string();
+
+    return true;
+}
+
+bool kis_database_logfile::serialize_device_record(device_record& record) {
+    std::stringstream sstr;
+
+    int r = Globalreg::globalreg->entrytracker->serialize(device_log_format, sstr, 
+            record.snapshot, nullptr);
+
+    record.snapshot.reset();
 
     if (r < 0) {
-        _MSG_ERROR("Failure serializing device key {} to the kisdatabaselog", d->get_key());
-        return 0;
+        _MSG_ERROR("Failure serializing device key {} to the kisdatabaselog", record.key);
+        return false;
     }
 
-    std::string streamstring = sstr.str();
+    record.json = sstr.str();
+
+    return true;
+}
+
+int kis_database_logfile::log_device_records(const std::vector<device_record>& records) {
+    if (!db_enabled)
+        return 0;
+
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
+    if (records.size() == 0)
+        return 0;
+
+    std::string sql;
 
     sqlite3_stmt *device_stmt;
     const char *device_pz;
@@ -831,7 +1285,7 @@ int kis_database_logfile::log_device(std::shared_ptr<kis_tracked_device_base> d)
         "bytes_data, type, device) "
         "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
 
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &device_stmt, &device_pz);
+    int r = sqlite3_prepare(db, sql.c_str(), sql.length(), &device_stmt, &device_pz);
 
     if (r != SQLITE_OK) {
         _MSG("kis_database_logfile unable to prepare database insert for devices in " +
@@ -840,63 +1294,49 @@ int kis_database_logfile::log_device(std::shared_ptr<kis_tracked_device_base> d)
         return -1;
     }
 
-    sqlite3_bind_int64(device_stmt, spos++, d->get_first_time());
-    sqlite3_bind_int64(device_stmt, spos++, d->get_last_time());
-    sqlite3_bind_text(device_stmt, spos++, keystring.c_str(), 
-            keystring.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_text(device_stmt, spos++, phystring.c_str(), 
-            phystring.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_text(device_stmt, spos++, macstring.c_str(), 
-            macstring.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_int(device_stmt, spos++, d->get_signal_data()->get_max_signal());
-
-    if (d->has_location() && (d->get_location()->has_min_loc() &&
-                              d->get_location()->has_max_loc() &&
-                              d->get_location()->has_avg_loc())) {
-        sqlite3_bind_double(device_stmt, spos++, 
-                            d->get_location()->get_min_loc()->get_lat());
-        sqlite3_bind_double(device_stmt, spos++,
-                            d->get_location()->get_min_loc()->get_lon());
-        sqlite3_bind_double(device_stmt, spos++,
-                            d->get_location()->get_max_loc()->get_lat());
-        sqlite3_bind_double(device_stmt, spos++,
-                            d->get_location()->get_max_loc()->get_lon());
-        sqlite3_bind_double(device_stmt, spos++,
-                            d->get_location()->get_avg_loc()->get_lat());
-        sqlite3_bind_double(device_stmt, spos++,
-                            d->get_location()->get_avg_loc()->get_lon());
-    } else {
-        // Empty location
-        sqlite3_bind_double(device_stmt, spos++, 0);
-        sqlite3_bind_double(device_stmt, spos++, 0);
-        sqlite3_bind_double(device_stmt, spos++, 0);
-        sqlite3_bind_double(device_stmt, spos++, 0);
-        sqlite3_bind_double(device_stmt, spos++, 0);
-        sqlite3_bind_double(device_stmt, spos++, 0);
-    }
-
-    sqlite3_bind_int64(device_stmt, spos++, d->get_datasize());
-    sqlite3_bind_text(device_stmt, spos++, typestring.c_str(), 
-            typestring.length(), SQLITE_TRANSIENT);
-
-    sqlite3_bind_blob(device_stmt, spos++, streamstring.c_str(), 
-            streamstring.length(), SQLITE_TRANSIENT);
-
-#if 0
-    kis_unique_lock<kis_mutex> dblock(ds_mutex, std::defer_lock, "kismetdb log_device");
-    db_lock_with_sync_check(dblock, return);
-#endif
-
-    if (sqlite3_step(device_stmt) != SQLITE_DONE) {
-        _MSG("kis_database_logfile unable to insert device in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-        close_log();
-        return -1;
+    // Records are written inside the open logging transaction, which is committed
+    // by the transaction timer
+    for (const auto& rec : records) {
+        int spos = 1;
+
+        sqlite3_reset(device_stmt);
+
+        sqlite3_bind_int64(device_stmt, spos++, rec.first_time);
+        sqlite3_bind_int64(device_stmt, spos++, rec.last_time);
+        sqlite3_bind_text(device_stmt, spos++, rec.key.c_str(), 
+                rec.key.length(), SQLITE_STATIC);
+        sqlite3_bind_text(device_stmt, spos++, rec.phyname.c_str(), 
+                rec.phyname.length(), SQLITE_STATIC);
+        sqlite3_bind_text(device_stmt, spos++, rec.macaddr.c_str(), 
+                rec.macaddr.length(), SQLITE_STATIC);
+        sqlite3_bind_int(device_stmt, spos++, rec.strongest_signal);
+
+        sqlite3_bind_double(device_stmt, spos++, rec.min_lat);
+        sqlite3_bind_double(device_stmt, spos++, rec.min_lon);
+        sqlite3_bind_double(device_stmt, spos++, rec.max_lat);
+        sqlite3_bind_double(device_stmt, spos++, rec.max_lon);
+        sqlite3_bind_double(device_stmt, spos++, rec.avg_lat);
+        sqlite3_bind_double(device_stmt, spos++, rec.avg_lon);
+
+        sqlite3_bind_int64(device_stmt, spos++, rec.datasize);
+        sqlite3_bind_text(device_stmt, spos++, rec.type.c_str(), 
+                rec.type.length(), SQLITE_STATIC);
+
+        sqlite3_bind_blob(device_stmt, spos++, rec.json.c_str(), 
+                rec.json.length(), SQLITE_STATIC);
+
+        if (sqlite3_step(device_stmt) != SQLITE_DONE) {
+            _MSG("kis_database_logfile unable to insert device in " +
+                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+            sqlite3_finalize(device_stmt);
+            close_log();
+            return -1;
+        }
     }
 
     sqlite3_finalize(device_stmt);
 
-    return 1;
+    return records.size();
 }
 
 int kis_database_logfile::log_packet(std::shared_ptr<kis_packet> in_pack) {
@@ -962,109 +1402,68 @@ int kis_database_logfile::log_packet(std::shared_ptr<kis_packet> in_pack) {
         sourceuuidstring = "00000000-0000-0000-0000-000000000000";
     }
 
-    // Log into the PACKET table if we're a loggable packet (ie, have a link frame)
-    if (chunk != nullptr) {
-        int r;
-        std::string sql;
-        sqlite3_stmt *packet_stmt;
-        const char *packet_pz;
-
-        sql =
-            "INSERT INTO packets "
-            "(ts_sec, ts_usec, phyname, "
-            "sourcemac, destmac, transmac, devkey, frequency, " 
-            "lat, lon, alt, speed, heading, "
-            "packet_len, signal, "
-            "datasource, "
-            "dlt, packet, "
-            "error, tags, datarate, hash, packetid) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-
-        r = sqlite3_prepare(db, sql.c_str(), sql.length(), &packet_stmt, &packet_pz);
-
-        if (r != SQLITE_OK) {
-            _MSG("kis_database_logfile unable to prepare database insert for packets in " +
-                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-            close_log();
-            return -1;
-        }
-
-        int sql_pos = 1;
+    if (heatmap != nullptr && gpsdata != nullptr && gpsdata->fix >= 2)
+        heatmap->add(commoninfo != nullptr ? macstring : "", gpsdata->lat, gpsdata->lon,
+                radioinfo != nullptr ? radioinfo->signal_dbm : 0);
 
-        sqlite3_bind_int64(packet_stmt, sql_pos++, in_pack->ts.tv_sec);
-        sqlite3_bind_int64(packet_stmt, sql_pos++, in_pack->ts.tv_usec);
+    // Queue a row for the PACKET table if we're a loggable packet (ie, have a link frame)
+    if (chunk != nullptr) {
+        packet_row row;
 
-        sqlite3_bind_text(packet_stmt, sql_pos++, phystring.c_str(), phystring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, macstring.c_str(), macstring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, deststring.c_str(), deststring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, transstring.c_str(), transstring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, keystring.c_str(), keystring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_double(packet_stmt, sql_pos++, frequency);
+        row.ts_sec = in_pack->ts.tv_sec;
+        row.ts_usec = in_pack->ts.tv_usec;
+        row.phyname = phystring;
+        row.sourcemac = macstring;
+        row.destmac = deststring;
+        row.transmac = transstring;
+        row.devkey = keystring;
+        row.frequency = frequency;
 
         if (gpsdata != NULL) {
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->lat);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->lon);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->alt);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->speed);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->heading);
+            row.lat = gpsdata->lat;
+            row.lon = gpsdata->lon;
+            row.alt = gpsdata->alt;
+            row.speed = gpsdata->speed;
+            row.heading = gpsdata->heading;
         } else {
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
+            row.lat = row.lon = row.alt = row.speed = row.heading = 0;
         }
 
-        sqlite3_bind_int64(packet_stmt, sql_pos++, chunk->length());
-
         if (radioinfo != nullptr) {
-            sqlite3_bind_int(packet_stmt, sql_pos++, radioinfo->signal_dbm);
+            row.signal = radioinfo->signal_dbm;
+            row.datarate = radioinfo->datarate / 10;
         } else {
-            sqlite3_bind_int(packet_stmt, sql_pos++, 0);
-        }
-
-        sqlite3_bind_text(packet_stmt, sql_pos++, sourceuuidstring.c_str(), 
-                sourceuuidstring.length(), SQLITE_TRANSIENT);
-
-        sqlite3_bind_int(packet_stmt, sql_pos++, chunk->dlt);
-        sqlite3_bind_blob(packet_stmt, sql_pos++, (const char *) chunk->data(), chunk->length(), 0);
-
-        sqlite3_bind_int(packet_stmt, sql_pos++, in_pack->error);
-
-        std::stringstream tagstream;
-        bool space_needed = false;
-
-        for (auto tag : in_pack->tag_map) {
-            if (space_needed)
-                tagstream << " ";
-            space_needed = true;
-            tagstream << tag.first;
+            row.signal = 0;
+            row.datarate = 0;
         }
 
-        auto str = tagstream.str();
-        sqlite3_bind_text(packet_stmt, sql_pos++, str.c_str(), tagstream.str().length(), SQLITE_TRANSIENT);
-
-        if (radioinfo != nullptr)
-            sqlite3_bind_double(packet_stmt, sql_pos++, radioinfo->datarate / 10);
-        else
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
+        row.datasource = sourceuuidstring;
+        row.dlt = chunk->dlt;
+        row.packet.assign((const char *) chunk->data(), chunk->length());
+        row.packet_len = chunk->length();
+        row.codec = KISMETDB_CODEC_RAW;
+        row.codec_dict = 0;
+        row.error = in_pack->error;
+
+        in_pack->for_each_tag([this, &row](int tag) {
+            if (row.tags.length() != 0)
+                row.tags += " ";
+            row.tags += packetchain->fetch_packet_tag_name(tag);
+        });
 
-        sqlite3_bind_int(packet_stmt, sql_pos++, in_pack->hash);
-        sqlite3_bind_int64(packet_stmt, sql_pos++, in_pack->packet_no);
+        row.hash = in_pack->hash;
+        row.packetid = in_pack->packet_no;
 
-#if 0
-        kis_unique_lock<kis_mutex> dblock(ds_mutex, std::defer_lock, "kismetdb log_packet");
-        db_lock_with_sync_check(dblock, return -1);
-#endif
+        // Hold the logging thread while the writer is too far behind; the packetchain
+        // log queue applies its own drop policy if it backs up in turn
+        while (packet_writer_running && packet_row_queue.size_approx() >= packet_write_backlog)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
-        if (sqlite3_step(packet_stmt) != SQLITE_DONE) {
-            _MSG("kis_database_logfile unable to insert packet in " +
-                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-            close_log();
-            return -1;
-        }
+        if (!packet_writer_running)
+            return 0;
 
-        sqlite3_finalize(packet_stmt);
+        packet_row_queue.enqueue(std::move(row));
+        packet_rows_queued++;
     }
 
     // If the packet has a metablob record, log that; if the packet ONLY has meta data we should only get a 'data'
@@ -1086,52 +1485,900 @@ int kis_database_logfile::log_packet(std::shared_ptr<kis_packet> in_pack) {
     return 1;
 }
 
-int kis_database_logfile::log_data(std::shared_ptr<kis_gps_packinfo> gps, struct timeval tv, 
-        std::string phystring, mac_addr devmac, uuid datasource_uuid, 
-        std::string type, std::string json) {
-
-    if (!db_enabled)
-        return 0;
-
-    std::string macstring = devmac.mac_to_string();
-    std::string uuidstring = datasource_uuid.uuid_to_string();
+bool kis_database_logfile::load_db_profile() {
+    auto profile_name = 
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("kis_log_db_profile", "default"));
+
+    if (profile_name == "default") {
+        io_profile = db_profile{"PERSIST", "", 0, 0, 0, 0};
+    } else if (profile_name == "throughput") {
+        io_profile = db_profile{"WAL", "NORMAL", 8192, -65536, 256 * 1024 * 1024, 30};
+    } else if (profile_name == "durable") {
+        io_profile = db_profile{"WAL", "FULL", 4096, -16384, 0, 5};
+    } else if (profile_name == "sdcard") {
+        // Large pages and rare checkpoints to cut down on small flash writes; no mmap
+        // since small devices are often 32 bit
+        io_profile = db_profile{"WAL", "NORMAL", 16384, -8192, 0, 60};
+    } else {
+        _MSG_FATAL("Unknown kis_log_db_profile '{}', expected default, throughput, durable, or sdcard",
+                profile_name);
+        return false;
+    }
 
-    int r;
-    std::string sql;
-    sqlite3_stmt *data_stmt;
-    const char *data_pz;
+    auto config = Globalreg::globalreg->kismet_config;
+
+    io_profile.journal_mode = 
+        str_upper(config->fetch_opt_dfl("kis_log_db_journal_mode", io_profile.journal_mode));
+    io_profile.synchronous =
+        str_upper(config->fetch_opt_dfl("kis_log_db_synchronous", io_profile.synchronous));
+    io_profile.page_size = 
+        config->fetch_opt_uint("kis_log_db_page_size", io_profile.page_size);
+    io_profile.cache_size =
+        config->fetch_opt_int("kis_log_db_cache_size", io_profile.cache_size);
+    io_profile.mmap_size =
+        config->fetch_opt_ulong("kis_log_db_mmap_size", io_profile.mmap_size);
+    io_profile.checkpoint_interval =
+        config->fetch_opt_uint("kis_log_db_checkpoint_interval", io_profile.checkpoint_interval);
+
+    // Ephemeral logs are unlinked once open, so a second connection can't find them
+    if (config->fetch_opt_bool("kis_log_ephemeral_dangerous", false))
+        io_profile.checkpoint_interval = 0;
+
+    if (io_profile.journal_mode != "WAL")
+        io_profile.checkpoint_interval = 0;
+
+    _MSG_INFO("Using the '{}' kismetdb profile: journal {}, synchronous {}, page size {}, "
+            "cache size {}, mmap size {}, checkpoint interval {}", profile_name,
+            io_profile.journal_mode, 
+            io_profile.synchronous.length() ? io_profile.synchronous : "default",
+            io_profile.page_size, io_profile.cache_size, io_profile.mmap_size,
+            io_profile.checkpoint_interval);
 
-    sql =
-        "INSERT INTO data "
-        "(ts_sec, ts_usec, "
-        "phyname, devmac, "
-        "lat, lon, alt, speed, heading, "
-        "datasource, "
-        "type, json) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    return true;
+}
 
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &data_stmt, &data_pz);
+void kis_database_logfile::database_configure_connection() {
+    configure_connection(db);
+}
 
-    if (r != SQLITE_OK) {
-        _MSG("kis_database_logfile unable to prepare database insert for data in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-        close_log();
-        return -1;
+void kis_database_logfile::configure_connection(sqlite3 *target) {
+    // Page size only applies to a database without content, so it must come first
+    if (io_profile.page_size != 0)
+        sqlite3_exec(target, fmt::format("PRAGMA page_size={}", io_profile.page_size).c_str(), 
+                NULL, NULL, NULL);
+
+    std::string journal_mode;
+
+    sqlite3_exec(target, fmt::format("PRAGMA journal_mode={}", io_profile.journal_mode).c_str(),
+            [] (void *aux, int argc, char **argv, char **) -> int {
+                if (argc > 0 && argv[0] != nullptr)
+                    *((std::string *) aux) = argv[0];
+                return 0;
+            }, (void *) &journal_mode, NULL);
+
+    if (str_upper(journal_mode) != io_profile.journal_mode) {
+        _MSG_ERROR("Unable to set the kismetdb journal mode to {}, sqlite is using {}",
+                io_profile.journal_mode, journal_mode);
+        io_profile.checkpoint_interval = 0;
     }
 
-    sqlite3_reset(data_stmt);
-    sqlite3_clear_bindings(data_stmt);
+    if (io_profile.synchronous.length())
+        sqlite3_exec(target, fmt::format("PRAGMA synchronous={}", io_profile.synchronous).c_str(),
+                NULL, NULL, NULL);
 
-    int sql_pos = 1;
+    if (io_profile.cache_size != 0)
+        sqlite3_exec(target, fmt::format("PRAGMA cache_size={}", io_profile.cache_size).c_str(),
+                NULL, NULL, NULL);
 
-    sqlite3_bind_int64(data_stmt, sql_pos++, tv.tv_sec);
-    sqlite3_bind_int64(data_stmt, sql_pos++, tv.tv_usec);
+    if (io_profile.mmap_size != 0)
+        sqlite3_exec(target, fmt::format("PRAGMA mmap_size={}", io_profile.mmap_size).c_str(),
+                NULL, NULL, NULL);
 
-    sqlite3_bind_text(data_stmt, sql_pos++, phystring.c_str(), phystring.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_text(data_stmt, sql_pos++, macstring.c_str(), macstring.length(), SQLITE_TRANSIENT);
+    if (io_profile.journal_mode == "WAL") {
+        // Keep a WAL which grew during a stall from holding the space forever
+        sqlite3_exec(target, "PRAGMA journal_size_limit=67108864", NULL, NULL, NULL);
 
-    if (gps != NULL) {
-        sqlite3_bind_double(data_stmt, sql_pos++, gps->lat);
+        if (io_profile.checkpoint_interval != 0)
+            sqlite3_exec(target, "PRAGMA wal_autocheckpoint=0", NULL, NULL, NULL);
+    }
+}
+
+void kis_database_logfile::start_checkpoint_runner() {
+    if (io_profile.checkpoint_interval == 0 || checkpoint_thread.joinable())
+        return;
+
+    checkpoint_running = true;
+
+    checkpoint_thread = std::thread([this]() {
+            thread_set_process_name("kismetdb ckpt");
+            checkpoint_runner();
+        });
+}
+
+void kis_database_logfile::stop_checkpoint_runner() {
+    {
+        std::lock_guard<std::mutex> lk(checkpoint_mutex);
+        checkpoint_running = false;
+    }
+
+    checkpoint_cv.notify_all();
+
+    if (checkpoint_thread.joinable())
+        checkpoint_thread.join();
+}
+
+void kis_database_logfile::checkpoint_runner() {
+    sqlite3 *ckpt_db = nullptr;
+
+    if (sqlite3_open_v2(ds_dbfile.c_str(), &ckpt_db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        _MSG_ERROR("Unable to open a checkpoint connection to the kismetdb log {}: {}; falling "
+                "back to automatic checkpoints", ds_dbfile, sqlite3_errmsg(ckpt_db));
+        sqlite3_close(ckpt_db);
+        sqlite3_exec(db, "PRAGMA wal_autocheckpoint=1000", NULL, NULL, NULL);
+        return;
+    }
+
+    sqlite3_busy_timeout(ckpt_db, 1000);
+
+    std::unique_lock<std::mutex> lk(checkpoint_mutex);
+
+    while (checkpoint_running) {
+        checkpoint_cv.wait_for(lk, std::chrono::seconds(io_profile.checkpoint_interval));
+
+        if (!checkpoint_running)
+            break;
+
+        lk.unlock();
+
+        int wal_frames = 0;
+        int ckpt_frames = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Passive checkpoints copy what they can without waiting on the writer
+        auto r = sqlite3_wal_checkpoint_v2(ckpt_db, nullptr, SQLITE_CHECKPOINT_PASSIVE,
+                &wal_frames, &ckpt_frames);
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+
+        if (r != SQLITE_OK && r != SQLITE_BUSY)
+            _MSG_ERROR("kismetdb WAL checkpoint failed: {}", sqlite3_errmsg(ckpt_db));
+
+        {
+            kis_lock_guard<kis_mutex> slk(checkpoint_stats_mutex, "kismetdb checkpoint_runner");
+
+            if (r == SQLITE_BUSY)
+                checkpoint_busy->set(checkpoint_busy->get() + 1);
+            else if (r == SQLITE_OK)
+                checkpoint_count->set(checkpoint_count->get() + 1);
+
+            checkpoint_time_rrd->add_sample(elapsed.count(), Globalreg::globalreg->last_tv_sec);
+
+            if (wal_frames > 0)
+                checkpoint_wal_rrd->add_sample(wal_frames, Globalreg::globalreg->last_tv_sec);
+        }
+
+        lk.lock();
+    }
+
+    lk.unlock();
+
+    sqlite3_close(ckpt_db);
+}
+
+void kis_database_logfile::write_manifest() {
+    std::vector<kismetdb_manifest_entry> entries;
+
+    {
+        kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb write_manifest");
+
+        if (manifest_path.length() == 0 || manifest.size() == 0)
+            return;
+
+        entries = manifest;
+    }
+
+    try {
+        kismetdb_write_manifest(manifest_path, entries);
+    } catch (const std::runtime_error& e) {
+        _MSG_ERROR("Unable to update the kismetdb log manifest: {}", e.what());
+    }
+}
+
+void kis_database_logfile::prepare_rotation() {
+    if (rotate_prepare_thread.joinable())
+        rotate_prepare_thread.join();
+
+    rotate_prepared = false;
+
+    // The tables of the next file are copied from the current file
+    std::vector<std::string> schema;
+
+    sqlite3_exec(db, 
+            "SELECT sql FROM sqlite_master WHERE type='table' AND sql NOT NULL AND "
+            "name NOT LIKE 'sqlite_%'",
+            [] (void *aux, int argc, char **argv, char **) -> int {
+                if (argc > 0 && argv[0] != nullptr)
+                    ((std::vector<std::string> *) aux)->push_back(argv[0]);
+                return 0;
+            }, (void *) &schema, NULL);
+
+    auto path = kismetdb_rotation_path(rotate_base_path, rotate_number + 1);
+
+    rotate_prepare_thread = std::thread([this, schema, path]() {
+            thread_set_process_name("kismetdb rotate");
+
+            // Never continue into a file left over from some other log
+            if (access(path.c_str(), F_OK) == 0) {
+                _MSG_ERROR("Unable to create the next kismetdb log file '{}', it already exists; "
+                        "the log will not be rotated", path);
+                return;
+            }
+
+            sqlite3 *next_db = nullptr;
+
+            if (sqlite3_open_v2(path.c_str(), &next_db, 
+                        SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 
+                        NULL) != SQLITE_OK) {
+                _MSG_ERROR("Unable to create the next kismetdb log file '{}': {}; the log will "
+                        "not be rotated", path, sqlite3_errmsg(next_db));
+                sqlite3_close(next_db);
+                return;
+            }
+
+            configure_connection(next_db);
+
+            sqlite3_exec(next_db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+            for (const auto& t : schema) {
+                char *sErrMsg = NULL;
+
+                if (sqlite3_exec(next_db, t.c_str(), NULL, NULL, &sErrMsg) != SQLITE_OK) {
+                    _MSG_ERROR("Unable to create the tables of the next kismetdb log file '{}': {}; "
+                            "the log will not be rotated", path, 
+                            sErrMsg != NULL ? sErrMsg : "unknown error");
+                    sqlite3_free(sErrMsg);
+                    sqlite3_close(next_db);
+                    unlink(path.c_str());
+                    return;
+                }
+            }
+
+            sqlite3_exec(next_db, "COMMIT", NULL, NULL, NULL);
+
+            rotate_next_db = next_db;
+            rotate_next_path = path;
+            rotate_prepared = true;
+        });
+}
+
+void kis_database_logfile::discard_rotation() {
+    if (rotate_prepare_thread.joinable())
+        rotate_prepare_thread.join();
+
+    if (!rotate_prepared.exchange(false))
+        return;
+
+    sqlite3_close(rotate_next_db);
+    rotate_next_db = nullptr;
+
+    unlink(rotate_next_path.c_str());
+}
+
+bool kis_database_logfile::rotation_due() {
+    if (!rotate_prepared || rotate_finishing)
+        return false;
+
+    if (rotate_packets != 0 && rotate_file_packets >= rotate_packets)
+        return true;
+
+    if (rotate_interval != 0 &&
+            std::chrono::steady_clock::now() - rotate_opened >= std::chrono::seconds(rotate_interval))
+        return true;
+
+    if (rotate_size != 0) {
+        uint64_t size = rotate_file_bytes;
+        struct stat st;
+
+        if (stat(ds_dbfile.c_str(), &st) == 0)
+            size += st.st_size;
+
+        if (stat((ds_dbfile + "-wal").c_str(), &st) == 0)
+            size += st.st_size;
+
+        return size >= rotate_size;
+    }
+
+    return false;
+}
+
+bool kis_database_logfile::rotate_log(sqlite3 *& old_db, std::string& old_path,
+        std::shared_ptr<kismetdb_segment_writer>& old_segments) {
+    if (rotate_prepare_thread.joinable())
+        rotate_prepare_thread.join();
+
+    if (!rotate_prepared.exchange(false))
+        return false;
+
+    auto next_db = rotate_next_db;
+    rotate_next_db = nullptr;
+
+    std::shared_ptr<kismetdb_segment_writer> next_segments;
+
+    if (packet_segments != nullptr) {
+        next_segments = std::make_shared<kismetdb_segment_writer>(rotate_next_path, packet_segment_size);
+
+        try {
+            next_segments->open();
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("Unable to open the packet segments of the next kismetdb log file: {}; the "
+                    "log will not be rotated", e.what());
+            sqlite3_close(next_db);
+            unlink(rotate_next_path.c_str());
+            return false;
+        }
+    }
+
+    // Finish the transaction of the current file
+    in_transaction_sync = true;
+
+    if (packet_segments != nullptr)
+        packet_segments->sync();
+
+    sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+
+    in_transaction_sync = false;
+
+    // Carry over what each file needs to be read on its own
+    sqlite3_stmt *attach_stmt = nullptr;
+    const char *pz;
+    std::string sql = "ATTACH DATABASE ? AS previous";
+
+    if (sqlite3_prepare_v2(next_db, sql.c_str(), sql.length(), &attach_stmt, &pz) == SQLITE_OK) {
+        sqlite3_bind_text(attach_stmt, 1, ds_dbfile.c_str(), ds_dbfile.length(), SQLITE_STATIC);
+
+        if (sqlite3_step(attach_stmt) == SQLITE_DONE) {
+            const std::vector<std::string> tables = {"KISMET", "datasources", "packet_dictionaries"};
+
+            for (const auto& t : tables) {
+                char *sErrMsg = NULL;
+                auto copy = fmt::format("INSERT INTO {} SELECT * FROM previous.{}", t, t);
+
+                if (sqlite3_exec(next_db, copy.c_str(), NULL, NULL, &sErrMsg) != SQLITE_OK) {
+                    _MSG_ERROR("Unable to copy the {} table to the next kismetdb log file: {}", t,
+                            sErrMsg != NULL ? sErrMsg : "unknown error");
+                    sqlite3_free(sErrMsg);
+                }
+            }
+
+            sqlite3_exec(next_db, "DETACH DATABASE previous", NULL, NULL, NULL);
+        } else {
+            _MSG_ERROR("Unable to copy the datasources to the next kismetdb log file: {}",
+                    sqlite3_errmsg(next_db));
+        }
+    }
+
+    sqlite3_finalize(attach_stmt);
+
+    old_db = db;
+    old_path = ds_dbfile;
+    old_segments = packet_segments;
+
+    // Cached statements belong to the old connection, which is closed once it's finished
+    ds_stmts.set_db(next_db);
+
+    db = next_db;
+    ds_dbfile = rotate_next_path;
+    packet_segments = next_segments;
+
+    if (readers_enabled)
+        readers.open(ds_dbfile, reader_pool_size);
+
+    if (heatmap != nullptr)
+        heatmap->set_progress(kismetdb_heatmap_source(ds_dbfile), KISMETDB_HEATMAP_PROGRESS_LIVE);
+
+    rotate_number++;
+
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    packet_indexes_built = false;
+
+    rotate_opened = std::chrono::steady_clock::now();
+    rotate_file_packets = 0;
+    rotate_file_bytes = 0;
+
+    kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb rotate_log");
+    manifest.back().active = false;
+    manifest.push_back(kismetdb_manifest_entry{ds_dbfile, 0, 0, 0, true});
+
+    return true;
+}
+
+void kis_database_logfile::finish_rotation(sqlite3 *old_db, const std::string& old_path,
+        std::shared_ptr<kismetdb_segment_writer> old_segments) {
+    // Rotation waits for the previous file to be finished, so this never blocks
+    if (rotate_finish_thread.joinable())
+        rotate_finish_thread.join();
+
+    rotate_finishing = true;
+
+    rotate_finish_thread = std::thread([this, old_db, old_path, old_segments]() {
+            thread_set_process_name("kismetdb finish");
+
+            if (old_segments != nullptr)
+                old_segments->close();
+
+            if (packet_index_mode == "close")
+                index_packets(old_db, old_path);
+
+            sqlite3_exec(old_db, "PRAGMA journal_mode=DELETE", NULL, NULL, NULL);
+            sqlite3_close(old_db);
+
+            rotate_finishing = false;
+        });
+
+    // The checkpoint connection follows the log to the new file
+    stop_checkpoint_runner();
+    start_checkpoint_runner();
+
+    // Every device is logged again, so that each file holds all the devices
+    {
+        kis_lock_guard<kis_mutex> lk(device_log_mutex, "kismetdb finish_rotation");
+        device_log_states.clear();
+    }
+
+    write_manifest();
+
+    {
+        kis_lock_guard<kis_mutex> lk(writer_stats_mutex, "kismetdb finish_rotation");
+        writer_rotations->set(writer_rotations->get() + 1);
+    }
+
+    _MSG_INFO("Continuing the kismetdb log in '{}'", ds_dbfile);
+
+    prepare_rotation();
+}
+
+void kis_database_logfile::start_packet_writer() {
+    if (packet_writer_thread.joinable())
+        return;
+
+    packet_writer_running = true;
+
+    packet_writer_thread = std::thread([this]() {
+            thread_set_process_name("kismetdb writer");
+            packet_writer();
+        });
+}
+
+void kis_database_logfile::stop_packet_writer() {
+    packet_writer_running = false;
+
+    if (!packet_writer_thread.joinable())
+        return;
+
+    // The writer closes the log itself on a failed insert
+    if (packet_writer_thread.get_id() == std::this_thread::get_id())
+        packet_writer_thread.detach();
+    else
+        packet_writer_thread.join();
+}
+
+void kis_database_logfile::commit_transaction() {
+    auto start = std::chrono::steady_clock::now();
+
+    in_transaction_sync = true;
+
+    // Packet bytes have to be on disk before the rows pointing at them
+    if (packet_segments != nullptr)
+        packet_segments->sync();
+
+    sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    in_transaction_sync = false;
+
+    if (packet_segments_expire.exchange(false))
+        expire_packet_segments();
+
+    if (heatmap != nullptr) {
+        try {
+            heatmap->flush();
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("Unable to update the kismetdb heat map: {}", e.what());
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+
+    kis_lock_guard<kis_mutex> lk(writer_stats_mutex, "kismetdb commit_transaction");
+    writer_commits->set(writer_commits->get() + 1);
+    writer_commit_time_rrd->add_sample(elapsed.count(), Globalreg::globalreg->last_tv_sec);
+}
+
+void kis_database_logfile::bind_packet_row(sqlite3_stmt *stmt, int& sql_pos, const packet_row& row) {
+    sqlite3_bind_int64(stmt, sql_pos++, row.ts_sec);
+    sqlite3_bind_int64(stmt, sql_pos++, row.ts_usec);
+
+    sqlite3_bind_text(stmt, sql_pos++, row.phyname.c_str(), row.phyname.length(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, sql_pos++, row.sourcemac.c_str(), row.sourcemac.length(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, sql_pos++, row.destmac.c_str(), row.destmac.length(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, sql_pos++, row.transmac.c_str(), row.transmac.length(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, sql_pos++, row.devkey.c_str(), row.devkey.length(), SQLITE_STATIC);
+    sqlite3_bind_double(stmt, sql_pos++, row.frequency);
+
+    sqlite3_bind_double(stmt, sql_pos++, row.lat);
+    sqlite3_bind_double(stmt, sql_pos++, row.lon);
+    sqlite3_bind_double(stmt, sql_pos++, row.alt);
+    sqlite3_bind_double(stmt, sql_pos++, row.speed);
+    sqlite3_bind_double(stmt, sql_pos++, row.heading);
+
+    sqlite3_bind_int64(stmt, sql_pos++, row.packet_len);
+    sqlite3_bind_int(stmt, sql_pos++, row.signal);
+
+    sqlite3_bind_text(stmt, sql_pos++, row.datasource.c_str(), row.datasource.length(), SQLITE_STATIC);
+
+    sqlite3_bind_int(stmt, sql_pos++, row.dlt);
+
+    if (packet_segments != nullptr)
+        sqlite3_bind_null(stmt, sql_pos++);
+    else
+        sqlite3_bind_blob(stmt, sql_pos++, row.packet.data(), row.packet.length(), SQLITE_STATIC);
+
+    sqlite3_bind_int(stmt, sql_pos++, row.error);
+    sqlite3_bind_text(stmt, sql_pos++, row.tags.c_str(), row.tags.length(), SQLITE_STATIC);
+    sqlite3_bind_double(stmt, sql_pos++, row.datarate);
+    sqlite3_bind_int(stmt, sql_pos++, row.hash);
+    sqlite3_bind_int64(stmt, sql_pos++, row.packetid);
+
+    if (packet_segments != nullptr) {
+        sqlite3_bind_int64(stmt, sql_pos++, row.segment);
+        sqlite3_bind_int64(stmt, sql_pos++, row.segment_offset);
+    } else {
+        sqlite3_bind_null(stmt, sql_pos++);
+        sqlite3_bind_null(stmt, sql_pos++);
+    }
+
+    sqlite3_bind_int(stmt, sql_pos++, row.codec);
+    sqlite3_bind_int64(stmt, sql_pos++, row.codec_dict);
+    sqlite3_bind_int64(stmt, sql_pos++, row.packet.length());
+}
+
+void kis_database_logfile::compress_packet_rows(std::vector<packet_row>& rows, size_t n_rows) {
+    if (packet_compressor == nullptr)
+        return;
+
+    // Collect the first packets of the log to train the dictionary; beacons and other 
+    // repeated frames are what make up most of them
+    if (!packet_compressor->has_dictionary() && packet_dict_samples > 0) {
+        for (size_t i = 0; i < n_rows && packet_dict_training.size() < packet_dict_samples; i++)
+            packet_dict_training.push_back(rows[i].packet.substr(0, 512));
+
+        if (packet_dict_training.size() >= packet_dict_samples) {
+            auto dictionary = kismetdb_train_dictionary(packet_dict_training, packet_dict_size);
+            packet_dict_training.clear();
+            packet_dict_training.shrink_to_fit();
+
+            sqlite3_stmt *dict_stmt = nullptr;
+            const char *pz;
+            std::string sql = "INSERT INTO packet_dictionaries (id, codec, dictionary) VALUES (1, ?, ?)";
+
+            if (sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &dict_stmt, &pz) == SQLITE_OK) {
+                sqlite3_bind_int(dict_stmt, 1, KISMETDB_CODEC_DEFLATE_DICT);
+                sqlite3_bind_blob(dict_stmt, 2, dictionary.data(), dictionary.length(), SQLITE_STATIC);
+
+                if (sqlite3_step(dict_stmt) == SQLITE_DONE)
+                    packet_compressor->set_dictionary(dictionary);
+                else
+                    _MSG_ERROR("kis_database_logfile unable to save packet dictionary in {}: {}",
+                            ds_dbfile, sqlite3_errmsg(db));
+            }
+
+            sqlite3_finalize(dict_stmt);
+
+            // Only try once; without a dictionary packets are compressed on their own
+            packet_dict_samples = 0;
+        }
+    }
+
+    for (size_t i = 0; i < n_rows; i++) {
+        rows[i].codec = packet_compressor->compress(rows[i].packet);
+        rows[i].codec_dict = rows[i].codec == KISMETDB_CODEC_DEFLATE_DICT ? 1 : 0;
+    }
+}
+
+void kis_database_logfile::expire_packet_segments() {
+    if (packet_segments == nullptr)
+        return;
+
+    // Segments before the oldest one still referenced hold only removed packets; with
+    // no packets left, everything before the current segment can go
+    int64_t first_segment = -1;
+
+    sqlite3_exec(db, "SELECT MIN(segment) FROM packets",
+            [] (void *aux, int argc, char **argv, char **) -> int {
+                if (argc > 0 && argv[0] != nullptr)
+                    *((int64_t *) aux) = strtoll(argv[0], nullptr, 10);
+                return 0;
+            }, (void *) &first_segment, NULL);
+
+    if (first_segment < 0)
+        first_segment = UINT32_MAX;
+
+    packet_segments->remove_before(first_segment);
+}
+
+// Rows per multi-row insert; 28 columns per row keeps the statement under the
+// 999 variable limit of older sqlite builds
+#define KISMETDB_PACKET_INSERT_ROWS     32
+
+bool kis_database_logfile::write_packet_rows(sqlite3_stmt *multi_stmt, sqlite3_stmt *single_stmt,
+        std::vector<packet_row>& rows, size_t n_rows) {
+    size_t pos = 0;
+
+    compress_packet_rows(rows, n_rows);
+
+    // Write the packet bytes of the whole batch to the segment in one go
+    if (packet_segments != nullptr) {
+        std::string block;
+        size_t block_len = 0;
+
+        for (size_t i = 0; i < n_rows; i++)
+            block_len += rows[i].packet.length();
+
+        block.reserve(block_len);
+
+        for (size_t i = 0; i < n_rows; i++)
+            block.append(rows[i].packet);
+
+        uint32_t segment;
+        uint64_t offset;
+
+        try {
+            packet_segments->append(block, segment, offset);
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("kis_database_logfile unable to log packets: {}", e.what());
+            return false;
+        }
+
+        rotate_file_bytes += block.length();
+
+        for (size_t i = 0; i < n_rows; i++) {
+            rows[i].segment = segment;
+            rows[i].segment_offset = offset;
+            offset += rows[i].packet.length();
+        }
+    }
+
+    while (pos < n_rows) {
+        auto stmt = single_stmt;
+        size_t n_stmt_rows = 1;
+
+        if (n_rows - pos >= KISMETDB_PACKET_INSERT_ROWS) {
+            stmt = multi_stmt;
+            n_stmt_rows = KISMETDB_PACKET_INSERT_ROWS;
+        }
+
+        int sql_pos = 1;
+
+        for (size_t i = 0; i < n_stmt_rows; i++)
+            bind_packet_row(stmt, sql_pos, rows[pos + i]);
+
+        auto r = sqlite3_step(stmt);
+
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        if (r != SQLITE_DONE) {
+            _MSG_ERROR("kis_database_logfile unable to insert packet in {}: {}", 
+                    ds_dbfile, sqlite3_errmsg(db));
+            return false;
+        }
+
+        pos += n_stmt_rows;
+    }
+
+    // Release the packet data instead of holding the largest batch until reuse
+    for (size_t i = 0; i < n_rows; i++)
+        rows[i] = packet_row{};
+
+    return true;
+}
+
+void kis_database_logfile::packet_writer() {
+    auto prepare_insert = [this](size_t n_rows) -> sqlite3_stmt * {
+        std::string sql =
+            "INSERT INTO packets "
+            "(ts_sec, ts_usec, phyname, "
+            "sourcemac, destmac, transmac, devkey, frequency, " 
+            "lat, lon, alt, speed, heading, "
+            "packet_len, signal, "
+            "datasource, "
+            "dlt, packet, "
+            "error, tags, datarate, hash, packetid, "
+            "segment, segment_offset, codec, codec_dict, stored_len) "
+            "VALUES ";
+
+        for (size_t i = 0; i < n_rows; i++) {
+            if (i != 0)
+                sql += ", ";
+            sql += "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+        }
+
+        sqlite3_stmt *stmt = nullptr;
+        const char *pz;
+
+        if (sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, &pz) != SQLITE_OK) {
+            _MSG_ERROR("kis_database_logfile unable to prepare database insert for packets in {}: {}",
+                    ds_dbfile, sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return nullptr;
+        }
+
+        return stmt;
+    };
+
+    auto multi_stmt = prepare_insert(KISMETDB_PACKET_INSERT_ROWS);
+    auto single_stmt = prepare_insert(1);
+    bool write_failed = multi_stmt == nullptr || single_stmt == nullptr;
+
+    std::vector<packet_row> rows(packet_write_batch);
+    uint64_t rows_written = 0;
+
+    auto last_commit = std::chrono::steady_clock::now();
+
+    while (true) {
+        auto n_rows = 
+            packet_row_queue.wait_dequeue_bulk_timed(rows.begin(), rows.size(), 
+                    std::chrono::milliseconds(250));
+
+        if (n_rows > 0 && !write_failed) {
+            uint64_t first_ts = rows[0].ts_sec;
+            uint64_t last_ts = rows[0].ts_sec;
+
+            for (size_t i = 1; i < n_rows; i++) {
+                first_ts = std::min(first_ts, (uint64_t) rows[i].ts_sec);
+                last_ts = std::max(last_ts, (uint64_t) rows[i].ts_sec);
+            }
+
+            if (!write_packet_rows(multi_stmt, single_stmt, rows, n_rows)) {
+                write_failed = true;
+            } else {
+                rows_written += n_rows;
+                rotate_file_packets += n_rows;
+
+                if (rotation_enabled()) {
+                    kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb packet_writer");
+                    auto& m = manifest.back();
+
+                    if (m.packets == 0 || first_ts < m.first_ts)
+                        m.first_ts = first_ts;
+                    m.last_ts = std::max(m.last_ts, last_ts);
+                    m.packets += n_rows;
+                }
+            }
+        }
+
+        auto backlog = packet_row_queue.size_approx();
+
+        // Stretch the commit interval towards the maximum as the backlog grows
+        auto interval = packet_commit_interval + 
+            (packet_commit_max_interval - packet_commit_interval) * 
+            std::min(backlog, packet_write_backlog) / packet_write_backlog;
+
+        {
+            kis_lock_guard<kis_mutex> lk(writer_stats_mutex, "kismetdb packet_writer");
+            writer_rows_queued->set(packet_rows_queued);
+            writer_rows_written->set(rows_written);
+            writer_commit_interval->set(interval);
+            if (n_rows > 0)
+                writer_rows_rrd->add_sample(n_rows, Globalreg::globalreg->last_tv_sec);
+            writer_backlog_rrd->add_sample(backlog, Globalreg::globalreg->last_tv_sec);
+        }
+
+        if (write_failed)
+            break;
+
+        if (!packet_writer_running && n_rows == 0)
+            break;
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - last_commit >= std::chrono::seconds(interval)) {
+            commit_transaction();
+            last_commit = now;
+        }
+
+        // Swap in the next file of a rolling log; when the connection is busy with a 
+        // query the rotation waits for the next pass instead of the writer waiting
+        if (rotation_due()) {
+            sqlite3 *old_db = nullptr;
+            std::string old_path;
+            std::shared_ptr<kismetdb_segment_writer> old_segments;
+            bool rotated = false;
+
+            {
+                std::unique_lock<kis_shared_mutex> rl(rotate_mutex, std::try_to_lock);
+
+                if (rl.owns_lock()) {
+                    sqlite3_finalize(multi_stmt);
+                    sqlite3_finalize(single_stmt);
+
+                    rotated = rotate_log(old_db, old_path, old_segments);
+
+                    multi_stmt = prepare_insert(KISMETDB_PACKET_INSERT_ROWS);
+                    single_stmt = prepare_insert(1);
+                    write_failed = multi_stmt == nullptr || single_stmt == nullptr;
+                }
+            }
+
+            if (rotated) {
+                finish_rotation(old_db, old_path, old_segments);
+                last_commit = now;
+            }
+
+            if (write_failed)
+                break;
+        }
+    }
+
+    sqlite3_finalize(multi_stmt);
+    sqlite3_finalize(single_stmt);
+
+    if (write_failed && packet_writer_running)
+        close_log();
+}
+
+int kis_database_logfile::log_data(std::shared_ptr<kis_gps_packinfo> gps, struct timeval tv, 
+        std::string phystring, mac_addr devmac, uuid datasource_uuid, 
+        std::string type, std::string json) {
+
+    if (!db_enabled)
+        return 0;
+
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
+    std::string macstring = devmac.mac_to_string();
+    std::string uuidstring = datasource_uuid.uuid_to_string();
+
+    int r;
+    std::string sql;
+    sqlite3_stmt *data_stmt;
+    const char *data_pz;
+
+    sql =
+        "INSERT INTO data "
+        "(ts_sec, ts_usec, "
+        "phyname, devmac, "
+        "lat, lon, alt, speed, heading, "
+        "datasource, "
+        "type, json) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &data_stmt, &data_pz);
+
+    if (r != SQLITE_OK) {
+        _MSG("kis_database_logfile unable to prepare database insert for data in " +
+                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+        close_log();
+        return -1;
+    }
+
+    sqlite3_reset(data_stmt);
+    sqlite3_clear_bindings(data_stmt);
+
+    int sql_pos = 1;
+
+    sqlite3_bind_int64(data_stmt, sql_pos++, tv.tv_sec);
+    sqlite3_bind_int64(data_stmt, sql_pos++, tv.tv_usec);
+
+    sqlite3_bind_text(data_stmt, sql_pos++, phystring.c_str(), phystring.length(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(data_stmt, sql_pos++, macstring.c_str(), macstring.length(), SQLITE_TRANSIENT);
+
+    if (gps != NULL) {
+        sqlite3_bind_double(data_stmt, sql_pos++, gps->lat);
         sqlite3_bind_double(data_stmt, sql_pos++, gps->lon);
         sqlite3_bind_double(data_stmt, sql_pos++, gps->alt);
         sqlite3_bind_double(data_stmt, sql_pos++, gps->speed);
@@ -1186,6 +2433,8 @@ int kis_database_logfile::log_datasource(shared_tracker_element in_datasource) {
     if (!db_enabled)
         return 0;
 
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
     std::shared_ptr<kis_datasource> ds =
         std::static_pointer_cast<kis_datasource>(in_datasource);
 
@@ -1252,6 +2501,8 @@ int kis_database_logfile::log_alert(std::shared_ptr<tracked_alert> in_alert) {
     if (!db_enabled)
         return 0;
 
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
     std::string macstring = in_alert->get_transmitter_mac().mac_to_string();
     std::string phystring = devicetracker->fetch_phy_name(in_alert->get_phy());
     std::string headerstring = in_alert->get_header();
@@ -1328,6 +2579,8 @@ int kis_database_logfile::log_snapshot(std::shared_ptr<kis_gps_packinfo> gps, st
     if (!db_enabled)
         return 0;
 
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
     int r;
     std::string sql;
     sqlite3_stmt *snapshot_stmt;
@@ -1396,18 +2649,67 @@ void kis_database_logfile::usage(const char *argv0) {
 }
 
 
+void kis_database_logfile::build_packet_indexes() {
+    if (packet_indexes_built.exchange(true))
+        return;
+
+    index_packets(db, ds_dbfile);
+}
+
+bool kis_database_logfile::index_packets(sqlite3 *target, const std::string& path) {
+    // Time ranges, optionally of one datasource or source address, are what the pcap
+    // API and log tools extract
+    const std::vector<std::string> indexes = {
+        "CREATE INDEX IF NOT EXISTS packets_ts_idx ON packets (ts_sec, ts_usec)",
+        "CREATE INDEX IF NOT EXISTS packets_datasource_ts_idx ON packets (datasource, ts_sec)",
+        "CREATE INDEX IF NOT EXISTS packets_sourcemac_ts_idx ON packets (sourcemac, ts_sec)",
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto& i : indexes) {
+        char *sErrMsg = NULL;
+
+        if (sqlite3_exec(target, i.c_str(), NULL, NULL, &sErrMsg) != SQLITE_OK) {
+            _MSG_ERROR("Unable to index packets in kismetdb log {}: {}", path, 
+                    sErrMsg != NULL ? sErrMsg : "unknown error");
+            sqlite3_free(sErrMsg);
+            return false;
+        }
+    }
+
+    sqlite3_exec(target, "ANALYZE packets", NULL, NULL, NULL);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+
+    _MSG_INFO("Indexed packets in kismetdb log {} in {}ms", path, elapsed.count());
+
+    return true;
+}
+
 void kis_database_logfile::pcapng_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
 	using namespace kissqlite3;
 
-	auto query = _SELECT(db, "packets", {"ts_sec", "ts_usec", "datasource", "dlt", "packet"});
+	const std::list<std::string> fields = {"ts_sec", "ts_usec", "datasource", "dlt", "packet",
+			"segment", "segment_offset", "stored_len", "codec", "codec_dict", "packet_len"};
+
+	// The filters are collected once and applied to each file of a rolling log
+	auto query = _SELECT(nullptr, "packets", fields);
+
+	uint64_t ts_start = 0, ts_end = 0;
 
 	auto ts_start_k = con->http_variables().find("timestamp_start");
-	if (ts_start_k != con->http_variables().end()) 
-		query.append_where(AND, _WHERE("ts_sec", GE, string_to_n<uint64_t>(ts_start_k->second)));
+	if (ts_start_k != con->http_variables().end()) {
+		ts_start = string_to_n<uint64_t>(ts_start_k->second);
+		query.append_where(AND, _WHERE("ts_sec", GE, ts_start));
+	}
 
 	auto ts_end_k = con->http_variables().find("timestamp_end");
-	if (ts_end_k != con->http_variables().end()) 
-		query.append_where(AND, _WHERE("ts_sec", LE, string_to_n<uint64_t>(ts_end_k->second)));
+	if (ts_end_k != con->http_variables().end()) {
+		ts_end = string_to_n<uint64_t>(ts_end_k->second);
+		query.append_where(AND, _WHERE("ts_sec", LE, ts_end));
+	}
 
 	auto datasource_k = con->http_variables().find("datasource");
 	if (datasource_k != con->http_variables().end()) 
@@ -1481,18 +2783,30 @@ void kis_database_logfile::pcapng_endp_handler(std::shared_ptr<kis_net_beast_htt
 	if (tag_k != con->http_variables().end())
 		query.append_where(AND, _WHERE("tags", LIKE, tag_k->second));
 
+	unsigned long limit = 0;
+
 	auto limit_k = con->http_variables().find("limit");
 	if (limit_k != con->http_variables().end()) 
-		query.append_clause(LIMIT, string_to_n<unsigned long>(limit_k->second));
+		limit = string_to_n<unsigned long>(limit_k->second);
 
 	con->clear_timeout();
 
-	auto pcapng = std::make_shared<pcapng_stream_database>(con->response_stream());
+	auto pcapng = 
+		std::make_shared<pcapng_stream_database>(con->response_stream(), pcap_stream_backlog);
 
 	con->set_target_file(fmt::format("{}.pcapng", con->uri_params()[":title"]));
-	con->set_closure_cb([pcapng]() { pcapng->stop_stream("http connection lost"); });
 
-	auto streamtracker = Globalreg::fetch_mandatory_global_as<stream_tracker>();
+	// Queries are cancelled once the client is gone
+	auto connected = std::make_shared<std::atomic<bool>>(true);
+
+	con->set_closure_cb([pcapng, connected]() {
+			*connected = false;
+			pcapng->stop_stream("http connection lost");
+		});
+
+	auto still_connected = [connected]() -> bool { return *connected; };
+
+	auto streamtracker = Globalreg::fetch_mandatory_global_handle<stream_tracker>();
 	auto sid = 
 		streamtracker->register_streamer(pcapng, fmt::format("kismet-dblog.pcapng"),
 				"pcapng", "httpd", 
@@ -1501,27 +2815,165 @@ void kis_database_logfile::pcapng_endp_handler(std::shared_ptr<kis_net_beast_htt
 
 	pcapng->start_stream();
 
-	// Get the list of all the interfaces we know about in the database and push them into the
-	// pcapng handler
-	auto datasource_query = _SELECT(db, "datasources", {"uuid", "name", "interface"});
+	unsigned long n_packets = 0;
+	bool streaming = true;
+
+	auto stream_log = [&](sqlite3 *log_db, const std::string& log_path) {
+		std::list<query_element> tail;
+
+		if (limit != 0)
+			tail.push_back(query_element{LIMIT, (int) (limit - n_packets)});
+
+		kissqlite3::query log_query(log_db, "packets", fields, query.where_clause, tail);
+
+		// Get the list of all the interfaces we know about in the database and push them into the
+		// pcapng handler
+		auto datasource_query = _SELECT(log_db, "datasources", {"uuid", "name", "interface"});
+
+		for (auto ds : datasource_query)  {
+			pcapng->add_database_interface(sqlite3_column_as<std::string>(ds, 0),
+					sqlite3_column_as<std::string>(ds, 1),
+					sqlite3_column_as<std::string>(ds, 2));
+		}
+
+		// Packets logged to segments are read from the mapped segment files
+		kismetdb_segment_reader segment_reader(log_path);
+
+		kismetdb_packet_decompressor decompressor;
+
+		auto dict_query = _SELECT(log_db, "packet_dictionaries", {"id", "dictionary"});
+		for (auto d : dict_query)
+			decompressor.add_dictionary(sqlite3_column_as<unsigned int>(d, 0),
+					sqlite3_column_as<std::string>(d, 1));
+
+		// Database handler registers itself as timing out so this should be OK to just blitz through
+		// now, we'll block as necessary
+		for (auto p : log_query) {
+			std::string packet;
+
+			try {
+				if (sqlite3_column_type(p.get(), 5) != SQLITE_NULL)
+					packet = segment_reader.read(sqlite3_column_as<unsigned int>(p, 5),
+							sqlite3_column_as<std::uint64_t>(p, 6),
+							sqlite3_column_as<std::uint64_t>(p, 7));
+				else
+					packet = sqlite3_column_as<std::string>(p, 4);
+
+				auto codec = sqlite3_column_as<int>(p, 8);
+
+				if (codec != KISMETDB_CODEC_RAW)
+					packet = decompressor.decompress(codec, sqlite3_column_as<unsigned int>(p, 9),
+							packet, sqlite3_column_as<std::uint64_t>(p, 10));
+			} catch (const std::runtime_error& e) {
+				_MSG_ERROR("Unable to read logged packet for pcapng stream: {}", e.what());
+				streaming = false;
+				break;
+			}
+
+			if (pcapng->pcapng_write_database_packet(
+						sqlite3_column_as<std::uint64_t>(p, 0),
+						sqlite3_column_as<std::uint64_t>(p, 1),
+						sqlite3_column_as<std::string>(p, 2),
+						sqlite3_column_as<unsigned int>(p, 3),
+						packet) < 0) {
+				streaming = false;
+				break;
+			}
+
+			n_packets++;
+		}
+
+		if (limit != 0 && n_packets >= limit)
+			streaming = false;
+	};
+
+	// Finished files of a rolling log are read through their own connections, skipping
+	// the files with no packets in the requested time
+	std::vector<kismetdb_manifest_entry> log_files;
+
+	{
+		kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb pcapng_endp_handler");
+		log_files = manifest;
+	}
+
+	for (const auto& f : log_files) {
+		if (!streaming)
+			break;
+
+		if (f.active || f.packets == 0)
+			continue;
+
+		if ((ts_start != 0 && f.last_ts < ts_start) || (ts_end != 0 && f.first_ts > ts_end))
+			continue;
+
+		sqlite3 *log_db = nullptr;
+
+		if (sqlite3_open_v2(f.file.c_str(), &log_db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+			_MSG_ERROR("Unable to open kismetdb log file '{}' for pcapng stream: {}", f.file,
+					sqlite3_errmsg(log_db));
+			sqlite3_close(log_db);
+			continue;
+		}
+
+		// The file may still be being indexed
+		sqlite3_busy_timeout(log_db, 5000);
 
-	for (auto ds : datasource_query)  {
-		pcapng->add_database_interface(sqlite3_column_as<std::string>(ds, 0),
-				sqlite3_column_as<std::string>(ds, 1),
-				sqlite3_column_as<std::string>(ds, 2));
+		try {
+			kismetdb_query_watch watch(log_db, pcap_query_timeout * 1000, still_connected);
+
+			stream_log(log_db, f.file);
+
+			if (watch.timed_out()) {
+				_MSG_ERROR("kismetdb pcapng stream '{}' timed out reading '{}'", con->uri(), f.file);
+				streaming = false;
+			}
+		} catch (const std::runtime_error& e) {
+			_MSG_ERROR("Unable to query kismetdb log file '{}' for pcapng stream: {}", f.file, e.what());
+		}
+
+		sqlite3_close(log_db);
 	}
 
-	// Database handler registers itself as timing out so this should be OK to just blitz through
-	// now, we'll block as necessary
-	for (auto p : query) {
-		if (pcapng->pcapng_write_database_packet(
-					sqlite3_column_as<std::uint64_t>(p, 0),
-					sqlite3_column_as<std::uint64_t>(p, 1),
-					sqlite3_column_as<std::string>(p, 2),
-					sqlite3_column_as<unsigned int>(p, 3),
-					sqlite3_column_as<std::string>(p, 4)) < 0) {
-			return;
+	if (streaming) {
+		std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
+		if (packet_index_mode == "query")
+			build_packet_indexes();
+
+		// Read the live file through a connection of our own; without one (an ephemeral
+		// log) the query shares the connection of the writer
+		std::shared_ptr<sqlite3> reader;
+
+		if (readers_enabled)
+			reader = readers.acquire();
+
+		sqlite3 *log_db = reader != nullptr ? reader.get() : db;
+
+		if (pcap_explain && query.where_clause.size() > 0) {
+			try {
+				kissqlite3::query log_query(log_db, "packets", fields, query.where_clause, {});
+
+				for (const auto& step : log_query.explain()) {
+					if (step.find("SCAN") == 0 && step.find("packets") != std::string::npos) {
+						_MSG_INFO("kismetdb pcap query '{}' reads the whole packets table ({}); long logs "
+								"may be slow to extract until the packets are indexed, see "
+								"kis_log_packet_indexes.", con->uri(), step);
+						break;
+					}
+				}
+			} catch (const std::runtime_error& e) {
+				_MSG_ERROR("Unable to check the kismetdb pcap query plan: {}", e.what());
+			}
 		}
+
+		// The watch belongs on a reader; the writer connection is shared with the writer
+		kismetdb_query_watch watch(reader.get(), pcap_query_timeout * 1000, still_connected);
+
+		stream_log(log_db, ds_dbfile);
+
+		if (watch.timed_out())
+			_MSG_ERROR("kismetdb pcapng stream '{}' timed out after {} seconds", con->uri(),
+					pcap_query_timeout);
 	}
 
 	streamtracker->remove_streamer(sid);
@@ -1538,12 +2990,62 @@ void kis_database_logfile::packet_drop_endpoint_handler(std::shared_ptr<kis_net_
         return;
     }
 
-        auto drop_query = 
-            _DELETE(db, "packets", _WHERE("ts_sec", LE, con->json()["drop_before"].get<uint64_t>()));
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
+    // Removing packets is a write, so it stays on the connection of the writer
+    auto drop_query = 
+        _DELETE(db, "packets", _WHERE("ts_sec", LE, con->json()["drop_before"].get<uint64_t>()));
+    drop_query.begin();
+
+    packet_segments_expire = true;
 
     ostream << "Packets removed\n";
 }
 
+void kis_database_logfile::heatmap_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con,
+        const std::string& devmac) {
+    std::ostream ostream(&con->response_stream());
+
+    auto hm = heatmap;
+
+    if (hm == nullptr) {
+        con->set_status(404);
+        ostream << "kismetdb heat map not enabled\n";
+        return;
+    }
+
+    auto zoom = string_to_n<unsigned int>(con->uri_params()[":zoom"]);
+    auto x = string_to_n<unsigned int>(con->uri_params()[":x"]);
+    auto y = string_to_n<unsigned int>(con->uri_params()[":y"]);
+
+    auto cells = hm->tile(devmac, zoom, x, y);
+
+    // Cells are sent as rows of the listed fields to keep dense tiles small; the signal
+    // fields are null in cells without any signal
+    auto rows = nlohmann::json::array();
+
+    for (const auto& c : cells) {
+        if (c.signal_count != 0)
+            rows.push_back({c.cell, c.count, c.signal_count,
+                    (double) c.signal_sum / c.signal_count, c.signal_max});
+        else
+            rows.push_back({c.cell, c.count, 0, nullptr, nullptr});
+    }
+
+    nlohmann::json tile = {
+        {"zoom", zoom},
+        {"x", x},
+        {"y", y},
+        {"min_zoom", hm->get_min_zoom()},
+        {"max_zoom", hm->get_max_zoom()},
+        {"tile_cells", KISMETDB_HEATMAP_TILE_CELLS},
+        {"fields", {"cell", "count", "signal_count", "signal_avg", "signal_max"}},
+        {"cells", rows},
+    };
+
+    ostream << tile.dump();
+}
+
 void kis_database_logfile::make_poi_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
     std::ostream ostream(&con->response_stream());
 
@@ -1571,14 +3073,103 @@ void kis_database_logfile::make_poi_endp_handler(std::shared_ptr<kis_net_beast_h
 
 std::shared_ptr<tracker_element> 
 kis_database_logfile::list_poi_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
-    return std::make_shared<tracker_element_vector>();
+    using namespace kissqlite3;
+
+    auto ret = std::make_shared<tracker_element_vector>();
+
+    auto list_log = [this, &ret](sqlite3 *log_db, bool watched) {
+        kismetdb_query_watch watch(watched ? log_db : nullptr, reader_query_timeout * 1000, nullptr);
+
+        auto poi_query = _SELECT(log_db, "snapshots", {"ts_sec", "ts_usec", "lat", "lon", "json"},
+                _WHERE("snaptype", EQ, "POI"));
+
+        for (auto p : poi_query) {
+            auto poi = std::make_shared<tracker_element_string_map>();
+
+            poi->insert("kismet.poi.ts_sec", 
+                    std::make_shared<tracker_element_uint64>(0, sqlite3_column_as<std::uint64_t>(p, 0)));
+            poi->insert("kismet.poi.ts_usec", 
+                    std::make_shared<tracker_element_uint64>(0, sqlite3_column_as<std::uint64_t>(p, 1)));
+            poi->insert("kismet.poi.lat", 
+                    std::make_shared<tracker_element_double>(0, sqlite3_column_as<double>(p, 2)));
+            poi->insert("kismet.poi.lon", 
+                    std::make_shared<tracker_element_double>(0, sqlite3_column_as<double>(p, 3)));
+
+            std::string note;
+
+            try {
+                auto json = nlohmann::json::parse(sqlite3_column_as<std::string>(p, 4));
+                note = json.value("note", "");
+            } catch (const std::exception& e) {
+
+            }
+
+            poi->insert("kismet.poi.note", std::make_shared<tracker_element_string>(0, note));
+
+            ret->push_back(poi);
+        }
+
+        if (watch.timed_out())
+            throw std::runtime_error(fmt::format("query timed out after {} seconds",
+                        reader_query_timeout));
+    };
+
+    if (!db_enabled)
+        return ret;
+
+    // Points of interest from the finished files of a rolling log come first
+    std::vector<kismetdb_manifest_entry> log_files;
+
+    {
+        kis_lock_guard<kis_mutex> lk(manifest_mutex, "kismetdb list_poi_endp_handler");
+        log_files = manifest;
+    }
+
+    for (const auto& f : log_files) {
+        if (f.active)
+            continue;
+
+        sqlite3 *log_db = nullptr;
+
+        if (sqlite3_open_v2(f.file.c_str(), &log_db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+            _MSG_ERROR("Unable to open kismetdb log file '{}' for points of interest: {}", f.file,
+                    sqlite3_errmsg(log_db));
+            sqlite3_close(log_db);
+            continue;
+        }
+
+        sqlite3_busy_timeout(log_db, 5000);
+
+        try {
+            list_log(log_db, true);
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("Unable to query kismetdb log file '{}' for points of interest: {}", f.file,
+                    e.what());
+        }
+
+        sqlite3_close(log_db);
+    }
+
+    std::shared_lock<kis_shared_mutex> rl(rotate_mutex);
+
+    std::shared_ptr<sqlite3> reader;
+
+    if (readers_enabled)
+        reader = readers.acquire();
+
+    if (reader != nullptr)
+        list_log(reader.get(), true);
+    else
+        list_log(db, false);
+
+    return ret;
 }
 
-pcapng_stream_database::pcapng_stream_database(future_chainbuf& buffer) :
+pcapng_stream_database::pcapng_stream_database(future_chainbuf& buffer, size_t backlog) :
     pcapng_stream_futurebuf(buffer, 
             nullptr, 
             nullptr,
-            1024*512,
+            backlog,
             true),
     next_pcap_intf_id{0} {
 
@@ -38,8 +38,14 @@
 #include "config.h"
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
@@ -53,10 +59,17 @@
 #include "class_filter.h"
 #include "packet_filter.h"
 #include "messagebus.h"
+#include "trackedrrd.h"
+#include "kismetdb_codec.h"
+#include "kismetdb_heatmap.h"
+#include "kismetdb_manifest.h"
+#include "kismetdb_readers.h"
+#include "kismetdb_segments.h"
+#include "moodycamel/blockingconcurrentqueue.h"
 
 // Kismetdb version
 
-#define KISMETDB_LOG_VERSION        8
+#define KISMETDB_LOG_VERSION        10
 
 // This is a bit of a unique case - because so many things plug into this, it has
 // to exist as a global record; we build it like we do any other global record;
@@ -100,6 +113,47 @@ public:
     // Log a vector of multiple devices, replacing any old device records
     virtual int log_device(std::shared_ptr<kis_tracked_device_base> in_device);
 
+    // Contents of a devices table row, built while the device is locked so that the
+    // database write can happen after the device locks are released
+    struct device_record {
+        time_t first_time;
+        time_t last_time;
+        std::string key;
+        std::string phyname;
+        std::string macaddr;
+        int strongest_signal;
+        double min_lat, min_lon, max_lat, max_lon, avg_lat, avg_lon;
+        uint64_t datasize;
+        std::string type;
+        std::string json;
+
+        // Copy of the device taken by prepare_device_record, until it is serialized
+        shared_tracker_element snapshot;
+    };
+
+    // Has the device changed enough since it was last logged to be logged again; a 
+    // device is logged once it has been updated kis_log_device_generations times, or
+    // has had any update and hasn't been logged for kis_log_device_max_interval seconds.
+    // Forcing logs any device with an update.  Must be called under the devicelist lock
+    bool device_needs_log(std::shared_ptr<kis_tracked_device_base> in_device, bool force);
+
+    // Build the record of a device; must be called under the devicelist lock.  Returns
+    // false if the device is filtered or can't be serialized
+    bool build_device_record(std::shared_ptr<kis_tracked_device_base> in_device, 
+            device_record& record);
+
+    // Build the record of a device in two steps, so that the devicelist is only locked 
+    // while the record is prepared: preparing fills in the columns and takes a snapshot
+    // of the device, and must be called under the devicelist lock; serializing the 
+    // snapshot into the record json doesn't touch the device, and can be called after 
+    // the lock is released.  Both return false if the record can't be logged
+    bool prepare_device_record(std::shared_ptr<kis_tracked_device_base> in_device,
+            device_record& record);
+    bool serialize_device_record(device_record& record);
+
+    // Write a batch of device records with a single prepared statement
+    virtual int log_device_records(const std::vector<device_record>& records);
+
     // Device logs are non-streaming; we need to know the last time we generated
     // device logs so that we can update just the logs we need.
     virtual time_t get_last_device_log_ts() { return last_device_log; }
@@ -107,6 +161,39 @@ public:
     // Log a packet
     virtual int log_packet(std::shared_ptr<kis_packet> in_packet);
 
+    // Contents of a packets table row, extracted on the packet logging thread so that
+    // the writer thread never touches the packet
+    struct packet_row {
+        int64_t ts_sec;
+        int64_t ts_usec;
+        std::string phyname;
+        std::string sourcemac;
+        std::string destmac;
+        std::string transmac;
+        std::string devkey;
+        double frequency;
+        double lat, lon, alt, speed, heading;
+        int signal;
+        std::string datasource;
+        int dlt;
+        std::string packet;
+        int error;
+        std::string tags;
+        double datarate;
+        unsigned int hash;
+        int64_t packetid;
+
+        // Original length of the packet, which may be compressed by the writer
+        int64_t packet_len;
+        int codec;
+        uint32_t codec_dict;
+
+        // Location of the packet bytes, filled in by the writer when packets are
+        // logged to segment files
+        uint32_t segment;
+        uint64_t segment_offset;
+    };
+
     // Log data that isn't a packet; this is a slightly more clunky API because we 
     // can't derive the data from the simple packet interface.  GPS may be null,
     // and other attributes may be empty, if that data is not available
@@ -179,7 +266,189 @@ protected:
     // Keep track of our commit cycles; to avoid thrashing the filesystem with
     // commit state we run a 10 second tranasction commit loop
     kis_mutex transaction_mutex;
-    int transaction_timer;
+
+    // Packet rows are written by a single writer thread, which inserts them in batches
+    // and owns the transaction commit; the commit interval stretches while the writer
+    // is behind, so a slow disk spends its time on inserts instead of syncs
+    moodycamel::BlockingConcurrentQueue<packet_row> packet_row_queue;
+    std::thread packet_writer_thread;
+    std::atomic<bool> packet_writer_running;
+    std::atomic<uint64_t> packet_rows_queued;
+
+    size_t packet_write_batch;
+    size_t packet_write_backlog;
+    unsigned int packet_commit_interval;
+    unsigned int packet_commit_max_interval;
+
+    void packet_writer();
+    bool write_packet_rows(sqlite3_stmt *multi_stmt, sqlite3_stmt *single_stmt,
+            std::vector<packet_row>& rows, size_t n_rows);
+    void bind_packet_row(sqlite3_stmt *stmt, int& sql_pos, const packet_row& row);
+    void commit_transaction();
+
+    void start_packet_writer();
+    void stop_packet_writer();
+
+    // Packet query indexes (kis_log_packet_indexes) are built when the log is closed,
+    // or the first time packets are queried, so they don't slow down logging
+    std::string packet_index_mode;
+    std::atomic<bool> packet_indexes_built;
+    void build_packet_indexes();
+    bool index_packets(sqlite3 *target, const std::string& path);
+
+    // Warn about pcap queries which scan the whole packets table
+    bool pcap_explain;
+
+    // Response data buffered for a pcap download before the query waits for the client
+    size_t pcap_stream_backlog;
+
+    // Queries from the REST API read the log through their own read-only connections
+    // (kis_log_db_readers), so they never hold the connection of the writer; see
+    // kismetdb_readers.h.  Timeouts are in seconds, 0 for none
+    kismetdb_reader_pool readers;
+    bool readers_enabled;
+    size_t reader_pool_size;
+    unsigned int reader_query_timeout;
+    unsigned int pcap_query_timeout;
+
+    // Device logging state, used to skip devices which haven't changed enough since
+    // they were last logged
+    struct device_log_state {
+        uint64_t generation;
+        time_t logged;
+    };
+
+    kis_mutex device_log_mutex;
+    std::unordered_map<device_key, device_log_state> device_log_states;
+    unsigned int device_log_generations;
+    unsigned int device_log_max_interval;
+
+    // Serializer for the device blobs, json or msgpack
+    std::string device_log_format;
+
+    // Packet bytes can be kept in append-only segment files instead of the packets
+    // table (kis_log_packet_segments), see kismetdb_segments.h
+    bool packet_segments_enabled;
+    uint64_t packet_segment_size;
+    std::shared_ptr<kismetdb_segment_writer> packet_segments;
+
+    // Set when packets have been removed, so the writer drops segments which no longer
+    // hold any logged packets after the next commit
+    std::atomic<bool> packet_segments_expire;
+    void expire_packet_segments();
+
+    // Signal heat map tiles of the log (kis_log_heatmap), built as packets are logged
+    // and flushed on every commit; see kismetdb_heatmap.h
+    std::shared_ptr<kismetdb_heatmap> heatmap;
+    void heatmap_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con,
+            const std::string& devmac);
+
+    // Packet content compression (kis_log_packet_compression), see kismetdb_codec.h.
+    // The dictionary is trained from the first packets the writer sees
+    std::shared_ptr<kismetdb_packet_compressor> packet_compressor;
+    size_t packet_dict_samples;
+    size_t packet_dict_size;
+    std::vector<std::string> packet_dict_training;
+
+    void compress_packet_rows(std::vector<packet_row>& rows, size_t n_rows);
+
+    // SQLite IO settings, picked by a named profile (kis_log_db_profile) and overridable
+    // one at a time
+    struct db_profile {
+        std::string journal_mode;
+        // Empty to leave at the sqlite default
+        std::string synchronous;
+        // 0 to leave at the sqlite default
+        unsigned int page_size;
+        // Pragma cache_size value; negative is in KiB, 0 leaves the default
+        int cache_size;
+        unsigned long mmap_size;
+        // Seconds between WAL checkpoints; 0 leaves checkpoints to sqlite
+        unsigned int checkpoint_interval;
+    };
+
+    db_profile io_profile;
+
+    bool load_db_profile();
+    virtual void database_configure_connection() override;
+    void configure_connection(sqlite3 *target);
+
+    // Rolling logs (kis_log_rotate_*) are continued in a new file once the current file
+    // is too large, too old, or holds too many packets; see kismetdb_manifest.h.  The
+    // next file is created in the background, swapped in by the writer between
+    // transactions, and the finished file is indexed and closed in the background
+    uint64_t rotate_size;
+    unsigned int rotate_interval;
+    uint64_t rotate_packets;
+
+    // Held shared by everything which uses the database connection, and exclusively by
+    // the writer while it swaps files.  The writer only tries the lock, so a long pcap
+    // download delays the rotation instead of stalling the writer
+    kis_shared_mutex rotate_mutex;
+
+    std::string rotate_base_path;
+    unsigned int rotate_number;
+
+    std::thread rotate_prepare_thread;
+    std::atomic<bool> rotate_prepared;
+    sqlite3 *rotate_next_db;
+    std::string rotate_next_path;
+
+    std::thread rotate_finish_thread;
+    std::atomic<bool> rotate_finishing;
+
+    // Contents of the current file, kept by the writer; the bytes are those written to
+    // packet segments, which aren't part of the database file size
+    std::chrono::steady_clock::time_point rotate_opened;
+    uint64_t rotate_file_packets;
+    uint64_t rotate_file_bytes;
+
+    kis_mutex manifest_mutex;
+    std::string manifest_path;
+    std::vector<kismetdb_manifest_entry> manifest;
+
+    bool rotation_enabled() {
+        return rotate_size != 0 || rotate_interval != 0 || rotate_packets != 0;
+    }
+
+    void prepare_rotation();
+    void discard_rotation();
+    bool rotation_due();
+    bool rotate_log(sqlite3 *& old_db, std::string& old_path,
+            std::shared_ptr<kismetdb_segment_writer>& old_segments);
+    void finish_rotation(sqlite3 *old_db, const std::string& old_path,
+            std::shared_ptr<kismetdb_segment_writer> old_segments);
+    void write_manifest();
+
+    // WAL checkpoints run on a second connection from their own thread, so they
+    // overlap packet inserts instead of stalling the commit that crossed the WAL limit
+    std::thread checkpoint_thread;
+    std::mutex checkpoint_mutex;
+    std::condition_variable checkpoint_cv;
+    bool checkpoint_running;
+
+    void start_checkpoint_runner();
+    void stop_checkpoint_runner();
+    void checkpoint_runner();
+
+    kis_mutex checkpoint_stats_mutex;
+    std::shared_ptr<tracker_element_map> checkpoint_stats_map;
+    std::shared_ptr<tracker_element_uint64> checkpoint_count;
+    std::shared_ptr<tracker_element_uint64> checkpoint_busy;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> checkpoint_time_rrd;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> checkpoint_wal_rrd;
+
+    // Packet writer stats
+    kis_mutex writer_stats_mutex;
+    std::shared_ptr<tracker_element_map> writer_stats_map;
+    std::shared_ptr<tracker_element_uint64> writer_rows_queued;
+    std::shared_ptr<tracker_element_uint64> writer_rows_written;
+    std::shared_ptr<tracker_element_uint64> writer_commits;
+    std::shared_ptr<tracker_element_uint32> writer_commit_interval;
+    std::shared_ptr<kis_tracked_rrd<>> writer_rows_rrd;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> writer_backlog_rrd;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> writer_commit_time_rrd;
+    std::shared_ptr<tracker_element_uint64> writer_rotations;
 
     // Packet time limit
     unsigned int packet_timeout;
@@ -219,6 +488,7 @@ protected:
 
     // Eventbus listeners
     std::shared_ptr<event_bus> eventbus;
+    std::shared_ptr<packet_chain> packetchain;
     void handle_message(std::shared_ptr<tracked_message> msg);
     unsigned long message_evt_id;
 
@@ -277,7 +547,7 @@ public:
 
 class pcapng_stream_database : public pcapng_stream_futurebuf {
 public:
-    pcapng_stream_database(future_chainbuf& buffer);
+    pcapng_stream_database(future_chainbuf& buffer, size_t backlog = 1024*512);
 
     virtual ~pcapng_stream_database();
 
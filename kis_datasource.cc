@@ -26,8 +26,20 @@
 #include "alertracker.h"
 #include "packetchain.h"
 #include "timetracker.h"
+#include "kis_external_compress.h"
+#include "kis_external_shm.h"
+#include "kis_spectrum.h"
 #include <future>
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#ifdef HAVE_LIBPCAP
+extern "C" {
+#include <pcap/pcap.h>
+}
+#endif
+
 // We never instantiate from a generic tracker component or from a stored
 // record so we always re-allocate ourselves
 kis_datasource::kis_datasource(shared_datasource_builder in_builder) :
@@ -46,6 +58,25 @@ kis_datasource::kis_datasource(shared_datasource_builder in_builder) :
     register_fields();
     reserve_fields(nullptr);
 
+    hot_source_uuid = std::make_shared<const uuid>(get_tracker_value<uuid>(source_uuid));
+    hot_source_key = get_tracker_value<uint32_t>(source_key);
+    hot_source_paused = get_tracker_value<uint8_t>(source_paused);
+    hot_source_remote = get_tracker_value<uint8_t>(source_remote);
+    hot_source_override_linktype = get_tracker_value<uint32_t>(source_override_linktype);
+
+    clobber_timestamp = false;
+    compress_reports = false;
+    shm_reports = false;
+
+    capture_filter_set = false;
+    capture_filter_snaplen = 0;
+    capture_filter_data_payload = -1;
+
+    remote_resumable = false;
+    remote_suspended = false;
+    remote_resume_timeout = 0;
+    resume_timer_id = -1;
+
     if (in_builder != nullptr) {
         set_source_builder(in_builder);
         insert(in_builder);
@@ -94,6 +125,7 @@ kis_datasource::~kis_datasource() {
     // Cancel any timer
     timetracker->remove_timer(error_timer_id);
     timetracker->remove_timer(ping_timer_id);
+    timetracker->remove_timer(resume_timer_id);
 
     kis_unique_lock<kis_mutex> lk(ext_mutex, "~kisdatasource");
     cancel_all_commands("source deleted");
@@ -316,6 +348,9 @@ void kis_datasource::open_interface(std::string in_definition, unsigned int in_t
     if (error_timer_id > 0)
         timetracker->remove_timer(error_timer_id);
 
+    // Local capture tools can hand us their packets through shared memory
+    ipc_shm_size = shm_reports ? KIS_EXTERNAL_SHM_SIZE : 0;
+
     // Launch the IPC, outside of lock 
     lock.unlock();
 
@@ -444,12 +479,57 @@ void kis_datasource::set_channel_hop_list(std::vector<std::string> in_chans,
             get_source_hop_offset(), in_transaction, in_cb);
 }
 
+void kis_datasource::set_capture_filter(const std::string& in_filter, unsigned int in_snaplen,
+        int in_data_payload, unsigned int in_transaction, configure_callback_t in_cb) {
+    kis_unique_lock<kis_mutex> lock(ext_mutex, std::defer_lock, "datasource set_capture_filter");
+    lock.lock();
+
+    if (in_transaction == 0)
+        in_transaction = next_transaction++;
+
+    // Anything shorter would cut into the radio headers
+    if (in_snaplen != 0 && in_snaplen < 64) {
+        if (in_cb != NULL) {
+            lock.unlock();
+            in_cb(in_transaction, false, "capture snaplen must be 0 or at least 64");
+            lock.lock();
+        }
+        return;
+    }
+
+    capture_filter_set = true;
+    capture_filter = in_filter;
+    capture_filter_snaplen = in_snaplen;
+    capture_filter_data_payload = in_data_payload < 0 ? -1 : in_data_payload;
+
+    // Otherwise it's pushed when the source opens
+    if (!get_source_running()) {
+        if (in_cb != NULL) {
+            lock.unlock();
+            in_cb(in_transaction, true, "");
+            lock.lock();
+        }
+        return;
+    }
+
+    send_configure_filter(in_transaction, in_cb);
+}
+
 void kis_datasource::connect_remote(std::string in_definition, kis_datasource* in_remote, 
-        bool in_tcp, configure_callback_t in_cb) {
+        const std::string& in_session, bool in_tcp, configure_callback_t in_cb) {
     kis_unique_lock<kis_mutex> lk(ext_mutex, "datasource connect_remote");
 
     cancelled = false;
 
+    // A new session replaces whatever we were waiting to resume
+    remote_session = in_session;
+    remote_resumable = false;
+    remote_suspended = false;
+
+    if (resume_timer_id > 0)
+        timetracker->remove_timer(resume_timer_id);
+    resume_timer_id = -1;
+
     // We can't reconnect failed interfaces that are remote
     set_int_source_retry(false);
     
@@ -504,6 +584,10 @@ void kis_datasource::connect_remote(std::string in_definition, kis_datasource* i
             return 0;
         }
 
+        // Nothing to ping while we wait for the capture to reconnect
+        if (remote_suspended)
+            return 1;
+
         if (Globalreg::globalreg->last_tv_sec - last_pong > 15) {
             ping_timer_id = -1;
             trigger_error("did not get a ping response from the capture");
@@ -531,6 +615,88 @@ void kis_datasource::connect_remote(std::string in_definition, kis_datasource* i
     send_open_source(get_source_definition(), 0, in_cb);
 }
 
+bool kis_datasource::resume_remote(kis_datasource* in_remote, const std::string& in_session) {
+    kis_unique_lock<kis_mutex> lk(ext_mutex, "datasource resume_remote");
+
+    if (in_session.length() == 0 || in_session != remote_session || !remote_resumable)
+        return false;
+
+    // The capture may notice the connection is gone before we do
+    if (!remote_suspended && !get_source_running())
+        return false;
+
+    remote_suspended = false;
+
+    if (resume_timer_id > 0)
+        timetracker->remove_timer(resume_timer_id);
+    resume_timer_id = -1;
+
+    last_pong = (time_t) Globalreg::globalreg->last_tv_sec;
+
+    lk.unlock();
+
+    if (io_ != nullptr)
+        io_->close();
+
+    // The capture kept its channel and hopping state and replays what it buffered while
+    // it was disconnected, so we only take over the new connection
+    io_ = in_remote->move_io(shared_from_this());
+    closure_cb = in_remote->move_closure_cb();
+
+    // The capture doesn't wait for us before sending what it buffered, so some of it may
+    // already be read
+    auto io = io_;
+    boost::asio::post(io->strand(), 
+            [io]() {
+                io->interface_->handle_packet(*io->in_buf_);
+            });
+
+    return true;
+}
+
+void kis_datasource::trigger_connection_lost(const std::string& in_error) {
+    kis_unique_lock<kis_mutex> lk(ext_mutex, "datasource trigger_connection_lost");
+
+    if (cancelled || remote_session.length() == 0 || !remote_resumable || 
+            remote_resume_timeout == 0 || !get_source_running()) {
+        lk.unlock();
+        return trigger_error(in_error);
+    }
+
+    if (remote_suspended)
+        return;
+
+    remote_suspended = true;
+
+    _MSG_INFO("Data source '{} / {}' ('{}') lost its remote connection ({}); waiting {} "
+            "seconds for the capture to resume", get_source_name(), 
+            generate_source_definition(), get_source_interface(), in_error, 
+            remote_resume_timeout);
+
+    // Keep the stopped io so that anything sent while we wait is quietly dropped
+    if (io_ != nullptr)
+        io_->close();
+
+    resume_timer_id = 
+        timetracker->register_timer(std::chrono::seconds(remote_resume_timeout), false, 
+                [this, in_error](int) -> int {
+                    kis_unique_lock<kis_mutex> lk(ext_mutex, "datasource resume_timer lambda");
+
+                    resume_timer_id = -1;
+
+                    if (!remote_suspended)
+                        return 0;
+
+                    remote_suspended = false;
+
+                    lk.unlock();
+
+                    trigger_error(in_error);
+
+                    return 0;
+                });
+}
+
 void kis_datasource::disable_source() {
     kis_lock_guard<kis_mutex> lk(ext_mutex, "datasource disable_source");
 
@@ -635,6 +801,14 @@ void kis_datasource::close_external_impl() {
         ping_timer_id = -1;
     }
 
+    if (resume_timer_id > 0) {
+        timetracker->remove_timer(resume_timer_id);
+        resume_timer_id = -1;
+    }
+
+    remote_suspended = false;
+    remote_resumable = false;
+
     set_int_source_running(false);
 
     lk.unlock();
@@ -783,6 +957,14 @@ bool kis_datasource::parse_source_definition(std::string in_definition) {
     clobber_timestamp = get_definition_opt_bool("timestamp", 
             datasourcetracker->get_config_defaults()->get_remote_cap_timestamp());
 
+    compress_reports = get_definition_opt_bool("compression",
+            datasourcetracker->get_config_defaults()->get_remote_cap_compression());
+
+    remote_resume_timeout = datasourcetracker->get_config_defaults()->get_remote_cap_resume();
+
+    shm_reports = get_definition_opt_bool("shm",
+            datasourcetracker->get_config_defaults()->get_local_cap_shm());
+
     set_source_info_antenna_type(get_definition_opt("info_antenna_type"));
     set_source_info_antenna_gain(get_definition_opt_double("info_antenna_gain", 0.0f));
     set_source_info_antenna_orientation(get_definition_opt_double("info_antenna_orientation", 0.0f));
@@ -940,6 +1122,9 @@ bool kis_datasource::dispatch_rx_packet(const nonstd::string_view& command,
     } else if (command.compare("KDSDATAREPORT") == 0) {
         handle_packet_data_report(seqno, content);
         return true;
+    } else if (command.compare("KDSDATAREPORTBATCH") == 0) {
+        handle_packet_data_report_batch(seqno, content);
+        return true;
     } else if (command.compare("KDSERRORREPORT") == 0) {
         handle_packet_error_report(seqno, content);
         return true;
@@ -956,6 +1141,8 @@ bool kis_datasource::dispatch_rx_packet(const nonstd::string_view& command,
         return true;
     } else if (command.compare("KDSWARNINGREPORT") == 0) {
         handle_packet_warning_report(seqno, content);
+    } else if (command.compare("KDSHOPREPORT") == 0) {
+        handle_packet_hop_report(seqno, content);
         return true;
     }
 
@@ -1217,6 +1404,13 @@ void kis_datasource::handle_packet_opensource_report(uint32_t in_seqno,
     set_int_source_running(report.success().success());
     set_int_source_error(!report.success().success());
 
+    // Only a capture which was opened has anything to resume
+    remote_resumable = report.success().success();
+
+    // A newly opened capture tool has none of the filtering we pushed before
+    if (report.success().success() && capture_filter_set)
+        send_configure_filter(0, nullptr);
+
     uint32_t seq = report.success().seqno();
     auto ci = command_ack_map.find(seq);
     if (ci != command_ack_map.end()) {
@@ -1390,22 +1584,58 @@ void kis_datasource::handle_packet_configure_report(uint32_t in_seqno,
 
 }
 
-void kis_datasource::handle_packet_data_report(uint32_t in_seqno, 
+void kis_datasource::handle_packet_data_report_batch(uint32_t in_seqno,
         const nonstd::string_view& in_content) {
-    {
-        kis_lock_guard<kis_mutex> lk(ext_mutex, "datasource handle_packet_data_report");
+    // Walk the DataReportBatch in place rather than parsing it; each report is only
+    // a view of the frame and is decoded into its own pooled report
+    google::protobuf::io::CodedInputStream is(reinterpret_cast<const uint8_t *>(in_content.data()),
+            in_content.length());
+    uint32_t tag;
+
+    while ((tag = is.ReadTag()) != 0) {
+        using wfl = google::protobuf::internal::WireFormatLite;
+
+        if (wfl::GetTagFieldNumber(tag) != 1 ||
+                wfl::GetTagWireType(tag) != wfl::WIRETYPE_LENGTH_DELIMITED) {
+            if (!wfl::SkipField(&is, tag))
+                break;
+            continue;
+        }
 
-        // If we haven't acquired the gpstracker, do so
-        if (gpstracker == nullptr)
-            gpstracker = Globalreg::fetch_mandatory_global_as<gps_tracker>();
+        uint32_t len;
+        const void *data;
+        int avail;
 
+        if (!is.ReadVarint32(&len) || !is.GetDirectBufferPointer(&data, &avail) ||
+                (uint32_t) avail < len)
+            break;
 
-        // If we're paused, throw away this packet
-        if (get_source_paused())
-            return;
+        handle_packet_data_report(in_seqno,
+                nonstd::string_view(static_cast<const char *>(data), len));
+
+        if (!is.Skip(len))
+            break;
+    }
+
+    if (!is.ConsumedEntireMessage()) {
+        _MSG(std::string("Kismet datasource driver ") + get_source_builder()->get_source_type() +
+                std::string(" could not parse the data report batch, something is wrong with "
+                    "the remote capture tool"), MSGFLAG_ERROR);
+        trigger_error("Invalid KDSDATAREPORTBATCH");
     }
+}
+
+void kis_datasource::handle_packet_data_report(uint32_t in_seqno, 
+        const nonstd::string_view& in_content) {
+    // If we're paused, throw away this packet; the paused state is read without
+    // locking so the packet path doesn't wait on commands to the source
+    if (get_source_paused())
+        return;
 
-    auto report = std::make_shared<KismetDatasource::DataReport>();
+    // The report comes from the thread pool and is returned to it once the packet
+    // (which references the payload in place in the report) is done with it
+    auto slot = thread_object_pool<kis_datareport_slot>::acquire();
+    auto report = std::shared_ptr<KismetDatasource::DataReport>(slot, &slot->report);
 
     if (!report->ParseFromArray(in_content.data(), in_content.length())) {
         _MSG(std::string("Kismet datasource driver ") + get_source_builder()->get_source_type() + 
@@ -1421,10 +1651,20 @@ void kis_datasource::handle_packet_data_report(uint32_t in_seqno,
     if (report->has_warning())
         set_int_source_warning(report->warning());
 
+    if (report->has_spectrum()) {
+        handle_rx_spectrum(report->spectrum());
+
+        // Reports of only a sweep don't make a packet
+        if (!report->has_packet() && !report->has_json() && !report->has_buffer())
+            return;
+    }
+
     auto packet = packetchain->generate_packet();
+    packetchain->start_packet_trace(packet);
 
     auto packreport = packetchain->new_packet_component<kis_packreport_packinfo>();
     packreport->set_report(report);
+    packet->insert(pack_comp_report, packreport);
 
     // Process the data chunk
     if (report->has_packet()) {
@@ -1474,8 +1714,6 @@ void kis_datasource::handle_packet_data_report(uint32_t in_seqno,
             packet->insert(pack_comp_gps, gpsinfo);
     }
 
-    // TODO handle spectrum
-   
     handle_rx_packet(packet);
 
 }
@@ -1513,14 +1751,43 @@ void kis_datasource::handle_rx_datalayer(std::shared_ptr<kis_packet> packet,
         packet->original_len = report.data().length();
     }
 
-    packet->set_data(report.data());
+    // Reference the payload in place in the data report, which the packet holds, 
+    // instead of copying it
+    auto packreport = packet->fetch<kis_packreport_packinfo>(pack_comp_report);
+
+    if (packreport != nullptr && packreport->get_report() != nullptr)
+        packet->set_data_ref(report.data(), packreport->get_report());
+    else
+        packet->set_data(report.data());
+
     datachunk->set_data(packet->data);
 
-    get_source_packet_size_rrd()->add_sample(report.data().length(), Globalreg::globalreg->last_tv_sec);
+    packet_size_rrd->add_sample(report.data().length(), Globalreg::globalreg->last_tv_sec);
 
     packet->insert(pack_comp_linkframe, datachunk);
 }
 
+void kis_datasource::handle_rx_spectrum(const KismetDatasource::SubSpectrum& report) {
+    auto spectrumtracker = Globalreg::fetch_global_as<kis_spectrum_tracker>();
+
+    if (spectrumtracker == nullptr)
+        return;
+
+    struct timeval ts;
+
+    if ((clobber_timestamp && get_source_remote()) || report.time_sec() == 0) {
+        gettimeofday(&ts, NULL);
+    } else {
+        ts.tv_sec = report.time_sec();
+        ts.tv_usec = report.time_usec();
+    }
+
+    spectrumtracker->add_sweep(get_source_uuid(), get_source_name(),
+            (uint64_t) ts.tv_sec * 1000000 + ts.tv_usec,
+            report.start_mhz() * 1e6, report.end_mhz() * 1e6,
+            report.data().data(), report.data_size());
+}
+
 void kis_datasource::handle_rx_jsonlayer(std::shared_ptr<kis_packet> packet,
         const KismetDatasource::SubJson& report) {
     auto jsoninfo = packetchain->new_packet_component<kis_json_packinfo>();
@@ -1541,19 +1808,20 @@ void kis_datasource::handle_rx_jsonlayer(std::shared_ptr<kis_packet> packet,
 }
 
 void kis_datasource::handle_rx_packet(std::shared_ptr<kis_packet> packet) {
-    auto datasrcinfo = packetchain->new_packet_component<packetchain_comp_datasource>();
+    auto datasrcinfo = packet->fetch_or_add<packetchain_comp_datasource>();
     datasrcinfo->ref_source = this;
 
-    packet->insert(pack_comp_datasrc, datasrcinfo);
-
     inc_source_num_packets(1);
-    get_source_packet_rrd()->add_sample(1, Globalreg::globalreg->last_tv_sec);
+    packet_rate_rrd->add_sample(1, Globalreg::globalreg->last_tv_sec);
 
     // Insert GPS data as soon as possible in the chain if there's no data
     // from the rest of the processing
     if (packet->fetch(pack_comp_gps) == nullptr &&
             packet->fetch(pack_comp_no_gps) == nullptr) {
-        auto gpsloc = gpstracker->get_best_location();
+        // The gps tracker may not exist yet when the source is created
+        auto gps = Globalreg::fetch_mandatory_global_handle<gps_tracker>();
+
+        auto gpsloc = gps->get_best_location();
 
         if (gpsloc != nullptr) {
             packet->insert(pack_comp_gps, std::move(gpsloc));
@@ -1583,6 +1851,29 @@ void kis_datasource::handle_packet_warning_report(uint32_t in_seqno,
     set_int_source_warning(report.warning());
 }
 
+void kis_datasource::handle_packet_hop_report(uint32_t in_seqno, 
+        const nonstd::string_view& in_content) {
+    kis_lock_guard<kis_mutex> lk(ext_mutex, "datasource handle_packet_hop_report");
+
+    KismetDatasource::HopReport report;
+
+    if (!report.ParseFromArray(in_content.data(), in_content.length())) {
+        _MSG(std::string("Kismet datasource driver ") + get_source_builder()->get_source_type() + 
+                std::string(" could not parse the hop report, something is wrong with "
+                    "the remote capture tool"), MSGFLAG_ERROR);
+        trigger_error("Invalid KDSHOPREPORT");
+        return;
+    }
+
+    set_int_source_hop_dwell_mean(report.mean_dwell());
+    set_int_source_hop_dwell_max(report.max_dwell());
+
+    if (report.has_mean_tune())
+        set_int_source_hop_tune_mean(report.mean_tune());
+    if (report.has_max_tune())
+        set_int_source_hop_tune_max(report.max_tune());
+}
+
 std::shared_ptr<kis_layer1_packinfo> kis_datasource::handle_sub_signal(KismetDatasource::SubSignal in_sig) {
     // Extract l1 info from a KV pair so we can add it to a packet
     auto siginfo = packetchain->new_packet_component<kis_layer1_packinfo>();
@@ -1692,6 +1983,14 @@ unsigned int kis_datasource::send_open_source(std::string in_definition,
 
     KismetDatasource::OpenSource o;
     o.set_definition(in_definition);
+    o.set_batch_reports(true);
+
+    // Compression only pays off over a network
+    if (compress_reports && get_source_remote())
+        o.set_compression(KIS_EXTERNAL_COMPRESS_VERSION);
+
+    if (shm_ring_ != nullptr && !get_source_remote())
+        o.set_shm_ring(KIS_EXTERNAL_SHM_VERSION);
 
     if (protocol_version == 0) {
         std::shared_ptr<KismetExternal::Command> c(new KismetExternal::Command());
@@ -1822,6 +2121,121 @@ unsigned int kis_datasource::send_configure_channel_hop(double in_rate,
     return seqno;
 }
 
+#ifdef HAVE_LIBPCAP
+// Compile a filter expression to the capture protocol form of a BPF program, 8-byte
+// instructions in network order
+static bool compile_capture_filter(const std::string& in_filter, int in_dlt, 
+        unsigned int in_snaplen, std::string& out_bpf, std::string& error) {
+    // The filter compiler in older versions of libpcap is not thread safe
+    static std::mutex compile_mutex;
+    std::lock_guard<std::mutex> lk(compile_mutex);
+
+    auto pd = pcap_open_dead(in_dlt, in_snaplen == 0 ? 65535 : in_snaplen);
+
+    if (pd == nullptr) {
+        error = "unable to initialize the filter compiler";
+        return false;
+    }
+
+    bpf_program prog;
+    memset(&prog, 0, sizeof(bpf_program));
+
+    if (pcap_compile(pd, &prog, in_filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        error = pcap_geterr(pd);
+        pcap_close(pd);
+        return false;
+    }
+
+    out_bpf.clear();
+    out_bpf.reserve(prog.bf_len * 8);
+
+    for (unsigned int i = 0; i < prog.bf_len; i++) {
+        uint16_t code = htons(prog.bf_insns[i].code);
+        uint32_t k = htonl(prog.bf_insns[i].k);
+
+        out_bpf.append(reinterpret_cast<const char *>(&code), 2);
+        out_bpf.push_back(static_cast<char>(prog.bf_insns[i].jt));
+        out_bpf.push_back(static_cast<char>(prog.bf_insns[i].jf));
+        out_bpf.append(reinterpret_cast<const char *>(&k), 4);
+    }
+
+    pcap_freecode(&prog);
+    pcap_close(pd);
+
+    return true;
+}
+#endif
+
+unsigned int kis_datasource::send_configure_filter(unsigned int in_transaction, 
+        configure_callback_t in_cb) {
+    kis_unique_lock<kis_mutex> lk(ext_mutex, "datasource send_configure_filter");
+
+    if (in_transaction == 0)
+        in_transaction = next_transaction++;
+
+    auto fail = [&](const std::string& error) -> unsigned int {
+        if (in_cb != NULL) {
+            lk.unlock();
+            in_cb(in_transaction, false, error);
+            lk.lock();
+        } else {
+            _MSG_ERROR("Source '{}' could not set capture filter '{}': {}",
+                    get_source_name(), capture_filter, error);
+        }
+
+        return 0;
+    };
+
+    std::shared_ptr<tracked_command> cmd;
+    uint32_t seqno;
+
+    KismetDatasource::Configure o;
+    auto f = new KismetDatasource::SubFilter();
+    o.set_allocated_filter(f);
+
+    // The capture tool filters the packets it captures, before any linktype override
+    if (capture_filter.length() != 0) {
+#ifdef HAVE_LIBPCAP
+        std::string bpf, error;
+
+        if (!compile_capture_filter(capture_filter, get_source_dlt(), capture_filter_snaplen, 
+                    bpf, error))
+            return fail(fmt::format("invalid capture filter '{}': {}", capture_filter, error));
+
+        f->set_bpf(bpf);
+#else
+        return fail("capture filters are not available; Kismet was built without libpcap");
+#endif
+    }
+
+    if (capture_filter_snaplen != 0)
+        f->set_snaplen(capture_filter_snaplen);
+
+    if (capture_filter_data_payload >= 0)
+        f->set_data_payload(capture_filter_data_payload);
+
+    if (protocol_version == 0) {
+        std::shared_ptr<KismetExternal::Command> c(new KismetExternal::Command());
+        c->set_command("KDSCONFIGURE");
+        c->set_content(o.SerializeAsString());
+        seqno = send_packet(c);
+    } else if (protocol_version == 2) {
+        seqno = send_packet_v2("KDSCONFIGURE", 0, o);
+    } else {
+        seqno = 0;
+    }
+
+    if (seqno == 0)
+        return fail("unable to generate command frame");
+
+    cmd.reset(new tracked_command(in_transaction, seqno, this));
+    cmd->configure_cb = in_cb;
+
+    command_ack_map.insert(std::make_pair(seqno, cmd));
+
+    return seqno;
+}
+
 unsigned int kis_datasource::send_list_interfaces(unsigned int in_transaction, list_callback_t in_cb) {
     kis_unique_lock<kis_mutex> lk(ext_mutex, "datasource send_list_interfaces");
 
@@ -1916,6 +2330,18 @@ void kis_datasource::register_fields() {
     register_field("kismet.datasource.hop_shuffle_skip", 
             "Number of channels skipped by source during hop shuffling", 
             &source_hop_shuffle_skip);
+    register_field("kismet.datasource.hop_dwell_mean", 
+            "Measured mean time on each channel while hopping, in seconds", 
+            &source_hop_dwell_mean);
+    register_field("kismet.datasource.hop_dwell_max", 
+            "Measured longest time on a channel while hopping, in seconds", 
+            &source_hop_dwell_max);
+    register_field("kismet.datasource.hop_tune_mean", 
+            "Measured mean time to change channel while hopping, in seconds", 
+            &source_hop_tune_mean);
+    register_field("kismet.datasource.hop_tune_max", 
+            "Measured longest time to change channel while hopping, in seconds", 
+            &source_hop_tune_max);
 
     register_field("kismet.datasource.error", "Source is in error state", &source_error);
     register_field("kismet.datasource.error_reason", 
@@ -1926,6 +2352,9 @@ void kis_datasource::register_fields() {
     register_field("kismet.datasource.num_error_packets", 
             "Number of invalid/error packets seen by source",
             &source_num_error_packets);
+    register_field("kismet.datasource.num_dropped_packets", 
+            "Number of packets from this source dropped by the packet queue limits or "
+            "drop policies", &source_num_dropped_packets);
 
     packet_rate_rrd_id = 
         register_dynamic_field("kismet.datasource.packets_rrd", 
@@ -1960,6 +2389,21 @@ void kis_datasource::register_fields() {
     register_field("kismet.datasource.linktype_override",
             "Overridden linktype, usually used in custom capture types.", &source_override_linktype);
 
+    register_field("kismet.datasource.compression.wire_bytes",
+            "Compressed data received from the remote capture tool", &source_compress_wire);
+    register_field("kismet.datasource.compression.raw_bytes",
+            "Size of the compressed data once decompressed", &source_compress_raw);
+    register_field("kismet.datasource.compression.ratio",
+            "Compression ratio of the data from the remote capture tool", &source_compress_ratio);
+    register_field("kismet.datasource.compression.cpu_usec",
+            "CPU time spent decompressing data from the remote capture tool, in microseconds",
+            &source_compress_cpu);
+
+    register_field("kismet.datasource.shm.frames",
+            "Frames received from the capture tool through shared memory", &source_shm_frames);
+    register_field("kismet.datasource.shm.bytes",
+            "Data received from the capture tool through shared memory", &source_shm_bytes);
+
 }
 
 void kis_datasource::handle_source_error() {
@@ -1982,8 +2426,8 @@ void kis_datasource::handle_source_error() {
                 "to reconnect to resume capture.", get_source_name(), get_source_uuid(), 
                 get_source_error_reason());
 
-            std::shared_ptr<alert_tracker> alertracker =
-                Globalreg::fetch_mandatory_global_as<alert_tracker>("ALERTTRACKER");
+            auto alertracker =
+                Globalreg::fetch_mandatory_global_handle<alert_tracker>();
             alertracker->raise_one_shot("SOURCEERROR", "SYSTEM", kis_alert_severity::critical, alrt, -1);
 
             _MSG(alrt, MSGFLAG_ERROR);
@@ -1999,8 +2443,8 @@ void kis_datasource::handle_source_error() {
                 "is not configured to automatically re-try opening; it will remain "
                 "closed.", get_source_name(), get_source_uuid(), get_source_error_reason());
 
-            std::shared_ptr<alert_tracker> alertracker =
-                Globalreg::fetch_mandatory_global_as<alert_tracker>("ALERTTRACKER");
+            auto alertracker =
+                Globalreg::fetch_mandatory_global_handle<alert_tracker>();
             alertracker->raise_one_shot("SOURCEERROR", "SYSTEM", kis_alert_severity::critical, alrt, -1);
 
             _MSG(alrt, MSGFLAG_ERROR);
@@ -2027,20 +2471,20 @@ void kis_datasource::handle_source_error() {
             "Kismet will attempt to re-open the source in 5 seconds.  ({} failures)",
             get_source_name(), get_source_uuid(), get_source_error_reason(), get_source_retry_attempts());
 
-        std::shared_ptr<alert_tracker> alertracker =
-            Globalreg::fetch_mandatory_global_as<alert_tracker>("ALERTTRACKER");
+        auto alertracker =
+            Globalreg::fetch_mandatory_global_handle<alert_tracker>();
         alertracker->raise_one_shot("SOURCEERROR", "SYSTEM", kis_alert_severity::critical, alrt, -1);
 
         _MSG(alrt, MSGFLAG_ERROR);
 
         // Set a new event to try to re-open the interface
-        error_timer_id = timetracker->register_timer(std::chrono::seconds(5), false, [this](int tid) -> int {
+        error_timer_id = timetracker->defer_task(std::chrono::seconds(5), [this]() {
                 kis_lock_guard<kis_mutex> lk(ext_mutex, "datasource error_timer lambda");
 
                 // _MSG_DEBUG("Reopen timer tid {} pid {}", tid, getpid());
 
                 if (get_source_retry() == false)
-                    return 0;
+                    return;
 
                 _MSG("Attempting to re-open source " + get_source_name(), MSGFLAG_INFO);
 
@@ -2057,8 +2501,8 @@ void kis_datasource::handle_source_error() {
                             auto alrt = fmt::format("Source {} ({}) successfully re-opened",
                                     get_source_name(), get_source_uuid());
 
-                            std::shared_ptr<alert_tracker> alertracker =
-                                Globalreg::fetch_mandatory_global_as<alert_tracker>("ALERTTRACKER");
+                            auto alertracker =
+                                Globalreg::fetch_mandatory_global_handle<alert_tracker>();
                             alertracker->raise_one_shot("SOURCEOPEN", "SYSTEM", kis_alert_severity::critical, alrt, -1);
 
                             if (get_source_hopping()) {
@@ -2076,8 +2520,6 @@ void kis_datasource::handle_source_error() {
                         });
 
                     error_timer_id = -1;
-
-                    return 0;
                 });
     } else {
         // fprintf(stderr, "debug - source error but we think a timer is already running\n");
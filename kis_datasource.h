@@ -21,6 +21,7 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <functional>
 
 #include "globalregistry.h"
@@ -53,6 +54,17 @@ class kis_datasource;
 
 class kis_gps;
 
+// Pooled holder for a data report; clearing a protobuf message keeps its sub-messages
+// and string storage, so parsing into a recycled report allocates nothing once the 
+// pool is warm
+struct kis_datareport_slot {
+    KismetDatasource::DataReport report;
+
+    void reset() {
+        report.Clear();
+    }
+};
+
 class kis_packreport_packinfo : public packet_component {
 public:
     kis_packreport_packinfo(std::shared_ptr<KismetDatasource::DataReport> r) :
@@ -64,6 +76,10 @@ public:
         report = r;
     }
 
+    std::shared_ptr<KismetDatasource::DataReport> get_report() const {
+        return report;
+    }
+
     void reset() {
         report.reset();
     }
@@ -208,6 +224,10 @@ public:
         kis_external_interface() {
         error_timer_id = -1;
         ping_timer_id = -1;
+        resume_timer_id = -1;
+        remote_suspended = false;
+        remote_resumable = false;
+        remote_resume_timeout = 0;
         register_fields();
         reserve_fields(NULL);
     }
@@ -217,6 +237,10 @@ public:
         kis_external_interface() {
         error_timer_id = -1;
         ping_timer_id = -1;
+        resume_timer_id = -1;
+        remote_suspended = false;
+        remote_resumable = false;
+        remote_resume_timeout = 0;
         register_fields();
         reserve_fields(NULL);
     }
@@ -226,6 +250,10 @@ public:
         kis_external_interface() {
         error_timer_id = -1;
         ping_timer_id = -1;
+        resume_timer_id = -1;
+        remote_suspended = false;
+        remote_resumable = false;
+        remote_resume_timeout = 0;
         register_fields();
         reserve_fields(e);
     }
@@ -307,11 +335,28 @@ public:
     virtual void set_channel_hop_list(std::vector<std::string> in_chans, 
             unsigned int in_transaction, configure_callback_t in_cb);
 
+    // Push a filter and truncation to the capture tool, so unwanted packets and bytes
+    // are dropped before they're sent to us.  The filter is a pcap filter expression,
+    // compiled for the link type of the source; an empty filter removes it.  A snaplen
+    // of 0 sends whole packets, and a data_payload below 0 sends whole 802.11 data
+    // frames.  The filter is pushed again whenever the source is re-opened.
+    virtual void set_capture_filter(const std::string& in_filter, unsigned int in_snaplen,
+            int in_data_payload, unsigned int in_transaction, configure_callback_t in_cb);
+
 
     // Instantiate from an incoming remote; caller must then assign tcpsocket or callbacks and trigger
     // a datasource open
     virtual void connect_remote(std::string in_definition, kis_datasource* in_remote, 
-            bool in_tcp, configure_callback_t in_cb);
+            const std::string& in_session, bool in_tcp, configure_callback_t in_cb);
+
+    // Resume a remote source whose connection was lost by taking over the connection of
+    // an incoming remote with the same session token, without re-opening the capture;
+    // returns false if the source can't be resumed by this session
+    virtual bool resume_remote(kis_datasource* in_remote, const std::string& in_session);
+
+    // A lost remote connection suspends the source for the resume window instead of
+    // failing it immediately
+    virtual void trigger_connection_lost(const std::string& in_error) override;
 
     // close the source
     // This must be called from either our own strand async functions, or fully 
@@ -358,10 +403,38 @@ public:
     // Kismet-only variables can be set realtime, they have no capture-binary
     // equivalents and are only used for tracking purposes in the Kismet server
     __ProxyM(source_name, std::string, std::string, std::string, source_name, data_mutex);
-    __ProxyM(source_uuid, uuid, uuid, uuid, source_uuid, data_mutex);
+
+    // The uuid and key are read for every packet, so the setters keep a copy outside
+    // of the tracked fields which can be read without data_mutex
+    shared_tracker_element get_tracker_source_uuid() {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        return source_uuid;
+    }
+    uuid get_source_uuid() const {
+        return *std::atomic_load_explicit(&hot_source_uuid, std::memory_order_acquire);
+    }
+    void set_source_uuid(const uuid& in) {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        set_tracker_value<uuid>(source_uuid, in);
+        mark_modified(source_uuid->get_id());
+        std::atomic_store_explicit(&hot_source_uuid, std::make_shared<const uuid>(in),
+                std::memory_order_release);
+    }
 
     // Source key is a checksum of the uuid for us to do fast indexing
-    __ProxyM(source_key, uint32_t, uint32_t, uint32_t, source_key, data_mutex);
+    shared_tracker_element get_tracker_source_key() {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        return source_key;
+    }
+    uint32_t get_source_key() const {
+        return hot_source_key.load(std::memory_order_acquire);
+    }
+    void set_source_key(const uint32_t& in) {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        set_tracker_value<uint32_t>(source_key, in);
+        mark_modified(source_key->get_id());
+        hot_source_key.store(in, std::memory_order_release);
+    }
 
     // Prototype/driver definition
     __ProxyTrackable(source_builder, kis_datasource_builder, source_builder);
@@ -391,12 +464,20 @@ public:
     __ProxyGetM(source_split_hop, uint8_t, bool, source_hop_split, data_mutex);
     __ProxyGetM(source_hop_offset, uint32_t, uint32_t, source_hop_offset, data_mutex);
     __ProxyGetM(source_hop_shuffle, uint8_t, bool, source_hop_shuffle, data_mutex);
+
+    // Measured hopping, as reported by the capture tool
+    __ProxyGetM(source_hop_dwell_mean, double, double, source_hop_dwell_mean, data_mutex);
+    __ProxyGetM(source_hop_dwell_max, double, double, source_hop_dwell_max, data_mutex);
+    __ProxyGetM(source_hop_tune_mean, double, double, source_hop_tune_mean, data_mutex);
+    __ProxyGetM(source_hop_tune_max, double, double, source_hop_tune_max, data_mutex);
     __ProxyGetM(source_hop_shuffle_skip, uint32_t, uint32_t, source_hop_shuffle_skip, data_mutex);
     __ProxyTrackableM(source_hop_vec, tracker_element_vector_string, source_hop_vec, data_mutex);
 
     __ProxyGetM(source_running, uint8_t, bool, source_running, data_mutex);
 
-    __ProxyGetM(source_remote, uint8_t, bool, source_remote, data_mutex);
+    bool get_source_remote() const {
+        return hot_source_remote.load(std::memory_order_acquire);
+    }
     __ProxyGetM(source_passive, uint8_t, bool, source_passive, data_mutex);
 
     __ProxyM(source_num_packets, uint64_t, uint64_t, uint64_t, source_num_packets, data_mutex);
@@ -405,10 +486,13 @@ public:
     __ProxyM(source_num_error_packets, uint64_t, uint64_t, uint64_t, source_num_error_packets, data_mutex);
     __ProxyIncDecM(Msource_num_error_packets, uint64_t, uint64_t, source_num_error_packets, data_mutex);
 
-    __ProxyDynamicTrackableM(source_packet_rrd, kis_tracked_rrd<>, 
+    __ProxyM(source_num_dropped_packets, uint64_t, uint64_t, uint64_t, source_num_dropped_packets, data_mutex);
+    __ProxyIncDecM(Msource_num_dropped_packets, uint64_t, uint64_t, source_num_dropped_packets, data_mutex);
+
+    __ProxyDynamicTrackableM(source_packet_rrd, kis_tracked_atomic_rrd<>, 
             packet_rate_rrd, packet_rate_rrd_id, data_mutex);
 
-    __ProxyDynamicTrackableM(source_packet_size_rrd, kis_tracked_rrd<>, 
+    __ProxyDynamicTrackableM(source_packet_size_rrd, kis_tracked_atomic_rrd<>, 
             packet_size_rrd, packet_size_rrd_id, data_mutex);
 
     // IPC binary name, if any
@@ -423,7 +507,20 @@ public:
 
     __Proxy(source_number, uint64_t, uint64_t, uint64_t, source_number);
 
-    __ProxyM(source_paused, uint8_t, bool, bool, source_paused, data_mutex);
+    // Checked for every packet, see source_uuid
+    shared_tracker_element get_tracker_source_paused() {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        return source_paused;
+    }
+    bool get_source_paused() const {
+        return hot_source_paused.load(std::memory_order_acquire);
+    }
+    void set_source_paused(const bool& in) {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        set_tracker_value<uint8_t>(source_paused, in);
+        mark_modified(source_paused->get_id());
+        hot_source_paused.store(in, std::memory_order_release);
+    }
 
 
     // Random metadata
@@ -434,9 +531,18 @@ public:
     __ProxyM(source_info_amp_type, std::string, std::string, std::string, source_info_amp_type, data_mutex);
     __ProxyM(source_info_amp_gain, double, double, double, source_info_amp_gain, data_mutex);
 
-    // Overridden linktype
-    __ProxyPrivSplitM(source_override_linktype, unsigned int, unsigned int, uint32_t, 
-            source_override_linktype, data_mutex);
+    // Overridden linktype, checked for every packet
+    uint32_t get_source_override_linktype() const {
+        return hot_source_override_linktype.load(std::memory_order_acquire);
+    }
+protected:
+    void set_int_source_override_linktype(const unsigned int& in) {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        source_override_linktype->set((uint32_t) in);
+        mark_modified(source_override_linktype->get_id());
+        hot_source_override_linktype.store(in, std::memory_order_release);
+    }
+public:
 
     __ProxyGetM(source_error_reason, std::string, std::string, source_error_reason, data_mutex);
 
@@ -454,6 +560,18 @@ public:
 
     virtual void pre_serialize() override {
         kis_lock_guard<kis_mutex> lk(data_mutex, kismet::retain_lock, "datasource preserialize");
+
+        // Compression stats are counted by the external interface as frames arrive
+        uint64_t wire = compress_wire_bytes;
+        uint64_t raw = compress_raw_bytes;
+
+        source_compress_wire->set(wire);
+        source_compress_raw->set(raw);
+        source_compress_ratio->set(wire == 0 ? 0.0f : (double) raw / (double) wire);
+        source_compress_cpu->set(compress_cpu_usec);
+
+        source_shm_frames->set(shm_frames);
+        source_shm_bytes->set(shm_bytes);
     }
 
     virtual void post_serialize() override {
@@ -478,6 +596,9 @@ public:
     virtual void handle_rx_jsonlayer(std::shared_ptr<kis_packet> packet,
             const KismetDatasource::SubJson& report);
 
+    // Hand a spectrum sweep to the spectrum tracker; sweeps don't enter the packet chain
+    virtual void handle_rx_spectrum(const KismetDatasource::SubSpectrum& report);
+
     // Handle injecting packets into the packet chain after the data report has been received
     // and processed.  Subclasses can override this to manipulate packet content.
     virtual void handle_rx_packet(std::shared_ptr<kis_packet> packet);
@@ -491,8 +612,6 @@ public:
     virtual void clear_device_gps();
 
 protected:
-    std::shared_ptr<gps_tracker> gpstracker;
-
     // Mutex for data elements
     kis_mutex data_mutex;
 
@@ -596,11 +715,13 @@ protected:
 
     virtual void handle_packet_configure_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
     virtual void handle_packet_data_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
+    virtual void handle_packet_data_report_batch(uint32_t in_seqno, const nonstd::string_view& in_packet);
     virtual void handle_packet_error_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
     virtual void handle_packet_interfaces_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
     virtual void handle_packet_opensource_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
     virtual void handle_packet_probesource_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
     virtual void handle_packet_warning_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
+    virtual void handle_packet_hop_report(uint32_t in_seqno, const nonstd::string_view& in_packet);
 
     virtual unsigned int send_configure_channel(std::string in_channel, unsigned int in_transaction,
             configure_callback_t in_cb);
@@ -608,6 +729,8 @@ protected:
             std::shared_ptr<tracker_element_vector_string> in_chans,
             bool in_shuffle, unsigned int in_offt, unsigned int in_transaction,
             configure_callback_t in_cb);
+    virtual unsigned int send_configure_filter(unsigned int in_transaction,
+            configure_callback_t in_cb);
     virtual unsigned int send_list_interfaces(unsigned int in_transaction, list_callback_t in_cb);
     virtual unsigned int send_open_source(std::string in_definition, unsigned int in_transaction, 
             open_callback_t in_cb);
@@ -656,6 +779,11 @@ protected:
     __ProxySetM(int_source_hop_offset, uint32_t, uint32_t, source_hop_offset, data_mutex);
     __ProxyTrackableM(int_source_hop_vec, tracker_element_vector_string, source_hop_vec, data_mutex);
 
+    __ProxySetM(int_source_hop_dwell_mean, double, double, source_hop_dwell_mean, data_mutex);
+    __ProxySetM(int_source_hop_dwell_max, double, double, source_hop_dwell_max, data_mutex);
+    __ProxySetM(int_source_hop_tune_mean, double, double, source_hop_tune_mean, data_mutex);
+    __ProxySetM(int_source_hop_tune_max, double, double, source_hop_tune_max, data_mutex);
+
     // Prototype object which created us, defines our overall capabilities
     std::shared_ptr<kis_datasource_builder> source_builder;
 
@@ -704,14 +832,23 @@ protected:
     std::shared_ptr<tracker_element_uint8> source_hop_shuffle;
     std::shared_ptr<tracker_element_uint32> source_hop_shuffle_skip;
 
+    // Measured dwell and tuning time over the last hop report from the capture tool
+    std::shared_ptr<tracker_element_double> source_hop_dwell_mean;
+    std::shared_ptr<tracker_element_double> source_hop_dwell_max;
+    std::shared_ptr<tracker_element_double> source_hop_tune_mean;
+    std::shared_ptr<tracker_element_double> source_hop_tune_max;
+
     std::shared_ptr<tracker_element_uint64> source_num_packets;
     std::shared_ptr<tracker_element_uint64> source_num_error_packets;
+    std::shared_ptr<tracker_element_uint64> source_num_dropped_packets;
 
+    // Packet and data RRDs are created with the source and added to by every packet
+    // thread, so they accumulate without a lock
     int packet_rate_rrd_id;
-    std::shared_ptr<kis_tracked_rrd<>> packet_rate_rrd;
+    std::shared_ptr<kis_tracked_atomic_rrd<>> packet_rate_rrd;
 
     int packet_size_rrd_id;
-    std::shared_ptr<kis_tracked_rrd<>> packet_size_rrd;
+    std::shared_ptr<kis_tracked_atomic_rrd<>> packet_size_rrd;
 
 
     // Local ID number is an increasing number assigned to each 
@@ -769,11 +906,55 @@ protected:
     
 
     // Do we clobber the remote timestamp?
-    bool clobber_timestamp;
-
-    __ProxySetM(int_source_remote, uint8_t, bool, source_remote, data_mutex);
+    std::atomic<bool> clobber_timestamp;
+
+    // Do we ask remote capture tools to compress their packets?
+    bool compress_reports;
+
+    // Do we ask local capture tools to send their packets through shared memory?
+    bool shm_reports;
+
+    // Session token of the remote capture tool, whether the source was opened and can be
+    // resumed, whether it's waiting for the capture to reconnect, and how long to wait;
+    // protected by ext_mutex
+    std::string remote_session;
+    bool remote_resumable;
+    bool remote_suspended;
+    unsigned int remote_resume_timeout;
+    int resume_timer_id;
+
+    // Capture filter pushed to the capture tool, kept to push again when the source
+    // is re-opened; protected by ext_mutex
+    bool capture_filter_set;
+    std::string capture_filter;
+    unsigned int capture_filter_snaplen;
+    int capture_filter_data_payload;
+
+    // Compressed remote capture
+    std::shared_ptr<tracker_element_uint64> source_compress_wire;
+    std::shared_ptr<tracker_element_uint64> source_compress_raw;
+    std::shared_ptr<tracker_element_double> source_compress_ratio;
+    std::shared_ptr<tracker_element_uint64> source_compress_cpu;
+
+    // Shared memory local capture
+    std::shared_ptr<tracker_element_uint64> source_shm_frames;
+    std::shared_ptr<tracker_element_uint64> source_shm_bytes;
+
+    void set_int_source_remote(const bool& in) {
+        kis_lock_guard<kis_mutex> lk(data_mutex, __func__);
+        set_tracker_value<uint8_t>(source_remote, in);
+        mark_modified(source_remote->get_id());
+        hot_source_remote.store(in, std::memory_order_release);
+    }
     std::shared_ptr<tracker_element_uint8> source_remote;
 
+    // Copies of the tracked fields the packet path reads, kept by their setters
+    std::shared_ptr<const uuid> hot_source_uuid;
+    std::atomic<uint32_t> hot_source_key;
+    std::atomic<bool> hot_source_paused;
+    std::atomic<bool> hot_source_remote;
+    std::atomic<uint32_t> hot_source_override_linktype;
+
     __ProxySetM(int_source_passive, uint8_t, bool, source_passive, data_mutex);
     std::shared_ptr<tracker_element_uint8> source_passive;
 
@@ -931,6 +1112,7 @@ public:
         ref_source = nullptr;
     }
 };
+KIS_PACKET_COMPONENT_SLOT(packetchain_comp_datasource, packet_slot::datasource)
 
 #endif
 
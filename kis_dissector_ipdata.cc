@@ -18,6 +18,11 @@
 
 #include "config.h"
 
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <set>
+
 #include "globalregistry.h"
 #include "util.h"
 #include "endian_magic.h"
@@ -25,6 +30,8 @@
 #include "packet.h"
 #include "packetchain.h"
 #include "alertracker.h"
+#include "configfile.h"
+#include "timetracker.h"
 
 #include "kis_dissector_ipdata.h"
 #include "phy_80211_packetsignatures.h"
@@ -75,11 +82,86 @@ int get_length_tag_offsets(unsigned int init_offset,
 }
 
 
+ipdata_flow_table::ipdata_flow_table(size_t in_max_flows) {
+    max_per_shard = std::max((size_t) 1, in_max_flows / shards.size());
+
+    for (auto& s : shards)
+        s.mutex.set_name("ipdata_flow_table");
+}
+
+uint8_t ipdata_flow_table::update(const ipdata_flow_key& in_key, const mac_addr& in_src_mac,
+        const mac_addr& in_dst_mac, size_t in_bytes, time_t in_time) {
+    auto& s = shard_for(in_key);
+
+    kis_lock_guard<kis_mutex> lk(s.mutex, "ipdata flow update");
+
+    auto i = s.index.find(in_key);
+
+    if (i != s.index.end()) {
+        auto& f = *(i->second);
+
+        f.packets++;
+        f.bytes += in_bytes;
+        f.last_time = in_time;
+
+        if (i->second != s.lru.begin())
+            s.lru.splice(s.lru.begin(), s.lru, i->second);
+
+        return f.flags;
+    }
+
+    // Reuse the least recently seen flow when the shard is full
+    if (s.index.size() >= max_per_shard) {
+        s.index.erase(s.lru.back().key);
+        s.lru.splice(s.lru.begin(), s.lru, std::prev(s.lru.end()));
+    } else {
+        s.lru.emplace_front();
+    }
+
+    auto& f = s.lru.front();
+
+    f.key = in_key;
+    f.src_mac = in_src_mac;
+    f.dst_mac = in_dst_mac;
+    f.packets = 1;
+    f.bytes = in_bytes;
+    f.first_time = f.last_time = in_time;
+    f.flags = 0;
+
+    s.index[in_key] = s.lru.begin();
+
+    return 0;
+}
+
+void ipdata_flow_table::set_flags(const ipdata_flow_key& in_key, uint8_t in_flags) {
+    auto& s = shard_for(in_key);
+
+    kis_lock_guard<kis_mutex> lk(s.mutex, "ipdata flow set_flags");
+
+    auto i = s.index.find(in_key);
+
+    if (i != s.index.end())
+        i->second->flags |= in_flags;
+}
+
+void ipdata_flow_table::expire(time_t in_time) {
+    for (auto& s : shards) {
+        kis_lock_guard<kis_mutex> lk(s.mutex, "ipdata flow expire");
+
+        // The oldest flows are at the back of the list
+        while (s.lru.size() != 0 && s.lru.back().last_time < in_time) {
+            s.index.erase(s.lru.back().key);
+            s.lru.pop_back();
+        }
+    }
+}
+
 int ipdata_packethook(CHAINCALL_PARMS) {
 	return ((kis_dissector_ip_data *) auxdata)->handle_packet(in_pack);
 }
 
-kis_dissector_ip_data::kis_dissector_ip_data() {
+kis_dissector_ip_data::kis_dissector_ip_data() :
+    flow_timer_id{-1} {
     auto packetchain =
         Globalreg::fetch_mandatory_global_as<packet_chain>();
 
@@ -106,6 +188,41 @@ kis_dissector_ip_data::kis_dissector_ip_data() {
                 "MAC of the packet.  A client which fails to do so may "
                 "be attempting to exhaust the DHCP pool with spoofed requests.");
 
+    auto max_flows =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("ipdata_flows", 16384);
+    flow_timeout =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("ipdata_flow_timeout", 300);
+
+    if (max_flows == 0)
+        return;
+
+    flows = std::unique_ptr<ipdata_flow_table>(new ipdata_flow_table(max_flows));
+
+    auto timetracker =
+        Globalreg::fetch_mandatory_global_as<time_tracker>();
+
+    flow_timer_id =
+        timetracker->register_timer(std::chrono::seconds(30), true,
+                [this](int) -> int {
+                    if (flow_timeout != 0)
+                        flows->expire(Globalreg::globalreg->last_tv_sec - flow_timeout);
+                    return 1;
+                });
+
+    auto httpd =
+        Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/ipdata/flows", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    flows_endp(con);
+                }));
+
+    httpd->register_route("/ipdata/devices", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    devices_endp(con);
+                }));
 }
 
 kis_dissector_ip_data::~kis_dissector_ip_data() {
@@ -116,6 +233,151 @@ kis_dissector_ip_data::~kis_dissector_ip_data() {
 
     if (packetchain != nullptr)
         packetchain->remove_handler(&ipdata_packethook, CHAINPOS_DATADISSECT);
+
+    auto timetracker =
+        Globalreg::fetch_global_as<time_tracker>();
+
+    if (timetracker != nullptr && flow_timer_id >= 0)
+        timetracker->remove_timer(flow_timer_id);
+}
+
+uint8_t kis_dissector_ip_data::update_flow(const ipdata_flow_key& in_key,
+        std::shared_ptr<kis_common_info> in_common, size_t in_bytes, time_t in_time) {
+    if (flows == nullptr)
+        return 0;
+
+    return flows->update(in_key, in_common->source, in_common->dest, in_bytes, in_time);
+}
+
+namespace {
+    std::string ipdata_addr(uint32_t in_addr) {
+        struct in_addr a;
+        a.s_addr = in_addr;
+        return inet_ntoa(a);
+    }
+
+    std::string ipdata_proto(uint8_t in_proto) {
+        return in_proto == proto_tcp ? "tcp" : "udp";
+    }
+}
+
+void kis_dissector_ip_data::flows_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::ostream os(&con->response_stream());
+
+    mac_addr filter_mac;
+    bool filter = false;
+    size_t limit = 1000;
+
+    try {
+        auto mac_k = con->http_variables().find("mac");
+        if (mac_k != con->http_variables().end()) {
+            filter_mac = string_to_n<mac_addr>(mac_k->second);
+            filter = true;
+        }
+
+        auto limit_k = con->http_variables().find("limit");
+        if (limit_k != con->http_variables().end())
+            limit = string_to_n<size_t>(limit_k->second);
+    } catch (const std::exception& e) {
+        con->set_status(400);
+        os << "Invalid request: " << e.what() << "\n";
+        return;
+    }
+
+    std::vector<ipdata_flow> matched;
+
+    flows->for_each([&](const ipdata_flow& f) {
+            if (!filter || f.src_mac == filter_mac || f.dst_mac == filter_mac)
+                matched.push_back(f);
+        });
+
+    // Busiest flows first
+    std::sort(matched.begin(), matched.end(),
+            [](const ipdata_flow& a, const ipdata_flow& b) {
+                return a.bytes > b.bytes;
+            });
+
+    if (matched.size() > limit)
+        matched.resize(limit);
+
+    auto ret = nlohmann::json::array();
+
+    for (const auto& f : matched) {
+        nlohmann::json j;
+
+        j["proto"] = ipdata_proto(f.key.proto);
+        j["src_mac"] = f.src_mac.mac_to_string();
+        j["src_ip"] = ipdata_addr(f.key.src_addr);
+        j["src_port"] = f.key.src_port;
+        j["dst_mac"] = f.dst_mac.mac_to_string();
+        j["dst_ip"] = ipdata_addr(f.key.dst_addr);
+        j["dst_port"] = f.key.dst_port;
+        j["packets"] = f.packets;
+        j["bytes"] = f.bytes;
+        j["first_time"] = f.first_time;
+        j["last_time"] = f.last_time;
+
+        ret.push_back(j);
+    }
+
+    os << ret;
+}
+
+void kis_dissector_ip_data::devices_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    struct device_summary {
+        std::set<uint32_t> addrs;
+        std::set<uint32_t> peers;
+        uint64_t flows = 0;
+        uint64_t tx_packets = 0, tx_bytes = 0;
+        uint64_t rx_packets = 0, rx_bytes = 0;
+        time_t last_time = 0;
+    };
+
+    std::map<mac_addr, device_summary> devices;
+
+    // Devices are summarized from the flows they send and receive, rather than
+    // keeping per-device counters in the packet path
+    flows->for_each([&](const ipdata_flow& f) {
+            auto& src = devices[f.src_mac];
+            src.addrs.insert(f.key.src_addr);
+            src.peers.insert(f.key.dst_addr);
+            src.flows++;
+            src.tx_packets += f.packets;
+            src.tx_bytes += f.bytes;
+            src.last_time = std::max(src.last_time, f.last_time);
+
+            auto& dst = devices[f.dst_mac];
+            dst.peers.insert(f.key.src_addr);
+            dst.flows++;
+            dst.rx_packets += f.packets;
+            dst.rx_bytes += f.bytes;
+            dst.last_time = std::max(dst.last_time, f.last_time);
+        });
+
+    auto ret = nlohmann::json::array();
+
+    for (const auto& d : devices) {
+        nlohmann::json j;
+
+        auto addrs = nlohmann::json::array();
+        for (const auto& a : d.second.addrs)
+            addrs.push_back(ipdata_addr(a));
+
+        j["mac"] = d.first.mac_to_string();
+        j["ip_addrs"] = addrs;
+        j["peers"] = d.second.peers.size();
+        j["flows"] = d.second.flows;
+        j["tx_packets"] = d.second.tx_packets;
+        j["tx_bytes"] = d.second.tx_bytes;
+        j["rx_packets"] = d.second.rx_packets;
+        j["rx_bytes"] = d.second.rx_bytes;
+        j["last_time"] = d.second.last_time;
+
+        ret.push_back(j);
+    }
+
+    std::ostream os(&con->response_stream());
+    os << ret;
 }
 
 #define MDNS_PTR_MASK		0xC0
@@ -329,6 +591,10 @@ int kis_dissector_ip_data::handle_packet(std::shared_ptr<kis_packet> in_pack) {
 		memcpy(&addr, &(chunk->data()[IP_OFFSET + 7]), 4);
 		datainfo->ip_dest_addr.s_addr = kis_hton32(addr);
 
+        ipdata_flow_key flow_key{datainfo->ip_source_addr.s_addr, datainfo->ip_dest_addr.s_addr,
+            (uint16_t) datainfo->ip_source_port, (uint16_t) datainfo->ip_dest_port, proto_udp};
+        auto flow_flags = update_flow(flow_key, common, chunk->length(), in_pack->ts.tv_sec);
+
 #if 0
 		if (datainfo->ip_source_port == IAPP_PORT &&
 			datainfo->ip_dest_port == IAPP_PORT &&
@@ -541,9 +807,13 @@ int kis_dissector_ip_data::handle_packet(std::shared_ptr<kis_packet> in_pack) {
 			}
 		}
 
-		// MDNS extractor
+		// MDNS extractor; the records of a flow are only walked until its first
+		// response
+		bool mdns_classified = false;
+
 		if (datainfo->ip_source_port == 5353 &&
-			datainfo->ip_dest_port == 5353) {
+			datainfo->ip_dest_port == 5353 &&
+            (flow_flags & IPDATA_FLOW_CLASSIFIED) == 0) {
 			uint16_t mdns_flag_response = (1 << 15);
 
 			uint16_t mdns_flags;
@@ -574,6 +844,8 @@ int kis_dissector_ip_data::handle_packet(std::shared_ptr<kis_packet> in_pack) {
 				goto mdns_end;
 			}
 
+			mdns_classified = true;
+
 			// Skip past flags
 			offt += 2;
 
@@ -663,6 +935,9 @@ mdns_end:
 
 		}
 
+		if (mdns_classified && flows != nullptr)
+			flows->set_flags(flow_key, IPDATA_FLOW_CLASSIFIED);
+
 		in_pack->insert(pack_comp_basicdata, datainfo);
 		return 1;
 
@@ -686,6 +961,10 @@ mdns_end:
 
 		datainfo->proto = proto_tcp;
 
+        ipdata_flow_key flow_key{datainfo->ip_source_addr.s_addr, datainfo->ip_dest_addr.s_addr,
+            (uint16_t) datainfo->ip_source_port, (uint16_t) datainfo->ip_dest_port, proto_tcp};
+        update_flow(flow_key, common, chunk->length(), in_pack->ts.tv_sec);
+
 		/*
 		if (datainfo->ip_source_port == PPTP_PORT || 
 			datainfo->ip_dest_port == PPTP_PORT) {
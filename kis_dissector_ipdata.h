@@ -21,10 +21,112 @@
 
 #include "config.h"
 
+#include <array>
+#include <list>
+#include <unordered_map>
+
 #include "globalregistry.h"
+#include "kis_mutex.h"
+#include "kis_net_beast_httpd.h"
+#include "macaddr.h"
 #include "packet.h"
 #include "packetchain.h"
 
+struct ipdata_flow_key {
+    uint32_t src_addr, dst_addr;
+    uint16_t src_port, dst_port;
+    uint8_t proto;
+
+    bool operator==(const ipdata_flow_key& k) const {
+        return src_addr == k.src_addr && dst_addr == k.dst_addr &&
+            src_port == k.src_port && dst_port == k.dst_port && proto == k.proto;
+    }
+};
+
+struct ipdata_flow_key_hash {
+    size_t operator()(const ipdata_flow_key& k) const {
+        uint64_t h = ((uint64_t) k.src_addr << 32) | k.dst_addr;
+        h ^= ((uint64_t) k.src_port << 24) ^ ((uint64_t) k.dst_port << 8) ^ k.proto;
+        h *= 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+};
+
+// The flow has been classified and its payload doesn't need to be inspected again
+#define IPDATA_FLOW_CLASSIFIED      (1 << 0)
+
+struct ipdata_flow {
+    ipdata_flow_key key;
+
+    mac_addr src_mac, dst_mac;
+
+    uint64_t packets;
+    uint64_t bytes;
+
+    time_t first_time, last_time;
+
+    uint8_t flags;
+};
+
+// Table of the IP flows seen in data frames, by 5-tuple.  The table is split into
+// shards by the hash of the flow, each with its own lock and LRU list, so packet
+// threads working on different flows don't contend; when a shard is full the least
+// recently seen flow is dropped, and flows are aged out after a timeout.
+class ipdata_flow_table {
+public:
+    ipdata_flow_table(size_t in_max_flows);
+
+    // Count a packet of a flow, creating the flow if it's new; returns the flags of the
+    // flow before the packet
+    uint8_t update(const ipdata_flow_key& in_key, const mac_addr& in_src_mac,
+            const mac_addr& in_dst_mac, size_t in_bytes, time_t in_time);
+
+    void set_flags(const ipdata_flow_key& in_key, uint8_t in_flags);
+
+    // Drop flows not seen since in_time
+    void expire(time_t in_time);
+
+    // Call fn with a copy of every flow
+    template<typename F>
+    void for_each(F fn) {
+        for (auto& s : shards) {
+            std::vector<ipdata_flow> flows;
+
+            {
+                kis_lock_guard<kis_mutex> lk(s.mutex, "ipdata flow for_each");
+                flows.assign(s.lru.begin(), s.lru.end());
+            }
+
+            for (const auto& f : flows)
+                fn(f);
+        }
+    }
+
+protected:
+    struct shard {
+        kis_mutex mutex;
+
+        // Most recently seen first
+        std::list<ipdata_flow> lru;
+        std::unordered_map<ipdata_flow_key, std::list<ipdata_flow>::iterator,
+            ipdata_flow_key_hash> index;
+    };
+
+    shard& shard_for(const ipdata_flow_key& in_key) {
+        return shards[ipdata_flow_key_hash()(in_key) % shards.size()];
+    }
+
+    std::array<shard, 16> shards;
+    size_t max_per_shard;
+};
+
+// Dissector of the IP payloads of data frames, which also keeps the flow table:
+//
+// GET /ipdata/flows.json?mac=XX:XX:XX:XX:XX:XX&limit=N
+//      Flows, busiest first, optionally only those sent or received by a MAC
+//
+// GET /ipdata/devices.json
+//      The addresses, peers, and traffic of each MAC, summarized from the flows
 class kis_dissector_ip_data : public lifetime_global {
 public:
     static std::string global_name() { return "IPDISSECTOR"; }
@@ -45,8 +147,20 @@ public:
 	~kis_dissector_ip_data();
 
 protected:
+    // Count the packet against its flow; returns the flags of the flow, or 0 when
+    // flows aren't tracked
+    uint8_t update_flow(const ipdata_flow_key& in_key, std::shared_ptr<kis_common_info> in_common,
+            size_t in_bytes, time_t in_time);
+
+    void flows_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+    void devices_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
 	int pack_comp_datapayload, pack_comp_basicdata, pack_comp_common;
 	int alert_dhcpclient_ref;
+
+    std::unique_ptr<ipdata_flow_table> flows;
+    time_t flow_timeout;
+    int flow_timer_id;
 };
 
 #endif
@@ -254,6 +254,10 @@ int kis_dlt_ppi::handle_packet(std::shared_ptr<kis_packet> in_pack) {
         }
     }
 
+    // A packet truncated by the capture tool doesn't have its FCS any more
+    if (in_pack->original_len > linkchunk->length())
+        applyfcs = 0;
+
     if (applyfcs)
         applyfcs = 4;
 
@@ -22,6 +22,7 @@
 
 #include "globalregistry.h"
 #include "util.h"
+#include "crc32.h"
 #include "endian_magic.h"
 #include "messagebus.h"
 #include "packet.h"
@@ -72,8 +73,6 @@ kis_dlt_radiotap::kis_dlt_radiotap() :
 	dlt = DLT_IEEE802_11_RADIO;
 
 	_MSG("Registering support for DLT_RADIOTAP packet header decoding", MSGFLAG_INFO);
-
-    crc32_init_table_80211(crc32_table);
 }
 
 #define ALIGN_OFFSET(offset, width) \
@@ -127,115 +126,41 @@ kis_dlt_radiotap::kis_dlt_radiotap() :
 #define BITNO_4(x) (((x) >> 2) ? 2 + BITNO_2((x) >> 2) : BITNO_2((x)))
 #define BITNO_2(x) (((x) & 2) ? 1 : 0)
 #define BIT(n)	(1 << n)
-int kis_dlt_radiotap::handle_packet(std::shared_ptr<kis_packet> in_pack) {
-    if (in_pack->has(pack_comp_decap))
-        return 1;
-
-    auto linkchunk = in_pack->fetch<kis_datachunk>(pack_comp_linkframe);
-
-	if (linkchunk == nullptr) {
-		return 1;
-	}
-
-	if (linkchunk->dlt != dlt) {
-		return 1;
-	}
-
-    if (linkchunk->length() == 0) {
-        return 1;
-    }
 
-    auto datasrc = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
-
-    // Everything needs a data source so we know how to checksum
-	if (datasrc == nullptr) {
-		return 1;
-	}
+// Most radiotap headers have a handful of present bitmaps; anything beyond this
+// is treated as corrupt
+#define RADIOTAP_MAX_PRESENT    16
 
-	union {
-		int8_t	i8;
-		int16_t	i16;
-		u_int8_t	u8;
-		u_int16_t	u16;
-		u_int32_t	u32;
-		u_int64_t	u64;
-	} u;
-	union {
-		int8_t		i8;
-		int16_t		i16;
-		u_int8_t	u8;
-		u_int16_t	u16;
-		u_int32_t	u32;
-		u_int64_t	u64;
-	} u2;
-
-	u2.u64 = 0;
-
-	const struct ieee80211_radiotap_header *hdr;
+void kis_dlt_radiotap::compile_layout(const uint32_t *present_words, size_t n_present, 
+        rt_layout& layout) {
 	u_int32_t present, next_present;
-	const u_int32_t *presentp, *last_presentp;
 	enum ieee80211_radiotap_presence bit;
 	int bit0;
-	const u_char *iter;
-	const u_char *iter_start;
 	unsigned int iter_align;
-	int fcs_cut = 0; // Is the FCS bit set?
-    bool fcs_flag_invalid = false; // Do we have a flag that tells us the fcs is known bad?
-    int record_num = 0;
-
-    std::shared_ptr<kis_layer1_packinfo> radioheader;
-
-    if (linkchunk->length() < sizeof(*hdr)) {
-        return 0;
-    }
-
-	// Assign it to the callback data
-    hdr = reinterpret_cast<const struct ieee80211_radiotap_header *>(linkchunk->data());
-    if (linkchunk->length() < EXTRACT_LE_16BITS(&hdr->it_len)) {
-        return 0;
-    }
-
-	// null-statement for-loop
-    for (last_presentp = &hdr->it_present;
-         (EXTRACT_LE_32BITS(last_presentp) & BIT(IEEE80211_RADIOTAP_EXT)) != 0 &&
-         (const u_char *) (last_presentp + 1) <= (const u_char *) linkchunk->data() + 
-         EXTRACT_LE_16BITS(&(hdr->it_len)); last_presentp++);
-
-    /* are there more bitmap extensions than bytes in header? */
-    if ((EXTRACT_LE_32BITS(last_presentp) & BIT(IEEE80211_RADIOTAP_EXT)) != 0) {
-		// snprintf(errstr, STATUS_MAX, "pcap radiotap converter got corrupted " "Radiotap bitmap length");
-		// globalreg->messagebus->inject_message(errstr, MSGFLAG_ERROR);
-        return 0;
-    }
 
-    auto decapchunk = packetchain->new_packet_component<kis_datachunk>();
-    radioheader = packetchain->new_packet_component<kis_layer1_packinfo>();
+    layout.present.assign(present_words, present_words + n_present);
+    layout.fields.clear();
+    layout.records.clear();
 
-	decapchunk->dlt = KDLT_IEEE802_11;
-	
-    iter = (const u_char*) (last_presentp + 1); 
-    // Alignment in Radiotap must be done from the beginning of the header, 
-    // not from the byte following the last bitmap. 
-    iter_start = (const u_char*) (linkchunk->data()); 
+    // Fields start after the fixed header and the bitmaps; alignment in radiotap 
+    // is from the beginning of the header, not from the byte following the last
+    // bitmap.
+    unsigned int iter = 4 + (n_present * 4);
 
-    bool assigned_signal = false;
+    for (size_t p = 0; p < n_present; p++) {
+        bit0 = p * 32;
 
-    for (bit0 = 0, presentp = &hdr->it_present; presentp <= last_presentp; presentp++, bit0 += 32) {
-        // printf("record num %d\n", record_num);
-        // printf("present %x\n", *presentp);
-        
         int record_antenna = -1;
-        int record_signal = 0;
-        bool signal_present = false;
+        int record_signal = -1;
 
-        for (present = EXTRACT_LE_32BITS(presentp); present; present = next_present) {
+        for (present = present_words[p]; present; present = next_present) {
             /* clear the least significant bit that is set */
             next_present = present & (present - 1);
 
             /* extract the least significant bit that is set */
             bit = (enum ieee80211_radiotap_presence) ((bit0 + BITNO_32(present ^ next_present)) % 32);
 
-            // printf("record %d bit %d\n", record_num, bit);
+            unsigned int field_offset = iter;
 
             switch (bit) {
                 case IEEE80211_RADIOTAP_FLAGS:
@@ -243,57 +168,38 @@ int kis_dlt_radiotap::handle_packet(std::shared_ptr<kis_packet> in_pack) {
                 case IEEE80211_RADIOTAP_ANTENNA:
                 case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
                 case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-                    u.u8 = *iter++;
-                    break;
                 case IEEE80211_RADIOTAP_DBM_TX_POWER:
-                    u.i8 = *iter++;
+                    iter += 1;
                     break;
                 case IEEE80211_RADIOTAP_CHANNEL:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 2);
+					iter_align = ALIGN_OFFSET(iter, 2);
 					iter += iter_align;
-
-                    u.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u.u16);
-                    u2.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u2.u16);
+                    field_offset = iter;
+                    iter += 4;
                     break;
                 case IEEE80211_RADIOTAP_FHSS:
                 case IEEE80211_RADIOTAP_LOCK_QUALITY:
                 case IEEE80211_RADIOTAP_TX_ATTENUATION:
                 case IEEE80211_RADIOTAP_DB_TX_ATTENUATION:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 2);
+                case IEEE80211_RADIOTAP_RX_FLAGS:
+					iter_align = ALIGN_OFFSET(iter, 2);
 					iter += iter_align;
-
-                    u.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u.u16);
+                    iter += 2;
                     break;
                 case IEEE80211_RADIOTAP_TSFT:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 8);
+					iter_align = ALIGN_OFFSET(iter, 8);
 					iter += iter_align;
-
-                    u.u64 = EXTRACT_LE_64BITS(iter);
-                    iter += sizeof(u.u64);
+                    iter += 8;
                     break;
 #if defined(SYS_OPENBSD)
                 case IEEE80211_RADIOTAP_RSSI:
-                    u.u8 = EXTRACT_LE_8BITS(iter);
-                    iter += sizeof(u.u8);
-                    u2.u8 = EXTRACT_LE_8BITS(iter);
-                    iter += sizeof(u2.u8);
+                    iter += 2;
                     break;
 #endif
-                case IEEE80211_RADIOTAP_RX_FLAGS:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 2);
-					iter += iter_align;
-
-                    u.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u.u16);
-                    break;
                 case IEEE80211_RADIOTAP_VHT:
                     /* TODO actually handle this data */
-                    iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 2);
+                    iter_align = ALIGN_OFFSET(iter, 2);
                     iter += iter_align;
-
                     iter += 12;
                     break;
                 case IEEE80211_RADIOTAP_MCS:
@@ -314,101 +220,228 @@ int kis_dlt_radiotap::handle_packet(std::shared_ptr<kis_packet> in_pack) {
                      * size we do not know, so we cannot
                      * proceed.
                      */
-                    // printf("Unknown bit %d\n", bit);
                     next_present = 0;
                     continue;
             }
 
-			// static int pnum = 0;
             switch (bit) {
                 case IEEE80211_RADIOTAP_CHANNEL:
-                    // radioheader->channel = ieee80211_mhz2ieee(u.u16, u2.u16);
-                    radioheader->freq_khz = (double) u.u16 * 1000;
-					// printf("debug - %d freq %u\n", pnum++, radioheader->freq_mhz);
-                    if (IEEE80211_IS_CHAN_FHSS(u2.u16))
-                        radioheader->carrier = carrier_80211fhss;
-                    else if (IEEE80211_IS_CHAN_A(u2.u16))
-                        radioheader->carrier = carrier_80211a;
-                    else if (IEEE80211_IS_CHAN_BPLUS(u2.u16))
-                        radioheader->carrier = carrier_80211bplus;
-                    else if (IEEE80211_IS_CHAN_B(u2.u16))
-                        radioheader->carrier = carrier_80211b;
-                    else if (IEEE80211_IS_CHAN_PUREG(u2.u16))
-                        radioheader->carrier = carrier_80211g;
-                    else if (IEEE80211_IS_CHAN_G(u2.u16))
-                        radioheader->carrier = carrier_80211g;
-                    else if (IEEE80211_IS_CHAN_T(u2.u16))
-                        radioheader->carrier = carrier_80211a;/*XXX*/
-                    else
-                        radioheader->carrier = carrier_unknown;
-                    if ((u2.u16 & IEEE80211_CHAN_CCK) == IEEE80211_CHAN_CCK)
-                        radioheader->encoding = encoding_cck;
-                    else if ((u2.u16 & IEEE80211_CHAN_OFDM) == IEEE80211_CHAN_OFDM)
-                        radioheader->encoding = encoding_ofdm;
-                    else if ((u2.u16 & IEEE80211_CHAN_DYN) == IEEE80211_CHAN_DYN)
-                        radioheader->encoding = encoding_dynamiccck;
-                    else if ((u2.u16 & IEEE80211_CHAN_GFSK) == IEEE80211_CHAN_GFSK)
-                        radioheader->encoding = encoding_gfsk;
-                    else
-                        radioheader->encoding = encoding_unknown;
-                    break;
                 case IEEE80211_RADIOTAP_RATE:
-					/* strip basic rate bit & convert to kismet units */
-                    radioheader->datarate = ((float) (u.u8 &~ 0x80) / 2) * 10;
-                    break;
-                case IEEE80211_RADIOTAP_ANTENNA:
-                    record_antenna = u.u8;
-                    break;
-				case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-                    record_signal = u.i8;
-                    signal_present = true;
-					break;
 				case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-                    radioheader->signal_type = kis_l1_signal_type_dbm;
-					radioheader->noise_dbm = u.i8;
-					break;
                 case IEEE80211_RADIOTAP_FLAGS:
-                    if (u.u8 & IEEE80211_RADIOTAP_F_FCS) {
-						fcs_cut = 4;
-					}
-
-                    if (u.u8 & IEEE80211_RADIOTAP_F_BADFCS) {
-                        fcs_flag_invalid = true;
-                    }
-
-                    break;
 #if defined(SYS_OPENBSD)
                 case IEEE80211_RADIOTAP_RSSI:
-                    /* Convert to Kismet units...  No reason to use RSSI units
-					 * here since we know the conversion factor */
-                    radioheader->signal_type = kis_l1_signal_type_dbm;
-                    radioheader->signal_dbm = int((float(u.u8) / float(u2.u8) * 255));
-                    break;
 #endif
+                    layout.fields.push_back(rt_field{(uint8_t) bit, (uint16_t) field_offset});
+                    break;
+                case IEEE80211_RADIOTAP_ANTENNA:
+                    record_antenna = field_offset;
+                    break;
+				case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+                    record_signal = field_offset;
+					break;
                 default:
                     break;
             }
         }
 
-        if (signal_present) {
-            // If we haven't assigned a signal, assign the first one we see as the
-            // overall signal level
-            if (!assigned_signal) {
-                assigned_signal = true;
-                radioheader->signal_type = kis_l1_signal_type_dbm;
-                radioheader->signal_dbm = record_signal;
-            }
+        if (record_signal >= 0)
+            layout.records.push_back(rt_record{record_antenna, record_signal});
+    }
 
-            if (record_antenna >= 0) {
-                radioheader->signal_type = kis_l1_signal_type_dbm;
-                radioheader->antenna_signal_map[record_antenna] = record_signal;
+    layout.min_len = iter;
+}
+
+int kis_dlt_radiotap::handle_packet(std::shared_ptr<kis_packet> in_pack) {
+    if (in_pack->has(pack_comp_decap))
+        return 1;
+
+    auto linkchunk = in_pack->fetch<kis_datachunk>(pack_comp_linkframe);
+
+	if (linkchunk == nullptr) {
+		return 1;
+	}
+
+	if (linkchunk->dlt != dlt) {
+		return 1;
+	}
+
+    if (linkchunk->length() == 0) {
+        return 1;
+    }
+
+    auto datasrc = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
+
+    // Everything needs a data source so we know how to checksum
+	if (datasrc == nullptr) {
+		return 1;
+	}
+
+	const struct ieee80211_radiotap_header *hdr;
+	const u_int32_t *last_presentp;
+	int fcs_cut = 0; // Is the FCS bit set?
+    bool fcs_flag_invalid = false; // Do we have a flag that tells us the fcs is known bad?
+
+    std::shared_ptr<kis_layer1_packinfo> radioheader;
+
+    if (linkchunk->length() < sizeof(*hdr)) {
+        return 0;
+    }
+
+	// Assign it to the callback data
+    hdr = reinterpret_cast<const struct ieee80211_radiotap_header *>(linkchunk->data());
+    if (linkchunk->length() < EXTRACT_LE_16BITS(&hdr->it_len)) {
+        return 0;
+    }
+
+	// null-statement for-loop
+    for (last_presentp = &hdr->it_present;
+         (EXTRACT_LE_32BITS(last_presentp) & BIT(IEEE80211_RADIOTAP_EXT)) != 0 &&
+         (const u_char *) (last_presentp + 1) <= (const u_char *) linkchunk->data() + 
+         EXTRACT_LE_16BITS(&(hdr->it_len)); last_presentp++);
+
+    /* are there more bitmap extensions than bytes in header? */
+    if ((EXTRACT_LE_32BITS(last_presentp) & BIT(IEEE80211_RADIOTAP_EXT)) != 0) {
+		// snprintf(errstr, STATUS_MAX, "pcap radiotap converter got corrupted " "Radiotap bitmap length");
+		// globalreg->messagebus->inject_message(errstr, MSGFLAG_ERROR);
+        return 0;
+    }
+
+    size_t n_present = (last_presentp - &hdr->it_present) + 1;
+
+    if (n_present > RADIOTAP_MAX_PRESENT)
+        return 0;
+
+    uint32_t present_words[RADIOTAP_MAX_PRESENT];
+
+    for (size_t p = 0; p < n_present; p++)
+        present_words[p] = EXTRACT_LE_32BITS(&hdr->it_present + p);
+
+    // Find the layout for these bitmaps; each packet thread keeps the last few it 
+    // has seen, which covers every source it handles in practice
+    static thread_local rt_layout layout_cache[4];
+    static thread_local unsigned int layout_next = 0;
+
+    rt_layout *layout = nullptr;
+
+    for (auto& l : layout_cache) {
+        if (l.present.size() == n_present &&
+                memcmp(l.present.data(), present_words, n_present * sizeof(uint32_t)) == 0) {
+            layout = &l;
+            break;
+        }
+    }
+
+    if (layout == nullptr) {
+        layout = &layout_cache[layout_next];
+        layout_next = (layout_next + 1) % 4;
+        compile_layout(present_words, n_present, *layout);
+    }
+
+    // The header has to hold every field it says is present
+    if (EXTRACT_LE_16BITS(&(hdr->it_len)) < layout->min_len)
+        return 0;
+
+    auto decapchunk = packetchain->new_packet_component<kis_datachunk>();
+    radioheader = packetchain->new_packet_component<kis_layer1_packinfo>();
+
+	decapchunk->dlt = KDLT_IEEE802_11;
+
+    auto rt_data = reinterpret_cast<const u_char *>(linkchunk->data());
+
+    for (const auto& f : layout->fields) {
+        auto field = rt_data + f.offset;
+
+        switch (f.bit) {
+            case IEEE80211_RADIOTAP_CHANNEL: {
+                auto freq = EXTRACT_LE_16BITS(field);
+                auto flags = EXTRACT_LE_16BITS(field + 2);
+
+                radioheader->freq_khz = (double) freq * 1000;
+
+                if (IEEE80211_IS_CHAN_FHSS(flags))
+                    radioheader->carrier = carrier_80211fhss;
+                else if (IEEE80211_IS_CHAN_A(flags))
+                    radioheader->carrier = carrier_80211a;
+                else if (IEEE80211_IS_CHAN_BPLUS(flags))
+                    radioheader->carrier = carrier_80211bplus;
+                else if (IEEE80211_IS_CHAN_B(flags))
+                    radioheader->carrier = carrier_80211b;
+                else if (IEEE80211_IS_CHAN_PUREG(flags))
+                    radioheader->carrier = carrier_80211g;
+                else if (IEEE80211_IS_CHAN_G(flags))
+                    radioheader->carrier = carrier_80211g;
+                else if (IEEE80211_IS_CHAN_T(flags))
+                    radioheader->carrier = carrier_80211a;/*XXX*/
+                else
+                    radioheader->carrier = carrier_unknown;
+                if ((flags & IEEE80211_CHAN_CCK) == IEEE80211_CHAN_CCK)
+                    radioheader->encoding = encoding_cck;
+                else if ((flags & IEEE80211_CHAN_OFDM) == IEEE80211_CHAN_OFDM)
+                    radioheader->encoding = encoding_ofdm;
+                else if ((flags & IEEE80211_CHAN_DYN) == IEEE80211_CHAN_DYN)
+                    radioheader->encoding = encoding_dynamiccck;
+                else if ((flags & IEEE80211_CHAN_GFSK) == IEEE80211_CHAN_GFSK)
+                    radioheader->encoding = encoding_gfsk;
+                else
+                    radioheader->encoding = encoding_unknown;
+                break;
             }
+            case IEEE80211_RADIOTAP_RATE:
+                /* strip basic rate bit & convert to kismet units */
+                radioheader->datarate = ((float) (field[0] &~ 0x80) / 2) * 10;
+                break;
+            case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+                radioheader->signal_type = kis_l1_signal_type_dbm;
+                radioheader->noise_dbm = (int8_t) field[0];
+                break;
+            case IEEE80211_RADIOTAP_FLAGS:
+                if (field[0] & IEEE80211_RADIOTAP_F_FCS) {
+                    fcs_cut = 4;
+                }
+
+                if (field[0] & IEEE80211_RADIOTAP_F_BADFCS) {
+                    fcs_flag_invalid = true;
+                }
+
+                break;
+#if defined(SYS_OPENBSD)
+            case IEEE80211_RADIOTAP_RSSI:
+                /* Convert to Kismet units...  No reason to use RSSI units
+                 * here since we know the conversion factor */
+                radioheader->signal_type = kis_l1_signal_type_dbm;
+                radioheader->signal_dbm = int((float(field[0]) / float(field[1]) * 255));
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+
+    bool assigned_signal = false;
+
+    for (const auto& r : layout->records) {
+        int record_signal = (int8_t) rt_data[r.signal_offset];
+
+        // If we haven't assigned a signal, assign the first one we see as the
+        // overall signal level
+        if (!assigned_signal) {
+            assigned_signal = true;
+            radioheader->signal_type = kis_l1_signal_type_dbm;
+            radioheader->signal_dbm = record_signal;
         }
 
-        record_num++;
+        if (r.antenna_offset >= 0) {
+            radioheader->signal_type = kis_l1_signal_type_dbm;
+            radioheader->antenna_signal_map[rt_data[r.antenna_offset]] = record_signal;
+        }
     }
 
     auto offset = EXTRACT_LE_16BITS(&(hdr->it_len));
+
+    // A packet truncated by the capture tool doesn't have its FCS any more
+    if (in_pack->original_len > linkchunk->length())
+        fcs_cut = 0;
     
     if (fcs_cut && offset + fcs_cut > (int) linkchunk->length()) {
         return 0;
@@ -453,9 +486,8 @@ int kis_dlt_radiotap::handle_packet(std::shared_ptr<kis_packet> in_pack) {
 	if (datasrc != NULL && datasrc->ref_source != NULL && fcschunk != NULL &&
         fcschunk->checksum_valid) {
 
-		// Compare it and flag the packet
-		uint32_t calc_crc =
-			crc32_le_80211(crc32_table, decapchunk->data(), decapchunk->length());
+		// Compare it and flag the packet; the 802.11 FCS is the standard CRC32
+		uint32_t calc_crc = crc32_fast(decapchunk->data(), decapchunk->length());
         uint32_t flipped_crc = kis_swap32(calc_crc);
 
         auto checksum_ptr = reinterpret_cast<const uint32_t *>(fcschunk->data());
@@ -485,47 +517,3 @@ int kis_dlt_radiotap::handle_packet(std::shared_ptr<kis_packet> in_pack) {
 #undef BITNO_2
 #undef BIT
 
-// Taken from the BBN USRP 802.11 encoding code
-unsigned int kis_dlt_radiotap::update_crc32_80211(unsigned int crc, const char *data,
-        int len, unsigned int poly) {
-	int i, j;
-	unsigned short ch;
-
-	for ( i = 0; i < len; ++i) {
-		ch = data[i];
-		for (j = 0; j < 8; ++j) {
-			if ((crc ^ ch) & 0x0001) {
-				crc = (crc >> 1) ^ poly;
-			} else {
-				crc = (crc >> 1);
-			}
-			ch >>= 1;
-		}
-	}
-	return crc;
-}
-
-void kis_dlt_radiotap::crc32_init_table_80211(unsigned int *crc32_table) {
-	int i;
-	char c;
-
-	for (i = 0; i < 256; ++i) {
-		c = i;
-		crc32_table[i] = update_crc32_80211(0, &c, 1, IEEE_802_3_CRC32_POLY);
-	}
-}
-
-unsigned int kis_dlt_radiotap::crc32_le_80211(unsigned int *crc32_table, 
-        const char *buf, int len) {
-	int i;
-	unsigned int crc = 0xFFFFFFFF;
-
-	for (i = 0; i < len; ++i) {
-		crc = (crc >> 8) ^ crc32_table[(crc ^ buf[i]) & 0xFF];
-	}
-
-	crc ^= 0xFFFFFFFF;
-
-	return crc;
-}
-
@@ -23,6 +23,8 @@
 
 #include "config.h"
 
+#include <vector>
+
 #include "globalregistry.h"
 #include "packet.h"
 #include "packetchain.h"
@@ -52,12 +54,34 @@ public:
 protected:
 	virtual int handle_packet(std::shared_ptr<kis_packet> in_pack) override;
 
-    unsigned int update_crc32_80211(unsigned int crc, const char *data,
-            int len, unsigned int poly);
-    void crc32_init_table_80211(unsigned int *crc32_table);
-    unsigned int crc32_le_80211(unsigned int *crc32_table, const char *buf, int len);
+    // Where the fields we decode sit in the header, for one set of radiotap present
+    // bitmaps.  The offsets depend only on the bitmaps, and a capture driver almost
+    // always sends the same ones, so each layout is worked out once and then reused
+    // for every frame with the same bitmaps.
+    struct rt_field {
+        uint8_t bit;
+        uint16_t offset;
+    };
+
+    struct rt_record {
+        int antenna_offset;
+        int signal_offset;
+    };
+
+    struct rt_layout {
+        std::vector<uint32_t> present;
+
+        // Fields in header order
+        std::vector<rt_field> fields;
+
+        // Antenna and signal of each bitmap which has a signal
+        std::vector<rt_record> records;
+
+        // Header length needed to hold every field
+        unsigned int min_len;
+    };
 
-    unsigned int crc32_table[256];
+    static void compile_layout(const uint32_t *present, size_t n_present, rt_layout& layout);
 };
 
 #endif
@@ -0,0 +1,293 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <time.h>
+
+#include <sstream>
+
+#include "alertracker.h"
+#include "configfile.h"
+#include "devicetracker_view_workers.h"
+#include "entrytracker.h"
+#include "kis_elklogfile.h"
+#include "messagebus.h"
+#include "timetracker.h"
+
+// Add an ISO 8601 @timestamp, which ELK maps as the time of the record, to the start of a
+// serialized record
+static std::string elk_timestamped(const std::string& record, double ts) {
+    if (record.length() < 2 || record[0] != '{')
+        return record;
+
+    time_t t = ts;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+
+    char tmstr[32];
+    strftime(tmstr, sizeof(tmstr), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    auto sep = record[1] == '}' ? "" : ",";
+
+    return fmt::format("{{\"@timestamp\":\"{}.{:03}Z\"{}{}", tmstr,
+            (int) ((ts - t) * 1000), sep, record.substr(1));
+}
+
+kis_elk_logfile::kis_elk_logfile(shared_log_builder in_builder) :
+    kis_logfile(in_builder),
+    device_timer{-1},
+    alert_evt_id{0},
+    sending_devices{false} {
+
+    devicetracker = Globalreg::fetch_mandatory_global_as<device_tracker>();
+    eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
+
+    index_prefix =
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("elk_index_prefix", "kismet");
+    device_rate =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("elk_device_rate", 30);
+
+    if (device_rate == 0)
+        device_rate = 1;
+}
+
+kis_elk_logfile::~kis_elk_logfile() {
+    close_log();
+}
+
+bool kis_elk_logfile::open_log(std::string in_path) {
+    kis_unique_lock<kis_mutex> lk(log_mutex, "open_log");
+
+    set_int_log_open(false);
+
+    auto config = Globalreg::globalreg->kismet_config;
+
+    elk_bulk_config bulk_config;
+
+    bulk_config.url = config->fetch_opt("elk_url");
+    bulk_config.auth = config->fetch_opt("elk_auth");
+    bulk_config.api_key = config->fetch_opt("elk_api_key");
+    bulk_config.connections = config->fetch_opt_uint("elk_connections", 4);
+    bulk_config.batch_docs = config->fetch_opt_uint("elk_batch_docs", 2000);
+    bulk_config.batch_bytes = config->fetch_opt_ulong("elk_batch_size", 4096) * 1024;
+    bulk_config.gzip_level = config->fetch_opt_bool("elk_gzip", true) ? 1 : 0;
+
+    // Errors are reported at most once a minute, not on every retry of an unreachable cluster
+    auto reported = std::make_shared<std::atomic<time_t>>(0);
+
+    bulk_config.error_cb = [reported](const std::string& error) {
+        time_t now = Globalreg::globalreg->last_tv_sec;
+
+        if (now - *reported < 60)
+            return;
+
+        *reported = now;
+
+        _MSG_ERROR("ELK log: {}", error);
+    };
+
+    if (bulk_config.url.length() == 0) {
+        _MSG_ERROR("The ELK log is enabled, but no elk_url is configured; set elk_url in "
+                "kismet_logging.conf or kismet_site.conf");
+        return false;
+    }
+
+    // The log has no file; the cluster is reported as its path
+    set_int_log_path(bulk_config.url);
+
+    bulk = std::make_shared<elk_bulk_client>(bulk_config);
+
+    try {
+        bulk->start();
+    } catch (const std::exception& e) {
+        _MSG_ERROR("Failed to open ELK log: {}", e.what());
+        bulk.reset();
+        return false;
+    }
+
+    _MSG_INFO("Sending devices and alerts to ELK at {}, indexes '{}-devices' and '{}-alerts'",
+            bulk_config.url, index_prefix, index_prefix);
+
+    set_int_log_open(true);
+
+    lk.unlock();
+
+    alert_evt_id =
+        eventbus->register_listener(alert_tracker::alert_event(),
+                [this](std::shared_ptr<eventbus_event> evt) {
+                auto alert_k = evt->get_event_content()->find(alert_tracker::alert_event());
+                if (alert_k == evt->get_event_content()->end())
+                    return;
+
+                auto alert = std::static_pointer_cast<tracked_alert>(alert_k->second);
+
+                std::stringstream ss;
+
+                if (Globalreg::globalreg->entrytracker->serialize("ekjson", ss, alert, nullptr) < 0)
+                    return;
+
+                auto b = get_bulk();
+
+                if (b == nullptr)
+                    return;
+
+                try {
+                    b->add(index_prefix + "-alerts", elk_timestamped(ss.str(), alert->get_timestamp()));
+                } catch (const std::exception& e) {
+                    return;
+                }
+                });
+
+    auto timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
+
+    device_timer =
+        timetracker->register_timer(std::chrono::seconds(device_rate), 1,
+                [this](int) -> int {
+                    if (sending_devices) {
+                        _MSG_ERROR("ELK log is still sending devices from the last pass; the "
+                                "cluster may not be keeping up.  Try increasing elk_device_rate "
+                                "or elk_connections.");
+                        return 1;
+                    }
+
+                    if (device_thread.joinable())
+                        device_thread.join();
+
+                    sending_devices = true;
+
+                    device_thread = std::thread([this]() {
+                        send_devices();
+                        sending_devices = false;
+                    });
+
+                    return 1;
+                });
+
+    return true;
+}
+
+void kis_elk_logfile::close_log() {
+    auto timetracker = Globalreg::fetch_global_as<time_tracker>();
+
+    if (timetracker != nullptr && device_timer >= 0)
+        timetracker->remove_timer(device_timer);
+
+    device_timer = -1;
+
+    if (alert_evt_id != 0) {
+        auto eventbus = Globalreg::fetch_global_as<event_bus>();
+
+        if (eventbus != nullptr)
+            eventbus->remove_listener(alert_evt_id);
+
+        alert_evt_id = 0;
+    }
+
+    std::shared_ptr<elk_bulk_client> b;
+
+    {
+        kis_lock_guard<kis_mutex> lk(log_mutex, "close_log");
+
+        set_int_log_open(false);
+
+        b = bulk;
+        bulk.reset();
+    }
+
+    // Stopping the bulk client also releases a device pass waiting for the cluster
+    if (b != nullptr)
+        b->stop();
+
+    if (device_thread.joinable())
+        device_thread.join();
+
+    if (b != nullptr)
+        _MSG_INFO("ELK log sent {} records, {} failed", b->get_docs_indexed(),
+                b->get_docs_failed());
+}
+
+std::shared_ptr<elk_bulk_client> kis_elk_logfile::get_bulk() {
+    kis_lock_guard<kis_mutex> lk(log_mutex, "elk get_bulk");
+
+    if (!get_log_open())
+        return nullptr;
+
+    return bulk;
+}
+
+void kis_elk_logfile::send_devices() {
+    if (get_bulk() == nullptr)
+        return;
+
+    // Only devices which changed since they were last sent are sent again
+    auto worker =
+        device_tracker_view_function_worker([this](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
+                auto gi = device_generations.find(dev->get_key());
+
+                if (gi == device_generations.end())
+                    return true;
+
+                return gi->second != dev->get_mod_generation();
+            });
+
+    auto changed = devicetracker->do_readonly_device_work(worker);
+
+    // Serialize in batches under the devicelist lock, and add them to the bulk client
+    // after releasing it, since adding waits when the cluster falls behind
+    const size_t batch_sz = 1024;
+    std::vector<std::pair<std::string, std::string>> records;
+    records.reserve(batch_sz);
+
+    for (size_t b = 0; b < changed->size(); b += batch_sz) {
+        auto e = std::min(changed->size(), b + batch_sz);
+
+        {
+            kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), "elk send_devices");
+
+            for (size_t i = b; i < e; i++) {
+                auto dev = std::static_pointer_cast<kis_tracked_device_base>((*changed)[i]);
+
+                std::stringstream ss;
+
+                if (Globalreg::globalreg->entrytracker->serialize("ekjson", ss, dev, nullptr) < 0)
+                    continue;
+
+                device_generations[dev->get_key()] = dev->get_mod_generation();
+
+                records.push_back(std::make_pair(dev->get_key().as_string(),
+                            elk_timestamped(ss.str(), dev->get_last_time())));
+            }
+        }
+
+        auto client = get_bulk();
+
+        if (client == nullptr)
+            return;
+
+        try {
+            for (const auto& r : records)
+                client->add(index_prefix + "-devices", r.second, r.first);
+        } catch (const std::exception& e) {
+            return;
+        }
+
+        records.clear();
+    }
+}
+
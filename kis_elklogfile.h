@@ -0,0 +1,112 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_ELK_LOGFILE_H__
+#define __KIS_ELK_LOGFILE_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include "devicetracker.h"
+#include "elk_bulk.h"
+#include "eventbus.h"
+#include "globalregistry.h"
+#include "logtracker.h"
+
+// Log devices and alerts to an Elasticsearch or OpenSearch cluster instead of a file.
+//
+// Records are serialized with the ekjson serializer and sent with bulk requests.  Devices
+// which changed are sent every elk_device_rate seconds, replacing the earlier document of
+// the device in the [prefix]-devices index; alerts are sent to [prefix]-alerts as they
+// are raised.
+class kis_elk_logfile : public kis_logfile {
+public:
+    kis_elk_logfile(shared_log_builder in_builder);
+    virtual ~kis_elk_logfile();
+
+    virtual bool open_log(std::string in_path) override;
+    virtual void close_log() override;
+
+protected:
+    // The bulk client while the log is open
+    std::shared_ptr<elk_bulk_client> get_bulk();
+
+    void send_devices();
+
+    std::shared_ptr<device_tracker> devicetracker;
+    std::shared_ptr<event_bus> eventbus;
+
+    std::shared_ptr<elk_bulk_client> bulk;
+    std::string index_prefix;
+
+    unsigned int device_rate;
+    int device_timer;
+    unsigned long alert_evt_id;
+
+    // Devices are sent from their own thread, one pass at a time
+    std::thread device_thread;
+    std::atomic<bool> sending_devices;
+
+    // Modification generation of each device when it was last sent
+    std::unordered_map<device_key, uint64_t> device_generations;
+};
+
+class elk_logfile_builder : public kis_logfile_builder {
+public:
+    elk_logfile_builder() :
+        kis_logfile_builder() {
+            register_fields();
+            reserve_fields(nullptr);
+            initialize();
+        }
+
+    elk_logfile_builder(int in_id) :
+        kis_logfile_builder(in_id) {
+            register_fields();
+            reserve_fields(nullptr);
+            initialize();
+        }
+
+    elk_logfile_builder(int in_id, std::shared_ptr<tracker_element_map> e) :
+        kis_logfile_builder(in_id, e) {
+            register_fields();
+            reserve_fields(e);
+            initialize();
+        }
+
+    virtual ~elk_logfile_builder() { }
+
+    virtual shared_logfile build_logfile(shared_log_builder builder) override {
+        return shared_logfile(new kis_elk_logfile(builder));
+    }
+
+    virtual void initialize() override {
+        set_log_class("elk");
+        set_log_name("ELK");
+        set_stream(false);
+        set_singleton(true);
+        set_log_description("Devices and alerts sent to Elasticsearch or OpenSearch");
+    }
+};
+
+#endif
+
@@ -16,6 +16,7 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <fcntl.h>
 #include <memory>
 #include <sys/stat.h>
 
@@ -25,7 +26,9 @@
 #include "json_adapter.h"
 
 #include "kis_external.h"
+#include "kis_external_compress.h"
 #include "kis_external_packet.h"
+#include "kis_external_shm.h"
 
 #include "endian_magic.h"
 
@@ -37,6 +40,75 @@
 #include "protobuf_cpp/http.pb.h"
 #include "protobuf_cpp/eventbus.pb.h"
 
+kis_external_rbuf::kis_external_rbuf() :
+    buf_{nullptr},
+    sz_{KIS_EXTERNAL_RBUF_SIZE},
+    mirrored_{false},
+    read_pos_{0},
+    write_pos_{0} {
+
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    int fd = syscall(SYS_memfd_create, "kismet_rbuf", MFD_CLOEXEC);
+
+    if (fd >= 0) {
+        if (ftruncate(fd, sz_) == 0) {
+            // Reserve the range, then map the buffer twice over it
+            auto base = (uint8_t *) mmap(NULL, sz_ * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (base != MAP_FAILED) {
+                if (mmap(base, sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                        mmap(base + sz_, sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                    buf_ = base;
+                    mirrored_ = true;
+                } else {
+                    munmap(base, sz_ * 2);
+                }
+            }
+        }
+
+        ::close(fd);
+    }
+#endif
+
+    if (buf_ == nullptr)
+        buf_ = new uint8_t[sz_];
+}
+
+kis_external_rbuf::~kis_external_rbuf() {
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    if (mirrored_) {
+        munmap(buf_, sz_ * 2);
+        return;
+    }
+#endif
+
+    delete[] buf_;
+}
+
+boost::asio::mutable_buffer kis_external_rbuf::prepare() {
+    if (!mirrored_ && read_pos_ > 0) {
+        // Only a partial frame is ever left behind, so this is a short move
+        memmove(buf_, buf_ + read_pos_, size());
+        write_pos_ -= read_pos_;
+        read_pos_ = 0;
+    }
+
+    return boost::asio::mutable_buffer(buf_ + (write_pos_ % sz_), sz_ - size());
+}
+
+size_t kis_external_io::gather_write(std::vector<boost::asio::const_buffer>& seq) {
+    seq.reserve(std::min(out_bufs_.size(), (size_t) KIS_EXTERNAL_IO_MAX_GATHER));
+
+    for (const auto& b : out_bufs_) {
+        if (seq.size() >= KIS_EXTERNAL_IO_MAX_GATHER)
+            break;
+
+        seq.push_back(boost::asio::buffer(b->data(), b->size()));
+    }
+
+    return seq.size();
+}
+
 kis_external_ipc::~kis_external_ipc() {
     close_impl();
 
@@ -47,19 +119,20 @@ kis_external_ipc::~kis_external_ipc() {
 
 void kis_external_ipc::start_read() {
     if (stopped_) {
-        interface_->handle_packet(in_buf_);
+        interface_->handle_packet(*in_buf_);
         return;
     }
 
-    boost::asio::async_read(ipc_in_, in_buf_,
-            boost::asio::transfer_at_least(sizeof(kismet_external_frame_t)),
+    // Frames never exceed 16k and every complete frame is consumed after each read, so
+    // there is always room in the buffer
+    ipc_in_.async_read_some(in_buf_->prepare(),
             boost::asio::bind_executor(strand(), 
                 [self = shared_from_this()](const boost::system::error_code& ec, std::size_t t) {
                     if (ec) {
                         if (ec.value() == boost::asio::error::operation_aborted) {
                             if (!self->stopped_) {
                                 self->close();
-                                self->interface_->handle_packet(self->in_buf_);
+                                self->interface_->handle_packet(*self->in_buf_);
                                 return self->interface_->trigger_error("IPC connection aborted");
                             }
 
@@ -69,7 +142,7 @@ void kis_external_ipc::start_read() {
                         if (ec.value() == boost::asio::error::eof) {
                             if (!self->stopped_) {
                                 self->close();
-                                self->interface_->handle_packet(self->in_buf_);
+                                self->interface_->handle_packet(*self->in_buf_);
                                 self->stopped_ = true;
                                 return self->interface_->trigger_error("IPC connection closed");
                             }
@@ -82,7 +155,9 @@ void kis_external_ipc::start_read() {
                         return self->interface_->trigger_error(fmt::format("IPC connection error: {}", ec.message()));
                     } 
 
-                    auto r = self->interface_->handle_packet(self->in_buf_);
+                    self->in_buf_->commit(t);
+
+                    auto r = self->interface_->handle_packet(*self->in_buf_);
 
                     if (r < 0) {
                         self->close();
@@ -100,16 +175,17 @@ void kis_external_ipc::write_impl() {
     if (stopped_)
         return;
 
-    auto buf = out_bufs_.front();
+    std::vector<boost::asio::const_buffer> seq;
+    auto n_bufs = gather_write(seq);
 
-    boost::asio::async_write(ipc_out_, boost::asio::buffer(buf->data(), buf->size()),
+    boost::asio::async_write(ipc_out_, seq,
             boost::asio::bind_executor(strand(), 
-                [self = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
-                if (self->out_bufs_.size())
+                [self = shared_from_this(), n_bufs](const boost::system::error_code& ec, std::size_t) {
+                for (size_t i = 0; i < n_bufs && self->out_bufs_.size(); i++)
                     self->out_bufs_.pop_front();
 
                 if (ec) {
-                    self->interface_->handle_packet(self->in_buf_);
+                    self->interface_->handle_packet(*self->in_buf_);
 
                     if (self->stopped() || ec.value() == boost::asio::error::operation_aborted) {
                         return;
@@ -173,19 +249,20 @@ kis_external_tcp::~kis_external_tcp() {
 
 void kis_external_tcp::start_read() {
     if (stopped_) {
-        interface_->handle_packet(in_buf_);
+        interface_->handle_packet(*in_buf_);
         return;
     }
 
-    boost::asio::async_read(tcpsocket_, in_buf_,
-            boost::asio::transfer_at_least(sizeof(kismet_external_frame_t)),
+    // Frames never exceed 16k and every complete frame is consumed after each read, so
+    // there is always room in the buffer
+    tcpsocket_.async_read_some(in_buf_->prepare(),
             boost::asio::bind_executor(strand(), 
                 [self = shared_from_this()](const boost::system::error_code& ec, std::size_t t) {
                     if (ec) {
                         if (ec.value() == boost::asio::error::operation_aborted) {
                             if (!self->stopped()) {
                                 self->close();
-                                self->interface_->handle_packet(self->in_buf_);
+                                self->interface_->handle_packet(*self->in_buf_);
                                 return self->interface_->trigger_error("TCP connection aborted");
                             }
 
@@ -195,18 +272,21 @@ void kis_external_tcp::start_read() {
                         if (ec.value() == boost::asio::error::eof) {
                             if (!self->stopped()) {
                                 self->close();
-                                self->interface_->handle_packet(self->in_buf_);
+                                self->interface_->handle_packet(*self->in_buf_);
                                 self->stopped_ = true;
-                                return self->interface_->trigger_error("TCP connection closed");
+                                return self->interface_->trigger_connection_lost("TCP connection closed");
                             }
 
                             return;
                         }
 
-                        return self->interface_->trigger_error(fmt::format("TCP connection error: {}", ec.message()));
+                        self->close();
+                        return self->interface_->trigger_connection_lost(fmt::format("TCP connection error: {}", ec.message()));
                     } 
 
-                    auto r = self->interface_->handle_packet(self->in_buf_);
+                    self->in_buf_->commit(t);
+
+                    auto r = self->interface_->handle_packet(*self->in_buf_);
 
                     if (r < 0) {
                         self->close();
@@ -247,16 +327,17 @@ void kis_external_tcp::write_impl() {
     if (stopped_)
         return;
 
-    auto buf = out_bufs_.front();
+    std::vector<boost::asio::const_buffer> seq;
+    auto n_bufs = gather_write(seq);
 
-    boost::asio::async_write(tcpsocket_, boost::asio::buffer(buf->data(), buf->size()),
+    boost::asio::async_write(tcpsocket_, seq,
             boost::asio::bind_executor(strand(), 
-                [self = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
-                if (self->out_bufs_.size())
+                [self = shared_from_this(), n_bufs](const boost::system::error_code& ec, std::size_t) {
+                for (size_t i = 0; i < n_bufs && self->out_bufs_.size(); i++)
                     self->out_bufs_.pop_front();
 
                 if (ec) {
-                    self->interface_->handle_packet(self->in_buf_);
+                    self->interface_->handle_packet(*self->in_buf_);
 
                     if (self->stopped() || ec.value() == boost::asio::error::operation_aborted) {
                         return;
@@ -265,7 +346,7 @@ void kis_external_tcp::write_impl() {
                     self->close();
 
                     _MSG_ERROR("Kismet external interface got an error writing to external TCP: {}", ec.message());
-                    self->interface_->trigger_error("write failure");
+                    self->interface_->trigger_connection_lost("write failure");
                     return;
                 }
 
@@ -300,7 +381,7 @@ void kis_external_ws::write_impl() {
                 if (errc) {
                     self->close();
 
-                    self->interface_->handle_packet(self->in_buf_);
+                    self->interface_->handle_packet(*self->in_buf_);
 
                     _MSG_ERROR("Kismet external interface got an error writing to callback: {}", errc.message());
                     self->interface_->trigger_error("write failure");
@@ -329,14 +410,27 @@ kis_external_interface::kis_external_interface() :
     ping_timer_id{-1},
     io_{nullptr},
     protocol_version{0},
+    inflate_active{false},
+    compress_wire_bytes{0},
+    compress_raw_bytes{0},
+    compress_cpu_usec{0},
+    ipc_shm_size{0},
+    shm_frames{0},
+    shm_bytes{0},
     eventbus{Globalreg::fetch_mandatory_global_as<event_bus>()},
     http_session_id{0} {
 
     ext_mutex.set_name("kis_external_interface");
+
+    // Read buffers are pooled across every external connection
+    Globalreg::enable_pool_type<kis_external_rbuf>([](auto *a) { a->reset(); });
 }
 
 kis_external_interface::~kis_external_interface() {
     close_external();
+
+    if (inflate_active)
+        inflateEnd(&inflate_zs);
 }
 
 bool kis_external_interface::attach_tcp_socket(tcp::socket& socket) {
@@ -392,6 +486,8 @@ void kis_external_interface::close_external_impl() {
 
     timetracker->remove_timer(ping_timer_id);
 
+    close_shm();
+
     if (io_ != nullptr) {
         io_->close();
         io_.reset();
@@ -552,6 +648,12 @@ bool kis_external_interface::run_ipc() {
         return false;
     }
 
+    // The ring is optional, the capture tool falls back to the pipe without it
+    int shm_fd = -1;
+
+    if (ipc_shm_size > 0)
+        shm_fd = open_shm();
+
     // We don't need to do signal masking because we run a dedicated signal handling thread
 
     char **cmdarg;
@@ -563,6 +665,11 @@ bool kis_external_interface::run_ipc() {
         ::close(outpipepair[0]);
         ::close(outpipepair[1]);
 
+        if (shm_fd >= 0) {
+            ::close(shm_fd);
+            close_shm();
+        }
+
         return false;
     } else if (child_pid == 0) {
         // We're the child process
@@ -572,8 +679,8 @@ bool kis_external_interface::run_ipc() {
         sigfillset(&unblock_mask);
         pthread_sigmask(SIG_UNBLOCK, &unblock_mask, nullptr);
 
-        // argv[0], "--in-fd" "--out-fd" ... NULL
-        cmdarg = new char*[external_binary_args.size() + 4];
+        // argv[0], "--in-fd" "--out-fd" ["--shm-fd"] ... NULL
+        cmdarg = new char*[external_binary_args.size() + 5];
         cmdarg[0] = strdup(helper_path.c_str());
 
         // Child reads from inpair
@@ -586,10 +693,18 @@ bool kis_external_interface::run_ipc() {
         argstr = fmt::format("--out-fd={}", outpipepair[1]);
         cmdarg[2] = strdup(argstr.c_str());
 
+        unsigned int argn = 3;
+
+        // The ring is created close-on-exec so that only this tool inherits it
+        if (shm_fd >= 0 && fcntl(shm_fd, F_SETFD, 0) == 0) {
+            argstr = fmt::format("--shm-fd={}", shm_fd);
+            cmdarg[argn++] = strdup(argstr.c_str());
+        }
+
         for (unsigned int x = 0; x < external_binary_args.size(); x++)
-            cmdarg[x+3] = strdup(external_binary_args[x].c_str());
+            cmdarg[argn++] = strdup(external_binary_args[x].c_str());
 
-        cmdarg[external_binary_args.size() + 3] = NULL;
+        cmdarg[argn] = NULL;
 
         // close the unused half of the pairs on the child
         ::close(inpipepair[1]);
@@ -606,6 +721,10 @@ bool kis_external_interface::run_ipc() {
     ::close(inpipepair[0]);
     ::close(outpipepair[1]);
 
+    // The ring stays mapped after the fd is closed
+    if (shm_fd >= 0)
+        ::close(shm_fd);
+
     auto ipc_out = boost::asio::posix::stream_descriptor(Globalreg::globalreg->io, inpipepair[1]);
     auto ipc_in = boost::asio::posix::stream_descriptor(Globalreg::globalreg->io, outpipepair[0]);
 
@@ -626,9 +745,132 @@ bool kis_external_interface::run_ipc() {
     io_ = std::make_shared<kis_external_ipc>(shared_from_this(), ipc, ipc_in, ipc_out);
     io_->start_read();
 
+    if (shm_ring_ != nullptr) {
+        auto ring = shm_ring_;
+        std::weak_ptr<kis_external_interface> weak_self = shared_from_this();
+        std::thread([weak_self, ring]() {
+                thread_set_process_name("ipc_shm");
+                shm_consumer(weak_self, ring);
+            }).detach();
+    }
+
     return true;
 }
 
+int kis_external_interface::open_shm() {
+    close_shm();
+
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    auto page_sz = (size_t) sysconf(_SC_PAGESIZE);
+    auto data_sz = ((ipc_shm_size + page_sz - 1) / page_sz) * page_sz;
+
+    int fd = syscall(SYS_memfd_create, "kismet_ipc_shm", MFD_CLOEXEC);
+
+    if (fd < 0) {
+        _MSG_ERROR("Could not create shared memory for the capture tool, falling back "
+                "to the IPC pipe: {}", kis_strerror_r(errno));
+        return -1;
+    }
+
+    auto ring = std::make_shared<shm_ring>();
+
+    if (ftruncate(fd, page_sz + data_sz) < 0 || kis_external_shm_map(fd, &ring->map) < 0) {
+        _MSG_ERROR("Could not map shared memory for the capture tool, falling back "
+                "to the IPC pipe: {}", kis_strerror_r(errno));
+        ::close(fd);
+        return -1;
+    }
+
+    ring->map.header->signature = KIS_EXTERNAL_SHM_SIG;
+    ring->map.header->version = KIS_EXTERNAL_SHM_VERSION;
+    ring->map.header->data_sz = data_sz;
+    ring->map.header->head = 0;
+    ring->map.header->tail = 0;
+    ring->map.header->doorbell = 0;
+    ring->map.header->consumer_waiting = 0;
+
+    shm_ring_ = ring;
+
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+void kis_external_interface::close_shm() {
+    if (shm_ring_ == nullptr)
+        return;
+
+    // The reader may be the thread closing us, so it is never joined; it drops its 
+    // reference to the ring when it sees the stop
+    shm_ring_->stop = true;
+
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    kis_external_shm_wake(&shm_ring_->map);
+#endif
+
+    shm_ring_.reset();
+}
+
+void kis_external_interface::shm_consumer(std::weak_ptr<kis_external_interface> weak_self,
+        std::shared_ptr<shm_ring> ring) {
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+    auto map = &ring->map;
+    auto header = map->header;
+
+    while (!ring->stop) {
+        uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            auto bell = __atomic_load_n(&header->doorbell, __ATOMIC_RELAXED);
+
+            __atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+            if (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) == tail && !ring->stop)
+                kis_external_shm_wait(map, bell, 500);
+
+            __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        auto self = weak_self.lock();
+
+        if (self == nullptr)
+            break;
+
+        // Frames are parsed in place; the space is only handed back to the capture 
+        // tool once each one has been dispatched
+        while (tail != head && !ring->stop && !self->cancelled) {
+            auto rec = map->data + (tail % map->data_sz);
+            auto len = *((const uint32_t *) rec);
+
+            if (len > KIS_EXTERNAL_SHM_MAX_FRAME || 
+                    kis_external_shm_record_len(len) > head - tail) {
+                ring->stop = true;
+                _MSG_ERROR("Kismet external interface got a corrupt record in the shared "
+                        "memory ring");
+                self->trigger_error("Corrupt shared memory record");
+                break;
+            }
+
+            if (self->handle_external_command(boost::asio::const_buffer(rec + 4, len), len) != 
+                    result_handle_packet_ok) {
+                ring->stop = true;
+                break;
+            }
+
+            self->shm_frames++;
+            self->shm_bytes += len;
+
+            tail += kis_external_shm_record_len(len);
+            __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+#endif
+}
+
 void kis_external_interface::start_write(const char *data, size_t len) {
     if (cancelled)
         return;
@@ -643,6 +885,20 @@ void kis_external_interface::start_write(const char *data, size_t len) {
     io_->write(data, len);
 }
 
+void kis_external_interface::start_write(std::shared_ptr<std::string> buf) {
+    if (cancelled)
+        return;
+
+    if (io_ == nullptr) {
+        throw(std::runtime_error("kis_external tried to write with no io handler"));
+    }
+
+    if (io_->stopped())
+        return;
+
+    io_->write(buf);
+}
+
 unsigned int kis_external_interface::send_packet(std::shared_ptr<KismetExternal::Command> c) {
     if (io_ == nullptr) {
         _MSG_DEBUG("Attempt to send {} on external interface with no IO", c->command());
@@ -727,12 +983,105 @@ bool kis_external_interface::dispatch_rx_packet(const nonstd::string_view& comma
     } else if (command.compare("EVENTBUSPUBLISH") == 0) {
         handle_packet_eventbus_publish(seqno, content);
         return true;
+    } else if (command.compare("KDSCOMPRESSED") == 0) {
+        handle_packet_compressed(seqno, content);
+        return true;
     }
 
     return false;
 
 }
 
+void kis_external_interface::handle_packet_compressed(uint32_t in_seqno,
+        const nonstd::string_view& in_content) {
+    struct timespec cpu_start, cpu_end;
+
+    if (in_content.length() < 1) {
+        trigger_error("Invalid KDSCOMPRESSED");
+        return;
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+    // The capture tool starts a new stream, with the preset dictionary, whenever the
+    // source is opened
+    if (in_content[0] & KIS_EXTERNAL_COMPRESS_FLAG_RESTART) {
+        if (!inflate_active) {
+            memset(&inflate_zs, 0, sizeof(inflate_zs));
+
+            if (inflateInit2(&inflate_zs, KIS_EXTERNAL_COMPRESS_WBITS) != Z_OK) {
+                trigger_error("Unable to initialize decompression");
+                return;
+            }
+
+            inflate_buf.reset(new char[KIS_EXTERNAL_COMPRESS_MAX]);
+            inflate_active = true;
+        } else {
+            inflateReset(&inflate_zs);
+        }
+
+        inflateSetDictionary(&inflate_zs, kis_external_compress_dict,
+                sizeof(kis_external_compress_dict));
+    } else if (!inflate_active) {
+        _MSG_ERROR("Kismet external interface got a compressed frame without the start of "
+                "a compressed stream; something is wrong with the remote capture tool");
+        trigger_error("Invalid KDSCOMPRESSED");
+        return;
+    }
+
+    inflate_zs.next_in = (Bytef *) in_content.data() + 1;
+    inflate_zs.avail_in = in_content.length() - 1;
+    inflate_zs.next_out = (Bytef *) inflate_buf.get();
+    inflate_zs.avail_out = KIS_EXTERNAL_COMPRESS_MAX;
+
+    auto r = inflate(&inflate_zs, Z_SYNC_FLUSH);
+
+    if ((r != Z_OK && r != Z_BUF_ERROR) || inflate_zs.avail_in != 0) {
+        _MSG_ERROR("Kismet external interface could not decompress a frame; something is "
+                "wrong with the remote capture tool");
+        trigger_error("Invalid KDSCOMPRESSED");
+        return;
+    }
+
+    size_t raw_sz = KIS_EXTERNAL_COMPRESS_MAX - inflate_zs.avail_out;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+
+    compress_wire_bytes += in_content.length();
+    compress_raw_bytes += raw_sz;
+    compress_cpu_usec += (cpu_end.tv_sec - cpu_start.tv_sec) * 1000000L +
+        (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000;
+
+    // The inflated content is one complete frame
+    auto frame_v2 = reinterpret_cast<const kismet_external_frame_v2_t *>(inflate_buf.get());
+
+    if (raw_sz < sizeof(kismet_external_frame_v2_t) ||
+            kis_ntoh32(frame_v2->signature) != KIS_EXTERNAL_PROTO_SIG ||
+            kis_ntoh16(frame_v2->v2_sentinel) != KIS_EXTERNAL_V2_SIG ||
+            kis_ntoh16(frame_v2->frame_version) != 0x02 ||
+            kis_ntoh32(frame_v2->data_sz) + sizeof(kismet_external_frame_v2_t) != raw_sz) {
+        _MSG_ERROR("Kismet external interface got an invalid frame inside a compressed frame; "
+                "something is wrong with the remote capture tool");
+        trigger_error("Invalid KDSCOMPRESSED");
+        return;
+    }
+
+    nonstd::string_view command(frame_v2->command, 32);
+
+    auto trim_pos = command.find('\0');
+    if (trim_pos != command.npos)
+        command.remove_suffix(command.size() - trim_pos);
+
+    if (command.compare("KDSCOMPRESSED") == 0) {
+        trigger_error("Invalid KDSCOMPRESSED");
+        return;
+    }
+
+    nonstd::string_view content((const char *) frame_v2->data, kis_ntoh32(frame_v2->data_sz));
+
+    dispatch_rx_packet(command, kis_ntoh32(frame_v2->seqno), content);
+}
+
 void kis_external_interface::handle_packet_message(uint32_t in_seqno, 
         const nonstd::string_view& in_content) {
     KismetExternal::MsgbusMessage m;
@@ -912,9 +1261,11 @@ void kis_external_interface::handle_packet_http_register(uint32_t in_seqno,
 
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
+    bool flow_control = uri.has_flow_control() && uri.flow_control();
+
     httpd->register_route(uri.uri(), {uri.method()}, httpd->LOGON_ROLE,
             std::make_shared<kis_net_web_function_endpoint>(
-                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                [this, flow_control](std::shared_ptr<kis_net_beast_httpd_connection> con) {
                     kis_unique_lock<kis_mutex> l(ext_mutex, std::defer_lock,
                             fmt::format("proxied req {}", con->uri()));
                     l.lock();
@@ -923,6 +1274,9 @@ void kis_external_interface::handle_packet_http_register(uint32_t in_seqno,
                     session->connection = con;
                     session->locker.reset(new conditional_locker<int>());
                     session->locker->lock();
+                    session->flow_control = flow_control;
+                    session->received = 0;
+                    session->allowed = flow_control ? KIS_EXTERNAL_HTTP_WINDOW : 0;
 
                     auto sess_id = http_session_id++;
                     http_proxy_session_map[sess_id] = session;
@@ -932,15 +1286,37 @@ void kis_external_interface::handle_packet_http_register(uint32_t in_seqno,
                         var_remap[v.first] = v.second;
 
                     send_http_request(sess_id, static_cast<std::string>(con->uri()), 
-                            fmt::format("{}", con->verb()), var_remap);
+                            fmt::format("{}", con->verb()), var_remap,
+                            flow_control ? KIS_EXTERNAL_HTTP_WINDOW : 0);
 
                     con->set_closure_cb([session]() { session->locker->unlock(-1); });
 
                     // Unlock the external mutex prior to blocking
                     l.unlock();
 
-                    // Block until we get a response
-                    session->locker->block_until();
+                    if (!flow_control) {
+                        // Block until we get a response
+                        session->locker->block_until();
+                    } else {
+                        // Grant the helper more content as the client drains the response,
+                        // until the response is complete
+                        auto& stream = con->response_stream();
+
+                        while (!session->locker->block_for_ms(std::chrono::milliseconds(0))) {
+                            if (!stream.running())
+                                break;
+
+                            if (stream.size() > KIS_EXTERNAL_HTTP_WINDOW / 2)
+                                stream.wait_drain_for(KIS_EXTERNAL_HTTP_WINDOW / 2,
+                                        std::chrono::milliseconds(100));
+                            else if (session->locker->block_for_ms(std::chrono::milliseconds(100)))
+                                break;
+
+                            l.lock();
+                            send_http_credit(sess_id, session);
+                            l.unlock();
+                        }
+                    }
 
                     // Reacquire the lock on the external interface
                     l.lock();
@@ -997,9 +1373,17 @@ void kis_external_interface::handle_packet_http_response(uint32_t in_seqno,
         return;
     }
 
-    // Copy any response data
+    // Forward the content to the client in the buffer it was parsed into, without
+    // copying it again
     if (resp.has_content() && resp.content().size() > 0) {
-        session->connection->response_stream().put_data(resp.content().data(), resp.content().size());
+        auto content = std::make_shared<std::string>(std::move(*resp.mutable_content()));
+        auto sz = content->size();
+
+        session->received += sz;
+        session->connection->response_stream().put_shared(
+                std::shared_ptr<char>(content, &(*content)[0]), sz);
+
+        send_http_credit(resp.req_id(), session);
     }
 
     // Are we finishing the connection?
@@ -1019,19 +1403,23 @@ void kis_external_interface::handle_packet_http_auth_request(uint32_t in_seqno,
         return;
     }
 
-    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+    auto httpd = Globalreg::fetch_mandatory_global_handle<kis_net_beast_httpd>();
     auto token = httpd->create_or_find_auth("external plugin", httpd->LOGON_ROLE, 0);
 
     send_http_auth(token);
 }
 
 unsigned int kis_external_interface::send_http_request(uint32_t in_http_sequence, std::string in_uri,
-        std::string in_method, std::map<std::string, std::string> in_vardata) {
+        std::string in_method, std::map<std::string, std::string> in_vardata,
+        uint32_t in_window) {
     KismetExternalHttp::HttpRequest r;
     r.set_req_id(in_http_sequence);
     r.set_uri(in_uri);
     r.set_method(in_method);
 
+    if (in_window != 0)
+        r.set_response_window(in_window);
+
     for (auto pi : in_vardata) {
         KismetExternalHttp::SubHttpVariableData *pd = r.add_variable_data();
         pd->set_field(pi.first);
@@ -1050,6 +1438,34 @@ unsigned int kis_external_interface::send_http_request(uint32_t in_http_sequence
     return -1;
 }
 
+void kis_external_interface::send_http_credit(uint32_t in_http_sequence,
+        std::shared_ptr<kis_external_http_session> in_session) {
+    if (!in_session->flow_control)
+        return;
+
+    auto buffered = in_session->connection->response_stream().size();
+    auto consumed = in_session->received > buffered ? in_session->received - buffered : 0;
+    auto allow = consumed + KIS_EXTERNAL_HTTP_WINDOW;
+
+    if (allow < in_session->allowed + KIS_EXTERNAL_HTTP_WINDOW / 2)
+        return;
+
+    KismetExternalHttp::HttpResponseCredit c;
+    c.set_req_id(in_http_sequence);
+    c.set_bytes(allow - in_session->allowed);
+
+    in_session->allowed = allow;
+
+    if (protocol_version == 0) {
+        std::shared_ptr<KismetExternal::Command> cmd(new KismetExternal::Command());
+        cmd->set_command("HTTPRESPONSECREDIT");
+        cmd->set_content(c.SerializeAsString());
+        send_packet(cmd);
+    } else if (protocol_version == 2) {
+        send_packet_v2("HTTPRESPONSECREDIT", 0, c);
+    }
+}
+
 unsigned int kis_external_interface::send_http_auth(std::string in_cookie) {
     std::shared_ptr<KismetExternal::Command> c(new KismetExternal::Command());
 
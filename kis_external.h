@@ -34,12 +34,14 @@
 
 #include <functional>
 #include <list>
+#include <zlib.h>
 
 #include "endian_magic.h"
 #include "eventbus.h"
 #include "globalregistry.h"
 #include "ipctracker_v2.h"
 #include "kis_external_packet.h"
+#include "kis_external_shm.h"
 #include "kis_net_beast_httpd.h"
 
 #include "boost/asio.hpp"
@@ -60,10 +62,73 @@ namespace KismetExternal {
 struct kis_external_http_session {
     std::shared_ptr<kis_net_beast_httpd_connection> connection;
     std::shared_ptr<conditional_locker<int> > locker;
+
+    // Response flow control, for URIs the helper registered with it: bytes of content
+    // received, and the total the helper has been allowed to send so far
+    bool flow_control;
+    uint64_t received;
+    uint64_t allowed;
 };
 
+// Response content a helper may have outstanding, sent to the client or not, on a
+// flow controlled request; credits are sent as the client takes at least half of it
+#define KIS_EXTERNAL_HTTP_WINDOW    (1024 * 1024)
+
 class kis_external_interface;
 
+// Size of the read buffer of each external connection; always larger than the largest
+// frame plus a full read
+#define KIS_EXTERNAL_RBUF_SIZE      (64 * 1024)
+
+// Read buffer for external connections.
+//
+// Where possible (Linux memfd) the buffer is mapped twice, back to back, so the unread
+// data is always one contiguous view no matter where in the ring it starts; frames are
+// parsed in place and consumed without moving the remaining data down.  Elsewhere the
+// buffer is linear and any partial frame is moved to the front before the next read.
+//
+// Buffers are pooled, so connections coming and going re-use the mappings.
+class kis_external_rbuf {
+public:
+    kis_external_rbuf();
+    ~kis_external_rbuf();
+
+    void reset() {
+        read_pos_ = write_pos_ = 0;
+    }
+
+    size_t size() const {
+        return write_pos_ - read_pos_;
+    }
+
+    // Unread data
+    boost::asio::const_buffer data() const {
+        return boost::asio::const_buffer(buf_ + (read_pos_ % sz_), size());
+    }
+
+    // All the free space, to read into
+    boost::asio::mutable_buffer prepare();
+
+    void commit(size_t n) {
+        write_pos_ += std::min(n, sz_ - size());
+    }
+
+    void consume(size_t n) {
+        read_pos_ += std::min(n, size());
+
+        if (read_pos_ == write_pos_)
+            reset();
+    }
+
+protected:
+    uint8_t *buf_;
+    size_t sz_;
+    bool mirrored_;
+
+    // Positions only grow until the buffer empties
+    size_t read_pos_, write_pos_;
+};
+
 class kis_external_io : public std::enable_shared_from_this<kis_external_io> {
 public:
     template <class d>
@@ -74,7 +139,8 @@ public:
     kis_external_io(std::shared_ptr<kis_external_interface> ext) :
         stopped_{false},
         interface_{ext},
-        strand_{Globalreg::globalreg->io} { }
+        strand_{Globalreg::globalreg->io},
+        in_buf_{Globalreg::new_from_pool<kis_external_rbuf>()} { }
     
     virtual ~kis_external_io() {
         close();
@@ -90,11 +156,15 @@ public:
     virtual void start_read() = 0;
 
     virtual void write(const char *data, size_t len) {
+        write(std::make_shared<std::string>(data, len));
+    }
+
+    // Queue an already framed buffer; everything queued while a write is in flight goes
+    // out in the next single gathered write
+    virtual void write(std::shared_ptr<std::string> buf) {
         if (stopped_)
             return;
 
-        auto buf = std::make_shared<std::string>(data, len);
-
         boost::asio::post(strand(), 
                 [self = shared_from_this(), buf]() mutable {
 
@@ -131,10 +201,17 @@ public:
     std::shared_ptr<kis_external_interface> interface_;
     boost::asio::io_service::strand strand_;
 
-    boost::asio::streambuf in_buf_;
+    std::shared_ptr<kis_external_rbuf> in_buf_;
     std::list<std::shared_ptr<std::string>> out_bufs_;
+
+protected:
+    // Gather up to KIS_EXTERNAL_IO_MAX_GATHER queued buffers into one write, returning
+    // how many were taken
+    size_t gather_write(std::vector<boost::asio::const_buffer>& seq);
 };
 
+#define KIS_EXTERNAL_IO_MAX_GATHER  64
+
 class kis_external_ipc : public kis_external_io {
 public:
     kis_external_ipc(std::shared_ptr<kis_external_interface> iface,
@@ -273,6 +350,12 @@ public:
     // Trigger an error
     virtual void trigger_error(const std::string& in_error);
 
+    // Trigger an error because the connection to the remote side was lost; interfaces
+    // which can be resumed on a new connection override this
+    virtual void trigger_connection_lost(const std::string& in_error) {
+        trigger_error(in_error);
+    }
+
     // Get the IO handler
     virtual std::shared_ptr<kis_external_io> move_io(std::shared_ptr<kis_external_interface> newif) {
         auto io_ref = io_;
@@ -318,8 +401,9 @@ protected:
 
         ssize_t frame_sz = sizeof(kismet_external_frame_v2_t) + content_sz;
 
-        char frame_buf[frame_sz];
-        auto frame = reinterpret_cast<kismet_external_frame_v2_t *>(frame_buf);
+        // Frame directly into the buffer which gets queued for writing
+        auto frame_buf = std::make_shared<std::string>(frame_sz, '\0');
+        auto frame = reinterpret_cast<kismet_external_frame_v2_t *>(&(*frame_buf)[0]);
 
         frame->signature = kis_hton32(KIS_EXTERNAL_PROTO_SIG);
         frame->data_sz = kis_hton32(content_sz);
@@ -330,7 +414,7 @@ protected:
 
         content.SerializeToArray(frame->data, content_sz);
 
-        start_write(frame_buf, frame_sz);
+        start_write(frame_buf);
 
         return in_seqno;
     }
@@ -349,6 +433,7 @@ protected:
     virtual void handle_packet_shutdown(uint32_t in_seqno, const nonstd::string_view& in_content);
     virtual void handle_packet_eventbus_register(uint32_t in_seqno, const nonstd::string_view& in_content);
     virtual void handle_packet_eventbus_publish(uint32_t in_seqno, const nonstd::string_view& in_content);
+    virtual void handle_packet_compressed(uint32_t in_seqno, const nonstd::string_view& in_content);
 
     unsigned int send_ping();
     unsigned int send_pong(uint32_t ping_seqno);
@@ -367,6 +452,7 @@ protected:
     int ping_timer_id;
 
     void start_write(const char *data, size_t len);
+    void start_write(std::shared_ptr<std::string> buf);
 
     std::shared_ptr<kis_external_io> io_;
 
@@ -379,6 +465,49 @@ protected:
 
     std::atomic<unsigned int> protocol_version;
 
+    // Inflate stream for KDSCOMPRESSED frames; only touched by the IO strand
+    z_stream inflate_zs;
+    bool inflate_active;
+    std::unique_ptr<char[]> inflate_buf;
+
+    // Compressed content received, what it inflated to, and the CPU time spent
+    // inflating it
+    std::atomic<uint64_t> compress_wire_bytes;
+    std::atomic<uint64_t> compress_raw_bytes;
+    std::atomic<uint64_t> compress_cpu_usec;
+
+    // Shared memory ring for data reports from a local capture tool; the ring is 
+    // created by run_ipc when ipc_shm_size is set, and is owned jointly with the 
+    // thread reading it, so that it stays mapped until the thread notices it has been
+    // closed
+    struct shm_ring {
+        shm_ring() :
+            map{nullptr, nullptr, 0, 0},
+            stop{false} { }
+
+        ~shm_ring() {
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+            kis_external_shm_unmap(&map);
+#endif
+        }
+
+        kis_external_shm_map_t map;
+        std::atomic<bool> stop;
+    };
+
+    size_t ipc_shm_size;
+    std::shared_ptr<shm_ring> shm_ring_;
+
+    // Frames and bytes read from the ring
+    std::atomic<uint64_t> shm_frames;
+    std::atomic<uint64_t> shm_bytes;
+
+    // Create the ring, returning the fd to pass to the capture tool or -1
+    int open_shm();
+    void close_shm();
+    static void shm_consumer(std::weak_ptr<kis_external_interface> weak_self,
+            std::shared_ptr<shm_ring> ring);
+
     // Eventbus proxy code
     std::shared_ptr<event_bus> eventbus;
     std::map<std::string, unsigned long> eventbus_callback_map;
@@ -393,9 +522,15 @@ protected:
     virtual void handle_packet_http_auth_request(uint32_t in_seqno, const nonstd::string_view& in_content);
 
     unsigned int send_http_request(uint32_t in_http_sequence, std::string in_uri,
-            std::string in_method, std::map<std::string, std::string> in_postdata);
+            std::string in_method, std::map<std::string, std::string> in_postdata,
+            uint32_t in_window = 0);
     unsigned int send_http_auth(std::string in_session);
 
+    // Allow a flow controlled helper to send more content once the client has consumed
+    // enough of what it sent; must be called with ext_mutex held
+    void send_http_credit(uint32_t in_http_sequence,
+            std::shared_ptr<kis_external_http_session> in_session);
+
     // HTTP session identities for multi-packet responses
     uint32_t http_session_id;
     std::map<uint32_t, std::shared_ptr<kis_external_http_session> > http_proxy_session_map;
@@ -474,6 +609,11 @@ public:
                 dispatch_rx_packet(command, seqno, content);
 
                 buffer.consume(frame_sz);
+
+                // The command handed our io to another interface, which picks up the
+                // rest of the buffer
+                if (io_ == nullptr)
+                    return result_handle_packet_ok;
             } else {
                 // Check the length
                 data_sz = kis_ntoh32(frame->data_sz);
@@ -522,6 +662,9 @@ public:
                 delete(ai);
 
                 buffer.consume(frame_sz);
+
+                if (io_ == nullptr)
+                    return result_handle_packet_ok;
             }
         }
 
@@ -0,0 +1,95 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_EXTERNAL_COMPRESS_H__
+#define __KIS_EXTERNAL_COMPRESS_H__
+
+/* Compressed data reports in the external capture protocol, shared by the capture
+ * framework and Kismet.
+ *
+ * When Kismet asks for compression in the OpenSource command, a capture tool sends
+ * its data reports as KDSCOMPRESSED frames.  The content of each frame is one byte of
+ * flags followed by the next part of a raw deflate stream, sync flushed at the end of
+ * the frame; it inflates to one complete v2 frame, header and all, no larger than any
+ * other frame may be.  Because the stream keeps its history, each frame is compressed
+ * against the packets before it and not just against itself.
+ *
+ * The capture tool starts a new stream whenever the source is opened, and marks the
+ * first frame of it with KIS_EXTERNAL_COMPRESS_FLAG_RESTART so that both ends agree
+ * on where it begins.  Every stream starts with the preset dictionary below so that
+ * the first packets compress too; it holds the frame headers and the 802.11 content
+ * which make up most of a capture.  The dictionary is part of the protocol: changing
+ * it needs a new KIS_EXTERNAL_COMPRESS_VERSION.
+ */
+
+/* Version of the compressed stream, sent by Kismet in the OpenSource command; a
+ * capture tool only compresses when it knows the same version */
+#define KIS_EXTERNAL_COMPRESS_VERSION   1
+
+#define KIS_EXTERNAL_COMPRESS_LEVEL     6
+/* Raw deflate, with a 32k window */
+#define KIS_EXTERNAL_COMPRESS_WBITS     -15
+
+/* Frames inflate to less than this, the same limit Kismet puts on every frame */
+#define KIS_EXTERNAL_COMPRESS_MAX       16384
+
+#define KIS_EXTERNAL_COMPRESS_FLAG_RESTART  0x01
+
+/* Most common content last, where deflate finds it with the shortest distance */
+static const unsigned char kis_external_compress_dict[] = {
+    /* 802.11 data frames, LLC/SNAP for IPv4, ARP and EAPOL */
+    0x88, 0x41, 0x00, 0x00, 0x08, 0x42, 0x00, 0x00, 0xaa, 0xaa, 0x03, 0x00,
+    0x00, 0x00, 0x08, 0x00, 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x08, 0x06,
+    0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8e,
+    /* Probe requests and responses */
+    0x40, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x50, 0x00,
+    0x00, 0x00,
+    /* Vendor IEs: WPS, WMM, Wi-Fi Alliance */
+    0xdd, 0x0e, 0x00, 0x50, 0xf2, 0x04, 0x10, 0x4a, 0x00, 0x01, 0x10, 0x10,
+    0x44, 0x00, 0x01, 0x02, 0xdd, 0x18, 0x00, 0x50, 0xf2, 0x02, 0x01, 0x01,
+    0xdd, 0x0a, 0x50, 0x6f, 0x9a,
+    /* HT capabilities and HT operation */
+    0x2d, 0x1a, 0xef, 0x19, 0x17, 0xff, 0xff, 0x00, 0x00, 0x3d, 0x16,
+    /* RSN, CCMP with PSK */
+    0x30, 0x14, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f,
+    0xac, 0x04, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x02, 0x0c, 0x00,
+    /* Supported rates, DS parameter, TIM, ERP, extended rates */
+    0x01, 0x08, 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24, 0x01, 0x08,
+    0x8c, 0x12, 0x98, 0x24, 0xb0, 0x48, 0x60, 0x6c, 0x03, 0x01, 0x06, 0x05,
+    0x04, 0x00, 0x01, 0x00, 0x00, 0x2a, 0x01, 0x00, 0x32, 0x04, 0x30, 0x48,
+    0x60, 0x6c,
+    /* Beacon header, broadcast, interval and capabilities */
+    0x80, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x64, 0x00,
+    0x11, 0x04, 0x64, 0x00, 0x31, 0x04, 0x64, 0x00, 0x11, 0x05,
+    /* Radiotap headers from common Linux drivers */
+    0x00, 0x00, 0x24, 0x00, 0x2f, 0x40, 0x00, 0xa0, 0x20, 0x08, 0x00, 0xa0,
+    0x20, 0x08, 0x00, 0x00, 0x00, 0x00, 0x12, 0x00, 0x2e, 0x48, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    /* DataReport packet and signal: dlt 127, size, data; signal dbm, freq, channel */
+    0x18, 0x7f, 0x20, 0x2a, 0x22, 0x09, 0x29, 0x00, 0x00, 0x00, 0x32,
+    /* v2 frame header and data report commands */
+    0xde, 0xca, 0xfb, 0xad, 0xab, 0xcd, 0x00, 0x02, 0x4b, 0x44, 0x53, 0x44,
+    0x41, 0x54, 0x41, 0x52, 0x45, 0x50, 0x4f, 0x52, 0x54, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xde, 0xca, 0xfb, 0xad, 0xab, 0xcd, 0x00, 0x02,
+    0x4b, 0x44, 0x53, 0x44, 0x41, 0x54, 0x41, 0x52, 0x45, 0x50, 0x4f, 0x52,
+    0x54, 0x42, 0x41, 0x54, 0x43, 0x48, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+#endif
@@ -0,0 +1,202 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_EXTERNAL_SHM_H__
+#define __KIS_EXTERNAL_SHM_H__
+
+/* Shared memory transport for data reports from local capture tools, shared by the
+ * capture framework and Kismet.
+ *
+ * When Kismet launches a capture tool it may create a memfd ring and pass it to the
+ * tool as --shm-fd=N.  If Kismet also asks for it in the OpenSource command, the tool
+ * writes its KDSDATAREPORT and KDSDATAREPORTBATCH frames into the ring instead of the
+ * pipe; every other command still goes over the pipe.  Kismet parses the frames in
+ * place in the shared memory, so packets skip the pipe copies entirely.
+ *
+ * The memfd holds one page of kis_external_shm_header_t followed by the data area,
+ * which is a whole number of pages.  Both ends map the data area twice, back to back,
+ * so a record which runs off the end of the ring is still contiguous in memory.
+ *
+ * Each record is a 32 bit length in host order, followed by one complete v2 frame of
+ * that length, padded out to KIS_EXTERNAL_SHM_ALIGN.  head and tail are positions in
+ * bytes which only ever grow; the capture tool owns head and Kismet owns tail.  When
+ * Kismet runs out of records it sets consumer_waiting and sleeps on the doorbell
+ * futex, and the capture tool rings the doorbell after publishing a record if it
+ * sees Kismet waiting.
+ *
+ * If the ring is full the capture tool sends the frame over the pipe instead, so
+ * nothing is lost, but frames may then arrive out of order.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Version of the ring, sent by Kismet in the OpenSource command; a capture tool only
+ * uses the ring when it knows the same version */
+#define KIS_EXTERNAL_SHM_VERSION    1
+
+#define KIS_EXTERNAL_SHM_SIG        0x4B534852
+
+/* Size of the data area Kismet creates */
+#define KIS_EXTERNAL_SHM_SIZE       (4 * 1024 * 1024)
+
+#define KIS_EXTERNAL_SHM_ALIGN      8
+
+/* Records are never larger than any other frame may be */
+#define KIS_EXTERNAL_SHM_MAX_FRAME  16384
+
+typedef struct {
+    uint32_t signature;
+    uint32_t version;
+    uint64_t data_sz;
+
+    /* Written by the capture tool */
+    uint64_t head __attribute__((aligned(64)));
+    uint32_t doorbell;
+
+    /* Written by Kismet */
+    uint64_t tail __attribute__((aligned(64)));
+    uint32_t consumer_waiting;
+} kis_external_shm_header_t;
+
+typedef struct {
+    kis_external_shm_header_t *header;
+    uint8_t *data;
+    size_t data_sz;
+    size_t page_sz;
+} kis_external_shm_map_t;
+
+#define kis_external_shm_record_len(l) \
+    ((4 + (l) + KIS_EXTERNAL_SHM_ALIGN - 1) & ~((size_t) KIS_EXTERNAL_SHM_ALIGN - 1))
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_memfd_create) && defined(SYS_futex)
+#define KIS_EXTERNAL_SHM_SUPPORTED  1
+#endif
+#endif
+
+#ifdef KIS_EXTERNAL_SHM_SUPPORTED
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC                 0x0001U
+#endif
+
+/* Map a ring; the data size is taken from the size of the memfd.  Returns 0 on
+ * success */
+static inline int kis_external_shm_map(int fd, kis_external_shm_map_t *map) {
+    struct stat st;
+    uint8_t *base;
+
+    map->page_sz = (size_t) sysconf(_SC_PAGESIZE);
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size <= map->page_sz ||
+            ((size_t) st.st_size % map->page_sz) != 0)
+        return -1;
+
+    map->data_sz = (size_t) st.st_size - map->page_sz;
+
+    /* Reserve the whole range, then map the header and both copies of the data
+     * over it */
+    base = (uint8_t *) mmap(NULL, map->page_sz + map->data_sz * 2, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED)
+        return -1;
+
+    if (mmap(base, map->page_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                fd, 0) == MAP_FAILED ||
+            mmap(base + map->page_sz, map->data_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, map->page_sz) == MAP_FAILED ||
+            mmap(base + map->page_sz + map->data_sz, map->data_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, map->page_sz) == MAP_FAILED) {
+        munmap(base, map->page_sz + map->data_sz * 2);
+        return -1;
+    }
+
+    map->header = (kis_external_shm_header_t *) base;
+    map->data = base + map->page_sz;
+
+    return 0;
+}
+
+static inline void kis_external_shm_unmap(kis_external_shm_map_t *map) {
+    if (map->header == NULL)
+        return;
+
+    munmap(map->header, map->page_sz + map->data_sz * 2);
+    map->header = NULL;
+    map->data = NULL;
+}
+
+static inline void kis_external_shm_wake(kis_external_shm_map_t *map) {
+    __atomic_add_fetch(&map->header->doorbell, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &map->header->doorbell, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Sleep until the doorbell moves on from in_bell or the timeout passes */
+static inline void kis_external_shm_wait(kis_external_shm_map_t *map, uint32_t in_bell,
+        unsigned int in_timeout_ms) {
+    struct timespec ts;
+
+    ts.tv_sec = in_timeout_ms / 1000;
+    ts.tv_nsec = (in_timeout_ms % 1000) * 1000000L;
+
+    syscall(SYS_futex, &map->header->doorbell, FUTEX_WAIT, in_bell, &ts, NULL, 0);
+}
+
+/* Find room for a record with a frame of in_len bytes; returns where to write the
+ * frame, or NULL if the ring is full.  The record is published by commit. */
+static inline uint8_t *kis_external_shm_reserve(kis_external_shm_map_t *map, size_t in_len) {
+    uint64_t head = __atomic_load_n(&map->header->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&map->header->tail, __ATOMIC_ACQUIRE);
+    uint8_t *rec;
+
+    if (in_len > KIS_EXTERNAL_SHM_MAX_FRAME ||
+            map->data_sz - (head - tail) < kis_external_shm_record_len(in_len))
+        return NULL;
+
+    rec = map->data + (head % map->data_sz);
+    *((uint32_t *) rec) = (uint32_t) in_len;
+
+    return rec + 4;
+}
+
+static inline void kis_external_shm_commit(kis_external_shm_map_t *map, size_t in_len) {
+    uint64_t head = __atomic_load_n(&map->header->head, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&map->header->head, head + kis_external_shm_record_len(in_len),
+            __ATOMIC_RELEASE);
+
+    /* Pairs with the consumer setting consumer_waiting before its last look at head */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&map->header->consumer_waiting, __ATOMIC_RELAXED))
+        kis_external_shm_wake(map);
+}
+
+#endif
+
+#endif
+
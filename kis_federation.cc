@@ -0,0 +1,666 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <limits>
+#include <stdexcept>
+
+#include "boost/asio.hpp"
+#include "boost/beast.hpp"
+
+#include "configfile.h"
+#include "fmt.h"
+#include "kis_federation.h"
+#include "messagebus.h"
+#include "util.h"
+
+// A keep-alive connection to a peer, owned by the thread polling it
+struct federation_connection {
+    federation_connection() :
+        resolver{ioc},
+        stream{ioc},
+        connected{false} { }
+
+    ~federation_connection() {
+        close();
+    }
+
+    void close() {
+        if (connected) {
+            boost::system::error_code ec;
+            stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            stream.close();
+        }
+
+        connected = false;
+    }
+
+    boost::asio::io_context ioc;
+    boost::asio::ip::tcp::resolver resolver;
+    boost::beast::tcp_stream stream;
+    bool connected;
+};
+
+namespace {
+    // Peer responses are unpacked into the JSON the peer would have sent: the msgpack
+    // serializer keys int and double maps by number and sends byte arrays raw, where
+    // the JSON serializer writes string keys and hex
+    class msgpack_reader {
+    public:
+        msgpack_reader(const std::string& in_data) :
+            pos{reinterpret_cast<const uint8_t *>(in_data.data())},
+            end{reinterpret_cast<const uint8_t *>(in_data.data()) + in_data.length()} { }
+
+        nlohmann::json read() {
+            auto b = get<uint8_t>();
+
+            if (b <= 0x7f)
+                return b;
+            if (b >= 0xe0)
+                return (int8_t) b;
+            if ((b & 0xf0) == 0x80)
+                return read_map(b & 0x0f);
+            if ((b & 0xf0) == 0x90)
+                return read_array(b & 0x0f);
+            if ((b & 0xe0) == 0xa0)
+                return read_str(b & 0x1f);
+
+            switch (b) {
+                case 0xc0: return nullptr;
+                case 0xc2: return false;
+                case 0xc3: return true;
+                case 0xc4: return read_bin(get<uint8_t>());
+                case 0xc5: return read_bin(get<uint16_t>());
+                case 0xc6: return read_bin(get<uint32_t>());
+                case 0xca: return get<float>();
+                case 0xcb: return get<double>();
+                case 0xcc: return get<uint8_t>();
+                case 0xcd: return get<uint16_t>();
+                case 0xce: return get<uint32_t>();
+                case 0xcf: return get<uint64_t>();
+                case 0xd0: return get<int8_t>();
+                case 0xd1: return get<int16_t>();
+                case 0xd2: return get<int32_t>();
+                case 0xd3: return get<int64_t>();
+                case 0xd9: return read_str(get<uint8_t>());
+                case 0xda: return read_str(get<uint16_t>());
+                case 0xdb: return read_str(get<uint32_t>());
+                case 0xdc: return read_array(get<uint16_t>());
+                case 0xdd: return read_array(get<uint32_t>());
+                case 0xde: return read_map(get<uint16_t>());
+                case 0xdf: return read_map(get<uint32_t>());
+            }
+
+            throw std::runtime_error(fmt::format("unsupported msgpack type {:#x}", b));
+        }
+
+    protected:
+        void need(size_t n) {
+            if ((size_t) (end - pos) < n)
+                throw std::runtime_error("truncated msgpack");
+        }
+
+        // Big-endian scalar
+        template<typename T>
+        T get() {
+            need(sizeof(T));
+
+            uint8_t raw[sizeof(T)];
+            for (size_t i = 0; i < sizeof(T); i++)
+                raw[i] = pos[sizeof(T) - 1 - i];
+            pos += sizeof(T);
+
+            T v;
+            memcpy(&v, raw, sizeof(T));
+            return v;
+        }
+
+        std::string read_str(size_t n) {
+            need(n);
+            std::string s(reinterpret_cast<const char *>(pos), n);
+            pos += n;
+            return s;
+        }
+
+        std::string read_bin(size_t n) {
+            static const char hex[] = "0123456789abcdef";
+
+            need(n);
+
+            std::string s;
+            s.reserve(n * 2);
+
+            for (size_t i = 0; i < n; i++) {
+                s.push_back(hex[pos[i] >> 4]);
+                s.push_back(hex[pos[i] & 0x0f]);
+            }
+
+            pos += n;
+            return s;
+        }
+
+        nlohmann::json read_array(size_t n) {
+            auto a = nlohmann::json::array();
+
+            for (size_t i = 0; i < n; i++)
+                a.push_back(read());
+
+            return a;
+        }
+
+        nlohmann::json read_map(size_t n) {
+            auto m = nlohmann::json::object();
+
+            for (size_t i = 0; i < n; i++) {
+                auto k = read();
+                auto key = k.is_string() ? k.get<std::string>() : k.dump();
+                m[key] = read();
+            }
+
+            return m;
+        }
+
+        const uint8_t *pos;
+        const uint8_t *end;
+    };
+}
+
+kis_federation::kis_federation() :
+    lifetime_global(),
+    deferred_startup(),
+    stopping{false},
+    last_expire{0} {
+
+    auto config = Globalreg::globalreg->kismet_config;
+
+    poll_rate = std::max(1U, config->fetch_opt_uint("federation_rate", 2));
+    device_timeout = config->fetch_opt_uint("federation_device_timeout",
+            config->fetch_opt_uint("tracker_device_timeout", 0));
+    alert_backlog = config->fetch_opt_uint("federation_alert_backlog", 1000);
+
+    for (const auto& p : config->fetch_opt_vec("federation_peer")) {
+        auto peer = std::make_unique<federation_peer>();
+
+        if (!parse_peer(p, *peer)) {
+            _MSG_ERROR("Skipping invalid federation_peer '{}', expected "
+                    "name:url=http://host:port,apikey=...", p);
+            continue;
+        }
+
+        peers.push_back(std::move(peer));
+    }
+
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/federation/devices", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    devices_endp(con);
+                }));
+
+    httpd->register_route("/federation/alerts", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    alerts_endp(con);
+                }));
+
+    httpd->register_route("/federation/peers", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    peers_endp(con);
+                }));
+}
+
+kis_federation::~kis_federation() {
+    trigger_deferred_shutdown();
+
+    Globalreg::globalreg->remove_global(global_name());
+}
+
+void kis_federation::trigger_deferred_startup() {
+    if (peers.size() == 0)
+        return;
+
+    _MSG_INFO("Federating devices and alerts from {} Kismet servers every {} seconds",
+            peers.size(), poll_rate);
+
+    for (auto& p : peers) {
+        auto peer = p.get();
+        peer->thread = std::thread([this, peer]() {
+                thread_set_process_name("federation");
+                peer_thread(peer);
+            });
+    }
+}
+
+void kis_federation::trigger_deferred_shutdown() {
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        stopping = true;
+    }
+
+    stop_cond.notify_all();
+
+    for (auto& p : peers) {
+        if (p->thread.joinable())
+            p->thread.join();
+    }
+}
+
+bool kis_federation::parse_peer(const std::string& in_definition, federation_peer& peer) {
+    auto cpos = in_definition.find(':');
+
+    if (cpos == std::string::npos || cpos == 0)
+        return false;
+
+    peer.name = in_definition.substr(0, cpos);
+
+    std::vector<opt_pair> optvec;
+
+    if (string_to_opts(in_definition.substr(cpos + 1), ",", &optvec) < 0)
+        return false;
+
+    std::map<std::string, std::string> opts;
+    for (const auto& o : optvec)
+        opts[str_lower(o.opt)] = o.val;
+
+    auto url = fetch_opt("url", opts);
+    peer.api_key = fetch_opt("apikey", opts);
+
+    if (url.find("http://") == 0)
+        url = url.substr(7);
+    else if (url.find("://") != std::string::npos)
+        return false;
+
+    // Peers are polled from the root of the server
+    auto spos = url.find('/');
+    if (spos != std::string::npos)
+        url = url.substr(0, spos);
+
+    auto ppos = url.rfind(':');
+
+    if (ppos == std::string::npos) {
+        peer.host = url;
+        peer.port = "2501";
+    } else {
+        peer.host = url.substr(0, ppos);
+        peer.port = url.substr(ppos + 1);
+    }
+
+    return peer.host.length() != 0 && peer.port.length() != 0;
+}
+
+void kis_federation::peer_thread(federation_peer *peer) {
+    federation_connection conn;
+
+    while (true) {
+        try {
+            poll_devices(peer, conn);
+            poll_alerts(peer, conn);
+
+            if (!peer->connected)
+                _MSG_INFO("Federating devices from Kismet server {} ({}:{})", peer->name,
+                        peer->host, peer->port);
+
+            peer->connected = true;
+            peer->polls++;
+            peer->last_poll = time(0);
+        } catch (const std::exception& e) {
+            conn.close();
+
+            peer->errors++;
+
+            if (peer->connected)
+                _MSG_ERROR("Lost federated Kismet server {} ({}:{}): {}", peer->name,
+                        peer->host, peer->port, e.what());
+
+            peer->connected = false;
+
+            std::lock_guard<std::mutex> lk(mutex);
+            peer->last_error = e.what();
+        }
+
+        std::unique_lock<std::mutex> lk(mutex);
+
+        if (stop_cond.wait_for(lk, std::chrono::seconds(poll_rate), [this]() { return stopping; }))
+            return;
+    }
+}
+
+nlohmann::json kis_federation::peer_fetch(federation_peer *peer, federation_connection& conn,
+        const std::string& in_path) {
+    namespace http = boost::beast::http;
+
+    http::response<http::string_body> res;
+
+    try {
+        if (!conn.connected) {
+            auto endpoints = conn.resolver.resolve(peer->host, peer->port);
+            conn.stream.expires_after(std::chrono::seconds(30));
+            conn.stream.connect(endpoints);
+            conn.connected = true;
+        }
+
+        http::request<http::string_body> req{http::verb::get, in_path, 11};
+        req.set(http::field::host, peer->host);
+        req.set(http::field::user_agent, "Kismet");
+        req.keep_alive(true);
+
+        if (peer->api_key.length() > 0)
+            req.set(http::field::cookie, fmt::format("KISMET={}", peer->api_key));
+
+        conn.stream.expires_after(std::chrono::seconds(30));
+        http::write(conn.stream, req);
+
+        // The first poll of a large peer carries every device
+        boost::beast::flat_buffer buffer;
+        http::response_parser<http::string_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+
+        http::read(conn.stream, buffer, parser);
+
+        res = parser.release();
+
+        if (!res.keep_alive())
+            conn.close();
+    } catch (const boost::system::system_error& e) {
+        throw std::runtime_error(e.what());
+    }
+
+    if (res.result_int() != 200)
+        throw std::runtime_error(fmt::format("{} returned {}", in_path, res.result_int()));
+
+    peer->bytes += res.body().length();
+
+    try {
+        return msgpack_reader(res.body()).read();
+    } catch (const std::exception& e) {
+        throw std::runtime_error(fmt::format("invalid response to {}: {}", in_path, e.what()));
+    }
+}
+
+void kis_federation::poll_devices(federation_peer *peer, federation_connection& conn) {
+    auto response =
+        peer_fetch(peer, conn, fmt::format("/devices/modified-since/{}/devices.msgpack",
+                    peer->generation));
+
+    uint64_t generation = response.value("kismet.devicelist.generation", (uint64_t) 0);
+
+    // A restarted peer counts generations from the start again, and everything it
+    // tracks is new
+    if (generation < peer->generation) {
+        peer->generation = 0;
+        peer->device_ids.clear();
+        poll_devices(peer, conn);
+        return;
+    }
+
+    peer->generation = generation;
+
+    auto devs = response.find("kismet.devicelist.devices");
+
+    if (devs == response.end() || !devs->is_array())
+        return;
+
+    std::vector<std::string> refetch;
+
+    for (auto& d : *devs) {
+        if (!merge_device(peer, d))
+            refetch.push_back(d.value("kismet.device.base.key", ""));
+    }
+
+    // Changes to devices which expired here while they were idle on the peer
+    for (const auto& k : refetch) {
+        auto full = peer_fetch(peer, conn, fmt::format("/devices/by-key/{}/device.msgpack", k));
+        merge_device(peer, full);
+    }
+
+    peer->devices = peer->device_ids.size();
+
+    expire_devices();
+}
+
+void kis_federation::poll_alerts(federation_peer *peer, federation_connection& conn) {
+    auto response =
+        peer_fetch(peer, conn, fmt::format("/alerts/wrapped/last-time/{:.6f}/alerts.msgpack",
+                    peer->alert_time));
+
+    // Alert times are taken from the clock of the peer
+    peer->alert_time = response.value("kismet.alert.timestamp", peer->alert_time);
+
+    auto list = response.find("kismet.alert.list");
+
+    if (list == response.end() || !list->is_array() || list->size() == 0)
+        return;
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    for (auto& a : *list) {
+        a["kismet.federation.peer"] = peer->name;
+        alerts.push_back(std::move(a));
+    }
+
+    while (alerts.size() > alert_backlog)
+        alerts.pop_front();
+}
+
+bool kis_federation::merge_device(federation_peer *peer, nlohmann::json& in_record) {
+    if (!in_record.is_object())
+        return true;
+
+    auto key = in_record.value("kismet.device.base.key", "");
+
+    if (key.length() == 0)
+        return true;
+
+    std::string id;
+
+    auto ki = peer->device_ids.find(key);
+
+    if (ki == peer->device_ids.end()) {
+        // Devices are merged across peers by phy and MAC, the keys of a device differ
+        // between servers
+        auto phy = in_record.value("kismet.device.base.phyname", "");
+        auto mac = in_record.value("kismet.device.base.macaddr", "");
+
+        if (phy.length() == 0 || mac.length() == 0)
+            return true;
+
+        id = phy + "/" + str_upper(mac);
+        peer->device_ids[key] = id;
+    } else {
+        id = ki->second;
+    }
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    auto& dev = devices[id];
+
+    auto ri = std::find_if(dev.records.begin(), dev.records.end(),
+            [peer](const std::pair<federation_peer *, nlohmann::json>& r) { return r.first == peer; });
+
+    if (ri == dev.records.end()) {
+        if (in_record.find("kismet.device.base.macaddr") == in_record.end()) {
+            if (dev.records.size() == 0)
+                devices.erase(id);
+            return false;
+        }
+
+        dev.records.emplace_back(peer, std::move(in_record));
+        ri = dev.records.end() - 1;
+    } else {
+        // Changes only carry the fields which changed; maps and vectors are sent whole
+        // when anything in their component changed
+        ri->second.merge_patch(in_record);
+    }
+
+    dev.last_time = std::max(dev.last_time,
+            (time_t) ri->second.value("kismet.device.base.last_time", (uint64_t) 0));
+
+    return true;
+}
+
+void kis_federation::expire_devices() {
+    if (device_timeout == 0)
+        return;
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    time_t now = time(0);
+
+    if (now - last_expire < 60)
+        return;
+
+    last_expire = now;
+
+    for (auto di = devices.begin(); di != devices.end(); ) {
+        if (now - di->second.last_time > (time_t) device_timeout)
+            di = devices.erase(di);
+        else
+            ++di;
+    }
+}
+
+nlohmann::json kis_federation::merged_device(const federated_device& in_device) {
+    const nlohmann::json *newest = nullptr;
+    uint64_t newest_time = 0;
+
+    uint64_t first_time = std::numeric_limits<uint64_t>::max();
+    uint64_t packets = 0;
+
+    auto peers_j = nlohmann::json::array();
+    auto seenby = nlohmann::json();
+
+    for (const auto& r : in_device.records) {
+        const auto& rec = r.second;
+
+        auto last = rec.value("kismet.device.base.last_time", (uint64_t) 0);
+
+        if (newest == nullptr || last > newest_time) {
+            newest = &rec;
+            newest_time = last;
+        }
+
+        first_time = std::min(first_time, rec.value("kismet.device.base.first_time", first_time));
+        packets += rec.value("kismet.device.base.packets.total", (uint64_t) 0);
+
+        peers_j.push_back(r.first->name);
+
+        // Seenby records are keyed by the datasource, which is unique across servers
+        auto sb = rec.find("kismet.device.base.seenby");
+
+        if (sb == rec.end())
+            continue;
+
+        if (sb->is_object()) {
+            if (!seenby.is_object())
+                seenby = nlohmann::json::object();
+            seenby.update(*sb);
+        } else if (sb->is_array()) {
+            if (!seenby.is_array())
+                seenby = nlohmann::json::array();
+            seenby.insert(seenby.end(), sb->begin(), sb->end());
+        }
+    }
+
+    if (newest == nullptr)
+        return nlohmann::json::object();
+
+    auto merged = *newest;
+
+    if (first_time != std::numeric_limits<uint64_t>::max())
+        merged["kismet.device.base.first_time"] = first_time;
+    merged["kismet.device.base.packets.total"] = packets;
+
+    if (!seenby.is_null())
+        merged["kismet.device.base.seenby"] = std::move(seenby);
+
+    merged["kismet.federation.peers"] = std::move(peers_j);
+
+    return merged;
+}
+
+void kis_federation::devices_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    con->set_mime_type("application/json");
+
+    std::ostream os(&con->response_stream());
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    os << "[";
+
+    bool first = true;
+
+    for (const auto& d : devices) {
+        if (!first)
+            os << ",";
+        first = false;
+
+        os << merged_device(d.second).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    }
+
+    os << "]";
+}
+
+void kis_federation::alerts_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    con->set_mime_type("application/json");
+
+    std::ostream os(&con->response_stream());
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    auto j = nlohmann::json::array();
+
+    for (const auto& a : alerts)
+        j.push_back(a);
+
+    os << j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+void kis_federation::peers_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    con->set_mime_type("application/json");
+
+    std::ostream os(&con->response_stream());
+
+    auto j = nlohmann::json::array();
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    for (const auto& p : peers) {
+        nlohmann::json pj;
+
+        pj["kismet.federation.peer.name"] = p->name;
+        pj["kismet.federation.peer.host"] = p->host;
+        pj["kismet.federation.peer.port"] = p->port;
+        pj["kismet.federation.peer.connected"] = p->connected.load();
+        pj["kismet.federation.peer.polls"] = p->polls.load();
+        pj["kismet.federation.peer.errors"] = p->errors.load();
+        pj["kismet.federation.peer.bytes"] = p->bytes.load();
+        pj["kismet.federation.peer.devices"] = p->devices.load();
+        pj["kismet.federation.peer.last_poll"] = (uint64_t) p->last_poll.load();
+        pj["kismet.federation.peer.last_error"] = p->last_error;
+
+        j.push_back(std::move(pj));
+    }
+
+    os << j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
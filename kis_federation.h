@@ -0,0 +1,168 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_FEDERATION_H__
+#define __KIS_FEDERATION_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "globalregistry.h"
+#include "kis_net_beast_httpd.h"
+#include "nlohmann/json.hpp"
+
+struct federation_connection;
+
+// Federation of Kismet servers into one consolidated view.
+//
+// An aggregating server polls every peer configured with 'federation_peer' for the
+// devices modified since its last poll (/devices/modified-since/, keyed by the
+// modification generation of the peer) and the alerts raised since then, both as
+// MessagePack.  After the first poll a peer only sends the fields which changed, so
+// the cost of a poll follows the activity on the peer instead of the number of devices
+// it tracks.
+//
+// Devices are merged across peers by phy and MAC address: a device seen by several
+// sensors is served once, with the earliest first time, the latest last time, the
+// packets of every peer added up, and the seenby records of every peer combined.
+// The merged devices are served at /federation/devices.json, the peer alerts at
+// /federation/alerts.json, and the state of each peer at /federation/peers.json.
+//
+// Federated devices are kept as the records the peers sent, separately from the
+// devices tracked from local sources.
+class kis_federation : public lifetime_global, public deferred_startup {
+public:
+    static std::string global_name() { return "FEDERATION"; }
+
+    static std::shared_ptr<kis_federation> create_federation() {
+        std::shared_ptr<kis_federation> mon(new kis_federation());
+        Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->register_deferred_global(mon);
+        Globalreg::globalreg->insert_global(global_name(), mon);
+        return mon;
+    }
+
+private:
+    kis_federation();
+
+public:
+    virtual ~kis_federation();
+
+    virtual void trigger_deferred_startup() override;
+    virtual void trigger_deferred_shutdown() override;
+
+protected:
+    struct federation_peer {
+        federation_peer() :
+            generation{0},
+            alert_time{0},
+            connected{false},
+            polls{0},
+            errors{0},
+            bytes{0},
+            devices{0},
+            last_poll{0} { }
+
+        std::string name;
+        std::string host;
+        std::string port;
+        std::string api_key;
+
+        std::thread thread;
+
+        // Generation and alert time to poll from next
+        uint64_t generation;
+        double alert_time;
+
+        // Federated device of each device key of the peer; changes after the first
+        // poll only carry the key
+        std::unordered_map<std::string, std::string> device_ids;
+
+        std::atomic<bool> connected;
+        std::atomic<uint64_t> polls;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> devices;
+        std::atomic<time_t> last_poll;
+        std::string last_error;
+    };
+
+    struct federated_device {
+        federated_device() :
+            last_time{0} { }
+
+        time_t last_time;
+
+        // Latest record of the device from each peer which has seen it
+        std::vector<std::pair<federation_peer *, nlohmann::json>> records;
+    };
+
+    // Parse a name:url=http://host:port,apikey=... peer definition
+    bool parse_peer(const std::string& in_definition, federation_peer& peer);
+
+    void peer_thread(federation_peer *peer);
+
+    // Fetch a path from the peer over a keep-alive connection and parse the MessagePack
+    // response; throws std::runtime_error
+    nlohmann::json peer_fetch(federation_peer *peer, federation_connection& conn,
+            const std::string& in_path);
+
+    void poll_devices(federation_peer *peer, federation_connection& conn);
+    void poll_alerts(federation_peer *peer, federation_connection& conn);
+
+    // Merge a full or partial device record from a peer; returns false when the record
+    // is a change to a device we no longer have, which has to be fetched whole
+    bool merge_device(federation_peer *peer, nlohmann::json& in_record);
+
+    // Drop devices not seen by any peer within the device timeout
+    void expire_devices();
+
+    nlohmann::json merged_device(const federated_device& in_device);
+
+    void devices_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+    void alerts_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+    void peers_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
+    std::vector<std::unique_ptr<federation_peer>> peers;
+
+    unsigned int poll_rate;
+    unsigned int device_timeout;
+    size_t alert_backlog;
+
+    std::mutex mutex;
+    std::condition_variable stop_cond;
+    bool stopping;
+
+    // Federated devices by phy name and MAC address
+    std::unordered_map<std::string, federated_device> devices;
+    time_t last_expire;
+
+    std::deque<nlohmann::json> alerts;
+};
+
+#endif
+
@@ -225,7 +225,7 @@ double kis_gps::gps_calc_rad(double lat) {
 }
 
 void kis_gps::update_locations() {
-    kis_lock_guard<kis_mutex> lk(data_mutex);
+    kis_unique_lock<kis_mutex> lk(data_mutex, "kis_gps update_locations");
     set_int_gps_data_time(time(0));
     set_int_gps_signal_time(time(0));
 
@@ -244,5 +244,11 @@ void kis_gps::update_locations() {
     tracked_location->set_fix(gps_location->fix);
     tracked_location->set_time_sec(gps_location->tv.tv_sec);
     tracked_location->set_time_usec(gps_location->tv.tv_usec);
+
+    lk.unlock();
+
+    // Packets use the published snapshot, so hand the new fix to the tracker
+    if (gpstracker != nullptr)
+        gpstracker->queue_publish_location();
 }
 
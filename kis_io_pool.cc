@@ -0,0 +1,230 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "fmt.h"
+#include "kis_io_pool.h"
+#include "messagebus.h"
+#include "util.h"
+
+kis_io_pool::kis_io_pool(const std::string& in_name, boost::asio::io_context& in_io,
+        unsigned int in_min, unsigned int in_max, const std::vector<unsigned int>& in_cpus) :
+    grow_latency{std::chrono::milliseconds(50)},
+    shrink_interval{std::chrono::seconds(60)},
+    name{in_name},
+    io{in_io},
+    cpus{in_cpus},
+    threads_min{std::max(1U, in_min)},
+    threads_max{std::max(std::max(1U, in_min), in_max)},
+    running{false},
+    next_thread_n{1},
+    n_threads{0},
+    threads_peak{0},
+    retire_pending{0},
+    handlers{0},
+    grown{0},
+    shrunk{0},
+    latency_us{0},
+    latency_max_us{0},
+    affinity_reported{false} { }
+
+kis_io_pool::~kis_io_pool() {
+    stop();
+}
+
+void kis_io_pool::start() {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (running)
+        return;
+
+    running = true;
+
+    for (unsigned int i = 0; i < threads_min; i++)
+        spawn_thread();
+
+    if (threads_max > threads_min)
+        monitor_thread = std::thread([this]() { monitor(); });
+}
+
+void kis_io_pool::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+
+        if (!running)
+            return;
+
+        running = false;
+    }
+
+    monitor_cond.notify_all();
+
+    if (monitor_thread.joinable())
+        monitor_thread.join();
+
+    // Workers notice within a second, or immediately if the context was stopped
+    for (auto& t : threads) {
+        if (t.thread.joinable())
+            t.thread.join();
+    }
+
+    threads.clear();
+}
+
+void kis_io_pool::spawn_thread() {
+    // Called with the mutex held; join any threads which retired since the last time
+    for (auto t = threads.begin(); t != threads.end(); ) {
+        if (!t->done) {
+            ++t;
+            continue;
+        }
+
+        if (t->thread.joinable())
+            t->thread.join();
+
+        t = threads.erase(t);
+    }
+
+    threads.emplace_back();
+    auto t = &threads.back();
+    auto n = next_thread_n++;
+
+    auto c = ++n_threads;
+
+    auto peak = threads_peak.load();
+    while (c > peak && !threads_peak.compare_exchange_weak(peak, c))
+        ;
+
+    t->thread = std::thread([this, t, n]() { worker(t, n); });
+}
+
+void kis_io_pool::worker(pool_thread *t, unsigned int n) {
+    thread_set_process_name(fmt::format("{} {}", name, n));
+
+    if (!thread_set_cpu_affinity(cpus) && !affinity_reported.exchange(true))
+        _MSG_ERROR("Could not restrict the {} thread pool to the configured CPUs; check "
+                "that the CPUs exist and are available to Kismet.", name);
+
+    while (running && !io.stopped()) {
+        handlers += io.run_one_for(std::chrono::seconds(1));
+
+        // Any idle thread can take a retirement the monitor asked for
+        auto r = retire_pending.load();
+        while (r > 0) {
+            if (retire_pending.compare_exchange_weak(r, r - 1)) {
+                shrunk++;
+                n_threads--;
+                t->done = true;
+                return;
+            }
+        }
+    }
+
+    n_threads--;
+    t->done = true;
+}
+
+void kis_io_pool::monitor() {
+    thread_set_process_name(fmt::format("{} pool", name));
+
+    // The probe state outlives the pool if a probe is still queued when it stops
+    struct probe_state {
+        std::atomic<bool> pending{false};
+        std::atomic<int64_t> latency_us{0};
+        std::chrono::steady_clock::time_point posted;
+    };
+
+    auto probe = std::make_shared<probe_state>();
+
+    auto settled_since = std::chrono::steady_clock::now();
+    int64_t window_max_us = 0;
+    unsigned int window_samples = 0;
+
+    std::unique_lock<std::mutex> lk(mutex);
+
+    while (running) {
+        if (!probe->pending) {
+            probe->pending = true;
+            probe->posted = std::chrono::steady_clock::now();
+
+            boost::asio::post(io, [probe]() {
+                probe->latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - probe->posted).count();
+                probe->pending = false;
+            });
+        }
+
+        monitor_cond.wait_for(lk, std::chrono::seconds(1), [this]() { return !running; });
+
+        if (!running)
+            break;
+
+        auto now = std::chrono::steady_clock::now();
+
+        // A probe which hasn't run yet has waited at least this long
+        int64_t lat_us = probe->latency_us;
+        if (probe->pending)
+            lat_us = std::chrono::duration_cast<std::chrono::microseconds>(now - probe->posted).count();
+
+        latency_us = lat_us;
+
+        window_max_us = std::max(window_max_us, lat_us);
+        latency_max_us = std::max(latency_max_us.load(), window_max_us);
+
+        if (++window_samples >= 60) {
+            latency_max_us = window_max_us;
+            window_max_us = 0;
+            window_samples = 0;
+        }
+
+        auto active = n_threads - std::min(n_threads.load(), retire_pending.load());
+
+        if (lat_us >= std::chrono::duration_cast<std::chrono::microseconds>(grow_latency).count()) {
+            settled_since = now;
+
+            // Cancel a pending retirement before adding a new thread
+            auto r = retire_pending.load();
+            if (r > 0 && retire_pending.compare_exchange_strong(r, r - 1))
+                continue;
+
+            if (active < threads_max) {
+                spawn_thread();
+                grown++;
+            }
+
+            continue;
+        }
+
+        // Only probes well under the grow latency count as settled
+        if (lat_us * 4 >= std::chrono::duration_cast<std::chrono::microseconds>(grow_latency).count()) {
+            settled_since = now;
+            continue;
+        }
+
+        if (now - settled_since >= shrink_interval) {
+            settled_since = now;
+
+            if (active > threads_min)
+                retire_pending++;
+        }
+    }
+}
+
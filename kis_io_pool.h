@@ -0,0 +1,118 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_IO_POOL_H__
+#define __KIS_IO_POOL_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+// Threads running an ASIO context, sized to the load on it.
+//
+// A monitor thread posts a probe to the context every second and measures how long
+// it waits behind other handlers.  While probes wait longer than the grow latency,
+// handlers are backing up (usually because threads are blocked in slow handlers) and a
+// thread is added, up to the maximum.  When the probes have run promptly for the
+// shrink interval, a thread is retired, down to the minimum.
+//
+// Threads can be restricted to a set of CPUs, such as the CPUs of a NUMA node.
+class kis_io_pool {
+public:
+    kis_io_pool(const std::string& in_name, boost::asio::io_context& in_io,
+            unsigned int in_min, unsigned int in_max,
+            const std::vector<unsigned int>& in_cpus);
+    ~kis_io_pool();
+
+    void start();
+    void stop();
+
+    const std::string& get_name() const { return name; }
+    const std::vector<unsigned int>& get_cpus() const { return cpus; }
+
+    unsigned int get_threads_min() const { return threads_min; }
+    unsigned int get_threads_max() const { return threads_max; }
+    unsigned int get_threads() const { return n_threads; }
+    unsigned int get_threads_peak() const { return threads_peak; }
+
+    // Handlers run by the pool, and times it grew and shrank
+    uint64_t get_handlers() const { return handlers; }
+    uint64_t get_grown() const { return grown; }
+    uint64_t get_shrunk() const { return shrunk; }
+
+    // Queue latency of the last probe, and the worst in the last minute
+    double get_latency_ms() const { return latency_us / 1000.0f; }
+    double get_latency_max_ms() const { return latency_max_us / 1000.0f; }
+
+    // Probes waiting longer than this grow the pool
+    std::chrono::milliseconds grow_latency;
+    // Probes running promptly for this long shrink the pool
+    std::chrono::seconds shrink_interval;
+
+protected:
+    // Retired threads exit on their own and are joined when the next thread is added,
+    // or when the pool stops
+    struct pool_thread {
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    void spawn_thread();
+    void worker(pool_thread *t, unsigned int n);
+    void monitor();
+
+    std::string name;
+    boost::asio::io_context& io;
+    std::vector<unsigned int> cpus;
+
+    unsigned int threads_min;
+    unsigned int threads_max;
+
+    std::mutex mutex;
+    std::condition_variable monitor_cond;
+    std::atomic<bool> running;
+
+    std::list<pool_thread> threads;
+    std::thread monitor_thread;
+    unsigned int next_thread_n;
+
+    std::atomic<unsigned int> n_threads;
+    std::atomic<unsigned int> threads_peak;
+    std::atomic<unsigned int> retire_pending;
+
+    std::atomic<uint64_t> handlers;
+    std::atomic<uint64_t> grown;
+    std::atomic<uint64_t> shrunk;
+
+    std::atomic<int64_t> latency_us;
+    std::atomic<int64_t> latency_max_us;
+
+    std::atomic<bool> affinity_reported;
+};
+
+#endif
+
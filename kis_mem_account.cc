@@ -0,0 +1,110 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <cxxabi.h>
+#include <stdlib.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "kis_mem_account.h"
+#include "trackedelement.h"
+
+namespace kis_mem_account {
+    std::atomic<bool> enabled{false};
+
+    // Intentionally never freed; pooled objects may be released during static teardown
+    static std::mutex& registry_mutex() {
+        static auto *m = new std::mutex();
+        return *m;
+    }
+
+    static std::map<std::pair<std::string, std::string>, std::unique_ptr<kis_mem_counter>>& registry() {
+        static auto *r =
+            new std::map<std::pair<std::string, std::string>, std::unique_ptr<kis_mem_counter>>();
+        return *r;
+    }
+
+    // Tracked elements are created constantly, so their counters are looked up by type
+    // number instead of by name
+    constexpr int max_tracked_type = 64;
+    static std::atomic<kis_mem_counter *> tracked_counters[max_tracked_type];
+
+    void set_enabled(bool in_enabled) {
+        enabled = in_enabled;
+    }
+
+    kis_mem_counter *counter_for(const std::string& category, const std::string& name) {
+        std::lock_guard<std::mutex> lk(registry_mutex());
+
+        auto& r = registry();
+        auto k = std::make_pair(category, name);
+        auto c = r.find(k);
+
+        if (c != r.end())
+            return c->second.get();
+
+        auto counter = new kis_mem_counter(category, name);
+        r[k] = std::unique_ptr<kis_mem_counter>(counter);
+
+        return counter;
+    }
+
+    std::string type_name(const std::type_info& t) {
+        int status;
+        auto name = abi::__cxa_demangle(t.name(), nullptr, nullptr, &status);
+
+        if (name == nullptr)
+            return t.name();
+
+        std::string ret(name);
+        free(name);
+
+        return ret;
+    }
+
+    kis_mem_counter *tracked_counter(int type) {
+        if (type < 0 || type >= max_tracked_type)
+            return nullptr;
+
+        auto c = tracked_counters[type].load(std::memory_order_acquire);
+
+        if (c == nullptr) {
+            c = counter_for("tracked element",
+                    tracker_element::type_to_typestring(static_cast<tracker_type>(type)));
+            tracked_counters[type].store(c, std::memory_order_release);
+        }
+
+        return c;
+    }
+
+    std::vector<kis_mem_counter *> all_counters() {
+        std::lock_guard<std::mutex> lk(registry_mutex());
+
+        std::vector<kis_mem_counter *> ret;
+
+        for (const auto& c : registry())
+            ret.push_back(c.second.get());
+
+        return ret;
+    }
+}
+
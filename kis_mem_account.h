@@ -0,0 +1,110 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_MEM_ACCOUNT_H__
+#define __KIS_MEM_ACCOUNT_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+// Optional accounting of the memory held by the major allocation sites (object pools,
+// tracked elements, packet components, chainbuf chunks, and serializer buffers), for
+// finding out where a long-running server spends its memory.
+//
+// Accounting is enabled once at startup (memory_accounting=true); objects are only
+// counted when they were created with accounting enabled, and the counts are exposed by
+// the system monitor in /system/memory.json.  The sizes are the sizes of the objects
+// themselves, plus the buffer space for chunks and serializer buffers; they don't
+// include the heap memory owned by members such as strings.
+
+// Live objects and bytes of one allocation category
+struct kis_mem_counter {
+    kis_mem_counter(const std::string& category, const std::string& name) :
+        category{category},
+        name{name},
+        objects{0},
+        bytes{0} { }
+
+    void add(int64_t sz) {
+        objects.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(sz, std::memory_order_relaxed);
+    }
+
+    void remove(int64_t sz) {
+        objects.fetch_sub(1, std::memory_order_relaxed);
+        bytes.fetch_sub(sz, std::memory_order_relaxed);
+    }
+
+    // Buffers which grow or shrink in place
+    void resize(int64_t delta) {
+        bytes.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    const std::string category;
+    const std::string name;
+
+    std::atomic<int64_t> objects;
+    std::atomic<int64_t> bytes;
+};
+
+namespace kis_mem_account {
+    extern std::atomic<bool> enabled;
+
+    inline bool active() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void set_enabled(bool in_enabled);
+
+    // Counter for a category and name, created on first use; counters are never freed,
+    // so callers look them up once and keep the pointer
+    kis_mem_counter *counter_for(const std::string& category, const std::string& name);
+
+    // Counter for a category and name, or nullptr when accounting is disabled
+    inline kis_mem_counter *fetch_counter(const std::string& category, const std::string& name) {
+        if (!active())
+            return nullptr;
+
+        return counter_for(category, name);
+    }
+
+    // Readable name of a type, for naming per-type counters
+    std::string type_name(const std::type_info& t);
+
+    template<typename T>
+    kis_mem_counter *fetch_type_counter(const std::string& category) {
+        if (!active())
+            return nullptr;
+
+        return counter_for(category, type_name(typeid(T)));
+    }
+
+    // Counter for tracked elements of a tracker_type, by type number
+    kis_mem_counter *tracked_counter(int type);
+
+    // Every counter created so far
+    std::vector<kis_mem_counter *> all_counters();
+}
+
+#endif
+
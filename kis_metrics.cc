@@ -0,0 +1,326 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "datasourcetracker.h"
+#include "devicetracker.h"
+#include "fmt.h"
+#include "kis_datasource.h"
+#include "kis_mem_account.h"
+#include "kis_metrics.h"
+#include "kis_mutex.h"
+#include "packet_retention.h"
+#include "packetchain.h"
+
+namespace {
+    // Label values escape backslash, quote, and newline
+    std::string escape_label(const std::string& in) {
+        std::string ret;
+        ret.reserve(in.length());
+
+        for (const auto& c : in) {
+            switch (c) {
+                case '\\':
+                    ret += "\\\\";
+                    break;
+                case '"':
+                    ret += "\\\"";
+                    break;
+                case '\n':
+                    ret += "\\n";
+                    break;
+                default:
+                    ret += c;
+            }
+        }
+
+        return ret;
+    }
+}
+
+void kis_metrics_writer::family(const std::string& in_name, const std::string& type,
+        const std::string& help) {
+    name = in_name;
+
+    stream << "# TYPE " << name << " " << type << "\n";
+    stream << "# HELP " << name << " " << help << "\n";
+}
+
+void kis_metrics_writer::write_sample(const std::string& suffix, const labels_t& labels,
+        const std::string& extra_label, const std::string& value) {
+    stream << name << suffix;
+
+    if (labels.size() != 0 || extra_label.length() != 0) {
+        stream << "{";
+
+        bool first = true;
+
+        for (const auto& l : labels) {
+            if (!first)
+                stream << ",";
+            first = false;
+
+            stream << l.first << "=\"" << escape_label(l.second) << "\"";
+        }
+
+        if (extra_label.length() != 0) {
+            if (!first)
+                stream << ",";
+            stream << extra_label;
+        }
+
+        stream << "}";
+    }
+
+    stream << " " << value << "\n";
+}
+
+void kis_metrics_writer::counter(uint64_t value, const labels_t& labels) {
+    write_sample("_total", labels, "", fmt::format("{}", value));
+}
+
+void kis_metrics_writer::counter(double value, const labels_t& labels) {
+    write_sample("_total", labels, "", fmt::format("{}", value));
+}
+
+void kis_metrics_writer::gauge(double value, const labels_t& labels) {
+    write_sample("", labels, "", fmt::format("{}", value));
+}
+
+void kis_metrics_writer::summary(const packet_handler_histogram& hist, const labels_t& labels) {
+    auto count = hist.count();
+
+    if (count != 0) {
+        for (const auto& q : {50, 90, 99})
+            write_sample("", labels, fmt::format("quantile=\"{}\"", q / 100.0),
+                    fmt::format("{}", hist.percentile(q) / 1e9));
+    }
+
+    write_sample("_count", labels, "", fmt::format("{}", count));
+    write_sample("_sum", labels, "", fmt::format("{}", hist.sum() / 1e9));
+}
+
+void kis_metrics_writer::finish() {
+    stream << "# EOF\n";
+}
+
+kis_metrics::kis_metrics() :
+    lifetime_global() {
+
+    statm_fd = -1;
+    mem_per_page = 0;
+
+#ifdef SYS_LINUX
+    mem_per_page = sysconf(_SC_PAGESIZE);
+    statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+#endif
+
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/metrics", {"GET"}, httpd->RO_ROLE,
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    metrics_endp(con);
+                }));
+}
+
+kis_metrics::~kis_metrics() {
+    Globalreg::globalreg->remove_global(global_name());
+
+    if (statm_fd >= 0)
+        close(statm_fd);
+}
+
+void kis_metrics::metrics_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    con->set_mime_type("application/openmetrics-text; version=1.0.0; charset=utf-8");
+
+    std::ostream stream(&con->response_stream());
+    write_metrics(stream);
+}
+
+void kis_metrics::write_metrics(std::ostream& stream) {
+    kis_metrics_writer writer(stream);
+
+    write_system_metrics(writer);
+
+    auto packetchain = Globalreg::fetch_global_as<packet_chain>();
+    if (packetchain != nullptr)
+        packetchain->write_metrics(writer);
+
+    write_datasource_metrics(writer);
+    write_mutex_metrics(writer);
+    write_memory_metrics(writer);
+    write_retention_metrics(writer);
+
+    writer.finish();
+}
+
+void kis_metrics::write_system_metrics(kis_metrics_writer& writer) {
+    writer.family("kismet_start_time_seconds", "gauge", "Time the server started");
+    writer.gauge(Globalreg::globalreg->start_time);
+
+    auto devicetracker = Globalreg::fetch_global_as<device_tracker>();
+
+    if (devicetracker != nullptr) {
+        writer.family("kismet_devices", "gauge", "Devices being tracked");
+        writer.gauge(devicetracker->fetch_num_devices());
+    }
+
+#ifdef SYS_LINUX
+    char procbuf[128];
+    unsigned long int pages;
+
+    if (statm_fd >= 0) {
+        auto r = pread(statm_fd, procbuf, sizeof(procbuf) - 1, 0);
+
+        if (r > 0) {
+            procbuf[r] = 0;
+
+            // Resident pages are the second field of statm
+            if (sscanf(procbuf, "%*u %lu", &pages) == 1) {
+                writer.family("kismet_resident_memory_bytes", "gauge", "Resident memory size");
+                writer.gauge((double) pages * mem_per_page);
+            }
+        }
+    }
+#endif
+}
+
+void kis_metrics::write_datasource_metrics(kis_metrics_writer& writer) {
+    auto datasourcetracker = Globalreg::fetch_global_as<datasource_tracker>();
+
+    if (datasourcetracker == nullptr)
+        return;
+
+    // Collect the sources first so each family is written in one block
+    struct source_counts {
+        kis_metrics_writer::labels_t labels;
+        uint64_t packets, errors, dropped;
+        bool running;
+    };
+
+    class metrics_worker : public datasource_tracker_worker {
+    public:
+        virtual void handle_datasource(std::shared_ptr<kis_datasource> in_src) override {
+            source_counts c;
+
+            c.labels = {{"uuid", in_src->get_source_uuid().as_string()},
+                {"name", in_src->get_source_name()}};
+            c.packets = in_src->get_source_num_packets();
+            c.errors = in_src->get_source_num_error_packets();
+            c.dropped = in_src->get_source_num_dropped_packets();
+            c.running = in_src->get_source_running();
+
+            sources.push_back(c);
+        }
+
+        std::vector<source_counts> sources;
+    };
+
+    metrics_worker worker;
+    datasourcetracker->iterate_datasources(&worker);
+
+    writer.family("kismet_datasource_running", "gauge", "Datasource is running");
+    for (const auto& s : worker.sources)
+        writer.gauge(s.running, s.labels);
+
+    writer.family("kismet_datasource_packets", "counter", "Packets received from the datasource");
+    for (const auto& s : worker.sources)
+        writer.counter(s.packets, s.labels);
+
+    writer.family("kismet_datasource_error_packets", "counter",
+            "Packets from the datasource which were in error");
+    for (const auto& s : worker.sources)
+        writer.counter(s.errors, s.labels);
+
+    writer.family("kismet_datasource_dropped_packets", "counter",
+            "Packets from the datasource dropped by the packet queue");
+    for (const auto& s : worker.sources)
+        writer.counter(s.dropped, s.labels);
+}
+
+void kis_metrics::write_mutex_metrics(kis_metrics_writer& writer) {
+    if (!kis_mutex_profile::active())
+        return;
+
+    auto stats = kis_mutex_profile::all_stats();
+
+    writer.family("kismet_mutex_acquisitions", "counter", "Lock acquisitions");
+    for (const auto& s : stats)
+        writer.counter(s->acquisitions.load(std::memory_order_relaxed), {{"mutex", s->name}});
+
+    writer.family("kismet_mutex_contended", "counter",
+            "Lock acquisitions which waited for another holder");
+    for (const auto& s : stats)
+        writer.counter(s->contended.load(std::memory_order_relaxed), {{"mutex", s->name}});
+
+    writer.family("kismet_mutex_wait_seconds", "counter", "Time spent waiting for the lock");
+    for (const auto& s : stats)
+        writer.counter(s->wait_ns.load(std::memory_order_relaxed) / 1e9, {{"mutex", s->name}});
+
+    writer.family("kismet_mutex_hold_seconds", "counter", "Time the lock was held");
+    for (const auto& s : stats)
+        writer.counter(s->hold_ns.load(std::memory_order_relaxed) / 1e9, {{"mutex", s->name}});
+}
+
+void kis_metrics::write_memory_metrics(kis_metrics_writer& writer) {
+    if (!kis_mem_account::active())
+        return;
+
+    auto counters = kis_mem_account::all_counters();
+
+    writer.family("kismet_memory_objects", "gauge", "Live objects by allocation category");
+    for (const auto& c : counters)
+        writer.gauge(c->objects.load(std::memory_order_relaxed),
+                {{"category", c->category}, {"site", c->name}});
+
+    writer.family("kismet_memory_bytes", "gauge", "Live bytes by allocation category");
+    for (const auto& c : counters)
+        writer.gauge(c->bytes.load(std::memory_order_relaxed),
+                {{"category", c->category}, {"site", c->name}});
+}
+
+void kis_metrics::write_retention_metrics(kis_metrics_writer& writer) {
+    auto retention = Globalreg::fetch_global_as<packet_retention>();
+
+    if (retention == nullptr)
+        return;
+
+    writer.family("kismet_retained_packet_bytes", "gauge", "Bytes of retained packets by category");
+    for (int c = 0; c < packet_retention::cat_max; c++) {
+        auto cat = static_cast<packet_retention::category>(c);
+        writer.gauge(retention->get_bytes(cat), {{"category", packet_retention::category_name(cat)}});
+    }
+
+    writer.family("kismet_retained_packets", "gauge", "Retained packets by category");
+    for (int c = 0; c < packet_retention::cat_max; c++) {
+        auto cat = static_cast<packet_retention::category>(c);
+        writer.gauge(retention->get_packets(cat), {{"category", packet_retention::category_name(cat)}});
+    }
+
+    writer.family("kismet_retained_packets_evicted", "counter",
+            "Retained packets evicted to stay within the retention budget");
+    for (int c = 0; c < packet_retention::cat_max; c++) {
+        auto cat = static_cast<packet_retention::category>(c);
+        writer.counter(retention->get_evicted(cat), {{"category", packet_retention::category_name(cat)}});
+    }
+}
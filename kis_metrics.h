@@ -0,0 +1,100 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_METRICS_H__
+#define __KIS_METRICS_H__
+
+#include "config.h"
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "globalregistry.h"
+#include "kis_net_beast_httpd.h"
+
+class packet_handler_histogram;
+
+// Render metrics in the OpenMetrics text format.  A metric family is started with
+// its type and help, followed by its samples; counters get the _total suffix, and
+// latency histograms (in ns) are exported as summaries in seconds.
+class kis_metrics_writer {
+public:
+    typedef std::vector<std::pair<std::string, std::string>> labels_t;
+
+    kis_metrics_writer(std::ostream& stream) :
+        stream{stream} { }
+
+    void family(const std::string& name, const std::string& type, const std::string& help);
+
+    void counter(uint64_t value, const labels_t& labels = {});
+    void counter(double value, const labels_t& labels = {});
+    void gauge(double value, const labels_t& labels = {});
+    void summary(const packet_handler_histogram& hist, const labels_t& labels = {});
+
+    // End of the exposition
+    void finish();
+
+protected:
+    void write_sample(const std::string& suffix, const labels_t& labels,
+            const std::string& extra_label, const std::string& value);
+
+    std::ostream& stream;
+    std::string name;
+};
+
+// Metrics exporter, which serves /metrics for Prometheus and other OpenMetrics
+// scrapers.  Everything is rendered straight from the counters, queue sizes, and
+// histograms kept by each subsystem, without building tracked elements, so it's cheap
+// enough to scrape every sensor every few seconds.
+class kis_metrics : public lifetime_global {
+public:
+    static std::string global_name() { return "METRICS"; }
+
+    static std::shared_ptr<kis_metrics> create_metrics() {
+        std::shared_ptr<kis_metrics> mon(new kis_metrics());
+        Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->insert_global(global_name(), mon);
+        return mon;
+    }
+
+private:
+    kis_metrics();
+
+public:
+    virtual ~kis_metrics();
+
+    void write_metrics(std::ostream& stream);
+
+protected:
+    void metrics_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
+    void write_system_metrics(kis_metrics_writer& writer);
+    void write_datasource_metrics(kis_metrics_writer& writer);
+    void write_mutex_metrics(kis_metrics_writer& writer);
+    void write_memory_metrics(kis_metrics_writer& writer);
+    void write_retention_metrics(kis_metrics_writer& writer);
+
+    int statm_fd;
+    long mem_per_page;
+};
+
+#endif
+
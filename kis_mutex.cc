@@ -0,0 +1,133 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "kis_mutex.h"
+
+static void atomic_max(std::atomic<uint64_t>& a, uint64_t v) {
+    auto m = a.load(std::memory_order_relaxed);
+    while (v > m && !a.compare_exchange_weak(m, v, std::memory_order_relaxed))
+        ;
+}
+
+void kis_mutex_stats::record_wait(uint64_t ns, const std::string *op) {
+    contended++;
+    wait_ns += ns;
+    atomic_max(wait_max_ns, ns);
+
+    if (op == nullptr)
+        return;
+
+    // Only contended acquisitions reach here, and they already waited for the lock
+    std::lock_guard<std::mutex> lk(op_mutex);
+    auto& o = ops[*op];
+    o.contended++;
+    o.wait_ns += ns;
+}
+
+void kis_mutex_stats::record_hold(uint64_t ns) {
+    hold_ns += ns;
+    atomic_max(hold_max_ns, ns);
+}
+
+std::vector<std::pair<std::string, kis_mutex_op_stats>> kis_mutex_stats::top_ops(size_t max) {
+    std::vector<std::pair<std::string, kis_mutex_op_stats>> ret;
+
+    {
+        std::lock_guard<std::mutex> lk(op_mutex);
+        ret.assign(ops.begin(), ops.end());
+    }
+
+    std::sort(ret.begin(), ret.end(),
+            [](const std::pair<std::string, kis_mutex_op_stats>& a,
+                const std::pair<std::string, kis_mutex_op_stats>& b) {
+                return a.second.wait_ns > b.second.wait_ns;
+            });
+
+    if (ret.size() > max)
+        ret.resize(max);
+
+    return ret;
+}
+
+void kis_mutex_stats::clear_ops() {
+    std::lock_guard<std::mutex> lk(op_mutex);
+    ops.clear();
+}
+
+namespace kis_mutex_profile {
+    std::atomic<bool> enabled{false};
+
+    // Function statics, since mutexes may be locked during static initialization
+    static std::mutex& registry_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::map<std::string, std::unique_ptr<kis_mutex_stats>>& registry() {
+        static std::map<std::string, std::unique_ptr<kis_mutex_stats>> r;
+        return r;
+    }
+
+    void set_enabled(bool in_enabled) {
+        enabled = in_enabled;
+    }
+
+    kis_mutex_stats *stats_for(const std::string& name) {
+        std::lock_guard<std::mutex> lk(registry_mutex());
+
+        auto& r = registry();
+        auto s = r.find(name);
+
+        if (s != r.end())
+            return s->second.get();
+
+        auto stats = new kis_mutex_stats(name);
+        r[name] = std::unique_ptr<kis_mutex_stats>(stats);
+
+        return stats;
+    }
+
+    std::vector<kis_mutex_stats *> all_stats() {
+        std::lock_guard<std::mutex> lk(registry_mutex());
+
+        std::vector<kis_mutex_stats *> ret;
+
+        for (const auto& s : registry())
+            ret.push_back(s.second.get());
+
+        return ret;
+    }
+
+    void reset() {
+        for (auto s : all_stats()) {
+            s->acquisitions = 0;
+            s->contended = 0;
+            s->recursive = 0;
+            s->wait_ns = 0;
+            s->wait_max_ns = 0;
+            s->hold_ns = 0;
+            s->hold_max_ns = 0;
+            s->clear_ops();
+        }
+    }
+}
+
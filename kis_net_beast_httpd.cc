@@ -20,9 +20,21 @@
 
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <random>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef SYS_LINUX
+#include <sys/sendfile.h>
+#endif
 
 #include "globalregistry.h"
 
@@ -32,6 +44,281 @@
 #include "messagebus.h"
 #include "util.h"
 
+namespace {
+    // Incremental gzip encoder for chunked responses
+    class gzip_encoder {
+    public:
+        gzip_encoder() :
+            active{false} { }
+
+        ~gzip_encoder() {
+            if (active)
+                deflateEnd(&zs);
+        }
+
+        bool begin() {
+            memset(&zs, 0, sizeof(z_stream));
+
+            // 15 bits of window + 16 for a gzip header
+            active = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, 
+                    Z_DEFAULT_STRATEGY) == Z_OK;
+
+            return active;
+        }
+
+        bool is_active() const {
+            return active;
+        }
+
+        // Compress a block of data, appending to out; flush with Z_SYNC_FLUSH to make
+        // everything so far decodable by the client, or Z_FINISH to end the stream
+        void compress(const char *data, size_t len, int flush, std::string& out) {
+            char buf[16384];
+
+            zs.next_in = (Bytef *) data;
+            zs.avail_in = len;
+
+            do {
+                zs.next_out = (Bytef *) buf;
+                zs.avail_out = sizeof(buf);
+
+                deflate(&zs, flush);
+
+                out.append(buf, sizeof(buf) - zs.avail_out);
+            } while (zs.avail_out == 0);
+        }
+
+    protected:
+        bool active;
+        z_stream zs;
+    };
+
+    // Does the client accept gzip content encoding, without disabling it with q=0?
+    bool accepts_gzip(const boost::beast::string_view& accept) {
+        size_t start = 0;
+
+        while (start < accept.length()) {
+            auto end = accept.find(',', start);
+            if (end == boost::beast::string_view::npos)
+                end = accept.length();
+
+            auto token = accept.substr(start, end - start);
+            start = end + 1;
+
+            auto param_pos = token.find(';');
+            auto coding = token.substr(0, param_pos);
+
+            while (coding.size() && coding.front() == ' ')
+                coding.remove_prefix(1);
+            while (coding.size() && coding.back() == ' ')
+                coding.remove_suffix(1);
+
+            if (!boost::beast::iequals(coding, "gzip"))
+                continue;
+
+            if (param_pos == boost::beast::string_view::npos)
+                return true;
+
+            auto q_pos = token.find("q=", param_pos);
+            if (q_pos == boost::beast::string_view::npos)
+                return true;
+
+            try {
+                return std::stod(static_cast<std::string>(token.substr(q_pos + 2))) > 0;
+            } catch (const std::exception& e) {
+                return false;
+            }
+        }
+
+        return false;
+    }
+
+    // Run a function when leaving the scope
+    class on_return {
+    public:
+        on_return(std::function<void ()> fn) :
+            fn{fn} { }
+
+        ~on_return() {
+            fn();
+        }
+
+    protected:
+        std::function<void ()> fn;
+    };
+
+    // Stream buffer which copies everything written to it into a string, up to a limit,
+    // so a response can be shared while it streams to the client
+    class tee_streambuf : public std::streambuf {
+    public:
+        tee_streambuf(std::streambuf *target, std::string& copy, size_t limit) :
+            target{target},
+            copy{copy},
+            limit{limit},
+            overflowed{false} { }
+
+        bool is_overflowed() const {
+            return overflowed;
+        }
+
+    protected:
+        void append(const char *s, std::streamsize n) {
+            if (overflowed)
+                return;
+
+            if (copy.length() + n > limit) {
+                overflowed = true;
+                copy.clear();
+                copy.shrink_to_fit();
+                return;
+            }
+
+            copy.append(s, n);
+        }
+
+        virtual std::streamsize xsputn(const char *s, std::streamsize n) override {
+            append(s, n);
+            return target->sputn(s, n);
+        }
+
+        virtual int_type overflow(int_type ch) override {
+            if (traits_type::eq_int_type(ch, traits_type::eof()))
+                return traits_type::not_eof(ch);
+
+            char c = traits_type::to_char_type(ch);
+            append(&c, 1);
+            return target->sputc(c);
+        }
+
+        virtual int sync() override {
+            return target->pubsync();
+        }
+
+        std::streambuf *target;
+        std::string& copy;
+        size_t limit;
+        bool overflowed;
+    };
+
+    // Compression is only worth it for text formats; pcap and other binary streams 
+    // are left alone
+    bool compressible_type(const boost::beast::string_view& type) {
+        return type.starts_with("text/") || type.find("json") != boost::beast::string_view::npos ||
+            type.find("javascript") != boost::beast::string_view::npos ||
+            type.find("xml") != boost::beast::string_view::npos;
+    }
+
+    // Split a JSON object into the text of its top-level members, without parsing the
+    // values; strings and nesting are tracked only enough to find where each value ends.
+    // Returns false if the body isn't an object the splitter understands, in which case
+    // the whole body is left to the parser.
+    struct json_member {
+        boost::beast::string_view name;
+        boost::beast::string_view text;
+    };
+
+    size_t skip_json_space(const boost::beast::string_view& s, size_t pos) {
+        while (pos < s.length() &&
+                (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\r' || s[pos] == '\n'))
+            pos++;
+        return pos;
+    }
+
+    // Position after a string starting at pos, or npos
+    size_t skip_json_string(const boost::beast::string_view& s, size_t pos) {
+        for (pos = pos + 1; pos < s.length(); pos++) {
+            if (s[pos] == '\\')
+                pos++;
+            else if (s[pos] == '"')
+                return pos + 1;
+        }
+
+        return boost::beast::string_view::npos;
+    }
+
+    bool split_json_members(const boost::beast::string_view& s, std::vector<json_member>& members) {
+        auto pos = skip_json_space(s, 0);
+
+        if (pos >= s.length() || s[pos] != '{')
+            return false;
+
+        pos = skip_json_space(s, pos + 1);
+
+        if (pos < s.length() && s[pos] == '}')
+            return skip_json_space(s, pos + 1) == s.length();
+
+        while (pos < s.length()) {
+            if (s[pos] != '"')
+                return false;
+
+            auto name_end = skip_json_string(s, pos);
+            if (name_end == boost::beast::string_view::npos)
+                return false;
+
+            // Names with escapes are left to the parser
+            auto name = s.substr(pos + 1, name_end - pos - 2);
+            if (name.find('\\') != boost::beast::string_view::npos)
+                return false;
+
+            pos = skip_json_space(s, name_end);
+            if (pos >= s.length() || s[pos] != ':')
+                return false;
+
+            pos = skip_json_space(s, pos + 1);
+
+            auto value_start = pos;
+            int depth = 0;
+
+            while (pos < s.length()) {
+                auto c = s[pos];
+
+                if (c == '"') {
+                    pos = skip_json_string(s, pos);
+                    if (pos == boost::beast::string_view::npos)
+                        return false;
+                    continue;
+                }
+
+                if (c == '{' || c == '[') {
+                    depth++;
+                } else if (c == '}' || c == ']') {
+                    if (depth == 0)
+                        break;
+                    depth--;
+                } else if (c == ',' && depth == 0) {
+                    break;
+                }
+
+                pos++;
+            }
+
+            if (pos >= s.length())
+                return false;
+
+            auto value_end = pos;
+            while (value_end > value_start &&
+                    (s[value_end - 1] == ' ' || s[value_end - 1] == '\t' ||
+                     s[value_end - 1] == '\r' || s[value_end - 1] == '\n'))
+                value_end--;
+
+            if (value_end == value_start)
+                return false;
+
+            members.push_back(json_member{name, s.substr(value_start, value_end - value_start)});
+
+            if (s[pos] == '}')
+                return skip_json_space(s, pos + 1) == s.length();
+
+            if (s[pos] != ',')
+                return false;
+
+            pos = skip_json_space(s, pos + 1);
+        }
+
+        return false;
+    }
+}
+
 const std::string kis_net_beast_httpd::LOGON_ROLE{"admin"};
 const std::string kis_net_beast_httpd::ANY_ROLE{"any"};
 const std::string kis_net_beast_httpd::RO_ROLE{"readonly"};
@@ -80,9 +367,11 @@ kis_net_beast_httpd::kis_net_beast_httpd(boost::asio::ip::tcp::endpoint& endpoin
     deferred_startup{},
     running{false},
     endpoint{endpoint},
-    acceptor{Globalreg::globalreg->io} {
+    acceptor{Globalreg::globalreg->http_io} {
 
     route_mutex.set_name("kis_net_beast_httpd route vector");
+    response_cache_mutex.set_name("kis_net_beast_httpd response cache");
+    request_member_mutex.set_name("kis_net_beast_httpd request members");
     auth_mutex.set_name("kis_net_beast_httpd auth");
 }
 
@@ -99,6 +388,8 @@ void kis_net_beast_httpd::trigger_deferred_startup() {
     register_mime_type("itjson", "application/json");
     register_mime_type("cmd", "application/json");
     register_mime_type("jcmd", "application/json");
+    register_mime_type("kcol", "application/vnd.kismet.columnar");
+    register_mime_type("msgpack", "application/msgpack");
     register_mime_type("xml", "application/xml");
     register_mime_type("png", "image/png");
     register_mime_type("jpg", "image/jpeg");
@@ -132,6 +423,55 @@ void kis_net_beast_httpd::trigger_deferred_startup() {
     allow_auth_creation = Globalreg::globalreg->kismet_config->fetch_opt_bool("httpd_allow_auth_creation", true);
     allow_auth_view = Globalreg::globalreg->kismet_config->fetch_opt_bool("httpd_allow_auth_view", true);
 
+    response_backlog_ = 
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("httpd_response_backlog", 1024 * 1024);
+
+    compress_responses_ =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("httpd_compress_responses", true);
+
+    response_cache_time_ = std::chrono::milliseconds(
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("httpd_response_cache_ms", 0));
+
+    if (response_cache_time_.count() > 0) {
+        for (const auto& u : Globalreg::globalreg->kismet_config->fetch_opt_vec("httpd_cached_uri"))
+            cached_uris_.insert(u);
+    }
+
+    static_cache_size_ =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("httpd_static_cache_size", 32 * 1024 * 1024);
+    static_cache_max_file_ =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("httpd_static_cache_max_file", 4 * 1024 * 1024);
+    static_cache_used = 0;
+
+    bulk_prefixes_ = Globalreg::globalreg->kismet_config->fetch_opt_vec("httpd_bulk_route");
+    bulk_concurrency_ =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("httpd_bulk_concurrency", 
+                std::max(1U, std::thread::hardware_concurrency() / 2));
+    bulk_nice_ = Globalreg::globalreg->kismet_config->fetch_opt_as<int>("httpd_bulk_nice", 5);
+    bulk_active = 0;
+
+    keepalive_timeout_ = std::chrono::milliseconds(
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("httpd_keepalive_timeout", 15) * 1000);
+
+    ws_queue_frames_ =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("httpd_ws_queue_frames", 1024);
+    ws_queue_bytes_ =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("httpd_ws_queue_bytes", 16 * 1024 * 1024);
+
+    auto slow_policy = 
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("httpd_ws_slow_consumer", "drop"));
+
+    if (slow_policy == "coalesce") {
+        ws_slow_consumer_ = ws_slow_consumer_policy::coalesce;
+    } else if (slow_policy == "disconnect") {
+        ws_slow_consumer_ = ws_slow_consumer_policy::disconnect;
+    } else {
+        if (slow_policy != "drop")
+            _MSG_ERROR("(HTTPD) Unknown httpd_ws_slow_consumer policy '{}', dropping the "
+                    "oldest frames of slow websocket clients.", slow_policy);
+        ws_slow_consumer_ = ws_slow_consumer_policy::drop_oldest;
+    }
+
     admin_username = Globalreg::globalreg->kismet_config->fetch_opt("httpd_username");
     admin_password = Globalreg::globalreg->kismet_config->fetch_opt("httpd_password");
 
@@ -381,6 +721,76 @@ void kis_net_beast_httpd::trigger_deferred_startup() {
                 }, auth_mutex));
 
 
+    auto entrytracker = Globalreg::fetch_mandatory_global_as<entry_tracker>();
+
+    connections_rrd = 
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<>>("kismet.httpd.connections_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "new http connections rrd");
+    requests_rrd = 
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<>>("kismet.httpd.requests_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "http requests rrd");
+    requests_per_connection_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(
+                "kismet.httpd.requests_per_connection_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "most requests served by a closed http connection rrd");
+    connection_setup_rrd =
+        entrytracker->register_and_get_field_as<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(
+                "kismet.httpd.connection_setup_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "longest time from accepting a connection to reading its first request, "
+                "in microseconds, rrd");
+
+    route_ttfb_rrd_id =
+        entrytracker->register_field("kismet.httpd.route_ttfb_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "longest time to the first byte of a response, in microseconds, rrd");
+    route_ttfb_map =
+        entrytracker->register_and_get_field_as<tracker_element_string_map>("kismet.httpd.route_ttfb",
+                tracker_element_factory<tracker_element_string_map>(),
+                "time to first byte by route");
+
+    metrics_map = std::make_shared<tracker_element_map>();
+    metrics_map->insert(connections_rrd);
+    metrics_map->insert(requests_rrd);
+    metrics_map->insert(requests_per_connection_rrd);
+    metrics_map->insert(connection_setup_rrd);
+    metrics_map->insert(route_ttfb_map);
+
+    register_route("/httpd/metrics", {"GET", "POST"}, RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(metrics_map, metrics_mutex));
+
+    register_route("/httpd/websockets", {"GET"}, LOGON_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                auto ret = std::make_shared<tracker_element_vector>();
+
+                kis_lock_guard<kis_mutex> lk(websocket_mutex, "httpd websocket stats");
+
+                for (const auto& w : websocket_vec) {
+                    auto ws = w.lock();
+
+                    if (ws == nullptr)
+                        continue;
+
+                    auto wmap = std::make_shared<tracker_element_string_map>();
+                    wmap->insert(std::make_pair("kismet.httpd.websocket.uri",
+                                std::make_shared<tracker_element_string>(ws->uri())));
+                    wmap->insert(std::make_pair("kismet.httpd.websocket.queue_depth",
+                                std::make_shared<tracker_element_uint64>(ws->queue_depth())));
+                    wmap->insert(std::make_pair("kismet.httpd.websocket.queue_bytes",
+                                std::make_shared<tracker_element_uint64>(ws->queue_bytes())));
+                    wmap->insert(std::make_pair("kismet.httpd.websocket.dropped_frames",
+                                std::make_shared<tracker_element_uint64>(ws->dropped_frames())));
+
+                    ret->push_back(wmap);
+                }
+
+                return ret;
+                }));
+
     // Test echo websocket
     register_websocket_route("/debug/echo", LOGON_ROLE, {"ws"},
             std::make_shared<kis_net_web_function_endpoint>(
@@ -476,7 +886,7 @@ void kis_net_beast_httpd::start_accept() {
 
     auto this_ref = shared_from_this();
 
-    acceptor.async_accept(boost::asio::make_strand(Globalreg::globalreg->io),
+    acceptor.async_accept(boost::asio::make_strand(Globalreg::globalreg->http_io),
             boost::beast::bind_front_handler(&kis_net_beast_httpd::handle_connection, shared_from_this()));
 }
 
@@ -488,25 +898,57 @@ void kis_net_beast_httpd::handle_connection(const boost::system::error_code& ec,
 
 	// Spin each connection into its own thread
     if (!ec) {
-        std::thread conthread([this, tcp_socket = boost::beast::tcp_stream(std::move(socket))]() mutable {
+        record_connection();
+
+        std::thread conthread([this, tcp_socket = boost::beast::tcp_stream(std::move(socket)),
+                accept_ts = std::chrono::steady_clock::now()]() mutable {
                 thread_set_process_name("BEAST");
 
+                // Requests pipelined by the client may be read ahead with the previous 
+                // request, so the read buffer lives as long as the socket
+                boost::beast::flat_buffer buffer;
+
+                unsigned int n_requests = 0;
+
                 while (tcp_socket.socket().is_open()) {
 					// Reset the timeout every loop through; each request in this 
 					// socket pipeline has up to 30 seconds to complete
 					boost::beast::get_lowest_layer(tcp_socket).expires_after(std::chrono::seconds(30));
 
+                    // Idle keep-alive connections give up their thread once the client 
+                    // has been quiet for the keepalive timeout; the blocking reads can't
+                    // be timed out by the stream
+                    if (n_requests > 0 && buffer.size() == 0 && keepalive_timeout_.count() > 0) {
+                        struct pollfd pfd;
+                        pfd.fd = tcp_socket.socket().native_handle();
+                        pfd.events = POLLIN;
+                        pfd.revents = 0;
+
+                        if (poll(&pfd, 1, keepalive_timeout_.count()) <= 0)
+                            break;
+                    }
+
                     // Associate the socket
                     auto conn = 
-                        std::make_shared<kis_net_beast_httpd_connection>(tcp_socket, shared_from_this());
+                        std::make_shared<kis_net_beast_httpd_connection>(tcp_socket, buffer, 
+                                shared_from_this());
 
                     // Run the connection
                     auto retain = conn->start();
 
+                    if (conn->has_request()) {
+                        if (n_requests == 0)
+                            record_connection_setup(std::chrono::duration_cast<std::chrono::microseconds>(
+                                        conn->request_ts_ - accept_ts));
+                        n_requests++;
+                    }
+
                     if (retain == false)
                         break;
                 }
 
+                record_connection_close(n_requests);
+
                 try {
                     tcp_socket.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send);
                 } catch (...) {
@@ -702,6 +1144,7 @@ void kis_net_beast_httpd::register_route(const std::string& route, const std::li
         b_verbs.emplace_back(boost::beast::http::string_to_verb(v));
 
     route_vec.emplace_back(std::make_shared<kis_net_beast_route>(route, b_verbs, true, roles, handler));
+    route_tree.insert(route_vec.back());
 }
 
 void kis_net_beast_httpd::register_route(const std::string& route, 
@@ -728,6 +1171,7 @@ void kis_net_beast_httpd::register_route(const std::string& route,
         b_verbs.emplace_back(boost::beast::http::string_to_verb(v));
 
     route_vec.emplace_back(std::make_shared<kis_net_beast_route>(route, b_verbs, true, roles, extensions, handler));
+    route_tree.insert(route_vec.back());
 }
 
 void kis_net_beast_httpd::remove_route(const std::string& route) {
@@ -736,11 +1180,51 @@ void kis_net_beast_httpd::remove_route(const std::string& route) {
     for (auto i = route_vec.begin(); i != route_vec.end(); ++i) {
         if ((*i)->route() == route) {
             route_vec.erase(i);
+
+            // Removal is rare; rebuild the tree rather than pruning it
+            route_tree.clear();
+            for (const auto& r : route_vec)
+                route_tree.insert(r);
+
             return;
         }
     }
 }
 
+void kis_net_beast_httpd::set_route_body_limit(const std::string& route, size_t in_limit) {
+    kis_lock_guard<kis_mutex> lk(route_mutex, "beast_httpd set_route_body_limit");
+    body_limits_[route] = in_limit;
+}
+
+size_t kis_net_beast_httpd::route_body_limit(boost::beast::string_view target) {
+    // Default limit for forms and JSON commands
+    const size_t default_limit = 100000;
+
+    auto q = target.find('?');
+    if (q != boost::beast::string_view::npos)
+        target = target.substr(0, q);
+
+    strip_uri_prefix(target);
+
+    auto dot = target.find_last_of('.');
+    auto slash = target.find_last_of('/');
+    if (dot != boost::beast::string_view::npos &&
+            (slash == boost::beast::string_view::npos || dot > slash))
+        target = target.substr(0, dot);
+
+    kis_lock_guard<kis_mutex> lk(route_mutex, "beast_httpd route_body_limit");
+
+    if (body_limits_.size() == 0)
+        return default_limit;
+
+    auto l = body_limits_.find(std::string(target));
+
+    if (l == body_limits_.end())
+        return default_limit;
+
+    return l->second;
+}
+
 void kis_net_beast_httpd::register_unauth_route(const std::string& route, 
         const std::list<std::string>& verbs,
         std::shared_ptr<kis_net_web_endpoint> handler) {
@@ -750,6 +1234,7 @@ void kis_net_beast_httpd::register_unauth_route(const std::string& route,
         b_verbs.emplace_back(boost::beast::http::string_to_verb(v));
     route_vec.emplace_back(std::make_shared<kis_net_beast_route>(route, b_verbs, false, 
                 std::list<std::string>{""}, handler));
+    route_tree.insert(route_vec.back());
 }
 
 void kis_net_beast_httpd::register_unauth_route(const std::string& route, 
@@ -762,6 +1247,7 @@ void kis_net_beast_httpd::register_unauth_route(const std::string& route,
     route_vec.emplace_back(std::make_shared<kis_net_beast_route>(route, b_verbs, false, 
                 std::list<std::string>{""},
                 extensions, handler));
+    route_tree.insert(route_vec.back());
 }
 
 void kis_net_beast_httpd::register_websocket_route(const std::string& route, 
@@ -777,6 +1263,7 @@ void kis_net_beast_httpd::register_websocket_route(const std::string& route,
 
     websocket_route_vec.emplace_back(std::make_shared<kis_net_beast_route>(route, 
                 std::list<boost::beast::http::verb>{}, true, roles, extensions, handler));
+    websocket_route_tree.insert(websocket_route_vec.back());
 
 }
 
@@ -807,6 +1294,7 @@ std::string kis_net_beast_httpd::create_auth_impl(const std::string& name, const
     auto auth = std::make_shared<kis_net_beast_auth>(token, name, role, expiry);
 
     auth_vec.emplace_back(auth);
+    flush_auth_cache();
     store_auth();
 
     return token;
@@ -864,6 +1352,7 @@ bool kis_net_beast_httpd::remove_auth(const std::string& auth_name) {
     for (auto a = auth_vec.begin(); a != auth_vec.end(); ++a) {
         if ((*a)->name() == auth_name) {
             auth_vec.erase(a);
+            flush_auth_cache();
             store_auth();
             return true;
         }
@@ -873,21 +1362,48 @@ bool kis_net_beast_httpd::remove_auth(const std::string& auth_name) {
 }
 
 std::shared_ptr<kis_net_beast_auth> kis_net_beast_httpd::check_auth_token(const boost::beast::string_view& token) {
+    if (token.length() == 0)
+        return nullptr;
+
+    time_t now = Globalreg::globalreg->last_tv_sec;
+    auto slot = std::hash<std::string_view>{}(std::string_view(token.data(), token.length())) % auth_cache_slots;
+
+    auto cached = std::atomic_load(&auth_cache[slot]);
+
+    if (cached != nullptr && cached->expires > now && 
+            !boost_stringview_constant_time_string_compare_ne{}(token, cached->token))
+        return cached->auth;
+
     kis_lock_guard<kis_mutex> lk(auth_mutex, "beast_httpd check_auth_token");
 
     // Step one: is it a JWT token? 
     auto authtoken = check_jwt_token(token);
 
-    if (authtoken != nullptr) 
-        return authtoken;
+    if (authtoken == nullptr) {
+        for (const auto& a : auth_vec) {
+            if (a->check_auth(token)) {
+                authtoken = a;
+                break;
+            }
+        }
+    }
 
-    for (const auto& a : auth_vec) {
-        if (a->check_auth(token)) 
-            return a;
+    auto entry = std::make_shared<auth_cache_entry>();
+    entry->token = static_cast<std::string>(token);
+    entry->auth = authtoken;
+    entry->expires = now + auth_cache_ttl;
 
-    }
+    if (authtoken != nullptr && authtoken->expires() != 0 && authtoken->expires() < entry->expires)
+        entry->expires = authtoken->expires();
 
-    return nullptr;
+    std::atomic_store(&auth_cache[slot], std::shared_ptr<const auth_cache_entry>(entry));
+
+    return authtoken;
+}
+
+void kis_net_beast_httpd::flush_auth_cache() {
+    for (auto& c : auth_cache)
+        std::atomic_store(&c, std::shared_ptr<const auth_cache_entry>());
 }
 
 std::shared_ptr<kis_net_beast_auth> kis_net_beast_httpd::check_jwt_token(const boost::beast::string_view& token) {
@@ -948,6 +1464,7 @@ void kis_net_beast_httpd::load_auth() {
     kis_lock_guard<kis_mutex> lk(auth_mutex, "beast_httpd load_auth");
 
     auth_vec.clear();
+    flush_auth_cache();
 
     auto sessiondb_file = 
         Globalreg::globalreg->kismet_config->fetch_opt_path("httpd_session_db", 
@@ -982,23 +1499,198 @@ void kis_net_beast_httpd::load_auth() {
 std::shared_ptr<kis_net_beast_route> kis_net_beast_httpd::find_endpoint(std::shared_ptr<kis_net_beast_httpd_connection> con) {
     kis_lock_guard<kis_mutex> lk(route_mutex, "beast_httpd find_endpoint");
 
-    for (const auto& r : route_vec) {
-        if (r->match_url(static_cast<const std::string>(con->uri()), con->uri_params_, con->http_variables_)) 
-            return r;
-    }
-
-    return nullptr;
+    return route_tree.find(static_cast<const std::string>(con->uri()), con->uri_params_, 
+            con->http_variables_);
 }
 
 std::shared_ptr<kis_net_beast_route> kis_net_beast_httpd::find_websocket_endpoint(std::shared_ptr<kis_net_beast_httpd_connection> con) {
     kis_lock_guard<kis_mutex> lk(route_mutex, "beast_httpd find_websocket_endpoint");
 
-    for (const auto& r : websocket_route_vec) {
-        if (r->match_url(static_cast<const std::string>(con->uri()), con->uri_params_, con->http_variables_))
-            return r;
+    return websocket_route_tree.find(static_cast<const std::string>(con->uri()), con->uri_params_, 
+            con->http_variables_);
+}
+
+bool kis_net_beast_httpd::bulk_route(const std::string& route) const {
+    for (const auto& p : bulk_prefixes_) {
+        if (route.compare(0, p.length(), p) == 0)
+            return true;
     }
 
-    return nullptr;
+    return false;
+}
+
+void kis_net_beast_httpd::acquire_bulk_slot() {
+    if (bulk_concurrency_ == 0)
+        return;
+
+    std::unique_lock<std::mutex> lk(bulk_mutex);
+    bulk_cv.wait(lk, [this]() { return bulk_active < bulk_concurrency_; });
+    bulk_active++;
+}
+
+void kis_net_beast_httpd::release_bulk_slot() {
+    if (bulk_concurrency_ == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk(bulk_mutex);
+        bulk_active--;
+    }
+
+    bulk_cv.notify_one();
+}
+
+void kis_net_beast_httpd::record_connection() {
+    if (connections_rrd != nullptr)
+        connections_rrd->add_sample(1, Globalreg::globalreg->last_tv_sec);
+}
+
+void kis_net_beast_httpd::record_connection_setup(std::chrono::microseconds setup) {
+    if (connection_setup_rrd != nullptr)
+        connection_setup_rrd->add_sample(setup.count(), Globalreg::globalreg->last_tv_sec);
+}
+
+void kis_net_beast_httpd::record_request() {
+    if (requests_rrd != nullptr)
+        requests_rrd->add_sample(1, Globalreg::globalreg->last_tv_sec);
+}
+
+void kis_net_beast_httpd::record_connection_close(unsigned int n_requests) {
+    if (requests_per_connection_rrd != nullptr && n_requests > 0)
+        requests_per_connection_rrd->add_sample(n_requests, Globalreg::globalreg->last_tv_sec);
+}
+
+void kis_net_beast_httpd::record_route_ttfb(const std::string& route, std::chrono::microseconds ttfb) {
+    if (route_ttfb_map == nullptr)
+        return;
+
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> rrd;
+
+    {
+        kis_lock_guard<kis_mutex> lk(metrics_mutex, "httpd record_route_ttfb");
+
+        auto ri = route_ttfb_map->find(route);
+
+        if (ri != route_ttfb_map->end()) {
+            rrd = std::static_pointer_cast<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(ri->second);
+        } else {
+            rrd = std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(route_ttfb_rrd_id);
+            route_ttfb_map->insert(route, rrd);
+        }
+    }
+
+    // RRDs lock themselves
+    rrd->add_sample(ttfb.count(), Globalreg::globalreg->last_tv_sec);
+}
+
+void kis_net_beast_httpd::register_websocket(std::shared_ptr<kis_net_web_websocket_endpoint> ws) {
+    kis_lock_guard<kis_mutex> lk(websocket_mutex, "httpd register_websocket");
+    websocket_vec.push_back(ws);
+}
+
+void kis_net_beast_httpd::remove_websocket(std::shared_ptr<kis_net_web_websocket_endpoint> ws) {
+    kis_lock_guard<kis_mutex> lk(websocket_mutex, "httpd remove_websocket");
+
+    websocket_vec.erase(std::remove_if(websocket_vec.begin(), websocket_vec.end(),
+                [&ws](const std::weak_ptr<kis_net_web_websocket_endpoint>& w) {
+                    auto wl = w.lock();
+                    return wl == nullptr || wl == ws;
+                }), websocket_vec.end());
+}
+
+bool kis_net_beast_httpd::cacheable_uri(const boost::beast::string_view& uri) const {
+    if (cached_uris_.size() == 0)
+        return false;
+
+    return cached_uris_.find(static_cast<std::string>(uri)) != cached_uris_.end();
+}
+
+std::shared_ptr<kis_net_beast_httpd::cached_response> 
+    kis_net_beast_httpd::fetch_cached_response(const std::string& key) {
+    kis_lock_guard<kis_mutex> lk(response_cache_mutex, "beast_httpd fetch_cached_response");
+
+    auto ci = response_cache.find(key);
+
+    if (ci == response_cache.end())
+        return nullptr;
+
+    if (std::chrono::steady_clock::now() - ci->second->ts > response_cache_time_) {
+        response_cache.erase(ci);
+        return nullptr;
+    }
+
+    return ci->second;
+}
+
+void kis_net_beast_httpd::cache_response(const std::string& key, 
+        std::shared_ptr<cached_response> response) {
+    kis_lock_guard<kis_mutex> lk(response_cache_mutex, "beast_httpd cache_response");
+    response_cache[key] = response;
+}
+
+nlohmann::json kis_net_beast_httpd::parse_request_json(const boost::beast::string_view& body,
+        std::unordered_map<std::string, std::string>& member_keys) {
+    // Small bodies aren't worth splitting
+    if (body.length() < 512)
+        return nlohmann::json::parse(body.begin(), body.end());
+
+    std::vector<json_member> members;
+
+    if (!split_json_members(body, members))
+        return nlohmann::json::parse(body.begin(), body.end());
+
+    std::string rest{"{"};
+    std::vector<std::pair<std::string, std::shared_ptr<const nlohmann::json>>> cached;
+
+    for (const auto& m : members) {
+        if (m.name != "fields" && m.name != "regex" && m.name != "colmap") {
+            if (rest.length() > 1)
+                rest += ",";
+            rest += "\"";
+            rest.append(m.name.data(), m.name.length());
+            rest += "\":";
+            rest.append(m.text.data(), m.text.length());
+            continue;
+        }
+
+        auto name = static_cast<std::string>(m.name);
+        auto text = static_cast<std::string>(m.text);
+        auto key = name + ":" + text;
+
+        std::shared_ptr<const nlohmann::json> parsed;
+
+        {
+            kis_lock_guard<kis_mutex> lk(request_member_mutex, "beast_httpd parse_request_json");
+            auto ci = request_member_cache.find(key);
+            if (ci != request_member_cache.end())
+                parsed = ci->second;
+        }
+
+        if (parsed == nullptr) {
+            parsed = std::make_shared<const nlohmann::json>(nlohmann::json::parse(text));
+
+            kis_lock_guard<kis_mutex> lk(request_member_mutex, "beast_httpd parse_request_json");
+
+            // Only a handful of distinct requests are expected from the UI; anything more
+            // is a client generating them, so start over instead of growing
+            if (request_member_cache.size() >= 256)
+                request_member_cache.clear();
+
+            request_member_cache[key] = parsed;
+        }
+
+        member_keys[name] = std::move(text);
+        cached.push_back(std::make_pair(std::move(name), parsed));
+    }
+
+    rest += "}";
+
+    auto json = nlohmann::json::parse(rest);
+
+    for (const auto& c : cached)
+        json[c.first] = *c.second;
+
+    return json;
 }
 
 void kis_net_beast_httpd::register_static_dir(const std::string& prefix, const std::string& path) {
@@ -1076,46 +1768,169 @@ bool kis_net_beast_httpd::serve_file(std::shared_ptr<kis_net_beast_httpd_connect
             continue;
         }
 
-        boost::beast::http::file_body::value_type body;
-        body.open(modified_realpath, boost::beast::file_mode::scan, ec);
+        struct stat st;
+        auto realpath_s = std::string(modified_realpath);
 
         free(modified_realpath);
         free(base_realpath);
 
-        if (ec == boost::beast::errc::no_such_file_or_directory) {
-            continue;
-        } else if (ec) {
-            // _MSG_ERROR("(DEBUG) {} - {}", uri, ec.message());
+        if (stat(realpath_s.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
             continue;
+
+        // Validators come from the file metadata, so they're known without reading the file
+        auto etag = fmt::format("\"{:x}-{:x}.{:x}\"", st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+
+        char lastmod[31];
+        struct tm tmstruct;
+        gmtime_r(&st.st_mtim.tv_sec, &tmstruct);
+        strftime(lastmod, 31, "%a, %d %b %Y %H:%M:%S GMT", &tmstruct);
+
+        auto inm_h = con->request().find(boost::beast::http::field::if_none_match);
+        if (inm_h != con->request().end() && 
+                (inm_h->value() == "*" || inm_h->value().find(etag) != boost::beast::string_view::npos)) {
+            boost::beast::http::response<boost::beast::http::empty_body> res{
+                boost::beast::http::status::not_modified, con->request().version()};
+
+            con->append_common_headers(res, uri);
+            res.set(boost::beast::http::field::etag, etag);
+            res.set(boost::beast::http::field::last_modified, lastmod);
+
+            ec = {};
+            boost::beast::http::write(con->stream(), res, ec);
+
+            return true;
         }
 
-        auto const size = body.size();
+        auto mime_type = resolve_mime_type(uri);
+
+        bool use_gzip = false;
+        auto ae_h = con->request().find(boost::beast::http::field::accept_encoding);
+        if (ae_h != con->request().end())
+            use_gzip = accepts_gzip(ae_h->value());
 
-        if (con->request().method() == boost::beast::http::verb::head) {
-            boost::beast::http::response<boost::beast::http::empty_body> res{boost::beast::http::status::ok, 
+        auto cached = fetch_static_file(realpath_s, st, mime_type);
+
+        if (cached != nullptr) {
+            bool send_gzip = use_gzip && cached->gzip_body.length() > 0;
+            const auto& content = send_gzip ? cached->gzip_body : cached->body;
+
+            boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::ok, 
                 con->request().version()};
 
             con->append_common_headers(res, uri);
+            res.set(boost::beast::http::field::etag, cached->etag);
+            res.set(boost::beast::http::field::last_modified, lastmod);
+
+            if (cached->gzip_body.length() > 0)
+                res.set(boost::beast::http::field::vary, "Accept-Encoding");
+
+            if (send_gzip)
+                res.set(boost::beast::http::field::content_encoding, "gzip");
 
-            res.content_length(size);
+            res.content_length(content.length());
 
             ec = {};
 
+            if (con->request().method() == boost::beast::http::verb::head) {
+                boost::beast::http::response_serializer<boost::beast::http::string_body> sr{res};
+                boost::beast::http::write_header(con->stream(), sr, ec);
+                return true;
+            }
+
+            res.body() = content;
             boost::beast::http::write(con->stream(), res, ec);
 
             return true;
         }
 
-        boost::beast::http::response<boost::beast::http::file_body> res{std::piecewise_construct,
-                std::make_tuple(std::move(body)), std::make_tuple(boost::beast::http::status::ok, 
-                        con->request().version())};
+        // Large files go from the file to the socket with sendfile
+        int fd = open(realpath_s.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            continue;
+
+        boost::beast::http::response<boost::beast::http::empty_body> res{boost::beast::http::status::ok, 
+            con->request().version()};
 
         con->append_common_headers(res, uri);
-        res.content_length(size);
+        res.set(boost::beast::http::field::etag, etag);
+        res.set(boost::beast::http::field::last_modified, lastmod);
+        res.content_length(st.st_size);
 
         ec = {};
 
-        boost::beast::http::write(con->stream(), res, ec);
+        boost::beast::http::response_serializer<boost::beast::http::empty_body> sr{res};
+        boost::beast::http::write_header(con->stream(), sr, ec);
+
+        if (ec || con->request().method() == boost::beast::http::verb::head) {
+            close(fd);
+            return true;
+        }
+
+        auto sock_fd = con->stream().socket().native_handle();
+        off_t offt = 0;
+
+        while (offt < st.st_size) {
+#ifdef SYS_LINUX
+            auto r = sendfile(sock_fd, fd, &offt, st.st_size - offt);
+
+            if (r > 0)
+                continue;
+#else
+            char buf[65536];
+            auto r = pread(fd, buf, std::min<off_t>(sizeof(buf), st.st_size - offt), offt);
+
+            if (r > 0) {
+                ssize_t w = 0;
+
+                while (w < r) {
+                    auto wr = write(sock_fd, buf + w, r - w);
+
+                    if (wr > 0) {
+                        w += wr;
+                        continue;
+                    }
+
+                    if (wr < 0 && (errno == EAGAIN || errno == EINTR)) {
+                        struct pollfd pfd;
+                        pfd.fd = sock_fd;
+                        pfd.events = POLLOUT;
+                        pfd.revents = 0;
+
+                        if (poll(&pfd, 1, 30000) > 0)
+                            continue;
+                    }
+
+                    break;
+                }
+
+                if (w == r) {
+                    offt += r;
+                    continue;
+                }
+
+                r = 0;
+            }
+#endif
+
+            if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+                struct pollfd pfd;
+                pfd.fd = sock_fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+
+                if (poll(&pfd, 1, 30000) > 0)
+                    continue;
+            }
+
+            // Short file or broken client; the length is already sent so the 
+            // connection can't be reused
+            close(fd);
+            con->stream().socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            return true;
+        }
+
+        close(fd);
 
         return true;
     }
@@ -1123,6 +1938,70 @@ bool kis_net_beast_httpd::serve_file(std::shared_ptr<kis_net_beast_httpd_connect
     return false;
 }
 
+std::shared_ptr<kis_net_beast_httpd::static_file> 
+    kis_net_beast_httpd::fetch_static_file(const std::string& path, const struct stat& st,
+            const std::string& mime_type) {
+
+    if (static_cache_size_ == 0 || static_cast<size_t>(st.st_size) > static_cache_max_file_)
+        return nullptr;
+
+    {
+        kis_lock_guard<kis_mutex> lk(static_cache_mutex, "httpd fetch_static_file");
+
+        auto ci = static_cache.find(path);
+
+        if (ci != static_cache.end()) {
+            if (ci->second->size == st.st_size && 
+                    ci->second->mtime.tv_sec == st.st_mtim.tv_sec &&
+                    ci->second->mtime.tv_nsec == st.st_mtim.tv_nsec)
+                return ci->second;
+
+            static_cache_used -= ci->second->body.length() + ci->second->gzip_body.length();
+            static_cache.erase(ci);
+        }
+    }
+
+    std::ifstream ifs(path, std::ios::binary);
+
+    if (!ifs.is_open())
+        return nullptr;
+
+    auto f = std::make_shared<static_file>();
+    f->body.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+    // The file changed while we read it; serve it uncached
+    if (static_cast<off_t>(f->body.length()) != st.st_size)
+        return nullptr;
+
+    f->size = st.st_size;
+    f->mtime = st.st_mtim;
+    f->etag = fmt::format("\"{:x}-{:x}.{:x}\"", st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+
+    if (compressible_type(mime_type)) {
+        gzip_encoder gz;
+
+        if (gz.begin()) {
+            gz.compress(f->body.data(), f->body.length(), Z_FINISH, f->gzip_body);
+
+            // Only keep variants worth sending
+            if (f->gzip_body.length() >= f->body.length())
+                f->gzip_body.clear();
+        }
+    }
+
+    kis_lock_guard<kis_mutex> lk(static_cache_mutex, "httpd fetch_static_file");
+
+    auto sz = f->body.length() + f->gzip_body.length();
+
+    // Once the cache is full, further files are served from disk
+    if (static_cache_used + sz <= static_cache_size_ && static_cache.find(path) == static_cache.end()) {
+        static_cache_used += sz;
+        static_cache[path] = f;
+    }
+
+    return f;
+}
+
 bool kis_net_beast_httpd::serve_file(std::shared_ptr<kis_net_beast_httpd_connection> con) {
 
     std::string uri;
@@ -1147,12 +2026,18 @@ void kis_net_beast_httpd::strip_uri_prefix(boost::beast::string_view& uri_view)
 
 
 kis_net_beast_httpd_connection::kis_net_beast_httpd_connection(boost::beast::tcp_stream& socket,
-        std::shared_ptr<kis_net_beast_httpd> httpd) :
+        boost::beast::flat_buffer& buffer, std::shared_ptr<kis_net_beast_httpd> httpd) :
     httpd{httpd},
     stream_{socket},
+    buffer{buffer},
+    has_request_{false},
+    first_byte_recorded_{false},
     login_valid_{false},
     first_response_write{false} {
         Globalreg::n_tracked_http_connections++;
+
+        // Large responses are generated no faster than the client reads them
+        response_stream_.set_high_water(httpd->response_backlog());
     }
 
 kis_net_beast_httpd_connection::~kis_net_beast_httpd_connection() {
@@ -1206,6 +2091,9 @@ bool kis_net_beast_httpd_connection::start() {
     parser_->body_limit(100000);
 
     try {
+        // The body limit depends on the route, so the headers are read first
+        boost::beast::http::read_header(stream_, buffer, *parser_);
+        parser_->body_limit(httpd->route_body_limit(parser_->get().target()));
         boost::beast::http::read(stream_, buffer, *parser_);
     } catch (const boost::system::system_error& e) {
         // Silently catch and fail on any error from the transport layer, because we don't
@@ -1213,6 +2101,10 @@ bool kis_net_beast_httpd_connection::start() {
         return do_close();
     }
 
+    has_request_ = true;
+    request_ts_ = std::chrono::steady_clock::now();
+    httpd->record_request();
+
     request_ = boost::beast::http::request<boost::beast::http::string_body>(parser_->release());
 
     uri_ = request_.target();
@@ -1401,6 +2293,8 @@ bool kis_net_beast_httpd_connection::start() {
     auto route = httpd->find_endpoint(shared_from_this());
 
     if (route != nullptr) {
+        route_name_ = route->route();
+
         if (!route->match_verb(verb_)) {
             boost::beast::http::response<boost::beast::http::string_body> 
                 res{boost::beast::http::status::method_not_allowed, request_.version()};
@@ -1491,6 +2385,50 @@ bool kis_net_beast_httpd_connection::start() {
 
     append_common_headers(response, uri_);
 
+    bool use_gzip = false;
+
+    if (httpd->compress_responses()) {
+        auto ae_h = request_.find(boost::beast::http::field::accept_encoding);
+        if (ae_h != request_.end())
+            use_gzip = accepts_gzip(ae_h->value());
+    }
+
+    // Frequently polled endpoints are answered from a recently generated response
+    std::string cache_key;
+
+    if (verb_ == boost::beast::http::verb::get && httpd->cacheable_uri(uri_)) {
+        cache_key = fmt::format("{}:{}", use_gzip ? "gzip" : "identity", uri_);
+
+        auto cached = httpd->fetch_cached_response(cache_key);
+
+        if (cached != nullptr) {
+            boost::beast::http::response<boost::beast::http::string_body> res{
+                static_cast<boost::beast::http::status>(cached->status), request_.version()};
+
+            append_common_headers(res, uri_);
+            res.set(boost::beast::http::field::content_type, cached->content_type);
+
+            if (cached->content_encoding.length()) {
+                res.set(boost::beast::http::field::content_encoding, cached->content_encoding);
+                res.set(boost::beast::http::field::vary, "Accept-Encoding");
+            }
+
+            res.body() = cached->body;
+            res.prepare_payload();
+
+            boost::system::error_code error;
+
+            record_first_byte();
+
+            boost::beast::http::write(stream_, res, error);
+
+            if (error || client_req_close)
+                return do_close();
+
+            return true;
+        }
+    }
+
     if (request_.method() == boost::beast::http::verb::post) {
         // Handle POST data fields
         http_post = request_.body();
@@ -1505,8 +2443,7 @@ bool kis_net_beast_httpd_connection::start() {
             auto j_k = http_variables_.find("json");
             if (j_k != http_variables_.end()) {
                 try {
-                    std::stringstream ss(j_k->second);
-                    ss >> json_;
+                    json_ = httpd->parse_request_json(j_k->second, json_member_keys_);
                 } catch (std::exception& e) {
                     ;
                 }
@@ -1515,7 +2452,7 @@ bool kis_net_beast_httpd_connection::start() {
                 boost::beast::iequals(content_type, "application/json; charset=UTF-8")) {
 
             try {
-                json_ = nlohmann::json::parse(http_post.data());
+                json_ = httpd->parse_request_json(http_post, json_member_keys_);
             } catch (std::exception& e) {
                 ;
             }
@@ -1534,10 +2471,22 @@ bool kis_net_beast_httpd_connection::start() {
     auto generator_launched = std::promise<void>();
     auto generator_ft = generator_launched.get_future();
 
-    std::thread tr([this, route, generator_launched = std::move(generator_launched),
+    // Bulk requests wait here for a generator slot
+    bool bulk = httpd->bulk_route(route_name_);
+
+    if (bulk)
+        httpd->acquire_bulk_slot();
+
+    std::thread tr([this, route, bulk, generator_launched = std::move(generator_launched),
             self = shared_from_this()]() mutable {
         thread_set_process_name("BEAST-WAIT");
 
+#ifdef SYS_LINUX
+        // Thread niceness is per-thread on Linux
+        if (bulk && httpd->bulk_nice() != 0)
+            setpriority(PRIO_PROCESS, 0, httpd->bulk_nice());
+#endif
+
         generator_launched.set_value();
 
         try {
@@ -1553,12 +2502,47 @@ bool kis_net_beast_httpd_connection::start() {
             os << "ERROR: " << e.what();
         }
 
+        if (bulk)
+            httpd->release_bulk_slot();
+
         response_stream_.complete();
     });
     tr.detach();
 
     generator_ft.wait();
 
+    gzip_encoder gz;
+    std::string gz_out;
+
+    // Packet streams hand us many small chunks (pcapng blocks are split around the packet
+    // data they reference); combine them so that each packet isn't its own write
+    const size_t small_chunk_sz = 2048;
+    const size_t gather_sz = 64 * 1024;
+    std::vector<char> gather_buf;
+
+    // Completed responses are cached up to a sane size
+    std::string cache_body;
+    const size_t max_cache_body = 16 * 1024 * 1024;
+
+    // Write a block of the response as a chunk
+    auto write_chunk = [&](const char *data, size_t len, boost::system::error_code& error) {
+        if (len == 0)
+            return;
+
+        if (cache_key.length()) {
+            if (cache_body.length() + len > max_cache_body)
+                cache_key.clear();
+            else
+                cache_body.append(data, len);
+        }
+
+        response.body().data = (void *) data;
+        response.body().size = len;
+        response.body().more = true;
+
+        boost::beast::http::write(stream_, sr, error);
+    };
+
     boost::system::error_code error;
     while (response_stream_.size() || response_stream_.running()) {
         auto sz = response_stream_.size();
@@ -1566,6 +2550,15 @@ bool kis_net_beast_httpd_connection::start() {
         if (sz) {
             // Write the headers once we have body content
             if (!first_response_write) {
+                // The content type is known by now, decide if it's worth compressing
+                if (use_gzip && compressible_type(response[boost::beast::http::field::content_type]) &&
+                        gz.begin()) {
+                    response.set(boost::beast::http::field::content_encoding, "gzip");
+                    response.set(boost::beast::http::field::vary, "Accept-Encoding");
+                }
+
+                record_first_byte();
+
                 boost::beast::http::write_header(stream_, sr, error);
 
                 if (error) {
@@ -1580,13 +2573,27 @@ bool kis_net_beast_httpd_connection::start() {
             char *body_data;
             auto chunk_sz = response_stream_.get(&body_data);
 
-            response.body().data = (void *) body_data;
-            response.body().size = chunk_sz;
-            response.body().more = true;
+            if (chunk_sz < small_chunk_sz && chunk_sz < sz) {
+                if (gather_buf.size() == 0)
+                    gather_buf.resize(gather_sz);
 
-            boost::beast::http::write(stream_, sr, error);
+                chunk_sz = response_stream_.gather(gather_buf.data(), gather_buf.size());
+                body_data = gather_buf.data();
+            }
 
-            response_stream_.consume(chunk_sz);
+            if (gz.is_active()) {
+                // Flush whenever the generator has nothing more buffered, so that slow
+                // streaming responses still reach the client as they're produced
+                gz_out.clear();
+                gz.compress(body_data, chunk_sz, 
+                        chunk_sz >= sz ? Z_SYNC_FLUSH : Z_NO_FLUSH, gz_out);
+                response_stream_.consume(chunk_sz);
+
+                write_chunk(gz_out.data(), gz_out.length(), error);
+            } else {
+                write_chunk(body_data, chunk_sz, error);
+                response_stream_.consume(chunk_sz);
+            }
 
             // _MSG_INFO("(DEBUG) {} {} - Consumed {}/{} running {}", verb_, uri_, sz, response_stream_.size(), response_stream_.running());
 
@@ -1609,11 +2616,27 @@ bool kis_net_beast_httpd_connection::start() {
 
     // _MSG_INFO("(DEBUG) {} {} - Out of buffer poll loop, remaining {}, running {}", verb_, uri_, response_stream_.size(), response_stream_.running());
 
+    if (gz.is_active()) {
+        gz_out.clear();
+        gz.compress(nullptr, 0, Z_FINISH, gz_out);
+
+        write_chunk(gz_out.data(), gz_out.length(), error);
+
+        if (error == boost::beast::http::error::need_buffer) {
+            error = {};
+        } else if (error) {
+            return do_close();
+        }
+    }
+
     // Send the completion record for the chunked response
     response.body().data = nullptr;
     response.body().size = 0;
     response.body().more = false;
 
+    // Responses with no content send their headers with the completion
+    record_first_byte();
+
     boost::beast::http::write(stream_, sr, error);
 
     if (error) {
@@ -1621,12 +2644,32 @@ bool kis_net_beast_httpd_connection::start() {
         return do_close();
     }
 
+    if (cache_key.length() && response.result() == boost::beast::http::status::ok) {
+        auto cached = std::make_shared<kis_net_beast_httpd::cached_response>();
+        cached->ts = std::chrono::steady_clock::now();
+        cached->status = response.result_int();
+        cached->content_type = static_cast<std::string>(response[boost::beast::http::field::content_type]);
+        cached->content_encoding = gz.is_active() ? "gzip" : "";
+        cached->body = std::move(cache_body);
+        httpd->cache_response(cache_key, cached);
+    }
+
     if (client_req_close)
         return do_close();
 
     return true;
 }
 
+void kis_net_beast_httpd_connection::record_first_byte() {
+    if (first_byte_recorded_ || route_name_.length() == 0)
+        return;
+
+    first_byte_recorded_ = true;
+
+    httpd->record_route_ttfb(route_name_,
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - request_ts_));
+}
+
 bool kis_net_beast_httpd_connection::do_close() {
     if (closure_cb) {
         closure_cb();
@@ -1665,6 +2708,8 @@ kis_net_beast_route::kis_net_beast_route(const std::string& route,
     auto ext_str = std::regex_replace(route, path_re, path_capture_pattern);
     // Match the RE + http variables
     match_re = std::regex(fmt::format("^{}(\\?.*?)?$", ext_str));
+
+    compile_segments();
 }
 
 kis_net_beast_route::kis_net_beast_route(const std::string& route, 
@@ -1676,7 +2721,8 @@ kis_net_beast_route::kis_net_beast_route(const std::string& route,
     verbs_{verbs},
     login_{login},
     roles_{roles},
-    match_types{true} {
+    match_types{true},
+    extensions_{extensions.begin(), extensions.end()} {
 
     // Generate the keys list
     for (auto i = std::sregex_token_iterator(route.begin(), route.end(), path_re); 
@@ -1709,6 +2755,220 @@ kis_net_beast_route::kis_net_beast_route(const std::string& route,
 
     // Match the RE + filetypes + http variables
     match_re = std::regex(fmt::format("^{}{}(\\?.*?)?$", ext_str, ft_regex));
+
+    compile_segments();
+}
+
+namespace {
+    bool is_alnum_string(const std::string& s) {
+        if (s.length() == 0)
+            return false;
+
+        for (const auto& c : s) {
+            if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+                return false;
+        }
+
+        return true;
+    }
+}
+
+void kis_net_beast_route::compile_segments() {
+    tree_matchable_ = false;
+
+    if (route_.length() == 0 || route_[0] != '/')
+        return;
+
+    for (const auto& e : extensions_)
+        if (!is_alnum_string(e))
+            return;
+
+    // Literal segments are regex expressions in the route regex, so anything which might
+    // be interpreted by the regex has to stay with the regex; parameters have to be a
+    // whole segment
+    size_t start = 1;
+
+    while (true) {
+        auto end = route_.find('/', start);
+        auto seg = route_.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+        if (seg.length() > 0 && seg[0] == ':') {
+            path_segments_.push_back(seg);
+        } else {
+            if (seg.find_first_of(".*+?()[]{}|^$\\:") != std::string::npos)
+                return;
+
+            path_segments_.push_back(seg);
+        }
+
+        if (end == std::string::npos)
+            break;
+
+        start = end + 1;
+    }
+
+    tree_matchable_ = true;
+}
+
+bool kis_net_beast_route::match_extension(const std::string& ext) const {
+    if (extensions_.size() == 0)
+        return is_alnum_string(ext);
+
+    for (const auto& e : extensions_)
+        if (e == ext)
+            return true;
+
+    return false;
+}
+
+void kis_net_beast_route::populate_params(const std::vector<std::string>& captures, 
+        const std::string& ext, const std::string& getvars, 
+        kis_net_beast_httpd_connection::uri_param_t& uri_params) {
+    size_t key_num = 0;
+
+    for (const auto& c : captures)
+        uri_params.emplace(std::make_pair(match_keys[key_num++], c));
+
+    if (match_types)
+        uri_params.emplace(std::make_pair(match_keys[key_num++], ext));
+
+    uri_params.emplace(std::make_pair(match_keys[key_num++], getvars));
+}
+
+void kis_net_beast_route_tree::insert(std::shared_ptr<kis_net_beast_route> route) {
+    auto route_seq = seq++;
+
+    if (!route->tree_matchable()) {
+        regex_routes.emplace_back(route_seq, route);
+        return;
+    }
+
+    auto n = &root;
+
+    for (const auto& seg : route->path_segments()) {
+        if (seg[0] == ':') {
+            if (n->param == nullptr)
+                n->param = std::make_unique<node>();
+            n = n->param.get();
+        } else {
+            auto& child = n->literals[seg];
+            if (child == nullptr)
+                child = std::make_unique<node>();
+            n = child.get();
+        }
+    }
+
+    n->routes.emplace_back(route_seq, route);
+}
+
+void kis_net_beast_route_tree::clear() {
+    root.literals.clear();
+    root.param.reset();
+    root.routes.clear();
+    regex_routes.clear();
+    seq = 0;
+}
+
+void kis_net_beast_route_tree::walk(const node *n, const std::vector<std::string>& segs,
+        size_t pos, const std::string& base, const std::string& ext, bool use_ext,
+        std::vector<std::string>& captures, match& best) {
+
+    if (pos == segs.size()) {
+        for (const auto& r : n->routes) {
+            if (r.first >= best.seq)
+                break;
+
+            if (r.second->has_extension() != use_ext)
+                continue;
+
+            if (use_ext && !r.second->match_extension(ext))
+                continue;
+
+            best.seq = r.first;
+            best.route = r.second;
+            best.captures = captures;
+            break;
+        }
+
+        return;
+    }
+
+    // The last segment is either matched whole, or without its extension for routes 
+    // which take one
+    const auto& seg = (pos == segs.size() - 1 && use_ext) ? base : segs[pos];
+
+    auto li = n->literals.find(seg);
+    if (li != n->literals.end())
+        walk(li->second.get(), segs, pos + 1, base, ext, use_ext, captures, best);
+
+    if (n->param != nullptr && seg.length() > 0) {
+        captures.push_back(seg);
+        walk(n->param.get(), segs, pos + 1, base, ext, use_ext, captures, best);
+        captures.pop_back();
+    }
+}
+
+std::shared_ptr<kis_net_beast_route> kis_net_beast_route_tree::find(const std::string& url,
+        uri_param_t& uri_params, std::unordered_map<std::string, std::string>& uri_variables) {
+
+    match best{std::numeric_limits<size_t>::max(), nullptr, {}};
+
+    auto qpos = url.find('?');
+    auto path = url.substr(0, qpos);
+    auto getvars = qpos == std::string::npos ? std::string{} : url.substr(qpos);
+
+    std::string ext;
+
+    if (path.length() > 0 && path[0] == '/') {
+        std::vector<std::string> segs;
+        size_t start = 1;
+
+        while (true) {
+            auto end = path.find('/', start);
+            segs.push_back(path.substr(start, end == std::string::npos ? std::string::npos : end - start));
+
+            if (end == std::string::npos)
+                break;
+
+            start = end + 1;
+        }
+
+        std::vector<std::string> captures;
+
+        walk(&root, segs, 0, "", "", false, captures, best);
+
+        auto dpos = segs.back().rfind('.');
+
+        if (dpos != std::string::npos) {
+            auto base = segs.back().substr(0, dpos);
+            auto cand_ext = segs.back().substr(dpos + 1);
+
+            if (is_alnum_string(cand_ext)) {
+                auto prev_seq = best.seq;
+
+                walk(&root, segs, 0, base, cand_ext, true, captures, best);
+
+                if (best.seq != prev_seq)
+                    ext = cand_ext;
+            }
+        }
+    }
+
+    // Regex routes registered before the tree match still take precedence
+    for (const auto& r : regex_routes) {
+        if (r.first >= best.seq)
+            break;
+
+        if (r.second->match_url(url, uri_params, uri_variables))
+            return r.second;
+    }
+
+    if (best.route == nullptr)
+        return nullptr;
+
+    best.route->populate_params(best.captures, ext, getvars, uri_params);
+
+    return best.route;
 }
 
 bool kis_net_beast_route::match_url(const std::string& url, 
@@ -1841,16 +3101,69 @@ nlohmann::json kis_net_beast_auth::as_json() {
 
 
 void kis_net_web_tracked_endpoint::handle_request(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    // Requests are identical if they have the same method, URI (including the query 
+    // and serialization type) and body (including any field summaries)
+    auto flight_key = fmt::format("{} {} {}", con->verb(), con->uri(), con->request().body());
+
+    std::promise<std::shared_ptr<shared_response>> flight;
+    bool leader = false;
+
+    {
+        kis_unique_lock<kis_mutex> il(inflight_mutex, "tracked endpoint inflight");
+
+        auto fi = inflight.find(flight_key);
+
+        if (fi == inflight.end()) {
+            inflight.emplace(flight_key, flight.get_future().share());
+            leader = true;
+        } else {
+            auto ft = fi->second;
+            il.unlock();
+
+            auto shared = ft.get();
+
+            // Otherwise the response was an error or too large to share, generate our own
+            if (shared->valid) {
+                std::ostream os(&con->response_stream());
+                os.write(shared->body.data(), shared->body.length());
+                os.flush();
+                return;
+            }
+        }
+    }
+
+    auto result = std::make_shared<shared_response>();
+    result->valid = false;
+
+    // Always release the waiting requests, however generation ends
+    on_return release_flight([this, leader, &flight, &flight_key, &result]() {
+        if (!leader)
+            return;
+
+        {
+            kis_lock_guard<kis_mutex> il(inflight_mutex, "tracked endpoint inflight complete");
+            inflight.erase(flight_key);
+        }
+
+        flight.set_value(result);
+    });
+
+    // Responses larger than this aren't kept for sharing
+    const size_t max_shared_sz = 16 * 1024 * 1024;
+    tee_streambuf tee(&con->response_stream(), result->body, leader ? max_shared_sz : 0);
+
     kis_unique_lock<kis_mutex> lk(mutex, std::defer_lock, "tracked endpoint");
 
     if (use_mutex)
         lk.lock();
 
-    std::ostream os(&con->response_stream());
+    std::ostream os(&tee);
 
     try {
         auto output_content = std::shared_ptr<tracker_element>();
-        auto rename_map = Globalreg::new_from_pool<tracker_element_serializer::rename_map>();
+
+        tracker_element_summary_arena arena;
+        auto rename_map = arena.make_rename_map();
 
         if (content == nullptr && generator == nullptr) {
             con->set_status(500);
@@ -1868,14 +3181,28 @@ void kis_net_web_tracked_endpoint::handle_request(std::shared_ptr<kis_net_beast_
 
         auto summary = con->summarize_with_json(output_content, rename_map);
 
-        Globalreg::globalreg->entrytracker->serialize(static_cast<std::string>(con->uri()), os, 
-                summary, rename_map);
-
-        os.flush();
+        // Serialize a copy of the summary without holding the endpoint lock; the
+        // response stream throttles to the client, and a slow client must not hold
+        // the lock (often the device list lock) while it drains
+        auto snapshot = tracker_element_snapshot(summary, rename_map);
 
         if (post_func)
             post_func(output_content);
 
+        if (use_mutex)
+            lk.unlock();
+
+        {
+            // Nothing else references the snapshot, so it can be serialized in parallel
+            tracker_element_serializer::parallel_scope ps;
+            Globalreg::globalreg->entrytracker->serialize(static_cast<std::string>(con->uri()), os, 
+                    snapshot, rename_map);
+        }
+
+        os.flush();
+
+        result->valid = leader && !tee.is_overflowed() && con->status() == 200;
+
     } catch (const std::exception& e) {
         try {
             con->set_status(500);
@@ -1888,6 +3215,9 @@ void kis_net_web_tracked_endpoint::handle_request(std::shared_ptr<kis_net_beast_
 }
 
 void kis_net_web_function_endpoint::handle_request(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    // Don't wait on a slow client while holding the endpoint lock; released after the lock
+    future_chainbuf::unthrottled_scope ut(con->response_stream(), use_mutex);
+
     kis_unique_lock<kis_mutex> lk(mutex, std::defer_lock, "function endpoint");
 
     if (use_mutex)
@@ -1971,13 +3301,53 @@ void kis_net_web_websocket_endpoint::handle_read(boost::beast::error_code ec, st
     }
 }
 
-void kis_net_web_websocket_endpoint::on_write(const std::string& msg) {
+void kis_net_web_websocket_endpoint::drop_pending(std::deque<ws_data>::iterator i) {
+    queue_bytes_ -= i->data.size();
+    ws_write_queue_.erase(i);
+    dropped_frames_++;
+}
+
+void kis_net_web_websocket_endpoint::on_write(const ws_data& msg) {
     if (!running || !ws_.is_open())
         return;
 
-    ws_write_queue_.push(msg);
+    // The frame at the front of the queue is being written and is never dropped
+    auto queue_full = [this, &msg]() {
+        if (ws_write_queue_.size() == 0)
+            return false;
 
-    // _MSG_DEBUG("ws {} write len {} queue {}", fmt::ptr(this), msg.size(), ws_write_queue_.size());
+        if (max_queue_frames_ != 0 && ws_write_queue_.size() >= max_queue_frames_)
+            return true;
+
+        if (max_queue_bytes_ != 0 && queue_bytes_ + msg.data.size() > max_queue_bytes_)
+            return true;
+
+        return false;
+    };
+
+    if (queue_full()) {
+        switch (slow_consumer_) {
+            case kis_net_beast_httpd::ws_slow_consumer_policy::disconnect:
+                _MSG_INFO("(HTTPD) Closing websocket {} which is not keeping up ({} frames, {} "
+                        "bytes pending)", uri_, ws_write_queue_.size(), queue_bytes_.load());
+                dropped_frames_ += ws_write_queue_.size();
+                return close_impl();
+            case kis_net_beast_httpd::ws_slow_consumer_policy::coalesce:
+                while (ws_write_queue_.size() > 1)
+                    drop_pending(std::next(ws_write_queue_.begin()));
+                break;
+            case kis_net_beast_httpd::ws_slow_consumer_policy::drop_oldest:
+                while (ws_write_queue_.size() > 1 && queue_full())
+                    drop_pending(std::next(ws_write_queue_.begin()));
+                break;
+        }
+    }
+
+    ws_write_queue_.push_back(msg);
+    queue_bytes_ += msg.data.size();
+    queue_depth_ = ws_write_queue_.size();
+
+    // _MSG_DEBUG("ws {} write len {} queue {}", fmt::ptr(this), msg.data.size(), ws_write_queue_.size());
 
     if (ws_write_queue_.size() > 1)
         return;
@@ -1993,7 +3363,9 @@ void kis_net_web_websocket_endpoint::handle_write() {
         return;
     }
 
-    ws_.async_write(boost::asio::buffer(ws_write_queue_.front()),
+    ws_.text(ws_write_queue_.front().text);
+
+    ws_.async_write(boost::asio::buffer(ws_write_queue_.front().data),
             boost::asio::bind_executor(
                 strand_,
                 std::bind(
@@ -2006,7 +3378,9 @@ void kis_net_web_websocket_endpoint::handle_write() {
                             return self->close_impl();
                         }
 
-                        self->ws_write_queue_.pop();
+                        self->queue_bytes_ -= self->ws_write_queue_.front().data.size();
+                        self->ws_write_queue_.pop_front();
+                        self->queue_depth_ = self->ws_write_queue_.size();
 
                         if (!self->ws_write_queue_.empty()) {
                             return self->handle_write();
@@ -2027,6 +3401,14 @@ void kis_net_web_websocket_endpoint::handle_request(std::shared_ptr<kis_net_beas
 
     ws_.accept(con->request());
 
+    auto httpd = Globalreg::fetch_mandatory_global_handle<kis_net_beast_httpd>();
+
+    max_queue_frames_ = httpd->ws_queue_frames();
+    max_queue_bytes_ = httpd->ws_queue_bytes();
+    slow_consumer_ = httpd->ws_slow_consumer();
+
+    httpd->register_websocket(shared_from_this());
+
     running = true;
 
     auto running_future = running_promise.get_future();
@@ -2036,5 +3418,7 @@ void kis_net_web_websocket_endpoint::handle_request(std::shared_ptr<kis_net_beas
 
     // That will eventually complete this future
     running_future.wait();
+
+    httpd->remove_websocket(shared_from_this());
 }
 
@@ -21,12 +21,19 @@
 
 #include "config.h"
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
 #include <list>
 #include <regex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
+
+#include <sys/stat.h>
 
 #include "boost/asio.hpp"
 #include "boost/beast.hpp"
@@ -43,6 +50,7 @@
 #include "kis_mutex.h"
 #include "messagebus.h"
 #include "trackedelement.h"
+#include "trackedrrd.h"
 
 #include "fmt_asio.h"
 
@@ -53,6 +61,48 @@ class kis_net_beast_httpd_connection;
 class kis_net_beast_route;
 class kis_net_beast_auth;
 class kis_net_web_endpoint;
+class kis_net_web_websocket_endpoint;
+
+// Route dispatch tree keyed by path segment.  Literal segments are looked up directly and
+// :param segments match any single segment, so a request only visits the routes sharing
+// its path instead of running the regex of every route.  Routes which can't be expressed
+// as whole segments are kept aside and matched by their regex.  As with a linear scan,
+// the first registered of multiple matching routes wins.
+class kis_net_beast_route_tree {
+public:
+    using uri_param_t = std::unordered_map<std::string, std::string>;
+
+    kis_net_beast_route_tree() :
+        seq{0} { }
+
+    void insert(std::shared_ptr<kis_net_beast_route> route);
+    void clear();
+
+    // Find the route for a URL, populating the uri params of the route
+    std::shared_ptr<kis_net_beast_route> find(const std::string& url, uri_param_t& uri_params,
+            std::unordered_map<std::string, std::string>& uri_variables);
+
+protected:
+    struct node {
+        std::unordered_map<std::string, std::unique_ptr<node>> literals;
+        std::unique_ptr<node> param;
+        std::vector<std::pair<size_t, std::shared_ptr<kis_net_beast_route>>> routes;
+    };
+
+    struct match {
+        size_t seq;
+        std::shared_ptr<kis_net_beast_route> route;
+        std::vector<std::string> captures;
+    };
+
+    void walk(const node *n, const std::vector<std::string>& segs, size_t pos,
+            const std::string& base, const std::string& ext, bool use_ext,
+            std::vector<std::string>& captures, match& best);
+
+    node root;
+    std::vector<std::pair<size_t, std::shared_ptr<kis_net_beast_route>>> regex_routes;
+    size_t seq;
+};
 
 class kis_net_beast_httpd : public lifetime_global, public deferred_startup,
     public std::enable_shared_from_this<kis_net_beast_httpd> {
@@ -111,6 +161,11 @@ public:
             std::shared_ptr<kis_net_web_endpoint> handler);
     void remove_route(const std::string& route);
 
+    // Requests to a route (matched without its extension) can carry a body of up to
+    // in_limit bytes instead of the default, for upload routes such as bulk reports
+    void set_route_body_limit(const std::string& route, size_t in_limit);
+    size_t route_body_limit(boost::beast::string_view target);
+
     // These routes do NOT require authentication; this is of course very dangerous and should
     // be limited to those endpoints used for logging in, etc
     void register_unauth_route(const std::string& route, const std::list<std::string>& verbs, 
@@ -164,6 +219,16 @@ public:
     bool serve_file(std::shared_ptr<kis_net_beast_httpd_connection> con);
     bool serve_file(std::shared_ptr<kis_net_beast_httpd_connection> con, std::string filepath);
 
+    // Static files small enough to cache are held in memory with their gzip variant,
+    // and revalidated against the file size and modification time on each request
+    struct static_file {
+        off_t size;
+        struct timespec mtime;
+        std::string etag;
+        std::string body;
+        std::string gzip_body;
+    };
+
     void strip_uri_prefix(boost::beast::string_view& uri_view);
 
     const bool& redirect_unknown() const {
@@ -174,6 +239,83 @@ public:
         return redirect_unknown_target_;
     }
 
+    // Maximum amount of response content buffered ahead of the client before the 
+    // response generator blocks
+    size_t response_backlog() const {
+        return response_backlog_;
+    }
+
+    // Are dynamic responses gzip compressed for clients which accept it?
+    bool compress_responses() const {
+        return compress_responses_;
+    }
+
+    // Complete responses of frequently polled endpoints, re-served to every client 
+    // asking for the same URI within the cache time
+    struct cached_response {
+        std::chrono::steady_clock::time_point ts;
+        unsigned int status;
+        std::string content_type;
+        std::string content_encoding;
+        std::string body;
+    };
+
+    // Bulk routes (large device queries and similar) are generated by a limited number
+    // of concurrent, lower priority threads so that bursts of them don't starve
+    // packet processing and capture IO
+    bool bulk_route(const std::string& route) const;
+    void acquire_bulk_slot();
+    void release_bulk_slot();
+
+    int bulk_nice() const {
+        return bulk_nice_;
+    }
+
+    // How long an idle keep-alive connection waits for its next request
+    std::chrono::milliseconds keepalive_timeout() const {
+        return keepalive_timeout_;
+    }
+
+    // Connection reuse and response latency metrics
+    void record_connection();
+    void record_connection_setup(std::chrono::microseconds setup);
+    void record_request();
+    void record_connection_close(unsigned int n_requests);
+    void record_route_ttfb(const std::string& route, std::chrono::microseconds ttfb);
+
+    // Pending frame limits of websockets, and what happens to clients which exceed them
+    enum class ws_slow_consumer_policy {
+        drop_oldest, coalesce, disconnect
+    };
+
+    size_t ws_queue_frames() const {
+        return ws_queue_frames_;
+    }
+
+    size_t ws_queue_bytes() const {
+        return ws_queue_bytes_;
+    }
+
+    ws_slow_consumer_policy ws_slow_consumer() const {
+        return ws_slow_consumer_;
+    }
+
+    // Track open websockets for the queue statistics
+    void register_websocket(std::shared_ptr<kis_net_web_websocket_endpoint> ws);
+    void remove_websocket(std::shared_ptr<kis_net_web_websocket_endpoint> ws);
+
+    bool cacheable_uri(const boost::beast::string_view& uri) const;
+    std::shared_ptr<cached_response> fetch_cached_response(const std::string& key);
+    void cache_response(const std::string& key, std::shared_ptr<cached_response> response);
+
+    // Parse a JSON request body.  Large bodies are split into their top-level members
+    // first, and the members which dashboards repeat verbatim on every request (fields,
+    // regex, and colmap) are parsed once and cached by their text; the text of each cached
+    // member is returned in member_keys, so the summaries and filters compiled from it can
+    // be cached by the same key.  Throws on malformed JSON.
+    nlohmann::json parse_request_json(const boost::beast::string_view& body,
+            std::unordered_map<std::string, std::string>& member_keys);
+
 protected:
     std::atomic<bool> running;
     unsigned int port;
@@ -181,15 +323,85 @@ protected:
     bool allow_auth_creation;
     bool allow_auth_view;
 
+    size_t response_backlog_;
+
+    bool compress_responses_;
+
+    std::chrono::milliseconds response_cache_time_;
+    std::unordered_set<std::string> cached_uris_;
+
+    std::chrono::milliseconds keepalive_timeout_;
+
+    std::vector<std::string> bulk_prefixes_;
+    unsigned int bulk_concurrency_;
+    int bulk_nice_;
+
+    std::mutex bulk_mutex;
+    std::condition_variable bulk_cv;
+    unsigned int bulk_active;
+
+    kis_mutex metrics_mutex;
+    std::shared_ptr<tracker_element_map> metrics_map;
+    std::shared_ptr<kis_tracked_rrd<>> connections_rrd;
+    std::shared_ptr<kis_tracked_rrd<>> requests_rrd;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> requests_per_connection_rrd;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> connection_setup_rrd;
+    std::shared_ptr<tracker_element_string_map> route_ttfb_map;
+    int route_ttfb_rrd_id;
+
+    size_t static_cache_size_;
+    size_t static_cache_max_file_;
+
+    kis_mutex static_cache_mutex;
+    size_t static_cache_used;
+    std::unordered_map<std::string, std::shared_ptr<static_file>> static_cache;
+
+    std::shared_ptr<static_file> fetch_static_file(const std::string& path, const struct stat& st,
+            const std::string& mime_type);
+
+    size_t ws_queue_frames_;
+    size_t ws_queue_bytes_;
+    ws_slow_consumer_policy ws_slow_consumer_;
+
+    kis_mutex websocket_mutex;
+    std::vector<std::weak_ptr<kis_net_web_websocket_endpoint>> websocket_vec;
+
+    kis_mutex response_cache_mutex;
+    std::unordered_map<std::string, std::shared_ptr<cached_response>> response_cache;
+
+    // Parsed request members by name and text
+    kis_mutex request_member_mutex;
+    std::unordered_map<std::string, std::shared_ptr<const nlohmann::json>> request_member_cache;
+
     std::unordered_map<std::string, std::string> mime_map;
 
     kis_mutex route_mutex;
     std::vector<std::shared_ptr<kis_net_beast_route>> route_vec;
     std::vector<std::shared_ptr<kis_net_beast_route>> websocket_route_vec;
+    kis_net_beast_route_tree route_tree;
+    kis_net_beast_route_tree websocket_route_tree;
+    std::unordered_map<std::string, size_t> body_limits_;
 
     kis_mutex auth_mutex;
     std::vector<std::shared_ptr<kis_net_beast_auth>> auth_vec;
 
+    // Results of recent token checks, valid or not, so that JWT signatures and the
+    // API token scan stay off the per-request path.  Slots are indexed by the token
+    // hash and read with atomic loads, without the auth lock; a new token replaces
+    // whatever held its slot.  Entries are only stored under the auth lock, and the
+    // whole cache is flushed under it whenever the API tokens change.
+    struct auth_cache_entry {
+        std::string token;
+        std::shared_ptr<kis_net_beast_auth> auth;
+        time_t expires;
+    };
+
+    static constexpr size_t auth_cache_slots = 1024;
+    static constexpr time_t auth_cache_ttl = 60;
+    std::array<std::shared_ptr<const auth_cache_entry>, auth_cache_slots> auth_cache;
+
+    void flush_auth_cache();
+
     class static_content_dir {
     public:
         static_content_dir(const std::string& prefix, const std::string& path) :
@@ -242,7 +454,9 @@ class kis_net_beast_httpd_connection : public std::enable_shared_from_this<kis_n
 public:
     friend class kis_net_beast_httpd;
 
-    kis_net_beast_httpd_connection(boost::beast::tcp_stream& stream,
+    // The read buffer belongs to the socket, not the request, so that pipelined 
+    // requests read ahead with the previous request aren't lost
+    kis_net_beast_httpd_connection(boost::beast::tcp_stream& stream, boost::beast::flat_buffer& buffer,
             std::shared_ptr<kis_net_beast_httpd> httpd);
     virtual ~kis_net_beast_httpd_connection();
 
@@ -250,6 +464,9 @@ public:
 
     bool start();
 
+    // Was a request read from the socket
+    bool has_request() const { return has_request_; }
+
     boost::beast::http::request<boost::beast::http::string_body>& request() { return request_; }
     boost::beast::http::verb& verb() { return verb_; }
 
@@ -271,6 +488,7 @@ public:
     // raise a runtime error exception
     void set_status(unsigned int response);
     void set_status(boost::beast::http::status status);
+    unsigned int status() const { return response.result_int(); }
     void set_mime_type(const std::string& type);
     void set_target_file(const std::string& type);
     void clear_timeout();
@@ -285,6 +503,18 @@ public:
     kis_net_beast_httpd::http_cookie_map_t& cookies() { return cookies_; }
     nlohmann::json& json() { return json_; }
 
+    // Text of a top-level member of a large JSON request, for caching what is compiled
+    // from it; empty if the member wasn't split out of the request
+    const std::string& json_member_key(const std::string& member) const {
+        static const std::string empty;
+
+        auto k = json_member_keys_.find(member);
+        if (k == json_member_keys_.end())
+            return empty;
+
+        return k->second;
+    }
+
     // Optional closure callback to signal to an async operation that there's a problem (for example
     // long-running packet streams)
     void set_closure_cb(std::function<void ()> cb) {
@@ -301,7 +531,16 @@ protected:
     std::function<void ()> closure_cb;
 
     boost::beast::tcp_stream& stream_;
-    boost::beast::flat_buffer buffer;
+    boost::beast::flat_buffer& buffer;
+
+    bool has_request_;
+
+    // Time the request was read, and the route it resolved to, for the time to 
+    // first byte of the response
+    std::chrono::steady_clock::time_point request_ts_;
+    std::string route_name_;
+    bool first_byte_recorded_;
+    void record_first_byte();
 
     boost::optional<boost::beast::http::request_parser<boost::beast::http::string_body>> parser_;
     boost::beast::http::request<boost::beast::http::string_body> request_;
@@ -318,6 +557,7 @@ protected:
 
     kis_net_beast_httpd::http_var_map_t http_variables_;
     nlohmann::json json_;
+    std::unordered_map<std::string, std::string> json_member_keys_;
     kis_net_beast_httpd::http_cookie_map_t cookies_;
     std::string auth_token_;
     boost::beast::string_view uri_;
@@ -394,27 +634,13 @@ public:
     std::shared_ptr<tracker_element> summarize_with_json(std::shared_ptr<T> in_data,
             std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-        auto summary_vec = std::vector<SharedElementSummary>{};
-
-        auto fields = json_["fields"];
-
-        if (!fields.is_null() && fields.is_array()) {
-            for (const auto& i : fields) {
-                if (i.is_string()) {
-                    summary_vec.push_back(std::make_shared<tracker_element_summary>(i.get<std::string>()));
-                } else if (i.is_array()) {
-                    if (i.size() != 2)
-                        throw std::runtime_error("Invalid field mapping, expected [field, name]");
-                    summary_vec.push_back(std::make_shared<tracker_element_summary>(i[0].get<std::string>(), i[1].get<std::string>()));
-                    // _MSG_DEBUG("Assigning summary vec {} {}", i[0].get<std::string>(), i[1].get<std::string>());
-                } else {
-                    throw std::runtime_error("Invalid field mapping, expected field or [field,rename]");
-                }
-            }
-
-        }
+        // Compiled summaries are cached by the field list, so repeated requests skip
+        // resolving the paths
+        auto summary_vec =
+            Globalreg::globalreg->entrytracker->compile_summary(json_["fields"],
+                    json_member_key("fields"));
 
-        return summarize_tracker_element(in_data, summary_vec, rename_map);
+        return summarize_tracker_element(in_data, *summary_vec, rename_map);
     }
 };
 
@@ -512,6 +738,16 @@ protected:
     gen_func_t generator;
     wrapper_func_t pre_func;
     wrapper_func_t post_func;
+
+    // Identical requests arriving while a response is being generated wait for it and
+    // are sent the same serialized response, instead of each generating their own
+    struct shared_response {
+        bool valid;
+        std::string body;
+    };
+
+    kis_mutex inflight_mutex;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<shared_response>>> inflight;
 };
 
 class kis_net_web_websocket_endpoint : public kis_net_web_endpoint, 
@@ -528,8 +764,9 @@ public:
 
     kis_net_web_websocket_endpoint(std::shared_ptr<kis_net_beast_httpd_connection> con, handler_func_t handler_func) :
         kis_net_web_endpoint{},
+        uri_{static_cast<std::string>(con->uri())},
         ws_{con->release_stream()},
-		strand_{Globalreg::globalreg->io},
+		strand_{Globalreg::globalreg->http_io},
         handler_cb{handler_func} { }
 
     virtual ~kis_net_web_websocket_endpoint() { }
@@ -539,42 +776,73 @@ public:
     void write(std::string data) {
         boost::asio::post(strand_,
                 boost::beast::bind_front_handler(&kis_net_web_websocket_endpoint::on_write, 
-                    shared_from_this(), data));
+                    shared_from_this(), ws_data{data, text_}));
     }
 
     void write(const char *data, size_t len) {
         boost::asio::post(strand_,
                 boost::beast::bind_front_handler(&kis_net_web_websocket_endpoint::on_write,
-                    shared_from_this(), std::string(data, len)));
+                    shared_from_this(), ws_data{std::string(data, len), text_}));
+    }
+
+    // Write a single binary frame, regardless of the mode of the socket
+    void write_binary(std::string data) {
+        boost::asio::post(strand_,
+                boost::beast::bind_front_handler(&kis_net_web_websocket_endpoint::on_write,
+                    shared_from_this(), ws_data{data, false}));
     }
 
     virtual void close();
 
 	virtual void binary() {
-		ws_.binary(true);
+		text_ = false;
 	}
 
 	virtual void text() {
-		ws_.text(true);
+		text_ = true;
 	}
 
 	boost::asio::io_service::strand &strand() { return strand_; };
 
+    const std::string& uri() const { return uri_; }
+
+    // Pending frames, including the frame being written, and frames dropped
+    // by the slow consumer policy
+    size_t queue_depth() const { return queue_depth_; }
+    size_t queue_bytes() const { return queue_bytes_; }
+    uint64_t dropped_frames() const { return dropped_frames_; }
+
 protected:
     virtual void close_impl();
 
     virtual void start_read(std::shared_ptr<kis_net_web_websocket_endpoint> ref);
     void handle_read(boost::beast::error_code ec, std::size_t);
 
-    void on_write(const std::string& msg);
+    void on_write(const ws_data& msg);
     void handle_write();
 
+    // Drop the pending frame after the one being written
+    void drop_pending(std::deque<ws_data>::iterator i);
+
+    std::string uri_;
+
     boost::beast::websocket::stream<boost::beast::tcp_stream> ws_;
 
     boost::beast::flat_buffer buffer_;
 	boost::asio::io_service::strand strand_;
 
-	std::queue<std::string, std::deque<std::string>> ws_write_queue_;
+	std::deque<ws_data> ws_write_queue_;
+
+    size_t max_queue_frames_ = 0;
+    size_t max_queue_bytes_ = 0;
+    kis_net_beast_httpd::ws_slow_consumer_policy slow_consumer_ = 
+        kis_net_beast_httpd::ws_slow_consumer_policy::drop_oldest;
+
+    std::atomic<size_t> queue_depth_{0};
+    std::atomic<size_t> queue_bytes_{0};
+    std::atomic<uint64_t> dropped_frames_{0};
+
+    std::atomic<bool> text_{true};
 
     std::promise<void> handle_pr;
 
@@ -624,7 +892,22 @@ public:
 
     std::string& route() { return route_; }
 
+    // Routes made only of literal and whole :param segments can be dispatched by the
+    // route tree; anything else is only matched by regex
+    bool tree_matchable() const { return tree_matchable_; }
+    const std::vector<std::string>& path_segments() const { return path_segments_; }
+
+    // Does the route take a file type extension, and is this one acceptable?
+    bool has_extension() const { return match_types; }
+    bool match_extension(const std::string& ext) const;
+
+    // Populate the uri params from a route tree match, in the same form as match_url
+    void populate_params(const std::vector<std::string>& captures, const std::string& ext,
+            const std::string& getvars, kis_net_beast_httpd_connection::uri_param_t& uri_params);
+
 protected:
+    void compile_segments();
+
     std::shared_ptr<kis_net_web_endpoint> handler;
 
     std::string route_;
@@ -643,6 +926,12 @@ protected:
     std::vector<std::string> match_keys;
 
     std::regex match_re;
+
+    // Accepted extensions; empty accepts any alphanumeric extension
+    std::vector<std::string> extensions_;
+
+    bool tree_matchable_;
+    std::vector<std::string> path_segments_;
 };
 
 struct auth_construction_error : public std::exception {
@@ -22,19 +22,69 @@
 #include "kis_pcapnglogfile.h"
 #include "messagebus.h"
 
+namespace {
+    // Keep a log name suffix to characters which are safe in a filename
+    std::string log_label(const std::string& in) {
+        std::string r;
+
+        for (auto c : in) {
+            if (isalnum(c) || c == '-' || c == '_' || c == '.')
+                r += c;
+            else
+                r += '_';
+        }
+
+        if (r.length() == 0)
+            r = "unknown";
+
+        return r;
+    }
+
+    // Split a path into the part before the extension and the extension
+    void split_extension(const std::string& path, std::string& stem, std::string& ext) {
+        auto slash = path.rfind('/');
+        auto dot = path.rfind('.');
+
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+            stem = path;
+            ext = "";
+            return;
+        }
+
+        stem = path.substr(0, dot);
+        ext = path.substr(dot);
+    }
+}
+
 kis_pcapng_logfile::kis_pcapng_logfile(shared_log_builder in_builder) :
     kis_logfile(in_builder),
-    buffer{4096, 1024} {
-    pcapng = nullptr;
-    pcapng_file = nullptr;
+    log_open{false},
+    split{split_mode::none} {
+
+    packet_mutex.set_name("kis_pcapng_logfile packet");
+
+    auto config = Globalreg::globalreg->kismet_config;
+
+    log_duplicate_packets = config->fetch_opt_bool("pcapng_log_duplicate_packets", true);
+    log_data_packets = config->fetch_opt_bool("pcapng_log_data_packets", true);
 
-    log_duplicate_packets =
-        Globalreg::globalreg->kismet_config->fetch_opt_bool("pcapng_log_duplicate_packets", true);
-    log_data_packets =
-        Globalreg::globalreg->kismet_config->fetch_opt_bool("pcapng_log_data_packets", true);
+    auto split_opt = str_lower(config->fetch_opt_dfl("pcapng_log_split", "none"));
+
+    if (split_opt == "source" || split_opt == "datasource") {
+        split = split_mode::source;
+    } else if (split_opt == "channel") {
+        split = split_mode::channel;
+    } else if (split_opt != "none") {
+        _MSG_ERROR("Unknown pcapng_log_split '{}', expected 'none', 'source', or 'channel'; "
+                "logging all packets to one pcapng file.", split_opt);
+    }
+
+    rotate_size = config->fetch_opt_ulong("pcapng_log_rotate_size", 0) * 1024 * 1024;
+    rotate_interval = config->fetch_opt_uint("pcapng_log_rotate_interval", 0);
 
     auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
     pack_comp_common = packetchain->register_packet_component("COMMON");
+    pack_comp_datasrc = packetchain->register_packet_component("KISDATASRC");
 }
 
 kis_pcapng_logfile::~kis_pcapng_logfile() {
@@ -42,89 +92,234 @@ kis_pcapng_logfile::~kis_pcapng_logfile() {
 }
 
 bool kis_pcapng_logfile::open_log(std::string in_path) {
-    kis_lock_guard<kis_mutex> lk(log_mutex);
+    kis_unique_lock<kis_mutex> lk(log_mutex, "open_log");
 
     set_int_log_path(in_path);
 
-    pcapng_file = fopen(in_path.c_str(), "w");
+    {
+        kis_lock_guard<kis_mutex> plk(packet_mutex, "open_log");
+
+        outputs.clear();
+
+        // Split logs are opened as their first packet arrives
+        if (split == split_mode::none) {
+            auto out = std::make_shared<log_output>();
+            out->base_path = in_path;
+            out->number = 0;
+
+            if (!open_output(out))
+                return false;
+
+            outputs[""] = out;
+        }
+
+        log_open = true;
+    }
+
+    if (split == split_mode::source)
+        _MSG_INFO("Opened pcapng log, writing a file for each data source named after '{}'", in_path);
+    else if (split == split_mode::channel)
+        _MSG_INFO("Opened pcapng log, writing a file for each channel named after '{}'", in_path);
+
+    set_int_log_open(true);
+
+    lk.unlock();
+
+    auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
+    packetchain->register_handler(&kis_pcapng_logfile::packet_handler, this, CHAINPOS_LOGGING, -100);
+
+    return true;
+}
+
+void kis_pcapng_logfile::close_log() {
+    kis_lock_guard<kis_mutex> lk(log_mutex);
+
+    set_int_log_open(false);
+
+    auto packetchain = Globalreg::fetch_global_as<packet_chain>("PACKETCHAIN");
+    if (packetchain != nullptr)
+        packetchain->remove_handler(&kis_pcapng_logfile::packet_handler, CHAINPOS_LOGGING);
+
+    std::unordered_map<std::string, std::shared_ptr<log_output>> closing;
+
+    {
+        kis_lock_guard<kis_mutex> plk(packet_mutex, "close_log");
+        log_open = false;
+        closing.swap(outputs);
+    }
+
+    for (const auto& o : closing) {
+        if (o.second == nullptr)
+            continue;
+
+        std::lock_guard<std::mutex> olk(o.second->mutex);
+        o.second->stream.reset();
+        o.second->buffer.reset();
+        o.second->writer.close();
+    }
+}
+
+std::string kis_pcapng_logfile::output_path(const std::string& base_path, unsigned int number) const {
+    if (number == 0)
+        return base_path;
+
+    std::string stem, ext;
+    split_extension(base_path, stem, ext);
+
+    return fmt::format("{}-{:04}{}", stem, number, ext);
+}
+
+bool kis_pcapng_logfile::open_output(std::shared_ptr<log_output> out) {
+    auto path = output_path(out->base_path, out->number);
+
+    out->stream.reset();
+    out->buffer.reset();
+    out->writer.close();
 
-    if (pcapng_file == nullptr) {
-        _MSG_ERROR("Failed to open pcapng log '{}' - {}",
-                in_path, kis_strerror_r(errno));
+    std::string error;
+
+    if (!out->writer.open(path, error)) {
+        _MSG_ERROR("Failed to open pcapng log '{}' - {}", path, error);
         return false;
     }
 
-    pcapng = new pcapng_stream_packetchain(buffer, 
-            [this](std::shared_ptr<kis_packet> in_pack) -> bool {
-                if (in_pack->filtered)
-                    return false;
+    out->buffer = std::make_unique<future_chainbuf>(4096, 1024);
+    out->stream = std::make_unique<pcapng_stream_logfile>(*out->buffer);
+    out->stream->start_stream();
+    out->opened = Globalreg::globalreg->last_tv_sec;
+
+    drain_output(out);
 
-                if (in_pack->duplicate && !log_duplicate_packets)
-                    return false;
+    _MSG_INFO("Opened pcapng log file '{}'", path);
 
-                if (!log_data_packets) {
-                    auto ci = in_pack->fetch<kis_common_info>(pack_comp_common);
+    return true;
+}
 
-                    if (ci != nullptr) {
-                        if (ci->type == packet_basic_data) {
-                            return false;
-                        }
-                    }
-                }
+void kis_pcapng_logfile::drain_output(std::shared_ptr<log_output> out) {
+    char *data;
+    size_t sz;
 
-                return true;
-            }, nullptr, 16384);
+    while ((sz = out->buffer->get(&data)) > 0) {
+        out->writer.write(data, sz);
+        out->buffer->consume(sz);
+    }
+}
 
-    _MSG_INFO("Opened pcapng log file '{}'", in_path);
+std::shared_ptr<kis_pcapng_logfile::log_output> 
+    kis_pcapng_logfile::find_output(std::shared_ptr<kis_packet> in_pack) {
 
-    set_int_log_open(true);
+    if (split == split_mode::none) {
+        auto oi = outputs.find("");
+        if (oi == outputs.end())
+            return nullptr;
+        return oi->second;
+    }
 
-    auto thread_p = std::promise<void>();
-    auto thread_f = thread_p.get_future();
+    std::string key, label;
 
-    stream_t = std::thread([this, thread_p = std::move(thread_p)]() mutable {
-            thread_p.set_value();
+    if (split == split_mode::source) {
+        auto datasrc = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
 
-            while (buffer.running() || buffer.size() > 0) {
-                buffer.wait();
+        if (datasrc == nullptr || datasrc->ref_source == nullptr)
+            return nullptr;
 
-                char *data;
+        key = datasrc->ref_source->get_source_uuid().as_string();
 
-                auto sz = buffer.get(&data);
+        auto oi = outputs.find(key);
+        if (oi != outputs.end())
+            return oi->second;
 
-                if (sz > 0) {
-                    if (fwrite(data, sz, 1, pcapng_file) == 0) {
-                        _MSG_ERROR("Error writing to pcapng log '{}' - {}", get_log_path(),
-                                kis_strerror_r(errno));
-                        close_log();
-                        return;
-                    }
-                }
+        label = log_label(datasrc->ref_source->get_source_name());
 
-                buffer.consume(sz);
+        // Sources with the same name get their own files
+        for (const auto& o : outputs) {
+            if (o.second != nullptr && o.second->label == label) {
+                label += "-" + key.substr(0, 8);
+                break;
             }
+        }
+    } else {
+        auto common = in_pack->fetch<kis_common_info>(pack_comp_common);
 
-        });
+        if (common == nullptr || common->channel.length() == 0 || common->channel == "0")
+            key = "unknown";
+        else
+            key = common->channel;
 
-    thread_f.wait();
-    pcapng->start_stream();
+        auto oi = outputs.find(key);
+        if (oi != outputs.end())
+            return oi->second;
 
-    return true;
+        label = log_label(key);
+    }
+
+    std::string stem, ext;
+    split_extension(get_log_path(), stem, ext);
+
+    auto out = std::make_shared<log_output>();
+    out->label = label;
+    out->base_path = fmt::format("{}-{}{}", stem, label, ext);
+    out->number = 0;
+
+    // Don't try to open a file which failed again for every packet
+    if (!open_output(out)) {
+        outputs[key] = nullptr;
+        return nullptr;
+    }
+
+    outputs[key] = out;
+
+    return out;
 }
 
-void kis_pcapng_logfile::close_log() {
-    kis_lock_guard<kis_mutex> lk(log_mutex);
+int kis_pcapng_logfile::packet_handler(CHAINCALL_PARMS) {
+    auto pcapnglog = static_cast<kis_pcapng_logfile *>(auxdata);
 
-    set_int_log_open(false);
+    if (in_pack->filtered)
+        return 1;
+
+    if (in_pack->duplicate && !pcapnglog->log_duplicate_packets)
+        return 1;
+
+    if (!pcapnglog->log_data_packets) {
+        auto ci = in_pack->fetch<kis_common_info>(pcapnglog->pack_comp_common);
+
+        if (ci != nullptr && ci->type == packet_basic_data)
+            return 1;
+    }
+
+    std::shared_ptr<log_output> out;
+
+    {
+        kis_lock_guard<kis_mutex> lk(pcapnglog->packet_mutex, "pcapng packet_handler");
+
+        if (!pcapnglog->log_open || pcapnglog->stream_paused)
+            return 1;
+
+        out = pcapnglog->find_output(in_pack);
+    }
+
+    if (out == nullptr)
+        return 1;
+
+    // Outputs are written in parallel; only packets for the same file wait on each other
+    std::lock_guard<std::mutex> olk(out->mutex);
 
-    buffer.cancel();
+    if (out->stream == nullptr)
+        return 1;
 
-    if (stream_t.joinable())
-        stream_t.join();
+    if ((pcapnglog->rotate_size != 0 && out->stream->get_log_size() >= pcapnglog->rotate_size) ||
+            (pcapnglog->rotate_interval != 0 &&
+             Globalreg::globalreg->last_tv_sec - out->opened >= (time_t) pcapnglog->rotate_interval)) {
+        out->number++;
+
+        if (!pcapnglog->open_output(out))
+            return 1;
+    }
 
-    if (pcapng_file)
-        fclose(pcapng_file);
+    out->stream->write_packet(in_pack);
+    pcapnglog->drain_output(out);
 
-    pcapng_file = nullptr;
+    return 1;
 }
 
@@ -21,10 +21,34 @@
 
 #include "config.h"
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #include "globalregistry.h"
+#include "kis_async_writer.h"
 #include "logtracker.h"
 #include "pcapng_stream_futurebuf.h"
 
+// A pcapng stream written to a log file: blocks are taken from the buffer as soon as
+// they're built and handed to an async writer, which writes them in large aligned blocks
+class pcapng_stream_logfile : public pcapng_stream_futurebuf {
+public:
+    pcapng_stream_logfile(future_chainbuf& buffer) :
+        pcapng_stream_futurebuf{buffer, nullptr, nullptr, 1024 * 1024, false} {
+        set_backlog_policy(pcapng_backlog_policy::drop, 0);
+    }
+
+    void write_packet(std::shared_ptr<kis_packet> in_packet) {
+        handle_packet(in_packet);
+    }
+};
+
+// The pcapng log writes every packet to one file, or with pcapng_log_split, a file for
+// each datasource or channel, each with a writer of its own.  Files are rotated once they
+// reach pcapng_log_rotate_size megabytes or have been written for
+// pcapng_log_rotate_interval seconds, and are numbered the same way as rotated kismetdb
+// logs.
 class kis_pcapng_logfile : public kis_logfile {
 public:
     kis_pcapng_logfile(shared_log_builder in_builder);
@@ -34,15 +58,54 @@ public:
     virtual void close_log() override;
 
 protected:
-    pcapng_stream_packetchain *pcapng;
-    future_chainbuf buffer;
-    FILE *pcapng_file;
-    std::thread stream_t;
+    enum class split_mode {
+        none, source, channel
+    };
+
+    struct log_output {
+        std::mutex mutex;
+
+        // Suffix added to the log name, empty for the unsplit log
+        std::string label;
+        // Path of the first file; rotated files are numbered after it
+        std::string base_path;
+        unsigned int number;
+
+        time_t opened;
+
+        // The stream references the buffer, so is destroyed first
+        std::unique_ptr<future_chainbuf> buffer;
+        std::unique_ptr<pcapng_stream_logfile> stream;
+        kis_async_writer writer;
+    };
+
+    static int packet_handler(CHAINCALL_PARMS);
+
+    // Output for a packet, opening it if it's the first packet for it; nullptr if the
+    // output can't be opened.  Must be called with packet_mutex held
+    std::shared_ptr<log_output> find_output(std::shared_ptr<kis_packet> in_pack);
+
+    // Open the current file of an output, starting a new stream
+    bool open_output(std::shared_ptr<log_output> out);
+
+    // Move the blocks built by the stream to the writer
+    void drain_output(std::shared_ptr<log_output> out);
+
+    std::string output_path(const std::string& base_path, unsigned int number) const;
+
+    kis_mutex packet_mutex;
+    bool log_open;
+
+    split_mode split;
+    uint64_t rotate_size;
+    unsigned int rotate_interval;
+
+    std::unordered_map<std::string, std::shared_ptr<log_output>> outputs;
 
     bool log_duplicate_packets;
     bool log_data_packets;
 
-    int pack_comp_common;
+    int pack_comp_common, pack_comp_datasrc;
 };
 
 class pcapng_logfile_builder : public kis_logfile_builder {
@@ -27,6 +27,24 @@
 #include "kis_ppi.h"
 #include "phy_80211.h"
 
+// Classic pcap file and record headers, host endian, as written by pcap_dump
+struct ppi_pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct ppi_pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
 kis_ppi_logfile::kis_ppi_logfile(shared_log_builder in_builder) : 
     kis_logfile(in_builder) {
 
@@ -36,10 +54,6 @@ kis_ppi_logfile::kis_ppi_logfile(shared_log_builder in_builder) :
 	cbfilter = NULL;
 	cbaux = NULL;
 
-	dumpfile = NULL;
-	dumper = NULL;
-    dump_filep = NULL;
-
     log_open = false;
 
     auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
@@ -67,38 +81,28 @@ bool kis_ppi_logfile::open_log(std::string in_path) {
     log_open = false;
     set_int_log_path(in_path);
 
-	dumpfile = NULL;
-	dumper = NULL;
-    dump_filep = NULL;
-
     auto packetchain =
         Globalreg::fetch_mandatory_global_as<packet_chain>("PACKETCHAIN");
 
-	dumpfile = pcap_open_dead(DLT_PPI, MAX_PACKET_LEN);
+    std::string error;
 
-	if (dumpfile == NULL) {
-        _MSG_ERROR("Failed to prepare pcap/ppi dump file '{}': {}",
-                in_path, kis_strerror_r(errno));
-        return false;
-	}
-
-    // Open as a filepointer
-    dump_filep = fopen(in_path.c_str(), "wb");
-    if (dump_filep == NULL) {
+    if (!dumpfile.open(in_path, error)) {
         _MSG_ERROR("Failed to open pcap/ppi dump file '{}' for writing: {}",
-                in_path, kis_strerror_r(errno));
+                in_path, error);
         return false;
     }
 
-    // close it on exec
-    fcntl(fileno(dump_filep), F_SETFL, fcntl(fileno(dump_filep), F_GETFL, 0) | O_CLOEXEC);
+    ppi_pcap_file_header fh;
 
-	dumper = pcap_dump_fopen(dumpfile, dump_filep);
-    if (dumper == NULL) {
-        _MSG_FATAL("Unable to open pcap/ppi dump file '{}': {}", in_path, kis_strerror_r(errno));
-        Globalreg::globalreg->fatal_condition = true;
-        return false;
-	}
+    fh.magic = 0xa1b2c3d4;
+    fh.version_major = 2;
+    fh.version_minor = 4;
+    fh.thiszone = 0;
+    fh.sigfigs = 0;
+    fh.snaplen = MAX_PACKET_LEN;
+    fh.linktype = DLT_PPI;
+
+    dumpfile.write(reinterpret_cast<const char *>(&fh), sizeof(fh));
 
     _MSG_INFO("Opened PPI pcap log file '{}'", in_path);
 
@@ -122,20 +126,12 @@ void kis_ppi_logfile::close_log() {
     if (packetchain != NULL) 
         packetchain->remove_handler(&kis_ppi_logfile::packet_handler, CHAINPOS_LOGGING);
 
-    // close files
-    if (dumper != NULL) {
-        pcap_dump_flush(dumper);
-        pcap_dump_close(dumper);
-    }
-
-    if (dumpfile != NULL) {
-        pcap_close(dumpfile);
+    {
+        kis_lock_guard<kis_mutex> plk(packet_mutex);
+        log_open = false;
     }
 
-	dumper = NULL;
-	dumpfile = NULL;
-    dump_filep = NULL;
-
+    dumpfile.close();
 }
 
 kis_ppi_logfile::~kis_ppi_logfile() {
@@ -274,7 +270,8 @@ int kis_ppi_logfile::packet_handler(CHAINCALL_PARMS) {
     if (dump_len == 0 || ppi_len == 0)
         return 0;
 
-    dump_data = new u_char[dump_len];
+    ppilog->dump_buf.resize(dump_len);
+    dump_data = ppilog->dump_buf.data();
     //memset(dump_data, 0xcc, dump_len); //Good for debugging ppi stuff.
     ppi_ph = (ppi_packet_header *) dump_data;
 
@@ -444,13 +441,8 @@ int kis_ppi_logfile::packet_handler(CHAINCALL_PARMS) {
 
     dump_offset = ppi_pos;
 
-    if (dump_len == 0) {
-        delete[] dump_data;
+    if (dump_len == 0)
         return 0;
-    }
-
-    if (dump_data == NULL)
-        dump_data = new u_char[dump_len];
 
     // copy the packet content in, offset if necessary
     if (chunk != NULL) {
@@ -465,18 +457,14 @@ int kis_ppi_logfile::packet_handler(CHAINCALL_PARMS) {
     }
 
     // Fake a header
-    struct pcap_pkthdr wh;
-    wh.ts.tv_sec = in_pack->ts.tv_sec;
-    wh.ts.tv_usec = in_pack->ts.tv_usec;
+    ppi_pcap_record_header wh;
+    wh.ts_sec = in_pack->ts.tv_sec;
+    wh.ts_usec = in_pack->ts.tv_usec;
     wh.caplen = wh.len = dump_len;
 
     // Dump it
-    {
-        kis_lock_guard<kis_mutex> lk(ppilog->log_mutex);
-        pcap_dump((u_char *) ppilog->dumper, &wh, dump_data);
-    }
-
-    delete[] dump_data;
+    ppilog->dumpfile.write(reinterpret_cast<const char *>(&wh), sizeof(wh),
+            reinterpret_cast<const char *>(dump_data), dump_len);
 
     ppilog->log_packets++;
     ppilog->log_size += dump_len;
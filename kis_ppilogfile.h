@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <pcap/pcap.h>
@@ -32,6 +33,7 @@ extern "C" {
 
 #include "globalregistry.h"
 #include "configfile.h"
+#include "kis_async_writer.h"
 #include "messagebus.h"
 #include "packetchain.h"
 #include "logtracker.h"
@@ -75,9 +77,12 @@ protected:
 	// Common internal startup
 	void startup_dumpfile();
 
-	pcap_t *dumpfile;
-	pcap_dumper_t *dumper;
-    FILE *dump_filep;
+    // The pcap file is written directly through the async writer instead of with
+    // pcap_dump, so that records are batched instead of written per packet
+    kis_async_writer dumpfile;
+
+    // Assembly buffer for each packet, reused under the packet mutex
+    std::vector<u_char> dump_buf;
 
 	int dlt;
 
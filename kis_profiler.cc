@@ -0,0 +1,494 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef SYS_LINUX
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "backward_wrapper.h"
+#include "configfile.h"
+#include "kis_profiler.h"
+#include "messagebus.h"
+#include "util.h"
+
+// Sampling needs per-thread CPU clock timers and a signal-safe unwinder
+#if defined(SYS_LINUX) && defined(SYS_timer_create) && !defined(DISABLE_BACKWARD)
+#define KIS_PROFILER_SUPPORTED 1
+#endif
+
+#ifdef KIS_PROFILER_SUPPORTED
+
+#if BACKWARD_HAS_UNWIND != 1
+#include <execinfo.h>
+#endif
+
+namespace {
+    constexpr unsigned int max_depth = 32;
+
+    // Samples are written by the signal handler into space allocated before the profile
+    // starts, so the handler never allocates
+    struct profile_sample {
+        std::atomic<bool> ready;
+        pid_t tid;
+        unsigned int depth;
+        void *ret;
+        void *frames[max_depth];
+    };
+
+    struct profile_run {
+        profile_run(size_t capacity) :
+            samples{new profile_sample[capacity]},
+            capacity{capacity},
+            next{0},
+            dropped{0} {
+            for (size_t i = 0; i < capacity; i++)
+                samples[i].ready = false;
+        }
+
+        std::unique_ptr<profile_sample[]> samples;
+        size_t capacity;
+        std::atomic<size_t> next;
+        std::atomic<uint64_t> dropped;
+    };
+
+    // The run being sampled, and the handlers currently running; a run is only freed once
+    // it is no longer active and no handler is still writing into it
+    std::atomic<profile_run *> active_run{nullptr};
+    std::atomic<int> handlers_running{0};
+
+    struct frame_writer {
+        void **frames;
+
+        void operator()(size_t idx, void *addr) {
+            frames[idx] = addr;
+        }
+    };
+
+    size_t unwind_here(void **frames, size_t depth) {
+#if BACKWARD_HAS_UNWIND == 1
+        return backward::details::unwind(frame_writer{frames}, depth);
+#else
+        return backtrace(frames, depth);
+#endif
+    }
+
+    __attribute__((noinline)) void sigprof_handler(int, siginfo_t *, void *) {
+        auto saved_errno = errno;
+
+        handlers_running++;
+
+        auto run = active_run.load();
+
+        if (run != nullptr) {
+            auto i = run->next.fetch_add(1, std::memory_order_relaxed);
+
+            if (i < run->capacity) {
+                auto& s = run->samples[i];
+                s.tid = syscall(SYS_gettid);
+                // The handler returns into the signal trampoline; everything up to it
+                // is the handler itself
+                s.ret = __builtin_return_address(0);
+                s.depth = unwind_here(s.frames, max_depth);
+                s.ready.store(true, std::memory_order_release);
+            } else {
+                run->dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        handlers_running--;
+
+        errno = saved_errno;
+    }
+
+    // The CPU clock of another thread of this process, as the kernel encodes it
+    // (CPUCLOCK_PERTHREAD | CPUCLOCK_SCHED); glibc only offers this for pthreads
+    clockid_t thread_cpu_clock(pid_t tid) {
+        return (~static_cast<clockid_t>(tid) << 3) | 6;
+    }
+
+    // Timers are created with the syscalls directly, since the thread-targeted form isn't
+    // exposed by every libc and older glibc keeps timer_create in librt
+    bool create_thread_timer(pid_t tid, int *timer_id) {
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+#ifdef sigev_notify_thread_id
+        sev.sigev_notify_thread_id = tid;
+#else
+        sev._sigev_un._tid = tid;
+#endif
+
+        return syscall(SYS_timer_create, thread_cpu_clock(tid), &sev, timer_id) == 0;
+    }
+
+    bool arm_thread_timer(int timer_id, unsigned int rate_hz) {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+
+        auto interval_ns = 1000000000UL / rate_hz;
+
+        its.it_interval.tv_sec = interval_ns / 1000000000UL;
+        its.it_interval.tv_nsec = interval_ns % 1000000000UL;
+        its.it_value = its.it_interval;
+
+        return syscall(SYS_timer_settime, timer_id, 0, &its, nullptr) == 0;
+    }
+
+    void delete_thread_timer(int timer_id) {
+        syscall(SYS_timer_delete, timer_id);
+    }
+
+    // Folded stack frames can't contain the separators
+    std::string folded_frame(std::string name) {
+        for (auto& c : name)
+            if (c == ';' || c == '\n')
+                c = ':';
+
+        return name;
+    }
+
+    // Resolves the addresses of the samples with the backward resolver, which reads a
+    // list of addresses the same way it reads a stack trace
+    struct address_list {
+        std::vector<void *> addrs;
+
+        void **begin() {
+            return addrs.data();
+        }
+
+        size_t size() const {
+            return addrs.size();
+        }
+    };
+}
+
+#endif
+
+bool kis_profiler::supported() {
+#ifdef KIS_PROFILER_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+kis_profiler::kis_profiler() :
+    lifetime_global() {
+
+    max_duration_s =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("sampling_profiler_max_duration", 300);
+
+    if (!supported()) {
+        _MSG_ERROR("The sampling profiler is not supported on this platform or build; "
+                "it needs Linux and stack unwinding support.");
+        return;
+    }
+
+#ifdef KIS_PROFILER_SUPPORTED
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sa_sigaction = sigprof_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGPROF, &sa, nullptr) < 0) {
+        _MSG_ERROR("Could not install the sampling profiler signal handler: {}",
+                kis_strerror_r(errno));
+        return;
+    }
+#endif
+
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/system/profile/folded", {"GET", "POST"}, httpd->LOGON_ROLE, {"txt"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    profile_endp(con);
+                }));
+
+    _MSG_INFO("Sampling profiler enabled; folded stacks are available from "
+            "/system/profile/folded.txt");
+}
+
+kis_profiler::~kis_profiler() {
+    Globalreg::globalreg->remove_global(global_name());
+}
+
+void kis_profiler::profile_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::ostream stream(&con->response_stream());
+
+    unsigned int duration_s = 10;
+    unsigned int rate_hz = 99;
+    std::vector<std::string> prefixes = {"PACKET", "IO", "timers", "eventbus"};
+
+    try {
+        auto d_k = con->http_variables().find("duration");
+        if (d_k != con->http_variables().end())
+            duration_s = string_to_n<unsigned int>(d_k->second);
+
+        auto r_k = con->http_variables().find("rate");
+        if (r_k != con->http_variables().end())
+            rate_hz = string_to_n<unsigned int>(r_k->second);
+
+        auto t_k = con->http_variables().find("threads");
+        if (t_k != con->http_variables().end()) {
+            prefixes.clear();
+
+            if (t_k->second != "all")
+                for (const auto& t : str_tokenize(t_k->second, ","))
+                    if (str_strip(t).length() != 0)
+                        prefixes.push_back(str_strip(t));
+        }
+    } catch (const std::exception& e) {
+        con->set_status(400);
+        stream << "Invalid request: " << e.what() << "\n";
+        return;
+    }
+
+    if (duration_s == 0 || duration_s > max_duration_s) {
+        con->set_status(400);
+        stream << "Invalid request: duration must be between 1 and " << max_duration_s <<
+            " seconds\n";
+        return;
+    }
+
+    if (rate_hz == 0 || rate_hz > 1000) {
+        con->set_status(400);
+        stream << "Invalid request: rate must be between 1 and 1000 samples per second\n";
+        return;
+    }
+
+    if (!supported()) {
+        con->set_status(501);
+        stream << "The sampling profiler is not supported on this platform\n";
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk(profile_mutex, std::try_to_lock);
+
+    if (!lk.owns_lock()) {
+        con->set_status(409);
+        stream << "A profile is already running\n";
+        return;
+    }
+
+    stream << profile(duration_s, rate_hz, prefixes);
+}
+
+std::string kis_profiler::profile(unsigned int duration_s, unsigned int rate_hz,
+        const std::vector<std::string>& thread_prefixes) {
+#ifndef KIS_PROFILER_SUPPORTED
+    return "";
+#else
+    // Threads to sample, by name
+    std::map<pid_t, std::string> threads;
+
+    auto taskdir = opendir("/proc/self/task");
+
+    if (taskdir == nullptr)
+        return "";
+
+    struct dirent *de;
+
+    while ((de = readdir(taskdir)) != nullptr) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        pid_t tid;
+
+        try {
+            tid = string_to_n<pid_t>(de->d_name);
+        } catch (const std::exception& e) {
+            continue;
+        }
+
+        std::ifstream commf(fmt::format("/proc/self/task/{}/comm", tid));
+        std::string comm;
+
+        if (!std::getline(commf, comm))
+            continue;
+
+        bool match = thread_prefixes.size() == 0;
+
+        for (const auto& p : thread_prefixes) {
+            if (comm.compare(0, p.length(), p) == 0) {
+                match = true;
+                break;
+            }
+        }
+
+        if (match)
+            threads[tid] = comm;
+    }
+
+    closedir(taskdir);
+
+    if (threads.size() == 0)
+        return "";
+
+    // Room for every sample the threads could produce if they were all busy, within reason
+    size_t n_busy = std::min<size_t>(threads.size(),
+            std::max(1U, std::thread::hardware_concurrency()));
+    size_t capacity = std::min<size_t>(32768,
+            (size_t) rate_hz * duration_s * n_busy + (rate_hz * duration_s) / 4 + 256);
+
+    std::unique_ptr<profile_run> run(new profile_run(capacity));
+
+    // The first unwind can allocate as the unwinder loads; do it here instead of in the
+    // first signal
+    void *prime[4];
+    unwind_here(prime, 4);
+
+    active_run.store(run.get());
+
+    std::vector<int> timers;
+
+    for (const auto& t : threads) {
+        int timer_id;
+
+        // Threads may exit before we get to them
+        if (!create_thread_timer(t.first, &timer_id))
+            continue;
+
+        if (!arm_thread_timer(timer_id, rate_hz)) {
+            delete_thread_timer(timer_id);
+            continue;
+        }
+
+        timers.push_back(timer_id);
+    }
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(duration_s);
+
+    while (!Globalreg::globalreg->spindown && std::chrono::steady_clock::now() < end)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (auto t : timers)
+        delete_thread_timer(t);
+
+    active_run.store(nullptr);
+
+    while (handlers_running.load() != 0)
+        std::this_thread::yield();
+
+    // Count the unique stacks, then resolve the frames they use
+    auto n_samples = std::min(run->next.load(), run->capacity);
+
+    std::map<std::pair<pid_t, std::vector<void *>>, uint64_t> stacks;
+    std::unordered_map<void *, std::string> names;
+
+    for (size_t i = 0; i < n_samples; i++) {
+        auto& s = run->samples[i];
+
+        if (!s.ready.load(std::memory_order_acquire))
+            continue;
+
+        // Skip the handler frames, up to and including the signal trampoline
+        unsigned int first = 0;
+
+        for (unsigned int f = 0; f < s.depth; f++) {
+            auto fa = reinterpret_cast<uintptr_t>(s.frames[f]);
+            auto ra = reinterpret_cast<uintptr_t>(s.ret);
+
+            if (fa == ra || fa + 1 == ra) {
+                first = f + 1;
+                break;
+            }
+        }
+
+        std::vector<void *> frames;
+
+        for (unsigned int f = first; f < s.depth; f++) {
+            // The unwinder ends some stacks with a null return address
+            if (s.frames[f] == nullptr || s.frames[f] == reinterpret_cast<void *>(UINTPTR_MAX))
+                continue;
+
+            frames.push_back(s.frames[f]);
+            names[s.frames[f]] = "";
+        }
+
+        stacks[std::make_pair(s.tid, std::move(frames))]++;
+    }
+
+    address_list addrs;
+
+    for (const auto& n : names)
+        addrs.addrs.push_back(n.first);
+
+    backward::TraceResolver resolver;
+    resolver.load_stacktrace(addrs);
+
+    for (size_t i = 0; i < addrs.addrs.size(); i++) {
+        auto r = resolver.resolve(backward::ResolvedTrace(backward::Trace(addrs.addrs[i], i)));
+
+        std::string name;
+
+        if (r.source.function.length() != 0)
+            name = r.source.function;
+        else if (r.object_function.length() != 0)
+            name = r.object_function;
+        else if (r.object_filename.length() != 0)
+            name = fmt::format("[{}]", r.object_filename.substr(r.object_filename.rfind('/') + 1));
+        else
+            name = fmt::format("{}", addrs.addrs[i]);
+
+        names[addrs.addrs[i]] = folded_frame(name);
+    }
+
+    // Folded stacks run from the outermost frame to the innermost
+    std::stringstream ss;
+
+    for (const auto& s : stacks) {
+        auto t = threads.find(s.first.first);
+
+        ss << folded_frame(t != threads.end() ? t->second : std::to_string(s.first.first));
+
+        for (auto f = s.first.second.rbegin(); f != s.first.second.rend(); ++f)
+            ss << ";" << names[*f];
+
+        ss << " " << s.second << "\n";
+    }
+
+    if (run->dropped > 0)
+        _MSG_INFO("Sampling profiler dropped {} samples which did not fit in the sample "
+                "buffer; lower the rate or the duration for a complete profile.", run->dropped.load());
+
+    return ss.str();
+#endif
+}
+
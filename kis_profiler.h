@@ -0,0 +1,82 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_PROFILER_H__
+#define __KIS_PROFILER_H__
+
+#include "config.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "kis_net_beast_httpd.h"
+
+// Built-in sampling profiler, for finding out where the CPU goes on remote sensors where
+// perf can't be run.
+//
+// While a profile runs, each selected thread gets a timer on its own CPU clock which
+// signals it with SIGPROF every 1/rate seconds of CPU it uses; the signal handler records
+// the stack of the thread with the backward unwinder.  Only threads using CPU are sampled,
+// like perf.  Once the profile finishes the stacks are resolved to function names and
+// exported as folded stacks, one line per unique stack with its sample count, which
+// flamegraph.pl and speedscope read directly:
+//
+// curl -u user:pass 'http://host:2501/system/profile/folded.txt?duration=30' > kismet.folded
+//
+// Threads are selected by the prefix of their name, such as "PACKET" for the packet
+// threads; functions which aren't exported are reported by object name.
+class kis_profiler : public lifetime_global {
+public:
+    static std::string global_name() { return "PROFILER"; }
+
+    static std::shared_ptr<kis_profiler> create_profiler() {
+        std::shared_ptr<kis_profiler> mon(new kis_profiler());
+        Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->insert_global(global_name(), mon);
+        return mon;
+    }
+
+    // Is sampling supported by this build
+    static bool supported();
+
+private:
+    kis_profiler();
+
+public:
+    virtual ~kis_profiler();
+
+    // Sample the threads whose names start with any of the prefixes (or every thread, if
+    // there are none) for duration_s seconds at rate_hz samples per CPU second, and
+    // return the folded stacks
+    std::string profile(unsigned int duration_s, unsigned int rate_hz,
+            const std::vector<std::string>& thread_prefixes);
+
+protected:
+    void profile_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
+    // One profile at a time
+    std::mutex profile_mutex;
+
+    unsigned int max_duration_s;
+};
+
+#endif
+
@@ -0,0 +1,406 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+
+#include "configfile.h"
+#include "endian_magic.h"
+#include "kis_spectrum.h"
+#include "messagebus.h"
+#include "util.h"
+
+void spectrum_decimate(const std::vector<int8_t>& in, size_t in_bins,
+        spectrum_decimation in_mode, std::vector<int8_t>& out) {
+    if (in_bins == 0 || in.size() <= in_bins) {
+        out = in;
+        return;
+    }
+
+    out.resize(in_bins);
+
+    for (size_t b = 0; b < in_bins; b++) {
+        // Each output bin covers at least one input bin
+        size_t start = b * in.size() / in_bins;
+        size_t end = (b + 1) * in.size() / in_bins;
+
+        int v = in[start];
+
+        if (in_mode == spectrum_decimation::min) {
+            for (size_t i = start + 1; i < end; i++)
+                v = std::min(v, (int) in[i]);
+        } else if (in_mode == spectrum_decimation::max) {
+            for (size_t i = start + 1; i < end; i++)
+                v = std::max(v, (int) in[i]);
+        } else {
+            // Average of the dBm values, not of the power
+            int sum = 0;
+
+            for (size_t i = start; i < end; i++)
+                sum += in[i];
+
+            v = sum / (int) (end - start);
+        }
+
+        out[b] = v;
+    }
+}
+
+const spectrum_sweep& spectrum_ring::add(uint64_t in_ts_usec, double in_start_hz,
+        double in_end_hz, const int32_t *in_data, size_t in_len) {
+    auto& s = slots[head];
+
+    s.ts_usec = in_ts_usec;
+    s.start_hz = in_start_hz;
+    s.end_hz = in_end_hz;
+    s.bins.resize(in_len);
+
+    for (size_t i = 0; i < in_len; i++)
+        s.bins[i] = std::max(-128, std::min(127, in_data[i]));
+
+    head = (head + 1) % slots.size();
+
+    if (count < slots.size())
+        count++;
+
+    total++;
+
+    return s;
+}
+
+kis_spectrum_tracker::kis_spectrum_tracker() :
+    lifetime_global() {
+
+    spectrum_mutex.set_name("kis_spectrum_tracker");
+
+    ring_slots = std::max(1U, Globalreg::globalreg->kismet_config->fetch_opt_uint("spectrum_history", 512));
+
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/spectrum/sources", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    sources_endp(con);
+                }));
+
+    httpd->register_route("/spectrum/by-uuid/:uuid/sweeps", {"GET", "POST"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    sweeps_endp(con);
+                }));
+
+    httpd->register_websocket_route("/spectrum/stream", httpd->RO_ROLE, {"ws"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    stream_endp(con);
+                }));
+}
+
+kis_spectrum_tracker::~kis_spectrum_tracker() {
+    Globalreg::globalreg->remove_global(global_name());
+}
+
+std::shared_ptr<kis_spectrum_tracker::source_spectrum>
+kis_spectrum_tracker::find_source(const uuid& in_uuid, bool in_create) {
+    kis_lock_guard<kis_mutex> lk(spectrum_mutex, "spectrum find_source");
+
+    auto s = sources.find(in_uuid);
+
+    if (s != sources.end())
+        return s->second;
+
+    if (!in_create)
+        return nullptr;
+
+    auto src = std::make_shared<source_spectrum>(in_uuid, ring_slots);
+    src->mutex.set_name(fmt::format("spectrum {}", in_uuid));
+    sources[in_uuid] = src;
+
+    return src;
+}
+
+bool kis_spectrum_tracker::parse_mode(const std::string& in_mode, spectrum_decimation& out_mode) {
+    auto m = str_lower(in_mode);
+
+    if (m == "" || m == "max")
+        out_mode = spectrum_decimation::max;
+    else if (m == "min")
+        out_mode = spectrum_decimation::min;
+    else if (m == "avg")
+        out_mode = spectrum_decimation::avg;
+    else
+        return false;
+
+    return true;
+}
+
+std::string kis_spectrum_tracker::stream_frame(const spectrum_sweep& in_sweep,
+        const std::vector<int8_t>& in_bins) {
+    std::string frame(32 + in_bins.size(), 0);
+    auto p = &frame[0];
+
+    uint32_t n = kis_htole32((uint32_t) in_bins.size());
+    uint64_t ts = kis_htole64(in_sweep.ts_usec);
+
+    // Doubles are written in the byte order of the host, which is little-endian on
+    // anything Kismet runs on
+    memcpy(p, "KSPC", 4);
+    memcpy(p + 4, &n, sizeof(n));
+    memcpy(p + 8, &ts, sizeof(ts));
+    memcpy(p + 16, &in_sweep.start_hz, sizeof(double));
+    memcpy(p + 24, &in_sweep.end_hz, sizeof(double));
+
+    if (in_bins.size() != 0)
+        memcpy(p + 32, in_bins.data(), in_bins.size());
+
+    return frame;
+}
+
+void kis_spectrum_tracker::add_sweep(const uuid& in_uuid, const std::string& in_name,
+        uint64_t in_ts_usec, double in_start_hz, double in_end_hz,
+        const int32_t *in_data, size_t in_len) {
+    auto src = find_source(in_uuid, true);
+
+    kis_lock_guard<kis_mutex> lk(src->mutex, "spectrum add_sweep");
+
+    if (src->name != in_name)
+        src->name = in_name;
+
+    const auto& sweep = src->ring.add(in_ts_usec, in_start_hz, in_end_hz, in_data, in_len);
+
+    for (const auto& c : src->clients) {
+        if (c->min_interval_usec != 0 && c->last_usec != 0 &&
+                in_ts_usec - c->last_usec < c->min_interval_usec &&
+                in_ts_usec >= c->last_usec)
+            continue;
+
+        c->last_usec = in_ts_usec;
+
+        spectrum_decimate(sweep.bins, c->bins, c->mode, c->scratch);
+        c->ws->write_binary(stream_frame(sweep, c->scratch));
+    }
+}
+
+void kis_spectrum_tracker::sources_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::vector<std::shared_ptr<source_spectrum>> srcs;
+
+    {
+        kis_lock_guard<kis_mutex> lk(spectrum_mutex, "spectrum sources_endp");
+
+        for (const auto& s : sources)
+            srcs.push_back(s.second);
+    }
+
+    auto ret = nlohmann::json::array();
+
+    for (const auto& s : srcs) {
+        kis_lock_guard<kis_mutex> lk(s->mutex, "spectrum sources_endp");
+
+        nlohmann::json j;
+
+        j["uuid"] = s->source_uuid.as_string();
+        j["name"] = s->name;
+        j["sweeps"] = s->ring.size();
+        j["total_sweeps"] = s->ring.total_sweeps();
+        j["clients"] = s->clients.size();
+
+        auto last = s->ring.last();
+
+        if (last != nullptr) {
+            j["last_ts_usec"] = last->ts_usec;
+            j["last_start_hz"] = last->start_hz;
+            j["last_end_hz"] = last->end_hz;
+            j["last_bins"] = last->bins.size();
+        }
+
+        ret.push_back(j);
+    }
+
+    std::ostream os(&con->response_stream());
+    os << ret;
+}
+
+void kis_spectrum_tracker::sweeps_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::ostream os(&con->response_stream());
+
+    size_t bins = 0, count = 1;
+    spectrum_decimation mode;
+    uuid src_uuid;
+
+    try {
+        src_uuid = string_to_n<uuid>(con->uri_params()[":uuid"]);
+
+        auto bins_k = con->http_variables().find("bins");
+        if (bins_k != con->http_variables().end())
+            bins = string_to_n<size_t>(bins_k->second);
+
+        auto count_k = con->http_variables().find("count");
+        if (count_k != con->http_variables().end())
+            count = string_to_n<size_t>(count_k->second);
+
+        std::string mode_str;
+
+        auto mode_k = con->http_variables().find("mode");
+        if (mode_k != con->http_variables().end())
+            mode_str = mode_k->second;
+
+        if (!parse_mode(mode_str, mode))
+            throw std::runtime_error("unknown mode, expected min, max, or avg");
+    } catch (const std::exception& e) {
+        con->set_status(400);
+        os << "Invalid request: " << e.what() << "\n";
+        return;
+    }
+
+    auto src = find_source(src_uuid, false);
+
+    if (src == nullptr) {
+        con->set_status(404);
+        os << "No spectrum from source " << src_uuid << "\n";
+        return;
+    }
+
+    // Sweeps are written directly, so a waterfall request doesn't build a JSON
+    // document of every bin
+    std::vector<int8_t> scratch;
+    bool first = true;
+
+    kis_lock_guard<kis_mutex> lk(src->mutex, "spectrum sweeps_endp");
+
+    os << "{\"uuid\": \"" << src_uuid << "\", \"sweeps\": [";
+
+    src->ring.for_each_recent(count, [&](const spectrum_sweep& s) {
+            spectrum_decimate(s.bins, bins, mode, scratch);
+
+            if (!first)
+                os << ",";
+            first = false;
+
+            os << fmt::format("{{\"ts_usec\": {}, \"start_hz\": {}, \"end_hz\": {}, \"bins\": [",
+                    s.ts_usec, s.start_hz, s.end_hz);
+
+            for (size_t i = 0; i < scratch.size(); i++) {
+                if (i != 0)
+                    os << ",";
+                os << (int) scratch[i];
+            }
+
+            os << "]}";
+        });
+
+    os << "]}";
+}
+
+void kis_spectrum_tracker::stream_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    // Subscriptions of this socket, by source
+    std::map<uuid, std::shared_ptr<stream_client>> subscriptions;
+    kis_mutex sub_mutex;
+
+    auto unsubscribe = [this](const uuid& in_uuid, std::shared_ptr<stream_client> in_client) {
+        auto src = find_source(in_uuid, false);
+
+        if (src == nullptr)
+            return;
+
+        kis_lock_guard<kis_mutex> lk(src->mutex, "spectrum unsubscribe");
+
+        src->clients.erase(std::remove(src->clients.begin(), src->clients.end(), in_client),
+                src->clients.end());
+    };
+
+    auto ws =
+        std::make_shared<kis_net_web_websocket_endpoint>(con,
+            [this, &subscriptions, &sub_mutex, unsubscribe](std::shared_ptr<kis_net_web_websocket_endpoint> ws,
+                boost::beast::flat_buffer& buf, bool text) {
+
+                if (!text) {
+                    ws->close();
+                    return;
+                }
+
+                nlohmann::json json;
+
+                try {
+                    std::stringstream ss(boost::beast::buffers_to_string(buf.data()));
+                    ss >> json;
+                } catch (const std::exception& e) {
+                    _MSG_ERROR("Invalid websocket request (could not parse JSON message) on "
+                            "/spectrum/stream.ws");
+                    return;
+                }
+
+                kis_lock_guard<kis_mutex> lk(sub_mutex, "spectrum stream subscription");
+
+                try {
+                    if (json["UNSUBSCRIBE"].is_string()) {
+                        auto u = string_to_n<uuid>(json["UNSUBSCRIBE"].get<std::string>());
+                        auto s = subscriptions.find(u);
+
+                        if (s != subscriptions.end()) {
+                            unsubscribe(u, s->second);
+                            subscriptions.erase(s);
+                        }
+                    }
+
+                    if (json["SUBSCRIBE"].is_string()) {
+                        auto u = string_to_n<uuid>(json["SUBSCRIBE"].get<std::string>());
+
+                        auto client = std::make_shared<stream_client>();
+                        client->ws = ws;
+                        client->bins = json.value("bins", 0);
+                        client->last_usec = 0;
+
+                        if (!parse_mode(json.value("mode", ""), client->mode))
+                            throw std::runtime_error("unknown mode, expected min, max, or avg");
+
+                        double rate = json.value("rate", 0.0);
+                        client->min_interval_usec = rate > 0 ? 1000000 / rate : 0;
+
+                        auto s = subscriptions.find(u);
+
+                        if (s != subscriptions.end()) {
+                            unsubscribe(u, s->second);
+                            subscriptions.erase(s);
+                        }
+
+                        // Sources can be subscribed to before their first sweep
+                        auto src = find_source(u, true);
+
+                        kis_lock_guard<kis_mutex> slk(src->mutex, "spectrum subscribe");
+                        src->clients.push_back(client);
+                        subscriptions[u] = client;
+                    }
+                } catch (const std::exception& e) {
+                    _MSG_ERROR("Invalid websocket request on /spectrum/stream.ws: {}", e.what());
+                }
+            });
+
+    ws->text();
+
+    try {
+        ws->handle_request(con);
+    } catch (const std::exception& e) {
+        ws->close();
+    }
+
+    kis_lock_guard<kis_mutex> lk(sub_mutex, "spectrum stream close");
+
+    for (const auto& s : subscriptions)
+        unsubscribe(s.first, s.second);
+}
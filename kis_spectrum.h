@@ -20,183 +20,163 @@
 #define __KIS_SPECTRUM_H__
 
 #include "config.h"
-#include "trackedelement.h"
-#include "kis_datasource.h"
 
-// Sweep record with full data
-class spectrum_sweep : public tracker_component {
-public:
-    spectrum_sweep(int in_id) :
-        tracker_component(in_id) {
-        register_fields();
-        reserve_fields(NULL);
-    }
-
-    spectrum_sweep(int in_id, shared_tracker_element e) :
-        tracker_component(in_id) {
-        register_fields();
-        reserve_fields(e);
-    }
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "kis_mutex.h"
+#include "kis_net_beast_httpd.h"
+#include "uuid.h"
+
+// Spectrum sweeps, from sources such as the HackRF sweep.  A wideband sweep can be
+// thousands of bins many times a second, so sweeps are not kept as tracked records;
+// each source gets a fixed-size ring of sweeps with the bins packed as int8 dBm, and
+// sweeps are decimated by the server to the resolution of the display:
+//
+// GET /spectrum/sources.json
+//      Sources with sweeps, and the last sweep of each
+//
+// GET /spectrum/by-uuid/[uuid]/sweeps.json?bins=N&count=N&mode=max
+//      The most recent sweeps of a source, oldest first, reduced to at most 'bins'
+//      bins by the min, max (the default), or avg of the bins they cover
+//
+// WS /spectrum/stream.ws
+//      Binary stream of the sweeps of a source, subscribed to by sending
+//      {"SUBSCRIBE": uuid, "bins": N, "mode": "max", "rate": N}, where rate limits the
+//      sweeps per second; {"UNSUBSCRIBE": uuid} ends the stream.  Each sweep is a
+//      binary frame, little-endian:
+//
+//          0   char[4]     "KSPC"
+//          4   uint32      number of bins
+//          8   uint64      time of the sweep, in microseconds
+//          16  double      start frequency, Hz
+//          24  double      end frequency, Hz
+//          32  int8[]      bins, dBm
+
+enum class spectrum_decimation {
+    min, max, avg
+};
 
-    virtual std::shared_ptr<tracker_element> clone_type() override {
-        using this_t = typename std::remove_pointer<decltype(this)>::type;
-        auto r = std::make_shared<this_t>();
-        r->set_id(this->get_id());
-        return r;
-    }
+// Reduce the bins of a sweep to at most in_bins bins, each the min, max, or average of
+// the bins it covers; sweeps with fewer bins are copied as-is.  0 copies every bin.
+void spectrum_decimate(const std::vector<int8_t>& in, size_t in_bins,
+        spectrum_decimation in_mode, std::vector<int8_t>& out);
 
-    virtual void register_fields() {
-        tracker_component::register_fields();
+struct spectrum_sweep {
+    uint64_t ts_usec;
+    double start_hz;
+    double end_hz;
+    std::vector<int8_t> bins;
+};
 
-        register_field("kismet.spectrum.sweep.num_samples", tracker_uint64,
-                "Number of samples per sweep record", &num_samples_sweep);
-        register_field("kismet.spectrum.sweep.start_mhz", tracker_uint64,
-                "Starting frequency of sweep (MHz)", &start_mhz);
-        register_field("kismet.spectrum.sweep.bin_hz", tracker_uint64,
-                "Sample width / Bin size (Hz)", &sample_hz_width);
-        register_field("kismet.spectrum.sweep.samples_per_freq,", tracker_uint64,
-                "Samples per frequency", &samples_per_freq);
+// Fixed-size ring of sweeps; the bin arrays of the slots are reused, so a source
+// sweeping the same range never allocates once the ring is full
+class spectrum_ring {
+public:
+    spectrum_ring(size_t in_slots) :
+        slots(in_slots),
+        head{0},
+        count{0},
+        total{0} { }
+
+    // Add a sweep, clamping the bins to the int8 range
+    const spectrum_sweep& add(uint64_t in_ts_usec, double in_start_hz, double in_end_hz,
+            const int32_t *in_data, size_t in_len);
+
+    // Call fn with each of the most recent in_max sweeps, oldest first
+    template<typename F>
+    void for_each_recent(size_t in_max, F fn) const {
+        auto n = std::min(in_max, count);
+
+        for (size_t i = 0; i < n; i++)
+            fn(slots[(head + slots.size() - n + i) % slots.size()]);
+    }
 
-        register_field("kismet.spectrum.samples", tracker_vector, 
-                "Vector of sample data, in dbm", &sample_vec);
+    const spectrum_sweep *last() const {
+        if (count == 0)
+            return nullptr;
 
+        return &slots[(head + slots.size() - 1) % slots.size()];
     }
 
-    __Proxy(num_samples, uint64_t, uint64_t, uint64_t, num_samples_sweep);
-    __Proxy(start_mhz, uint64_t, uint64_t, uint64_t, start_mhz);
-    __Proxy(bin_hz, uint64_t, uint64_t, uint64_t, sample_hz_width);
-    __Proxy(samples_per_freq, uint64_t, uint64_t, uint64_t, samples_per_freq);
+    size_t size() const { return count; }
+    uint64_t total_sweeps() const { return total; }
 
 protected:
-
-    shared_tracker_element num_samples_sweep;
-    shared_tracker_element start_mhz;
-    shared_tracker_element sample_hz_width;
-    shared_tracker_element samples_per_freq;
-
-    shared_tracker_element sample_vec;
-
+    std::vector<spectrum_sweep> slots;
+    size_t head;
+    size_t count;
+    uint64_t total;
 };
 
-// Spectrum-specific sub-type of Kismet data sources
-class spectrum_datasource : public kis_datasource {
+class kis_spectrum_tracker : public lifetime_global {
 public:
-    spectrum_datasource(shared_datasource_builder in_builder);
-
-    // Configure sweeping
-    virtual void set_sweep(uint64_t in_start_mhz, uint64_t in_end_mhz, uint64_t in_num_per_freq,
-            uint64_t in_bin_width) = 0;
-
-    // Configure sweeping with amplification
-    virtual void set_sweep_amp(uint64_t in_start_mhz, uint64_t in_end_mhz, 
-            uint64_t in_num_per_freq, uint64_t in_bin_width, bool in_amp,
-            uint64_t in_if_amp, uint64_t in_baseband_amp) = 0;
-
-    __ProxyGet(spectrum_configurable, uint8_t, bool, spectrum_configurable);
+    static std::string global_name() { return "SPECTRUMTRACKER"; }
 
-    __ProxyGet(spectrum_min_mhz, uint64_t, uint64_t, spectrum_min_mhz);
-    __ProxyGet(spectrum_max_mhz, uint64_t, uint64_t, spectrum_max_mhz);
-
-    __ProxyGet(spectrum_min_bin_hz, uint64_t, uint64_t, spectrum_min_bin_hz);
-    __ProxyGet(spectrum_max_bin_hz, uint64_t, uint64_t, spectrum_max_bin_hz);
+    static std::shared_ptr<kis_spectrum_tracker> create_spectrumtracker() {
+        std::shared_ptr<kis_spectrum_tracker> mon(new kis_spectrum_tracker());
+        Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->insert_global(global_name(), mon);
+        return mon;
+    }
 
-    __ProxyGet(spectrum_amp, uint8_t, bool, spectrum_amp);
+private:
+    kis_spectrum_tracker();
 
-    __ProxyGet(spectrum_gain_if, uint64_t, uint64_t, spectrum_gain_if);
-    __ProxyGet(spectrum_gain_if_min, uint64_t, uint64_t, spectrum_gain_if_min);
-    __ProxyGet(spectrum_gain_if_max, uint64_t, uint64_t, spectrum_gain_if_max);
-    __ProxyGet(spectrum_gain_if_step, uint64_t, uint64_t, spectrum_gain_if_step);
+public:
+    virtual ~kis_spectrum_tracker();
 
-    __ProxyGet(spectrum_gain_baseband, uint64_t, uint64_t, spectrum_gain_baseband);
-    __ProxyGet(spectrum_gain_baseband_min, uint64_t, uint64_t, spectrum_gain_baseband_min);
-    __ProxyGet(spectrum_gain_baseband_max, uint64_t, uint64_t, spectrum_gain_baseband_max);
-    __ProxyGet(spectrum_gain_baseband_step, uint64_t, uint64_t, spectrum_gain_baseband_step);
+    // Record a sweep from a source, and send it to the clients streaming the source
+    void add_sweep(const uuid& in_uuid, const std::string& in_name, uint64_t in_ts_usec,
+            double in_start_hz, double in_end_hz, const int32_t *in_data, size_t in_len);
 
 protected:
-    virtual void register_fields() {
-        tracker_component::register_fields();
-
-        register_field("kismet.spectrum.device.configurable", tracker_uint8,
-                "spectrum range is configurable (bool)", &spectrum_configurable);
-
-        register_field("kismet.spectrum.device.min_mhz", tracker_uint64,
-                "minimum frequency of spectrum sweep (Hz)", &spectrum_min_mhz);
-        register_field("kismet.spectrum.device.max_mhz", tracker_uint64,
-                "maximum frequency of spectrum sweep (Hz)", &spectrum_max_mhz);
-        register_field("kismet.spectrum.device.min_bin_mhz", tracker_uint64,
-                "minimum size of frequency bin (Hz)", &spectrum_min_bin_mhz);
-        register_field("kismet.spectrum.device.max_bin_mhz", tracker_uint64,
-                "maximum size of frequency bin (Hz)", &spectrum_max_bin_mhz);
-        register_field("kismet.spectrum.device.min_num_samples_per", tracker_uint64,
-                "minimum number of samples per frequency bin", &spectrum_min_num_samples_per);
-        register_field("kismet.spectrum.device.max_num_samples_per", tracker_uint64,
-                "maximum number of samples per frequency bin", &spectrum_max_num_samples_per);
-
-        register_field("kismet.spectrum.device.amp", tracker_uint8,
-                "amplifier enabled", &spectrum_amp);
-
-        register_field("kismet.spectrum.device.gain_if", tracker_uint64,
-                "lna/if gain", &spectrum_gain_if);
-        register_field("kismet.spectrum.device.gain_if_min", tracker_uint64,
-                "lna/if minimum gain", &spectrum_gain_if_min);
-        register_field("kismet.spectrum.device.gain_if_max", tracker_uint64,
-                "lna/if maximum gain", &spectrum_gain_if_max);
-        register_field("kismet.spectrum.device.gain_if_step", tracker_uint64,
-                "lna/if gain step", &spectrum_gain_if_step);
-
-        register_field("kismet.spectrum.device.gain_baseband", tracker_uint64,
-                "VGA/baseband gain", &spectrum_gain_baseband);
-        register_field("kismet.spectrum.device.gain_baseband_min", tracker_uint64,
-                "VGA/baseband minimum gain", &spectrum_gain_baseband_min);
-        register_field("kismet.spectrum.device.gain_baseband_max", tracker_uint64,
-                "VGA/baseband maximum gain", &spectrum_gain_baseband_max);
-        register_field("kismet.spectrum.device.gain_baseband_step", tracker_uint64,
-                "VGA/baseband gain step", &spectrum_gain_baseband_step);
+    struct stream_client {
+        std::shared_ptr<kis_net_web_websocket_endpoint> ws;
+        size_t bins;
+        spectrum_decimation mode;
+        uint64_t min_interval_usec;
+        uint64_t last_usec;
 
-    }
+        // Decimated bins, reused for every sweep
+        std::vector<int8_t> scratch;
+    };
 
-    __ProxySet(spectrum_configurable, uint8_t, bool, spectrum_configurable);
+    struct source_spectrum {
+        source_spectrum(const uuid& in_uuid, size_t in_slots) :
+            source_uuid{in_uuid},
+            ring{in_slots} { }
 
-    __ProxySet(spectrum_min_mhz, uint64_t, uint64_t, spectrum_min_mhz);
-    __ProxySet(spectrum_max_mhz, uint64_t, uint64_t, spectrum_max_mhz);
+        kis_mutex mutex;
 
-    __ProxySet(spectrum_min_bin_hz, uint64_t, uint64_t, spectrum_min_bin_hz);
-    __ProxySet(spectrum_max_bin_hz, uint64_t, uint64_t, spectrum_max_bin_hz);
+        uuid source_uuid;
+        std::string name;
 
-    __ProxySet(spectrum_amp, uint8_t, bool, spectrum_amp);
+        spectrum_ring ring;
 
-    __ProxySet(int_spectrum_gain_if, uint64_t, uint64_t, spectrum_gain_if);
-    __ProxySet(int_spectrum_gain_if_min, uint64_t, uint64_t, spectrum_gain_if_min);
-    __ProxySet(int_spectrum_gain_if_max, uint64_t, uint64_t, spectrum_gain_if_max);
-    __ProxySet(int_spectrum_gain_if_step, uint64_t, uint64_t, spectrum_gain_if_step);
+        std::vector<std::shared_ptr<stream_client>> clients;
+    };
 
-    __ProxySet(int_spectrum_gain_baseband, uint64_t, uint64_t, spectrum_gain_baseband);
-    __ProxySet(int_spectrum_gain_baseband_min, uint64_t, uint64_t, spectrum_gain_baseband_min);
-    __ProxySet(int_spectrum_gain_baseband_max, uint64_t, uint64_t, spectrum_gain_baseband_max);
-    __ProxySet(int_spectrum_gain_baseband_step, uint64_t, uint64_t, spectrum_gain_baseband_step);
+    std::shared_ptr<source_spectrum> find_source(const uuid& in_uuid, bool in_create);
 
-    shared_tracker_element spectrum_configurable;
+    static bool parse_mode(const std::string& in_mode, spectrum_decimation& out_mode);
 
-    shared_tracker_element spectrum_min_mhz;
-    shared_tracker_element spectrum_max_mhz;
-    shared_tracker_element spectrum_min_bin_hz;
-    shared_tracker_element spectrum_max_bin_hz;
-    shared_tracker_element spectrum_min_num_samples_per;
-    shared_tracker_element spectrum_max_num_samples_per;
+    static std::string stream_frame(const spectrum_sweep& in_sweep,
+            const std::vector<int8_t>& in_bins);
 
-    shared_tracker_element spectrum_amp;
+    void sources_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+    void sweeps_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+    void stream_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
 
-    shared_tracker_element spectrum_gain_if;
-    shared_tracker_element spectrum_gain_if_min;
-    shared_tracker_element spectrum_gain_if_max;
-    shared_tracker_element spectrum_gain_if_step;
+    kis_mutex spectrum_mutex;
+    std::map<uuid, std::shared_ptr<source_spectrum>> sources;
 
-    shared_tracker_element spectrum_gain_baseband;
-    shared_tracker_element spectrum_gain_baseband_min;
-    shared_tracker_element spectrum_gain_baseband_max;
-    shared_tracker_element spectrum_gain_baseband_step;
-    
-    
+    // Sweeps kept per source
+    size_t ring_slots;
 };
 
 #endif
@@ -24,24 +24,34 @@
 #include "phy_80211.h"
 #include "phy_bluetooth.h"
 #include "phy_btle.h"
+#include "string_scan.h"
 #include "version.h"
 
 // Aggressive additional mangle of text to handle converting ',' and '"' to
 // hexcode for CSV
 std::string munge_for_csv(const std::string& in_data) {
 	std::string ret;
-
-	for (size_t i = 0; i < in_data.length(); i++) {
-		if ((unsigned char) in_data[i] >= 32 && (unsigned char) in_data[i] <= 126 &&
-				in_data[i] != ',' && in_data[i] != '\"' ) {
-			ret += in_data[i];
-		} else {
-			ret += '\\';
-			ret += ((in_data[i] >> 6) & 0x03) + '0';
-			ret += ((in_data[i] >> 3) & 0x07) + '0';
-			ret += ((in_data[i] >> 0) & 0x07) + '0';
-		}
-	}
+    ret.reserve(in_data.length());
+
+    const auto data = in_data.data();
+    const auto len = in_data.length();
+    size_t i = 0;
+
+    while (true) {
+        // copy the run of printable text whole
+        const auto run = printable_span(data + i, len - i, ",\"");
+        ret.append(data + i, run);
+        i += run;
+
+        if (i >= len)
+            break;
+
+        ret += '\\';
+        ret += ((data[i] >> 6) & 0x03) + '0';
+        ret += ((data[i] >> 3) & 0x07) + '0';
+        ret += ((data[i] >> 0) & 0x07) + '0';
+        i++;
+    }
 
 	return ret;
 }
@@ -124,8 +134,6 @@ int frequency_to_wifi_channel(double in_freq) {
 kis_wiglecsv_logfile::kis_wiglecsv_logfile(shared_log_builder in_builder) :
     kis_logfile(in_builder) {
 
-    csvfile = nullptr;
-
     devicetracker = Globalreg::fetch_mandatory_global_as<device_tracker>();
 
     auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
@@ -168,26 +176,24 @@ bool kis_wiglecsv_logfile::open_log(std::string in_path) {
 
     auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
 
-    csvfile = fopen(in_path.c_str(), "wa");
-    if (csvfile == NULL) {
-        _MSG_ERROR("Failed to open wiglecsv log '{}': {}", in_path,
-                kis_strerror_r(errno));
+    std::string error;
+
+    if (!csvfile.open(in_path, error)) {
+        _MSG_ERROR("Failed to open wiglecsv log '{}': {}", in_path, error);
         return false;
     }
 
     _MSG_INFO("Opened wiglecsv log file '{}'", in_path);
 
     // CSV headers
-    fmt::print(csvfile, "WigleWifi-1.4,appRelease=Kismet{0}{1}{2},model=Kismet,release={0}.{1}.{2},"
+    csvfile.write(fmt::format("WigleWifi-1.4,appRelease=Kismet{0}{1}{2},model=Kismet,release={0}.{1}.{2},"
             "device=kismet,display=kismet,board=kismet,brand=kismet\n", 
-            VERSION_MAJOR, VERSION_MINOR, VERSION_TINY);
-    fmt::print(csvfile, "MAC,SSID,AuthMode,FirstSeen,Channel,RSSI,CurrentLatitude,CurrentLongitude,"
+            VERSION_MAJOR, VERSION_MINOR, VERSION_TINY));
+    csvfile.write("MAC,SSID,AuthMode,FirstSeen,Channel,RSSI,CurrentLatitude,CurrentLongitude,"
             "AltitudeMeters,AccuracyMeters,Type\n");
 
     set_int_log_open(true);
 
-    fflush(csvfile);
-
     lk.unlock();
 
     packetchain->register_handler(&kis_wiglecsv_logfile::packet_handler, this, CHAINPOS_LOGGING, -100);
@@ -200,10 +206,7 @@ void kis_wiglecsv_logfile::close_log() {
 
     set_int_log_open(false);
 
-    if (csvfile != nullptr)
-        fclose(csvfile);
-
-    csvfile = nullptr;
+    csvfile.close();
 
     auto packetchain = 
         Globalreg::fetch_global_as<packet_chain>();
@@ -308,7 +311,7 @@ int kis_wiglecsv_logfile::packet_handler(CHAINCALL_PARMS) {
 
         auto channel = frequency_to_wifi_channel(dev->get_frequency());
 
-        fmt::print(wigle->csvfile, "{},{},{},{},{},{},{:3.6f},{:3.6f},{:f},0,{}\n",
+        wigle->csvfile.write(fmt::format("{},{},{},{},{},{},{:3.6f},{:3.6f},{:f},0,{}\n",
                 dev->get_macaddr(),
                 name,
                 crypt,
@@ -316,7 +319,7 @@ int kis_wiglecsv_logfile::packet_handler(CHAINCALL_PARMS) {
                 (int) channel,
                 signal,
                 gps->lat, gps->lon, gps->alt,
-                "WIFI");
+                "WIFI"));
 
     } else if (wigle->bt_phy->device_is_a(dev)) {
         auto bt = wigle->bt_phy->fetch_bluetooth_record(dev);
@@ -351,7 +354,7 @@ int kis_wiglecsv_logfile::packet_handler(CHAINCALL_PARMS) {
                 break;
         }
 
-        fmt::print(wigle->csvfile, "{},{},{},{},{},{},{:3.10f},{:3.10f},{:f},0,{}\n",
+        wigle->csvfile.write(fmt::format("{},{},{},{},{},{},{:3.10f},{:3.10f},{:f},0,{}\n",
                 dev->get_macaddr(),
                 name,
                 crypt,
@@ -359,12 +362,10 @@ int kis_wiglecsv_logfile::packet_handler(CHAINCALL_PARMS) {
                 0,
                 signal,
                 gps->lat, gps->lon, gps->alt,
-                type);
+                type));
     }
 
     wigle->timer_map[dev->get_key()] = time(0) + wigle->throttle_seconds;
 
-    fflush(wigle->csvfile);
-
     return 1;
 }
@@ -23,6 +23,7 @@
 
 #include "configfile.h"
 #include "globalregistry.h"
+#include "kis_async_writer.h"
 #include "logtracker.h"
 #include "packetchain.h"
 #include "phy_80211.h"
@@ -42,7 +43,7 @@ public:
 protected:
     static int packet_handler(CHAINCALL_PARMS);
 
-    FILE *csvfile;
+    kis_async_writer csvfile;
 
     int pack_comp_80211, pack_comp_common, pack_comp_gps, pack_comp_l1info,
         pack_comp_device;
@@ -63,6 +63,11 @@
 #include "kis_datasource.h"
 #include "datasourcetracker.h"
 #include "datasource_pcapfile.h"
+#include "datasource_beast.h"
+#include "datasource_replay.h"
+#include "datasource_ndjson.h"
+#include "datasource_synthetic.h"
+#include "datasource_tzsp.h"
 #include "datasource_kismetdb.h"
 #include "datasource_linux_wifi.h"
 #include "datasource_linux_bluetooth.h"
@@ -89,13 +94,22 @@
 
 #include "logtracker.h"
 #include "kis_ppilogfile.h"
+#include "kis_benchmark.h"
 #include "kis_databaselogfile.h"
 #include "kis_pcapnglogfile.h"
 #include "kis_wiglecsvlogfile.h"
+#include "kis_elklogfile.h"
 
 #include "timetracker.h"
 #include "alertracker.h"
 
+#include "kis_io_pool.h"
+#include "kis_mem_account.h"
+#include "kis_metrics.h"
+#include "kis_federation.h"
+#include "packet_retention.h"
+#include "kis_spectrum.h"
+#include "kis_profiler.h"
 #include "kis_net_beast_httpd.h"
 
 #include "system_monitor.h"
@@ -109,6 +123,7 @@
 
 #include "devicetracker.h"
 #include "phy_80211.h"
+#include "dot11_ssidscan.h"
 #include "phy_sensor.h"
 #include "phy_meter.h"
 #include "phy_adsb.h"
@@ -124,6 +139,8 @@
 #include "manuf.h"
 #include "entrytracker.h"
 #include "json_adapter.h"
+#include "columnar_adapter.h"
+#include "msgpack_adapter.h"
 
 #include "kis_server_announce.h"
 
@@ -179,7 +196,8 @@ void SpindownKismet() {
     auto devicetracker =
         Globalreg::fetch_global_as<device_tracker>();
     if (devicetracker != NULL) {
-        devicetracker->databaselog_write_devices();
+        devicetracker->databaselog_write_devices(true);
+        devicetracker->snapshot_write_devices();
     }
 
     // shutdown everything
@@ -191,6 +209,7 @@ void SpindownKismet() {
         fprintf(stderr, "\n*** KISMET IS SHUTTING DOWN ***\n");
 
     Globalreg::globalreg->io.stop();
+    Globalreg::globalreg->http_io.stop();
 
     // Be noisy
     if (globalregistry->fatal_condition) {
@@ -602,6 +621,7 @@ int main(int argc, char *argv[], char *envp[]) {
 
     // Allocate the IO service
     boost::asio::io_service::work work(Globalreg::globalreg->io);
+    boost::asio::io_service::work http_work(Globalreg::globalreg->http_io);
 
     // Make the timetracker
     auto timetracker = time_tracker::create_timetracker();
@@ -709,6 +729,11 @@ int main(int argc, char *argv[], char *envp[]) {
     }
     globalregistry->kismet_config = conf;
 
+    // Enabled before anything accountable is created, so the counts cover the whole run
+    kis_mem_account::set_enabled(conf->fetch_opt_bool("memory_accounting", false));
+
+    globalregistry->startup_mark("config files");
+
     struct stat fstat;
     std::string configdir;
 
@@ -785,16 +810,23 @@ int main(int argc, char *argv[], char *envp[]) {
     if (globalregistry->fatal_condition)
         SpindownKismet();
 
+    globalregistry->startup_mark("manufacturer db");
+
     // Base serializers
     entrytracker->register_serializer("json", std::make_shared<json_adapter::serializer>());
     entrytracker->register_serializer("tjson", std::make_shared<translated_adapter::serializer>());
     entrytracker->register_serializer("ekjson", std::make_shared<ek_json_adapter::serializer>());
     entrytracker->register_serializer("itjson", std::make_shared<it_json_adapter::serializer>());
     entrytracker->register_serializer("prettyjson", std::make_shared<pretty_json_adapter::serializer>());
+    entrytracker->register_serializer("msgpack", std::make_shared<msgpack_adapter::serializer>());
+    entrytracker->register_serializer("kcol", std::make_shared<columnar_adapter::serializer>());
 
     entrytracker->register_serializer("jcmd", std::make_shared<json_adapter::serializer>());
     entrytracker->register_serializer("cmd", std::make_shared<json_adapter::serializer>());
 
+    json_adapter::set_parallel_workers(
+            globalregistry->kismet_config->fetch_opt_as<unsigned int>("httpd_serialize_threads", 0));
+
     if (daemonize) {
         // remove messagebus clients so we stop printing
         eventbus->remove_listener(msg_listener_id);
@@ -834,6 +866,9 @@ int main(int argc, char *argv[], char *envp[]) {
     if (globalregistry->fatal_condition)
         SpindownKismet();
 
+    // Create the retained packet budget, which the packet chain and phys report to
+    packet_retention::create_packet_retention();
+
     // Create the packet chain
     auto packetchain = packet_chain::create_packetchain();
 
@@ -858,6 +893,9 @@ int main(int argc, char *argv[], char *envp[]) {
     if (globalregistry->fatal_condition)
         SpindownKismet();
 
+    // Spectrum sweeps from the datasources
+    kis_spectrum_tracker::create_spectrumtracker();
+
     // Create the alert tracker
     auto alertracker = alert_tracker::create_alertracker();
 
@@ -880,25 +918,49 @@ int main(int argc, char *argv[], char *envp[]) {
 
     auto ipdissector = kis_dissector_ip_data::create_dissector_ip_data();
 
-    // Register the base PHYs
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_80211_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_sensor_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new Kis_Zwave_Phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_bluetooth_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new Kis_UAV_Phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new Kis_Mousejack_Phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_btle_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_meter_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_adsb_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_802154_phy()));
-    devicetracker->register_phy_handler(dynamic_cast<kis_phy_handler *>(new kis_radiation_phy()));
+    // Register the base PHYs, skipping any disabled in the config
+    auto disabled_phys = conf->fetch_opt_vec("disable_phy");
+
+    auto register_phy = [&devicetracker, &disabled_phys](const std::string& name, kis_phy_handler *phy) {
+        for (const auto& d : disabled_phys) {
+            if (str_lower(str_strip(d)) == str_lower(name)) {
+                _MSG_INFO("Not enabling the {} phy, it is disabled by disable_phy", name);
+                delete phy;
+                return;
+            }
+        }
+
+        devicetracker->register_phy_handler(phy);
+    };
+
+    register_phy("IEEE802.11", new kis_80211_phy());
+    register_phy("RFSENSOR", new kis_sensor_phy());
+    register_phy("Z-Wave", new Kis_Zwave_Phy());
+    register_phy("Bluetooth", new kis_bluetooth_phy());
+    register_phy("UAV", new Kis_UAV_Phy());
+    register_phy("NrfMousejack", new Kis_Mousejack_Phy());
+    register_phy("BTLE", new kis_btle_phy());
+    register_phy("METER", new kis_meter_phy());
+    register_phy("ADSB", new kis_adsb_phy());
+    register_phy("802.15.4", new kis_802154_phy());
+    register_phy("RADIATION", new kis_radiation_phy());
 
     if (globalregistry->fatal_condition) 
         SpindownKismet();
 
+    globalregistry->startup_mark("phy handlers");
+
+    // Pipeline benchmarking, usually from the benchmark override config
+    if (conf->fetch_opt_bool("benchmark", false))
+        kis_benchmark::create_benchmark();
+
     // Add the datasources
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_pcapfile_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_kismetdb_builder()));
+    datasourcetracker->register_datasource(shared_datasource_builder(new datasource_replay_builder()));
+    datasourcetracker->register_datasource(shared_datasource_builder(new datasource_synthetic_builder()));
+    datasourcetracker->register_datasource(shared_datasource_builder(new datasource_ndjson_builder()));
+    datasourcetracker->register_datasource(shared_datasource_builder(new datasource_beast_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_linux_wifi_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_linux_bluetooth_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_osx_corewlan_wifi_builder()));
@@ -919,9 +981,14 @@ int main(int argc, char *argv[], char *envp[]) {
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_bt_geiger_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_hak5_wifi_coconut_builder()));
 
+    globalregistry->startup_mark("datasource types");
+
     // Virtual sources get a special meta-builder
     datasource_virtual_builder::create_virtualbuilder();
 
+    // TZSP senders are virtual sources
+    tzsp_source::create_tzsp_source();
+
     // Create the database logger as a global because it's a special case
     kis_database_logfile::create_kisdatabaselog();
 
@@ -932,11 +999,18 @@ int main(int argc, char *argv[], char *envp[]) {
     logtracker->register_log(shared_log_builder(new kis_database_logfile_builder()));
     logtracker->register_log(shared_log_builder(new pcapng_logfile_builder()));
 	logtracker->register_log(shared_log_builder(new wiglecsv_logfile_builder()));
+    logtracker->register_log(shared_log_builder(new elk_logfile_builder()));
+
+    globalregistry->startup_mark("log types");
 
 	// Create the scan-only handlers
 	dot11_scan_source::create_dot11_scan_source();
     bluetooth_scan_source::create_bluetooth_scan_source();
 
+    // Targeted SSID capture, which needs the dot11 phy
+    if (devicetracker->fetch_phy_handler_by_name("IEEE802.11") != nullptr)
+        dot11_ssid_scan::create_ssidscan();
+
     std::shared_ptr<plugin_tracker> plugintracker;
 
 	// Start the announcement system
@@ -958,6 +1032,15 @@ int main(int argc, char *argv[], char *envp[]) {
     // Add system monitor 
     Systemmonitor::create_systemmonitor();
 
+    // OpenMetrics exporter for monitoring
+    kis_metrics::create_metrics();
+
+    // Devices and alerts federated from other Kismet servers
+    kis_federation::create_federation();
+
+    if (conf->fetch_opt_bool("sampling_profiler", false))
+        kis_profiler::create_profiler();
+
     // Start up any code that needs everything to be loaded
     globalregistry->start_deferred();
 
@@ -970,7 +1053,8 @@ int main(int argc, char *argv[], char *envp[]) {
     glob_silent = local_silent;
 
     // finalize any plugins which were waiting for other code to load
-    plugintracker->finalize_plugins();
+    if (plugintracker != nullptr)
+        plugintracker->finalize_plugins();
 
     // Load alerts from the config
     auto config_alerts = Globalreg::globalreg->kismet_config->fetch_opt_vec("load_alert");
@@ -1009,8 +1093,7 @@ int main(int argc, char *argv[], char *envp[]) {
         SpindownKismet();
     }
 
-    // Throttle info messages after startup
-    messagebus->set_info_throttle(25);
+    globalregistry->startup_mark("web server");
 
     // Start the main timer thread
     timetracker->spawn_timetracker_thread();
@@ -1018,15 +1101,36 @@ int main(int argc, char *argv[], char *envp[]) {
     // Start the packetchain
     packetchain->start_processing();
 
-    // Initiate the IO threads
-    std::vector<std::thread> iov;
-    iov.reserve(Globalreg::globalreg->n_io_threads);
-    for (auto i = Globalreg::globalreg->n_io_threads - 1; i > 0; i--) {
-        iov.emplace_back([i] () {
-                thread_set_process_name(fmt::format("IO {}", i));
-                Globalreg::globalreg->io.run();
-                });
-    }
+    globalregistry->startup_mark("packet processing");
+
+    // Initiate the IO thread pools
+    auto n_cpus = std::max(1U, std::thread::hardware_concurrency());
+
+    auto make_io_pool = [conf](const std::string& name, const std::string& opt, 
+            boost::asio::io_context& io, unsigned int dfl_min, unsigned int dfl_max) {
+        std::vector<unsigned int> cpus;
+
+        if (!parse_cpu_list(conf->fetch_opt(opt + "_cpus"), cpus)) {
+            _MSG_ERROR("Could not parse {}_cpus '{}', expected a list of CPUs such as "
+                    "0-3,8 or a NUMA node such as node0; {} threads will run on any CPU.",
+                    opt, conf->fetch_opt(opt + "_cpus"), name);
+            cpus.clear();
+        }
+
+        auto pool = 
+            std::make_shared<kis_io_pool>(name, io, 
+                    conf->fetch_opt_as<unsigned int>(opt + "s_min", dfl_min),
+                    conf->fetch_opt_as<unsigned int>(opt + "s_max", dfl_max), cpus);
+        pool->start();
+
+        return pool;
+    };
+
+    std::atomic_store(&Globalreg::globalreg->io_pool,
+            make_io_pool("IO", "io_thread", Globalreg::globalreg->io, n_cpus, n_cpus * 4));
+    std::atomic_store(&Globalreg::globalreg->http_io_pool,
+            make_io_pool("HTTP IO", "http_io_thread", Globalreg::globalreg->http_io, 2,
+                std::max(2U, n_cpus * 2)));
 
     // Activate plugins at the end
     if (plugintracker != nullptr) {
@@ -1038,8 +1142,14 @@ int main(int argc, char *argv[], char *envp[]) {
                     "are built against the same version of Kismet.");
             SpindownKismet();
         }
+
+        globalregistry->startup_mark("plugins");
     }
 
+    globalregistry->report_startup_profile(conf->fetch_opt_bool("startup_profile", false));
+
+    // Throttle info messages after startup
+    messagebus->set_info_throttle(25);
 
     while (true) {
         if (Globalreg::globalreg->spindown || Globalreg::globalreg->fatal_condition) 
@@ -1048,10 +1158,5 @@ int main(int argc, char *argv[], char *envp[]) {
         usleep(500000);
     }
 
-    for (auto& t : iov) {
-        if (t.joinable())
-            t.join();
-    }
-
 }
 
@@ -0,0 +1,172 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "fmt.h"
+#include "kismetdb_codec.h"
+
+// Frames shorter than this don't compress enough to pay for the codec
+#define KISMETDB_CODEC_MIN_LEN      48
+
+kismetdb_packet_compressor::kismetdb_packet_compressor(int level) {
+    memset(&zs, 0, sizeof(z_stream));
+
+    // Raw deflate, no zlib header or checksum per packet
+    active = deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+kismetdb_packet_compressor::~kismetdb_packet_compressor() {
+    if (active)
+        deflateEnd(&zs);
+}
+
+void kismetdb_packet_compressor::set_dictionary(const std::string& in_dictionary) {
+    dictionary = in_dictionary;
+}
+
+int kismetdb_packet_compressor::compress(std::string& packet) {
+    if (!active || packet.length() < KISMETDB_CODEC_MIN_LEN)
+        return KISMETDB_CODEC_RAW;
+
+    deflateReset(&zs);
+
+    if (dictionary.length() != 0)
+        deflateSetDictionary(&zs, (const Bytef *) dictionary.data(), dictionary.length());
+
+    // Only worth keeping if it is smaller than the original
+    buf.resize(packet.length());
+
+    zs.next_in = (Bytef *) packet.data();
+    zs.avail_in = packet.length();
+    zs.next_out = (Bytef *) &buf[0];
+    zs.avail_out = buf.length();
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+        return KISMETDB_CODEC_RAW;
+
+    buf.resize(buf.length() - zs.avail_out);
+    packet.swap(buf);
+
+    if (dictionary.length() != 0)
+        return KISMETDB_CODEC_DEFLATE_DICT;
+
+    return KISMETDB_CODEC_DEFLATE;
+}
+
+kismetdb_packet_decompressor::kismetdb_packet_decompressor() {
+    memset(&zs, 0, sizeof(z_stream));
+    active = inflateInit2(&zs, -15) == Z_OK;
+}
+
+kismetdb_packet_decompressor::~kismetdb_packet_decompressor() {
+    if (active)
+        inflateEnd(&zs);
+}
+
+void kismetdb_packet_decompressor::add_dictionary(uint32_t id, const std::string& dictionary) {
+    dictionaries[id] = dictionary;
+}
+
+std::string kismetdb_packet_decompressor::decompress(int codec, uint32_t dict_id, 
+        const std::string& data, size_t len) {
+    if (codec == KISMETDB_CODEC_RAW)
+        return data;
+
+    if (codec != KISMETDB_CODEC_DEFLATE && codec != KISMETDB_CODEC_DEFLATE_DICT)
+        throw std::runtime_error(fmt::format("unknown packet codec {}", codec));
+
+    if (!active)
+        throw std::runtime_error("unable to initialize packet decompression");
+
+    inflateReset(&zs);
+
+    if (codec == KISMETDB_CODEC_DEFLATE_DICT) {
+        auto di = dictionaries.find(dict_id);
+
+        if (di == dictionaries.end())
+            throw std::runtime_error(fmt::format("missing packet dictionary {}", dict_id));
+
+        inflateSetDictionary(&zs, (const Bytef *) di->second.data(), di->second.length());
+    }
+
+    std::string out;
+    out.resize(len);
+
+    zs.next_in = (Bytef *) data.data();
+    zs.avail_in = data.length();
+    zs.next_out = (Bytef *) &out[0];
+    zs.avail_out = out.length();
+
+    auto r = inflate(&zs, Z_FINISH);
+
+    if (r != Z_STREAM_END || zs.avail_out != 0)
+        throw std::runtime_error(fmt::format("corrupt compressed packet ({})", 
+                    zs.msg != nullptr ? zs.msg : "length mismatch"));
+
+    return out;
+}
+
+std::string kismetdb_train_dictionary(const std::vector<std::string>& samples, size_t max_len) {
+    std::unordered_map<std::string, unsigned int> counts;
+
+    for (const auto& s : samples)
+        counts[s]++;
+
+    std::vector<std::pair<const std::string *, unsigned int>> ordered;
+    ordered.reserve(counts.size());
+
+    for (const auto& c : counts)
+        ordered.push_back(std::make_pair(&c.first, c.second));
+
+    // Most common first, so they're the ones that survive the length limit
+    std::sort(ordered.begin(), ordered.end(), 
+            [](const std::pair<const std::string *, unsigned int>& a,
+                const std::pair<const std::string *, unsigned int>& b) {
+                if (a.second != b.second)
+                    return a.second > b.second;
+                return *a.first < *b.first;
+            });
+
+    std::vector<const std::string *> chosen;
+    size_t len = 0;
+
+    for (const auto& o : ordered) {
+        if (len + o.first->length() > max_len)
+            continue;
+
+        chosen.push_back(o.first);
+        len += o.first->length();
+    }
+
+    // Most common last, closest to the data being compressed
+    std::string dictionary;
+    dictionary.reserve(len);
+
+    for (auto ci = chosen.rbegin(); ci != chosen.rend(); ++ci)
+        dictionary.append(**ci);
+
+    return dictionary;
+}
+
@@ -0,0 +1,98 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_CODEC_H__
+#define __KISMETDB_CODEC_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Packet content compression for the kismetdb log.
+//
+// Each row of the packets table records the codec of its packet content:
+//
+//   0  raw
+//   1  raw deflate stream
+//   2  raw deflate stream using a preset dictionary from the packet_dictionaries table,
+//      selected by the codec_dict column
+//
+// Packets are compressed one at a time so that any packet can still be read on its
+// own.  Small frames barely compress on their own, but most of what fills a log is
+// the same few kinds of frame (beacons above all), so a dictionary made from the first
+// packets of the log gives deflate something to match against from the first byte.
+//
+// The codec code is shared with the log tools and does not depend on the rest of the
+// server.
+
+#define KISMETDB_CODEC_RAW              0
+#define KISMETDB_CODEC_DEFLATE          1
+#define KISMETDB_CODEC_DEFLATE_DICT     2
+
+class kismetdb_packet_compressor {
+public:
+    kismetdb_packet_compressor(int level);
+    ~kismetdb_packet_compressor();
+
+    // Use a preset dictionary for all following packets
+    void set_dictionary(const std::string& dictionary);
+
+    bool has_dictionary() const {
+        return dictionary.length() != 0;
+    }
+
+    // Compress the packet in place when that makes it smaller; returns the codec of
+    // the packet
+    int compress(std::string& packet);
+
+protected:
+    bool active;
+    z_stream zs;
+    std::string dictionary;
+    std::string buf;
+};
+
+class kismetdb_packet_decompressor {
+public:
+    kismetdb_packet_decompressor();
+    ~kismetdb_packet_decompressor();
+
+    void add_dictionary(uint32_t id, const std::string& dictionary);
+
+    // Decode packet content of the given codec and original length; throws 
+    // std::runtime_error
+    std::string decompress(int codec, uint32_t dict_id, const std::string& data, size_t len);
+
+protected:
+    bool active;
+    z_stream zs;
+    std::map<uint32_t, std::string> dictionaries;
+};
+
+// Build a dictionary of at most max_len bytes out of sample packets.  Identical samples
+// are counted, and the most common ones are placed at the end of the dictionary, where
+// deflate reaches them with the shortest distances
+std::string kismetdb_train_dictionary(const std::vector<std::string>& samples, size_t max_len);
+
+#endif
+
@@ -0,0 +1,389 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "fmt.h"
+#include "kismetdb_heatmap.h"
+
+// Web mercator stops short of the poles
+#define KISMETDB_HEATMAP_MAX_LAT    85.0511287798
+
+std::string kismetdb_heatmap_path(const std::string& db_path) {
+    return db_path + "-heatmap";
+}
+
+std::string kismetdb_heatmap_source(const std::string& db_path) {
+    auto slash = db_path.rfind('/');
+
+    if (slash == std::string::npos)
+        return db_path;
+
+    return db_path.substr(slash + 1);
+}
+
+kismetdb_heatmap::kismetdb_heatmap(const std::string& path, unsigned int min_zoom,
+        unsigned int max_zoom, bool per_device) :
+    path{path},
+    min_zoom{std::min(min_zoom, (unsigned int) KISMETDB_HEATMAP_MAX_ZOOM)},
+    max_zoom{std::min(max_zoom, (unsigned int) KISMETDB_HEATMAP_MAX_ZOOM)},
+    per_device{per_device},
+    db{nullptr},
+    upsert_stmt{nullptr},
+    tile_stmt{nullptr} {
+
+    if (this->min_zoom > this->max_zoom)
+        std::swap(this->min_zoom, this->max_zoom);
+}
+
+kismetdb_heatmap::~kismetdb_heatmap() {
+    close();
+}
+
+void kismetdb_heatmap::exec(const std::string& sql) {
+    char *errmsg = nullptr;
+
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        auto e = std::string(errmsg != nullptr ? errmsg : "unknown error");
+        sqlite3_free(errmsg);
+        throw std::runtime_error(fmt::format("heat map {}: {}", path, e));
+    }
+}
+
+void kismetdb_heatmap::open() {
+    std::lock_guard<std::mutex> lk(db_mutex);
+
+    if (db != nullptr)
+        return;
+
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                nullptr) != SQLITE_OK) {
+        auto e = std::string(db != nullptr ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        db = nullptr;
+        throw std::runtime_error(fmt::format("unable to open heat map {}: {}", path, e));
+    }
+
+    try {
+        exec("PRAGMA journal_mode=WAL");
+
+        exec("CREATE TABLE IF NOT EXISTS heatmap ("
+                "version INT, "
+                "tile_cells INT, "
+                "min_zoom INT, "
+                "max_zoom INT, "
+                "per_device INT)");
+
+        // Cells are only ever looked up by tile, so they are stored in tile order
+        exec("CREATE TABLE IF NOT EXISTS cells ("
+                "devmac TEXT, "
+                "zoom INT, "
+                "x INT, "
+                "y INT, "
+                "cell INT, "
+                "count INT, "
+                "signal_count INT, "
+                "signal_sum INT, "
+                "signal_max INT, "
+                "PRIMARY KEY (devmac, zoom, x, y, cell)) WITHOUT ROWID");
+
+        exec("CREATE TABLE IF NOT EXISTS progress ("
+                "source TEXT PRIMARY KEY, "
+                "position INT)");
+
+        sqlite3_stmt *stmt;
+
+        sqlite3_prepare_v2(db, "SELECT version, tile_cells, min_zoom, max_zoom, per_device "
+                "FROM heatmap", -1, &stmt, nullptr);
+
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            // An existing heat map keeps its layout
+            auto version = sqlite3_column_int(stmt, 0);
+            auto tile_cells = sqlite3_column_int(stmt, 1);
+
+            min_zoom = sqlite3_column_int(stmt, 2);
+            max_zoom = sqlite3_column_int(stmt, 3);
+            per_device = sqlite3_column_int(stmt, 4) != 0;
+
+            sqlite3_finalize(stmt);
+
+            if (version != KISMETDB_HEATMAP_VERSION || tile_cells != KISMETDB_HEATMAP_TILE_CELLS ||
+                    min_zoom > max_zoom || max_zoom > KISMETDB_HEATMAP_MAX_ZOOM)
+                throw std::runtime_error(fmt::format("heat map {} is an unsupported version "
+                            "or layout", path));
+        } else {
+            sqlite3_finalize(stmt);
+
+            exec(fmt::format("INSERT INTO heatmap (version, tile_cells, min_zoom, max_zoom, per_device) "
+                        "VALUES ({}, {}, {}, {}, {})", KISMETDB_HEATMAP_VERSION,
+                        KISMETDB_HEATMAP_TILE_CELLS, min_zoom, max_zoom, per_device ? 1 : 0));
+        }
+
+        if (sqlite3_prepare_v2(db,
+                    "INSERT INTO cells "
+                    "(devmac, zoom, x, y, cell, count, signal_count, signal_sum, signal_max) "
+                    "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?) "
+                    "ON CONFLICT (devmac, zoom, x, y, cell) DO UPDATE SET "
+                    "count = count + excluded.count, "
+                    "signal_count = signal_count + excluded.signal_count, "
+                    "signal_sum = signal_sum + excluded.signal_sum, "
+                    "signal_max = CASE "
+                    "WHEN signal_max IS NULL THEN excluded.signal_max "
+                    "WHEN excluded.signal_max IS NULL THEN signal_max "
+                    "ELSE max(signal_max, excluded.signal_max) END",
+                    -1, &upsert_stmt, nullptr) != SQLITE_OK ||
+                sqlite3_prepare_v2(db,
+                    "SELECT cell, count, signal_count, signal_sum, signal_max FROM cells "
+                    "WHERE devmac = ? AND zoom = ? AND x = ? AND y = ?",
+                    -1, &tile_stmt, nullptr) != SQLITE_OK)
+            throw std::runtime_error(fmt::format("unable to prepare heat map {}: {}", path,
+                        sqlite3_errmsg(db)));
+    } catch (const std::runtime_error&) {
+        sqlite3_finalize(upsert_stmt);
+        sqlite3_finalize(tile_stmt);
+        upsert_stmt = tile_stmt = nullptr;
+        sqlite3_close(db);
+        db = nullptr;
+        throw;
+    }
+}
+
+void kismetdb_heatmap::close() {
+    std::lock_guard<std::mutex> lk(db_mutex);
+
+    if (db == nullptr)
+        return;
+
+    sqlite3_finalize(upsert_stmt);
+    sqlite3_finalize(tile_stmt);
+    upsert_stmt = tile_stmt = nullptr;
+
+    sqlite3_close(db);
+    db = nullptr;
+}
+
+void kismetdb_heatmap::add(const std::string& devmac, double lat, double lon, int signal) {
+    if ((lat == 0 && lon == 0) || !std::isfinite(lat) || !std::isfinite(lon) ||
+            lat < -90 || lat > 90 || lon < -180 || lon > 180)
+        return;
+
+    lat = std::max(-KISMETDB_HEATMAP_MAX_LAT, std::min(KISMETDB_HEATMAP_MAX_LAT, lat));
+
+    // Position of the record in cells across the whole map at the deepest zoom; the
+    // shallower zooms are the same position shifted down
+    auto scale = (double) ((uint64_t) KISMETDB_HEATMAP_TILE_CELLS << max_zoom);
+    auto lat_r = lat * M_PI / 180;
+
+    auto fx = (lon + 180) / 360 * scale;
+    auto fy = (1 - log(tan(lat_r) + 1 / cos(lat_r)) / M_PI) / 2 * scale;
+
+    auto cx = (uint32_t) std::max(0.0, std::min(scale - 1, floor(fx)));
+    auto cy = (uint32_t) std::max(0.0, std::min(scale - 1, floor(fy)));
+
+    std::lock_guard<std::mutex> lk(mutex);
+
+    add_cells("", cx, cy, signal);
+
+    if (per_device && devmac.length() != 0)
+        add_cells(devmac, cx, cy, signal);
+}
+
+void kismetdb_heatmap::add_cells(const std::string& devmac, uint32_t cx, uint32_t cy, int signal) {
+    cell_key key{devmac, 0, 0, 0};
+
+    for (unsigned int z = min_zoom; z <= max_zoom; z++) {
+        key.zoom = z;
+        key.cx = cx >> (max_zoom - z);
+        key.cy = cy >> (max_zoom - z);
+
+        auto c = pending_cells.find(key);
+
+        if (c == pending_cells.end())
+            c = pending_cells.emplace(key, cell_agg{0, 0, 0, 0}).first;
+
+        c->second.count++;
+
+        if (signal != 0) {
+            if (c->second.signal_count == 0 || signal > c->second.signal_max)
+                c->second.signal_max = signal;
+
+            c->second.signal_count++;
+            c->second.signal_sum += signal;
+        }
+    }
+}
+
+void kismetdb_heatmap::set_progress(const std::string& source, int64_t position) {
+    std::lock_guard<std::mutex> lk(mutex);
+    pending_progress[source] = position;
+}
+
+int64_t kismetdb_heatmap::get_progress(const std::string& source) {
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        auto p = pending_progress.find(source);
+
+        if (p != pending_progress.end())
+            return p->second;
+    }
+
+    std::lock_guard<std::mutex> lk(db_mutex);
+
+    if (db == nullptr)
+        return 0;
+
+    sqlite3_stmt *stmt;
+    int64_t position = 0;
+
+    sqlite3_prepare_v2(db, "SELECT position FROM progress WHERE source = ?", -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, source.data(), source.length(), SQLITE_TRANSIENT);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        position = sqlite3_column_int64(stmt, 0);
+
+    sqlite3_finalize(stmt);
+
+    return position;
+}
+
+size_t kismetdb_heatmap::pending() {
+    std::lock_guard<std::mutex> lk(mutex);
+    return pending_cells.size();
+}
+
+void kismetdb_heatmap::flush() {
+    std::lock_guard<std::mutex> dlk(db_mutex);
+
+    if (db == nullptr)
+        throw std::runtime_error(fmt::format("heat map {} is not open", path));
+
+    decltype(pending_cells) cells;
+    decltype(pending_progress) progress;
+
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        cells.swap(pending_cells);
+        progress.swap(pending_progress);
+    }
+
+    if (cells.size() == 0 && progress.size() == 0)
+        return;
+
+    exec("BEGIN TRANSACTION");
+
+    try {
+        for (const auto& c : cells) {
+            int pos = 1;
+
+            sqlite3_reset(upsert_stmt);
+
+            sqlite3_bind_text(upsert_stmt, pos++, c.first.devmac.data(), c.first.devmac.length(),
+                    SQLITE_STATIC);
+            sqlite3_bind_int(upsert_stmt, pos++, c.first.zoom);
+            sqlite3_bind_int64(upsert_stmt, pos++, c.first.cx / KISMETDB_HEATMAP_TILE_CELLS);
+            sqlite3_bind_int64(upsert_stmt, pos++, c.first.cy / KISMETDB_HEATMAP_TILE_CELLS);
+            sqlite3_bind_int(upsert_stmt, pos++,
+                    (c.first.cy % KISMETDB_HEATMAP_TILE_CELLS) * KISMETDB_HEATMAP_TILE_CELLS +
+                    (c.first.cx % KISMETDB_HEATMAP_TILE_CELLS));
+            sqlite3_bind_int64(upsert_stmt, pos++, c.second.count);
+            sqlite3_bind_int64(upsert_stmt, pos++, c.second.signal_count);
+            sqlite3_bind_int64(upsert_stmt, pos++, c.second.signal_sum);
+
+            if (c.second.signal_count != 0)
+                sqlite3_bind_int(upsert_stmt, pos++, c.second.signal_max);
+            else
+                sqlite3_bind_null(upsert_stmt, pos++);
+
+            if (sqlite3_step(upsert_stmt) != SQLITE_DONE)
+                throw std::runtime_error(fmt::format("unable to write heat map {}: {}", path,
+                            sqlite3_errmsg(db)));
+        }
+
+        sqlite3_reset(upsert_stmt);
+
+        if (progress.size() != 0) {
+            sqlite3_stmt *stmt;
+
+            sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO progress (source, position) "
+                    "VALUES (?, ?)", -1, &stmt, nullptr);
+
+            for (const auto& p : progress) {
+                sqlite3_reset(stmt);
+                sqlite3_bind_text(stmt, 1, p.first.data(), p.first.length(), SQLITE_STATIC);
+                sqlite3_bind_int64(stmt, 2, p.second);
+
+                if (sqlite3_step(stmt) != SQLITE_DONE) {
+                    sqlite3_finalize(stmt);
+                    throw std::runtime_error(fmt::format("unable to write heat map {}: {}",
+                                path, sqlite3_errmsg(db)));
+                }
+            }
+
+            sqlite3_finalize(stmt);
+        }
+
+        exec("END TRANSACTION");
+    } catch (const std::runtime_error&) {
+        sqlite3_reset(upsert_stmt);
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+std::vector<kismetdb_heatmap_cell> kismetdb_heatmap::tile(const std::string& devmac,
+        unsigned int zoom, unsigned int x, unsigned int y) {
+    std::vector<kismetdb_heatmap_cell> ret;
+
+    if (zoom < min_zoom || zoom > max_zoom || x >= (1U << zoom) || y >= (1U << zoom))
+        return ret;
+
+    flush();
+
+    std::lock_guard<std::mutex> lk(db_mutex);
+
+    sqlite3_reset(tile_stmt);
+    sqlite3_bind_text(tile_stmt, 1, devmac.data(), devmac.length(), SQLITE_TRANSIENT);
+    sqlite3_bind_int(tile_stmt, 2, zoom);
+    sqlite3_bind_int64(tile_stmt, 3, x);
+    sqlite3_bind_int64(tile_stmt, 4, y);
+
+    int r;
+
+    while ((r = sqlite3_step(tile_stmt)) == SQLITE_ROW) {
+        ret.push_back(kismetdb_heatmap_cell{
+                (unsigned int) sqlite3_column_int(tile_stmt, 0),
+                (uint64_t) sqlite3_column_int64(tile_stmt, 1),
+                (uint64_t) sqlite3_column_int64(tile_stmt, 2),
+                sqlite3_column_int64(tile_stmt, 3),
+                sqlite3_column_int(tile_stmt, 4)});
+    }
+
+    sqlite3_reset(tile_stmt);
+
+    if (r != SQLITE_DONE)
+        throw std::runtime_error(fmt::format("unable to read heat map {}: {}", path,
+                    sqlite3_errmsg(db)));
+
+    return ret;
+}
+
@@ -0,0 +1,167 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_HEATMAP_H__
+#define __KISMETDB_HEATMAP_H__
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlite3.h>
+
+// Signal heat map tiles of a kismetdb log.
+//
+// Every located packet and data record is counted into a pyramid of map tiles, kept in a
+// sqlite file next to the log, named '[log]-heatmap'.  Tiles use the web mercator
+// z/x/y numbering of slippy maps, and each tile is a grid of
+// KISMETDB_HEATMAP_TILE_CELLS by KISMETDB_HEATMAP_TILE_CELLS cells.  A cell holds the
+// number of records seen in it, and the sum and the strongest of the signal levels of
+// the records which had one.
+//
+// Cells are kept for every zoom level between the minimum and maximum zoom of the heat
+// map, for all devices together (the empty device) and, optionally, for each device by
+// its MAC address.  Records are aggregated in memory and written by flush, so building
+// the tiles is incremental and serving a tile is a single indexed query.
+//
+// The server builds the heat map of the log it is writing as it goes; the
+// kismetdb_heatmap log tool builds it for existing logs, and records how far into each
+// log it has read, so it can be run again as a log grows.
+//
+// The heat map code is shared with the log tools and does not depend on the rest of
+// the server.
+
+#define KISMETDB_HEATMAP_VERSION        1
+
+// Cells along each side of a tile
+#define KISMETDB_HEATMAP_TILE_CELLS     64
+
+// Deepest zoom a heat map may have, so that cell numbers fit in 32 bits
+#define KISMETDB_HEATMAP_MAX_ZOOM       22
+
+// Progress of a log which the server counted as it was written; log tools skip it
+#define KISMETDB_HEATMAP_PROGRESS_LIVE  -1
+
+std::string kismetdb_heatmap_path(const std::string& db_path);
+
+// Name progress is recorded under for a log file, relative so the log can be moved
+std::string kismetdb_heatmap_source(const std::string& db_path);
+
+struct kismetdb_heatmap_cell {
+    // Position of the cell in the tile, row * KISMETDB_HEATMAP_TILE_CELLS + column
+    unsigned int cell;
+
+    uint64_t count;
+
+    // Records with a signal level, and the sum and the strongest of their signals
+    uint64_t signal_count;
+    int64_t signal_sum;
+    int signal_max;
+};
+
+class kismetdb_heatmap {
+public:
+    // The zoom range is only used when the heat map is created; an existing heat map
+    // keeps the range it was created with
+    kismetdb_heatmap(const std::string& path, unsigned int min_zoom, unsigned int max_zoom,
+            bool per_device);
+    ~kismetdb_heatmap();
+
+    // Open or create the heat map file; throws std::runtime_error
+    void open();
+    void close();
+
+    // Count a record at a location; a signal of 0 is no signal.  Records without a
+    // location are ignored
+    void add(const std::string& devmac, double lat, double lon, int signal);
+
+    // Record how far into a log or table has been counted, written along with the cells
+    // on the next flush
+    void set_progress(const std::string& source, int64_t position);
+    int64_t get_progress(const std::string& source);
+
+    // Write the aggregated cells and progress to the file; throws std::runtime_error
+    void flush();
+
+    // Cells of a tile with any records in them, after flushing; devmac is empty for all
+    // devices.  Throws std::runtime_error
+    std::vector<kismetdb_heatmap_cell> tile(const std::string& devmac, unsigned int zoom,
+            unsigned int x, unsigned int y);
+
+    // Number of cells waiting for the next flush
+    size_t pending();
+
+    unsigned int get_min_zoom() const { return min_zoom; }
+    unsigned int get_max_zoom() const { return max_zoom; }
+    const std::string& get_path() const { return path; }
+
+protected:
+    struct cell_key {
+        std::string devmac;
+        unsigned int zoom;
+
+        // Cell position across the whole map at this zoom
+        uint32_t cx, cy;
+
+        bool operator==(const cell_key& k) const {
+            return cx == k.cx && cy == k.cy && zoom == k.zoom && devmac == k.devmac;
+        }
+    };
+
+    struct cell_key_hash {
+        size_t operator()(const cell_key& k) const {
+            return std::hash<std::string>()(k.devmac) ^
+                ((((uint64_t) k.cx << 32) | k.cy) * 0x9E3779B97F4A7C15ULL) ^ k.zoom;
+        }
+    };
+
+    struct cell_agg {
+        uint64_t count;
+        uint64_t signal_count;
+        int64_t signal_sum;
+        int signal_max;
+    };
+
+    void add_cells(const std::string& devmac, uint32_t cx, uint32_t cy, int signal);
+
+    void exec(const std::string& sql);
+
+    std::string path;
+    unsigned int min_zoom;
+    unsigned int max_zoom;
+    bool per_device;
+
+    // Guards the pending cells and progress
+    std::mutex mutex;
+    std::unordered_map<cell_key, cell_agg, cell_key_hash> pending_cells;
+    std::unordered_map<std::string, int64_t> pending_progress;
+
+    // Guards the database
+    std::mutex db_mutex;
+    sqlite3 *db;
+    sqlite3_stmt *upsert_stmt;
+    sqlite3_stmt *tile_stmt;
+};
+
+#endif
+
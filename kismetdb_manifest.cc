@@ -0,0 +1,163 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <stdexcept>
+
+#include "fmt.h"
+#include "kismetdb_manifest.h"
+#include "nlohmann/json.hpp"
+
+#define KISMETDB_LOG_SUFFIX         ".kismet"
+#define KISMETDB_MANIFEST_SUFFIX    ".manifest"
+
+namespace {
+
+// Log path without the kismetdb suffix
+std::string log_stem(const std::string& db_path) {
+    auto suffix_len = strlen(KISMETDB_LOG_SUFFIX);
+
+    if (db_path.length() > suffix_len &&
+            db_path.compare(db_path.length() - suffix_len, suffix_len, KISMETDB_LOG_SUFFIX) == 0)
+        return db_path.substr(0, db_path.length() - suffix_len);
+
+    return db_path;
+}
+
+}
+
+std::string kismetdb_manifest_path(const std::string& db_path) {
+    return log_stem(db_path) + KISMETDB_MANIFEST_SUFFIX;
+}
+
+std::string kismetdb_rotation_path(const std::string& db_path, unsigned int n) {
+    if (n == 0)
+        return db_path;
+
+    return fmt::format("{}-{:04}{}", log_stem(db_path), n, KISMETDB_LOG_SUFFIX);
+}
+
+std::string kismetdb_manifest_file(const std::string& manifest_path,
+        const kismetdb_manifest_entry& entry) {
+    auto slash = manifest_path.rfind('/');
+
+    if (slash == std::string::npos)
+        return entry.file;
+
+    return manifest_path.substr(0, slash + 1) + entry.file;
+}
+
+bool kismetdb_is_manifest(const std::string& path) {
+    auto suffix_len = strlen(KISMETDB_MANIFEST_SUFFIX);
+
+    return path.length() > suffix_len &&
+        path.compare(path.length() - suffix_len, suffix_len, KISMETDB_MANIFEST_SUFFIX) == 0;
+}
+
+void kismetdb_write_manifest(const std::string& manifest_path,
+        const std::vector<kismetdb_manifest_entry>& entries) {
+    nlohmann::json files = nlohmann::json::array();
+
+    for (const auto& e : entries) {
+        // Entries are kept relative so that the log can be moved as a whole
+        auto slash = e.file.rfind('/');
+
+        files.push_back({
+                {"file", slash == std::string::npos ? e.file : e.file.substr(slash + 1)},
+                {"first_ts", e.first_ts},
+                {"last_ts", e.last_ts},
+                {"packets", e.packets},
+                {"active", e.active},
+                });
+    }
+
+    nlohmann::json manifest = {
+        {"kismetdb_manifest", KISMETDB_MANIFEST_VERSION},
+        {"files", files},
+    };
+
+    auto content = manifest.dump(4);
+
+    // Write a new copy and rename it over the old one, so a reader never sees a
+    // partial manifest
+    auto tmp_path = manifest_path + ".tmp";
+
+    auto f = fopen(tmp_path.c_str(), "w");
+
+    if (f == nullptr)
+        throw std::runtime_error(fmt::format("unable to write kismetdb manifest {}: {}",
+                    tmp_path, strerror(errno)));
+
+    if (fwrite(content.data(), content.length(), 1, f) != 1 || fflush(f) != 0 ||
+            fsync(fileno(f)) < 0) {
+        auto e = errno;
+        fclose(f);
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(fmt::format("unable to write kismetdb manifest {}: {}",
+                    tmp_path, strerror(e)));
+    }
+
+    fclose(f);
+
+    if (rename(tmp_path.c_str(), manifest_path.c_str()) < 0) {
+        auto e = errno;
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(fmt::format("unable to replace kismetdb manifest {}: {}",
+                    manifest_path, strerror(e)));
+    }
+}
+
+std::vector<kismetdb_manifest_entry> kismetdb_read_manifest(const std::string& manifest_path) {
+    std::ifstream f(manifest_path);
+
+    if (!f.is_open())
+        throw std::runtime_error(fmt::format("unable to open kismetdb manifest {}: {}",
+                    manifest_path, strerror(errno)));
+
+    std::vector<kismetdb_manifest_entry> entries;
+
+    try {
+        nlohmann::json manifest;
+        f >> manifest;
+
+        if (manifest.value("kismetdb_manifest", 0) != KISMETDB_MANIFEST_VERSION)
+            throw std::runtime_error("unsupported manifest version");
+
+        for (const auto& e : manifest["files"]) {
+            entries.push_back(kismetdb_manifest_entry{
+                    e["file"].get<std::string>(),
+                    e.value("first_ts", (uint64_t) 0),
+                    e.value("last_ts", (uint64_t) 0),
+                    e.value("packets", (uint64_t) 0),
+                    e.value("active", false)});
+        }
+    } catch (const std::exception& e) {
+        throw std::runtime_error(fmt::format("unable to parse kismetdb manifest {}: {}",
+                    manifest_path, e.what()));
+    }
+
+    return entries;
+}
+
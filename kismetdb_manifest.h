@@ -0,0 +1,78 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_MANIFEST_H__
+#define __KISMETDB_MANIFEST_H__
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Manifest of a rolling kismetdb log.
+//
+// A rolling log is continued in a new kismetdb file once the current file grows too
+// large, too old, or holds too many packets.  The first file keeps the name of the log
+// and the following files are numbered after it ('Kismet-xyz-0001.kismet', ...).  Each
+// file is a complete kismetdb log of its own, with the datasources and packet
+// dictionaries copied from the file before it.
+//
+// The manifest ('Kismet-xyz.manifest') is a JSON record of the files in the order they
+// were written, with the time range and number of the packets in each, so that readers
+// can query across the whole log and skip files outside of the time they want.  It is
+// replaced atomically whenever a file is started or finished.
+//
+// The manifest code is shared with the log tools and does not depend on the rest of
+// the server.
+
+#define KISMETDB_MANIFEST_VERSION       1
+
+struct kismetdb_manifest_entry {
+    // File name, relative to the directory of the manifest
+    std::string file;
+
+    // Time range of the packets in the file; 0 when there are no packets
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint64_t packets;
+
+    // The file is still being written
+    bool active;
+};
+
+std::string kismetdb_manifest_path(const std::string& db_path);
+
+// Path of the nth file of a rolling log; the first file is the log itself
+std::string kismetdb_rotation_path(const std::string& db_path, unsigned int n);
+
+// Path of a manifest entry
+std::string kismetdb_manifest_file(const std::string& manifest_path,
+        const kismetdb_manifest_entry& entry);
+
+// Is the file a manifest, instead of a kismetdb log
+bool kismetdb_is_manifest(const std::string& path);
+
+// Write or read a manifest; throws std::runtime_error
+void kismetdb_write_manifest(const std::string& manifest_path,
+        const std::vector<kismetdb_manifest_entry>& entries);
+std::vector<kismetdb_manifest_entry> kismetdb_read_manifest(const std::string& manifest_path);
+
+#endif
+
@@ -0,0 +1,142 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "kismetdb_readers.h"
+#include "messagebus.h"
+
+// Virtual machine steps between checks of the deadline and progress of a query
+#define KISMETDB_QUERY_WATCH_STEPS      10000
+
+kismetdb_reader_pool::kismetdb_reader_pool() :
+    state{std::make_shared<pool_state>()} {
+    state->max_idle = 0;
+    state->generation = 0;
+}
+
+kismetdb_reader_pool::~kismetdb_reader_pool() {
+    close();
+}
+
+void kismetdb_reader_pool::open(const std::string& in_path, size_t in_max_idle) {
+    std::vector<sqlite3 *> closing;
+
+    {
+        std::lock_guard<std::mutex> lk(state->mutex);
+
+        state->path = in_path;
+        state->max_idle = in_max_idle;
+        state->generation++;
+
+        closing.swap(state->idle);
+    }
+
+    for (auto c : closing)
+        sqlite3_close(c);
+}
+
+void kismetdb_reader_pool::close() {
+    open("", 0);
+}
+
+std::shared_ptr<sqlite3> kismetdb_reader_pool::acquire() {
+    sqlite3 *conn = nullptr;
+    std::string path;
+    unsigned int generation;
+
+    {
+        std::lock_guard<std::mutex> lk(state->mutex);
+
+        if (state->path.length() == 0)
+            return nullptr;
+
+        path = state->path;
+        generation = state->generation;
+
+        if (state->idle.size() > 0) {
+            conn = state->idle.back();
+            state->idle.pop_back();
+        }
+    }
+
+    if (conn == nullptr) {
+        if (sqlite3_open_v2(path.c_str(), &conn, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                    NULL) != SQLITE_OK) {
+            _MSG_ERROR("Unable to open a kismetdb reader for '{}': {}", path, sqlite3_errmsg(conn));
+            sqlite3_close(conn);
+            return nullptr;
+        }
+
+        // Readers only wait on the writer while a checkpoint resets the WAL
+        sqlite3_busy_timeout(conn, 5000);
+    }
+
+    auto pool = state;
+
+    return std::shared_ptr<sqlite3>(conn, [pool, generation](sqlite3 *c) {
+            {
+                std::lock_guard<std::mutex> lk(pool->mutex);
+
+                if (pool->generation == generation && pool->idle.size() < pool->max_idle) {
+                    pool->idle.push_back(c);
+                    return;
+                }
+            }
+
+            sqlite3_close(c);
+        });
+}
+
+kismetdb_query_watch::kismetdb_query_watch(sqlite3 *db, unsigned int in_timeout_ms,
+        progress_cb in_progress) :
+    db{db},
+    has_deadline{in_timeout_ms != 0},
+    progress{in_progress},
+    expired{false},
+    stopped{false} {
+
+    if (has_deadline)
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(in_timeout_ms);
+
+    if (db != nullptr && (has_deadline || progress != nullptr))
+        sqlite3_progress_handler(db, KISMETDB_QUERY_WATCH_STEPS,
+                &kismetdb_query_watch::progress_handler, this);
+}
+
+kismetdb_query_watch::~kismetdb_query_watch() {
+    if (db != nullptr)
+        sqlite3_progress_handler(db, 0, nullptr, nullptr);
+}
+
+int kismetdb_query_watch::progress_handler(void *aux) {
+    auto watch = static_cast<kismetdb_query_watch *>(aux);
+
+    if (watch->has_deadline && std::chrono::steady_clock::now() >= watch->deadline) {
+        watch->expired = true;
+        return 1;
+    }
+
+    if (watch->progress != nullptr && !watch->progress()) {
+        watch->stopped = true;
+        return 1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,119 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_READERS_H__
+#define __KISMETDB_READERS_H__
+
+#include "config.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+// Read-only connections to the live kismetdb log, for queries from the REST API.
+//
+// The writer keeps the log connection inside a transaction and commits on its own
+// schedule; a query run on the same connection holds the connection for as long as it
+// runs, so a long pcap download stalls the packet writer.  Queries which only read the
+// log use a connection of their own instead.  With a WAL journal readers and the writer
+// don't block each other; a reader sees the log as of the last commit.
+//
+// Released connections are kept for the next query, up to the size of the pool; when
+// every kept connection is in use another one is opened, and closed once it's done.
+
+class kismetdb_reader_pool {
+public:
+    kismetdb_reader_pool();
+    ~kismetdb_reader_pool();
+
+    // Read from a log file, keeping up to max_idle connections open between queries.
+    // Connections to a previous file are closed as they are released
+    void open(const std::string& in_path, size_t in_max_idle);
+    void close();
+
+    // Read-only connection to the log, which goes back to the pool when it's released;
+    // nullptr if the pool is closed or the log can't be opened
+    std::shared_ptr<sqlite3> acquire();
+
+protected:
+    struct pool_state {
+        std::mutex mutex;
+
+        std::string path;
+        size_t max_idle;
+
+        // Changes with every open or close, so connections to the previous file
+        // aren't kept
+        unsigned int generation;
+
+        std::vector<sqlite3 *> idle;
+    };
+
+    std::shared_ptr<pool_state> state;
+};
+
+// Limits of a query on a read-only connection: a deadline, and a callback polled while
+// the query runs which can cancel it, for instance once the client has gone away.
+//
+// An interrupted query fails with SQLITE_INTERRUPT, which ends the result iterators of
+// sqlite3_cpp11 the same way as running out of rows; check interrupted() after reading
+// the results.
+class kismetdb_query_watch {
+public:
+    // Returns false to cancel the query
+    using progress_cb = std::function<bool ()>;
+
+    // A timeout of 0 has no deadline; with a null database nothing is watched
+    kismetdb_query_watch(sqlite3 *db, unsigned int in_timeout_ms, progress_cb in_progress);
+    ~kismetdb_query_watch();
+
+    kismetdb_query_watch(const kismetdb_query_watch&) = delete;
+    kismetdb_query_watch& operator=(const kismetdb_query_watch&) = delete;
+
+    bool timed_out() const {
+        return expired;
+    }
+
+    bool cancelled() const {
+        return stopped;
+    }
+
+    bool interrupted() const {
+        return expired || stopped;
+    }
+
+protected:
+    static int progress_handler(void *aux);
+
+    sqlite3 *db;
+
+    bool has_deadline;
+    std::chrono::steady_clock::time_point deadline;
+    progress_cb progress;
+
+    bool expired;
+    bool stopped;
+};
+
+#endif
+
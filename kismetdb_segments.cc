@@ -0,0 +1,271 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "fmt.h"
+#include "kismetdb_segments.h"
+
+// Segments are named by number so that they sort in write order
+#define KISMETDB_SEGMENT_SUFFIX     ".kseg"
+
+// Number of segments a reader keeps mapped
+#define KISMETDB_SEGMENT_MAPPINGS   8
+
+std::string kismetdb_segment_dir(const std::string& db_path) {
+    return db_path + "-segments";
+}
+
+std::string kismetdb_segment_path(const std::string& segment_dir, uint32_t segment) {
+    return fmt::format("{}/{:08}{}", segment_dir, segment, KISMETDB_SEGMENT_SUFFIX);
+}
+
+kismetdb_segment_writer::kismetdb_segment_writer(const std::string& db_path, uint64_t max_size) :
+    segment_dir{kismetdb_segment_dir(db_path)},
+    max_size{max_size},
+    fd{-1},
+    cur_segment{0},
+    cur_size{0},
+    first_segment{0} { }
+
+kismetdb_segment_writer::~kismetdb_segment_writer() {
+    close();
+}
+
+void kismetdb_segment_writer::open() {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (mkdir(segment_dir.c_str(), 0755) < 0 && errno != EEXIST)
+        throw std::runtime_error(fmt::format("unable to create packet segment directory {}: {}",
+                    segment_dir, strerror(errno)));
+
+    // Continue after any segments left by a previous run of the same log
+    uint32_t next_segment = 0;
+    bool found = false;
+
+    auto dir = opendir(segment_dir.c_str());
+
+    if (dir == nullptr)
+        throw std::runtime_error(fmt::format("unable to open packet segment directory {}: {}",
+                    segment_dir, strerror(errno)));
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != nullptr) {
+        unsigned int n;
+        char suffix[8];
+
+        if (sscanf(de->d_name, "%u%7s", &n, suffix) != 2 || 
+                strcmp(suffix, KISMETDB_SEGMENT_SUFFIX) != 0)
+            continue;
+
+        if (!found || n < first_segment)
+            first_segment = n;
+
+        if (n + 1 > next_segment)
+            next_segment = n + 1;
+
+        found = true;
+    }
+
+    closedir(dir);
+
+    if (!found)
+        first_segment = 0;
+
+    open_segment(next_segment);
+}
+
+void kismetdb_segment_writer::close() {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void kismetdb_segment_writer::open_segment(uint32_t segment) {
+    if (fd >= 0)
+        ::close(fd);
+
+    auto path = kismetdb_segment_path(segment_dir, segment);
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+    if (fd < 0)
+        throw std::runtime_error(fmt::format("unable to create packet segment {}: {}",
+                    path, strerror(errno)));
+
+    char header[KISMETDB_SEGMENT_HEADER_LEN] = {'K', 'S', 'E', 'G', 
+        KISMETDB_SEGMENT_VERSION & 0xFF, 0, 0, 0};
+
+    if (write(fd, header, sizeof(header)) != sizeof(header))
+        throw std::runtime_error(fmt::format("unable to write packet segment {}: {}",
+                    path, strerror(errno)));
+
+    cur_segment = segment;
+    cur_size = sizeof(header);
+}
+
+void kismetdb_segment_writer::append(const std::string& block, uint32_t& segment, uint64_t& offset) {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (fd < 0)
+        throw std::runtime_error("packet segments not open");
+
+    if (cur_size > KISMETDB_SEGMENT_HEADER_LEN && cur_size + block.length() > max_size)
+        open_segment(cur_segment + 1);
+
+    size_t pos = 0;
+
+    while (pos < block.length()) {
+        auto r = write(fd, block.data() + pos, block.length() - pos);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // Drop a partial block so the offsets of the next block stay valid
+            auto err = errno;
+            if (pos != 0 && ftruncate(fd, cur_size) < 0)
+                err = errno;
+
+            throw std::runtime_error(fmt::format("unable to write packet segment {}: {}",
+                        kismetdb_segment_path(segment_dir, cur_segment), strerror(err)));
+        }
+
+        pos += r;
+    }
+
+    segment = cur_segment;
+    offset = cur_size;
+
+    cur_size += block.length();
+}
+
+void kismetdb_segment_writer::sync() {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (fd < 0)
+        return;
+
+#ifdef SYS_LINUX
+    fdatasync(fd);
+#else
+    fsync(fd);
+#endif
+}
+
+void kismetdb_segment_writer::remove_before(uint32_t segment) {
+    std::lock_guard<std::mutex> lk(mutex);
+
+    if (segment > cur_segment)
+        segment = cur_segment;
+
+    while (first_segment < segment) {
+        unlink(kismetdb_segment_path(segment_dir, first_segment).c_str());
+        first_segment++;
+    }
+}
+
+kismetdb_segment_reader::kismetdb_segment_reader(const std::string& db_path) :
+    segment_dir{kismetdb_segment_dir(db_path)} { }
+
+kismetdb_segment_reader::~kismetdb_segment_reader() {
+    for (auto& m : mappings)
+        unmap(m.second);
+}
+
+void kismetdb_segment_reader::unmap(mapping& m) {
+    if (m.base != nullptr)
+        munmap(m.base, m.len);
+    if (m.fd >= 0)
+        ::close(m.fd);
+
+    m.base = nullptr;
+    m.fd = -1;
+}
+
+const kismetdb_segment_reader::mapping& kismetdb_segment_reader::map_segment(uint32_t segment, 
+        uint64_t min_len) {
+    auto mi = mappings.find(segment);
+
+    if (mi != mappings.end() && mi->second.len >= min_len)
+        return mi->second;
+
+    if (mi != mappings.end()) {
+        // The segment is still being written and has grown since it was mapped
+        unmap(mi->second);
+        mappings.erase(mi);
+    } else if (mappings.size() >= KISMETDB_SEGMENT_MAPPINGS) {
+        // Ranges are usually read in order, so the oldest segment is the least useful
+        unmap(mappings.begin()->second);
+        mappings.erase(mappings.begin());
+    }
+
+    auto path = kismetdb_segment_path(segment_dir, segment);
+
+    mapping m;
+    m.fd = ::open(path.c_str(), O_RDONLY);
+    m.base = nullptr;
+    m.len = 0;
+
+    if (m.fd < 0)
+        throw std::runtime_error(fmt::format("unable to open packet segment {}: {}",
+                    path, strerror(errno)));
+
+    struct stat st;
+    if (fstat(m.fd, &st) < 0 || (uint64_t) st.st_size < min_len) {
+        ::close(m.fd);
+        throw std::runtime_error(fmt::format("packet segment {} is shorter than the "
+                    "requested range", path));
+    }
+
+    m.len = st.st_size;
+    m.base = mmap(nullptr, m.len, PROT_READ, MAP_SHARED, m.fd, 0);
+
+    if (m.base == MAP_FAILED) {
+        m.base = nullptr;
+        ::close(m.fd);
+        throw std::runtime_error(fmt::format("unable to map packet segment {}: {}",
+                    path, strerror(errno)));
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(m.base, m.len, MADV_SEQUENTIAL);
+#endif
+
+    return mappings.emplace(segment, m).first->second;
+}
+
+std::string kismetdb_segment_reader::read(uint32_t segment, uint64_t offset, uint64_t len) {
+    auto& m = map_segment(segment, offset + len);
+    return std::string(static_cast<const char *>(m.base) + offset, len);
+}
+
@@ -0,0 +1,112 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_SEGMENTS_H__
+#define __KISMETDB_SEGMENTS_H__
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+// Append-only packet segment files for the kismetdb log.
+//
+// When enabled, the packet bytes are kept out of the sqlite packets table and
+// appended to numbered segment files in a directory next to the log, named
+// '[log]-segments'.  The packets table keeps the metadata of each packet, plus the
+// segment number and the offset of the packet bytes in the segment.
+//
+// A segment is the header (the magic 'KSEG' and a 32 bit little-endian version)
+// followed by the raw bytes of the packets, in the order they were logged.  Segments
+// are only ever appended to, so extracting a range of time is a sequential read, and
+// readers map them into memory instead of copying the bytes through sqlite.
+//
+// The segment code is shared with the log tools and does not depend on the rest of
+// the server.
+
+#define KISMETDB_SEGMENT_VERSION        1
+#define KISMETDB_SEGMENT_HEADER_LEN     8
+
+std::string kismetdb_segment_dir(const std::string& db_path);
+std::string kismetdb_segment_path(const std::string& segment_dir, uint32_t segment);
+
+class kismetdb_segment_writer {
+public:
+    // Segments are rolled over once they reach max_size
+    kismetdb_segment_writer(const std::string& db_path, uint64_t max_size);
+    ~kismetdb_segment_writer();
+
+    // Create the segment directory and the first segment; throws std::runtime_error
+    void open();
+    void close();
+
+    // Append a block of packet data with a single write; a block is never split across
+    // segments.  Returns the segment and offset of the start of the block, or throws
+    // std::runtime_error
+    void append(const std::string& block, uint32_t& segment, uint64_t& offset);
+
+    // Flush appended data to disk, before the rows which reference it are committed
+    void sync();
+
+    // Remove the segments before the given segment; the current segment is never removed
+    void remove_before(uint32_t segment);
+
+    const std::string& get_dir() const { return segment_dir; }
+
+protected:
+    void open_segment(uint32_t segment);
+
+    std::mutex mutex;
+
+    std::string segment_dir;
+    uint64_t max_size;
+
+    int fd;
+    uint32_t cur_segment;
+    uint64_t cur_size;
+    uint32_t first_segment;
+};
+
+class kismetdb_segment_reader {
+public:
+    kismetdb_segment_reader(const std::string& db_path);
+    ~kismetdb_segment_reader();
+
+    // Copy a range of a segment out of the mapped segment file, mapping it (or mapping
+    // it again if it has grown) as needed; throws std::runtime_error
+    std::string read(uint32_t segment, uint64_t offset, uint64_t len);
+
+protected:
+    struct mapping {
+        int fd;
+        void *base;
+        size_t len;
+    };
+
+    const mapping& map_segment(uint32_t segment, uint64_t min_len);
+    void unmap(mapping& m);
+
+    std::string segment_dir;
+    std::map<uint32_t, mapping> mappings;
+};
+
+#endif
+
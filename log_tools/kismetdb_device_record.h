@@ -0,0 +1,37 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_DEVICE_RECORD_H__
+#define __KISMETDB_DEVICE_RECORD_H__
+
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+// Device records in the kismetdb devices table are JSON, or MessagePack when the log
+// was written with kis_log_device_format=msgpack.  A JSON record is always an object, 
+// so anything which doesn't start with '{' is MessagePack.  Throws on invalid records.
+inline nlohmann::json kismetdb_parse_device_record(const std::string& record) {
+    if (record.length() > 0 && record[0] != '{')
+        return nlohmann::json::from_msgpack(record);
+
+    return nlohmann::json::parse(record);
+}
+
+#endif
+
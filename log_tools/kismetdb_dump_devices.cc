@@ -35,6 +35,7 @@
 #include <sqlite3.h>
 
 #include "getopt.h"
+#include "kismetdb_device_record.h"
 
 #include "fmt.h"
 #include "nlohmann/json.hpp"
@@ -269,14 +270,12 @@ int main(int argc, char *argv[]) {
 
         }
 
-        auto json = sqlite3_column_as<std::string>(d, 0);
+        auto record = sqlite3_column_as<std::string>(d, 0);
 
         try {
-            std::stringstream ss(json);
+            std::stringstream ss;
 
-            nlohmann::json parsed_json;
-
-            ss >> parsed_json;
+            auto parsed_json = kismetdb_parse_device_record(record);
 
             if (reformat)
                 transform_json(parsed_json);
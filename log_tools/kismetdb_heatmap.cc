@@ -0,0 +1,335 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Build the signal heat map tiles of a kismetdb log
+ */
+
+#include "config.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "getopt.h"
+#include "fmt.h"
+#include "kismetdb_heatmap.h"
+#include "kismetdb_manifest.h"
+#include "sqlite3_cpp11.h"
+
+// Records between each write of the heat map
+#define HEATMAP_BATCH       100000
+
+void print_help(char *argv) {
+    printf("Kismetdb heat map\n");
+    printf("Build the signal heat map tiles of a KismetDB log, which the Kismet web UI and\n"
+           "other map tools can load without processing the whole log.\n");
+    printf("usage: %s [OPTION]\n", argv);
+    printf(" -i, --in [filename]          Input kismetdb file, or the manifest of a rolling\n"
+           "                              kismetdb log to read all of its files\n"
+           " -o, --out [filename]         Output heat map file; by default the heat map is\n"
+           "                              kept next to the log as [log]-heatmap\n"
+           " -v, --verbose                Verbose output\n"
+           "     --rebuild                Remove any existing heat map and count the whole log\n"
+           "     --min-zoom [zoom]        Shallowest zoom level to build tiles for (default 4)\n"
+           "     --max-zoom [zoom]        Deepest zoom level to build tiles for (default 17)\n"
+           "     --no-devices             Only build tiles of all devices, not of each device\n"
+           "\n"
+           "The heat map records how far into each log file it has counted, so running the\n"
+           "tool again on a log which has grown only counts the new records.  Log files which\n"
+           "Kismet built the heat map for while logging are skipped.\n"
+           "\n"
+           "Cleaning (vacuuming) a log may renumber its records; use --rebuild afterwards.\n"
+           "\n"
+           "The zoom levels and --no-devices only apply when the heat map is created.\n"
+          );
+}
+
+// Count the located records of a table in a log file after the last record counted
+// before; returns the number of records counted
+unsigned long count_table(sqlite3 *db, int db_version, kismetdb_heatmap& heatmap,
+        const std::string& source, const std::string& table, bool verbose) {
+    using namespace kissqlite3;
+
+    auto progress_key = fmt::format("{}:{}", source, table);
+    auto last_rowid = heatmap.get_progress(progress_key);
+
+    std::list<std::string> fields;
+
+    if (table == "packets")
+        fields = {"rowid", "sourcemac", "lat", "lon", "signal"};
+    else
+        fields = {"rowid", "devmac", "lat", "lon"};
+
+    auto query = _SELECT(db, table, fields,
+            _WHERE("rowid", GT, last_rowid, AND, "lat", NEQ, 0, AND, "lon", NEQ, 0),
+            ORDERBY, "rowid");
+
+    unsigned long n = 0;
+
+    for (auto r : query) {
+        auto rowid = sqlite3_column_as<int64_t>(r, 0);
+        auto devmac = sqlite3_column_as<std::string>(r, 1);
+        auto lat = sqlite3_column_as<double>(r, 2);
+        auto lon = sqlite3_column_as<double>(r, 3);
+        int signal = 0;
+
+        if (table == "packets")
+            signal = sqlite3_column_as<int>(r, 4);
+
+        // Old logs stored locations as fixed point
+        if (db_version < 5) {
+            lat = lat / 100000;
+            lon = lon / 100000;
+        }
+
+        if (devmac == "00:00:00:00:00:00")
+            devmac = "";
+
+        heatmap.add(devmac, lat, lon, signal);
+
+        n++;
+
+        if ((n % HEATMAP_BATCH) == 0) {
+            heatmap.set_progress(progress_key, rowid);
+            heatmap.flush();
+
+            if (verbose)
+                fmt::print(stderr, "* Counted {} {} records from '{}'\n", n, table, source);
+        }
+
+        last_rowid = rowid;
+    }
+
+    heatmap.set_progress(progress_key, last_rowid);
+    heatmap.flush();
+
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+#define OPT_REBUILD             1
+#define OPT_MIN_ZOOM            2
+#define OPT_MAX_ZOOM            3
+#define OPT_NO_DEVICES          4
+    static struct option longopt[] = {
+        { "in", required_argument, 0, 'i' },
+        { "out", required_argument, 0, 'o' },
+        { "verbose", no_argument, 0, 'v' },
+        { "help", no_argument, 0, 'h' },
+        { "rebuild", no_argument, 0, OPT_REBUILD },
+        { "min-zoom", required_argument, 0, OPT_MIN_ZOOM },
+        { "max-zoom", required_argument, 0, OPT_MAX_ZOOM },
+        { "no-devices", no_argument, 0, OPT_NO_DEVICES },
+        { 0, 0, 0, 0 }
+    };
+
+    int option_idx = 0;
+    optind = 0;
+    opterr = 0;
+
+    std::string in_fname, out_fname;
+    bool verbose = false;
+    bool rebuild = false;
+    bool per_device = true;
+    unsigned int min_zoom = 4;
+    unsigned int max_zoom = 17;
+
+    while (1) {
+        int r = getopt_long(argc, argv,
+                            "-hi:o:v",
+                            longopt, &option_idx);
+        if (r < 0) break;
+
+        if (r == 'h') {
+            print_help(argv[0]);
+            exit(1);
+        } else if (r == 'i') {
+            in_fname = std::string(optarg);
+        } else if (r == 'o') {
+            out_fname = std::string(optarg);
+        } else if (r == 'v') {
+            verbose = true;
+        } else if (r == OPT_REBUILD) {
+            rebuild = true;
+        } else if (r == OPT_MIN_ZOOM || r == OPT_MAX_ZOOM) {
+            unsigned int z;
+
+            if (sscanf(optarg, "%u", &z) != 1 || z > KISMETDB_HEATMAP_MAX_ZOOM) {
+                fmt::print(stderr, "ERROR:  Expected a zoom level between 0 and {}\n",
+                        KISMETDB_HEATMAP_MAX_ZOOM);
+                exit(1);
+            }
+
+            if (r == OPT_MIN_ZOOM)
+                min_zoom = z;
+            else
+                max_zoom = z;
+        } else if (r == OPT_NO_DEVICES) {
+            per_device = false;
+        }
+    }
+
+    if (in_fname == "") {
+        fmt::print(stderr, "ERROR: Expected --in [kismetdb file]\n");
+        exit(1);
+    }
+
+    if (min_zoom > max_zoom) {
+        fmt::print(stderr, "ERROR:  --min-zoom must not be deeper than --max-zoom\n");
+        exit(1);
+    }
+
+    // A rolling log is read file by file, in the order it was written
+    std::vector<std::string> in_files;
+
+    if (kismetdb_is_manifest(in_fname)) {
+        try {
+            for (const auto& e : kismetdb_read_manifest(in_fname))
+                in_files.push_back(kismetdb_manifest_file(in_fname, e));
+        } catch (const std::runtime_error& e) {
+            fmt::print(stderr, "ERROR:  {}\n", e.what());
+            exit(1);
+        }
+
+        if (in_files.size() == 0) {
+            fmt::print(stderr, "ERROR:  No kismetdb files in manifest '{}'\n", in_fname);
+            exit(1);
+        }
+
+        if (verbose)
+            fmt::print(stderr, "* Found {} kismetdb files in manifest '{}'\n", in_files.size(), in_fname);
+    } else {
+        in_files.push_back(in_fname);
+    }
+
+    // The heat map of a rolling log is named after its first file, as Kismet names it
+    if (out_fname == "")
+        out_fname = kismetdb_heatmap_path(in_files[0]);
+
+    if (rebuild) {
+        for (const auto& suffix : {"", "-wal", "-shm"}) {
+            auto f = out_fname + suffix;
+
+            if (unlink(f.c_str()) < 0 && errno != ENOENT) {
+                fmt::print(stderr, "ERROR:  Unable to remove existing heat map '{}': {}\n",
+                        f, strerror(errno));
+                exit(1);
+            }
+        }
+    }
+
+    kismetdb_heatmap heatmap(out_fname, min_zoom, max_zoom, per_device);
+
+    try {
+        heatmap.open();
+    } catch (const std::runtime_error& e) {
+        fmt::print(stderr, "ERROR:  {}\n", e.what());
+        exit(1);
+    }
+
+    if (verbose)
+        fmt::print(stderr, "* Building heat map '{}' for zoom levels {} to {}\n",
+                out_fname, heatmap.get_min_zoom(), heatmap.get_max_zoom());
+
+    using namespace kissqlite3;
+
+    unsigned long n_total = 0;
+
+    for (const auto& in_file : in_files) {
+        auto source = kismetdb_heatmap_source(in_file);
+
+        if (heatmap.get_progress(source) == KISMETDB_HEATMAP_PROGRESS_LIVE) {
+            if (verbose)
+                fmt::print(stderr, "* Skipping '{}', Kismet built its heat map while logging\n",
+                        in_file);
+            continue;
+        }
+
+        struct stat statbuf;
+
+        if (stat(in_file.c_str(), &statbuf) < 0) {
+            fmt::print(stderr, "ERROR:  Unable to open input file '{}': {}\n", in_file,
+                    strerror(errno));
+            exit(1);
+        }
+
+        // The log is never cleaned here; a vacuum could renumber the records the heat map
+        // has already counted
+        sqlite3 *db = nullptr;
+
+        if (sqlite3_open_v2(in_file.c_str(), &db, SQLITE_OPEN_READONLY, nullptr)) {
+            fmt::print(stderr, "ERROR:  Unable to open '{}': {}\n", in_file, sqlite3_errmsg(db));
+            exit(1);
+        }
+
+        try {
+            auto version_query = _SELECT(db, "KISMET", {"db_version"});
+            auto version_ret = version_query.begin();
+            if (version_ret == version_query.end()) {
+                fmt::print(stderr, "ERROR:  Unable to fetch database version from '{}'.\n", in_file);
+                sqlite3_close(db);
+                exit(1);
+            }
+            auto db_version = sqlite3_column_as<int>(*version_ret, 0);
+
+            if (verbose)
+                fmt::print(stderr, "* Counting '{}', KismetDB version {}\n", in_file, db_version);
+
+            auto n_packets = count_table(db, db_version, heatmap, source, "packets", verbose);
+
+            // Only newer logs have the data table
+            unsigned long n_data = 0;
+
+            auto data_q = _SELECT(db, "sqlite_master", {"name"},
+                    _WHERE("type", EQ, "table", AND, "name", EQ, "data"));
+
+            if (data_q.begin() != data_q.end())
+                n_data = count_table(db, db_version, heatmap, source, "data", verbose);
+
+            if (verbose)
+                fmt::print(stderr, "* Counted {} new packets and {} new data records from '{}'\n",
+                        n_packets, n_data, in_file);
+
+            n_total += n_packets + n_data;
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "ERROR:  Unable to build heat map from '{}': {}\n", in_file, e.what());
+            sqlite3_close(db);
+            exit(1);
+        }
+
+        sqlite3_close(db);
+    }
+
+    heatmap.close();
+
+    fmt::print(stderr, "* Counted {} new records into heat map '{}'\n", n_total, out_fname);
+
+    return 0;
+}
+
@@ -0,0 +1,788 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Merge kismetdb logs, such as the logs of several sensors, into a single log
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "crc32.h"
+#include "fmt.h"
+#include "getopt.h"
+#include "kismetdb_codec.h"
+#include "kismetdb_manifest.h"
+#include "kismetdb_segments.h"
+#include "version.h"
+
+// Log version the merged log is written as; the schema below matches
+// KISMETDB_LOG_VERSION of the server
+#define MERGE_DB_VERSION        10
+
+// Oldest log version which can be merged; older logs stored locations as fixed point
+#define MERGE_MIN_DB_VERSION    5
+
+// Rows written between each commit of the merged log
+#define MERGE_COMMIT_ROWS       50000
+
+// Packets remembered for finding duplicates, the default of the server
+#define MERGE_DEDUPE_SIZE       2048
+
+void print_help(char *argv) {
+    printf("Kismetdb merge\n");
+    printf("Merge several KismetDB logs, such as the logs of a group of sensors, into a\n"
+           "single KismetDB log.\n");
+    printf("usage: %s [OPTION] [kismetdb file] ...\n", argv);
+    printf(" -i, --in [filename]          Input kismetdb file, or the manifest of a rolling\n"
+           "                              kismetdb log to read all of its files; may be given\n"
+           "                              more than once, or inputs may be listed after the\n"
+           "                              options\n"
+           " -o, --out [filename]         Output kismetdb file\n"
+           " -f, --force                  Overwrite an existing output file\n"
+           " -s, --strip-packets          Drop the packet content, keeping the packet records\n"
+           "     --no-dedupe              Keep packets which more than one sensor saw\n"
+           "     --dedupe-size [count]    Number of recent packets duplicates are looked for\n"
+           "                              among (default 2048)\n"
+           "     --dedupe-window [secs]   Only treat packets as duplicates when they are seen\n"
+           "                              within this many seconds of each other; by default\n"
+           "                              only the number of recent packets limits it\n"
+           " -v, --verbose                Verbose output\n"
+           "\n"
+           "Packets, data, GPS snapshots, alerts and messages of all the inputs are merged in\n"
+           "time order.  A packet seen by more than one sensor is written once, using the\n"
+           "same CRC32 checksum and length the Kismet server uses to find duplicate packets.\n"
+           "Of each device, the record seen most recently is kept.\n"
+           "\n"
+           "Packets are written to the merged log uncompressed and in the log itself, even if\n"
+           "the inputs logged them compressed or to segment files.\n"
+           "\n"
+           "The inputs are read a record at a time, so merging uses the same small amount of\n"
+           "memory however large the logs are.  The merged log is written to [out].partial\n"
+           "and renamed once it is complete.\n"
+          );
+}
+
+void merge_exec(sqlite3 *db, const std::string& sql) {
+    char *errmsg = nullptr;
+
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        auto e = std::string(errmsg != nullptr ? errmsg : "unknown error");
+        sqlite3_free(errmsg);
+        throw std::runtime_error(fmt::format("unable to run '{}': {}", sql, e));
+    }
+}
+
+sqlite3_stmt *merge_prepare(sqlite3 *db, const std::string& sql) {
+    sqlite3_stmt *stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(fmt::format("unable to prepare '{}': {}", sql, sqlite3_errmsg(db)));
+
+    return stmt;
+}
+
+// Columns of a table, or none if the log has no such table
+std::vector<std::string> table_columns(sqlite3 *db, const std::string& table) {
+    std::vector<std::string> columns;
+
+    auto stmt = merge_prepare(db, fmt::format("PRAGMA table_info({})", table));
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        columns.push_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+
+    sqlite3_finalize(stmt);
+
+    return columns;
+}
+
+std::string join_columns(const std::vector<std::string>& columns) {
+    std::string r;
+
+    for (const auto& c : columns) {
+        if (r.length())
+            r += ", ";
+        r += c;
+    }
+
+    return r;
+}
+
+// Create the tables of the merged log, as the server creates them
+void create_log(sqlite3 *out) {
+    const std::vector<std::string> tables = {
+        "CREATE TABLE KISMET (kismet_version TEXT, db_version INT, db_module TEXT)",
+
+        "CREATE TABLE devices (first_time INT, last_time INT, devkey TEXT, phyname TEXT, "
+            "devmac TEXT, strongest_signal INT, min_lat REAL, min_lon REAL, max_lat REAL, "
+            "max_lon REAL, avg_lat REAL, avg_lon REAL, bytes_data INT, type TEXT, device BLOB, "
+            "UNIQUE(phyname, devmac) ON CONFLICT REPLACE)",
+
+        "CREATE TABLE packets (ts_sec INT, ts_usec INT, phyname TEXT, sourcemac TEXT, "
+            "destmac TEXT, transmac TEXT, frequency REAL, devkey TEXT, lat REAL, lon REAL, "
+            "alt REAL, speed REAL, heading REAL, packet_len INT, signal INT, datasource TEXT, "
+            "dlt INT, packet BLOB, error INT, tags TEXT, datarate REAL, hash INT, packetid INT, "
+            "segment INT, segment_offset INT, codec INT, codec_dict INT, stored_len INT)",
+
+        "CREATE TABLE packet_dictionaries (id INT PRIMARY KEY, codec INT, dictionary BLOB)",
+
+        "CREATE TABLE data (ts_sec INT, ts_usec INT, phyname TEXT, devmac TEXT, lat REAL, "
+            "lon REAL, alt REAL, speed REAL, heading REAL, datasource TEXT, type TEXT, json BLOB)",
+
+        "CREATE TABLE datasources (uuid TEXT, typestring TEXT, definition TEXT, name TEXT, "
+            "interface TEXT, json BLOB, UNIQUE(uuid) ON CONFLICT REPLACE)",
+
+        "CREATE TABLE alerts (ts_sec INT, ts_usec INT, phyname TEXT, devmac TEXT, lat REAL, "
+            "lon REAL, header TEXT, json BLOB)",
+
+        "CREATE TABLE messages (ts_sec INT, lat REAL, lon REAL, msgtype TEXT, message TEXT)",
+
+        "CREATE TABLE snapshots (ts_sec INT, ts_usec INT, lat REAL, lon REAL, snaptype TEXT, "
+            "json BLOB)",
+    };
+
+    for (const auto& t : tables)
+        merge_exec(out, t);
+
+    auto stmt = merge_prepare(out,
+            "INSERT INTO KISMET (kismet_version, db_version, db_module) VALUES (?, ?, ?)");
+
+    auto kversion = fmt::format("{}.{}.{}", VERSION_MAJOR, VERSION_MINOR, VERSION_TINY);
+
+    sqlite3_bind_text(stmt, 1, kversion.c_str(), kversion.length(), SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, MERGE_DB_VERSION);
+    sqlite3_bind_text(stmt, 3, "kismetlog", -1, SQLITE_STATIC);
+
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+// An input log, with the readers of packets kept in segment files or compressed
+struct merge_input {
+    merge_input(const std::string& path) :
+        path{path},
+        db{nullptr},
+        db_version{0},
+        segment_reader{path} { }
+
+    ~merge_input() {
+        if (db != nullptr)
+            sqlite3_close(db);
+    }
+
+    std::string path;
+    sqlite3 *db;
+    int db_version;
+
+    kismetdb_segment_reader segment_reader;
+    kismetdb_packet_decompressor decompressor;
+};
+
+// Duplicate packets, found the way the server finds them: a packet is a duplicate when
+// a packet with the same CRC32 and length is among the most recent packets and, if
+// there is a window, was seen within the window
+class merge_dedupe {
+public:
+    merge_dedupe(size_t size, time_t window) :
+        ring(std::max(size, static_cast<size_t>(16))),
+        ring_pos{0},
+        window{window} { }
+
+    bool duplicate(uint32_t hash, uint32_t len, time_t ts) {
+        uint64_t key = (static_cast<uint64_t>(hash) << 32) | len;
+
+        auto ei = index.find(key);
+
+        if (ei != index.end()) {
+            if (window == 0 || ts - ring[ei->second].ts <= window)
+                return true;
+        }
+
+        // Record the packet, replacing the oldest one
+        auto pos = ring_pos;
+        ring_pos = (ring_pos + 1) % ring.size();
+
+        auto& e = ring[pos];
+
+        if (e.used) {
+            auto oi = index.find(e.key);
+            if (oi != index.end() && oi->second == pos)
+                index.erase(oi);
+        }
+
+        e.key = key;
+        e.ts = ts;
+        e.used = true;
+
+        index[key] = pos;
+
+        return false;
+    }
+
+protected:
+    struct entry {
+        uint64_t key;
+        time_t ts;
+        bool used;
+    };
+
+    std::vector<entry> ring;
+    size_t ring_pos;
+    std::unordered_map<uint64_t, size_t> index;
+    time_t window;
+};
+
+struct merge_config {
+    bool strip_packets;
+    bool dedupe;
+    size_t dedupe_size;
+    time_t dedupe_window;
+    bool verbose;
+};
+
+// The next row of a table of an input, in time order
+struct merge_cursor {
+    merge_input *input;
+    size_t input_no;
+    sqlite3_stmt *stmt;
+    int64_t ts_sec;
+    int64_t ts_usec;
+};
+
+struct merge_cursor_later {
+    bool operator()(const merge_cursor& a, const merge_cursor& b) const {
+        if (a.ts_sec != b.ts_sec)
+            return a.ts_sec > b.ts_sec;
+        if (a.ts_usec != b.ts_usec)
+            return a.ts_usec > b.ts_usec;
+        return a.input_no > b.input_no;
+    }
+};
+
+// Columns of packets which hold or describe the packet content, instead of being copied
+const std::vector<std::string> packet_content_columns = {
+    "packet", "segment", "segment_offset", "codec", "codec_dict", "stored_len"
+};
+
+// Merge a table of all the inputs in time order; returns the number of rows written.
+// Throws std::runtime_error
+unsigned long merge_table(std::vector<std::unique_ptr<merge_input>>& inputs, sqlite3 *out,
+        const std::string& table, const merge_config& cfg, unsigned long& n_duplicates) {
+    auto out_columns = table_columns(out, table);
+    bool packets = (table == "packets");
+    bool usec = std::find(out_columns.begin(), out_columns.end(), "ts_usec") != out_columns.end();
+
+    // Columns copied as they are; the packet content is decoded and written separately
+    std::vector<std::string> copy_columns;
+
+    for (const auto& c : out_columns) {
+        if (packets && std::find(packet_content_columns.begin(), packet_content_columns.end(), c) !=
+                packet_content_columns.end())
+            continue;
+
+        copy_columns.push_back(c);
+    }
+
+    auto insert_columns = copy_columns;
+
+    if (packets) {
+        insert_columns.push_back("packet");
+        insert_columns.push_back("codec");
+        insert_columns.push_back("stored_len");
+    }
+
+    std::vector<std::string> params(insert_columns.size(), "?");
+
+    auto insert_stmt = merge_prepare(out,
+            fmt::format("INSERT INTO {} ({}) VALUES ({})", table, join_columns(insert_columns),
+                join_columns(params)));
+
+    std::priority_queue<merge_cursor, std::vector<merge_cursor>, merge_cursor_later> cursors;
+
+    auto advance = [&cursors](merge_cursor c) {
+        if (sqlite3_step(c.stmt) != SQLITE_ROW) {
+            sqlite3_finalize(c.stmt);
+            return;
+        }
+
+        c.ts_sec = sqlite3_column_int64(c.stmt, 0);
+        c.ts_usec = sqlite3_column_int64(c.stmt, 1);
+
+        cursors.push(c);
+    };
+
+    // Each input is read in time order, selecting the columns the merged log has; columns
+    // an older log doesn't have are written as null.  The timestamps are selected first
+    // for ordering, and the packet content columns follow the copied columns
+    for (size_t i = 0; i < inputs.size(); i++) {
+        auto in_columns = table_columns(inputs[i]->db, table);
+
+        if (in_columns.size() == 0)
+            continue;
+
+        auto in_or_null = [&in_columns](const std::string& c) -> std::string {
+            if (std::find(in_columns.begin(), in_columns.end(), c) != in_columns.end())
+                return c;
+            return "NULL";
+        };
+
+        std::vector<std::string> select_columns = {"ts_sec", usec ? "ts_usec" : "0"};
+
+        for (const auto& c : copy_columns)
+            select_columns.push_back(in_or_null(c));
+
+        if (packets)
+            for (const auto& c : packet_content_columns)
+                select_columns.push_back(in_or_null(c));
+
+        auto sql = fmt::format("SELECT {} FROM {} ORDER BY ts_sec{}", join_columns(select_columns),
+                table, usec ? ", ts_usec" : "");
+
+        advance(merge_cursor{inputs[i].get(), i, merge_prepare(inputs[i]->db, sql), 0, 0});
+    }
+
+    merge_dedupe dedupe(cfg.dedupe_size, cfg.dedupe_window);
+
+    // Positions of the packet columns in the selected rows
+    auto copy_col = [&copy_columns](const std::string& c) -> int {
+        return 2 + std::distance(copy_columns.begin(),
+                std::find(copy_columns.begin(), copy_columns.end(), c));
+    };
+
+    int content_col = 2 + copy_columns.size();
+    int hash_col = copy_col("hash");
+    int len_col = copy_col("packet_len");
+
+    unsigned long n = 0;
+
+    merge_exec(out, "BEGIN TRANSACTION");
+
+    while (!cursors.empty()) {
+        auto c = cursors.top();
+        cursors.pop();
+
+        auto row = c.stmt;
+
+        for (size_t col = 0; col < copy_columns.size(); col++)
+            sqlite3_bind_value(insert_stmt, col + 1, sqlite3_column_value(row, col + 2));
+
+        if (packets) {
+            auto packet_len = sqlite3_column_int64(row, len_col);
+            std::string content;
+
+            // The packet is only decoded when it is kept, or when the log has no checksum
+            // of it to find duplicates by
+            bool need_content = !cfg.strip_packets ||
+                (cfg.dedupe && sqlite3_column_int64(row, hash_col) == 0);
+
+            if (need_content) {
+                if (sqlite3_column_type(row, content_col + 1) != SQLITE_NULL) {
+                    auto stored_len = packet_len;
+
+                    if (sqlite3_column_type(row, content_col + 5) != SQLITE_NULL)
+                        stored_len = sqlite3_column_int64(row, content_col + 5);
+
+                    content = c.input->segment_reader.read(sqlite3_column_int(row, content_col + 1),
+                            sqlite3_column_int64(row, content_col + 2), stored_len);
+                } else {
+                    auto blob = sqlite3_column_blob(row, content_col);
+
+                    if (blob != nullptr)
+                        content = std::string(static_cast<const char *>(blob),
+                                sqlite3_column_bytes(row, content_col));
+                }
+
+                auto codec = sqlite3_column_int(row, content_col + 3);
+
+                if (codec != KISMETDB_CODEC_RAW)
+                    content = c.input->decompressor.decompress(codec,
+                            sqlite3_column_int(row, content_col + 4), content, packet_len);
+            }
+
+            if (cfg.dedupe) {
+                uint32_t hash = sqlite3_column_int64(row, hash_col);
+
+                if (hash == 0 && content.length() != 0)
+                    hash = crc32_fast(content.data(), content.length(), 0);
+
+                if (packet_len == 0)
+                    packet_len = content.length();
+
+                if (hash != 0 && dedupe.duplicate(hash, packet_len, c.ts_sec)) {
+                    n_duplicates++;
+                    sqlite3_reset(insert_stmt);
+                    advance(c);
+                    continue;
+                }
+            }
+
+            if (cfg.strip_packets)
+                content = "";
+
+            sqlite3_bind_blob(insert_stmt, copy_columns.size() + 1, content.data(), content.length(),
+                    SQLITE_TRANSIENT);
+            sqlite3_bind_int(insert_stmt, copy_columns.size() + 2, KISMETDB_CODEC_RAW);
+            sqlite3_bind_int64(insert_stmt, copy_columns.size() + 3, content.length());
+        }
+
+        if (sqlite3_step(insert_stmt) != SQLITE_DONE) {
+            auto e = std::string(sqlite3_errmsg(out));
+            sqlite3_finalize(insert_stmt);
+            throw std::runtime_error(fmt::format("unable to write {}: {}", table, e));
+        }
+
+        sqlite3_reset(insert_stmt);
+
+        n++;
+
+        if ((n % MERGE_COMMIT_ROWS) == 0) {
+            merge_exec(out, "COMMIT");
+            merge_exec(out, "BEGIN TRANSACTION");
+
+            if (cfg.verbose)
+                fmt::print(stderr, "* Merged {} {} records\n", n, table);
+        }
+
+        advance(c);
+    }
+
+    merge_exec(out, "COMMIT");
+
+    sqlite3_finalize(insert_stmt);
+
+    return n;
+}
+
+// Copy the records of a table which aren't ordered in time; devices are upserted so the
+// most recently seen record of each device is kept.  Returns the number of records read
+unsigned long merge_records(std::vector<std::unique_ptr<merge_input>>& inputs, sqlite3 *out,
+        const std::string& table) {
+    auto out_columns = table_columns(out, table);
+
+    unsigned long n = 0;
+
+    merge_exec(out, "BEGIN TRANSACTION");
+
+    for (auto& input : inputs) {
+        auto in_columns = table_columns(input->db, table);
+
+        if (in_columns.size() == 0)
+            continue;
+
+        std::vector<std::string> columns;
+
+        for (const auto& c : out_columns) {
+            if (std::find(in_columns.begin(), in_columns.end(), c) != in_columns.end())
+                columns.push_back(c);
+        }
+
+        std::vector<std::string> params(columns.size(), "?");
+
+        auto sql = fmt::format("INSERT INTO {} ({}) VALUES ({})", table, join_columns(columns),
+                join_columns(params));
+
+        if (table == "devices") {
+            std::vector<std::string> updates;
+
+            for (const auto& c : columns)
+                updates.push_back(fmt::format("{} = excluded.{}", c, c));
+
+            sql += fmt::format(" ON CONFLICT(phyname, devmac) DO UPDATE SET {} "
+                    "WHERE excluded.last_time > devices.last_time", join_columns(updates));
+        }
+
+        auto insert_stmt = merge_prepare(out, sql);
+        auto select_stmt = merge_prepare(input->db,
+                fmt::format("SELECT {} FROM {}", join_columns(columns), table));
+
+        while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+            for (size_t col = 0; col < columns.size(); col++)
+                sqlite3_bind_value(insert_stmt, col + 1, sqlite3_column_value(select_stmt, col));
+
+            if (sqlite3_step(insert_stmt) != SQLITE_DONE) {
+                auto e = std::string(sqlite3_errmsg(out));
+                sqlite3_finalize(insert_stmt);
+                sqlite3_finalize(select_stmt);
+                throw std::runtime_error(fmt::format("unable to write {}: {}", table, e));
+            }
+
+            sqlite3_reset(insert_stmt);
+
+            n++;
+        }
+
+        sqlite3_finalize(insert_stmt);
+        sqlite3_finalize(select_stmt);
+    }
+
+    merge_exec(out, "COMMIT");
+
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+#define OPT_NO_DEDUPE           10
+#define OPT_DEDUPE_SIZE         11
+#define OPT_DEDUPE_WINDOW       12
+    static struct option longopt[] = {
+        { "in", required_argument, 0, 'i' },
+        { "out", required_argument, 0, 'o' },
+        { "force", no_argument, 0, 'f' },
+        { "strip-packets", no_argument, 0, 's' },
+        { "verbose", no_argument, 0, 'v' },
+        { "help", no_argument, 0, 'h' },
+        { "no-dedupe", no_argument, 0, OPT_NO_DEDUPE },
+        { "dedupe-size", required_argument, 0, OPT_DEDUPE_SIZE },
+        { "dedupe-window", required_argument, 0, OPT_DEDUPE_WINDOW },
+        { 0, 0, 0, 0 }
+    };
+
+    int option_idx = 0;
+    optind = 0;
+    opterr = 0;
+
+    std::vector<std::string> in_fnames;
+    std::string out_fname;
+    bool force = false;
+
+    merge_config cfg;
+    cfg.strip_packets = false;
+    cfg.dedupe = true;
+    cfg.dedupe_size = MERGE_DEDUPE_SIZE;
+    cfg.dedupe_window = 0;
+    cfg.verbose = false;
+
+    while (1) {
+        int r = getopt_long(argc, argv,
+                            "-hi:o:fsv",
+                            longopt, &option_idx);
+        if (r < 0) break;
+
+        if (r == 'h') {
+            print_help(argv[0]);
+            exit(1);
+        } else if (r == 'i' || r == 1) {
+            in_fnames.push_back(std::string(optarg));
+        } else if (r == 'o') {
+            out_fname = std::string(optarg);
+        } else if (r == 'f') {
+            force = true;
+        } else if (r == 's') {
+            cfg.strip_packets = true;
+        } else if (r == 'v') {
+            cfg.verbose = true;
+        } else if (r == OPT_NO_DEDUPE) {
+            cfg.dedupe = false;
+        } else if (r == OPT_DEDUPE_SIZE) {
+            unsigned long sz;
+
+            if (sscanf(optarg, "%lu", &sz) != 1 || sz == 0) {
+                fmt::print(stderr, "ERROR:  Expected a number of packets for --dedupe-size\n");
+                exit(1);
+            }
+
+            cfg.dedupe_size = sz;
+        } else if (r == OPT_DEDUPE_WINDOW) {
+            unsigned int w;
+
+            if (sscanf(optarg, "%u", &w) != 1) {
+                fmt::print(stderr, "ERROR:  Expected a number of seconds for --dedupe-window\n");
+                exit(1);
+            }
+
+            cfg.dedupe_window = w;
+        }
+    }
+
+    if (in_fnames.size() == 0) {
+        fmt::print(stderr, "ERROR: Expected --in [kismetdb file]\n");
+        exit(1);
+    }
+
+    if (out_fname == "") {
+        fmt::print(stderr, "ERROR: Expected --out [kismetdb file]\n");
+        exit(1);
+    }
+
+    struct stat statbuf;
+
+    if (!force && stat(out_fname.c_str(), &statbuf) == 0) {
+        fmt::print(stderr, "ERROR:  Output file '{}' exists, use --force to overwrite it\n", out_fname);
+        exit(1);
+    }
+
+    // Rolling logs are merged file by file
+    std::vector<std::string> in_files;
+
+    for (const auto& in_fname : in_fnames) {
+        if (kismetdb_is_manifest(in_fname)) {
+            try {
+                for (const auto& e : kismetdb_read_manifest(in_fname))
+                    in_files.push_back(kismetdb_manifest_file(in_fname, e));
+            } catch (const std::runtime_error& e) {
+                fmt::print(stderr, "ERROR:  {}\n", e.what());
+                exit(1);
+            }
+        } else {
+            in_files.push_back(in_fname);
+        }
+    }
+
+    std::vector<std::unique_ptr<merge_input>> inputs;
+
+    for (const auto& in_file : in_files) {
+        if (stat(in_file.c_str(), &statbuf) < 0) {
+            fmt::print(stderr, "ERROR:  Unable to open input file '{}': {}\n", in_file,
+                    strerror(errno));
+            exit(1);
+        }
+
+        auto input = std::unique_ptr<merge_input>(new merge_input(in_file));
+
+        if (sqlite3_open_v2(in_file.c_str(), &input->db, SQLITE_OPEN_READONLY, nullptr)) {
+            fmt::print(stderr, "ERROR:  Unable to open '{}': {}\n", in_file, sqlite3_errmsg(input->db));
+            exit(1);
+        }
+
+        try {
+            auto stmt = merge_prepare(input->db, "SELECT db_version FROM KISMET");
+
+            if (sqlite3_step(stmt) != SQLITE_ROW) {
+                sqlite3_finalize(stmt);
+                throw std::runtime_error("no database version");
+            }
+
+            input->db_version = sqlite3_column_int(stmt, 0);
+            sqlite3_finalize(stmt);
+
+            if (input->db_version < MERGE_MIN_DB_VERSION || input->db_version > MERGE_DB_VERSION)
+                throw std::runtime_error(fmt::format("KismetDB version {} can not be merged, "
+                            "expected version {} to {}", input->db_version, MERGE_MIN_DB_VERSION,
+                            MERGE_DB_VERSION));
+
+            if (input->db_version >= 10) {
+                stmt = merge_prepare(input->db, "SELECT id, dictionary FROM packet_dictionaries");
+
+                while (sqlite3_step(stmt) == SQLITE_ROW)
+                    input->decompressor.add_dictionary(sqlite3_column_int(stmt, 0),
+                            std::string(static_cast<const char *>(sqlite3_column_blob(stmt, 1)),
+                                sqlite3_column_bytes(stmt, 1)));
+
+                sqlite3_finalize(stmt);
+            }
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "ERROR:  Unable to read '{}': {}\n", in_file, e.what());
+            exit(1);
+        }
+
+        if (cfg.verbose)
+            fmt::print(stderr, "* Merging '{}', KismetDB version {}\n", in_file, input->db_version);
+
+        inputs.push_back(std::move(input));
+    }
+
+    // The merged log is built under another name, so an interrupted merge never leaves a
+    // log which looks complete
+    auto partial_fname = out_fname + ".partial";
+
+    if (unlink(partial_fname.c_str()) < 0 && errno != ENOENT) {
+        fmt::print(stderr, "ERROR:  Unable to remove '{}': {}\n", partial_fname, strerror(errno));
+        exit(1);
+    }
+
+    sqlite3 *out = nullptr;
+
+    if (sqlite3_open_v2(partial_fname.c_str(), &out, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                nullptr)) {
+        fmt::print(stderr, "ERROR:  Unable to create '{}': {}\n", partial_fname, sqlite3_errmsg(out));
+        exit(1);
+    }
+
+    unsigned long n_packets = 0, n_duplicates = 0;
+
+    try {
+        // Nothing needs to survive a crash of a file which is thrown away if the merge
+        // doesn't finish
+        merge_exec(out, "PRAGMA journal_mode=OFF");
+        merge_exec(out, "PRAGMA synchronous=OFF");
+
+        create_log(out);
+
+        for (const auto& t : {"datasources", "devices"}) {
+            auto n = merge_records(inputs, out, t);
+
+            if (cfg.verbose)
+                fmt::print(stderr, "* Merged {} {} records\n", n, t);
+        }
+
+        for (const auto& t : {"packets", "data", "snapshots", "alerts", "messages"}) {
+            unsigned long n_dupes = 0;
+            auto n = merge_table(inputs, out, t, cfg, n_dupes);
+
+            if (std::string(t) == "packets") {
+                n_packets = n;
+                n_duplicates = n_dupes;
+            }
+
+            if (cfg.verbose)
+                fmt::print(stderr, "* Merged {} {} records\n", n, t);
+        }
+
+        // Index the packets as the server does when it closes a log
+        merge_exec(out, "CREATE INDEX packets_ts_idx ON packets (ts_sec, ts_usec)");
+        merge_exec(out, "CREATE INDEX packets_datasource_ts_idx ON packets (datasource, ts_sec)");
+        merge_exec(out, "CREATE INDEX packets_sourcemac_ts_idx ON packets (sourcemac, ts_sec)");
+        merge_exec(out, "ANALYZE packets");
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  Unable to merge logs: {}\n", e.what());
+        sqlite3_close(out);
+        unlink(partial_fname.c_str());
+        exit(1);
+    }
+
+    sqlite3_close(out);
+
+    if (rename(partial_fname.c_str(), out_fname.c_str()) < 0) {
+        fmt::print(stderr, "ERROR:  Unable to rename '{}' to '{}': {}\n", partial_fname, out_fname,
+                strerror(errno));
+        exit(1);
+    }
+
+    fmt::print(stderr, "* Merged {} logs into '{}', {} packets written, {} duplicate packets "
+            "dropped\n", inputs.size(), out_fname, n_packets, n_duplicates);
+
+    return 0;
+}
+
@@ -22,7 +22,9 @@
 #include <iomanip>
 #include <ctime>
 #include <iostream>
+#include <sstream>
 #include <tuple>
+#include <vector>
 
 #include <string.h>
 #include <stdio.h>
@@ -60,20 +62,313 @@ double distance_meters(double lat0, double lon0, double lat1, double lon1) {
     return ret;
 }
 
+// Partial aggregates of a log are kept in a checkpoint, a sqlite file next to the log
+// named '[log]-stats', with the last rowid counted from each table, so each run only
+// counts the records added to the log since the last run.
+#define STATS_CHECKPOINT_VERSION    1
+
+// Packets and data records are counted by datasource, phy, and hour
+#define STATS_BUCKET_SECONDS        3600
+
+void checkpoint_exec(sqlite3 *ckpt, const std::string& sql) {
+    char *errmsg = nullptr;
+
+    if (sqlite3_exec(ckpt, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        auto e = std::string(errmsg != nullptr ? errmsg : "unknown error");
+        sqlite3_free(errmsg);
+        throw std::runtime_error(fmt::format("statistics checkpoint: {}", e));
+    }
+}
+
+sqlite3_stmt *checkpoint_prepare(sqlite3 *db, const std::string& sql) {
+    sqlite3_stmt *stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(fmt::format("unable to prepare '{}': {}", sql, sqlite3_errmsg(db)));
+
+    return stmt;
+}
+
+sqlite3 *open_checkpoint(const std::string& path, bool rebuild) {
+    sqlite3 *ckpt = nullptr;
+
+    if (sqlite3_open_v2(path.c_str(), &ckpt, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                nullptr) != SQLITE_OK) {
+        auto e = std::string(ckpt != nullptr ? sqlite3_errmsg(ckpt) : "out of memory");
+        sqlite3_close(ckpt);
+        throw std::runtime_error(fmt::format("unable to open statistics checkpoint {}: {}", path, e));
+    }
+
+    checkpoint_exec(ckpt, "CREATE TABLE IF NOT EXISTS checkpoint (version INT)");
+
+    // A checkpoint from another version is rebuilt
+    auto stmt = checkpoint_prepare(ckpt, "SELECT version FROM checkpoint");
+    if (sqlite3_step(stmt) == SQLITE_ROW && 
+            sqlite3_column_int(stmt, 0) != STATS_CHECKPOINT_VERSION)
+        rebuild = true;
+    sqlite3_finalize(stmt);
+
+    if (rebuild) {
+        checkpoint_exec(ckpt, "DROP TABLE IF EXISTS progress");
+        checkpoint_exec(ckpt, "DROP TABLE IF EXISTS counts");
+        checkpoint_exec(ckpt, "DROP TABLE IF EXISTS tags");
+        checkpoint_exec(ckpt, "DROP TABLE IF EXISTS breadcrumb");
+        checkpoint_exec(ckpt, "DELETE FROM checkpoint");
+    }
+
+    checkpoint_exec(ckpt, fmt::format("INSERT INTO checkpoint (version) SELECT {} "
+                "WHERE NOT EXISTS (SELECT * FROM checkpoint)", STATS_CHECKPOINT_VERSION));
+
+    checkpoint_exec(ckpt, "CREATE TABLE IF NOT EXISTS progress ("
+            "source TEXT PRIMARY KEY, "
+            "position INT)");
+
+    checkpoint_exec(ckpt, "CREATE TABLE IF NOT EXISTS counts ("
+            "source TEXT, "
+            "datasource TEXT, "
+            "phyname TEXT, "
+            "bucket INT, "
+            "count INT, "
+            "with_loc INT, "
+            "bytes INT, "
+            "PRIMARY KEY (source, datasource, phyname, bucket)) WITHOUT ROWID");
+
+    checkpoint_exec(ckpt, "CREATE TABLE IF NOT EXISTS tags (tag TEXT PRIMARY KEY) WITHOUT ROWID");
+
+    checkpoint_exec(ckpt, "CREATE TABLE IF NOT EXISTS breadcrumb ("
+            "last_lat REAL, "
+            "last_lon REAL, "
+            "distance REAL)");
+
+    checkpoint_exec(ckpt, "INSERT INTO breadcrumb (last_lat, last_lon, distance) SELECT 0, 0, 0 "
+            "WHERE NOT EXISTS (SELECT * FROM breadcrumb)");
+
+    return ckpt;
+}
+
+int64_t query_int64(sqlite3 *db, const std::string& sql) {
+    auto stmt = checkpoint_prepare(db, sql);
+    int64_t r = 0;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        r = sqlite3_column_int64(stmt, 0);
+
+    sqlite3_finalize(stmt);
+
+    return r;
+}
+
+// Count the records of a log table added since the last checkpoint; returns the number
+// of records counted
+unsigned long checkpoint_table(sqlite3 *db, sqlite3 *ckpt, const std::string& table,
+        const std::string& bytes_expr) {
+    auto last = query_int64(ckpt, 
+            fmt::format("SELECT position FROM progress WHERE source = '{}'", table));
+
+    // Records are counted up to the last one now in the log, so records written while
+    // counting are left to the next run
+    auto high = query_int64(db, fmt::format("SELECT max(rowid) FROM {}", table));
+
+    if (high <= last)
+        return 0;
+
+    auto count_stmt = checkpoint_prepare(db, 
+            fmt::format("SELECT datasource, phyname, ts_sec / {}, count(*), "
+                "sum(case when (lat != 0 and lon != 0) then 1 else 0 end), {} "
+                "FROM {} WHERE rowid > ? AND rowid <= ? GROUP BY 1, 2, 3",
+                STATS_BUCKET_SECONDS, bytes_expr, table));
+
+    auto upsert_stmt = checkpoint_prepare(ckpt,
+            "INSERT INTO counts (source, datasource, phyname, bucket, count, with_loc, bytes) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?) "
+            "ON CONFLICT (source, datasource, phyname, bucket) DO UPDATE SET "
+            "count = count + excluded.count, "
+            "with_loc = with_loc + excluded.with_loc, "
+            "bytes = bytes + excluded.bytes");
+
+    sqlite3_bind_int64(count_stmt, 1, last);
+    sqlite3_bind_int64(count_stmt, 2, high);
+
+    unsigned long n = 0;
+
+    while (sqlite3_step(count_stmt) == SQLITE_ROW) {
+        sqlite3_reset(upsert_stmt);
+        sqlite3_bind_text(upsert_stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+
+        for (int c = 0; c < 2; c++) {
+            auto t = reinterpret_cast<const char *>(sqlite3_column_text(count_stmt, c));
+            sqlite3_bind_text(upsert_stmt, c + 2, t != nullptr ? t : "", -1, SQLITE_TRANSIENT);
+        }
+
+        for (int c = 2; c < 6; c++)
+            sqlite3_bind_int64(upsert_stmt, c + 2, sqlite3_column_int64(count_stmt, c));
+
+        n += sqlite3_column_int64(count_stmt, 3);
+
+        if (sqlite3_step(upsert_stmt) != SQLITE_DONE) {
+            sqlite3_finalize(count_stmt);
+            sqlite3_finalize(upsert_stmt);
+            throw std::runtime_error(fmt::format("unable to update statistics checkpoint: {}",
+                        sqlite3_errmsg(ckpt)));
+        }
+    }
+
+    sqlite3_finalize(count_stmt);
+    sqlite3_finalize(upsert_stmt);
+
+    checkpoint_exec(ckpt, fmt::format("INSERT OR REPLACE INTO progress (source, position) "
+                "VALUES ('{}', {})", table, high));
+
+    return n;
+}
+
+// Collect the packet tags added since the last checkpoint
+void checkpoint_tags(sqlite3 *db, sqlite3 *ckpt) {
+    auto last = query_int64(ckpt, "SELECT position FROM progress WHERE source = 'tags'");
+    auto high = query_int64(db, "SELECT max(rowid) FROM packets");
+
+    if (high <= last)
+        return;
+
+    auto tags_stmt = checkpoint_prepare(db, 
+            "SELECT DISTINCT tags FROM packets WHERE rowid > ? AND rowid <= ? AND tags != ''");
+    auto insert_stmt = checkpoint_prepare(ckpt, "INSERT OR IGNORE INTO tags (tag) VALUES (?)");
+
+    sqlite3_bind_int64(tags_stmt, 1, last);
+    sqlite3_bind_int64(tags_stmt, 2, high);
+
+    while (sqlite3_step(tags_stmt) == SQLITE_ROW) {
+        auto t = reinterpret_cast<const char *>(sqlite3_column_text(tags_stmt, 0));
+
+        if (t == nullptr)
+            continue;
+
+        std::stringstream ss(t);
+        std::string tag;
+
+        while (ss >> tag) {
+            sqlite3_reset(insert_stmt);
+            sqlite3_bind_text(insert_stmt, 1, tag.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(insert_stmt);
+        }
+    }
+
+    sqlite3_finalize(tags_stmt);
+    sqlite3_finalize(insert_stmt);
+
+    checkpoint_exec(ckpt, fmt::format("INSERT OR REPLACE INTO progress (source, position) "
+                "VALUES ('tags', {})", high));
+}
+
+// Extend the breadcrumb distance with the GPS snapshots added since the last checkpoint
+void checkpoint_breadcrumb(sqlite3 *db, sqlite3 *ckpt) {
+    auto last = query_int64(ckpt, "SELECT position FROM progress WHERE source = 'snapshots'");
+    auto high = query_int64(db, "SELECT max(rowid) FROM snapshots");
+
+    if (high <= last)
+        return;
+
+    double bc_last_lat = 0, bc_last_lon = 0, breadcrumb_len = 0;
+
+    auto bc_stmt = checkpoint_prepare(ckpt, "SELECT last_lat, last_lon, distance FROM breadcrumb");
+    if (sqlite3_step(bc_stmt) == SQLITE_ROW) {
+        bc_last_lat = sqlite3_column_double(bc_stmt, 0);
+        bc_last_lon = sqlite3_column_double(bc_stmt, 1);
+        breadcrumb_len = sqlite3_column_double(bc_stmt, 2);
+    }
+    sqlite3_finalize(bc_stmt);
+
+    auto snap_stmt = checkpoint_prepare(db, 
+            "SELECT lat, lon FROM snapshots WHERE rowid > ? AND rowid <= ? AND "
+            "lat != 0 AND lon != 0 AND snaptype = 'GPS' ORDER BY rowid");
+
+    sqlite3_bind_int64(snap_stmt, 1, last);
+    sqlite3_bind_int64(snap_stmt, 2, high);
+
+    while (sqlite3_step(snap_stmt) == SQLITE_ROW) {
+        auto bc_cur_lat = sqlite3_column_double(snap_stmt, 0);
+        auto bc_cur_lon = sqlite3_column_double(snap_stmt, 1);
+
+        if (bc_last_lat == 0 || bc_last_lon == 0) {
+            bc_last_lat = bc_cur_lat;
+            bc_last_lon = bc_cur_lon;
+            continue;
+        }
+
+        if (bc_cur_lat == bc_last_lat && bc_cur_lon == bc_last_lon)
+            continue;
+
+        breadcrumb_len += distance_meters(bc_cur_lat, bc_cur_lon, bc_last_lat, bc_last_lon);
+
+        bc_last_lat = bc_cur_lat;
+        bc_last_lon = bc_cur_lon;
+    }
+
+    sqlite3_finalize(snap_stmt);
+
+    checkpoint_exec(ckpt, fmt::format("UPDATE breadcrumb SET last_lat = {}, last_lon = {}, distance = {}",
+                bc_last_lat, bc_last_lon, breadcrumb_len));
+    checkpoint_exec(ckpt, fmt::format("INSERT OR REPLACE INTO progress (source, position) "
+                "VALUES ('snapshots', {})", high));
+}
+
+// Rows of a grouped query of the checkpoint counts, as the group key and the count, 
+// records with a location, and bytes
+std::vector<std::tuple<std::string, uint64_t, uint64_t, uint64_t>> 
+    checkpoint_counts(sqlite3 *ckpt, const std::string& source, const std::string& group) {
+    std::vector<std::tuple<std::string, uint64_t, uint64_t, uint64_t>> ret;
+
+    auto stmt = checkpoint_prepare(ckpt, 
+            fmt::format("SELECT {}, sum(count), sum(with_loc), sum(bytes) FROM counts "
+                "WHERE source = ? GROUP BY 1 ORDER BY 1", group));
+
+    sqlite3_bind_text(stmt, 1, source.c_str(), -1, SQLITE_TRANSIENT);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        auto k = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+
+        ret.push_back(std::make_tuple(std::string(k != nullptr ? k : ""),
+                    (uint64_t) sqlite3_column_int64(stmt, 1),
+                    (uint64_t) sqlite3_column_int64(stmt, 2),
+                    (uint64_t) sqlite3_column_int64(stmt, 3)));
+    }
+
+    sqlite3_finalize(stmt);
+
+    return ret;
+}
+
 void print_help(char *argv) {
     printf("Kismetdb statistics\n");
     printf("usage: %s [OPTION]\n", argv);
     printf(" -i, --in [filename]          Input kismetdb file\n"
            " -s, --skip-clean             Don't clean (sql vacuum) input database\n"
-           " -j, --json                   Dump stats as a JSON dictionary\n");
+           " -j, --json                   Dump stats as a JSON dictionary\n"
+           " -c, --checkpoint [filename]  Statistics checkpoint file; by default the checkpoint\n"
+           "                              is kept next to the log as [log]-stats\n"
+           "     --no-checkpoint          Count the whole log without keeping a checkpoint\n"
+           "     --rebuild                Discard the checkpoint and count the whole log\n"
+           "\n"
+           "Packet, data, tag, and GPS track statistics are kept in the checkpoint, so running\n"
+           "the tool again on a log which has grown only counts the new records.  Records\n"
+           "removed from the log after being counted, such as by the log timeouts, remain\n"
+           "counted.\n"
+           "\n"
+           "Cleaning (vacuuming) a log may renumber its records, so the checkpoint is rebuilt\n"
+           "when the log is cleaned; use --skip-clean with live logs.\n");
 }
 
 int main(int argc, char *argv[]) {
+#define OPT_NO_CHECKPOINT       1
+#define OPT_REBUILD             2
     static struct option longopt[] = {
         { "in", required_argument, 0, 'i' },
         { "skip-clean", no_argument, 0, 's' },
         { "json", no_argument, 0, 'j' },
         { "help", no_argument, 0, 'h' },
+        { "checkpoint", required_argument, 0, 'c' },
+        { "no-checkpoint", no_argument, 0, OPT_NO_CHECKPOINT },
+        { "rebuild", no_argument, 0, OPT_REBUILD },
         { 0, 0, 0, 0 }
     };
 
@@ -81,9 +376,11 @@ int main(int argc, char *argv[]) {
     optind = 0;
     opterr = 0;
 
-    std::string in_fname;
+    std::string in_fname, ckpt_fname;
     bool skipclean = false;
     bool outputjson = false;
+    bool use_checkpoint = true;
+    bool rebuild = false;
     nlohmann::json root;
 
     int sql_r = 0;
@@ -94,7 +391,7 @@ int main(int argc, char *argv[]) {
 
     while (1) {
         int r = getopt_long(argc, argv, 
-                            "-hi:sj", longopt, &option_idx);
+                            "-hi:sjc:", longopt, &option_idx);
         if (r < 0) break;
 
         if (r == 'h') {
@@ -106,6 +403,12 @@ int main(int argc, char *argv[]) {
             skipclean = true;
         } else if (r == 'j') {
             outputjson = true;
+        } else if (r == 'c') {
+            ckpt_fname = std::string(optarg);
+        } else if (r == OPT_NO_CHECKPOINT) {
+            use_checkpoint = false;
+        } else if (r == OPT_REBUILD) {
+            rebuild = true;
         }
     }
 
@@ -147,6 +450,35 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Records counted before cleaning may have been renumbered
+    if (!skipclean)
+        rebuild = true;
+
+    if (ckpt_fname == "")
+        ckpt_fname = in_fname + "-stats";
+
+    if (!use_checkpoint)
+        ckpt_fname = ":memory:";
+
+    sqlite3 *ckpt = nullptr;
+
+    try {
+        ckpt = open_checkpoint(ckpt_fname, rebuild);
+
+        // A log with fewer records than were counted was replaced or cleaned elsewhere
+        if (!rebuild && query_int64(db, "SELECT max(rowid) FROM packets") < 
+                query_int64(ckpt, "SELECT position FROM progress WHERE source = 'packets'")) {
+            fmt::print(stderr, "* Log '{}' has changed since it was counted, rebuilding "
+                    "statistics\n", in_fname);
+            sqlite3_close(ckpt);
+            ckpt = open_checkpoint(ckpt_fname, true);
+        }
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  {}\n", e.what());
+        sqlite3_close(db);
+        exit(1);
+    }
+
     // Use our sql adapters
 
     using namespace kissqlite3;
@@ -167,27 +499,96 @@ int main(int argc, char *argv[]) {
             fmt::print("\n");
         }
 
-        // Get the total counts
-        auto npackets_q = _SELECT(db, "packets", 
-                {"count(*), sum(case when (lat != 0 and lon != 0) then 1 else 0 end)"});
-        auto npackets_ret = npackets_q.run();
-        auto n_total_packets_db = sqlite3_column_as<unsigned long>(*npackets_ret, 0);
-        auto n_packets_with_loc = sqlite3_column_as<unsigned long>(*npackets_ret, 1);
+        // Count the records added since the last checkpoint
+        auto has_data = query_int64(db, "SELECT count(*) FROM sqlite_master WHERE "
+                "type = 'table' AND name = 'data'") != 0;
+
+        checkpoint_exec(ckpt, "BEGIN TRANSACTION");
+
+        auto n_new_packets = checkpoint_table(db, ckpt, "packets", "sum(packet_len)");
+        unsigned long n_new_data = 0;
+
+        if (has_data)
+            n_new_data = checkpoint_table(db, ckpt, "data", "0");
+
+        if (db_version >= 6)
+            checkpoint_tags(db, ckpt);
 
-        auto ndata_q = _SELECT(db, "data",
-                {"count(*), sum(case when(lat != 0 and lon != 0) then 1 else 0 end)"});
-        auto ndata_ret = ndata_q.run();
-        auto n_total_data_db = sqlite3_column_as<unsigned long>(*ndata_ret, 0);
-        auto n_data_with_loc = sqlite3_column_as<unsigned long>(*ndata_ret, 1);
+        checkpoint_breadcrumb(db, ckpt);
+
+        checkpoint_exec(ckpt, "COMMIT");
+
+        uint64_t n_total_packets_db = 0, n_packets_with_loc = 0, n_packet_bytes = 0;
+        uint64_t n_total_data_db = 0, n_data_with_loc = 0;
+
+        for (const auto& c : checkpoint_counts(ckpt, "packets", "source")) {
+            n_total_packets_db = std::get<1>(c);
+            n_packets_with_loc = std::get<2>(c);
+            n_packet_bytes = std::get<3>(c);
+        }
+
+        for (const auto& c : checkpoint_counts(ckpt, "data", "source")) {
+            n_total_data_db = std::get<1>(c);
+            n_data_with_loc = std::get<2>(c);
+        }
+
+        if (outputjson) {
+            root["checkpoint"] = use_checkpoint ? ckpt_fname : "";
+            root["new_packets"] = (uint64_t) n_new_packets;
+            root["new_data_packets"] = (uint64_t) n_new_data;
+            root["packet_bytes"] = n_packet_bytes;
+            root["packets_with_location"] = n_packets_with_loc;
+            root["data_with_location"] = n_data_with_loc;
+        } else if (use_checkpoint) {
+            fmt::print("  Checkpoint: {} ({} new packets, {} new data)\n", ckpt_fname,
+                    n_new_packets, n_new_data);
+        }
 
         if (outputjson) {
             root["packets"] = (uint64_t) n_total_packets_db;
             root["data_packets"] = (uint64_t) n_total_data_db;
         } else {
-            fmt::print("  Packets: {}\n", n_total_packets_db);
+            fmt::print("  Packets: {} ({} bytes)\n", n_total_packets_db, n_packet_bytes);
             fmt::print("  Non-packet data: {}\n", n_total_data_db);
             fmt::print("\n");
         }
+
+        // Packets and data by datasource, phy, and hour
+        for (const auto& source : {"packets", "data"}) {
+            auto by_source = nlohmann::json::object();
+            auto by_phy = nlohmann::json::object();
+            auto by_hour = nlohmann::json::array();
+
+            for (const auto& c : checkpoint_counts(ckpt, source, "datasource"))
+                by_source[std::get<0>(c)] = std::get<1>(c);
+
+            for (const auto& c : checkpoint_counts(ckpt, source, "phyname"))
+                by_phy[std::get<0>(c)] = std::get<1>(c);
+
+            for (const auto& c : checkpoint_counts(ckpt, source, "bucket")) {
+                nlohmann::json hour;
+                hour["time"] = std::stoull(std::get<0>(c)) * STATS_BUCKET_SECONDS;
+                hour["count"] = std::get<1>(c);
+                hour["with_location"] = std::get<2>(c);
+                hour["bytes"] = std::get<3>(c);
+                by_hour.push_back(hour);
+            }
+
+            if (outputjson) {
+                root[fmt::format("{}_by_datasource", source)] = by_source;
+                root[fmt::format("{}_by_phy", source)] = by_phy;
+                root[fmt::format("{}_by_hour", source)] = by_hour;
+            } else if (by_phy.size() != 0) {
+                fmt::print("  {} by phy:\n", source == std::string("packets") ? "Packets" : "Data");
+                for (const auto& p : by_phy.items())
+                    fmt::print("    {:<24} {}\n", p.key(), p.value().get<uint64_t>());
+                fmt::print("  {} by datasource:\n", source == std::string("packets") ? "Packets" : "Data");
+                for (const auto& p : by_source.items())
+                    fmt::print("    {:<36} {}\n", p.key(), p.value().get<uint64_t>());
+                fmt::print("  Hours with {}: {}\n", source, by_hour.size());
+                fmt::print("\n");
+            }
+        }
        
         auto ndevices_q = _SELECT(db, "devices", {"count(*)", "min(first_time)", "max(last_time)"});
         auto ndevices_ret = ndevices_q.run();
@@ -313,30 +714,15 @@ int main(int argc, char *argv[]) {
             fmt::print("\n");
         }
 
-        // Extract tags
+        // Tags are collected in the checkpoint
         std::map<std::string, bool> tag_map;
 
-        auto tags_q = _SELECT(db, "packets", 
-                              {"DISTINCT tags"},
-                              _WHERE("tags", NEQ, ""));
+        auto tags_stmt = checkpoint_prepare(ckpt, "SELECT tag FROM tags");
 
-        for (auto ti : tags_q) {
-            auto t = sqlite3_column_as<std::string>(ti, 0);
+        while (sqlite3_step(tags_stmt) == SQLITE_ROW)
+            tag_map[reinterpret_cast<const char *>(sqlite3_column_text(tags_stmt, 0))] = true;
 
-            while (t.size()) {
-                auto index = t.find(" ");
-                if (index != std::string::npos) {
-                    tag_map[t.substr(0, index)] = true;
-                    t = t.substr(index + 1);
-
-                    if (t.size() == 0)
-                        tag_map[t] = true;
-                } else {
-                    tag_map[t] = true;
-                    t = "";
-                }
-            }
-        }
+        sqlite3_finalize(tags_stmt);
 
         nlohmann::json tag_vec;
 
@@ -405,34 +791,13 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        auto breadcrumb_q = _SELECT(db, "snapshots",
-                {"lat", "lon"},
-                _WHERE("lat", NEQ, 0, 
-                    AND,
-                    "lon", NEQ, 0,
-                    AND,
-                    "snaptype", EQ, "GPS"));
-        double bc_cur_lat = 0, bc_cur_lon = 0, bc_last_lat = 0, bc_last_lon = 0;
+        // The breadcrumb distance is extended in the checkpoint
         double breadcrumb_len = 0;
 
-        for (auto bc : breadcrumb_q) {
-            if (bc_last_lat == 0 || bc_last_lon == 0) {
-                bc_last_lat = sqlite3_column_as<double>(bc, 0);
-                bc_last_lon = sqlite3_column_as<double>(bc, 1);
-                continue;
-            }
-
-            bc_cur_lat = sqlite3_column_as<double>(bc, 0);
-            bc_cur_lon = sqlite3_column_as<double>(bc, 1);
-
-            if (bc_cur_lat == bc_last_lat && bc_cur_lon == bc_last_lon)
-                continue;
-
-            breadcrumb_len += distance_meters(bc_cur_lat, bc_cur_lon, bc_last_lat, bc_last_lon);
-
-            bc_last_lat = bc_cur_lat;
-            bc_last_lon = bc_cur_lon;
-        }
+        auto bc_stmt = checkpoint_prepare(ckpt, "SELECT distance FROM breadcrumb");
+        if (sqlite3_step(bc_stmt) == SQLITE_ROW)
+            breadcrumb_len = sqlite3_column_double(bc_stmt, 0);
+        sqlite3_finalize(bc_stmt);
 
         if (outputjson) {
             root["breadcrumb_dist_meters"] = breadcrumb_len;
@@ -452,6 +817,9 @@ int main(int argc, char *argv[]) {
         exit(0);
     }
 
+    sqlite3_close(ckpt);
+    sqlite3_close(db);
+
     if (outputjson) {
         std::stringstream os;
 
@@ -0,0 +1,431 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Send the records of a kismetdb log to Elasticsearch or OpenSearch
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "elk_bulk.h"
+#include "fmt.h"
+#include "getopt.h"
+#include "kismetdb_device_record.h"
+#include "kismetdb_manifest.h"
+#include "nlohmann/json.hpp"
+#include "sqlite3_cpp11.h"
+
+void print_help(char *argv) {
+    printf("Kismetdb to ELK\n");
+    printf("Send the records of a KismetDB log to Elasticsearch or OpenSearch, using bulk\n"
+           "requests over several connections.\n");
+    printf("usage: %s [OPTION]\n", argv);
+    printf(" -i, --in [filename]          Input kismetdb file, or the manifest of a rolling\n"
+           "                              kismetdb log to read all of its files\n"
+           " -u, --url [url]              Cluster to send to, as http://host:port\n"
+           "     --index-prefix [prefix]  Records are sent to the [prefix]-[record type] index;\n"
+           "                              the default prefix is 'kismet'\n"
+           " -r, --records [types]        Comma separated record types to send, of devices,\n"
+           "                              alerts, data, snapshots, messages and packets; by\n"
+           "                              default devices and alerts\n"
+           "     --auth [user:password]   Basic authentication for the cluster\n"
+           "     --api-key [key]          API key for the cluster\n"
+           " -c, --connections [count]    Concurrent connections to the cluster (default 4)\n"
+           "     --batch-docs [count]     Records in each bulk request (default 2000)\n"
+           "     --no-gzip                Send bulk requests uncompressed\n"
+           " -v, --verbose                Verbose output\n"
+           "\n"
+           "Records are sent in the form of the Kismet ekjson serializer, with the periods in\n"
+           "field names replaced by underscores, and an @timestamp field.  A device replaces\n"
+           "the earlier document of the same device, so a log can be sent again as it grows.\n"
+           "Packets are sent without their content.\n"
+           "\n"
+           "Only plain HTTP is supported; a TLS cluster can be reached through a local proxy.\n"
+          );
+}
+
+// Sub-records which older logs wrote as 0 when they were empty, instead of leaving them out
+static const std::set<std::string> old_empty_trees = {
+    "kismet.device.base.location",
+    "kismet.device.base.datasize.rrd",
+    "kismet.device.base.location_cloud",
+    "kismet.device.base.packet.bin.250",
+    "kismet.device.base.packet.bin.500",
+    "kismet.device.base.packet.bin.1000",
+    "kismet.device.base.packet.bin.1500",
+    "kismet.device.base.packet.bin.jumbo",
+    "kismet.common.signal.signal_rrd",
+    "kismet.common.signal.peak_loc",
+    "dot11.client.location",
+    "client.location",
+    "dot11.client.ipdata",
+    "dot11.advertisedssid.location",
+    "dot11.probedssid.location",
+    "kismet.common.seenby.signal",
+};
+
+// Rename the fields of a record the way the ekjson serializer does, as ELK doesn't allow
+// periods in field names
+nlohmann::json elk_record(const nlohmann::json& in) {
+    if (in.is_array()) {
+        auto r = nlohmann::json::array();
+
+        for (const auto& v : in)
+            r.push_back(elk_record(v));
+
+        return r;
+    }
+
+    if (!in.is_object())
+        return in;
+
+    auto r = nlohmann::json::object();
+
+    for (const auto& kv : in.items()) {
+        if (kv.value().is_number() && kv.value() == 0 &&
+                old_empty_trees.find(kv.key()) != old_empty_trees.end())
+            continue;
+
+        auto k = kv.key();
+        std::replace(k.begin(), k.end(), '.', '_');
+
+        r[k] = elk_record(kv.value());
+    }
+
+    return r;
+}
+
+std::string elk_timestamp(uint64_t ts_sec, uint64_t ts_usec) {
+    time_t t = ts_sec;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+
+    char tmstr[32];
+    strftime(tmstr, sizeof(tmstr), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    return fmt::format("{}.{:03}Z", tmstr, ts_usec / 1000);
+}
+
+// Send the devices of a log, replacing the earlier document of each device
+unsigned long send_devices(sqlite3 *db, elk_bulk_client& bulk, const std::string& index) {
+    using namespace kissqlite3;
+
+    auto query = _SELECT(db, "devices", {"devkey", "phyname", "devmac", "last_time", "device"});
+
+    unsigned long n = 0;
+
+    for (auto d : query) {
+        auto devkey = sqlite3_column_as<std::string>(d, 0);
+
+        nlohmann::json record;
+
+        try {
+            record = elk_record(kismetdb_parse_device_record(sqlite3_column_as<std::string>(d, 4)));
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "WARNING:  Could not process device info for {}/{}, skipping: {}\n",
+                    sqlite3_column_as<std::string>(d, 2), sqlite3_column_as<std::string>(d, 1), e.what());
+            continue;
+        }
+
+        record["@timestamp"] = elk_timestamp(sqlite3_column_as<uint64_t>(d, 3), 0);
+
+        bulk.add(index, record.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace), devkey);
+
+        n++;
+    }
+
+    return n;
+}
+
+// Send the records of a table with a timestamp; the columns of a record are sent as
+// fields, its JSON as the 'record' field, and packet content is left out
+unsigned long send_table(sqlite3 *db, elk_bulk_client& bulk, const std::string& table,
+        const std::string& index) {
+    sqlite3_stmt *stmt = nullptr;
+
+    auto sql = fmt::format("SELECT * FROM {}", table);
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        fmt::print(stderr, "WARNING:  Could not read {} from log, skipping: {}\n", table, sqlite3_errmsg(db));
+        return 0;
+    }
+
+    unsigned long n = 0;
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        auto record = nlohmann::json::object();
+        uint64_t ts_sec = 0, ts_usec = 0;
+
+        for (int c = 0; c < sqlite3_column_count(stmt); c++) {
+            std::string name = sqlite3_column_name(stmt, c);
+
+            if (name == "ts_sec") {
+                ts_sec = sqlite3_column_int64(stmt, c);
+            } else if (name == "ts_usec") {
+                ts_usec = sqlite3_column_int64(stmt, c);
+            } else if (name == "packet") {
+                continue;
+            } else if (name == "json") {
+                auto text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, c));
+
+                if (text == nullptr)
+                    continue;
+
+                try {
+                    record["record"] = elk_record(nlohmann::json::parse(text));
+                } catch (const std::exception& e) {
+                    continue;
+                }
+            } else {
+                switch (sqlite3_column_type(stmt, c)) {
+                    case SQLITE_INTEGER:
+                        record[name] = sqlite3_column_int64(stmt, c);
+                        break;
+                    case SQLITE_FLOAT:
+                        record[name] = sqlite3_column_double(stmt, c);
+                        break;
+                    case SQLITE_TEXT:
+                        record[name] = reinterpret_cast<const char *>(sqlite3_column_text(stmt, c));
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        record["@timestamp"] = elk_timestamp(ts_sec, ts_usec);
+
+        bulk.add(index, record.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+
+        n++;
+    }
+
+    sqlite3_finalize(stmt);
+
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+#define OPT_INDEX_PREFIX        10
+#define OPT_AUTH                11
+#define OPT_API_KEY             12
+#define OPT_BATCH_DOCS          13
+#define OPT_NO_GZIP             14
+    static struct option longopt[] = {
+        { "in", required_argument, 0, 'i' },
+        { "url", required_argument, 0, 'u' },
+        { "records", required_argument, 0, 'r' },
+        { "connections", required_argument, 0, 'c' },
+        { "verbose", no_argument, 0, 'v' },
+        { "help", no_argument, 0, 'h' },
+        { "index-prefix", required_argument, 0, OPT_INDEX_PREFIX },
+        { "auth", required_argument, 0, OPT_AUTH },
+        { "api-key", required_argument, 0, OPT_API_KEY },
+        { "batch-docs", required_argument, 0, OPT_BATCH_DOCS },
+        { "no-gzip", no_argument, 0, OPT_NO_GZIP },
+        { 0, 0, 0, 0 }
+    };
+
+    int option_idx = 0;
+    optind = 0;
+    opterr = 0;
+
+    std::string in_fname;
+    std::string index_prefix = "kismet";
+    std::string records_opt = "devices,alerts";
+    bool verbose = false;
+
+    elk_bulk_config bulk_config;
+
+    bulk_config.error_cb = [](const std::string& error) {
+        fmt::print(stderr, "WARNING:  {}\n", error);
+    };
+
+    while (1) {
+        int r = getopt_long(argc, argv,
+                            "-hi:u:r:c:v",
+                            longopt, &option_idx);
+        if (r < 0) break;
+
+        if (r == 'h') {
+            print_help(argv[0]);
+            exit(1);
+        } else if (r == 'i') {
+            in_fname = std::string(optarg);
+        } else if (r == 'u') {
+            bulk_config.url = std::string(optarg);
+        } else if (r == 'r') {
+            records_opt = std::string(optarg);
+        } else if (r == 'c') {
+            if (sscanf(optarg, "%u", &bulk_config.connections) != 1 || bulk_config.connections == 0) {
+                fmt::print(stderr, "ERROR:  Expected a number of connections\n");
+                exit(1);
+            }
+        } else if (r == 'v') {
+            verbose = true;
+        } else if (r == OPT_INDEX_PREFIX) {
+            index_prefix = std::string(optarg);
+        } else if (r == OPT_AUTH) {
+            bulk_config.auth = std::string(optarg);
+        } else if (r == OPT_API_KEY) {
+            bulk_config.api_key = std::string(optarg);
+        } else if (r == OPT_BATCH_DOCS) {
+            unsigned long n;
+
+            if (sscanf(optarg, "%lu", &n) != 1 || n == 0) {
+                fmt::print(stderr, "ERROR:  Expected a number of records for --batch-docs\n");
+                exit(1);
+            }
+
+            bulk_config.batch_docs = n;
+        } else if (r == OPT_NO_GZIP) {
+            bulk_config.gzip_level = 0;
+        }
+    }
+
+    if (in_fname == "") {
+        fmt::print(stderr, "ERROR: Expected --in [kismetdb file]\n");
+        exit(1);
+    }
+
+    if (bulk_config.url == "") {
+        fmt::print(stderr, "ERROR: Expected --url [http://host:port]\n");
+        exit(1);
+    }
+
+    const std::vector<std::string> record_types =
+        {"devices", "alerts", "data", "snapshots", "messages", "packets"};
+    std::set<std::string> records;
+
+    size_t pos = 0;
+    while (pos <= records_opt.length()) {
+        auto end = records_opt.find(',', pos);
+        if (end == std::string::npos)
+            end = records_opt.length();
+
+        auto t = records_opt.substr(pos, end - pos);
+
+        if (t.length() > 0) {
+            if (std::find(record_types.begin(), record_types.end(), t) == record_types.end()) {
+                fmt::print(stderr, "ERROR:  Unknown record type '{}'\n", t);
+                exit(1);
+            }
+
+            records.insert(t);
+        }
+
+        pos = end + 1;
+    }
+
+    std::vector<std::string> in_files;
+
+    if (kismetdb_is_manifest(in_fname)) {
+        try {
+            for (const auto& e : kismetdb_read_manifest(in_fname))
+                in_files.push_back(kismetdb_manifest_file(in_fname, e));
+        } catch (const std::runtime_error& e) {
+            fmt::print(stderr, "ERROR:  {}\n", e.what());
+            exit(1);
+        }
+    } else {
+        in_files.push_back(in_fname);
+    }
+
+    elk_bulk_client bulk(bulk_config);
+
+    try {
+        bulk.start();
+    } catch (const std::runtime_error& e) {
+        fmt::print(stderr, "ERROR:  {}\n", e.what());
+        exit(1);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long n_total = 0;
+
+    for (const auto& in_file : in_files) {
+        struct stat statbuf;
+
+        if (stat(in_file.c_str(), &statbuf) < 0) {
+            fmt::print(stderr, "ERROR:  Unable to open input file '{}': {}\n", in_file,
+                    strerror(errno));
+            exit(1);
+        }
+
+        sqlite3 *db = nullptr;
+
+        if (sqlite3_open_v2(in_file.c_str(), &db, SQLITE_OPEN_READONLY, nullptr)) {
+            fmt::print(stderr, "ERROR:  Unable to open '{}': {}\n", in_file, sqlite3_errmsg(db));
+            exit(1);
+        }
+
+        // Types are sent in a fixed order, devices first
+        for (const auto& t : record_types) {
+            if (records.find(t) == records.end())
+                continue;
+
+            unsigned long n;
+
+            if (t == "devices")
+                n = send_devices(db, bulk, index_prefix + "-devices");
+            else
+                n = send_table(db, bulk, t, index_prefix + "-" + t);
+
+            if (verbose)
+                fmt::print(stderr, "* Queued {} {} from '{}'\n", n, t, in_file);
+
+            n_total += n;
+        }
+
+        sqlite3_close(db);
+    }
+
+    // Wait for the cluster to take everything, however long it backs off
+    bulk.flush();
+    bulk.stop();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    fmt::print(stderr, "* Sent {} records in {:.1f} seconds, {} indexed, {} failed, {} bulk "
+            "requests, {} retried\n", n_total, elapsed / 1000.0, bulk.get_docs_indexed(),
+            bulk.get_docs_failed(), bulk.get_batches_sent(), bulk.get_retries());
+
+    if (bulk.get_docs_failed() > 0)
+        return 1;
+
+    return 0;
+}
+
@@ -40,34 +40,49 @@
 #include <sqlite3.h>
 
 #include "getopt.h"
+#include "kismetdb_device_record.h"
 #include "nlohmann/json.hpp"
 #include "sqlite3_cpp11.h"
+#include "string_scan.h"
 #include "fmt.h"
 #include "packet_ieee80211.h"
 
 // Aggressive additional mangle of text to handle converting to hexcode for XML
 std::string MungeForXML(const std::string& in_data) {
 	std::string ret;
+    ret.reserve(in_data.length());
 
-	for (size_t i = 0; i < in_data.length(); i++) {
-        if (in_data[i] == '<') {
+    const auto data = in_data.data();
+    const auto len = in_data.length();
+    size_t i = 0;
+
+    while (true) {
+        // copy the run of printable text whole
+        const auto run = printable_span(data + i, len - i, "<>&\"'");
+        ret.append(data + i, run);
+        i += run;
+
+        if (i >= len)
+            break;
+
+        if (data[i] == '<') {
             ret += "&lt;";
-        } else if (in_data[i] == '>') {
+        } else if (data[i] == '>') {
             ret += "&gt;";
-        } else if (in_data[i] == '&') {
+        } else if (data[i] == '&') {
             ret += "&amp;";
-        } else if (in_data[i] == '"') { 
+        } else if (data[i] == '"') { 
             ret += "&quot;";
-        } else if (in_data[i] == '\'') {
+        } else if (data[i] == '\'') {
             ret += "&apos;";
-        } else if ((unsigned char) in_data[i] >= 32 && (unsigned char) in_data[i] <= 126) {
-			ret += in_data[i];
-		} else {
+        } else {
 			ret += '\\';
-			ret += ((in_data[i] >> 6) & 0x03) + '0';
-			ret += ((in_data[i] >> 3) & 0x07) + '0';
-			ret += ((in_data[i] >> 0) & 0x07) + '0';
+			ret += ((data[i] >> 6) & 0x03) + '0';
+			ret += ((data[i] >> 3) & 0x07) + '0';
+			ret += ((data[i] >> 0) & 0x07) + '0';
 		}
+
+        i++;
 	}
 
 	return ret;
@@ -322,6 +337,9 @@ int main(int argc, char *argv[]) {
 
     using namespace kissqlite3;
 
+    // The packet and data queries are run once per device
+    stmt_cache stmts(db);
+
     int db_version = 0;
     long int n_total_packets_db = 0L;
     long int n_packets_db = 0L;
@@ -455,10 +473,10 @@ int main(int argc, char *argv[]) {
             }
 
             nlohmann::json json;
-            std::stringstream ss(sqlite3_column_as<std::string>(d, 6));
+            auto record = sqlite3_column_as<std::string>(d, 6);
 
             try {
-                ss >> json;
+                json = kismetdb_parse_device_record(record);
 
                 if (avg_lat == 0 || avg_lon == 0)
                     continue;
@@ -495,12 +513,12 @@ int main(int argc, char *argv[]) {
             auto devmac = sqlite3_column_as<std::string>(d, 1);
             nlohmann::json json;
 
-            std::stringstream ss(sqlite3_column_as<std::string>(d, 2));
+            auto record = sqlite3_column_as<std::string>(d, 2);
 
             gpx_waypoint pl;
 
             try {
-                ss >> json;
+                json = kismetdb_parse_device_record(record);
                 pl.name = json["kismet.device.base.commonname"].get<std::string>();
             } catch (const std::exception& e) {
                 fmt::print(stderr, "WARNING:  Could not process device info for '{}', skipping\n", json.dump());
@@ -515,6 +533,7 @@ int main(int argc, char *argv[]) {
 
             auto packet_q = _SELECT(db, "packets", packet_fields,
                     _WHERE("sourcemac", EQ, devmac, AND, "phyname", EQ, phyname, AND, "lat", NEQ, 0, AND, "lon", NEQ, 0));
+            packet_q.cached(stmts);
 
             for (auto p : packet_q) {
                 double lat, lon, alt;
@@ -558,6 +577,7 @@ int main(int argc, char *argv[]) {
 
             auto data_q = _SELECT(db, "data", packet_fields,
                     _WHERE("devmac", EQ, devmac, AND, "phyname", EQ, phyname, AND, "lat", NEQ, 0, AND, "lon", NEQ, 0));
+            data_q.cached(stmts);
 
             for (auto p : data_q) {
                 double lat, lon, alt;
@@ -657,6 +677,7 @@ int main(int argc, char *argv[]) {
         fclose(ofile);
     }
 
+    stmts.clear();
     sqlite3_close(db);
 
     return 0;
@@ -24,10 +24,14 @@
 #include "config.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <iomanip>
 #include <ctime>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <tuple>
 #include <string>
 
@@ -45,6 +49,9 @@
 #include "endian_magic.h"
 #include "fmt.h"
 #include "getopt.h"
+#include "kismetdb_codec.h"
+#include "kismetdb_manifest.h"
+#include "kismetdb_segments.h"
 #include "nlohmann/json.hpp"
 #include "packet_ieee80211.h"
 #include "pcapng.h"
@@ -59,6 +66,10 @@ extern "C" {
 #endif
 }
 
+// Output files are written through a large buffer, so packets are written in few large
+// writes instead of two small writes each
+#define OUTPUT_BUFFER_SZ        (1024 * 1024)
+
 size_t PAD_TO_32BIT(size_t in) {
     while (in % 4) in++;
     return in;
@@ -197,6 +208,8 @@ FILE *open_pcap_file(const std::string& path, bool force, unsigned int dlt) {
                         path, strerror(errno), errno));
     }
 
+    setvbuf(pcap_file, nullptr, _IOFBF, OUTPUT_BUFFER_SZ);
+
     pcap_hdr_t pcap_hdr {
         .magic_number = PCAP_MAGIC,
         .version_major = PCAP_VERSION_MAJOR,
@@ -268,6 +281,8 @@ FILE *open_pcapng_file(const std::string& path, bool force) {
                         path, strerror(errno), errno));
     }
 
+    setvbuf(pcapng_file, nullptr, _IOFBF, OUTPUT_BUFFER_SZ);
+
     std::string app = fmt::format("Kismet kismetdb_to_pcapng {}-{}-{} {}",
             VERSION_MAJOR, VERSION_MINOR, VERSION_TINY, VERSION_GIT_COMMIT);
 
@@ -629,12 +644,426 @@ void write_pcapng_packet(FILE *pcapng_file, const std::string& packet,
 }
     
 
+// Settings of an extraction, shared by every thread of a parallel extraction
+struct extract_config {
+    std::string out_fname;
+    bool verbose;
+    bool force;
+    bool pcapng;
+    bool skip_gps;
+    bool skip_gps_track;
+    bool split_interface;
+    unsigned int split_packets;
+    unsigned int split_size;
+    int dlt;
+    std::map<std::string, bool> tag_filter_map;
+
+    // Range of packet times to extract, 0 for no limit
+    unsigned long since;
+    unsigned long until;
+
+    std::vector<std::shared_ptr<db_interface>> interface_vec;
+};
+
+// Files written by an extraction; each thread of a parallel extraction writes its own
+class extract_output {
+public:
+    extract_output() :
+        single_log{std::make_shared<log_file>()} { }
+
+    ~extract_output() {
+        close();
+    }
+
+    void close() {
+        if (single_log->file != nullptr) {
+            fflush(single_log->file);
+            fclose(single_log->file);
+            single_log->file = nullptr;
+        }
+
+        for (const auto& l : per_interface_logs) {
+            if (l.second->file != nullptr) {
+                fflush(l.second->file);
+                fclose(l.second->file);
+                l.second->file = nullptr;
+            }
+        }
+    }
+
+    std::map<std::string, std::shared_ptr<log_file>> per_interface_logs;
+    std::shared_ptr<log_file> single_log;
+};
+
+// Packets written by every thread, reported about once a second in verbose mode
+class extract_progress {
+public:
+    extract_progress(bool verbose, unsigned long total) :
+        verbose{verbose},
+        total{total},
+        packets{0},
+        bytes{0},
+        start{std::chrono::steady_clock::now()},
+        last_report{start} { }
+
+    void add(size_t in_bytes) {
+        auto n = ++packets;
+        bytes += in_bytes;
+
+        if (!verbose || (n % 10000) != 0)
+            return;
+
+        std::lock_guard<std::mutex> lk(mutex);
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - last_report < std::chrono::seconds(1))
+            return;
+
+        last_report = now;
+
+        if (total != 0)
+            fmt::print(stderr, "* Extracted {} of {} packets ({:.1f}%), {}\n",
+                    n, total, (double) n * 100 / total, rate(now));
+        else
+            fmt::print(stderr, "* Extracted {} packets, {}\n", n, rate(now));
+    }
+
+    void summary() {
+        auto now = std::chrono::steady_clock::now();
+
+        fmt::print(stderr, "* Extracted {} packets in {:.1f} seconds, {}\n", packets.load(),
+                std::chrono::duration<double>(now - start).count(), rate(now));
+    }
+
+protected:
+    std::string rate(std::chrono::steady_clock::time_point now) {
+        auto elapsed = std::chrono::duration<double>(now - start).count();
+
+        if (elapsed <= 0)
+            elapsed = 1;
+
+        return fmt::format("{:.1f}MB ({:.1f}MB/s, {:.0f} packets/s)",
+                (double) bytes / (1024 * 1024), (double) bytes / (1024 * 1024) / elapsed,
+                packets / elapsed);
+    }
+
+    bool verbose;
+    unsigned long total;
+
+    std::atomic<unsigned long> packets;
+    std::atomic<unsigned long> bytes;
+
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last_report;
+};
+
+// Extract the packets of a log file matching a filter into the output files, merged with
+// the GPS track when writing a single pcapng file; throws std::runtime_error
+void extract_log(sqlite3 *db, const std::string& in_file, int db_version,
+        const std::list<kissqlite3::query_element>& packet_filter_q,
+        const extract_config& cfg, extract_output& output, extract_progress& progress) {
+    using namespace kissqlite3;
+
+    std::list<std::string> packet_fields;
+    if (db_version < 6) {
+        packet_fields = 
+            std::list<std::string>{"ts_sec", "ts_usec", "dlt", "datasource", "packet", "lat", "lon", "alt"};
+    } else if (db_version < 9) {
+        packet_fields = 
+            std::list<std::string>{"ts_sec", "ts_usec", "dlt", "datasource", "packet", "lat", "lon", "alt", "tags"};
+    } else if (db_version < 10) {
+        packet_fields = 
+            std::list<std::string>{"ts_sec", "ts_usec", "dlt", "datasource", "packet", "lat", "lon", "alt", "tags",
+                "segment", "segment_offset", "packet_len"};
+    } else {
+        packet_fields = 
+            std::list<std::string>{"ts_sec", "ts_usec", "dlt", "datasource", "packet", "lat", "lon", "alt", "tags",
+                "segment", "segment_offset", "packet_len", "codec", "codec_dict", "stored_len"};
+    }
+
+    // Packets logged to segment files are read from the mapped segments
+    kismetdb_segment_reader segment_reader(in_file);
+
+    // Compressed packets are decoded with the dictionaries saved in the log
+    kismetdb_packet_decompressor decompressor;
+
+    if (db_version >= 10) {
+        auto dict_q = _SELECT(db, "packet_dictionaries", {"id", "dictionary"});
+
+        for (auto d : dict_q)
+            decompressor.add_dictionary(sqlite3_column_as<unsigned int>(d, 0),
+                    sqlite3_column_as<std::string>(d, 1));
+    }
+
+    auto packets_q = _SELECT(db, "packets", 
+            packet_fields,
+            packet_filter_q);
+
+    if (cfg.tag_filter_map.size() != 0) {
+        for (auto ti : cfg.tag_filter_map) {
+            packets_q.append_where(AND, _WHERE("tags", LIKE, fmt::format("%{}%", ti.first)));
+        }
+    }
+
+    auto gps_q = _SELECT(db, "snapshots",
+            {"ts_sec", "ts_usec", "json"},
+            _WHERE("snaptype", EQ, "GPS"));
+
+    if (cfg.since != 0)
+        gps_q.append_where(AND, _WHERE("ts_sec", GE, cfg.since));
+
+    if (cfg.until != 0)
+        gps_q.append_where(AND, _WHERE("ts_sec", LE, cfg.until));
+
+    // The GPS track is only written to a single pcapng file
+    bool gps_track = cfg.pcapng && !cfg.split_interface && !cfg.skip_gps_track;
+
+    auto pkt = packets_q.begin();
+    auto gps = gps_track ? gps_q.begin() : gps_q.end();
+
+    uint64_t pkt_time = 0, pkt_time_us = 0;
+    uint64_t gps_time = 0, gps_time_us = 0;
+
+    while (pkt != packets_q.end() || gps != gps_q.end()) {
+        if (pkt_time == 0 && pkt != packets_q.end()) {
+            pkt_time = sqlite3_column_as<unsigned long>(*pkt, 0);
+            pkt_time_us = sqlite3_column_as<unsigned long>(*pkt, 1);
+        }
+
+        if (gps_time == 0 && gps != gps_q.end()) {
+            gps_time = sqlite3_column_as<unsigned long>(*gps, 0);
+            gps_time_us = sqlite3_column_as<unsigned long>(*gps, 1);
+        }
+
+        if (pkt_time != 0 && (gps_time == 0 || (pkt_time < gps_time || 
+                        ((pkt_time == gps_time && pkt_time_us < gps_time_us))))) {
+            auto ts_sec = sqlite3_column_as<unsigned long>(*pkt, 0);
+            auto ts_usec = sqlite3_column_as<unsigned long>(*pkt, 1);
+            auto pkt_dlt = sqlite3_column_as<unsigned int>(*pkt, 2);
+            auto datasource = sqlite3_column_as<std::string>(*pkt, 3);
+            std::string bytes;
+
+            if (db_version >= 9 && sqlite3_column_type((*pkt).get(), 9) != SQLITE_NULL)
+                bytes = segment_reader.read(sqlite3_column_as<unsigned int>(*pkt, 9),
+                        sqlite3_column_as<unsigned long>(*pkt, 10),
+                        sqlite3_column_as<unsigned long>(*pkt, db_version >= 10 ? 14 : 11));
+            else
+                bytes = sqlite3_column_as<std::string>(*pkt, 4);
+
+            if (db_version >= 10 && sqlite3_column_as<int>(*pkt, 12) != KISMETDB_CODEC_RAW)
+                bytes = decompressor.decompress(sqlite3_column_as<int>(*pkt, 12),
+                        sqlite3_column_as<unsigned int>(*pkt, 13), bytes,
+                        sqlite3_column_as<unsigned long>(*pkt, 11));
+
+            auto lat = sqlite3_column_as<double>(*pkt, 5);
+            auto lon = sqlite3_column_as<double>(*pkt, 6);
+            auto alt = sqlite3_column_as<double>(*pkt, 7);
+
+            std::string tags;
+
+            if (db_version >= 6)
+                tags = sqlite3_column_as<std::string>(*pkt, 8);
+
+            std::shared_ptr<log_file> log_interface;
+
+            if (cfg.split_interface) {
+                auto log_index = output.per_interface_logs.find(datasource);
+
+                if (log_index == output.per_interface_logs.end()) {
+                    log_interface = std::make_shared<log_file>();
+                    output.per_interface_logs[datasource] = log_interface;
+                } else {
+                    log_interface = log_index->second;
+                }
+
+            } else {
+                log_interface = output.single_log;
+            }
+
+            if (log_interface->file == nullptr) {
+                int file_dlt = cfg.dlt;
+
+                if (file_dlt < 0)
+                    file_dlt = pkt_dlt;
+
+                auto fname = cfg.out_fname;
+
+                if (cfg.split_interface)
+                    fname = fmt::format("{}-{}", fname, datasource);
+
+                if (cfg.split_packets || cfg.split_size) {
+                    fname = fmt::format("{}-{:06}", fname, log_interface->number);
+                    log_interface->number++;
+                }
+
+                if (cfg.verbose)
+                    fmt::print(stderr, "* Opening {} file {}\n", 
+                            cfg.pcapng ? "pcapng" : "legacy pcap", fname);
+
+                log_interface->name = fname;
+
+                try {
+                    if (cfg.pcapng)
+                        log_interface->file = open_pcapng_file(fname, cfg.force);
+                    else
+                        log_interface->file = open_pcap_file(fname, cfg.force, file_dlt);
+                } catch (const std::runtime_error& e) {
+                    fmt::print(stderr, "ERROR: Couldn't open {} for writing ({})\n",
+                               log_interface->name, e.what());
+                    return;
+                }
+            }
+
+            if (!cfg.pcapng) {
+                write_pcap_packet(log_interface->file, bytes, ts_sec, ts_usec);
+            } else {
+                auto source_combo = fmt::format("{}-{}", datasource, pkt_dlt);
+                auto source_key = log_interface->ng_interface_map.find(source_combo);
+                unsigned int ngindex = 0;
+
+                if (source_key == log_interface->ng_interface_map.end()) {
+                    for (auto dbi : cfg.interface_vec) {
+                        if (dbi->uuid == datasource) {
+                            auto desc = fmt::format("Kismet datasource {} ({} - {})",
+                                    dbi->name, dbi->interface, dbi->definition);
+                            ngindex = log_interface->ng_interface_map.size();
+
+                            log_interface->ng_interface_map[source_combo] = ngindex;
+
+                            write_pcapng_interface(log_interface->file, ngindex,
+                                    dbi->interface, pkt_dlt, desc);
+
+                            break;
+                        }
+                    }
+                } else {
+                    ngindex = source_key->second;
+                }
+
+                if (cfg.skip_gps) {
+                    lat = 0;
+                    lon = 0;
+                    alt = 0;
+                }
+
+                write_pcapng_packet(log_interface->file, bytes, ts_sec, ts_usec, tags, ngindex,
+                        lat, lon, alt);
+            }
+
+            log_interface->sz += bytes.size();
+            log_interface->count++;
+
+            progress.add(bytes.size());
+
+            if (cfg.split_packets && log_interface->count >= cfg.split_packets) {
+                if (cfg.verbose)
+                    fmt::print(stderr, "* Closing {} file {} after {} packets\n",
+                            cfg.pcapng ? "pcapng" : "pcap", log_interface->name, log_interface->count);
+
+                fclose(log_interface->file);
+                log_interface->file = nullptr;
+                log_interface->count = 0;
+            } else if (cfg.split_size && log_interface->sz >= cfg.split_size * 1024) {
+                if (cfg.verbose)
+                    fmt::print(stderr, "* Closing {} file {} after {}kb\n",
+                            cfg.pcapng ? "pcapng" : "pcap", log_interface->name, log_interface->sz / 1024);
+                fclose(log_interface->file);
+                log_interface->file = nullptr;
+                log_interface->sz = 0;
+            }
+
+            // Advance the packet counter and reset its time
+            ++pkt;
+
+            pkt_time = 0;
+            pkt_time_us = 0;
+        } else if (gps_time != 0) {
+            auto ts_sec = sqlite3_column_as<unsigned long>(*gps, 0);
+            auto ts_usec = sqlite3_column_as<unsigned long>(*gps, 1);
+
+            nlohmann::json json;
+            std::stringstream ss(sqlite3_column_as<std::string>(*gps, 2));
+
+            try {
+                ss >> json;
+
+                auto alt = json["kismet.gps.last_location"].value("kismet.common.location.alt", (double) 0);
+                auto lat = json["kismet.gps.last_location"]["kismet.common.location.geopoint"][1].get<double>();
+                auto lon = json["kismet.gps.last_location"]["kismet.common.location.geopoint"][0].get<double>();
+
+                if (lat != 0 && lon != 0) {
+                    auto single_log = output.single_log;
+
+                    try {
+                        if (single_log->file == nullptr) {
+                            auto fname = cfg.out_fname;
+
+                            if (cfg.verbose)
+                                fmt::print(stderr, "* Opening pcapng file {}\n", fname);
+
+                            single_log->name = fname;
+                            single_log->file = open_pcapng_file(fname, cfg.force);
+                        }
+                    } catch (const std::runtime_error& e) {
+                        fmt::print(stderr, "ERROR: Couldn't open {} for writing ({})\n",
+                                single_log->name, e.what());
+                        return;
+                    }
+
+                    write_pcapng_gps(single_log->file, ts_sec, ts_usec, lat, lon, alt);
+                }
+            } catch (const std::exception& e) {
+                fmt::print(stderr, "WARNING: Could not process GPS JSON, skipping ({})\n", e.what());
+            }
+
+            // Advance and reset the gps query
+            ++gps;
+
+            gps_time = 0;
+            gps_time_us = 0;
+        }
+    }
+}
+
+// Parse a --since or --until time, as seconds since the epoch or a local date and time
+bool parse_time_arg(const char *arg, unsigned long& ret_time) {
+    char extra;
+
+    if (sscanf(arg, "%lu%c", &ret_time, &extra) == 1)
+        return true;
+
+    for (auto f : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(struct tm));
+
+        auto end = strptime(arg, f, &tm);
+
+        if (end == nullptr || *end != 0)
+            continue;
+
+        tm.tm_isdst = -1;
+
+        auto t = mktime(&tm);
+
+        if (t < 0)
+            return false;
+
+        ret_time = t;
+        return true;
+    }
+
+    return false;
+}
+
 void print_help(char *argv) {
     printf("Kismetdb to pcap\n");
     printf("Convert packet data from KismetDB logs to standard pcap or pcapng logs for use in\n"
            "tools like Wireshark and tcpdump\n");
     printf("usage: %s [OPTION]\n", argv);
-    printf(" -i, --in [filename]            Input kismetdb file\n"
+    printf(" -i, --in [filename]            Input kismetdb file, or the manifest of a rolling\n"
+           "                                kismetdb log to read all of its files\n"
            " -o, --out [filename]           Output file name\n"
            " -f, --force                    Overwrite any existing output files\n"
            " -v, --verbose                  Verbose output\n"
@@ -660,6 +1089,11 @@ void print_help(char *argv) {
            "                                via the Kismet PEN custom fields\n"
            "     --skip-gps-track           When generating pcapng logs, don't include GPS movement\n"
            "                                track information\n"
+           "     --since [time]             Only export packets seen at or after a time, in seconds\n"
+           "                                since the epoch or as 'YYYY-MM-DD HH:MM:SS' local time\n"
+           "     --until [time]             Only export packets seen at or before a time\n"
+           "     --threads [num]            When splitting output by datasource, extract datasources\n"
+           "                                in parallel with [num] threads\n"
            "\n"
            "When splitting output by datasource, the file will be named [outname]-[datasource-uuid].\n"
            "\n"
@@ -671,6 +1105,10 @@ void print_help(char *argv) {
            "\n"
            "When splitting by both datasource and count or size, the files will be named \n"
            "[outname]-[datasource-uuid]-0001, and so on.\n"
+           "\n"
+           "Time ranges are found with the packet time index of the log; when the log has no\n"
+           "index, it is indexed first, unless --skip-clean was given, which reads the log\n"
+           "without changing it.\n"
           );
 }
 
@@ -686,6 +1124,9 @@ int main(int argc, char *argv[]) {
 #define OPT_SKIP_GPSTRACK       9
 #define OPT_LIST_TAGS           10
 #define OPT_FILTER_TAG          11
+#define OPT_SINCE               12
+#define OPT_UNTIL               13
+#define OPT_THREADS             14
     static struct option longopt[] = {
         { "in", required_argument, 0, 'i' },
         { "out", required_argument, 0, 'o' },
@@ -704,6 +1145,9 @@ int main(int argc, char *argv[]) {
         { "dlt", required_argument, 0, OPT_DLT },
         { "skip-gps", no_argument, 0, OPT_SKIP_GPS },
         { "skip-gps-track", no_argument, 0, OPT_SKIP_GPSTRACK },
+        { "since", required_argument, 0, OPT_SINCE },
+        { "until", required_argument, 0, OPT_UNTIL },
+        { "threads", required_argument, 0, OPT_THREADS },
         { 0, 0, 0, 0 }
     };
 
@@ -726,6 +1170,9 @@ int main(int argc, char *argv[]) {
     std::vector<std::string> raw_interface_vec;
     int dlt = -1;
     std::map<std::string, bool> tag_filter_map;
+    unsigned long since = 0;
+    unsigned long until = 0;
+    unsigned int threads = 1;
 
     int sql_r = 0;
     char *sql_errmsg = NULL;
@@ -735,10 +1182,6 @@ int main(int argc, char *argv[]) {
     std::vector<std::shared_ptr<db_interface>> interface_vec;
     std::vector<std::shared_ptr<db_interface>> logging_interface_vec;
 
-    // Log states
-    std::map<std::string, std::shared_ptr<log_file>> per_interface_logs;
-    std::shared_ptr<log_file> single_log = std::make_shared<log_file>();
-
     struct stat statbuf;
 
     while (1) {
@@ -798,6 +1241,17 @@ int main(int argc, char *argv[]) {
         } else if (r == OPT_SKIP_GPSTRACK) {
             fmt::print(stderr, "Skipping GPS movement/track data\n");
             skip_gps_track = true;
+        } else if (r == OPT_SINCE || r == OPT_UNTIL) {
+            if (!parse_time_arg(optarg, r == OPT_SINCE ? since : until)) {
+                fmt::print(stderr, "ERROR:  Expected --{} [seconds since epoch] or "
+                        "[YYYY-MM-DD HH:MM:SS]\n", r == OPT_SINCE ? "since" : "until");
+                exit(1);
+            }
+        } else if (r == OPT_THREADS) {
+            if (sscanf(optarg, "%u", &threads) != 1 || threads == 0) {
+                fmt::print(stderr, "ERROR:  Expected --threads [number]\n");
+                exit(1);
+            }
         }
     }
 
@@ -817,6 +1271,17 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    if (threads > 1 && !split_interface) {
+        fmt::print(stderr, "ERROR: --threads extracts datasources in parallel, and needs\n"
+                           "       --split-datasource.\n");
+        exit(1);
+    }
+
+    if (since != 0 && until != 0 && since > until) {
+        fmt::print(stderr, "ERROR: --since must not be after --until\n");
+        exit(1);
+    }
+
     if ((split_packets || split_size) && out_fname == "-") {
         fmt::print(stderr, "ERROR: Cannot split by packets or size when outputting to stdout\n");
         exit(1);
@@ -832,126 +1297,172 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    /* Open the database and run the vacuum command to clean up any stray journals */
-    if (!skipclean)
-        sql_r = sqlite3_open(in_fname.c_str(), &db);
-    else
-        sql_r = sqlite3_open_v2(in_fname.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+    // A rolling log is read file by file, in the order it was written
+    std::vector<std::string> in_files;
 
-    if (sql_r) {
-        fmt::print(stderr, "ERROR:  Unable to open '{}': {}\n", in_fname, sqlite3_errmsg(db));
-        exit(1);
-    }
-
-    if (!skipclean) {
-        if (verbose)
-            fmt::print(stderr, "* Preparing input database '{}'...\n", in_fname);
-
-        sql_r = sqlite3_exec(db, "VACUUM;", NULL, NULL, &sql_errmsg);
-
-        if (sql_r != SQLITE_OK) {
-            fmt::print(stderr, "ERROR:  Unable to clean up (vacuum) database before copying: {}\n", 
-                    sql_errmsg);
-            sqlite3_close(db);
+    if (kismetdb_is_manifest(in_fname)) {
+        try {
+            for (const auto& e : kismetdb_read_manifest(in_fname))
+                in_files.push_back(kismetdb_manifest_file(in_fname, e));
+        } catch (const std::runtime_error& e) {
+            fmt::print(stderr, "ERROR:  {}\n", e.what());
             exit(1);
         }
+
+        if (verbose)
+            fmt::print(stderr, "* Found {} kismetdb files in manifest '{}'\n", in_files.size(), in_fname);
+    } else {
+        in_files.push_back(in_fname);
     }
 
     using namespace kissqlite3;
 
-    int db_version = 0;
+    std::vector<std::tuple<std::string, sqlite3 *, int>> in_dbs;
+    bool data_warned = false;
+
+    for (const auto& in_file : in_files) {
+        /* Open the database and run the vacuum command to clean up any stray journals */
+        if (!skipclean)
+            sql_r = sqlite3_open(in_file.c_str(), &db);
+        else
+            sql_r = sqlite3_open_v2(in_file.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
 
-    try {
-        // Get the version
-        auto version_query = _SELECT(db, "KISMET", {"db_version"});
-        auto version_ret = version_query.begin();
-        if (version_ret == version_query.end()) {
-            fmt::print(stderr, "ERROR:  Unable to fetch database version.\n");
-            sqlite3_close(db);
+        if (sql_r) {
+            fmt::print(stderr, "ERROR:  Unable to open '{}': {}\n", in_file, sqlite3_errmsg(db));
             exit(1);
         }
-        db_version = sqlite3_column_as<int>(*version_ret, 0);
 
-        if (verbose)
-            fmt::print(stderr, "* Found KismetDB version {}\n", db_version);
+        if (!skipclean) {
+            if (verbose)
+                fmt::print(stderr, "* Preparing input database '{}'...\n", in_file);
 
-    } catch (const std::exception& e) {
-        fmt::print(stderr, "ERROR:  Could not get database information from '{}': {}\n", in_fname, e.what());
-        exit(0);
-    }
+            sql_r = sqlite3_exec(db, "VACUUM;", NULL, NULL, &sql_errmsg);
 
-    if (verbose) {
-        try {
-            auto data_q = _SELECT(db, "data", {"ts_sec"}, LIMIT, 1);
-            if (data_q.begin() != data_q.end()) {
-                fmt::print(stderr, "WARNING: KismetDB log contains non-packet data logs from datasources\n"
-                        "which do not support traditional pcap, they will not currently be included\n"
-                        "in the generated pcap file.\n");
+            if (sql_r != SQLITE_OK) {
+                fmt::print(stderr, "ERROR:  Unable to clean up (vacuum) database before copying: {}\n", 
+                        sql_errmsg);
+                sqlite3_close(db);
+                exit(1);
             }
-        } catch (...) {
-
         }
-    }
 
-    try {
-        if (verbose)
-            fmt::print(stderr, "* Collecting info about datasources...\n");
-
-        auto interface_query = _SELECT(db, "datasources", 
-                {"uuid", "typestring", "definition", "name", "interface"});
-     
-        for (auto q : interface_query) {
-            auto dbsource = std::make_shared<db_interface>();
-            dbsource->uuid = sqlite3_column_as<std::string>(q, 0);
-            dbsource->typestring = sqlite3_column_as<std::string>(q, 1);
-            dbsource->definition = sqlite3_column_as<std::string>(q, 2);
-            dbsource->name = sqlite3_column_as<std::string>(q, 3);
-            dbsource->interface = sqlite3_column_as<std::string>(q, 4);
-
-            // Get the total counts
-            auto npackets_q = _SELECT(db, "packets", 
-                    {"count(*)"}, 
-                    _WHERE("datasource", EQ, dbsource->uuid));
-            auto npackets_ret = npackets_q.begin();
-            if (npackets_ret == npackets_q.end()) {
-                fmt::print(stderr, "ERROR:  Unable to fetch packet count for datasource {} {} ({}).\n",
-                        dbsource->uuid, dbsource->name, dbsource->interface);
+        int db_version = 0;
+
+        try {
+            // Get the version
+            auto version_query = _SELECT(db, "KISMET", {"db_version"});
+            auto version_ret = version_query.begin();
+            if (version_ret == version_query.end()) {
+                fmt::print(stderr, "ERROR:  Unable to fetch database version.\n");
                 sqlite3_close(db);
                 exit(1);
             }
-            dbsource->num_packets = sqlite3_column_as<unsigned long>(*npackets_ret, 0);
+            db_version = sqlite3_column_as<int>(*version_ret, 0);
 
-            dbsource->dlts = get_dlts_per_datasouce(db, dbsource->uuid);
+            if (verbose)
+                fmt::print(stderr, "* Found KismetDB version {}\n", db_version);
 
-            interface_vec.push_back(dbsource);
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "ERROR:  Could not get database information from '{}': {}\n", in_file, e.what());
+            exit(0);
         }
 
-    } catch (const std::exception& e) {
-        fmt::print(stderr, "ERROR:  Could not get datasources from '{}': {}\n", in_fname, e.what());
-        exit(0);
+        if (verbose && !data_warned) {
+            try {
+                auto data_q = _SELECT(db, "data", {"ts_sec"}, LIMIT, 1);
+                if (data_q.begin() != data_q.end()) {
+                    fmt::print(stderr, "WARNING: KismetDB log contains non-packet data logs from datasources\n"
+                            "which do not support traditional pcap, they will not currently be included\n"
+                            "in the generated pcap file.\n");
+                    data_warned = true;
+                }
+            } catch (...) {
+
+            }
+        }
+
+        try {
+            if (verbose)
+                fmt::print(stderr, "* Collecting info about datasources...\n");
+
+            auto interface_query = _SELECT(db, "datasources", 
+                    {"uuid", "typestring", "definition", "name", "interface"});
+         
+            for (auto q : interface_query) {
+                auto uuid = sqlite3_column_as<std::string>(q, 0);
+
+                // Datasources are repeated in each file of a rolling log
+                std::shared_ptr<db_interface> dbsource;
+
+                for (auto i : interface_vec) {
+                    if (i->uuid == uuid) {
+                        dbsource = i;
+                        break;
+                    }
+                }
+
+                if (dbsource == nullptr) {
+                    dbsource = std::make_shared<db_interface>();
+                    dbsource->uuid = uuid;
+                    dbsource->typestring = sqlite3_column_as<std::string>(q, 1);
+                    dbsource->definition = sqlite3_column_as<std::string>(q, 2);
+                    dbsource->name = sqlite3_column_as<std::string>(q, 3);
+                    dbsource->interface = sqlite3_column_as<std::string>(q, 4);
+                    dbsource->num_packets = 0;
+
+                    interface_vec.push_back(dbsource);
+                }
+
+                // Get the total counts
+                auto npackets_q = _SELECT(db, "packets", 
+                        {"count(*)"}, 
+                        _WHERE("datasource", EQ, dbsource->uuid));
+                auto npackets_ret = npackets_q.begin();
+                if (npackets_ret == npackets_q.end()) {
+                    fmt::print(stderr, "ERROR:  Unable to fetch packet count for datasource {} {} ({}).\n",
+                            dbsource->uuid, dbsource->name, dbsource->interface);
+                    sqlite3_close(db);
+                    exit(1);
+                }
+                dbsource->num_packets += sqlite3_column_as<unsigned long>(*npackets_ret, 0);
+
+                for (auto d : get_dlts_per_datasouce(db, dbsource->uuid)) {
+                    if (std::find(dbsource->dlts.begin(), dbsource->dlts.end(), d) == dbsource->dlts.end())
+                        dbsource->dlts.push_back(d);
+                }
+            }
+
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "ERROR:  Could not get datasources from '{}': {}\n", in_file, e.what());
+            exit(0);
+        }
+
+        in_dbs.push_back(std::make_tuple(in_file, db, db_version));
     }
 
     if (list_tags) {
         std::map<std::string, bool> tag_map;
 
-        auto tags_q = _SELECT(db, "packets", 
-                              {"DISTINCT tags"},
-                              _WHERE("tags", NEQ, ""));
+        for (const auto& in_db : in_dbs) {
+            auto tags_q = _SELECT(std::get<1>(in_db), "packets", 
+                                  {"DISTINCT tags"},
+                                  _WHERE("tags", NEQ, ""));
 
-        for (auto ti : tags_q) {
-            auto t = sqlite3_column_as<std::string>(ti, 0);
+            for (auto ti : tags_q) {
+                auto t = sqlite3_column_as<std::string>(ti, 0);
 
-            while (t.size()) {
-                auto index = t.find(" ");
-                if (index != std::string::npos) {
-                    tag_map[t.substr(0, index)] = true;
-                    t = t.substr(index + 1);
+                while (t.size()) {
+                    auto index = t.find(" ");
+                    if (index != std::string::npos) {
+                        tag_map[t.substr(0, index)] = true;
+                        t = t.substr(index + 1);
 
-                    if (t.size() == 0)
+                        if (t.size() == 0)
+                            tag_map[t] = true;
+                    } else {
                         tag_map[t] = true;
-                } else {
-                    tag_map[t] = true;
-                    t = "";
+                        t = "";
+                    }
                 }
             }
         }
@@ -1074,312 +1585,169 @@ int main(int argc, char *argv[]) {
         packet_filter_q = _WHERE(packet_filter_q, AND, uuid_clause);
     }
 
-    std::list<std::string> packet_fields;
-    if (db_version < 6) {
-        packet_fields = 
-            std::list<std::string>{"ts_sec", "ts_usec", "dlt", "datasource", "packet", "lat", "lon", "alt"};
-    } else {
-        packet_fields = 
-            std::list<std::string>{"ts_sec", "ts_usec", "dlt", "datasource", "packet", "lat", "lon", "alt", "tags"};
-    }
-
-    auto packets_q = _SELECT(db, "packets", 
-            packet_fields,
-            packet_filter_q);
-
-    if (tag_filter_map.size() != 0) {
-        for (auto ti : tag_filter_map) {
-            packets_q.append_where(AND, _WHERE("tags", LIKE, fmt::format("%{}%", ti.first)));
-        }
-    }
-
-    auto gps_q = _SELECT(db, "snapshots",
-            {"ts_sec", "ts_usec", "json"},
-            _WHERE("snaptype", EQ, "GPS"));
+    // Time ranges use the packet time index the server builds, indexing the log now if
+    // it was logged without one
+    if (since != 0 || until != 0) {
+        if (since != 0)
+            packet_filter_q = _WHERE(packet_filter_q, AND, "ts_sec", GE, since);
 
-    auto pkt = packets_q.begin();
-    auto gps = gps_q.begin();
+        if (until != 0)
+            packet_filter_q = _WHERE(packet_filter_q, AND, "ts_sec", LE, until);
 
-    if (skip_gps_track)
-        gps = gps_q.end();
+        for (const auto& in_db : in_dbs) {
+            auto db = std::get<1>(in_db);
 
-    uint64_t pkt_time = 0, pkt_time_us = 0;
-    uint64_t gps_time = 0, gps_time_us = 0;
+            auto index_q = _SELECT(db, "sqlite_master", {"name"},
+                    _WHERE("type", EQ, "index", AND, "name", EQ, "packets_ts_idx"));
 
-    try {
-        while (pkt != packets_q.end() || gps != gps_q.end()) {
-            if (pkt_time == 0 && pkt != packets_q.end()) {
-                pkt_time = sqlite3_column_as<unsigned long>(*pkt, 0);
-                pkt_time_us = sqlite3_column_as<unsigned long>(*pkt, 1);
-            }
+            if (index_q.begin() != index_q.end())
+                continue;
 
-            if (!skip_gps_track && gps_time == 0 && gps != gps_q.end()) {
-                gps_time = sqlite3_column_as<unsigned long>(*gps, 0);
-                gps_time_us = sqlite3_column_as<unsigned long>(*gps, 1);
+            if (skipclean) {
+                fmt::print(stderr, "WARNING: '{}' has no packet time index, and will be scanned "
+                        "in full\n", std::get<0>(in_db));
+                continue;
             }
 
-            if (pkt_time != 0 && (gps_time == 0 || (pkt_time < gps_time || 
-                            ((pkt_time == gps_time && pkt_time_us < gps_time_us))))) {
-                auto ts_sec = sqlite3_column_as<unsigned long>(*pkt, 0);
-                auto ts_usec = sqlite3_column_as<unsigned long>(*pkt, 1);
-                auto pkt_dlt = sqlite3_column_as<unsigned int>(*pkt, 2);
-                auto datasource = sqlite3_column_as<std::string>(*pkt, 3);
-                auto bytes = sqlite3_column_as<std::string>(*pkt, 4);
-                auto lat = sqlite3_column_as<double>(*pkt, 5);
-                auto lon = sqlite3_column_as<double>(*pkt, 6);
-                auto alt = sqlite3_column_as<double>(*pkt, 7);
-
-                std::string tags;
-
-                if (db_version >= 6)
-                    tags = sqlite3_column_as<std::string>(*pkt, 8);
-
-                if (!pcapng) {
-                    std::shared_ptr<log_file> log_interface;
-
-                    if (split_interface) {
-                        auto log_index = per_interface_logs.find(datasource);
-
-                        if (log_index == per_interface_logs.end()) {
-                            log_interface = std::make_shared<log_file>();
-                            per_interface_logs[datasource] = log_interface;
-                        } else {
-                            log_interface = log_index->second;
-                        }
-
-                    } else {
-                        log_interface = single_log;
-                    }
-
-                    if (log_interface->file == nullptr) {
-                        int file_dlt = dlt;
-
-                        if (file_dlt < 0)
-                            file_dlt = pkt_dlt;
+            if (verbose)
+                fmt::print(stderr, "* Indexing packet times in '{}'...\n", std::get<0>(in_db));
 
-                        auto fname = out_fname;
+            sql_r = sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS packets_ts_idx ON packets (ts_sec, ts_usec)",
+                    NULL, NULL, &sql_errmsg);
 
-                        if (split_interface)
-                            fname = fmt::format("{}-{}", fname, datasource);
-
-                        if (split_packets || split_size) {
-                            fname = fmt::format("{}-{:06}", fname, log_interface->number);
-                            log_interface->number++;
-                        }
+            if (sql_r != SQLITE_OK) {
+                fmt::print(stderr, "ERROR:  Unable to index packet times: {}\n", sql_errmsg);
+                exit(1);
+            }
+        }
+    }
 
-                        if (verbose)
-                            fmt::print(stderr, "* Opening legacy pcap file {}\n", fname);
+    extract_config cfg;
+    cfg.out_fname = out_fname;
+    cfg.verbose = verbose;
+    cfg.force = force;
+    cfg.pcapng = pcapng;
+    cfg.skip_gps = skip_gps;
+    cfg.skip_gps_track = skip_gps_track;
+    cfg.split_interface = split_interface;
+    cfg.split_packets = split_packets;
+    cfg.split_size = split_size;
+    cfg.dlt = dlt;
+    cfg.tag_filter_map = tag_filter_map;
+    cfg.since = since;
+    cfg.until = until;
+    cfg.interface_vec = interface_vec;
+
+    // The total is only known when every packet of the datasources is extracted
+    unsigned long total_packets = 0;
+
+    if (dlt < 0 && tag_filter_map.size() == 0 && since == 0 && until == 0) {
+        for (auto i : logging_interface_vec)
+            total_packets += i->num_packets;
+    }
 
-                        log_interface->name = fname;
+    extract_progress progress(verbose, total_packets);
 
-                        try {
-                            log_interface->file = open_pcap_file(fname, force, file_dlt);
-                        } catch (const std::runtime_error& e) {
-                            fmt::print(stderr, "ERROR: Couldn't open {} for writing ({})\n",
-                                       log_interface->name, e.what());
-                            break;
-                        }
-                    }
+    if (threads <= 1) {
+        extract_output output;
 
-                    write_pcap_packet(log_interface->file, bytes, ts_sec, ts_usec);
-
-                    log_interface->sz += bytes.size();
-                    log_interface->count++;
-
-                    if (split_packets && log_interface->count >= split_packets) {
-                        if (verbose)
-                            fmt::print(stderr, "* Closing pcap file {} after {} packets\n",
-                                    log_interface->name, log_interface->count);
-
-                        fclose(log_interface->file);
-                        log_interface->file = nullptr;
-                        log_interface->count = 0;
-                    } else if (split_size && log_interface->sz >= split_size * 1024) {
-                        if (verbose)
-                            fmt::print(stderr, "* Closing pcap file {} after {}kb\n",
-                                    log_interface->name, log_interface->sz / 1024);
-                        fclose(log_interface->file);
-                        log_interface->file = nullptr;
-                        log_interface->sz = 0;
-                    }
-                } else {
-                    // pcapng
+        for (const auto& in_db : in_dbs) {
+            const auto& in_file = std::get<0>(in_db);
 
-                    std::shared_ptr<log_file> log_interface;
+            if (verbose && in_dbs.size() > 1)
+                fmt::print(stderr, "* Extracting packets from '{}'\n", in_file);
 
-                    if (split_interface) {
-                        auto log_index = per_interface_logs.find(datasource);
+            try {
+                extract_log(std::get<1>(in_db), in_file, std::get<2>(in_db), packet_filter_q,
+                        cfg, output, progress);
+            } catch (const std::exception& e) {
+                fmt::print(stderr, "*ERROR: Failed to extract and write packets: {}\n", e.what());
+                exit(0);
+            }
+        }
+    } else {
+        // Each thread takes the next datasource, largest first, and extracts it from every
+        // log file through its own read-only connections into its own files
+        std::vector<std::shared_ptr<db_interface>> work_vec;
 
-                        if (log_index == per_interface_logs.end()) {
-                            log_interface = std::make_shared<log_file>();
-                            per_interface_logs[datasource] = log_interface;
-                        } else {
-                            log_interface = log_index->second;
-                        }
+        for (auto i : logging_interface_vec) {
+            if (i->num_packets != 0)
+                work_vec.push_back(i);
+        }
 
-                    } else {
-                        log_interface = single_log;
-                    }
+        std::sort(work_vec.begin(), work_vec.end(),
+                [](const std::shared_ptr<db_interface>& a, const std::shared_ptr<db_interface>& b) {
+                    return a->num_packets > b->num_packets;
+                });
 
-                    if (log_interface->file == nullptr) {
-                        int file_dlt = dlt;
+        if (verbose)
+            fmt::print(stderr, "* Extracting {} datasources with {} threads\n", work_vec.size(),
+                    std::min<size_t>(threads, work_vec.size()));
 
-                        if (file_dlt < 0)
-                            file_dlt = pkt_dlt;
+        std::atomic<size_t> next_work{0};
+        std::atomic<bool> failed{false};
+        std::vector<std::thread> workers;
 
-                        auto fname = out_fname;
+        for (unsigned int t = 0; t < threads && t < work_vec.size(); t++) {
+            workers.push_back(std::thread([&]() {
+                extract_output output;
 
-                        if (split_interface)
-                            fname = fmt::format("{}-{}", fname, datasource);
+                while (!failed) {
+                    auto w = next_work++;
 
-                        if (split_packets || split_size) {
-                            fname = fmt::format("{}-{:06}", fname, log_interface->number);
-                            log_interface->number++;
-                        }
+                    if (w >= work_vec.size())
+                        break;
 
-                        if (verbose)
-                            fmt::print(stderr, "* Opening pcapng file {}\n", fname);
+                    auto source_filter_q = packet_filter_q;
+                    source_filter_q = _WHERE(source_filter_q, AND, "datasource", EQ, work_vec[w]->uuid);
 
-                        log_interface->name = fname;
+                    for (const auto& in_db : in_dbs) {
+                        const auto& in_file = std::get<0>(in_db);
+                        sqlite3 *worker_db = nullptr;
 
-                        try {
-                            log_interface->file = open_pcapng_file(fname, force);
-                        } catch (const std::runtime_error& e) {
-                            fmt::print(stderr, "ERROR: Couldn't open {} for writing ({})\n",
-                                       log_interface->name, e.what());
+                        if (sqlite3_open_v2(in_file.c_str(), &worker_db, 
+                                    SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr)) {
+                            fmt::print(stderr, "ERROR:  Unable to open '{}': {}\n", in_file,
+                                    sqlite3_errmsg(worker_db));
+                            sqlite3_close(worker_db);
+                            failed = true;
                             break;
                         }
-                    }
-
-                    auto source_combo = fmt::format("{}-{}", datasource, pkt_dlt);
-                    auto source_key = log_interface->ng_interface_map.find(source_combo);
-                    unsigned int ngindex = 0;
-
-                    if (source_key == log_interface->ng_interface_map.end()) {
-                        std::shared_ptr<db_interface> dbinterface;
-
-                        for (auto dbi : interface_vec) {
-                            if (dbi->uuid == datasource) {
-                                auto desc = fmt::format("Kismet datasource {} ({} - {})",
-                                        dbi->name, dbi->interface, dbi->definition);
-                                ngindex = log_interface->ng_interface_map.size();
-
-                                log_interface->ng_interface_map[source_combo] = ngindex;
 
-                                write_pcapng_interface(log_interface->file, ngindex,
-                                        dbi->interface, pkt_dlt, desc);
-
-                                break;
-                            }
+                        try {
+                            extract_log(worker_db, in_file, std::get<2>(in_db), source_filter_q,
+                                    cfg, output, progress);
+                        } catch (const std::exception& e) {
+                            fmt::print(stderr, "*ERROR: Failed to extract and write packets "
+                                    "from datasource {}: {}\n", work_vec[w]->uuid, e.what());
+                            failed = true;
                         }
-                    } else {
-                        ngindex = source_key->second;
-                    }
 
-                    if (skip_gps) {
-                        lat = 0;
-                        lon = 0;
-                        alt = 0;
-                    }
+                        sqlite3_close(worker_db);
 
-                    write_pcapng_packet(log_interface->file, bytes, ts_sec, ts_usec, tags, ngindex,
-                            lat, lon, alt);
-
-                    log_interface->sz += bytes.size();
-                    log_interface->count++;
-
-                    if (split_packets && log_interface->count >= split_packets) {
-                        if (verbose)
-                            fmt::print(stderr, "* Closing pcapng file {} after {} packets\n",
-                                    log_interface->name, log_interface->count);
-
-                        fclose(log_interface->file);
-                        log_interface->file = nullptr;
-                        log_interface->count = 0;
-                    } else if (split_size && log_interface->sz >= split_size * 1024) {
-                        if (verbose)
-                            fmt::print(stderr, "* Closing pcap file {} after {}kb\n",
-                                    log_interface->name, log_interface->sz / 1024);
-                        fclose(log_interface->file);
-                        log_interface->file = nullptr;
-                        log_interface->sz = 0;
+                        if (failed)
+                            break;
                     }
-                }
-
-                // Advance the packet counter and reset its time
-                ++pkt;
-
-                pkt_time = 0;
-                pkt_time_us = 0;
-            } else if (gps_time != 0) {
-                auto ts_sec = sqlite3_column_as<unsigned long>(*gps, 0);
-                auto ts_usec = sqlite3_column_as<unsigned long>(*gps, 1);
-
-                if (pcapng && !split_interface) {
-                    nlohmann::json json;
-                    std::stringstream ss(sqlite3_column_as<std::string>(*gps, 2));
 
-                    try {
-                        ss >> json;
-
-                        auto alt = json["kismet.gps.last_location"].value("kismet.common.location.alt", (double) 0);
-                        auto lat = json["kismet.gps.last_location"]["kismet.common.location.geopoint"][1].get<double>();
-                        auto lon = json["kismet.gps.last_location"]["kismet.common.location.geopoint"][0].get<double>();
-
-                        if (lat != 0 && lon != 0) {
-                            try {
-                                if (single_log->file == nullptr) {
-                                    auto fname = out_fname;
-
-                                    if (verbose)
-                                        fmt::print(stderr, "* Opening pcapng file {}\n", fname);
-
-                                    single_log->name = fname;
-                                    single_log->file = open_pcapng_file(fname, force);
-                                }
-                            } catch (const std::runtime_error& e) {
-                                fmt::print(stderr, "ERROR: Couldn't open {} for writing ({})\n",
-                                        single_log->name, e.what());
-                                break;
-                            }
-
-                            write_pcapng_gps(single_log->file, ts_sec, ts_usec, lat, lon, alt);
-                        }
-                    } catch (const std::exception& e) {
-                        fmt::print(stderr, "WARNING: Could not process GPS JSON, skipping ({})\n", e.what());
-                    }
+                    // Datasources each have their own files, which are finished now
+                    output.close();
                 }
+            }));
+        }
 
-                // Advance and reset the gps query
-                ++gps;
-
-                gps_time = 0;
-                gps_time_us = 0;
-            }
+        for (auto& w : workers)
+            w.join();
 
-        }
-    } catch (const std::exception& e) {
-        fmt::print(stderr, "*ERROR: Failed to extract and write packets: {}\n", e.what());
-        exit(0);
+        if (failed)
+            exit(0);
     }
 
-    fmt::print(stderr, "Done...\n");
+    progress.summary();
 
-    sqlite3_close(db);
-
-    if (single_log != nullptr) {
-        if (single_log->file != nullptr) {
-            fflush(single_log->file);
-            fclose(single_log->file);
-        }
-    }
+    fmt::print(stderr, "Done...\n");
 
-    for (const auto& l : per_interface_logs) {
-        if (l.second->file != nullptr) {
-            fflush(l.second->file);
-            fclose(l.second->file);
-        }
-    }
+    for (const auto& in_db : in_dbs)
+        sqlite3_close(std::get<1>(in_db));
 
     return 0;
 }
@@ -28,6 +28,7 @@
 #include <ctime>
 #include <iostream>
 #include <tuple>
+#include <unordered_map>
 
 #include <string.h>
 #include <stdio.h>
@@ -41,8 +42,10 @@
 #include <sqlite3.h>
 
 #include "getopt.h"
+#include "kismetdb_device_record.h"
 #include "nlohmann/json.hpp"
 #include "sqlite3_cpp11.h"
+#include "string_scan.h"
 #include "fmt.h"
 #include "packet_ieee80211.h"
 #include "version.h"
@@ -60,18 +63,27 @@
 // hexcode for CSV
 std::string MungeForCSV(const std::string& in_data) {
 	std::string ret;
+    ret.reserve(in_data.length());
 
-	for (size_t i = 0; i < in_data.length(); i++) {
-		if ((unsigned char) in_data[i] >= 32 && (unsigned char) in_data[i] <= 126 &&
-				in_data[i] != ',' && in_data[i] != '\"' ) {
-			ret += in_data[i];
-		} else {
-			ret += '\\';
-			ret += ((in_data[i] >> 6) & 0x03) + '0';
-			ret += ((in_data[i] >> 3) & 0x07) + '0';
-			ret += ((in_data[i] >> 0) & 0x07) + '0';
-		}
-	}
+    const auto data = in_data.data();
+    const auto len = in_data.length();
+    size_t i = 0;
+
+    while (true) {
+        // copy the run of printable text whole
+        const auto run = printable_span(data + i, len - i, ",\"");
+        ret.append(data + i, run);
+        i += run;
+
+        if (i >= len)
+            break;
+
+        ret += '\\';
+        ret += ((data[i] >> 6) & 0x03) + '0';
+        ret += ((data[i] >> 3) & 0x07) + '0';
+        ret += ((data[i] >> 0) & 0x07) + '0';
+        i++;
+    }
 
 	return ret;
 }
@@ -180,7 +192,7 @@ void print_help(char *argv) {
            " -f, --force                  Force writing to the target file, even if it exists.\n"
            " -r, --rate-limit [rate]      Limit updated records to one update per [rate] seconds\n"
            "                              per device\n"
-           " -c, --cache-limit [limit]    Maximum number of device to cache, defaults to 1000.\n"
+           " -c, --cache-limit [limit]    Ignored; every device is decoded once and cached\n"
            " -v, --verbose                Verbose output\n"
            " -s, --skip-clean             Don't clean (sql vacuum) input database\n"
            " -e, --exclude lat,lon,dist   Exclude records within 'dist' *meters* of the lat,lon\n"
@@ -313,7 +325,6 @@ int main(int argc, char *argv[]) {
     struct stat statbuf;
 
     unsigned int rate_limit = 1;
-    unsigned int cache_limit = 1000;
 
     while (1) {
         int r = getopt_long(argc, argv, 
@@ -340,10 +351,7 @@ int main(int argc, char *argv[]) {
                 exit(1);
             }
         } else if (r == 'c') {
-            if (sscanf(optarg, "%u", &cache_limit) != 1) {
-                fmt::print(stderr, "ERROR:  Expected a cache limit number.\n");
-                exit(1);
-            }
+            // Devices are all cached now; the limit is accepted for older scripts
         } else if (r == 'e') {
             double lat, lon, distance;
 
@@ -495,8 +503,13 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Define a simple cache; we don't need to use a proper kismet macaddr here, just operate
-    // on it as a string
+    // Records are written through a large buffer, in few large writes
+    setvbuf(ofile, nullptr, _IOFBF, 1024 * 1024);
+
+    // Every device is decoded from its JSON record once, up front, into the few attributes
+    // the CSV needs; the packets and data records are then matched against the cache in
+    // a single pass over each table.  Devices are keyed by phy and MAC; we don't need to
+    // use a proper kismet macaddr here, just operate on it as a string
     class cache_obj {
     public:
         cache_obj(std::string t, std::string s, std::string c) :
@@ -527,10 +540,127 @@ int main(int argc, char *argv[]) {
         bool filtered;
     };
 
-    std::map<std::string, std::shared_ptr<cache_obj>> device_cache_map;
+    // Devices as written from packets, and Bluetooth devices as written from data records
+    std::unordered_map<std::string, std::shared_ptr<cache_obj>> device_cache_map;
+    std::unordered_map<std::string, std::shared_ptr<cache_obj>> bt_cache_map;
+
+    auto format_first_time = [](uint64_t timestamp) -> std::string {
+        std::time_t timet(timestamp);
+        std::tm tm;
+
+        gmtime_r(&timet, &tm);
+
+        char tmstr[256];
+        strftime(tmstr, 255, "%Y-%m-%d %H:%M:%S", &tm);
+
+        // because apparently gcc4 is still a thing?
+        // ts << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
+
+        return std::string(tmstr);
+    };
+
+    if (verbose) 
+        fmt::print(stderr, "* Decoding {} devices...\n", n_devices_db);
+
+    try {
+        auto devices_q = _SELECT(db, "devices", {"devmac", "phyname", "device"});
+
+        for (auto d : devices_q) {
+            auto devmac = sqlite3_column_as<std::string>(d, 0);
+            auto phy = sqlite3_column_as<std::string>(d, 1);
+            auto key = fmt::format("{}/{}", phy, devmac);
+
+            nlohmann::json json;
+
+            try {
+                json = kismetdb_parse_device_record(sqlite3_column_as<std::string>(d, 2));
+            } catch (const std::exception& e) {
+                std::cerr << 
+                    fmt::format("WARNING:  Could not process device info for {}/{}, skipping: {}", devmac, phy, e.what()) << std::endl;
+                continue;
+            }
+
+            try {
+                if (json["kismet.device.base.first_time"].is_null())
+                    throw std::runtime_error("No first_time in record");
+
+                auto timestamp = json["kismet.device.base.first_time"].get<uint64_t>();
+                auto name = std::string{""};
+                auto crypt = std::string{""};
+                auto type = json["kismet.device.base.type"].get<std::string>();
+
+                std::shared_ptr<cache_obj> cached;
+
+                if (phy == "IEEE802.11") {
+                    if (json["dot11.device"]["dot11.device.last_beaconed_ssid"].is_string()) {
+                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid"]);
+                    } else if (json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].is_string()) {
+                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"]);
+                    } else {
+                        name = "";
+                    }
+
+                    // Only access points are written
+                    if (type == "Wi-Fi AP") {
+                        // Handle the aliased ssid_record for modern info
+                        if (!json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].is_null()) {
+                            crypt = WifiCryptToString(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].value("dot11.advertisedssid.crypt_set", 0));
+                        } else {
+                            if (json["dot11.device"]["dot11.device.last_beaconed_ssid_checksum"].is_null()) 
+                                throw std::runtime_error("No last beaconed checksum");
+
+                            auto last_ssid_key = 
+                                json["dot11.device"]["dot11.device.last_beaconed_ssid_checksum"].get<uint64_t>();
+                            std::stringstream ss;
+
+                            ss << last_ssid_key;
+
+                            crypt = WifiCryptToString(json["dot11.device"]["dot11.device.advertised_ssid_map"][ss.str()].value("dot11.advertisedssid.crypt_set", 0));
+                        }
+
+                        crypt += "[ESS]";
+                    }
+                }
+
+                cached = std::make_shared<cache_obj>(format_first_time(timestamp), name, crypt);
+
+                if (phy == "IEEE802.11" && type != "Wi-Fi AP")
+                    cached->filter(true);
+
+#if defined(HAVE_LIBPCRE1) || defined(HAVE_LIBPCRE2)
+                for (const auto& i : pcre_list) {
+                    if (i->match(name))
+                        cached->filter(true);
+                }
+#endif
+
+                device_cache_map[key] = cached;
+
+                if (phy == "Bluetooth" || phy == "BTLE") {
+                    auto bt_name = MungeForCSV(json["kismet.device.base.commonname"]);
+
+                    if (bt_name == devmac)
+                        bt_name = "";
+
+                    if (type == "BTLE")
+                        bt_cache_map[key] = 
+                            std::make_shared<cache_obj>(format_first_time(timestamp), bt_name, "Misc [LE]", "BLE");
+                    else
+                        bt_cache_map[key] = 
+                            std::make_shared<cache_obj>(format_first_time(timestamp), bt_name, "Misc [BT]", "BT");
+                }
+            } catch (const std::exception& e) {
+                std::cerr << 
+                    fmt::format("WARNING:  Could not process device info for {}/{}, skipping: {}", devmac, phy, e.what()) << std::endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  Could not read devices from '{}': {}\n", in_fname, e.what());
+        exit(1);
+    }
 
     if (verbose) 
-        fmt::print(stderr, "* Starting to process file, max device cache {}\n", cache_limit);
+        fmt::print(stderr, "* Cached {} devices, starting to process file\n", device_cache_map.size());
 
     // CSV headers
     fmt::print(ofile, "WigleWifi-1.4,appRelease=Kismet{0}{1}{2},model=Kismet,release={0}.{1}.{2}.{3},"
@@ -583,35 +713,43 @@ int main(int argc, char *argv[]) {
     if (n_division <= 0)
         n_division = 1;
 
-    for (auto p : query) {
-        // Brute-force cache maintenance; if we're full at the start of the 
-        // processing loop, nuke the ENTIRE cache and rebuild it; this is
-        // cleaner than constantly re-sorting it.
-        if (device_cache_map.size() >= cache_limit) {
-            if (verbose)
-                fmt::print(stderr, "* Cleaning cache...\n");
-
-            device_cache_map.clear();
+    // Check to see if we lie in any exclusion zones
+    auto violates_exclusion = [&exclusion_zones](double lat, double lon) -> bool {
+        for (auto ez : exclusion_zones) {
+            if (distance_meters(lat, lon, std::get<0>(ez), std::get<1>(ez)) <= std::get<2>(ez))
+                return true;
         }
 
+        return false;
+    };
+
+    for (auto p : query) {
         n_logs++;
         if (n_logs % n_division == 0 && verbose)
             std::cerr << 
-                fmt::format("* {}%% processed {} records, {} discarded from rate limiting, {} discarded from exclusion zones, {} cached",
+                fmt::format("* {}%% processed {} records, {} discarded from rate limiting, {} discarded from exclusion zones",
                     (int) (((float) n_logs / (float) n_packets_db) * 100) + 1, 
-                    n_logs, n_discarded_logs_rate, n_discarded_logs_zones, device_cache_map.size()) << std::endl;
+                    n_logs, n_discarded_logs_rate, n_discarded_logs_zones) << std::endl;
 
         auto ts = sqlite3_column_as<std::uint64_t>(p, 0);
         auto sourcemac = sqlite3_column_as<std::string>(p, 1);
         auto phy = sqlite3_column_as<std::string>(p, 2);
 
+        auto ci = device_cache_map.find(fmt::format("{}/{}", phy, sourcemac));
+
+        if (ci == device_cache_map.end())
+            continue;
+
+        auto cached = ci->second;
+
+        if (cached->filtered)
+            continue;
+
         auto lat = 0.0f, lon = 0.0f, alt = 0.0f;
 
         auto signal = sqlite3_column_as<int>(p, 5);
         auto channel = sqlite3_column_as<double>(p, 6);
 
-        auto crypt = std::string{""};
-
         // Handle the different versions
         if (db_version < 5) {
             lat = sqlite3_column_as<double>(p, 3) / 100000;
@@ -622,131 +760,14 @@ int main(int argc, char *argv[]) {
             alt = sqlite3_column_as<double>(p, 7);
         }
 
-        auto ci = device_cache_map.find(sourcemac);
-        std::shared_ptr<cache_obj> cached;
-
-        if (ci != device_cache_map.end()) {
-            cached = ci->second;
-        } else {
-            auto dev_query = _SELECT(db, "devices", {"device"},
-                    _WHERE("devmac", EQ, sourcemac,
-                        AND,
-                        "phyname", EQ, phy));
-
-            auto dev = dev_query.begin();
-
-            if (dev == dev_query.end()) {
-                // printf("Could not find device record for %s\n", sqlite3_column_as<std::string>(p, 0).c_str());
-                continue;
-            }
-
-            // Check to see if we lie in any exclusion zones
-            bool violates_exclusion = false;
-            for (auto ez : exclusion_zones) {
-                if (distance_meters(lat, lon, std::get<0>(ez), std::get<1>(ez)) <= std::get<2>(ez)) {
-                    violates_exclusion = true;
-                    break;
-                }
-            }
-
-            if (violates_exclusion) {
-                n_discarded_logs_zones++;
-                continue;
-            }
-
-            nlohmann::json json;
-            std::stringstream ss(sqlite3_column_as<std::string>(*dev, 0));
-
-            try {
-                ss >> json;
-
-                if (json["kismet.device.base.first_time"].is_null())
-                    throw std::runtime_error("No first_time in record");
-
-                auto timestamp = json["kismet.device.base.first_time"].get<uint64_t>();
-                auto name = std::string{""};
-                auto crypt = std::string{""};
-                auto type = json["kismet.device.base.type"].get<std::string>();
-
-                if (phy == "IEEE802.11") {
-                    if (type != "Wi-Fi AP")
-                        continue;
-
-                    if (json["dot11.device"]["dot11.device.last_beaconed_ssid"].is_string()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid"]);
-                    } else if (!json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].is_null()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"]);
-                    } else {
-                        name = "";
-                    }
-
-                    if (json["dot11.device"]["dot11.device.last_beaconed_ssid"].is_string()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid"]);
-                    } else if (json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].is_string()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"]);
-                    } else {
-                        name = "";
-                    }
-
-                    // Handle the aliased ssid_record for modern info
-                    if (!json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].is_null()) {
-                        crypt = WifiCryptToString(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].value("dot11.advertisedssid.crypt_set", 0));
-                    } else {
-                        if (json["dot11.device"]["dot11.device.last_beaconed_ssid_checksum"].is_null()) 
-                            throw std::runtime_error("No last beaconed checksum");
-
-                        auto last_ssid_key = 
-                            json["dot11.device"]["dot11.device.last_beaconed_ssid_checksum"].get<uint64_t>();
-                        std::stringstream ss;
-
-                        ss << last_ssid_key;
-
-                        crypt = WifiCryptToString(json["dot11.device"]["dot11.device.advertised_ssid_map"][ss.str()].value("dot11.advertisedssid.crypt_set", 0));
-                    }
-
-                    crypt += "[ESS]";
-
-                }
-
-                std::time_t timet(timestamp);
-                std::tm tm;
-                std::stringstream ts;
-
-                gmtime_r(&timet, &tm);
-
-                char tmstr[256];
-                strftime(tmstr, 255, "%Y-%m-%d %H:%M:%S", &tm);
-                ts << tmstr;
-
-                // because apparently gcc4 is still a thing?
-                // ts << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
-
-                cached = std::make_shared<cache_obj>(ts.str(), name, crypt);
-
-                device_cache_map[sourcemac] = cached;
-
-#if defined(HAVE_LIBPCRE1) || defined(HAVE_LIBPCRE2)
-                for (const auto& i : pcre_list) {
-                    if (i->match(name))
-                        cached->filter(true);
-                }
-#endif
-
-            } catch (const std::exception& e) {
-                std::cerr << 
-                    fmt::format("WARNING:  Could not process device info for {}/{}, skipping: {}", sourcemac, phy, e.what()) << std::endl;
-            }
-        }
-
-        if (cached == nullptr)
-            continue;
-
-        if (cached->filtered)
+        if (violates_exclusion(lat, lon)) {
+            n_discarded_logs_zones++;
             continue;
+        }
 
         // Rate throttle
         if (rate_limit != 0 && cached->last_time_sec != 0) {
-            if (cached->last_time_sec + rate_limit < ts) {
+            if (ts < cached->last_time_sec + rate_limit) {
                 n_discarded_logs_rate++;
                 continue;
             }
@@ -771,31 +792,25 @@ int main(int argc, char *argv[]) {
         n_saved++;
     }
 
-    // Clear the cache before bluetooth processing
-    device_cache_map.clear();
-
     for (auto p : bt_query) {
-        // Brute-force cache maintenance; if we're full at the start of the 
-        // processing loop, nuke the ENTIRE cache and rebuild it; this is
-        // cleaner than constantly re-sorting it.
-        if (device_cache_map.size() >= cache_limit) {
-            if (verbose)
-                fmt::print(stderr, "* Cleaning cache...\n");
-
-            device_cache_map.clear();
-        }
-
         n_logs++;
         if (n_logs % n_division == 0 && verbose)
             std::cerr << 
-                fmt::format("* {}%% processed {} records, {} discarded from rate limiting, {} discarded from exclusion zones, {} cached",
+                fmt::format("* {}%% processed {} records, {} discarded from rate limiting, {} discarded from exclusion zones",
                     (int) (((float) n_logs / (float) n_packets_db) * 100) + 1, 
-                    n_logs, n_discarded_logs_rate, n_discarded_logs_zones, device_cache_map.size()) << std::endl;
+                    n_logs, n_discarded_logs_rate, n_discarded_logs_zones) << std::endl;
 
         auto ts = sqlite3_column_as<std::uint64_t>(p, 0);
         auto sourcemac = sqlite3_column_as<std::string>(p, 1);
         auto phy = sqlite3_column_as<std::string>(p, 2);
 
+        auto ci = bt_cache_map.find(fmt::format("{}/{}", phy, sourcemac));
+
+        if (ci == bt_cache_map.end())
+            continue;
+
+        auto cached = ci->second;
+
         auto lat = 0.0f, lon = 0.0f, alt = 0.0f;
 
         if (db_version < 5) {
@@ -804,90 +819,17 @@ int main(int argc, char *argv[]) {
         } else {
             lat = sqlite3_column_as<double>(p, 3);
             lon = sqlite3_column_as<double>(p, 4);
-            alt = sqlite3_column_as<double>(p, 7);
-        }
-
-        auto ci = device_cache_map.find(sourcemac);
-        std::shared_ptr<cache_obj> cached;
-
-        if (ci != device_cache_map.end()) {
-            cached = ci->second;
-        } else {
-            auto dev_query = _SELECT(db, "devices", {"device"},
-                    _WHERE("devmac", EQ, sourcemac,
-                        AND,
-                        "phyname", EQ, phy));
-
-            auto dev = dev_query.begin();
-
-            if (dev == dev_query.end()) {
-                // printf("Could not find device record for %s\n", sqlite3_column_as<std::string>(p, 0).c_str());
-                continue;
-            }
-
-            // Check to see if we lie in any exclusion zones
-            bool violates_exclusion = false;
-            for (auto ez : exclusion_zones) {
-                if (distance_meters(lat, lon, std::get<0>(ez), std::get<1>(ez)) <= std::get<2>(ez)) {
-                    violates_exclusion = true;
-                    break;
-                }
-            }
-
-            if (violates_exclusion) {
-                n_discarded_logs_zones++;
-                continue;
-            }
-
-            nlohmann::json json;
-            std::stringstream ss(sqlite3_column_as<std::string>(*dev, 0));
-
-            try {
-                ss >> json;
-
-                auto timestamp = json["kismet.device.base.first_time"].get<uint64_t>();
-                auto type = json["kismet.device.base.type"].get<std::string>();
-                auto name = MungeForCSV(json["kismet.device.base.commonname"]);
-
-                if (name == sourcemac)
-                    name = "";
-
-                std::time_t timet(timestamp);
-                std::tm tm;
-                std::stringstream ts;
-                auto crypt = std::string{""};
-                auto mod_type = std::string("");
-
-                gmtime_r(&timet, &tm);
-
-                char tmstr[256];
-                strftime(tmstr, 255, "%Y-%m-%d %H:%M:%S", &tm);
-                ts << tmstr;
-
-                if (type == "BTLE") {
-                    crypt = "Misc [LE]";
-                    mod_type = "BLE";
-                } else {
-                    crypt = "Misc [BT]";
-                    mod_type = "BT";
-                }
-
-                cached = std::make_shared<cache_obj>(ts.str(), name, crypt, mod_type);
-
-                device_cache_map[sourcemac] = cached;
-
-            } catch (const std::exception& e) {
-                std::cerr << 
-                    fmt::format("WARNING:  Could not process device info for {}/{}, skipping", sourcemac, phy) << std::endl;
-            }
+            alt = sqlite3_column_as<double>(p, 5);
         }
 
-        if (cached == nullptr)
+        if (violates_exclusion(lat, lon)) {
+            n_discarded_logs_zones++;
             continue;
+        }
 
         // Rate throttle
         if (rate_limit != 0 && cached->last_time_sec != 0) {
-            if (cached->last_time_sec + rate_limit < ts) {
+            if (ts < cached->last_time_sec + rate_limit) {
                 n_discarded_logs_rate++;
                 continue;
             }
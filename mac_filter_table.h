@@ -0,0 +1,102 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __MAC_FILTER_TABLE_H__
+#define __MAC_FILTER_TABLE_H__
+
+#include "config.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "macaddr.h"
+
+// Immutable lookup table of MAC address filters, built from the filter maps of the
+// packet and class filters whenever they are edited, so filtering never takes a lock.
+//
+// Filters are grouped by their mask, and each group is a hash table of the masked
+// addresses; an address is looked up in each group in turn, most specific mask first.
+// Plain addresses are all in a single group, so large block lists of whole addresses
+// are one hash lookup, and masked filters only cost a lookup per distinct mask.
+class mac_filter_table {
+public:
+    mac_filter_table() { }
+
+    mac_filter_table(const std::map<mac_addr, bool>& in_filters) {
+        for (const auto& f : in_filters) {
+            auto mask = filter_mask(f.first);
+
+            auto g = std::find_if(groups.begin(), groups.end(),
+                    [mask](const mask_group& g) { return g.mask == mask; });
+
+            if (g == groups.end()) {
+                groups.push_back(mask_group{mask, {}});
+                g = std::prev(groups.end());
+            }
+
+            g->filters[f.first.longmac & mask] = f.second;
+        }
+
+        // Masks are left-aligned, so a larger mask is a more specific one
+        std::sort(groups.begin(), groups.end(),
+                [](const mask_group& a, const mask_group& b) { return a.mask > b.mask; });
+    }
+
+    // Find the value of the most specific filter matching an address; returns false if
+    // no filter matches
+    bool find(const mac_addr& in_mac, bool& ret_value) const {
+        for (const auto& g : groups) {
+            auto fi = g.filters.find(in_mac.longmac & g.mask);
+
+            if (fi != g.filters.end()) {
+                ret_value = fi->second;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool empty() const {
+        return groups.size() == 0;
+    }
+
+protected:
+    // A mask which covers the whole address is a plain address
+    static uint64_t filter_mask(const mac_addr& in_mac) {
+        if (in_mac.maskbits >= in_mac.length() * 8)
+            return (uint64_t) -1;
+
+        if (in_mac.maskbits == 0)
+            return 0;
+
+        return in_mac.bits_to_mask(in_mac.maskbits);
+    }
+
+    struct mask_group {
+        uint64_t mask;
+        std::unordered_map<uint64_t, bool> filters;
+    };
+
+    std::vector<mask_group> groups;
+};
+
+#endif
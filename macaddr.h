@@ -51,6 +51,11 @@
 
 #define MAC_LEN_MAX		8
 
+// Upper case hex pairs of every byte value, "000102...FF"
+extern const char mac_hex_pairs[513];
+// Value of every hex digit, or 0xFF
+extern const uint8_t mac_hex_nibbles[256];
+
 struct mac_addr {
     constexpr uint64_t bits_to_mask(unsigned int bits) const {
         return ((uint64_t) -1) << (64 - bits);
@@ -108,15 +113,52 @@ struct mac_addr {
         state.len = len - 1;
     }
 
+    // Parse the plain colon-separated form (such as AA:BB:CC:DD:EE:FF) of up to 8 octets
+    // without a mask, which is nearly every mac we see; returns false for anything else
+    // so the full parser can handle it
+    bool string2long_plain(const char *in, size_t in_len) {
+        if (in_len < 2 || in_len > (MAC_LEN_MAX * 3) - 1 || (in_len + 1) % 3 != 0)
+            return false;
+
+        unsigned int nbytes = (in_len + 1) / 3;
+
+        uint64_t v = 0;
+        unsigned int bad = 0;
+
+        // Accumulate invalid digits and separators instead of branching on each one
+        for (unsigned int b = 0; b < nbytes; b++) {
+            auto hi = mac_hex_nibbles[(uint8_t) in[b * 3]];
+            auto lo = mac_hex_nibbles[(uint8_t) in[b * 3 + 1]];
+
+            bad |= (hi | lo) & 0xF0;
+
+            if (b + 1 < nbytes)
+                bad |= in[b * 3 + 2] ^ ':';
+
+            v = (v << 8) | (hi << 4) | lo;
+        }
+
+        if (bad != 0)
+            return false;
+
+        longmac = v << ((MAC_LEN_MAX - nbytes) * 8);
+        maskbits = 64;
+        state.len = nbytes - 1;
+        state.error = 0;
+
+        return true;
+    }
+
     void string2long(const char *in) {
+        if (string2long_plain(in, strlen(in)))
+            return;
+
         state.len = 5;
         state.error = 0;
 
         longmac = 0;
         auto longmask = (uint64_t) -1;
 
-        short unsigned int byte;
-
         int nbyte = 0;
         int mode = 0;
         int len = 0;
@@ -135,15 +177,24 @@ struct mac_addr {
                 continue;
             }
 
-            if (sscanf(in, "%2hX", &byte) != 1) {
+            // One or two hex digits; the character after the byte is always skipped
+            uint64_t byte = mac_hex_nibbles[(uint8_t) in[0]];
+
+            if (byte > 0xF) {
                 state.error = true;
                 break;
             }
 
-            if (strlen(in) >= 2)
+            if (in[1] != 0) {
+                auto lo = mac_hex_nibbles[(uint8_t) in[1]];
+
+                if (lo <= 0xF)
+                    byte = (byte << 4) | lo;
+
                 in += 2;
-            else
+            } else {
                 in++;
+            }
 
             if (nbyte >= MAC_LEN_MAX) {
                 state.error = true;
@@ -151,10 +202,10 @@ struct mac_addr {
             }
 
             if (mode == 0) {
-                longmac |= (uint64_t) byte << ((MAC_LEN_MAX - nbyte - 1) * 8);
+                longmac |= byte << ((MAC_LEN_MAX - nbyte - 1) * 8);
                 len++;
             } else if (mode == 1) {
-                longmask |= (uint64_t) byte << ((MAC_LEN_MAX - nbyte - 1) * 8);
+                longmask |= byte << ((MAC_LEN_MAX - nbyte - 1) * 8);
             }
 
             nbyte++;
@@ -239,7 +290,6 @@ struct mac_addr {
     // Convert a string to a positional search fragment, places fragment
     // in ret_term and length of fragment in ret_len
     inline static bool prepare_search_term(const std::string& s, uint64_t &ret_term, unsigned int &ret_len) {
-        short unsigned int byte;
         int nbyte = 0;
         const char *in = s.c_str();
 
@@ -255,22 +305,29 @@ struct mac_addr {
                 continue;
             }
 
-            if (sscanf(in, "%2hX", &byte) != 1) {
+            uint64_t byte = mac_hex_nibbles[(uint8_t) in[0]];
+
+            if (byte > 0xF) {
                 ret_len = 0;
                 return false;
             }
 
-            if (strlen(in) >= 2)
-                in += 2;
-            else
+            if (in[1] == 0)
                 break;
 
+            auto lo = mac_hex_nibbles[(uint8_t) in[1]];
+
+            if (lo <= 0xF)
+                byte = (byte << 4) | lo;
+
+            in += 2;
+
             if (nbyte >= MAC_LEN_MAX) {
                 ret_len = 0;
                 return false;
             }
 
-            temp_long |= (uint64_t) byte << ((MAC_LEN_MAX - nbyte - 1) * 8);
+            temp_long |= byte << ((MAC_LEN_MAX - nbyte - 1) * 8);
 
             nbyte++;
         }
@@ -382,87 +439,32 @@ struct mac_addr {
         return (val[0] << 16) | (val[1] << 8) | val[2];
     }
 
+    // Longest formatted mac or mask, 8 octets
+    static constexpr size_t format_max = (MAC_LEN_MAX * 3) - 1;
+
+    // Format a mac or mask into a buffer of format_max + 1 bytes without allocating;
+    // returns the length.  Every octet is written, and the length
+    // trims to the octets of this mac, so there are no branches per octet.
+    size_t format_to(char *out) const {
+        return format_bits_to(longmac, out);
+    }
+
+    size_t mask_format_to(char *out) const {
+        return format_bits_to(bits_to_mask(maskbits), out);
+    }
+
     inline std::string as_string() const {
         return mac_to_string();
     }
 
     inline std::string mac_to_string() const {
-        switch (state.len) {
-            case 0:
-                return fmt::format("{:02X}", 
-                        index64(longmac, 0));
-            case 1:
-                return fmt::format("{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1));
-            case 2:
-                return fmt::format("{:02X}:{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1), index64(longmac, 2));
-            case 3:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1), index64(longmac, 2),
-                        index64(longmac, 3));
-            case 4:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1), index64(longmac, 2),
-                        index64(longmac, 3), index64(longmac, 4));
-            case 5:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1), index64(longmac, 2),
-                        index64(longmac, 3), index64(longmac, 4), index64(longmac, 5));
-            case 6:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1), index64(longmac, 2),
-                        index64(longmac, 3), index64(longmac, 4), index64(longmac, 5),
-                        index64(longmac, 6));
-            case 7:
-            default:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmac, 0), index64(longmac, 1), index64(longmac, 2),
-                        index64(longmac, 3), index64(longmac, 4), index64(longmac, 5),
-                        index64(longmac, 6), index64(longmac, 7));
-
-
-        }
+        char buf[format_max + 1];
+        return std::string(buf, format_to(buf));
     }
 
     inline std::string mac_mask_to_string() const {
-        auto longmask = bits_to_mask(maskbits);
-        switch (state.len) {
-            case 0:
-                return fmt::format("{:02X}", 
-                        index64(longmask, 0));
-            case 1:
-                return fmt::format("{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1));
-            case 2:
-                return fmt::format("{:02X}:{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1), index64(longmask, 2));
-            case 3:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1), index64(longmask, 2),
-                        index64(longmask, 3));
-            case 4:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1), index64(longmask, 2),
-                        index64(longmask, 3), index64(longmask, 4));
-            case 5:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1), index64(longmask, 2),
-                        index64(longmask, 3), index64(longmask, 4), index64(longmask, 5));
-            case 6:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1), index64(longmask, 2),
-                        index64(longmask, 3), index64(longmask, 4), index64(longmask, 5),
-                        index64(longmask, 6));
-            case 7:
-            default:
-                return fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}",
-                        index64(longmask, 0), index64(longmask, 1), index64(longmask, 2),
-                        index64(longmask, 3), index64(longmask, 4), index64(longmask, 5),
-                        index64(longmask, 6), index64(longmask, 7));
-
-
-        }
+        char buf[format_max + 1];
+        return std::string(buf, mask_format_to(buf));
     }
 
     constexpr17 uint64_t get_as_long() const {
@@ -475,12 +477,34 @@ struct mac_addr {
 
     friend std::ostream& operator<<(std::ostream& os, const mac_addr& m);
     friend std::istream& operator>>(std::istream& is, mac_addr& m);
+
+protected:
+    size_t format_bits_to(uint64_t bits, char *out) const {
+        // The last octet writes a separator into the spare byte of the buffer,
+        // which the length leaves off
+        for (unsigned int b = 0; b < MAC_LEN_MAX; b++) {
+            const char *pair = &mac_hex_pairs[index64(bits, b) * 2];
+            out[b * 3] = pair[0];
+            out[b * 3 + 1] = pair[1];
+            out[b * 3 + 2] = ':';
+        }
+
+        return (length() * 3) - 1;
+    }
 };
 
 std::ostream& operator<<(std::ostream& os, const mac_addr& m);
 std::istream& operator>>(std::istream& is, mac_addr& m);
 
-template <>struct fmt::formatter<mac_addr> : fmt::ostream_formatter {};
+// Width, fill, and alignment specs apply to the formatted address as a string
+template <>struct fmt::formatter<mac_addr> : fmt::formatter<fmt::string_view> {
+    template <typename FormatContext>
+    auto format(const mac_addr& m, FormatContext& ctx) const -> decltype(ctx.out()) {
+        char buf[mac_addr::format_max + 1];
+        auto len = m.format_to(buf);
+        return fmt::formatter<fmt::string_view>::format(fmt::string_view(buf, len), ctx);
+    }
+};
 
 // A hash algorithm which is unique by mask.
 //
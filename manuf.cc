@@ -18,14 +18,41 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unordered_map>
+
 #include "configfile.h"
+#include "endian_magic.h"
 #include "entrytracker.h"
 #include "messagebus.h"
 #include "util.h"
 #include "manuf.h"
 
-kis_manuf::kis_manuf() {
+#define OUI_BIN_MAGIC           "KISOUI01"
+#define OUI_BIN_HEADER_LEN      12
+#define OUI_BIN_RECORD_LEN      8
+
+namespace {
+
+uint32_t oui_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return kis_letoh32(v);
+}
+
+}
+
+kis_manuf::kis_manuf() :
+    loaded{false},
+    zmfile{nullptr},
+    bin_map{nullptr},
+    bin_len{0},
+    bin_count{0} {
     auto entrytracker = Globalreg::fetch_mandatory_global_as<entry_tracker>();
 
     manuf_id = 
@@ -40,6 +67,7 @@ kis_manuf::kis_manuf() {
 
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("manuf_lookup", true) == false) {
         _MSG("Disabling OUI lookup.", MSGFLAG_INFO);
+        loaded = true;
         return;
     }
 
@@ -71,22 +99,44 @@ kis_manuf::kis_manuf() {
         }
     }
 
-    auto fname = Globalreg::globalreg->kismet_config->fetch_opt_vec("ouifile");
-    if (fname.size() == 0) {
+    auto binname = Globalreg::globalreg->kismet_config->fetch_opt_vec("ouibinfile");
+    if (binname.size() == 0)
+        binname.push_back("%S/kismet/kismet_manuf.bin");
+
+    std::vector<std::string> binfiles;
+    for (const auto& f : binname)
+        binfiles.push_back(Globalreg::globalreg->kismet_config->expand_log_path(f, "", "", 0, 1));
+
+    std::vector<std::string> ouifiles;
+    for (const auto& f : Globalreg::globalreg->kismet_config->fetch_opt_vec("ouifile"))
+        ouifiles.push_back(Globalreg::globalreg->kismet_config->expand_log_path(f, "", "", 0, 1));
+
+    load_done = std::async(std::launch::async, [this, binfiles, ouifiles]() {
+            thread_set_process_name("manuf db");
+            load_db(binfiles, ouifiles);
+            loaded.store(true, std::memory_order_release);
+            }).share();
+}
+
+void kis_manuf::load_db(std::vector<std::string> in_binfiles, std::vector<std::string> in_ouifiles) {
+    for (const auto& f : in_binfiles) {
+        if (open_binary(f))
+            return;
+    }
+
+    if (in_ouifiles.size() == 0) {
         _MSG("Missing 'ouifile' option in config, will not resolve manufacturer "
              "names for MAC addresses", MSGFLAG_ERROR);
         return;
     }
 
-    for (auto f : fname) {
-        auto expanded = Globalreg::globalreg->kismet_config->expand_log_path(f, "", "", 0, 1);
-
-        if ((zmfile = gzopen(expanded.c_str(), "r")) != nullptr) {
-            _MSG("Opened OUI file '" + expanded, MSGFLAG_INFO);
+    for (const auto& f : in_ouifiles) {
+        if ((zmfile = gzopen(f.c_str(), "r")) != nullptr) {
+            _MSG("Opened OUI file '" + f, MSGFLAG_INFO);
             break;
         }
 
-        _MSG("Could not open OUI file '" + expanded + "': " + std::string(strerror(errno)), MSGFLAG_INFO);
+        _MSG("Could not open OUI file '" + f + "': " + std::string(strerror(errno)), MSGFLAG_INFO);
     }
 
     if (zmfile == nullptr) {
@@ -98,6 +148,118 @@ kis_manuf::kis_manuf() {
     IndexOUI();
 }
 
+kis_manuf::~kis_manuf() {
+    if (load_done.valid())
+        load_done.wait();
+
+    if (bin_map != nullptr)
+        munmap(const_cast<uint8_t *>(bin_map), bin_len);
+
+    if (zmfile != nullptr)
+        gzclose(zmfile);
+}
+
+bool kis_manuf::open_binary(const std::string& in_path) {
+    int fd = open(in_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    // No binary table is normal for source builds, fall back to the manuf db
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < OUI_BIN_HEADER_LEN) {
+        _MSG_ERROR("Invalid OUI table '{}', falling back to the OUI file", in_path);
+        close(fd);
+        return false;
+    }
+
+    auto base = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        _MSG_ERROR("Could not map OUI table '{}': {}", in_path, kis_strerror_r(errno));
+        return false;
+    }
+
+    auto map = static_cast<const uint8_t *>(base);
+    size_t len = sb.st_size;
+    auto count = oui_read32(map + 8);
+
+    auto fail = [&]() {
+        _MSG_ERROR("Invalid OUI table '{}', falling back to the OUI file", in_path);
+        munmap(base, len);
+        bin_manuf.clear();
+        return false;
+    };
+
+    if (memcmp(map, OUI_BIN_MAGIC, 8) != 0 ||
+            OUI_BIN_HEADER_LEN + (uint64_t) count * OUI_BIN_RECORD_LEN > len)
+        return fail();
+
+    // Intern each manufacturer once, records of the same manufacturer share the
+    // string offset
+    std::unordered_map<uint32_t, std::shared_ptr<tracker_element_string>> interned;
+
+    bin_manuf.reserve(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        auto offt = oui_read32(map + OUI_BIN_HEADER_LEN + (size_t) i * OUI_BIN_RECORD_LEN + 4);
+
+        auto im = interned.find(offt);
+
+        if (im != interned.end()) {
+            bin_manuf.push_back(im->second);
+            continue;
+        }
+
+        if (offt >= len)
+            return fail();
+
+        auto start = reinterpret_cast<const char *>(map + offt);
+        auto end = static_cast<const char *>(memchr(start, 0, len - offt));
+
+        if (end == nullptr)
+            return fail();
+
+        auto manuf = std::make_shared<tracker_element_string>(manuf_id);
+        manuf->set(munge_to_printable(std::string(start, end - start)));
+
+        interned[offt] = manuf;
+        bin_manuf.push_back(manuf);
+    }
+
+    bin_map = map;
+    bin_len = len;
+    bin_count = count;
+
+    _MSG_INFO("Using OUI table '{}', {} OUIs from {} manufacturers", in_path, bin_count,
+            interned.size());
+
+    return true;
+}
+
+std::shared_ptr<tracker_element_string> kis_manuf::lookup_binary(uint32_t in_oui) const {
+    auto records = bin_map + OUI_BIN_HEADER_LEN;
+
+    // Binary search for the first record >= oui
+    uint32_t lo = 0, hi = bin_count;
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+
+        if (oui_read32(records + (size_t) mid * OUI_BIN_RECORD_LEN) < in_oui)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == bin_count || oui_read32(records + (size_t) lo * OUI_BIN_RECORD_LEN) != in_oui)
+        return unknown_manuf;
+
+    return bin_manuf[lo];
+}
+
 void kis_manuf::IndexOUI() {
     char buf[1024];
     int line = 0;
@@ -160,93 +322,7 @@ void kis_manuf::IndexOUI() {
 }
 
 std::shared_ptr<tracker_element_string> kis_manuf::lookup_oui(mac_addr in_mac) {
-    uint32_t soui = in_mac.OUI(), toui;
-    int matched = -1;
-    char buf[1024];
-    short int m[3];
-
-    if (zmfile == nullptr)
-        return unknown_manuf;
-
-    {
-        kis_lock_guard<kis_mutex> lk(mutex);
-
-        // Use the cache first
-        if (oui_map.find(soui) != oui_map.end()) {
-            return oui_map[soui].manuf;
-        }
-
-        for (unsigned int x = 0; x < index_vec.size(); x++) {
-            if (soui > index_vec[x].oui) {
-                matched = x;
-                continue;
-            }
-
-            break;
-        }
-
-        // Cache unknown to save us effort in the future
-        if (matched < 0) {
-            manuf_data md;
-            md.oui = soui;
-            md.manuf = unknown_manuf;
-            oui_map[soui] = md;
-
-            return md.manuf;
-        }
-
-        // Jump backwards one index in the matching unless we're in the first block
-        if (matched > 0)
-            matched -= 1;
-    }
-
-    {
-        kis_lock_guard<kis_mutex> lk(mutex);
-
-        gzseek(zmfile, index_vec[matched].pos, SEEK_SET);
-
-        while (!gzeof(zmfile)) {
-            if (gzgets(zmfile, buf, 1024) == nullptr || gzeof(zmfile))
-                break;
-
-            if (strlen(buf) < 10)
-                continue;
-
-            // Trim \n
-            auto mlen = strlen(buf + 9) - 1;
-
-            if (mlen == 0)
-                continue;
-
-
-            if (sscanf(buf, "%hx:%hx:%hx\t", &(m[0]), &(m[1]), &(m[2])) == 3) {
-
-                // Log a position at the previous pos - which is the line before
-                // this one, so we're inclusive
-                toui = mac_addr::OUI(m);
-
-                if (toui == soui) {
-                    manuf_data md;
-                    md.oui = soui;
-
-                    md.manuf = std::make_shared<tracker_element_string>(manuf_id);
-                    md.manuf->set(munge_to_printable(std::string(buf + 9, mlen)));
-                    oui_map[soui] = md;
-                    return md.manuf;
-                }
-
-                if (toui > soui) {
-                    manuf_data md;
-                    md.oui = soui;
-                    md.manuf = unknown_manuf;
-                    oui_map[soui] = md;
-                    return md.manuf;
-                }
-            }
-        }
-    }
-
-    return unknown_manuf;
+    return lookup_oui(in_mac.OUI());
 }
 
 std::shared_ptr<tracker_element_string> kis_manuf::lookup_oui(uint32_t in_oui) {
@@ -255,6 +331,18 @@ std::shared_ptr<tracker_element_string> kis_manuf::lookup_oui(uint32_t in_oui) {
     char buf[1024];
     short int m[3];
 
+    wait_loaded();
+
+    if (bin_map != nullptr) {
+        // Config file records are only added at startup, and the binary table is
+        // never modified, so neither needs the lock
+        auto cfg = oui_map.find(soui);
+        if (cfg != oui_map.end())
+            return cfg->second.manuf;
+
+        return lookup_binary(soui);
+    }
+
     if (zmfile == nullptr)
         return unknown_manuf;
 
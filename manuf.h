@@ -34,6 +34,8 @@
 
 #include <zlib.h>
 
+#include <atomic>
+#include <future>
 #include <string>
 
 #include "globalregistry.h"
@@ -41,9 +43,18 @@
 #include "trackedelement.h"
 #include "util.h"
 
+// Manufacturers are looked up in a sorted binary table mapped into memory, generated
+// from the manuf db by 'tools/create_oui_db.py --binary'.  Every manufacturer in the
+// table is interned when it's loaded, so lookups take no lock and return the same
+// string object for every OUI of a manufacturer.  If there is no binary table we fall
+// back to indexing and seeking through the gzipped manuf db.
+//
+// The table is loaded, or the manuf db indexed, in the background while the rest of
+// the server starts; lookups made before it's ready wait for it.
 class kis_manuf {
 public:
     kis_manuf();
+    ~kis_manuf();
 
     void IndexOUI();
 
@@ -69,6 +80,19 @@ public:
     bool is_unknown_manuf(std::shared_ptr<tracker_element_string> in_manuf);
 
 protected:
+    // Open the binary table or index the manuf db, from the background load
+    void load_db(std::vector<std::string> in_binfiles, std::vector<std::string> in_ouifiles);
+    void wait_loaded() {
+        if (!loaded.load(std::memory_order_acquire))
+            load_done.wait();
+    }
+
+    std::atomic<bool> loaded;
+    std::shared_future<void> load_done;
+
+    bool open_binary(const std::string& in_path);
+    std::shared_ptr<tracker_element_string> lookup_binary(uint32_t in_oui) const;
+
     kis_mutex mutex;
 
     std::vector<index_pos> index_vec;
@@ -77,6 +101,12 @@ protected:
 
     gzFile zmfile;
 
+    // Mapped binary table, and the interned manufacturer of each record
+    const uint8_t *bin_map;
+    size_t bin_len;
+    uint32_t bin_count;
+    std::vector<std::shared_ptr<tracker_element_string>> bin_manuf;
+
     // IDs for manufacturer objects
     int manuf_id;
     std::shared_ptr<tracker_element_string> unknown_manuf;
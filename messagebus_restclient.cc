@@ -18,16 +18,32 @@
 
 #include "config.h"
 
+#include <algorithm>
+
+#include "configfile.h"
 #include "messagebus.h"
 #include "messagebus_restclient.h"
 
 #include "json_adapter.h"
 
 rest_message_client::rest_message_client() :
-    lifetime_global() {
+    lifetime_global(),
+    ring_head{0},
+    ring_count{0},
+    next_sequence{1} {
+
+    msg_mutex.set_name("rest_message_client");
 
     eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
 
+    auto backlog = 
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("messagebus_backlog", 100);
+
+    if (backlog == 0)
+        backlog = 1;
+
+    message_ring.resize(backlog);
+
     message_vec_id =
         Globalreg::globalreg->entrytracker->register_field("kismet.messagebus.list",
                 tracker_element_factory<tracker_element_vector>(),
@@ -38,6 +54,16 @@ rest_message_client::rest_message_client() :
                 tracker_element_factory<tracker_element_uint64>(),
                 "message update timestamp");
 
+    message_sequence_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.messagebus.sequence",
+                tracker_element_factory<tracker_element_uint64>(),
+                "last message sequence number");
+
+    message_record_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.messagebus.message_record",
+                tracker_element_factory<tracked_message_record>(),
+                "message");
+
     listener_id = 
         eventbus->register_listener(message_bus::event_message(), 
                 [this](std::shared_ptr<eventbus_event> evt) {
@@ -48,11 +74,7 @@ rest_message_client::rest_message_client() :
 
                 auto msg = std::static_pointer_cast<tracked_message>(msg_k->second);
 
-                kis_lock_guard<kis_mutex> lk(msg_mutex, "rest_message_client message_event");
-                message_list.push_back(msg);
-
-                if (message_list.size() > 50)
-                    message_list.pop_front();
+                add_message(msg->get_message(), msg->get_flags(), msg->get_timestamp());
                 });
 
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
@@ -64,17 +86,17 @@ rest_message_client::rest_message_client() :
                     auto ts = string_to_n<long>(ts_k->second);
 
                     kis_lock_guard<kis_mutex> lk(msg_mutex, "/messagebus/last-time/messages");
-                    auto wrapper = std::make_shared<tracker_element_map>();
-                    auto msgvec = std::make_shared<tracker_element_vector>(message_vec_id);
-
-                    wrapper->insert(msgvec);
-                    wrapper->insert(std::make_shared<tracker_element_uint64>(message_timestamp_id, time(0)));
+                    return build_messages(ring_after_time(ts));
+                }));
 
-                    for (auto i : message_list) 
-                        if (ts < i->get_timestamp()) 
-                            msgvec->push_back(i);
+    httpd->register_route("/messagebus/last-seq/:sequence/messages", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    auto seq_k = con->uri_params().find(":sequence");
+                    auto seq = string_to_n<uint64_t>(seq_k->second);
 
-                    return wrapper;
+                    kis_lock_guard<kis_mutex> lk(msg_mutex, "/messagebus/last-seq/messages");
+                    return build_messages(ring_after_sequence(seq));
                 }));
 
     httpd->register_route("/messagebus/all_messages", {"GET", "POST"}, httpd->RO_ROLE, {},
@@ -82,11 +104,7 @@ rest_message_client::rest_message_client() :
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
                     kis_lock_guard<kis_mutex> lk(msg_mutex, "/messagebus/all_messages");
 
-                    auto ret = std::make_shared<tracker_element_vector>();
-                    for (auto i : message_list) 
-                        ret->push_back(i);
-
-                    return ret;
+                    return build_messages(0)->get_sub(message_vec_id);
                 }));
 
 }
@@ -95,7 +113,93 @@ rest_message_client::~rest_message_client() {
     eventbus->remove_listener(listener_id);
 
     Globalreg::globalreg->remove_global("REST_MSG_CLIENT");
+}
+
+void rest_message_client::add_message(const std::string& in_msg, int in_flags, time_t in_time) {
+    kis_lock_guard<kis_mutex> lk(msg_mutex, "rest_message_client add_message");
+
+    // Coalesce a repeat of the last message; it moves to the new sequence number so
+    // clients polling by sequence see the new count
+    if (ring_count > 0) {
+        auto& last = ring_at(ring_count - 1);
+
+        if (last.flags == in_flags && last.message == in_msg) {
+            last.sequence = next_sequence++;
+            last.last_time = std::max(last.last_time, in_time);
+            last.repeat++;
+            return;
+        }
+    }
+
+    if (ring_count == message_ring.size()) {
+        ring_head = (ring_head + 1) % message_ring.size();
+        ring_count--;
+    }
+
+    auto& rec = ring_at(ring_count);
+    ring_count++;
+
+    rec.sequence = next_sequence++;
+    rec.message = in_msg;
+    rec.flags = in_flags;
+    rec.first_time = in_time;
+    rec.last_time = in_time;
+    rec.repeat = 1;
+}
+
+size_t rest_message_client::ring_after_sequence(uint64_t in_seq) {
+    size_t lo = 0, hi = ring_count;
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+
+        if (ring_at(mid).sequence <= in_seq)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+size_t rest_message_client::ring_after_time(time_t in_time) {
+    size_t lo = 0, hi = ring_count;
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
 
-    message_list.clear();
+        if (ring_at(mid).last_time <= in_time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
 }
 
+std::shared_ptr<tracker_element_map> rest_message_client::build_messages(size_t in_start) {
+    auto wrapper = std::make_shared<tracker_element_map>();
+    auto msgvec = std::make_shared<tracker_element_vector>(message_vec_id);
+
+    wrapper->insert(msgvec);
+    wrapper->insert(std::make_shared<tracker_element_uint64>(message_timestamp_id, time(0)));
+    wrapper->insert(std::make_shared<tracker_element_uint64>(message_sequence_id, next_sequence - 1));
+
+    msgvec->reserve(ring_count - in_start);
+
+    for (size_t i = in_start; i < ring_count; i++) {
+        const auto& rec = ring_at(i);
+
+        auto msg = std::make_shared<tracked_message_record>(message_record_id);
+        msg->set_message(rec.message);
+        msg->set_flags(rec.flags);
+        msg->set_timestamp(rec.last_time);
+        msg->set_first_timestamp(rec.first_time);
+        msg->set_sequence(rec.sequence);
+        msg->set_repeat(rec.repeat);
+
+        msgvec->push_back(msg);
+    }
+
+    return wrapper;
+}
@@ -33,6 +33,69 @@
 #include "trackedcomponent.h"
 #include "kis_net_beast_httpd.h"
 
+// A message as served from the REST backlog; identical consecutive messages are
+// served once, with the number of times they were repeated
+class tracked_message_record : public tracker_component {
+public:
+    tracked_message_record() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_message_record(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_message_record(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_message_record");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(message, std::string, std::string, std::string, message);
+    __Proxy(flags, int32_t, int32_t, int32_t, flags);
+    __Proxy(timestamp, uint64_t, time_t, time_t, timestamp);
+    __Proxy(first_timestamp, uint64_t, time_t, time_t, first_timestamp);
+    __Proxy(sequence, uint64_t, uint64_t, uint64_t, sequence);
+    __Proxy(repeat, uint32_t, uint32_t, uint32_t, repeat);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.messagebus.message_string", "Message content", &message);
+        register_field("kismet.messagebus.message_flags", "Message flags (per messagebus.h)", &flags);
+        register_field("kismet.messagebus.message_time", "Message time_t", &timestamp);
+        register_field("kismet.messagebus.message_first_time", 
+                "Message time_t of the first repeat", &first_timestamp);
+        register_field("kismet.messagebus.message_sequence", 
+                "Message sequence number", &sequence);
+        register_field("kismet.messagebus.message_repeat", 
+                "Number of times the message was repeated", &repeat);
+    }
+
+    std::shared_ptr<tracker_element_string> message;
+    std::shared_ptr<tracker_element_int32> flags;
+    std::shared_ptr<tracker_element_uint64> timestamp;
+    std::shared_ptr<tracker_element_uint64> first_timestamp;
+    std::shared_ptr<tracker_element_uint64> sequence;
+    std::shared_ptr<tracker_element_uint32> repeat;
+};
+
 class rest_message_client : public lifetime_global {
 public:
     static std::shared_ptr<rest_message_client> 
@@ -50,15 +113,43 @@ public:
 	virtual ~rest_message_client();
 
 protected:
+    // Compact backlog record; a repeated message takes the sequence number of its last
+    // repeat, so records in the ring are always in sequence and time order
+    struct message_record {
+        uint64_t sequence;
+        std::string message;
+        int flags;
+        time_t first_time;
+        time_t last_time;
+        uint32_t repeat;
+    };
+
+    void add_message(const std::string& in_msg, int in_flags, time_t in_time);
+
+    // Records in the ring, oldest first
+    message_record& ring_at(size_t n) {
+        return message_ring[(ring_head + n) % message_ring.size()];
+    }
+
+    // Index of the first record in the ring after a sequence number or time
+    size_t ring_after_sequence(uint64_t in_seq);
+    size_t ring_after_time(time_t in_time);
+
+    std::shared_ptr<tracker_element_map> build_messages(size_t in_start);
+
     kis_mutex msg_mutex;
 
     std::shared_ptr<event_bus> eventbus;
 
-    std::list<std::shared_ptr<tracked_message> > message_list;
+    // Fixed capacity ring of the most recent messages
+    std::vector<message_record> message_ring;
+    size_t ring_head, ring_count;
+
+    uint64_t next_sequence;
 
     unsigned long listener_id;
 
-    int message_vec_id, message_timestamp_id;
+    int message_vec_id, message_timestamp_id, message_sequence_id, message_record_id;
 };
 
 
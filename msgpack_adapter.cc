@@ -0,0 +1,466 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <cstring>
+#include <type_traits>
+
+#include "entrytracker.h"
+#include "msgpack_adapter.h"
+
+namespace {
+
+using msgpack_adapter::field_dictionary;
+
+template<typename T>
+void append_be(std::string& out, T v) {
+    using bits_t = typename std::conditional<sizeof(T) == 1, uint8_t,
+          typename std::conditional<sizeof(T) == 2, uint16_t,
+          typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type;
+
+    bits_t u;
+    memcpy(&u, &v, sizeof(T));
+
+    for (size_t i = sizeof(T); i > 0; i--)
+        out.push_back(static_cast<char>((static_cast<uint64_t>(u) >> (8 * (i - 1))) & 0xFF));
+}
+
+void pack_uint(std::string& out, uint64_t v) {
+    if (v < 0x80) {
+        out.push_back(static_cast<char>(v));
+    } else if (v <= 0xFF) {
+        out.push_back(static_cast<char>(0xcc));
+        append_be<uint8_t>(out, v);
+    } else if (v <= 0xFFFF) {
+        out.push_back(static_cast<char>(0xcd));
+        append_be<uint16_t>(out, v);
+    } else if (v <= 0xFFFFFFFF) {
+        out.push_back(static_cast<char>(0xce));
+        append_be<uint32_t>(out, v);
+    } else {
+        out.push_back(static_cast<char>(0xcf));
+        append_be<uint64_t>(out, v);
+    }
+}
+
+void pack_int(std::string& out, int64_t v) {
+    if (v >= 0) {
+        pack_uint(out, v);
+    } else if (v >= -32) {
+        out.push_back(static_cast<char>(v));
+    } else if (v >= INT8_MIN) {
+        out.push_back(static_cast<char>(0xd0));
+        append_be<int8_t>(out, v);
+    } else if (v >= INT16_MIN) {
+        out.push_back(static_cast<char>(0xd1));
+        append_be<int16_t>(out, v);
+    } else if (v >= INT32_MIN) {
+        out.push_back(static_cast<char>(0xd2));
+        append_be<int32_t>(out, v);
+    } else {
+        out.push_back(static_cast<char>(0xd3));
+        append_be<int64_t>(out, v);
+    }
+}
+
+void pack_float(std::string& out, float v) {
+    out.push_back(static_cast<char>(0xca));
+    append_be(out, v);
+}
+
+void pack_double(std::string& out, double v) {
+    out.push_back(static_cast<char>(0xcb));
+    append_be(out, v);
+}
+
+void pack_bin(std::string& out, const std::string& s) {
+    if (s.length() <= 0xFF) {
+        out.push_back(static_cast<char>(0xc4));
+        append_be<uint8_t>(out, s.length());
+    } else if (s.length() <= 0xFFFF) {
+        out.push_back(static_cast<char>(0xc5));
+        append_be<uint16_t>(out, s.length());
+    } else {
+        out.push_back(static_cast<char>(0xc6));
+        append_be<uint32_t>(out, s.length());
+    }
+
+    out.append(s);
+}
+
+void pack_array_header(std::string& out, uint32_t n) {
+    if (n < 16) {
+        out.push_back(static_cast<char>(0x90 | n));
+    } else if (n <= 0xFFFF) {
+        out.push_back(static_cast<char>(0xdc));
+        append_be<uint16_t>(out, n);
+    } else {
+        out.push_back(static_cast<char>(0xdd));
+        append_be<uint32_t>(out, n);
+    }
+}
+
+template<class E>
+typename std::remove_reference<decltype(std::declval<E>().get())>::type numeric_value(const shared_tracker_element& e) {
+    return static_cast<E *>(e.get())->get();
+}
+
+// Key of a field in a field map, matching the names the JSON adapter uses
+void pack_field_key(std::string& out, uint16_t field_id, const shared_tracker_element& v,
+        const std::shared_ptr<tracker_element_serializer::rename_map>& name_map,
+        field_dictionary *fields) {
+
+    if (name_map != nullptr) {
+        auto nmi = name_map->find(v);
+        if (nmi != name_map->end() && nmi->second->rename.length() != 0) {
+            msgpack_adapter::pack_str(out, nmi->second->rename);
+            return;
+        }
+    }
+
+    std::string name;
+
+    if (v->get_type() == tracker_type::tracker_placeholder_missing)
+        name = static_cast<tracker_element_placeholder *>(v.get())->get_name();
+    else if (v->get_type() == tracker_type::tracker_alias)
+        name = static_cast<tracker_element_alias *>(v.get())->get_alias_name();
+
+    if (name.length() != 0) {
+        msgpack_adapter::pack_str(out, name);
+        return;
+    }
+
+    if (fields != nullptr) {
+        fields->use(field_id);
+        pack_uint(out, field_id);
+        return;
+    }
+
+    msgpack_adapter::pack_str(out, Globalreg::globalreg->entrytracker->get_field_name(field_id));
+}
+
+template<class M, class K>
+void pack_keyed_map(std::string& out, M *m, K key_packer,
+        const std::shared_ptr<tracker_element_serializer::rename_map>& name_map,
+        field_dictionary *fields) {
+
+    if (m->as_key_vector()) {
+        pack_array_header(out, m->size());
+
+        for (const auto& i : *m)
+            key_packer(out, i.first);
+
+        return;
+    }
+
+    uint32_t n = 0;
+    for (const auto& i : *m)
+        if (i.second != nullptr)
+            n++;
+
+    if (m->as_vector())
+        pack_array_header(out, n);
+    else
+        msgpack_adapter::pack_map_header(out, n);
+
+    for (const auto& i : *m) {
+        if (i.second == nullptr)
+            continue;
+
+        if (!m->as_vector())
+            key_packer(out, i.first);
+
+        msgpack_adapter::pack(out, i.second, name_map, fields);
+    }
+}
+
+void pack_string_key(std::string& out, const std::string& k) {
+    msgpack_adapter::pack_str(out, k);
+}
+
+}
+
+void msgpack_adapter::pack_map_header(std::string& out, uint32_t n) {
+    if (n < 16) {
+        out.push_back(static_cast<char>(0x80 | n));
+    } else if (n <= 0xFFFF) {
+        out.push_back(static_cast<char>(0xde));
+        append_be<uint16_t>(out, n);
+    } else {
+        out.push_back(static_cast<char>(0xdf));
+        append_be<uint32_t>(out, n);
+    }
+}
+
+void msgpack_adapter::pack_str(std::string& out, const std::string& s) {
+    pack_str(out, s.data(), s.length());
+}
+
+void msgpack_adapter::pack_str(std::string& out, const char *s, size_t len) {
+    if (len < 32) {
+        out.push_back(static_cast<char>(0xa0 | len));
+    } else if (len <= 0xFF) {
+        out.push_back(static_cast<char>(0xd9));
+        append_be<uint8_t>(out, len);
+    } else if (len <= 0xFFFF) {
+        out.push_back(static_cast<char>(0xda));
+        append_be<uint16_t>(out, len);
+    } else {
+        out.push_back(static_cast<char>(0xdb));
+        append_be<uint32_t>(out, len);
+    }
+
+    out.append(s, len);
+}
+
+void msgpack_adapter::field_dictionary::pack_pending(std::string& out) {
+    pack_map_header(out, pending.size());
+
+    for (const auto& f : pending) {
+        pack_uint(out, f);
+        pack_str(out, Globalreg::globalreg->entrytracker->get_field_name(f));
+    }
+
+    pending.clear();
+}
+
+void msgpack_adapter::pack(std::string& out, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map,
+        field_dictionary *fields) {
+
+    if (e == nullptr) {
+        out.push_back(static_cast<char>(0xc0));
+        return;
+    }
+
+    serializer_scope s(e, name_map);
+
+    if (e->get_type() == tracker_type::tracker_alias) {
+        e = static_cast<tracker_element_alias *>(e.get())->get();
+
+        if (e == nullptr) {
+            out.push_back(static_cast<char>(0xc0));
+            return;
+        }
+    }
+
+    uint32_t n;
+
+    switch (e->get_type()) {
+        case tracker_type::tracker_uint8:
+            pack_uint(out, numeric_value<tracker_element_uint8>(e));
+            break;
+        case tracker_type::tracker_int8:
+            pack_int(out, numeric_value<tracker_element_int8>(e));
+            break;
+        case tracker_type::tracker_uint16:
+            pack_uint(out, numeric_value<tracker_element_uint16>(e));
+            break;
+        case tracker_type::tracker_int16:
+            pack_int(out, numeric_value<tracker_element_int16>(e));
+            break;
+        case tracker_type::tracker_uint32:
+            pack_uint(out, numeric_value<tracker_element_uint32>(e));
+            break;
+        case tracker_type::tracker_int32:
+            pack_int(out, numeric_value<tracker_element_int32>(e));
+            break;
+        case tracker_type::tracker_uint64:
+            pack_uint(out, numeric_value<tracker_element_uint64>(e));
+            break;
+        case tracker_type::tracker_int64:
+            pack_int(out, numeric_value<tracker_element_int64>(e));
+            break;
+        case tracker_type::tracker_float:
+            pack_float(out, numeric_value<tracker_element_float>(e));
+            break;
+        case tracker_type::tracker_double:
+            pack_double(out, numeric_value<tracker_element_double>(e));
+            break;
+        case tracker_type::tracker_byte_array:
+            pack_bin(out, static_cast<tracker_element_byte_array *>(e.get())->get());
+            break;
+        case tracker_type::tracker_vector:
+            n = 0;
+            for (const auto& i : *static_cast<tracker_element_vector *>(e.get()))
+                if (i != nullptr)
+                    n++;
+
+            pack_array_header(out, n);
+
+            for (const auto& i : *static_cast<tracker_element_vector *>(e.get()))
+                if (i != nullptr)
+                    pack(out, i, name_map, fields);
+
+            break;
+        case tracker_type::tracker_vector_double:
+            pack_array_header(out, static_cast<tracker_element_vector_double *>(e.get())->size());
+
+            for (const auto& i : *static_cast<tracker_element_vector_double *>(e.get()))
+                pack_double(out, i);
+
+            break;
+        case tracker_type::tracker_vector_string:
+            pack_array_header(out, static_cast<tracker_element_vector_string *>(e.get())->size());
+
+            for (const auto& i : *static_cast<tracker_element_vector_string *>(e.get()))
+                pack_str(out, i);
+
+            break;
+        case tracker_type::tracker_pair_double:
+            pack_array_header(out, 2);
+            pack_double(out, std::get<0>(static_cast<tracker_element_pair_double *>(e.get())->get()));
+            pack_double(out, std::get<1>(static_cast<tracker_element_pair_double *>(e.get())->get()));
+            break;
+        case tracker_type::tracker_map: {
+            auto m = static_cast<tracker_element_map *>(e.get());
+
+            // Built once so the count matches the fields packed
+            auto extra = m->get_extra_fields();
+
+            n = 0;
+            for (const auto& i : *m)
+                if (i.second != nullptr)
+                    n++;
+            for (const auto& i : extra)
+                if (i.second != nullptr)
+                    n++;
+
+            if (m->as_vector())
+                pack_array_header(out, n);
+            else
+                pack_map_header(out, n);
+
+            auto pack_field = [&](const auto& i) {
+                if (i.second == nullptr)
+                    return;
+
+                if (!m->as_vector())
+                    pack_field_key(out, i.first, i.second, name_map, fields);
+
+                pack(out, i.second, name_map, fields);
+            };
+
+            for (const auto& i : *m)
+                pack_field(i);
+            for (const auto& i : extra)
+                pack_field(i);
+
+            break;
+        }
+        case tracker_type::tracker_summary_mapvec: {
+            auto m = static_cast<tracker_element_mapvec *>(e.get());
+
+            n = 0;
+            for (const auto& i : *m)
+                if (i != nullptr)
+                    n++;
+
+            pack_map_header(out, n);
+
+            for (const auto& i : *m) {
+                if (i == nullptr)
+                    continue;
+
+                pack_field_key(out, i->get_id(), i, name_map, fields);
+                pack(out, i, name_map, fields);
+            }
+
+            break;
+        }
+        case tracker_type::tracker_int_map:
+            pack_keyed_map(out, static_cast<tracker_element_int_map *>(e.get()),
+                    [](std::string& out, int k) { pack_int(out, k); }, name_map, fields);
+            break;
+        case tracker_type::tracker_hashkey_map:
+            pack_keyed_map(out, static_cast<tracker_element_hashkey_map *>(e.get()),
+                    [](std::string& out, size_t k) { pack_uint(out, k); }, name_map, fields);
+            break;
+        case tracker_type::tracker_double_map:
+            pack_keyed_map(out, static_cast<tracker_element_double_map *>(e.get()),
+                    [](std::string& out, double k) { pack_double(out, k); }, name_map, fields);
+            break;
+        case tracker_type::tracker_mac_map:
+            pack_keyed_map(out, static_cast<tracker_element_mac_map *>(e.get()),
+                    [](std::string& out, const mac_addr& k) {
+                        char buf[mac_addr::format_max + 1];
+                        pack_str(out, buf, k.format_to(buf));
+                    },
+                    name_map, fields);
+            break;
+        case tracker_type::tracker_uuid_map:
+            pack_keyed_map(out, static_cast<tracker_element_uuid_map *>(e.get()),
+                    [](std::string& out, const uuid& k) { pack_str(out, k.as_string()); },
+                    name_map, fields);
+            break;
+        case tracker_type::tracker_key_map:
+            pack_keyed_map(out, static_cast<tracker_element_device_key_map *>(e.get()),
+                    [](std::string& out, const device_key& k) { pack_str(out, k.as_string()); },
+                    name_map, fields);
+            break;
+        case tracker_type::tracker_string_map:
+            pack_keyed_map(out, static_cast<tracker_element_string_map *>(e.get()),
+                    pack_string_key, name_map, fields);
+            break;
+        case tracker_type::tracker_double_map_double: {
+            auto m = static_cast<tracker_element_double_map_double *>(e.get());
+
+            if (m->as_key_vector() || m->as_vector()) {
+                pack_array_header(out, m->size());
+
+                for (const auto& i : *m)
+                    pack_double(out, m->as_vector() ? i.second : i.first);
+
+                break;
+            }
+
+            pack_map_header(out, m->size());
+
+            for (const auto& i : *m) {
+                pack_double(out, i.first);
+                pack_double(out, i.second);
+            }
+
+            break;
+        }
+        case tracker_type::tracker_mac_addr: {
+            char buf[mac_addr::format_max + 1];
+            auto& m = static_cast<tracker_element_mac_addr *>(e.get())->get();
+            pack_str(out, buf, m.format_to(buf));
+            break;
+        }
+        default:
+            if (e->is_stringable())
+                pack_str(out, e->as_string());
+            else
+                out.push_back(static_cast<char>(0xc0));
+            break;
+    }
+}
+
+int msgpack_adapter::serializer::serialize(shared_tracker_element in_elem, std::ostream &stream,
+        std::shared_ptr<rename_map> name_map) {
+    std::string out;
+
+    pack(out, in_elem, name_map);
+    stream.write(out.data(), out.length());
+
+    return 0;
+}
+
@@ -0,0 +1,88 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __MSGPACK_ADAPTER_H__
+#define __MSGPACK_ADAPTER_H__
+
+#include "config.h"
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "globalregistry.h"
+#include "trackedelement.h"
+
+// MessagePack serialization adapter.  Records are serialized the same way as the JSON
+// adapter forms them - field maps become maps keyed by field name, vectors become
+// arrays - but numbers keep their native width and byte arrays are raw binary instead
+// of hex.
+//
+// For streams of records, such as websocket feeds, a field dictionary can be used:
+// plain fields are then keyed by their integer field id instead of their name, and the
+// dictionary collects the ids which haven't been sent over that stream yet, so that the
+// names are sent once per stream.  Renamed fields, aliases, and placeholders are always
+// keyed by name.
+namespace msgpack_adapter {
+
+class field_dictionary {
+public:
+    field_dictionary() { }
+
+    // Key a field by id, noting it if the name hasn't been sent yet
+    void use(uint16_t field_id) {
+        if (sent.insert(field_id).second)
+            pending.push_back(field_id);
+    }
+
+    bool has_pending() const {
+        return pending.size() > 0;
+    }
+
+    // Pack the fields used since the last call as a map of id to name, and mark
+    // them as sent
+    void pack_pending(std::string& out);
+
+protected:
+    std::unordered_set<uint16_t> sent;
+    std::vector<uint16_t> pending;
+};
+
+// Append the packed element to the output
+void pack(std::string& out, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map = nullptr,
+        field_dictionary *fields = nullptr);
+
+// Raw packers for building the framing around packed records
+void pack_map_header(std::string& out, uint32_t n);
+void pack_str(std::string& out, const std::string& s);
+void pack_str(std::string& out, const char *s, size_t len);
+
+class serializer : public tracker_element_serializer {
+public:
+    serializer() :
+        tracker_element_serializer() { }
+
+    virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
+            std::shared_ptr<rename_map> name_map = nullptr) override;
+};
+
+}
+
+#endif
+
@@ -19,12 +19,15 @@
 #ifndef __OBJECTPOOL_H__
 #define __OBJECTPOOL_H__ 
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <stack>
 #include <thread>
 #include <mutex>
+#include <vector>
 
+#include "kis_mem_account.h"
 #include "kis_mutex.h"
 
 template <class T>
@@ -33,9 +36,10 @@ private:
     struct pool_deleter {
     public:
         explicit pool_deleter(std::weak_ptr<shared_object_pool<T>* > pool, 
-                std::function<void (T*)> reset) : 
+                std::function<void (T*)> reset, kis_mem_counter *acct) : 
             pool_(pool),
-            reset_(reset) { }
+            reset_(reset),
+            acct_(acct) { }
 
         void operator()(T* ptr) {
             if (auto pool_ptr = pool_.lock()) {
@@ -48,12 +52,16 @@ private:
                 }
             }
 
+            if (acct_ != nullptr)
+                acct_->remove(sizeof(T));
+
             std::default_delete<T>{}(ptr);
         }
 
     private:
         std::weak_ptr<shared_object_pool<T>* > pool_;
         std::function<void (T*)> reset_;
+        kis_mem_counter *acct_;
     };
 
 public:
@@ -62,14 +70,20 @@ public:
     shared_object_pool() : 
         this_(new shared_object_pool<T>*(this)),
         max_sz{0},
-        reset_{[](T*) {}} { }
+        reset_{[](T*) {}},
+        acct_{kis_mem_account::fetch_type_counter<T>("pool")} { }
 
     shared_object_pool(size_t maxsz) :
         this_(new shared_object_pool<T>*(this)),
         max_sz{maxsz},
-        reset_([](T*) {}) { }
+        reset_([](T*) {}),
+        acct_{kis_mem_account::fetch_type_counter<T>("pool")} { }
 
-    virtual ~shared_object_pool() { }
+    virtual ~shared_object_pool() {
+        if (acct_ != nullptr)
+            for (size_t i = 0; i < pool_.size(); i++)
+                acct_->remove(sizeof(T));
+    }
 
     void set_max(size_t sz) {
         kis_lock_guard<kis_mutex> lg(pool_mutex);
@@ -86,17 +100,23 @@ public:
 
         if (max_sz == 0 || (max_sz != 0 && size() < max_sz)) {
             pool_.push(std::move(t));
-        } 
+        } else if (acct_ != nullptr) {
+            acct_->remove(sizeof(T));
+        }
     }
 
     ptr_type acquire() {
         kis_lock_guard<kis_mutex> lg(pool_mutex);
         if (pool_.empty()) {
+            // Objects are counted while the pool owns them, pooled or in use
+            if (acct_ != nullptr)
+                acct_->add(sizeof(T));
+
             return ptr_type(new T(), 
-                    pool_deleter{std::weak_ptr<shared_object_pool<T>*>{this_}, reset_});
+                    pool_deleter{std::weak_ptr<shared_object_pool<T>*>{this_}, reset_, acct_});
         } else {
             ptr_type tmp(pool_.top().release(),
-                    pool_deleter{std::weak_ptr<shared_object_pool<T>*>{this_}, reset_});
+                    pool_deleter{std::weak_ptr<shared_object_pool<T>*>{this_}, reset_, acct_});
             pool_.pop();
             return tmp;
         }
@@ -118,6 +138,170 @@ private:
     kis_mutex pool_mutex;
     size_t max_sz;
     std::function<void (T*)> reset_;
+
+    // Allocation accounting, when enabled as the pool was created
+    kis_mem_counter *acct_;
+};
+
+// Hit and miss counters for thread-local pools, summed over every pooled type
+struct thread_object_pool_stats {
+    static std::atomic<uint64_t>& hits() {
+        static std::atomic<uint64_t> h{0};
+        return h;
+    }
+
+    static std::atomic<uint64_t>& misses() {
+        static std::atomic<uint64_t> m{0};
+        return m;
+    }
+};
+
+// Accounting category of objects from a thread_object_pool; specialized by the pooled
+// families, such as packet components
+template <class T, class Enable = void>
+struct thread_object_pool_category {
+    static const char *name() { return "thread pool"; }
+};
+
+// Per-type object pool with a lock-free free list per thread.  Each type has a single
+// static pool (so there is no map lookup to find it); objects are acquired from and 
+// released to the free list of the calling thread, and only when a thread list is empty 
+// or overfull does it exchange a batch of objects with the shared overflow stack, under
+// the overflow lock.
+//
+// Objects are reset before they are returned to a pool, via T::reset()
+template <class T>
+class thread_object_pool {
+public:
+    static constexpr size_t thread_max = 256;
+    static constexpr size_t overflow_max = 4096;
+    static constexpr size_t batch_sz = thread_max / 2;
+
+    static std::shared_ptr<T> acquire() {
+        T *obj = nullptr;
+
+        if (!thread_dead()) {
+            auto& tl = thread_list();
+
+            if (tl.empty())
+                refill(tl);
+
+            if (!tl.empty()) {
+                obj = tl.back();
+                tl.pop_back();
+            }
+        }
+
+        if (obj == nullptr) {
+            thread_object_pool_stats::misses().fetch_add(1, std::memory_order_relaxed);
+            obj = new T();
+
+            if (acct() != nullptr)
+                acct()->add(sizeof(T));
+        } else {
+            thread_object_pool_stats::hits().fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return std::shared_ptr<T>(obj, [](T *o) { release(o); });
+    }
+
+protected:
+    struct free_list : public std::vector<T *> {
+        ~free_list() {
+            // Hand anything we still hold to the overflow stack so other threads can use it,
+            // and make sure nothing released during thread teardown touches this list
+            thread_dead() = true;
+            drain(*this, this->size());
+
+            for (auto o : *this)
+                destroy(o);
+        }
+    };
+
+    struct overflow_stack {
+        kis_mutex mutex;
+        std::vector<T *> stack;
+    };
+
+    static free_list& thread_list() {
+        static thread_local free_list tl;
+        return tl;
+    }
+
+    // Allocation accounting, when enabled before the first object was acquired; objects
+    // are counted while the pool owns them, pooled or in use
+    static kis_mem_counter *acct() {
+        static auto *c = 
+            kis_mem_account::fetch_type_counter<T>(thread_object_pool_category<T>::name());
+        return c;
+    }
+
+    static void destroy(T *o) {
+        if (acct() != nullptr)
+            acct()->remove(sizeof(T));
+
+        delete o;
+    }
+
+    static bool& thread_dead() {
+        static thread_local bool dead = false;
+        return dead;
+    }
+
+    static overflow_stack& overflow() {
+        // Intentionally never freed; objects may be released during static teardown
+        static auto *o = new overflow_stack();
+        return *o;
+    }
+
+    static void refill(free_list& tl) {
+        auto& o = overflow();
+        kis_lock_guard<kis_mutex> lk(o.mutex, "thread_object_pool refill");
+
+        auto n = std::min(batch_sz, o.stack.size());
+        tl.insert(tl.end(), o.stack.end() - n, o.stack.end());
+        o.stack.resize(o.stack.size() - n);
+    }
+
+    static void drain(free_list& tl, size_t n) {
+        auto& o = overflow();
+        kis_lock_guard<kis_mutex> lk(o.mutex, "thread_object_pool drain");
+
+        while (n > 0 && !tl.empty()) {
+            if (o.stack.size() >= overflow_max)
+                break;
+
+            o.stack.push_back(tl.back());
+            tl.pop_back();
+            n--;
+        }
+    }
+
+    static void release(T *o) {
+        try {
+            o->reset();
+        } catch (...) {
+            destroy(o);
+            return;
+        }
+
+        if (thread_dead()) {
+            destroy(o);
+            return;
+        }
+
+        auto& tl = thread_list();
+
+        if (tl.size() >= thread_max)
+            drain(tl, batch_sz);
+
+        if (tl.size() >= thread_max) {
+            destroy(o);
+            return;
+        }
+
+        tl.push_back(o);
+    }
 };
 
 #endif /* ifndef OBJECTPOOL_H */
@@ -43,10 +43,21 @@ kis_packet::kis_packet() {
     crc_ok = 0;
 	filtered = 0;
     duplicate = 0;
+    held = 0;
+    resume_chain = 0;
     hash = 0;
 
     assignment_id = 0;
 
+    for (auto& t : trace_ns)
+        t = 0;
+
+    content_present = 0;
+    for (size_t x = 0; x < MAX_PACKET_COMPONENTS; x++)
+        content_recycle[x] = nullptr;
+
+    memset(tags, 0, sizeof(tags));
+
     raw_data = "";
     raw_data.reserve(MAX_PACKET_LEN);
     data = nonstd::string_view(raw_data);
@@ -67,6 +78,12 @@ void kis_packet::insert(const unsigned int index, std::shared_ptr<packet_compone
                     "index is corrupt.", index, MAX_PACKET_COMPONENTS));
 
 	content_vec[index] = data;
+    content_recycle[index] = nullptr;
+
+    if (data != nullptr)
+        content_present |= slot_bit(index);
+    else
+        content_present &= ~slot_bit(index);
 
     if (original != nullptr) {
         kis_lock_guard<kis_mutex> lg(original->mutex);
@@ -74,10 +91,28 @@ void kis_packet::insert(const unsigned int index, std::shared_ptr<packet_compone
     }
 }
 
+void kis_packet::alias(const unsigned int index, std::shared_ptr<packet_component> data) {
+	if (index >= MAX_PACKET_COMPONENTS) 
+        throw std::runtime_error(fmt::format("Attempted to reference packet component index {} "
+                    "outside of the maximum bounds {}; this implies the pack_comp_x or _PCM "
+                    "index is corrupt.", index, MAX_PACKET_COMPONENTS));
+
+	content_vec[index] = data;
+    content_recycle[index] = nullptr;
+
+    if (data != nullptr)
+        content_present |= slot_bit(index);
+    else
+        content_present &= ~slot_bit(index);
+}
+
 std::shared_ptr<packet_component> kis_packet::fetch(const unsigned int index) const {
 	if (index >= MAX_PACKET_COMPONENTS)
 		return nullptr;
 
+	if (!(content_present & slot_bit(index)))
+		return nullptr;
+
 	return content_vec[index];
 }
 
@@ -86,5 +121,7 @@ void kis_packet::erase(const unsigned int index) {
 		return;
 
     content_vec[index].reset();
+    content_recycle[index] = nullptr;
+    content_present &= ~slot_bit(index);
 }
 
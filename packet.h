@@ -28,8 +28,11 @@
 #include <inttypes.h>
 #endif
 
+#include <string.h>
+
 #include <algorithm>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <map>
 
@@ -48,6 +51,9 @@
 // generating a packet (slightly) so I'm leaving it relatively low.
 #define MAX_PACKET_COMPONENTS	64
 
+// Maximum number of distinct packet tags, registered with register_packet_tag
+#define MAX_PACKET_TAGS			256
+
 // Maximum length of a frame
 #define MAX_PACKET_LEN			8192
 
@@ -66,6 +72,52 @@ public:
     virtual bool unique() { return false; }
 };
 
+// Pooled packet components are accounted together
+template<class T>
+struct thread_object_pool_category<T,
+    typename std::enable_if<std::is_base_of<packet_component, T>::value>::type> {
+    static const char *name() { return "packet component"; }
+};
+
+// Fixed packet component slots.  Core components always occupy the same slot, so they
+// can be resolved at compile time by type; register_packet_component hands out these
+// slots for the core component names, and allocates runtime components after them.
+namespace packet_slot {
+    constexpr unsigned int linkframe = 1;
+    constexpr unsigned int decap = 2;
+    constexpr unsigned int radiodata = 3;
+    constexpr unsigned int radiodata_agg = 4;
+    constexpr unsigned int datasource = 5;
+    constexpr unsigned int gps = 6;
+    constexpr unsigned int common = 7;
+    constexpr unsigned int phy80211 = 8;
+    constexpr unsigned int device = 9;
+    constexpr unsigned int json = 10;
+    constexpr unsigned int protobuf = 11;
+    constexpr unsigned int metablob = 12;
+    constexpr unsigned int devicetag = 13;
+
+    // First slot available to runtime registration
+    constexpr unsigned int first_dynamic = 14;
+}
+
+// Opt-in compile-time registration of a component type to a fixed slot.  A registered
+// type can be fetched by type alone, and is recycled in place by the packet when it is
+// not shared with anything else.  Each fixed slot may be registered to at most one type,
+// and the type must provide reset().
+template<class T>
+struct packet_component_slot { };
+
+#define KIS_PACKET_COMPONENT_SLOT(t, s) \
+    template<> struct packet_component_slot<t> { static constexpr unsigned int slot = s; };
+
+template<class T, class = void>
+struct has_packet_component_slot : std::false_type { };
+
+template<class T>
+struct has_packet_component_slot<T, decltype((void) packet_component_slot<T>::slot)> : 
+    std::true_type { };
+
 // Overall packet container that holds packet information
 class kis_packet {
 public:
@@ -93,6 +145,11 @@ public:
     // Are we a duplicate?
     int duplicate;
 
+    // Has a handler taken the packet out of the chain for now, and which chain
+    // does it pick up at when it's returned?
+    int held;
+    int resume_chain;
+
     // What hash has been calculated, if any?
     uint32_t hash;
 
@@ -102,18 +159,43 @@ public:
     std::string raw_data;
     nonstd::string_view data;
 
+    // Owner of the memory data refers to, when the payload is referenced in place 
+    // (for instance inside the datasource report it arrived in) instead of copied 
+    // into raw_data.  Held until the packet is reset.
+    std::shared_ptr<void> data_owner;
+
     // Original length of capture, if truncated
     uint64_t original_len;
 
+    // Monotonic time in ns at each PACKET_TRACE_ point; a packet is only traced when
+    // it is stamped at PACKET_TRACE_RECEIVE, and points it skips are left at 0
+    uint64_t trace_ns[PACKET_TRACE_MAX];
+
+    bool traced() const {
+        return trace_ns[PACKET_TRACE_RECEIVE] != 0;
+    }
+
     // Did this packet trigger creation of a new device?  Since a 
     // single packet can create multiple devices in some phys, maintain
     // a vector of device events to publish when all devices are done
     // processing
     std::vector<std::shared_ptr<eventbus_event>> process_complete_events;
 
+    // Devices created by this packet, batched as new devices when tracking is done
+    std::vector<std::shared_ptr<tracker_element>> new_devices;
+
     // pre-allocated vector of broken down packet components
     std::shared_ptr<packet_component> content_vec[MAX_PACKET_COMPONENTS];
 
+    static_assert(MAX_PACKET_COMPONENTS <= 64, "content_present holds one bit per component");
+
+    // Bitmask of the components which are present; a slot may hold a recycled component
+    // which is not present
+    uint64_t content_present;
+
+    // Reset functions of components which can be recycled in place, by slot
+    void (*content_recycle[MAX_PACKET_COMPONENTS])(packet_component *);
+
     kis_packet();
     ~kis_packet();
 
@@ -124,22 +206,45 @@ public:
         crc_ok = 0;
         filtered = 0;
         duplicate = 0;
+        held = 0;
+        resume_chain = 0;
 
         original.reset();
 
         hash = 0;
 
+        if (traced()) {
+            for (auto& t : trace_ns)
+                t = 0;
+        }
+
         // Reset and re-reserve in case we were resized somehow
         raw_data.clear();
         raw_data.reserve(MAX_PACKET_LEN);
         data = nonstd::string_view{raw_data};
+        data_owner.reset();
 
         process_complete_events.clear();
+        new_devices.clear();
+
+        // Recycle the storage of unshared registered components in place, and only
+        // release the components which are present
+        auto present = content_present;
+        while (present) {
+            auto x = __builtin_ctzll(present);
+            present &= present - 1;
+
+            if (content_recycle[x] != nullptr && content_vec[x].use_count() == 1) {
+                content_recycle[x](content_vec[x].get());
+                continue;
+            }
 
-        for (size_t x = 0; x < MAX_PACKET_COMPONENTS; x++)
             content_vec[x].reset();
+            content_recycle[x] = nullptr;
+        }
+        content_present = 0;
 
-        tag_map.clear();
+        memset(tags, 0, sizeof(tags));
     }
 
     void set_data(const std::string& sdata) {
@@ -153,14 +258,41 @@ public:
         data = nonstd::string_view{raw_data};
     }
 
+    // Reference data held by another object without copying it; the owner is kept 
+    // alive for the lifetime of the packet data
+    void set_data_ref(const nonstd::string_view& view, std::shared_ptr<void> owner) {
+        raw_data.clear();
+        data_owner = owner;
+        data = view;
+    }
+
     // Preferred smart pointers
     void insert(const unsigned int index, std::shared_ptr<packet_component> data);
 
+    // Reference a component owned by another packet, without propagating it to the
+    // original packet
+    void alias(const unsigned int index, std::shared_ptr<packet_component> data);
+
     std::shared_ptr<packet_component> fetch(const unsigned int index) const;
 
+    // Fetch a component by type; resolves the fixed slot of registered types and 
+    // returns nullptr for everything else
     template<class T> 
     std::shared_ptr<T> fetch() {
-        return nullptr;
+        return fetch_slot<T>(has_packet_component_slot<T>{});
+    }
+
+    // Borrow a registered component without touching the reference count; only valid
+    // while the packet holds the component
+    template<class T>
+    T *peek() const {
+        static_assert(has_packet_component_slot<T>::value, 
+                "peek requires a component registered with KIS_PACKET_COMPONENT_SLOT");
+
+        if (!(content_present & slot_bit(packet_component_slot<T>::slot)))
+            return nullptr;
+
+        return static_cast<T *>(content_vec[packet_component_slot<T>::slot].get());
     }
 
     template<class T, typename... Pn> 
@@ -170,7 +302,7 @@ public:
         if (k != nullptr)
             return k;
 
-        return this->fetch<T>(args...);
+        return this->fetch_next<T>(args...);
     }
 
     template<class T, typename... Pn>
@@ -180,9 +312,15 @@ public:
         if (k != nullptr)
             return k;
 
-        k = Globalreg::globalreg->packetchain->new_packet_component<T>();
-        this->insert(index, k);
-        return k;
+        return add_component<T>(index, has_packet_component_slot<T>{});
+    }
+
+    template<class T>
+    std::shared_ptr<T> fetch_or_add() {
+        static_assert(has_packet_component_slot<T>::value, 
+                "fetch_or_add requires an index or a component registered with "
+                "KIS_PACKET_COMPONENT_SLOT");
+        return fetch_or_add<T>(packet_component_slot<T>::slot);
     }
 
     void erase(const unsigned int index);
@@ -192,17 +330,102 @@ public:
             throw std::runtime_error(fmt::format("invalid packet component index {} greater than {}",
                         index, MAX_PACKET_COMPONENTS));
 
-        return content_vec[index] != nullptr;
+        return content_present & slot_bit(index);
+    }
+
+    // Tags applied to the packet, as bits by the ids from register_packet_tag; the tag
+    // names are only looked up when the tags are logged
+    uint64_t tags[MAX_PACKET_TAGS / 64];
+
+    void tag(int in_tag) {
+        if (in_tag < 0 || in_tag >= MAX_PACKET_TAGS)
+            return;
+
+        tags[in_tag / 64] |= (1ULL << (in_tag % 64));
+    }
+
+    bool has_tag(int in_tag) const {
+        if (in_tag < 0 || in_tag >= MAX_PACKET_TAGS)
+            return false;
+
+        return tags[in_tag / 64] & (1ULL << (in_tag % 64));
     }
 
-    // Tags applied to the packet
-    robin_hood::unordered_map<std::string, bool> tag_map;
+    // Call a function with the id of each tag on the packet, in id order
+    template<typename F>
+    void for_each_tag(F fn) const {
+        for (unsigned int w = 0; w < MAX_PACKET_TAGS / 64; w++) {
+            auto bits = tags[w];
+
+            while (bits) {
+                auto b = __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                fn((int) (w * 64) + b);
+            }
+        }
+    }
 
     // Original packet if we're a duplicate
     std::shared_ptr<kis_packet> original;
 
     // Packet lock
     kis_mutex mutex;
+
+protected:
+    static constexpr uint64_t slot_bit(const unsigned int index) {
+        return static_cast<uint64_t>(1) << index;
+    }
+
+    template<class T>
+    static void recycle_component(packet_component *c) {
+        static_cast<T *>(c)->reset();
+    }
+
+    template<class T>
+    std::shared_ptr<T> fetch_next() {
+        return nullptr;
+    }
+
+    template<class T, typename... Pn>
+    std::shared_ptr<T> fetch_next(const unsigned int index, const Pn& ... args) {
+        return this->fetch<T>(index, args...);
+    }
+
+    template<class T>
+    std::shared_ptr<T> fetch_slot(std::true_type) {
+        return std::static_pointer_cast<T>(this->fetch(packet_component_slot<T>::slot));
+    }
+
+    template<class T>
+    std::shared_ptr<T> fetch_slot(std::false_type) {
+        return nullptr;
+    }
+
+    template<class T>
+    std::shared_ptr<T> add_component(const unsigned int index, std::true_type) {
+        if (index != packet_component_slot<T>::slot)
+            return add_component<T>(index, std::false_type{});
+
+        // A recycler is only ever set on a fixed slot by this path, so a recycled 
+        // component here is always a T which has already been reset
+        std::shared_ptr<T> k;
+        if (content_vec[index] != nullptr && content_recycle[index] != nullptr)
+            k = std::static_pointer_cast<T>(content_vec[index]);
+        else
+            k = Globalreg::globalreg->packetchain->new_packet_component<T>();
+
+        this->insert(index, k);
+        content_recycle[index] = &recycle_component<T>;
+        return k;
+    }
+
+    template<class T>
+    std::shared_ptr<T> add_component(const unsigned int index, std::false_type) {
+        auto k = Globalreg::globalreg->packetchain->new_packet_component<T>();
+        this->insert(index, k);
+        return k;
+    }
 };
 
 
@@ -445,6 +668,7 @@ public:
     // Frequency in khz
     double freq_khz;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_common_info, packet_slot::common)
 
 // String reference
 class kis_string_info : public packet_component {
@@ -585,6 +809,7 @@ public:
     // data
     uint32_t content_checkum;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_layer1_packinfo, packet_slot::radiodata)
 
 // Combined list of signal levels collected over time for tracking signal levels of the
 // same transmission over multiple datasources, collected by the content deduper phase
@@ -604,21 +829,54 @@ public:
 
     std::unordered_map<uuid, std::shared_ptr<kis_layer1_packinfo>> source_l1_map;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_layer1_aggregate_packinfo, packet_slot::radiodata_agg)
 
 // JSON as a raw string; parsing happens in the DS code; currently supports one JSON report
-// per packet, which is fine for the current design
+// per packet, which is fine for the current design.  
+//
+// Several phys may consume the same record (rtl433 sensors and meters, for instance), so
+// the parsed document is kept with the record and shared; it is parsed the first time it
+// is asked for, and must not be modified.
 class kis_json_packinfo : public packet_component {
 public:
-    kis_json_packinfo() { }
+    kis_json_packinfo() :
+        parsed{false} { }
 
     void reset() {
         type.clear();
         json_string.clear();
+        parsed = false;
+        doc = nullptr;
+    }
+
+    // Parsed document, or nullptr if the record isn't valid JSON; the packet must be locked
+    const nlohmann::json *document() {
+        if (!parsed) {
+            parsed = true;
+            doc = nlohmann::json::parse(json_string, nullptr, false);
+        }
+
+        if (doc.is_discarded())
+            return nullptr;
+
+        return &doc;
+    }
+
+    // Set a record which was already parsed by the source, along with its text
+    void set_document(nlohmann::json&& in_doc) {
+        json_string = in_doc.dump();
+        doc = std::move(in_doc);
+        parsed = true;
     }
 
     std::string type;
     std::string json_string;
+
+protected:
+    bool parsed;
+    nlohmann::json doc;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_json_packinfo, packet_slot::json)
 
 // Protobuf record as a raw string-like record; parsing happens in the DS code; currently
 // supports one protobuf report per packet, which is fine for the current design.
@@ -634,6 +892,7 @@ public:
     std::string type;
     std::string buffer_string;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_protobuf_packinfo, packet_slot::protobuf)
 
 // Device tags added at capture time by the capture or scan engine 
 class kis_devicetag_packetinfo : public packet_component { 
@@ -646,6 +905,7 @@ public:
 
     std::map<std::string, std::string> tagmap;
 };
+KIS_PACKET_COMPONENT_SLOT(kis_devicetag_packetinfo, packet_slot::devicetag)
 
 #endif
 
@@ -24,6 +24,9 @@
 #include "packet.h"
 #include "packetchain.h"
 #include "devicetracker.h"
+#include "kis_datasource.h"
+#include "packet_ieee80211.h"
+#include "phy_80211.h"
 
 packet_filter::packet_filter(const std::string& in_id, const std::string& in_description,
         const std::string& in_type) :
@@ -149,6 +152,8 @@ packet_filter_mac_addr::packet_filter_mac_addr(const std::string& in_id, const s
 
     auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
     pack_comp_common = packetchain->register_packet_component("COMMON");
+
+    build_filter_tables();
 }
 
 packet_filter_mac_addr::~packet_filter_mac_addr() {
@@ -185,12 +190,46 @@ void packet_filter_mac_addr::update_phy_map(std::shared_ptr<eventbus_event> evt)
     // Copy the filter-engine code over to the new one
     phy_mac_filter_map[phy->fetch_phy_id()] = unknown_key->second;
     unknown_phy_mac_filter_map.erase(unknown_key);
+
+    build_filter_tables();
+}
+
+void packet_filter_mac_addr::build_filter_tables() {
+    auto tables = std::make_shared<std::unordered_map<int, phy_filter_table>>();
+
+    for (const auto& pi : phy_mac_filter_map) {
+        auto& t = (*tables)[pi.first];
+
+        t.filter_source = mac_filter_table(pi.second.filter_source);
+        t.filter_dest = mac_filter_table(pi.second.filter_dest);
+        t.filter_network = mac_filter_table(pi.second.filter_network);
+        t.filter_other = mac_filter_table(pi.second.filter_other);
+        t.filter_any = mac_filter_table(pi.second.filter_any);
+    }
+
+    std::atomic_store(&phy_filter_tables,
+            std::shared_ptr<const std::unordered_map<int, phy_filter_table>>(tables));
 }
 
 void packet_filter_mac_addr::set_filter(mac_addr in_mac, const std::string& in_phy, 
         const std::string& in_block, bool value) {
     kis_lock_guard<kis_mutex> lk(mutex);
 
+    set_filter_entry(in_mac, in_phy, in_block, value);
+    build_filter_tables();
+}
+
+void packet_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& in_phy, 
+        const std::string& in_block) {
+    kis_lock_guard<kis_mutex> lk(mutex);
+
+    remove_filter_entry(in_mac, in_phy, in_block);
+    build_filter_tables();
+}
+
+void packet_filter_mac_addr::set_filter_entry(mac_addr in_mac, const std::string& in_phy, 
+        const std::string& in_block, bool value) {
+
 	// Build the tracked version of the record, building any containers we need along the way, this
 	// always gets built even for unknown phys
 	auto tracked_phy_key = filter_phy_blocks->find(in_phy);
@@ -279,10 +318,8 @@ void packet_filter_mac_addr::set_filter(mac_addr in_mac, const std::string& in_p
         phy_mac_filter_map[phy->fetch_phy_id()].filter_any[in_mac] = value;
 }
 
-void packet_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& in_phy, 
+void packet_filter_mac_addr::remove_filter_entry(mac_addr in_mac, const std::string& in_phy, 
         const std::string& in_block) {
-    kis_lock_guard<kis_mutex> lk(mutex);
-
 	// Build the tracked version of the record, building any containers we need along the way, this
 	// always gets built even for unknown phys
 	auto tracked_phy_key = filter_phy_blocks->find(in_phy);
@@ -384,6 +421,10 @@ void packet_filter_mac_addr::edit_endp_handler(std::shared_ptr<kis_net_beast_htt
         return;
     }
 
+    // Check every address before changing any filter, then rebuild the filter tables once
+    // for the whole set, since a set may be a large block list
+    std::vector<std::pair<mac_addr, bool>> filters;
+
     for (const auto& i : filter.items()) {
         mac_addr m(i.key());
         bool v = i.value();
@@ -392,9 +433,14 @@ void packet_filter_mac_addr::edit_endp_handler(std::shared_ptr<kis_net_beast_htt
             throw std::runtime_error(fmt::format("Invalid MAC address: '{}'",
                         con->escape_html(i.key())));
 
-        set_filter(m, con->uri_params()[":phyname"], con->uri_params()[":block"], v);
+        filters.push_back(std::make_pair(m, v));
     }
 
+    for (const auto& f : filters)
+        set_filter_entry(f.first, con->uri_params()[":phyname"], con->uri_params()[":block"], f.second);
+
+    build_filter_tables();
+
     stream << "set filter\n";
     return;
 }
@@ -410,6 +456,8 @@ void packet_filter_mac_addr::remove_endp_handler(std::shared_ptr<kis_net_beast_h
         return;
     }
 
+    std::vector<mac_addr> filters;
+
     for (const auto& i : filter) {
         mac_addr m{i.get<std::string>()};
 
@@ -417,9 +465,14 @@ void packet_filter_mac_addr::remove_endp_handler(std::shared_ptr<kis_net_beast_h
             throw std::runtime_error(fmt::format("Invalid MAC address: '{}'",
                         con->escape_html(i)));
 
-        remove_filter(m, con->uri_params()[":phyname"], con->uri_params()[":block"]);
+        filters.push_back(m);
     }
 
+    for (const auto& m : filters)
+        remove_filter_entry(m, con->uri_params()[":phyname"], con->uri_params()[":block"]);
+
+    build_filter_tables();
+
     stream << "Removed filter\n";
 }
 
@@ -429,62 +482,740 @@ bool packet_filter_mac_addr::filter_packet(std::shared_ptr<kis_packet> packet) {
     if (common == nullptr)
         return get_filter_default();
 
-    auto phy_filter_group =
-        phy_mac_filter_map.find(common->phyid);
+    auto tables = std::atomic_load(&phy_filter_tables);
 
-    if (phy_filter_group == phy_mac_filter_map.end())
+    auto phy_filter_table = tables->find(common->phyid);
+
+    if (phy_filter_table == tables->end())
         return get_filter_default();
 
-    auto si = phy_filter_group->second.filter_source.find(common->source);
-    if (si != phy_filter_group->second.filter_source.end()) {
-        return si->second;
+    const auto& t = phy_filter_table->second;
+    bool value;
+
+    if (t.filter_source.find(common->source, value))
+        return value;
+
+    if (t.filter_dest.find(common->dest, value))
+        return value;
+
+    if (t.filter_network.find(common->network, value))
+        return value;
+
+    if (t.filter_other.find(common->transmitter, value))
+        return value;
+
+    if (t.filter_any.find(common->source, value) ||
+            t.filter_any.find(common->dest, value) ||
+            t.filter_any.find(common->network, value) ||
+            t.filter_any.find(common->transmitter, value))
+        return value;
+
+    return get_filter_default();
+}
+
+std::shared_ptr<tracker_element_map> packet_filter_mac_addr::self_endp_handler() {
+    auto ret = std::make_shared<tracker_element_map>();
+    build_self_content(ret);
+    return ret;
+}
+
+void packet_filter_mac_addr::build_self_content(std::shared_ptr<tracker_element_map> content) { 
+    packet_filter::build_self_content(content);
+
+    content->insert(filter_phy_blocks);
+}
+
+// Recursive descent compiler from an expression to a postfix program
+struct packet_filter_expression::expr_compiler {
+    enum class tok {
+        end, word, number, string, cmp, lparen, rparen, op_and, op_or, op_not
+    };
+
+    expr_compiler(const std::string& in_expression, expr_program& in_program) :
+        expression{in_expression},
+        program{in_program},
+        pos{0},
+        depth{0},
+        nesting{0} { }
+
+    const std::string& expression;
+    expr_program& program;
+
+    // Current token
+    tok kind;
+    std::string text;
+    size_t tok_pos;
+
+    size_t pos;
+
+    // Operand stack depth of the program so far, and nesting of the parser
+    unsigned int depth;
+    unsigned int nesting;
+
+    [[noreturn]] void error(const std::string& msg) {
+        throw std::runtime_error(fmt::format("{} at position {} of filter expression '{}'",
+                    msg, tok_pos + 1, expression));
     }
 
-    auto di = phy_filter_group->second.filter_dest.find(common->dest);
-    if (di != phy_filter_group->second.filter_dest.end()) {
-        return di->second;
+    static bool word_char(char c) {
+        return isalnum(c) || c == '_' || c == '.' || c == ':' || c == '-' || c == '+';
     }
 
-    auto ni = phy_filter_group->second.filter_network.find(common->network);
-    if (ni != phy_filter_group->second.filter_network.end()) {
-        return ni->second;
+    void next() {
+        while (pos < expression.length() && isspace(expression[pos]))
+            pos++;
+
+        tok_pos = pos;
+        text.clear();
+
+        if (pos >= expression.length()) {
+            kind = tok::end;
+            return;
+        }
+
+        auto c = expression[pos];
+        auto n = pos + 1 < expression.length() ? expression[pos + 1] : '\0';
+
+        if (c == '(' || c == ')') {
+            kind = c == '(' ? tok::lparen : tok::rparen;
+            text = c;
+            pos++;
+        } else if ((c == '&' && n == '&') || (c == '|' && n == '|')) {
+            kind = c == '&' ? tok::op_and : tok::op_or;
+            text = expression.substr(pos, 2);
+            pos += 2;
+        } else if ((c == '=' || c == '!' || c == '<' || c == '>') && n == '=') {
+            kind = tok::cmp;
+            text = expression.substr(pos, 2);
+            pos += 2;
+        } else if (c == '!') {
+            kind = tok::op_not;
+            text = c;
+            pos++;
+        } else if (c == '=' || c == '<' || c == '>' || c == '~') {
+            kind = tok::cmp;
+            text = c;
+            pos++;
+        } else if (c == '"' || c == '\'') {
+            kind = tok::string;
+            pos++;
+
+            while (pos < expression.length() && expression[pos] != c) {
+                if (expression[pos] == '\\' && pos + 1 < expression.length())
+                    pos++;
+                text += expression[pos++];
+            }
+
+            if (pos >= expression.length())
+                error("Unterminated string");
+
+            pos++;
+        } else if (word_char(c)) {
+            while (pos < expression.length() && word_char(expression[pos]))
+                text += expression[pos++];
+
+            auto lword = str_lower(text);
+            char *end;
+
+            strtod(text.c_str(), &end);
+
+            if (*end == '\0')
+                kind = tok::number;
+            else if (lword == "and")
+                kind = tok::op_and;
+            else if (lword == "or")
+                kind = tok::op_or;
+            else if (lword == "not")
+                kind = tok::op_not;
+            else
+                kind = tok::word;
+        } else {
+            error(fmt::format("Unexpected '{}'", c));
+        }
     }
 
-    auto oi = phy_filter_group->second.filter_other.find(common->transmitter);
-    if (oi != phy_filter_group->second.filter_other.end()) {
-        return oi->second;
+    void compile() {
+        next();
+        parse_or();
+
+        if (kind != tok::end)
+            error(fmt::format("Unexpected '{}'", text));
     }
 
-    auto ai = phy_filter_group->second.filter_any.find(common->source);
+    void parse_or() {
+        parse_and();
 
-    if (ai == phy_filter_group->second.filter_any.end())
-        ai = phy_filter_group->second.filter_any.find(common->dest);
+        while (kind == tok::op_or) {
+            next();
+            parse_and();
+            emit(expr_op::op_or);
+        }
+    }
 
-    if (ai == phy_filter_group->second.filter_any.end())
-        ai = phy_filter_group->second.filter_any.find(common->network);
-    
-    if (ai == phy_filter_group->second.filter_any.end())
-        ai = phy_filter_group->second.filter_any.find(common->transmitter);
-   
-    if (ai == phy_filter_group->second.filter_any.end())
-        ai = phy_filter_group->second.filter_any.find(common->dest);
+    void parse_and() {
+        parse_not();
+
+        while (kind == tok::op_and) {
+            next();
+            parse_not();
+            emit(expr_op::op_and);
+        }
+    }
+
+    void parse_not() {
+        if (++nesting > max_depth)
+            error("Expression nested too deeply");
+
+        if (kind == tok::op_not) {
+            next();
+            parse_not();
+            emit(expr_op::op_not);
+        } else if (kind == tok::lparen) {
+            next();
+            parse_or();
+
+            if (kind != tok::rparen)
+                error("Expected ')'");
+
+            next();
+        } else {
+            parse_test();
+        }
+
+        nesting--;
+    }
+
+    void parse_test() {
+        if (kind != tok::word)
+            error("Expected a field");
+
+        expr_field field;
+        auto lfield = str_lower(text);
+
+        if (lfield == "type")
+            field = expr_field::type;
+        else if (lfield == "subtype")
+            field = expr_field::subtype;
+        else if (lfield == "datasource")
+            field = expr_field::datasource;
+        else if (lfield == "channel")
+            field = expr_field::channel;
+        else if (lfield == "freq")
+            field = expr_field::freq;
+        else if (lfield == "signal")
+            field = expr_field::signal;
+        else if (lfield == "ssid")
+            field = expr_field::ssid;
+        else
+            error(fmt::format("Unknown field '{}'", text));
+
+        next();
+
+        if (kind != tok::cmp)
+            error("Expected a comparison");
+
+        auto cmp_text = text;
+        bool regex = false;
+        expr_cmp cmp;
+
+        if (cmp_text == "==" || cmp_text == "=")
+            cmp = expr_cmp::eq;
+        else if (cmp_text == "!=")
+            cmp = expr_cmp::ne;
+        else if (cmp_text == "<")
+            cmp = expr_cmp::lt;
+        else if (cmp_text == "<=")
+            cmp = expr_cmp::le;
+        else if (cmp_text == ">")
+            cmp = expr_cmp::gt;
+        else if (cmp_text == ">=")
+            cmp = expr_cmp::ge;
+        else {
+            cmp = expr_cmp::eq;
+            regex = true;
+        }
+
+        next();
+
+        if (kind != tok::word && kind != tok::number && kind != tok::string)
+            error("Expected a value");
+
+        auto value_kind = kind;
+        auto value = text;
+
+        switch (field) {
+            case expr_field::freq:
+            case expr_field::signal:
+                if (regex || value_kind != tok::number)
+                    error("Expected a number");
+
+                emit_num(field, cmp, strtod(value.c_str(), nullptr));
+                break;
+
+            case expr_field::type:
+            case expr_field::subtype:
+                if (regex)
+                    error(fmt::format("Can not match '{}' with a regex", cmp_text));
+
+                if (value_kind == tok::number) {
+                    emit_num(field, cmp, strtod(value.c_str(), nullptr));
+                } else {
+                    if (cmp != expr_cmp::eq && cmp != expr_cmp::ne)
+                        error("Named frame types can only be compared with == or !=");
+
+                    emit_frame_type(field, cmp, str_lower(value));
+                }
+                break;
+
+            case expr_field::datasource:
+            case expr_field::channel:
+            case expr_field::ssid:
+                if (regex) {
+                    try {
+                        program.regexes.push_back(std::regex(value, std::regex::extended));
+                    } catch (const std::regex_error& e) {
+                        error(fmt::format("Invalid regex '{}': {}", value, e.what()));
+                    }
+
+                    emit(expr_op::test_regex, field, cmp, program.regexes.size() - 1);
+                    break;
+                }
+
+                if (cmp != expr_cmp::eq && cmp != expr_cmp::ne)
+                    error("Text can only be compared with ==, != or ~");
+
+                // Data sources can be given by uuid, which is compared without locking
+                // the source
+                if (field == expr_field::datasource) {
+                    uuid u(value);
+
+                    if (!u.error) {
+                        program.uuids.push_back(u);
+                        emit(expr_op::test_uuid, field, cmp, program.uuids.size() - 1);
+                        break;
+                    }
+                }
+
+                program.strs.push_back(value);
+                emit(expr_op::test_str, field, cmp, program.strs.size() - 1);
+                break;
+        }
+
+        next();
+    }
+
+    void emit_num(expr_field field, expr_cmp cmp, double value) {
+        program.nums.push_back(value);
+        emit(expr_op::test_num, field, cmp, program.nums.size() - 1);
+    }
+
+    void emit_frame_type(expr_field field, expr_cmp cmp, const std::string& name) {
+        struct frame_type {
+            const char *name;
+            int type;
+            int subtype;
+        };
+
+        static const frame_type types[] = {
+            {"management", packet_management, -1},
+            {"mgmt", packet_management, -1},
+            {"control", packet_phy, -1},
+            {"ctrl", packet_phy, -1},
+            {"data", packet_data, -1},
+        };
+
+        static const frame_type subtypes[] = {
+            {"assoc_req", packet_management, packet_sub_association_req},
+            {"assoc_resp", packet_management, packet_sub_association_resp},
+            {"reassoc_req", packet_management, packet_sub_reassociation_req},
+            {"reassoc_resp", packet_management, packet_sub_reassociation_resp},
+            {"probe_req", packet_management, packet_sub_probe_req},
+            {"probe_resp", packet_management, packet_sub_probe_resp},
+            {"beacon", packet_management, packet_sub_beacon},
+            {"atim", packet_management, packet_sub_atim},
+            {"disassoc", packet_management, packet_sub_disassociation},
+            {"auth", packet_management, packet_sub_authentication},
+            {"deauth", packet_management, packet_sub_deauthentication},
+            {"action", packet_management, packet_sub_action},
+            {"block_ack_req", packet_phy, packet_sub_block_ack_req},
+            {"block_ack", packet_phy, packet_sub_block_ack},
+            {"pspoll", packet_phy, packet_sub_pspoll},
+            {"rts", packet_phy, packet_sub_rts},
+            {"cts", packet_phy, packet_sub_cts},
+            {"ack", packet_phy, packet_sub_ack},
+            {"data", packet_data, packet_sub_data},
+            {"null", packet_data, packet_sub_data_null},
+            {"qos_data", packet_data, packet_sub_data_qos_data},
+            {"qos_null", packet_data, packet_sub_data_qos_null},
+        };
+
+        if (field == expr_field::type) {
+            for (const auto& t : types) {
+                if (name == t.name) {
+                    emit_num(field, cmp, t.type);
+                    return;
+                }
+            }
+
+            error(fmt::format("Unknown frame type '{}'", name));
+        }
+
+        // Subtype numbers are only unique within a type, so a named subtype tests both
+        for (const auto& t : subtypes) {
+            if (name == t.name) {
+                emit_num(expr_field::type, expr_cmp::eq, t.type);
+                emit_num(expr_field::subtype, expr_cmp::eq, t.subtype);
+                emit(expr_op::op_and);
+
+                if (cmp == expr_cmp::ne)
+                    emit(expr_op::op_not);
+
+                return;
+            }
+        }
 
-    if (ai != phy_filter_group->second.filter_any.end())
-        return ai->second;
+        error(fmt::format("Unknown frame subtype '{}'", name));
+    }
+
+    void emit(expr_op op, expr_field field = expr_field::type, 
+            expr_cmp cmp = expr_cmp::eq, uint32_t arg = 0) {
+        if (op == expr_op::op_and || op == expr_op::op_or) {
+            depth--;
+        } else if (op != expr_op::op_not) {
+            if (++depth > max_depth)
+                error("Expression too complex");
+        }
+
+        program.code.push_back(expr_insn{op, field, cmp, arg});
+    }
+};
+
+packet_filter_expression::packet_filter_expression(const std::string& in_id,
+        const std::string& in_description) :
+    packet_filter(in_id, in_description, "expression"),
+    next_rule_id{0} {
+
+    register_fields();
+    reserve_fields(nullptr);
+
+    rules = std::make_shared<std::vector<std::shared_ptr<expr_rule>>>();
+
+    auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
+
+    pack_comp_l1info = packetchain->register_packet_component("RADIODATA");
+    pack_comp_80211 = packetchain->register_packet_component("PHY80211");
+    pack_comp_datasrc = packetchain->register_packet_component("KISDATASRC");
+    pack_comp_linkframe = packetchain->register_packet_component("LINKFRAME");
+    pack_comp_decap = packetchain->register_packet_component("DECAP");
+
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    auto addurl = fmt::format("{}/add_rule", base_uri);
+    auto remurl = fmt::format("{}/remove_rule", base_uri);
+
+    httpd->register_route(addurl, {"POST"}, httpd->LOGON_ROLE, {"cmd"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this, addurl](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    kis_lock_guard<kis_mutex> lk(mutex, addurl);
+                    return add_endp_handler(con);
+                }));
+
+    httpd->register_route(remurl, {"POST"}, httpd->LOGON_ROLE, {"cmd"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this, remurl](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    kis_lock_guard<kis_mutex> lk(mutex, remurl);
+                    return remove_endp_handler(con);
+                }));
+}
+
+unsigned int packet_filter_expression::add_rule(const std::string& in_expression, bool in_value) {
+    auto rule = std::make_shared<expr_rule>();
+
+    rule->expression = in_expression;
+    rule->value = in_value;
+    rule->hits = 0;
+
+    expr_compiler(in_expression, rule->program).compile();
+
+    kis_lock_guard<kis_mutex> lk(mutex, "packet_filter_expression add_rule");
+
+    rule->id = next_rule_id++;
+
+    auto new_rules = std::make_shared<std::vector<std::shared_ptr<expr_rule>>>(*rules);
+    new_rules->push_back(rule);
+
+    std::atomic_store(&rules, 
+            std::shared_ptr<const std::vector<std::shared_ptr<expr_rule>>>(new_rules));
+
+    return rule->id;
+}
+
+bool packet_filter_expression::remove_rule(unsigned int in_id) {
+    kis_lock_guard<kis_mutex> lk(mutex, "packet_filter_expression remove_rule");
+
+    auto new_rules = std::make_shared<std::vector<std::shared_ptr<expr_rule>>>(*rules);
+
+    auto ri = std::find_if(new_rules->begin(), new_rules->end(),
+            [in_id](const std::shared_ptr<expr_rule>& r) { return r->id == in_id; });
+
+    if (ri == new_rules->end())
+        return false;
+
+    new_rules->erase(ri);
+
+    std::atomic_store(&rules, 
+            std::shared_ptr<const std::vector<std::shared_ptr<expr_rule>>>(new_rules));
+
+    return true;
+}
+
+void packet_filter_expression::add_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::ostream stream(&con->response_stream());
+
+    try {
+        auto expression = con->json()["expression"].get<std::string>();
+        auto value = filterstring_to_bool(con->json().value("filter", "block"));
+
+        auto id = add_rule(expression, value);
+
+        stream << "Added rule " << id << "\n";
+    } catch (const std::exception& e) {
+        con->set_status(500);
+        stream << "Invalid request: " << con->escape_html(e.what()) << "\n";
+    }
+}
+
+void packet_filter_expression::remove_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    std::ostream stream(&con->response_stream());
+
+    try {
+        auto id = con->json()["id"].get<unsigned int>();
+
+        if (!remove_rule(id)) {
+            con->set_status(404);
+            stream << "No such rule\n";
+            return;
+        }
+
+        stream << "Removed rule\n";
+    } catch (const std::exception& e) {
+        con->set_status(500);
+        stream << "Invalid request: " << con->escape_html(e.what()) << "\n";
+    }
+}
+
+bool packet_filter_expression::filter_packet(std::shared_ptr<kis_packet> packet) {
+    auto current_rules = std::atomic_load(&rules);
+
+    if (current_rules->size() == 0)
+        return get_filter_default();
+
+    expr_packet p;
+
+    p.packet = packet;
+    p.l1info = packet->fetch<kis_layer1_packinfo>(pack_comp_l1info);
+    p.dot11info = packet->fetch<dot11_packinfo>(pack_comp_80211);
+    p.datasrc = packet->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
+
+    for (const auto& r : *current_rules) {
+        if (run(r->program, p)) {
+            r->hits.fetch_add(1, std::memory_order_relaxed);
+            return r->value;
+        }
+    }
 
     return get_filter_default();
 }
 
-std::shared_ptr<tracker_element_map> packet_filter_mac_addr::self_endp_handler() {
+bool packet_filter_expression::run(const expr_program& program, const expr_packet& packet) {
+    bool stack[max_depth];
+    unsigned int sp = 0;
+
+    for (const auto& i : program.code) {
+        switch (i.op) {
+            case expr_op::test_num: {
+                double v;
+                bool r = false;
+
+                if (num_field(i.field, packet, v)) {
+                    auto o = program.nums[i.arg];
+
+                    switch (i.cmp) {
+                        case expr_cmp::eq: r = v == o; break;
+                        case expr_cmp::ne: r = v != o; break;
+                        case expr_cmp::lt: r = v < o; break;
+                        case expr_cmp::le: r = v <= o; break;
+                        case expr_cmp::gt: r = v > o; break;
+                        case expr_cmp::ge: r = v >= o; break;
+                    }
+                }
+
+                stack[sp++] = r;
+                break;
+            }
+            case expr_op::test_str: {
+                std::string v;
+                stack[sp++] = str_field(i.field, packet, v) && 
+                    (v == program.strs[i.arg]) == (i.cmp == expr_cmp::eq);
+                break;
+            }
+            case expr_op::test_regex: {
+                std::string v;
+                stack[sp++] = str_field(i.field, packet, v) && 
+                    std::regex_search(v, program.regexes[i.arg]);
+                break;
+            }
+            case expr_op::test_uuid:
+                stack[sp++] = packet.datasrc != nullptr && packet.datasrc->ref_source != nullptr &&
+                    (packet.datasrc->ref_source->get_source_uuid() == program.uuids[i.arg]) == 
+                    (i.cmp == expr_cmp::eq);
+                break;
+            case expr_op::op_and:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] && stack[sp];
+                break;
+            case expr_op::op_or:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] || stack[sp];
+                break;
+            case expr_op::op_not:
+                stack[sp - 1] = !stack[sp - 1];
+                break;
+        }
+    }
+
+    return sp != 0 && stack[sp - 1];
+}
+
+// A field the packet doesn't have fails every test of it
+bool packet_filter_expression::num_field(expr_field field, const expr_packet& packet, 
+        double& ret_value) {
+    switch (field) {
+        case expr_field::type:
+            if (packet.dot11info == nullptr || packet.dot11info->type < 0)
+                return false;
+            ret_value = packet.dot11info->type;
+            return true;
+        case expr_field::subtype:
+            if (packet.dot11info == nullptr || packet.dot11info->subtype < 0)
+                return false;
+            ret_value = packet.dot11info->subtype;
+            return true;
+        case expr_field::freq:
+            if (packet.l1info == nullptr || packet.l1info->freq_khz == 0)
+                return false;
+            ret_value = packet.l1info->freq_khz;
+            return true;
+        case expr_field::signal:
+            if (packet.l1info == nullptr || 
+                    packet.l1info->signal_type != kis_l1_signal_type_dbm)
+                return false;
+            ret_value = packet.l1info->signal_dbm;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool packet_filter_expression::str_field(expr_field field, const expr_packet& packet,
+        std::string& ret_value) {
+    switch (field) {
+        case expr_field::datasource:
+            if (packet.datasrc == nullptr || packet.datasrc->ref_source == nullptr)
+                return false;
+            ret_value = packet.datasrc->ref_source->get_source_name();
+            return true;
+        case expr_field::channel:
+            if (packet.l1info == nullptr || packet.l1info->channel == "0")
+                return false;
+            ret_value = packet.l1info->channel;
+            return true;
+        case expr_field::ssid:
+            return frame_ssid(packet, ret_value);
+        default:
+            return false;
+    }
+}
+
+bool packet_filter_expression::frame_ssid(const expr_packet& packet, std::string& ret_ssid) {
+    const auto& dot11info = packet.dot11info;
+
+    if (dot11info == nullptr || dot11info->type != packet_management || dot11info->corrupt)
+        return false;
+
+    if (dot11info->ssid.length() != 0) {
+        ret_ssid = dot11info->ssid;
+        return true;
+    }
+
+    if (dot11info->subtype != packet_sub_beacon &&
+            dot11info->subtype != packet_sub_probe_req &&
+            dot11info->subtype != packet_sub_probe_resp &&
+            dot11info->subtype != packet_sub_association_req &&
+            dot11info->subtype != packet_sub_reassociation_req)
+        return false;
+
+    auto chunk = packet.packet->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+    if (chunk == nullptr || chunk->dlt != KDLT_IEEE802_11)
+        return false;
+
+    size_t offt = dot11info->header_offset;
+
+    while (offt + 2 <= chunk->length()) {
+        auto tag_num = (uint8_t) (*chunk)[offt];
+        auto tag_len = (uint8_t) (*chunk)[offt + 1];
+
+        if (offt + 2 + tag_len > chunk->length())
+            return false;
+
+        if (tag_num == 0) {
+            // The ssid has always stopped at the first nul
+            auto ssid = chunk->substr(offt + 2, tag_len);
+            ssid = ssid.substr(0, ssid.find('\0'));
+            ret_ssid = std::string(ssid.data(), ssid.length());
+            return true;
+        }
+
+        offt += 2 + tag_len;
+    }
+
+    return false;
+}
+
+std::shared_ptr<tracker_element_map> packet_filter_expression::self_endp_handler() {
     auto ret = std::make_shared<tracker_element_map>();
     build_self_content(ret);
     return ret;
 }
 
-void packet_filter_mac_addr::build_self_content(std::shared_ptr<tracker_element_map> content) { 
+void packet_filter_expression::build_self_content(std::shared_ptr<tracker_element_map> content) {
     packet_filter::build_self_content(content);
 
-    content->insert(filter_phy_blocks);
-}
+    // Hit counts are read as the rules are served
+    auto rules_vec = std::make_shared<tracker_element_vector>(rules_vec_id);
+
+    for (const auto& r : *std::atomic_load(&rules)) {
+        auto rule = std::make_shared<tracker_element_map>();
 
+        auto id = std::make_shared<tracker_element_uint32>(rule_id_id);
+        id->set(r->id);
+        rule->insert(id);
 
+        auto expression = std::make_shared<tracker_element_string>(rule_expression_id);
+        expression->set(r->expression);
+        rule->insert(expression);
+
+        auto value = std::make_shared<tracker_element_uint8>(rule_value_id);
+        value->set(r->value);
+        rule->insert(value);
+
+        auto hits = std::make_shared<tracker_element_uint64>(rule_hits_id);
+        hits->set(r->hits.load(std::memory_order_relaxed));
+        rule->insert(hits);
+
+        rules_vec->push_back(rule);
+    }
+
+    content->insert(rules_vec);
+}
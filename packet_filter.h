@@ -16,13 +16,24 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#ifndef __PACKET_FILTER_H__
+#define __PACKET_FILTER_H__
+
 #include "config.h"
 
+#include <atomic>
+#include <regex>
+
 #include "packetchain.h"
 #include "packet.h"
 #include "trackedcomponent.h"
 #include "eventbus.h"
 #include "kis_net_beast_httpd.h"
+#include "mac_filter_table.h"
+#include "uuid.h"
+
+class dot11_packinfo;
+class packetchain_comp_datasource;
 
 // Common packet filter mechanism which can be used in multiple locations;
 // implements basic default behavior, filtering by address, and REST endpoints.
@@ -159,11 +170,33 @@ protected:
         std::map<mac_addr, bool> filter_any;
     };
 
-	// Internal fast lookup tables per-phy we use for actual filtering
+	// Internal lookup tables per-phy the filter tables are built from
 	std::map<int, struct phy_filter_group> phy_mac_filter_map;
 	// Internal unknown phy map for filters registered before we had a phy ID
 	std::map<std::string, struct phy_filter_group> unknown_phy_mac_filter_map;
 
+    struct phy_filter_table {
+        mac_filter_table filter_source;
+        mac_filter_table filter_dest;
+        mac_filter_table filter_network;
+        mac_filter_table filter_other;
+        mac_filter_table filter_any;
+    };
+
+    // Filter tables per-phy used for the actual filtering; rebuilt and swapped whenever
+    // the filters change, so filtering a packet never takes the filter lock
+    std::shared_ptr<const std::unordered_map<int, phy_filter_table>> phy_filter_tables;
+
+    // Rebuild the filter tables; must be called under the filter lock
+    void build_filter_tables();
+
+    // Set or remove a filter without rebuilding the filter tables; must be called under
+    // the filter lock
+    void set_filter_entry(mac_addr in_mac, const std::string& in_phy,
+            const std::string& in_block, bool value);
+    void remove_filter_entry(mac_addr in_mac, const std::string& in_phy,
+            const std::string& in_block);
+
     // Address management endpoint keyed on path
     void edit_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
     void remove_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
@@ -172,3 +205,146 @@ protected:
     virtual void build_self_content(std::shared_ptr<tracker_element_map> content) override;
 };
 
+// Expression based filter.
+//
+// Rules are expressions over what the capture and the dissectors know of a packet before it
+// is classified; the 802.11 frame type and subtype, the data source, channel, frequency,
+// signal and SSID.  For example:
+//
+//   type == data && signal < -85
+//   subtype == beacon && ssid ~ "^xfinity"
+//   datasource != "wlan1" || channel == 6
+//
+// Each rule has a value, true to filter the packet and false to pass it; rules are checked
+// in order, the first rule which matches decides, and packets matched by no rule get the
+// default.  Rules are compiled to a flat program when they are added, and the compiled rules
+// are swapped in as a whole, so filtering a packet never takes the filter lock.  Each rule
+// counts the packets it matched.
+class packet_filter_expression : public packet_filter {
+public:
+    packet_filter_expression(const std::string& in_id, const std::string& in_description);
+    virtual ~packet_filter_expression() { }
+
+    virtual bool filter_packet(std::shared_ptr<kis_packet> packet) override;
+
+    // Compile and append a rule, returning the id of the rule; throws std::runtime_error
+    // if the expression does not compile
+    unsigned int add_rule(const std::string& in_expression, bool in_value);
+    bool remove_rule(unsigned int in_id);
+
+    // Are there any rules; when there are none every packet gets the default
+    bool has_rules() {
+        return std::atomic_load(&rules)->size() != 0;
+    }
+
+protected:
+    virtual void register_fields() override {
+        packet_filter::register_fields();
+
+        rules_vec_id =
+            register_field("kismet.packetfilter.expression.rules",
+                    tracker_element_factory<tracker_element_vector>(),
+                    "Filter rules");
+
+        rule_id_id =
+            register_field("kismet.packetfilter.expression.rule.id",
+                    tracker_element_factory<tracker_element_uint32>(),
+                    "Rule ID");
+
+        rule_expression_id =
+            register_field("kismet.packetfilter.expression.rule.expression",
+                    tracker_element_factory<tracker_element_string>(),
+                    "Rule expression");
+
+        rule_value_id =
+            register_field("kismet.packetfilter.expression.rule.value",
+                    tracker_element_factory<tracker_element_uint8>(),
+                    "Filter value");
+
+        rule_hits_id =
+            register_field("kismet.packetfilter.expression.rule.hits",
+                    tracker_element_factory<tracker_element_uint64>(),
+                    "Packets matched by the rule");
+    }
+
+    enum class expr_field : uint8_t {
+        type, subtype, datasource, channel, freq, signal, ssid
+    };
+
+    enum class expr_op : uint8_t {
+        // Tests push their result
+        test_num, test_str, test_regex, test_uuid,
+        // Operators pop their operands and push their result
+        op_and, op_or, op_not
+    };
+
+    enum class expr_cmp : uint8_t {
+        eq, ne, lt, le, gt, ge
+    };
+
+    struct expr_insn {
+        expr_op op;
+        expr_field field;
+        expr_cmp cmp;
+        // Index of the constant in the constant table of the test
+        uint32_t arg;
+    };
+
+    struct expr_program {
+        std::vector<expr_insn> code;
+
+        std::vector<double> nums;
+        std::vector<std::string> strs;
+        std::vector<std::regex> regexes;
+        std::vector<uuid> uuids;
+    };
+
+    struct expr_rule {
+        unsigned int id;
+        std::string expression;
+        bool value;
+
+        expr_program program;
+
+        std::atomic<uint64_t> hits;
+    };
+
+    // Deepest operand stack and nesting a program may have
+    static constexpr unsigned int max_depth = 32;
+
+    struct expr_compiler;
+
+    // Components of the packet being filtered
+    struct expr_packet {
+        std::shared_ptr<kis_packet> packet;
+        std::shared_ptr<kis_layer1_packinfo> l1info;
+        std::shared_ptr<dot11_packinfo> dot11info;
+        std::shared_ptr<packetchain_comp_datasource> datasrc;
+    };
+
+    bool run(const expr_program& program, const expr_packet& packet);
+
+    bool num_field(expr_field field, const expr_packet& packet, double& ret_value);
+    bool str_field(expr_field field, const expr_packet& packet, std::string& ret_value);
+
+    // SSID of a management frame, read from the IE tags of the frame since the
+    // dissectors have not parsed them yet
+    bool frame_ssid(const expr_packet& packet, std::string& ret_ssid);
+
+    int pack_comp_l1info, pack_comp_80211, pack_comp_datasrc, pack_comp_linkframe,
+        pack_comp_decap;
+
+    int rules_vec_id, rule_id_id, rule_expression_id, rule_value_id, rule_hits_id;
+
+    // Compiled rules, replaced as a whole whenever the rules change
+    std::shared_ptr<const std::vector<std::shared_ptr<expr_rule>>> rules;
+    unsigned int next_rule_id;
+
+    void add_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
+    void remove_endp_handler(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
+    virtual std::shared_ptr<tracker_element_map> self_endp_handler() override;
+    virtual void build_self_content(std::shared_ptr<tracker_element_map> content) override;
+};
+
+#endif
@@ -0,0 +1,255 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "configfile.h"
+#include "messagebus.h"
+#include "nlohmann/json.hpp"
+#include "packet_retention.h"
+#include "timetracker.h"
+#include "util.h"
+
+const char *packet_retention::category_name(category in_cat) {
+    switch (in_cat) {
+        case cat_eapol:
+            return "eapol";
+        case cat_beacon:
+            return "beacon";
+        case cat_pmkid:
+            return "pmkid";
+        case cat_dedupe:
+            return "dedupe";
+        default:
+            return "unknown";
+    }
+}
+
+packet_retention::packet_retention() :
+    lifetime_global() {
+
+    mutex.set_name("packet_retention");
+
+    budget =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("packet_retention_max",
+                64 * 1024 * 1024);
+
+    for (int c = 0; c < cat_max; c++) {
+        quota[c] = 0;
+        bytes[c] = 0;
+        packets[c] = 0;
+        evicted[c] = 0;
+    }
+
+    for (const auto& q : Globalreg::globalreg->kismet_config->fetch_opt_vec("packet_retention_quota")) {
+        auto t = str_tokenize(q, ",");
+
+        if (t.size() != 2) {
+            _MSG_ERROR("Invalid packet_retention_quota '{}', expected category,bytes", q);
+            continue;
+        }
+
+        int c;
+        for (c = 0; c < cat_max; c++) {
+            if (str_lower(t[0]) == category_name(static_cast<category>(c)))
+                break;
+        }
+
+        if (c == cat_max) {
+            _MSG_ERROR("Unknown packet_retention_quota category '{}', expected one of "
+                    "eapol, beacon, pmkid, or dedupe", t[0]);
+            continue;
+        }
+
+        auto sz = string_to_n_dfl<size_t>(t[1], 0);
+
+        if (sz == 0) {
+            _MSG_ERROR("Invalid packet_retention_quota size '{}'", t[1]);
+            continue;
+        }
+
+        quota[c] = sz;
+    }
+
+    if (budget != 0)
+        _MSG_INFO("Limiting retained packets to {} bytes", budget);
+
+    auto timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
+
+    sweep_timer_id =
+        timetracker->register_timer(std::chrono::seconds(10), true,
+                [this](int) -> int {
+                    sweep();
+                    return 1;
+                });
+
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/packetretention/status", {"GET"}, httpd->RO_ROLE, {"json"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    status_endp(con);
+                }));
+}
+
+packet_retention::~packet_retention() {
+    auto timetracker = Globalreg::fetch_global_as<time_tracker>();
+
+    if (timetracker != nullptr)
+        timetracker->remove_timer(sweep_timer_id);
+
+    Globalreg::globalreg->remove_global(global_name());
+}
+
+void packet_retention::retain(category in_cat, std::shared_ptr<kis_tracked_packet> in_packet) {
+    if (in_packet == nullptr)
+        return;
+
+    size_t sz = in_packet->get_data()->length();
+
+    kis_lock_guard<kis_mutex> lk(mutex, "packet_retention retain");
+
+    auto ri = retained_index.find(in_packet.get());
+
+    if (ri != retained_index.end()) {
+        // A packet which is snapshotted again, like the beacon, moves to the back; a
+        // freed packet whose memory was reused for this one is replaced
+        release(ri->second);
+    }
+
+    retained[in_cat].push_back(retained_packet{in_packet, in_packet.get(), in_cat, sz});
+    retained_index[in_packet.get()] = std::prev(retained[in_cat].end());
+
+    bytes[in_cat].fetch_add(sz, std::memory_order_relaxed);
+    packets[in_cat].fetch_add(1, std::memory_order_relaxed);
+
+    // Evict from the category over its quota first, then from the largest category
+    // until the total fits the budget
+    while (quota[in_cat] != 0 && (size_t) get_bytes(in_cat) > quota[in_cat]) {
+        if (!evict_oldest(in_cat, in_packet.get()))
+            break;
+    }
+
+    if (budget == 0)
+        return;
+
+    while (true) {
+        int64_t total = 0;
+        int largest = -1;
+
+        for (int c = 0; c < cat_max; c++) {
+            total += get_bytes(static_cast<category>(c));
+
+            // The dedupe index evicts on its own
+            if (c == cat_dedupe || retained[c].size() == 0)
+                continue;
+
+            if (largest < 0 || get_bytes(static_cast<category>(c)) > get_bytes(static_cast<category>(largest)))
+                largest = c;
+        }
+
+        if (total <= (int64_t) budget || largest < 0)
+            break;
+
+        if (!evict_oldest(static_cast<category>(largest), in_packet.get()))
+            break;
+    }
+}
+
+void packet_retention::release(retained_list::iterator in_rp) {
+    bytes[in_rp->cat].fetch_sub(in_rp->bytes, std::memory_order_relaxed);
+    packets[in_rp->cat].fetch_sub(1, std::memory_order_relaxed);
+
+    auto ri = retained_index.find(in_rp->key);
+    if (ri != retained_index.end() && ri->second == in_rp)
+        retained_index.erase(ri);
+
+    retained[in_rp->cat].erase(in_rp);
+}
+
+bool packet_retention::evict_oldest(category in_cat, kis_tracked_packet *in_keep) {
+    while (retained[in_cat].size() > 0) {
+        auto rp = retained[in_cat].begin();
+        auto pkt = rp->packet.lock();
+
+        if (pkt.get() == in_keep)
+            return false;
+
+        if (pkt == nullptr) {
+            release(rp);
+            continue;
+        }
+
+        // Replace the data instead of clearing it, since a PMKID packet shares the data
+        // of the EAPOL packet it was copied from
+        pkt->set_data(std::static_pointer_cast<tracker_element_byte_array>(pkt->get_data()->clone_type()));
+
+        release(rp);
+        evicted[in_cat].fetch_add(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    return false;
+}
+
+void packet_retention::sweep() {
+    kis_lock_guard<kis_mutex> lk(mutex, "packet_retention sweep");
+
+    for (int c = 0; c < cat_max; c++) {
+        for (auto rp = retained[c].begin(); rp != retained[c].end(); ) {
+            auto next = std::next(rp);
+
+            if (rp->packet.expired())
+                release(rp);
+
+            rp = next;
+        }
+    }
+}
+
+void packet_retention::status_endp(std::shared_ptr<kis_net_beast_httpd_connection> con) {
+    con->set_mime_type("application/json");
+
+    std::ostream os(&con->response_stream());
+
+    nlohmann::json j;
+
+    j["kismet.packetretention.max_bytes"] = budget;
+
+    auto cj = nlohmann::json::array();
+
+    for (int c = 0; c < cat_max; c++) {
+        auto cat = static_cast<category>(c);
+
+        nlohmann::json e;
+
+        e["kismet.packetretention.category"] = category_name(cat);
+        e["kismet.packetretention.quota_bytes"] = quota[c];
+        e["kismet.packetretention.bytes"] = get_bytes(cat);
+        e["kismet.packetretention.packets"] = get_packets(cat);
+        e["kismet.packetretention.evicted"] = get_evicted(cat);
+
+        cj.push_back(std::move(e));
+    }
+
+    j["kismet.packetretention.categories"] = std::move(cj);
+
+    os << j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
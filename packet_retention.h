@@ -0,0 +1,154 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __PACKET_RETENTION_H__
+#define __PACKET_RETENTION_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "globalregistry.h"
+#include "kis_mutex.h"
+#include "kis_net_beast_httpd.h"
+#include "packet.h"
+
+// Memory budget for packets kept after they've been processed: the EAPOL frames, beacons,
+// and PMKID frames kept with 802.11 devices, and the original packets the dedupe index
+// holds on to.  In dense areas, or under a flood of handshakes, these otherwise grow
+// without limit.
+//
+// Packets are retained under a total budget (packet_retention_max) and optional quotas per
+// category (packet_retention_quota=category,bytes).  When a category exceeds its quota, or
+// the total exceeds the budget, the oldest packets are evicted: the packet data is dropped
+// and the timestamp, DLT, and source are kept, so an evicted packet can still be found in
+// the kismetdb packet log.
+//
+// Device packets are registered with retain(), which evicts packets of other devices, so
+// it must be called with the device list locked.  The dedupe index enforces its quota
+// itself, under its own locks, and reports its usage with account().
+//
+// Retained bytes, packets, and evictions per category are served at
+// /packetretention/status.json and exported in /metrics.
+class packet_retention : public lifetime_global {
+public:
+    static std::string global_name() { return "PACKET_RETENTION"; }
+
+    static std::shared_ptr<packet_retention> create_packet_retention() {
+        std::shared_ptr<packet_retention> mon(new packet_retention());
+        Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->insert_global(global_name(), mon);
+        return mon;
+    }
+
+    enum category {
+        cat_eapol = 0,
+        cat_beacon,
+        cat_pmkid,
+        cat_dedupe,
+        cat_max
+    };
+
+    static const char *category_name(category in_cat);
+
+private:
+    packet_retention();
+
+public:
+    virtual ~packet_retention();
+
+    // Retain the data of a device packet, or update the size of a packet retained before;
+    // may evict older packets.  The device list must be locked
+    void retain(category in_cat, std::shared_ptr<kis_tracked_packet> in_packet);
+
+    // Packets retained and released outside of the manager
+    void account(category in_cat, int64_t in_bytes, int64_t in_packets) {
+        bytes[in_cat].fetch_add(in_bytes, std::memory_order_relaxed);
+        packets[in_cat].fetch_add(in_packets, std::memory_order_relaxed);
+    }
+
+    void account_evicted(category in_cat, uint64_t in_packets) {
+        evicted[in_cat].fetch_add(in_packets, std::memory_order_relaxed);
+    }
+
+    // Quota of a category in bytes, or 0 for only the total budget
+    size_t get_quota(category in_cat) const {
+        return quota[in_cat];
+    }
+
+    size_t get_budget() const {
+        return budget;
+    }
+
+    uint64_t get_bytes(category in_cat) const {
+        return bytes[in_cat].load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_packets(category in_cat) const {
+        return packets[in_cat].load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_evicted(category in_cat) const {
+        return evicted[in_cat].load(std::memory_order_relaxed);
+    }
+
+protected:
+    struct retained_packet {
+        std::weak_ptr<kis_tracked_packet> packet;
+        // Index key, which outlives the packet
+        kis_tracked_packet *key;
+        category cat;
+        size_t bytes;
+    };
+
+    using retained_list = std::list<retained_packet>;
+
+    // Forget a retained packet without touching it
+    void release(retained_list::iterator in_rp);
+
+    // Drop the data of the oldest packet of a category; false if none is left other
+    // than the packet being retained
+    bool evict_oldest(category in_cat, kis_tracked_packet *in_keep);
+
+    // Forget packets which were freed with their devices
+    void sweep();
+
+    void status_endp(std::shared_ptr<kis_net_beast_httpd_connection> con);
+
+    kis_mutex mutex;
+
+    size_t budget;
+    size_t quota[cat_max];
+
+    std::atomic<int64_t> bytes[cat_max];
+    std::atomic<int64_t> packets[cat_max];
+    std::atomic<uint64_t> evicted[cat_max];
+
+    // Retained device packets of each category, oldest first
+    retained_list retained[cat_max];
+    std::unordered_map<kis_tracked_packet *, retained_list::iterator> retained_index;
+
+    int sweep_timer_id;
+};
+
+#endif
+
@@ -31,11 +31,14 @@
 #include "configfile.h"
 #include "globalregistry.h"
 #include "kis_datasource.h"
+#include "kis_metrics.h"
 #include "messagebus.h"
 #include "packet.h"
+#include "packet_retention.h"
 #include "packetchain.h"
 
 #include "crc32.h"
+#include "xxhash.h"
 
 class SortLinkPriority {
 public:
@@ -47,48 +50,169 @@ public:
     }
 };
 
+uint64_t packet_handler_histogram::count() const {
+    uint64_t c = 0;
+
+    for (const auto& b : buckets)
+        c += b.load(std::memory_order_relaxed);
+
+    return c;
+}
+
+uint64_t packet_handler_histogram::percentile(double p) const {
+    uint64_t counts[n_buckets];
+    uint64_t total = 0;
+
+    for (unsigned int b = 0; b < n_buckets; b++) {
+        counts[b] = buckets[b].load(std::memory_order_relaxed);
+        total += counts[b];
+    }
+
+    if (total == 0)
+        return 0;
+
+    uint64_t target = std::max(static_cast<uint64_t>(1),
+            static_cast<uint64_t>((p / 100.0) * total + 0.5));
+    uint64_t seen = 0;
+
+    for (unsigned int b = 0; b < n_buckets; b++) {
+        seen += counts[b];
+
+        if (seen >= target)
+            return std::min(bucket_value(b), max());
+    }
+
+    return max();
+}
+
 packet_chain::packet_chain() {
     packetcomp_mutex.set_name("packetchain packet_comp");
     packetchain_mutex.set_name("packetchain packetchain");
-    pack_no_mutex.set_name("packetchain packetno");
 
     unique_packet_no = 1;
 
-    dedupe_list_pos = 0;
+    auto dedupe_size =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("packet_dedup_size", 2048);
+    dedupe_window =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<time_t>("packet_dedup_window", 0);
+
+    _MSG_INFO("Using {} CRC32 for packet deduplication and FCS validation.", crc32_fast_name());
+
+    retention = Globalreg::fetch_mandatory_global_as<packet_retention>();
+    dedupe_shard_quota = retention->get_quota(packet_retention::cat_dedupe) / dedupe_n_shards;
+
+    for (auto& shard : dedupe_shards) {
+        shard.mutex.set_name("packetchain dedupe");
+        shard.ring.resize(std::max(dedupe_size / dedupe_n_shards, static_cast<size_t>(16)));
+        shard.index.reserve(shard.ring.size());
+    }
 
     Globalreg::enable_pool_type<kis_tracked_packet>([](auto *a) { a->reset(); });
 
-    next_componentid = 1;
+    // Core components are pinned to their fixed slots so they can also be resolved by type
+    const std::vector<std::pair<std::string, unsigned int>> fixed_components = {
+        {"linkframe", packet_slot::linkframe},
+        {"decap", packet_slot::decap},
+        {"radiodata", packet_slot::radiodata},
+        {"radiodata_agg", packet_slot::radiodata_agg},
+        {"kisdatasrc", packet_slot::datasource},
+        {"gps", packet_slot::gps},
+        {"common", packet_slot::common},
+        {"phy80211", packet_slot::phy80211},
+        {"device", packet_slot::device},
+        {"json", packet_slot::json},
+        {"protobuf", packet_slot::protobuf},
+        {"metablob", packet_slot::metablob},
+        {"devicetag", packet_slot::devicetag},
+    };
+
+    for (const auto& fc : fixed_components) {
+        component_str_map[fc.first] = fc.second;
+        component_id_map[fc.second] = fc.first;
+    }
+
+    next_componentid = packet_slot::first_dynamic;
 	next_handlerid = 1;
 
+    packet_tag_names.reset(new std::string[MAX_PACKET_TAGS]);
+    n_packet_tags = 0;
+
     last_packet_queue_user_warning = 0;
     last_packet_drop_user_warning = 0;
 
+    packets_total = 0;
+    packets_processed = 0;
+    packets_error = 0;
+    packets_dupe = 0;
+    packets_dropped = 0;
+    log_dropped = 0;
+
     packet_queue_warning = 
         Globalreg::globalreg->kismet_config->fetch_opt_uint("packet_log_warning", 0);
     packet_queue_drop =
         Globalreg::globalreg->kismet_config->fetch_opt_uint("packet_backlog_limit", 8192);
+    packet_queue_shed =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("packet_shed_limit", 0);
+
+    next_drop_policy_id = 1;
+
+    packet_batch_size =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("packet_batch_size", 1);
+
+    if (packet_batch_size == 0)
+        packet_batch_size = 1;
+
+    n_log_threads =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("packet_log_threads", 1);
+    log_queue_drop =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("packet_log_backlog_limit", 8192);
+    last_log_drop_user_warning = 0;
+
+    handler_timing_interval =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<uint64_t>("packet_handler_timing", 0);
+
+    if (handler_timing_interval != 0) {
+        for (auto& sl : stage_latency)
+            sl = std::make_shared<packet_handler_histogram>();
+    }
+
+    latency_trace_interval =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<uint64_t>("packet_latency_trace", 0);
+
+    packet_thread_affinity =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("packet_thread_affinity", false);
+
+    packet_priority_lanes =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("packet_priority_lanes", true);
+    packet_lane_starvation =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("packet_lane_starvation", 8);
+
+    if (packet_lane_starvation == 0)
+        packet_lane_starvation = 1;
+
+    packet_threads = nullptr;
+    n_packet_threads = 0;
 
     auto entrytracker = 
         Globalreg::fetch_mandatory_global_as<entry_tracker>();
 
     packet_peak_rrd_id = 
         entrytracker->register_field("kismet.packetchain.peak_packets_rrd",
-                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_default_aggregator,
+                tracker_element_factory<kis_tracked_atomic_rrd<kis_tracked_rrd_default_aggregator,
                     kis_tracked_rrd_prev_pos_extreme_aggregator, 
                     kis_tracked_rrd_prev_pos_extreme_aggregator>>(),
                 "incoming packets peak rrd");
     packet_peak_rrd = 
-        std::make_shared<kis_tracked_rrd<kis_tracked_rrd_default_aggregator,
+        std::make_shared<kis_tracked_atomic_rrd<kis_tracked_rrd_default_aggregator,
             kis_tracked_rrd_prev_pos_extreme_aggregator, 
             kis_tracked_rrd_prev_pos_extreme_aggregator>>(packet_peak_rrd_id);
 
     packet_rate_rrd_id = 
         entrytracker->register_field("kismet.packetchain.packets_rrd",
-                tracker_element_factory<kis_tracked_rrd<>>(),
+                tracker_element_factory<kis_tracked_atomic_rrd<>>(),
                 "total packet rate rrd");
     packet_rate_rrd = 
-        std::make_shared<kis_tracked_rrd<>>(packet_rate_rrd_id);
+        std::make_shared<kis_tracked_atomic_rrd<>>(packet_rate_rrd_id);
 
     packet_error_rrd_id = 
         entrytracker->register_field("kismet.packetchain.error_packets_rrd",
@@ -118,6 +242,32 @@ packet_chain::packet_chain() {
     packet_drop_rrd =
         std::make_shared<kis_tracked_rrd<>>(packet_drop_rrd_id);
 
+    log_queue_rrd_id =
+        entrytracker->register_field("kismet.packetchain.log_queued_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "packet logging backlog queue rrd");
+    log_queue_rrd =
+        std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(log_queue_rrd_id);
+
+    log_drop_rrd_id =
+        entrytracker->register_field("kismet.packetchain.log_dropped_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "packets not logged / logging queue overfull rrd");
+    log_drop_rrd =
+        std::make_shared<kis_tracked_rrd<>>(log_drop_rrd_id);
+
+    drop_policy_rrd_id =
+        entrytracker->register_field("kismet.packetchain.policy_dropped_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "packets shed by a drop policy rrd");
+
+    drop_policy_map_id =
+        entrytracker->register_field("kismet.packetchain.drop_policies",
+                tracker_element_factory<tracker_element_string_map>(),
+                "packets shed by each drop policy");
+    drop_policy_map =
+        std::make_shared<tracker_element_string_map>(drop_policy_map_id);
+
     packet_processed_rrd_id =
         entrytracker->register_field("kismet.packetchain.processed_packets_rrd",
                 tracker_element_factory<kis_tracked_rrd<>>(),
@@ -125,6 +275,102 @@ packet_chain::packet_chain() {
     packet_processed_rrd =
         std::make_shared<kis_tracked_rrd<>>(packet_processed_rrd_id);
 
+    packet_batch_rrd_id =
+        entrytracker->register_field("kismet.packetchain.batch_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "packet processing batch size rrd");
+    packet_batch_rrd =
+        std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(packet_batch_rrd_id);
+
+    component_pool_hit_rrd_id =
+        entrytracker->register_field("kismet.packetchain.component_pool_hit_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "packet components allocated from the pool rrd");
+    component_pool_hit_rrd =
+        std::make_shared<kis_tracked_rrd<>>(component_pool_hit_rrd_id);
+
+    component_pool_miss_rrd_id =
+        entrytracker->register_field("kismet.packetchain.component_pool_miss_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "packet components allocated outside the pool rrd");
+    component_pool_miss_rrd =
+        std::make_shared<kis_tracked_rrd<>>(component_pool_miss_rrd_id);
+
+    last_component_pool_hits = 0;
+    last_component_pool_misses = 0;
+
+    handler_timing_entry_id =
+        entrytracker->register_field("kismet.packetchain.handler",
+                tracker_element_factory<tracked_handler_latency>(),
+                "packet handler latency");
+
+    handler_timing_vec_id =
+        entrytracker->register_field("kismet.packetchain.handler_timing",
+                tracker_element_factory<tracker_element_vector>(),
+                "packet handler latencies");
+
+    source_trace_segment_id =
+        entrytracker->register_field("kismet.packetchain.trace.segment_latency",
+                tracker_element_factory<tracked_trace_segment>(),
+                "traced packet segment latency");
+
+    source_trace_entry_id =
+        entrytracker->register_field("kismet.packetchain.trace.source",
+                tracker_element_factory<tracked_source_trace>(),
+                "traced packet latency of a datasource");
+
+    source_trace_vec_id =
+        entrytracker->register_field("kismet.packetchain.source_latency",
+                tracker_element_factory<tracker_element_vector>(),
+                "traced packet latency of each datasource");
+
+    packet_thread_queue_rrd_id =
+        entrytracker->register_field("kismet.packetchain.thread_queued_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "per-thread packet backlog queue rrd");
+
+    packet_thread_queue_vec_id =
+        entrytracker->register_field("kismet.packetchain.thread_queues",
+                tracker_element_factory<tracker_element_vector>(),
+                "per-thread packet backlog queues");
+    packet_thread_queue_vec =
+        std::make_shared<tracker_element_vector>(packet_thread_queue_vec_id);
+
+    lane_queue_rrd_id =
+        entrytracker->register_field("kismet.packetchain.lane_queued_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "packet backlog ahead of a queue lane rrd");
+
+    lane_drop_rrd_id =
+        entrytracker->register_field("kismet.packetchain.lane_dropped_packets_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "packets dropped from a queue lane rrd");
+
+    lane_queue_map_id =
+        entrytracker->register_field("kismet.packetchain.lane_queues",
+                tracker_element_factory<tracker_element_string_map>(),
+                "packet backlog ahead of each queue lane");
+    lane_queue_map =
+        std::make_shared<tracker_element_string_map>(lane_queue_map_id);
+
+    lane_drop_map_id =
+        entrytracker->register_field("kismet.packetchain.lane_drops",
+                tracker_element_factory<tracker_element_string_map>(),
+                "packets dropped from each queue lane");
+    lane_drop_map =
+        std::make_shared<tracker_element_string_map>(lane_drop_map_id);
+
+    for (int l = 0; l < PACKET_LANE_MAX; l++) {
+        lane_queue_rrd[l] = 
+            std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(lane_queue_rrd_id);
+        lane_queue_map->insert(lane_name(l), lane_queue_rrd[l]);
+
+        lane_drop_rrd[l] = std::make_shared<kis_tracked_rrd<>>(lane_drop_rrd_id);
+        lane_drop_map->insert(lane_name(l), lane_drop_rrd[l]);
+
+        lane_dropped[l] = 0;
+    }
+
     packet_stats_map = 
         std::make_shared<tracker_element_map>();
     packet_stats_map->insert(packet_peak_rrd);
@@ -133,7 +379,16 @@ packet_chain::packet_chain() {
     packet_stats_map->insert(packet_dupe_rrd);
     packet_stats_map->insert(packet_queue_rrd);
     packet_stats_map->insert(packet_drop_rrd);
+    packet_stats_map->insert(drop_policy_map);
+    packet_stats_map->insert(log_queue_rrd);
+    packet_stats_map->insert(log_drop_rrd);
     packet_stats_map->insert(packet_processed_rrd);
+    packet_stats_map->insert(packet_batch_rrd);
+    packet_stats_map->insert(component_pool_hit_rrd);
+    packet_stats_map->insert(component_pool_miss_rrd);
+    packet_stats_map->insert(packet_thread_queue_vec);
+    packet_stats_map->insert(lane_queue_map);
+    packet_stats_map->insert(lane_drop_map);
 
     packet_pool.set_max(1024);
     packet_pool.set_reset([](kis_packet *p) { p->reset(); });
@@ -158,20 +413,52 @@ packet_chain::packet_chain() {
             std::make_shared<kis_net_web_tracked_endpoint>(packet_drop_rrd));
     httpd->register_route("/packetchain/packet_processed", {"GET", "POST"}, httpd->RO_ROLE, {},
             std::make_shared<kis_net_web_tracked_endpoint>(packet_processed_rrd));
+    httpd->register_route("/packetchain/packet_batch", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(packet_batch_rrd));
+    httpd->register_route("/packetchain/handler_timing", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection>) -> std::shared_ptr<tracker_element> {
+                    return handler_timing_summary();
+                }));
+    httpd->register_route("/packetchain/source_latency", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection>) -> std::shared_ptr<tracker_element> {
+                    return source_trace_summary();
+                }));
 
     packetchain_shutdown = false;
+    packet_processing = false;
 
    timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
     eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
+    event_handlertiming_chan = eventbus->register_channel(event_handlertiming());
 
     event_timer_id = 
         timetracker->register_timer(std::chrono::seconds(1), true, 
                 [this](int) -> int {
 
+                time_t now = (time_t) Globalreg::globalreg->last_tv_sec;
+
+                auto hits = thread_object_pool_stats::hits().load(std::memory_order_relaxed);
+                auto misses = thread_object_pool_stats::misses().load(std::memory_order_relaxed);
+
+                component_pool_hit_rrd->add_sample(hits - last_component_pool_hits, now);
+                component_pool_miss_rrd->add_sample(misses - last_component_pool_misses, now);
+
+                last_component_pool_hits = hits;
+                last_component_pool_misses = misses;
+
                 auto evt = eventbus->get_eventbus_event(event_packetstats());
                 evt->get_event_content()->insert(event_packetstats(), packet_stats_map);
                 eventbus->publish(evt);
 
+                if (handler_timing_interval != 0 && 
+                        eventbus->has_listeners(event_handlertiming_chan)) {
+                    auto tevt = eventbus->get_eventbus_event(event_handlertiming());
+                    tevt->get_event_content()->insert(event_handlertiming(), handler_timing_summary());
+                    eventbus->publish(tevt);
+                }
+
                 return 1;
                 });
 
@@ -181,76 +468,166 @@ packet_chain::packet_chain() {
     pack_comp_l1_agg = register_packet_component("RADIODATA_AGG");
 	pack_comp_datasource = register_packet_component("KISDATASRC");
 
-    postcap_chain_update = false;
-    llcdissect_chain_update = false;
-    decrypt_chain_update = false;
-    datadissect_chain_update = false;
-    classifier_chain_update = false;
-    tracker_chain_update = false;
-    logging_chain_update = false;
-
-    // Checksum and dedupe function runs at the end of LLC dissection, which should be
-    // after any phy demangling and DLT demangling; lock the packet for the rest of the 
-    // packet chain
-    register_handler([this](std::shared_ptr<kis_packet> in_pack) -> int {
-        // Lock the hash list, gating all hash comparisons 
-        kis_lock_guard<kis_shared_mutex> lk(pack_no_mutex, "hash handler");
-
-        auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+    publish_chains(std::make_shared<chain_set>());
 
-        if (chunk == nullptr)
-            return 1;
-
-        if (chunk->data() == nullptr)
-            return 1;
+    // Checksum and dedupe runs at the end of post-capture, which is after any DLT
+    // demangling; it runs in the capture thread before the packet is assigned to a 
+    // processing thread, so that duplicates can be assigned to the same thread as the
+    // original
+    register_handler([this](std::shared_ptr<kis_packet> in_pack) -> int {
+        dedupe_packet(in_pack);
+        return 1;
+    }, CHAINPOS_POSTCAP, 100000);
 
-        if (chunk->length() == 0)
+    // Once the duplicate is running in the processing thread, copy the decoded state 
+    // of the original, and lock the packet for the rest of the packet chain
+    register_handler([this](std::shared_ptr<kis_packet> in_pack) -> int {
+        if (!in_pack->duplicate || in_pack->original == nullptr)
             return 1;
 
-        in_pack->hash = crc32_fast(chunk->data(), chunk->length(), 0);
-
-        for (unsigned int i = 0; i < 1024; i++) {
-            if (dedupe_list[i].hash == in_pack->hash) {
-                in_pack->duplicate = true;
-                in_pack->packet_no = dedupe_list[i].packno;
-                in_pack->original = dedupe_list[i].original_pkt;
-
-                // We have to wait until everything is done being changed in the packet
-                // before we can copy the duplicate decoded state over, grab the lock that
-                // is released at the end of the chain
-                kis_lock_guard<kis_mutex> lg(dedupe_list[i].original_pkt->mutex);
-                for (unsigned int c = 0; c < MAX_PACKET_COMPONENTS; c++) {
-                    auto cp = dedupe_list[i].original_pkt->content_vec[c];
-                    if (cp != nullptr) {
-                        if (cp->unique())
-                            continue;
-
-                        in_pack->content_vec[c] = cp;
-                    }
-                }
-
-                // Merge the signal levels
-                if (in_pack->has(pack_comp_l1) && in_pack->has(pack_comp_datasource)) {
-                    auto l1 = in_pack->original->fetch<kis_layer1_packinfo>(pack_comp_l1);
-                    auto radio_agg = in_pack->fetch_or_add<kis_layer1_aggregate_packinfo>(pack_comp_l1_agg);
-                    auto datasrc = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasource);
-                    radio_agg->source_l1_map[datasrc->ref_source->get_source_uuid()] = l1;
-                }
+        // The original is processed by the same thread ahead of us, so it has either
+        // completed or is earlier in the same batch (and the lock is ours).  Once it has
+        // completed, a log thread may be holding it while it logs the batch it is in, so
+        // this can wait on logging, but never on another processing thread.
+        //
+        // An original earlier in the same batch has only been through the stages up to 
+        // LLC dissection, so only the components decoded by then are aliased; anything 
+        // the original decodes later is not shared with the duplicate.
+        kis_lock_guard<kis_mutex> lg(in_pack->original->mutex);
+        for (unsigned int c = 0; c < MAX_PACKET_COMPONENTS; c++) {
+            auto cp = in_pack->original->fetch(c);
+            if (cp != nullptr) {
+                if (cp->unique())
+                    continue;
+
+                in_pack->alias(c, cp);
             }
         }
 
-        // Assign a new packet number and cache it in the dedupe
-        if (!in_pack->duplicate) {
-            auto listpos = dedupe_list_pos++ % 1024;
-            in_pack->packet_no = unique_packet_no++;
-            dedupe_list[listpos].hash = in_pack->hash;
-            dedupe_list[listpos].packno = unique_packet_no++;
-            dedupe_list[listpos].original_pkt = in_pack;
+        // Merge the signal levels of this source into the aggregate shared with 
+        // the original
+        if (in_pack->has(pack_comp_l1) && in_pack->has(pack_comp_datasource)) {
+            auto l1 = in_pack->fetch<kis_layer1_packinfo>(pack_comp_l1);
+            auto radio_agg = in_pack->fetch_or_add<kis_layer1_aggregate_packinfo>(pack_comp_l1_agg);
+            auto datasrc = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasource);
+            radio_agg->source_l1_map[datasrc->ref_source->get_source_uuid()] = l1;
         }
 
         return 1;
     }, CHAINPOS_LLCDISSECT, -100000);
 
+    // Built-in drop policies, enabled in the order they're configured
+    for (const auto& p : Globalreg::globalreg->kismet_config->fetch_opt_vec("packet_shed_policy")) {
+        auto policy = str_lower(p);
+
+        if (policy == "duplicate") {
+            register_drop_policy(policy, [](std::shared_ptr<kis_packet> in_pack) -> bool {
+                return in_pack->duplicate;
+            });
+        } else if (policy == "dot11_data") {
+            register_drop_policy(policy, [this](std::shared_ptr<kis_packet> in_pack) -> bool {
+                return dot11_frame_type(in_pack) == 2;
+            });
+        } else if (policy == "dot11_nonmgmt") {
+            register_drop_policy(policy, [this](std::shared_ptr<kis_packet> in_pack) -> bool {
+                auto t = dot11_frame_type(in_pack);
+                return t == 1 || t == 2;
+            });
+        } else {
+            _MSG_ERROR("Unknown packet_shed_policy '{}', expected one of duplicate, "
+                    "dot11_data, or dot11_nonmgmt", p);
+        }
+    }
+}
+
+void packet_chain::dedupe_packet(std::shared_ptr<kis_packet> in_pack) {
+    auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+    if (chunk == nullptr)
+        return;
+
+    if (chunk->data() == nullptr)
+        return;
+
+    if (chunk->length() == 0)
+        return;
+
+    in_pack->hash = crc32_fast(chunk->data(), chunk->length(), 0);
+
+    uint64_t key = (static_cast<uint64_t>(in_pack->hash) << 32) | 
+        static_cast<uint32_t>(chunk->length());
+    auto& shard = dedupe_shards[in_pack->hash % dedupe_n_shards];
+    time_t now = in_pack->ts.tv_sec;
+
+    kis_lock_guard<kis_mutex> lk(shard.mutex, "dedupe");
+
+    auto ei = shard.index.find(key);
+
+    if (ei != shard.index.end()) {
+        auto& e = shard.ring[ei->second];
+
+        if (dedupe_window == 0 || now - e.ts <= dedupe_window) {
+            in_pack->duplicate = true;
+            in_pack->packet_no = e.packno;
+            in_pack->original = e.original_pkt;
+            return;
+        }
+    }
+
+    // Assign a new packet number and record it, replacing the oldest entry in 
+    // the shard
+    in_pack->packet_no = unique_packet_no++;
+
+    auto pos = shard.ring_pos;
+    shard.ring_pos = (shard.ring_pos + 1) % shard.ring.size();
+
+    auto& e = shard.ring[pos];
+
+    if (e.original_pkt != nullptr)
+        dedupe_release(shard, e);
+
+    e.key = key;
+    e.packno = in_pack->packet_no;
+    e.ts = now;
+    e.original_pkt = in_pack;
+    e.bytes = chunk->length();
+
+    shard.index[key] = pos;
+
+    shard.bytes += e.bytes;
+    retention->account(packet_retention::cat_dedupe, e.bytes, 1);
+
+    // Over the quota, release the oldest originals; the ring position now points at the
+    // oldest entry
+    if (dedupe_shard_quota != 0 && shard.bytes > dedupe_shard_quota) {
+        uint64_t n_evicted = 0;
+
+        for (size_t i = 0; i < shard.ring.size() - 1 && shard.bytes > dedupe_shard_quota; i++) {
+            auto& o = shard.ring[(shard.ring_pos + i) % shard.ring.size()];
+
+            if (o.original_pkt == nullptr)
+                continue;
+
+            dedupe_release(shard, o);
+            n_evicted++;
+        }
+
+        retention->account_evicted(packet_retention::cat_dedupe, n_evicted);
+    }
+}
+
+void packet_chain::dedupe_release(dedupe_shard& shard, dedupe_entry& e) {
+    auto oi = shard.index.find(e.key);
+    auto pos = static_cast<size_t>(&e - shard.ring.data());
+
+    if (oi != shard.index.end() && oi->second == pos)
+        shard.index.erase(oi);
+
+    shard.bytes -= e.bytes;
+    retention->account(packet_retention::cat_dedupe, -static_cast<int64_t>(e.bytes), -1);
+
+    e.original_pkt.reset();
+    e.bytes = 0;
 }
 
 packet_chain::~packet_chain() {
@@ -268,7 +645,8 @@ packet_chain::~packet_chain() {
             if (t == nullptr)
                 continue;
 
-            t->packet_queue.enqueue(nullptr);
+            // Behind everything else, so the thread drains its lanes first
+            enqueue_packet(t, PACKET_LANE_MAX - 1, nullptr);
 
             if (t->packet_thread.joinable())
                 t->packet_thread.join();
@@ -279,44 +657,82 @@ packet_chain::~packet_chain() {
 
         delete[] packet_threads;
         packet_threads = nullptr;
+
+        // Loggers are stopped after the packet threads so they can drain anything
+        // still queued to them
+        for (size_t i = 0; i < log_threads.size(); i++)
+            log_queue.enqueue(nullptr);
+
+        for (auto& t : log_threads) {
+            if (t.joinable())
+                t.join();
+        }
+
+        log_threads.clear();
     }
 
     {
-        kis_lock_guard<kis_shared_mutex> lk(packetchain_mutex, "~packet_chain");
+        kis_lock_guard<kis_mutex> lk(packetchain_mutex, "~packet_chain");
 
         Globalreg::globalreg->remove_global("PACKETCHAIN");
         Globalreg::globalreg->packetchain = NULL;
 
-        postcap_chain.clear();
-        llcdissect_chain.clear();
-        decrypt_chain.clear();
-        datadissect_chain.clear();
-        classifier_chain.clear();
-        tracker_chain.clear();
-        logging_chain.clear();
+        publish_chains(std::make_shared<chain_set>());
 
     }
 
 }
 
+thread_local int packet_chain::packet_thread_index = -1;
+
 void packet_chain::start_processing() {
     n_packet_threads = Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("kismet_packet_threads", 0);
 
     if (n_packet_threads == 0)
         n_packet_threads = static_cast<unsigned int>(std::thread::hardware_concurrency());
 
+    auto cpus_opt = Globalreg::globalreg->kismet_config->fetch_opt("packet_thread_cpus");
+
+    if (!parse_cpu_list(cpus_opt, packet_thread_cpus)) {
+        _MSG_ERROR("Could not parse packet_thread_cpus '{}', expected a list of CPUs such as "
+                "0-3,8 or a NUMA node such as node0; packet threads will run on any CPU.",
+                cpus_opt);
+        packet_thread_cpus.clear();
+    }
+
     packet_threads = new packet_thread*[n_packet_threads];
 
     for (unsigned int n = 0; n < n_packet_threads; n++) {
         packet_threads[n] = new packet_thread();
+        packet_threads[n]->queue_rrd =
+            std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(packet_thread_queue_rrd_id);
+        packet_thread_queue_vec->push_back(packet_threads[n]->queue_rrd);
+
         packet_threads[n]->packet_thread = 
             std::thread([this, n]() {
             auto name = fmt::format("PACKET {}/{}", n, n_packet_threads);
             thread_set_process_name(name);
-            packet_queue_processor(&packet_threads[n]->packet_queue);
+
+            packet_thread_index = static_cast<int>(n);
+
+            if (!thread_set_cpu_affinity(packet_thread_cpus) && n == 0)
+                _MSG_ERROR("Could not restrict the packet threads to the configured CPUs; "
+                        "check that the CPUs exist and are available to Kismet.");
+
+            packet_queue_processor(packet_threads[n]);
         });
     }
 
+    packet_processing = true;
+
+    for (unsigned int n = 0; n < n_log_threads; n++) {
+        log_threads.push_back(std::thread([this, n]() {
+            auto name = fmt::format("PACKETLOG {}/{}", n, n_log_threads);
+            thread_set_process_name(name);
+            log_queue_processor();
+        }));
+    }
+
 }
 
 int packet_chain::register_packet_component(std::string in_component) {
@@ -368,553 +784,1284 @@ std::string packet_chain::fetch_packet_component_name(int in_id) {
 	return component_id_map[in_id];
 }
 
+int packet_chain::register_packet_tag(const std::string& in_tag) {
+    kis_lock_guard<kis_mutex> lk(packetcomp_mutex, "packet_chain register_packet_tag");
+
+    auto ti = packet_tag_map.find(in_tag);
+    if (ti != packet_tag_map.end())
+        return ti->second;
+
+    int num = n_packet_tags.load(std::memory_order_relaxed);
+
+    if (num >= MAX_PACKET_TAGS) {
+        _MSG_ERROR("Attempted to register more than the maximum of {} packet tags; packets "
+                "will not be tagged with {}.  Report this to the kismet developers along "
+                "with a list of any plugins you might be using.", MAX_PACKET_TAGS, in_tag);
+        return -1;
+    }
+
+    packet_tag_names[num] = in_tag;
+    packet_tag_map[in_tag] = num;
+
+    n_packet_tags.store(num + 1, std::memory_order_release);
+
+    return num;
+}
+
+const std::string& packet_chain::fetch_packet_tag_name(int in_id) const {
+    static const std::string unknown{"<UNKNOWN>"};
+
+    if (in_id < 0 || in_id >= n_packet_tags.load(std::memory_order_acquire))
+        return unknown;
+
+    return packet_tag_names[in_id];
+}
+
 std::shared_ptr<kis_packet> packet_chain::generate_packet() {
     return packet_pool.acquire();
     // return std::make_shared<kis_packet>();
 }
 
-void packet_chain::packet_queue_processor(moodycamel::BlockingConcurrentQueue<std::shared_ptr<kis_packet>> *packet_queue) {
-    std::shared_ptr<kis_packet> packet;
+// Time each packet in the current batch has spent in the stage, when handler timing is enabled
+static thread_local std::vector<uint64_t> batch_stage_ns;
 
-    while (!packetchain_shutdown && 
-            !Globalreg::globalreg->spindown && 
-            !Globalreg::globalreg->fatal_condition &&
-            !Globalreg::globalreg->complete) {
+void packet_chain::process_chain_batch(const std::vector<std::shared_ptr<packet_chain::pc_link>>& chain,
+        int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets, uint64_t first_no) {
+    if (handler_timing_interval != 0)
+        batch_stage_ns.assign(n_packets, 0);
 
-        packet_queue->wait_dequeue(packet);
+    // Batch subscribers split the chain; the handlers ahead of one finish the whole
+    // batch before it's called, so every handler still sees each packet in priority order
+    auto seg_start = chain.cbegin();
 
-        if (packet == nullptr)
-            break;
+    for (auto l = chain.cbegin(); l != chain.cend(); ++l) {
+        if ((*l)->b_callback == nullptr)
+            continue;
 
+        process_chain_segment(seg_start, l, in_chain, batch, n_packets, first_no);
+        call_batch_handler(*l, in_chain, batch, n_packets);
 
-        // Lock the packet chain and update any processing queues by replacing
-        // the old queue with the new one.
+        seg_start = l + 1;
+    }
 
-        kis_unique_lock<kis_shared_mutex> lk(packetchain_mutex, "packet processor");
+    process_chain_segment(seg_start, chain.cend(), in_chain, batch, n_packets, first_no);
 
-        if (llcdissect_chain_update) {
-            llcdissect_chain = llcdissect_chain_new;
-            llcdissect_chain_new.clear();
-            llcdissect_chain_update = false;
-        }
+    if (latency_trace_interval != 0)
+        stamp_packet_trace(in_chain, batch, n_packets);
 
-        if (decrypt_chain_update) {
-            decrypt_chain = decrypt_chain_new;
-            decrypt_chain_new.clear();
-            decrypt_chain_update = false;
-        }
+    if (handler_timing_interval == 0 || chain.size() == 0)
+        return;
 
-        if (datadissect_chain_update) {
-            datadissect_chain = datadissect_chain_new;
-            datadissect_chain_new.clear();
-            datadissect_chain_update = false;
-        }
+    // Packets which skipped the stage took no time in it
+    for (size_t i = 0; i < n_packets; i++) {
+        if ((first_no + i) % handler_timing_interval == 0 && batch_stage_ns[i] != 0)
+            stage_latency[in_chain]->record(batch_stage_ns[i]);
+    }
+}
 
-        if (classifier_chain_update) {
-            classifier_chain = classifier_chain_new;
-            classifier_chain_new.clear();
-            classifier_chain_update = false;
-        }
+void packet_chain::process_chain_segment(std::vector<std::shared_ptr<packet_chain::pc_link>>::const_iterator first,
+        std::vector<std::shared_ptr<packet_chain::pc_link>>::const_iterator last,
+        int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets, uint64_t first_no) {
+    if (first == last)
+        return;
 
-        if (tracker_chain_update) {
-            tracker_chain = tracker_chain_new;
-            tracker_chain_new.clear();
-            tracker_chain_update = false;
-        }
+    for (size_t i = 0; i < n_packets; i++) {
+        if (batch[i]->held || batch[i]->resume_chain > in_chain)
+            continue;
 
-        if (logging_chain_update) {
-            logging_chain = logging_chain_new;
-            logging_chain_new.clear();
-            logging_chain_update = false;
-        }
+        if (handler_timing_interval != 0 && (first_no + i) % handler_timing_interval == 0) {
+            auto start = std::chrono::steady_clock::now();
 
-        lk.unlock();
-
-        // These can only be perturbed inside a sync, which can only occur when
-        // the worker thread is in the sync block above, so we shouldn't
-        // need to worry about the integrity of these vectors while running
-
-        /* Postcap is now handled before it gets into the per-thread chain
-           for (const auto& pcl : postcap_chain) {
-           if (pcl->callback != nullptr)
-           pcl->callback(pcl->auxdata, packet);
-           else if (pcl->l_callback != nullptr)
-           pcl->l_callback(packet);
-           }
-           */
-
-        // Lock the individual packet to make sure no competing processing threads
-        // manipulate it while we're processing
-        packet->mutex.lock();
-
-        for (const auto& pcl : llcdissect_chain) {
-            if (pcl->callback != nullptr)
-                pcl->callback(pcl->auxdata, packet);
-            else if (pcl->l_callback != nullptr)
-                pcl->l_callback(packet);
-        }
+            for (auto pcl = first; pcl != last; ++pcl) {
+                call_handler_timed(*pcl, batch[i]);
 
-        for (const auto& pcl : decrypt_chain) {
-            if (pcl->callback != nullptr)
-                pcl->callback(pcl->auxdata, packet);
-            else if (pcl->l_callback != nullptr)
-                pcl->l_callback(packet);
-        }
+                if (batch[i]->held)
+                    break;
+            }
 
-        for (const auto& pcl : datadissect_chain) {
-            if (pcl->callback != nullptr)
-                pcl->callback(pcl->auxdata, packet);
-            else if (pcl->l_callback != nullptr)
-                pcl->l_callback(packet);
-        }
+            batch_stage_ns[i] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
 
-        for (const auto& pcl : classifier_chain) {
-            if (pcl->callback != nullptr)
-                pcl->callback(pcl->auxdata, packet);
-            else if (pcl->l_callback != nullptr)
-                pcl->l_callback(packet);
+            continue;
         }
 
-        for (const auto& pcl : tracker_chain) {
-            if (pcl->callback != nullptr)
-                pcl->callback(pcl->auxdata, packet);
-            else if (pcl->l_callback != nullptr)
-                pcl->l_callback(packet);
-        }
+        for (auto pcl = first; pcl != last; ++pcl) {
+            call_handler(*pcl, batch[i]);
 
-        for (const auto& pcl : logging_chain) {
-            if (pcl->callback != nullptr)
-                pcl->callback(pcl->auxdata, packet);
-            else if (pcl->l_callback != nullptr)
-                pcl->l_callback(packet);
+            if (batch[i]->held)
+                break;
         }
+    }
+}
 
-        packet->mutex.unlock();
-
-        uint64_t now = Globalreg::globalreg->last_tv_sec;
+void packet_chain::call_batch_handler(const std::shared_ptr<packet_chain::pc_link>& pcl,
+        int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets) {
+    static thread_local std::vector<std::shared_ptr<kis_packet>> matched;
+    static thread_local std::vector<size_t> matched_idx;
 
-        if (packet->error)
-            packet_error_rrd->add_sample(1, now);
+    matched.clear();
+    matched_idx.clear();
 
-        if (packet->duplicate)
-            packet_dupe_rrd->add_sample(1, now);
+    for (size_t i = 0; i < n_packets; i++) {
+        if (batch[i]->held || batch[i]->resume_chain > in_chain)
+            continue;
 
-        packet_processed_rrd->add_sample(1, now);
+        if (!handler_matches(pcl, batch[i]))
+            continue;
 
-        continue;
+        matched.push_back(batch[i]);
+        matched_idx.push_back(i);
     }
-}
-
-int packet_chain::process_packet(std::shared_ptr<kis_packet> in_pack) {
-    if (in_pack == nullptr)
-        return 1;
-
-    time_t now = (time_t) Globalreg::globalreg->last_tv_sec;
 
-    // Total packet rate always gets added, even when we drop, so we can compare
-    packet_rate_rrd->add_sample(1, now);
-    packet_peak_rrd->add_sample(1, now);
+    if (matched.size() == 0)
+        return;
 
-    // Import the new postcap chain, if it has been modified
-    kis_unique_lock<kis_shared_mutex> lk(packetchain_mutex, "process_packet");
-    if (postcap_chain_update) {
-        postcap_chain = postcap_chain_new;
-        postcap_chain_new.clear();
-        postcap_chain_update = false;
-    }
-    lk.unlock();
+    if (handler_timing_interval != 0 && pcl->latency != nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        pcl->b_callback(matched.data(), matched.size());
+        auto end = std::chrono::steady_clock::now();
 
-    // Run the post-capture processing
-    for (const auto& pcl : postcap_chain) {
-        if (pcl->callback != nullptr)
-            pcl->callback(pcl->auxdata, in_pack);
-        else if (pcl->l_callback != nullptr)
-            pcl->l_callback(in_pack);
-    }
+        // Recorded per packet, so batch subscribers compare with per-packet handlers
+        auto per_packet_ns = 
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / matched.size();
 
-    // assign it to a thread
-    unsigned int processing_id;
+        pcl->latency->record(per_packet_ns);
 
-    // If there is no assignment id, randomly assign the packet to a thread.
-    // Otherwise transform the assignment id to a consistent thread.
-    // If the packet is a duplicate, assign it to the same thread as the original.
-    if (in_pack->assignment_id == 0) {
-        if (in_pack->original != nullptr) {
-            processing_id = in_pack->original->assignment_id % n_packet_threads;
-        } else {
-            processing_id = rand() % n_packet_threads;
-        }
+        for (auto i : matched_idx)
+            batch_stage_ns[i] += per_packet_ns;
     } else {
-        processing_id = in_pack->assignment_id % n_packet_threads;
+        pcl->b_callback(matched.data(), matched.size());
     }
 
-    auto qsize = packet_threads[processing_id]->packet_queue.size_approx();
-
-    if (packet_queue_drop != 0 && qsize > packet_queue_drop) {
-        time_t offt = now - last_packet_drop_user_warning;
+    matched.clear();
+}
 
-        if (offt > 30) {
-            last_packet_drop_user_warning = now;
+void packet_chain::enqueue_packet(packet_thread *in_thread, int in_lane, 
+        std::shared_ptr<kis_packet> in_pack) {
+    in_thread->lanes[in_lane].enqueue(std::move(in_pack));
+    in_thread->pending.signal();
+}
 
-            std::shared_ptr<alert_tracker> alertracker =
-                Globalreg::fetch_mandatory_global_as<alert_tracker>();
-            alertracker->raise_one_shot("PACKETLOST", 
-                    "SYSTEM", kis_alert_severity::high,
-                    fmt::format("The packet queue has exceeded the maximum size of {}; Kismet "
-                        "will start dropping packets.  Your system may not have enough CPU to keep "
-                        "up with the packet rate in your environment or other processes may be "
-                        "taking up the CPU.  You can increase the packet backlog with the "
-                        "packet_backlog_limit configuration parameter.", packet_queue_drop), -1);
-        }
+size_t packet_chain::dequeue_packet_batch(packet_thread *in_thread, 
+        std::shared_ptr<kis_packet> *batch) {
+    // Every packet counted by the semaphore has been queued to a lane, so there are at 
+    // least n_packets to take, though a packet which was just queued may take a moment 
+    // to become visible
+    auto n_packets = static_cast<size_t>(in_thread->pending.waitMany(packet_batch_size));
 
-        packet_drop_rrd->add_sample(1, now);
+    // A lower lane which has been passed over for too long goes first
+    int first = -1;
 
-        return 1;
+    for (int l = PACKET_LANE_MAX - 1; l > 0; l--) {
+        if (in_thread->lane_starved[l] >= packet_lane_starvation) {
+            first = l;
+            break;
+        }
     }
 
-    if (qsize > packet_queue_warning && packet_queue_warning != 0) {
-        time_t offt = now - last_packet_queue_user_warning;
+    size_t taken[PACKET_LANE_MAX] = {};
+    size_t n = 0;
 
-        if (offt > 30) {
-            last_packet_queue_user_warning = now;
+    if (first >= 0) {
+        taken[first] = in_thread->lanes[first].try_dequeue_bulk(batch, n_packets);
+        n += taken[first];
+    }
 
-            auto alertracker = Globalreg::fetch_mandatory_global_as<alert_tracker>();
-            alertracker->raise_one_shot("PACKETQUEUE", 
-                    "SYSTEM", kis_alert_severity::medium,
-                    fmt::format("The packet queue has a backlog of {} packets; "
-                    "your system may not have enough CPU to keep up with the packet rate "
-                    "in your environment or you may have other processes taking up CPU.  "
-                    "Kismet will continue to process packets, as this may be a momentary spike "
-                    "in packet load.", packet_queue_warning), -1);
+    while (n < n_packets) {
+        for (int l = 0; l < PACKET_LANE_MAX && n < n_packets; l++) {
+            auto t = in_thread->lanes[l].try_dequeue_bulk(batch + n, n_packets - n);
+            taken[l] += t;
+            n += t;
         }
     }
 
+    for (int l = 1; l < PACKET_LANE_MAX; l++) {
+        if (taken[l] != 0 || in_thread->lanes[l].size_approx() == 0)
+            in_thread->lane_starved[l] = 0;
+        else
+            in_thread->lane_starved[l]++;
+    }
 
-    // Queue the packet to the target thread
-    packet_threads[processing_id]->packet_queue.enqueue(in_pack);
-    packet_queue_rrd->add_sample(qsize, now);
-
-    return 1;
+    return n_packets;
 }
 
-int packet_chain::register_int_handler(pc_callback in_cb, void *in_aux,
-        std::function<int (std::shared_ptr<kis_packet>)> in_l_cb, 
-        int in_chain, int in_prio) {
+void packet_chain::packet_queue_processor(packet_thread *in_thread) {
+    std::vector<std::shared_ptr<kis_packet>> batch(packet_batch_size);
+    bool queue_shutdown = false;
 
-    kis_lock_guard<kis_shared_mutex> lk(packetchain_mutex, "register_int_handler");
+    // Sequence of packets processed by this thread, for sampling handler timing
+    uint64_t thread_packet_no = 0;
 
-    auto link = std::make_shared<pc_link>();
-
-    // Generate packet, we'll nuke it if it's invalid later
-    link->priority = in_prio;
-    link->callback = in_cb;
-    link->l_callback = in_l_cb;
-    link->auxdata = in_aux;
-    link->id = next_handlerid++;
+    while (!queue_shutdown &&
+            !packetchain_shutdown && 
+            !Globalreg::globalreg->spindown && 
+            !Globalreg::globalreg->fatal_condition &&
+            !Globalreg::globalreg->complete) {
 
-    switch (in_chain) {
-        case CHAINPOS_POSTCAP:
-            if (!postcap_chain_update) {
-                postcap_chain_update = true;
-                postcap_chain_new = postcap_chain;
-            }
+        auto n_packets = dequeue_packet_batch(in_thread, batch.data());
 
-            postcap_chain_new.push_back(link);
-            stable_sort(postcap_chain_new.begin(), postcap_chain_new.end(), 
-                    SortLinkPriority());
-            break;
+        // A null packet wakes us up for shutdown; drop it from the batch and process 
+        // the rest, including anything dequeued after it, before exiting
+        size_t n_valid = 0;
 
-        case CHAINPOS_LLCDISSECT:
-            if (!llcdissect_chain_update) {
-                llcdissect_chain_update = true;
-                llcdissect_chain_new = llcdissect_chain;
+        for (size_t i = 0; i < n_packets; i++) {
+            if (batch[i] == nullptr) {
+                queue_shutdown = true;
+                continue;
             }
 
-            llcdissect_chain_new.push_back(link);
-            stable_sort(llcdissect_chain_new.begin(), llcdissect_chain_new.end(), 
-                    SortLinkPriority());
-            break;
+            if (n_valid != i)
+                batch[n_valid] = std::move(batch[i]);
 
-        case CHAINPOS_DECRYPT:
-            if (!decrypt_chain_update) {
-                decrypt_chain_update = true;
-                decrypt_chain_new = decrypt_chain;
-            }
+            n_valid++;
+        }
 
-            decrypt_chain_new.push_back(link);
-            stable_sort(decrypt_chain_new.begin(), decrypt_chain_new.end(), 
-                    SortLinkPriority());
-            break;
+        n_packets = n_valid;
 
-        case CHAINPOS_DATADISSECT:
-            if (!datadissect_chain_update) {
-                datadissect_chain_update = true;
-                datadissect_chain_new = datadissect_chain;
-            }
+        if (n_packets == 0)
+            continue;
 
-            datadissect_chain_new.push_back(link);
-            stable_sort(datadissect_chain_new.begin(), datadissect_chain_new.end(), 
-                    SortLinkPriority());
-            break;
+        if (latency_trace_interval != 0) {
+            auto now_ns = trace_now_ns();
 
-        case CHAINPOS_CLASSIFIER:
-            if (!classifier_chain_update) {
-                classifier_chain_update = true;
-                classifier_chain_new = classifier_chain;
+            // Resumed packets keep the time they were first dequeued; the time they
+            // were held counts against the stage they resume at
+            for (size_t i = 0; i < n_packets; i++) {
+                if (batch[i]->traced() && batch[i]->trace_ns[PACKET_TRACE_DEQUEUE] == 0)
+                    batch[i]->trace_ns[PACKET_TRACE_DEQUEUE] = now_ns;
             }
+        }
 
-            classifier_chain_new.push_back(link);
-            stable_sort(classifier_chain_new.begin(), classifier_chain_new.end(), 
-                    SortLinkPriority());
-            break;
-
-        case CHAINPOS_TRACKER:
-            if (!tracker_chain_update) {
-                tracker_chain_update = true;
-                tracker_chain_new = tracker_chain;
+        // Grab the current chain snapshot; registration publishes a new set 
+        // instead of modifying this one, so it stays valid for the whole batch
+        auto cs = fetch_chains();
+
+        // Lock the individual packets to make sure nothing else manipulates them 
+        // while we're processing
+        for (size_t i = 0; i < n_packets; i++)
+            batch[i]->mutex.lock();
+
+        // Walk the batch through each stage in turn, which keeps the handlers for a 
+        // stage hot across the batch.  A duplicate whose original is earlier in the 
+        // same batch aliases the components the original has at that point, which 
+        // covers everything from llc dissection; phys already re-dissect duplicates
+        // which are missing their decode.
+        process_chain_batch(cs->llcdissect_chain, CHAINPOS_LLCDISSECT,
+                batch.data(), n_packets, thread_packet_no);
+        process_chain_batch(cs->decrypt_chain, CHAINPOS_DECRYPT,
+                batch.data(), n_packets, thread_packet_no);
+        process_chain_batch(cs->datadissect_chain, CHAINPOS_DATADISSECT,
+                batch.data(), n_packets, thread_packet_no);
+        process_chain_batch(cs->classifier_chain, CHAINPOS_CLASSIFIER,
+                batch.data(), n_packets, thread_packet_no);
+        process_chain_batch(cs->tracker_chain, CHAINPOS_TRACKER,
+                batch.data(), n_packets, thread_packet_no);
+
+        // Logging is handed off to the logging threads after the packet is unlocked
+        bool log_inline = n_log_threads == 0;
+        bool log_queued = !log_inline && cs->logging_chain.size() > 0;
+
+        if (log_inline)
+            process_chain_batch(cs->logging_chain, CHAINPOS_LOGGING, batch.data(), n_packets, thread_packet_no);
+
+        thread_packet_no += n_packets;
+
+        time_t now = (time_t) Globalreg::globalreg->last_tv_sec;
+
+        size_t n_held = 0;
+
+        for (size_t i = 0; i < n_packets; i++) {
+            // A held packet can be resumed by another thread as soon as it's unlocked,
+            // so check before letting go of it; it's counted when it finishes
+            bool held = batch[i]->held;
+
+            batch[i]->mutex.unlock();
+
+            if (held) {
+                n_held++;
+                batch[i].reset();
+                continue;
             }
 
-            tracker_chain_new.push_back(link);
-            stable_sort(tracker_chain_new.begin(), tracker_chain_new.end(), 
-                    SortLinkPriority());
-            break;
+            if (batch[i]->error) {
+                packet_error_rrd->add_sample(1, now);
+                packets_error.fetch_add(1, std::memory_order_relaxed);
+            }
 
-        case CHAINPOS_LOGGING:
-            if (!logging_chain_update) {
-                logging_chain_update = true;
-                logging_chain_new = logging_chain;
+            if (batch[i]->duplicate) {
+                packet_dupe_rrd->add_sample(1, now);
+                packets_dupe.fetch_add(1, std::memory_order_relaxed);
             }
 
-            logging_chain_new.push_back(link);
-            stable_sort(logging_chain_new.begin(), logging_chain_new.end(), 
-                    SortLinkPriority());
-            break;
+            if (log_queued)
+                queue_packet_log(batch[i], now);
+            else if (batch[i]->traced())
+                finish_packet_trace(batch[i]);
 
-        default:
-            _MSG("packet_chain::register_handler requested unknown chain", MSGFLAG_ERROR);
-            return -1;
-    }
+            // Release our reference so the packet returns to the pool
+            batch[i].reset();
+        }
 
-    return link->id;
+        packet_processed_rrd->add_sample(n_packets - n_held, now);
+        packets_processed.fetch_add(n_packets - n_held, std::memory_order_relaxed);
+        packet_batch_rrd->add_sample(n_packets, now);
+    }
 }
 
-int packet_chain::register_handler(pc_callback in_cb, void *in_aux, int in_chain, int in_prio) {
-    return register_int_handler(in_cb, in_aux, NULL, in_chain, in_prio);
-}
+void packet_chain::queue_packet_log(std::shared_ptr<kis_packet>& in_pack, time_t now) {
+    auto qsize = log_queue.size_approx();
 
-int packet_chain::register_handler(std::function<int (std::shared_ptr<kis_packet>)> in_cb, int in_chain, int in_prio) {
-    return register_int_handler(NULL, NULL, in_cb, in_chain, in_prio);
-}
+    if (log_queue_drop != 0 && qsize > log_queue_drop) {
+        time_t offt = now - last_log_drop_user_warning;
 
-int packet_chain::remove_handler(int in_id, int in_chain) {
-    kis_lock_guard<kis_shared_mutex> lk(packetchain_mutex, "remove_handler");
+        if (offt > 30) {
+            last_log_drop_user_warning = now;
 
-    unsigned int x;
+            auto alertracker = Globalreg::fetch_mandatory_global_handle<alert_tracker>();
+            alertracker->raise_one_shot("PACKETLOGLOST", 
+                    "SYSTEM", kis_alert_severity::high,
+                    fmt::format("The packet logging queue has exceeded the maximum size of {}; "
+                        "Kismet will continue to process packets, but will not log packets "
+                        "until the backlog is reduced.  The storage holding your logs may not "
+                        "be able to keep up with the packet rate.  You can increase the "
+                        "logging backlog with the packet_log_backlog_limit configuration "
+                        "parameter.", log_queue_drop), -1);
+        }
 
-    switch (in_chain) {
-        case CHAINPOS_POSTCAP:
-            if (!postcap_chain_update) {
-                postcap_chain_update = true;
-                postcap_chain_new = postcap_chain;
-            }
+        log_drop_rrd->add_sample(1, now);
+        log_dropped.fetch_add(1, std::memory_order_relaxed);
 
-            for (x = 0; x < postcap_chain_new.size(); x++) {
-                if (postcap_chain_new[x]->id == in_id) {
-                    postcap_chain_new.erase(postcap_chain_new.begin() + x);
-                }
-            }
-            break;
+        if (in_pack->traced())
+            finish_packet_trace(in_pack);
 
-        case CHAINPOS_LLCDISSECT:
-            if (!llcdissect_chain_update) {
-                llcdissect_chain_update = true;
-                llcdissect_chain_new = llcdissect_chain;
-            }
+        return;
+    }
 
-            for (x = 0; x < llcdissect_chain_new.size(); x++) {
-                if (llcdissect_chain_new[x]->id == in_id) {
-                    llcdissect_chain_new.erase(llcdissect_chain_new.begin() + x);
-                }
-            }
-            break;
+    log_queue.enqueue(in_pack);
+    log_queue_rrd->add_sample(qsize, now);
+}
 
-        case CHAINPOS_DECRYPT:
-            if (!decrypt_chain_update) {
-                decrypt_chain_update = true;
-                decrypt_chain_new = decrypt_chain;
-            }
+void packet_chain::log_queue_processor() {
+    std::vector<std::shared_ptr<kis_packet>> batch(packet_batch_size);
+    bool queue_shutdown = false;
 
-            for (x = 0; x < decrypt_chain_new.size(); x++) {
-                if (decrypt_chain_new[x]->id == in_id) {
-                    decrypt_chain_new.erase(decrypt_chain_new.begin() + x);
-                }
-            }
-            break;
+    uint64_t thread_packet_no = 0;
 
-        case CHAINPOS_DATADISSECT:
-            if (!datadissect_chain_update) {
-                datadissect_chain_update = true;
-                datadissect_chain_new = datadissect_chain;
-            }
+    // Keep logging until we're explicitly woken for shutdown, so that anything 
+    // the packet threads queued before they exited still gets logged
+    while (!queue_shutdown && !Globalreg::globalreg->fatal_condition) {
+        auto n_packets = log_queue.wait_dequeue_bulk(batch.begin(), packet_batch_size);
 
-            for (x = 0; x < datadissect_chain_new.size(); x++) {
-                if (datadissect_chain_new[x]->id == in_id) {
-                    datadissect_chain_new.erase(datadissect_chain_new.begin() + x);
+        for (size_t i = 0; i < n_packets; i++) {
+            if (batch[i] == nullptr) {
+                // Put back any packets we pulled after our shutdown marker
+                for (size_t j = i + 1; j < n_packets; j++) {
+                    log_queue.enqueue(batch[j]);
+                    batch[j].reset();
                 }
-            }
-            break;
 
-        case CHAINPOS_CLASSIFIER:
-            if (!classifier_chain_update) {
-                classifier_chain_update = true;
-                classifier_chain_new = classifier_chain;
+                n_packets = i;
+                queue_shutdown = true;
+                break;
             }
+        }
 
-            for (x = 0; x < classifier_chain_new.size(); x++) {
-                if (classifier_chain_new[x]->id == in_id) {
-                    classifier_chain_new.erase(classifier_chain_new.begin() + x);
-                }
-            }
-            break;
+        if (n_packets == 0)
+            continue;
 
-        case CHAINPOS_TRACKER:
-            if (!tracker_chain_update) {
-                tracker_chain_update = true;
-                tracker_chain_new = tracker_chain;
-            }
+        auto cs = fetch_chains();
 
-            for (x = 0; x < tracker_chain_new.size(); x++) {
-                if (tracker_chain_new[x]->id == in_id) {
-                    tracker_chain_new.erase(tracker_chain_new.begin() + x);
-                }
-            }
-            break;
+        if (latency_trace_interval != 0) {
+            auto now_ns = trace_now_ns();
 
-        case CHAINPOS_LOGGING:
-            if (!logging_chain_update) {
-                logging_chain_update = true;
-                logging_chain_new = logging_chain;
+            for (size_t i = 0; i < n_packets; i++) {
+                if (batch[i]->traced())
+                    batch[i]->trace_ns[PACKET_TRACE_LOG_DEQUEUE] = now_ns;
             }
+        }
 
-            for (x = 0; x < logging_chain_new.size(); x++) {
-                if (logging_chain_new[x]->id == in_id) {
-                    logging_chain_new.erase(logging_chain_new.begin() + x);
-                }
+        // Logging only reads the packet, but duplicates processed in the packet 
+        // threads can still update components they share with it
+        for (size_t i = 0; i < n_packets; i++)
+            batch[i]->mutex.lock();
+
+        process_chain_batch(cs->logging_chain, CHAINPOS_LOGGING, batch.data(), n_packets, thread_packet_no);
+        thread_packet_no += n_packets;
+
+        for (size_t i = 0; i < n_packets; i++) {
+            batch[i]->mutex.unlock();
+
+            if (batch[i]->traced())
+                finish_packet_trace(batch[i]);
+
+            batch[i].reset();
+        }
+    }
+}
+
+bool packet_chain::queues_idle() {
+    if (log_queue.size_approx() != 0)
+        return false;
+
+    if (!packet_processing)
+        return true;
+
+    for (unsigned int n = 0; n < n_packet_threads; n++) {
+        if (packet_threads[n]->size_approx() != 0)
+            return false;
+    }
+
+    return true;
+}
+
+bool packet_chain::queue_congested() {
+    auto limit = packet_queue_drop;
+
+    if (packet_queue_shed != 0 && (limit == 0 || packet_queue_shed < limit))
+        limit = packet_queue_shed;
+
+    if (limit != 0 && packet_processing) {
+        for (size_t i = 0; i < n_packet_threads; i++) {
+            if (packet_threads[i]->size_approx() > limit / 2)
+                return true;
+        }
+    }
+
+    if (log_queue_drop != 0 && log_queue.size_approx() > log_queue_drop / 2)
+        return true;
+
+    return false;
+}
+
+int packet_chain::process_packet(std::shared_ptr<kis_packet> in_pack) {
+    if (in_pack == nullptr)
+        return 1;
+
+    // Sources which capture in their own threads can be opened before the packet 
+    // threads are started; hold them until there is somewhere to queue the packet
+    while (!packet_processing) {
+        if (packetchain_shutdown || Globalreg::globalreg->spindown)
+            return 1;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    time_t now = (time_t) Globalreg::globalreg->last_tv_sec;
+
+    // Total packet rate always gets added, even when we drop, so we can compare
+    packet_rate_rrd->add_sample(1, now);
+    packets_total.fetch_add(1, std::memory_order_relaxed);
+    packet_peak_rrd->add_sample(1, now);
+
+    auto cs = fetch_chains();
+
+    // Run the post-capture processing; post-capture runs in whatever thread 
+    // captured the packet, so timing is sampled per capturing thread
+    static thread_local uint64_t postcap_packet_no = 0;
+
+    if (handler_timing_interval != 0 && postcap_packet_no++ % handler_timing_interval == 0) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (const auto& pcl : cs->postcap_chain)
+            call_handler_timed(pcl, in_pack);
+
+        if (cs->postcap_chain.size() != 0)
+            stage_latency[CHAINPOS_POSTCAP]->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count());
+    } else {
+        for (const auto& pcl : cs->postcap_chain)
+            call_handler(pcl, in_pack);
+    }
+
+    // Pin the flow to a thread by transmitter if we're doing flow affinity
+    // and the phy hasn't already given us an id
+    if (packet_thread_affinity && in_pack->assignment_id == 0)
+        in_pack->assignment_id = flow_assignment_id(in_pack);
+
+    // assign it to a thread
+    auto processing_id = packet_thread_id(in_pack);
+    auto pthread = packet_threads[processing_id];
+
+    // The backlog limits apply to the packets which will be processed ahead of this
+    // one, so packets in lower lanes are shed and dropped first while the lanes above
+    // them keep flowing
+    auto lane = packet_lane(in_pack);
+    auto qsize = pthread->depth_ahead(lane);
+
+    if (packet_queue_drop != 0 && qsize > packet_queue_drop) {
+        time_t offt = now - last_packet_drop_user_warning;
+
+        if (offt > 30) {
+            last_packet_drop_user_warning = now;
+
+            auto alertracker = Globalreg::fetch_mandatory_global_handle<alert_tracker>();
+            alertracker->raise_one_shot("PACKETLOST", 
+                    "SYSTEM", kis_alert_severity::high,
+                    fmt::format("The packet queue has exceeded the maximum size of {}; Kismet "
+                        "will start dropping packets.  Your system may not have enough CPU to keep "
+                        "up with the packet rate in your environment or other processes may be "
+                        "taking up the CPU.  You can increase the packet backlog with the "
+                        "packet_backlog_limit configuration parameter.", packet_queue_drop), -1);
+        }
+
+        count_packet_drop(in_pack, lane, now);
+
+        return 1;
+    }
+
+    if (packet_queue_shed != 0 && qsize > packet_queue_shed) {
+        for (const auto& dp : cs->drop_policies) {
+            if (dp->cb(in_pack)) {
+                dp->drop_rrd->add_sample(1, now);
+                dp->dropped->fetch_add(1, std::memory_order_relaxed);
+                count_packet_drop(in_pack, lane, now);
+                return 1;
             }
-            break;
+        }
+    }
 
-        default:
-            _MSG("packet_chain::remove_handler requested unknown chain", 
-                    MSGFLAG_ERROR);
-            return -1;
+    if (qsize > packet_queue_warning && packet_queue_warning != 0) {
+        time_t offt = now - last_packet_queue_user_warning;
+
+        if (offt > 30) {
+            last_packet_queue_user_warning = now;
+
+            auto alertracker = Globalreg::fetch_mandatory_global_handle<alert_tracker>();
+            alertracker->raise_one_shot("PACKETQUEUE", 
+                    "SYSTEM", kis_alert_severity::medium,
+                    fmt::format("The packet queue has a backlog of {} packets; "
+                    "your system may not have enough CPU to keep up with the packet rate "
+                    "in your environment or you may have other processes taking up CPU.  "
+                    "Kismet will continue to process packets, as this may be a momentary spike "
+                    "in packet load.", packet_queue_warning), -1);
+        }
     }
 
+
+    if (in_pack->traced())
+        in_pack->trace_ns[CHAINPOS_POSTCAP] = trace_now_ns();
+
+    // Queue the packet to the target thread
+    auto tsize = pthread->size_approx();
+    enqueue_packet(pthread, lane, in_pack);
+    packet_queue_rrd->add_sample(tsize, now);
+    pthread->queue_rrd->add_sample(tsize, now);
+    lane_queue_rrd[lane]->add_sample(qsize, now);
+
     return 1;
 }
 
-int packet_chain::remove_handler(pc_callback in_cb, int in_chain) {
-    kis_lock_guard<kis_shared_mutex> lk(packetchain_mutex, "remove_handler");
+unsigned int packet_chain::packet_thread_id(const std::shared_ptr<kis_packet>& in_pack) {
+    // If there is no assignment id, assign the packet by content hash, so that
+    // duplicates always land on the same thread as the original, or randomly if
+    // there is no content.  Otherwise transform the assignment id to a consistent thread.
+    if (in_pack->assignment_id == 0) {
+        if (in_pack->hash != 0)
+            return in_pack->hash % n_packet_threads;
+
+        return rand() % n_packet_threads;
+    }
+
+    return in_pack->assignment_id % n_packet_threads;
+}
+
+void packet_chain::hold_packet(std::shared_ptr<kis_packet> in_pack) {
+    in_pack->held = 1;
+}
+
+void packet_chain::resume_packet(std::shared_ptr<kis_packet> in_pack, int in_chain) {
+    {
+        kis_lock_guard<kis_mutex> lk(in_pack->mutex, "packet_chain resume_packet");
+        in_pack->held = 0;
+        in_pack->resume_chain = in_chain;
+    }
+
+    if (packetchain_shutdown || packet_threads == nullptr)
+        return;
+
+    auto processing_id = packet_thread_id(in_pack);
+    time_t now = (time_t) Globalreg::globalreg->last_tv_sec;
+
+    // Resumed packets go in the lane they were first queued to
+    auto pthread = packet_threads[processing_id];
+    auto qsize = pthread->size_approx();
+    enqueue_packet(pthread, packet_lane(in_pack), in_pack);
+    pthread->queue_rrd->add_sample(qsize, now);
+}
+
+void packet_chain::count_packet_drop(std::shared_ptr<kis_packet> in_pack, int in_lane, time_t now) {
+    packet_drop_rrd->add_sample(1, now);
+    packets_dropped.fetch_add(1, std::memory_order_relaxed);
+
+    lane_drop_rrd[in_lane]->add_sample(1, now);
+    lane_dropped[in_lane].fetch_add(1, std::memory_order_relaxed);
+
+    auto datasrc = in_pack->peek<packetchain_comp_datasource>();
+
+    if (datasrc != nullptr && datasrc->ref_source != nullptr)
+        datasrc->ref_source->inc_Msource_num_dropped_packets(1);
+}
+
+int packet_chain::packet_lane(const std::shared_ptr<kis_packet>& in_pack) {
+    if (!packet_priority_lanes)
+        return PACKET_LANE_NORMAL;
+
+    auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+    if (chunk == nullptr || chunk->data() == nullptr || chunk->length() < 2 ||
+            chunk->dlt != KDLT_IEEE802_11)
+        return PACKET_LANE_NORMAL;
+
+    auto data = chunk->data();
+    auto type = (data[0] >> 2) & 0x03;
+
+    // Management
+    if (type == 0)
+        return PACKET_LANE_PRIORITY;
+
+    // Control and anything unknown
+    if (type != 2)
+        return PACKET_LANE_NORMAL;
+
+    // Unprotected data frames carrying EAPOL go with the management frames, so that 
+    // handshakes are seen in the same order as the associations around them.  The
+    // header is 24 bytes, plus the fourth address in a WDS frame, the QoS control in a
+    // QoS frame, and the HT control when a QoS frame has the order bit set.
+    if (data[1] & 0x40)
+        return PACKET_LANE_BULK;
+
+    size_t hdr_len = 24;
+
+    if ((data[1] & 0x03) == 0x03)
+        hdr_len += 6;
+
+    if (data[0] & 0x80) {
+        hdr_len += 2;
+
+        if (data[1] & 0x80)
+            hdr_len += 4;
+    }
+
+    static const uint8_t eapol_llc[] = { 0xAA, 0xAA, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8E };
 
-    unsigned int x;
+    if (chunk->length() >= hdr_len + sizeof(eapol_llc) &&
+            memcmp(data + hdr_len, eapol_llc, sizeof(eapol_llc)) == 0)
+        return PACKET_LANE_PRIORITY;
 
+    return PACKET_LANE_BULK;
+}
+
+std::string packet_chain::lane_name(int in_lane) {
+    switch (in_lane) {
+        case PACKET_LANE_PRIORITY:
+            return "priority";
+        case PACKET_LANE_NORMAL:
+            return "normal";
+        case PACKET_LANE_BULK:
+            return "bulk";
+    }
+
+    return "unknown";
+}
+
+int packet_chain::dot11_frame_type(std::shared_ptr<kis_packet> in_pack) {
+    auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+    if (chunk == nullptr || chunk->data() == nullptr || chunk->length() < 1)
+        return -1;
+
+    if (chunk->dlt != KDLT_IEEE802_11)
+        return -1;
+
+    // Type is bits 2-3 of the first frame control byte
+    return (chunk->data()[0] >> 2) & 0x03;
+}
+
+std::shared_ptr<packet_handler_histogram> packet_chain::get_stage_latency(int in_chain) const {
+    if (in_chain < CHAINPOS_POSTCAP || in_chain > CHAINPOS_LOGGING)
+        return nullptr;
+
+    return stage_latency[in_chain];
+}
+
+std::string packet_chain::chain_name(int in_chain) {
     switch (in_chain) {
         case CHAINPOS_POSTCAP:
-            if (!postcap_chain_update) {
-                postcap_chain_update = true;
-                postcap_chain_new = postcap_chain;
-            }
+            return "postcap";
+        case CHAINPOS_LLCDISSECT:
+            return "llcdissect";
+        case CHAINPOS_DECRYPT:
+            return "decrypt";
+        case CHAINPOS_DATADISSECT:
+            return "datadissect";
+        case CHAINPOS_CLASSIFIER:
+            return "classifier";
+        case CHAINPOS_TRACKER:
+            return "tracker";
+        case CHAINPOS_LOGGING:
+            return "logging";
+    }
 
-            for (x = 0; x < postcap_chain_new.size(); x++) {
-                if (postcap_chain_new[x]->callback == in_cb) {
-                    postcap_chain_new.erase(postcap_chain_new.begin() + x);
-                }
-            }
-            break;
+    return "unknown";
+}
 
-        case CHAINPOS_LLCDISSECT:
-            if (!llcdissect_chain_update) {
-                llcdissect_chain_update = true;
-                llcdissect_chain_new = llcdissect_chain;
-            }
+std::shared_ptr<tracker_element_vector> packet_chain::handler_timing_summary() {
+    auto ret = std::make_shared<tracker_element_vector>(handler_timing_vec_id);
 
-            for (x = 0; x < llcdissect_chain_new.size(); x++) {
-                if (llcdissect_chain_new[x]->callback == in_cb) {
-                    llcdissect_chain_new.erase(llcdissect_chain_new.begin() + x);
-                }
-            }
-            break;
+    auto cs = fetch_chains();
 
-        case CHAINPOS_DECRYPT:
-            if (!decrypt_chain_update) {
-                decrypt_chain_update = true;
-                decrypt_chain_new = decrypt_chain;
-            }
+    const std::vector<std::pair<std::string, const std::vector<std::shared_ptr<pc_link>> *>> stages = {
+        {"postcap", &cs->postcap_chain},
+        {"llcdissect", &cs->llcdissect_chain},
+        {"decrypt", &cs->decrypt_chain},
+        {"datadissect", &cs->datadissect_chain},
+        {"classifier", &cs->classifier_chain},
+        {"tracker", &cs->tracker_chain},
+        {"logging", &cs->logging_chain},
+    };
 
-            for (x = 0; x < decrypt_chain_new.size(); x++) {
-                if (decrypt_chain_new[x]->callback == in_cb) {
-                    decrypt_chain_new.erase(decrypt_chain_new.begin() + x);
-                }
-            }
-            break;
+    for (const auto& stage : stages) {
+        for (const auto& pcl : *stage.second) {
+            if (pcl->latency == nullptr)
+                continue;
 
-        case CHAINPOS_DATADISSECT:
-            if (!datadissect_chain_update) {
-                datadissect_chain_update = true;
-                datadissect_chain_new = datadissect_chain;
-            }
+            auto t = std::make_shared<tracked_handler_latency>(handler_timing_entry_id);
 
-            for (x = 0; x < datadissect_chain_new.size(); x++) {
-                if (datadissect_chain_new[x]->callback == in_cb) {
-                    datadissect_chain_new.erase(datadissect_chain_new.begin() + x);
-                }
-            }
-            break;
+            t->set_handler_id(pcl->id);
+            t->set_chain(stage.first);
+            t->set_priority(pcl->priority);
+            t->set_samples(pcl->latency->count());
+            t->set_p50_ns(pcl->latency->percentile(50));
+            t->set_p90_ns(pcl->latency->percentile(90));
+            t->set_p99_ns(pcl->latency->percentile(99));
+            t->set_max_ns(pcl->latency->max());
 
-        case CHAINPOS_CLASSIFIER:
-            if (!classifier_chain_update) {
-                classifier_chain_update = true;
-                classifier_chain_new = classifier_chain;
-            }
+            ret->push_back(t);
+        }
+    }
 
-            for (x = 0; x < classifier_chain_new.size(); x++) {
-                if (classifier_chain_new[x]->callback == in_cb) {
-                    classifier_chain_new.erase(classifier_chain_new.begin() + x);
-                }
-            }
-            break;
+    return ret;
+}
 
-        case CHAINPOS_TRACKER:
-            if (!tracker_chain_update) {
-                tracker_chain_update = true;
-                tracker_chain_new = tracker_chain;
-            }
+// Trace points in the order a packet passes them
+static const unsigned int packet_trace_order[] = {
+    PACKET_TRACE_RECEIVE, CHAINPOS_POSTCAP, PACKET_TRACE_DEQUEUE,
+    CHAINPOS_LLCDISSECT, CHAINPOS_DECRYPT, CHAINPOS_DATADISSECT, CHAINPOS_CLASSIFIER,
+    CHAINPOS_TRACKER, PACKET_TRACE_LOG_DEQUEUE, CHAINPOS_LOGGING,
+};
 
-            for (x = 0; x < tracker_chain_new.size(); x++) {
-                if (tracker_chain_new[x]->callback == in_cb) {
-                    tracker_chain_new.erase(tracker_chain_new.begin() + x);
-                }
+void packet_chain::write_metrics(kis_metrics_writer& writer) {
+    auto rl = std::memory_order_relaxed;
+
+    writer.family("kismet_packets", "counter", "Packets received from all datasources");
+    writer.counter(packets_total.load(rl));
+
+    writer.family("kismet_packets_processed", "counter", "Packets processed by the packet chain");
+    writer.counter(packets_processed.load(rl));
+
+    writer.family("kismet_packets_error", "counter", "Packets which were in error");
+    writer.counter(packets_error.load(rl));
+
+    writer.family("kismet_packets_duplicate", "counter", "Duplicate packets");
+    writer.counter(packets_dupe.load(rl));
+
+    writer.family("kismet_packets_dropped", "counter", 
+            "Packets dropped because the packet queue was full or shed by a drop policy");
+    writer.counter(packets_dropped.load(rl));
+
+    writer.family("kismet_packets_log_dropped", "counter", 
+            "Packets not logged because the logging queue was full");
+    writer.counter(log_dropped.load(rl));
+
+    {
+        kis_lock_guard<kis_mutex> lk(packetchain_mutex, "packet_chain write_metrics");
+
+        writer.family("kismet_packets_policy_dropped", "counter", "Packets shed by each drop policy");
+        for (const auto& dp : drop_policy_totals)
+            writer.counter(dp.second->load(rl), {{"policy", dp.first}});
+    }
+
+    writer.family("kismet_packet_queue_depth", "gauge", "Packets waiting for each packet thread");
+    if (packet_threads != nullptr) {
+        for (size_t n = 0; n < n_packet_threads; n++)
+            writer.gauge(packet_threads[n]->size_approx(), 
+                    {{"thread", fmt::format("{}", n)}});
+
+        writer.family("kismet_packet_lane_depth", "gauge", 
+                "Packets waiting in each priority lane of the packet threads");
+        for (int l = 0; l < PACKET_LANE_MAX; l++) {
+            size_t depth = 0;
+
+            for (size_t n = 0; n < n_packet_threads; n++)
+                depth += packet_threads[n]->lanes[l].size_approx();
+
+            writer.gauge(depth, {{"lane", lane_name(l)}});
+        }
+    }
+
+    writer.family("kismet_packet_lane_dropped", "counter", 
+            "Packets dropped from each priority lane, by the backlog limit or a drop policy");
+    for (int l = 0; l < PACKET_LANE_MAX; l++)
+        writer.counter(lane_dropped[l].load(rl), {{"lane", lane_name(l)}});
+
+    writer.family("kismet_log_queue_depth", "gauge", "Packets waiting for the logging threads");
+    writer.gauge(log_queue.size_approx());
+
+    if (handler_timing_interval != 0) {
+        writer.family("kismet_packet_stage_latency_seconds", "summary", 
+                "Time a timed packet spends in each packet chain stage");
+        for (int c = CHAINPOS_POSTCAP; c <= CHAINPOS_LOGGING; c++)
+            writer.summary(*stage_latency[c], {{"stage", chain_name(c)}});
+
+        auto cs = fetch_chains();
+
+        const std::vector<std::shared_ptr<pc_link>> *stages[] = {
+            &cs->postcap_chain, &cs->llcdissect_chain, &cs->decrypt_chain, 
+            &cs->datadissect_chain, &cs->classifier_chain, &cs->tracker_chain,
+            &cs->logging_chain,
+        };
+
+        writer.family("kismet_packet_handler_latency_seconds", "summary", 
+                "Time each packet handler takes for a timed packet");
+
+        for (int c = CHAINPOS_POSTCAP; c <= CHAINPOS_LOGGING; c++) {
+            for (const auto& pcl : *stages[c - CHAINPOS_POSTCAP]) {
+                if (pcl->latency == nullptr)
+                    continue;
+
+                writer.summary(*pcl->latency, 
+                        {{"stage", chain_name(c)}, {"handler", fmt::format("{}", pcl->id)}});
             }
-            break;
+        }
+    }
+
+    if (latency_trace_interval != 0) {
+        kis_lock_guard<kis_mutex> lk(source_trace_mutex, "packet_chain write_metrics");
+
+        writer.family("kismet_packet_trace_latency_seconds", "summary", 
+                "Latency of each segment of the packets traced from each datasource");
+
+        for (const auto& sti : source_traces) {
+            const auto& st = sti.second;
+            auto uuid_str = st->source_uuid.as_string();
+
+            for (auto p : packet_trace_order)
+                writer.summary(st->segments[p], 
+                        {{"uuid", uuid_str}, {"name", st->source_name}, 
+                        {"segment", trace_segment_name(p)}});
+
+            writer.summary(st->segments[PACKET_TRACE_MAX], 
+                    {{"uuid", uuid_str}, {"name", st->source_name}, 
+                    {"segment", trace_segment_name(PACKET_TRACE_MAX)}});
+        }
+    }
+}
+
+void packet_chain::start_packet_trace_int(const std::shared_ptr<kis_packet>& in_pack) {
+    // Sampled per capture thread, like post-capture timing
+    static thread_local uint64_t trace_packet_no = 0;
+
+    if (trace_packet_no++ % latency_trace_interval == 0)
+        in_pack->trace_ns[PACKET_TRACE_RECEIVE] = trace_now_ns();
+}
+
+void packet_chain::stamp_packet_trace(int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets) {
+    uint64_t now_ns = 0;
+
+    for (size_t i = 0; i < n_packets; i++) {
+        if (!batch[i]->traced() || batch[i]->held || batch[i]->resume_chain > in_chain)
+            continue;
+
+        if (now_ns == 0)
+            now_ns = trace_now_ns();
+
+        batch[i]->trace_ns[in_chain] = now_ns;
+    }
+}
+
+void packet_chain::finish_packet_trace(const std::shared_ptr<kis_packet>& in_pack) {
+    auto datasrc = in_pack->peek<packetchain_comp_datasource>();
+
+    if (datasrc == nullptr || datasrc->ref_source == nullptr)
+        return;
+
+    auto now_ns = trace_now_ns();
+    auto src = datasrc->ref_source;
+    auto key = src->get_source_key();
+
+    std::shared_ptr<source_trace> st;
 
+    {
+        kis_lock_guard<kis_mutex> lk(source_trace_mutex, "packet_chain finish_packet_trace");
+
+        auto sti = source_traces.find(key);
+
+        if (sti == source_traces.end()) {
+            st = std::make_shared<source_trace>();
+            st->source_uuid = src->get_source_uuid();
+            st->source_name = src->get_source_name();
+            st->source_remote = src->get_source_remote();
+            source_traces[key] = st;
+        } else {
+            st = sti->second;
+        }
+    }
+
+    auto first_ns = in_pack->trace_ns[PACKET_TRACE_RECEIVE];
+    auto prev_ns = first_ns;
+
+    // Each segment runs from the last point the packet was stamped at
+    for (auto p : packet_trace_order) {
+        auto t = in_pack->trace_ns[p];
+
+        if (p == PACKET_TRACE_RECEIVE || t == 0 || t < prev_ns)
+            continue;
+
+        st->segments[p].record(t - prev_ns);
+        prev_ns = t;
+    }
+
+    uint64_t total_ns = prev_ns - first_ns;
+
+    // The capture timestamp of a remote source comes from the clock of the remote 
+    // system, so remote traces start when the report is received.  Local captures are
+    // compared in wall-clock time, backing out the time since the packet was received.
+    if (!st->source_remote && in_pack->ts.tv_sec != 0) {
+        auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        int64_t ts_ns = (int64_t) in_pack->ts.tv_sec * 1000000000LL + 
+            (int64_t) in_pack->ts.tv_usec * 1000LL;
+        int64_t capture_ns = (wall_ns - (int64_t) (now_ns - first_ns)) - ts_ns;
+
+        if (capture_ns >= 0) {
+            st->segments[PACKET_TRACE_RECEIVE].record(capture_ns);
+            total_ns += capture_ns;
+        }
+    }
+
+    st->segments[PACKET_TRACE_MAX].record(total_ns);
+}
+
+std::string packet_chain::trace_segment_name(unsigned int in_point) {
+    switch (in_point) {
+        case PACKET_TRACE_RECEIVE:
+            return "capture";
+        case PACKET_TRACE_DEQUEUE:
+            return "queue";
+        case PACKET_TRACE_LOG_DEQUEUE:
+            return "log_queue";
+        case PACKET_TRACE_MAX:
+            return "total";
+    }
+
+    return chain_name(in_point);
+}
+
+std::shared_ptr<tracker_element_vector> packet_chain::source_trace_summary() {
+    auto ret = std::make_shared<tracker_element_vector>(source_trace_vec_id);
+
+    kis_lock_guard<kis_mutex> lk(source_trace_mutex, "packet_chain source_trace_summary");
+
+    for (const auto& sti : source_traces) {
+        const auto& st = sti.second;
+
+        auto t = std::make_shared<tracked_source_trace>(source_trace_entry_id);
+
+        t->set_source_uuid(st->source_uuid);
+        t->set_source_name(st->source_name);
+        t->set_source_remote(st->source_remote);
+
+        auto segs = t->get_segments();
+
+        auto add_segment = [&](unsigned int p) {
+            if (st->segments[p].count() == 0)
+                return;
+
+            auto seg = std::make_shared<tracked_trace_segment>(source_trace_segment_id);
+            seg->set_from(trace_segment_name(p), st->segments[p]);
+            segs->push_back(seg);
+        };
+
+        // The capture segment ends at the receive point, so the segments are already
+        // listed in the order the packet passes through them
+        for (auto p : packet_trace_order)
+            add_segment(p);
+
+        add_segment(PACKET_TRACE_MAX);
+
+        ret->push_back(t);
+    }
+
+    return ret;
+}
+
+uint32_t packet_chain::flow_assignment_id(std::shared_ptr<kis_packet> in_pack) {
+    auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+    if (chunk == nullptr || chunk->data() == nullptr)
+        return 0;
+
+    // Only 802.11 has a fixed enough header to pull the transmitter without a full 
+    // dissection; other phys fall back to their own assignment or a random thread
+    if (chunk->dlt != KDLT_IEEE802_11)
+        return 0;
+
+    // Transmitter is addr2; control frames which only carry addr1 (ack, cts) are 
+    // pinned to the receiver they're talking to
+    uint32_t aid;
+
+    if (chunk->length() >= 16)
+        aid = XXH32(chunk->data() + 10, 6, 0);
+    else if (chunk->length() >= 10)
+        aid = XXH32(chunk->data() + 4, 6, 0);
+    else
+        return 0;
+
+    // 0 means unassigned
+    if (aid == 0)
+        aid = 1;
+
+    return aid;
+}
+
+std::vector<std::shared_ptr<packet_chain::pc_link>> *packet_chain::chain_set::chain_at(int in_chain) {
+    switch (in_chain) {
+        case CHAINPOS_POSTCAP:
+            return &postcap_chain;
+        case CHAINPOS_LLCDISSECT:
+            return &llcdissect_chain;
+        case CHAINPOS_DECRYPT:
+            return &decrypt_chain;
+        case CHAINPOS_DATADISSECT:
+            return &datadissect_chain;
+        case CHAINPOS_CLASSIFIER:
+            return &classifier_chain;
+        case CHAINPOS_TRACKER:
+            return &tracker_chain;
         case CHAINPOS_LOGGING:
-            if (!logging_chain_update) {
-                logging_chain_update = true;
-                logging_chain_new = logging_chain;
-            }
+            return &logging_chain;
+    }
 
-            for (x = 0; x < logging_chain_new.size(); x++) {
-                if (logging_chain_new[x]->callback == in_cb) {
-                    logging_chain_new.erase(logging_chain_new.begin() + x);
-                }
-            }
-            break;
+    return nullptr;
+}
+
+int packet_chain::register_int_handler(std::shared_ptr<pc_link> in_link, int in_chain, int in_prio) {
+    kis_lock_guard<kis_mutex> lk(packetchain_mutex, "register_int_handler");
+
+    // Copy the current chains; the packet threads never see the copy until it's published
+    auto new_chains = std::make_shared<chain_set>(*fetch_chains());
+    auto chain = new_chains->chain_at(in_chain);
+
+    if (chain == nullptr) {
+        _MSG("packet_chain::register_handler requested unknown chain", MSGFLAG_ERROR);
+        return -1;
+    }
+
+    in_link->priority = in_prio;
+    in_link->id = next_handlerid++;
+    in_link->chain = in_chain;
+
+    if (handler_timing_interval != 0)
+        in_link->latency = std::make_shared<packet_handler_histogram>();
+
+    chain->push_back(in_link);
+    stable_sort(chain->begin(), chain->end(), SortLinkPriority());
+
+    publish_chains(new_chains);
+
+    return in_link->id;
+}
+
+int packet_chain::register_handler(pc_callback in_cb, void *in_aux, int in_chain, int in_prio) {
+    auto link = std::make_shared<pc_link>();
+
+    link->callback = in_cb;
+    link->auxdata = in_aux;
+
+    return register_int_handler(link, in_chain, in_prio);
+}
+
+int packet_chain::register_handler(std::function<int (std::shared_ptr<kis_packet>)> in_cb, int in_chain, int in_prio) {
+    auto link = std::make_shared<pc_link>();
+
+    link->l_callback = in_cb;
+
+    return register_int_handler(link, in_chain, in_prio);
+}
+
+std::shared_ptr<packet_chain::pc_link> packet_chain::subscription_link(const packet_subscription& in_sub) {
+    auto link = std::make_shared<pc_link>();
+
+    link->subscribed = true;
+    link->match_components = 0;
+    link->match_phyid = in_sub.phyid;
+    link->match_dlt = in_sub.dlt;
+    link->match_dot11_type = in_sub.dot11_type;
+
+    for (auto c : in_sub.components) {
+        if (c < 0 || c >= MAX_PACKET_COMPONENTS) {
+            _MSG_ERROR("packet_chain::register_subscriber requested unknown packet component {}", c);
+            return nullptr;
+        }
+
+        link->match_components |= static_cast<uint64_t>(1) << c;
+    }
+
+    // The phy comes from the common info, and the dlt and frame type from the link frame,
+    // so a packet without them never matches
+    if (link->match_phyid >= 0)
+        link->match_components |= static_cast<uint64_t>(1) << packet_slot::common;
+
+    return link;
+}
+
+int packet_chain::register_subscriber(const packet_subscription& in_sub,
+        std::function<int (std::shared_ptr<kis_packet>)> in_cb, int in_chain, int in_prio) {
+    auto link = subscription_link(in_sub);
+
+    if (link == nullptr)
+        return -1;
+
+    link->l_callback = in_cb;
+
+    return register_int_handler(link, in_chain, in_prio);
+}
+
+int packet_chain::register_batch_subscriber(const packet_subscription& in_sub,
+        pc_batch_callback in_cb, int in_chain, int in_prio) {
+    auto link = subscription_link(in_sub);
+
+    if (link == nullptr)
+        return -1;
+
+    link->b_callback = in_cb;
 
-        default:
-            _MSG("packet_chain::remove_handler requested unknown chain", 
-                    MSGFLAG_ERROR);
-            return -1;
+    return register_int_handler(link, in_chain, in_prio);
+}
+
+bool packet_chain::subscription_matches(const std::shared_ptr<packet_chain::pc_link>& pcl,
+        const std::shared_ptr<kis_packet>& in_pack) {
+    if ((in_pack->content_present & pcl->match_components) != pcl->match_components)
+        return false;
+
+    if (pcl->match_phyid >= 0) {
+        auto common = in_pack->peek<kis_common_info>();
+
+        if (common == nullptr || common->phyid != pcl->match_phyid)
+            return false;
+    }
+
+    if (pcl->match_dlt >= 0 || pcl->match_dot11_type >= 0) {
+        kis_datachunk *chunk = nullptr;
+
+        if (in_pack->has(pack_comp_decap))
+            chunk = static_cast<kis_datachunk *>(in_pack->content_vec[pack_comp_decap].get());
+        else if (in_pack->has(pack_comp_linkframe))
+            chunk = static_cast<kis_datachunk *>(in_pack->content_vec[pack_comp_linkframe].get());
+
+        if (chunk == nullptr)
+            return false;
+
+        if (pcl->match_dlt >= 0 && chunk->dlt != pcl->match_dlt)
+            return false;
+
+        if (pcl->match_dot11_type >= 0) {
+            if (chunk->dlt != KDLT_IEEE802_11 || chunk->data() == nullptr || chunk->length() < 1)
+                return false;
+
+            if (((chunk->data()[0] >> 2) & 0x03) != pcl->match_dot11_type)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+int packet_chain::remove_handler(int in_id, int in_chain) {
+    kis_lock_guard<kis_mutex> lk(packetchain_mutex, "remove_handler");
+
+    auto new_chains = std::make_shared<chain_set>(*fetch_chains());
+    auto chain = new_chains->chain_at(in_chain);
+
+    if (chain == nullptr) {
+        _MSG("packet_chain::remove_handler requested unknown chain", 
+                MSGFLAG_ERROR);
+        return -1;
+    }
+
+    chain->erase(std::remove_if(chain->begin(), chain->end(), 
+                [in_id](const std::shared_ptr<pc_link>& l) { return l->id == in_id; }),
+            chain->end());
+
+    publish_chains(new_chains);
+
+    return 1;
+}
+
+int packet_chain::remove_handler(pc_callback in_cb, int in_chain) {
+    kis_lock_guard<kis_mutex> lk(packetchain_mutex, "remove_handler");
+
+    auto new_chains = std::make_shared<chain_set>(*fetch_chains());
+    auto chain = new_chains->chain_at(in_chain);
+
+    if (chain == nullptr) {
+        _MSG("packet_chain::remove_handler requested unknown chain", 
+                MSGFLAG_ERROR);
+        return -1;
     }
 
+    chain->erase(std::remove_if(chain->begin(), chain->end(), 
+                [in_cb](const std::shared_ptr<pc_link>& l) { return l->callback == in_cb; }),
+            chain->end());
+
+    publish_chains(new_chains);
+
     return 1;
 }
 
+int packet_chain::register_drop_policy(const std::string& in_name, drop_policy_cb in_cb) {
+    kis_lock_guard<kis_mutex> lk(packetchain_mutex, "register_drop_policy");
+
+    auto new_chains = std::make_shared<chain_set>(*fetch_chains());
+
+    auto policy = std::make_shared<drop_policy>();
+
+    policy->name = in_name;
+    policy->cb = in_cb;
+    policy->id = next_drop_policy_id++;
+
+    // Policies which share a name share a drop count
+    auto existing = drop_policy_map->find(in_name);
+    if (existing != drop_policy_map->end()) {
+        policy->drop_rrd = std::static_pointer_cast<kis_tracked_rrd<>>(existing->second);
+    } else {
+        policy->drop_rrd = std::make_shared<kis_tracked_rrd<>>(drop_policy_rrd_id);
+        drop_policy_map->insert(in_name, policy->drop_rrd);
+    }
+
+    auto& total = drop_policy_totals[in_name];
+    if (total == nullptr)
+        total = std::make_shared<std::atomic<uint64_t>>(0);
+    policy->dropped = total;
+
+    new_chains->drop_policies.push_back(policy);
+
+    publish_chains(new_chains);
+
+    return policy->id;
+}
+
+int packet_chain::remove_drop_policy(int in_id) {
+    kis_lock_guard<kis_mutex> lk(packetchain_mutex, "remove_drop_policy");
+
+    auto new_chains = std::make_shared<chain_set>(*fetch_chains());
+
+    new_chains->drop_policies.erase(std::remove_if(new_chains->drop_policies.begin(), 
+                new_chains->drop_policies.end(),
+                [in_id](const std::shared_ptr<drop_policy>& p) { return p->id == in_id; }),
+            new_chains->drop_policies.end());
+
+    publish_chains(new_chains);
+
+    return 1;
+}
@@ -29,6 +29,9 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 #include <map>
@@ -43,6 +46,7 @@
 #include "objectpool.h"
 #include "robin_hood.h"
 #include "timetracker.h"
+#include "trackedcomponent.h"
 #include "trackedelement.h"
 #include "trackedrrd.h"
 
@@ -95,11 +99,278 @@
 #define CHAINPOS_TRACKER		7
 #define CHAINPOS_LOGGING        8
 
+// Points at which a packet sampled for latency tracing is stamped.  The end of each
+// packet chain stage is stamped at the CHAINPOS_ of the stage (2 - 8), so the end of
+// post-capture is the time the packet is queued to a packet thread and the end of 
+// logging is the time it is committed to the logs.
+#define PACKET_TRACE_RECEIVE        0
+#define PACKET_TRACE_DEQUEUE        1
+#define PACKET_TRACE_LOG_DEQUEUE    9
+#define PACKET_TRACE_MAX            10
+
+// Priority lanes of the packet thread queues.  Each packet thread drains its lanes 
+// highest priority first, so that the management frames which drive device discovery
+// and alerts aren't stuck behind a flood of data: 802.11 management frames and EAPOL
+// go in the priority lane, 802.11 data frames in the bulk lane, and everything else
+// in the normal lane.
+#define PACKET_LANE_PRIORITY    0
+#define PACKET_LANE_NORMAL      1
+#define PACKET_LANE_BULK        2
+#define PACKET_LANE_MAX         3
+
 #define CHAINCALL_PARMS \
     void *auxdata __attribute__ ((unused)), \
     std::shared_ptr<kis_packet> in_pack
 
 class kis_packet;
+class kis_metrics_writer;
+
+// Log-linear latency histogram in the style of HDR histograms; each power-of-two range
+// of nanoseconds is split into linear sub-buckets, which keeps the relative error of
+// any recorded value under 1/sub_buckets with a fixed number of buckets.  Recording is
+// lock-free and may happen from any number of threads.
+class packet_handler_histogram {
+public:
+    static constexpr unsigned int sub_bits = 3;
+    static constexpr unsigned int sub_buckets = 1 << sub_bits;
+    static constexpr unsigned int n_buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    packet_handler_histogram() {
+        for (auto& b : buckets)
+            b = 0;
+        max_ns = 0;
+        sum_ns = 0;
+    }
+
+    void record(uint64_t ns) {
+        buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        auto m = max_ns.load(std::memory_order_relaxed);
+        while (ns > m && !max_ns.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    // Number of samples, the value at percentile p (0-100), the largest sample, and
+    // the total of every sample
+    uint64_t count() const;
+    uint64_t percentile(double p) const;
+    uint64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_ns.load(std::memory_order_relaxed); }
+
+protected:
+    static unsigned int bucket_of(uint64_t ns) {
+        if (ns < sub_buckets)
+            return ns;
+
+        unsigned int shift = (63 - __builtin_clzll(ns)) - sub_bits;
+        return (shift + 1) * sub_buckets + ((ns >> shift) - sub_buckets);
+    }
+
+    // Upper bound of the values recorded in a bucket
+    static uint64_t bucket_value(unsigned int b) {
+        if (b < sub_buckets)
+            return b;
+
+        unsigned int shift = (b / sub_buckets) - 1;
+        uint64_t top = (b % sub_buckets) + sub_buckets;
+        return ((top + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> buckets[n_buckets];
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> sum_ns;
+};
+
+// Summary of the latency of a single packet handler
+class tracked_handler_latency : public tracker_component {
+public:
+    tracked_handler_latency() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_handler_latency(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_handler_latency(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_handler_latency");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(handler_id, int32_t, int, int, handler_id);
+    __Proxy(chain, std::string, std::string, std::string, chain);
+    __Proxy(priority, int32_t, int, int, priority);
+    __Proxy(samples, uint64_t, uint64_t, uint64_t, samples);
+    __Proxy(p50_ns, uint64_t, uint64_t, uint64_t, p50_ns);
+    __Proxy(p90_ns, uint64_t, uint64_t, uint64_t, p90_ns);
+    __Proxy(p99_ns, uint64_t, uint64_t, uint64_t, p99_ns);
+    __Proxy(max_ns, uint64_t, uint64_t, uint64_t, max_ns);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.packetchain.handler.id", "Packet handler ID", &handler_id);
+        register_field("kismet.packetchain.handler.chain", "Packet chain stage", &chain);
+        register_field("kismet.packetchain.handler.priority", "Packet handler priority", &priority);
+        register_field("kismet.packetchain.handler.samples", "Number of timed calls", &samples);
+        register_field("kismet.packetchain.handler.p50_ns", "Median call latency (ns)", &p50_ns);
+        register_field("kismet.packetchain.handler.p90_ns", "90th percentile call latency (ns)", &p90_ns);
+        register_field("kismet.packetchain.handler.p99_ns", "99th percentile call latency (ns)", &p99_ns);
+        register_field("kismet.packetchain.handler.max_ns", "Maximum call latency (ns)", &max_ns);
+    }
+
+    std::shared_ptr<tracker_element_int32> handler_id;
+    std::shared_ptr<tracker_element_string> chain;
+    std::shared_ptr<tracker_element_int32> priority;
+    std::shared_ptr<tracker_element_uint64> samples;
+    std::shared_ptr<tracker_element_uint64> p50_ns;
+    std::shared_ptr<tracker_element_uint64> p90_ns;
+    std::shared_ptr<tracker_element_uint64> p99_ns;
+    std::shared_ptr<tracker_element_uint64> max_ns;
+};
+
+// Latency of one segment of the path of the traced packets from a datasource
+class tracked_trace_segment : public tracker_component {
+public:
+    tracked_trace_segment() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_trace_segment(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_trace_segment(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_trace_segment");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(segment, std::string, std::string, std::string, segment);
+    __Proxy(samples, uint64_t, uint64_t, uint64_t, samples);
+    __Proxy(p50_ns, uint64_t, uint64_t, uint64_t, p50_ns);
+    __Proxy(p90_ns, uint64_t, uint64_t, uint64_t, p90_ns);
+    __Proxy(p99_ns, uint64_t, uint64_t, uint64_t, p99_ns);
+    __Proxy(max_ns, uint64_t, uint64_t, uint64_t, max_ns);
+
+    void set_from(const std::string& in_segment, const packet_handler_histogram& in_hist) {
+        set_segment(in_segment);
+        set_samples(in_hist.count());
+        set_p50_ns(in_hist.percentile(50));
+        set_p90_ns(in_hist.percentile(90));
+        set_p99_ns(in_hist.percentile(99));
+        set_max_ns(in_hist.max());
+    }
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.packetchain.trace.segment", "Traced segment", &segment);
+        register_field("kismet.packetchain.trace.samples", "Number of traced packets", &samples);
+        register_field("kismet.packetchain.trace.p50_ns", "Median latency (ns)", &p50_ns);
+        register_field("kismet.packetchain.trace.p90_ns", "90th percentile latency (ns)", &p90_ns);
+        register_field("kismet.packetchain.trace.p99_ns", "99th percentile latency (ns)", &p99_ns);
+        register_field("kismet.packetchain.trace.max_ns", "Maximum latency (ns)", &max_ns);
+    }
+
+    std::shared_ptr<tracker_element_string> segment;
+    std::shared_ptr<tracker_element_uint64> samples;
+    std::shared_ptr<tracker_element_uint64> p50_ns;
+    std::shared_ptr<tracker_element_uint64> p90_ns;
+    std::shared_ptr<tracker_element_uint64> p99_ns;
+    std::shared_ptr<tracker_element_uint64> max_ns;
+};
+
+// Latency of the traced packets from one datasource
+class tracked_source_trace : public tracker_component {
+public:
+    tracked_source_trace() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_source_trace(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_source_trace(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_source_trace");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(source_uuid, uuid, uuid, uuid, source_uuid);
+    __Proxy(source_name, std::string, std::string, std::string, source_name);
+    __Proxy(source_remote, uint8_t, bool, bool, source_remote);
+    __ProxyTrackable(segments, tracker_element_vector, segments);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.packetchain.trace.source_uuid", "Datasource UUID", &source_uuid);
+        register_field("kismet.packetchain.trace.source_name", "Datasource name", &source_name);
+        register_field("kismet.packetchain.trace.source_remote", 
+                "Remote datasource; latency is measured from the time the packet is received", 
+                &source_remote);
+        register_field("kismet.packetchain.trace.segments", "Latency of each segment", &segments);
+    }
+
+    std::shared_ptr<tracker_element_uuid> source_uuid;
+    std::shared_ptr<tracker_element_string> source_name;
+    std::shared_ptr<tracker_element_uint8> source_remote;
+    std::shared_ptr<tracker_element_vector> segments;
+};
+
+class packet_retention;
 
 class packet_chain : public lifetime_global {
 public:
@@ -121,24 +392,72 @@ public:
 
     void start_processing();
 
+    // Packet threads are a fixed pool, so that packets from a transmitter stay in order
+    size_t get_n_packet_threads() const { return n_packet_threads; }
+
+    // Index of the packet thread making the call, or -1 from any other thread
+    static int get_packet_thread_index() { return packet_thread_index; }
+    const std::vector<unsigned int>& get_packet_thread_cpus() const { return packet_thread_cpus; }
+
     int register_packet_component(std::string in_component);
     int remove_packet_component(int in_id);
     std::string fetch_packet_component_name(int in_id);
 
+    // Packet tags are interned: a tag name is registered once, to a small id, and packets
+    // carry their tags as bits (see kis_packet::tag).  Registering a name again returns
+    // the same id.  Names are case sensitive and are logged as registered.
+    int register_packet_tag(const std::string& in_tag);
+    // Registered names never change, so this doesn't lock and can be called from any
+    // thread with a tag id from a packet
+    const std::string& fetch_packet_tag_name(int in_id) const;
+
     // Generate a packet and hand it back
     std::shared_ptr<kis_packet> generate_packet();
 
     // Inject a packet into the chain
     int process_packet(std::shared_ptr<kis_packet> in_pack);
+
+    // Is any processing or logging queue half way to the level where packets are
+    // shed or dropped; sources which can produce packets faster than they can be
+    // processed (such as replaying a log) wait for this to clear instead
+    bool queue_congested();
+
+    // Are the packet and logging queues empty; packets already taken from a queue may
+    // still be in their handlers
+    bool queues_idle();
+
+    // Hold a packet out of the rest of the chain; called by a handler which hands the
+    // packet to another thread (such as a decryption worker).  The packet thread skips
+    // the remaining stages, logging, and statistics for a held packet.
+    void hold_packet(std::shared_ptr<kis_packet> in_pack);
+
+    // Return a held packet to the packet thread it was assigned to, continuing at
+    // in_chain (a CHAINPOS_); resumed packets are never dropped by the backlog limits,
+    // they were already accepted once
+    void resume_packet(std::shared_ptr<kis_packet> in_pack, int in_chain);
  
     // Callback and information 
     typedef int (*pc_callback)(CHAINCALL_PARMS);
+    typedef std::function<void (std::shared_ptr<kis_packet> *, size_t)> pc_batch_callback;
     typedef struct {
         int priority;
 		packet_chain::pc_callback callback;
         std::function<int (std::shared_ptr<kis_packet>)> l_callback;
+        packet_chain::pc_batch_callback b_callback;
         void *auxdata;
 		int id;
+        int chain;
+
+        // Subscribers are only called for packets with all the required components,
+        // and the phy, dlt, and 802.11 frame type they asked for (-1 for any)
+        bool subscribed;
+        uint64_t match_components;
+        int match_phyid;
+        int match_dlt;
+        int match_dot11_type;
+
+        // Call latency, when handler timing is enabled
+        std::shared_ptr<packet_handler_histogram> latency;
     } pc_link;
 
     // Register a callback, aux data, a chain to put it in, and the priority 
@@ -147,90 +466,367 @@ public:
     int remove_handler(pc_callback in_cb, int in_chain);
 	int remove_handler(int in_id, int in_chain);
 
+    // Packets a subscriber is interested in; a packet has to match every field which
+    // is set.  Components are the ids from register_packet_component, and the phy is
+    // the phy id the common classifier assigned the packet.
+    struct packet_subscription {
+        packet_subscription() :
+            phyid{-1},
+            dlt{-1},
+            dot11_type{-1} { }
+
+        std::vector<int> components;
+        int phyid;
+        int dlt;
+        int dot11_type;
+    };
+
+    // Register a handler which is only called for matching packets.  Matching is a
+    // mask test against the components present in the packet, and a compare of the
+    // phy, dlt, or frame type when they're requested, so packets a plugin doesn't care
+    // about never reach it.  Subscribers are removed with remove_handler.
+    int register_subscriber(const packet_subscription& in_sub,
+            std::function<int (std::shared_ptr<kis_packet>)> in_cb, int in_chain, int in_prio);
+
+    // Register a subscriber which is called once with every matching packet of a batch
+    // pulled from a packet queue, instead of once per packet (see packet_batch_size).
+    // Handlers ahead of it in the chain finish the whole batch before it's called, and
+    // the packets are locked for the duration of the call.  Packets injected outside
+    // of the packet threads are delivered in batches of one.
+    int register_batch_subscriber(const packet_subscription& in_sub,
+            pc_batch_callback in_cb, int in_chain, int in_prio);
+
+    // Drop policies shed less valuable packets before they are queued, once the queue
+    // of the target thread is over the shed limit.  Policies run in registration order
+    // in the capture thread, after post-capture, so they should only use cheap 
+    // classification; the first policy to return true drops the packet and counts it.
+    typedef std::function<bool (std::shared_ptr<kis_packet>)> drop_policy_cb;
+
+    int register_drop_policy(const std::string& in_name, drop_policy_cb in_cb);
+    int remove_drop_policy(int in_id);
+
     static std::string event_packetstats() { return "PACKETCHAIN_STATS"; }
+    static std::string event_handlertiming() { return "PACKETCHAIN_HANDLER_TIMING"; }
+
+    // Write the packet counters, queue depths, and any latency histograms
+    void write_metrics(kis_metrics_writer& writer);
+
+    // Sampled end-to-end latency tracing; a datasource starts the trace of a packet
+    // as soon as the report carrying it arrives, and it's stamped at each PACKET_TRACE_
+    // point on the way through the chain
+    void start_packet_trace(const std::shared_ptr<kis_packet>& in_pack) {
+        if (latency_trace_interval != 0)
+            start_packet_trace_int(in_pack);
+    }
+
+    static uint64_t trace_now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Name of the segment of a trace ending at a PACKET_TRACE_ point; the segment at
+    // PACKET_TRACE_RECEIVE is from the capture timestamp, and PACKET_TRACE_MAX is the
+    // whole trace
+    static std::string trace_segment_name(unsigned int in_point);
+
+    // Per-packet latency of a whole stage (a CHAINPOS_), or nullptr when handler timing
+    // is disabled
+    std::shared_ptr<packet_handler_histogram> get_stage_latency(int in_chain) const;
+    static std::string chain_name(int in_chain);
 
+    static std::string lane_name(int in_lane);
+
+    // Packet components come from a per-type pool with a free list per thread, so 
+    // allocating a component takes no locks in the common case
     template<typename T>
     std::shared_ptr<T> new_packet_component() {
-        kis_lock_guard<kis_mutex> lk(packetcomp_mutex);
-
-        auto p = component_pool_map.find(typeid(T).hash_code());
-
-        if (p != component_pool_map.end()) {
-            return std::static_pointer_cast<shared_object_pool<T>>(p->second)->acquire();
-        } else {
-            auto pool = std::make_shared<shared_object_pool<T>>();
-            pool->set_max(1024);
-            pool->set_reset([](T *c) { c->reset(); });
-            component_pool_map.insert({typeid(T).hash_code(), pool});
-            return pool->acquire();
-        }
+        return thread_object_pool<T>::acquire();
     }
 
 protected:
-    void packet_queue_processor(moodycamel::BlockingConcurrentQueue<std::shared_ptr<kis_packet>> *packet_queue);
+    struct packet_thread;
+
+    void packet_queue_processor(packet_thread *in_thread);
+
+    // Fill a batch from the lanes of a packet thread, waiting for at least one packet
+    size_t dequeue_packet_batch(packet_thread *in_thread, std::shared_ptr<kis_packet> *batch);
+
+    // Run the logging chain for packets handed off by the packet threads
+    void log_queue_processor();
+
+    // Hand a processed packet to the logging threads, or drop it from logging if 
+    // the logging backlog is full
+    void queue_packet_log(std::shared_ptr<kis_packet>& in_pack, time_t now);
+
+    // Run every packet in a batch through a single chain before moving to the next chain;
+    // first_no is the per-thread sequence number of the first packet in the batch, which
+    // selects the packets to time.  in_chain is the CHAINPOS_ of the chain, held packets
+    // and packets resuming at a later stage are skipped.
+    void process_chain_batch(const std::vector<std::shared_ptr<packet_chain::pc_link>>& chain,
+            int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets, uint64_t first_no);
+
+    // Run a batch through a run of per-packet handlers, one packet at a time
+    void process_chain_segment(std::vector<std::shared_ptr<packet_chain::pc_link>>::const_iterator first,
+            std::vector<std::shared_ptr<packet_chain::pc_link>>::const_iterator last,
+            int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets, uint64_t first_no);
+
+    // Hand the matching packets of a batch to a batch subscriber
+    void call_batch_handler(const std::shared_ptr<packet_chain::pc_link>& pcl,
+            int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets);
+
+    // Packet thread a packet is processed by
+    unsigned int packet_thread_id(const std::shared_ptr<kis_packet>& in_pack);
+
+    // Lane of the packet thread queue a packet goes in (a PACKET_LANE_), from the DLT and
+    // the frame control of the link frame; only the header bytes are examined
+    int packet_lane(const std::shared_ptr<kis_packet>& in_pack);
+
+    void enqueue_packet(packet_thread *in_thread, int in_lane, std::shared_ptr<kis_packet> in_pack);
+
+    // Does a packet match the subscription of a handler
+    bool handler_matches(const std::shared_ptr<packet_chain::pc_link>& pcl,
+            const std::shared_ptr<kis_packet>& in_pack) {
+        return !pcl->subscribed || subscription_matches(pcl, in_pack);
+    }
+
+    bool subscription_matches(const std::shared_ptr<packet_chain::pc_link>& pcl,
+            const std::shared_ptr<kis_packet>& in_pack);
+
+    void call_handler(const std::shared_ptr<packet_chain::pc_link>& pcl, 
+            std::shared_ptr<kis_packet>& in_pack) {
+        if (!handler_matches(pcl, in_pack))
+            return;
+
+        if (pcl->callback != nullptr)
+            pcl->callback(pcl->auxdata, in_pack);
+        else if (pcl->l_callback != nullptr)
+            pcl->l_callback(in_pack);
+        else if (pcl->b_callback != nullptr)
+            pcl->b_callback(&in_pack, 1);
+    }
+
+    void call_handler_timed(const std::shared_ptr<packet_chain::pc_link>& pcl,
+            std::shared_ptr<kis_packet>& in_pack) {
+        if (!handler_matches(pcl, in_pack))
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+        call_handler(pcl, in_pack);
+        auto end = std::chrono::steady_clock::now();
+
+        if (pcl->latency != nullptr)
+            pcl->latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
 
-    // Common function for both insertion methods
-    int register_int_handler(pc_callback in_cb, void *in_aux, 
-            std::function<int (std::shared_ptr<kis_packet>)> in_l_cb, 
-            int in_chain, int in_prio);
+    // Build the latency summary of every handler in the current chains
+    std::shared_ptr<tracker_element_vector> handler_timing_summary();
+
+    void start_packet_trace_int(const std::shared_ptr<kis_packet>& in_pack);
+
+    // Stamp the end of a stage on the traced packets of a batch which ran it
+    void stamp_packet_trace(int in_chain, std::shared_ptr<kis_packet> *batch, size_t n_packets);
+
+    // Record a traced packet which has finished the chain against its datasource
+    void finish_packet_trace(const std::shared_ptr<kis_packet>& in_pack);
+
+    // Latency of the traced packets of the datasources
+    std::shared_ptr<tracker_element_vector> source_trace_summary();
+
+    // Derive a flow assignment from the transmitter of the decapsulated frame, so that
+    // every packet from the same device lands on the same processing thread.  Returns 0
+    // when no flow can be determined cheaply.
+    uint32_t flow_assignment_id(std::shared_ptr<kis_packet> in_pack);
+
+    // Common function for all insertion methods; the link carries the callback and
+    // subscription, the id and chain are filled in
+    int register_int_handler(std::shared_ptr<pc_link> in_link, int in_chain, int in_prio);
+
+    // Build the link of a subscriber
+    std::shared_ptr<pc_link> subscription_link(const packet_subscription& in_sub);
 
     int next_componentid, next_handlerid;
 
     std::map<std::string, int> component_str_map;
     std::map<int, std::string> component_id_map;
 
-    // Core chain components
-    std::vector<std::shared_ptr<packet_chain::pc_link>> postcap_chain;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> llcdissect_chain;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> decrypt_chain;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> datadissect_chain;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> classifier_chain;
-	std::vector<std::shared_ptr<packet_chain::pc_link>> tracker_chain;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> logging_chain;
-
-    // Updated chain components
-    std::vector<std::shared_ptr<packet_chain::pc_link>> postcap_chain_new;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> llcdissect_chain_new;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> decrypt_chain_new;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> datadissect_chain_new;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> classifier_chain_new;
-	std::vector<std::shared_ptr<packet_chain::pc_link>> tracker_chain_new;
-    std::vector<std::shared_ptr<packet_chain::pc_link>> logging_chain_new;
-
-    bool postcap_chain_update;
-    bool llcdissect_chain_update;
-    bool decrypt_chain_update;
-    bool datadissect_chain_update;
-    bool classifier_chain_update;
-    bool tracker_chain_update;
-    bool logging_chain_update;
+    // Packet tag names by id, allocated once for the maximum number of tags; names are
+    // written before the count which publishes them
+    std::unique_ptr<std::string[]> packet_tag_names;
+    std::atomic<int> n_packet_tags;
+    robin_hood::unordered_flat_map<std::string, int> packet_tag_map;
+
+    // Count a dropped packet against the totals, the lane it would have been queued to,
+    // and the source it came from
+    void count_packet_drop(std::shared_ptr<kis_packet> in_pack, int in_lane, time_t now);
+
+    // 802.11 frame type from the link frame, or -1 if this isn't an 802.11 frame
+    int dot11_frame_type(std::shared_ptr<kis_packet> in_pack);
+
+    struct drop_policy {
+        std::string name;
+        drop_policy_cb cb;
+        int id;
+
+        // Packets dropped by this policy
+        std::shared_ptr<kis_tracked_rrd<>> drop_rrd;
+        std::shared_ptr<std::atomic<uint64_t>> dropped;
+    };
+
+    // Total dropped by the policies of each name, under packetchain_mutex
+    std::map<std::string, std::shared_ptr<std::atomic<uint64_t>>> drop_policy_totals;
+
+    // Immutable snapshot of all the handler chains.  Registering or removing a handler
+    // builds a new chain set under the registration lock and publishes it atomically;
+    // the packet path only loads the current snapshot, and can hold it for as long as
+    // it needs without blocking registration or seeing a partial update.
+    struct chain_set {
+        std::vector<std::shared_ptr<packet_chain::pc_link>> postcap_chain;
+        std::vector<std::shared_ptr<packet_chain::pc_link>> llcdissect_chain;
+        std::vector<std::shared_ptr<packet_chain::pc_link>> decrypt_chain;
+        std::vector<std::shared_ptr<packet_chain::pc_link>> datadissect_chain;
+        std::vector<std::shared_ptr<packet_chain::pc_link>> classifier_chain;
+        std::vector<std::shared_ptr<packet_chain::pc_link>> tracker_chain;
+        std::vector<std::shared_ptr<packet_chain::pc_link>> logging_chain;
+
+        std::vector<std::shared_ptr<drop_policy>> drop_policies;
+
+        // Map a CHAINPOS_ to the chain vector, or nullptr if unknown
+        std::vector<std::shared_ptr<packet_chain::pc_link>> *chain_at(int in_chain);
+    };
+
+    std::shared_ptr<const chain_set> chains;
+
+    std::shared_ptr<const chain_set> fetch_chains() const {
+        return std::atomic_load_explicit(&chains, std::memory_order_acquire);
+    }
+
+    void publish_chains(std::shared_ptr<const chain_set> in_chains) {
+        std::atomic_store_explicit(&chains, in_chains, std::memory_order_release);
+    }
 
     // Packet component mutex
     kis_mutex packetcomp_mutex;
 
-    // Packet chain mutex
-    kis_shared_mutex packetchain_mutex;
+    // Packet chain registration mutex; only taken by writers
+    kis_mutex packetchain_mutex;
 
     struct packet_thread {
         std::thread packet_thread;
-        moodycamel::BlockingConcurrentQueue<std::shared_ptr<kis_packet>> packet_queue;
+
+        // Queue lanes, drained highest priority first; pending counts the packets in
+        // every lane, and is what the thread waits on when it runs out of work
+        moodycamel::ConcurrentQueue<std::shared_ptr<kis_packet>> lanes[PACKET_LANE_MAX];
+        moodycamel::LightweightSemaphore pending;
+
+        // Batches in a row each lane has been passed over for while it had packets 
+        // waiting; only touched by the packet thread
+        unsigned int lane_starved[PACKET_LANE_MAX] = {};
+
+        size_t size_approx() const {
+            size_t sz = 0;
+
+            for (const auto& l : lanes)
+                sz += l.size_approx();
+
+            return sz;
+        }
+
+        // Packets which will be processed ahead of a packet queued to a lane now: the
+        // lane and every lane above it
+        size_t depth_ahead(int in_lane) const {
+            size_t sz = 0;
+
+            for (int l = 0; l <= in_lane; l++)
+                sz += lanes[l].size_approx();
+
+            return sz;
+        }
+
+        // Per-thread backlog, exposed in the packet stats
+        std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> queue_rrd;
     };
 
     packet_thread **packet_threads;
     size_t n_packet_threads;
 
+    static thread_local int packet_thread_index;
+
+    // CPUs the packet threads are restricted to, if any
+    std::vector<unsigned int> packet_thread_cpus;
+
+    // Logging runs on dedicated threads fed from a shared queue, so that slow storage
+    // never stalls dissection; with no logging threads the logging chain runs inline
+    // in the packet threads
+    std::vector<std::thread> log_threads;
+    size_t n_log_threads;
+    moodycamel::BlockingConcurrentQueue<std::shared_ptr<kis_packet>> log_queue;
+
+    // Discard level for the logging backlog
+    unsigned int log_queue_drop;
+    time_t last_log_drop_user_warning;
+
+    // Pin flows to processing threads by transmitter instead of relying on the 
+    // assignment id from the phy
+    bool packet_thread_affinity;
+
+    // Sort packets into the priority lanes, or queue everything to the normal lane
+    bool packet_priority_lanes;
+
+    // A lane passed over for this many batches in a row while it has packets waiting
+    // is served first in the next batch
+    unsigned int packet_lane_starvation;
+
     bool packetchain_shutdown;
 
-    // Warning and discard levels for packet queue being full
-    unsigned int packet_queue_warning, packet_queue_drop;
+    // Set once the packet threads exist; in-process sources may start capturing 
+    // before then
+    std::atomic<bool> packet_processing;
+
+    // Maximum number of packets pulled from a thread queue and processed as a batch
+    size_t packet_batch_size;
+
+    // Time the handlers for one in every handler_timing_interval packets, or 0 to 
+    // disable handler timing
+    uint64_t handler_timing_interval;
+    int handler_timing_vec_id, handler_timing_entry_id;
+
+    // Time spent by a timed packet in each stage, indexed by CHAINPOS_
+    std::shared_ptr<packet_handler_histogram> stage_latency[CHAINPOS_LOGGING + 1];
+
+    // Trace one in every latency_trace_interval packets received by each capture thread,
+    // or 0 to disable tracing
+    uint64_t latency_trace_interval;
+
+    // Trace segments of a datasource, indexed by the PACKET_TRACE_ point they end at,
+    // followed by the whole trace
+    struct source_trace {
+        uuid source_uuid;
+        std::string source_name;
+        bool source_remote;
+        packet_handler_histogram segments[PACKET_TRACE_MAX + 1];
+    };
+
+    // Keyed by source key; only traced packets take the lock
+    kis_mutex source_trace_mutex;
+    std::map<uint32_t, std::shared_ptr<source_trace>> source_traces;
+    int source_trace_vec_id, source_trace_entry_id, source_trace_segment_id;
+
+    // Warning and discard levels for packet queue being full, and the level at which
+    // drop policies start shedding packets
+    unsigned int packet_queue_warning, packet_queue_drop, packet_queue_shed;
     time_t last_packet_queue_user_warning, last_packet_drop_user_warning;
 
-    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_default_aggregator,
+    // Running totals for the metrics exporter, which only reads atomics
+    std::atomic<uint64_t> packets_total, packets_processed, packets_error, packets_dupe,
+        packets_dropped, log_dropped;
+
+    // Added to by every packet, so these accumulate without the RRD lock
+    std::shared_ptr<kis_tracked_atomic_rrd<kis_tracked_rrd_default_aggregator,
         kis_tracked_rrd_prev_pos_extreme_aggregator, 
         kis_tracked_rrd_prev_pos_extreme_aggregator>> packet_peak_rrd;
     int packet_peak_rrd_id;
 
-    std::shared_ptr<kis_tracked_rrd<>> packet_rate_rrd;
+    std::shared_ptr<kis_tracked_atomic_rrd<>> packet_rate_rrd;
     int packet_rate_rrd_id;
 
     std::shared_ptr<kis_tracked_rrd<>> packet_error_rrd;
@@ -245,42 +841,110 @@ protected:
     std::shared_ptr<kis_tracked_rrd<>> packet_drop_rrd;
     int packet_drop_rrd_id;
 
+    // Per-policy drop rrds, by policy name
+    std::shared_ptr<tracker_element_string_map> drop_policy_map;
+    int drop_policy_map_id, drop_policy_rrd_id;
+    int next_drop_policy_id;
+
     std::shared_ptr<kis_tracked_rrd<>> packet_processed_rrd;
     int packet_processed_rrd_id;
 
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> log_queue_rrd;
+    int log_queue_rrd_id;
+
+    std::shared_ptr<kis_tracked_rrd<>> log_drop_rrd;
+    int log_drop_rrd_id;
+
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> packet_batch_rrd;
+    int packet_batch_rrd_id;
+
+    std::shared_ptr<tracker_element_vector> packet_thread_queue_vec;
+    int packet_thread_queue_vec_id, packet_thread_queue_rrd_id;
+
+    // Backlog ahead of packets queued to each lane and packets dropped from each lane,
+    // by lane name
+    std::shared_ptr<tracker_element_string_map> lane_queue_map, lane_drop_map;
+    int lane_queue_map_id, lane_drop_map_id, lane_queue_rrd_id, lane_drop_rrd_id;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> lane_queue_rrd[PACKET_LANE_MAX];
+    std::shared_ptr<kis_tracked_rrd<>> lane_drop_rrd[PACKET_LANE_MAX];
+    std::atomic<uint64_t> lane_dropped[PACKET_LANE_MAX];
+
     std::shared_ptr<tracker_element_map> packet_stats_map;
 
     std::shared_ptr<time_tracker> timetracker;
     int event_timer_id;
     std::shared_ptr<event_bus> eventbus;
+    int event_handlertiming_chan;
 
     // Packet & data component pools
     shared_object_pool<kis_packet> packet_pool;
 
-    robin_hood::unordered_map<size_t, std::shared_ptr<void>> component_pool_map;
+    // Component pool efficiency, sampled from the pool counters each second
+    std::shared_ptr<kis_tracked_rrd<>> component_pool_hit_rrd;
+    int component_pool_hit_rrd_id;
+
+    std::shared_ptr<kis_tracked_rrd<>> component_pool_miss_rrd;
+    int component_pool_miss_rrd_id;
 
-    // Unique lock for packet number and dedupe
-    kis_shared_mutex pack_no_mutex;
+    uint64_t last_component_pool_hits, last_component_pool_misses;
 
     // Next unique packet number
     std::atomic<uint64_t> unique_packet_no;
 
-    // A simple array of hash to packet ID for the past 1024 unique packets
-    typedef struct packno_map {
-        packno_map() {
-            hash = 0;
-            packno = 0;
-        }
-
-        uint32_t hash;
+    // Index of recently seen unique packets, keyed by content checksum and length.  The
+    // index is split into independently locked shards by checksum; each shard is a ring
+    // of entries bounding the size, with an open-addressed map to the ring slot for O(1)
+    // lookup.
+    struct dedupe_entry {
+        dedupe_entry() :
+            key{0},
+            packno{0},
+            ts{0},
+            bytes{0} { }
+
+        uint64_t key;
         uint64_t packno;
+        time_t ts;
+
+        // Length of the original packet data, counted against the dedupe retention quota
+        size_t bytes;
+
+        // Duplicates alias the decoded components of the original, some of which 
+        // reference the original packet data directly, so the original must be kept
         std::shared_ptr<kis_packet> original_pkt;
-    } packno_map_t;
+    };
+
+    struct dedupe_shard {
+        dedupe_shard() :
+            ring_pos{0},
+            bytes{0} { }
+
+        kis_mutex mutex;
+        robin_hood::unordered_flat_map<uint64_t, size_t> index;
+        std::vector<dedupe_entry> ring;
+        size_t ring_pos;
+
+        // Bytes of original packets held by the shard
+        size_t bytes;
+    };
+
+    static constexpr size_t dedupe_n_shards = 16;
+    dedupe_shard dedupe_shards[dedupe_n_shards];
+
+    // Maximum age of an original packet for deduping, in seconds, or 0 for no limit
+    time_t dedupe_window;
+
+    // Bytes of original packets each shard may hold, from the dedupe retention quota, or
+    // 0 for no limit beyond the size of the ring
+    size_t dedupe_shard_quota;
+    std::shared_ptr<packet_retention> retention;
 
-    packno_map_t dedupe_list[1024];
+    // Drop the original packet of a dedupe entry; the shard must be locked
+    void dedupe_release(dedupe_shard& shard, dedupe_entry& e);
 
-    // Current position in the dedupe list
-    std::atomic<unsigned int> dedupe_list_pos;
+    // Look up a packet in the dedupe index, marking it as a duplicate or recording it
+    // as a new original
+    void dedupe_packet(std::shared_ptr<kis_packet> in_pack);
 
 	int pack_comp_linkframe, pack_comp_decap, pack_comp_l1_agg, pack_comp_l1, pack_comp_datasource;
     
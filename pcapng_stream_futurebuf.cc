@@ -18,7 +18,9 @@
 
 #include "config.h"
 
+#include "configfile.h"
 #include "kis_mutex.h"
+#include "objectpool.h"
 #include "pcapng_stream_futurebuf.h"
 
 pcapng_stream_futurebuf::pcapng_stream_futurebuf(future_chainbuf& buffer,
@@ -30,11 +32,30 @@ pcapng_stream_futurebuf::pcapng_stream_futurebuf(future_chainbuf& buffer,
     chainbuf{buffer},
     max_backlog{backlog_sz},
     block_for_buffer{block_for_write}, 
+    backlog_policy{pcapng_backlog_policy::drop},
+    backlog_timeout{0},
+    backlog_full_since{0},
     accept_cb{accept_filter},
     selector_cb{data_selector} {
 
     pcap_mutex.set_name("pcapng_stream_futurebuf");
 
+    auto policy = 
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("pcapng_stream_backlog_policy", "drop"));
+
+    if (policy == "disconnect") {
+        backlog_policy = pcapng_backlog_policy::disconnect;
+    } else if (policy != "drop") {
+        _MSG_ERROR("Unknown pcapng_stream_backlog_policy '{}', expected 'drop' or 'disconnect'; "
+                "dropping packets for slow pcapng streams.", policy);
+    }
+
+    backlog_timeout = 
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_stream_backlog_timeout", 30);
+
+    zerocopy_min =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_stream_zerocopy_min", 256);
+
     // Kick us out of stream mode into packet mode
     chainbuf.set_packetmode();
 
@@ -58,9 +79,142 @@ void pcapng_stream_futurebuf::start_stream() {
     pcapng_make_shb("", "", "Kismet");
 }
 
+void pcapng_stream_futurebuf::set_backlog_policy(pcapng_backlog_policy in_policy, 
+        unsigned int in_timeout) {
+    kis_lock_guard<kis_mutex> lk(pcap_mutex, "set_backlog_policy");
+
+    backlog_policy = in_policy;
+    backlog_timeout = in_timeout;
+    backlog_full_since = 0;
+}
+
+void pcapng_stream_futurebuf::set_bpf_filter(const std::string& in_expression) {
+    kis_lock_guard<kis_mutex> lk(pcap_mutex, "set_bpf_filter");
+
+#ifdef HAVE_LIBPCAP
+    bpf_programs.clear();
+    bpf_expression = in_expression;
+
+    if (bpf_expression.length() == 0)
+        return;
+
+    // Filters are compiled against the DLT of each packet as it's seen, but an expression
+    // which doesn't compile for any of the common types is almost certainly a mistake
+    std::string first_error;
+    bool compiled = false;
+
+    for (auto dlt : {DLT_IEEE802_11_RADIO, DLT_IEEE802_11, DLT_EN10MB}) {
+        std::string error;
+
+        auto prog = bpf_compile(dlt, error);
+        bpf_programs[dlt] = prog;
+
+        if (prog != nullptr)
+            compiled = true;
+        else if (first_error.length() == 0)
+            first_error = error;
+    }
+
+    if (!compiled) {
+        bpf_programs.clear();
+        bpf_expression.clear();
+        throw std::runtime_error(fmt::format("invalid packet filter '{}': {}", 
+                    in_expression, first_error));
+    }
+#else
+    if (in_expression.length() != 0)
+        throw std::runtime_error("packet filters are not available; Kismet was built without libpcap");
+#endif
+}
+
+#ifdef HAVE_LIBPCAP
+std::shared_ptr<bpf_program> pcapng_stream_futurebuf::bpf_compile(int in_dlt, std::string& error) {
+    // The filter compiler in older versions of libpcap is not thread safe
+    static std::mutex compile_mutex;
+    std::lock_guard<std::mutex> lk(compile_mutex);
+
+    auto pd = pcap_open_dead(in_dlt, 65535);
+
+    if (pd == nullptr) {
+        error = "unable to initialize the filter compiler";
+        return nullptr;
+    }
+
+    auto prog = std::shared_ptr<bpf_program>(new bpf_program, 
+            [](bpf_program *p) { 
+                pcap_freecode(p);
+                delete p;
+            });
+
+    memset(prog.get(), 0, sizeof(bpf_program));
+
+    if (pcap_compile(pd, prog.get(), bpf_expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        error = pcap_geterr(pd);
+        pcap_close(pd);
+        return nullptr;
+    }
+
+    pcap_close(pd);
+
+    return prog;
+}
+#endif
+
+bool pcapng_stream_futurebuf::bpf_match(std::shared_ptr<kis_datachunk> in_data) {
+    if (bpf_expression.length() == 0)
+        return true;
+
+#ifdef HAVE_LIBPCAP
+    std::shared_ptr<bpf_program> prog;
+
+    auto prog_k = bpf_programs.find(in_data->dlt);
+
+    if (prog_k != bpf_programs.end()) {
+        prog = prog_k->second;
+    } else {
+        std::string error;
+
+        prog = bpf_compile(in_data->dlt, error);
+        bpf_programs[in_data->dlt] = prog;
+
+        if (prog == nullptr)
+            _MSG_INFO("The packet filter '{}' for pcapng stream {} doesn't apply to packets "
+                    "with DLT {} ({}); they will not be included in the stream.", 
+                    bpf_expression, get_stream_id(), in_data->dlt, error);
+    }
+
+    if (prog == nullptr)
+        return false;
+
+    return bpf_filter(prog->bf_insns, reinterpret_cast<const u_char *>(in_data->data()),
+            in_data->length(), in_data->length()) != 0;
+#else
+    return true;
+#endif
+}
+
 bool pcapng_stream_futurebuf::block_until(size_t req_bytes) {
-    if (!block_for_buffer)
-        return chainbuf.size() + req_bytes < max_backlog;
+    if (!block_for_buffer) {
+        if (chainbuf.size() + req_bytes < max_backlog) {
+            backlog_full_since = 0;
+            return true;
+        }
+
+        if (backlog_policy == pcapng_backlog_policy::disconnect) {
+            time_t now = Globalreg::globalreg->last_tv_sec;
+
+            if (backlog_full_since == 0) {
+                backlog_full_since = now;
+            } else if (now - backlog_full_since >= (time_t) backlog_timeout && chainbuf.running()) {
+                _MSG_INFO("Closing pcapng stream {}, the client has not kept up with the packet "
+                        "rate for {} seconds and {} packets were dropped.", get_stream_id(),
+                        now - backlog_full_since, log_dropped + 1);
+                chainbuf.cancel();
+            }
+        }
+
+        return false;
+    }
 
     while (chainbuf.size() + req_bytes > max_backlog) {
         if (!chainbuf.running())
@@ -290,86 +444,41 @@ int pcapng_stream_futurebuf::pcapng_make_idb(unsigned int in_sourcenumber, const
     return logid;
 }
 
-int pcapng_stream_futurebuf::pcapng_write_packet(std::shared_ptr<kis_packet> in_packet, 
-        std::shared_ptr<kis_datachunk> in_data) {
-    kis_lock_guard<kis_mutex> lk(pcap_mutex, "pcapng_futurebuf pcapng_write_packet");
-
-    auto datasrcinfo = in_packet->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
-    auto gpsinfo = in_packet->fetch<kis_gps_packinfo>(pack_comp_gpsinfo);
-
-    if (datasrcinfo == nullptr)
-        return 0;
-
-    int ng_interface_id = pcapng_make_idb(datasrcinfo->ref_source, in_data->dlt);
-
-    std::shared_ptr<char> buf;
-
-    // Total buffer size starts header + data + options + end of option
-    size_t buf_sz = sizeof(pcapng_epb_t) + PAD_TO_32BIT(in_data->length()) + sizeof(pcapng_option_t);
-
-    // Optionally we add the GPS option into the total length
-    size_t gps_len = 0;
+size_t pcapng_stream_futurebuf::pcapng_epb_options_len(std::shared_ptr<kis_packet> in_packet,
+        std::shared_ptr<kis_gps_packinfo> gpsinfo) {
+    // End of options
+    size_t opt_sz = sizeof(pcapng_option_t);
 
     if (gpsinfo != nullptr && gpsinfo->fix >= 2) {
-        // GPS header
-        gps_len = sizeof(kismet_pcapng_gps_chunk_t);
-
-        // Always lat/lon, optionally alt
-        gps_len += 8;
+        // GPS header, always lat/lon, optionally alt
+        size_t gps_len = sizeof(kismet_pcapng_gps_chunk_t) + 8;
 
         if (gpsinfo->fix > 2 && gpsinfo->alt != 0)
             gps_len += 4;
 
         // Total additional size is custom option block including PEN, and padded custom data
-        buf_sz += sizeof(pcapng_custom_option_t) + PAD_TO_32BIT(gps_len);
+        opt_sz += sizeof(pcapng_custom_option_t) + PAD_TO_32BIT(gps_len);
     }
 
     if (in_packet->hash != 0) {
         // CRC32 hash, 1 octet identifier, 4 octet hash
-        buf_sz += PAD_TO_32BIT(sizeof(pcapng_epb_hash_option_t));
+        opt_sz += PAD_TO_32BIT(sizeof(pcapng_epb_hash_option_t));
     }
 
     if (in_packet->packet_no != 0) {
         // Unique packet number, 8 bytes
-        buf_sz += PAD_TO_32BIT(sizeof(pcapng_epb_packetid_option_t));
+        opt_sz += PAD_TO_32BIT(sizeof(pcapng_epb_packetid_option_t));
     }
 
-    // Allocate 4 bytes larger to hold the final length
-    if (!block_until(buf_sz + 4))
-        return 0;
-
-    pcapng_epb *epb;
-    pcapng_option *opt;
-
-    buf = std::shared_ptr<char>(new char[buf_sz + 4], std::default_delete<char[]>());
-    memset(buf.get(), 0x00, buf_sz + 4);
-
-    epb = reinterpret_cast<pcapng_epb *>(buf.get());
-
-    epb->block_type = PCAPNG_EPB_BLOCK_TYPE;
-    epb->block_length = buf_sz + 4;
-    epb->interface_id = ng_interface_id;
-
-    // Convert timestamp to 10e6 usec precision
-    uint64_t conv_ts;
-    conv_ts = (uint64_t) in_packet->ts.tv_sec * 1000000L;
-    conv_ts += in_packet->ts.tv_usec;
-
-    // Split high and low ts
-    epb->timestamp_high = (conv_ts >> 32);
-    epb->timestamp_low = conv_ts;
-
-    epb->captured_length = in_data->length();
-    epb->original_length = in_data->length();
-
-    // Copy the data after the epb header
-    memcpy(buf.get() + sizeof(pcapng_epb_t), in_data->data(), in_data->length());
+    return opt_sz;
+}
 
-    // Offset to the end of the epb header + data + pad
-    size_t opt_offt = sizeof(pcapng_epb_t) + PAD_TO_32BIT(in_data->length());
+void pcapng_stream_futurebuf::pcapng_write_epb_options(char *dest, std::shared_ptr<kis_packet> in_packet,
+        std::shared_ptr<kis_gps_packinfo> gpsinfo) {
+    size_t opt_offt = 0;
 
     if (in_packet->hash != 0) {
-        auto hopt = reinterpret_cast<pcapng_epb_hash_option_t *>(buf.get() + opt_offt);
+        auto hopt = reinterpret_cast<pcapng_epb_hash_option_t *>(dest + opt_offt);
 
         hopt->option_code = PCAPNG_OPT_EPB_HASH;
         hopt->option_length = 5;
@@ -380,7 +489,7 @@ int pcapng_stream_futurebuf::pcapng_write_packet(std::shared_ptr<kis_packet> in_
     }
 
     if (in_packet->packet_no != 0) {
-        auto popt = reinterpret_cast<pcapng_epb_packetid_option_t *>(buf.get() + opt_offt);
+        auto popt = reinterpret_cast<pcapng_epb_packetid_option_t *>(dest + opt_offt);
 
         popt->option_code = PCAPNG_OPT_EPB_PACKETID;
         popt->option_length = 8;
@@ -390,13 +499,13 @@ int pcapng_stream_futurebuf::pcapng_write_packet(std::shared_ptr<kis_packet> in_
     }
 
     if (gpsinfo != nullptr && gpsinfo->fix >= 2) {
-        auto gopt = reinterpret_cast<pcapng_custom_option_t *>(buf.get() + opt_offt);
+        auto gopt = reinterpret_cast<pcapng_custom_option_t *>(dest + opt_offt);
 
         // Always lon and lat
         uint32_t gps_fields = PCAPNG_GPS_FLAG_LAT | PCAPNG_GPS_FLAG_LON;
 
         // lon/lat
-        gps_len = 8;
+        size_t gps_len = 8;
 
         if (gpsinfo->fix > 2 && gpsinfo->alt != 0) {
             gps_len += 4;
@@ -437,17 +546,105 @@ int pcapng_stream_futurebuf::pcapng_write_packet(std::shared_ptr<kis_packet> in_
     }
 
     // Place an end option after the data - header + pad32(data)
-    opt = reinterpret_cast<pcapng_option *>(buf.get() + opt_offt);
+    auto opt = reinterpret_cast<pcapng_option *>(dest + opt_offt);
     opt->option_code = PCAPNG_OPT_ENDOFOPT;
     opt->option_length = 0;
+}
 
-    // Final size
-    auto end_sz = reinterpret_cast<uint32_t *>(buf.get() + buf_sz);
-    *end_sz = buf_sz + 4;
+int pcapng_stream_futurebuf::pcapng_write_packet(std::shared_ptr<kis_packet> in_packet, 
+        std::shared_ptr<kis_datachunk> in_data) {
+    kis_lock_guard<kis_mutex> lk(pcap_mutex, "pcapng_futurebuf pcapng_write_packet");
 
-    chainbuf.put_data(buf, buf_sz + 4);
+    auto datasrcinfo = in_packet->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
+    auto gpsinfo = in_packet->fetch<kis_gps_packinfo>(pack_comp_gpsinfo);
 
-    log_size += buf_sz + 4;
+    if (datasrcinfo == nullptr)
+        return 0;
+
+    int ng_interface_id = pcapng_make_idb(datasrcinfo->ref_source, in_data->dlt);
+
+    size_t data_sz = in_data->length();
+    size_t pad_sz = PAD_TO_32BIT(data_sz) - data_sz;
+    size_t opt_sz = pcapng_epb_options_len(in_packet, gpsinfo);
+
+    // Total block is header + data + pad + options + final length
+    size_t block_sz = sizeof(pcapng_epb_t) + data_sz + pad_sz + opt_sz + 4;
+
+    // Streams over their bandwidth budget skip packets instead of buffering them
+    if (!take_rate_budget(block_sz))
+        return 0;
+
+    if (!block_until(block_sz)) {
+        log_dropped++;
+        return 0;
+    }
+
+    // The block is split around the packet data; the header comes before it and the
+    // padding, options, and final length after it
+    size_t trailer_sz = pad_sz + opt_sz + 4;
+
+    std::shared_ptr<char> buf;
+    std::shared_ptr<char> header, trailer;
+
+    bool zerocopy = data_sz >= zerocopy_min && 
+        sizeof(pcapng_epb_t) + trailer_sz <= block_frame::frame_sz;
+
+    if (zerocopy) {
+        auto frame = thread_object_pool<block_frame>::acquire();
+
+        header = std::shared_ptr<char>(frame, frame->data);
+        trailer = std::shared_ptr<char>(frame, frame->data + sizeof(pcapng_epb_t));
+    } else {
+        buf = std::shared_ptr<char>(new char[block_sz], std::default_delete<char[]>());
+
+        header = buf;
+        trailer = std::shared_ptr<char>(buf, buf.get() + sizeof(pcapng_epb_t) + data_sz);
+
+        // Copy the data after the epb header
+        memcpy(buf.get() + sizeof(pcapng_epb_t), in_data->data(), data_sz);
+    }
+
+    memset(header.get(), 0x00, sizeof(pcapng_epb_t));
+    memset(trailer.get(), 0x00, trailer_sz);
+
+    auto epb = reinterpret_cast<pcapng_epb *>(header.get());
+
+    epb->block_type = PCAPNG_EPB_BLOCK_TYPE;
+    epb->block_length = block_sz;
+    epb->interface_id = ng_interface_id;
+
+    // Convert timestamp to 10e6 usec precision
+    uint64_t conv_ts;
+    conv_ts = (uint64_t) in_packet->ts.tv_sec * 1000000L;
+    conv_ts += in_packet->ts.tv_usec;
+
+    // Split high and low ts
+    epb->timestamp_high = (conv_ts >> 32);
+    epb->timestamp_low = conv_ts;
+
+    epb->captured_length = data_sz;
+    epb->original_length = data_sz;
+
+    pcapng_write_epb_options(trailer.get() + pad_sz, in_packet, gpsinfo);
+
+    // Final size
+    auto end_sz = reinterpret_cast<uint32_t *>(trailer.get() + pad_sz + opt_sz);
+    *end_sz = block_sz;
+
+    if (zerocopy) {
+        // Reference the packet data in place; holding the packet and the chunk keeps
+        // the data (which may be a view into another chunk of the packet) from being
+        // released or recycled by the packet pools until the consumer is done with it
+        auto payload = std::shared_ptr<char>(const_cast<char *>(in_data->data()),
+                [in_packet, in_data](char *) { });
+
+        chainbuf.put_gather({{header, sizeof(pcapng_epb_t)}, {payload, data_sz}, 
+                {trailer, trailer_sz}});
+    } else {
+        chainbuf.put_data(buf, block_sz);
+    }
+
+    log_size += block_sz;
 
     return 1;
 }
@@ -529,9 +726,11 @@ void pcapng_stream_futurebuf::handle_packet(std::shared_ptr<kis_packet> in_packe
 
     kis_lock_guard<kis_mutex> lk(pcap_mutex, "pcapng_futurebuf handle_packet");
 
-    pcapng_write_packet(in_packet, target_datachunk);
+    if (!bpf_match(target_datachunk))
+        return;
 
-    log_packets++;
+    if (pcapng_write_packet(in_packet, target_datachunk) > 0)
+        log_packets++;
 
     if (check_over_size() || check_over_packets()) {
         chainbuf.cancel();
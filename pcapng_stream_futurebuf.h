@@ -25,6 +25,12 @@
 #include <unordered_map>
 #include <vector>
 
+#ifdef HAVE_LIBPCAP
+extern "C" {
+#include <pcap/pcap.h>
+}
+#endif
+
 #include "future_chainbuf.h"
 #include "globalregistry.h"
 #include "packetchain.h"
@@ -36,10 +42,27 @@
 // future_chainbuf; registers as a stream handler in the streaming subsystem.
 //
 // Can be configured to have a maximum pending buffer size, with discard or stall behavior.
+// Streams which discard can also be closed once the consumer has been unable to keep up
+// for too long (pcapng_stream_backlog_policy).
+//
+// Packets are not copied into the buffer: each block is a small pooled frame holding the
+// block header and trailer, around a reference to the packet data, which keeps the packet
+// alive until the consumer has sent it.  Payloads smaller than pcapng_stream_zerocopy_min 
+// are copied instead, since holding a whole packet for them costs more than the copy.
+//
+// Streams can be narrowed with a BPF filter expression, which is checked against the
+// packet data before a block is built; it's compiled once for each DLT the stream sees.
 //
 // Can be stalled until the lifetime of the stream completes, for easy inclusion in http request
 // threads
 
+enum class pcapng_backlog_policy {
+    // Discard packets while the backlog is full
+    drop,
+    // Discard packets, and close the stream once the backlog has been full for the timeout
+    disconnect
+};
+
 class pcapng_stream_futurebuf : public streaming_agent, public std::enable_shared_from_this<pcapng_stream_futurebuf> {
 public:
     pcapng_stream_futurebuf(future_chainbuf& buffer, 
@@ -55,7 +78,29 @@ public:
     virtual void stop_stream(std::string in_reason) override;
 
     virtual void block_until_stream_done();
+
+    // Live streams which don't block for the client share the stream bandwidth cap
+    virtual bool rate_limited() override { return !block_for_buffer; }
+
+    // Policy for a full backlog on a stream which doesn't block; by default set from the
+    // pcapng_stream_backlog_policy and pcapng_stream_backlog_timeout options
+    void set_backlog_policy(pcapng_backlog_policy in_policy, unsigned int in_timeout);
+
+    // Only stream packets matching a BPF filter expression; throws std::runtime_error if the
+    // expression can't be compiled for any of the common capture types
+    void set_bpf_filter(const std::string& in_expression);
+
 protected:
+    // Pooled storage for the header and trailer of a block built around referenced
+    // packet data; large enough for the EPB header, padding, every option we write, 
+    // and the trailing length
+    struct block_frame {
+        static constexpr size_t frame_sz = 128;
+        char data[frame_sz];
+
+        void reset() { }
+    };
+
     kis_mutex pcap_mutex;
 
     future_chainbuf& chainbuf;
@@ -66,6 +111,23 @@ protected:
     size_t max_backlog;
     bool block_for_buffer;
 
+    pcapng_backlog_policy backlog_policy;
+    unsigned int backlog_timeout;
+    time_t backlog_full_since;
+
+    size_t zerocopy_min;
+
+    // Compiled BPF filter per DLT; a DLT the expression can't be compiled for holds a null
+    // program and matches nothing
+    std::string bpf_expression;
+#ifdef HAVE_LIBPCAP
+    std::unordered_map<int, std::shared_ptr<bpf_program>> bpf_programs;
+
+    std::shared_ptr<bpf_program> bpf_compile(int in_dlt, std::string& error);
+#endif
+
+    bool bpf_match(std::shared_ptr<kis_datachunk> in_data);
+
     std::function<bool (std::shared_ptr<kis_packet>)> accept_cb;
     std::function<std::shared_ptr<kis_datachunk>(std::shared_ptr<kis_packet>)> selector_cb;
 
@@ -86,6 +148,12 @@ protected:
             std::shared_ptr<kis_datachunk> in_data);
     virtual int pcapng_write_packet(int interface_t, const struct timeval& ts, const std::string& in_data);
 
+    // Length of the EPB options we write for a packet, including the end of options
+    size_t pcapng_epb_options_len(std::shared_ptr<kis_packet> in_packet,
+            std::shared_ptr<kis_gps_packinfo> in_gps);
+    void pcapng_write_epb_options(char *dest, std::shared_ptr<kis_packet> in_packet,
+            std::shared_ptr<kis_gps_packinfo> in_gps);
+
     virtual void handle_packet(std::shared_ptr<kis_packet> in_packet);
 
     static size_t PAD_TO_32BIT(size_t in) {
@@ -110,6 +110,10 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
     devicetracker = Globalreg::fetch_mandatory_global_as<device_tracker>();
     eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
     entrytracker = Globalreg::fetch_mandatory_global_as<entry_tracker>();
+
+    dot11_new_advertised_ssid_chan = eventbus->register_channel(dot11_new_advertised_ssid);
+    dot11_new_probed_ssid_chan = eventbus->register_channel(dot11_new_probed_ssid);
+    dot11_new_response_ssid_chan = eventbus->register_channel(dot11_new_response_ssid);
     streamtracker = Globalreg::fetch_mandatory_global_as<stream_tracker>();
 
     Globalreg::enable_pool_type<std::vector<ie_tag_tuple>>([](auto *t) { t->clear(); });
@@ -230,6 +234,14 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
     pack_comp_json =
         packetchain->register_packet_component("JSON");
 
+    pack_tag_probe_req = packetchain->register_packet_tag("DOT11_PROBE_REQ");
+    pack_tag_disassociation = packetchain->register_packet_tag("DOT11_DISASSOCIATION");
+    pack_tag_deauthentication = packetchain->register_packet_tag("DOT11_DEAUTHENTICATION");
+    pack_tag_beacon_ssid = packetchain->register_packet_tag("DOT11_BEACON_SSID");
+    pack_tag_response_ssid = packetchain->register_packet_tag("DOT11_RESPONSE_SSID");
+    pack_tag_wpa_handshake = packetchain->register_packet_tag("DOT11_WPAHANDSHAKE");
+    pack_tag_rsn_pmkid = packetchain->register_packet_tag("DOT11_RSNPMKID");
+
     devtype_adhoc = devicetracker->get_cached_devicetype("Wi-Fi Ad-Hoc");
     devtype_ap = devicetracker->get_cached_devicetype("Wi-Fi AP");
     devtype_client = devicetracker->get_cached_devicetype("Wi-Fi Client"); 
@@ -238,6 +250,7 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
     devtype_wds_ap = devicetracker->get_cached_devicetype("Wi-Fi WDS AP"); 
     devtype_bridged = devicetracker->get_cached_devicetype("Wi-Fi Bridged");
     devtype_device = devicetracker->get_cached_devicetype("Wi-Fi Device");
+    devtype_random_group = devicetracker->get_cached_devicetype("Wi-Fi Randomized Group");
 
     ssid_regex_vec =
         Globalreg::globalreg->entrytracker->register_and_get_field_as<tracker_element_vector>("phy80211.ssid_alerts", 
@@ -585,6 +598,8 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
                 "or potential exploits.",
                 phyid);
 
+    compile_alert_signatures();
+
     // Threshold
     signal_too_loud_threshold = 
         Globalreg::globalreg->kismet_config->fetch_opt_int("dot11_max_signal", -10);
@@ -639,6 +654,22 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
         return;
     }
 
+    wep_decrypt_async =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("dot11_wep_decrypt_async", true);
+    wep_decrypt_backlog =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("dot11_wep_decrypt_backlog", 1024);
+
+    if (wep_decrypt_backlog == 0)
+        wep_decrypt_async = false;
+
+    // Only run the decryption worker when there's something to decrypt
+    if (wep_decrypt_async && wepkeys.size() > 0) {
+        wep_decrypt_thread = std::thread([this]() {
+                thread_set_process_name("WEPDECRYPT");
+                wep_decrypt_worker();
+            });
+    }
+
     // TODO turn into REST endpoint
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("allowkeytransmit", 0)) {
         _MSG("Allowing Kismet clients to view WEP keys", MSGFLAG_INFO);
@@ -793,6 +824,69 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
         _MSG_INFO("Keeping a copy of advertised IE tags for each SSID; this can use more CPU and RAM.");
 
 
+    random_client_max =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("dot11_random_client_max", 64);
+    random_probe_max =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("dot11_random_probe_max", 16);
+
+    legacy_ie_parser =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("dot11_legacy_ie_parser", false);
+    if (legacy_ie_parser)
+        _MSG_INFO("Parsing IE tags with the legacy stream parser; this uses more CPU.");
+
+    auto volatile_v =
+        quote_str_tokenize(Globalreg::globalreg->kismet_config->fetch_opt_dfl("dot11_beacon_volatile_ie",
+                    "5,11"), ",");
+
+    for (const auto& i : volatile_v) {
+        unsigned int t;
+
+        if (sscanf(i.c_str(), "%u", &t) != 1 || t > 255) {
+            _MSG_ERROR("Invalid IE tag number in dot11_beacon_volatile_ie, skipping.");
+            continue;
+        }
+
+        volatile_ie_tags.set(t);
+    }
+
+    random_probe_group =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("dot11_random_probe_group", false);
+
+    if (random_probe_group) {
+        _MSG_INFO("Grouping probes from randomized MACs into a device per probe fingerprint.");
+
+        auto group_v =
+            quote_str_tokenize(Globalreg::globalreg->kismet_config->fetch_opt_dfl("dot11_random_probe_group_ie",
+                        "1,45,50,59,107,127,191"), ",");
+
+        for (const auto& i : group_v) {
+            unsigned int t;
+
+            if (sscanf(i.c_str(), "%u", &t) != 1 || t > 255) {
+                _MSG_ERROR("Invalid IE tag number in dot11_random_probe_group_ie, skipping.");
+                continue;
+            }
+
+            random_probe_group_ie.set(t);
+        }
+
+        auto track_v =
+            quote_str_tokenize(Globalreg::globalreg->kismet_config->fetch_opt("dot11_random_probe_track"), ",");
+
+        for (const auto& i : track_v) {
+            mac_addr m(i);
+
+            if (m.error()) {
+                _MSG_ERROR("Invalid MAC address '{}' in dot11_random_probe_track, skipping.", i);
+                continue;
+            }
+
+            random_probe_track.push_back(m);
+        }
+    }
+
+    retention = Globalreg::fetch_mandatory_global_as<packet_retention>();
+
     keep_eapol_packets =
         Globalreg::globalreg->kismet_config->fetch_opt_bool("dot11_keep_eapol", true);
     if (keep_eapol_packets)
@@ -802,6 +896,21 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
         _MSG_INFO("Not keeping EAPOL packets in memory, EAP replay WIDS and handshake downloads will not "
                 "be available.");
 
+    eapol_async =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("dot11_eapol_async", true);
+    eapol_backlog =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("dot11_eapol_backlog", 4096);
+
+    if (eapol_backlog == 0)
+        eapol_async = false;
+
+    if (eapol_async) {
+        eapol_thread = std::thread([this]() {
+                thread_set_process_name("EAPOL");
+                eapol_worker();
+            });
+    }
+
     filter_survey_only =
         Globalreg::globalreg->kismet_config->fetch_opt_bool("dot11_ap_only_survey", false);
 
@@ -987,6 +1096,20 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
                     return generate_handshake_pcap(con, dev, dot11, mac_addr(), "pmkid");
                 }));
 
+    httpd->register_mime_type("22000", "text/plain");
+
+    httpd->register_route("/phy/phy80211/handshakes/handshakes", {"GET", "POST"}, httpd->RO_ROLE, {"pcapng"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    return generate_handshake_bulk(con, "pcapng");
+                }));
+
+    httpd->register_route("/phy/phy80211/handshakes/handshakes", {"GET", "POST"}, httpd->RO_ROLE, {"22000"},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    return generate_handshake_bulk(con, "22000");
+                }));
+
     httpd->register_route("/phy/phy80211/pcap/by-bssid/:mac/packets.pcapng", {"GET"}, httpd->RO_ROLE, {"pcapng"},
             std::make_shared<kis_net_web_function_endpoint>(
                 [this](std::shared_ptr<kis_net_beast_httpd_connection> con) {
@@ -1010,6 +1133,10 @@ kis_80211_phy::kis_80211_phy(int in_phyid) :
                             nullptr,
                             1024*512);
         
+                    auto filter_k = con->http_variables().find("filter");
+                    if (filter_k != con->http_variables().end())
+                        pcapng->set_bpf_filter(filter_k->second);
+
                     con->clear_timeout();
                     con->set_target_file(fmt::format("kismet-80211-bssid-{}.pcapng", mac));
                     con->set_closure_cb([pcapng]() { pcapng->stop_stream("http connection lost"); });
@@ -1033,6 +1160,22 @@ kis_80211_phy::~kis_80211_phy() {
 	packetchain->remove_handler(&packet_dot11_common_classifier, CHAINPOS_CLASSIFIER);
 
     timetracker->remove_timer(device_idle_timer);
+
+    // A null packet wakes the worker for shutdown
+    if (wep_decrypt_thread.joinable()) {
+        wep_decrypt_queue.enqueue(nullptr);
+        wep_decrypt_thread.join();
+    }
+
+    if (eapol_thread.joinable()) {
+        eapol_queue.enqueue(nullptr);
+        eapol_thread.join();
+    }
+
+    for (auto& ks : wepkeys) {
+        for (auto k : ks.second.keys)
+            delete k;
+    }
 }
 
 const std::string kis_80211_phy::khz_to_channel(const double in_khz) {
@@ -1103,7 +1246,7 @@ int kis_80211_phy::load_wepkeys() {
         keyinfo->len = len;
         memcpy(keyinfo->key, key, sizeof(unsigned char) * WEPKEY_MAX);
 
-        wepkeys.insert(std::make_pair(bssid_mac, keyinfo));
+        wepkeys[bssid_mac].keys.push_back(keyinfo);
 
         _MSG_INFO("Using key '{}' for BSSID '{}'", rawkey, bssid_mac);
     }
@@ -1307,9 +1450,24 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
                 bflags |= (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES |
                         UCD_UPDATE_LOCATION);
 
+            auto source_mac = dot11info->source_mac;
+
+            // Randomized MACs which only probe are folded into a device per probe
+            // fingerprint, unless the MAC already has a device of its own
+            if (d11phy->random_probe_group && 
+                    dot11info->subtype == packet_sub_probe_req &&
+                    mac_is_random(source_mac) &&
+                    d11phy->devicetracker->fetch_device(device_key(d11phy->fetch_phyname_hash(), 
+                            source_mac)) == nullptr &&
+                    std::find(d11phy->random_probe_track.begin(), d11phy->random_probe_track.end(), 
+                        source_mac) == d11phy->random_probe_track.end()) {
+                source_mac = d11phy->random_probe_group_mac(in_pack, dot11info);
+                dot11info->random_group = (source_mac != dot11info->source_mac);
+            }
+
             dot11info->source_dev =
                 d11phy->devicetracker->update_common_device(commoninfo, 
-                        dot11info->source_mac, d11phy, in_pack, 
+                        source_mac, d11phy, in_pack, 
                         bflags, "Wi-Fi Device");
         }
 
@@ -1438,6 +1596,7 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
                 dot11info->bssid_dot11->bitset_type_set(DOT11_DEVICE_TYPE_PROBE_AP);
             }
 
+            dot11info->bssid_dev->set_phy_view_inputs(dot11info->bssid_dot11->get_type_set());
             d11phy->devicetracker->update_view_device(dot11info->bssid_dev);
         }
 
@@ -1477,8 +1636,22 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
                 }
             }
 
-            // If it's sending ibss-flagged packets it's got to be adoc
-            if (dot11info->ibss) {
+            // A probe group stands in for many clients; otherwise if it's sending 
+            // ibss-flagged packets it's got to be adoc
+            if (dot11info->random_group) {
+                dot11info->source_dev->set_tracker_type_string(d11phy->devtype_random_group);
+                dot11info->source_dev->bitset_basic_type_set(KIS_DEVICE_BASICTYPE_CLIENT);
+                dot11info->source_dot11->bitset_type_set(DOT11_DEVICE_TYPE_RANDOM_GROUP);
+
+                if (!dot11info->source_dot11->random_group_macs.contains(dot11info->source_mac))
+                    dot11info->source_dot11->inc_num_random_group_macs(1);
+
+                // Remember enough recent members that a MAC repeating its probes
+                // isn't counted each time
+                mac_addr evicted;
+                dot11info->source_dot11->random_group_macs.touch(dot11info->source_mac,
+                        in_pack->ts.tv_sec, 64, evicted);
+            } else if (dot11info->ibss) {
                 dot11info->source_dev->bitset_basic_type_set(KIS_DEVICE_BASICTYPE_PEER);
                 dot11info->source_dev->set_tracker_type_string(d11phy->devtype_adhoc);
                 dot11info->source_dot11->bitset_type_set(DOT11_DEVICE_TYPE_ADHOC);
@@ -1494,10 +1667,11 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
             if (dot11info->subtype == packet_sub_probe_req ||
                     dot11info->subtype == packet_sub_association_req ||
                     dot11info->subtype == packet_sub_reassociation_req) {
-                in_pack->tag_map["DOT11_PROBE_REQ"] = true;
+                in_pack->tag(d11phy->pack_tag_probe_req);
                 handle_probed_ssid = true;
             }
 
+            dot11info->source_dev->set_phy_view_inputs(dot11info->source_dot11->get_type_set());
             d11phy->devicetracker->update_view_device(dot11info->source_dev);
         }
 
@@ -1527,6 +1701,7 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
             dot11info->dest_dev->bitclear_basic_type_set(KIS_DEVICE_BASICTYPE_WIRED);
             dot11info->dest_dev->bitset_basic_type_set(KIS_DEVICE_BASICTYPE_CLIENT);
 
+            dot11info->dest_dev->set_phy_view_inputs(dot11info->dest_dot11->get_type_set());
             d11phy->devicetracker->update_view_device(dot11info->dest_dev);
         }
 
@@ -1558,10 +1733,10 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
                     dot11info->subtype == packet_sub_deauthentication)) {
 
                 if (dot11info->subtype == packet_sub_disassociation) {
-                    in_pack->tag_map["DOT11_DISASSOCIATION"] = true;
+                    in_pack->tag(d11phy->pack_tag_disassociation);
 
                 } else if (dot11info->subtype == packet_sub_deauthentication) {
-                    in_pack->tag_map["DOT11_DEAUTHENTICATION"] = true;
+                    in_pack->tag(d11phy->pack_tag_deauthentication);
                 }
 
                 // if we're w/in time of the last one, update, otherwise clear
@@ -1575,7 +1750,8 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
                 dot11info->bssid_dot11->set_client_disconnects_last(now);
 
                 if (dot11info->bssid_dot11->get_client_disconnects() > 10) {
-                    if (d11phy->alertracker->potential_alert(d11phy->alert_deauthflood_ref)) {
+                    if (d11phy->mgmt_alert_armed(dot11info, alert_sig_deauthflood) &&
+                            d11phy->alertracker->potential_alert(d11phy->alert_deauthflood_ref)) {
                         std::string al = "Deauth/Disassociate flood on " + dot11info->bssid_mac.mac_to_string();
 
                         d11phy->alertracker->raise_alert(d11phy->alert_deauthflood_ref, in_pack,
@@ -1592,6 +1768,7 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
             if  ((dot11info->subtype == packet_sub_disassociation ||
                         dot11info->subtype == packet_sub_deauthentication) &&
                     dot11info->dest_mac == Globalreg::globalreg->broadcast_mac &&
+                    d11phy->mgmt_alert_armed(dot11info, alert_sig_bcastdcon) &&
                     d11phy->alertracker->potential_alert(d11phy->alert_bcastdcon_ref)) {
 
                 auto al = fmt::format("IEEE80211 Access Point BSSID {} broadcast deauthentication "
@@ -2082,18 +2259,23 @@ int kis_80211_phy::packet_dot11_common_classifier(CHAINCALL_PARMS) {
                 d11phy->process_client(dot11info->bssid_dev, dot11info->bssid_dot11, 
                         dot11info->source_dev, dot11info->source_dot11, 
                         in_pack, dot11info, pack_gpsinfo, pack_datainfo);
-                d11phy->process_wpa_handshake(dot11info->bssid_dev, dot11info->bssid_dot11, 
-                        dot11info->source_dev, dot11info->source_dot11,
-                        in_pack, dot11info);
             }
 
             if (dot11info->dest_dev != NULL) {
                 d11phy->process_client(dot11info->bssid_dev, dot11info->bssid_dot11, 
                         dot11info->dest_dev, dot11info->dest_dot11, 
                         in_pack, dot11info, pack_gpsinfo, pack_datainfo);
-                d11phy->process_wpa_handshake(dot11info->bssid_dev, dot11info->bssid_dot11, 
-                        dot11info->dest_dev, dot11info->dest_dot11,
-                        in_pack, dot11info);
+            }
+
+            // Handshakes are assembled by the eapol worker, or here if it's backed up
+            if ((dot11info->source_dev != NULL || dot11info->dest_dev != NULL) &&
+                    d11phy->packet_dot11_eapol_detect(in_pack, dot11info)) {
+                if (d11phy->eapol_thread.joinable() &&
+                        d11phy->eapol_queue.size_approx() < d11phy->eapol_backlog) {
+                    d11phy->eapol_queue.enqueue(in_pack);
+                } else {
+                    d11phy->process_eapol_packet(in_pack, dot11info);
+                }
             }
         }
 
@@ -2147,17 +2329,21 @@ int kis_80211_phy::packet_dot11_scan_json_classifier(CHAINCALL_PARMS) {
     // "centerfreq1": Center frequency 1
 
     try {
-        std::stringstream ss(pack_json->json_string);
-        nlohmann::json json;
-        ss >> json;
-
-        auto bssid_j = json["bssid"];
-        auto ssid_j = json["ssid"];
-        auto ietags_j = json["ietags"];
-        auto chanwidth_j = json["chanwidth"];
-        auto capabilities_j = json["capabilities"];
-        auto centerfreq0_j = json["centerfreq0"];
-        auto centerfreq1_j = json["centerfreq1"];
+        // Parsed once, and already parsed when the report came in bulk
+        auto doc = pack_json->document();
+
+        if (doc == nullptr)
+            throw std::runtime_error("invalid JSON in scan report");
+
+        const auto& json = *doc;
+
+        auto bssid_j = json.value("bssid", nlohmann::json());
+        auto ssid_j = json.value("ssid", nlohmann::json());
+        auto ietags_j = json.value("ietags", nlohmann::json());
+        auto chanwidth_j = json.value("chanwidth", nlohmann::json());
+        auto capabilities_j = json.value("capabilities", nlohmann::json());
+        auto centerfreq0_j = json.value("centerfreq0", nlohmann::json());
+        auto centerfreq1_j = json.value("centerfreq1", nlohmann::json());
 
         if (bssid_j.is_null()) {
             _MSG_ERROR("Phy80211/Wi-Fi scan report with no BSSID, dropping.");
@@ -2408,7 +2594,7 @@ int kis_80211_phy::packet_dot11_scan_json_classifier(CHAINCALL_PARMS) {
         if (ssid->get_crypt_set() != cryptset) {
             if (ssid->get_crypt_set() && cryptset == crypt_none &&
                     d11phy->alertracker->potential_alert(d11phy->alert_wepflap_ref)) {
-                in_pack->tag_map["DOT11_BEACON_SSID"] = true;
+                in_pack->tag(d11phy->pack_tag_beacon_ssid);
 
                 std::string al = "IEEE80211 Access Point BSSID " +
                     bssid_dev->get_macaddr().mac_to_string() + " SSID \"" +
@@ -2457,6 +2643,7 @@ int kis_80211_phy::packet_dot11_scan_json_classifier(CHAINCALL_PARMS) {
             ssid->set_channel(commoninfo->channel); 
         }
 
+        bssid_dev->set_phy_view_inputs(bssid_dot11->get_type_set());
         d11phy->devicetracker->update_view_device(bssid_dev);
 
     } catch (const std::exception& e) {
@@ -2468,6 +2655,34 @@ int kis_80211_phy::packet_dot11_scan_json_classifier(CHAINCALL_PARMS) {
     return 1;
 }
 
+void kis_80211_phy::compile_alert_signatures() {
+    const std::vector<std::tuple<uint32_t, int, std::vector<int>>> sigs = {
+        {alert_sig_deauthflood, alert_deauthflood_ref,
+            {packet_sub_disassociation, packet_sub_deauthentication}},
+        {alert_sig_bcastdcon, alert_bcastdcon_ref,
+            {packet_sub_disassociation, packet_sub_deauthentication}},
+        {alert_sig_formatstring, alert_formatstring_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+        {alert_sig_airjackssid, alert_airjackssid_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+        {alert_sig_ssidmatch, alert_ssidmatch_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+        {alert_sig_l33t, alert_l33t_ref, {packet_sub_probe_resp}},
+        {alert_sig_wepflap, alert_wepflap_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+        {alert_sig_cryptchange, alert_cryptchange_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+        {alert_sig_dot11d, alert_dot11d_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+        {alert_sig_beaconrate, alert_beaconrate_ref, {packet_sub_beacon, packet_sub_probe_resp}},
+    };
+
+    for (auto& m : mgmt_alert_sigs)
+        m = 0;
+
+    for (const auto& s : sigs) {
+        if (!alertracker->alert_enabled(std::get<1>(s)))
+            continue;
+
+        for (auto st : std::get<2>(s))
+            mgmt_alert_sigs[st & 0x0F] |= std::get<0>(s);
+    }
+}
+
 void kis_80211_phy::set_string_extract(int in_extr) {
     if (in_extr == 0 && dissect_strings == 2) {
         _MSG("set_string_extract(): String dissection cannot be disabled because "
@@ -2495,14 +2710,21 @@ void kis_80211_phy::add_wep_key(mac_addr bssid, uint8_t *key, unsigned int len,
 
     memcpy(winfo->key, key, len);
 
-    // Replace exiting ones
-    if (wepkeys.find(winfo->bssid) != wepkeys.end()) {
-        delete wepkeys[winfo->bssid];
-        wepkeys[winfo->bssid] = winfo;
-        return;
+    kis_lock_guard<kis_mutex> lk(wepkey_mutex, "add_wep_key");
+
+    auto& ks = wepkeys[winfo->bssid];
+
+    // Replace an existing copy of the same key, other keys for the BSSID are kept
+    // and tried in turn
+    for (auto& k : ks.keys) {
+        if (k->len == len && memcmp(k->key, key, len) == 0) {
+            delete k;
+            k = winfo;
+            return;
+        }
     }
 
-    wepkeys.insert(std::make_pair(winfo->bssid, winfo));
+    ks.keys.push_back(winfo);
 }
 
 void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev,
@@ -2530,6 +2752,10 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
             if (dot11info->subtype == packet_sub_beacon) {
                 ssid->inc_beacons_sec();
+
+                // QBSS load is left out of the checksum, keep it current
+                if (volatile_ie_tags[11])
+                    handle_ssid_qbss(ssid, in_pack, dot11info);
             }
         }
 
@@ -2563,8 +2789,12 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
             beacon_packet->set_source(chunk->source_id);
 
             beacon_packet->get_data()->set(chunk->data(), chunk->length());
+
+            retention->retain(packet_retention::cat_beacon, beacon_packet);
         }
 
+        invalidate_handshake_cache(basedev->get_key());
+
     }
 
     if (dot11info->channel != "0" && dot11info->channel != "") {
@@ -2591,7 +2821,7 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
             ssid = dot11dev->new_responded_ssid();
 
-            in_pack->tag_map["DOT11_RESPONSE_SSID"] = true;
+            in_pack->tag(pack_tag_response_ssid);
 
             new_ssid = true;
             new_resp_ssid = true;
@@ -2613,7 +2843,7 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
             ssid = dot11dev->new_advertised_ssid();
 
-            in_pack->tag_map["DOT11_BEACON_SSID"] = true;
+            in_pack->tag(pack_tag_beacon_ssid);
 
             new_ssid = true;
             new_adv_ssid = true;
@@ -2738,7 +2968,8 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
         _MSG_INFO("802.11 Wi-Fi device {} advertising {}", basedev->get_macaddr(), ssidstr);
 
-        if (alertracker->potential_alert(alert_formatstring_ref)) {
+        if (mgmt_alert_armed(dot11info, alert_sig_formatstring) &&
+                alertracker->potential_alert(alert_formatstring_ref)) {
             auto ssidtxt = ssid->get_ssid();
 
             if (ssidtxt.find("%s") != std::string::npos ||
@@ -2756,7 +2987,8 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
             }
         }
 
-        if (alertracker->potential_alert(alert_airjackssid_ref) &&
+        if (mgmt_alert_armed(dot11info, alert_sig_airjackssid) &&
+                alertracker->potential_alert(alert_airjackssid_ref) &&
                 ssid->get_ssid() == "AirJack" ) {
 
             std::string al = "IEEE80211 Access Point BSSID " +
@@ -2780,7 +3012,8 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
         // If we have a new ssid and we can consider raising an alert, do the 
         // regex compares to see if we trigger apspoof
-        if (dot11info->ssid_len != 0 && alertracker->potential_alert(alert_ssidmatch_ref)) {
+        if (dot11info->ssid_len != 0 && mgmt_alert_armed(dot11info, alert_sig_ssidmatch) &&
+                alertracker->potential_alert(alert_ssidmatch_ref)) {
             for (const auto& s : *ssid_regex_vec) {
                 auto sa = static_cast<dot11_tracked_ssid_alert *>(s.get());
 
@@ -2870,9 +3103,9 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
             ssid->set_beacon_info(dot11info->beacon_info);
 
         // Set the mobility
-        if (dot11info->dot11r_mobility != NULL) {
+        if (dot11info->get_dot11r_mobility() != NULL) {
             ssid->set_dot11r_mobility(true);
-            ssid->set_dot11r_mobility_domain_id(dot11info->dot11r_mobility->mobility_domain());
+            ssid->set_dot11r_mobility_domain_id(dot11info->get_dot11r_mobility()->mobility_domain());
         }
 
         // Set tx power
@@ -2882,42 +3115,42 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
         ssid->set_cisco_client_mfp(dot11info->cisco_client_mfp);
 
         // Set QBSS
-        if (dot11info->qbss != NULL) {
+        if (dot11info->get_qbss() != NULL) {
             ssid->set_dot11e_qbss(true);
-            ssid->set_dot11e_qbss_stations(dot11info->qbss->station_count());
+            ssid->set_dot11e_qbss_stations(dot11info->get_qbss()->station_count());
 
             // Percentage is value / max (1 byte, 255)
-            double chperc = (double) ((double) dot11info->qbss->channel_utilization() / 
+            double chperc = (double) ((double) dot11info->get_qbss()->channel_utilization() / 
                     (double) 255.0f) * 100.0f;
             ssid->set_dot11e_qbss_channel_load(chperc);
         }
 
         // Set the HT and VHT info.  If we have VHT, we assume we must have HT; I've never
         // seen VHT without HT.  We handle HT only later on.
-        if (dot11info->dot11vht != nullptr && dot11info->dot11ht != nullptr) {
+        if (dot11info->get_dot11vht() != nullptr && dot11info->get_dot11ht() != nullptr) {
             channel_from_ht = true;
 
             // Grab the primary channel from the HT data
-            ssid->set_channel(n_to_string<int>(dot11info->dot11ht->primary_channel()));
+            ssid->set_channel(n_to_string<int>(dot11info->get_dot11ht()->primary_channel()));
 
-            if (dot11info->dot11vht->channel_width() == dot11_ie_192_vht_op::ch_80) {
+            if (dot11info->get_dot11vht()->channel_width() == dot11_ie_192_vht_op::ch_80) {
                 ssid->set_ht_mode("HT80");
-                ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht->center1()));
+                ssid->set_ht_center_1(5000 + (5 * dot11info->get_dot11vht()->center1()));
                 ssid->set_ht_center_2(0);
-            } else if (dot11info->dot11vht->channel_width() == dot11_ie_192_vht_op::ch_160) {
+            } else if (dot11info->get_dot11vht()->channel_width() == dot11_ie_192_vht_op::ch_160) {
                 ssid->set_ht_mode("HT160");
-                ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht->center1()));
+                ssid->set_ht_center_1(5000 + (5 * dot11info->get_dot11vht()->center1()));
                 ssid->set_ht_center_2(0);
-            } else if (dot11info->dot11vht->channel_width() == dot11_ie_192_vht_op::ch_80_80) {
+            } else if (dot11info->get_dot11vht()->channel_width() == dot11_ie_192_vht_op::ch_80_80) {
                 ssid->set_ht_mode("HT80+80");
-                ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht->center1()));
-                ssid->set_ht_center_2(5000 + (5 * dot11info->dot11vht->center2()));
-            } else if (dot11info->dot11vht->channel_width() == dot11_ie_192_vht_op::ch_20_40) {
-                if (dot11info->dot11ht->ht_info_chan_offset_none()) {
+                ssid->set_ht_center_1(5000 + (5 * dot11info->get_dot11vht()->center1()));
+                ssid->set_ht_center_2(5000 + (5 * dot11info->get_dot11vht()->center2()));
+            } else if (dot11info->get_dot11vht()->channel_width() == dot11_ie_192_vht_op::ch_20_40) {
+                if (dot11info->get_dot11ht()->ht_info_chan_offset_none()) {
                     ssid->set_ht_mode("HT20");
-                } else if (dot11info->dot11ht->ht_info_chan_offset_above()) {
+                } else if (dot11info->get_dot11ht()->ht_info_chan_offset_above()) {
                     ssid->set_ht_mode("HT40+");
-                } else if (dot11info->dot11ht->ht_info_chan_offset_below()) {
+                } else if (dot11info->get_dot11ht()->ht_info_chan_offset_below()) {
                     ssid->set_ht_mode("HT40-");
                 }
 
@@ -2925,13 +3158,13 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
                 ssid->set_ht_center_2(0);
 
             } 
-        } else if (dot11info->dot11ht != nullptr) {
+        } else if (dot11info->get_dot11ht() != nullptr) {
             // Only HT info no VHT
-            if (dot11info->dot11ht->ht_info_chan_offset_none()) {
+            if (dot11info->get_dot11ht()->ht_info_chan_offset_none()) {
                 ssid->set_ht_mode("HT20");
-            } else if (dot11info->dot11ht->ht_info_chan_offset_above()) {
+            } else if (dot11info->get_dot11ht()->ht_info_chan_offset_above()) {
                 ssid->set_ht_mode("HT40+");
-            } else if (dot11info->dot11ht->ht_info_chan_offset_below()) {
+            } else if (dot11info->get_dot11ht()->ht_info_chan_offset_below()) {
                 ssid->set_ht_mode("HT40-");
             }
 
@@ -2939,7 +3172,7 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
             ssid->set_ht_center_1(0);
             ssid->set_ht_center_2(0);
-            ssid->set_channel(n_to_string<int>(dot11info->dot11ht->primary_channel()));
+            ssid->set_channel(n_to_string<int>(dot11info->get_dot11ht()->primary_channel()));
         }
 
         // Update OWE
@@ -2970,7 +3203,8 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
         if (mac_addr((uint8_t *) "\x00\x13\x37\x00\x00\x00", 6, 24) == 
                 dot11info->source_mac) {
 
-            if (alertracker->potential_alert(alert_l33t_ref)) {
+            if (mgmt_alert_armed(dot11info, alert_sig_l33t) &&
+                    alertracker->potential_alert(alert_l33t_ref)) {
                 std::string al = "IEEE80211 probe response from OUI 00:13:37 seen, "
                     "which typically implies a Karma AP impersonation attack.";
 
@@ -2987,6 +3221,7 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
 
     if (ssid->get_crypt_set() != dot11info->cryptset) {
         if (ssid->get_crypt_set() && dot11info->cryptset == crypt_none &&
+                mgmt_alert_armed(dot11info, alert_sig_wepflap) &&
                 alertracker->potential_alert(alert_wepflap_ref)) {
 
             std::string al = "IEEE80211 Access Point BSSID " +
@@ -3000,6 +3235,7 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
                     dot11info->dest_mac, dot11info->other_mac, 
                     dot11info->channel, al);
         } else if (ssid->get_crypt_set() != dot11info->cryptset &&
+                mgmt_alert_armed(dot11info, alert_sig_cryptchange) &&
                 alertracker->potential_alert(alert_cryptchange_ref)) {
 
             auto al = fmt::format("IEEE80211 Access Point BSSID {} SSID \"{}\" changed advertised "
@@ -3078,7 +3314,8 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
         }
 
         if (dot11dmismatch) {
-            if (alertracker->potential_alert(alert_dot11d_ref)) {
+            if (mgmt_alert_armed(dot11info, alert_sig_dot11d) &&
+                    alertracker->potential_alert(alert_dot11d_ref)) {
 
                 std::string al = "IEEE80211 Access Point BSSID " +
                     basedev->get_macaddr().mac_to_string() + " SSID \"" +
@@ -3128,6 +3365,7 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
             Ieee80211Interval2NSecs(dot11info->beacon_interval)) {
 
         if (ssid->get_beaconrate() != 0 && 
+                mgmt_alert_armed(dot11info, alert_sig_beaconrate) &&
                 alertracker->potential_alert(alert_beaconrate_ref)) {
             std::string al = "IEEE80211 Access Point BSSID " +
                 basedev->get_macaddr().mac_to_string() + " SSID \"" +
@@ -3179,12 +3417,12 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
                 ssid->get_crypt_set(), basedev);
     }
 
-    if (new_adv_ssid) {
+    if (new_adv_ssid && eventbus->has_listeners(dot11_new_advertised_ssid_chan)) {
         auto evt = eventbus->get_eventbus_event(dot11_new_advertised_ssid);
         evt->get_event_content()->insert(dot11_new_ssid_device, basedev);
         evt->get_event_content()->insert(dot11_new_advertised_ssid, ssid);
         eventbus->publish(evt);
-    } else if (new_resp_ssid) {
+    } else if (new_resp_ssid && eventbus->has_listeners(dot11_new_response_ssid_chan)) {
         auto evt = eventbus->get_eventbus_event(dot11_new_response_ssid);
         evt->get_event_content()->insert(dot11_new_ssid_device, basedev);
         evt->get_event_content()->insert(dot11_new_response_ssid, ssid);
@@ -3192,6 +3430,68 @@ void kis_80211_phy::handle_ssid(std::shared_ptr<kis_tracked_device_base> basedev
     }
 }
 
+void kis_80211_phy::handle_ssid_qbss(std::shared_ptr<dot11_advertised_ssid> ssid,
+        std::shared_ptr<kis_packet> in_pack,
+        std::shared_ptr<dot11_packinfo> dot11info) {
+    auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+    if (chunk == nullptr || chunk->dlt != KDLT_IEEE802_11 ||
+            dot11info->header_offset > chunk->length())
+        return;
+
+    for (const auto& t : dot11_ie_view(chunk->substr(dot11info->header_offset))) {
+        if (t.num != 11)
+            continue;
+
+        // V1 and V2 both start with the station count and utilization
+        if (t.data.length() != 4 && t.data.length() != 5)
+            return;
+
+        ssid->set_dot11e_qbss(true);
+        ssid->set_dot11e_qbss_stations(((uint8_t) t.data[1] << 8) + (uint8_t) t.data[0]);
+
+        // Percentage is value / max (1 byte, 255)
+        ssid->set_dot11e_qbss_channel_load(((double) (uint8_t) t.data[2] / 255.0f) * 100.0f);
+
+        return;
+    }
+}
+
+mac_addr kis_80211_phy::random_probe_group_mac(std::shared_ptr<kis_packet> in_pack,
+        std::shared_ptr<dot11_packinfo> dot11info) {
+    if (dot11info->ie_tags == nullptr) {
+        auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+        // Leave anything we can't split to the normal path, which flags it as corrupt
+        if (chunk == nullptr || chunk->dlt != KDLT_IEEE802_11 ||
+                !packet_dot11_ie_split(chunk, dot11info))
+            return dot11info->source_mac;
+    }
+
+    // The order of the tags says a lot about the driver, and the content of the 
+    // capability tags about the hardware; the SSID is left out so that wildcard and
+    // directed probes from the same device land in the same group
+    auto fp = xx_hash_cpp{};
+
+    for (const auto& t : *(dot11info->ie_tags->tags())) {
+        uint8_t num = t->tag_num();
+        fp.update(&num, 1);
+
+        if (random_probe_group_ie[num]) {
+            auto d = t->tag_data_view();
+            fp.update(d.data(), d.length());
+        }
+    }
+
+    auto h = fp.hash();
+
+    // A locally administered, unicast MAC in a block of its own
+    uint8_t bytes[6] = { 0x06, 0xd1, (uint8_t) (h >> 24), (uint8_t) (h >> 16), 
+        (uint8_t) (h >> 8), (uint8_t) h };
+
+    return mac_addr(bytes, 6);
+}
+
 void kis_80211_phy::handle_probed_ssid(std::shared_ptr<kis_tracked_device_base> basedev,
         std::shared_ptr<dot11_tracked_device> dot11dev,
         std::shared_ptr<kis_packet> in_pack,
@@ -3229,6 +3529,19 @@ void kis_80211_phy::handle_probed_ssid(std::shared_ptr<kis_tracked_device_base>
 
         auto ssid_itr = probemap->find(dot11info->ssid_csum);
 
+        // Randomized MACs only keep their most recently probed SSIDs, a probe storm
+        // can't grow the map without bound
+        if (random_probe_max != 0 && mac_is_random(basedev->get_macaddr())) {
+            size_t evicted;
+
+            if (dot11dev->random_probed_ssids.touch(dot11info->ssid_csum, in_pack->ts.tv_sec,
+                        random_probe_max, evicted)) {
+                probemap->erase(evicted);
+                dot11dev->inc_num_aged_probed_ssids(1);
+                ssid_itr = probemap->find(dot11info->ssid_csum);
+            }
+        }
+
         if (ssid_itr == probemap->end() || ssid_itr->second == nullptr) {
             new_probessid = true;
 
@@ -3262,9 +3575,9 @@ void kis_80211_phy::handle_probed_ssid(std::shared_ptr<kis_tracked_device_base>
             }
         }
 
-        if (dot11info->dot11r_mobility != nullptr) {
+        if (dot11info->get_dot11r_mobility() != nullptr) {
             probessid->set_dot11r_mobility(true);
-            probessid->set_dot11r_mobility_domain_id(dot11info->dot11r_mobility->mobility_domain());
+            probessid->set_dot11r_mobility_domain_id(dot11info->get_dot11r_mobility()->mobility_domain());
         }
 
         // Alias the last ssid snapshot
@@ -3372,7 +3685,7 @@ void kis_80211_phy::handle_probed_ssid(std::shared_ptr<kis_tracked_device_base>
         ssidtracker->handle_probe_ssid(probessid->get_ssid(), probessid->get_ssid_len(),
                 probessid->get_crypt_set(), basedev);
 
-        if (new_probessid) {
+        if (new_probessid && eventbus->has_listeners(dot11_new_probed_ssid_chan)) {
             auto evt = eventbus->get_eventbus_event(dot11_new_probed_ssid);
             evt->get_event_content()->insert(dot11_new_ssid_device, basedev);
             evt->get_event_content()->insert(dot11_new_probed_ssid, probessid);
@@ -3427,9 +3740,9 @@ void kis_80211_phy::process_client(std::shared_ptr<kis_tracked_device_base> bssi
     if (dot11info->type == packet_management) {
         // Client-level assoc req advertisements
         if (dot11info->subtype == packet_sub_association_req) {
-            if (dot11info->tx_power != nullptr) {
-                clientdot11->set_min_tx_power(dot11info->tx_power->min_power());
-                clientdot11->set_max_tx_power(dot11info->tx_power->max_power());
+            if (dot11info->get_tx_power() != nullptr) {
+                clientdot11->set_min_tx_power(dot11info->get_tx_power()->min_power());
+                clientdot11->set_max_tx_power(dot11info->get_tx_power()->max_power());
             }
 
             if (dot11info->supported_channels != nullptr) {
@@ -3573,10 +3886,63 @@ void kis_80211_phy::process_client(std::shared_ptr<kis_tracked_device_base> bssi
     }
 
     // Update the backwards map to the client
-    if (bssiddot11->get_associated_client_map()->find(clientdev->get_macaddr()) ==
-            bssiddot11->get_associated_client_map()->end()) {
-        bssiddot11->get_associated_client_map()->insert(clientdev->get_macaddr(),
-                clientdev->get_tracker_key());
+    auto assoc_map = bssiddot11->get_associated_client_map();
+
+    // Randomized clients (usually probe floods) are kept to the most recently seen
+    // and the rest are only counted
+    if (random_client_max != 0 && mac_is_random(clientdev->get_macaddr())) {
+        mac_addr evicted;
+
+        if (bssiddot11->random_clients.touch(clientdev->get_macaddr(), in_pack->ts.tv_sec,
+                    random_client_max, evicted)) {
+            assoc_map->erase(evicted);
+            bssiddot11->inc_num_aged_random_clients(1);
+        }
+    }
+
+    if (assoc_map->find(clientdev->get_macaddr()) == assoc_map->end()) {
+        assoc_map->insert(clientdev->get_macaddr(), clientdev->get_tracker_key());
+    }
+}
+
+void kis_80211_phy::process_eapol_packet(std::shared_ptr<kis_packet> in_pack,
+        std::shared_ptr<dot11_packinfo> dot11info) {
+    if (dot11info->bssid_dev == nullptr)
+        return;
+
+    if (dot11info->source_dev != nullptr)
+        process_wpa_handshake(dot11info->bssid_dev, dot11info->bssid_dot11, 
+                dot11info->source_dev, dot11info->source_dot11,
+                in_pack, dot11info);
+
+    if (dot11info->dest_dev != nullptr)
+        process_wpa_handshake(dot11info->bssid_dev, dot11info->bssid_dot11, 
+                dot11info->dest_dev, dot11info->dest_dot11,
+                in_pack, dot11info);
+}
+
+void kis_80211_phy::eapol_worker() {
+    std::shared_ptr<kis_packet> pack;
+
+    while (true) {
+        eapol_queue.wait_dequeue(pack);
+
+        if (pack == nullptr)
+            break;
+
+        {
+            // Same lock order as the packet threads; the packet is released once the 
+            // batch it was classified in is done
+            kis_lock_guard<kis_mutex> lk(pack->mutex, "eapol_worker");
+            kis_lock_guard<kis_mutex> list_lk(devicetracker->get_devicelist_mutex(), "eapol_worker");
+
+            auto dot11info = pack->fetch<dot11_packinfo>(pack_comp_80211);
+
+            if (dot11info != nullptr)
+                process_eapol_packet(pack, dot11info);
+        }
+
+        pack.reset();
     }
 }
 
@@ -3607,6 +3973,7 @@ void kis_80211_phy::process_wpa_handshake(std::shared_ptr<kis_tracked_device_bas
     if (bssid_dot11->get_pmkid_needed() && eapol->get_rsnpmkid_bytes().length() != 0) {
         auto pmkid_packet = bssid_dot11->get_pmkid_packet();
         pmkid_packet->copy_packet(eapol->get_eapol_packet());
+        retention->retain(packet_retention::cat_pmkid, pmkid_packet);
     }
 
     // Start doing something smart here about eliminating
@@ -3645,6 +4012,9 @@ void kis_80211_phy::process_wpa_handshake(std::shared_ptr<kis_tracked_device_bas
     }
 
     bssid_vec->push_back(eapol);
+    retention->retain(packet_retention::cat_eapol, eapol->get_eapol_packet());
+
+    invalidate_handshake_cache(bssid_dev->get_key());
 
     // Calculate the key mask of seen handshake keys
     keymask = 0;
@@ -3953,94 +4323,6 @@ std::string kis_80211_phy::crypt_to_simple_string(uint64_t cryptset) {
 }
 
 
-void kis_80211_phy::generate_handshake_pcap(std::shared_ptr<kis_net_beast_httpd_connection> con, 
-        std::shared_ptr<kis_tracked_device_base> dev, 
-        std::shared_ptr<dot11_tracked_device> dot11dev, 
-        mac_addr target_mac, std::string mode) {
-
-    // Hardcode the pcap header
-    struct pcap_header {
-        uint32_t magic = 0xa1b2c3d4;
-        uint16_t vmajor = 2;
-        uint16_t vminor = 4;
-        int32_t offset = 0;
-        uint32_t sigfigs = 0;
-        uint32_t len = 8192;
-        uint32_t dlt = KDLT_IEEE802_11;
-    } hdr;
-
-    // Hardcode the pcap packet header
-    struct pcap_packet_header {
-        uint32_t timeval_s;
-        uint32_t timeval_us;
-        uint32_t len;
-        uint32_t caplen;
-    } pkt_hdr;
-
-    std::ostream stream(&con->response_stream());
-
-    stream.write((const char *) &hdr, sizeof(hdr));
-
-    kis_unique_lock<kis_mutex> list_locker(devicetracker->get_devicelist_mutex(),
-            "phy80211 generate_handshake_pcap");
-
-
-    /* Write the beacon */
-    if (dot11dev->get_beacon_packet_present()) {
-        auto packet = dot11dev->get_ssid_beacon_packet();
-
-        pkt_hdr.timeval_s = packet->get_ts_sec();
-        pkt_hdr.timeval_us = packet->get_ts_usec();
-
-        pkt_hdr.len = packet->get_data()->length();
-        pkt_hdr.caplen = pkt_hdr.len;
-
-        stream.write((const char *) &pkt_hdr, sizeof(pkt_hdr));
-        stream.write((const char *) packet->get_data()->get().data(), pkt_hdr.len);
-    }
-
-    if (mode == "handshake") {
-        // Write all the handshakes
-        if (dot11dev->has_wpa_key_map()) {
-            const auto hsm = dot11dev->get_wpa_key_map();
-            const auto hsi = hsm->find(target_mac);
-
-            if (hsi != hsm->end()) {
-                auto hsv = static_cast<tracker_element_vector *>(hsi->second.get());
-                for (const auto& i : *(hsv)) {
-                    auto eapol = static_cast<dot11_tracked_eapol *>(i.get());
-
-                    auto packet = eapol->get_eapol_packet();
-
-                    // Make a pcap header
-                    pkt_hdr.timeval_s = packet->get_ts_sec();
-                    pkt_hdr.timeval_us = packet->get_ts_usec();
-
-                    pkt_hdr.len = packet->get_data()->length();
-                    pkt_hdr.caplen = pkt_hdr.len;
-
-                    stream.write((const char *) &pkt_hdr, sizeof(pkt_hdr));
-                    stream.write((const char *) packet->get_data()->get().data(), pkt_hdr.len);
-                }
-            }
-        }
-    } else if (mode == "pmkid") {
-        // Write just the pmkid
-        if (dot11dev->get_pmkid_present()) {
-            auto packet = dot11dev->get_pmkid_packet();
-
-            pkt_hdr.timeval_s = packet->get_ts_sec();
-            pkt_hdr.timeval_us = packet->get_ts_usec();
-
-            pkt_hdr.len = packet->get_data()->length();
-            pkt_hdr.caplen = pkt_hdr.len;
-
-            stream.write((const char *) &pkt_hdr, sizeof(pkt_hdr));
-            stream.write((const char *) packet->get_data()->get().data(), pkt_hdr.len);
-        }
-    }
-}
-
 class phy80211_devicetracker_expire_worker : public device_tracker_view_worker {
 public:
     phy80211_devicetracker_expire_worker(int in_timeout, unsigned int in_packets, int entry_id) {
@@ -25,11 +25,14 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <bitset>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <thread>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -46,6 +49,7 @@
 #include "boost_like_hash.h"
 #include "globalregistry.h"
 #include "packetchain.h"
+#include "packet_retention.h"
 #include "timetracker.h"
 #include "packet.h"
 #include "gpstracker.h"
@@ -90,6 +94,16 @@ class dot11_wep_key {
         unsigned int failed;
 };
 
+// All the keys configured for a BSSID, and the one which last decrypted a frame
+class dot11_wep_keyset {
+    public:
+        dot11_wep_keyset() :
+            last_good{0} { }
+
+        std::vector<dot11_wep_key *> keys;
+        size_t last_good;
+};
+
 // dot11 packet components
 
 class dot11_packinfo_dot11d_entry {
@@ -185,6 +199,8 @@ class dot11_packinfo : public packet_component {
 
             new_device = false;
             new_adv_ssid = false;
+            random_group = false;
+            eapol_key = false;
 
             ietag_hash_map.clear();
             dot11d_country = "";
@@ -201,6 +217,7 @@ class dot11_packinfo : public packet_component {
             owe_transition.reset();
             rsn.reset();
             droneid.reset();
+            ie_decoded.reset();
 
             basic_rates.clear();
             extended_rates.clear();
@@ -308,7 +325,8 @@ class dot11_packinfo : public packet_component {
         std::string wps_serial_number;
         std::string wps_uuid_e;
 
-        // Direct kaitai structs pulled from the beacon
+        // Direct kaitai structs pulled from the beacon.  QBSS, tx power, mobility, HT
+        // and VHT are only decoded when asked for, through the get_ functions below
         std::shared_ptr<dot11_ie_11_qbss> qbss;
         std::shared_ptr<dot11_ie_33_power> tx_power;
         std::shared_ptr<dot11_ie_36_supported_channels> supported_channels;
@@ -320,6 +338,26 @@ class dot11_packinfo : public packet_component {
 
         std::shared_ptr<dot11_ie_221_dji_droneid> droneid;
 
+        std::shared_ptr<dot11_ie_11_qbss> get_qbss() {
+            return decode_ie_tag(qbss, 11);
+        }
+
+        std::shared_ptr<dot11_ie_33_power> get_tx_power() {
+            return decode_ie_tag(tx_power, 33);
+        }
+
+        std::shared_ptr<dot11_ie_54_mobility> get_dot11r_mobility() {
+            return decode_ie_tag(dot11r_mobility, 54);
+        }
+
+        std::shared_ptr<dot11_ie_61_ht_op> get_dot11ht() {
+            return decode_ie_tag(dot11ht, 61);
+        }
+
+        std::shared_ptr<dot11_ie_192_vht_op> get_dot11vht() {
+            return decode_ie_tag(dot11vht, 192);
+        }
+
         double maxrate;
         // 11g rates
         std::vector<std::string> basic_rates;
@@ -335,6 +373,12 @@ class dot11_packinfo : public packet_component {
         bool new_device;
         bool new_adv_ssid;
 
+        // Was the source folded into a randomized probe group?
+        bool random_group;
+
+        // Is this an unencrypted RSN EAPOL key frame?
+        bool eapol_key;
+
         std::shared_ptr<kis_tracked_device_base> source_dev;
         std::shared_ptr<kis_tracked_device_base> dest_dev;
         std::shared_ptr<kis_tracked_device_base> bssid_dev;
@@ -346,7 +390,38 @@ class dot11_packinfo : public packet_component {
         std::shared_ptr<dot11_tracked_device> bssid_dot11;
         std::shared_ptr<dot11_tracked_device> receive_dot11;
         std::shared_ptr<dot11_tracked_device> transmit_dot11;
+
+    protected:
+        // Decode a tag from the split IE tags the first time it's asked for; like the
+        // dissector, the last copy of a repeated tag wins, and a tag which can't be
+        // decoded is skipped
+        template<typename T>
+        std::shared_ptr<T> decode_ie_tag(std::shared_ptr<T>& cache, uint8_t tag_num) {
+            if (cache != nullptr || ie_tags == nullptr || ie_decoded[tag_num])
+                return cache;
+
+            ie_decoded.set(tag_num);
+
+            auto tag = ie_tags->tags_map()->find(tag_num);
+
+            if (tag == ie_tags->tags_map()->end())
+                return cache;
+
+            try {
+                auto decoded = Globalreg::new_from_pool<T>();
+                tag->second->tag_data_stream()->seek(0);
+                decoded->parse(tag->second->tag_data_stream());
+                cache = decoded;
+            } catch (const std::exception& e) {
+                ;
+            }
+
+            return cache;
+        }
+
+        std::bitset<256> ie_decoded;
 };
+KIS_PACKET_COMPONENT_SLOT(dot11_packinfo, packet_slot::phy80211)
 
 class dot11_ssid_alert {
     public:
@@ -420,6 +495,12 @@ public:
     // IE tags to the best of our ability
     int packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack, 
             std::shared_ptr<dot11_packinfo> in_dot11info);
+    // Checksum of the IE tags of a beacon or probe response, leaving out the tags which
+    // change from one beacon to the next
+    uint32_t packet_dot11_ie_checksum(nonstd::string_view in_tags);
+    // Split the IE tags of a frame into the packinfo; returns false if the tags are corrupt
+    bool packet_dot11_ie_split(std::shared_ptr<kis_datachunk> in_chunk,
+            std::shared_ptr<dot11_packinfo> in_dot11info);
     // Generate a list of IE tag numbers
     std::shared_ptr<std::vector<ie_tag_tuple>> packet_dot11_ie_list(std::shared_ptr<kis_packet> in_pack, 
             std::shared_ptr<dot11_packinfo> in_dot11info);
@@ -429,15 +510,23 @@ public:
     // Is packet a WPS M3 message?  Used to detect Reaver, etc
     int packet_dot11_wps_m3(std::shared_ptr<kis_packet> in_pack);
 
+    // Cheap check for an RSN EAPOL key frame, run on every data frame; only the header
+    // bytes are examined, the handshake itself is parsed by packet_dot11_eapol_handshake
+    bool packet_dot11_eapol_detect(std::shared_ptr<kis_packet> in_pack,
+            std::shared_ptr<dot11_packinfo> packinfo);
+
     // Is the packet a WPA handshake?  Return an eapol tracker element if so
     std::shared_ptr<dot11_tracked_eapol> packet_dot11_eapol_handshake(std::shared_ptr<kis_packet> in_pack,
             std::shared_ptr<dot11_tracked_device> dot11device);
 
-    // static in case some other component wants to use it
+    // static in case some other component wants to use it.  With in_llc_check the
+    // key is abandoned as soon as the first three bytes of plaintext fail to decrypt
+    // to an LLC UI header, which rejects a wrong key without decrypting the whole
+    // frame; only use it when trying keys which aren't known to be good.
     static std::shared_ptr<kis_datachunk> DecryptWEP(std::shared_ptr<dot11_packinfo> in_packinfo,
             std::shared_ptr<kis_datachunk> in_chunk, 
             unsigned char *in_key, int in_key_len,
-            unsigned char *in_id);
+            unsigned char *in_id, bool in_llc_check = false);
 
     // TODO - what do we do with the strings?  Can we make them phy-neutral?
     // int packet_dot11string_dissector(kis_packet *in_pack);
@@ -501,6 +590,10 @@ protected:
     std::shared_ptr<device_tracker> devicetracker;
     std::shared_ptr<event_bus> eventbus;
     std::shared_ptr<entry_tracker> entrytracker;
+
+    // Event bus channels of the SSID events, which are skipped when nothing listens
+    int dot11_new_advertised_ssid_chan, dot11_new_probed_ssid_chan, 
+        dot11_new_response_ssid_chan;
     std::shared_ptr<stream_tracker> streamtracker;
 
     // Handle advertised SSIDs
@@ -511,6 +604,11 @@ protected:
             std::shared_ptr<kis_gps_packinfo> pack_gpsinfo);
 
     // Handle probed SSIDs
+    // Update the QBSS load of an ssid from a beacon which is otherwise unchanged
+    void handle_ssid_qbss(std::shared_ptr<dot11_advertised_ssid> ssid,
+            std::shared_ptr<kis_packet> in_pack,
+            std::shared_ptr<dot11_packinfo> dot11info);
+
     void handle_probed_ssid(std::shared_ptr<kis_tracked_device_base> basedev, 
             std::shared_ptr<dot11_tracked_device> dot11dev,
             std::shared_ptr<kis_packet> in_pack,
@@ -539,10 +637,57 @@ protected:
             std::shared_ptr<dot11_tracked_device> dot11dev, 
             mac_addr target_mac, std::string mode);
 
+    // Handshakes of many BSSIDs in one export, as a pcapng or hashcat 22000 hashes
+    void generate_handshake_bulk(std::shared_ptr<kis_net_beast_httpd_connection> con,
+            const std::string& format);
+
+    // Encoded exports of a BSSID device; the device list must be locked
+    std::shared_ptr<std::string> encode_handshake_pcap(std::shared_ptr<dot11_tracked_device> dot11dev,
+            mac_addr target_mac, const std::string& mode);
+    std::shared_ptr<std::string> encode_handshake_pcapng(std::shared_ptr<kis_tracked_device_base> dev,
+            std::shared_ptr<dot11_tracked_device> dot11dev);
+    std::shared_ptr<std::string> encode_handshake_22000(std::shared_ptr<kis_tracked_device_base> dev,
+            std::shared_ptr<dot11_tracked_device> dot11dev);
+
+    // Cached export of a BSSID device, encoded on a miss; the device list must be locked
+    std::shared_ptr<std::string> cached_handshake_export(const device_key& in_key,
+            const std::string& in_variant, std::function<std::shared_ptr<std::string> ()> in_encode);
+
+    // Drop the cached exports of a BSSID when its handshake or beacon changes
+    void invalidate_handshake_cache(const device_key& in_key);
+
+    kis_mutex handshake_cache_mutex;
+    std::unordered_map<device_key, std::unordered_map<std::string, std::shared_ptr<std::string>>> handshake_cache;
+
     int dot11_device_entry_id;
 
     int load_wepkeys();
 
+    // Try the keys for the BSSID of a WEP frame and replace the payload with the
+    // plaintext; the packet must be locked
+    bool decrypt_wep_packet(std::shared_ptr<kis_packet> in_pack,
+            std::shared_ptr<dot11_packinfo> packinfo, std::shared_ptr<kis_datachunk> chunk);
+
+    void wep_decrypt_worker();
+
+    // Record the handshake of a classified EAPOL frame against the BSSID and each
+    // client; the packet and the device list must be locked
+    void process_eapol_packet(std::shared_ptr<kis_packet> in_pack,
+            std::shared_ptr<dot11_packinfo> dot11info);
+
+    void eapol_worker();
+
+    // Is a MAC locally administered, as randomized client MACs are?
+    static bool mac_is_random(const mac_addr& mac) {
+        return (mac[0] & 0x03) == 0x02;
+    }
+
+    // MAC of the group device for a probe from a randomized MAC, derived from the
+    // fingerprint of the probe; returns the source MAC if the probe can't be
+    // fingerprinted
+    mac_addr random_probe_group_mac(std::shared_ptr<kis_packet> in_pack,
+            std::shared_ptr<dot11_packinfo> dot11info);
+
     std::map<mac_addr, std::string> bssid_cloak_map;
 
     std::string ssid_cache_path, ip_cache_path;
@@ -557,6 +702,11 @@ protected:
         pack_comp_decap, pack_comp_common, pack_comp_datapayload,
         pack_comp_gps, pack_comp_l1info, pack_comp_json;
 
+    // Packet tags
+    int pack_tag_probe_req, pack_tag_disassociation, pack_tag_deauthentication,
+        pack_tag_beacon_ssid, pack_tag_response_ssid, pack_tag_wpa_handshake,
+        pack_tag_rsn_pmkid;
+
     // Do we do any data dissection or do we hide it all (legal safety
     // cutout)
     int dissect_data;
@@ -580,7 +730,25 @@ protected:
     // Are we allowed to send wepkeys to the client (server config)
     int client_wepkey_allowed;
     // Map of wepkeys to BSSID (or bssid masks)
-    std::map<mac_addr, dot11_wep_key *> wepkeys;
+    std::map<mac_addr, dot11_wep_keyset> wepkeys;
+    kis_mutex wepkey_mutex;
+
+    // WEP frames are decrypted in a worker thread and return to the packet chain at
+    // data dissection; once wep_decrypt_backlog frames are waiting they're decrypted
+    // in the packet thread instead
+    bool wep_decrypt_async;
+    size_t wep_decrypt_backlog;
+    std::thread wep_decrypt_thread;
+    moodycamel::BlockingConcurrentQueue<std::shared_ptr<kis_packet>> wep_decrypt_queue;
+
+    // EAPOL frames are only tagged by the classifier; the handshakes are parsed and
+    // recorded by a worker thread so a burst of reassociations doesn't stall the
+    // packet threads.  Once eapol_backlog frames are waiting they're handled in the
+    // packet thread instead
+    bool eapol_async;
+    size_t eapol_backlog;
+    std::thread eapol_thread;
+    moodycamel::BlockingConcurrentQueue<std::shared_ptr<kis_packet>> eapol_queue;
 
     // Generated WEP identity / base
     unsigned char wep_identity[256];
@@ -594,6 +762,32 @@ protected:
         alert_atheros_rsnloop_ref, alert_bssts_ref, alert_qcom_extended_ref,
         alert_bad_fixlen_ie, alert_formatstring_ref;
 
+    // Compiled alert signatures; the enabled alerts which a management frame of each
+    // subtype can raise in the classifier.  The table is built once every alert is
+    // registered, so the classifier skips the signatures of disabled alerts with a mask
+    // test instead of a locked lookup per packet
+    enum dot11_alert_sig : uint32_t {
+        alert_sig_deauthflood = (1 << 0),
+        alert_sig_bcastdcon = (1 << 1),
+        alert_sig_formatstring = (1 << 2),
+        alert_sig_airjackssid = (1 << 3),
+        alert_sig_ssidmatch = (1 << 4),
+        alert_sig_l33t = (1 << 5),
+        alert_sig_wepflap = (1 << 6),
+        alert_sig_cryptchange = (1 << 7),
+        alert_sig_dot11d = (1 << 8),
+        alert_sig_beaconrate = (1 << 9),
+    };
+
+    uint32_t mgmt_alert_sigs[16];
+
+    void compile_alert_signatures();
+
+    bool mgmt_alert_armed(const std::shared_ptr<dot11_packinfo>& dot11info, uint32_t sig) const {
+        return dot11info->type == packet_management &&
+            (mgmt_alert_sigs[dot11info->subtype & 0x0F] & sig) != 0;
+    }
+
     int signal_too_loud_threshold;
 
     // Command refs
@@ -638,9 +832,34 @@ protected:
     // Do we store the last beaconed tags in the ssid record?
     bool keep_ie_tags_per_bssid;
 
+    // Do we split IE tags through the kaitai stream parser instead of in place?
+    bool legacy_ie_parser;
+
+    // IE tags left out of the advertisement checksum, so that a beacon which only
+    // changes them isn't dissected again
+    std::bitset<256> volatile_ie_tags;
+
     // Do we keep WPA packets?
     bool keep_eapol_packets;
 
+    // Memory budget of the EAPOL, beacon, and PMKID packets kept with devices
+    std::shared_ptr<packet_retention> retention;
+
+    // How many randomized (locally administered) clients an AP keeps in its associated
+    // client map, and how many probed SSIDs a randomized device keeps; 0 for no limit
+    size_t random_client_max;
+    size_t random_probe_max;
+
+    // Are probes from randomized MACs folded into one device per probe fingerprint?
+    // Randomized MACs get their own device once they do anything but probe, or if
+    // they match random_probe_track
+    bool random_probe_group;
+    std::vector<mac_addr> random_probe_track;
+
+    // IE tags whose content is part of the probe group fingerprint; the order of
+    // all the tags always is
+    std::bitset<256> random_probe_group_ie;
+
     // Do we only get signal from beacons?
     bool signal_from_beacon;
 
@@ -655,6 +874,7 @@ protected:
     std::shared_ptr<tracker_element_string> devtype_wds_ap;
     std::shared_ptr<tracker_element_string> devtype_bridged;
     std::shared_ptr<tracker_element_string> devtype_device;
+    std::shared_ptr<tracker_element_string> devtype_random_group;
 
     std::shared_ptr<dot11_tracked_device> dot11_builder;
 };
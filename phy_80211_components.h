@@ -488,7 +488,7 @@ public:
         return r;
     }
 
-    __Proxy(ssid, std::string, std::string, std::string, ssid);
+    __ProxyInterned(ssid, ssid);
     __Proxy(ssid_len, uint32_t, unsigned int, unsigned int, ssid_len);
     __Proxy(bssid, mac_addr, mac_addr, mac_addr, bssid);
     __Proxy(first_time, uint64_t, time_t, time_t, first_time);
@@ -1044,10 +1044,82 @@ protected:
 #define DOT11_DEVICE_TYPE_INFERRED_WIRED    (1 << 7)
 // Device has responded to probes, looking like an AP
 #define DOT11_DEVICE_TYPE_PROBE_AP          (1 << 8)
+// Group of randomized MACs sending probes with the same fingerprint
+#define DOT11_DEVICE_TYPE_RANDOM_GROUP      (1 << 9)
 
 // Dot11 device
 //
 // Device-level data, additional data stored in the client and ssid arrays
+// Bounded recency list of records about randomized (locally administered) MACs.
+// Probe floods from randomized MACs would otherwise grow the per-device maps without
+// limit; the keys are kept in a flat vector and found by a linear scan, which for a
+// few dozen entries is cheaper than a map.  Once the list is full the least recently
+// seen key is pushed out, and handed back so the caller can drop its record.
+template<typename K>
+class dot11_recent_keys {
+public:
+    // Record a sighting of a key; returns true and sets evicted when the list was
+    // full and an older key was pushed out
+    bool touch(const K& key, time_t ts, size_t max, K& evicted) {
+        for (auto& e : entries) {
+            if (e.key == key) {
+                if (e.last_time < ts)
+                    e.last_time = ts;
+                return false;
+            }
+        }
+
+        if (entries.size() < max) {
+            entries.push_back(entry{key, ts});
+            return false;
+        }
+
+        auto oldest = entries.begin();
+
+        for (auto i = entries.begin(); i != entries.end(); ++i) {
+            if (i->last_time < oldest->last_time)
+                oldest = i;
+        }
+
+        evicted = oldest->key;
+        oldest->key = key;
+        oldest->last_time = ts;
+
+        return true;
+    }
+
+    void erase(const K& key) {
+        for (auto i = entries.begin(); i != entries.end(); ++i) {
+            if (i->key == key) {
+                *i = entries.back();
+                entries.pop_back();
+                return;
+            }
+        }
+    }
+
+    bool contains(const K& key) const {
+        for (const auto& e : entries) {
+            if (e.key == key)
+                return true;
+        }
+
+        return false;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+protected:
+    struct entry {
+        K key;
+        time_t last_time;
+    };
+
+    std::vector<entry> entries;
+};
+
 class dot11_tracked_device : public tracker_component {
     friend class kis_80211_phy;
 public:
@@ -1112,10 +1184,14 @@ public:
             __ImportId(probed_ssid_map_id, p);
             __ImportId(probed_ssid_map_entry_id, p);
             __ImportField(num_probed_ssids, p);
+            __ImportField(num_aged_probed_ssids, p);
+
+            __ImportField(num_random_group_macs, p);
 
             __ImportId(associated_client_map_id, p);
             __ImportId(associated_client_map_entry_id, p);
             __ImportField(num_associated_clients, p);
+            __ImportField(num_aged_random_clients, p);
             __ImportField(client_disconnects, p);
             __ImportField(client_disconnects_last, p);
 
@@ -1217,11 +1293,30 @@ public:
 
     __Proxy(num_probed_ssids, uint64_t, uint64_t, uint64_t, num_probed_ssids);
 
+    // Probed SSIDs of a randomized MAC pushed out of the probed SSID map
+    __Proxy(num_aged_probed_ssids, uint64_t, uint64_t, uint64_t, num_aged_probed_ssids);
+    __ProxyIncDec(num_aged_probed_ssids, uint64_t, uint64_t, num_aged_probed_ssids);
+
     __ProxyDynamicTrackable(associated_client_map, tracker_element_mac_map, 
             associated_client_map, associated_client_map_id);
 
     __Proxy(num_associated_clients, uint64_t, uint64_t, uint64_t, num_associated_clients);
 
+    // Randomized clients pushed out of the associated client map
+    __Proxy(num_aged_random_clients, uint64_t, uint64_t, uint64_t, num_aged_random_clients);
+    __ProxyIncDec(num_aged_random_clients, uint64_t, uint64_t, num_aged_random_clients);
+
+    // Recency of the randomized clients in the associated client map, and of the
+    // SSIDs probed by a randomized device
+    dot11_recent_keys<mac_addr> random_clients;
+    dot11_recent_keys<size_t> random_probed_ssids;
+
+    // MACs folded into a randomized probe group device; the count is of MACs which
+    // weren't among the most recently seen members
+    __Proxy(num_random_group_macs, uint64_t, uint64_t, uint64_t, num_random_group_macs);
+    __ProxyIncDec(num_random_group_macs, uint64_t, uint64_t, num_random_group_macs);
+    dot11_recent_keys<mac_addr> random_group_macs;
+
     __Proxy(client_disconnects, uint64_t, uint64_t, uint64_t, client_disconnects);
     __ProxyIncDec(client_disconnects, uint64_t, uint64_t, client_disconnects);
 
@@ -1278,6 +1373,10 @@ public:
     }
 
     virtual void pre_serialize() override {
+        // The counts are derived from the maps; left unstamped, they're reported with
+        // any other change to the device
+        derived_fields_scope ds;
+
         if (client_map != nullptr)
             set_num_client_aps(client_map->size());
         else
@@ -1382,6 +1481,8 @@ protected:
                     "probed ssid");
 
         register_field("dot11.device.num_probed_ssids", "number of probed SSIDs", &num_probed_ssids);
+        register_field("dot11.device.num_aged_probed_ssids", 
+                "number of probed SSIDs of a randomized MAC no longer kept", &num_aged_probed_ssids);
 
         associated_client_map_id =
             register_dynamic_field("dot11.device.associated_client_map", "associated clients", &associated_client_map);
@@ -1393,6 +1494,10 @@ protected:
 
         register_field("dot11.device.num_associated_clients", 
                 "number of associated clients", &num_associated_clients);
+        register_field("dot11.device.num_aged_random_clients", 
+                "number of randomized-MAC clients no longer kept", &num_aged_random_clients);
+        register_field("dot11.device.num_random_group_macs", 
+                "number of randomized MACs in a probe group", &num_random_group_macs);
 
         register_field("dot11.device.client_disconnects", 
                 "client disconnects message count", 
@@ -1569,11 +1674,14 @@ protected:
     int probed_ssid_map_id;
     int probed_ssid_map_entry_id;
     std::shared_ptr<tracker_element_uint64> num_probed_ssids;
+    std::shared_ptr<tracker_element_uint64> num_aged_probed_ssids;
 
     std::shared_ptr<tracker_element_mac_map> associated_client_map;
     int associated_client_map_id;
     int associated_client_map_entry_id;
     std::shared_ptr<tracker_element_uint64> num_associated_clients;
+    std::shared_ptr<tracker_element_uint64> num_aged_random_clients;
+    std::shared_ptr<tracker_element_uint64> num_random_group_macs;
     std::shared_ptr<tracker_element_uint64> client_disconnects;
     std::shared_ptr<tracker_element_uint64> client_disconnects_last;
 
@@ -319,10 +319,8 @@ int kis_80211_phy::packet_dot11_dissector(std::shared_ptr<kis_packet> in_pack) {
     }
 
 
-    if (common == NULL) {
-        common = packetchain->new_packet_component<kis_common_info>();
-        in_pack->insert(pack_comp_common, common);
-    }
+    if (common == NULL)
+        common = in_pack->fetch_or_add<kis_common_info>();
 
     common->phyid = phyid;
 
@@ -669,8 +667,7 @@ int kis_80211_phy::packet_dot11_dissector(std::shared_ptr<kis_packet> in_pack) {
                 packinfo->bssid_mac = mac_addr(addr2, PHY80211_MAC_LEN);
 
                 packinfo->ietag_csum =
-                    crc32_fast(chunk->data() + packinfo->header_offset,
-                                           chunk->length() - packinfo->header_offset);
+                    packet_dot11_ie_checksum(chunk->substr(packinfo->header_offset));
 
                 break;
 
@@ -715,8 +712,7 @@ int kis_80211_phy::packet_dot11_dissector(std::shared_ptr<kis_packet> in_pack) {
                 packinfo->beacon_interval = kis_letoh16(fixparm->beacon);
 
                 packinfo->ietag_csum =
-                    crc32_fast(chunk->data() + packinfo->header_offset,
-                            chunk->length() - packinfo->header_offset);
+                    packet_dot11_ie_checksum(chunk->substr(packinfo->header_offset));
 
                 break;
 
@@ -1206,6 +1202,58 @@ eap_end:
     return 1;
 }
 
+uint32_t kis_80211_phy::packet_dot11_ie_checksum(nonstd::string_view in_tags) {
+    // Hash the runs of tags between the volatile ones; anything past the last complete
+    // tag is hashed as it is
+    uint32_t hash = 0;
+    const char *run = in_tags.data();
+
+    for (const auto& t : dot11_ie_view(in_tags)) {
+        if (!volatile_ie_tags[t.num])
+            continue;
+
+        const char *tag_start = t.data.data() - 2;
+
+        if (tag_start > run)
+            hash = XXH32(run, tag_start - run, hash);
+
+        run = t.data.data() + t.data.length();
+    }
+
+    const char *end = in_tags.data() + in_tags.length();
+
+    if (end > run)
+        hash = XXH32(run, end - run, hash);
+
+    return hash;
+}
+
+bool kis_80211_phy::packet_dot11_ie_split(std::shared_ptr<kis_datachunk> chunk,
+        std::shared_ptr<dot11_packinfo> packinfo) {
+    if (packinfo->header_offset > chunk->length())
+        return false;
+
+    packinfo->ie_tags = Globalreg::new_from_pool<dot11_ie>();
+
+    if (!legacy_ie_parser) {
+        // Tags reference the frame, which lives as long as the packinfo does
+        return packinfo->ie_tags->parse(chunk->substr(packinfo->header_offset));
+    }
+
+    membuf tags_membuf((char *) &(chunk->data()[packinfo->header_offset]), 
+            (char *) &(chunk->data()[chunk->length()]));
+    std::istream istream_ietags(&tags_membuf);
+
+    try {
+        std::shared_ptr<kaitai::kstream> stream_ietags(new kaitai::kstream(&istream_ietags));
+        packinfo->ie_tags->parse(stream_ietags);
+    } catch (const std::exception& e) {
+        return false;
+    }
+
+    return true;
+}
+
 std::shared_ptr<std::vector<kis_80211_phy::ie_tag_tuple>> kis_80211_phy::packet_dot11_ie_list(
         std::shared_ptr<kis_packet> in_pack, 
         std::shared_ptr<dot11_packinfo> packinfo) {
@@ -1237,21 +1285,24 @@ std::shared_ptr<std::vector<kis_80211_phy::ie_tag_tuple>> kis_80211_phy::packet_
         if (chunk->dlt != KDLT_IEEE802_11)
             return packinfo->ie_tags_listed;
 
-        membuf tags_membuf((char *) &(chunk->data()[packinfo->header_offset]), 
-                (char *) &(chunk->data()[chunk->length()]));
-        std::istream istream_ietags(&tags_membuf);
-
-		packinfo->ie_tags = Globalreg::new_from_pool<dot11_ie>();
-
-        try {
-            std::shared_ptr<kaitai::kstream> stream_ietags(new kaitai::kstream(&istream_ietags));
-            packinfo->ie_tags->parse(stream_ietags);
-        } catch (const std::exception& e) {
+        if (!packet_dot11_ie_split(chunk, packinfo))
             return packinfo->ie_tags_listed;
-        }
     }
 
     for (auto ie_tag : *(packinfo->ie_tags->tags())) {
+        if (!legacy_ie_parser) {
+            uint32_t oui = 0;
+            uint8_t oui_type = 0;
+
+            if (ie_tag->tag_num() == 150 || ie_tag->tag_num() == 221) {
+                if (!dot11_ie_view::vendor_oui(ie_tag->tag_data_view(), oui, oui_type))
+                    return packinfo->ie_tags_listed;
+            }
+
+            packinfo->ie_tags_listed->push_back(ie_tag_tuple{ie_tag->tag_num(), oui, oui_type});
+            continue;
+        }
+
         if (ie_tag->tag_num() == 150) {
             try {
                 ie_tag->tag_data_stream()->seek(0);
@@ -1305,16 +1356,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
         return 0;
 
     if (packinfo->ie_tags == nullptr) {
-        membuf tags_membuf((char *) &(chunk->data()[packinfo->header_offset]), 
-                (char *) &(chunk->data()[chunk->length()]));
-        std::istream istream_ietags(&tags_membuf);
-
-		packinfo->ie_tags = Globalreg::new_from_pool<dot11_ie>();
-
-        try {
-            std::shared_ptr<kaitai::kstream> stream_ietags(new kaitai::kstream(&istream_ietags));
-            packinfo->ie_tags->parse(stream_ietags);
-        } catch (const std::exception& e) {
+        if (!packet_dot11_ie_split(chunk, packinfo)) {
             // fmt::print(stderr, "debug - IE tag structure corrupt\n");
             packinfo->corrupt = 1;
             return -1;
@@ -1331,15 +1373,29 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
     unsigned int wmmtspec_responses = 0;
 
     for (auto ie_tag : *(packinfo->ie_tags->tags())) {
-        auto hash = std::hash<std::string>{};
+        auto hash = std::hash<nonstd::string_view>{};
+        auto tag_data = ie_tag->tag_data_view();
 
-        if (ie_tag->tag_num() == 150) {
+        if (!legacy_ie_parser) {
+            uint32_t oui = 0;
+            uint8_t oui_type = 0;
+
+            if (ie_tag->tag_num() == 150 || ie_tag->tag_num() == 221) {
+                if (!dot11_ie_view::vendor_oui(tag_data, oui, oui_type)) {
+                    packinfo->corrupt = 1;
+                    return -1;
+                }
+            }
+
+            packinfo->ietag_hash_map.insert(std::make_pair(ie_tag_tuple{ie_tag->tag_num(), oui, oui_type},
+                        hash(tag_data)));
+        } else if (ie_tag->tag_num() == 150) {
             try {
 				auto vendor = Globalreg::new_from_pool<dot11_ie_150_vendor>();
                 vendor->parse(ie_tag->tag_data_stream());
 
                 packinfo->ietag_hash_map.insert(std::make_pair(ie_tag_tuple{150, vendor->vendor_oui_int(), 
-                    vendor->vendor_oui_type()}, hash(ie_tag->tag_data())));
+                    vendor->vendor_oui_type()}, hash(tag_data)));
             } catch (const std::exception& e) {
                 packinfo->corrupt = 1;
                 return -1;
@@ -1350,14 +1406,14 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
                 vendor->parse(ie_tag->tag_data_stream());
 
                 packinfo->ietag_hash_map.insert(std::make_pair(ie_tag_tuple{221, vendor->vendor_oui_int(), 
-                    vendor->vendor_oui_type()}, hash(ie_tag->tag_data())));
+                    vendor->vendor_oui_type()}, hash(tag_data)));
             } catch (const std::exception& e) {
                 packinfo->corrupt = 1;
                 return -1;
             }
         } else {
             packinfo->ietag_hash_map.insert(std::make_pair(ie_tag_tuple{ie_tag->tag_num(), 0, 0}, 
-                                                           hash(ie_tag->tag_data())));
+                                                           hash(tag_data)));
         }
 
         // IE 0 SSID
@@ -1370,9 +1426,8 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             seen_ssid = true;
             */
 
-            packinfo->ssid_len = ie_tag->tag_data().length();
-            packinfo->ssid_csum = kis_80211_phy::ssid_hash(ie_tag->tag_data().data(), 
-                    ie_tag->tag_data().length());
+            packinfo->ssid_len = tag_data.length();
+            packinfo->ssid_csum = kis_80211_phy::ssid_hash(tag_data.data(), tag_data.length());
 
             if (packinfo->ssid_len == 0) {
                 packinfo->ssid_blank = true;
@@ -1380,10 +1435,12 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             }
 
             if (packinfo->ssid_len <= DOT11_PROTO_SSID_LEN) {
-                if (ie_tag->tag_data().find_first_not_of('\0') == std::string::npos) {
+                if (tag_data.find_first_not_of('\0') == nonstd::string_view::npos) {
                     packinfo->ssid_blank = true;
                 } else {
-                    packinfo->ssid = munge_to_printable(ie_tag->tag_data().data());
+                    // The ssid has always stopped at the first nul
+                    auto ssid = tag_data.substr(0, tag_data.find('\0'));
+                    packinfo->ssid = munge_to_printable(std::string(ssid.data(), ssid.length()));
                 }
             } else { 
                 _ALERT(alert_longssid_ref, in_pack, packinfo,
@@ -1422,7 +1479,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
                 */
             }
 
-            if (ie_tag->tag_data().find("\x75\xEB\x49") != std::string::npos) {
+            if (tag_data.find("\x75\xEB\x49") != nonstd::string_view::npos) {
                 _ALERT(alert_msfdlinkrate_ref, in_pack, packinfo,
                         "MSF-style poisoned rate field in beacon for network " +
                         packinfo->bssid_mac.mac_to_string() + ", exploit attempt "
@@ -1433,7 +1490,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             }
 
             std::vector<std::string> basicrates;
-            for (uint8_t r : ie_tag->tag_data()) {
+            for (uint8_t r : tag_data) {
                 std::string rate;
 
                 switch (r) {
@@ -1596,7 +1653,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
                 return -1;
             }
                 
-            packinfo->channel = fmt::format("{}", (uint8_t) (ie_tag->tag_data()[0]));
+            packinfo->channel = fmt::format("{}", tag_data.length() ? (uint8_t) tag_data[0] : 0);
             continue;
         }
 
@@ -1631,15 +1688,10 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             continue;
         }
 
-        // IE 11 QBSS
+        // IE 11 QBSS, decoded by get_qbss(); only v1 and v2 are valid
         if (ie_tag->tag_num() == 11) {
-            try {
-				auto qbss = Globalreg::new_from_pool<dot11_ie_11_qbss>();
-                ie_tag->tag_data_stream()->seek(0);
-                qbss->parse(ie_tag->tag_data_stream());
-                packinfo->qbss = qbss;
-            } catch (const std::exception& e) {
-                // fprintf(stderr, "debug - corrupt QBSS %s\n", e.what());
+            if (ie_tag->tag_len() != 4 && ie_tag->tag_len() != 5) {
+                // fprintf(stderr, "debug - corrupt QBSS\n");
                 packinfo->corrupt = 1;
                 return -1;
             }
@@ -1647,16 +1699,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             continue;
         }
 
-        // IE 33 advertised txpower in probe req
-        if (ie_tag->tag_num() == 33) {
-            try {
-				packinfo->tx_power = Globalreg::new_from_pool<dot11_ie_33_power>();
-                packinfo->tx_power->parse(ie_tag->tag_data_stream());
-            } catch (const std::exception& e) {
-                // fmt::print(stderr, "debug - corrupt IE33 power: {}\n", e.what());
-            }
-
-        }
+        // IE 33 advertised txpower in probe req, decoded by get_tx_power()
 
 #if 0
         // We don't use this, don't decode
@@ -1826,34 +1869,18 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             continue;
         }
 
-        // IE 54 Mobility
+        // IE 54 Mobility, decoded by get_dot11r_mobility(); domain and policy
         if (ie_tag->tag_num() == 54) {
-            try {
-				auto mobility = Globalreg::new_from_pool<dot11_ie_54_mobility>();
-                mobility->parse(ie_tag->tag_data_stream());
-                packinfo->dot11r_mobility = mobility;
-            } catch (const std::exception& e) {
+            if (ie_tag->tag_len() < 3) {
                 packinfo->corrupt = 1;
                 return -1;
             }
-            continue;
-        }
-
-        // IE 61 HT
-        if (ie_tag->tag_num() == 61) {
-            try {
-				auto ht = Globalreg::new_from_pool<dot11_ie_61_ht_op>();
-                ht->parse(ie_tag->tag_data_stream());
-                packinfo->dot11ht = ht;
-            } catch (const std::exception& e) {
-                // fprintf(stderr, "debug - unparsable HT\n");
-                // Don't consider unparsable HT a corrupt packet (for now)
-                continue;
-            }
 
             continue;
         }
 
+        // IE 61 HT is decoded by get_dot11ht()
+
         // IE 133 CISCO CCX
         if (ie_tag->tag_num() == 133) {
             try {
@@ -1891,8 +1918,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
 			// If we have no SSID tag, use the mesh ID as the SSID checksum to differentiate
 			// between multiple mesh advertisements; otherwise use the SSID
 			if (packinfo->ssid_len == 0) {
-				packinfo->ssid_csum = kis_80211_phy::ssid_hash(ie_tag->tag_data().data(), 
-						ie_tag->tag_data().length());
+				packinfo->ssid_csum = kis_80211_phy::ssid_hash(tag_data.data(), tag_data.length());
 			}
 
             continue;
@@ -2000,20 +2026,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
             continue;
         }
 
-        // IE 192 VHT Operation
-        if (ie_tag->tag_num() == 192) {
-            try {
-				auto vht = Globalreg::new_from_pool<dot11_ie_192_vht_op>();
-                vht->parse(ie_tag->tag_data_stream());
-                packinfo->dot11vht = vht;
-
-            } catch (const std::exception& e) {
-                // fprintf(stderr, "debug - vht 192 error %s\n", e.what());
-                // Don't consider this a corrupt packet just because we didn't parse it
-            }
-
-            continue;
-        }
+        // IE 192 VHT Operation is decoded by get_dot11vht()
 
         if (ie_tag->tag_num() == 221) {
             try {
@@ -2025,7 +2038,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
                 if (packinfo->subtype == packet_sub_beacon &&
                         vendor->vendor_oui_int() == 0x0050f2 &&
                         vendor->vendor_oui_type() == 2 &&
-                        ie_tag->tag_data().length() > 24) {
+                        tag_data.length() > 24) {
 
                     std::string al = "IEEE80211 Access Point BSSID " + 
                         packinfo->bssid_mac.mac_to_string() + " sent association "
@@ -2255,7 +2268,7 @@ int kis_80211_phy::packet_dot11_ie_dissector(std::shared_ptr<kis_packet> in_pack
 std::shared_ptr<kis_datachunk> kis_80211_phy::DecryptWEP(std::shared_ptr<dot11_packinfo> in_packinfo,
         std::shared_ptr<kis_datachunk> in_chunk,
         unsigned char *in_key, int in_key_len,
-        unsigned char *in_id) {
+        unsigned char *in_id, bool in_llc_check) {
 
     std::shared_ptr<kis_datachunk> manglechunk;
 
@@ -2307,6 +2320,9 @@ std::shared_ptr<kis_datachunk> kis_80211_phy::DecryptWEP(std::shared_ptr<dot11_p
     // Allocate the mangled chunk -- 4 byte IV/Key# gone, 4 byte ICV gone
     char manglebuf[in_chunk->length() - 8];
 
+    // The header is carried over as-is
+    memcpy(manglebuf, in_chunk->data(), in_packinfo->header_offset);
+
     // Decrypt the data payload and check the CRC
     kba = kbb = 0;
     uint32_t crc = ~0;
@@ -2330,6 +2346,15 @@ std::shared_ptr<kis_datachunk> kis_80211_phy::DecryptWEP(std::shared_ptr<dot11_p
             in_chunk->data()[dpos] ^ keyblock[(keyblock[kba] + keyblock[kbb]) & 0xFF];
 
         crc = dot11_wep_crc32_table[(crc ^ manglebuf[dpos - 4]) & 0xFF] ^ (crc >> 8);
+
+        // Data frames start with an LLC UI header (aa aa 03 for SNAP, 42 42 03 for
+        // STP, and so on); if a key doesn't produce one, don't decrypt the rest
+        if (in_llc_check && dpos == in_packinfo->header_offset + 6) {
+            auto llc = reinterpret_cast<uint8_t *>(manglebuf + in_packinfo->header_offset);
+
+            if (llc[0] != llc[1] || llc[2] != 0x03)
+                return NULL;
+        }
     }
 
     // Check the CRC
@@ -2373,8 +2398,6 @@ std::shared_ptr<kis_datachunk> kis_80211_phy::DecryptWEP(std::shared_ptr<dot11_p
 }
 
 int kis_80211_phy::packet_wep_decryptor(std::shared_ptr<kis_packet> in_pack) {
-    std::shared_ptr<kis_datachunk> manglechunk;
-
     if (in_pack->error)
         return 0;
 
@@ -2407,18 +2430,70 @@ int kis_80211_phy::packet_wep_decryptor(std::shared_ptr<kis_packet> in_pack) {
         return 0;
 
     // Bail if we can't find a key match
-    auto bwmitr = wepkeys.find(packinfo->bssid_mac);
-    if (bwmitr == wepkeys.end())
-        return 0;
+    {
+        kis_lock_guard<kis_mutex> lk(wepkey_mutex, "packet_wep_decryptor");
 
-    manglechunk = DecryptWEP(packinfo, chunk, (bwmitr->second)->key, (bwmitr->second)->len, wep_identity);
+        if (wepkeys.find(packinfo->bssid_mac) == wepkeys.end())
+            return 0;
+    }
 
-    if (manglechunk == NULL) {
-        (bwmitr->second)->failed++;
-        return 0;
+    // Hand the frame to the decryption worker; it comes back to the packet chain at
+    // data dissection, decrypted or not
+    if (wep_decrypt_thread.joinable() && 
+            wep_decrypt_queue.size_approx() < wep_decrypt_backlog) {
+        packetchain->hold_packet(in_pack);
+        wep_decrypt_queue.enqueue(in_pack);
+        return 1;
+    }
+
+    return decrypt_wep_packet(in_pack, packinfo, chunk) ? 1 : 0;
+}
+
+bool kis_80211_phy::decrypt_wep_packet(std::shared_ptr<kis_packet> in_pack,
+        std::shared_ptr<dot11_packinfo> packinfo, std::shared_ptr<kis_datachunk> chunk) {
+    std::shared_ptr<kis_datachunk> manglechunk;
+
+    kis_lock_guard<kis_mutex> lk(wepkey_mutex, "decrypt_wep_packet");
+
+    auto ksitr = wepkeys.find(packinfo->bssid_mac);
+
+    if (ksitr == wepkeys.end() || ksitr->second.keys.size() == 0)
+        return false;
+
+    auto& ks = ksitr->second;
+
+    if (ks.last_good >= ks.keys.size())
+        ks.last_good = 0;
+
+    // The key which worked last time almost always works again, so it gets a full
+    // decrypt; the rest are only decrypted past the LLC header if they produce one
+    auto key = ks.keys[ks.last_good];
+    manglechunk = DecryptWEP(packinfo, chunk, key->key, key->len, wep_identity);
+
+    if (manglechunk == nullptr) {
+        key->failed++;
+
+        for (size_t k = 0; k < ks.keys.size(); k++) {
+            if (k == ks.last_good)
+                continue;
+
+            manglechunk = DecryptWEP(packinfo, chunk, ks.keys[k]->key, ks.keys[k]->len,
+                    wep_identity, true);
+
+            if (manglechunk != nullptr) {
+                ks.last_good = k;
+                key = ks.keys[k];
+                break;
+            }
+
+            ks.keys[k]->failed++;
+        }
     }
 
-    (bwmitr->second)->decrypted++;
+    if (manglechunk == nullptr)
+        return false;
+
+    key->decrypted++;
     packinfo->decrypted = 1;
 
     in_pack->insert(pack_comp_mangleframe, manglechunk);
@@ -2434,7 +2509,32 @@ int kis_80211_phy::packet_wep_decryptor(std::shared_ptr<kis_packet> in_pack) {
         in_pack->insert(pack_comp_datapayload, datachunk);
     }
 
-    return 1;
+    return true;
+}
+
+void kis_80211_phy::wep_decrypt_worker() {
+    std::shared_ptr<kis_packet> pack;
+
+    while (true) {
+        wep_decrypt_queue.wait_dequeue(pack);
+
+        if (pack == nullptr)
+            break;
+
+        {
+            // The packet thread holds the packet until it's done with the batch
+            kis_lock_guard<kis_mutex> lk(pack->mutex, "wep_decrypt_worker");
+
+            auto packinfo = pack->fetch<dot11_packinfo>(pack_comp_80211);
+            auto chunk = pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+
+            if (packinfo != nullptr && chunk != nullptr)
+                decrypt_wep_packet(pack, packinfo, chunk);
+        }
+
+        packetchain->resume_packet(pack, CHAINPOS_DATADISSECT);
+        pack.reset();
+    }
 }
 
 int kis_80211_phy::packet_dot11_wps_m3(std::shared_ptr<kis_packet> in_pack) {
@@ -2537,6 +2637,51 @@ int kis_80211_phy::packet_dot11_wps_m3(std::shared_ptr<kis_packet> in_pack) {
     return 0;
 }
 
+bool kis_80211_phy::packet_dot11_eapol_detect(std::shared_ptr<kis_packet> in_pack,
+        std::shared_ptr<dot11_packinfo> packinfo) {
+    if (in_pack->error || packinfo->corrupt)
+        return false;
+
+    if (packinfo->type != packet_data || 
+            (packinfo->subtype != packet_sub_data &&
+             packinfo->subtype != packet_sub_data_qos_data))
+        return false;
+
+    // If it's encrypted it's not eapol
+    if (packinfo->cryptset)
+        return false;
+
+    auto chunk = in_pack->fetch<kis_datachunk>(pack_comp_decap, pack_comp_linkframe);
+    if (chunk == nullptr || chunk->dlt != KDLT_IEEE802_11)
+        return false;
+
+    static const uint8_t eapol_llc[] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8e };
+
+    // LLC, then the 802.1x version, type, and length, and the key descriptor type
+    unsigned int pos = packinfo->header_offset;
+
+    if (pos + sizeof(eapol_llc) + 5 > chunk->length())
+        return false;
+
+    auto data = reinterpret_cast<const uint8_t *>(chunk->data()) + pos;
+
+    if (memcmp(data, eapol_llc, sizeof(eapol_llc)))
+        return false;
+
+    data += sizeof(eapol_llc);
+
+    if (data[1] != dot11_wpa_eap::dot1x_type_eap_key ||
+            data[4] != dot11_wpa_eap::dot1x_key::dot1x_key_type_eapol_rsn)
+        return false;
+
+    packinfo->eapol_key = true;
+
+    // Set a packet tag for handshakes
+    in_pack->tag(pack_tag_wpa_handshake);
+
+    return true;
+}
+
 std::shared_ptr<dot11_tracked_eapol> 
 kis_80211_phy::packet_dot11_eapol_handshake(std::shared_ptr<kis_packet> in_pack,
                                             std::shared_ptr<dot11_tracked_device> dot11dev) {
@@ -2624,9 +2769,6 @@ kis_80211_phy::packet_dot11_eapol_handshake(std::shared_ptr<kis_packet> in_pack,
         if (rsnkey == NULL)
             return NULL;
 
-        // Set a packet tag for handshakes
-        in_pack->tag_map["DOT11_WPAHANDSHAKE"] = true;
-
         if (!keep_eapol_packets)
             return nullptr;
 
@@ -2732,7 +2874,7 @@ kis_80211_phy::packet_dot11_eapol_handshake(std::shared_ptr<kis_packet> in_pack,
                             eapol->set_rsnpmkid_bytes(pmkid.pmkid());
 
                             // Tag the packet
-                            in_pack->tag_map["DOT11_RSNPMKID"] = true;
+                            in_pack->tag(pack_tag_rsn_pmkid);
                         }
                     }
                 }
@@ -0,0 +1,448 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Exports of the WPA handshakes kept with the 802.11 devices: the per-device pcaps, and
+// the bulk pcapng and hashcat (mode 22000) exports of many BSSIDs at once.
+//
+// Encoded exports are cached per BSSID device; a BSSID drops its cached exports when it
+// records another EAPOL frame or snapshots its beacon, so repeated downloads of an
+// unchanged handshake are served from the cache.
+
+#include "config.h"
+
+#include <set>
+#include <sstream>
+
+#include "devicetracker.h"
+#include "devicetracker_view_workers.h"
+#include "pcapng.h"
+#include "phy_80211.h"
+#include "util.h"
+
+// Cached exports are dropped wholesale once this many BSSIDs have them
+#define HANDSHAKE_CACHE_MAX     4096
+
+namespace {
+    // EAPOL frame following the LLC/SNAP header of a stored 802.11 data frame; empty if
+    // the frame doesn't hold one
+    std::string handshake_eapol_frame(const std::string& frame) {
+        static const std::string eapol_llc("\xaa\xaa\x03\x00\x00\x00\x88\x8e", 8);
+
+        auto pos = frame.find(eapol_llc, 24);
+
+        if (pos == std::string::npos)
+            return "";
+
+        pos += eapol_llc.length();
+
+        if (frame.length() < pos + 4)
+            return "";
+
+        size_t len = 4 + (((uint8_t) frame[pos + 2] << 8) | (uint8_t) frame[pos + 3]);
+
+        if (frame.length() < pos + len)
+            return "";
+
+        return frame.substr(pos, len);
+    }
+
+    // Offset and length of the key MIC in an EAPOL-Key frame, and the shortest frame
+    // which holds the MIC and the key data length
+    const size_t eapol_mic_offset = 81;
+    const size_t eapol_mic_len = 16;
+    const size_t eapol_min_len = 99;
+
+    std::string hex(const std::string& in) {
+        return str_lower(uint8_to_hex_str((uint8_t *) in.data(), in.length()));
+    }
+
+    std::string hex_mac(const mac_addr& mac) {
+        return str_lower(fmt::format("{:02X}{:02X}{:02X}{:02X}{:02X}{:02X}",
+                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]));
+    }
+
+    void pcap_packet(std::ostream& stream, std::shared_ptr<kis_tracked_packet> packet) {
+        // Packets evicted from the retention budget have no data left
+        if (packet->get_data()->length() == 0)
+            return;
+
+        pcap_packet_hdr_t pkt_hdr;
+
+        pkt_hdr.ts_sec = packet->get_ts_sec();
+        pkt_hdr.ts_usec = packet->get_ts_usec();
+        pkt_hdr.incl_len = packet->get_data()->length();
+        pkt_hdr.orig_len = pkt_hdr.incl_len;
+
+        stream.write((const char *) &pkt_hdr, sizeof(pkt_hdr));
+        stream.write((const char *) packet->get_data()->get().data(), pkt_hdr.incl_len);
+    }
+
+    size_t pad_to_32bit(size_t in) {
+        return (in + 3) & ~((size_t) 3);
+    }
+
+    // Enhanced packet block on interface 0, with a comment
+    void pcapng_packet(std::ostream& stream, std::shared_ptr<kis_tracked_packet> packet,
+            const std::string& comment) {
+        const auto& data = packet->get_data()->get();
+
+        if (data.length() == 0)
+            return;
+
+        size_t data_pad = pad_to_32bit(data.length());
+        size_t comment_pad = pad_to_32bit(comment.length());
+
+        pcapng_epb_t epb;
+        pcapng_option_t opt;
+        uint32_t pad = 0;
+
+        uint64_t ts = (uint64_t) packet->get_ts_sec() * 1000000 + packet->get_ts_usec();
+
+        epb.block_type = PCAPNG_EPB_BLOCK_TYPE;
+        epb.block_length = sizeof(pcapng_epb_t) + data_pad +
+            sizeof(pcapng_option_t) + comment_pad +
+            sizeof(pcapng_option_t) + 4;
+        epb.interface_id = 0;
+        epb.timestamp_high = ts >> 32;
+        epb.timestamp_low = ts;
+        epb.captured_length = data.length();
+        epb.original_length = data.length();
+
+        stream.write((const char *) &epb, sizeof(epb));
+        stream.write(data.data(), data.length());
+        stream.write((const char *) &pad, data_pad - data.length());
+
+        opt.option_code = PCAPNG_OPT_COMMENT;
+        opt.option_length = comment.length();
+        stream.write((const char *) &opt, sizeof(opt));
+        stream.write(comment.data(), comment.length());
+        stream.write((const char *) &pad, comment_pad - comment.length());
+
+        opt.option_code = PCAPNG_OPT_ENDOFOPT;
+        opt.option_length = 0;
+        stream.write((const char *) &opt, sizeof(opt));
+
+        stream.write((const char *) &epb.block_length, 4);
+    }
+
+    // Section header and a single 802.11 interface
+    void pcapng_header(std::ostream& stream) {
+        pcapng_shb_t shb;
+        shb.block_type = PCAPNG_SHB_TYPE_MAGIC;
+        shb.block_length = sizeof(pcapng_shb_t) + 4;
+        shb.block_endian_magic = PCAPNG_SHB_ENDIAN_MAGIC;
+        shb.version_major = PCAPNG_SHB_VERSION_MAJOR;
+        shb.version_minor = PCAPNG_SHB_VERSION_MINOR;
+        shb.section_length = -1;
+
+        stream.write((const char *) &shb, sizeof(shb));
+        stream.write((const char *) &shb.block_length, 4);
+
+        pcapng_idb_t idb;
+        idb.block_type = PCAPNG_IDB_BLOCK_TYPE;
+        idb.block_length = sizeof(pcapng_idb_t) + 4;
+        idb.dlt = KDLT_IEEE802_11;
+        idb.reserved = 0;
+        idb.snaplen = 65535;
+
+        stream.write((const char *) &idb, sizeof(idb));
+        stream.write((const char *) &idb.block_length, 4);
+    }
+}
+
+std::shared_ptr<std::string> kis_80211_phy::cached_handshake_export(const device_key& in_key,
+        const std::string& in_variant, std::function<std::shared_ptr<std::string> ()> in_encode) {
+    {
+        kis_lock_guard<kis_mutex> lk(handshake_cache_mutex, "phy80211 cached_handshake_export");
+
+        auto dk = handshake_cache.find(in_key);
+
+        if (dk != handshake_cache.end()) {
+            auto vk = dk->second.find(in_variant);
+
+            if (vk != dk->second.end())
+                return vk->second;
+        }
+    }
+
+    auto blob = in_encode();
+
+    kis_lock_guard<kis_mutex> lk(handshake_cache_mutex, "phy80211 cached_handshake_export");
+
+    if (handshake_cache.size() >= HANDSHAKE_CACHE_MAX &&
+            handshake_cache.find(in_key) == handshake_cache.end())
+        handshake_cache.clear();
+
+    handshake_cache[in_key][in_variant] = blob;
+
+    return blob;
+}
+
+void kis_80211_phy::invalidate_handshake_cache(const device_key& in_key) {
+    kis_lock_guard<kis_mutex> lk(handshake_cache_mutex, "phy80211 invalidate_handshake_cache");
+    handshake_cache.erase(in_key);
+}
+
+std::shared_ptr<std::string> kis_80211_phy::encode_handshake_pcap(
+        std::shared_ptr<dot11_tracked_device> dot11dev, mac_addr target_mac,
+        const std::string& mode) {
+    std::stringstream stream;
+
+    pcap_hdr_t hdr;
+    hdr.magic_number = PCAP_MAGIC;
+    hdr.version_major = PCAP_VERSION_MAJOR;
+    hdr.version_minor = PCAP_VERSION_MINOR;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = PCAP_MAX_SNAPLEN;
+    hdr.dlt = KDLT_IEEE802_11;
+
+    stream.write((const char *) &hdr, sizeof(hdr));
+
+    /* Write the beacon */
+    if (dot11dev->get_beacon_packet_present())
+        pcap_packet(stream, dot11dev->get_ssid_beacon_packet());
+
+    if (mode == "handshake") {
+        // Write all the handshakes
+        if (dot11dev->has_wpa_key_map()) {
+            const auto hsm = dot11dev->get_wpa_key_map();
+            const auto hsi = hsm->find(target_mac);
+
+            if (hsi != hsm->end()) {
+                auto hsv = static_cast<tracker_element_vector *>(hsi->second.get());
+                for (const auto& i : *(hsv))
+                    pcap_packet(stream, static_cast<dot11_tracked_eapol *>(i.get())->get_eapol_packet());
+            }
+        }
+    } else if (mode == "pmkid") {
+        // Write just the pmkid
+        if (dot11dev->get_pmkid_present())
+            pcap_packet(stream, dot11dev->get_pmkid_packet());
+    }
+
+    return std::make_shared<std::string>(stream.str());
+}
+
+std::shared_ptr<std::string> kis_80211_phy::encode_handshake_pcapng(
+        std::shared_ptr<kis_tracked_device_base> dev,
+        std::shared_ptr<dot11_tracked_device> dot11dev) {
+    std::stringstream stream;
+
+    std::string ssid;
+    auto adv_ssid = dot11dev->get_last_adv_ssid();
+
+    if (adv_ssid != nullptr)
+        ssid = adv_ssid->get_ssid();
+
+    auto comment = fmt::format("BSSID {} SSID '{}'", dev->get_macaddr(), ssid);
+
+    if (dot11dev->get_beacon_packet_present()) {
+        auto beacon = dot11dev->get_ssid_beacon_packet();
+
+        if (beacon->get_dlt() == KDLT_IEEE802_11)
+            pcapng_packet(stream, beacon, comment + " beacon");
+    }
+
+    if (dot11dev->has_wpa_key_map()) {
+        for (const auto& hs : *dot11dev->get_wpa_key_map()) {
+            auto client_comment = fmt::format("{} client {}", comment, hs.first);
+            auto hsv = static_cast<tracker_element_vector *>(hs.second.get());
+
+            for (const auto& i : *hsv) {
+                auto eapol = static_cast<dot11_tracked_eapol *>(i.get());
+
+                pcapng_packet(stream, eapol->get_eapol_packet(),
+                        fmt::format("{} message {}", client_comment, eapol->get_eapol_msg_num()));
+            }
+        }
+    }
+
+    return std::make_shared<std::string>(stream.str());
+}
+
+std::shared_ptr<std::string> kis_80211_phy::encode_handshake_22000(
+        std::shared_ptr<kis_tracked_device_base> dev,
+        std::shared_ptr<dot11_tracked_device> dot11dev) {
+    std::stringstream stream;
+
+    auto adv_ssid = dot11dev->get_last_adv_ssid();
+
+    // Nothing can be cracked without the SSID
+    if (adv_ssid == nullptr || adv_ssid->get_ssid().length() == 0 || !dot11dev->has_wpa_key_map())
+        return std::make_shared<std::string>();
+
+    auto ap = hex_mac(dev->get_macaddr());
+    auto essid = hex(adv_ssid->get_ssid());
+
+    std::set<std::string> written;
+
+    for (const auto& hs : *dot11dev->get_wpa_key_map()) {
+        auto sta = hex_mac(hs.first);
+        auto hsv = static_cast<tracker_element_vector *>(hs.second.get());
+
+        std::vector<dot11_tracked_eapol *> records;
+        for (const auto& i : *hsv)
+            records.push_back(static_cast<dot11_tracked_eapol *>(i.get()));
+
+        for (auto r : records) {
+            // PMKID from the first message
+            auto pmkid = r->get_rsnpmkid_bytes();
+
+            if (pmkid.length() == 16 && written.insert(pmkid).second)
+                stream << fmt::format("WPA*01*{}*{}*{}*{}***\n", hex(pmkid), ap, sta, essid);
+
+            if (r->get_eapol_msg_num() != 2)
+                continue;
+
+            // The second message holds the MIC; pair it with the ANonce of the first
+            // message of the same exchange, or failing that the third
+            std::string anonce;
+            std::string pair;
+
+            for (auto a : records) {
+                if (a->get_eapol_msg_num() == 1 &&
+                        a->get_eapol_replay_counter() == r->get_eapol_replay_counter()) {
+                    anonce = a->get_eapol_nonce_bytes();
+                    pair = "00";
+                }
+            }
+
+            if (anonce.length() == 0) {
+                for (auto a : records) {
+                    if (a->get_eapol_msg_num() == 3 &&
+                            a->get_eapol_replay_counter() == r->get_eapol_replay_counter() + 1) {
+                        anonce = a->get_eapol_nonce_bytes();
+                        pair = "02";
+                    }
+                }
+            }
+
+            if (anonce.length() == 0)
+                continue;
+
+            auto eapol = handshake_eapol_frame(r->get_eapol_packet()->get_data()->get());
+
+            if (eapol.length() < eapol_min_len)
+                continue;
+
+            auto mic = eapol.substr(eapol_mic_offset, eapol_mic_len);
+
+            if (!written.insert(mic).second)
+                continue;
+
+            // The MIC is computed over the frame with the MIC zeroed
+            eapol.replace(eapol_mic_offset, eapol_mic_len, eapol_mic_len, '\0');
+
+            stream << fmt::format("WPA*02*{}*{}*{}*{}*{}*{}*{}\n", hex(mic), ap, sta, essid,
+                    hex(anonce), hex(eapol), pair);
+        }
+    }
+
+    return std::make_shared<std::string>(stream.str());
+}
+
+void kis_80211_phy::generate_handshake_pcap(std::shared_ptr<kis_net_beast_httpd_connection> con,
+        std::shared_ptr<kis_tracked_device_base> dev,
+        std::shared_ptr<dot11_tracked_device> dot11dev,
+        mac_addr target_mac, std::string mode) {
+
+    std::shared_ptr<std::string> blob;
+
+    {
+        kis_lock_guard<kis_mutex> list_locker(devicetracker->get_devicelist_mutex(),
+                "phy80211 generate_handshake_pcap");
+
+        blob = cached_handshake_export(dev->get_key(), fmt::format("{}/{}", mode, target_mac),
+                [&]() { return encode_handshake_pcap(dot11dev, target_mac, mode); });
+    }
+
+    // The response is written without holding the device list
+    std::ostream stream(&con->response_stream());
+    stream.write(blob->data(), blob->length());
+}
+
+void kis_80211_phy::generate_handshake_bulk(std::shared_ptr<kis_net_beast_httpd_connection> con,
+        const std::string& format) {
+    std::vector<std::shared_ptr<kis_tracked_device_base>> devices;
+
+    // A list of BSSID device keys can be posted, otherwise every device with a handshake
+    // is exported
+    const auto& keys = con->json()["devices"];
+
+    if (keys.is_array()) {
+        for (const auto& k : keys) {
+            auto key = string_to_n<device_key>(k.get<std::string>());
+
+            if (key.get_error())
+                throw std::runtime_error("invalid device key");
+
+            auto dev = devicetracker->fetch_device(key);
+
+            if (dev != nullptr)
+                devices.push_back(dev);
+        }
+    } else {
+        auto worker = device_tracker_view_function_worker([this](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
+                auto dot11 = dev->get_sub_as<dot11_tracked_device>(dot11_device_entry_id);
+
+                if (dot11 == nullptr)
+                    return false;
+
+                return dot11->get_pmkid_present() ||
+                    (dot11->has_wpa_key_map() && dot11->get_wpa_key_map()->size() > 0);
+            });
+
+        for (const auto& d : *devicetracker->do_readonly_device_work(worker))
+            devices.push_back(std::static_pointer_cast<kis_tracked_device_base>(d));
+    }
+
+    con->clear_timeout();
+    con->set_target_file(fmt::format("kismet-handshakes.{}", format));
+
+    std::ostream stream(&con->response_stream());
+
+    if (format == "pcapng")
+        pcapng_header(stream);
+
+    for (const auto& dev : devices) {
+        std::shared_ptr<std::string> blob;
+
+        {
+            kis_lock_guard<kis_mutex> list_locker(devicetracker->get_devicelist_mutex(),
+                    "phy80211 generate_handshake_bulk");
+
+            auto dot11 = dev->get_sub_as<dot11_tracked_device>(dot11_device_entry_id);
+
+            if (dot11 == nullptr)
+                continue;
+
+            blob = cached_handshake_export(dev->get_key(), format, [&]() {
+                    if (format == "pcapng")
+                        return encode_handshake_pcapng(dev, dot11);
+                    return encode_handshake_22000(dev, dot11);
+                });
+        }
+
+        stream.write(blob->data(), blob->length());
+
+        if (!stream)
+            break;
+    }
+}
+
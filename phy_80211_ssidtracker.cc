@@ -26,7 +26,12 @@
 
 dot11_tracked_ssid_group::dot11_tracked_ssid_group(const dot11_tracked_ssid_group *p, const std::string& in_ssid, unsigned int in_ssid_len,
         unsigned int in_crypt_set) :
-    tracker_component(p) {
+    tracker_component(p),
+    first_time_a{0},
+    last_time_a{0},
+    last_advertising{0},
+    last_responding{0},
+    last_probing{0} {
         mutex.set_name("dot11_tracked_ssid_group internal");
 
         __ImportField(ssid_hash, p);
@@ -85,42 +90,51 @@ void dot11_tracked_ssid_group::reserve_fields(std::shared_ptr<tracker_element_ma
 
 }
 
-void dot11_tracked_ssid_group::add_advertising_device(std::shared_ptr<kis_tracked_device_base> device) {
-    kis_lock_guard<kis_mutex> lk(mutex);
-    advertising_device_map->insert(device->get_key(), nullptr);
+void dot11_tracked_ssid_group::update_times(time_t device_first, time_t device_last) {
+    auto ft = first_time_a.load(std::memory_order_relaxed);
+
+    while ((ft == 0 || device_first < ft) &&
+            !first_time_a.compare_exchange_weak(ft, device_first, std::memory_order_relaxed))
+        ;
 
-    if (device->get_first_time() < get_first_time() || get_first_time() == 0)
-        set_first_time(device->get_first_time());
+    auto lt = last_time_a.load(std::memory_order_relaxed);
 
-    if (device->get_last_time() > get_last_time())
-        set_last_time(device->get_last_time());
+    while (device_last > lt &&
+            !last_time_a.compare_exchange_weak(lt, device_last, std::memory_order_relaxed))
+        ;
 }
 
-void dot11_tracked_ssid_group::add_probing_device(std::shared_ptr<kis_tracked_device_base> device) {
-    kis_lock_guard<kis_mutex> lk(mutex);
-    probing_device_map->insert(device->get_key(), nullptr);
+void dot11_tracked_ssid_group::add_device(std::shared_ptr<kis_tracked_device_base>& device,
+        tracker_element_device_key_map *device_map, std::atomic<uint64_t>& last_device) {
+    auto key = device->get_key();
 
-    if (device->get_first_time() < get_first_time() || get_first_time() == 0)
-        set_first_time(device->get_first_time());
+    if (last_device.load(std::memory_order_relaxed) != key.get_dkey()) {
+        kis_lock_guard<kis_mutex> lk(mutex);
+        device_map->insert(key, nullptr);
+        last_device.store(key.get_dkey(), std::memory_order_relaxed);
+    }
 
-    if (device->get_last_time() > get_last_time())
-        set_last_time(device->get_last_time());
+    update_times(device->get_first_time(), device->get_last_time());
 }
 
-void dot11_tracked_ssid_group::add_responding_device(std::shared_ptr<kis_tracked_device_base> device) {
-    kis_lock_guard<kis_mutex> lk(mutex);
-    responding_device_map->insert(device->get_key(), nullptr);
+void dot11_tracked_ssid_group::add_advertising_device(std::shared_ptr<kis_tracked_device_base> device) {
+    add_device(device, advertising_device_map.get(), last_advertising);
+}
 
-    if (device->get_first_time() < get_first_time() || get_first_time() == 0)
-        set_first_time(device->get_first_time());
+void dot11_tracked_ssid_group::add_probing_device(std::shared_ptr<kis_tracked_device_base> device) {
+    add_device(device, probing_device_map.get(), last_probing);
+}
 
-    if (device->get_last_time() > get_last_time())
-        set_last_time(device->get_last_time());
+void dot11_tracked_ssid_group::add_responding_device(std::shared_ptr<kis_tracked_device_base> device) {
+    add_device(device, responding_device_map.get(), last_responding);
 }
 
 phy_80211_ssid_tracker::phy_80211_ssid_tracker() {
     mutex.set_name("phy_80211_ssid_tracker");
 
+    for (auto& sh : ssid_shards)
+        sh.mutex.set_name("phy_80211_ssid_tracker shard");
+
     auto timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
 
     cleanup_timer_id = -1;
@@ -170,7 +184,9 @@ void phy_80211_ssid_tracker::ssid_endpoint_handler(std::shared_ptr<kis_net_beast
     std::ostream stream(&con->response_stream());
 
     auto summary_vec = std::vector<SharedElementSummary>{};
-    auto rename_map = Globalreg::new_from_pool<tracker_element_serializer::rename_map>();
+
+    tracker_element_summary_arena arena;
+    auto rename_map = arena.make_rename_map();
 
     time_t timestamp_min = 0;
 
@@ -320,6 +336,9 @@ void phy_80211_ssid_tracker::ssid_endpoint_handler(std::shared_ptr<kis_net_beast
         total_sz_elem->set(next_work_vec->size());
     }
 
+    for (const auto& e : *next_work_vec)
+        static_cast<dot11_tracked_ssid_group *>(e.get())->sync_times();
+
     // If we have a time filter, apply that first, it's the fastest.
     if (timestamp_min > 0) {
         auto worker = 
@@ -410,17 +429,39 @@ void phy_80211_ssid_tracker::ssid_endpoint_handler(std::shared_ptr<kis_net_beast
 }
 
 std::shared_ptr<tracker_element> phy_80211_ssid_tracker::detail_endpoint_handler(std::shared_ptr<kis_net_beast_httpd_connection> con) {
-    kis_lock_guard<kis_mutex> lk(mutex, "phy_80211_ssid_tracker detail_endpoint_handler");
-
     auto h = string_to_n<size_t>(con->uri_params()[":hash"]);
-    auto k = ssid_map.find(h);
+    auto& shard = shard_for(h);
+
+    kis_lock_guard<kis_mutex> lk(shard.mutex, "phy_80211_ssid_tracker detail_endpoint_handler");
+
+    auto k = shard.ssid_map.find(h);
 
-    if (k == ssid_map.end())
+    if (k == shard.ssid_map.end())
         throw std::runtime_error("unknown ssid");
 
     return k->second;
 }
 
+std::shared_ptr<dot11_tracked_ssid_group> phy_80211_ssid_tracker::fetch_group(const std::string& ssid, 
+        unsigned int ssid_len, uint64_t crypt_set) {
+    auto key = kis_80211_phy::ssid_hash(ssid, ssid_len);
+    auto& shard = shard_for(key);
+
+    kis_lock_guard<kis_mutex> lk(shard.mutex, "phy_80211_ssid_tracker fetch_group");
+
+    auto mapdev = shard.ssid_map.find(key);
+
+    if (mapdev != shard.ssid_map.end())
+        return mapdev->second;
+
+    auto tssid = std::make_shared<dot11_tracked_ssid_group>(group_builder.get(), ssid, ssid_len, crypt_set);
+    shard.ssid_map[key] = tssid;
+
+    kis_lock_guard<kis_mutex> vlk(mutex, "phy_80211_ssid_tracker fetch_group vector");
+    ssid_vector->push_back(tssid);
+
+    return tssid;
+}
 
 void phy_80211_ssid_tracker::handle_broadcast_ssid(const std::string& ssid, unsigned int ssid_len, 
         uint64_t crypt_set, std::shared_ptr<kis_tracked_device_base> device) {
@@ -431,21 +472,7 @@ void phy_80211_ssid_tracker::handle_broadcast_ssid(const std::string& ssid, unsi
     if (ssid_len == 0)
         return;
 
-    auto key = kis_80211_phy::ssid_hash(ssid, ssid_len);
-
-    kis_lock_guard<kis_mutex> lk(mutex);
-
-    auto mapdev = ssid_map.find(key);
-
-    if (mapdev == ssid_map.end()) {
-        auto tssid = std::make_shared<dot11_tracked_ssid_group>(group_builder.get(), ssid, ssid_len, crypt_set);
-        tssid->add_advertising_device(device);
-        ssid_map[key] = tssid;
-        ssid_vector->push_back(tssid);
-    } else {
-        auto tssid = static_cast<dot11_tracked_ssid_group *>(mapdev->second.get());
-        tssid->add_advertising_device(device);
-    }
+    fetch_group(ssid, ssid_len, crypt_set)->add_advertising_device(device);
 }
 
 void phy_80211_ssid_tracker::handle_response_ssid(const std::string& ssid, unsigned int ssid_len, 
@@ -457,22 +484,7 @@ void phy_80211_ssid_tracker::handle_response_ssid(const std::string& ssid, unsig
     if (ssid_len == 0)
         return;
 
-    auto key = kis_80211_phy::ssid_hash(ssid, ssid_len);
-
-    kis_lock_guard<kis_mutex> lk(mutex);
-
-    auto mapdev = ssid_map.find(key);
-
-    if (mapdev == ssid_map.end()) {
-        auto tssid = std::make_shared<dot11_tracked_ssid_group>(group_builder.get(), ssid, ssid_len, crypt_set);
-        tssid->add_responding_device(device);
-        ssid_map[key] = tssid;
-        ssid_vector->push_back(tssid);
-    } else {
-        auto tssid = static_cast<dot11_tracked_ssid_group *>(mapdev->second.get());
-        tssid->add_responding_device(device);
-    }
-
+    fetch_group(ssid, ssid_len, crypt_set)->add_responding_device(device);
 }
 
 void phy_80211_ssid_tracker::handle_probe_ssid(const std::string& ssid, unsigned int ssid_len, 
@@ -484,21 +496,5 @@ void phy_80211_ssid_tracker::handle_probe_ssid(const std::string& ssid, unsigned
     if (ssid_len == 0)
         return;
 
-    auto key = kis_80211_phy::ssid_hash(ssid, ssid_len);
-
-    kis_lock_guard<kis_mutex> lk(mutex);
-
-    auto mapdev = ssid_map.find(key);
-
-    if (mapdev == ssid_map.end()) {
-        auto tssid = std::make_shared<dot11_tracked_ssid_group>(group_builder.get(), ssid, ssid_len, crypt_set);
-        tssid->add_probing_device(device);
-        ssid_map[key] = tssid;
-        ssid_vector->push_back(tssid);
-    } else {
-        auto tssid = static_cast<dot11_tracked_ssid_group *>(mapdev->second.get());
-        tssid->add_probing_device(device);
-    }
-
+    fetch_group(ssid, ssid_len, crypt_set)->add_probing_device(device);
 }
-
@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <array>
+#include <atomic>
 #include <functional>
 
 #include "devicetracker.h"
@@ -39,28 +41,48 @@
 class dot11_tracked_ssid_group : public tracker_component {
 public:
     dot11_tracked_ssid_group() :
-        tracker_component() {
+        tracker_component(),
+        first_time_a{0},
+        last_time_a{0},
+        last_advertising{0},
+        last_responding{0},
+        last_probing{0} {
         mutex.set_name("dot11_tracked_ssid_group internal");
         register_fields();
         reserve_fields(NULL);
     }
 
     dot11_tracked_ssid_group(int in_id) : 
-        tracker_component(in_id) { 
+        tracker_component(in_id),
+        first_time_a{0},
+        last_time_a{0},
+        last_advertising{0},
+        last_responding{0},
+        last_probing{0} { 
         mutex.set_name("dot11_tracked_ssid_group internal");
         register_fields();
         reserve_fields(NULL);
     } 
 
     dot11_tracked_ssid_group(int in_id, std::shared_ptr<tracker_element_map> e) : 
-        tracker_component(in_id) {
+        tracker_component(in_id),
+        first_time_a{0},
+        last_time_a{0},
+        last_advertising{0},
+        last_responding{0},
+        last_probing{0} {
         mutex.set_name("dot11_tracked_ssid_group internal");
         register_fields();
         reserve_fields(e);
     }
 
     dot11_tracked_ssid_group(const dot11_tracked_ssid_group* p) :
-        tracker_component(p) {
+        tracker_component(p),
+        first_time_a{0},
+        last_time_a{0},
+        last_advertising{0},
+        last_responding{0},
+        last_probing{0} {
 
         __ImportField(ssid_hash, p);
         __ImportField(ssid, p);
@@ -95,7 +117,7 @@ public:
     }
 
     __Proxy(ssid_hash, uint64_t, uint64_t, uint64_t, ssid_hash);
-    __Proxy(ssid, std::string, std::string, std::string, ssid);
+    __ProxyInterned(ssid, ssid);
     __Proxy(ssid_len, uint32_t, uint32_t, uint32_t, ssid_len);
     __Proxy(crypt_set, uint64_t, uint64_t, uint64_t, crypt_set);
 
@@ -110,10 +132,21 @@ public:
     void add_probing_device(std::shared_ptr<kis_tracked_device_base> device);
     void add_responding_device(std::shared_ptr<kis_tracked_device_base> device);
 
+    // The first and last times are kept in atomics as devices are added, and copied
+    // to the tracked fields when they're needed for filtering, sorting, or output
+    void sync_times() {
+        kis_lock_guard<kis_mutex> lk(mutex);
+        set_first_time(first_time_a);
+        set_last_time(last_time_a);
+    }
+
     virtual void pre_serialize() override {
         // We have to protect our maps so we lock around them
         mutex.lock();
 
+        set_first_time(first_time_a);
+        set_last_time(last_time_a);
+
         set_advertising_device_len(advertising_device_map->size());
         set_probing_device_len(probing_device_map->size());
         set_responding_device_len(responding_device_map->size());
@@ -126,6 +159,22 @@ public:
 protected:
     kis_mutex mutex;
 
+    // Add a device to one of the device sets; the same device is almost always added
+    // again (every beacon from an AP), so the last device added to each set is kept and
+    // a repeat only updates the times, without taking the lock.  Every device here is
+    // from the 802.11 phy, so the device part of the key alone identifies it.
+    void add_device(std::shared_ptr<kis_tracked_device_base>& device,
+            tracker_element_device_key_map *device_map, std::atomic<uint64_t>& last_device);
+
+    void update_times(time_t device_first, time_t device_last);
+
+    std::atomic<time_t> first_time_a;
+    std::atomic<time_t> last_time_a;
+
+    std::atomic<uint64_t> last_advertising;
+    std::atomic<uint64_t> last_responding;
+    std::atomic<uint64_t> last_probing;
+
     virtual void register_fields() override;
     virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override;
 
@@ -176,9 +225,29 @@ public:
             std::shared_ptr<kis_tracked_device_base> device);
 
 protected:
+    // Protects the ssid vector; groups are found through the shards, which each have
+    // their own lock, so only creating a group touches this
     kis_mutex mutex;
 
-    robin_hood::unordered_node_map<size_t, std::shared_ptr<dot11_tracked_ssid_group>> ssid_map;
+    // SSID groups are split across shards by hash so that beacons and probes for
+    // different SSIDs don't contend for the same lock
+    static constexpr size_t n_ssid_shards = 16;
+
+    struct ssid_shard {
+        kis_mutex mutex;
+        robin_hood::unordered_node_map<size_t, std::shared_ptr<dot11_tracked_ssid_group>> ssid_map;
+    };
+
+    std::array<ssid_shard, n_ssid_shards> ssid_shards;
+
+    ssid_shard& shard_for(size_t key) {
+        return ssid_shards[key % n_ssid_shards];
+    }
+
+    // Find or create the group for an SSID
+    std::shared_ptr<dot11_tracked_ssid_group> fetch_group(const std::string& ssid, 
+            unsigned int ssid_len, uint64_t crypt_set);
+
     std::shared_ptr<tracker_element_vector> ssid_vector;
 
     int tracked_ssid_id;
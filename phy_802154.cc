@@ -43,9 +43,6 @@
 #define ACK_802154      0x02
 #define CMD_802154      0x03
 
-uint8_t chan = 0;
-uint8_t sigstr = 0;
-
 // 802.15.4 header
 struct _802_15_4_fcf {
     unsigned char type : 3;
@@ -61,14 +58,6 @@ struct _802_15_4_fcf {
     unsigned char src_addr_mode : 2;
 };
 
-uint8_t dest[2] = {0x00, 0x00};
-uint8_t dest_pan[2] = {0x00, 0x00};
-uint8_t src[2] = {0x00, 0x00};
-uint8_t src_pan[2] = {0x00, 0x00};
-
-uint8_t ext_dest[8];
-uint8_t ext_source[8];
-
 kis_802154_phy::kis_802154_phy(int in_phyid) :
     kis_phy_handler(in_phyid) {
 
@@ -111,11 +100,20 @@ int kis_802154_phy::dissector802154(CHAINCALL_PARMS) {
         return 1;
 
     auto packdata = in_pack->fetch<kis_datachunk>(mphy->pack_comp_linkframe);
-    _802_15_4_tap *tap_header = nullptr;
 
     unsigned short fcf = 0;
     auto hdr_802_15_4_fcf = reinterpret_cast<_802_15_4_fcf *>(&fcf);
 
+    // Addresses of this frame; the dissector runs on several packet threads at once,
+    // so nothing about the frame can be kept outside of it
+    uint8_t dest[2] = {0x00, 0x00};
+    uint8_t dest_pan[2] = {0x00, 0x00};
+    uint8_t src[2] = {0x00, 0x00};
+    uint8_t src_pan[2] = {0x00, 0x00};
+
+    uint8_t ext_dest[8];
+    uint8_t ext_source[8];
+
     if (packdata == NULL)
         return 0;
 
@@ -138,17 +136,8 @@ int kis_802154_phy::dissector802154(CHAINCALL_PARMS) {
 
     unsigned int pkt_ctr = 0;
     if (packdata->dlt == KDLT_IEEE802_15_4_TAP) {
-        uint64_t tap_header_size = sizeof(_802_15_4_tap);
-        uint8_t tmp_header[32];
-        memset(tmp_header, 0x00, 32);
-        memcpy(tmp_header, &packdata->data()[pkt_ctr], tap_header_size);
-        tap_header = (_802_15_4_tap *) &tmp_header;
-
-        // Really we are going to want to iterate through them to pull them
-        // correctly.
-        chan = kis_letoh32(tap_header->tlv[2].value);
-        sigstr = kis_letoh32(tap_header->tlv[1].value);
-        pkt_ctr += tap_header_size;
+        // Skip the TAP header; the channel and signal are already in the radio data
+        pkt_ctr += sizeof(_802_15_4_tap);
     }
 
     // Are we more than just a header?
@@ -372,6 +361,14 @@ int kis_802154_phy::dissector802154(CHAINCALL_PARMS) {
             common->dest = mac_addr(dest, 2);
         }
 
+        // The PAN is the network the frame belongs to
+        if (hdr_802_15_4_fcf->dest_addr_mode >= 0x02)
+            common->network = mac_addr(dest_pan, 2);
+        else if (!hdr_802_15_4_fcf->pan_id_comp)
+            common->network = mac_addr(src_pan, 2);
+
+        common->transmitter = common->source;
+
         in_pack->insert(mphy->pack_comp_common, common);
     }
 
@@ -401,57 +398,72 @@ int kis_802154_phy::commonclassifier802154(CHAINCALL_PARMS) {
     if (common == NULL)
         return 0;
 
+    // Frames only carry the addressing modes they need (acks and many mesh data
+    // frames have only one address); don't make devices for addresses which aren't
+    // in the frame
+    bool has_source = common->source.longmac != 0;
+    bool has_dest = common->dest.longmac != 0;
+
     if (in_pack->duplicate) {
-        auto source_dev = mphy->devicetracker->update_common_device(common,
-                common->source, mphy, in_pack,
-                (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES | 
-                 UCD_UPDATE_LOCATION | UCD_UPDATE_SEENBY),
-                "802.15.4");
+        if (has_source)
+            mphy->devicetracker->update_common_device(common,
+                    common->source, mphy, in_pack,
+                    (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES | 
+                     UCD_UPDATE_LOCATION | UCD_UPDATE_SEENBY),
+                    "802.15.4");
+
+        return 1;
     }
 
     // as source
     // Update with all the options in case we can add signal and frequency
     // in the future
-    auto source_dev = mphy->devicetracker->update_common_device(common,
-        common->source, mphy, in_pack,
-        (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS |
-            UCD_UPDATE_LOCATION | UCD_UPDATE_SEENBY | UCD_UPDATE_ENCRYPTION),
-        "802.15.4");
-
-    auto source_kis_802154 = source_dev->get_sub_as<kis_802154_tracked_device>(
-        mphy->kis_802154_device_entry_id);
-
-    if (source_kis_802154 == NULL) {
-        _MSG_INFO(
-            "Detected new 802.15.4 device {}", common->source.mac_to_string());
-        source_kis_802154 = std::make_shared<kis_802154_tracked_device>(
-            mphy->kis_802154_device_entry_id);
-        source_dev->insert(source_kis_802154);
+    if (has_source) {
+        auto source_dev = mphy->devicetracker->update_common_device(common,
+            common->source, mphy, in_pack,
+            (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS |
+                UCD_UPDATE_LOCATION | UCD_UPDATE_SEENBY | UCD_UPDATE_ENCRYPTION),
+            "802.15.4");
+
+        mphy->add_802154_record(source_dev, common->source);
     }
 
-    // as destination
-    // Update with all the options in case we can add signal and frequency
-    // in the future
-    auto dest_dev = mphy->devicetracker->update_common_device(common,
-        common->dest, mphy, in_pack,
-        (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS |
-            UCD_UPDATE_LOCATION | UCD_UPDATE_SEENBY | UCD_UPDATE_ENCRYPTION),
-        "802.15.4");
-
-    auto dest_kis_802154 = dest_dev->get_sub_as<kis_802154_tracked_device>(
-        mphy->kis_802154_device_entry_id);
-
-    if (dest_kis_802154 == NULL) {
-        _MSG_INFO(
-            "Detected new 802.15.4 device {}", common->dest.mac_to_string());
-        dest_kis_802154 = std::make_shared<kis_802154_tracked_device>(
-            mphy->kis_802154_device_entry_id);
-        dest_dev->insert(dest_kis_802154);
+    // as destination; the signal and location are the transmitter's, so only the
+    // packets and who saw them count for the destination
+    if (has_dest) {
+        auto dest_dev = mphy->devicetracker->update_common_device(common,
+            common->dest, mphy, in_pack,
+            (UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS | UCD_UPDATE_SEENBY),
+            "802.15.4");
+
+        mphy->add_802154_record(dest_dev, common->dest);
     }
 
     return 1;
 }
 
+void kis_802154_phy::add_802154_record(std::shared_ptr<kis_tracked_device_base> device,
+        const mac_addr& addr) {
+    if (device == nullptr)
+        return;
+
+    auto dev_802154 = device->get_sub_as<kis_802154_tracked_device>(
+        kis_802154_device_entry_id);
+
+    if (dev_802154 != nullptr)
+        return;
+
+    dev_802154 = std::make_shared<kis_802154_tracked_device>(kis_802154_device_entry_id);
+
+    {
+        kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(),
+                "802154 add_802154_record");
+        device->insert(dev_802154);
+    }
+
+    _MSG_INFO("Detected new 802.15.4 device {}", addr);
+}
+
 void kis_802154_phy::load_phy_storage(
     shared_tracker_element in_storage, shared_tracker_element in_device) {
     if (in_storage == nullptr || in_device == nullptr)
@@ -114,6 +114,10 @@ public:
 
 
 protected:
+    // Add the 802.15.4 record to a device the first time we see it
+    void add_802154_record(std::shared_ptr<kis_tracked_device_base> device,
+            const mac_addr& addr);
+
     std::shared_ptr<packet_chain> packetchain;
     std::shared_ptr<entry_tracker> entrytracker;
     std::shared_ptr<device_tracker> devicetracker;
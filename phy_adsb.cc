@@ -53,6 +53,8 @@ kis_adsb_phy::kis_adsb_phy(int in_phyid) :
         packetchain->register_packet_component("GPS");
     pack_comp_datasource =
         packetchain->register_packet_component("KISDATASRC");
+    pack_comp_adsb =
+        packetchain->register_packet_component("ADSB");
 
     adsb_adsb_id =
         Globalreg::globalreg->entrytracker->register_field("adsb.device",
@@ -165,19 +167,25 @@ kis_adsb_phy::kis_adsb_phy(int in_phyid) :
                                                 return;
                                             }
 
-                                            // Proxy input
+                                            // Proxy input is decoded natively
+                                            auto frame = hex_to_bytes(bufstr.substr(1, bufstr.length() - 3));
+
+                                            if (frame.length() != ADSB_MODES_SHORT_LEN &&
+                                                    frame.length() != ADSB_MODES_LONG_LEN) {
+                                                _MSG_DEBUG("Invalid adsb proxy {}", bufstr);
+                                                return;
+                                            }
+
                                             auto packet = packetchain->generate_packet();
                                             gettimeofday(&(packet->ts), NULL);
 
-                                            auto jsoninfo = std::make_shared<kis_json_packinfo>();
+                                            auto adsbinfo = std::make_shared<kis_adsb_packinfo>();
 
-                                            jsoninfo->type = "adsb";
+                                            adsbinfo->set_frame(reinterpret_cast<const uint8_t *>(frame.data()), 
+                                                    frame.length());
+                                            adsb_modes_decode(adsbinfo->frame, adsbinfo->len, adsbinfo->msg);
 
-                                            jsoninfo->json_string = 
-                                                fmt::format("{{\"adsb_raw_msg\": \"{}\"}}",
-                                                        bufstr.substr(1, bufstr.length() - 3));
-
-                                            packet->insert(pack_comp_json, jsoninfo);
+                                            packet->insert(pack_comp_adsb, adsbinfo);
 
                                             virtual_source->handle_rx_packet(packet);
 
@@ -219,21 +227,13 @@ kis_adsb_phy::kis_adsb_phy(int in_phyid) :
                             if (in_pack->error || in_pack->filtered || in_pack->duplicate)
                                 return 0;
 
-                            auto json = in_pack->fetch<kis_json_packinfo>(pack_comp_json);
-                            
-                            if (json == NULL)
-                                return 0;
+                            std::string raw_hex;
 
-                            if (json->type != "adsb")
+                            if (!packet_raw_msg(in_pack, raw_hex))
                                 return 0;
 
-                            std::stringstream ss(json->json_string);
-                            nlohmann::json device_json;
-
                             try {
-                                ss >> device_json;
-
-                                auto adsb_content = hex_to_bytes(device_json["adsb_raw_msg"]);
+                                auto adsb_content = hex_to_bytes(raw_hex);
 
                                 if (adsb_content.size() != 7 && adsb_content.size() != 14) {
                                     _MSG_DEBUG("unexpected content length {}", adsb_content.size());
@@ -304,24 +304,13 @@ kis_adsb_phy::kis_adsb_phy(int in_phyid) :
                             if (in_pack->error || in_pack->filtered || in_pack->duplicate)
                                 return 0;
 
-                            auto json = in_pack->fetch<kis_json_packinfo>(pack_comp_json);
-                            
-                            if (json == NULL)
-                                return 0;
+                            std::string raw_hex;
 
-                            if (json->type != "adsb")
+                            if (!packet_raw_msg(in_pack, raw_hex))
                                 return 0;
 
-                            std::stringstream ss(json->json_string);
-                            nlohmann::json device_json;
-
                             try {
-                                ss >> device_json;
-
-                                auto adsb_content = 
-                                    fmt::format("*{};\n", device_json["adsb_raw_msg"].get<std::string>());
-
-                                ws->write(adsb_content);
+                                ws->write(fmt::format("*{};\n", raw_hex));
                             } catch (std::exception& e) {
                                 return 0;
                             }
@@ -365,14 +354,6 @@ kis_adsb_phy::kis_adsb_phy(int in_phyid) :
                             if (in_pack->error || in_pack->filtered || in_pack->duplicate)
                                 return 0;
 
-                            auto json = in_pack->fetch<kis_json_packinfo>(pack_comp_json);
-                            
-                            if (json == nullptr)
-                                return 0;
-
-                            if (json->type != "adsb")
-                                return 0;
-
                             auto src = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasource);
 
                             if (src == nullptr)
@@ -381,16 +362,13 @@ kis_adsb_phy::kis_adsb_phy(int in_phyid) :
                             if (src->ref_source->get_source_uuid() != srcuuid)
                                 return 0;
 
-                            std::stringstream ss(json->json_string);
-                            nlohmann::json device_json;
+                            std::string raw_hex;
 
-                            try {
-                                ss >> device_json;
-
-                                auto adsb_content = 
-                                    fmt::format("*{};\n", device_json["adsb_raw_msg"].get<std::string>());
+                            if (!packet_raw_msg(in_pack, raw_hex))
+                                return 0;
 
-                                ws->write(adsb_content);
+                            try {
+                                ws->write(fmt::format("*{};\n", raw_hex));
                             } catch (std::exception& e) {
                                 return 0;
                             }
@@ -416,7 +394,7 @@ kis_adsb_phy::~kis_adsb_phy() {
     packetchain->remove_handler(&packet_handler, CHAINPOS_CLASSIFIER);
 }
 
-mac_addr kis_adsb_phy::json_to_mac(nlohmann::json json) {
+mac_addr kis_adsb_phy::json_to_mac(const nlohmann::json& json) {
     // Derive a mac addr from the model and device id data
     //
     // We turn the model string into 4 bytes using the adler32 checksum,
@@ -424,6 +402,16 @@ mac_addr kis_adsb_phy::json_to_mac(nlohmann::json json) {
     //
     // Finally we set the locally assigned bit on the first octet
     
+    std::string smodel = "unk";
+
+    try {
+        smodel = json_field(json, "icao");
+    } catch (...) { }
+
+    return icao_to_mac(smodel);
+}
+
+mac_addr kis_adsb_phy::icao_to_mac(const std::string& smodel) {
     uint8_t bytes[6];
     uint16_t *model = (uint16_t *) bytes;
     uint32_t *checksum = (uint32_t *) (bytes + 2);
@@ -432,10 +420,7 @@ mac_addr kis_adsb_phy::json_to_mac(nlohmann::json json) {
 
     bool set_model = false;
 
-    std::string smodel = "unk";
-
     try {
-        smodel = json["icao"];
         *model = kis_hton16(std::stoi(smodel, 0, 16));
         set_model = true;
     } catch (...) { }
@@ -452,11 +437,11 @@ mac_addr kis_adsb_phy::json_to_mac(nlohmann::json json) {
     return mac_addr(bytes, 6);
 }
 
-bool kis_adsb_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet> packet) {
+bool kis_adsb_phy::json_to_rtl(const nlohmann::json& json, std::shared_ptr<kis_packet> packet) {
     std::string err;
     std::string v;
 
-    auto crc_j = json["crc_valid"];
+    auto crc_j = json_field(json, "crc_valid");
     if (crc_j.is_boolean() && crc_j == false)
         return false;
 
@@ -473,7 +458,7 @@ bool kis_adsb_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet>
     common->phyid = fetch_phy_id();
     common->datasize = 0;
 
-    auto channel_j = json["channel"];
+    auto channel_j = json_field(json, "channel");
     if (channel_j.is_string())
         common->channel = channel_j;
     else if (channel_j.is_number())
@@ -496,7 +481,7 @@ bool kis_adsb_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet>
     std::string dn = "Airplane";
 
     try {
-        dn = json["icao"];
+        dn = json_field(json, "icao");
     } catch (...) { }
 
     basedev->set_manuf(rtl_manuf);
@@ -512,6 +497,54 @@ bool kis_adsb_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet>
     if (adsbdev == nullptr)
         return false;
 
+    update_adsb_device(basedev, adsbdev, common, packet);
+
+    return true;
+}
+
+bool kis_adsb_phy::modes_to_rtl(const adsb_modes_message& msg, std::shared_ptr<kis_packet> packet) {
+    if (!msg.crc_valid)
+        return false;
+
+    // Same form as the JSON records, so devices keep their keys whichever way they're seen
+    auto icao = fmt::format("{:06x}", msg.icao);
+
+    mac_addr rtlmac = icao_to_mac(icao);
+
+    if (rtlmac.state.error)
+        return false;
+
+    auto common = packet->fetch_or_add<kis_common_info>(pack_comp_common);
+
+    common->type = packet_basic_data;
+    common->phyid = fetch_phy_id();
+    common->datasize = 0;
+    common->freq_khz = 1090000;
+    common->source = rtlmac;
+    common->transmitter = rtlmac;
+
+    std::shared_ptr<kis_tracked_device_base> basedev =
+        devicetracker->update_common_device(common, common->source, this, packet,
+                (UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS |
+                 UCD_UPDATE_SEENBY), "ADSB");
+
+    kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), "adsb_modes_to_rtl");
+
+    basedev->set_manuf(rtl_manuf);
+
+    basedev->set_tracker_type_string(devicetracker->get_cached_devicetype("Airplane"));
+    basedev->set_devicename(fmt::format("ADSB {}", icao));
+
+    auto adsbdev = add_adsb_modes(packet, icao, msg, basedev);
+
+    update_adsb_device(basedev, adsbdev, common, packet);
+
+    return true;
+}
+
+void kis_adsb_phy::update_adsb_device(std::shared_ptr<kis_tracked_device_base> basedev,
+        std::shared_ptr<adsb_tracked_adsb> adsbdev, std::shared_ptr<kis_common_info> common,
+        std::shared_ptr<kis_packet> packet) {
     auto icao = adsbdev->get_icao_record();
 
     if (icao != icaodb->get_unknown_icao()) {
@@ -583,14 +616,12 @@ bool kis_adsb_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet>
         devicetracker->update_common_device(common, common->source, this, packet,
                 (UCD_UPDATE_LOCATION), "ADSB Transmitter");
     }
-
-    return true;
 }
 
-bool kis_adsb_phy::is_adsb(nlohmann::json json) {
+bool kis_adsb_phy::is_adsb(const nlohmann::json& json) {
 
     //fprintf(stderr, "ADSB: checking to see if it is a adsb\n");
-    auto icao_j = json["icao"];
+    auto icao_j = json_field(json, "icao");
 
     if (!icao_j.is_null()) {
         return true;
@@ -600,31 +631,17 @@ bool kis_adsb_phy::is_adsb(nlohmann::json json) {
 }
 
 std::shared_ptr<adsb_tracked_adsb> kis_adsb_phy::add_adsb(std::shared_ptr<kis_packet> packet,
-        nlohmann::json json, std::shared_ptr<kis_tracked_device_base> rtlholder) {
+        const nlohmann::json& json, std::shared_ptr<kis_tracked_device_base> rtlholder) {
 
-    auto icao_j = json["icao"];
-    bool new_adsb = false;
+    auto icao_j = json_field(json, "icao");
     std::stringstream new_ss;
 
     if (!icao_j.is_null()) {
-        auto adsbdev = 
-            rtlholder->get_sub_as<adsb_tracked_adsb>(adsb_adsb_id);
+        auto adsbdev = fetch_adsb(icao_j.get<std::string>(), rtlholder, new_ss);
+        bool new_adsb = new_ss.tellp() > 0;
+        auto icao_record = adsbdev->get_icao_record();
 
-        if (adsbdev == NULL) {
-            adsbdev = 
-                std::make_shared<adsb_tracked_adsb>(adsb_adsb_id);
-            rtlholder->insert(adsbdev);
-            new_adsb = true;
-
-            new_ss << "Detected new ADSB device ICAO " << icao_j;
-        }
-
-        adsbdev->set_icao(icao_j);
-
-        auto icao_record = icaodb->lookup_icao(icao_j.get<std::string>());
-        adsbdev->set_icao_record(icao_record);
-
-        auto callsign_j = json["callsign"];
+        auto callsign_j = json_field(json, "callsign");
         if (callsign_j.is_string()) {
             auto raw_cs = callsign_j.get<std::string>();
 
@@ -648,55 +665,35 @@ std::shared_ptr<adsb_tracked_adsb> kis_adsb_phy::add_adsb(std::shared_ptr<kis_pa
             new_ss << " " << icao_record->get_atype()->get();
         }
 
-        auto altitude_j = json["altitude"];
+        auto altitude_j = json_field(json, "altitude");
         if (altitude_j.is_number()) {
             adsbdev->alt = altitude_j.get<double>() * 0.3048;
             adsbdev->update_location = true;
         }
 
-        auto speed_j = json["speed"];
+        auto speed_j = json_field(json, "speed");
         if (speed_j.is_number()) {
             adsbdev->speed = speed_j.get<double>() * 1.60934;
             adsbdev->update_location = true;
         }
 
-        auto heading_j = json["heading"];
+        auto heading_j = json_field(json, "heading");
         if (heading_j.is_number()) {
             adsbdev->heading = heading_j.get<double>();
             adsbdev->update_location = true;
         }
 
-        auto gsas_j = json["gsas"];
+        auto gsas_j = json_field(json, "gsas");
         if (gsas_j.is_string()) {
             adsbdev->set_gsas(gsas_j);
         }
 
         try {
-            auto raw_lat = json["raw_lat"].get<double>();
-            auto raw_lon = json["raw_lon"].get<double>();
-            auto raw_even = json["coordpair_even"].get<bool>();
-            bool calc_coords = false;
-
-            if (raw_even) {
-                adsbdev->set_even_raw_lat(raw_lat);
-                adsbdev->set_even_raw_lon(raw_lon);
-                adsbdev->set_even_ts(time(0));
-
-                if (adsbdev->get_even_ts() - adsbdev->get_odd_ts() < 10)
-                    calc_coords = true;
-
-            } else {
-                adsbdev->set_odd_raw_lat(raw_lat);
-                adsbdev->set_odd_raw_lon(raw_lon);
-                adsbdev->set_odd_ts(time(0));
-
-                if (adsbdev->get_odd_ts() - adsbdev->get_even_ts() < 10)
-                    calc_coords = true;
-            }
-
-            if (calc_coords)
-                decode_cpr(adsbdev, packet);
+            auto raw_lat = json_field(json, "raw_lat").get<double>();
+            auto raw_lon = json_field(json, "raw_lon").get<double>();
+            auto raw_even = json_field(json, "coordpair_even").get<bool>();
 
+            update_cpr(adsbdev, raw_lat, raw_lon, raw_even, packet);
         } catch (...) { }
 
         if (new_adsb) {
@@ -709,6 +706,129 @@ std::shared_ptr<adsb_tracked_adsb> kis_adsb_phy::add_adsb(std::shared_ptr<kis_pa
     return nullptr;
 }
 
+std::shared_ptr<adsb_tracked_adsb> kis_adsb_phy::add_adsb_modes(std::shared_ptr<kis_packet> packet,
+        const std::string& icao, const adsb_modes_message& msg,
+        std::shared_ptr<kis_tracked_device_base> rtlholder) {
+    std::stringstream new_ss;
+
+    auto adsbdev = fetch_adsb(icao, rtlholder, new_ss);
+    bool new_adsb = new_ss.tellp() > 0;
+    auto icao_record = adsbdev->get_icao_record();
+
+    if (msg.has_callsign) {
+        adsbdev->set_callsign(msg.callsign);
+        if (adsbdev->get_callsign() != "")
+            new_ss << adsbdev->get_callsign();
+    }
+
+    if (new_adsb && icao_record != icaodb->get_unknown_icao()) {
+        new_ss << " " << icao_record->get_model();
+        new_ss << " " << icao_record->get_model_type();
+        new_ss << " " << icao_record->get_owner();
+        new_ss << " " << icao_record->get_atype()->get();
+    }
+
+    // Same units as the JSON records
+    if (msg.has_altitude) {
+        adsbdev->alt = msg.altitude * 0.3048;
+        adsbdev->update_location = true;
+    }
+
+    if (msg.has_speed) {
+        adsbdev->speed = msg.speed * 1.60934;
+        adsbdev->update_location = true;
+    }
+
+    if (msg.has_heading) {
+        adsbdev->heading = msg.heading;
+        adsbdev->update_location = true;
+    }
+
+    if (msg.has_position)
+        update_cpr(adsbdev, msg.raw_lat, msg.raw_lon, !msg.cpr_odd, packet);
+
+    if (new_adsb) {
+        _MSG_INFO("{}", new_ss.str());
+    }
+
+    return adsbdev;
+}
+
+std::shared_ptr<adsb_tracked_adsb> kis_adsb_phy::fetch_adsb(const std::string& icao,
+        std::shared_ptr<kis_tracked_device_base> rtlholder, std::stringstream& new_ss) {
+    auto adsbdev = 
+        rtlholder->get_sub_as<adsb_tracked_adsb>(adsb_adsb_id);
+
+    if (adsbdev == nullptr) {
+        adsbdev = 
+            std::make_shared<adsb_tracked_adsb>(adsb_adsb_id);
+        rtlholder->insert(adsbdev);
+
+        new_ss << "Detected new ADSB device ICAO " << icao;
+    }
+
+    // Only look the record up when the ICAO is new to the device
+    if (adsbdev->get_icao() != icao) {
+        adsbdev->set_icao(icao);
+        adsbdev->set_icao_record(icaodb->lookup_icao(icao));
+    }
+
+    return adsbdev;
+}
+
+void kis_adsb_phy::update_cpr(std::shared_ptr<adsb_tracked_adsb> adsbdev, double raw_lat,
+        double raw_lon, bool even, std::shared_ptr<kis_packet> packet) {
+    bool calc_coords = false;
+
+    if (even) {
+        adsbdev->set_even_raw_lat(raw_lat);
+        adsbdev->set_even_raw_lon(raw_lon);
+        adsbdev->set_even_ts(time(0));
+
+        if (adsbdev->get_even_ts() - adsbdev->get_odd_ts() < 10)
+            calc_coords = true;
+
+    } else {
+        adsbdev->set_odd_raw_lat(raw_lat);
+        adsbdev->set_odd_raw_lon(raw_lon);
+        adsbdev->set_odd_ts(time(0));
+
+        if (adsbdev->get_odd_ts() - adsbdev->get_even_ts() < 10)
+            calc_coords = true;
+    }
+
+    if (calc_coords)
+        decode_cpr(adsbdev, packet);
+}
+
+bool kis_adsb_phy::packet_raw_msg(std::shared_ptr<kis_packet> packet, std::string& raw_hex) {
+    auto adsbinfo = packet->fetch<kis_adsb_packinfo>(pack_comp_adsb);
+
+    if (adsbinfo != nullptr) {
+        raw_hex = adsbinfo->frame_hex();
+        return true;
+    }
+
+    auto json = packet->fetch<kis_json_packinfo>(pack_comp_json);
+
+    if (json == nullptr || json->type != "adsb")
+        return false;
+
+    auto device_json = json->document();
+
+    if (device_json == nullptr)
+        return false;
+
+    const auto& raw_j = json_field(*device_json, "adsb_raw_msg");
+
+    if (!raw_j.is_string())
+        return false;
+
+    raw_hex = raw_j.get<std::string>();
+
+    return true;
+}
+
 int kis_adsb_phy::packet_handler(CHAINCALL_PARMS) {
     kis_adsb_phy *adsb = (kis_adsb_phy *) auxdata;
 
@@ -717,6 +837,18 @@ int kis_adsb_phy::packet_handler(CHAINCALL_PARMS) {
     if (in_pack->error || in_pack->filtered || in_pack->duplicate)
         return 0;
 
+    // Binary sources decode the frame themselves
+    auto adsbinfo = in_pack->fetch<kis_adsb_packinfo>(adsb->pack_comp_adsb);
+    if (adsbinfo != nullptr) {
+        if (adsb->modes_to_rtl(adsbinfo->msg, in_pack)) {
+            auto adata = in_pack->fetch_or_add<packet_metablob>(adsb->pack_comp_meta);
+            adata->set_data("ADSB", 
+                    fmt::format("{{\"adsb_raw_msg\": \"{}\"}}", adsbinfo->frame_hex()));
+        }
+
+        return 1;
+    }
+
     auto json = in_pack->fetch<kis_json_packinfo>(adsb->pack_comp_json);
     if (json == NULL)
         return 0;
@@ -727,14 +859,13 @@ int kis_adsb_phy::packet_handler(CHAINCALL_PARMS) {
     if (json->type != "adsb" && json->type != "RTLadsb")
         return 0;
 
-    std::stringstream ss(json->json_string);
-    nlohmann::json device_json;
+    auto device_json = json->document();
+    if (device_json == nullptr)
+        return 0;
 
     try {
-        ss >> device_json;
-
         // Copy the JSON as the meta field for logging, if it's valid
-        if (adsb->json_to_rtl(device_json, in_pack)) {
+        if (adsb->json_to_rtl(*device_json, in_pack)) {
              auto adata = in_pack->fetch_or_add<packet_metablob>(adsb->pack_comp_meta);
              adata->set_data("ADSB", json->json_string);
         }
@@ -761,69 +892,7 @@ int kis_adsb_phy::cpr_mod(int a, int b) {
 
 int kis_adsb_phy::cpr_nl(double lat) {
     // Precomputed table from 1090-WP-9-14
-    //
-    if (lat < 0) 
-        lat = -lat;
-
-    if (lat < 10.47047130) return 59;
-    if (lat < 14.82817437) return 58;
-    if (lat < 18.18626357) return 57;
-    if (lat < 21.02939493) return 56;
-    if (lat < 23.54504487) return 55;
-    if (lat < 25.82924707) return 54;
-    if (lat < 27.93898710) return 53;
-    if (lat < 29.91135686) return 52;
-    if (lat < 31.77209708) return 51;
-    if (lat < 33.53993436) return 50;
-    if (lat < 35.22899598) return 49;
-    if (lat < 36.85025108) return 48;
-    if (lat < 38.41241892) return 47;
-    if (lat < 39.92256684) return 46;
-    if (lat < 41.38651832) return 45;
-    if (lat < 42.80914012) return 44;
-    if (lat < 44.19454951) return 43;
-    if (lat < 45.54626723) return 42;
-    if (lat < 46.86733252) return 41;
-    if (lat < 48.16039128) return 40;
-    if (lat < 49.42776439) return 39;
-    if (lat < 50.67150166) return 38;
-    if (lat < 51.89342469) return 37;
-    if (lat < 53.09516153) return 36;
-    if (lat < 54.27817472) return 35;
-    if (lat < 55.44378444) return 34;
-    if (lat < 56.59318756) return 33;
-    if (lat < 57.72747354) return 32;
-    if (lat < 58.84763776) return 31;
-    if (lat < 59.95459277) return 30;
-    if (lat < 61.04917774) return 29;
-    if (lat < 62.13216659) return 28;
-    if (lat < 63.20427479) return 27;
-    if (lat < 64.26616523) return 26;
-    if (lat < 65.31845310) return 25;
-    if (lat < 66.36171008) return 24;
-    if (lat < 67.39646774) return 23;
-    if (lat < 68.42322022) return 22;
-    if (lat < 69.44242631) return 21;
-    if (lat < 70.45451075) return 20;
-    if (lat < 71.45986473) return 19;
-    if (lat < 72.45884545) return 18;
-    if (lat < 73.45177442) return 17;
-    if (lat < 74.43893416) return 16;
-    if (lat < 75.42056257) return 15;
-    if (lat < 76.39684391) return 14;
-    if (lat < 77.36789461) return 13;
-    if (lat < 78.33374083) return 12;
-    if (lat < 79.29428225) return 11;
-    if (lat < 80.24923213) return 10;
-    if (lat < 81.19801349) return 9;
-    if (lat < 82.13956981) return 8;
-    if (lat < 83.07199445) return 7;
-    if (lat < 83.99173563) return 6;
-    if (lat < 84.89166191) return 5;
-    if (lat < 85.75541621) return 4;
-    if (lat < 86.53536998) return 3;
-    if (lat < 87.00000000) return 2;
-    else return 1;
+    return adsb_cpr_nl(lat);
 }
 
 int kis_adsb_phy::cpr_n(double lat, int odd) {
@@ -951,19 +1020,18 @@ kis_adsb_phy::adsb_map_endp_handler(std::shared_ptr<kis_net_beast_httpd_connecti
             auto loc = dev->get_tracker_location();
 
             if (loc != nullptr) {
-                auto last_loc = loc->get_last_loc();
-
-                if (last_loc != nullptr && last_loc->get_lat() != 0 &&
-                        last_loc->get_lon() != 0) {
-                    if (last_loc->get_lat() < min_lat->get() || min_lat->get() == 0)
-                        min_lat->set(last_loc->get_lat());
-                    if (last_loc->get_lon() < min_lon->get() || min_lon->get() == 0)
-                        min_lon->set(last_loc->get_lon());
-
-                    if (last_loc->get_lat() > max_lat->get() || max_lat->get() == 0)
-                        max_lat->set(last_loc->get_lat());
-                    if (last_loc->get_lon() > max_lon->get() || max_lon->get() == 0)
-                        max_lon->set(last_loc->get_lon());
+                const auto& acc = loc->get_accumulator();
+
+                if (acc.num_loc > 0 && acc.last_lat != 0 && acc.last_lon != 0) {
+                    if (acc.last_lat < min_lat->get() || min_lat->get() == 0)
+                        min_lat->set(acc.last_lat);
+                    if (acc.last_lon < min_lon->get() || min_lon->get() == 0)
+                        min_lon->set(acc.last_lon);
+
+                    if (acc.last_lat > max_lat->get() || max_lat->get() == 0)
+                        max_lat->set(acc.last_lat);
+                    if (acc.last_lon > max_lon->get() || max_lon->get() == 0)
+                        max_lon->set(acc.last_lon);
                 }
             }
 
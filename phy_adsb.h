@@ -24,6 +24,7 @@
 
 
 #include "adsb_icao.h"
+#include "adsb_modes.h"
 #include "datasourcetracker.h"
 #include "devicetracker_component.h"
 #include "globalregistry.h"
@@ -157,16 +158,40 @@ protected:
     int pack_comp_gps;
 
     // Convert a JSON record to a RTL-based device key
-    mac_addr json_to_mac(nlohmann::json in_json);
+    mac_addr json_to_mac(const nlohmann::json& in_json);
+    mac_addr icao_to_mac(const std::string& in_icao);
 
     // convert to a device record & push into device tracker, return false
     // if we can't do anything with it
-    bool json_to_rtl(nlohmann::json in_json, std::shared_ptr<kis_packet> packet);
+    bool json_to_rtl(const nlohmann::json& in_json, std::shared_ptr<kis_packet> packet);
 
-    bool is_adsb(nlohmann::json json);
+    bool is_adsb(const nlohmann::json& json);
 
     std::shared_ptr<adsb_tracked_adsb> add_adsb(std::shared_ptr<kis_packet> packet, 
-            nlohmann::json json, std::shared_ptr<kis_tracked_device_base> rtlholder);
+            const nlohmann::json& json, std::shared_ptr<kis_tracked_device_base> rtlholder);
+
+    // Natively decoded Mode-S frames from binary sources
+    bool modes_to_rtl(const adsb_modes_message& msg, std::shared_ptr<kis_packet> packet);
+
+    std::shared_ptr<adsb_tracked_adsb> add_adsb_modes(std::shared_ptr<kis_packet> packet,
+            const std::string& icao, const adsb_modes_message& msg,
+            std::shared_ptr<kis_tracked_device_base> rtlholder);
+
+    // Find or create the adsb record of a device
+    std::shared_ptr<adsb_tracked_adsb> fetch_adsb(const std::string& icao,
+            std::shared_ptr<kis_tracked_device_base> rtlholder, std::stringstream& new_ss);
+
+    // Record half of a CPR position pair, and decode the position once we have both
+    void update_cpr(std::shared_ptr<adsb_tracked_adsb> adsbdev, double raw_lat, double raw_lon,
+            bool even, std::shared_ptr<kis_packet> packet);
+
+    // Set the type and name of the device from the ICAO record, and update the location
+    void update_adsb_device(std::shared_ptr<kis_tracked_device_base> basedev,
+            std::shared_ptr<adsb_tracked_adsb> adsbdev, std::shared_ptr<kis_common_info> common,
+            std::shared_ptr<kis_packet> packet);
+
+    // Raw message of an ADSB packet, from a binary source or a JSON record
+    bool packet_raw_msg(std::shared_ptr<kis_packet> packet, std::string& raw_hex);
 
     double f_to_c(double f);
 
@@ -182,7 +207,7 @@ protected:
 
     int adsb_adsb_id;
 
-    int pack_comp_common, pack_comp_json, pack_comp_meta, pack_comp_datasource;
+    int pack_comp_common, pack_comp_json, pack_comp_meta, pack_comp_datasource, pack_comp_adsb;
 
     std::shared_ptr<tracker_element_string> rtl_manuf;
 
@@ -132,11 +132,15 @@ int kis_bluetooth_phy::packet_bluetooth_scan_json_classifier(CHAINCALL_PARMS) {
 
     try {
         std::stringstream newdevstr;
-        std::stringstream ss(pack_json->json_string);
-        nlohmann::json json;
-        ss >> json;
+        // Parsed once, and already parsed when the report came in bulk
+        auto doc = pack_json->document();
 
-        auto btaddr_j = json["btaddr"];
+        if (doc == nullptr)
+            throw std::runtime_error("invalid JSON in scan report");
+
+        const auto& json = *doc;
+
+        auto btaddr_j = json.value("btaddr", nlohmann::json());
 
         if (btaddr_j.is_null()) 
             throw std::runtime_error("no btaddr in scan report");
@@ -169,22 +173,22 @@ int kis_bluetooth_phy::packet_bluetooth_scan_json_classifier(CHAINCALL_PARMS) {
                     "Bluetooth Device");
 
         // Mapped to base name
-        auto devname_j = json["name"]; 
+        auto devname_j = json.value("name", nlohmann::json()); 
 
         // Mapped to base type, a combination of android major/minor
-        auto devtype_j = json["devicetype"];
+        auto devtype_j = json.value("devicetype", nlohmann::json());
 
-        auto powerlevel_j = json["txpowerlevel"];
-        auto pathloss_j = json["pathloss"];
+        auto powerlevel_j = json.value("txpowerlevel", nlohmann::json());
+        auto pathloss_j = json.value("pathloss", nlohmann::json());
 
         // Mapped to base signal
-        auto signal_j = json["signal"];
+        auto signal_j = json.value("signal", nlohmann::json());
 
         // Scan bytes, hex string, optional
-        auto scan_bytes_j = json["scan_data"];
+        auto scan_bytes_j = json.value("scan_data", nlohmann::json());
 
         // Service data bytes, hex string, optional
-        auto service_bytes_map_j = json["service_data"];
+        auto service_bytes_map_j = json.value("service_data", nlohmann::json());
 
         if (devname_j.is_string())
             btdev->set_devicename(munge_to_printable(devname_j));
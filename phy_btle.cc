@@ -39,6 +39,8 @@
 #include "alertracker.h"
 
 #include "phy_btle.h"
+#include "xxhash.h"
+#include "xxhash_cpp.h"
 
 #include "kaitai/kaitaistream.h"
 #include "bluetooth_parsers/btle.h"
@@ -72,69 +74,82 @@ public:
 #define BTLE_ADVDATA_FLAG_SIMUL_BREDR_CONTROLLER    (1 << 3)
 #define BTLE_ADVDATA_FLAG_SIMUL_BREDR_HOST          (1 << 4)
 
+#define BTLE_ADVDATA_UUID16_INCOMPLETE          0x02
+#define BTLE_ADVDATA_UUID128_COMPLETE           0x07
+#define BTLE_ADVDATA_SHORT_NAME                 0x08
+#define BTLE_ADVDATA_APPEARANCE                 0x19
+#define BTLE_ADVDATA_SERVICE_DATA16             0x16
+#define BTLE_ADVDATA_MANUF_DATA                 0xFF
+
+// Slots in the per-thread cache of decoded advertisements
+#define BTLE_DECODE_CACHE_SLOTS                 256
+
+// Advertising channel CRC init, 0x555555, bit-reversed
+#define BTLE_CRC_INIT_ADV_REFLECTED     0xAAAAAA
+
+namespace {
+
+// CRC-24 polynomial x^24 + x^10 + x^9 + x^6 + x^4 + x^3 + x + 1, bit-reversed; the CRC
+// is shifted out LSB first, the same as the rest of the packet
+constexpr uint32_t btle_crc_poly_reflected = 0xDA6000;
+
+struct btle_crc_table {
+    constexpr btle_crc_table() : t{} {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+
+            for (unsigned int b = 0; b < 8; b++) {
+                if (c & 1)
+                    c = (c >> 1) ^ btle_crc_poly_reflected;
+                else
+                    c >>= 1;
+            }
+
+            t[i] = c;
+        }
+    }
+
+    uint32_t t[256];
+};
+
+constexpr btle_crc_table crc_table;
+
+// Reverse the order of all 24 bits
+uint32_t reflect24(uint32_t val) {
+    auto r = kis_btle_phy::reverse_bits(val);
+    return ((r & 0xFF) << 16) | (r & 0xFF00) | ((r >> 16) & 0xFF);
+}
+
+}
+
+uint32_t kis_btle_phy::calc_btle_crc_reflected(uint32_t crc_init_reflected, const char *data,
+        size_t len) {
+    uint32_t crc = crc_init_reflected;
+
+    for (size_t pos = 0; pos < len; pos++)
+        crc = (crc >> 8) ^ crc_table.t[(crc ^ (uint8_t) data[pos]) & 0xFF];
+
+    return crc;
+}
+
 /*
  * Implements Bluetooth Vol 6, Part B, Section 3.1.1 (ref Figure 3.2)
  *
- * At entry: tvb is entire BTLE packet without preamble
- *           payload_len is the Length field from the BTLE PDU header
+ * At entry: payload is the entire BTLE packet without preamble
+ *           len is the end of the PDU, the CRC covers the PDU after the 4 byte AA
  *           crc_init as defined in the specifications
  *
- * This implementation operates on nibbles and is therefore
- * endian-neutral.
- *
- * Taken from the Wireshark implementation
+ * Returns the CRC in the form of the Wireshark implementation; this is the reflected
+ * byte-wise CRC with the bit order converted on the way in and out.
  */
 uint32_t kis_btle_phy::calc_btle_crc(uint32_t crc_init, const char *payload, size_t len) {
-    static const uint16_t btle_crc_next_state_flips[256] = {
-        0x0000, 0x32d8, 0x196c, 0x2bb4, 0x0cb6, 0x3e6e, 0x15da, 0x2702,
-        0x065b, 0x3483, 0x1f37, 0x2def, 0x0aed, 0x3835, 0x1381, 0x2159,
-        0x065b, 0x3483, 0x1f37, 0x2def, 0x0aed, 0x3835, 0x1381, 0x2159,
-        0x0000, 0x32d8, 0x196c, 0x2bb4, 0x0cb6, 0x3e6e, 0x15da, 0x2702,
-        0x0cb6, 0x3e6e, 0x15da, 0x2702, 0x0000, 0x32d8, 0x196c, 0x2bb4,
-        0x0aed, 0x3835, 0x1381, 0x2159, 0x065b, 0x3483, 0x1f37, 0x2def,
-        0x0aed, 0x3835, 0x1381, 0x2159, 0x065b, 0x3483, 0x1f37, 0x2def,
-        0x0cb6, 0x3e6e, 0x15da, 0x2702, 0x0000, 0x32d8, 0x196c, 0x2bb4,
-        0x196c, 0x2bb4, 0x0000, 0x32d8, 0x15da, 0x2702, 0x0cb6, 0x3e6e,
-        0x1f37, 0x2def, 0x065b, 0x3483, 0x1381, 0x2159, 0x0aed, 0x3835,
-        0x1f37, 0x2def, 0x065b, 0x3483, 0x1381, 0x2159, 0x0aed, 0x3835,
-        0x196c, 0x2bb4, 0x0000, 0x32d8, 0x15da, 0x2702, 0x0cb6, 0x3e6e,
-        0x15da, 0x2702, 0x0cb6, 0x3e6e, 0x196c, 0x2bb4, 0x0000, 0x32d8,
-        0x1381, 0x2159, 0x0aed, 0x3835, 0x1f37, 0x2def, 0x065b, 0x3483,
-        0x1381, 0x2159, 0x0aed, 0x3835, 0x1f37, 0x2def, 0x065b, 0x3483,
-        0x15da, 0x2702, 0x0cb6, 0x3e6e, 0x196c, 0x2bb4, 0x0000, 0x32d8,
-        0x32d8, 0x0000, 0x2bb4, 0x196c, 0x3e6e, 0x0cb6, 0x2702, 0x15da,
-        0x3483, 0x065b, 0x2def, 0x1f37, 0x3835, 0x0aed, 0x2159, 0x1381,
-        0x3483, 0x065b, 0x2def, 0x1f37, 0x3835, 0x0aed, 0x2159, 0x1381,
-        0x32d8, 0x0000, 0x2bb4, 0x196c, 0x3e6e, 0x0cb6, 0x2702, 0x15da,
-        0x3e6e, 0x0cb6, 0x2702, 0x15da, 0x32d8, 0x0000, 0x2bb4, 0x196c,
-        0x3835, 0x0aed, 0x2159, 0x1381, 0x3483, 0x065b, 0x2def, 0x1f37,
-        0x3835, 0x0aed, 0x2159, 0x1381, 0x3483, 0x065b, 0x2def, 0x1f37,
-        0x3e6e, 0x0cb6, 0x2702, 0x15da, 0x32d8, 0x0000, 0x2bb4, 0x196c,
-        0x2bb4, 0x196c, 0x32d8, 0x0000, 0x2702, 0x15da, 0x3e6e, 0x0cb6,
-        0x2def, 0x1f37, 0x3483, 0x065b, 0x2159, 0x1381, 0x3835, 0x0aed,
-        0x2def, 0x1f37, 0x3483, 0x065b, 0x2159, 0x1381, 0x3835, 0x0aed,
-        0x2bb4, 0x196c, 0x32d8, 0x0000, 0x2702, 0x15da, 0x3e6e, 0x0cb6,
-        0x2702, 0x15da, 0x3e6e, 0x0cb6, 0x2bb4, 0x196c, 0x32d8, 0x0000,
-        0x2159, 0x1381, 0x3835, 0x0aed, 0x2def, 0x1f37, 0x3483, 0x065b,
-        0x2159, 0x1381, 0x3835, 0x0aed, 0x2def, 0x1f37, 0x3483, 0x065b,
-        0x2702, 0x15da, 0x3e6e, 0x0cb6, 0x2bb4, 0x196c, 0x32d8, 0x0000
-    };
-
-    uint8_t offset = 4;
-    uint32_t state = crc_init;
-
-    for (size_t pos = offset; pos < len; pos++) {
-        uint8_t byte = payload[pos];
-        uint8_t nibble = (byte & 0xF);
-        uint8_t byte_index = ((state >> 16) & 0xF0) | nibble;
+    const size_t offset = 4;
 
-        state = ((state << 4) ^ btle_crc_next_state_flips[byte_index]) & 0xFFFFFF;
-        nibble = ((byte >> 4) & 0xF);
-        byte_index = ((state >> 16) & 0xF0) | nibble;
-        state = ((state << 4) ^ btle_crc_next_state_flips[byte_index]) & 0xFFFFFF;
-    }
+    if (len <= offset)
+        return crc_init;
 
-    return state;
+    return reflect24(calc_btle_crc_reflected(reflect24(crc_init), payload + offset,
+                len - offset));
 }
 
 /*
@@ -212,6 +227,15 @@ kis_btle_phy::kis_btle_phy(int in_phyid) :
     if (ignore_random)
         _MSG_INFO("Ignoring BTLE devices with random MAC addresses");
 
+    random_group =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("btle_random_group", false);
+
+    if (random_group && !ignore_random)
+        _MSG_INFO("Grouping BTLE advertisements from rotating random MAC addresses into a "
+                "device per advertisement fingerprint");
+
+    devtype_random_group = devicetracker->get_cached_devicetype("BTLE Randomized Group");
+
     // Register js module for UI
     auto httpregistry = Globalreg::fetch_mandatory_global_as<kis_httpd_registry>();
     httpregistry->register_js_module("kismet_ui_btle", "js/kismet.ui.btle.js");
@@ -255,26 +279,36 @@ int kis_btle_phy::dissector(CHAINCALL_PARMS) {
             return 0;
         }
 
-        uint32_t line_crc;
-        line_crc = 
-            packdata->data()[packdata->length() - 3] << 16 |
-            packdata->data()[packdata->length() - 2] << 8 |
-            packdata->data()[packdata->length() - 1];
+        // The CRC is sent LSB first, so in the reflected form it's simply the last 3
+        // bytes as a little-endian value
+        auto crc_bytes = reinterpret_cast<const uint8_t *>(packdata->data()) +
+            packdata->length() - 3;
+        uint32_t line_crc = crc_bytes[0] | (crc_bytes[1] << 8) | (crc_bytes[2] << 16);
 
         // Get the CRC as if it was a broadcast; we'll redo this later if we get
         // data packets
         uint32_t packet_crc = 
-            calc_btle_crc(0x555555, packdata->data(), packdata->length() - 3);
+            calc_btle_crc_reflected(BTLE_CRC_INIT_ADV_REFLECTED, packdata->data() + 4,
+                    packdata->length() - 4 - 3);
 
-        if (reverse_bits(packet_crc) != line_crc) {
+        if (packet_crc != line_crc) {
             in_pack->error = 1;
             return 0;
         }
     }
 
-    membuf btle_membuf((char *) packdata->data(), (char *) &packdata->data()[packdata->length()]);
-    std::istream btle_istream(&btle_membuf);
-    auto btle_stream = std::make_shared<kaitai::kstream>(&btle_istream);
+    // Devices repeat the same advertisement over and over; keep the decode of recently
+    // seen advertisements and share it instead of parsing them again.  The decode is
+    // never modified once it's been parsed.
+    struct decode_slot {
+        std::string pdu;
+        std::shared_ptr<bluetooth_btle> decode;
+    };
+
+    thread_local std::vector<decode_slot> decode_cache(BTLE_DECODE_CACHE_SLOTS);
+
+    auto& slot = decode_cache[XXH32(packdata->data(), packdata->length(), 0) % 
+        BTLE_DECODE_CACHE_SLOTS];
 
     common = mphy->packetchain->new_packet_component<kis_common_info>();
     common->phyid = mphy->fetch_phy_id();
@@ -284,8 +318,22 @@ int kis_btle_phy::dissector(CHAINCALL_PARMS) {
     auto btle_info = mphy->packetchain->new_packet_component<btle_packinfo>();
 
     try {
-        auto btle = std::make_shared<bluetooth_btle>();
-        btle->parse(btle_stream);
+        std::shared_ptr<bluetooth_btle> btle;
+
+        if (slot.decode != nullptr && slot.pdu.length() == packdata->length() &&
+                memcmp(slot.pdu.data(), packdata->data(), packdata->length()) == 0) {
+            btle = slot.decode;
+        } else {
+            membuf btle_membuf((char *) packdata->data(), (char *) &packdata->data()[packdata->length()]);
+            std::istream btle_istream(&btle_membuf);
+            auto btle_stream = std::make_shared<kaitai::kstream>(&btle_istream);
+
+            btle = std::make_shared<bluetooth_btle>();
+            btle->parse(btle_stream);
+
+            slot.pdu.assign(packdata->data(), packdata->length());
+            slot.decode = btle;
+        }
 
         common->source = btle->advertising_address();
         common->transmitter = btle->advertising_address();
@@ -324,10 +372,24 @@ int kis_btle_phy::common_classifier(CHAINCALL_PARMS) {
     if (btle_info->btle_decode->is_txaddr_random() && mphy->ignore_random)
         return 0;
 
+    auto source_mac = common->source;
+    bool random_group = false;
+
+    // Rotating (resolvable and non-resolvable) private addresses are folded into a 
+    // device per advertisement fingerprint, unless the address already has a device of
+    // its own; static random addresses have 11 in the top bits and don't rotate
+    if (mphy->random_group && btle_info->btle_decode->is_txaddr_random() &&
+            (source_mac[0] & 0xC0) != 0xC0 &&
+            mphy->devicetracker->fetch_device(device_key(mphy->fetch_phyname_hash(),
+                    source_mac)) == nullptr) {
+        source_mac = mphy->random_group_mac(btle_info->btle_decode);
+        random_group = true;
+    }
+
     if (in_pack->duplicate) {
         auto device = 
             mphy->devicetracker->update_common_device(common,
-                    common->source, mphy, in_pack,
+                    source_mac, mphy, in_pack,
                     (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES |
                      UCD_UPDATE_LOCATION | UCD_UPDATE_SEENBY),
                     "BTLE Device");
@@ -339,7 +401,7 @@ int kis_btle_phy::common_classifier(CHAINCALL_PARMS) {
     // in the future
     auto device = 
         mphy->devicetracker->update_common_device(common,
-                common->source, mphy, in_pack,
+                source_mac, mphy, in_pack,
                 (UCD_UPDATE_SIGNAL | UCD_UPDATE_FREQUENCIES |
                  UCD_UPDATE_PACKETS | UCD_UPDATE_LOCATION |
                  UCD_UPDATE_SEENBY | UCD_UPDATE_ENCRYPTION),
@@ -362,6 +424,9 @@ int kis_btle_phy::common_classifier(CHAINCALL_PARMS) {
     if (btle_info->btle_decode->is_txaddr_random())
         device->set_manuf(Globalreg::globalreg->manufdb->get_random_manuf());
 
+    if (random_group)
+        device->set_tracker_type_string(mphy->devtype_random_group);
+
     for (auto ad : *btle_info->btle_decode->advertised_data()) {
         if (btle_info->btle_decode->pdu_type() == btle_info->btle_decode->pdu_adv_ind() ||
                 btle_info->btle_decode->pdu_type() == btle_info->btle_decode->pdu_adv_scan_ind()) {
@@ -390,7 +455,9 @@ int kis_btle_phy::common_classifier(CHAINCALL_PARMS) {
     }
 
     if (new_dev) {
-        if (device->get_devicename().length() > 0) 
+        if (random_group)
+            _MSG_INFO("Detected new BTLE randomized group {} from {}", source_mac, common->source);
+        else if (device->get_devicename().length() > 0) 
             _MSG_INFO("Detected new BTLE device {} {}", common->source, device->get_devicename());
         else
             _MSG_INFO("Detected new BTLE device {}", common->source);
@@ -399,6 +466,41 @@ int kis_btle_phy::common_classifier(CHAINCALL_PARMS) {
     return 1;
 }
 
+mac_addr kis_btle_phy::random_group_mac(std::shared_ptr<bluetooth_btle> in_btle) {
+    // The types and order of the advertised data describe the device and its OS; the
+    // service UUIDs, appearance, flags, and name are stable across address rotations.
+    // Manufacturer and service data usually carry rotating payloads, so only the
+    // company or service ID and the length of them are used.
+    auto fp = xx_hash_cpp{};
+
+    uint8_t pdu_type = in_btle->pdu_type();
+    fp.update(&pdu_type, 1);
+
+    for (const auto& ad : *in_btle->advertised_data()) {
+        uint8_t hdr[2] = { ad->type(), ad->length() };
+        fp.update(hdr, 2);
+
+        auto t = ad->type();
+        auto d = ad->data();
+
+        if (t == BTLE_ADVDATA_FLAGS || t == BTLE_ADVDATA_DEVICE_NAME ||
+                t == BTLE_ADVDATA_SHORT_NAME || t == BTLE_ADVDATA_APPEARANCE ||
+                (t >= BTLE_ADVDATA_UUID16_INCOMPLETE && t <= BTLE_ADVDATA_UUID128_COMPLETE))
+            fp.update(d.data(), d.length());
+        else if ((t == BTLE_ADVDATA_MANUF_DATA || t == BTLE_ADVDATA_SERVICE_DATA16) &&
+                d.length() >= 2)
+            fp.update(d.data(), 2);
+    }
+
+    auto h = fp.hash();
+
+    // A locally administered MAC in a block of its own
+    uint8_t bytes[6] = { 0x06, 0xb7, (uint8_t) (h >> 24), (uint8_t) (h >> 16),
+        (uint8_t) (h >> 8), (uint8_t) h };
+
+    return mac_addr(bytes, 6);
+}
+
 void kis_btle_phy::load_phy_storage(shared_tracker_element in_storage,
         shared_tracker_element in_device) {
     if (in_storage == nullptr || in_device == nullptr)
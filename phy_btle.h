@@ -150,6 +150,8 @@ protected:
     std::shared_ptr<tracker_element_uint8> simultaneous_br_edr_host;
 };
 
+class bluetooth_btle;
+
 class kis_btle_phy : public kis_phy_handler {
 public:
     kis_btle_phy() :
@@ -173,6 +175,12 @@ public:
     static uint32_t calc_btle_crc(uint32_t crc_init, const char *data, size_t len);
     static uint32_t reverse_bits(const uint32_t val);
 
+    // CRC over the PDU in the bit order it's sent over the air, a byte at a time.  The
+    // init value is bit-reversed the same way, and the result equals the CRC bytes at
+    // the end of the packet read as a little-endian value.
+    static uint32_t calc_btle_crc_reflected(uint32_t crc_init_reflected, const char *data,
+            size_t len);
+
     virtual bool device_is_a(std::shared_ptr<kis_tracked_device_base> dev) override;
 
 protected:
@@ -189,6 +197,16 @@ protected:
 
     bool ignore_random;
 
+    // Are advertisements from rotating private addresses folded into one device per
+    // advertisement fingerprint?  Addresses get their own device if they already have
+    // one, and static random addresses are never folded.
+    bool random_group;
+    std::shared_ptr<tracker_element_string> devtype_random_group;
+
+    // MAC of the group device for an advertisement from a rotating address, derived
+    // from the layout of the advertised data
+    mac_addr random_group_mac(std::shared_ptr<bluetooth_btle> in_btle);
+
     int alert_bleedingtooth_ref;
 };
 
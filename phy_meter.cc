@@ -96,7 +96,7 @@ mac_addr kis_meter_phy::synth_mac(std::string model_s, uint64_t id) {
     return mac_addr(bytes, 6);
 }
 
-mac_addr kis_meter_phy::json_to_mac(nlohmann::json json) {
+mac_addr kis_meter_phy::json_to_mac(const nlohmann::json& json) {
     // Derive a mac addr from the model and device id data
     //
     // We turn the model string into 4 bytes using the adler32 checksum,
@@ -111,8 +111,8 @@ mac_addr kis_meter_phy::json_to_mac(nlohmann::json json) {
     memset(bytes, 0, 6);
 
     try {
-        *model = json["model"];
-        *deviceid = json["meterid"];
+        *model = json_field(json, "model");
+        *deviceid = json_field(json, "meterid");
     } catch (const std::exception& e) {
         mac_addr m;
         m.state.error = true;
@@ -125,23 +125,23 @@ mac_addr kis_meter_phy::json_to_mac(nlohmann::json json) {
     return mac_addr(bytes, 6);
 }
 
-bool kis_meter_phy::rtlamr_json_to_phy(nlohmann::json json, std::shared_ptr<kis_packet> packet) {
+bool kis_meter_phy::rtlamr_json_to_phy(const nlohmann::json& json, std::shared_ptr<kis_packet> packet) {
     std::string err;
     std::string v;
 
     // If we're not valid from the capture engine, drop entirely
     try {
-        if (!json["valid"].get<bool>())
+        if (!json_field(json, "valid").get<bool>())
             return false;
     } catch (const std::exception& e) {
         return false;
     }
 
-    auto id_j = json["meterid"];
-    auto type_j = json["metertype"];
-    auto phy_j = json["phytamper"];
-    auto end_j = json["endptamper"];
-    auto consumption_j = json["consumption"];
+    auto id_j = json_field(json, "meterid");
+    auto type_j = json_field(json, "metertype");
+    auto phy_j = json_field(json, "phytamper");
+    auto end_j = json_field(json, "endptamper");
+    auto consumption_j = json_field(json, "consumption");
 
     // We need at least an id, type, and consumption
     if (id_j.is_null() || type_j.is_null() || consumption_j.is_null())
@@ -248,7 +248,7 @@ l
 
 bool kis_meter_phy::is_meter(const nlohmann::json &json) { 
     // This list will need to be updated as rtl_433 adds more meter types
-    auto model_j = json["model"];
+    const auto& model_j = json_field(json, "model");
 
     if (model_j.is_string()) {
         if (model_j == "IDM") 
@@ -266,22 +266,22 @@ bool kis_meter_phy::is_meter(const nlohmann::json &json) {
     return false;
 }
 
-bool kis_meter_phy::rtl433_json_to_phy(nlohmann::json json, std::shared_ptr<kis_packet> packet) { 
+bool kis_meter_phy::rtl433_json_to_phy(const nlohmann::json& json, std::shared_ptr<kis_packet> packet) { 
     std::string err;
     std::string v;
 
-    auto id_j = json["id"];
-    auto ert_serial_j = json["ERTSerialNumber"];
-    auto model_j = json["model"];
-    auto type_j = json["MeterType"];
-    auto endp_type_j = json["EndpointType"];
-    auto ert_type_j = json["ERTType"];
-	auto ert_type_2_j = json["ert_type"];
-    auto consumption_j = json["consumption"];
-    auto consumption_2_j = json["Consumption"];
-    auto consumption_data_j = json["consumption_data"];
-	auto last_consumption_j = json["LastConsumptionCount"];
-	auto freq_j = json["freq"];
+    auto id_j = json_field(json, "id");
+    auto ert_serial_j = json_field(json, "ERTSerialNumber");
+    auto model_j = json_field(json, "model");
+    auto type_j = json_field(json, "MeterType");
+    auto endp_type_j = json_field(json, "EndpointType");
+    auto ert_type_j = json_field(json, "ERTType");
+	auto ert_type_2_j = json_field(json, "ert_type");
+    auto consumption_j = json_field(json, "consumption");
+    auto consumption_2_j = json_field(json, "Consumption");
+    auto consumption_data_j = json_field(json, "consumption_data");
+	auto last_consumption_j = json_field(json, "LastConsumptionCount");
+	auto freq_j = json_field(json, "freq");
 
     if (model_j.is_null())
         return false;
@@ -485,13 +485,12 @@ int kis_meter_phy::PacketHandler(CHAINCALL_PARMS) {
         return 0;
 
     if (json->type == "RTLamr") {
-        std::stringstream ss(json->json_string);
-        nlohmann::json device_json;
+        auto device_json = json->document();
+        if (device_json == nullptr)
+            return 0;
 
         try {
-            ss >> device_json;
-
-            if (phy->rtlamr_json_to_phy(device_json, in_pack)) {
+            if (phy->rtlamr_json_to_phy(*device_json, in_pack)) {
                 auto adata = in_pack->fetch_or_add<packet_metablob>(phy->pack_comp_meta);
                 adata->set_data("METER", json->json_string);
             }
@@ -502,21 +501,18 @@ int kis_meter_phy::PacketHandler(CHAINCALL_PARMS) {
 
         return 1;
     } else if (json->type == "RTL433") {
-        std::stringstream ss(json->json_string);
-        nlohmann::json device_json;
-
-            ss >> device_json;
+        auto device_json = json->document();
+        if (device_json == nullptr)
+            return 0;
 
-            if (phy->rtl433_json_to_phy(device_json, in_pack)) { 
-                auto adata = in_pack->fetch_or_add<packet_metablob>(phy->pack_comp_meta);
-                adata->set_data("METER", json->json_string);
-            }
+        if (phy->rtl433_json_to_phy(*device_json, in_pack)) { 
+            auto adata = in_pack->fetch_or_add<packet_metablob>(phy->pack_comp_meta);
+            adata->set_data("METER", json->json_string);
+        }
 
 #if 0
         try {
-            ss >> device_json;
-
-            if (phy->rtl433_json_to_phy(device_json, in_pack)) { 
+            if (phy->rtl433_json_to_phy(*device_json, in_pack)) { 
                 auto adata = in_pack->fetch_or_add<packet_metablob>(phy->pack_comp_meta);
                 adata->set_data("METER", json->json_string);
             }
@@ -105,7 +105,7 @@ double Kis_RTL433_Phy::f_to_c(double f) {
     return (f - 32) / (double) 1.8f;
 }
 
-mac_addr Kis_RTL433_Phy::json_to_mac(nlohmann::json json) {
+mac_addr Kis_RTL433_Phy::json_to_mac(const nlohmann::json& json) {
     // Derive a mac addr from the model and device id data
     //
     // We turn the model string into 4 bytes using the adler32 checksum,
@@ -122,14 +122,14 @@ mac_addr Kis_RTL433_Phy::json_to_mac(nlohmann::json json) {
     std::string smodel = "unk";
 
     try {
-        smodel = json["model"].get<std::string>();
+        smodel = json_field(json, "model").get<std::string>();
     } catch (...) { }
 
     *checksum = adler32_checksum(smodel.c_str(), smodel.length());
 
     bool set_model = false;
 
-    auto idmem = json["id"];
+    auto idmem = json_field(json, "id");
     if (idmem.is_number()) {
         *model = kis_hton16((uint16_t) idmem.get<unsigned int>());
         set_model = true;
@@ -140,7 +140,7 @@ mac_addr Kis_RTL433_Phy::json_to_mac(nlohmann::json json) {
         set_model = true;
     }
 
-    auto fromid = json["from_id"];
+    auto fromid = json_field(json, "from_id");
     if (fromid.is_string()) {
         smodel = munge_to_printable(fromid.get<std::string>());
         *checksum = adler32_checksum(smodel);
@@ -148,8 +148,8 @@ mac_addr Kis_RTL433_Phy::json_to_mac(nlohmann::json json) {
         set_model = true;
     }
 
-    if (!set_model && !json["device"].is_null()) {
-        auto d = json["device"];
+    if (!set_model && !json_field(json, "device").is_null()) {
+        auto d = json_field(json, "device");
         if (d.is_number()) {
             *model = kis_hton16((uint16_t) d.get<unsigned int>());
             set_model = true;
@@ -166,7 +166,7 @@ mac_addr Kis_RTL433_Phy::json_to_mac(nlohmann::json json) {
     return mac_addr(bytes, 6);
 }
 
-bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet> packet) {
+bool Kis_RTL433_Phy::json_to_rtl(const nlohmann::json& json, std::shared_ptr<kis_packet> packet) {
     std::string err;
     std::string v;
 
@@ -189,7 +189,7 @@ bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
     common->datasize = 0;
 
     // If this json record has a channel
-    auto channel_j = json["channel"];
+    auto channel_j = json_field(json, "channel");
 
     if (channel_j.is_string())
         common->channel = munge_to_printable(channel_j);
@@ -211,8 +211,8 @@ bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
 
     std::string dn = "Sensor";
 
-    if (!json["model"].is_null()) {
-        dn = munge_to_printable(json["model"]);
+    if (!json_field(json, "model").is_null()) {
+        dn = munge_to_printable(json_field(json, "model"));
     }
 
     basedev->set_manuf(rtl_manuf);
@@ -241,7 +241,7 @@ bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         commondev->set_model(dn);
 
         bool set_id = false;
-        auto id_j = json["id"];
+        auto id_j = json_field(json, "id");
 
         if (id_j.is_number())
             commondev->set_rtlid(fmt::format("{}", id_j.get<int>()));
@@ -251,7 +251,7 @@ bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         }
 
         if (!set_id) {
-            auto device_j = json["device"];
+            auto device_j = json_field(json, "device");
 
             if (device_j.is_number())
                 commondev->set_rtlid(fmt::format("{}", device_j.get<int>()));
@@ -275,24 +275,24 @@ bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         commondev->set_rtlchannel(munge_to_printable(channel_j));
     
 
-    auto battery_j = json["battery"];
+    auto battery_j = json_field(json, "battery");
     if (battery_j.is_string())
         commondev->set_battery(munge_to_printable(battery_j));
 
-    auto rssi_j = json["rssi"];
+    auto rssi_j = json_field(json, "rssi");
     if (rssi_j.is_number())
         commondev->set_rssi(fmt::format("{}", rssi_j.get<int>()));
     else if (rssi_j.is_string())
         commondev->set_rssi(munge_to_printable(rssi_j));
 
-    auto snr_j = json["snr"];
+    auto snr_j = json_field(json, "snr");
     if (snr_j.is_number())
         commondev->set_snr(fmt::format("{}", snr_j.get<int>()));
     else if (snr_j.is_string())
         commondev->set_snr(munge_to_printable(snr_j));
 
 
-    auto noise_j = json["noise"];
+    auto noise_j = json_field(json, "noise");
     if (noise_j.is_number())
         commondev->set_noise(fmt::format("{}", noise_j.get<int>()));
     else if (noise_j.is_string())
@@ -331,53 +331,53 @@ bool Kis_RTL433_Phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
     return true;
 }
 
-bool Kis_RTL433_Phy::is_weather_station(nlohmann::json json) {
-    if (!json["direction_deg"].is_null())
+bool Kis_RTL433_Phy::is_weather_station(const nlohmann::json& json) {
+    if (!json_field(json, "direction_deg").is_null())
         return true;
 
-    if (!json["windstrength"].is_null())
+    if (!json_field(json, "windstrength").is_null())
         return true;
 
-    if (!json["winddirection"].is_null())
+    if (!json_field(json, "winddirection").is_null())
         return true;
 
-    if (!json["speed"].is_null())
+    if (!json_field(json, "speed").is_null())
         return true;
 
-    if (!json["gust"].is_null())
+    if (!json_field(json, "gust").is_null())
         return true;
 
-    if (!json["rain"].is_null())
+    if (!json_field(json, "rain").is_null())
         return true;
 
-    if (!json["uv_index"].is_null())
+    if (!json_field(json, "uv_index").is_null())
         return true;
 
-    if (!json["lux"].is_null())
+    if (!json_field(json, "lux").is_null())
         return true;
 
     return false;
 }
 
-bool Kis_RTL433_Phy::is_thermometer(nlohmann::json json) {
-    if (!json["humidity"].is_null())
+bool Kis_RTL433_Phy::is_thermometer(const nlohmann::json& json) {
+    if (!json_field(json, "humidity").is_null())
         return true;
 
-    if (!json["moisture"].is_null())
+    if (!json_field(json, "moisture").is_null())
         return true;
 
-    if (!json["temperature_F"].is_null())
+    if (!json_field(json, "temperature_F").is_null())
         return true;
 
-    if (!json["temperature_C"].is_null())
+    if (!json_field(json, "temperature_C").is_null())
         return true;
 
     return false;
 }
 
-bool Kis_RTL433_Phy::is_tpms(nlohmann::json json) {
+bool Kis_RTL433_Phy::is_tpms(const nlohmann::json& json) {
     try {
-        return json["type"] == "TPMS";
+        return json_field(json, "type") == "TPMS";
 
     } catch (...) {
         return false;
@@ -386,76 +386,76 @@ bool Kis_RTL433_Phy::is_tpms(nlohmann::json json) {
     return false;
 }
 
-bool Kis_RTL433_Phy::is_switch(nlohmann::json json) {
-    if (!json["switch0"].is_null())
+bool Kis_RTL433_Phy::is_switch(const nlohmann::json& json) {
+    if (!json_field(json, "switch0").is_null())
         return true;
 
-    if (!json["switch1"].is_null())
+    if (!json_field(json, "switch1").is_null())
         return true;
 
-    if (!json["switch1"].is_null())
+    if (!json_field(json, "switch1").is_null())
         return true;
 
-    if (!json["switch2"].is_null())
+    if (!json_field(json, "switch2").is_null())
         return true;
 
-    if (!json["switch3"].is_null())
+    if (!json_field(json, "switch3").is_null())
         return true;
 
-    if (!json["switch4"].is_null())
+    if (!json_field(json, "switch4").is_null())
         return true;
 
-    if (!json["switch5"].is_null())
+    if (!json_field(json, "switch5").is_null())
         return true;
 
-    if (!json["switch6"].is_null())
+    if (!json_field(json, "switch6").is_null())
         return true;
 
     return false;
 }
 
-bool Kis_RTL433_Phy::is_insteon(nlohmann::json json) {
-    if (!json["from_id"].is_null())
+bool Kis_RTL433_Phy::is_insteon(const nlohmann::json& json) {
+    if (!json_field(json, "from_id").is_null())
         return true;
 
-    if (!json["to_id"].is_null())
+    if (!json_field(json, "to_id").is_null())
         return true;
 
-    if (!json["msg_type"].is_null())
+    if (!json_field(json, "msg_type").is_null())
         return true;
 
-    if (!json["msg_str"].is_null())
+    if (!json_field(json, "msg_str").is_null())
         return true;
 
-    if (!json["hopsmax"].is_null())
+    if (!json_field(json, "hopsmax").is_null())
         return true;
 
-    if (!json["hopsleft"].is_null())
+    if (!json_field(json, "hopsleft").is_null())
         return true;
 
     return false;
 }
 
-bool Kis_RTL433_Phy::is_lightning(nlohmann::json json) {
-    if (!json["strike_count"].is_null())
+bool Kis_RTL433_Phy::is_lightning(const nlohmann::json& json) {
+    if (!json_field(json, "strike_count").is_null())
         return true;
 
-    if (!json["storm_dist"].is_null())
+    if (!json_field(json, "storm_dist").is_null())
         return true;
 
-    if (!json["active"].is_null())
+    if (!json_field(json, "active").is_null())
         return true;
 
-    if (!json["rfi"].is_null())
+    if (!json_field(json, "rfi").is_null())
         return true;
 
     return true;
 }
 
-void Kis_RTL433_Phy::add_weather_station(nlohmann::json json, 
+void Kis_RTL433_Phy::add_weather_station(const nlohmann::json& json, 
         std::shared_ptr<tracker_element_map> rtlholder) {
-    auto uv_index_j = json["uv_index"];
-    auto lux_j = json["lux"];
+    auto uv_index_j = json_field(json, "uv_index");
+    auto lux_j = json_field(json, "lux");
 
     auto weatherdev = 
         rtlholder->get_sub_as<rtl433_tracked_weatherstation>(rtl433_weatherstation_id);
@@ -467,53 +467,53 @@ void Kis_RTL433_Phy::add_weather_station(nlohmann::json json,
     }
 
     try {
-        weatherdev->set_wind_dir(json["winddirection"]);
-        weatherdev->get_wind_dir_rrd()->add_sample(json["winddirection"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_dir(json_field(json, "winddirection"));
+        weatherdev->get_wind_dir_rrd()->add_sample(json_field(json, "winddirection"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["windspeed"]);
-        weatherdev->get_wind_speed_rrd()->add_sample(json["windspeed"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "windspeed"));
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "windspeed"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["windstrength"]);
-        weatherdev->get_wind_speed_rrd()->add_sample(json["windstrength"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "windstrength"));
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "windstrength"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["wind_avg_km_h"]);
-        weatherdev->get_wind_speed_rrd()->add_sample(json["wind_avg_km_h"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "wind_avg_km_h"));
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "wind_avg_km_h"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["speed"]);
-        weatherdev->get_wind_speed_rrd()->add_sample(json["speed"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "speed"));
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "speed"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_gust(json["gust"]);
-        weatherdev->get_wind_gust_rrd()->add_sample(json["gust"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_gust(json_field(json, "gust"));
+        weatherdev->get_wind_gust_rrd()->add_sample(json_field(json, "gust"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_rain(json["rain"]);
-        weatherdev->get_rain_rrd()->add_sample(json["rain"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_rain(json_field(json, "rain"));
+        weatherdev->get_rain_rrd()->add_sample(json_field(json, "rain"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_uv_index(json["uv_index"]);
-        weatherdev->get_uv_index_rrd()->add_sample(json["uv_index"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_uv_index(json_field(json, "uv_index"));
+        weatherdev->get_uv_index_rrd()->add_sample(json_field(json, "uv_index"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_lux(json["lux"]);
-        weatherdev->get_lux_rrd()->add_sample(json["lux"], Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_lux(json_field(json, "lux"));
+        weatherdev->get_lux_rrd()->add_sample(json_field(json, "lux"), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
 }
 
-void Kis_RTL433_Phy::add_thermometer(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void Kis_RTL433_Phy::add_thermometer(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     auto thermdev = 
         rtlholder->get_sub_as<rtl433_tracked_thermometer>(rtl433_thermometer_id);
 
@@ -524,24 +524,24 @@ void Kis_RTL433_Phy::add_thermometer(nlohmann::json json, std::shared_ptr<tracke
     }
 
     try {
-        thermdev->set_humidity(json["humidity"]);
+        thermdev->set_humidity(json_field(json, "humidity"));
     } catch (...) { }
 
     try {
-        thermdev->set_humidity(json["moisture"]);
+        thermdev->set_humidity(json_field(json, "moisture"));
     } catch (...) { }
 
     try {
-        thermdev->set_temperature(json["temperature_F"]);
+        thermdev->set_temperature(json_field(json, "temperature_F"));
     } catch (...) { }
 
     try {
-        thermdev->set_temperature(json["temperature_C"]);
+        thermdev->set_temperature(json_field(json, "temperature_C"));
     } catch (...) { }
 
 }
 
-void Kis_RTL433_Phy::add_tpms(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void Kis_RTL433_Phy::add_tpms(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     auto tpmsdev = 
         rtlholder->get_sub_as<rtl433_tracked_tpms>(rtl433_tpms_id);
 
@@ -552,32 +552,32 @@ void Kis_RTL433_Phy::add_tpms(nlohmann::json json, std::shared_ptr<tracker_eleme
     }
 
     try {
-        tpmsdev->set_pressure_bar(json["pressure_bar"]);
+        tpmsdev->set_pressure_bar(json_field(json, "pressure_bar"));
     } catch (...) { }
 
     try {
-        tpmsdev->set_pressure_kpa(json["pressure_kPa"]);
+        tpmsdev->set_pressure_kpa(json_field(json, "pressure_kPa"));
     } catch (...) { }
 
     try {
-        tpmsdev->set_flags(munge_to_printable(json["flags"]));
+        tpmsdev->set_flags(munge_to_printable(json_field(json, "flags")));
     } catch (...) { }
 
     try {
-        tpmsdev->set_checksum(munge_to_printable(json["mic"]));
+        tpmsdev->set_checksum(munge_to_printable(json_field(json, "mic")));
     } catch (...) { }
 
     try {
-        tpmsdev->set_state(munge_to_printable(json["state"]));
+        tpmsdev->set_state(munge_to_printable(json_field(json, "state")));
     } catch (...) { }
 
     try {
-        tpmsdev->set_code(munge_to_printable(json["code"]));
+        tpmsdev->set_code(munge_to_printable(json_field(json, "code")));
     } catch (...) { }
 
 }
 
-void Kis_RTL433_Phy::add_switch(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void Kis_RTL433_Phy::add_switch(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     //{"time" : "2021-08-18 16:16:54", "model" : "Interlogix-Security", "subtype" : "contact", "id" : "a55b4b", "battery_ok" : 1, "switch1" : "OPEN", "switch2" : "OPEN", "switch3" : "OPEN", "switch4" : "OPEN", "switch5" : "OPEN", "raw_message" : "2dd4ac"}
 
     auto switchdev = 
@@ -590,36 +590,36 @@ void Kis_RTL433_Phy::add_switch(nlohmann::json json, std::shared_ptr<tracker_ele
     }
 
     try {
-        switchdev->set_switch1(munge_to_printable(json["switch1"]));
+        switchdev->set_switch1(munge_to_printable(json_field(json, "switch1")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch2(munge_to_printable(json["switch2"]));
+        switchdev->set_switch2(munge_to_printable(json_field(json, "switch2")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch3(munge_to_printable(json["switch3"]));
+        switchdev->set_switch3(munge_to_printable(json_field(json, "switch3")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch4(munge_to_printable(json["switch4"]));
+        switchdev->set_switch4(munge_to_printable(json_field(json, "switch4")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch1(munge_to_printable(json["switch5"]));
+        switchdev->set_switch1(munge_to_printable(json_field(json, "switch5")));
     } catch (...) { }
 
     /*
-    auto model_j = json["model"];
-    auto subtype_j = json["subtype"];
-    auto battery_j = json["battery_ok"];
-    auto msg_j = json["raw_message"];
-    auto sw_id = json["id"];
+    auto model_j = json_field(json, "model");
+    auto subtype_j = json_field(json, "subtype");
+    auto battery_j = json_field(json, "battery_ok");
+    auto msg_j = json_field(json, "raw_message");
+    auto sw_id = json_field(json, "id");
     */
     
 }
 
-void Kis_RTL433_Phy::add_insteon(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void Kis_RTL433_Phy::add_insteon(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     //{"time" : "2021-08-19 18:52:48", "model" : "Insteon", "from_id" : "CCFF79", "to_id" : "9F39E6", "msg_type" : 7, "msg_str" : "NAK of Group Cleanup Direct Message", "extended" : 0, "hopsmax" : 3, "hopsleft" : 0, "formatted" : "E3 : 9F39E6 : CCFF79 : 39 E7  B7", "mic" : "CRC", "payload" : "E3E6399F79FFCC39E7B7", "cmd_dat" : [57, 231], "mod" : "FSK", "freq1" : 914.909, "freq2" : 915.069, "rssi" : -0.212, "snr" : 25.305, "noise" : -25.517}
     
     auto insteondev =
@@ -632,32 +632,32 @@ void Kis_RTL433_Phy::add_insteon(nlohmann::json json, std::shared_ptr<tracker_el
     }
 
     try {
-        insteondev->set_from_id(munge_to_printable(json["from_id"]));
+        insteondev->set_from_id(munge_to_printable(json_field(json, "from_id")));
     } catch (...) { }
 
     try {
-        insteondev->set_to_id(munge_to_printable(json["to_id"]));
+        insteondev->set_to_id(munge_to_printable(json_field(json, "to_id")));
     } catch (...) { }
 
     try {
-        insteondev->set_msg_type(munge_to_printable(json["msg_type"]));
+        insteondev->set_msg_type(munge_to_printable(json_field(json, "msg_type")));
     } catch (...) { }
 
     try {
-        insteondev->set_msg_str(munge_to_printable(json["msg_str"]));
+        insteondev->set_msg_str(munge_to_printable(json_field(json, "msg_str")));
     } catch (...) { }
 
     try {
-        insteondev->set_hopsmax(munge_to_printable(json["hopsmax"]));
+        insteondev->set_hopsmax(munge_to_printable(json_field(json, "hopsmax")));
     } catch (...) { }
 
     try {
-        insteondev->set_hopsleft(munge_to_printable(json["hopsleft"]));
+        insteondev->set_hopsleft(munge_to_printable(json_field(json, "hopsleft")));
     } catch (...) { }
 }
 
 
-void Kis_RTL433_Phy::add_lightning(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void Kis_RTL433_Phy::add_lightning(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     // {"time" : "2019-02-24 22:12:13", "model" : "Acurite Lightning 6045M", "id" : 15580, "channel" : "B", "temperature_F" : 38.300, "humidity" : 53, "strike_count" : 1, "storm_dist" : 8, "active" : 1, "rfi" : 0, "ussb1" : 0, "battery" : "OK", "exception" : 0, "raw_msg" : "bcdc6f354edb81886e"}
     
     auto lightningdev = 
@@ -670,19 +670,19 @@ void Kis_RTL433_Phy::add_lightning(nlohmann::json json, std::shared_ptr<tracker_
     }
 
     try {
-        lightningdev->set_strike_count(json["strike_count"]);
+        lightningdev->set_strike_count(json_field(json, "strike_count"));
     } catch (...) { }
 
     try {
-        lightningdev->set_storm_distance(json["storm_dist"]);
+        lightningdev->set_storm_distance(json_field(json, "storm_dist"));
     } catch (...) { }
 
     try {
-        lightningdev->set_storm_active(json["active"]);
+        lightningdev->set_storm_active(json_field(json, "active"));
     } catch (...) { }
 
     try {
-        lightningdev->set_lightning_rfi(json["rfi"]);
+        lightningdev->set_lightning_rfi(json_field(json, "rfi"));
     } catch (...) { }
 
 }
@@ -700,14 +700,13 @@ int Kis_RTL433_Phy::PacketHandler(CHAINCALL_PARMS) {
     if (json->type != "RTL433")
         return 0;
 
-    std::stringstream ss(json->json_string);
-    nlohmann::json device_json;
+    auto device_json = json->document();
+    if (device_json == nullptr)
+        return 0;
 
     try {
-        ss >> device_json;
-
         // Copy the JSON as the meta field for logging, if it's valid
-        if (rtl433->json_to_rtl(device_json, in_pack)) {
+        if (rtl433->json_to_rtl(*device_json, in_pack)) {
             auto metablob = in_pack->fetch<packet_metablob>(rtl433->pack_comp_meta);
             if (metablob == nullptr) {
                 metablob = std::make_shared<packet_metablob>("RTL433", json->json_string);
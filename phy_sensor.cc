@@ -105,6 +105,26 @@ kis_sensor_phy::kis_sensor_phy(int in_phyid) :
         Globalreg::fetch_mandatory_global_as<kis_httpd_registry>();
     httpregistry->register_js_module("kismet_ui_sensor", "js/kismet.ui.sensor.js");
 
+    // Decoders are applied in this order
+    register_decoder(&kis_sensor_phy::add_thermometer, 
+            {"temperature_F", "temperature_C"});
+    register_decoder(&kis_sensor_phy::add_moisture, 
+            {"moisture", "humidity"});
+    register_decoder(&kis_sensor_phy::add_weather_station, 
+            {"direction_deg", "windstrength", "winddirection", "wind_dir_deg", 
+            "wind_avg_km_h", "wind_max_km_h", "speed", "gust", "rain", "rain_mm", 
+            "rain_raw", "uv_index", "lux"});
+    register_decoder(&kis_sensor_phy::add_tpms, 
+            {"type"}, &kis_sensor_phy::is_tpms);
+    register_decoder(&kis_sensor_phy::add_switch, 
+            {"switch0", "switch1", "switch2", "switch3", "switch4", "switch5", "switch6"});
+    register_decoder(&kis_sensor_phy::add_insteon, 
+            {"from_id", "to_id", "msg_type", "msg_str", "hopsmax", "hopsleft"});
+    register_decoder(&kis_sensor_phy::add_lightning, 
+            {"strike_count", "storm_dist", "active", "rfi"});
+    register_decoder(&kis_sensor_phy::add_aqi, 
+            {"pm2_5_ug_m3", "estimated_pm10_0_ug_m3"});
+
 	packetchain->register_handler(&packet_handler, this, CHAINPOS_CLASSIFIER, -100);
 
     track_last_record = 
@@ -115,11 +135,21 @@ kis_sensor_phy::~kis_sensor_phy() {
     packetchain->remove_handler(&packet_handler, CHAINPOS_CLASSIFIER);
 }
 
+void kis_sensor_phy::register_decoder(sensor_decoder_t in_decoder, 
+        const std::vector<std::string>& in_fields, sensor_check_t in_check) {
+    uint32_t bit = 1 << decoders.size();
+
+    decoders.push_back(sensor_decoder{in_decoder, in_check});
+
+    for (const auto& f : in_fields)
+        decoder_fields[f] |= bit;
+}
+
 double kis_sensor_phy::f_to_c(double f) {
     return (f - 32) / (double) 1.8f;
 }
 
-mac_addr kis_sensor_phy::json_to_mac(nlohmann::json json) {
+mac_addr kis_sensor_phy::json_to_mac(const nlohmann::json& json) {
     // Derive a mac addr from the model and device id data
     //
     // We turn the model string into 4 bytes using the adler32 checksum,
@@ -136,14 +166,14 @@ mac_addr kis_sensor_phy::json_to_mac(nlohmann::json json) {
     std::string smodel = "unk";
 
     try {
-        smodel = json["model"].get<std::string>();
+        smodel = json_field(json, "model").get<std::string>();
     } catch (...) { }
 
     *checksum = adler32_checksum(smodel.c_str(), smodel.length());
 
     bool set_model = false;
 
-    auto idmem = json["id"];
+    auto idmem = json_field(json, "id");
     if (idmem.is_number()) {
         *model = kis_hton16((uint16_t) idmem.get<unsigned int>());
         set_model = true;
@@ -154,7 +184,7 @@ mac_addr kis_sensor_phy::json_to_mac(nlohmann::json json) {
         set_model = true;
     }
 
-    auto fromid = json["from_id"];
+    auto fromid = json_field(json, "from_id");
     if (fromid.is_string()) {
         smodel = munge_to_printable(fromid.get<std::string>());
         *checksum = adler32_checksum(smodel);
@@ -162,8 +192,8 @@ mac_addr kis_sensor_phy::json_to_mac(nlohmann::json json) {
         set_model = true;
     }
 
-    if (!set_model && !json["device"].is_null()) {
-        auto d = json["device"];
+    if (!set_model && !json_field(json, "device").is_null()) {
+        auto d = json_field(json, "device");
         if (d.is_number()) {
             *model = kis_hton16((uint16_t) d.get<unsigned int>());
             set_model = true;
@@ -180,7 +210,7 @@ mac_addr kis_sensor_phy::json_to_mac(nlohmann::json json) {
     return mac_addr(bytes, 6);
 }
 
-bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet> packet) {
+bool kis_sensor_phy::json_to_rtl(const nlohmann::json& json, std::shared_ptr<kis_packet> packet) {
     std::string err;
     std::string v;
 
@@ -203,20 +233,20 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
     common->datasize = 0;
 
     // If this json record has a channel
-    auto channel_j = json["channel"];
+    auto channel_j = json_field(json, "channel");
 
     if (channel_j.is_string())
         common->channel = munge_to_printable(channel_j);
     else if (channel_j.is_number()) 
         common->channel = fmt::format("{}", channel_j.get<int>());
 
-    auto freq_j = json["freq"];
+    auto freq_j = json_field(json, "freq");
 
     if (!freq_j.is_number())
-        freq_j = json["freq1"];
+        freq_j = json_field(json, "freq1");
 
     if (!freq_j.is_number())
-        freq_j = json["freq2"];
+        freq_j = json_field(json, "freq2");
 
     if (freq_j.is_number() && freq_j.get<double>() != 0) {
         common->freq_khz = freq_j.get<double>() * 1000;
@@ -230,26 +260,48 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
                 (UCD_UPDATE_FREQUENCIES | UCD_UPDATE_PACKETS | UCD_UPDATE_LOCATION |
                  UCD_UPDATE_SEENBY), "RF Sensor");
 
-    kis_lock_guard<kis_mutex> lk(devicetracker->get_devicelist_mutex(), "sensor_json_to_rtl");
-
     std::string dn = "Sensor";
 
-    if (json["model"].is_string()) {
-        if (json["id"].is_string()) {
-            dn = fmt::format("{}-{}", munge_to_printable(json["model"]), 
-                    munge_to_printable(json["id"]));
-        } else if (json["id"].is_number()) {
-            dn = fmt::format("{}-{}", munge_to_printable(json["model"]), 
-                    json["id"].get<unsigned int>());
+    if (json_field(json, "model").is_string()) {
+        if (json_field(json, "id").is_string()) {
+            dn = fmt::format("{}-{}", munge_to_printable(json_field(json, "model")), 
+                    munge_to_printable(json_field(json, "id")));
+        } else if (json_field(json, "id").is_number()) {
+            dn = fmt::format("{}-{}", munge_to_printable(json_field(json, "model")), 
+                    json_field(json, "id").get<unsigned int>());
         } else {
-            dn = munge_to_printable(json["model"]);
+            dn = munge_to_printable(json_field(json, "model"));
         }
-    } else if (json["id"].is_string()) {
-        dn = munge_to_printable(json["id"]);
-    } else if (json["id"].is_number()) {
-        dn = fmt::format("{}", json["id"].get<unsigned int>());
+    } else if (json_field(json, "id").is_string()) {
+        dn = munge_to_printable(json_field(json, "id"));
+    } else if (json_field(json, "id").is_number()) {
+        dn = fmt::format("{}", json_field(json, "id").get<unsigned int>());
+    }
+
+    // Find the decoders for the sensor types in this record; this only looks at the
+    // record, so it's done before we lock the devices
+    uint32_t matched = 0;
+
+    for (auto i = json.begin(); json.is_object() && i != json.end(); ++i) {
+        if (i.value().is_null())
+            continue;
+
+        auto d = decoder_fields.find(i.key());
+
+        if (d != decoder_fields.end())
+            matched |= d->second;
     }
 
+    for (size_t d = 0; matched != 0 && d < decoders.size(); d++) {
+        if ((matched & (1 << d)) == 0)
+            continue;
+
+        if (decoders[d].check != nullptr && !(this->*decoders[d].check)(json))
+            matched &= ~(1 << d);
+    }
+
+    kis_unique_lock<kis_mutex> lk(devicetracker->get_devicelist_mutex(), "sensor_json_to_rtl");
+
     basedev->set_manuf(sensor_manuf);
 
     basedev->set_tracker_type_string(devicetracker->get_cached_devicetype("Sensor"));
@@ -276,7 +328,7 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         commondev->set_model(dn);
 
         bool set_id = false;
-        auto id_j = json["id"];
+        auto id_j = json_field(json, "id");
 
         if (id_j.is_number())
             commondev->set_rtlid(fmt::format("{}", id_j.get<int>()));
@@ -286,7 +338,7 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         }
 
         if (!set_id) {
-            auto device_j = json["device"];
+            auto device_j = json_field(json, "device");
 
             if (device_j.is_number())
                 commondev->set_rtlid(fmt::format("{}", device_j.get<int>()));
@@ -316,9 +368,9 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         commondev->set_subchannel(munge_to_printable(channel_j));
     
 
-    auto battery_j = json["battery"];
+    auto battery_j = json_field(json, "battery");
     if (battery_j.is_null()) {
-        battery_j = json["battery_ok"];
+        battery_j = json_field(json, "battery_ok");
     }
 
     if (battery_j.is_string()) {
@@ -329,48 +381,31 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         commondev->set_battery(fmt::format("{}", battery_j.get<bool>()));
     }
 
-    auto rssi_j = json["rssi"];
+    auto rssi_j = json_field(json, "rssi");
     if (rssi_j.is_number())
         commondev->set_rssi(fmt::format("{}", rssi_j.get<int>()));
     else if (rssi_j.is_string())
         commondev->set_rssi(munge_to_printable(rssi_j));
 
-    auto snr_j = json["snr"];
+    auto snr_j = json_field(json, "snr");
     if (snr_j.is_number())
         commondev->set_snr(fmt::format("{}", snr_j.get<int>()));
     else if (snr_j.is_string())
         commondev->set_snr(munge_to_printable(snr_j));
 
 
-    auto noise_j = json["noise"];
+    auto noise_j = json_field(json, "noise");
     if (noise_j.is_number())
         commondev->set_noise(fmt::format("{}", noise_j.get<int>()));
     else if (noise_j.is_string())
         commondev->set_noise(munge_to_printable(noise_j));
 
-    if (is_thermometer(json))
-        add_thermometer(json, rtlholder);
-
-    if (is_moisture(json))
-        add_moisture(json, rtlholder);
-
-    if (is_weather_station(json))
-        add_weather_station(json, rtlholder);
-
-    if (is_tpms(json))
-        add_tpms(json, rtlholder);
-
-    if (is_switch(json))
-        add_switch(json, rtlholder);
-
-    if (is_insteon(json))
-        add_insteon(json, rtlholder);
-
-    if (is_lightning(json))
-        add_lightning(json, rtlholder);
+    for (size_t d = 0; matched != 0 && d < decoders.size(); d++) {
+        if ((matched & (1 << d)) == 0)
+            continue;
 
-    if (is_aqi(json))
-        add_aqi(json, rtlholder);
+        (this->*decoders[d].decoder)(json, rtlholder);
+    }
 
     if (newrtl && commondev != NULL) {
         std::string info = "Detected new RF sensor device '" + commondev->get_model() + "'";
@@ -381,68 +416,17 @@ bool kis_sensor_phy::json_to_rtl(nlohmann::json json, std::shared_ptr<kis_packet
         if (commondev->get_subchannel() != "0")
             info += " Channel " + commondev->get_subchannel();
 
+        lk.unlock();
+
         _MSG(info, MSGFLAG_INFO);
     }
 
     return true;
 }
 
-bool kis_sensor_phy::is_weather_station(nlohmann::json json) {
-    if (!json["direction_deg"].is_null())
-        return true;
-
-    if (!json["windstrength"].is_null())
-        return true;
-
-    if (!json["winddirection"].is_null())
-        return true;
-
-    if (!json["wind_dir_deg"].is_null())
-        return true;
-
-    if (!json["wind_avg_km_h"].is_null())
-        return true;
-
-    if (!json["wind_max_km_h"].is_null())
-        return true;
-
-    if (!json["speed"].is_null())
-        return true;
-
-    if (!json["gust"].is_null())
-        return true;
-
-    if (!json["rain"].is_null())
-        return true;
-
-    if (!json["rain_mm"].is_null())
-        return true;
-
-    if (!json["rain_raw"].is_null())
-        return true;
-
-    if (!json["uv_index"].is_null())
-        return true;
-
-    if (!json["lux"].is_null())
-        return true;
-
-    return false;
-}
-
-bool kis_sensor_phy::is_thermometer(nlohmann::json json) {
-    if (!json["temperature_F"].is_null())
-        return true;
-
-    if (!json["temperature_C"].is_null())
-        return true;
-
-    return false;
-}
-
-bool kis_sensor_phy::is_tpms(nlohmann::json json) {
+bool kis_sensor_phy::is_tpms(const nlohmann::json& json) {
     try {
-        return json["type"] == "TPMS";
+        return json_field(json, "type") == "TPMS";
 
     } catch (...) {
         return false;
@@ -451,96 +435,10 @@ bool kis_sensor_phy::is_tpms(nlohmann::json json) {
     return false;
 }
 
-bool kis_sensor_phy::is_switch(nlohmann::json json) {
-    if (!json["switch0"].is_null())
-        return true;
-
-    if (!json["switch1"].is_null())
-        return true;
-
-    if (!json["switch1"].is_null())
-        return true;
-
-    if (!json["switch2"].is_null())
-        return true;
-
-    if (!json["switch3"].is_null())
-        return true;
-
-    if (!json["switch4"].is_null())
-        return true;
-
-    if (!json["switch5"].is_null())
-        return true;
-
-    if (!json["switch6"].is_null())
-        return true;
-
-    return false;
-}
-
-bool kis_sensor_phy::is_insteon(nlohmann::json json) {
-    if (!json["from_id"].is_null())
-        return true;
-
-    if (!json["to_id"].is_null())
-        return true;
-
-    if (!json["msg_type"].is_null())
-        return true;
-
-    if (!json["msg_str"].is_null())
-        return true;
-
-    if (!json["hopsmax"].is_null())
-        return true;
-
-    if (!json["hopsleft"].is_null())
-        return true;
-
-    return false;
-}
-
-bool kis_sensor_phy::is_lightning(nlohmann::json json) {
-    if (!json["strike_count"].is_null())
-        return true;
-
-    if (!json["storm_dist"].is_null())
-        return true;
-
-    if (!json["active"].is_null())
-        return true;
-
-    if (!json["rfi"].is_null())
-        return true;
-
-    return false;
-}
-
-bool kis_sensor_phy::is_moisture(nlohmann::json json) {
-    if (!json["moisture"].is_null())
-        return true;
-
-    if (!json["humidity"].is_null())
-        return true;
-
-    return false;
-}
-
-bool kis_sensor_phy::is_aqi(nlohmann::json json) {
-    if (!json["pm2_5_ug_m3"].is_null())
-        return true;
-
-    if (!json["estimated_pm10_0_ug_m3"].is_null())
-        return true;
-
-    return false;
-}
-
-void kis_sensor_phy::add_weather_station(nlohmann::json json, 
+void kis_sensor_phy::add_weather_station(const nlohmann::json& json, 
         std::shared_ptr<tracker_element_map> rtlholder) {
-    auto uv_index_j = json["uv_index"];
-    auto lux_j = json["lux"];
+    auto uv_index_j = json_field(json, "uv_index");
+    auto lux_j = json_field(json, "lux");
 
     auto weatherdev = 
         rtlholder->get_sub_as<sensor_tracked_weatherstation>(sensor_weatherstation_id);
@@ -554,75 +452,75 @@ void kis_sensor_phy::add_weather_station(nlohmann::json json,
     // {"time": "2023-07-13 18:31:29", "model": "Fineoffset-WHx080", "subtype": 0, "id": 129, "battery_ok": 1, "temperature_C": 30.9, "humidity": 50, "wind_dir_deg": 180, "wind_avg_km_h": 2.448, "wind_max_km_h": 4.896, "rain_mm": 0.0, "mic": "CRC", "mod": "ASK", "freq": 433.861, "rssi": -0.13, "snr": 15.077, "noise": -15.207}
 
     try {
-        weatherdev->set_wind_dir(json["winddirection"].get<double>());
-        weatherdev->get_wind_dir_rrd()->add_sample(json["winddirection"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_dir(json_field(json, "winddirection").get<double>());
+        weatherdev->get_wind_dir_rrd()->add_sample(json_field(json, "winddirection").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_dir(json["wind_dir_deg"].get<double>());
-        weatherdev->get_wind_dir_rrd()->add_sample(json["wind_dir_deg"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_dir(json_field(json, "wind_dir_deg").get<double>());
+        weatherdev->get_wind_dir_rrd()->add_sample(json_field(json, "wind_dir_deg").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["windspeed"].get<double>());
-        weatherdev->get_wind_speed_rrd()->add_sample(json["windspeed"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "windspeed").get<double>());
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "windspeed").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["windstrength"].get<double>());
-        weatherdev->get_wind_speed_rrd()->add_sample(json["windstrength"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "windstrength").get<double>());
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "windstrength").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["wind_avg_km_h"].get<double>());
-        weatherdev->get_wind_speed_rrd()->add_sample(json["wind_avg_km_h"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "wind_avg_km_h").get<double>());
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "wind_avg_km_h").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_speed(json["speed"].get<double>());
-        weatherdev->get_wind_speed_rrd()->add_sample(json["speed"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_speed(json_field(json, "speed").get<double>());
+        weatherdev->get_wind_speed_rrd()->add_sample(json_field(json, "speed").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_gust(json["gust"].get<double>());
-        weatherdev->get_wind_gust_rrd()->add_sample(json["gust"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_gust(json_field(json, "gust").get<double>());
+        weatherdev->get_wind_gust_rrd()->add_sample(json_field(json, "gust").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_wind_gust(json["wind_max_km_h"].get<double>());
-        weatherdev->get_wind_gust_rrd()->add_sample(json["wind_max_km_h"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_wind_gust(json_field(json, "wind_max_km_h").get<double>());
+        weatherdev->get_wind_gust_rrd()->add_sample(json_field(json, "wind_max_km_h").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
-    if (json["rain"].is_number()) {
+    if (json_field(json, "rain").is_number()) {
         try {
-            weatherdev->set_rain(json["rain"].get<double>());
-            weatherdev->get_rain_rrd()->add_sample(json["rain"].get<double>(), Globalreg::globalreg->last_tv_sec);
+            weatherdev->set_rain(json_field(json, "rain").get<double>());
+            weatherdev->get_rain_rrd()->add_sample(json_field(json, "rain").get<double>(), Globalreg::globalreg->last_tv_sec);
         } catch (...) { }
-    } else if (json["rain_mm"].is_number()) {
+    } else if (json_field(json, "rain_mm").is_number()) {
         try {
-            weatherdev->set_rain(json["rain_mm"].get<double>());
-            weatherdev->get_rain_rrd()->add_sample(json["rain_mm"].get<double>(), 
+            weatherdev->set_rain(json_field(json, "rain_mm").get<double>());
+            weatherdev->get_rain_rrd()->add_sample(json_field(json, "rain_mm").get<double>(), 
                     Globalreg::globalreg->last_tv_sec);
         } catch (...) { }
     }
 
     try {
-        weatherdev->set_rain_raw(json["rain_raw"].get<double>());
+        weatherdev->set_rain_raw(json_field(json, "rain_raw").get<double>());
     } catch (...) { }
 
     try {
-        weatherdev->set_uv_index(json["uv_index"].get<double>());
-        weatherdev->get_uv_index_rrd()->add_sample(json["uv_index"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_uv_index(json_field(json, "uv_index").get<double>());
+        weatherdev->get_uv_index_rrd()->add_sample(json_field(json, "uv_index").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        weatherdev->set_lux(json["lux"].get<double>());
-        weatherdev->get_lux_rrd()->add_sample(json["lux"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        weatherdev->set_lux(json_field(json, "lux").get<double>());
+        weatherdev->get_lux_rrd()->add_sample(json_field(json, "lux").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
 }
 
-void kis_sensor_phy::add_thermometer(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_thermometer(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     auto thermdev = 
         rtlholder->get_sub_as<sensor_tracked_thermometer>(sensor_thermometer_id);
 
@@ -633,18 +531,18 @@ void kis_sensor_phy::add_thermometer(nlohmann::json json, std::shared_ptr<tracke
     }
 
     try {
-        thermdev->set_temperature(f_to_c(json["temperature_F"].get<double>()));
-        thermdev->get_temperature_rrd()->add_sample(f_to_c(json["temperature_F"].get<double>()), Globalreg::globalreg->last_tv_sec);
+        thermdev->set_temperature(f_to_c(json_field(json, "temperature_F").get<double>()));
+        thermdev->get_temperature_rrd()->add_sample(f_to_c(json_field(json, "temperature_F").get<double>()), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        thermdev->set_temperature(json["temperature_C"].get<double>());
-        thermdev->get_temperature_rrd()->add_sample(json["temperature_C"].get<double>(), Globalreg::globalreg->last_tv_sec);
+        thermdev->set_temperature(json_field(json, "temperature_C").get<double>());
+        thermdev->get_temperature_rrd()->add_sample(json_field(json, "temperature_C").get<double>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
 }
 
-void kis_sensor_phy::add_tpms(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_tpms(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     //{"time" : "2023-06-12 11:16:48", "model" : "Schrader-EG53MA4", "type" : "TPMS", "flags" : "4d930078", "id" : "891932", "pressure_kPa" : 220.000, "temperature_F" : 103.000, "mic" : "CHECKSUM", "mod" : "ASK", "freq" : 314.931, "rssi" : -2.296, "snr" : 6.350, "noise" : -8.646}
     //{"time" : "2023-06-12 20:30:58", "model" : "Toyota", "type" : "TPMS", "id" : "da22b333", "status" : 128, "pressure_PSI" : 30.250, "temperature_C" : 20.000, "mic" : "CRC", "mod" : "FSK", "freq1" : 315.009, "freq2" : 314.962, "rssi" : -6.950, "snr" : 26.163, "noise" : -33.113} 
     auto tpmsdev = 
@@ -657,44 +555,44 @@ void kis_sensor_phy::add_tpms(nlohmann::json json, std::shared_ptr<tracker_eleme
     }
 
     try {
-        tpmsdev->set_temperature(f_to_c(json["temperature_F"].get<double>()));
+        tpmsdev->set_temperature(f_to_c(json_field(json, "temperature_F").get<double>()));
     } catch (...) { }
 
     try {
-        tpmsdev->set_temperature(json["temperature_C"].get<double>());
+        tpmsdev->set_temperature(json_field(json, "temperature_C").get<double>());
     } catch (...) { }
 
     try {
-        tpmsdev->set_pressure_psi(json["pressure_PSI"].get<double>());
+        tpmsdev->set_pressure_psi(json_field(json, "pressure_PSI").get<double>());
     } catch (...) { }
 
     try {
-        tpmsdev->set_pressure_bar(json["pressure_bar"].get<double>());
+        tpmsdev->set_pressure_bar(json_field(json, "pressure_bar").get<double>());
     } catch (...) { }
 
     try {
-        tpmsdev->set_pressure_kpa(json["pressure_kPa"].get<double>());
+        tpmsdev->set_pressure_kpa(json_field(json, "pressure_kPa").get<double>());
     } catch (...) { }
 
     try {
-        tpmsdev->set_flags(munge_to_printable(json["flags"]));
+        tpmsdev->set_flags(munge_to_printable(json_field(json, "flags")));
     } catch (...) { }
 
     try {
-        tpmsdev->set_checksum(munge_to_printable(json["mic"]));
+        tpmsdev->set_checksum(munge_to_printable(json_field(json, "mic")));
     } catch (...) { }
 
     try {
-        tpmsdev->set_state(munge_to_printable(json["state"]));
+        tpmsdev->set_state(munge_to_printable(json_field(json, "state")));
     } catch (...) { }
 
     try {
-        tpmsdev->set_code(munge_to_printable(json["code"]));
+        tpmsdev->set_code(munge_to_printable(json_field(json, "code")));
     } catch (...) { }
 
 }
 
-void kis_sensor_phy::add_switch(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_switch(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     //{"time" : "2021-08-18 16:16:54", "model" : "Interlogix-Security", "subtype" : "contact", "id" : "a55b4b", "battery_ok" : 1, "switch1" : "OPEN", "switch2" : "OPEN", "switch3" : "OPEN", "switch4" : "OPEN", "switch5" : "OPEN", "raw_message" : "2dd4ac"}
 
     auto switchdev = 
@@ -707,36 +605,36 @@ void kis_sensor_phy::add_switch(nlohmann::json json, std::shared_ptr<tracker_ele
     }
 
     try {
-        switchdev->set_switch1(munge_to_printable(json["switch1"]));
+        switchdev->set_switch1(munge_to_printable(json_field(json, "switch1")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch2(munge_to_printable(json["switch2"]));
+        switchdev->set_switch2(munge_to_printable(json_field(json, "switch2")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch3(munge_to_printable(json["switch3"]));
+        switchdev->set_switch3(munge_to_printable(json_field(json, "switch3")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch4(munge_to_printable(json["switch4"]));
+        switchdev->set_switch4(munge_to_printable(json_field(json, "switch4")));
     } catch (...) { }
 
     try {
-        switchdev->set_switch5(munge_to_printable(json["switch5"]));
+        switchdev->set_switch5(munge_to_printable(json_field(json, "switch5")));
     } catch (...) { }
 
     /*
-    auto model_j = json["model"];
-    auto subtype_j = json["subtype"];
-    auto battery_j = json["battery_ok"];
-    auto msg_j = json["raw_message"];
-    auto sw_id = json["id"];
+    auto model_j = json_field(json, "model");
+    auto subtype_j = json_field(json, "subtype");
+    auto battery_j = json_field(json, "battery_ok");
+    auto msg_j = json_field(json, "raw_message");
+    auto sw_id = json_field(json, "id");
     */
     
 }
 
-void kis_sensor_phy::add_insteon(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_insteon(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     //{"time" : "2021-08-19 18:52:48", "model" : "Insteon", "from_id" : "CCFF79", "to_id" : "9F39E6", "msg_type" : 7, "msg_str" : "NAK of Group Cleanup Direct Message", "extended" : 0, "hopsmax" : 3, "hopsleft" : 0, "formatted" : "E3 : 9F39E6 : CCFF79 : 39 E7  B7", "mic" : "CRC", "payload" : "E3E6399F79FFCC39E7B7", "cmd_dat" : [57, 231], "mod" : "FSK", "freq1" : 914.909, "freq2" : 915.069, "rssi" : -0.212, "snr" : 25.305, "noise" : -25.517}
     
     auto insteondev =
@@ -749,32 +647,32 @@ void kis_sensor_phy::add_insteon(nlohmann::json json, std::shared_ptr<tracker_el
     }
 
     try {
-        insteondev->set_from_id(munge_to_printable(json["from_id"]));
+        insteondev->set_from_id(munge_to_printable(json_field(json, "from_id")));
     } catch (...) { }
 
     try {
-        insteondev->set_to_id(munge_to_printable(json["to_id"]));
+        insteondev->set_to_id(munge_to_printable(json_field(json, "to_id")));
     } catch (...) { }
 
     try {
-        insteondev->set_msg_type(munge_to_printable(json["msg_type"]));
+        insteondev->set_msg_type(munge_to_printable(json_field(json, "msg_type")));
     } catch (...) { }
 
     try {
-        insteondev->set_msg_str(munge_to_printable(json["msg_str"]));
+        insteondev->set_msg_str(munge_to_printable(json_field(json, "msg_str")));
     } catch (...) { }
 
     try {
-        insteondev->set_hopsmax(munge_to_printable(json["hopsmax"]));
+        insteondev->set_hopsmax(munge_to_printable(json_field(json, "hopsmax")));
     } catch (...) { }
 
     try {
-        insteondev->set_hopsleft(munge_to_printable(json["hopsleft"]));
+        insteondev->set_hopsleft(munge_to_printable(json_field(json, "hopsleft")));
     } catch (...) { }
 }
 
 
-void kis_sensor_phy::add_lightning(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_lightning(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     // {"time" : "2019-02-24 22:12:13", "model" : "Acurite Lightning 6045M", "id" : 15580, "channel" : "B", "temperature_F" : 38.300, "humidity" : 53, "strike_count" : 1, "storm_dist" : 8, "active" : 1, "rfi" : 0, "ussb1" : 0, "battery" : "OK", "exception" : 0, "raw_msg" : "bcdc6f354edb81886e"}
     
     auto lightningdev = 
@@ -787,25 +685,25 @@ void kis_sensor_phy::add_lightning(nlohmann::json json, std::shared_ptr<tracker_
     }
 
     try {
-        lightningdev->set_strike_count(json["strike_count"].get<unsigned int>());
-        lightningdev->get_strike_count_rrd()->add_sample(json["strike_count"].get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
+        lightningdev->set_strike_count(json_field(json, "strike_count").get<unsigned int>());
+        lightningdev->get_strike_count_rrd()->add_sample(json_field(json, "strike_count").get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
     } catch (...) { }
 
     try {
-        lightningdev->set_storm_distance(json["storm_dist"].get<uint64_t>());
+        lightningdev->set_storm_distance(json_field(json, "storm_dist").get<uint64_t>());
     } catch (...) { }
 
     try {
-        lightningdev->set_storm_active(json["active"].get<unsigned int>());
+        lightningdev->set_storm_active(json_field(json, "active").get<unsigned int>());
     } catch (...) { }
 
     try {
-        lightningdev->set_lightning_rfi(json["rfi"].get<unsigned int>());
+        lightningdev->set_lightning_rfi(json_field(json, "rfi").get<unsigned int>());
     } catch (...) { }
 
 }
 
-void kis_sensor_phy::add_moisture(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_moisture(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     auto mdev = 
         rtlholder->get_sub_as<sensor_tracked_moisture>(sensor_moisture_id);
 
@@ -815,23 +713,23 @@ void kis_sensor_phy::add_moisture(nlohmann::json json, std::shared_ptr<tracker_e
         rtlholder->insert(mdev);
     }
 
-    if (json["moisture"].is_number()) {
+    if (json_field(json, "moisture").is_number()) {
         try {
-            mdev->set_moisture(json["moisture"].get<unsigned int>());
-            mdev->get_moisture_rrd()->add_sample(json["moisture"].get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
+            mdev->set_moisture(json_field(json, "moisture").get<unsigned int>());
+            mdev->get_moisture_rrd()->add_sample(json_field(json, "moisture").get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
         } catch (...) { }
     }
 
-    if (json["humidity"].is_number()) {
+    if (json_field(json, "humidity").is_number()) {
         try {
-            mdev->set_moisture(json["humidity"].get<unsigned int>());
-            mdev->get_moisture_rrd()->add_sample(json["humidity"].get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
+            mdev->set_moisture(json_field(json, "humidity").get<unsigned int>());
+            mdev->get_moisture_rrd()->add_sample(json_field(json, "humidity").get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
         } catch (...) { }
     }
 
 }
 
-void kis_sensor_phy::add_aqi(nlohmann::json json, std::shared_ptr<tracker_element_map> rtlholder) {
+void kis_sensor_phy::add_aqi(const nlohmann::json& json, std::shared_ptr<tracker_element_map> rtlholder) {
     auto mdev = 
         rtlholder->get_sub_as<sensor_tracked_aqi>(sensor_aqi_id);
 
@@ -841,17 +739,17 @@ void kis_sensor_phy::add_aqi(nlohmann::json json, std::shared_ptr<tracker_elemen
         rtlholder->insert(mdev);
     }
 
-    if (json["pm2_5_ug_m3"].is_number()) {
+    if (json_field(json, "pm2_5_ug_m3").is_number()) {
         try {
-            mdev->set_pm2_5(json["pm2_5_ug_m3"].get<unsigned int>());
-            mdev->get_pm2_5_rrd()->add_sample(json["pm2_5_ug_m3"].get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
+            mdev->set_pm2_5(json_field(json, "pm2_5_ug_m3").get<unsigned int>());
+            mdev->get_pm2_5_rrd()->add_sample(json_field(json, "pm2_5_ug_m3").get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
         } catch (...) { }
     }
 
-    if (json["estimated_pm10_0_ug_m3"].is_number()) {
+    if (json_field(json, "estimated_pm10_0_ug_m3").is_number()) {
         try {
-            mdev->set_pm10(json["estimated_pm10_0_ug_m3"].get<unsigned int>());
-            mdev->get_pm10_rrd()->add_sample(json["estimated_pm10_0_ug_m3"].get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
+            mdev->set_pm10(json_field(json, "estimated_pm10_0_ug_m3").get<unsigned int>());
+            mdev->get_pm10_rrd()->add_sample(json_field(json, "estimated_pm10_0_ug_m3").get<unsigned int>(), Globalreg::globalreg->last_tv_sec);
         } catch (...) { }
     }
 
@@ -871,20 +769,21 @@ int kis_sensor_phy::packet_handler(CHAINCALL_PARMS) {
     if (json->type != "RTL433")
         return 0;
 
-    std::stringstream ss(json->json_string);
-    nlohmann::json device_json;
+    auto device_json = json->document();
+    if (device_json == nullptr) {
+        _MSG_DEBUG("RTL json error: invalid JSON record");
+        return 0;
+    }
 
     try {
-        ss >> device_json;
-
         // Manually exclude other phys that also use rtl433 data
-        if (kis_meter_phy::is_meter(device_json))
+        if (kis_meter_phy::is_meter(*device_json))
             return 0;
 
         // _MSG_DEBUG("RTL433 data: {}", json->json_string);
 
         // Copy the JSON as the meta field for logging, if it's valid
-        if (sensor->json_to_rtl(device_json, in_pack)) {
+        if (sensor->json_to_rtl(*device_json, in_pack)) {
             auto metablob = in_pack->fetch<packet_metablob>(sensor->pack_comp_meta);
             if (metablob == nullptr) {
                 metablob = std::make_shared<packet_metablob>("sensor", json->json_string);
@@ -21,6 +21,9 @@
 #define __PHY_SENSOR_H__ 
 
 #include "config.h"
+
+#include <unordered_map>
+
 #include "globalregistry.h"
 #include "trackedelement.h"
 #include "devicetracker_component.h"
@@ -680,32 +683,45 @@ public:
 
 protected:
     // Convert a JSON record to a RTL-based device key
-    mac_addr json_to_mac(nlohmann::json in_json);
+    mac_addr json_to_mac(const nlohmann::json& in_json);
 
     // convert to a device record & push into device tracker, return false
     // if we can't do anything with it
-    bool json_to_rtl(nlohmann::json in_json, std::shared_ptr<kis_packet> packet);
-
-    bool is_weather_station(nlohmann::json json);
-    bool is_thermometer(nlohmann::json json);
-    bool is_tpms(nlohmann::json json);
-    bool is_switch(nlohmann::json json);
-    bool is_insteon(nlohmann::json json);
-    bool is_lightning(nlohmann::json json);
-    bool is_moisture(nlohmann::json json);
-    bool is_aqi(nlohmann::json json);
-
-    void add_weather_station(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_thermometer(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_tpms(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_switch(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_insteon(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_lightning(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_moisture(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
-    void add_aqi(nlohmann::json json, std::shared_ptr<tracker_element_map> sensorholder);
+    bool json_to_rtl(const nlohmann::json& in_json, std::shared_ptr<kis_packet> packet);
+
+    bool is_tpms(const nlohmann::json& json);
+
+    void add_weather_station(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_thermometer(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_tpms(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_switch(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_insteon(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_lightning(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_moisture(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
+    void add_aqi(const nlohmann::json& json, std::shared_ptr<tracker_element_map> sensorholder);
 
     double f_to_c(double f);
 
+    // A record may carry several types of sensor; each type has a decoder which is
+    // selected by any of the fields which only that type of record has, and optionally
+    // a check of the record once a field has matched.  Records are matched against the
+    // decoders in one pass over their fields
+    typedef void (kis_sensor_phy::*sensor_decoder_t)(const nlohmann::json&,
+            std::shared_ptr<tracker_element_map>);
+    typedef bool (kis_sensor_phy::*sensor_check_t)(const nlohmann::json&);
+
+    struct sensor_decoder {
+        sensor_decoder_t decoder;
+        sensor_check_t check;
+    };
+
+    void register_decoder(sensor_decoder_t in_decoder, const std::vector<std::string>& in_fields,
+            sensor_check_t in_check = nullptr);
+
+    // Decoders in the order they're applied, and the decoder bits selected by each field
+    std::vector<sensor_decoder> decoders;
+    std::unordered_map<std::string, uint32_t> decoder_fields;
+
 
 protected:
     std::shared_ptr<packet_chain> packetchain;
@@ -25,6 +25,9 @@
 #include "devicetracker.h"
 #include "messagebus.h"
 
+// Bound the per-BSSID match cache; it's rebuilt from scratch if it grows past this
+#define UAV_MATCH_CACHE_MAX         65536
+
 void uav_manuf_match::set_uav_manuf_ssid_regex(const std::string& in_regexstr) {
 #if defined(HAVE_LIBPCRE1)
     const char *compile_error, *study_error;
@@ -62,6 +65,8 @@ void uav_manuf_match::set_uav_manuf_ssid_regex(const std::string& in_regexstr) {
         throw std::runtime_error(fmt::format("Could not parse PCRE regex: {} at {}",
                     (int) erroroffset, (char *) buffer));
     }
+
+    match_data = pcre2_match_data_create_from_pattern(re, NULL);
 #else
     throw std::runtime_error("Cannot set PCRE match for SSID; Kismet was not compiled with PCRE "
             "support");
@@ -133,15 +138,16 @@ Kis_UAV_Phy::Kis_UAV_Phy(int in_phyid) :
         Globalreg::fetch_mandatory_global_as<kis_httpd_registry>();
     httpregistry->register_js_module("kismet_ui_uav", "js/kismet.ui.uav.js");
 
-    // Parse the ssid regex options
-    auto uav_lines = Globalreg::globalreg->kismet_config->fetch_opt_vec("uav_match");
-    for (auto l : uav_lines)
-        parse_manuf_definition(l);
+    // The ssid regex options are compiled the first time they're needed
+    uav_match_lines = Globalreg::globalreg->kismet_config->fetch_opt_vec("uav_match");
 
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
     httpd->register_route("/phy/phyuav/manuf_matchers", {"GET", "POST"}, httpd->RO_ROLE, {},
-            std::make_shared<kis_net_web_tracked_endpoint>(manuf_match_vec, uav_mutex));
+            std::make_shared<kis_net_web_tracked_endpoint>(manuf_match_vec, uav_mutex,
+                [this](std::shared_ptr<tracker_element>) {
+                    load_manuf_definitions();
+                }));
 
 }
 
@@ -179,6 +185,17 @@ int Kis_UAV_Phy::CommonClassifier(CHAINCALL_PARMS) {
     if (devinfo == nullptr || commoninfo == nullptr || dot11info == nullptr)
         return 1;
 
+    // Match the SSID fingerprints before taking the device lock; almost every packet
+    // matches nothing and carries no DroneID, and never needs the lock at all
+    std::shared_ptr<uav_manuf_match> manuf_match;
+
+    if (dot11info->new_adv_ssid && dot11info->type == packet_management && 
+            (dot11info->subtype == packet_sub_beacon || dot11info->subtype == packet_sub_probe_resp))
+        manuf_match = uavphy->match_manuf(dot11info->bssid_mac, dot11info->ssid);
+
+    if (dot11info->droneid == nullptr && manuf_match == nullptr)
+        return 1;
+
     kis_lock_guard<kis_mutex> lk(uavphy->devicetracker->get_devicelist_mutex(), "uav_phy common_classifier");
 
     for (auto di : devinfo->devrefs) {
@@ -291,35 +308,81 @@ int Kis_UAV_Phy::CommonClassifier(CHAINCALL_PARMS) {
             }
         }
         
-        if (dot11info->new_adv_ssid && dot11info->type == packet_management && 
-                (dot11info->subtype == packet_sub_beacon || dot11info->subtype == packet_sub_probe_resp)) {
+        if (manuf_match != nullptr) {
+            auto uavdev =
+                basedev->get_sub_as<uav_tracked_device>(uavphy->uav_device_id);
+
+            if (uavdev == nullptr) {
+                uavdev =
+                    std::make_shared<uav_tracked_device>(uavphy->uav_device_id);
+                basedev->insert(uavdev);
+                uavdev->set_uav_manufacturer(manuf_match->get_uav_manuf_name());
+                uavdev->set_uav_model(manuf_match->get_uav_manuf_model());
+            }
 
-            for (auto mi : *(uavphy->manuf_match_vec)) {
-                auto m = std::static_pointer_cast<uav_manuf_match>(mi);
+            uavdev->set_tracker_matched_type(manuf_match);
 
-                if (m->match_record(dot11info->bssid_mac, dot11info->ssid)) {
-                    auto uavdev =
-                        basedev->get_sub_as<uav_tracked_device>(uavphy->uav_device_id);
+            uavdev->set_uav_match_type("UAV Fingerprint");
+        }
+    }
 
-                    if (uavdev == nullptr) {
-                        uavdev =
-                            std::make_shared<uav_tracked_device>(uavphy->uav_device_id);
-                        basedev->insert(uavdev);
-                        uavdev->set_uav_manufacturer(m->get_uav_manuf_name());
-                        uavdev->set_uav_model(m->get_uav_manuf_model());
-                    }
+    return 1;
+}
 
-                    uavdev->set_tracker_matched_type(m);
+std::shared_ptr<uav_manuf_match> Kis_UAV_Phy::match_manuf(const mac_addr& in_bssid,
+        const std::string& in_ssid) {
+    load_manuf_definitions();
 
-                    uavdev->set_uav_match_type("UAV Fingerprint");
+    auto ssid_csum = adler32_checksum(in_ssid);
 
-                    break;
-                }
+    // Matching shares the compiled regex state of each definition, so it's done under
+    // the cache lock; it only happens when a BSSID advertises a new SSID
+    kis_lock_guard<kis_mutex> lk(match_mutex, "uav_phy match_manuf");
+
+    auto cached = match_cache.find(in_bssid.longmac);
+    if (cached != match_cache.end() && cached->second.ssid_csum == ssid_csum)
+        return cached->second.match;
+
+    std::shared_ptr<uav_manuf_match> match;
+    size_t match_seq = (size_t) -1;
+
+    auto oui_matches = manuf_oui_map.find(in_bssid.OUI());
+
+    if (oui_matches != manuf_oui_map.end()) {
+        for (const auto& m : oui_matches->second) {
+            if (m.second->match_record(in_bssid, in_ssid)) {
+                match = m.second;
+                match_seq = m.first;
+                break;
             }
         }
     }
 
-    return 1;
+    for (const auto& m : manuf_any_vec) {
+        if (m.first > match_seq)
+            break;
+
+        if (m.second->match_record(in_bssid, in_ssid)) {
+            match = m.second;
+            break;
+        }
+    }
+
+    if (match_cache.size() >= UAV_MATCH_CACHE_MAX)
+        match_cache.clear();
+
+    match_cache[in_bssid.longmac] = uav_match_cache{ssid_csum, match};
+
+    return match;
+}
+
+void Kis_UAV_Phy::load_manuf_definitions() {
+    std::call_once(manuf_defs_once, [this]() {
+            for (const auto& l : uav_match_lines)
+                parse_manuf_definition(l);
+
+            uav_match_lines.clear();
+            });
 }
 
 bool Kis_UAV_Phy::parse_manuf_definition(std::string in_def) {
@@ -397,6 +460,17 @@ bool Kis_UAV_Phy::parse_manuf_definition(std::string in_def) {
 
     manuf_match_vec->push_back(manufmatch);
 
+    kis_lock_guard<kis_mutex> mlk(match_mutex, "uav_phy parse_manuf_definition");
+
+    auto seq = manuf_match_vec->size() - 1;
+
+    if (macstr != "" && mac.maskbits >= 24)
+        manuf_oui_map[mac.OUI()].push_back(uav_match_seq{seq, manufmatch});
+    else
+        manuf_any_vec.push_back(uav_match_seq{seq, manufmatch});
+
+    match_cache.clear();
+
     return true;
 }
 
@@ -20,10 +20,13 @@
 #ifndef __PHY_UAV_DRONE_H__
 #define __PHY_UAV_DRONE_H__
 
+#include <mutex>
+
 #include "trackedelement.h"
 #include "trackedlocation.h"
 #include "phyhandler.h"
 #include "packetchain.h"
+#include "robin_hood.h"
 
 #include "dot11_parsers/dot11_ie_221_dji_droneid.h"
 
@@ -421,10 +424,36 @@ public:
             shared_tracker_element in_device);
 
 protected:
+    // Compile the uav_match definitions from the config, once, when they're first needed
+    void load_manuf_definitions();
+    std::once_flag manuf_defs_once;
+    std::vector<std::string> uav_match_lines;
+
     bool parse_manuf_definition(std::string def);
 
+    // Find the first manufacturer definition, in config order, matching a BSSID and SSID
+    std::shared_ptr<uav_manuf_match> match_manuf(const mac_addr& in_bssid,
+            const std::string& in_ssid);
+
     kis_mutex uav_mutex;
 
+    // Definitions indexed by the OUI they match, so a beacon is only compared to the
+    // definitions of its OUI; definitions with no MAC, or a MAC mask shorter than an
+    // OUI, are compared to every beacon.  Each is paired with its position in the
+    // config so the first match still wins.
+    using uav_match_seq = std::pair<size_t, std::shared_ptr<uav_manuf_match>>;
+    robin_hood::unordered_flat_map<uint32_t, std::vector<uav_match_seq>> manuf_oui_map;
+    std::vector<uav_match_seq> manuf_any_vec;
+
+    // Last match result per BSSID, valid as long as the BSSID advertises the same SSID
+    struct uav_match_cache {
+        uint32_t ssid_csum;
+        std::shared_ptr<uav_manuf_match> match;
+    };
+
+    robin_hood::unordered_flat_map<uint64_t, uav_match_cache> match_cache;
+    kis_mutex match_mutex;
+
     std::shared_ptr<packet_chain> packetchain;
     std::shared_ptr<device_tracker> devicetracker;
 
@@ -0,0 +1,412 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "rrd_kernels.h"
+
+namespace {
+    // The vector kernels handle whole vectors and leave the tail, and records too short
+    // for a vector, to these
+
+    template<typename T>
+    double sum_scalar(const T *v, size_t n, size_t *zeros) {
+        double sum = 0;
+        size_t z = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            sum += v[i];
+
+            if (v[i] == 0)
+                z++;
+        }
+
+        *zeros = z;
+        return sum;
+    }
+
+    template<typename T>
+    double max_scalar(const T *v, size_t n, double most) {
+        for (size_t i = 0; i < n; i++) {
+            if (v[i] > most)
+                most = v[i];
+        }
+
+        return most;
+    }
+
+    double sum_f_scalar(const float *v, size_t n, size_t *zeros) {
+        return sum_scalar(v, n, zeros);
+    }
+
+    double sum_d_scalar(const double *v, size_t n, size_t *zeros) {
+        return sum_scalar(v, n, zeros);
+    }
+
+    double max_f_scalar(const float *v, size_t n) {
+        return max_scalar(v + 1, n - 1, v[0]);
+    }
+
+    double max_d_scalar(const double *v, size_t n) {
+        return max_scalar(v + 1, n - 1, v[0]);
+    }
+
+    // Kernels are only called with at least rrd_kernel_min values, enough for one whole
+    // vector of the widest instruction set
+    constexpr size_t rrd_kernel_min = 8;
+
+    struct rrd_kernel_impl {
+        const char *name;
+        double (*sum_f)(const float *, size_t, size_t *);
+        double (*sum_d)(const double *, size_t, size_t *);
+        double (*max_f)(const float *, size_t);
+        double (*max_d)(const double *, size_t);
+    };
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RRD_KERNEL_X86
+#include <immintrin.h>
+
+namespace {
+    // Floats are widened to doubles before they're summed, so a record sums the same
+    // whether it's held as floats or doubles
+
+    __attribute__((target("sse2")))
+    double sum_f_sse2(const float *v, size_t n, size_t *zeros) {
+        const __m128 zero = _mm_setzero_ps();
+
+        __m128d acc0 = _mm_setzero_pd();
+        __m128d acc1 = _mm_setzero_pd();
+        size_t z = 0;
+
+        size_t i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_loadu_ps(v + i);
+
+            acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(x));
+            acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+            z += __builtin_popcount(_mm_movemask_ps(_mm_cmpeq_ps(x, zero)));
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+
+        double sum = lanes[0] + lanes[1] + sum_scalar(v + i, n - i, zeros);
+        *zeros += z;
+
+        return sum;
+    }
+
+    __attribute__((target("sse2")))
+    double sum_d_sse2(const double *v, size_t n, size_t *zeros) {
+        const __m128d zero = _mm_setzero_pd();
+
+        __m128d acc = _mm_setzero_pd();
+        size_t z = 0;
+
+        size_t i = 0;
+
+        for (; i + 2 <= n; i += 2) {
+            __m128d x = _mm_loadu_pd(v + i);
+
+            acc = _mm_add_pd(acc, x);
+            z += __builtin_popcount(_mm_movemask_pd(_mm_cmpeq_pd(x, zero)));
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc);
+
+        double sum = lanes[0] + lanes[1] + sum_scalar(v + i, n - i, zeros);
+        *zeros += z;
+
+        return sum;
+    }
+
+    __attribute__((target("sse2")))
+    double max_f_sse2(const float *v, size_t n) {
+        __m128 most = _mm_loadu_ps(v);
+
+        size_t i = 4;
+
+        for (; i + 4 <= n; i += 4)
+            most = _mm_max_ps(most, _mm_loadu_ps(v + i));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, most);
+
+        return max_scalar(v + i, n - i, max_scalar(lanes + 1, 3, lanes[0]));
+    }
+
+    __attribute__((target("sse2")))
+    double max_d_sse2(const double *v, size_t n) {
+        __m128d most = _mm_loadu_pd(v);
+
+        size_t i = 2;
+
+        for (; i + 2 <= n; i += 2)
+            most = _mm_max_pd(most, _mm_loadu_pd(v + i));
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, most);
+
+        return max_scalar(v + i, n - i, max_scalar(lanes + 1, 1, lanes[0]));
+    }
+
+    __attribute__((target("avx2")))
+    double sum_f_avx2(const float *v, size_t n, size_t *zeros) {
+        const __m256 zero = _mm256_setzero_ps();
+
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+        size_t z = 0;
+
+        size_t i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+            __m256 x = _mm256_loadu_ps(v + i);
+
+            acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+            acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+            z += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(x, zero, _CMP_EQ_OQ)));
+        }
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+
+        double sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+            sum_scalar(v + i, n - i, zeros);
+        *zeros += z;
+
+        return sum;
+    }
+
+    __attribute__((target("avx2")))
+    double sum_d_avx2(const double *v, size_t n, size_t *zeros) {
+        const __m256d zero = _mm256_setzero_pd();
+
+        __m256d acc = _mm256_setzero_pd();
+        size_t z = 0;
+
+        size_t i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+            __m256d x = _mm256_loadu_pd(v + i);
+
+            acc = _mm256_add_pd(acc, x);
+            z += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(x, zero, _CMP_EQ_OQ)));
+        }
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+
+        double sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+            sum_scalar(v + i, n - i, zeros);
+        *zeros += z;
+
+        return sum;
+    }
+
+    __attribute__((target("avx2")))
+    double max_f_avx2(const float *v, size_t n) {
+        __m256 most = _mm256_loadu_ps(v);
+
+        size_t i = 8;
+
+        for (; i + 8 <= n; i += 8)
+            most = _mm256_max_ps(most, _mm256_loadu_ps(v + i));
+
+        float lanes[8];
+        _mm256_storeu_ps(lanes, most);
+
+        return max_scalar(v + i, n - i, max_scalar(lanes + 1, 7, lanes[0]));
+    }
+
+    __attribute__((target("avx2")))
+    double max_d_avx2(const double *v, size_t n) {
+        __m256d most = _mm256_loadu_pd(v);
+
+        size_t i = 4;
+
+        for (; i + 4 <= n; i += 4)
+            most = _mm256_max_pd(most, _mm256_loadu_pd(v + i));
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, most);
+
+        return max_scalar(v + i, n - i, max_scalar(lanes + 1, 3, lanes[0]));
+    }
+}
+#endif
+
+#if defined(__aarch64__)
+#define RRD_KERNEL_NEON
+#include <arm_neon.h>
+
+namespace {
+    // Zero compares are all ones, so subtracting them counts the zeros
+
+    double sum_f_neon(const float *v, size_t n, size_t *zeros) {
+        float64x2_t acc0 = vdupq_n_f64(0);
+        float64x2_t acc1 = vdupq_n_f64(0);
+        uint32x4_t z = vdupq_n_u32(0);
+
+        size_t i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t x = vld1q_f32(v + i);
+
+            acc0 = vaddq_f64(acc0, vcvt_f64_f32(vget_low_f32(x)));
+            acc1 = vaddq_f64(acc1, vcvt_high_f64_f32(x));
+            z = vsubq_u32(z, vceqzq_f32(x));
+        }
+
+        double sum = vaddvq_f64(vaddq_f64(acc0, acc1)) + sum_scalar(v + i, n - i, zeros);
+        *zeros += vaddvq_u32(z);
+
+        return sum;
+    }
+
+    double sum_d_neon(const double *v, size_t n, size_t *zeros) {
+        float64x2_t acc = vdupq_n_f64(0);
+        uint64x2_t z = vdupq_n_u64(0);
+
+        size_t i = 0;
+
+        for (; i + 2 <= n; i += 2) {
+            float64x2_t x = vld1q_f64(v + i);
+
+            acc = vaddq_f64(acc, x);
+            z = vsubq_u64(z, vceqzq_f64(x));
+        }
+
+        double sum = vaddvq_f64(acc) + sum_scalar(v + i, n - i, zeros);
+        *zeros += vaddvq_u64(z);
+
+        return sum;
+    }
+
+    double max_f_neon(const float *v, size_t n) {
+        float32x4_t most = vld1q_f32(v);
+
+        size_t i = 4;
+
+        for (; i + 4 <= n; i += 4)
+            most = vmaxq_f32(most, vld1q_f32(v + i));
+
+        return max_scalar(v + i, n - i, vmaxvq_f32(most));
+    }
+
+    double max_d_neon(const double *v, size_t n) {
+        float64x2_t most = vld1q_f64(v);
+
+        size_t i = 2;
+
+        for (; i + 2 <= n; i += 2)
+            most = vmaxq_f64(most, vld1q_f64(v + i));
+
+        return max_scalar(v + i, n - i, vmaxvq_f64(most));
+    }
+}
+#endif
+
+namespace {
+    rrd_kernel_impl rrd_kernel_select() {
+#ifdef RRD_KERNEL_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            return {"avx2", sum_f_avx2, sum_d_avx2, max_f_avx2, max_d_avx2};
+
+        if (__builtin_cpu_supports("sse2"))
+            return {"sse2", sum_f_sse2, sum_d_sse2, max_f_sse2, max_d_sse2};
+#endif
+
+#ifdef RRD_KERNEL_NEON
+        return {"neon", sum_f_neon, sum_d_neon, max_f_neon, max_d_neon};
+#endif
+
+        return {"scalar", sum_f_scalar, sum_d_scalar, max_f_scalar, max_d_scalar};
+    }
+
+    const rrd_kernel_impl& rrd_kernel() {
+        static const rrd_kernel_impl impl = rrd_kernel_select();
+        return impl;
+    }
+}
+
+double rrd_sum(const float *v, size_t n) noexcept {
+    size_t zeros;
+    return rrd_sum_nonzero(v, n, &zeros);
+}
+
+double rrd_sum(const double *v, size_t n) noexcept {
+    size_t zeros;
+    return rrd_sum_nonzero(v, n, &zeros);
+}
+
+double rrd_sum_nonzero(const float *v, size_t n, size_t *nonzero) noexcept {
+    size_t zeros;
+    double sum;
+
+    if (n < rrd_kernel_min)
+        sum = sum_f_scalar(v, n, &zeros);
+    else
+        sum = rrd_kernel().sum_f(v, n, &zeros);
+
+    *nonzero = n - zeros;
+    return sum;
+}
+
+double rrd_sum_nonzero(const double *v, size_t n, size_t *nonzero) noexcept {
+    size_t zeros;
+    double sum;
+
+    if (n < rrd_kernel_min)
+        sum = sum_d_scalar(v, n, &zeros);
+    else
+        sum = rrd_kernel().sum_d(v, n, &zeros);
+
+    *nonzero = n - zeros;
+    return sum;
+}
+
+double rrd_max(const float *v, size_t n) noexcept {
+    if (n == 0)
+        return 0;
+
+    if (n < rrd_kernel_min)
+        return max_f_scalar(v, n);
+
+    return rrd_kernel().max_f(v, n);
+}
+
+double rrd_max(const double *v, size_t n) noexcept {
+    if (n == 0)
+        return 0;
+
+    if (n < rrd_kernel_min)
+        return max_d_scalar(v, n);
+
+    return rrd_kernel().max_d(v, n);
+}
+
+const char *rrd_kernel_name() noexcept {
+    return rrd_kernel().name;
+}
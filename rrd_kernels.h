@@ -0,0 +1,51 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __RRD_KERNELS_H__
+#define __RRD_KERNELS_H__
+
+#include "config.h"
+
+#include <stddef.h>
+
+// Vectorized reductions for rolling RRD records up into the next record (seconds into
+// a minute, minutes into an hour, hours into a day).
+//
+// Records are the float arrays of the compact RRDs or the double vectors of the tracked
+// RRDs; both are summed as doubles.  The reductions use AVX2 when the CPU has it and
+// SSE2 otherwise on x86, and NEON on ARMv8; other CPUs, and records shorter than a
+// vector, are reduced one value at a time.
+
+// Sum of the values
+double rrd_sum(const float *v, size_t n) noexcept;
+double rrd_sum(const double *v, size_t n) noexcept;
+
+// Sum of the values, and the number of values which are not 0 in 'nonzero'; since the
+// 0s add nothing to the sum this is what aggregators which skip empty slots average
+double rrd_sum_nonzero(const float *v, size_t n, size_t *nonzero) noexcept;
+double rrd_sum_nonzero(const double *v, size_t n, size_t *nonzero) noexcept;
+
+// Largest value, or 0 for an empty record
+double rrd_max(const float *v, size_t n) noexcept;
+double rrd_max(const double *v, size_t n) noexcept;
+
+// Name of the instruction set used by the reductions on this CPU
+const char *rrd_kernel_name() noexcept;
+
+#endif
+
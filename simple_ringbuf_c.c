@@ -36,6 +36,13 @@
 
 #include "simple_ringbuf_c.h"
 
+/* The reader and writer each own one position, and see the other's with acquire
+ * loads; a position is only published with a release store after the data it
+ * covers has been copied */
+#define rb_load_own(p)          __atomic_load_n((p), __ATOMIC_RELAXED)
+#define rb_load_other(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define rb_publish(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
 #ifdef USE_MMAP_RBUF
 #define __NR_memfd_create 319
 int memfd_create(const char *name, unsigned int flags) {
@@ -53,9 +60,9 @@ kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size) {
     char tmpfname[256];
 #endif
 
-    rb = (kis_simple_ringbuf_t *) malloc(sizeof(kis_simple_ringbuf_t));
-
-    if (rb == NULL)
+    /* Keep the read and write positions on their own cache lines */
+    if (posix_memalign((void **) &rb, KIS_SIMPLE_RINGBUF_CACHELINE, 
+                sizeof(kis_simple_ringbuf_t)) != 0)
         return NULL;
 
 #ifdef USE_MMAP_RBUF
@@ -110,8 +117,8 @@ kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size) {
 #endif
 
     rb->buffer_sz = size;
-    rb->start_pos = 0;
-    rb->length = 0;
+    rb->write_pos = 0;
+    rb->read_pos = 0;
     rb->mid_peek = 0;
     rb->mid_commit = 0;
     rb->free_peek = 0;
@@ -137,20 +144,46 @@ void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf) {
 /* Clear ring buffer
  */
 void kis_simple_ringbuf_clear(kis_simple_ringbuf_t *ringbuf) {
-    ringbuf->start_pos = 0;
-    ringbuf->length = 0;
+    rb_publish(&ringbuf->read_pos, rb_load_other(&ringbuf->write_pos));
+}
+
+/* Distance between two positions */
+static size_t rb_distance(kis_simple_ringbuf_t *ringbuf, size_t read_pos, size_t write_pos) {
+    if (write_pos >= read_pos)
+        return write_pos - read_pos;
+
+    return (2 * ringbuf->buffer_sz) - read_pos + write_pos;
+}
+
+/* Advance a position, wrapping at twice the buffer size */
+static size_t rb_advance(kis_simple_ringbuf_t *ringbuf, size_t pos, size_t amount) {
+    pos += amount;
+
+    if (pos >= 2 * ringbuf->buffer_sz)
+        pos -= 2 * ringbuf->buffer_sz;
+
+    return pos;
+}
+
+/* Offset into the buffer of a position */
+static size_t rb_offset(kis_simple_ringbuf_t *ringbuf, size_t pos) {
+    if (pos >= ringbuf->buffer_sz)
+        return pos - ringbuf->buffer_sz;
+
+    return pos;
 }
 
 /* Get available space
  */
 size_t kis_simple_ringbuf_available(kis_simple_ringbuf_t *ringbuf) {
-    return ringbuf->buffer_sz - ringbuf->length;
+    return ringbuf->buffer_sz - kis_simple_ringbuf_used(ringbuf);
 }
 
 /* Get used space
  */
 size_t kis_simple_ringbuf_used(kis_simple_ringbuf_t *ringbuf) {
-    return ringbuf->length;
+    return rb_distance(ringbuf, rb_load_other(&ringbuf->read_pos), 
+            rb_load_other(&ringbuf->write_pos));
 }
 
 /* Get total space
@@ -159,48 +192,66 @@ size_t kis_simple_ringbuf_size(kis_simple_ringbuf_t *ringbuf) {
     return ringbuf->buffer_sz;
 }
 
-/* Append data
- *
- * Returns amount written
- */
-size_t kis_simple_ringbuf_write(kis_simple_ringbuf_t *ringbuf, 
-        void *data, size_t length) {
-    size_t copy_start;
-
-    if (kis_simple_ringbuf_available(ringbuf) < length)
-        return 0;
-
-    copy_start = 
-        (ringbuf->start_pos + ringbuf->length) % ringbuf->buffer_sz;
+/* Copy into the buffer at a write position, splitting around the end of the buffer */
+static void rb_copy_in(kis_simple_ringbuf_t *ringbuf, size_t pos, void *data, size_t length) {
+    size_t copy_start = rb_offset(ringbuf, pos);
 
 #ifdef USE_MMAP_RBUF
     memcpy(ringbuf->buffer + copy_start, data, length);
-    ringbuf->length += length;
-
-    return length;
 #else
     /* Does the write op fit w/out looping? */
-    if (copy_start + length < ringbuf->buffer_sz) {
+    if (copy_start + length <= ringbuf->buffer_sz) {
         memcpy(ringbuf->buffer + copy_start, data, length);
-        ringbuf->length += length;
-
-        return length;
     } else {
         /* We have to split up, figure out the length of the two chunks */
         size_t chunk_a = ringbuf->buffer_sz - copy_start;
         size_t chunk_b = length - chunk_a;
 
-        memcpy(ringbuf->buffer + ringbuf->start_pos + ringbuf->length, data, chunk_a);
+        memcpy(ringbuf->buffer + copy_start, data, chunk_a);
         memcpy(ringbuf->buffer, (uint8_t *) data + chunk_a, chunk_b);
+    }
+#endif
+}
 
-        /* Increase the length of the buffer */
-        ringbuf->length += length;
+/* Copy out of the buffer at a read position, splitting around the end of the buffer */
+static void rb_copy_out(kis_simple_ringbuf_t *ringbuf, size_t pos, void *ptr, size_t length) {
+    size_t copy_start = rb_offset(ringbuf, pos);
 
-        return length;
+#ifdef USE_MMAP_RBUF
+    memcpy(ptr, ringbuf->buffer + copy_start, length);
+#else
+    /* Simple contiguous read */
+    if (copy_start + length <= ringbuf->buffer_sz) {
+        memcpy(ptr, ringbuf->buffer + copy_start, length);
+    } else {
+        /* First chunk, start to end of buffer */
+        size_t chunk_a = ringbuf->buffer_sz - copy_start;
+        /* Second chunk, 0 to remaining data */
+        size_t chunk_b = length - chunk_a;
+
+        memcpy(ptr, ringbuf->buffer + copy_start, chunk_a);
+        memcpy((uint8_t *) ptr + chunk_a, ringbuf->buffer, chunk_b);
     }
 #endif
+}
 
-    return 0;
+/* Append data
+ *
+ * Returns amount written
+ */
+size_t kis_simple_ringbuf_write(kis_simple_ringbuf_t *ringbuf, 
+        void *data, size_t length) {
+    size_t write_pos = rb_load_own(&ringbuf->write_pos);
+
+    if (ringbuf->buffer_sz - 
+            rb_distance(ringbuf, rb_load_other(&ringbuf->read_pos), write_pos) < length)
+        return 0;
+
+    rb_copy_in(ringbuf, write_pos, data, length);
+
+    rb_publish(&ringbuf->write_pos, rb_advance(ringbuf, write_pos, length));
+
+    return length;
 }
 
 size_t kis_simple_ringbuf_reserve(kis_simple_ringbuf_t *ringbuf, void **data, size_t size) {
@@ -215,10 +266,7 @@ size_t kis_simple_ringbuf_reserve(kis_simple_ringbuf_t *ringbuf, void **data, si
         return 0;
     }
 
-    ringbuf->mid_commit = 1;
-
-    copy_start = 
-        (ringbuf->start_pos + ringbuf->length) % ringbuf->buffer_sz;
+    copy_start = rb_offset(ringbuf, rb_load_own(&ringbuf->write_pos));
 
 #ifdef USE_MMAP_RBUF
     ringbuf->mid_commit = 1;
@@ -228,6 +276,7 @@ size_t kis_simple_ringbuf_reserve(kis_simple_ringbuf_t *ringbuf, void **data, si
 #else
     /* Does the write op fit w/out looping? */
     if (copy_start + size <= ringbuf->buffer_sz) {
+        ringbuf->mid_commit = 1;
         ringbuf->free_commit = 0;
         *data = ringbuf->buffer + copy_start;
         return size;
@@ -239,6 +288,7 @@ size_t kis_simple_ringbuf_reserve(kis_simple_ringbuf_t *ringbuf, void **data, si
             return 0;
         }
 
+        ringbuf->mid_commit = 1;
         ringbuf->free_commit = 1;
 
         return size;
@@ -261,19 +311,15 @@ size_t kis_simple_ringbuf_reserve_zcopy(kis_simple_ringbuf_t *ringbuf, void **da
     }
 
     ringbuf->mid_commit = 1;
+    ringbuf->free_commit = 0;
 
-    copy_start = 
-        (ringbuf->start_pos + ringbuf->length) % ringbuf->buffer_sz;
+    copy_start = rb_offset(ringbuf, rb_load_own(&ringbuf->write_pos));
 
-#ifdef USE_MMAP_RBUF
-    ringbuf->mid_commit = 1;
-    ringbuf->free_commit = 0;
     *data = ringbuf->buffer + copy_start;
+
+#ifdef USE_MMAP_RBUF
     return size;
 #else
-    ringbuf->free_commit = 0;
-    *data = ringbuf->buffer + copy_start;
-
     /* Does the write op fit w/out looping? */
     if (copy_start + size <= ringbuf->buffer_sz) {
         return size;
@@ -286,50 +332,27 @@ size_t kis_simple_ringbuf_reserve_zcopy(kis_simple_ringbuf_t *ringbuf, void **da
 }
 
 size_t kis_simple_ringbuf_commit(kis_simple_ringbuf_t *ringbuf, void *data, size_t size) {
+    size_t write_pos;
+
     if (!ringbuf->mid_commit) {
         fprintf(stderr, "ERROR: kis_simple_ringbuf_t not in a commit when commit called\n");
         return 0;
     }
 
-#ifdef USE_MMAP_RBUF
-    ringbuf->mid_commit = 0;
-    ringbuf->length += size;
-    return size;
-#else
-    size_t copy_start;
-
-    copy_start = 
-        (ringbuf->start_pos + ringbuf->length) % ringbuf->buffer_sz;
-
     ringbuf->mid_commit = 0;
 
-    if (!ringbuf->free_commit) {
-        ringbuf->length += size;
-        return size;
-    } else {
-        /* Does the write op fit w/out looping? */
-        if (copy_start + size <= ringbuf->buffer_sz) {
-            memcpy(ringbuf->buffer + copy_start, data, size);
-            ringbuf->length += size;
-
-            return size;
-        } else {
-            /* We have to split up, figure out the length of the two chunks */
-            size_t chunk_a = ringbuf->buffer_sz - copy_start;
-            size_t chunk_b = size - chunk_a;
-
-            memcpy(ringbuf->buffer + ringbuf->start_pos + ringbuf->length, data, chunk_a);
-            memcpy(ringbuf->buffer, (uint8_t *) data + chunk_a, chunk_b);
+    write_pos = rb_load_own(&ringbuf->write_pos);
 
-            /* Increase the length of the buffer */
-            ringbuf->length += size;
-
-            return size;
-        }
+    /* Split reservations were made in a temporary buffer */
+    if (ringbuf->free_commit) {
+        rb_copy_in(ringbuf, write_pos, data, size);
+        free(data);
+        ringbuf->free_commit = 0;
     }
-#endif
 
-    return 0;
+    rb_publish(&ringbuf->write_pos, rb_advance(ringbuf, write_pos, size));
+
+    return size;
 }
 
 /* Free a previously reserved chunk without committing it.
@@ -343,6 +366,7 @@ void kis_simple_ringbuf_reserve_free(kis_simple_ringbuf_t *ringbuf, void *data)
         free(data);
 
     ringbuf->mid_commit = 0;
+    ringbuf->free_commit = 0;
 }
 
 /* Copies data into provided buffer.  Advances ringbuf, clearing consumed data.
@@ -353,9 +377,11 @@ void kis_simple_ringbuf_reserve_free(kis_simple_ringbuf_t *ringbuf, void *data)
  */
 size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr, 
         size_t size) {
+    size_t read_pos = rb_load_own(&ringbuf->read_pos);
+
     /* Start with how much we have available - no matter what was
      * requested, we can't read more than this */
-    size_t opsize = kis_simple_ringbuf_used(ringbuf);
+    size_t opsize = rb_distance(ringbuf, read_pos, rb_load_other(&ringbuf->write_pos));
 
     if (opsize == 0)
         return 0;
@@ -364,42 +390,13 @@ size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr,
     if (opsize > size)
         opsize = size;
 
-#ifdef USE_MMAP_RBUF
     if (ptr != NULL)
-        memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, opsize);
+        rb_copy_out(ringbuf, read_pos, ptr, opsize);
 
-    ringbuf->start_pos = (ringbuf->start_pos + opsize) % ringbuf->buffer_sz;
-    ringbuf->length -= opsize;
+    /* Hand the space back to the writer */
+    rb_publish(&ringbuf->read_pos, rb_advance(ringbuf, read_pos, opsize));
 
     return opsize;
-#else
-    /* Simple contiguous read */
-    if (ringbuf->start_pos + opsize <= ringbuf->buffer_sz) {
-        if (ptr != NULL)
-            memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, opsize);
-        ringbuf->start_pos += opsize;
-        ringbuf->length -= opsize;
-        return opsize;
-    } else {
-        /* First chunk, start to end of buffer */
-        size_t chunk_a = ringbuf->buffer_sz - ringbuf->start_pos;
-        /* Second chunk, 0 to remaining data */
-        size_t chunk_b = opsize - chunk_a;
-
-        if (ptr != NULL) {
-            memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, chunk_a);
-            memcpy((uint8_t *) ptr + chunk_a, ringbuf->buffer, chunk_b);
-        }
-
-        /* Fastforward around the ring to where we finished reading */
-        ringbuf->start_pos = chunk_b;
-        ringbuf->length -= opsize;
-
-        return opsize;
-    }
-#endif
-
-    return 0;
 }
 
 /* Peeks at data by copying into provided buffer.  Does NOT advance ringbuf
@@ -412,9 +409,11 @@ size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr,
  */
 size_t kis_simple_ringbuf_peek(kis_simple_ringbuf_t *ringbuf, void *ptr, 
         size_t size) {
+    size_t read_pos = rb_load_own(&ringbuf->read_pos);
+
     /* Start with how much we have available - no matter what was
      * requested, we can't read more than this */
-    size_t opsize = kis_simple_ringbuf_used(ringbuf);
+    size_t opsize = rb_distance(ringbuf, read_pos, rb_load_other(&ringbuf->write_pos));
 
     if (opsize == 0)
         return 0;
@@ -423,34 +422,18 @@ size_t kis_simple_ringbuf_peek(kis_simple_ringbuf_t *ringbuf, void *ptr,
     if (opsize > size)
         opsize = size;
 
-#ifdef USE_MMAP_RBUF
-    memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, opsize);
-    return opsize;
-#else
-    /* Simple contiguous read */
-    if (ringbuf->start_pos + opsize <= ringbuf->buffer_sz) {
-        memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, opsize);
-        return opsize;
-    } else {
-        /* First chunk, start to end of buffer */
-        size_t chunk_a = ringbuf->buffer_sz - ringbuf->start_pos;
-        /* Second chunk, 0 to remaining data */
-        size_t chunk_b = opsize - chunk_a;
-
-        memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, chunk_a);
-        memcpy((uint8_t *) ptr + chunk_a, ringbuf->buffer, chunk_b);
-
-        return opsize;
-    }
-#endif
+    rb_copy_out(ringbuf, read_pos, ptr, opsize);
 
-    return 0;
+    return opsize;
 }
 
 size_t kis_simple_ringbuf_peek_zc(kis_simple_ringbuf_t *ringbuf, void **ptr, size_t size) {
+    size_t read_pos = rb_load_own(&ringbuf->read_pos);
+    size_t copy_start = rb_offset(ringbuf, read_pos);
+
     /* Start with how much we have available - no matter what was
      * requested, we can't read more than this */
-    size_t opsize = kis_simple_ringbuf_used(ringbuf);
+    size_t opsize = rb_distance(ringbuf, read_pos, rb_load_other(&ringbuf->write_pos));
 
     if (ringbuf->mid_peek) {
         fprintf(stderr, "ERROR: simple_ringbuf_peek_zc mid-peek already\n");
@@ -458,6 +441,7 @@ size_t kis_simple_ringbuf_peek_zc(kis_simple_ringbuf_t *ringbuf, void **ptr, siz
     }
     
     ringbuf->mid_peek = 1;
+    ringbuf->free_peek = 0;
 
     if (opsize == 0)
         return 0;
@@ -470,22 +454,14 @@ size_t kis_simple_ringbuf_peek_zc(kis_simple_ringbuf_t *ringbuf, void **ptr, siz
         opsize = size;
 
 #ifdef USE_MMAP_RBUF
-    ringbuf->mid_peek = 1;
-    ringbuf->free_peek = 0;
-    *ptr = ringbuf->buffer + ringbuf->start_pos;
+    *ptr = ringbuf->buffer + copy_start;
     return opsize;
 #else
     /* Simple contiguous read */
-    if (ringbuf->start_pos + opsize <= ringbuf->buffer_sz) {
-        ringbuf->free_peek = 0;
-        *ptr = ringbuf->buffer + ringbuf->start_pos;
+    if (copy_start + opsize <= ringbuf->buffer_sz) {
+        *ptr = ringbuf->buffer + copy_start;
         return opsize;
     } else {
-        /* First chunk, start to end of buffer */
-        size_t chunk_a = ringbuf->buffer_sz - ringbuf->start_pos;
-        /* Second chunk, 0 to remaining data */
-        size_t chunk_b = opsize - chunk_a;
-
         *ptr = malloc(opsize);
 
         if (*ptr == NULL) {
@@ -495,8 +471,7 @@ size_t kis_simple_ringbuf_peek_zc(kis_simple_ringbuf_t *ringbuf, void **ptr, siz
 
         ringbuf->free_peek = 1;
 
-        memcpy(*ptr, ringbuf->buffer + ringbuf->start_pos, chunk_a);
-        memcpy((uint8_t *) *ptr + chunk_a, ringbuf->buffer, chunk_b);
+        rb_copy_out(ringbuf, read_pos, *ptr, opsize);
 
         return opsize;
     }
@@ -505,6 +480,22 @@ size_t kis_simple_ringbuf_peek_zc(kis_simple_ringbuf_t *ringbuf, void **ptr, siz
     return 0;
 }
 
+size_t kis_simple_ringbuf_peek_contig(kis_simple_ringbuf_t *ringbuf, void **ptr) {
+    size_t read_pos = rb_load_own(&ringbuf->read_pos);
+    size_t copy_start = rb_offset(ringbuf, read_pos);
+    size_t opsize = rb_distance(ringbuf, read_pos, rb_load_other(&ringbuf->write_pos));
+
+    *ptr = ringbuf->buffer + copy_start;
+
+#ifndef USE_MMAP_RBUF
+    /* Stop at the end of the buffer; the rest is at the start */
+    if (copy_start + opsize > ringbuf->buffer_sz)
+        opsize = ringbuf->buffer_sz - copy_start;
+#endif
+
+    return opsize;
+}
+
 void kis_simple_ringbuf_peek_free(kis_simple_ringbuf_t *ringbuf, void *ptr) {
     if (!ringbuf->mid_peek) {
         fprintf(stderr, "ERROR: kis_simple_ringbuf_peek_free called with no peeked data\n");
@@ -515,5 +506,6 @@ void kis_simple_ringbuf_peek_free(kis_simple_ringbuf_t *ringbuf, void *ptr) {
         free(ptr);
 
     ringbuf->mid_peek = 0;
+    ringbuf->free_peek = 0;
 }
 
@@ -17,7 +17,16 @@
 */
 
 /* An extremely basic ring buffer implemented in pure C; for use with datasource 
- * implementations in C */
+ * implementations in C
+ *
+ * The buffer is safe for one writer and one reader in different threads without
+ * locking:  the write functions (write, reserve, commit) only move the write position,
+ * the read functions (read, peek, clear) only move the read position, and each side
+ * publishes its position to the other with release/acquire ordering.  The positions
+ * are kept on separate cache lines so the two threads don't bounce a line between
+ * them on every operation.  Multiple writers, or multiple readers, must still be
+ * serialized by the caller.
+ */
 
 #ifndef __RINGBUF_C_H__
 #define __RINGBUF_C_H__
@@ -29,14 +38,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define KIS_SIMPLE_RINGBUF_CACHELINE    64
+
 struct kis_simple_ringbuf {
     uint8_t *buffer;
     size_t buffer_sz;
-    size_t start_pos; /* Where reading starts from */
-    size_t length; /* Amount of data in the buffer */
 
-    int mid_peek, mid_commit; /* Are we in a peek or reserve? */
-    int free_peek, free_commit; /* Do we need to free the peek or reserved buffers */
+    /* Positions run from 0 to twice the buffer size, so a full buffer can be told
+     * from an empty one; only the writer changes write_pos and only the reader
+     * changes read_pos */
+    size_t write_pos __attribute__((aligned(KIS_SIMPLE_RINGBUF_CACHELINE)));
+    int mid_commit; /* Are we in a reserve? */
+    int free_commit; /* Do we need to free the reserved buffer */
+
+    size_t read_pos __attribute__((aligned(KIS_SIMPLE_RINGBUF_CACHELINE)));
+    int mid_peek; /* Are we in a peek? */
+    int free_peek; /* Do we need to free the peeked buffer */
 
 #ifdef USE_MMAP_RBUF
     void *mmap_region0;
@@ -57,7 +74,8 @@ kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size);
  */
 void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf);
 
-/* Clear ring buffer
+/* Clear ring buffer; this discards everything written so far, and is a read
+ * operation
  */
 void kis_simple_ringbuf_clear(kis_simple_ringbuf_t *ringbuf);
 
@@ -135,6 +153,14 @@ size_t kis_simple_ringbuf_peek(kis_simple_ringbuf_t *ringbuf, void *ptr, size_t
  */
 size_t kis_simple_ringbuf_peek_zc(kis_simple_ringbuf_t *ringbuf, void **ptr, size_t size);
 
+/* Peeks at the data which can be read without copying; this stops at the end of the
+ * buffer even when more data wraps around to the start.  Does NOT advance ringbuf
+ * or consume data, and does not need to be freed.
+ *
+ * Returns amount available at ptr
+ */
+size_t kis_simple_ringbuf_peek_contig(kis_simple_ringbuf_t *ringbuf, void **ptr);
+
 /* Frees peeked zc data.  Must be called after peeking.
  *
  */
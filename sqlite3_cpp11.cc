@@ -18,6 +18,10 @@
 
 #include "sqlite3_cpp11.h"
 
+#include <ctype.h>
+
+#include <algorithm>
+
 namespace kissqlite3 {
 
     std::ostream& operator<<(std::ostream& os, const query_element& q) {
@@ -415,6 +419,248 @@ namespace kissqlite3 {
         return update(table, fields, terms, where_clause);
     }
 
+    std::string stmt_cache::normalize(const std::string& sql) {
+        std::string ret;
+        ret.reserve(sql.length());
+
+        bool space = false;
+
+        for (auto c : sql) {
+            if (isspace((unsigned char) c)) {
+                space = true;
+                continue;
+            }
+
+            if (space && ret.length() > 0)
+                ret += ' ';
+            space = false;
+
+            ret += c;
+        }
+
+        return ret;
+    }
+
+    void stmt_cache::clear() {
+        std::lock_guard<std::mutex> lk(mutex);
+
+        for (auto& s : stmts) {
+            std::lock_guard<std::mutex> slk(s.second->mutex);
+
+            if (s.second->busy) {
+                s.second->evicted = true;
+            } else {
+                sqlite3_finalize(s.second->stmt);
+                s.second->stmt = nullptr;
+            }
+        }
+
+        stmts.clear();
+    }
+
+    std::shared_ptr<sqlite3_stmt> stmt_cache::lend(std::shared_ptr<cached_stmt> entry) {
+        entry->busy = true;
+
+        // Releasing the last reference resets the statement for the next caller, or
+        // finalizes it if the cache was cleared in the meantime
+        return std::shared_ptr<sqlite3_stmt>(entry->stmt, [entry](sqlite3_stmt *p) {
+                std::lock_guard<std::mutex> slk(entry->mutex);
+
+                if (entry->evicted) {
+                    sqlite3_finalize(p);
+                    entry->stmt = nullptr;
+                } else {
+                    sqlite3_reset(p);
+                    sqlite3_clear_bindings(p);
+                }
+
+                entry->busy = false;
+            });
+    }
+
+    std::shared_ptr<sqlite3_stmt> stmt_cache::prepare(const std::string& sql) {
+        auto key = normalize(sql);
+
+        std::lock_guard<std::mutex> lk(mutex);
+
+        if (db == nullptr)
+            throw std::runtime_error("Failed to prepare statement: " + key + " no database");
+
+        auto k = stmts.find(key);
+
+        if (k != stmts.end()) {
+            auto entry = k->second;
+            std::lock_guard<std::mutex> slk(entry->mutex);
+
+            if (!entry->busy)
+                return lend(entry);
+        }
+
+        sqlite3_stmt *stmt_raw;
+        const char *pz = nullptr;
+
+        if (sqlite3_prepare_v2(db, key.c_str(), key.length(), &stmt_raw, &pz) != SQLITE_OK)
+            throw std::runtime_error("Failed to prepare statement: " + key + " " +
+                    std::string(sqlite3_errmsg(db)));
+
+        // A second copy of a busy statement, or a statement past the size of the
+        // cache, is finalized when it's released
+        if (k != stmts.end() || stmts.size() >= max_stmts) {
+            return std::shared_ptr<sqlite3_stmt>(stmt_raw, [](sqlite3_stmt *p) {
+                    sqlite3_finalize(p);
+                });
+        }
+
+        auto entry = std::make_shared<cached_stmt>(stmt_raw);
+        stmts[key] = entry;
+
+        return lend(entry);
+    }
+
+    int bind_elem(sqlite3_stmt *stmt, int pos, const insert_elem& e) {
+        switch (e.bind_type) {
+            case BindType::sql_blob:
+                return sqlite3_bind_blob(stmt, pos, e.value.data(), e.value.length(),
+                        SQLITE_TRANSIENT);
+            case BindType::sql_text:
+                return sqlite3_bind_text(stmt, pos, e.value.data(), e.value.length(),
+                        SQLITE_TRANSIENT);
+            case BindType::sql_int:
+                return sqlite3_bind_int(stmt, pos, e.num_value);
+            case BindType::sql_int64:
+                return sqlite3_bind_int64(stmt, pos, e.num_value);
+            case BindType::sql_double:
+                return sqlite3_bind_double(stmt, pos, e.num_value);
+            case BindType::sql_null:
+            case BindType::sql_joining_op:
+                break;
+        };
+
+        return sqlite3_bind_null(stmt, pos);
+    }
+
+    void exec(sqlite3 *db, const std::string& sql) {
+        char *err = nullptr;
+
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+            std::string e = err != nullptr ? err : sqlite3_errmsg(db);
+            sqlite3_free(err);
+            throw std::runtime_error("Failed to execute " + sql + ": " + e);
+        }
+    }
+
+    batch_insert::batch_insert(sqlite3 *db, stmt_cache& cache, const std::string& table,
+            const std::list<std::string>& fields, const std::string& verb) :
+        db {db},
+        cache {cache},
+        verb {verb},
+        table {table},
+        fields {fields},
+        n_rows {0},
+        own_transaction {false},
+        in_transaction {false} {
+
+        if (fields.size() == 0)
+            throw std::runtime_error("Batch insert into " + table + " with no fields");
+
+        // Keep the statements to a sensible size even when sqlite allows a great many
+        // variables
+        size_t max_vars = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+        stmt_rows = std::max((size_t) 1, std::min((size_t) 64, max_vars / fields.size()));
+
+        pending.reserve(stmt_rows * fields.size());
+    }
+
+    batch_insert::~batch_insert() {
+        if (own_transaction && in_transaction)
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+
+    std::string batch_insert::insert_sql(size_t in_rows) const {
+        std::stringstream os;
+
+        os << verb << " INTO " << table << " (";
+
+        bool comma = false;
+        for (const auto& f : fields) {
+            if (comma)
+                os << ", ";
+            comma = true;
+
+            os << f;
+        }
+
+        os << ") VALUES ";
+
+        for (size_t r = 0; r < in_rows; r++) {
+            if (r != 0)
+                os << ", ";
+
+            os << "(";
+
+            for (size_t f = 0; f < fields.size(); f++) {
+                if (f != 0)
+                    os << ", ";
+                os << "?";
+            }
+
+            os << ")";
+        }
+
+        return os.str();
+    }
+
+    void batch_insert::flush(size_t in_rows) {
+        auto stmt = cache.prepare(insert_sql(in_rows));
+
+        int pos = 1;
+        for (size_t i = 0; i < in_rows * fields.size(); i++) {
+            if (bind_elem(stmt.get(), pos++, pending[i]) != SQLITE_OK)
+                throw std::runtime_error("Failed to bind batch insert into " + table + ": " +
+                        std::string(sqlite3_errmsg(db)));
+        }
+
+        if (sqlite3_step(stmt.get()) != SQLITE_DONE)
+            throw std::runtime_error("Failed to run batch insert into " + table + ": " +
+                    std::string(sqlite3_errmsg(db)));
+
+        pending.erase(pending.begin(), pending.begin() + in_rows * fields.size());
+    }
+
+    void batch_insert::add(const std::list<insert_elem>& row) {
+        if (row.size() != fields.size())
+            throw std::runtime_error("Supplied fields not equal to supplied template");
+
+        // Join the transaction of the caller if there is one
+        if (!in_transaction) {
+            if (sqlite3_get_autocommit(db)) {
+                exec(db, "BEGIN TRANSACTION");
+                own_transaction = true;
+            }
+
+            in_transaction = true;
+        }
+
+        pending.insert(pending.end(), row.begin(), row.end());
+        n_rows++;
+
+        if (pending.size() >= stmt_rows * fields.size())
+            flush(stmt_rows);
+    }
+
+    void batch_insert::commit() {
+        // The remainder goes one row at a time through the single row statement, so that
+        // every partial batch size doesn't become a statement of its own
+        while (pending.size() > 0)
+            flush(1);
+
+        if (own_transaction && in_transaction)
+            exec(db, "COMMIT");
+
+        in_transaction = false;
+        own_transaction = false;
+    }
+
     // Extractors
     template<typename T>
     T sqlite3_column_as(std::shared_ptr<sqlite3_stmt> stmt, unsigned int column);
@@ -62,9 +62,11 @@
 #include <iostream>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include <sqlite3.h>
@@ -115,6 +117,70 @@ namespace kissqlite3 {
             bool end = false;
     };
 
+    // Prepared statements of one database, keyed by their SQL with the whitespace
+    // collapsed, so a statement which is run over and over is only compiled once.
+    //
+    // prepare() hands out a statement which is reset and has no values bound; when the
+    // last reference to it is released it is reset and its bindings are cleared again,
+    // ready for the next caller.  A statement which is still in use when the same SQL
+    // is prepared again is not shared, the second caller gets a statement of its own.
+    //
+    // The cache has to be cleared before the database is closed.
+    class stmt_cache {
+    public:
+        stmt_cache(sqlite3 *db = nullptr, size_t max_stmts = 64) :
+            db {db},
+            max_stmts {max_stmts} { }
+
+        ~stmt_cache() {
+            clear();
+        }
+
+        stmt_cache(const stmt_cache&) = delete;
+        stmt_cache& operator=(const stmt_cache&) = delete;
+
+        // Change the database; clears any statements of the previous one
+        void set_db(sqlite3 *in_db) {
+            clear();
+            db = in_db;
+        }
+
+        // Finalize all the cached statements; statements still in use are finalized
+        // when they are released
+        void clear();
+
+        // Cached statement for the SQL, reset and with no values bound; throws
+        // std::runtime_error if the SQL can't be prepared
+        std::shared_ptr<sqlite3_stmt> prepare(const std::string& sql);
+
+        // SQL with runs of whitespace collapsed to one space and no leading or trailing
+        // whitespace
+        static std::string normalize(const std::string& sql);
+
+    protected:
+        struct cached_stmt {
+            cached_stmt(sqlite3_stmt *stmt) :
+                stmt {stmt},
+                busy {false},
+                evicted {false} { }
+
+            std::mutex mutex;
+            sqlite3_stmt *stmt;
+            bool busy;
+            bool evicted;
+        };
+
+        // Mark a cached statement busy and wrap it so it goes back to the cache when
+        // it's released
+        static std::shared_ptr<sqlite3_stmt> lend(std::shared_ptr<cached_stmt> entry);
+
+        sqlite3 *db;
+        size_t max_stmts;
+
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<cached_stmt>> stmts;
+    };
+
     // Template compiletime grammar elements
     
     enum class BindType {
@@ -350,14 +416,24 @@ namespace kissqlite3 {
             tail_clause.push_back(query_element{ORDERBY, field});
         }
 
+        // Prepare the query through a statement cache, for queries which are run
+        // repeatedly with different values
+        query& cached(stmt_cache& in_cache) {
+            cache = &in_cache;
+            return *this;
+        }
+
         void bind_stmt() {
             // Generate the placeholdered WHERE string
             std::stringstream os;
 
             bool comma = false;
 
+            // DELETE has no fields
+            os << op;
+
             if (fields.size() > 0) {
-                os << op << " ";
+                os << " ";
                 for (auto f : fields) {
                     if (comma)
                         os << ", ";
@@ -418,17 +494,25 @@ namespace kissqlite3 {
             int r;
             const char *pz = nullptr;
 
-            sqlite3_stmt *stmt_raw;
-            auto str = os.str();
-            r = sqlite3_prepare(db, str.c_str(), os.str().length(), &stmt_raw, &pz);
+            // Release any previous run before taking a statement from the cache, so
+            // that running the query again reuses it
+            stmt.reset();
 
-            if (r != SQLITE_OK)
-                throw std::runtime_error("Failed to prepare statement: " + os.str() + " " + 
-                        std::string(sqlite3_errmsg(db)));
+            if (cache != nullptr) {
+                stmt = cache->prepare(os.str());
+            } else {
+                sqlite3_stmt *stmt_raw;
+                auto str = os.str();
+                r = sqlite3_prepare(db, str.c_str(), os.str().length(), &stmt_raw, &pz);
+
+                if (r != SQLITE_OK)
+                    throw std::runtime_error("Failed to prepare statement: " + os.str() + " " + 
+                            std::string(sqlite3_errmsg(db)));
 
-            stmt = std::shared_ptr<sqlite3_stmt>(stmt_raw, [](sqlite3_stmt *p) {
-                    sqlite3_finalize(p);
-                });
+                stmt = std::shared_ptr<sqlite3_stmt>(stmt_raw, [](sqlite3_stmt *p) {
+                        sqlite3_finalize(p);
+                    });
+            }
 
             std::function<void (std::shared_ptr<sqlite3_stmt>, unsigned int&, const query_element&)> bind_function = 
                 [&bind_function](std::shared_ptr<sqlite3_stmt> stmt, unsigned int& bind_pos, const query_element& c) {
@@ -479,6 +563,34 @@ namespace kissqlite3 {
                         std::string(sqlite3_errmsg(db)));
         }
 
+        // Query plan of the statement from EXPLAIN QUERY PLAN, one line per step of the 
+        // plan; throws an exception if the query cannot be prepared
+        std::vector<std::string> explain() {
+            bind_stmt();
+
+            std::vector<std::string> plan;
+            std::string sql = std::string("EXPLAIN QUERY PLAN ") + sqlite3_sql(stmt.get());
+
+            sqlite3_stmt *plan_raw;
+            const char *pz = nullptr;
+
+            if (sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &plan_raw, &pz) != SQLITE_OK)
+                throw std::runtime_error("Failed to prepare query plan: " + sql + " " +
+                        std::string(sqlite3_errmsg(db)));
+
+            // The last column is the description of the step
+            while (sqlite3_step(plan_raw) == SQLITE_ROW) {
+                auto detail = sqlite3_column_text(plan_raw, sqlite3_column_count(plan_raw) - 1);
+
+                if (detail != nullptr)
+                    plan.push_back(reinterpret_cast<const char *>(detail));
+            }
+
+            sqlite3_finalize(plan_raw);
+
+            return plan;
+        }
+
         // Similar to begin, but throws an exception if the query cannot be run or has
         // no results.
         sqlite3_stmt_iterator run() {
@@ -510,6 +622,7 @@ namespace kissqlite3 {
         }
 
         sqlite3 *db = nullptr;
+        stmt_cache *cache = nullptr;
         std::shared_ptr<sqlite3_stmt> stmt;
 
         std::string op;
@@ -744,6 +857,68 @@ namespace kissqlite3 {
     update _UPDATE(const std::string& table, const std::list<std::string>& fields,
             const std::list<insert_elem>& terms, const std::list<query_element>& where_clause);
 
+    // Bind a value to a position of a statement; returns the sqlite3 result
+    int bind_elem(sqlite3_stmt *stmt, int pos, const insert_elem& e);
+
+    // Run a statement which returns no rows, like BEGIN or COMMIT; throws
+    // std::runtime_error
+    void exec(sqlite3 *db, const std::string& sql);
+
+    // Batched insert of rows which share a table and set of fields.
+    //
+    // Rows are grouped into multi-row statements,
+    //   INSERT INTO table (a, b) VALUES (?, ?), (?, ?), ...
+    // taken from a statement cache, so a large insert compiles two statements and steps
+    // once per group of rows instead of once per row.  All the rows go into one
+    // transaction, begun with the first row (or joined, if the caller already has one
+    // open) and committed by commit(); a batch which is destroyed without being
+    // committed rolls back the rows it inserted.
+    //
+    // The verb can be any form of insert, like "INSERT OR REPLACE".  Errors throw
+    // std::runtime_error.
+    class batch_insert {
+    public:
+        batch_insert(sqlite3 *db, stmt_cache& cache, const std::string& table,
+                const std::list<std::string>& fields, const std::string& verb = "INSERT");
+        ~batch_insert();
+
+        batch_insert(const batch_insert&) = delete;
+        batch_insert& operator=(const batch_insert&) = delete;
+
+        void add(const std::list<insert_elem>& row);
+
+        // Insert any remaining rows and commit the transaction, unless it belongs to
+        // the caller
+        void commit();
+
+        size_t rows() const {
+            return n_rows;
+        }
+
+    protected:
+        // SQL of a statement inserting a number of rows
+        std::string insert_sql(size_t in_rows) const;
+
+        // Insert a number of pending rows from the front of the pending values
+        void flush(size_t in_rows);
+
+        sqlite3 *db;
+        stmt_cache& cache;
+
+        std::string verb;
+        std::string table;
+        std::list<std::string> fields;
+
+        // Rows per statement, limited by the number of variables a statement can bind
+        size_t stmt_rows;
+
+        std::vector<insert_elem> pending;
+        size_t n_rows;
+
+        bool own_transaction;
+        bool in_transaction;
+    };
+
     // Simple column extractors
     template<typename T>
     T sqlite3_column_as(std::shared_ptr<sqlite3_stmt> stmt, unsigned int column);
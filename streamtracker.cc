@@ -18,8 +18,14 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "streamtracker.h"
+#include "configfile.h"
 #include "entrytracker.h"
+#include "messagebus.h"
+#include "timetracker.h"
 
 stream_tracker::stream_tracker() :
     lifetime_global() {
@@ -35,6 +41,21 @@ stream_tracker::stream_tracker() :
 
     next_stream_id = 1;
 
+    stream_max_rate =
+        Globalreg::globalreg->kismet_config->fetch_opt_ulong("stream_max_rate", 0) * 1024;
+    stream_total_rate =
+        Globalreg::globalreg->kismet_config->fetch_opt_ulong("stream_total_rate", 0) * 1024;
+
+    if (stream_max_rate != 0 || stream_total_rate != 0)
+        _MSG_INFO("Limiting live packet streams to {}KB/s each and {}KB/s total "
+                "(0 for no limit)", stream_max_rate / 1024, stream_total_rate / 1024);
+
+    auto timetracker = Globalreg::fetch_mandatory_global_as<time_tracker>();
+    rate_timer_id = timetracker->register_timer(std::chrono::seconds(1), 1,
+            [this](int evt_id) -> int {
+                return update_rates_event(evt_id);
+            });
+
     auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
 
     httpd->register_route("/streams/all_streams", {"GET", "POST"}, httpd->RO_ROLE, {},
@@ -73,7 +94,81 @@ stream_tracker::stream_tracker() :
 }
 
 stream_tracker::~stream_tracker() {
+    auto timetracker = Globalreg::fetch_global_as<time_tracker>();
+    if (timetracker != nullptr)
+        timetracker->remove_timer(rate_timer_id);
+}
+
+int stream_tracker::update_rates_event(int evt_id) {
+    kis_lock_guard<kis_mutex> lk(mutex, "stream_tracker update_rates_event");
+
+    struct stream_demand {
+        std::shared_ptr<streaming_agent> agent;
+        uint64_t want;
+    };
+
+    std::vector<stream_demand> demands;
+
+    time_t now = Globalreg::globalreg->last_tv_sec;
+
+    for (auto s_i : *tracked_stream_map) {
+        auto s = std::static_pointer_cast<streaming_info_record>(s_i.second);
+        auto offered = s->sample_rates(now);
+        auto agent = s->get_agent();
+
+        if (agent == nullptr || !agent->rate_limited())
+            continue;
+
+        // A stream may grow past what it was offered last second by a quarter, and by
+        // enough for a burst of full sized packets
+        uint64_t want = offered + (offered / 4) + 65536;
+
+        if (stream_max_rate != 0)
+            want = std::min(want, stream_max_rate);
+
+        demands.push_back(stream_demand{agent, want});
+    }
+
+    if (stream_total_rate == 0) {
+        for (const auto& d : demands)
+            d.agent->set_rate_budget(stream_max_rate);
+
+        return 1;
+    }
+
+    if (demands.size() == 0)
+        return 1;
+
+    // Max-min fair share of the total:  streams asking for less than an even share get
+    // what they ask for, and the rest is split evenly among the busier streams
+    std::sort(demands.begin(), demands.end(),
+            [](const stream_demand& a, const stream_demand& b) { return a.want < b.want; });
+
+    uint64_t remaining = stream_total_rate;
+    std::vector<uint64_t> budgets;
+    budgets.reserve(demands.size());
+
+    for (size_t i = 0; i < demands.size(); i++) {
+        auto share = remaining / (demands.size() - i);
+        auto budget = std::min(share, demands[i].want);
+        budgets.push_back(budget);
+        remaining -= budget;
+    }
+
+    // Bandwidth no stream asked for is split evenly so any stream can ramp up
+    auto spare = remaining / demands.size();
+
+    for (size_t i = 0; i < demands.size(); i++) {
+        auto budget = budgets[i] + spare;
+
+        if (stream_max_rate != 0)
+            budget = std::min(budget, stream_max_rate);
+
+        // Never leave a stream unlimited by a zero budget
+        demands[i].agent->set_rate_budget(std::max<uint64_t>(budget, 1));
+    }
 
+    return 1;
 }
 
 void stream_tracker::cancel_streams() {
@@ -21,11 +21,15 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
 #include "trackedelement.h"
+#include "trackedrrd.h"
 #include "kis_net_beast_httpd.h"
 #include "devicetracker_component.h"
 
@@ -35,9 +39,14 @@ public:
         stream_id = 0;
         log_packets = 0;
         log_size = 0;
+        log_dropped = 0;
         max_size = 0;
         max_packets = 0;
         stream_paused = false;
+        log_offered = 0;
+        log_limited = 0;
+        rate_budget = 0;
+        rate_tokens = 0;
     }
 
     virtual ~streaming_agent() { };
@@ -46,6 +55,7 @@ public:
 
     uint64_t get_log_size() { return log_size; }
     uint64_t get_log_packets() { return log_packets; }
+    uint64_t get_log_dropped() { return log_dropped; }
 
     void set_max_size(uint64_t in_sz) { max_size = in_sz; }
     uint64_t get_max_size() { return max_size; }
@@ -68,15 +78,71 @@ public:
     virtual void pause_stream() { stream_paused = true; }
     virtual void resume_stream() { stream_paused = false; }
 
+    // Streams which can discard data to stay within a bandwidth budget; the stream
+    // tracker shares the stream bandwidth cap among them
+    virtual bool rate_limited() { return false; }
+
+    uint64_t get_log_offered() { return log_offered; }
+    uint64_t get_log_limited() { return log_limited; }
+
+    // Bytes per second the stream may send, 0 for no limit
+    void set_rate_budget(uint64_t in_budget) { rate_budget = in_budget; }
+    uint64_t get_rate_budget() { return rate_budget; }
+
 protected:
+    // Account for a block offered to the stream and take its size from the budget;
+    // returns false if the stream is over budget and the block should be skipped.
+    // Called with the write lock of the stream held.  The budget may burst to a
+    // second of traffic, and always to a full sized packet.
+    bool take_rate_budget(size_t in_sz) {
+        log_offered += in_sz;
+
+        auto budget = rate_budget.load(std::memory_order_relaxed);
+
+        if (budget == 0)
+            return true;
+
+        auto now = std::chrono::steady_clock::now();
+        double burst = std::max<double>(budget, 65536);
+
+        if (rate_last.time_since_epoch().count() == 0) {
+            rate_tokens = burst;
+        } else {
+            std::chrono::duration<double> elapsed = now - rate_last;
+            rate_tokens = std::min(burst, rate_tokens + elapsed.count() * budget);
+        }
+
+        rate_last = now;
+
+        if (rate_tokens < in_sz) {
+            log_limited++;
+            return false;
+        }
+
+        rate_tokens -= in_sz;
+        return true;
+    }
+
     double stream_id;
     uint64_t log_size;
     uint64_t log_packets;
 
+    // Packets discarded because the consumer of the stream couldn't keep up
+    uint64_t log_dropped;
+
     uint64_t max_size;
     uint64_t max_packets;
 
     bool stream_paused;
+
+    // Bytes offered to the stream, whether or not they were sent, and packets skipped
+    // because the stream was over its bandwidth budget
+    uint64_t log_offered;
+    uint64_t log_limited;
+
+    std::atomic<uint64_t> rate_budget;
+    double rate_tokens;
+    std::chrono::steady_clock::time_point rate_last;
 };
 
 class streaming_info_record : public tracker_component {
@@ -123,12 +189,42 @@ public:
 
     __Proxy(log_packets, uint64_t, uint64_t, uint64_t, log_packets);
     __Proxy(log_size, uint64_t, uint64_t, uint64_t, log_size);
+    __Proxy(log_dropped, uint64_t, uint64_t, uint64_t, log_dropped);
 
     __Proxy(max_packets, uint64_t, uint64_t, uint64_t, max_packets);
     __Proxy(max_size, uint64_t, uint64_t, uint64_t, max_size);
 
     __Proxy(log_paused, uint8_t, bool, bool, log_paused);
 
+    __Proxy(log_limited, uint64_t, uint64_t, uint64_t, log_limited);
+    __Proxy(rate_budget, uint64_t, uint64_t, uint64_t, rate_budget);
+
+    typedef kis_tracked_rrd<> uint64_rrd;
+    __ProxyTrackable(bytes_rrd, uint64_rrd, bytes_rrd);
+    __ProxyTrackable(packets_rrd, uint64_rrd, packets_rrd);
+
+    // Sample the traffic of the agent since the last sample into the rate RRDs; returns
+    // the bytes offered to the stream since the last sample
+    uint64_t sample_rates(time_t in_time) {
+        if (agent == nullptr)
+            return 0;
+
+        auto size = agent->get_log_size();
+        auto packets = agent->get_log_packets();
+        auto offered = agent->get_log_offered();
+
+        bytes_rrd->add_sample(size - last_size, in_time);
+        packets_rrd->add_sample(packets - last_packets, in_time);
+
+        auto offered_delta = offered - last_offered;
+
+        last_size = size;
+        last_packets = packets;
+        last_offered = offered;
+
+        return offered_delta;
+    }
+
     void set_agent(std::shared_ptr<streaming_agent> in_agent) {
         agent = in_agent;
     }
@@ -145,9 +241,12 @@ public:
             set_stream_id(agent->get_stream_id());
             set_log_packets(agent->get_log_packets());
             set_log_size(agent->get_log_size());
+            set_log_dropped(agent->get_log_dropped());
             set_max_packets(agent->get_max_packets());
             set_max_size(agent->get_max_size());
             set_log_paused(agent->get_stream_paused());
+            set_log_limited(agent->get_log_limited());
+            set_rate_budget(agent->get_rate_budget());
         }
     }
 
@@ -165,9 +264,25 @@ protected:
         register_field("kismet.stream.description", "Stream / Log description", &log_description);
         register_field("kismet.stream.packets", "Number of packets (if known)", &log_packets);
         register_field("kismet.stream.size", "Size of log, if known, in bytes", &log_size);
+        register_field("kismet.stream.dropped", 
+                "Packets dropped because the stream client fell behind", &log_dropped);
         register_field("kismet.stream.max_packets", "Maximum number of packets", &max_packets);
         register_field("kismet.stream.max_size", "Maximum allowed size (bytes)", &max_size);
         register_field("kismet.stream.paused", "Stream processing paused", &log_paused);
+        register_field("kismet.stream.limited",
+                "Packets skipped because the stream was over its bandwidth budget", &log_limited);
+        register_field("kismet.stream.rate_budget",
+                "Bandwidth budget of the stream (bytes per second, 0 for no limit)", &rate_budget);
+        register_field("kismet.stream.bytes_rrd", "Bytes sent RRD", &bytes_rrd);
+        register_field("kismet.stream.packets_rrd", "Packets sent RRD", &packets_rrd);
+    }
+
+    virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override {
+        tracker_component::reserve_fields(e);
+
+        last_size = 0;
+        last_packets = 0;
+        last_offered = 0;
     }
 
     std::shared_ptr<tracker_element_double> stream_id;
@@ -178,6 +293,7 @@ protected:
     std::shared_ptr<tracker_element_string> log_description;
     std::shared_ptr<tracker_element_uint64> log_packets;
     std::shared_ptr<tracker_element_uint64> log_size;
+    std::shared_ptr<tracker_element_uint64> log_dropped;
 
     // Maximum values, if any
     std::shared_ptr<tracker_element_uint64> max_packets;
@@ -185,6 +301,18 @@ protected:
 
     std::shared_ptr<tracker_element_uint8> log_paused;
 
+    std::shared_ptr<tracker_element_uint64> log_limited;
+    std::shared_ptr<tracker_element_uint64> rate_budget;
+
+    // Bytes and packets sent each second
+    std::shared_ptr<kis_tracked_rrd<>> bytes_rrd;
+    std::shared_ptr<kis_tracked_rrd<>> packets_rrd;
+
+    // Agent counters at the last rate sample
+    uint64_t last_size;
+    uint64_t last_packets;
+    uint64_t last_offered;
+
     std::shared_ptr<streaming_agent> agent;
 };
 
@@ -212,8 +340,19 @@ public:
     void cancel_streams();
    
 protected:
+    // Sample the stream rates and share the bandwidth caps among the rate limited
+    // streams, once a second
+    int update_rates_event(int evt_id);
+
     kis_mutex mutex;
 
+    // Bandwidth cap of each stream and of all streams together, in bytes per second,
+    // 0 for no cap
+    uint64_t stream_max_rate;
+    uint64_t stream_total_rate;
+
+    int rate_timer_id;
+
     std::shared_ptr<tracker_element_double_map> tracked_stream_map;
 
     int info_builder_id;
@@ -0,0 +1,326 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+
+#include "string_scan.h"
+
+namespace {
+    inline bool json_plain_byte(unsigned char c) {
+        return c >= 0x20 && c != '"' && c != '\\';
+    }
+
+    inline bool printable_byte(unsigned char c, const char *specials) {
+        return c >= 0x20 && c <= 0x7E && strchr(specials, c) == nullptr;
+    }
+
+    size_t json_plain_scalar(const char *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (!json_plain_byte(data[i]))
+                return i;
+        }
+
+        return len;
+    }
+
+    size_t printable_scalar(const char *data, size_t len, const char *specials) {
+        for (size_t i = 0; i < len; i++) {
+            if (!printable_byte(data[i], specials))
+                return i;
+        }
+
+        return len;
+    }
+
+    size_t ascii_scalar(const char *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if ((unsigned char) data[i] & 0x80)
+                return i;
+        }
+
+        return len;
+    }
+
+    struct string_scan_impl {
+        const char *name;
+        size_t (*json_plain)(const char *, size_t);
+        size_t (*printable)(const char *, size_t, const char *);
+        size_t (*ascii)(const char *, size_t);
+    };
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define STRING_SCAN_X86
+#include <immintrin.h>
+
+namespace {
+    // Bytes are compared as signed, so everything from 0x80 up is below 0x20; the
+    // control characters are the bytes which are both below 0x20 and not negative
+
+    __attribute__((target("sse2")))
+    size_t json_plain_sse2(const char *data, size_t len) {
+        const __m128i space = _mm_set1_epi8(0x20);
+        const __m128i neg = _mm_set1_epi8(-1);
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i bslash = _mm_set1_epi8('\\');
+
+        size_t i = 0;
+
+        for (; i + 16 <= len; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (data + i));
+
+            __m128i bad = _mm_and_si128(_mm_cmplt_epi8(x, space), _mm_cmpgt_epi8(x, neg));
+            bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, quote));
+            bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, bslash));
+
+            unsigned int mask = _mm_movemask_epi8(bad);
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+
+        return i + json_plain_scalar(data + i, len - i);
+    }
+
+    __attribute__((target("sse2")))
+    size_t printable_sse2(const char *data, size_t len, const char *specials) {
+        const __m128i low = _mm_set1_epi8(0x1F);
+        const __m128i high = _mm_set1_epi8(0x7F);
+
+        size_t nspecials = strlen(specials);
+
+        size_t i = 0;
+
+        for (; i + 16 <= len; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (data + i));
+
+            __m128i good = _mm_and_si128(_mm_cmpgt_epi8(x, low), _mm_cmplt_epi8(x, high));
+
+            for (size_t s = 0; s < nspecials; s++)
+                good = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(specials[s])), good);
+
+            unsigned int mask = ~_mm_movemask_epi8(good) & 0xFFFF;
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+
+        return i + printable_scalar(data + i, len - i, specials);
+    }
+
+    __attribute__((target("sse2")))
+    size_t ascii_sse2(const char *data, size_t len) {
+        size_t i = 0;
+
+        for (; i + 16 <= len; i += 16) {
+            unsigned int mask =
+                _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (data + i)));
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+
+        return i + ascii_scalar(data + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t json_plain_avx2(const char *data, size_t len) {
+        const __m256i space = _mm256_set1_epi8(0x20);
+        const __m256i neg = _mm256_set1_epi8(-1);
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i bslash = _mm256_set1_epi8('\\');
+
+        size_t i = 0;
+
+        for (; i + 32 <= len; i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (data + i));
+
+            __m256i bad = _mm256_and_si256(_mm256_cmpgt_epi8(space, x),
+                    _mm256_cmpgt_epi8(x, neg));
+            bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, quote));
+            bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, bslash));
+
+            unsigned int mask = _mm256_movemask_epi8(bad);
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+
+        return i + json_plain_sse2(data + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t printable_avx2(const char *data, size_t len, const char *specials) {
+        const __m256i low = _mm256_set1_epi8(0x1F);
+        const __m256i high = _mm256_set1_epi8(0x7F);
+
+        size_t nspecials = strlen(specials);
+
+        size_t i = 0;
+
+        for (; i + 32 <= len; i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (data + i));
+
+            __m256i good = _mm256_and_si256(_mm256_cmpgt_epi8(x, low),
+                    _mm256_cmpgt_epi8(high, x));
+
+            for (size_t s = 0; s < nspecials; s++)
+                good = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(specials[s])),
+                        good);
+
+            unsigned int mask = ~((unsigned int) _mm256_movemask_epi8(good));
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+
+        return i + printable_sse2(data + i, len - i, specials);
+    }
+
+    __attribute__((target("avx2")))
+    size_t ascii_avx2(const char *data, size_t len) {
+        size_t i = 0;
+
+        for (; i + 32 <= len; i += 32) {
+            unsigned int mask =
+                _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (data + i)));
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+
+        return i + ascii_sse2(data + i, len - i);
+    }
+}
+#endif
+
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define STRING_SCAN_NEON
+#include <arm_neon.h>
+
+namespace {
+    // NEON has no movemask; a block with any bad byte is finished a byte at a time
+
+    size_t json_plain_neon(const char *data, size_t len) {
+        const uint8x16_t space = vdupq_n_u8(0x20);
+        const uint8x16_t quote = vdupq_n_u8('"');
+        const uint8x16_t bslash = vdupq_n_u8('\\');
+
+        size_t i = 0;
+
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t x = vld1q_u8((const uint8_t *) (data + i));
+
+            uint8x16_t bad = vorrq_u8(vcltq_u8(x, space), vceqq_u8(x, quote));
+            bad = vorrq_u8(bad, vceqq_u8(x, bslash));
+
+            if (vmaxvq_u8(bad) != 0)
+                return i + json_plain_scalar(data + i, 16);
+        }
+
+        return i + json_plain_scalar(data + i, len - i);
+    }
+
+    size_t printable_neon(const char *data, size_t len, const char *specials) {
+        const uint8x16_t space = vdupq_n_u8(0x20);
+        const uint8x16_t tilde = vdupq_n_u8(0x7E);
+
+        size_t nspecials = strlen(specials);
+
+        size_t i = 0;
+
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t x = vld1q_u8((const uint8_t *) (data + i));
+
+            uint8x16_t bad = vorrq_u8(vcltq_u8(x, space), vcgtq_u8(x, tilde));
+
+            for (size_t s = 0; s < nspecials; s++)
+                bad = vorrq_u8(bad, vceqq_u8(x, vdupq_n_u8(specials[s])));
+
+            if (vmaxvq_u8(bad) != 0)
+                return i + printable_scalar(data + i, 16, specials);
+        }
+
+        return i + printable_scalar(data + i, len - i, specials);
+    }
+
+    size_t ascii_neon(const char *data, size_t len) {
+        size_t i = 0;
+
+        for (; i + 16 <= len; i += 16) {
+            if (vmaxvq_u8(vld1q_u8((const uint8_t *) (data + i))) & 0x80)
+                return i + ascii_scalar(data + i, 16);
+        }
+
+        return i + ascii_scalar(data + i, len - i);
+    }
+}
+#endif
+
+namespace {
+    string_scan_impl string_scan_select() {
+#ifdef STRING_SCAN_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            return {"avx2", json_plain_avx2, printable_avx2, ascii_avx2};
+
+        if (__builtin_cpu_supports("sse2"))
+            return {"sse2", json_plain_sse2, printable_sse2, ascii_sse2};
+#endif
+
+#ifdef STRING_SCAN_NEON
+        return {"neon", json_plain_neon, printable_neon, ascii_neon};
+#endif
+
+        return {"scalar", json_plain_scalar, printable_scalar, ascii_scalar};
+    }
+
+    const string_scan_impl& string_scan() {
+        static const string_scan_impl impl = string_scan_select();
+        return impl;
+    }
+}
+
+size_t json_plain_span(const char *data, size_t len) noexcept {
+    if (len < 16)
+        return json_plain_scalar(data, len);
+
+    return string_scan().json_plain(data, len);
+}
+
+size_t printable_span(const char *data, size_t len, const char *specials) noexcept {
+    if (len < 16)
+        return printable_scalar(data, len, specials);
+
+    return string_scan().printable(data, len, specials);
+}
+
+size_t ascii_span(const char *data, size_t len) noexcept {
+    if (len < 16)
+        return ascii_scalar(data, len);
+
+    return string_scan().ascii(data, len);
+}
+
+const char *string_scan_name() noexcept {
+    return string_scan().name;
+}
+
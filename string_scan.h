@@ -0,0 +1,50 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __STRING_SCAN_H__
+#define __STRING_SCAN_H__
+
+#include "config.h"
+
+#include <stddef.h>
+
+// Vectorized scans for the string escaping done when serializing and logging.
+//
+// Each scan returns the length of the leading run of bytes which need no escaping, so
+// the escapers copy the clean runs whole and only handle the bytes between them one at
+// a time.  Strings which need no escaping at all, the common case, are checked 16 or
+// 32 bytes at a time.
+//
+// The scans use AVX2 when the CPU has it and SSE2 otherwise on x86, and NEON on ARMv8;
+// other CPUs, and strings shorter than a vector, are scanned a byte at a time.
+
+// Bytes which JSON string escaping passes unchanged: anything but a control character,
+// a quote, or a backslash
+size_t json_plain_span(const char *data, size_t len) noexcept;
+
+// Printable ASCII (0x20 to 0x7E) which isn't one of the bytes in 'specials'
+size_t printable_span(const char *data, size_t len, const char *specials = "") noexcept;
+
+// 7-bit ASCII
+size_t ascii_span(const char *data, size_t len) noexcept;
+
+// Name of the instruction set used by the scans on this CPU
+const char *string_scan_name() noexcept;
+
+#endif
+
@@ -18,8 +18,11 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <memory>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <unistd.h>
 
@@ -36,6 +39,9 @@
 #include "globalregistry.h"
 #include "json_adapter.h"
 #include "kis_databaselogfile.h"
+#include "kis_io_pool.h"
+#include "kis_mem_account.h"
+#include "packetchain.h"
 #include "system_monitor.h"
 #include "util.h"
 #include "version.h"
@@ -54,6 +60,16 @@ Systemmonitor::Systemmonitor() :
 #ifdef SYS_LINUX
     // Get the bytes per page
     mem_per_page = sysconf(_SC_PAGESIZE);
+
+    statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    thermal_fd = open("/sys/class/thermal/thermal_zone0/temp", O_RDONLY | O_CLOEXEC);
+
+    clock_ticks = sysconf(_SC_CLK_TCK);
+    thread_sample_time = std::chrono::steady_clock::now();
+
+    thread_pool_id = 
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.threadpool",
+                tracker_element_factory<tracked_thread_pool>(), "thread pool CPU use");
 #endif
 
     timer_id = timetracker->register_timer(SERVER_TIMESLICES_SEC, NULL, 1, this);
@@ -134,6 +150,58 @@ Systemmonitor::Systemmonitor() :
             }, monitor_mutex);
     httpd->register_route("/system/timestamp", {"GET", "POST"}, httpd->RO_ROLE, {}, timestamp_endp);
 
+    kis_mutex_profile::set_enabled(
+            Globalreg::globalreg->kismet_config->fetch_opt_bool("mutex_profiling", false));
+
+    mutex_profile_vec_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.mutex_profile",
+                tracker_element_factory<tracker_element_vector>(), "mutex contention profile");
+    mutex_profile_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.mutex",
+                tracker_element_factory<tracked_mutex_profile>(), "mutex contention");
+    mutex_op_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.mutex.op",
+                tracker_element_factory<tracked_mutex_op>(), "mutex contention by op");
+
+    httpd->register_route("/system/mutex_profile", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection>) -> std::shared_ptr<tracker_element> {
+                    return mutex_profile();
+                }));
+
+    httpd->register_route("/system/mutex_profile/reset", {"POST"}, httpd->LOGON_ROLE, {},
+            std::make_shared<kis_net_web_function_endpoint>(
+                [](std::shared_ptr<kis_net_beast_httpd_connection> con) {
+                    std::ostream stream(&con->response_stream());
+                    kis_mutex_profile::reset();
+                    stream << "OK";
+                }));
+
+    memory_report_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.memory",
+                tracker_element_factory<tracker_element_map>(), "memory use");
+    memory_enabled_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.memory.accounting",
+                tracker_element_factory<tracker_element_uint8>(), "memory accounting enabled");
+    memory_categories_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.memory.allocations",
+                tracker_element_factory<tracker_element_vector>(), "live allocations by category");
+    memory_category_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.memory.allocation",
+                tracker_element_factory<tracked_memory_category>(), "live allocations");
+    memory_phys_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.memory.device_records",
+                tracker_element_factory<tracker_element_vector>(), "device record sizes by phy");
+    memory_phy_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.system.memory.device_record",
+                tracker_element_factory<tracked_memory_phy>(), "device record size");
+
+    httpd->register_route("/system/memory", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection>) -> std::shared_ptr<tracker_element> {
+                    return memory_report();
+                }));
+
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_system_status", true)) {
         auto snap_time_s = 
             Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("kis_log_system_status_rate", 30);
@@ -248,6 +316,349 @@ Systemmonitor::~Systemmonitor() {
     timetracker->remove_timer(event_timer_id);
 
     eventbus->remove_listener(logopen_evt_id);
+
+#ifdef SYS_LINUX
+    if (statm_fd >= 0)
+        close(statm_fd);
+    if (thermal_fd >= 0)
+        close(thermal_fd);
+
+    for (const auto& t : thread_samples) {
+        close(t.second.stat_fd);
+        close(t.second.comm_fd);
+    }
+#endif
+}
+
+#ifdef SYS_LINUX
+ssize_t Systemmonitor::pread_proc(int fd, char *buf, size_t sz) {
+    if (fd < 0)
+        return -1;
+
+    auto r = pread(fd, buf, sz - 1, 0);
+
+    if (r < 0)
+        return -1;
+
+    buf[r] = 0;
+
+    return r;
+}
+
+void Systemmonitor::sample_threads() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - thread_sample_time).count();
+    thread_sample_time = now;
+
+    DIR *taskdir = opendir("/proc/self/task");
+
+    if (taskdir == nullptr)
+        return;
+
+    struct pool_sample {
+        unsigned int threads = 0;
+        uint64_t delta = 0;
+        uint64_t max_delta = 0;
+        uint64_t ticks = 0;
+    };
+
+    std::map<std::string, pool_sample> pools;
+
+    for (auto& t : thread_samples)
+        t.second.seen = false;
+
+    while (auto ent = readdir(taskdir)) {
+        if (ent->d_name[0] < '0' || ent->d_name[0] > '9')
+            continue;
+
+        pid_t tid = atoi(ent->d_name);
+
+        auto ts = thread_samples.find(tid);
+
+        if (ts == thread_samples.end()) {
+            thread_sample s;
+
+            s.stat_fd = open(fmt::format("/proc/self/task/{}/stat", tid).c_str(), O_RDONLY | O_CLOEXEC);
+            s.comm_fd = open(fmt::format("/proc/self/task/{}/comm", tid).c_str(), O_RDONLY | O_CLOEXEC);
+            s.ticks = 0;
+
+            if (s.stat_fd < 0 || s.comm_fd < 0) {
+                if (s.stat_fd >= 0)
+                    close(s.stat_fd);
+                if (s.comm_fd >= 0)
+                    close(s.comm_fd);
+                continue;
+            }
+
+            ts = thread_samples.emplace(tid, s).first;
+        }
+
+        ts->second.seen = true;
+
+        char buf[512];
+
+        // Threads are named after they start, so the name is read every time
+        if (pread_proc(ts->second.comm_fd, buf, sizeof(buf)) <= 0)
+            continue;
+
+        std::string comm(buf);
+        if (comm.length() && comm.back() == '\n')
+            comm.pop_back();
+
+        if (pread_proc(ts->second.stat_fd, buf, sizeof(buf)) <= 0)
+            continue;
+
+        // utime and stime are fields 14 and 15; the name may contain anything, so 
+        // count from the last paren
+        auto paren = strrchr(buf, ')');
+
+        if (paren == nullptr)
+            continue;
+
+        unsigned long long utime, stime;
+
+        if (sscanf(paren + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", 
+                    &utime, &stime) != 2)
+            continue;
+
+        uint64_t ticks = utime + stime;
+        uint64_t delta = ticks - std::min(ticks, ts->second.ticks);
+        ts->second.ticks = ticks;
+
+        auto& p = pools[thread_pool_of(comm)];
+        p.threads++;
+        p.delta += delta;
+        p.max_delta = std::max(p.max_delta, delta);
+        p.ticks += ticks;
+    }
+
+    closedir(taskdir);
+
+    for (auto t = thread_samples.begin(); t != thread_samples.end(); ) {
+        if (t->second.seen) {
+            ++t;
+            continue;
+        }
+
+        close(t->second.stat_fd);
+        close(t->second.comm_fd);
+        t = thread_samples.erase(t);
+    }
+
+    auto pool_map = status->get_thread_pools();
+    pool_map->clear();
+
+    auto packetchain = Globalreg::fetch_global_handle<packet_chain>();
+
+    if (clock_ticks <= 0 || elapsed <= 0)
+        return;
+
+    for (const auto& p : pools) {
+        auto tp = std::make_shared<tracked_thread_pool>(thread_pool_id);
+
+        tp->set_pool_name(p.first);
+        tp->set_threads(p.second.threads);
+        tp->set_cpu_perc(100.0f * p.second.delta / clock_ticks / elapsed);
+        tp->set_cpu_max_thread_perc(100.0f * p.second.max_delta / clock_ticks / elapsed);
+        tp->set_cpu_sec((double) p.second.ticks / clock_ticks);
+
+        if (p.first == "io")
+            fill_io_pool_state(tp, std::atomic_load(&Globalreg::globalreg->io_pool));
+        else if (p.first == "http_io")
+            fill_io_pool_state(tp, std::atomic_load(&Globalreg::globalreg->http_io_pool));
+        else if (p.first == "packet" && packetchain != nullptr) {
+            tp->set_threads_min(packetchain->get_n_packet_threads());
+            tp->set_threads_max(packetchain->get_n_packet_threads());
+            tp->set_threads_peak(packetchain->get_n_packet_threads());
+            tp->set_cpus(cpu_list_str(packetchain->get_packet_thread_cpus()));
+        }
+
+        pool_map->insert(p.first, tp);
+    }
+}
+
+void Systemmonitor::fill_io_pool_state(std::shared_ptr<tracked_thread_pool> tp,
+        std::shared_ptr<kis_io_pool> pool) {
+    if (pool == nullptr)
+        return;
+
+    tp->set_threads_min(pool->get_threads_min());
+    tp->set_threads_max(pool->get_threads_max());
+    tp->set_threads_peak(pool->get_threads_peak());
+    tp->set_cpus(cpu_list_str(pool->get_cpus()));
+    tp->set_queue_latency(pool->get_latency_ms());
+    tp->set_queue_latency_max(pool->get_latency_max_ms());
+    tp->set_handlers(pool->get_handlers());
+}
+
+std::string Systemmonitor::cpu_list_str(const std::vector<unsigned int>& cpus) {
+    std::stringstream ss;
+    bool first = true;
+
+    for (auto c : cpus) {
+        if (!first)
+            ss << ",";
+        first = false;
+        ss << c;
+    }
+
+    return ss.str();
+}
+#endif
+
+std::string Systemmonitor::thread_pool_of(const std::string& comm) {
+    if (comm.find("PACKETLOG") == 0)
+        return "packetlog";
+    if (comm.find("PACKET") == 0)
+        return "packet";
+    if (comm.find("HTTP IO") == 0)
+        return "http_io";
+    if (comm.find("IO ") == 0 || comm.find("BEAST") == 0)
+        return "io";
+    if (comm == "timers" || comm == "TIME_EVT")
+        return "timer";
+    if (comm.find("eventbus") == 0)
+        return "eventbus";
+    if (comm.find("kismetdb") == 0 || comm == "LOGWRITER")
+        return "log";
+
+    return "other";
+}
+
+std::shared_ptr<tracker_element> Systemmonitor::mutex_profile() {
+    auto ret = std::make_shared<tracker_element_vector>(mutex_profile_vec_id);
+
+    if (!kis_mutex_profile::active())
+        return ret;
+
+    auto stats = kis_mutex_profile::all_stats();
+
+    // Most contended first
+    std::sort(stats.begin(), stats.end(), 
+            [](const kis_mutex_stats *a, const kis_mutex_stats *b) {
+                return a->wait_ns > b->wait_ns;
+            });
+
+    for (auto s : stats) {
+        if (s->acquisitions == 0)
+            continue;
+
+        auto mp = std::make_shared<tracked_mutex_profile>(mutex_profile_id);
+        mp->set_from(s, mutex_op_id);
+        ret->push_back(mp);
+    }
+
+    return ret;
+}
+
+std::shared_ptr<tracker_element> Systemmonitor::memory_report() {
+    auto ret = std::make_shared<tracker_element_map>(memory_report_id);
+
+    ret->insert(std::make_shared<tracker_element_uint8>(memory_enabled_id, 
+                kis_mem_account::active()));
+
+    auto allocations = std::make_shared<tracker_element_vector>(memory_categories_id);
+    ret->insert(allocations);
+
+    auto counters = kis_mem_account::all_counters();
+
+    // Largest first
+    std::sort(counters.begin(), counters.end(),
+            [](const kis_mem_counter *a, const kis_mem_counter *b) {
+                return a->bytes > b->bytes;
+            });
+
+    for (auto c : counters) {
+        if (c->objects == 0 && c->bytes == 0)
+            continue;
+
+        auto mc = std::make_shared<tracked_memory_category>(memory_category_id);
+        mc->set_category(c->category);
+        mc->set_site(c->name);
+        mc->set_objects(c->objects);
+        mc->set_bytes(c->bytes);
+        allocations->push_back(mc);
+    }
+
+    // Device records are estimated from a sample spread over the device list, since
+    // walking every record of a large population takes a while under the device lock
+    class memory_phy_worker : public device_tracker_view_worker {
+    public:
+        memory_phy_worker(unsigned int stride) :
+            stride{stride},
+            n{0} { }
+
+        virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override {
+            auto& p = phys[device->get_phyname()];
+
+            p.devices++;
+
+            if (n++ % stride == 0) {
+                p.sampled++;
+                p.bytes += tracker_element_size_estimate(device);
+            }
+
+            return false;
+        }
+
+        struct phy_sizes {
+            uint64_t devices = 0;
+            uint64_t sampled = 0;
+            uint64_t bytes = 0;
+        };
+
+        std::map<std::string, phy_sizes> phys;
+
+    protected:
+        unsigned int stride;
+        unsigned long n;
+    };
+
+    const unsigned int max_samples = 1000;
+
+    memory_phy_worker worker(std::max(1U, devicetracker->fetch_num_devices() / max_samples));
+    devicetracker->do_readonly_device_work(worker);
+
+    auto records = std::make_shared<tracker_element_vector>(memory_phys_id);
+    ret->insert(records);
+
+    for (const auto& p : worker.phys) {
+        auto mp = std::make_shared<tracked_memory_phy>(memory_phy_id);
+        mp->set_phy_name(p.first);
+        mp->set_devices(p.second.devices);
+        mp->set_sampled(p.second.sampled);
+
+        if (p.second.sampled > 0) {
+            auto avg = p.second.bytes / p.second.sampled;
+            mp->set_record_bytes(avg);
+            mp->set_total_bytes(avg * p.second.devices);
+        }
+
+        records->push_back(mp);
+    }
+
+    return ret;
+}
+
+void tracked_mutex_profile::set_from(kis_mutex_stats *stats, int op_id) {
+    set_mutex_name(stats->name);
+    set_acquisitions(stats->acquisitions);
+    set_contended(stats->contended);
+    set_recursive(stats->recursive);
+    set_wait_ns(stats->wait_ns);
+    set_wait_max_ns(stats->wait_max_ns);
+    set_hold_ns(stats->hold_ns);
+    set_hold_max_ns(stats->hold_max_ns);
+
+    auto ops = get_top_ops();
+
+    for (const auto& o : stats->top_ops(10)) {
+        auto to = std::make_shared<tracked_mutex_op>(op_id);
+        to->set_op(o.first);
+        to->set_contended(o.second.contended);
+        to->set_wait_ns(o.second.wait_ns);
+        ops->push_back(to);
+    }
 }
 
 void tracked_system_status::register_fields() {
@@ -276,6 +687,8 @@ void tracked_system_status::register_fields() {
     register_field("kismet.system.sensors.fan", "fan sensors", &sensors_fans);
     register_field("kismet.system.sensors.temp", "temperature sensors", &sensors_temp);
 
+    register_field("kismet.system.threadpools", "CPU use by thread pool", &thread_pools);
+
     register_field("kismet.system.num_fields", "number of allocated tracked element fields", &num_fields);
     register_field("kismet.system.num_components", "number of allocated tracked element components", &num_components);
     register_field("kismet.system.num_http_connections", "number of concurrent http connections", &num_http_connections);
@@ -291,40 +704,20 @@ int Systemmonitor::timetracker_event(int eventid) {
     status->get_devices_rrd()->add_sample(num_devices, Globalreg::globalreg->last_tv_sec);
 
 #ifdef SYS_LINUX
-    // Grab the memory from /proc
-    std::string procline;
-    std::ifstream procfile;
-
-    procfile.open("/proc/self/stat");
-
-    if (procfile.good()) {
-        std::getline(procfile, procline);
-        procfile.close();
-
-        // Find the last paren because status is 'pid (name) stuff'.
-        // Memory is nominally field 24, so we find the last paren, add a 
-        // space, and split the rest
-        size_t paren = procline.find_last_of(")");
-
-        if (paren != std::string::npos) {
-            std::vector<std::string> toks = 
-                str_tokenize(procline.substr(paren + 1, procline.length()), " ");
-
-            if (toks.size() > 22) {
-                unsigned long int m;
+    // Resident pages are the second field of statm
+    char procbuf[128];
+    unsigned long int m;
 
-                if (sscanf(toks[22].c_str(), "%lu", &m) == 1) {
-                    m *= mem_per_page;
+    if (pread_proc(statm_fd, procbuf, sizeof(procbuf)) > 0 &&
+            sscanf(procbuf, "%*u %lu", &m) == 1) {
+        m *= mem_per_page;
+        m /= 1024;
 
-                    m /= 1024;
-
-                    status->set_memory(m);
-                    status->get_memory_rrd()->add_sample(m, Globalreg::globalreg->last_tv_sec);
-                }
-            }
-        }
+        status->set_memory(m);
+        status->get_memory_rrd()->add_sample(m, Globalreg::globalreg->last_tv_sec);
     }
 
+    sample_threads();
 #endif
 
 #if defined(SYS_LINUX)
@@ -398,19 +791,13 @@ int Systemmonitor::timetracker_event(int eventid) {
 #endif
 
     // Try reading the system temperature for newer linuxes
-    FILE *tempf = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-
-    if (tempf != NULL) {
-        std::string synth_name = "system-thermal-0";
-        double temp;
+    double temp;
 
-        if (fscanf(tempf, "%lf", &temp) == 1) {
-            temp = temp / 1000;
-            status->get_sensors_temp()->insert(synth_name, std::make_shared<tracker_element_double>(0, temp));
-        }
-
-
-        fclose(tempf);
+    if (pread_proc(thermal_fd, procbuf, sizeof(procbuf)) > 0 &&
+            sscanf(procbuf, "%lf", &temp) == 1) {
+        temp = temp / 1000;
+        status->get_sensors_temp()->insert("system-thermal-0", 
+                std::make_shared<tracker_element_double>(0, temp));
     }
 
 #endif
@@ -421,23 +808,29 @@ int Systemmonitor::timetracker_event(int eventid) {
 void tracked_system_status::pre_serialize() {
     kis_lock_guard<kis_mutex> lk(monitor_mutex);
 
-    kis_battery_info batinfo;
-    fetch_battery_info(&batinfo);
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    uint64_t now_ms = now.tv_sec * 1000ULL + now.tv_usec / 1000;
 
-    set_battery_perc(batinfo.percentage);
-    if (batinfo.ac && batinfo.charging) {
-        set_battery_charging("charging");
-    } else if (batinfo.ac && !batinfo.charging) {
-        set_battery_charging("charged");
-    } else if (!batinfo.ac) {
-        set_battery_charging("discharging");
-    }
+    if (now_ms - battery_sample_ms >= 1000) {
+        battery_sample_ms = now_ms;
 
-    set_battery_ac(batinfo.ac);
-    set_battery_remaining(batinfo.remaining_sec);
+        kis_battery_info batinfo;
+        fetch_battery_info(&batinfo);
 
-    struct timeval now;
-    gettimeofday(&now, NULL);
+        set_battery_perc(batinfo.percentage);
+        if (batinfo.ac && batinfo.charging) {
+            set_battery_charging("charging");
+        } else if (batinfo.ac && !batinfo.charging) {
+            set_battery_charging("charged");
+        } else if (!batinfo.ac) {
+            set_battery_charging("discharging");
+        }
+
+        set_battery_ac(batinfo.ac);
+        set_battery_remaining(batinfo.remaining_sec);
+    }
 
     set_timestamp_sec(now.tv_sec);
     set_timestamp_usec(now.tv_usec);
@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <chrono>
+#include <map>
 #include <string>
 
 #include "kis_mutex.h"
@@ -32,22 +34,354 @@
 
 class event_bus;
 
+// CPU use of one group of server threads, grouped by thread name
+class tracked_thread_pool : public tracker_component {
+public:
+    tracked_thread_pool() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_thread_pool(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_thread_pool(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_thread_pool");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(pool_name, std::string, std::string, std::string, pool_name);
+    __Proxy(threads, uint32_t, uint32_t, uint32_t, threads);
+    __Proxy(cpu_perc, double, double, double, cpu_perc);
+    __Proxy(cpu_max_thread_perc, double, double, double, cpu_max_thread_perc);
+    __Proxy(cpu_sec, double, double, double, cpu_sec);
+
+    __Proxy(threads_min, uint32_t, uint32_t, uint32_t, threads_min);
+    __Proxy(threads_max, uint32_t, uint32_t, uint32_t, threads_max);
+    __Proxy(threads_peak, uint32_t, uint32_t, uint32_t, threads_peak);
+    __Proxy(cpus, std::string, std::string, std::string, cpus);
+    __Proxy(queue_latency, double, double, double, queue_latency);
+    __Proxy(queue_latency_max, double, double, double, queue_latency_max);
+    __Proxy(handlers, uint64_t, uint64_t, uint64_t, handlers);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.system.threadpool.name", "Thread pool", &pool_name);
+        register_field("kismet.system.threadpool.threads", "Number of threads", &threads);
+        register_field("kismet.system.threadpool.cpu_perc", 
+                "CPU used over the last sample, in percent of one core", &cpu_perc);
+        register_field("kismet.system.threadpool.cpu_max_thread_perc", 
+                "CPU used by the busiest thread over the last sample, in percent of one core", 
+                &cpu_max_thread_perc);
+        register_field("kismet.system.threadpool.cpu_sec", 
+                "CPU seconds used by the current threads", &cpu_sec);
+
+        register_field("kismet.system.threadpool.threads_min", 
+                "Minimum threads of an adaptive pool", &threads_min);
+        register_field("kismet.system.threadpool.threads_max", 
+                "Maximum threads of an adaptive pool", &threads_max);
+        register_field("kismet.system.threadpool.threads_peak", 
+                "Most threads an adaptive pool has run", &threads_peak);
+        register_field("kismet.system.threadpool.cpus", 
+                "CPUs the pool is restricted to, or empty for any CPU", &cpus);
+        register_field("kismet.system.threadpool.queue_latency", 
+                "Time the last probe waited in the pool queue, in milliseconds", &queue_latency);
+        register_field("kismet.system.threadpool.queue_latency_max", 
+                "Longest a probe waited in the pool queue over the last minute, in milliseconds", 
+                &queue_latency_max);
+        register_field("kismet.system.threadpool.handlers", 
+                "Handlers run by the pool", &handlers);
+    }
+
+    std::shared_ptr<tracker_element_string> pool_name;
+    std::shared_ptr<tracker_element_uint32> threads;
+    std::shared_ptr<tracker_element_double> cpu_perc;
+    std::shared_ptr<tracker_element_double> cpu_max_thread_perc;
+    std::shared_ptr<tracker_element_double> cpu_sec;
+
+    std::shared_ptr<tracker_element_uint32> threads_min;
+    std::shared_ptr<tracker_element_uint32> threads_max;
+    std::shared_ptr<tracker_element_uint32> threads_peak;
+    std::shared_ptr<tracker_element_string> cpus;
+    std::shared_ptr<tracker_element_double> queue_latency;
+    std::shared_ptr<tracker_element_double> queue_latency_max;
+    std::shared_ptr<tracker_element_uint64> handlers;
+};
+
+// Contention of a mutex on behalf of one op
+class tracked_mutex_op : public tracker_component {
+public:
+    tracked_mutex_op() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_mutex_op(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_mutex_op(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_mutex_op");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(op, std::string, std::string, std::string, op);
+    __Proxy(contended, uint64_t, uint64_t, uint64_t, contended);
+    __Proxy(wait_ns, uint64_t, uint64_t, uint64_t, wait_ns);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.system.mutex.op.name", "Lock op", &op);
+        register_field("kismet.system.mutex.op.contended", 
+                "Contended acquisitions for this op", &contended);
+        register_field("kismet.system.mutex.op.wait_ns", 
+                "Time spent waiting for the lock for this op (ns)", &wait_ns);
+    }
+
+    std::shared_ptr<tracker_element_string> op;
+    std::shared_ptr<tracker_element_uint64> contended;
+    std::shared_ptr<tracker_element_uint64> wait_ns;
+};
+
+// Lock profile of all the mutexes sharing a name
+class tracked_mutex_profile : public tracker_component {
+public:
+    tracked_mutex_profile() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_mutex_profile(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_mutex_profile(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_mutex_profile");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(mutex_name, std::string, std::string, std::string, mutex_name);
+    __Proxy(acquisitions, uint64_t, uint64_t, uint64_t, acquisitions);
+    __Proxy(contended, uint64_t, uint64_t, uint64_t, contended);
+    __Proxy(recursive, uint64_t, uint64_t, uint64_t, recursive);
+    __Proxy(wait_ns, uint64_t, uint64_t, uint64_t, wait_ns);
+    __Proxy(wait_max_ns, uint64_t, uint64_t, uint64_t, wait_max_ns);
+    __Proxy(hold_ns, uint64_t, uint64_t, uint64_t, hold_ns);
+    __Proxy(hold_max_ns, uint64_t, uint64_t, uint64_t, hold_max_ns);
+    __ProxyTrackable(top_ops, tracker_element_vector, top_ops);
+
+    void set_from(kis_mutex_stats *stats, int op_id);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.system.mutex.name", "Mutex name", &mutex_name);
+        register_field("kismet.system.mutex.acquisitions", "Acquisitions", &acquisitions);
+        register_field("kismet.system.mutex.contended", 
+                "Acquisitions which waited for another holder", &contended);
+        register_field("kismet.system.mutex.recursive", 
+                "Acquisitions by the thread already holding the mutex", &recursive);
+        register_field("kismet.system.mutex.wait_ns", "Total time spent waiting (ns)", &wait_ns);
+        register_field("kismet.system.mutex.wait_max_ns", "Longest wait (ns)", &wait_max_ns);
+        register_field("kismet.system.mutex.hold_ns", "Total time held (ns)", &hold_ns);
+        register_field("kismet.system.mutex.hold_max_ns", "Longest hold (ns)", &hold_max_ns);
+        register_field("kismet.system.mutex.top_ops", 
+                "Ops which waited longest for the mutex", &top_ops);
+    }
+
+    std::shared_ptr<tracker_element_string> mutex_name;
+    std::shared_ptr<tracker_element_uint64> acquisitions;
+    std::shared_ptr<tracker_element_uint64> contended;
+    std::shared_ptr<tracker_element_uint64> recursive;
+    std::shared_ptr<tracker_element_uint64> wait_ns;
+    std::shared_ptr<tracker_element_uint64> wait_max_ns;
+    std::shared_ptr<tracker_element_uint64> hold_ns;
+    std::shared_ptr<tracker_element_uint64> hold_max_ns;
+    std::shared_ptr<tracker_element_vector> top_ops;
+};
+
+// Live objects and bytes of one memory accounting category
+class tracked_memory_category : public tracker_component {
+public:
+    tracked_memory_category() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_memory_category(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_memory_category(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_memory_category");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(category, std::string, std::string, std::string, category);
+    __Proxy(site, std::string, std::string, std::string, site);
+    __Proxy(objects, int64_t, int64_t, int64_t, objects);
+    __Proxy(bytes, int64_t, int64_t, int64_t, bytes);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.system.memory.category", "Allocation category", &category);
+        register_field("kismet.system.memory.site", "Allocation type or site", &site);
+        register_field("kismet.system.memory.objects", "Live objects", &objects);
+        register_field("kismet.system.memory.bytes", "Live bytes", &bytes);
+    }
+
+    std::shared_ptr<tracker_element_string> category;
+    std::shared_ptr<tracker_element_string> site;
+    std::shared_ptr<tracker_element_int64> objects;
+    std::shared_ptr<tracker_element_int64> bytes;
+};
+
+// Estimated size of the device records of one phy
+class tracked_memory_phy : public tracker_component {
+public:
+    tracked_memory_phy() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_memory_phy(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(nullptr);
+    }
+
+    tracked_memory_phy(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_memory_phy");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(phy_name, std::string, std::string, std::string, phy_name);
+    __Proxy(devices, uint64_t, uint64_t, uint64_t, devices);
+    __Proxy(sampled, uint64_t, uint64_t, uint64_t, sampled);
+    __Proxy(record_bytes, uint64_t, uint64_t, uint64_t, record_bytes);
+    __Proxy(total_bytes, uint64_t, uint64_t, uint64_t, total_bytes);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.system.memory.phy.name", "Phy name", &phy_name);
+        register_field("kismet.system.memory.phy.devices", "Devices of this phy", &devices);
+        register_field("kismet.system.memory.phy.sampled", 
+                "Devices sampled for the estimate", &sampled);
+        register_field("kismet.system.memory.phy.record_bytes", 
+                "Estimated average size of a device record, in bytes", &record_bytes);
+        register_field("kismet.system.memory.phy.total_bytes", 
+                "Estimated size of every device record of this phy, in bytes", &total_bytes);
+    }
+
+    std::shared_ptr<tracker_element_string> phy_name;
+    std::shared_ptr<tracker_element_uint64> devices;
+    std::shared_ptr<tracker_element_uint64> sampled;
+    std::shared_ptr<tracker_element_uint64> record_bytes;
+    std::shared_ptr<tracker_element_uint64> total_bytes;
+};
+
 class tracked_system_status : public tracker_component {
 public:
     tracked_system_status() :
-        tracker_component() {
+        tracker_component(),
+        battery_sample_ms{0} {
         register_fields();
         reserve_fields(nullptr);
     }
 
     tracked_system_status(int in_id) :
-        tracker_component(in_id) {
+        tracker_component(in_id),
+        battery_sample_ms{0} {
         register_fields();
         reserve_fields(nullptr);
     }
 
     tracked_system_status(int in_id, std::shared_ptr<tracker_element_map> e) :
-        tracker_component(in_id) {
+        tracker_component(in_id),
+        battery_sample_ms{0} {
         register_fields();
         reserve_fields(e);
     }
@@ -91,6 +425,8 @@ public:
     __ProxyTrackable(sensors_fans, tracker_element_string_map, sensors_fans);
     __ProxyTrackable(sensors_temp, tracker_element_string_map, sensors_temp);
 
+    __ProxyTrackable(thread_pools, tracker_element_string_map, thread_pools);
+
     __Proxy(num_fields, uint64_t, uint64_t, uint64_t, num_fields);
     __Proxy(num_components, uint64_t, uint64_t, uint64_t, num_components);
     __Proxy(num_http_connections, uint64_t, uint64_t, uint64_t, num_http_connections);
@@ -100,6 +436,10 @@ public:
 protected:
     kis_mutex monitor_mutex;
 
+    // Battery state is read from sysfs at most once a second, no matter how many 
+    // clients are polling the status
+    uint64_t battery_sample_ms;
+
     virtual void register_fields() override;
 
     std::shared_ptr<device_tracker> devicetracker;
@@ -127,6 +467,8 @@ protected:
     std::shared_ptr<tracker_element_string_map> sensors_fans;
     std::shared_ptr<tracker_element_string_map> sensors_temp;
 
+    std::shared_ptr<tracker_element_string_map> thread_pools;
+
     std::shared_ptr<tracker_element_uint64> num_fields;
     std::shared_ptr<tracker_element_uint64> num_components;
     std::shared_ptr<tracker_element_uint64> num_http_connections;
@@ -166,12 +508,54 @@ protected:
     std::shared_ptr<kis_net_web_tracked_endpoint> user_monitor_endp;
     std::shared_ptr<kis_net_web_tracked_endpoint> timestamp_endp;
 
+    // Lock contention profile, when mutex_profiling is enabled
+    std::shared_ptr<tracker_element> mutex_profile();
+    int mutex_profile_vec_id, mutex_profile_id, mutex_op_id;
+
+    // Allocation accounting, when memory_accounting is enabled, and the estimated size
+    // of the device records of each phy
+    std::shared_ptr<tracker_element> memory_report();
+    int memory_report_id, memory_enabled_id, memory_categories_id, memory_category_id;
+    int memory_phys_id, memory_phy_id;
+
     std::shared_ptr<device_tracker> devicetracker;
 
     std::shared_ptr<tracked_system_status> status;
 
     long mem_per_page;
 
+#ifdef SYS_LINUX
+    // /proc and /sys files read every second are kept open and re-read with pread
+    int statm_fd;
+    int thermal_fd;
+
+    // Read a small proc file from the start into buf, returning the length or -1
+    static ssize_t pread_proc(int fd, char *buf, size_t sz);
+
+    // Per-thread CPU accounting, from /proc/self/task
+    struct thread_sample {
+        int stat_fd;
+        int comm_fd;
+        uint64_t ticks;
+        bool seen;
+    };
+
+    std::map<pid_t, thread_sample> thread_samples;
+    std::chrono::steady_clock::time_point thread_sample_time;
+    long clock_ticks;
+    int thread_pool_id;
+
+    void sample_threads();
+
+    // State of the adaptive IO pools, which the thread samples don't show
+    static void fill_io_pool_state(std::shared_ptr<tracked_thread_pool> tp, 
+            std::shared_ptr<kis_io_pool> pool);
+    static std::string cpu_list_str(const std::vector<unsigned int>& cpus);
+#endif
+
+    // Map a thread name to the pool it belongs to
+    static std::string thread_pool_of(const std::string& comm);
+
     std::shared_ptr<time_tracker> timetracker;
     int event_timer_id;
     int kismetdb_log_timer;
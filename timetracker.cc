@@ -25,16 +25,20 @@
 
 #include "timetracker.h"
 
+#include "kis_net_beast_httpd.h"
 #include "messagebus.h"
 
-time_tracker::time_tracker() {
+#define TIMETRACKER_SLICE_US        (1000000L / SERVER_TIMESLICES_SEC)
+
+time_tracker::time_tracker() :
+    lifetime_global(),
+    deferred_startup() {
+
     time_mutex.set_name("time_tracker");
-    removed_id_mutex.set_name("time_tracker_removed_id");
+    deferred_mutex.set_name("time_tracker_deferred");
 
     next_timer_id = 1;
 
-    timer_sort_required = true;
-
     struct timeval cur_tm;
     gettimeofday(&cur_tm, NULL);
 
@@ -42,6 +46,20 @@ time_tracker::time_tracker() {
     Globalreg::globalreg->last_tv_sec = cur_tm.tv_sec;
     Globalreg::globalreg->last_tv_usec = cur_tm.tv_usec;
 
+    wheel_epoch_us = (uint64_t) cur_tm.tv_sec * 1000000L + cur_tm.tv_usec;
+    wheel_tick = 0;
+    deferred_tick = 0;
+
+    timer_entry_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.timetracker.timer",
+                tracker_element_factory<tracked_timer>(),
+                "Timer");
+
+    timer_vec_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.timetracker.timers",
+                tracker_element_factory<tracker_element_vector>(),
+                "Timers");
+
     shutdown = false;
 
     // Allocate workers and fill them with joinable threads
@@ -82,10 +100,110 @@ time_tracker::~time_tracker() {
     Globalreg::globalreg->timetracker = NULL;
 }
 
+void time_tracker::trigger_deferred_startup() {
+    auto httpd = Globalreg::fetch_mandatory_global_as<kis_net_beast_httpd>();
+
+    httpd->register_route("/timetracker/timers", {"GET", "POST"}, httpd->RO_ROLE, {},
+            std::make_shared<kis_net_web_tracked_endpoint>(
+                [this](std::shared_ptr<kis_net_beast_httpd_connection>) -> std::shared_ptr<tracker_element> {
+                    return timer_summary();
+                }));
+}
+
+uint64_t time_tracker::tick_of(const struct timeval& tv) const {
+    uint64_t us = (uint64_t) tv.tv_sec * 1000000L + tv.tv_usec;
+
+    if (us <= wheel_epoch_us)
+        return 0;
+
+    return (us - wheel_epoch_us + TIMETRACKER_SLICE_US - 1) / TIMETRACKER_SLICE_US;
+}
+
+void time_tracker::wheel_insert(std::shared_ptr<timer_event> evt, bool cascade) {
+    auto expires = tick_of(evt->trigger_tm);
+
+    // Anything already due runs on the next tick; timers cascading down while the 
+    // wheel turns may still land on the current tick, whose slot hasn't run yet
+    auto earliest = cascade ? wheel_tick : wheel_tick + 1;
+
+    if (expires < earliest)
+        expires = earliest;
+
+    evt->wheel_expires = expires;
+
+    auto delta = expires - wheel_tick;
+
+    // Timers past the end of the wheel are parked as far out as it goes, and 
+    // re-inserted when they cascade down
+    const uint64_t max_delta = (1ULL << (TIMETRACKER_WHEEL_BITS * TIMETRACKER_WHEEL_LEVELS)) - 1;
+
+    if (delta > max_delta) {
+        delta = max_delta;
+        expires = wheel_tick + max_delta;
+    }
+
+    unsigned int level = 0;
+    while (level < TIMETRACKER_WHEEL_LEVELS - 1 && 
+            delta >= (1ULL << (TIMETRACKER_WHEEL_BITS * (level + 1))))
+        level++;
+
+    auto slot_n = (expires >> (TIMETRACKER_WHEEL_BITS * level)) & (TIMETRACKER_WHEEL_SLOTS - 1);
+    auto& slot = timer_wheel[level][slot_n];
+
+    evt->wheel_pos = slot.insert(slot.end(), evt);
+    evt->wheel_slot = &slot;
+    evt->wheel_linked = true;
+}
+
+void time_tracker::wheel_remove(const std::shared_ptr<timer_event>& evt) {
+    if (!evt->wheel_linked)
+        return;
+
+    evt->wheel_linked = false;
+    evt->wheel_slot->erase(evt->wheel_pos);
+    evt->wheel_slot = nullptr;
+}
+
+void time_tracker::wheel_advance(std::vector<std::shared_ptr<timer_event>>& expired) {
+    wheel_tick++;
+
+    // When a level wraps, the next slot of the level above is due to be spread out 
+    // over the levels below
+    for (unsigned int level = 1; level < TIMETRACKER_WHEEL_LEVELS; level++) {
+        if ((wheel_tick >> (TIMETRACKER_WHEEL_BITS * (level - 1))) & (TIMETRACKER_WHEEL_SLOTS - 1))
+            break;
+
+        auto slot_n = (wheel_tick >> (TIMETRACKER_WHEEL_BITS * level)) & (TIMETRACKER_WHEEL_SLOTS - 1);
+
+        wheel_slot_t cascade;
+        cascade.swap(timer_wheel[level][slot_n]);
+
+        for (const auto& evt : cascade) {
+            evt->wheel_linked = false;
+            wheel_insert(evt, true);
+        }
+    }
+
+    wheel_slot_t due;
+    due.swap(timer_wheel[0][wheel_tick & (TIMETRACKER_WHEEL_SLOTS - 1)]);
+
+    for (const auto& evt : due) {
+        evt->wheel_linked = false;
+        evt->wheel_slot = nullptr;
+
+        if (evt->wheel_expires > wheel_tick) {
+            wheel_insert(evt);
+            continue;
+        }
+
+        expired.push_back(evt);
+    }
+}
+
 void time_tracker::time_dispatcher() {
-    while (!shutdown && !Globalreg::globalreg->spindown && !Globalreg::globalreg->fatal_condition) {
-        kis_unique_lock<kis_mutex> lock(time_mutex, std::defer_lock, "time_tracker time_dispatcher");
+    std::vector<std::shared_ptr<timer_event>> action_timers;
 
+    while (!shutdown && !Globalreg::globalreg->spindown && !Globalreg::globalreg->fatal_condition) {
         // Calculate the next tick
         auto start = std::chrono::system_clock::now();
         auto end = start + std::chrono::milliseconds(1000 / SERVER_TIMESLICES_SEC);
@@ -97,32 +215,26 @@ void time_tracker::time_dispatcher() {
         Globalreg::globalreg->last_tv_sec = cur_tm.tv_sec;
         Globalreg::globalreg->last_tv_usec = cur_tm.tv_usec;
 
-        // Sort and duplicate the vector to a safe list; we have to re-sort 
-        // timers from recurring events
-        lock.lock();
+        uint64_t cur_us = (uint64_t) cur_tm.tv_sec * 1000000L + cur_tm.tv_usec;
+        uint64_t cur_tick = cur_us > wheel_epoch_us ? 
+            (cur_us - wheel_epoch_us) / TIMETRACKER_SLICE_US : 0;
 
-        if (timer_sort_required)
-            sort(sorted_timers.begin(), sorted_timers.end(), sort_timer_events_trigger());
+        // Turn the wheel up to now; if the clock went backwards we wait for it to
+        // catch up to the ticks we've already run
+        action_timers.clear();
 
-        timer_sort_required = false;
+        {
+            kis_lock_guard<kis_mutex> lk(time_mutex, "time_tracker time_dispatcher");
 
-        // Sort the timers
-        auto action_timers = std::vector<std::shared_ptr<timer_event>>(sorted_timers.begin(), sorted_timers.end());
-        lock.unlock();
+            while (wheel_tick < cur_tick)
+                wheel_advance(action_timers);
+        }
 
-        for (auto evt : action_timers) {
-            // If we're pending cancellation, throw us out
-            if (evt->timer_cancelled) {
-                kis_lock_guard<kis_mutex> rl(removed_id_mutex);
-                removed_timer_ids.push_back(evt->timer_id);
-                continue;
-            }
+        dispatch_deferred(cur_tick);
 
-            // We're into the future, bail
-            if ((cur_tm.tv_sec < evt->trigger_tm.tv_sec) ||
-                    ((cur_tm.tv_sec == evt->trigger_tm.tv_sec) && (cur_tm.tv_usec < evt->trigger_tm.tv_usec))) {
-                break;
-            }
+        for (const auto& evt : action_timers) {
+            if (evt->timer_cancelled)
+                continue;
 
             // Find a usable worker slot; this is a fast-burn while loop for now
             // to see how it performs, if we need to add a sleep we will
@@ -143,39 +255,7 @@ void time_tracker::time_dispatcher() {
 
                         time_workers[t] = std::thread([evt, this]() {
                             thread_set_process_name("TIME_EVT");
-
-                            // Call the function with the given parameters
-                            int ret = 0;
-                            if (evt->callback != NULL) {
-                                ret = (*evt->callback)(evt.get(), evt->callback_parm, Globalreg::globalreg);
-                            } else if (evt->event != NULL) {
-                                ret = evt->event->timetracker_event(evt->timer_id);
-                            } else if (evt->event_func != NULL) {
-                                ret = evt->event_func(evt->timer_id);
-                            }
-
-                            if (ret > 0 && evt->timeslices != -1 && evt->recurring) {
-                                kis_lock_guard<kis_mutex> tl(time_mutex, "event rescheduler");
-
-                                struct timeval cur_tm;
-                                gettimeofday(&cur_tm, NULL);
-
-                                evt->schedule_tm.tv_sec = cur_tm.tv_sec;
-                                evt->schedule_tm.tv_usec = cur_tm.tv_usec;
-                                evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (evt->timeslices / SERVER_TIMESLICES_SEC);
-                                evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + 
-                                    ((evt->timeslices % SERVER_TIMESLICES_SEC) * (1000000L / SERVER_TIMESLICES_SEC));
-
-                                if (evt->trigger_tm.tv_usec >= 999999L) {
-                                    evt->trigger_tm.tv_sec++;
-                                    evt->trigger_tm.tv_usec %= 1000000L;
-                                }
-
-                                timer_sort_required = true;
-                            } else {
-                                kis_lock_guard<kis_mutex> rl(removed_id_mutex);
-                                removed_timer_ids.push_back(evt->timer_id);
-                            }
+                            run_timer(evt);
                         });
 
                         launched = true;
@@ -185,40 +265,160 @@ void time_tracker::time_dispatcher() {
             }
         }
 
-        {
-            // Actually remove the timers under dual lock
-            std::lock(time_mutex, removed_id_mutex);
-            kis_lock_guard<kis_mutex> l(time_mutex, std::adopt_lock);
-            kis_lock_guard<kis_mutex> rl(removed_id_mutex, std::adopt_lock);
-
-            for (auto x : removed_timer_ids) {
-                auto itr = timer_map.find(x);
-
-                if (itr != timer_map.end()) {
-                    for (auto sorted_itr = sorted_timers.begin(); sorted_itr != sorted_timers.end(); ++sorted_itr) {
-                        if ((*sorted_itr)->timer_id == x) {
-                            sorted_timers.erase(sorted_itr);
-                            break;
-                        }
-                    }
+        std::this_thread::sleep_until(end);
+    }
+}
 
-                    timer_map.erase(itr);
-                }
+void time_tracker::run_timer(std::shared_ptr<timer_event> evt) {
+    auto run_start = std::chrono::steady_clock::now();
+
+    // Call the function with the given parameters
+    int ret = 0;
+    if (evt->callback != NULL) {
+        ret = (*evt->callback)(evt.get(), evt->callback_parm, Globalreg::globalreg);
+    } else if (evt->event != NULL) {
+        ret = evt->event->timetracker_event(evt->timer_id);
+    } else if (evt->event_func != NULL) {
+        ret = evt->event_func(evt->timer_id);
+    }
+
+    double run_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - run_start).count();
+
+    std::string overrun;
+
+    {
+        kis_lock_guard<kis_mutex> tl(time_mutex, "event rescheduler");
+
+        evt->runs++;
+        evt->last_ms = run_ms;
+        evt->total_ms += run_ms;
+
+        // Report runs which hold a worker past the end of their slice, but only when a
+        // timer sets a new worst case so that consistently slow timers don't flood the log
+        if (run_ms > 1000.0 / SERVER_TIMESLICES_SEC) {
+            evt->overruns++;
+
+            if (run_ms > evt->max_ms)
+                overrun = fmt::format("Timer {} overran its timeslice, running for {:.1f}ms "
+                        "({} overruns, {:.1f}ms average)", evt->timer_id, run_ms, 
+                        evt->overruns, evt->total_ms / evt->runs);
+        }
+
+        if (run_ms > evt->max_ms)
+            evt->max_ms = run_ms;
+
+        if (ret > 0 && evt->timeslices != -1 && evt->recurring && !evt->timer_cancelled) {
+            struct timeval cur_tm;
+            gettimeofday(&cur_tm, NULL);
+
+            evt->schedule_tm.tv_sec = cur_tm.tv_sec;
+            evt->schedule_tm.tv_usec = cur_tm.tv_usec;
+            evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (evt->timeslices / SERVER_TIMESLICES_SEC);
+            evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + 
+                ((evt->timeslices % SERVER_TIMESLICES_SEC) * (1000000L / SERVER_TIMESLICES_SEC));
+
+            if (evt->trigger_tm.tv_usec >= 999999L) {
+                evt->trigger_tm.tv_sec++;
+                evt->trigger_tm.tv_usec %= 1000000L;
             }
 
-            removed_timer_ids.clear();
+            wheel_insert(evt);
+        } else {
+            auto itr = timer_map.find(evt->timer_id);
+
+            if (itr != timer_map.end() && itr->second == evt)
+                timer_map.erase(itr);
         }
+    }
+
+    if (overrun.length() != 0)
+        _MSG_INFO("{}", overrun);
+}
+
+int time_tracker::defer_task(const slice& in_delay, std::function<void ()> in_task) {
+    struct timeval cur_tm;
+    gettimeofday(&cur_tm, NULL);
+
+    uint64_t cur_us = (uint64_t) cur_tm.tv_sec * 1000000L + cur_tm.tv_usec;
+    uint64_t due_us = cur_us + (uint64_t) std::max(in_delay.count(), 0) * TIMETRACKER_SLICE_US;
+    uint64_t due = due_us > wheel_epoch_us ?
+        (due_us - wheel_epoch_us + TIMETRACKER_SLICE_US - 1) / TIMETRACKER_SLICE_US : 0;
+
+    auto task_id = next_timer_id++;
 
-        /*
-        if (std::chrono::system_clock::now() >= end) {
-            fmt::print("debug - timetracker missed time slot by {} ms\n",
-                    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - end).count());
+    kis_lock_guard<kis_mutex> lk(deferred_mutex, "time_tracker defer_task");
+
+    // Anything already due goes out with the next batch
+    if (due <= deferred_tick)
+        due = deferred_tick + 1;
+
+    deferred_buckets[due].push_back(deferred_task{task_id, std::move(in_task)});
+    deferred_index[task_id] = due;
+
+    return task_id;
+}
+
+void time_tracker::dispatch_deferred(uint64_t in_tick) {
+    std::vector<deferred_task> batch;
+
+    {
+        kis_lock_guard<kis_mutex> lk(deferred_mutex, "time_tracker dispatch_deferred");
+
+        while (deferred_tick < in_tick) {
+            deferred_tick++;
+
+            auto b = deferred_buckets.find(deferred_tick);
+
+            if (b == deferred_buckets.end())
+                continue;
+
+            for (auto& t : b->second) {
+                deferred_index.erase(t.task_id);
+                batch.push_back(std::move(t));
+            }
+
+            deferred_buckets.erase(b);
         }
-        */
+    }
 
+    if (batch.size() == 0)
+        return;
 
-        std::this_thread::sleep_until(end);
+    boost::asio::post(Globalreg::globalreg->io,
+            [batch = std::move(batch)]() {
+                for (const auto& t : batch) {
+                    try {
+                        t.task();
+                    } catch (const std::exception& e) {
+                        _MSG_ERROR("Deferred task {} failed: {}", t.task_id, e.what());
+                    }
+                }
+            });
+}
+
+std::shared_ptr<tracker_element_vector> time_tracker::timer_summary() {
+    auto ret = std::make_shared<tracker_element_vector>(timer_vec_id);
+
+    kis_lock_guard<kis_mutex> lk(time_mutex, "time_tracker timer_summary");
+
+    for (const auto& i : timer_map) {
+        const auto& evt = i.second;
+
+        auto t = std::make_shared<tracked_timer>(timer_entry_id);
+
+        t->set_timer_id(evt->timer_id);
+        t->set_timeslices(evt->timeslices);
+        t->set_recurring(evt->recurring);
+        t->set_runs(evt->runs);
+        t->set_overruns(evt->overruns);
+        t->set_last_ms(evt->last_ms);
+        t->set_avg_ms(evt->runs == 0 ? 0 : evt->total_ms / evt->runs);
+        t->set_max_ms(evt->max_ms);
+
+        ret->push_back(t);
     }
+
+    return ret;
 }
 
 int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
@@ -231,6 +431,9 @@ int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
 
     evt->total_ms = 0;
     evt->last_ms = 0;
+    evt->max_ms = 0;
+    evt->runs = 0;
+    evt->overruns = 0;
 
     evt->timer_id = next_timer_id++;
     gettimeofday(&(evt->schedule_tm), NULL);
@@ -251,10 +454,7 @@ int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
     evt->event = NULL;
 
     timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    timer_sort_required = true;
+    wheel_insert(evt);
 
     return evt->timer_id;
 }
@@ -267,6 +467,9 @@ int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
 
     evt->total_ms = 0;
     evt->last_ms = 0;
+    evt->max_ms = 0;
+    evt->runs = 0;
+    evt->overruns = 0;
 
     evt->timer_cancelled = false;
     evt->timer_id = next_timer_id++;
@@ -298,10 +501,7 @@ int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
     evt->event = in_event;
 
     timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    timer_sort_required = true;
+    wheel_insert(evt);
 
     return evt->timer_id;
 }
@@ -314,6 +514,9 @@ int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
 
     evt->total_ms = 0;
     evt->last_ms = 0;
+    evt->max_ms = 0;
+    evt->runs = 0;
+    evt->overruns = 0;
 
     evt->timer_cancelled = false;
     evt->timer_id = next_timer_id++;
@@ -346,10 +549,7 @@ int time_tracker::register_timer(int in_timeslices, struct timeval *in_trigger,
     evt->event_func = in_event;
 
     timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    timer_sort_required = true;
+    wheel_insert(evt);
 
     return evt->timer_id;
 }
@@ -364,6 +564,9 @@ int time_tracker::register_timer(const slice& in_timeslices,
 
     evt->total_ms = 0;
     evt->last_ms = 0;
+    evt->max_ms = 0;
+    evt->runs = 0;
+    evt->overruns = 0;
 
     evt->timer_id = next_timer_id++;
     gettimeofday(&(evt->schedule_tm), NULL);
@@ -383,10 +586,7 @@ int time_tracker::register_timer(const slice& in_timeslices,
     evt->event = NULL;
 
     timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    timer_sort_required = true;
+    wheel_insert(evt);
 
     return evt->timer_id;
 }
@@ -399,6 +599,9 @@ int time_tracker::register_timer(const slice& in_timeslices,
 
     evt->total_ms = 0;
     evt->last_ms = 0;
+    evt->max_ms = 0;
+    evt->runs = 0;
+    evt->overruns = 0;
 
     evt->timer_cancelled = false;
     evt->timer_id = next_timer_id++;
@@ -425,30 +628,49 @@ int time_tracker::register_timer(const slice& in_timeslices,
     evt->event_func = in_event;
 
     timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    timer_sort_required = true;
+    wheel_insert(evt);
 
     return evt->timer_id;
 }
 
 int time_tracker::remove_timer(int in_timerid) {
-    // Removing a timer sets the atomic cancelled and puts us on the abort list;
-    // we'll get cleaned out of the main list the next iteration through the main code.
+    // Removing a timer unlinks it from the wheel; if it's running right now the
+    // cancelled flag keeps it from being rescheduled when it finishes.
     
+    {
+        kis_lock_guard<kis_mutex> dl(deferred_mutex, "time_tracker remove_timer");
+
+        auto d = deferred_index.find(in_timerid);
+
+        if (d != deferred_index.end()) {
+            auto& bucket = deferred_buckets[d->second];
+
+            for (auto t = bucket.begin(); t != bucket.end(); ++t) {
+                if (t->task_id == in_timerid) {
+                    bucket.erase(t);
+                    break;
+                }
+            }
+
+            if (bucket.size() == 0)
+                deferred_buckets.erase(d->second);
+
+            deferred_index.erase(d);
+
+            return 1;
+        }
+    }
+
     kis_lock_guard<kis_mutex> lk(time_mutex);
 
     auto itr = timer_map.find(in_timerid);
 
-    if (itr != timer_map.end()) {
-        itr->second->timer_cancelled = true;
-
-        kis_lock_guard<kis_mutex> lk(removed_id_mutex);
-        removed_timer_ids.push_back(in_timerid);
-    } else {
+    if (itr == timer_map.end())
         return 0;
-    }
+
+    itr->second->timer_cancelled = true;
+    wheel_remove(itr->second);
+    timer_map.erase(itr);
 
     return 1;
 }
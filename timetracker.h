@@ -22,18 +22,21 @@
 #include "config.h"
 
 #include <algorithm>
+#include <array>
 #include <chrono>
 #include <list>
 #include <map>
 #include <stdio.h>
 #include <string>
 #include <time.h>
+#include <unordered_map>
 #include <vector>
 
 #include <functional>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
+#include "trackedcomponent.h"
 
 // For ubertooth and a few older plugins that compile against both svn and old
 #define KIS_NEW_TIMER_PARM	1
@@ -41,9 +44,86 @@
 #define TIMEEVENT_PARMS time_tracker::timer_event *evt __attribute__ ((unused)), \
     void *auxptr __attribute__ ((unused)), global_registry *globalreg __attribute__ ((unused))
 
+// Timers are held in a hierarchical timing wheel of TIMETRACKER_WHEEL_LEVELS levels of
+// 2^TIMETRACKER_WHEEL_BITS slots; level 0 slots are one timeslice wide, and each level
+// above covers the whole span of the level below per slot.  Inserting and cancelling
+// a timer is constant time, and each tick only touches the timers in the expiring slot
+// (and the timers cascading down from a higher level when a level wraps).  Timers
+// further out than the top level (about 19 days) are parked in the last slot and
+// re-inserted as the wheel turns.
+#define TIMETRACKER_WHEEL_BITS      6
+#define TIMETRACKER_WHEEL_SLOTS     (1 << TIMETRACKER_WHEEL_BITS)
+#define TIMETRACKER_WHEEL_LEVELS    4
+
 class time_tracker_event;
 
-class time_tracker : public lifetime_global {
+class tracked_timer : public tracker_component {
+public:
+    tracked_timer() :
+        tracker_component() {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_timer(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    tracked_timer(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("tracked_timer");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    __Proxy(timer_id, int32_t, int32_t, int32_t, timer_id);
+    __Proxy(timeslices, int32_t, int32_t, int32_t, timeslices);
+    __Proxy(recurring, uint8_t, bool, bool, recurring);
+    __Proxy(runs, uint64_t, uint64_t, uint64_t, runs);
+    __Proxy(overruns, uint64_t, uint64_t, uint64_t, overruns);
+    __Proxy(last_ms, double, double, double, last_ms);
+    __Proxy(avg_ms, double, double, double, avg_ms);
+    __Proxy(max_ms, double, double, double, max_ms);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.timetracker.timer.id", "Timer ID", &timer_id);
+        register_field("kismet.timetracker.timer.timeslices", 
+                "Timer interval in timeslices, or -1 for an explicit time", &timeslices);
+        register_field("kismet.timetracker.timer.recurring", "Timer is recurring", &recurring);
+        register_field("kismet.timetracker.timer.runs", "Number of times the timer ran", &runs);
+        register_field("kismet.timetracker.timer.overruns", 
+                "Number of runs longer than a timeslice", &overruns);
+        register_field("kismet.timetracker.timer.last_ms", "Last run time (ms)", &last_ms);
+        register_field("kismet.timetracker.timer.avg_ms", "Average run time (ms)", &avg_ms);
+        register_field("kismet.timetracker.timer.max_ms", "Maximum run time (ms)", &max_ms);
+    }
+
+    std::shared_ptr<tracker_element_int32> timer_id;
+    std::shared_ptr<tracker_element_int32> timeslices;
+    std::shared_ptr<tracker_element_uint8> recurring;
+    std::shared_ptr<tracker_element_uint64> runs;
+    std::shared_ptr<tracker_element_uint64> overruns;
+    std::shared_ptr<tracker_element_double> last_ms;
+    std::shared_ptr<tracker_element_double> avg_ms;
+    std::shared_ptr<tracker_element_double> max_ms;
+};
+
+class time_tracker : public lifetime_global, public deferred_startup {
 public:
     using slice = std::chrono::duration<int, std::ratio<1, 10>>;
 
@@ -53,9 +133,12 @@ public:
         // Event name
         std::string name;
 
-        // Time running in ms
+        // Time running in ms, updated under the timetracker lock
         double total_ms;
         double last_ms;
+        double max_ms;
+        uint64_t runs;
+        uint64_t overruns;
 
         // Is the timer cancelled?
         std::atomic<bool> timer_cancelled;
@@ -79,20 +162,12 @@ public:
         // C function, if we weren't
         int (*callback)(timer_event *, void *, global_registry *);
         void *callback_parm;
-    };
 
-    // Sort alerts by alert trigger time
-    class sort_timer_events_trigger {
-    public:
-        inline bool operator() (std::shared_ptr<time_tracker::timer_event> x, 
-								std::shared_ptr<time_tracker::timer_event> y) const {
-            if ((x->trigger_tm.tv_sec < y->trigger_tm.tv_sec) ||
-                ((x->trigger_tm.tv_sec == y->trigger_tm.tv_sec) && 
-				 (x->trigger_tm.tv_usec < y->trigger_tm.tv_usec)))
-                return 1;
-
-            return 0;
-        }
+        // Position in the timing wheel, if the timer is waiting to run
+        bool wheel_linked = false;
+        uint64_t wheel_expires = 0;
+        std::list<std::shared_ptr<timer_event>> *wheel_slot = nullptr;
+        std::list<std::shared_ptr<timer_event>>::iterator wheel_pos;
     };
 
     static std::string global_name() { return "TIMETRACKER"; }
@@ -101,6 +176,7 @@ public:
         std::shared_ptr<time_tracker> mon(new time_tracker());
         Globalreg::globalreg->timetracker = mon.get();
         Globalreg::globalreg->register_lifetime_global(mon);
+        Globalreg::globalreg->register_deferred_global(mon);
         Globalreg::globalreg->insert_global(global_name(), mon);
         return mon;
     }
@@ -111,6 +187,8 @@ private:
 public:
     virtual ~time_tracker();
 
+    void trigger_deferred_startup() override;
+
     // Register an optionally recurring timer.  
     int register_timer(int in_timeslices, struct timeval *in_trigger,
                       int in_recurring, 
@@ -131,29 +209,69 @@ public:
     int register_timer(const slice& in_timeslices,
             int in_recurring, std::function<int (int)> event);
 
-    // Remove a timer that's going to execute
+    // Run a one-shot task after a delay.  Deferred tasks don't allocate a timer 
+    // event or take the timer lock; all the tasks due in the same timeslice are 
+    // run as one batch on the IO pool.  The returned ID shares the timer ID space, 
+    // so a pending task can be cancelled with remove_timer.
+    int defer_task(const slice& in_delay, std::function<void ()> in_task);
+
+    // Remove a timer that's going to execute, or cancel a deferred task
     int remove_timer(int timer_id);
 
     void spawn_timetracker_thread();
 
+    // Run time statistics of all registered timers
+    std::shared_ptr<tracker_element_vector> timer_summary();
+
 protected:
+    using wheel_slot_t = std::list<std::shared_ptr<timer_event>>;
+
     kis_mutex time_mutex;
 
     std::vector<std::thread> time_workers;
 
     void time_dispatcher(void);
 
-    // Do we have to re-sort the list of timers?
-    std::atomic<bool> timer_sort_required;
+    void run_timer(std::shared_ptr<timer_event> evt);
+
+    // Wheel tick a trigger time falls in, rounded up so timers never fire early
+    uint64_t tick_of(const struct timeval& tv) const;
+
+    // Link and unlink a timer in the wheel; must be called under time_mutex
+    void wheel_insert(std::shared_ptr<timer_event> evt, bool cascade = false);
+    void wheel_remove(const std::shared_ptr<timer_event>& evt);
+
+    // Move the wheel forward one tick, appending the expired timers; must be called
+    // under time_mutex
+    void wheel_advance(std::vector<std::shared_ptr<timer_event>>& expired);
 
     // Next timer ID to be assigned
     std::atomic<int> next_timer_id;
 
     std::map<int, std::shared_ptr<timer_event>> timer_map;
-    std::vector<std::shared_ptr<timer_event>> sorted_timers;
 
-    kis_mutex removed_id_mutex;
-    std::vector<int> removed_timer_ids;
+    // Wall clock time of tick 0 in usec, and the last tick processed
+    uint64_t wheel_epoch_us;
+    uint64_t wheel_tick;
+
+    std::array<std::array<wheel_slot_t, TIMETRACKER_WHEEL_SLOTS>, TIMETRACKER_WHEEL_LEVELS> timer_wheel;
+
+    int timer_entry_id, timer_vec_id;
+
+    // Deferred one-shot tasks, bucketed by the tick they're due in; the ID index
+    // is only used to cancel them
+    struct deferred_task {
+        int task_id;
+        std::function<void ()> task;
+    };
+
+    kis_mutex deferred_mutex;
+    uint64_t deferred_tick;
+    std::unordered_map<uint64_t, std::vector<deferred_task>> deferred_buckets;
+    std::unordered_map<int, uint64_t> deferred_index;
+
+    // Pull the batches of deferred tasks due up to the tick and post them to the IO pool
+    void dispatch_deferred(uint64_t in_tick);
 
     std::thread time_dispatch_t;
     std::atomic<bool> shutdown;
@@ -4,16 +4,74 @@
 # to generate the aircraft ICAO database.
 # 
 # Used during Kismet release tagging to generate the aircraft db
+#
+# With '--binary in.txt.gz out.bin' the sorted text db is instead compiled into the
+# binary table Kismet maps into memory for lookups:
+#
+#   header      "KISICAO1", uint32 record count
+#   records     uint32 icao, uint32 offset of the record strings; sorted by icao
+#   strings     aircraft type byte, then the NUL terminated registration, model type,
+#               model, and owner
+#
+# All integers are little endian.
 
 import csv
-import requests
-import urllib3
+import gzip
 import io
+import struct
 import zipfile
 
 import os
 import sys
 
+def compile_binary(infile, outfile):
+    records = []
+
+    opener = gzip.open if infile.endswith(".gz") else open
+
+    with opener(infile, 'rt', encoding='utf-8', errors='replace') as f:
+        for row in csv.reader(f, delimiter='\t', quotechar='"'):
+            if len(row) == 0 or row[0].startswith('#'):
+                continue
+
+            if len(row) != 6 or len(row[5]) == 0:
+                print("Invalid ICAO entry, skipping: {}".format(row), file=sys.stderr)
+                continue
+
+            try:
+                icao = int(row[0], 16)
+            except ValueError:
+                print("Invalid ICAO entry, skipping: {}".format(row), file=sys.stderr)
+                continue
+
+            strs = b"".join(x.strip().encode('utf-8') + b"\0" for x in row[1:5])
+            records.append((icao, row[5][0].encode('utf-8')[:1] + strs))
+
+    # Lookups binary search the table, the first record of an icao wins
+    records.sort(key=lambda r: r[0])
+
+    header = struct.pack("<8sI", b"KISICAO1", len(records))
+    offt = len(header) + 8 * len(records)
+
+    index = io.BytesIO()
+    strings = io.BytesIO()
+
+    for (icao, data) in records:
+        index.write(struct.pack("<II", icao, offt + strings.tell()))
+        strings.write(data)
+
+    with open(outfile, 'wb') as f:
+        f.write(header)
+        f.write(index.getvalue())
+        f.write(strings.getvalue())
+
+if len(sys.argv) == 4 and sys.argv[1] == "--binary":
+    compile_binary(sys.argv[2], sys.argv[3])
+    sys.exit(0)
+
+import requests
+import urllib3
+
 # Kluge up request lib because the canadian server later in the script has an invalid DH key
 requests.packages.urllib3.disable_warnings()
 requests.packages.urllib3.util.ssl_.DEFAULT_CIPHERS += ':HIGH:!DH:!aNULL'
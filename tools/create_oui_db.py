@@ -1,9 +1,67 @@
 #!/usr/bin/env python3
 
+# Fetches the IEEE OUI registry and prints the sorted manuf db.
+#
+# With '--binary in.txt.gz out.bin' the manuf db is instead compiled into the binary
+# table Kismet maps into memory for lookups:
+#
+#   header      "KISOUI01", uint32 record count
+#   records     uint32 oui, uint32 offset of the manufacturer name; sorted by oui
+#   strings     NUL terminated manufacturer names, each stored once
+#
+# All integers are little endian.
+
 from __future__ import print_function
+import gzip
+import io
 import os
 import sys
 import re
+import struct
+
+def compile_binary(infile, outfile):
+    records = {}
+
+    opener = gzip.open if infile.endswith(".gz") else open
+
+    with opener(infile, 'rt', encoding='utf-8', errors='replace') as f:
+        for l in f:
+            m = re.match("([0-9A-Fa-f]{2}):([0-9A-Fa-f]{2}):([0-9A-Fa-f]{2})\t(.+)", l.rstrip("\r\n"))
+
+            if m is None:
+                continue
+
+            oui = (int(m.group(1), 16) << 16) | (int(m.group(2), 16) << 8) | int(m.group(3), 16)
+
+            # Lookups binary search the table, the first record of an oui wins
+            if oui not in records:
+                records[oui] = m.group(4)
+
+    header = struct.pack("<8sI", b"KISOUI01", len(records))
+    offt = len(header) + 8 * len(records)
+
+    index = io.BytesIO()
+    strings = io.BytesIO()
+    interned = {}
+
+    for oui in sorted(records.keys()):
+        name = records[oui]
+
+        if name not in interned:
+            interned[name] = offt + strings.tell()
+            strings.write(name.encode('utf-8') + b"\0")
+
+        index.write(struct.pack("<II", oui, interned[name]))
+
+    with open(outfile, 'wb') as f:
+        f.write(header)
+        f.write(index.getvalue())
+        f.write(strings.getvalue())
+
+if len(sys.argv) == 4 and sys.argv[1] == "--binary":
+    compile_binary(sys.argv[2], sys.argv[3])
+    sys.exit(0)
+
 import requests
 
 manufs = []
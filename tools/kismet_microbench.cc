@@ -0,0 +1,569 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Microbenchmarks of the tracked element data model.
+ *
+ * Measures the primitives every record in Kismet is built from - constructing and
+ * cloning elements, path lookups, summarizing, map insert and find, and JSON
+ * serialization of each element type - and a complete construct, update, and
+ * serialize cycle of an 802.11 device, outside of the server.  Changes to the data
+ * model can be measured here without the noise of the packet pipeline.
+ *
+ * Each benchmark is calibrated to run for the requested time, then run for several
+ * rounds; the median time per operation is reported, with the allocations per
+ * operation from the counting allocator linked into the binary.
+ *
+ * Built and run with 'make microbench'; MICROBENCH_ARGS are passed to the binary.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "devicetracker_component.h"
+#include "entrytracker.h"
+#include "fmt.h"
+#include "globalregistry.h"
+#include "json_adapter.h"
+#include "packet.h"
+#include "phy_80211_components.h"
+#include "trackedelement.h"
+
+// Allocation counter from kis_alloc_counter.cc
+uint64_t kis_alloc_count() __attribute__((weak));
+
+namespace {
+
+// Keep the compiler from discarding the result of a benchmarked operation
+template<typename T>
+inline void keep(T const& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+struct bench_case {
+    std::string name;
+
+    // Run the operation n times
+    std::function<void (uint64_t)> run;
+};
+
+struct bench_result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+// Distinct MAC for each n, in the OUI of the benchmark access points
+mac_addr bench_mac(uint64_t n) {
+    uint8_t mac[6] = {0x00, 0x1A, 0x11,
+        (uint8_t) (n >> 16), (uint8_t) (n >> 8), (uint8_t) n};
+    return mac_addr(mac, 6);
+}
+
+bench_result run_case(const bench_case& c, unsigned int time_ms, unsigned int rounds) {
+    using clock = std::chrono::steady_clock;
+
+    auto time_run = [&](uint64_t n) {
+        auto start = clock::now();
+        c.run(n);
+        return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    };
+
+    // Grow the iterations until a run is long enough to time, then scale to the
+    // requested time per round
+    uint64_t n = 1;
+    double elapsed = time_run(n);
+
+    while (elapsed < 10e6 && n < (1ULL << 40)) {
+        n *= elapsed < 1e6 ? 10 : 2;
+        elapsed = time_run(n);
+    }
+
+    n = std::max((uint64_t) 1, (uint64_t) (n * (time_ms * 1e6) / elapsed));
+
+    std::vector<double> per_op;
+    uint64_t start_allocs = kis_alloc_count != nullptr ? kis_alloc_count() : 0;
+
+    for (unsigned int r = 0; r < rounds; r++)
+        per_op.push_back(time_run(n) / n);
+
+    uint64_t allocs = kis_alloc_count != nullptr ? kis_alloc_count() - start_allocs : 0;
+
+    std::sort(per_op.begin(), per_op.end());
+
+    return bench_result{c.name, n, per_op[per_op.size() / 2],
+        (double) allocs / ((double) n * rounds)};
+}
+
+void print_help(char *argv) {
+    printf("Kismet tracked element microbenchmarks\n");
+    printf("usage: %s [OPTION]\n", argv);
+    printf(" -f, --filter <text>          Run only the benchmarks whose names contain the text;\n"
+           "                              may be given more than once\n"
+           " -t, --time <ms>              Time of each round of a benchmark (default 200)\n"
+           " -r, --rounds <n>             Rounds of each benchmark; the median is reported\n"
+           "                              (default 5)\n"
+           " -l, --list                   List the benchmarks and exit\n"
+           "     --json                   Print the results as JSON\n");
+}
+
+}
+
+int main(int argc, char *argv[]) {
+#define OPT_JSON            10
+    static struct option longopt[] = {
+        { "filter", required_argument, 0, 'f' },
+        { "time", required_argument, 0, 't' },
+        { "rounds", required_argument, 0, 'r' },
+        { "list", no_argument, 0, 'l' },
+        { "json", no_argument, 0, OPT_JSON },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int option_idx = 0;
+    optind = 0;
+    opterr = 0;
+
+    std::vector<std::string> filters;
+    unsigned int time_ms = 200;
+    unsigned int rounds = 5;
+    bool list = false;
+    bool json_out = false;
+
+    auto parse_uint = [](const char *arg, const char *what) -> unsigned int {
+        unsigned int v;
+
+        if (sscanf(arg, "%u", &v) != 1 || v == 0) {
+            fmt::print(stderr, "ERROR:  Expected a number for {}\n", what);
+            exit(1);
+        }
+
+        return v;
+    };
+
+    while (1) {
+        int r = getopt_long(argc, argv, "-hf:t:r:l", longopt, &option_idx);
+        if (r < 0) break;
+
+        if (r == 'h') {
+            print_help(argv[0]);
+            exit(0);
+        } else if (r == 'f') {
+            filters.push_back(optarg);
+        } else if (r == 't') {
+            time_ms = parse_uint(optarg, "--time");
+        } else if (r == 'r') {
+            rounds = parse_uint(optarg, "--rounds");
+        } else if (r == 'l') {
+            list = true;
+        } else if (r == OPT_JSON) {
+            json_out = true;
+        } else {
+            print_help(argv[0]);
+            exit(1);
+        }
+    }
+
+    // The data model only needs the registry and the entry tracker
+    Globalreg::globalreg = new global_registry;
+    auto entrytracker = entry_tracker::create_entrytracker();
+
+    auto uint8_id = entrytracker->register_field("microbench.uint8",
+            tracker_element_factory<tracker_element_uint8>(), "uint8");
+    auto uint64_id = entrytracker->register_field("microbench.uint64",
+            tracker_element_factory<tracker_element_uint64>(), "uint64");
+    auto double_id = entrytracker->register_field("microbench.double",
+            tracker_element_factory<tracker_element_double>(), "double");
+    auto string_id = entrytracker->register_field("microbench.string",
+            tracker_element_factory<tracker_element_string>(), "string");
+    auto mac_id = entrytracker->register_field("microbench.mac",
+            tracker_element_factory<tracker_element_mac_addr>(), "mac");
+    auto uuid_id = entrytracker->register_field("microbench.uuid",
+            tracker_element_factory<tracker_element_uuid>(), "uuid");
+    auto key_id = entrytracker->register_field("microbench.key",
+            tracker_element_factory<tracker_element_device_key>(), "device key");
+    auto vector_double_id = entrytracker->register_field("microbench.vector_double",
+            tracker_element_factory<tracker_element_vector_double>(), "vector of doubles");
+    auto map_id = entrytracker->register_field("microbench.map",
+            tracker_element_factory<tracker_element_map>(), "map");
+    auto mac_map_id = entrytracker->register_field("microbench.mac_map",
+            tracker_element_factory<tracker_element_mac_map>(), "mac map");
+
+    // Children of the maps, each with its own field
+    std::vector<std::shared_ptr<tracker_element_uint64>> map_children;
+
+    for (unsigned int i = 0; i < 32; i++) {
+        auto id = entrytracker->register_field(fmt::format("microbench.map.field{}", i),
+                tracker_element_factory<tracker_element_uint64>(), "map field");
+        auto c = std::make_shared<tracker_element_uint64>(id);
+        c->set(i);
+        map_children.push_back(c);
+    }
+
+    auto device_base_id = entrytracker->register_field("kismet.device.base",
+            tracker_element_factory<kis_tracked_device_base>(), "core device record");
+    auto dot11_device_id = entrytracker->register_field("dot11.device",
+            tracker_element_factory<dot11_tracked_device>(), "IEEE802.11 device");
+
+    auto device_builder = std::make_shared<kis_tracked_device_base>(device_base_id);
+    auto dot11_builder = std::make_shared<dot11_tracked_device>(dot11_device_id);
+
+    // Shared strings, as the device tracker caches them
+    auto phyname = std::make_shared<tracker_element_string>("IEEE802.11");
+    auto devtype_ap = std::make_shared<tracker_element_string>("Wi-Fi AP");
+
+    // Builds a device the way the 802.11 phy does for a new access point
+    auto make_device = [&](uint64_t n) {
+        auto dev = std::static_pointer_cast<kis_tracked_device_base>(device_builder->clone_type());
+        auto dot11 = std::static_pointer_cast<dot11_tracked_device>(dot11_builder->clone_type());
+
+        auto mac = bench_mac(n);
+
+        dev->set_key(device_key(1, mac));
+        dev->set_macaddr(mac);
+        dev->set_tracker_phyname(phyname);
+        dev->set_devicename(mac.mac_to_string());
+        dev->set_tracker_type_string(devtype_ap);
+        dev->set_first_time(1700000000);
+
+        dot11_tracked_device::attach_base_parent(dot11, dev);
+
+        return std::make_pair(dev, dot11);
+    };
+
+    kis_layer1_packinfo l1info;
+    l1info.signal_type = kis_l1_signal_type_dbm;
+    l1info.signal_dbm = -60;
+    l1info.freq_khz = 2437000;
+
+    uint64_t update_ts = 1700000000;
+
+    // Updates a device the way the 802.11 phy does for a beacon
+    auto update_device = [&](std::shared_ptr<kis_tracked_device_base> dev,
+            std::shared_ptr<dot11_tracked_device> dot11) {
+        auto ts = update_ts++ / 10;
+
+        dev->set_last_time(ts);
+        dev->inc_packets();
+        dev->inc_datasize(300);
+        dev->get_packets_rrd()->add_sample(1, ts);
+        dev->get_signal_data()->append_signal(l1info, true, ts);
+        dev->inc_frequency_count(l1info.freq_khz);
+
+        dot11->set_last_bssid(dev->get_macaddr());
+
+        auto ssid_map = dot11->get_advertised_ssid_map();
+        auto ssid_itr = ssid_map->find(0x5151);
+
+        if (ssid_itr == ssid_map->end()) {
+            auto ssid = dot11->new_advertised_ssid();
+            ssid_map->insert(0x5151, ssid);
+
+            ssid->set_ssid("microbench");
+            ssid->set_ssid_len(10);
+            ssid->set_crypt_set(0x80);
+            ssid->set_first_time(ts);
+            ssid->set_last_time(ts);
+
+            dot11->set_num_advertised_ssids(ssid_map->size());
+        } else {
+            std::static_pointer_cast<dot11_advertised_ssid>(ssid_itr->second)->set_last_time(ts);
+        }
+    };
+
+    // A device with its dynamic fields filled in, for the lookup and serialization
+    // benchmarks
+    auto device = make_device(0);
+    update_device(device.first, device.second);
+
+    const std::string signal_path = "kismet.device.base.signal/kismet.common.signal.last_signal";
+    std::vector<int> signal_resolved_path{
+        entrytracker->get_field_id("kismet.device.base.signal"),
+        entrytracker->get_field_id("kismet.common.signal.last_signal")};
+
+    // Fields of a typical device list view
+    std::vector<SharedElementSummary> summary{
+        std::make_shared<tracker_element_summary>("kismet.device.base.macaddr"),
+        std::make_shared<tracker_element_summary>("kismet.device.base.name"),
+        std::make_shared<tracker_element_summary>("kismet.device.base.type"),
+        std::make_shared<tracker_element_summary>("kismet.device.base.last_time"),
+        std::make_shared<tracker_element_summary>("kismet.device.base.packets.total"),
+        std::make_shared<tracker_element_summary>(signal_path, "last_signal"),
+        std::make_shared<tracker_element_summary>("dot11.device/dot11.device.last_bssid",
+                "last_bssid"),
+    };
+
+    // One element of each type for the serialization benchmarks
+    auto e_uint8 = std::make_shared<tracker_element_uint8>(uint8_id, 42);
+    auto e_uint64 = std::make_shared<tracker_element_uint64>(uint64_id, 1234567890123ULL);
+    auto e_double = std::make_shared<tracker_element_double>(double_id, 2437.123456);
+    auto e_string = std::make_shared<tracker_element_string>(string_id,
+            "a typical \"ssid\" string");
+    auto e_mac = std::make_shared<tracker_element_mac_addr>(mac_id, mac_addr("00:1A:11:22:33:44"));
+    auto e_uuid = std::make_shared<tracker_element_uuid>(uuid_id,
+            uuid("5FE308BD-0000-0000-0000-00C0CA123456"));
+    auto e_key = std::make_shared<tracker_element_device_key>(key_id);
+    e_key->set(device_key(1, mac_addr("00:1A:11:22:33:44")));
+
+    auto e_vector_double = std::make_shared<tracker_element_vector_double>(vector_double_id);
+    for (unsigned int i = 0; i < 16; i++)
+        e_vector_double->push_back(i * 1.5);
+
+    auto e_map = std::make_shared<tracker_element_map>(map_id);
+    for (unsigned int i = 0; i < 8; i++)
+        e_map->insert(map_children[i]);
+
+    auto e_mac_map = std::make_shared<tracker_element_mac_map>(mac_map_id);
+    for (unsigned int i = 0; i < 1024; i++)
+        e_mac_map->insert(bench_mac(i), map_children[i % 32]);
+
+    robin_hood::unordered_flat_map<device_key, uint64_t> key_map;
+    for (unsigned int i = 0; i < 65536; i++)
+        key_map[device_key(1, bench_mac(i))] = i;
+
+    std::ostringstream stream;
+
+    // SSID and probe sized strings; plain text, and binary-ish with escapes scattered
+    // through it
+    const std::string ascii_str("Kismet Guest Network 5GHz - Building 12 Floor 3");
+    std::string binary_str(ascii_str);
+    for (size_t i = 0; i < binary_str.length(); i += 7)
+        binary_str[i] = (char) (i * 37);
+
+    // Serialize into a reused stream, like a response buffer
+    auto pack_case = [&](const std::string& name, shared_tracker_element e) {
+        return bench_case{name, [&stream, e](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                stream.str("");
+                json_adapter::pack(stream, e);
+            }
+
+            keep(stream.tellp());
+        }};
+    };
+
+    std::vector<bench_case> cases{
+        {"element/construct/uint64", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(std::make_shared<tracker_element_uint64>(uint64_id, i));
+        }},
+        {"element/clone_type/uint64", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(e_uint64->clone_type());
+        }},
+        {"element/clone_type/string", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(e_string->clone_type());
+        }},
+        {"element/clone_type/map", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(e_map->clone_type());
+        }},
+        {"element/clone_type/signal_data", [&](uint64_t n) {
+            auto signal = device.first->get_signal_data();
+
+            for (uint64_t i = 0; i < n; i++)
+                keep(signal->clone_type());
+        }},
+
+        {"path/string", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(get_tracker_element_path(signal_path, device.first));
+        }},
+        {"path/resolved", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(get_tracker_element_path(signal_resolved_path, device.first));
+        }},
+
+        {"summary/summarize", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                auto rename_map = std::make_shared<tracker_element_serializer::rename_map>();
+                keep(summarize_tracker_element(device.first, summary, rename_map));
+            }
+        }},
+        {"summary/summarize_arena", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                tracker_element_summary_arena arena;
+                keep(summarize_tracker_element(device.first, summary, arena.make_rename_map()));
+            }
+        }},
+        {"summary/pack_summary", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                stream.str("");
+                json_adapter::pack_summary(stream, device.first, summary,
+                        json_adapter::plain_keys());
+            }
+
+            keep(stream.tellp());
+        }},
+
+        {"map/insert", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                auto m = std::make_shared<tracker_element_map>(map_id);
+
+                for (const auto& c : map_children)
+                    m->insert(c);
+
+                keep(m);
+            }
+        }},
+        {"map/find", [&](uint64_t n) {
+            auto m = std::make_shared<tracker_element_map>(map_id);
+
+            for (const auto& c : map_children)
+                m->insert(c);
+
+            for (uint64_t i = 0; i < n; i++)
+                keep(m->find(map_children[i % map_children.size()]->get_id()));
+        }},
+        {"mac_map/insert", [&](uint64_t n) {
+            auto m = std::make_shared<tracker_element_mac_map>(mac_map_id);
+
+            for (uint64_t i = 0; i < n; i++) {
+                if ((i % 1024) == 0)
+                    m->clear();
+
+                m->insert(bench_mac(i % 1024), map_children[0]);
+            }
+
+            keep(m);
+        }},
+        {"mac_map/find", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(e_mac_map->find(bench_mac(i % 1024)));
+        }},
+        {"device_key/find", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(key_map.find(device_key(1, bench_mac(i % 65536))) != key_map.end());
+        }},
+
+        pack_case("pack/uint8", e_uint8),
+        pack_case("pack/uint64", e_uint64),
+        pack_case("pack/double", e_double),
+        pack_case("pack/string", e_string),
+        pack_case("pack/mac", e_mac),
+        pack_case("pack/uuid", e_uuid),
+        pack_case("pack/device_key", e_key),
+        pack_case("pack/vector_double", e_vector_double),
+        pack_case("pack/map", e_map),
+        pack_case("pack/mac_map", e_mac_map),
+        pack_case("pack/device", device.first),
+
+        {"string/sanitize/ascii", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(json_adapter::sanitize_string(ascii_str));
+        }},
+        {"string/sanitize/binary", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(json_adapter::sanitize_string(binary_str));
+        }},
+        {"string/munge/ascii", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(munge_to_printable(ascii_str));
+        }},
+        {"string/munge/binary", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(munge_to_printable(binary_str));
+        }},
+
+        {"device/construct", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                keep(make_device(i));
+        }},
+        {"device/update", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                update_device(device.first, device.second);
+        }},
+        {"device/cycle", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                auto d = make_device(i);
+
+                for (unsigned int u = 0; u < 10; u++)
+                    update_device(d.first, d.second);
+
+                stream.str("");
+                json_adapter::pack(stream, d.first);
+            }
+
+            keep(stream.tellp());
+        }},
+    };
+
+    if (list) {
+        for (const auto& c : cases)
+            printf("%s\n", c.name.c_str());
+        return 0;
+    }
+
+    std::vector<bench_result> results;
+
+    if (!json_out)
+        fmt::print("{:<32} {:>12} {:>12} {:>10}\n", "benchmark", "iterations", "ns/op", "allocs/op");
+
+    for (const auto& c : cases) {
+        if (filters.size() != 0 &&
+                std::none_of(filters.begin(), filters.end(),
+                    [&c](const std::string& f) { return c.name.find(f) != std::string::npos; }))
+            continue;
+
+        auto r = run_case(c, time_ms, rounds);
+
+        if (!json_out) {
+            if (kis_alloc_count != nullptr)
+                fmt::print("{:<32} {:>12} {:>12.1f} {:>10.2f}\n", r.name, r.iterations,
+                        r.ns_per_op, r.allocs_per_op);
+            else
+                fmt::print("{:<32} {:>12} {:>12.1f} {:>10}\n", r.name, r.iterations,
+                        r.ns_per_op, "-");
+        }
+
+        results.push_back(r);
+    }
+
+    if (json_out) {
+        fmt::print("[");
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+
+            fmt::print("{}\n  {{\"name\": \"{}\", \"iterations\": {}, \"ns_per_op\": {:.2f}",
+                    i == 0 ? "" : ",", r.name, r.iterations, r.ns_per_op);
+
+            if (kis_alloc_count != nullptr)
+                fmt::print(", \"allocs_per_op\": {:.3f}", r.allocs_per_op);
+
+            fmt::print("}}");
+        }
+
+        fmt::print("\n]\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,662 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * REST load generator for the Kismet server.
+ *
+ * Drives concurrent keep-alive connections against the device view, summary field,
+ * last-time polling and full serialization endpoints, and holds websocket device
+ * monitor subscriptions open alongside them.  Reports requests/sec, latency
+ * percentiles, bytes per request, and (with --server-pid, when the server is local)
+ * the server CPU time per request.
+ *
+ * The device population comes from the server; run it with benchmark_devices set in
+ * the benchmark override config for a synthetic population, or replay a capture from
+ * a real deployment.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boost/asio.hpp"
+#include "boost/beast.hpp"
+#include "boost/beast/websocket.hpp"
+
+#include "base64.h"
+#include "fmt.h"
+#include "nlohmann/json.hpp"
+
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+using tcp = boost::asio::ip::tcp;
+
+struct bench_config {
+    std::string host = "localhost";
+    std::string port = "2501";
+    std::string auth;
+    std::string api_key;
+    std::string view = "all";
+    std::vector<std::string> fields;
+    unsigned int connections = 8;
+    unsigned int websockets = 0;
+    unsigned int duration = 30;
+    unsigned int page_size = 50;
+    unsigned int poll_window = 10;
+    bool gzip = false;
+    pid_t server_pid = 0;
+
+    // Request types by weight
+    std::vector<std::pair<std::string, unsigned int>> mix;
+};
+
+// Results of one request type, merged from all the connections
+struct bench_result {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    std::vector<uint64_t> latency_us;
+};
+
+// The summary fields the web UI device list requests
+static const std::vector<std::string> default_fields = {
+    "kismet.device.base.macaddr",
+    "kismet.device.base.key",
+    "kismet.device.base.phyname",
+    "kismet.device.base.name",
+    "kismet.device.base.commonname",
+    "kismet.device.base.type",
+    "kismet.device.base.channel",
+    "kismet.device.base.frequency",
+    "kismet.device.base.first_time",
+    "kismet.device.base.last_time",
+    "kismet.device.base.packets.total",
+    "kismet.device.base.datasize",
+    "kismet.device.base.signal/kismet.common.signal.last_signal",
+    "kismet.device.base.crypt",
+    "kismet.device.base.manuf",
+};
+
+void print_help(char *argv) {
+    printf("Kismet REST benchmark\n");
+    printf("Drive concurrent REST requests and websocket subscriptions against a Kismet\n"
+           "server and report the request rate, latency, and size.\n");
+    printf("usage: %s [OPTION]\n", argv);
+    printf("     --host [host]            Kismet server (default localhost)\n"
+           "     --port [port]            Kismet server port (default 2501)\n"
+           " -a, --auth [user:password]   Login for the server\n"
+           "     --api-key [key]          API key for the server, instead of a login\n"
+           " -c, --connections [count]    Concurrent request connections (default 8)\n"
+           " -w, --websockets [count]     Device monitor websocket subscriptions (default 0)\n"
+           " -d, --duration [seconds]     Length of the run (default 30)\n"
+           " -m, --mix [type:weight,...]  Request types and their share of the requests;\n"
+           "                              types are view (a page of the device view with\n"
+           "                              summary fields, as the web UI requests it),\n"
+           "                              fields (the whole view with summary fields),\n"
+           "                              full (the whole view, every field), and\n"
+           "                              lasttime (devices changed in the poll window).\n"
+           "                              Default view:4,lasttime:4,fields:1,full:1\n"
+           "     --view [id]              Device view to request (default all)\n"
+           "     --fields [f1,f2,...]     Summary fields (default: the web UI device list)\n"
+           "     --page-size [count]      Devices in each view page (default 50)\n"
+           "     --poll-window [seconds]  last-time polls ask for devices changed in the last\n"
+           "                              [seconds] (default 10)\n"
+           "     --gzip                   Accept compressed responses, and count the\n"
+           "                              compressed size\n"
+           "     --server-pid [pid]       Report the CPU time the server (on this host) used\n"
+           "                              per request\n"
+           "     --json                   Print the results as JSON\n");
+}
+
+static void apply_auth(const bench_config& config, http::fields& fields) {
+    if (config.api_key.length())
+        fields.set(http::field::cookie, fmt::format("KISMET={}", config.api_key));
+    else if (config.auth.length())
+        fields.set(http::field::authorization, fmt::format("Basic {}", base64::encode(config.auth)));
+}
+
+// Server CPU time, in seconds, from /proc
+static double server_cpu_seconds(pid_t pid) {
+    if (pid == 0)
+        return 0;
+
+    std::ifstream f(fmt::format("/proc/{}/stat", pid));
+    std::string stat;
+
+    if (!std::getline(f, stat))
+        return -1;
+
+    // Skip past the process name, which can contain spaces
+    auto paren = stat.rfind(')');
+
+    if (paren == std::string::npos)
+        return -1;
+
+    std::istringstream ss(stat.substr(paren + 2));
+    std::string field;
+    unsigned long utime = 0, stime = 0;
+
+    // utime and stime are fields 14 and 15, the 12th and 13th after the name
+    for (unsigned int i = 0; i < 13 && ss >> field; i++) {
+        if (i == 11)
+            utime = std::stoul(field);
+        else if (i == 12)
+            stime = std::stoul(field);
+    }
+
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static std::string url_encode(const std::string& in) {
+    std::string out;
+
+    for (auto c : in) {
+        if (isalnum((unsigned char) c) || c == '-' || c == '_' || c == '.' || c == '~')
+            out += c;
+        else
+            out += fmt::format("%{:02X}", (unsigned char) c);
+    }
+
+    return out;
+}
+
+static http::request<http::string_body> build_request(const bench_config& config,
+        const std::string& type, std::mt19937& rng, unsigned int n_pages) {
+    http::request<http::string_body> req;
+
+    req.version(11);
+    req.set(http::field::host, config.host);
+    req.set(http::field::user_agent, "kismet_rest_bench");
+
+    if (config.gzip)
+        req.set(http::field::accept_encoding, "gzip");
+
+    apply_auth(config, req);
+
+    nlohmann::json fields = config.fields;
+
+    if (type == "full") {
+        req.method(http::verb::get);
+        req.target(fmt::format("/devices/views/{}/devices.json", config.view));
+    } else if (type == "fields") {
+        nlohmann::json j;
+        j["fields"] = fields;
+
+        req.method(http::verb::post);
+        req.target(fmt::format("/devices/views/{}/devices.json", config.view));
+        req.set(http::field::content_type, "application/json");
+        req.body() = j.dump();
+    } else if (type == "lasttime") {
+        nlohmann::json j;
+        j["fields"] = fields;
+
+        req.method(http::verb::post);
+        req.target(fmt::format("/devices/views/{}/last-time/-{}/devices.json",
+                    config.view, config.poll_window));
+        req.set(http::field::content_type, "application/json");
+        req.body() = j.dump();
+    } else {
+        // A random page of the view, the way the web UI device table asks for it
+        nlohmann::json j;
+        j["fields"] = fields;
+        j["datatable"] = true;
+
+        auto page = std::uniform_int_distribution<unsigned int>(0, std::max(1U, n_pages) - 1)(rng);
+
+        req.method(http::verb::post);
+        req.target(fmt::format("/devices/views/{}/devices.json", config.view));
+        req.set(http::field::content_type, "application/x-www-form-urlencoded");
+        req.body() = fmt::format("json={}&start={}&length={}&draw=1",
+                url_encode(j.dump()),
+                page * config.page_size, config.page_size);
+    }
+
+    req.prepare_payload();
+
+    return req;
+}
+
+int main(int argc, char *argv[]) {
+#define OPT_HOST            10
+#define OPT_PORT            11
+#define OPT_API_KEY         12
+#define OPT_VIEW            13
+#define OPT_FIELDS          14
+#define OPT_PAGE_SIZE       15
+#define OPT_POLL_WINDOW     16
+#define OPT_GZIP            17
+#define OPT_SERVER_PID      18
+#define OPT_JSON            19
+    static struct option longopt[] = {
+        { "host", required_argument, 0, OPT_HOST },
+        { "port", required_argument, 0, OPT_PORT },
+        { "auth", required_argument, 0, 'a' },
+        { "api-key", required_argument, 0, OPT_API_KEY },
+        { "connections", required_argument, 0, 'c' },
+        { "websockets", required_argument, 0, 'w' },
+        { "duration", required_argument, 0, 'd' },
+        { "mix", required_argument, 0, 'm' },
+        { "view", required_argument, 0, OPT_VIEW },
+        { "fields", required_argument, 0, OPT_FIELDS },
+        { "page-size", required_argument, 0, OPT_PAGE_SIZE },
+        { "poll-window", required_argument, 0, OPT_POLL_WINDOW },
+        { "gzip", no_argument, 0, OPT_GZIP },
+        { "server-pid", required_argument, 0, OPT_SERVER_PID },
+        { "json", no_argument, 0, OPT_JSON },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int option_idx = 0;
+    optind = 0;
+    opterr = 0;
+
+    bench_config config;
+    std::string mix_opt = "view:4,lasttime:4,fields:1,full:1";
+    bool json_out = false;
+
+    config.fields = default_fields;
+
+    auto parse_uint = [](const char *arg, const char *what) -> unsigned int {
+        unsigned int v;
+
+        if (sscanf(arg, "%u", &v) != 1) {
+            fmt::print(stderr, "ERROR:  Expected a number for {}\n", what);
+            exit(1);
+        }
+
+        return v;
+    };
+
+    while (1) {
+        int r = getopt_long(argc, argv,
+                            "-ha:c:w:d:m:",
+                            longopt, &option_idx);
+        if (r < 0) break;
+
+        if (r == 'h') {
+            print_help(argv[0]);
+            exit(1);
+        } else if (r == OPT_HOST) {
+            config.host = std::string(optarg);
+        } else if (r == OPT_PORT) {
+            config.port = std::string(optarg);
+        } else if (r == 'a') {
+            config.auth = std::string(optarg);
+        } else if (r == OPT_API_KEY) {
+            config.api_key = std::string(optarg);
+        } else if (r == 'c') {
+            config.connections = parse_uint(optarg, "--connections");
+        } else if (r == 'w') {
+            config.websockets = parse_uint(optarg, "--websockets");
+        } else if (r == 'd') {
+            config.duration = parse_uint(optarg, "--duration");
+        } else if (r == 'm') {
+            mix_opt = std::string(optarg);
+        } else if (r == OPT_VIEW) {
+            config.view = std::string(optarg);
+        } else if (r == OPT_FIELDS) {
+            config.fields.clear();
+
+            std::stringstream ss(optarg);
+            std::string f;
+
+            while (std::getline(ss, f, ','))
+                if (f.length())
+                    config.fields.push_back(f);
+        } else if (r == OPT_PAGE_SIZE) {
+            config.page_size = std::max(1U, parse_uint(optarg, "--page-size"));
+        } else if (r == OPT_POLL_WINDOW) {
+            config.poll_window = parse_uint(optarg, "--poll-window");
+        } else if (r == OPT_GZIP) {
+            config.gzip = true;
+        } else if (r == OPT_SERVER_PID) {
+            config.server_pid = parse_uint(optarg, "--server-pid");
+        } else if (r == OPT_JSON) {
+            json_out = true;
+        }
+    }
+
+    {
+        std::stringstream ss(mix_opt);
+        std::string m;
+
+        while (std::getline(ss, m, ',')) {
+            auto c = m.find(':');
+            auto type = m.substr(0, c);
+            unsigned int weight = 1;
+
+            if (c != std::string::npos)
+                weight = parse_uint(m.substr(c + 1).c_str(), "the --mix weight");
+
+            if (type != "view" && type != "fields" && type != "full" && type != "lasttime") {
+                fmt::print(stderr, "ERROR:  Unknown request type '{}' in --mix\n", type);
+                exit(1);
+            }
+
+            if (weight > 0)
+                config.mix.push_back(std::make_pair(type, weight));
+        }
+    }
+
+    if (config.mix.size() == 0 && config.websockets == 0) {
+        fmt::print(stderr, "ERROR:  Nothing to request; set --mix or --websockets\n");
+        exit(1);
+    }
+
+    if (config.connections == 0 && config.websockets == 0) {
+        fmt::print(stderr, "ERROR:  Expected at least one connection or websocket\n");
+        exit(1);
+    }
+
+    boost::asio::io_context resolve_io;
+    tcp::resolver::results_type endpoints;
+
+    try {
+        tcp::resolver resolver(resolve_io);
+        endpoints = resolver.resolve(config.host, config.port);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  Could not resolve {}:{}: {}\n", config.host, config.port, e.what());
+        exit(1);
+    }
+
+    // Size the view once, so view requests pick pages which exist
+    unsigned int n_pages = 1;
+
+    try {
+        boost::asio::io_context io;
+        beast::tcp_stream stream(io);
+        stream.connect(endpoints);
+
+        http::request<http::string_body> req{http::verb::get, "/devices/views/all_views.json", 11};
+        req.set(http::field::host, config.host);
+        apply_auth(config, req);
+
+        http::write(stream, req);
+
+        beast::flat_buffer buf;
+        http::response<http::string_body> res;
+        http::read(stream, buf, res);
+
+        if (res.result() == http::status::unauthorized) {
+            fmt::print(stderr, "ERROR:  The server rejected the login; set --auth or --api-key\n");
+            exit(1);
+        }
+
+        auto views = nlohmann::json::parse(res.body());
+
+        for (const auto& v : views) {
+            if (v.value("kismet.devices.view.id", "") == config.view) {
+                n_pages = v.value("kismet.devices.view.size", 0) / config.page_size + 1;
+                fmt::print(stderr, "View '{}' has {} devices\n", config.view,
+                        v.value("kismet.devices.view.size", 0));
+            }
+        }
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  Could not list the device views on {}:{}: {}\n",
+                config.host, config.port, e.what());
+        exit(1);
+    }
+
+    unsigned int total_weight = 0;
+    for (const auto& m : config.mix)
+        total_weight += m.second;
+
+    std::atomic<bool> running{true};
+    std::mutex result_mutex;
+    std::map<std::string, bench_result> results;
+
+    // Websocket subscriptions count the device updates pushed to them
+    std::atomic<uint64_t> ws_messages{0}, ws_bytes{0}, ws_errors{0};
+    std::mutex ws_socket_mutex;
+    std::vector<int> ws_sockets;
+
+    auto start_cpu = server_cpu_seconds(config.server_pid);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(config.duration);
+
+    std::vector<std::thread> threads;
+
+    for (unsigned int c = 0; c < (config.mix.size() ? config.connections : 0); c++) {
+        threads.push_back(std::thread([&, c]() {
+            std::mt19937 rng(c);
+            std::map<std::string, bench_result> local;
+
+            boost::asio::io_context io;
+            std::unique_ptr<beast::tcp_stream> stream;
+            beast::flat_buffer buf;
+
+            while (std::chrono::steady_clock::now() < deadline) {
+                // Pick a request type by weight
+                auto w = std::uniform_int_distribution<unsigned int>(0, total_weight - 1)(rng);
+                std::string type;
+
+                for (const auto& m : config.mix) {
+                    if (w < m.second) {
+                        type = m.first;
+                        break;
+                    }
+
+                    w -= m.second;
+                }
+
+                auto& r = local[type];
+
+                try {
+                    if (stream == nullptr) {
+                        stream = std::make_unique<beast::tcp_stream>(io);
+                        stream->connect(endpoints);
+                        buf.clear();
+                    }
+
+                    auto req = build_request(config, type, rng, n_pages);
+
+                    auto req_start = std::chrono::steady_clock::now();
+
+                    http::write(*stream, req);
+
+                    http::response_parser<http::string_body> parser;
+                    parser.body_limit(boost::none);
+                    http::read(*stream, buf, parser);
+
+                    auto req_end = std::chrono::steady_clock::now();
+
+                    auto& res = parser.get();
+
+                    r.requests++;
+                    r.bytes += res.body().size();
+                    r.latency_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                                req_end - req_start).count());
+
+                    if (res.result() != http::status::ok)
+                        r.errors++;
+
+                    if (!res.keep_alive())
+                        stream.reset();
+                } catch (const std::exception& e) {
+                    r.errors++;
+                    stream.reset();
+                }
+            }
+
+            std::lock_guard<std::mutex> lk(result_mutex);
+
+            for (auto& l : local) {
+                auto& r = results[l.first];
+                r.requests += l.second.requests;
+                r.errors += l.second.errors;
+                r.bytes += l.second.bytes;
+                r.latency_us.insert(r.latency_us.end(), l.second.latency_us.begin(),
+                        l.second.latency_us.end());
+            }
+        }));
+    }
+
+    for (unsigned int c = 0; c < config.websockets; c++) {
+        threads.push_back(std::thread([&, c]() {
+            try {
+                boost::asio::io_context io;
+                websocket::stream<tcp::socket> ws(io);
+
+                boost::asio::connect(ws.next_layer(), endpoints);
+
+                {
+                    std::lock_guard<std::mutex> lk(ws_socket_mutex);
+                    ws_sockets.push_back(ws.next_layer().native_handle());
+                }
+
+                ws.set_option(websocket::stream_base::decorator([&config](websocket::request_type& req) {
+                            apply_auth(config, req);
+                        }));
+
+                ws.handshake(config.host, "/devices/monitor.ws");
+
+                nlohmann::json sub;
+                sub["monitor"] = "*";
+                sub["request"] = c + 1;
+                sub["rate"] = 1;
+                sub["fields"] = config.fields;
+
+                ws.text(true);
+                ws.write(boost::asio::buffer(sub.dump()));
+
+                beast::flat_buffer buf;
+
+                while (running) {
+                    ws.read(buf);
+                    ws_messages++;
+                    ws_bytes += buf.size();
+                    buf.clear();
+                }
+            } catch (const std::exception& e) {
+                // Closing the sockets at the end of the run lands here too
+                if (running)
+                    ws_errors++;
+            }
+        }));
+    }
+
+    std::this_thread::sleep_until(deadline);
+    running = false;
+
+    // Websocket reads block until the server sends something; shut the sockets down
+    // to end them
+    {
+        std::lock_guard<std::mutex> lk(ws_socket_mutex);
+        for (auto s : ws_sockets)
+            shutdown(s, SHUT_RDWR);
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto end_cpu = server_cpu_seconds(config.server_pid);
+
+    uint64_t total_requests = 0;
+    for (const auto& r : results)
+        total_requests += r.second.requests;
+
+    auto percentile = [](const std::vector<uint64_t>& v, double p) -> double {
+        if (v.size() == 0)
+            return 0;
+        auto i = std::min(v.size() - 1, (size_t) (p / 100 * v.size()));
+        return v[i] / 1000.0f;
+    };
+
+    nlohmann::json out;
+
+    out["seconds"] = elapsed;
+    out["connections"] = config.connections;
+    out["requests"] = total_requests;
+    out["requests_per_sec"] = total_requests / elapsed;
+
+    if (config.server_pid != 0 && start_cpu >= 0 && end_cpu >= 0 && total_requests > 0) {
+        out["server_cpu_seconds"] = end_cpu - start_cpu;
+        out["server_cpu_ms_per_request"] = (end_cpu - start_cpu) * 1000 / total_requests;
+    }
+
+    if (!json_out) {
+        fmt::print("{} requests in {:.1f} seconds over {} connections, {:.1f} requests/sec\n",
+                total_requests, elapsed, config.connections, total_requests / elapsed);
+        fmt::print("{:<10} {:>10} {:>8} {:>10} {:>10} {:>10} {:>12}\n", "type", "requests",
+                "errors", "req/sec", "p50 ms", "p99 ms", "bytes/req");
+    }
+
+    for (auto& r : results) {
+        std::sort(r.second.latency_us.begin(), r.second.latency_us.end());
+
+        auto bytes_per = r.second.requests ? r.second.bytes / r.second.requests : 0;
+
+        nlohmann::json rj;
+        rj["requests"] = r.second.requests;
+        rj["errors"] = r.second.errors;
+        rj["requests_per_sec"] = r.second.requests / elapsed;
+        rj["p50_ms"] = percentile(r.second.latency_us, 50);
+        rj["p99_ms"] = percentile(r.second.latency_us, 99);
+        rj["bytes_per_request"] = bytes_per;
+        out["types"][r.first] = rj;
+
+        if (!json_out)
+            fmt::print("{:<10} {:>10} {:>8} {:>10.1f} {:>10.2f} {:>10.2f} {:>12}\n", r.first,
+                    r.second.requests, r.second.errors, r.second.requests / elapsed,
+                    percentile(r.second.latency_us, 50), percentile(r.second.latency_us, 99),
+                    bytes_per);
+    }
+
+    if (config.websockets > 0) {
+        out["websockets"]["subscriptions"] = config.websockets;
+        out["websockets"]["messages"] = ws_messages.load();
+        out["websockets"]["messages_per_sec"] = ws_messages / elapsed;
+        out["websockets"]["bytes_per_message"] = ws_messages ? ws_bytes / ws_messages : 0;
+        out["websockets"]["errors"] = ws_errors.load();
+
+        if (!json_out)
+            fmt::print("{} websocket subscriptions received {} device updates, {:.1f}/sec, "
+                    "{} bytes each, {} errors\n", config.websockets, ws_messages.load(),
+                    ws_messages / elapsed, ws_messages ? ws_bytes / ws_messages : 0,
+                    ws_errors.load());
+    }
+
+    if (json_out) {
+        fmt::print("{}\n", out.dump(4));
+    } else if (out.contains("server_cpu_ms_per_request")) {
+        fmt::print("Server used {:.2f} CPU seconds, {:.3f} ms per request\n",
+                out["server_cpu_seconds"].get<double>(),
+                out["server_cpu_ms_per_request"].get<double>());
+    }
+
+    return 0;
+}
+
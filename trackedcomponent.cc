@@ -18,6 +18,8 @@
 
 #include "config.h"
 
+#include <typeindex>
+
 #include "trackedcomponent.h"
 
 std::string tracker_component::get_name() {
@@ -47,9 +49,41 @@ int tracker_component::register_field(const std::string& in_name,
 }
 
 void tracker_component::reserve_fields(std::shared_ptr<tracker_element_map> e) {
+    auto inline_table = get_inline_fields();
+
+    if (inline_table != nullptr) {
+        // The first instance has registered every inline field by now
+        inline_table->sealed = true;
+
+        if (e != nullptr && e->get_type() == tracker_type::tracker_map) {
+            for (const auto& f : inline_table->fields)
+                f.import(reinterpret_cast<char *>(this) + f.offset, e->get_sub(f.id));
+        }
+    }
+
     if (registered_fields == nullptr)
         return;
 
+    // Slot the generations of the registered fields; the class table is the same for 
+    // every instance, so only the first has to fill it in
+    auto slot_table = get_generation_slot_table(typeid(*this));
+
+    if (!slot_table->sealed) {
+        kis_lock_guard<kis_mutex> lk(slot_table->mutex, "tracker_component generation slots");
+
+        if (!slot_table->sealed) {
+            for (const auto& rf : *registered_fields)
+                slot_table->slots.emplace(abs(rf->id), static_cast<int>(slot_table->slots.size()));
+
+            slot_table->sealed = true;
+        }
+    }
+
+    if (slot_table->slots.size() != 0) {
+        generation_slots = slot_table;
+        field_generations.reset(new uint64_t[slot_table->slots.size()]());
+    }
+
     for (auto& rf : *registered_fields) {
         if (rf->assign != nullptr) {
             // We use negative IDs to indicate dynamic to eke out 4 more bytes
@@ -144,3 +178,89 @@ shared_tracker_element tracker_component::get_child_path(const std::vector<std::
     return next_elem;
 }
 
+
+shared_tracker_element tracker_component::get_sub_fallback(int id) {
+    auto inline_table = get_inline_fields();
+
+    if (inline_table == nullptr)
+        return nullptr;
+
+    for (const auto& f : inline_table->fields) {
+        if (f.id == id)
+            return f.materialize(f.id, reinterpret_cast<const char *>(this) + f.offset);
+    }
+
+    return nullptr;
+}
+
+tracker_element_map::extra_fields_t tracker_component::get_extra_fields() {
+    auto inline_table = get_inline_fields();
+
+    if (inline_table == nullptr)
+        return extra_fields_t();
+
+    extra_fields_t ret;
+    ret.reserve(inline_table->fields.size());
+
+    for (const auto& f : inline_table->fields)
+        ret.emplace_back(f.id, f.materialize(f.id, reinterpret_cast<const char *>(this) + f.offset));
+
+    return ret;
+}
+
+std::atomic<uint64_t> tracker_component::global_generation{1};
+thread_local unsigned int tracker_component::derived_fields_depth = 0;
+
+tracker_component::generation_slot_table *
+    tracker_component::get_generation_slot_table(const std::type_info& type) {
+    static kis_mutex tables_mutex;
+    static std::map<std::type_index, std::unique_ptr<generation_slot_table>> tables;
+
+    kis_lock_guard<kis_mutex> lk(tables_mutex, "tracker_component generation slot tables");
+
+    auto& t = tables[std::type_index(type)];
+
+    if (t == nullptr)
+        t.reset(new generation_slot_table());
+
+    return t.get();
+}
+
+std::shared_ptr<tracker_element_mapvec> tracker_component::modified_since(uint64_t generation) {
+    auto ret = std::make_shared<tracker_element_mapvec>(get_id());
+
+    // Let the component update itself, the same as it would before serializing
+    pre_serialize();
+
+    bool component_modified = modified_generation >= generation;
+
+    for_each_field([&](const auto& i) {
+        if (i.second == nullptr)
+            return;
+
+        if (i.second->get_type() == tracker_type::tracker_map) {
+            auto sub = dynamic_cast<tracker_component *>(i.second.get());
+
+            if (sub != nullptr) {
+                auto sub_mod = sub->modified_since(generation);
+
+                if (sub_mod != nullptr)
+                    ret->push_back(sub_mod);
+
+                return;
+            }
+        }
+
+        auto field_gen = get_field_generation(i.first);
+
+        if ((field_gen != 0 && field_gen >= generation) || (field_gen == 0 && component_modified))
+            ret->push_back(i.second);
+    });
+
+    post_serialize();
+
+    if (ret->size() == 0)
+        return nullptr;
+
+    return ret;
+}
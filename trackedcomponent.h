@@ -30,7 +30,10 @@
 #include <vector>
 #include <map>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <typeinfo>
 
 #include "globalregistry.h"
 #include "trackedelement.h"
@@ -39,6 +42,19 @@
 #include "nlohmann/json.hpp"
 
 
+// Element types used to present scalar fields stored inline in a component
+template<typename T> struct tracker_inline_element { };
+template<> struct tracker_inline_element<uint8_t> { using type = tracker_element_uint8; };
+template<> struct tracker_inline_element<int8_t> { using type = tracker_element_int8; };
+template<> struct tracker_inline_element<uint16_t> { using type = tracker_element_uint16; };
+template<> struct tracker_inline_element<int16_t> { using type = tracker_element_int16; };
+template<> struct tracker_inline_element<uint32_t> { using type = tracker_element_uint32; };
+template<> struct tracker_inline_element<int32_t> { using type = tracker_element_int32; };
+template<> struct tracker_inline_element<uint64_t> { using type = tracker_element_uint64; };
+template<> struct tracker_inline_element<int64_t> { using type = tracker_element_int64; };
+template<> struct tracker_inline_element<float> { using type = tracker_element_float; };
+template<> struct tracker_inline_element<double> { using type = tracker_element_double; };
+
 // Complex trackable unit based on trackertype dataunion.
 //
 // All tracker_components are built from maps.
@@ -57,6 +73,14 @@
 //
 // Subclasses MUST override the signature, typically with a checksum of the class
 // name, so that the entry tracker can differentiate multiple tracker_map classes
+//
+// Numeric fields which are updated often and present in every instance can be
+// stored inline in the component as plain members instead of as individually
+// allocated elements, via register_inline_field and the __ProxyInline macros.
+// Inline fields are never held in the map; serializers get them as elements built
+// from the current values via get_extra_fields, and lookups by path get a copy of
+// the current value; setting those copies does not change the component.  Every class which registers 
+// inline fields must include __InlineFields in its definition.
 class tracker_component : public tracker_element_map {
 
 // Import from a builder instance and insert into our map
@@ -82,6 +106,7 @@ class tracker_component : public tracker_element_map {
     } \
     inline void set_##name(const itype& in) { \
         set_tracker_value<ptype>(cvar, static_cast<ptype>(in)); \
+        mark_modified(cvar->get_id()); \
     }
 
 // Ugly macro for standard proxy access but with an additional mutex; this should
@@ -99,6 +124,7 @@ class tracker_component : public tracker_element_map {
     inline void set_##name(const itype& in) { \
         kis_lock_guard<kis_mutex> lk(mvar, __func__); \
         set_tracker_value<ptype>(cvar, static_cast<ptype>(in)); \
+        mark_modified(cvar->get_id()); \
     }
 
 // Ugly trackercomponent macro for proxying trackerelement values
@@ -119,10 +145,12 @@ class tracker_component : public tracker_element_map {
     } \
     inline bool set_##name(const itype& in) { \
         cvar->set((ptype) in); \
+        mark_modified(cvar->get_id()); \
         return lambda(in); \
     } \
     inline void set_only_##name(const itype& in) { \
         cvar->set((ptype) in); \
+        mark_modified(cvar->get_id()); \
     }
 
 // Newer dynamic proxy model which doesn't use an instance pointer, only the
@@ -164,10 +192,12 @@ class tracker_component : public tracker_element_map {
             if (cvar != nullptr) {\
                 insert(cvar); \
                 cvar->set(in); \
+                mark_modified(id); \
                 return; \
             } \
         } \
         std::static_pointer_cast<ctype>(ci->second)->set(in); \
+        mark_modified(id); \
     } \
     inline bool has_##name() const { \
         return this->find(id) != this->cend(); \
@@ -208,6 +238,7 @@ class tracker_component : public tracker_element_map {
                 insert(cvar); \
         } \
         cvar->set((ptype) in); \
+        mark_modified(id); \
     } \
     inline void set_only_##name(const itype& in) { \
         if (cvar == nullptr) { \
@@ -217,6 +248,7 @@ class tracker_component : public tracker_element_map {
                 insert(cvar); \
         } \
         cvar->set((ptype) in); \
+        mark_modified(id); \
     } \
     inline bool has_##name() const { \
         return cvar != nullptr; \
@@ -253,6 +285,7 @@ class tracker_component : public tracker_element_map {
                 insert(cvar); \
         } \
         cvar->set((ptype) in); \
+        mark_modified(id); \
     } \
     inline void set_only_##name(const itype& in) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
@@ -263,6 +296,7 @@ class tracker_component : public tracker_element_map {
                 insert(cvar); \
         } \
         cvar->set((ptype) in); \
+        mark_modified(id); \
     } \
     inline bool has_##name() { \
         kis_lock_guard<kis_mutex> lk(mutex); \
@@ -298,6 +332,7 @@ class tracker_component : public tracker_element_map {
                 insert(cvar); \
         } \
         cvar->set((ptype) in); \
+        mark_modified(id); \
         return lambda(in); \
     } \
     inline void set_only_##name(const itype& in) { \
@@ -308,6 +343,7 @@ class tracker_component : public tracker_element_map {
                 insert(cvar); \
         } \
         cvar->set((ptype) in); \
+        mark_modified(id); \
     } \
     inline bool has_##name() const { \
         return cvar != nullptr; \
@@ -324,6 +360,7 @@ class tracker_component : public tracker_element_map {
 #define __ProxySet(name, ptype, stype, cvar) \
     inline void set_##name(const stype& in) { \
         set_tracker_value<ptype>(cvar, in); \
+        mark_modified(cvar->get_id()); \
     } 
 
 
@@ -337,6 +374,7 @@ class tracker_component : public tracker_element_map {
     inline void set_##name(const stype& in) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         set_tracker_value<ptype>(cvar, in); \
+        mark_modified(cvar->get_id()); \
     } 
 
 // Get and set only, protected with a std::shared_ptr<mutex>
@@ -349,6 +387,7 @@ class tracker_component : public tracker_element_map {
     inline void set_##name(const stype& in) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         set_tracker_value<ptype>(cvar, in); \
+        mark_modified(cvar->get_id()); \
     } 
 
 // Proxy a split public/private get/set function; This is even funkier than the 
@@ -361,6 +400,7 @@ class tracker_component : public tracker_element_map {
     protected: \
     inline void set_int_##name(const itype& in) { \
         cvar->set((ptype) in); \
+        mark_modified(cvar->get_id()); \
     } \
     public:
 
@@ -377,6 +417,7 @@ class tracker_component : public tracker_element_map {
     inline void set_int_##name(const itype& in) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         cvar->set((ptype) in); \
+        mark_modified(cvar->get_id()); \
     } \
     public:
 
@@ -393,6 +434,7 @@ class tracker_component : public tracker_element_map {
     virtual void set_int_##name(const itype& in) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         cvar->set((ptype) in); \
+        mark_modified(cvar->get_id()); \
     } \
     public:
 
@@ -409,6 +451,7 @@ class tracker_component : public tracker_element_map {
     inline void set_int_##name(const itype& in) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         cvar->set((ptype) in); \
+        mark_modified(cvar->get_id()); \
     } \
     public:
 
@@ -416,15 +459,19 @@ class tracker_component : public tracker_element_map {
 #define __ProxyIncDec(name, ptype, rtype, cvar) \
     inline void inc_##name() { \
         (*cvar) += 1; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void inc_##name(rtype i) { \
         (*cvar) += (ptype) i; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void dec_##name() { \
         (*cvar) -= 1; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void dec_##name(rtype i) { \
         (*cvar) -= (ptype) i; \
+        mark_modified(cvar->get_id()); \
     }
 
 // Proxy increment and decrement functions, with mutex
@@ -432,18 +479,22 @@ class tracker_component : public tracker_element_map {
     inline void inc_##name() { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) += 1; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void inc_##name(rtype i) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) += (ptype) i; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void dec_##name() { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) -= 1; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void dec_##name(rtype i) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) -= (ptype) i; \
+        mark_modified(cvar->get_id()); \
     }
 
 // Proxy increment and decrement functions, with shared mutex
@@ -451,27 +502,33 @@ class tracker_component : public tracker_element_map {
     inline void inc_##name() { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) += 1; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void inc_##name(rtype i) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) += (ptype) i; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void dec_##name() { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) -= 1; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void dec_##name(rtype i) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) -= (ptype) i; \
+        mark_modified(cvar->get_id()); \
     }
 
 // Proxy add/subtract
 #define __ProxyAddSub(name, ptype, itype, cvar) \
     inline void add_##name(itype i) { \
         (*cvar) += (ptype) i; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void sub_##name(itype i) { \
         (*cvar) -= (ptype) i; \
+        mark_modified(cvar->get_id()); \
     }
 
 // Proxy add/subtract, with mutex
@@ -479,10 +536,12 @@ class tracker_component : public tracker_element_map {
     inline void add_##name(itype i) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) += (ptype) i; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void sub_##name(itype i) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) -= (ptype) i; \
+        mark_modified(cvar->get_id()); \
     }
 
 // Proxy add/subtract, with shared mutex
@@ -490,10 +549,12 @@ class tracker_component : public tracker_element_map {
     inline void add_##name(itype i) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) += (ptype) i; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void sub_##name(itype i) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) -= (ptype) i; \
+        mark_modified(cvar->get_id()); \
     }
 
 // Proxy sub-trackable (name, trackable type, class variable)
@@ -766,13 +827,35 @@ class tracker_component : public tracker_element_map {
             cvar = in; \
         }
 
+// Proxy a string field which references a shared element from the string pool; 
+// setting the value swaps in the pooled element for the new string instead of
+// modifying the shared element
+#define __ProxyInterned(name, cvar) \
+        inline std::shared_ptr<tracker_element_string> get_tracker_##name() { \
+            return cvar; \
+        } \
+        inline std::string get_##name() const { \
+            return get_tracker_value<std::string>(cvar); \
+        } \
+        inline void set_##name(const std::string& in) { \
+            if (cvar->get() == in) \
+                return; \
+            auto id = cvar->get_id(); \
+            erase(cvar); \
+            cvar = tracker_element_string_pool::intern(id, in); \
+            insert(cvar); \
+            mark_modified(id); \
+        }
+
 // Proxy bitset functions (name, trackable type, data type, class var)
 #define __ProxyBitset(name, dtype, cvar) \
     inline void bitset_##name(dtype bs) { \
         (*cvar) |= bs; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void bitclear_##name(dtype bs) { \
         (*cvar) &= ~(bs); \
+        mark_modified(cvar->get_id()); \
     } \
     inline dtype bitcheck_##name(dtype bs) { \
         return (dtype) (get_tracker_value<dtype>(cvar) & bs); \
@@ -783,10 +866,12 @@ class tracker_component : public tracker_element_map {
     inline void bitset_##name(dtype bs) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) |= bs; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void bitclear_##name(dtype bs) { \
         kis_lock_guard<kis_mutex> lk(mutex, __func__); \
         (*cvar) &= ~(bs); \
+        mark_modified(cvar->get_id()); \
     } \
     inline dtype bitcheck_##name(dtype bs) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
@@ -798,16 +883,55 @@ class tracker_component : public tracker_element_map {
     inline void bitset_##name(dtype bs) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) |= bs; \
+        mark_modified(cvar->get_id()); \
     } \
     inline void bitclear_##name(dtype bs) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         (*cvar) &= ~(bs); \
+        mark_modified(cvar->get_id()); \
     } \
     inline dtype bitcheck_##name(dtype bs) { \
         kis_lock_guard<kis_mutex> lk(mutex); \
         return (dtype) (get_tracker_value<dtype>(cvar) & bs); \
     }
 
+// Declare the table of inline fields for a component class
+#define __InlineFields \
+    virtual inline_field_table *get_inline_fields() override { \
+        static inline_field_table table; \
+        return &table; \
+    }
+
+// Proxy a numeric field stored inline in the component (name, storage type, 
+// input type, return type, class var)
+#define __ProxyInline(name, ptype, itype, rtype, cvar) \
+    inline rtype get_##name() const { \
+        return (rtype) cvar; \
+    } \
+    inline void set_##name(const itype& in) { \
+        cvar = static_cast<ptype>(in); \
+        mark_modified(); \
+    }
+
+// Proxy increment and decrement functions for an inline field
+#define __ProxyInlineIncDec(name, ptype, rtype, cvar) \
+    inline void inc_##name() { \
+        cvar += 1; \
+        mark_modified(); \
+    } \
+    inline void inc_##name(rtype i) { \
+        cvar += (ptype) i; \
+        mark_modified(); \
+    } \
+    inline void dec_##name() { \
+        cvar -= 1; \
+        mark_modified(); \
+    } \
+    inline void dec_##name(rtype i) { \
+        cvar -= (ptype) i; \
+        mark_modified(); \
+    }
+
     class registered_field {
         // We use negative IDs to indicate dynamic assignment, since this exists for every field
         // in every tracked element we actually do benefit from squeezing the boolean out
@@ -840,29 +964,76 @@ class tracker_component : public tracker_element_map {
             shared_tracker_element *assign;
     };
 
+protected:
+    // Inline field, by offset into the component, with the functions to convert
+    // it to and from an element
+    struct inline_field {
+        int id;
+        size_t offset;
+        shared_tracker_element (*materialize)(int id, const void *src);
+        void (*import)(void *dest, const shared_tracker_element& src);
+    };
+
+    // Per-class table of inline fields, filled in by the first instance and 
+    // immutable once sealed
+    struct inline_field_table {
+        inline_field_table() :
+            sealed{false} { }
+
+        std::atomic<bool> sealed;
+        kis_mutex mutex;
+        std::vector<inline_field> fields;
+    };
+
+    template<typename T>
+    static shared_tracker_element materialize_inline(int id, const void *src) {
+        using element_t = typename tracker_inline_element<T>::type;
+
+        auto e = std::make_shared<element_t>(id);
+        e->set(*static_cast<const T *>(src));
+
+        return e;
+    }
+
+    template<typename T>
+    static void import_inline(void *dest, const shared_tracker_element& src) {
+        using element_t = typename tracker_inline_element<T>::type;
+
+        if (src != nullptr && src->get_type() == element_t::static_type())
+            *static_cast<T *>(dest) = static_cast<element_t *>(src.get())->get();
+    }
+
 
 public:
     tracker_component() :
         tracker_element_map(0),
-        registered_fields{nullptr} {
+        registered_fields{nullptr},
+        modified_generation{current_generation()},
+        generation_slots{nullptr} {
             Globalreg::n_tracked_components++;
         }
 
     tracker_component(int in_id) :
         tracker_element_map(in_id),
-        registered_fields{nullptr} {
+        registered_fields{nullptr},
+        modified_generation{current_generation()},
+        generation_slots{nullptr} {
             Globalreg::n_tracked_components++;
         }
 
     tracker_component(int in_id, std::shared_ptr<tracker_element_map> e __attribute__((unused))) :
         tracker_element_map(in_id),
-        registered_fields{nullptr} {
+        registered_fields{nullptr},
+        modified_generation{current_generation()},
+        generation_slots{nullptr} {
             Globalreg::n_tracked_components++;
         }
 
     tracker_component(const tracker_component *p) :
         tracker_element_map(p),
-        registered_fields{nullptr} {
+        registered_fields{nullptr},
+        modified_generation{current_generation()},
+        generation_slots{nullptr} {
             Globalreg::n_tracked_components++;
         }
 
@@ -900,6 +1071,88 @@ public:
     shared_tracker_element get_child_path(const std::string& in_path);
     shared_tracker_element get_child_path(const std::vector<std::string>& in_path);
 
+    virtual shared_tracker_element get_sub_fallback(int id) override;
+    virtual extra_fields_t get_extra_fields() override;
+
+    // Modification generations.  Setting a field through the proxy functions stamps the
+    // field and the component with the current global generation; a client which wants
+    // only the changes advances the generation, and asks for the fields modified since
+    // the generation it was given last time.
+    static uint64_t current_generation() {
+        return global_generation.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t advance_generation() {
+        return global_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    uint64_t get_generation() const {
+        return modified_generation;
+    }
+
+    // Generation a field was last set through a proxy, or 0 if it never has been
+    uint64_t get_field_generation(int id) const {
+        if (field_generations == nullptr)
+            return 0;
+
+        auto slot = generation_slots->slot(id);
+
+        if (slot < 0)
+            return 0;
+
+        return field_generations[slot];
+    }
+
+    // Mark a field as modified; code which changes a field element directly instead of
+    // through a proxy can call this to report the change
+    void mark_modified(int id) {
+        if (derived_fields_depth != 0)
+            return;
+
+        modified_generation = current_generation();
+
+        if (field_generations == nullptr)
+            return;
+
+        auto slot = generation_slots->slot(id);
+
+        if (slot >= 0)
+            field_generations[slot] = modified_generation;
+    }
+
+    // Mark the component as modified without tracking a specific field
+    void mark_modified() {
+        if (derived_fields_depth != 0)
+            return;
+
+        modified_generation = current_generation();
+    }
+
+    // Fields set while the thread holds a derived_fields_scope aren't stamped as 
+    // modified.  pre_serialize uses it when refreshing fields derived from other state
+    // (counts of maps, serialization times), so that serializing a component doesn't 
+    // make it look modified to every client asking for changes.
+    class derived_fields_scope {
+    public:
+        derived_fields_scope() {
+            derived_fields_depth++;
+        }
+
+        derived_fields_scope(const derived_fields_scope&) = delete;
+        derived_fields_scope& operator=(const derived_fields_scope&) = delete;
+
+        ~derived_fields_scope() {
+            derived_fields_depth--;
+        }
+    };
+
+    // Summarize the fields modified since a generation, as a summary record with this
+    // component's id.  Sub-components contribute only their own modified fields, and
+    // fields which are never set through a proxy (such as maps and vectors) are 
+    // included whenever the component has been modified.  Returns nullptr when 
+    // nothing has been modified.
+    std::shared_ptr<tracker_element_mapvec> modified_since(uint64_t generation);
+
 protected:
     // Register a field via the entrytracker, using standard entrytracker build methods.
     // This field will be automatically assigned or created during the reservefields 
@@ -967,6 +1220,44 @@ protected:
         return id;
     }
 
+    // Register a numeric field which is stored inline in the component, at in_dest.  
+    // The class must declare __InlineFields, and the field should be mapped via
+    // the __ProxyInline calls.
+    template<typename T>
+    int register_inline_field(const std::string& in_name, const std::string& in_desc, T *in_dest) {
+        using element_t = typename tracker_inline_element<T>::type;
+
+        int id = 
+            Globalreg::globalreg->entrytracker->register_field(in_name, 
+                    tracker_element_factory<element_t>(), in_desc);
+
+        auto table = get_inline_fields();
+
+        if (table == nullptr)
+            throw std::runtime_error(fmt::format("inline field {} registered by a component "
+                        "with no inline field table", in_name));
+
+        if (!table->sealed) {
+            kis_lock_guard<kis_mutex> lk(table->mutex, "tracker_component register_inline_field");
+
+            auto existing = std::find_if(table->fields.begin(), table->fields.end(),
+                    [id](const inline_field& f) { return f.id == id; });
+
+            if (existing == table->fields.end())
+                table->fields.push_back(inline_field{id, 
+                        static_cast<size_t>(reinterpret_cast<char *>(in_dest) - 
+                            reinterpret_cast<char *>(this)),
+                        &materialize_inline<T>, &import_inline<T>});
+        }
+
+        return id;
+    }
+
+    // Table of inline fields, provided by __InlineFields
+    virtual inline_field_table *get_inline_fields() {
+        return nullptr;
+    }
+
     // Register field types and get a field ID.  Called during record creation, prior to 
     // assigning an existing trackerelement tree or creating a new one
     virtual void register_fields() { }
@@ -984,6 +1275,39 @@ protected:
     virtual shared_tracker_element import_or_new(std::shared_ptr<tracker_element_map> e, int i);
 
     std::vector<std::unique_ptr<registered_field>> *registered_fields;
+
+    static std::atomic<uint64_t> global_generation;
+    static thread_local unsigned int derived_fields_depth;
+
+    // Per-class slots of the field generations, by field id.  Filled in by the first 
+    // instance of a class to reserve its fields and immutable once sealed; fields a 
+    // class only registers later have no slot, and are reported with the component.
+    struct generation_slot_table {
+        generation_slot_table() :
+            sealed{false} { }
+
+        int slot(int id) const {
+            auto i = slots.find(id);
+
+            if (i == slots.end())
+                return -1;
+
+            return i->second;
+        }
+
+        std::atomic<bool> sealed;
+        kis_mutex mutex;
+        robin_hood::unordered_flat_map<int, int> slots;
+    };
+
+    static generation_slot_table *get_generation_slot_table(const std::type_info& type);
+
+    uint64_t modified_generation;
+
+    // Generation of each field by the slot in the class table, allocated when the 
+    // fields are reserved
+    generation_slot_table *generation_slots;
+    std::unique_ptr<uint64_t[]> field_generations;
 };
 
 
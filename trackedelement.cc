@@ -125,6 +125,64 @@ std::istream& operator>>(std::istream& is, device_key& k) {
 
 // New
 
+tracker_element_string_pool& tracker_element_string_pool::pool() {
+    // Never destroyed, pooled elements may outlive static destruction
+    static auto p = new tracker_element_string_pool();
+    return *p;
+}
+
+std::shared_ptr<tracker_element_string> tracker_element_string_pool::intern(int id, 
+        const std::string& value) {
+    auto& p = pool();
+
+    kis_lock_guard<kis_mutex> lk(p.mutex, "tracker_element_string_pool intern");
+
+    auto& id_strings = p.strings[id];
+
+    auto k = id_strings.find(value);
+    if (k != id_strings.end()) {
+        auto e = k->second.lock();
+        if (e != nullptr)
+            return e;
+    } else {
+        p.n_strings++;
+    }
+
+    // The pool entry is removed by the last reference; the id is captured since 
+    // the element id can be reassigned by the holders
+    auto e = std::shared_ptr<tracker_element_string>(new tracker_element_string(id, value),
+            [id](tracker_element_string *e) {
+                pool().release(e, id);
+                delete e;
+            });
+
+    id_strings[value] = e;
+
+    return e;
+}
+
+size_t tracker_element_string_pool::size() {
+    auto& p = pool();
+    kis_lock_guard<kis_mutex> lk(p.mutex, "tracker_element_string_pool size");
+    return p.n_strings;
+}
+
+void tracker_element_string_pool::release(tracker_element_string *e, int id) {
+    kis_lock_guard<kis_mutex> lk(mutex, "tracker_element_string_pool release");
+
+    auto i = strings.find(id);
+    if (i == strings.end())
+        return;
+
+    auto k = i->second.find(e->get());
+
+    // Only remove the entry if it hasn't been replaced by a new live element
+    if (k != i->second.end() && k->second.expired()) {
+        i->second.erase(k);
+        n_strings--;
+    }
+}
+
 void tracker_element_string::coercive_set(const std::string& in_str) {
     value = in_str;
 }
@@ -195,6 +253,30 @@ void tracker_element_mac_addr::coercive_set(const shared_tracker_element& e) {
     }
 }
 
+void tracker_element_ipv4_addr::coercive_set(const std::string& in_str) {
+    struct in_addr addr;
+
+    if (inet_aton(in_str.c_str(), &addr) != 1)
+        throw std::runtime_error("Could not coerce string to IPv4 address");
+
+    value = addr.s_addr;
+}
+
+void tracker_element_ipv4_addr::coercive_set(double in_num) {
+    throw std::runtime_error("Cannot coerce IPv4 address from number");
+}
+
+void tracker_element_ipv4_addr::coercive_set(const shared_tracker_element& e) {
+    switch (e->get_type()) {
+        case tracker_type::tracker_ipv4_addr:
+            value = static_cast<tracker_element_ipv4_addr *>(e.get())->get();
+            break;
+        default:
+            throw std::runtime_error(fmt::format("Could not coerce {} to {}",
+                        e->get_type_as_string(), get_type_as_string()));
+    }
+}
+
 std::string tracker_element::type_to_string(tracker_type t) {
     switch (t) {
         case tracker_type::tracker_unassigned:
@@ -661,6 +743,20 @@ template<> void set_tracker_value(const shared_tracker_element& e, const device_
     static_cast<tracker_element_device_key *>(e.get())->set(v);
 }
 
+int tracker_element_serializer::serialize_summary(std::shared_ptr<tracker_element_vector> in_vec,
+        const std::vector<SharedElementSummary>& summary, std::ostream& stream) {
+    tracker_element_summary_arena arena;
+    auto name_map = arena.make_rename_map();
+    auto sum_vec = Globalreg::new_from_pool<tracker_element_vector>();
+
+    for (const auto& i : *in_vec)
+        sum_vec->push_back(summarize_tracker_element(i, summary, name_map));
+
+    return serialize(sum_vec, stream, name_map);
+}
+
+thread_local bool tracker_element_serializer::parallel_ok = false;
+
 void tracker_element_serializer::pre_serialize_path(const SharedElementSummary& in_summary) {
 
     // Iterate through the path on this object, calling pre-serialize as
@@ -1226,11 +1322,23 @@ std::vector<shared_tracker_element> get_tracker_element_multi_path(const std::ve
     return ret;
 }
 
+// Allocate part of a summary from the arena of the rename map, or from the object
+// pool when the rename map isn't arena-backed
+template<typename T>
+std::shared_ptr<T> summary_alloc(const std::shared_ptr<tracker_element_serializer::rename_map>& rename_map) {
+    auto res = rename_map != nullptr ? rename_map->get_allocator().resource() : nullptr;
+
+    if (res == nullptr || res == std::pmr::get_default_resource())
+        return Globalreg::new_from_pool<T>();
+
+    return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(res));
+}
+
 std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<tracker_element_vector> elem,
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_vector>();
+    auto ret = summary_alloc<tracker_element_vector>(rename_map);
 
     for (const auto& i : *elem)
         ret->push_back(summarize_tracker_element(i, summary, rename_map));
@@ -1242,7 +1350,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_int_map>();
+    auto ret = summary_alloc<tracker_element_int_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1254,7 +1362,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_double_map>();
+    auto ret = summary_alloc<tracker_element_double_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1266,7 +1374,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_string_map>();
+    auto ret = summary_alloc<tracker_element_string_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1278,7 +1386,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_mac_map>();
+    auto ret = summary_alloc<tracker_element_mac_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1290,7 +1398,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_macfilter_map>();
+    auto ret = summary_alloc<tracker_element_macfilter_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1302,7 +1410,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_device_key_map>();
+    auto ret = summary_alloc<tracker_element_device_key_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1314,7 +1422,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_uuid_map>();
+    auto ret = summary_alloc<tracker_element_uuid_map>(rename_map);
 
     for (const auto& i : *elem) 
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1326,7 +1434,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>& summary,
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
-    auto ret = Globalreg::new_from_pool<tracker_element_hashkey_map>();
+    auto ret = summary_alloc<tracker_element_hashkey_map>(rename_map);
 
     for (const auto& i : *elem)
         ret->insert(i.first, summarize_tracker_element(i.second, summary, rename_map));
@@ -1339,7 +1447,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
 
     // Always return a map
-    auto ret_elem = Globalreg::new_from_pool<tracker_element_mapvec>();
+    auto ret_elem = summary_alloc<tracker_element_mapvec>(rename_map);
 
     if (in == nullptr)
         return ret_elem;
@@ -1397,9 +1505,13 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         shared_tracker_element f = get_tracker_element_path(si->resolved_path, in);
 
         if (f == nullptr) {
-            f = Globalreg::globalreg->entrytracker->register_and_get_field(fmt::format("unknown{}", fn),
-                    tracker_element_factory<tracker_element_placeholder>(),
-                    "unallocated field");
+            auto placeholder_id = 
+                Globalreg::globalreg->entrytracker->register_field(fmt::format("unknown{}", fn),
+                        tracker_element_factory<tracker_element_placeholder>(),
+                        "unallocated field");
+
+            f = summary_alloc<tracker_element_placeholder>(rename_map);
+            f->set_id(placeholder_id);
 
             std::static_pointer_cast<tracker_element_placeholder>(f)->set(0);
         
@@ -1422,7 +1534,7 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         // object so that when we serialize we can descend the path calling
         // the proper pre-serialization methods
         if (si->rename.length() != 0 || si->resolved_path.size() > 1) {
-            auto sum = Globalreg::new_from_pool<tracker_element_summary>();
+            auto sum = summary_alloc<tracker_element_summary>(rename_map);
             sum->assign(si);
             sum->parent_element = in;
             (*rename_map)[f] = sum;
@@ -1621,3 +1733,312 @@ bool fast_sort_tracker_element_less(const std::shared_ptr<tracker_element> lhs,
     return false;
 }
 
+
+namespace {
+    // Shared elements are allocated along with their shared_ptr control block
+    constexpr size_t shared_element_overhead = 16;
+
+    size_t string_heap_size(const std::string& s) {
+        // Short strings are held in the string itself
+        if (s.capacity() <= 15)
+            return 0;
+
+        return s.capacity() + 1;
+    }
+
+    size_t value_size_estimate(const shared_tracker_element& v) {
+        return tracker_element_size_estimate(v);
+    }
+
+    template<typename T>
+    size_t value_size_estimate(const T&) {
+        return 0;
+    }
+
+    template<typename M>
+    size_t map_size_estimate(const shared_tracker_element& e) {
+        auto m = static_cast<M *>(e.get());
+        size_t sz = sizeof(M) + shared_element_overhead;
+
+        for (const auto& i : *m)
+            sz += sizeof(typename M::pair) + value_size_estimate(i.second);
+
+        return sz;
+    }
+
+    template<typename V>
+    size_t vector_size_estimate(const shared_tracker_element& e) {
+        auto v = static_cast<V *>(e.get());
+        size_t sz = sizeof(V) + shared_element_overhead +
+            v->capacity() * sizeof(typename V::vector_t::value_type);
+
+        for (const auto& i : *v)
+            sz += value_size_estimate(i);
+
+        return sz;
+    }
+}
+
+size_t tracker_element_size_estimate(const shared_tracker_element& e) {
+    if (e == nullptr)
+        return 0;
+
+    switch (e->get_type()) {
+        case tracker_type::tracker_string:
+        case tracker_type::tracker_byte_array:
+            return sizeof(tracker_element_string) + shared_element_overhead +
+                string_heap_size(static_cast<tracker_element_string *>(e.get())->get());
+        case tracker_type::tracker_int8:
+        case tracker_type::tracker_uint8:
+        case tracker_type::tracker_placeholder_missing:
+            return sizeof(tracker_element_uint8) + shared_element_overhead;
+        case tracker_type::tracker_int16:
+        case tracker_type::tracker_uint16:
+        case tracker_type::tracker_int32:
+        case tracker_type::tracker_uint32:
+        case tracker_type::tracker_int64:
+        case tracker_type::tracker_uint64:
+        case tracker_type::tracker_float:
+        case tracker_type::tracker_double:
+            return sizeof(tracker_element_uint64) + shared_element_overhead;
+        case tracker_type::tracker_mac_addr:
+            return sizeof(tracker_element_mac_addr) + shared_element_overhead;
+        case tracker_type::tracker_uuid:
+            return sizeof(tracker_element_uuid) + shared_element_overhead;
+        case tracker_type::tracker_key:
+            return sizeof(tracker_element_device_key) + shared_element_overhead;
+        case tracker_type::tracker_ipv4_addr:
+            return sizeof(tracker_element_ipv4_addr) + shared_element_overhead;
+        case tracker_type::tracker_pair_double:
+            return sizeof(tracker_element_pair_double) + shared_element_overhead;
+        case tracker_type::tracker_alias:
+            // The aliased element is counted where it lives
+            return sizeof(tracker_element_alias) + shared_element_overhead;
+        case tracker_type::tracker_map:
+            return map_size_estimate<tracker_element_map>(e);
+        case tracker_type::tracker_int_map:
+            return map_size_estimate<tracker_element_int_map>(e);
+        case tracker_type::tracker_mac_map:
+            return map_size_estimate<tracker_element_mac_map>(e);
+        case tracker_type::tracker_macfilter_map:
+            return map_size_estimate<tracker_element_macfilter_map>(e);
+        case tracker_type::tracker_string_map:
+            return map_size_estimate<tracker_element_string_map>(e);
+        case tracker_type::tracker_double_map:
+            return map_size_estimate<tracker_element_double_map>(e);
+        case tracker_type::tracker_key_map:
+            return map_size_estimate<tracker_element_device_key_map>(e);
+        case tracker_type::tracker_uuid_map:
+            return map_size_estimate<tracker_element_uuid_map>(e);
+        case tracker_type::tracker_hashkey_map:
+            return map_size_estimate<tracker_element_hashkey_map>(e);
+        case tracker_type::tracker_double_map_double:
+            return map_size_estimate<tracker_element_double_map_double>(e);
+        case tracker_type::tracker_vector:
+            return vector_size_estimate<tracker_element_vector>(e);
+        case tracker_type::tracker_summary_mapvec:
+            return vector_size_estimate<tracker_element_mapvec>(e);
+        case tracker_type::tracker_vector_double:
+            return vector_size_estimate<tracker_element_vector_double>(e);
+        case tracker_type::tracker_vector_string: {
+            auto sz = vector_size_estimate<tracker_element_vector_string>(e);
+
+            for (const auto& s : *static_cast<tracker_element_vector_string *>(e.get()))
+                sz += string_heap_size(s);
+
+            return sz;
+        }
+        case tracker_type::tracker_unassigned:
+            break;
+    }
+
+    return 0;
+}
+
+namespace {
+    template<typename T>
+    shared_tracker_element scalar_snapshot(const shared_tracker_element& e) {
+        auto r = Globalreg::new_from_pool<T>();
+        r->set_id(e->get_id());
+        r->set(static_cast<T *>(e.get())->get());
+        return r;
+    }
+
+    using snapshot_rename_map = tracker_element_serializer::rename_map;
+
+    shared_tracker_element element_snapshot(const shared_tracker_element& e,
+            snapshot_rename_map *renames);
+
+    shared_tracker_element value_snapshot(const shared_tracker_element& v,
+            snapshot_rename_map *renames) {
+        return element_snapshot(v, renames);
+    }
+
+    template<typename T>
+    const T& value_snapshot(const T& v, snapshot_rename_map *renames) {
+        return v;
+    }
+
+    template<typename M>
+    shared_tracker_element map_snapshot(const shared_tracker_element& e,
+            snapshot_rename_map *renames) {
+        auto m = static_cast<M *>(e.get());
+        auto r = Globalreg::new_from_pool<M>();
+        r->set_id(e->get_id());
+        r->set_as_vector(m->as_vector());
+        r->set_as_key_vector(m->as_key_vector());
+
+        for (const auto& i : *m)
+            r->get().insert({i.first, value_snapshot(i.second, renames)});
+
+        return r;
+    }
+
+    template<typename V>
+    shared_tracker_element vector_snapshot(const shared_tracker_element& e,
+            snapshot_rename_map *renames) {
+        auto v = static_cast<V *>(e.get());
+        auto r = Globalreg::new_from_pool<V>();
+        r->set_id(e->get_id());
+        r->get().reserve(v->size());
+
+        for (const auto& i : *v)
+            r->get().push_back(value_snapshot(i, renames));
+
+        return r;
+    }
+
+    shared_tracker_element element_copy(const shared_tracker_element& e,
+            snapshot_rename_map *renames);
+
+    // Copy an element, carrying any rename of the original over to the copy.  The
+    // copy only takes the name; the path back to the original is left empty so that
+    // serializing the copy doesn't pre-serialize the original outside of its lock.
+    shared_tracker_element element_snapshot(const shared_tracker_element& e,
+            snapshot_rename_map *renames) {
+        auto r = element_copy(e, renames);
+
+        if (renames != nullptr && r != nullptr) {
+            auto ri = renames->find(e);
+            if (ri != renames->end() && ri->second->rename.length() != 0) {
+                auto rs = std::make_shared<tracker_element_summary>();
+                rs->rename = ri->second->rename;
+                renames->emplace(r, rs);
+            }
+        }
+
+        return r;
+    }
+
+    shared_tracker_element element_copy(const shared_tracker_element& e,
+            snapshot_rename_map *renames) {
+        if (e == nullptr)
+            return nullptr;
+
+        switch (e->get_type()) {
+            case tracker_type::tracker_string:
+                return scalar_snapshot<tracker_element_string>(e);
+            case tracker_type::tracker_byte_array:
+                return scalar_snapshot<tracker_element_byte_array>(e);
+            case tracker_type::tracker_int8:
+                return scalar_snapshot<tracker_element_int8>(e);
+            case tracker_type::tracker_uint8:
+                return scalar_snapshot<tracker_element_uint8>(e);
+            case tracker_type::tracker_int16:
+                return scalar_snapshot<tracker_element_int16>(e);
+            case tracker_type::tracker_uint16:
+                return scalar_snapshot<tracker_element_uint16>(e);
+            case tracker_type::tracker_int32:
+                return scalar_snapshot<tracker_element_int32>(e);
+            case tracker_type::tracker_uint32:
+                return scalar_snapshot<tracker_element_uint32>(e);
+            case tracker_type::tracker_int64:
+                return scalar_snapshot<tracker_element_int64>(e);
+            case tracker_type::tracker_uint64:
+                return scalar_snapshot<tracker_element_uint64>(e);
+            case tracker_type::tracker_float:
+                return scalar_snapshot<tracker_element_float>(e);
+            case tracker_type::tracker_double:
+                return scalar_snapshot<tracker_element_double>(e);
+            case tracker_type::tracker_mac_addr:
+                return scalar_snapshot<tracker_element_mac_addr>(e);
+            case tracker_type::tracker_uuid:
+                return scalar_snapshot<tracker_element_uuid>(e);
+            case tracker_type::tracker_key:
+                return scalar_snapshot<tracker_element_device_key>(e);
+            case tracker_type::tracker_ipv4_addr:
+                return scalar_snapshot<tracker_element_ipv4_addr>(e);
+            case tracker_type::tracker_pair_double: {
+                auto r = Globalreg::new_from_pool<tracker_element_pair_double>();
+                const auto& p = static_cast<tracker_element_pair_double *>(e.get())->get();
+                r->set_id(e->get_id());
+                r->set(p.first, p.second);
+                return r;
+            }
+            case tracker_type::tracker_placeholder_missing: {
+                auto r = Globalreg::new_from_pool<tracker_element_placeholder>();
+                r->set_id(e->get_id());
+                r->set_name(static_cast<tracker_element_placeholder *>(e.get())->get_name());
+                return r;
+            }
+            case tracker_type::tracker_alias: {
+                auto a = static_cast<tracker_element_alias *>(e.get());
+                auto r = Globalreg::new_from_pool<tracker_element_alias>();
+                r->set_id(e->get_id());
+                r->set_name(a->get_alias_name());
+                r->set(element_snapshot(a->get(), renames));
+                return r;
+            }
+            case tracker_type::tracker_map: {
+                // Components are copied as plain maps, with their inline fields as
+                // elements; pre-serializing them lets them update any derived fields,
+                // the same as serializing them directly would
+                e->pre_serialize();
+                auto r = map_snapshot<tracker_element_map>(e, renames);
+                for (const auto& i : static_cast<tracker_element_map *>(e.get())->get_extra_fields())
+                    static_cast<tracker_element_map *>(r.get())->insert(i.second);
+                e->post_serialize();
+                return r;
+            }
+            case tracker_type::tracker_int_map:
+                return map_snapshot<tracker_element_int_map>(e, renames);
+            case tracker_type::tracker_mac_map:
+                return map_snapshot<tracker_element_mac_map>(e, renames);
+            case tracker_type::tracker_macfilter_map:
+                return map_snapshot<tracker_element_macfilter_map>(e, renames);
+            case tracker_type::tracker_string_map:
+                return map_snapshot<tracker_element_string_map>(e, renames);
+            case tracker_type::tracker_double_map:
+                return map_snapshot<tracker_element_double_map>(e, renames);
+            case tracker_type::tracker_key_map:
+                return map_snapshot<tracker_element_device_key_map>(e, renames);
+            case tracker_type::tracker_uuid_map:
+                return map_snapshot<tracker_element_uuid_map>(e, renames);
+            case tracker_type::tracker_hashkey_map:
+                return map_snapshot<tracker_element_hashkey_map>(e, renames);
+            case tracker_type::tracker_double_map_double:
+                return map_snapshot<tracker_element_double_map_double>(e, renames);
+            case tracker_type::tracker_vector:
+                return vector_snapshot<tracker_element_vector>(e, renames);
+            case tracker_type::tracker_summary_mapvec:
+                return vector_snapshot<tracker_element_mapvec>(e, renames);
+            case tracker_type::tracker_vector_double:
+                return vector_snapshot<tracker_element_vector_double>(e, renames);
+            case tracker_type::tracker_vector_string:
+                return vector_snapshot<tracker_element_vector_string>(e, renames);
+            case tracker_type::tracker_unassigned:
+                break;
+        }
+
+        return nullptr;
+    }
+}
+
+shared_tracker_element tracker_element_snapshot(const shared_tracker_element& e) {
+    return element_snapshot(e, nullptr);
+}
+
+shared_tracker_element tracker_element_snapshot(const shared_tracker_element& e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map) {
+    return element_snapshot(e, name_map.get());
+}
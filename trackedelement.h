@@ -36,11 +36,13 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <unordered_map>
 
 #include "fmt.h"
 #include "globalregistry.h"
 #include "nlohmann/json.hpp"
+#include "kis_mem_account.h"
 #include "kis_mutex.h"
 #include "macaddr.h"
 #include "robin_hood.h"
@@ -107,12 +109,35 @@ std::istream& operator>>(std::istream& is, device_key& k);
 
 template <>struct fmt::formatter<device_key> : fmt::ostream_formatter {};
 
+// Device keys differ mostly in the low octets of the MAC and in a handful of phy and
+// source keys, so both halves are folded together and run through the murmur3
+// finalizer; every bit of the hash then depends on every bit of the key, which
+// keeps the open-addressed maps and the shard selection evenly spread
+inline std::size_t device_key_hash(uint64_t spkey, uint64_t dkey) noexcept {
+    uint64_t h = dkey ^ (spkey * 0x9E3779B97F4A7C15ULL);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return static_cast<std::size_t>(h);
+}
+
 namespace std {
     template<> struct hash<device_key> {
         std::size_t operator()(device_key const& d) const noexcept {
-            std::size_t h1 = std::hash<uint64_t>{}(d.get_spkey());
-            std::size_t h2 = std::hash<uint64_t>{}(d.get_dkey());
-            return h1 ^ (h2 << 1);
+            return device_key_hash(d.get_spkey(), d.get_dkey());
+        }
+    };
+}
+
+// The key is already fully mixed, so robin_hood doesn't need to mix it again
+namespace robin_hood {
+    template<> struct hash<device_key> {
+        std::size_t operator()(device_key const& d) const noexcept {
+            return device_key_hash(d.get_spkey(), d.get_dkey());
         }
     };
 }
@@ -210,6 +235,34 @@ enum class tracker_type {
 
 };
 
+// Counts the live elements of each type when memory accounting is enabled.  It is an
+// empty base of the core element classes, so it adds nothing to the size of an element;
+// E is the core class, whose size is counted.
+template<typename E, tracker_type T>
+class tracker_element_mem_tag {
+protected:
+    tracker_element_mem_tag() {
+        if (kis_mem_account::active()) {
+            auto c = kis_mem_account::tracked_counter(static_cast<int>(T));
+            if (c != nullptr)
+                c->add(sizeof(E));
+        }
+    }
+
+    tracker_element_mem_tag(const tracker_element_mem_tag&) :
+        tracker_element_mem_tag() { }
+
+    tracker_element_mem_tag& operator=(const tracker_element_mem_tag&) = default;
+
+    ~tracker_element_mem_tag() {
+        if (kis_mem_account::active()) {
+            auto c = kis_mem_account::tracked_counter(static_cast<int>(T));
+            if (c != nullptr)
+                c->remove(sizeof(E));
+        }
+    }
+};
+
 class tracker_element {
 public:
     tracker_element() : 
@@ -358,7 +411,8 @@ constexpr17 C tracker_element_clone_adaptor(C p) {
 // Aliased element used to link one element to anothers name, for instance to
 // allow the dot11 tracker a way to link the most recently used ssid from the
 // map to a custom field
-class tracker_element_alias : public tracker_element {
+class tracker_element_alias : public tracker_element,
+    private tracker_element_mem_tag<tracker_element_alias, tracker_type::tracker_alias> {
 public:
     tracker_element_alias() :
         tracker_element() { }
@@ -449,8 +503,28 @@ protected:
 
 // Superclass for generic components for pod-like scalar attributes, though
 // they don't need to be explicitly POD
+// Element type of each scalar value type, for accounting; byte arrays are counted as
+// strings
+template<class P> struct tracker_scalar_type;
+template<> struct tracker_scalar_type<std::string> {
+    static constexpr tracker_type type = tracker_type::tracker_string;
+};
+template<> struct tracker_scalar_type<device_key> {
+    static constexpr tracker_type type = tracker_type::tracker_key;
+};
+template<> struct tracker_scalar_type<uuid> {
+    static constexpr tracker_type type = tracker_type::tracker_uuid;
+};
+template<> struct tracker_scalar_type<mac_addr> {
+    static constexpr tracker_type type = tracker_type::tracker_mac_addr;
+};
+template<> struct tracker_scalar_type<uint32_t> {
+    static constexpr tracker_type type = tracker_type::tracker_ipv4_addr;
+};
+
 template <class P>
-class tracker_element_core_scalar : public tracker_element {
+class tracker_element_core_scalar : public tracker_element,
+    private tracker_element_mem_tag<tracker_element_core_scalar<P>, tracker_scalar_type<P>::type> {
 public:
     tracker_element_core_scalar() :
         tracker_element{} { }
@@ -582,6 +656,31 @@ public:
 
 };
 
+// Pool of shared string elements, so that records which hold the same string in the
+// same field (such as SSIDs seen by many devices) all reference a single element.  
+// Elements are keyed by field id and value, and removed from the pool when the last 
+// reference is released.
+//
+// Pooled elements are shared and must never be modified; to change the value, swap
+// in the pooled element for the new value (see __ProxyInterned)
+class tracker_element_string_pool {
+public:
+    static std::shared_ptr<tracker_element_string> intern(int id, const std::string& value);
+
+    // Number of distinct strings currently pooled
+    static size_t size();
+
+protected:
+    static tracker_element_string_pool& pool();
+
+    void release(tracker_element_string *e, int id);
+
+    kis_mutex mutex;
+    robin_hood::unordered_node_map<int, 
+        robin_hood::unordered_node_map<std::string, std::weak_ptr<tracker_element_string>>> strings;
+    size_t n_strings = 0;
+};
+
 class tracker_element_byte_array : public tracker_element_string {
 public:
     tracker_element_byte_array() :
@@ -934,7 +1033,8 @@ public:
 // Simplify numeric conversion w/ an interstitial scalar-like that holds all 
 // our numeric subclasses
 template<class N, tracker_type T = tracker_type::tracker_double, class S = numerical_string<N>>
-class tracker_element_core_numeric : public tracker_element {
+class tracker_element_core_numeric : public tracker_element,
+    private tracker_element_mem_tag<tracker_element_core_numeric<N, T, S>, T> {
 public:
     tracker_element_core_numeric() :
         tracker_element(),
@@ -1188,7 +1288,8 @@ using tracker_element_double = tracker_element_core_numeric<double, tracker_type
 // map;  alternate implementation available as core_unordered_map for structures which don't
 // need comparator operations
 template <typename MT, typename K, typename V, tracker_type T>
-class tracker_element_core_map : public tracker_element {
+class tracker_element_core_map : public tracker_element,
+    private tracker_element_mem_tag<tracker_element_core_map<MT, K, V, T>, T> {
 public:
     using map_t = MT;
     using iterator = typename map_t::iterator;
@@ -1309,8 +1410,14 @@ public:
         return map.find(k);
     }
 
+    // The robin_hood tables expect a valid entry, so erasing a key which isn't
+    // present must not reach them as end()
     iterator erase(const K& k) {
         iterator i = map.find(k);
+
+        if (i == map.end())
+            return i;
+
         return erase(i);
     }
 
@@ -1366,23 +1473,34 @@ protected:
     uint8_t present_set;
 };
 
+// Maps which are typically small and present in every record (component fields, 
+// per-client and per-source maps, frequency counts) store their entries inline in 
+// an open-addressing table instead of allocating a node per entry.  Entries move
+// on any insert (robin hood displacement as well as growth) and on any erase
+// (backward shift), so references, pointers, and iterators into the table must
+// not be held across an insert or erase on the same map; look the key up again
+// instead.  erase(iterator) still returns the next entry to visit, so erasing
+// while iterating is safe.
+template<typename K, typename V>
+using tracker_flat_map = robin_hood::unordered_flat_map<K, V>;
+
 // Dictionary / map-by-id
-class tracker_element_map : public tracker_element_core_map<robin_hood::unordered_node_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map> {
+class tracker_element_map : public tracker_element_core_map<tracker_flat_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map> {
 public:
     tracker_element_map() :
-        tracker_element_core_map<robin_hood::unordered_node_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map>() { }
+        tracker_element_core_map<tracker_flat_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map>() { }
 
     tracker_element_map(int id) :
-        tracker_element_core_map<robin_hood::unordered_node_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map>(id) { }
+        tracker_element_core_map<tracker_flat_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map>(id) { }
 
     tracker_element_map(const tracker_element_map *p) :
-        tracker_element_core_map<robin_hood::unordered_node_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map>(p) { }
+        tracker_element_core_map<tracker_flat_map<uint16_t, std::shared_ptr<tracker_element>>, uint16_t, std::shared_ptr<tracker_element>, tracker_type::tracker_map>(p) { }
 
     shared_tracker_element get_sub(int id) {
         auto v = map.find(id);
 
         if (v == map.end())
-            return NULL;
+            return get_sub_fallback(id);
 
         return v->second;
     }
@@ -1392,11 +1510,36 @@ public:
         auto v = map.find(id);
 
         if (v == map.end())
-            return NULL;
+            return std::static_pointer_cast<T>(get_sub_fallback(id));
 
         return std::static_pointer_cast<T>(v->second);
     }
 
+    // Fields which are not held as elements in the map, such as inline fields of
+    // tracker components, can be provided on lookup by subclasses
+    virtual shared_tracker_element get_sub_fallback(int id) {
+        return nullptr;
+    }
+
+    // The same fields, as elements built from their current values, for anything which
+    // walks every field of the map (serializers, snapshots); the map itself isn't 
+    // modified, so any number of readers can walk it at once
+    using extra_fields_t = std::vector<std::pair<uint16_t, shared_tracker_element>>;
+
+    virtual extra_fields_t get_extra_fields() {
+        return extra_fields_t();
+    }
+
+    // Call fn with each field in the map followed by each extra field
+    template<typename F>
+    void for_each_field(F&& fn) {
+        for (const auto& i : map)
+            fn(i);
+
+        for (const auto& i : get_extra_fields())
+            fn(i);
+    }
+
     std::pair<iterator, bool> insert(shared_tracker_element e) {
         if (e == NULL) 
             throw std::runtime_error("Attempted to insert null tracker_element with no ID");
@@ -1456,17 +1599,17 @@ public:
 };
 
 // int::element
-using tracker_element_int_map = tracker_element_core_map<robin_hood::unordered_node_map<int, std::shared_ptr<tracker_element>>, int, std::shared_ptr<tracker_element>, tracker_type::tracker_int_map>;
+using tracker_element_int_map = tracker_element_core_map<tracker_flat_map<int, std::shared_ptr<tracker_element>>, int, std::shared_ptr<tracker_element>, tracker_type::tracker_int_map>;
 
 // hash::element
-using tracker_element_hashkey_map = tracker_element_core_map<robin_hood::unordered_node_map<size_t, std::shared_ptr<tracker_element>>, size_t, std::shared_ptr<tracker_element>, tracker_type::tracker_hashkey_map>;
+using tracker_element_hashkey_map = tracker_element_core_map<tracker_flat_map<size_t, std::shared_ptr<tracker_element>>, size_t, std::shared_ptr<tracker_element>, tracker_type::tracker_hashkey_map>;
 
 // double::element
 using tracker_element_double_map = tracker_element_core_map<robin_hood::unordered_node_map<double, std::shared_ptr<tracker_element>>, double, std::shared_ptr<tracker_element>, tracker_type::tracker_double_map>;
 
 // mac::element, keyed as *unordered*, does not allow mask operations.  for generating mac maps which allow
 // masks, use tracker_element_macfilter_map
-using tracker_element_mac_map = tracker_element_core_map<robin_hood::unordered_node_map<mac_addr, std::shared_ptr<tracker_element>>, mac_addr, std::shared_ptr<tracker_element>, tracker_type::tracker_mac_map>;
+using tracker_element_mac_map = tracker_element_core_map<tracker_flat_map<mac_addr, std::shared_ptr<tracker_element>>, mac_addr, std::shared_ptr<tracker_element>, tracker_type::tracker_mac_map>;
 using tracker_element_macfilter_map = tracker_element_core_map<std::map<mac_addr, std::shared_ptr<tracker_element>>, mac_addr, std::shared_ptr<tracker_element>, tracker_type::tracker_mac_map>;
 
 // string::element
@@ -1478,11 +1621,12 @@ using tracker_element_device_key_map = tracker_element_core_map<robin_hood::unor
 using tracker_element_uuid_map = tracker_element_core_map<robin_hood::unordered_node_map<uuid, std::shared_ptr<tracker_element>>, uuid, std::shared_ptr<tracker_element>, tracker_type::tracker_uuid_map>;
 
 // double::double
-using tracker_element_double_map_double = tracker_element_core_map<robin_hood::unordered_node_map<double, double>, double, double, tracker_type::tracker_double_map_double>;
+using tracker_element_double_map_double = tracker_element_core_map<tracker_flat_map<double, double>, double, double, tracker_type::tracker_double_map_double>;
 
 // Core vector
 template<typename T, tracker_type TT>
-class tracker_element_core_vector : public tracker_element {
+class tracker_element_core_vector : public tracker_element,
+    private tracker_element_mem_tag<tracker_element_core_vector<T, TT>, TT> {
 public:
     using vector_t = std::vector<T>;
     using iterator = typename vector_t::iterator;
@@ -1606,6 +1750,10 @@ public:
         vector.reserve(cap);
     }
 
+    size_t capacity() const {
+        return vector.capacity();
+    }
+
     size_t size() const {
         return vector.size();
     }
@@ -1636,7 +1784,8 @@ using tracker_element_vector_double = tracker_element_core_vector<double, tracke
 using tracker_element_vector_string = tracker_element_core_vector<std::string, tracker_type::tracker_vector_string>;
 
 template<typename T1, typename T2, tracker_type TT>
-class tracker_element_core_pair : public tracker_element {
+class tracker_element_core_pair : public tracker_element,
+    private tracker_element_mem_tag<tracker_element_core_pair<T1, T2, TT>, TT> {
 public:
     using pair_t = std::pair<T1, T2>;
 
@@ -1778,6 +1927,18 @@ protected:
 
 using tracker_element_mapvec = tracker_element_core_vector<std::shared_ptr<tracker_element>, tracker_type::tracker_summary_mapvec>;
 
+// Rough estimate of the memory held by an element and everything under it, for memory
+// reports.  Aliases aren't followed, and component members which aren't fields (such as
+// the pointers kept to each field) aren't counted.
+size_t tracker_element_size_estimate(const shared_tracker_element& e);
+
+// Copy an element and everything under it, for serializing without holding the locks of
+// the original.  Components are copied as plain maps of their fields, and aliases are
+// copied along with a copy of the element they point to.  The copy is taken under the
+// locks which protect the original; the copy is never modified, so it can be serialized
+// by any number of readers at once.
+shared_tracker_element tracker_element_snapshot(const shared_tracker_element& e);
+
 // Templated generic access functions
 
 template<typename T> T get_tracker_value(const shared_tracker_element&);
@@ -1863,20 +2024,78 @@ class tracker_element_serializer {
 public:
     tracker_element_serializer() { }
 
-    using rename_map = std::map<shared_tracker_element, SharedElementSummary>;
+    // Rename maps carry their memory resource; summarizing into a rename map allocated
+    // from a tracker_element_summary_arena allocates the summary from the arena as well
+    using rename_map = std::pmr::map<shared_tracker_element, SharedElementSummary>;
 
     virtual ~tracker_element_serializer() { }
 
     virtual int serialize(shared_tracker_element in_elem, 
             std::ostream &stream, std::shared_ptr<rename_map> name_map) = 0;
 
+    // Serialize a vector of records, summarized by a compiled summary.  By default
+    // each record is summarized and the resulting vector serialized; serializers
+    // can override this to emit the summarized fields directly from the records.
+    virtual int serialize_summary(std::shared_ptr<tracker_element_vector> in_vec,
+            const std::vector<SharedElementSummary>& summary, std::ostream& stream);
+
     // Fields extracted from a summary path need to preserialize their parent
     // paths or updates may not happen in the expected fashion, serializers should
     // call this when necessary
     static void pre_serialize_path(const SharedElementSummary& in_summary);
     static void post_serialize_path(const SharedElementSummary& in_summary);
+
+    // Serializers may only split an element across worker threads while a parallel 
+    // scope is held by the serializing thread.  The caller vouches that no lock protects
+    // the element (such as a snapshot) and that it holds no lock the workers could 
+    // need, since the workers can't share the caller's locks.
+    class parallel_scope {
+    public:
+        parallel_scope() :
+            prev{parallel_ok} {
+            parallel_ok = true;
+        }
+
+        parallel_scope(const parallel_scope&) = delete;
+        parallel_scope& operator=(const parallel_scope&) = delete;
+
+        ~parallel_scope() {
+            parallel_ok = prev;
+        }
+
+    protected:
+        bool prev;
+    };
+
+    static bool parallel_allowed() {
+        return parallel_ok;
+    }
+
 protected:
     kis_mutex mutex;
+
+    static thread_local bool parallel_ok;
+};
+
+// Request-scoped arena for summarizing records.  The rename map from make_rename_map
+// allocates from the arena, and summarizing into it allocates the summarized records
+// and rename records from the arena instead of individually, so that they're released
+// in one shot when the arena is destroyed.
+//
+// The arena must outlive the rename map and everything summarized into it, and must 
+// only be summarized into from one thread at a time.
+class tracker_element_summary_arena {
+public:
+    tracker_element_summary_arena(size_t initial_sz = 64 * 1024) :
+        arena{initial_sz} { }
+
+    std::shared_ptr<tracker_element_serializer::rename_map> make_rename_map() {
+        return std::allocate_shared<tracker_element_serializer::rename_map>(
+                std::pmr::polymorphic_allocator<tracker_element_serializer::rename_map>(&arena));
+    }
+
+protected:
+    std::pmr::monotonic_buffer_resource arena;
 };
 
 // Get an element using path semantics
@@ -1956,6 +2175,11 @@ std::shared_ptr<tracker_element> summarize_tracker_element(std::shared_ptr<track
         const std::vector<std::shared_ptr<tracker_element_summary>>&,
         std::shared_ptr<tracker_element_serializer::rename_map>);
 
+// Snapshot a summarized element; the rename of any element copied is added to the rename
+// map for its copy, so the copy serializes with the same names as the original.
+shared_tracker_element tracker_element_snapshot(const shared_tracker_element& e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map);
+
 // Handle comparing fields
 bool sort_tracker_element_less(const std::shared_ptr<tracker_element> lhs, 
         const std::shared_ptr<tracker_element> rhs);
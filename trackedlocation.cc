@@ -259,8 +259,6 @@ void kis_tracked_location_full::reserve_fields(std::shared_ptr<tracker_element_m
 
 kis_tracked_location::kis_tracked_location() :
     tracker_component(0) {
-    agg_x = agg_y = agg_z = agg_a = 0;
-    num_avg = num_alt_avg = 0;
     last_location_time = 0;
 
     register_fields();
@@ -270,8 +268,6 @@ kis_tracked_location::kis_tracked_location() :
 kis_tracked_location::kis_tracked_location(int in_id) :
     tracker_component(in_id) { 
 
-    agg_x = agg_y = agg_z = agg_a = 0;
-    num_avg = num_alt_avg = 0;
     last_location_time = 0;
 
     register_fields();
@@ -281,8 +277,6 @@ kis_tracked_location::kis_tracked_location(int in_id) :
 kis_tracked_location::kis_tracked_location(int in_id, std::shared_ptr<tracker_element_map> e) : 
     tracker_component(in_id) {
 
-    agg_x = agg_y = agg_z = agg_a = 0;
-    num_avg = num_alt_avg = 0;
     last_location_time = 0;
 
     register_fields();
@@ -298,55 +292,96 @@ kis_tracked_location::kis_tracked_location(const kis_tracked_location *p) :
         __ImportId(last_loc_id, p);
         __ImportField(loc_fix, p);
 
+        last_location_time = 0;
+
         reserve_fields(nullptr);
 }
 
-void kis_tracked_location::add_loc_with_avg(double in_lat, double in_lon, double in_alt, 
-        unsigned int fix, double in_speed, double in_heading) {
-    add_loc(in_lat, in_lon, in_alt, fix, in_speed, in_heading);
+void kis_location_accumulator::add(double in_lat, double in_lon, double in_alt, 
+        unsigned int in_fix, double in_speed, double in_heading) {
+    num_loc++;
 
-    if (avg_loc == nullptr) {
-        // We probably have a last location; set the ID anyhow to make sure; if we don't,
-        // this is just a new(nullptr) which is also fine
-        avg_loc = Globalreg::new_from_pool<kis_tracked_location_triplet>(last_loc.get());
-        avg_loc->set_id(avg_loc_id);
-        insert(avg_loc);
+    last_lat = in_lat;
+    last_lon = in_lon;
+    last_alt = in_alt;
+    last_fix = in_fix;
+    last_speed = in_speed;
+    last_heading = in_heading;
+
+    if (in_lat < min_lat || min_lat == 0)
+        min_lat = in_lat;
+
+    if (in_lat > max_lat || max_lat == 0)
+        max_lat = in_lat;
+
+    if (in_lon < min_lon || min_lon == 0)
+        min_lon = in_lon;
+
+    if (in_lon > max_lon || max_lon == 0)
+        max_lon = in_lon;
+
+    if (in_fix > 2) {
+        if (in_alt < min_alt || min_alt == 0)
+            min_alt = in_alt;
+
+        if (in_alt > max_alt || max_alt == 0)
+            max_alt = in_alt;
     }
+}
 
-    // Convert to vector for average
+void kis_location_accumulator::add_avg(double in_lat, double in_lon, double in_alt, 
+        unsigned int in_fix) {
     double mod_lat = in_lat * M_PI / 180;
     double mod_lon = in_lon * M_PI / 180;
 
-    agg_x += cos(mod_lat) * cos(mod_lon);
-    agg_y += cos(mod_lat) * sin(mod_lon);
-    agg_z += sin(mod_lat);
+    num_avg++;
 
-    num_avg += 1;
+    mean_x += (cos(mod_lat) * cos(mod_lon) - mean_x) / num_avg;
+    mean_y += (cos(mod_lat) * sin(mod_lon) - mean_y) / num_avg;
+    mean_z += (sin(mod_lat) - mean_z) / num_avg;
 
-    if (fix > 2) {
-        agg_a += in_alt;
-        num_alt_avg += 1;
+    if (in_fix > 2) {
+        num_alt_avg++;
+        mean_alt += (in_alt - mean_alt) / num_alt_avg;
     }
 
-    double r_x = agg_x / num_avg;
-    double r_y = agg_y / num_avg;
-    double r_z = agg_z / num_avg;
+    if (num_avg == 1) {
+        first_lat = in_lat;
+        first_lon = in_lon;
+        first_alt = in_alt;
+        avg_fix = in_fix;
+    } else {
+        avg_fix = num_alt_avg > 0 ? 3 : 2;
+    }
 
-    double central_lon = atan2(r_y, r_x);
-    double central_sqr = sqrt(r_x * r_x + r_y * r_y);
-    double central_lat = atan2(r_z, central_sqr);
+    gettimeofday(&avg_time, NULL);
+}
 
-    double r_alt = 0;
+double kis_location_accumulator::avg_lat() const {
+    if (num_avg < 2)
+        return first_lat;
 
-    if (num_alt_avg > 0) 
-       r_alt =  agg_a / num_alt_avg;
+    return atan2(mean_z, sqrt(mean_x * mean_x + mean_y * mean_y)) * 180 / M_PI;
+}
 
-    // Use the incoming if we're the first packet
-    if (num_avg > 1)
-        avg_loc->set(central_lat * 180 / M_PI, central_lon * 180 / M_PI, 
-                     r_alt, num_alt_avg > 0 ? 3 : 2);
-    else
-        avg_loc->set(in_lat, in_lon, in_alt, fix);
+double kis_location_accumulator::avg_lon() const {
+    if (num_avg < 2)
+        return first_lon;
+
+    return atan2(mean_y, mean_x) * 180 / M_PI;
+}
+
+double kis_location_accumulator::avg_alt() const {
+    if (num_avg < 2)
+        return first_alt;
+
+    return mean_alt;
+}
+
+void kis_tracked_location::add_loc_with_avg(double in_lat, double in_lon, double in_alt, 
+        unsigned int fix, double in_speed, double in_heading) {
+    add_loc(in_lat, in_lon, in_alt, fix, in_speed, in_heading);
+    loc_acc.add_avg(in_lat, in_lon, in_alt, fix);
 }
 
 void kis_tracked_location::add_loc(double in_lat, double in_lon, double in_alt, 
@@ -356,6 +391,13 @@ void kis_tracked_location::add_loc(double in_lat, double in_lon, double in_alt,
         set_fix(fix);
     }
 
+    loc_acc.add(in_lat, in_lon, in_alt, fix, in_speed, in_heading);
+}
+
+void kis_tracked_location::materialize_locations() {
+    if (loc_acc.num_loc == 0)
+        return;
+
     if (min_loc == nullptr) {
         min_loc = Globalreg::new_from_pool<kis_tracked_location_triplet>();
         min_loc->set_id(min_loc_id);
@@ -374,45 +416,35 @@ void kis_tracked_location::add_loc(double in_lat, double in_lon, double in_alt,
         insert(last_loc);
     }
 
-    last_loc->set_location(in_lat, in_lon);
-    last_loc->set_alt(in_alt);
-    last_loc->set_fix(fix);
-    last_loc->set_speed(in_speed);
-    last_loc->set_heading(in_heading);
+    min_loc->set_location(loc_acc.min_lat, loc_acc.min_lon);
+    max_loc->set_location(loc_acc.max_lat, loc_acc.max_lon);
 
-    double min_lat = min_loc->get_lat();
-    double max_lat = max_loc->get_lat();
-    double min_lon = min_loc->get_lon();
-    double max_lon = max_loc->get_lon();
+    if (loc_acc.min_alt != 0)
+        min_loc->set_alt(loc_acc.min_alt);
 
-    if (in_lat < min_loc->get_lat() || min_loc->get_lat() == 0) {
-        min_lat = in_lat;
-    }
+    if (loc_acc.max_alt != 0)
+        max_loc->set_alt(loc_acc.max_alt);
 
-    if (in_lat > max_loc->get_lat() || max_loc->get_lat() == 0) {
-        max_lat = in_lat; 
-    }
+    last_loc->set_location(loc_acc.last_lat, loc_acc.last_lon);
+    last_loc->set_alt(loc_acc.last_alt);
+    last_loc->set_fix(loc_acc.last_fix);
+    last_loc->set_speed(loc_acc.last_speed);
+    last_loc->set_heading(loc_acc.last_heading);
 
-    if (in_lon < min_loc->get_lon() || min_loc->get_lon() == 0) {
-        min_lon = in_lon;
-    }
+    if (loc_acc.num_avg == 0)
+        return;
 
-    if (in_lon > max_loc->get_lon() || max_loc->get_lon() == 0) {
-        max_lon = in_lon;
+    if (avg_loc == nullptr) {
+        avg_loc = Globalreg::new_from_pool<kis_tracked_location_triplet>();
+        avg_loc->set_id(avg_loc_id);
+        insert(avg_loc);
     }
 
-    min_loc->set_location(min_lat, min_lon);
-    max_loc->set_location(max_lat, max_lon);
-
-    if (fix > 2) {
-        if (in_alt < min_loc->get_alt() || min_loc->get_alt() == 0) {
-            min_loc->set_alt(in_alt);
-        }
-
-        if (in_alt > max_loc->get_alt() || max_loc->get_alt() == 0) {
-            max_loc->set_alt(in_alt);
-        }
-    }
+    avg_loc->set_location(loc_acc.avg_lat(), loc_acc.avg_lon());
+    avg_loc->set_alt(loc_acc.avg_alt());
+    avg_loc->set_fix(loc_acc.avg_fix);
+    avg_loc->set_time_sec(loc_acc.avg_time.tv_sec);
+    avg_loc->set_time_usec(loc_acc.avg_time.tv_usec);
 }
 
 void kis_tracked_location::register_fields() {
@@ -434,3 +466,155 @@ void kis_tracked_location::register_fields() {
                 "Last location", &last_loc);
 }
 
+kis_location_sample kis_location_reservoir::average() const {
+    kis_location_sample r;
+
+    if (samples.size() == 0)
+        return r;
+
+    double avg_x = 0, avg_y = 0, avg_z = 0, avg_alt = 0;
+    double heading = 0, speed = 0, signal = 0, timesec = 0, frequency = 0;
+    unsigned int num_alt = 0, num_signal = 0;
+
+    for (const auto& s : samples) {
+        // Convert to vector for average
+        double mod_lat = s.lat * M_PI / 180;
+        double mod_lon = s.lon * M_PI / 180;
+
+        avg_x += cos(mod_lat) * cos(mod_lon);
+        avg_y += cos(mod_lat) * sin(mod_lon);
+        avg_z += sin(mod_lat);
+
+        if (s.alt != 0) {
+            avg_alt += s.alt;
+            num_alt++;
+        }
+
+        heading += s.heading;
+        speed += s.speed;
+
+        if (s.signal != 0) {
+            signal += s.signal;
+            num_signal++;
+        }
+
+        timesec += s.time_sec;
+        frequency += s.frequency;
+    }
+
+    double n = samples.size();
+
+    double r_x = avg_x / n;
+    double r_y = avg_y / n;
+    double r_z = avg_z / n;
+
+    r.lon = atan2(r_y, r_x) * 180 / M_PI;
+    r.lat = atan2(r_z, sqrt(r_x * r_x + r_y * r_y)) * 180 / M_PI;
+
+    if (num_alt > 0)
+        r.alt = avg_alt / num_alt;
+
+    if (num_signal > 0)
+        r.signal = signal / num_signal;
+
+    r.heading = heading / n;
+    r.speed = speed / n;
+    r.time_sec = timesec / n;
+    r.frequency = frequency / n;
+
+    return r;
+}
+
+void kis_location_rrd::add_sample(const kis_location_sample& in_sample) {
+    set_int_last_sample_ts(in_sample.time_sec);
+
+    reservoir_100.push(in_sample);
+
+    // We've gotten 100 samples, cascade up to our next bucket
+    if (++samples_100_cascade >= 100) {
+        samples_100_cascade = 0;
+
+        reservoir_10k.push(reservoir_100.average());
+
+        // If we've gotten 100 samples in the 10k bucket, cascade up again
+        if (++samples_10k_cascade >= 100) {
+            samples_10k_cascade = 0;
+
+            reservoir_1m.push(reservoir_10k.average());
+        }
+    }
+}
+
+void kis_location_rrd::pre_serialize() {
+    tracker_component::pre_serialize();
+
+    materialize_samples(samples_100, reservoir_100);
+    materialize_samples(samples_10k, reservoir_10k);
+    materialize_samples(samples_1m, reservoir_1m);
+}
+
+void kis_location_rrd::reserve_fields(std::shared_ptr<tracker_element_map> e) {
+    tracker_component::reserve_fields(e);
+
+    samples_100_cascade = 0;
+    samples_10k_cascade = 0;
+
+    if (e != nullptr) {
+        absorb_samples(samples_100, reservoir_100);
+        absorb_samples(samples_10k, reservoir_10k);
+        absorb_samples(samples_1m, reservoir_1m);
+    }
+}
+
+kis_location_sample kis_location_rrd::sample_of(kis_historic_location *in_loc) {
+    kis_location_sample s;
+
+    s.lat = in_loc->get_lat();
+    s.lon = in_loc->get_lon();
+    s.alt = in_loc->get_alt();
+    s.heading = in_loc->get_heading();
+    s.speed = in_loc->get_speed();
+    s.signal = in_loc->get_signal();
+    s.frequency = in_loc->get_frequency();
+    s.time_sec = in_loc->get_time_sec();
+
+    return s;
+}
+
+void kis_location_rrd::materialize_samples(std::shared_ptr<tracker_element_vector> in_vec,
+        const kis_location_reservoir& in_reservoir) {
+    if (in_vec->size() > in_reservoir.size())
+        in_vec->erase(in_vec->begin() + in_reservoir.size(), in_vec->end());
+
+    for (size_t i = 0; i < in_reservoir.size(); i++) {
+        std::shared_ptr<kis_historic_location> hl;
+
+        if (i < in_vec->size()) {
+            hl = std::static_pointer_cast<kis_historic_location>((*in_vec)[i]);
+        } else {
+            hl = Globalreg::new_from_pool<kis_historic_location>(historic_location_builder.get());
+            in_vec->push_back(hl);
+        }
+
+        const auto& s = in_reservoir.at(i);
+
+        hl->set_lat(s.lat);
+        hl->set_lon(s.lon);
+        hl->set_alt(s.alt);
+        hl->set_heading(s.heading);
+        hl->set_speed(s.speed);
+        hl->set_signal(s.signal);
+        hl->set_frequency(s.frequency);
+        hl->set_time_sec(s.time_sec);
+    }
+}
+
+void kis_location_rrd::absorb_samples(std::shared_ptr<tracker_element_vector> in_vec,
+        kis_location_reservoir& in_reservoir) {
+    for (const auto& g : *in_vec) {
+        auto hl = std::dynamic_pointer_cast<kis_historic_location>(g);
+
+        if (hl != nullptr)
+            in_reservoir.push(sample_of(hl.get()));
+    }
+}
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <sys/time.h>
 #include <list>
 #include <map>
 #include <vector>
@@ -160,6 +161,59 @@ protected:
     uint16_t magheading_id;
 };
 
+// Running location statistics, kept as plain values and only turned into tracked
+// location elements when serialized.  Locations are added for every packet with GPS,
+// so updating them must not touch any tracked elements.
+struct kis_location_accumulator {
+    kis_location_accumulator() {
+        reset();
+    }
+
+    void reset() {
+        num_loc = 0;
+        min_lat = min_lon = max_lat = max_lon = 0;
+        min_alt = max_alt = 0;
+        last_lat = last_lon = last_alt = last_speed = last_heading = 0;
+        last_fix = 0;
+
+        num_avg = num_alt_avg = 0;
+        mean_x = mean_y = mean_z = mean_alt = 0;
+        first_lat = first_lon = first_alt = 0;
+        avg_fix = 0;
+        avg_time.tv_sec = avg_time.tv_usec = 0;
+    }
+
+    // Bounding box and last location
+    void add(double in_lat, double in_lon, double in_alt, unsigned int in_fix,
+            double in_speed, double in_heading);
+
+    // Running average; means are updated incrementally (Welford) instead of from
+    // unbounded sums
+    void add_avg(double in_lat, double in_lon, double in_alt, unsigned int in_fix);
+
+    // Average location; the first sample is used as-is
+    double avg_lat() const;
+    double avg_lon() const;
+    double avg_alt() const;
+
+    uint64_t num_loc;
+
+    // Zero is treated as unset, as it always has been for the bounding box
+    double min_lat, min_lon, max_lat, max_lon;
+    double min_alt, max_alt;
+
+    double last_lat, last_lon, last_alt, last_speed, last_heading;
+    unsigned int last_fix;
+
+    // Average of the position as a unit vector, so it holds up across the 
+    // antimeridian, and of the altitude of 3d fixes
+    uint64_t num_avg, num_alt_avg;
+    double mean_x, mean_y, mean_z, mean_alt;
+    double first_lat, first_lon, first_alt;
+    unsigned int avg_fix;
+    struct timeval avg_time;
+};
+
 class kis_tracked_location : public tracker_component {
 public:
     kis_tracked_location();
@@ -186,14 +240,37 @@ public:
         return get_fix() >= 2;
     }
 
-    bool has_min_loc() { return min_loc != nullptr; }
-    std::shared_ptr<kis_tracked_location_triplet> get_min_loc() { return min_loc; }
-    bool has_max_loc() { return max_loc != nullptr; }
-    std::shared_ptr<kis_tracked_location_triplet> get_max_loc() { return max_loc; }
-    bool has_avg_loc() { return avg_loc != nullptr; }
-    std::shared_ptr<kis_tracked_location_triplet> get_avg_loc() { return avg_loc; }
-    bool has_last_loc() { return last_loc != nullptr; }
-    std::shared_ptr<kis_tracked_location_full> get_last_loc() { return last_loc; }
+    // The location elements are built from the accumulator when requested; callers
+    // which only need the values should use get_accumulator
+    bool has_min_loc() { return loc_acc.num_loc > 0; }
+    std::shared_ptr<kis_tracked_location_triplet> get_min_loc() { 
+        materialize_locations();
+        return min_loc; 
+    }
+    bool has_max_loc() { return loc_acc.num_loc > 0; }
+    std::shared_ptr<kis_tracked_location_triplet> get_max_loc() { 
+        materialize_locations();
+        return max_loc; 
+    }
+    bool has_avg_loc() { return loc_acc.num_avg > 0; }
+    std::shared_ptr<kis_tracked_location_triplet> get_avg_loc() { 
+        materialize_locations();
+        return avg_loc; 
+    }
+    bool has_last_loc() { return loc_acc.num_loc > 0; }
+    std::shared_ptr<kis_tracked_location_full> get_last_loc() { 
+        materialize_locations();
+        return last_loc; 
+    }
+
+    const kis_location_accumulator& get_accumulator() const {
+        return loc_acc;
+    }
+
+    virtual void pre_serialize() override {
+        tracker_component::pre_serialize();
+        materialize_locations();
+    }
 
     time_t get_last_location_time() const {
         return last_location_time;
@@ -216,14 +293,16 @@ public:
         if (last_loc)
             last_loc->reset();
 
-        agg_x = agg_y = agg_z = agg_a = 0;
-        num_avg = num_alt_avg = 0;
+        loc_acc.reset();
         last_location_time = 0;
     }
 
 protected:
     virtual void register_fields() override;
 
+    // Create or update the location elements from the accumulator
+    void materialize_locations();
+
     // We save the IDs here because we dynamically generate them
     std::shared_ptr<kis_tracked_location_triplet> min_loc, max_loc, avg_loc;
     std::shared_ptr<kis_tracked_location_full> last_loc;
@@ -232,8 +311,7 @@ protected:
 
     std::shared_ptr<tracker_element_uint8> loc_fix;
 
-    double agg_x, agg_y, agg_z, agg_a;
-    uint64_t num_avg, num_alt_avg;
+    kis_location_accumulator loc_acc;
 
     time_t last_location_time;
 };
@@ -334,35 +412,93 @@ protected:
     std::shared_ptr<tracker_element_uint64> time_sec;
 };
 
-// RRD-like history track
+// Packed sample of the location history
+struct kis_location_sample {
+    kis_location_sample() :
+        lat{0}, lon{0}, alt{0}, heading{0}, speed{0},
+        signal{0}, frequency{0}, time_sec{0} { }
+
+    double lat, lon, alt, heading, speed;
+    int32_t signal;
+    uint64_t frequency;
+    uint64_t time_sec;
+};
+
+// Bounded ring of packed history samples, oldest first
+class kis_location_reservoir {
+public:
+    kis_location_reservoir(size_t in_max) :
+        max_sz{in_max},
+        start{0} { }
+
+    void push(const kis_location_sample& in_sample) {
+        if (samples.size() < max_sz) {
+            samples.push_back(in_sample);
+            return;
+        }
+
+        samples[start] = in_sample;
+        start = (start + 1) % max_sz;
+    }
+
+    size_t size() const {
+        return samples.size();
+    }
+
+    const kis_location_sample& at(size_t i) const {
+        return samples[(start + i) % samples.size()];
+    }
+
+    // Average of every sample; the location is averaged as a vector, altitude and
+    // signal only over samples which have them
+    kis_location_sample average() const;
+
+protected:
+    size_t max_sz;
+    size_t start;
+    std::vector<kis_location_sample> samples;
+};
+
+// RRD-like history track.
+//
+// Samples are kept packed in bounded reservoirs, and only turned into historic
+// location elements when the history is serialized.
 class kis_location_rrd : public tracker_component {
 public:
     kis_location_rrd() :
-        tracker_component{0} {
+        tracker_component{0},
+        reservoir_100{100},
+        reservoir_10k{100},
+        reservoir_1m{100} {
         register_fields();
         reserve_fields(nullptr);
-        samples_10k_cascade = 0;
-        samples_100_cascade = 0;
     }
 
     kis_location_rrd(int in_id) :
-        tracker_component{in_id} {
+        tracker_component{in_id},
+        reservoir_100{100},
+        reservoir_10k{100},
+        reservoir_1m{100} {
         register_fields();
         reserve_fields(nullptr);
-        samples_10k_cascade = 0;
-        samples_100_cascade = 0;
     }
 
     kis_location_rrd(int in_id, std::shared_ptr<tracker_element_map> e) :
-        tracker_component(in_id) {
+        tracker_component(in_id),
+        reservoir_100{100},
+        reservoir_10k{100},
+        reservoir_1m{100} {
         register_fields();
         reserve_fields(e);
-        samples_10k_cascade = 0;
-        samples_100_cascade = 0;
     }
 
     kis_location_rrd(const kis_location_rrd* p) :
-        tracker_component{p} {
+        tracker_component{p},
+        reservoir_100{100},
+        reservoir_10k{100},
+        reservoir_1m{100},
+        samples_100_cascade{0},
+        samples_10k_cascade{0} {
 
             __ImportField(samples_100, p);
             __ImportField(samples_10k, p);
@@ -387,159 +523,14 @@ public:
         return dup;
     }
 
-    void add_sample(std::shared_ptr<kis_historic_location> in_sample) {
-        set_int_last_sample_ts(in_sample->get_time_sec());
-
-        samples_100->push_back(in_sample);
-
-        if (samples_100->size() > 100) 
-            samples_100->erase(samples_100->begin());
-
-        samples_100_cascade++;
-
-        // We've gotten 100 samples, cascade up to our next bucket
-        if (samples_100_cascade >= 100) {
-            double avg_x = 0, avg_y = 0, avg_z = 0, avg_alt = 0;
-
-            double heading, speed, signal, timesec, frequency;
-            double num_signal, num_alt;
-
-            heading = speed = signal = timesec = frequency = 0;
-            num_signal = num_alt = 0;
-
-            for (auto g : *samples_100) {
-                std::shared_ptr<kis_historic_location> gl =
-                    std::static_pointer_cast<kis_historic_location>(g);
-
-                // Convert to vector for average
-                double mod_lat = gl->get_lat() * M_PI / 180;
-                double mod_lon = gl->get_lon() * M_PI / 180;
-
-                avg_x += cos(mod_lat) * cos(mod_lon);
-                avg_y += cos(mod_lat) * sin(mod_lon);
-                avg_z += sin(mod_lat);
-
-                if (gl->get_alt()) {
-                    avg_alt += gl->get_alt();
-                    num_alt++;
-                }
-
-                heading += gl->get_heading();
-                speed += gl->get_speed();
-
-                if (gl->get_signal() != 0) {
-                    signal += gl->get_signal();
-                    num_signal++;
-                }
-
-                timesec += gl->get_time_sec();
-                frequency += gl->get_frequency();
-            }
-
-            auto aggloc =
-                Globalreg::new_from_pool<kis_historic_location>(historic_location_builder.get());
-
-            double r_x = avg_x / samples_100->size();
-            double r_y = avg_y / samples_100->size();
-            double r_z = avg_z / samples_100->size();
-
-            double central_lon = atan2(r_y, r_x);
-            double central_sqr = sqrt(r_x * r_x + r_y * r_y);
-            double central_lat = atan2(r_z, central_sqr);
-
-            double r_alt = 0;
-
-            if (num_alt > 0) 
-                r_alt =  avg_alt / num_alt;
-
-            aggloc->set_lat(central_lat * 180 / M_PI);
-            aggloc->set_lon(central_lon * 180 / M_PI);
-            aggloc->set_alt(r_alt);
-
-            aggloc->set_heading(heading / samples_100->size());
-            aggloc->set_speed(speed / samples_100->size());
-            aggloc->set_signal(signal / num_signal);
-            aggloc->set_time_sec(timesec / samples_100->size());
-            aggloc->set_frequency(frequency / samples_100->size());
-
-            samples_100_cascade = 0;
-
-            samples_10k->push_back(aggloc);
-            if (samples_10k->size() > 100)
-                samples_10k->erase(samples_10k->begin());
-
-            samples_10k_cascade++;
-
-            if (samples_10k_cascade >= 100) {
-                // If we've gotten 100 samples in the 10k bucket, cascade up again
-                avg_x = avg_y = avg_z = avg_alt = heading = speed = signal = timesec = frequency = 0;
-                num_alt = num_signal = 0;
-
-                for (auto g : *samples_10k) {
-                    std::shared_ptr<kis_historic_location> gl =
-                        std::static_pointer_cast<kis_historic_location>(g);
-
-                    // Convert to vector for average
-                    double mod_lat = gl->get_lat() * M_PI / 180;
-                    double mod_lon = gl->get_lon() * M_PI / 180;
-
-                    avg_x += cos(mod_lat) * cos(mod_lon);
-                    avg_y += cos(mod_lat) * sin(mod_lon);
-                    avg_z += sin(mod_lat);
-
-                    if (gl->get_alt()) {
-                        avg_alt += gl->get_alt();
-                        num_alt++;
-                    }
-
-                    heading += gl->get_heading();
-                    speed += gl->get_speed();
-
-                    if (gl->get_signal()) {
-                        signal += gl->get_signal();
-                        num_signal++;
-                    }
-
-                    timesec += gl->get_time_sec();
-                    frequency += gl->get_frequency();
-                }
-
-                auto aggloc10 =
-                    Globalreg::new_from_pool<kis_historic_location>(historic_location_builder.get());
-
-                r_x = avg_x / samples_100->size();
-                r_y = avg_y / samples_100->size();
-                r_z = avg_z / samples_100->size();
-
-                central_lon = atan2(r_y, r_x);
-                central_sqr = sqrt(r_x * r_x + r_y * r_y);
-                central_lat = atan2(r_z, central_sqr);
-
-                r_alt = 0;
-
-                if (num_alt > 0) 
-                    r_alt =  avg_alt / num_alt;
-
-                aggloc10->set_lat(central_lat * 180 / M_PI);
-                aggloc10->set_lon(central_lat * 180 / M_PI);
-                aggloc10->set_alt(r_alt);
-
-                aggloc10->set_heading(heading / samples_10k->size());
-                aggloc10->set_speed(speed / samples_10k->size());
-                aggloc10->set_signal(signal / num_signal);
-                aggloc10->set_time_sec(timesec / samples_10k->size());
-                aggloc10->set_frequency(timesec / samples_10k->size());
-
-                samples_10k_cascade = 0;
-
-                samples_1m->push_back(aggloc10);
-                if (samples_1m->size() > 100)
-                    samples_1m->erase(samples_1m->begin());
-            }
-        }
+    void add_sample(const kis_location_sample& in_sample);
 
+    void add_sample(std::shared_ptr<kis_historic_location> in_sample) {
+        add_sample(sample_of(in_sample.get()));
     }
 
+    virtual void pre_serialize() override;
+
     __ProxyPrivSplit(last_sample_ts, uint64_t, time_t, time_t, last_sample_ts);
 
 protected:
@@ -561,12 +552,17 @@ protected:
             Globalreg::new_from_pool<kis_historic_location>();
     }
 
-    virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override {
-        tracker_component::reserve_fields(e);
+    virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override;
 
-        samples_100_cascade = 0;
-        samples_10k_cascade = 0;
-    }
+    static kis_location_sample sample_of(kis_historic_location *in_loc);
+
+    // Fill a history vector from a reservoir, re-using the elements already in it
+    void materialize_samples(std::shared_ptr<tracker_element_vector> in_vec,
+            const kis_location_reservoir& in_reservoir);
+
+    // Load any samples from a restored record into a reservoir
+    void absorb_samples(std::shared_ptr<tracker_element_vector> in_vec,
+            kis_location_reservoir& in_reservoir);
 
     std::shared_ptr<tracker_element_vector> samples_100;
     std::shared_ptr<tracker_element_vector> samples_10k;
@@ -576,6 +572,8 @@ protected:
 
     std::shared_ptr<kis_historic_location> historic_location_builder;
 
+    kis_location_reservoir reservoir_100, reservoir_10k, reservoir_1m;
+
     unsigned int samples_100_cascade;
     unsigned int samples_10k_cascade;
 
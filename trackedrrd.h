@@ -27,6 +27,9 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -36,9 +39,21 @@
 #include "entrytracker.h"
 #include "globalregistry.h"
 #include "kis_mutex.h"
+#include "rrd_kernels.h"
 #include "trackedelement.h"
 #include "trackedcomponent.h"
 
+// Contiguous values of a record handed to an aggregator, either a tracked vector or the
+// fixed array of a compact RRD, for the rollup kernels
+inline const double *rrd_record_data(const std::shared_ptr<tracker_element_vector_double>& e) {
+    return e->get().data();
+}
+
+template<size_t N>
+inline const float *rrd_record_data(const std::array<float, N> *e) {
+    return e->data();
+}
+
 // Aggregator class used for RRD.  Performs functions like combining elements
 // (for instance, adding to the existing element, or choosing to replace the
 // element), and for averaging to higher buckets (for instance, performing a 
@@ -56,13 +71,11 @@ public:
     }
 
     // Combine a vector for a higher-level record (seconds to minutes, minutes to 
-    // hours, and so on).
-    static int64_t combine_vector(std::shared_ptr<tracker_element_vector_double> e) {
-        int64_t avg = 0;
-        for (const auto i : *e)
-            avg += i;
-
-        return avg / e->size();
+    // hours, and so on).  The vector is a pointer to either a tracked vector or the
+    // fixed array of a compact RRD.
+    template<class V>
+    static int64_t combine_vector(const V& e) {
+        return (int64_t) rrd_sum(rrd_record_data(e), e->size()) / (int64_t) e->size();
     }
 
     // Default 'empty' value
@@ -305,6 +318,9 @@ public:
         tracker_component::pre_serialize();
         M_Aggregator m_agg;
 
+        // Catching up to the current time isn't a modification
+        derived_fields_scope ds;
+
         uint64_t now = Globalreg::globalreg->last_tv_sec;
         set_serial_time(now);
 
@@ -433,6 +449,473 @@ protected:
     bool update_first;
 };
 
+// RRD for counters added to from every packet thread, such as the total packet rate
+// or the per-source packet counts.
+//
+// Samples for the current second are summed into an atomic bucket without taking
+// the RRD lock, and the bucket is folded into the minute, hour, and day records when
+// the second turns or the RRD is read.  Only the first sample of each second, late
+// samples, and folds take the lock.
+//
+// Because samples are summed before they reach the minute aggregator, this is only
+// for RRDs which add their per-second samples (the default aggregator).  A sample
+// racing the turn of a second may be counted in the next second.
+//
+// Code which reads the vectors directly instead of serializing the RRD should
+// fold() first.
+template <class M_Aggregator = kis_tracked_rrd_default_aggregator,
+         class H_Aggregator = M_Aggregator, class D_Aggregator = M_Aggregator>
+class kis_tracked_atomic_rrd : public kis_tracked_rrd<M_Aggregator, H_Aggregator, D_Aggregator> {
+public:
+    using base_rrd = kis_tracked_rrd<M_Aggregator, H_Aggregator, D_Aggregator>;
+
+    kis_tracked_atomic_rrd() :
+        base_rrd(),
+        pending_time{0},
+        pending_val{0} { }
+
+    kis_tracked_atomic_rrd(int in_id) :
+        base_rrd(in_id),
+        pending_time{0},
+        pending_val{0} { }
+
+    kis_tracked_atomic_rrd(int in_id, std::shared_ptr<tracker_element_map> e) :
+        base_rrd(in_id, e),
+        pending_time{0},
+        pending_val{0} { }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        return r;
+    }
+
+    void add_sample(int64_t in_s, time_t in_time) {
+        if (in_time == pending_time.load(std::memory_order_acquire)) {
+            pending_val.fetch_add(in_s, std::memory_order_relaxed);
+            return;
+        }
+
+        kis_lock_guard<kis_mutex> lk(this->mutex, "kis_tracked_atomic_rrd add_sample");
+
+        // Another thread turned the second while we waited for the lock
+        auto ptime = pending_time.load(std::memory_order_acquire);
+
+        if (in_time == ptime) {
+            pending_val.fetch_add(in_s, std::memory_order_relaxed);
+            return;
+        }
+
+        // Out of order samples go straight to the records
+        if (in_time < ptime) {
+            base_rrd::add_sample(in_s, in_time);
+            return;
+        }
+
+        fold_pending();
+
+        pending_val.fetch_add(in_s, std::memory_order_relaxed);
+        pending_time.store(in_time, std::memory_order_release);
+    }
+
+    // Fold the current second into the records
+    void fold() {
+        kis_lock_guard<kis_mutex> lk(this->mutex, "kis_tracked_atomic_rrd fold");
+        fold_pending();
+    }
+
+    virtual void pre_serialize() override {
+        fold();
+        base_rrd::pre_serialize();
+    }
+
+protected:
+    // Must be called with the RRD lock held
+    void fold_pending() {
+        auto ptime = pending_time.load(std::memory_order_acquire);
+
+        if (ptime == 0)
+            return;
+
+        base_rrd::add_sample(pending_val.exchange(0, std::memory_order_relaxed), ptime);
+    }
+
+    std::atomic<time_t> pending_time;
+    std::atomic<int64_t> pending_val;
+};
+
+// Compact RRD for records held by every device.
+//
+// The minute, hour, and day records are kept as fixed arrays of floats in the RRD
+// instead of as tracked vectors of doubles, and are only turned into tracked vectors
+// while the RRD is being serialized, or as a copy when looked up by path.  The
+// serialized form is the same as kis_tracked_rrd.
+//
+// The day record can be turned off with set_day_history(false), typically on the
+// builder registered for a field so that every RRD cloned from it drops it; the day
+// vector is then serialized empty.
+template <class M_Aggregator = kis_tracked_rrd_default_aggregator,
+         class H_Aggregator = M_Aggregator, class D_Aggregator = M_Aggregator>
+class kis_tracked_compact_rrd : public tracker_component {
+public:
+    kis_tracked_compact_rrd() :
+        tracker_component(),
+        day{new std::array<float, 24>()},
+        materialized{0},
+        update_first{true},
+        rollup_pending{false} {
+        register_fields();
+        reserve_fields(NULL);
+        mutex.set_name("kis_tracked_compact_rrd");
+    }
+
+    kis_tracked_compact_rrd(int in_id) :
+        tracker_component(in_id),
+        day{new std::array<float, 24>()},
+        materialized{0},
+        update_first{true},
+        rollup_pending{false} {
+        register_fields();
+        reserve_fields(NULL);
+        mutex.set_name("kis_tracked_compact_rrd");
+    }
+
+    kis_tracked_compact_rrd(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id),
+        day{new std::array<float, 24>()},
+        materialized{0},
+        update_first{true},
+        rollup_pending{false} {
+        register_fields();
+        reserve_fields(e);
+        mutex.set_name("kis_tracked_compact_rrd");
+    }
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("kis_tracked_compact_rrd");
+    }
+
+    virtual std::shared_ptr<tracker_element> clone_type() override {
+        using this_t = typename std::remove_pointer<decltype(this)>::type;
+        auto r = std::make_shared<this_t>();
+        r->set_id(this->get_id());
+        r->set_day_history(day != nullptr);
+        return r;
+    }
+
+    // See kis_tracked_rrd::update_before_serialize
+    void update_before_serialize(bool in_upd) {
+        update_first = in_upd;
+    }
+
+    void set_day_history(bool in_day) {
+        kis_lock_guard<kis_mutex> lk(mutex, "kis_tracked_compact_rrd set_day_history");
+
+        if (in_day && day == nullptr)
+            day.reset(new std::array<float, 24>());
+        else if (!in_day)
+            day.reset();
+    }
+
+    __Proxy(last_time, uint64_t, time_t, time_t, last_time);
+    __Proxy(serial_time, uint64_t, time_t, time_t, serial_time);
+
+    // Add a sample, with the same semantics as kis_tracked_rrd::add_sample
+    void add_sample(int64_t in_s, time_t in_time) {
+        kis_lock_guard<kis_mutex> lk(mutex, "kis_tracked_compact_rrd add_sample");
+
+        M_Aggregator m_agg;
+        H_Aggregator h_agg;
+        D_Aggregator d_agg;
+
+        int sec_bucket = in_time % 60;
+        int min_bucket = (in_time / 60) % 60;
+        int hour_bucket = (in_time / 3600) % 24;
+
+        time_t ltime = get_last_time();
+
+        int last_sec_bucket = ltime % 60;
+        int last_min_bucket = (ltime / 60) % 60;
+        int last_hour_bucket = (ltime / 3600) % 24;
+
+        // Allow backfilling w/in the past minute because packets might come out-of-order
+        if (in_time < ltime) {
+            if (ltime - in_time > 60)
+                return;
+
+            minute[sec_bucket] = m_agg.combine_element(minute[sec_bucket], in_s);
+            rollup_pending = true;
+            return;
+        }
+
+        // Finish the last minute before moving on from it
+        if (rollup_pending && in_time / 60 != ltime / 60)
+            rollup(ltime);
+
+        if (in_time - ltime > 60 * 60 * 24) {
+            // Nothing in the past day is valid
+            minute.fill(m_agg.default_val());
+            hour.fill(h_agg.default_val());
+
+            if (day != nullptr)
+                day->fill(d_agg.default_val());
+        } else if (in_time - ltime > 60 * 60) {
+            // Nothing in the past hour is valid, and the hours since the last sample
+            // are empty
+            minute.fill(m_agg.default_val());
+            hour.fill(h_agg.default_val());
+
+            if (day != nullptr) {
+                for (int h = 0; h < hours_different(last_hour_bucket + 1, hour_bucket); h++)
+                    (*day)[(last_hour_bucket + 1 + h) % 24] = d_agg.default_val();
+            }
+        } else if (in_time - ltime > 60) {
+            // Nothing in the past minute is valid, and the minutes since the last
+            // sample are empty
+            minute.fill(m_agg.default_val());
+
+            for (int m = 0; m < minutes_different(last_min_bucket + 1, min_bucket); m++)
+                hour[(last_min_bucket + 1 + m) % 60] = h_agg.default_val();
+        } else if (in_time != ltime) {
+            // Fast-forward the seconds since the last sample
+            for (int s = 0; s < minutes_different(last_sec_bucket + 1, sec_bucket); s++)
+                minute[(last_sec_bucket + 1 + s) % 60] = m_agg.default_val();
+        }
+
+        if (in_time == ltime)
+            minute[sec_bucket] = m_agg.combine_element(minute[sec_bucket], in_s);
+        else
+            minute[sec_bucket] = in_s;
+
+        rollup_pending = true;
+
+        set_last_time(in_time);
+    }
+
+    virtual void pre_serialize() override {
+        kis_lock_guard<kis_mutex> lk(mutex, kismet::retain_lock, "kis_tracked_compact_rrd serialize");
+
+        tracker_component::pre_serialize();
+
+        fast_forward();
+
+        if (materialized++ > 0)
+            return;
+
+        for (const auto& id : { get_ids().minute_vec_id, get_ids().hour_vec_id,
+                get_ids().day_vec_id, get_ids().blank_val_id })
+            insert(materialize(id));
+    }
+
+    virtual void post_serialize() override {
+        kis_lock_guard<kis_mutex> lk(mutex, std::adopt_lock);
+
+        if (materialized > 0 && --materialized == 0) {
+            for (const auto& id : { get_ids().minute_vec_id, get_ids().hour_vec_id,
+                    get_ids().day_vec_id, get_ids().blank_val_id }) {
+                auto i = find(id);
+                if (i != end())
+                    erase(i);
+            }
+        }
+
+        tracker_component::post_serialize();
+    }
+
+    virtual shared_tracker_element get_sub_fallback(int id) override {
+        const auto& ids = get_ids();
+
+        if (id != ids.minute_vec_id && id != ids.hour_vec_id && id != ids.day_vec_id &&
+                id != ids.blank_val_id)
+            return tracker_component::get_sub_fallback(id);
+
+        kis_lock_guard<kis_mutex> lk(mutex, "kis_tracked_compact_rrd get_sub_fallback");
+
+        fast_forward();
+
+        return materialize(id);
+    }
+
+protected:
+    struct compact_rrd_ids {
+        int minute_vec_id;
+        int hour_vec_id;
+        int day_vec_id;
+        int blank_val_id;
+    };
+
+    // The record fields aren't registered per instance since they're never held as
+    // elements outside of serialization
+    static const compact_rrd_ids& get_ids() {
+        static const compact_rrd_ids ids = []() {
+            auto et = Globalreg::globalreg->entrytracker;
+
+            compact_rrd_ids r;
+
+            r.minute_vec_id = et->register_field("kismet.common.rrd.minute_vec",
+                    tracker_element_factory<tracker_element_vector_double>(), 
+                    "past minute values per second");
+            r.hour_vec_id = et->register_field("kismet.common.rrd.hour_vec",
+                    tracker_element_factory<tracker_element_vector_double>(), 
+                    "past hour values per minute");
+            r.day_vec_id = et->register_field("kismet.common.rrd.day_vec",
+                    tracker_element_factory<tracker_element_vector_double>(), 
+                    "past day values per hour");
+            r.blank_val_id = et->register_field("kismet.common.rrd.blank_val",
+                    tracker_element_factory<tracker_element_int64>(), 
+                    "blank value");
+
+            return r;
+        }();
+
+        return ids;
+    }
+
+    // Bring the records up to the current time before they're read; must be called
+    // with the RRD lock held
+    void fast_forward() {
+        M_Aggregator m_agg;
+
+        // Catching up to the current time isn't a modification
+        derived_fields_scope ds;
+
+        time_t now = Globalreg::globalreg->last_tv_sec;
+        set_serial_time(now);
+
+        if (update_first)
+            add_sample(m_agg.default_val(), now);
+
+        if (rollup_pending)
+            rollup(get_last_time());
+    }
+
+    // Roll the current minute up into its slot of the hour, and the hour into its slot
+    // of the day.  Samples only touch the minute; the rollup is done once when the
+    // minute is left behind or the records are read, instead of re-averaging the hour
+    // and day on every sample.  Must be called with the RRD lock held
+    void rollup(time_t in_time) {
+        H_Aggregator h_agg;
+        D_Aggregator d_agg;
+
+        hour[(in_time / 60) % 60] = h_agg.combine_vector(&minute);
+
+        if (day != nullptr)
+            (*day)[(in_time / 3600) % 24] = d_agg.combine_vector(&hour);
+
+        rollup_pending = false;
+    }
+
+    // Must be called with the RRD lock held
+    shared_tracker_element materialize(int id) {
+        const auto& ids = get_ids();
+
+        if (id == ids.blank_val_id) {
+            M_Aggregator m_agg;
+
+            auto e = std::make_shared<tracker_element_int64>(id);
+            e->set(m_agg.default_val());
+            return e;
+        }
+
+        auto e = std::make_shared<tracker_element_vector_double>(id);
+
+        auto fill = [&e](const float *v, size_t n) {
+            e->reserve(n);
+            for (size_t i = 0; i < n; i++)
+                e->push_back(v[i]);
+        };
+
+        if (id == ids.minute_vec_id)
+            fill(minute.data(), minute.size());
+        else if (id == ids.hour_vec_id)
+            fill(hour.data(), hour.size());
+        else if (day != nullptr)
+            fill(day->data(), day->size());
+
+        return e;
+    }
+
+    inline int minutes_different(int m1, int m2) const {
+        m1 = m1 % 60;
+        m2 = m2 % 60;
+
+        if (m1 <= m2)
+            return m2 - m1;
+
+        return 60 - m1 + m2;
+    }
+
+    inline int hours_different(int h1, int h2) const {
+        h1 = h1 % 24;
+        h2 = h2 % 24;
+
+        if (h1 <= h2)
+            return h2 - h1;
+
+        return 24 - h1 + h2;
+    }
+
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.common.rrd.last_time", "last time updated", &last_time);
+        register_field("kismet.common.rrd.serial_time", "timestamp of serialization", &serial_time);
+    }
+
+    virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override {
+        tracker_component::reserve_fields(e);
+
+        M_Aggregator m_agg;
+        H_Aggregator h_agg;
+        D_Aggregator d_agg;
+
+        minute.fill(m_agg.default_val());
+        hour.fill(h_agg.default_val());
+        day->fill(d_agg.default_val());
+
+        if (e == nullptr)
+            return;
+
+        // Import the records of a parsed RRD
+        const auto& ids = get_ids();
+
+        auto import = [&e](int id, float *v, size_t n) {
+            auto i = e->find(id);
+
+            if (i == e->end() || i->second == nullptr ||
+                    i->second->get_type() != tracker_type::tracker_vector_double)
+                return;
+
+            auto vec = static_cast<tracker_element_vector_double *>(i->second.get());
+
+            for (size_t x = 0; x < n && x < vec->size(); x++)
+                v[x] = (*vec)[x];
+        };
+
+        import(ids.minute_vec_id, minute.data(), minute.size());
+        import(ids.hour_vec_id, hour.data(), hour.size());
+        import(ids.day_vec_id, day->data(), day->size());
+    }
+
+    kis_mutex mutex;
+
+    std::shared_ptr<tracker_element_uint64> last_time;
+    std::shared_ptr<tracker_element_uint64> serial_time;
+
+    std::array<float, 60> minute;
+    std::array<float, 60> hour;
+    std::unique_ptr<std::array<float, 24>> day;
+
+    // Nested serializations sharing the materialized records
+    unsigned int materialized;
+
+    bool update_first;
+
+    // Samples have been added to the minute since it was last rolled up
+    bool rollup_pending;
+};
+
 // Easier to make this it's own class since for a single-minute RRD the logic is
 // far simpler.  In a perfect would this would be derived from the common
 // RRD (or the other way around) but until it becomes a problem that's a
@@ -542,6 +1025,9 @@ public:
         tracker_component::pre_serialize();
         Aggregator agg;
 
+        // Catching up to the current time isn't a modification
+        derived_fields_scope ds;
+
         uint64_t now = Globalreg::globalreg->last_tv_sec;
 
         set_serial_time(now);
@@ -633,23 +1119,15 @@ public:
     }
 
     // Select the strongest signal of the bucket
-    static int64_t combine_vector(std::shared_ptr<tracker_element_vector_double> e) {
-        int64_t avg = 0, avgc = 0;
-
-        for (auto i : *e) {
-            int64_t v = i;
-
-            if (v == 0)
-                continue;
-
-            avg += v;
-            avgc++;
-        }
+    template<class V>
+    static int64_t combine_vector(const V& e) {
+        size_t avgc;
+        int64_t avg = rrd_sum_nonzero(rrd_record_data(e), e->size(), &avgc);
 
         if (avgc == 0)
             return default_val();
 
-        return avg / avgc;
+        return avg / (int64_t) avgc;
     }
 
     // Default 'empty' value, no legit signal would be 0
@@ -693,13 +1171,9 @@ public:
     }
 
     // Simple average
-    static int64_t combine_vector(std::shared_ptr<tracker_element_vector_double> e) {
-        int64_t avg = 0;
-
-        for (auto i : *e) 
-            avg += i;
-
-        return avg / e->size();
+    template<class V>
+    static int64_t combine_vector(const V& e) {
+        return (int64_t) rrd_sum(rrd_record_data(e), e->size()) / (int64_t) e->size();
     }
 
     // Default 'empty' value, no legit signal would be 0
@@ -739,13 +1213,12 @@ public:
     }
 
     // Simple average
-    static int64_t combine_vector(std::shared_ptr<tracker_element_vector_double> e) {
-        int64_t most = 0;
+    template<class V>
+    static int64_t combine_vector(const V& e) {
+        int64_t most = rrd_max(rrd_record_data(e), e->size());
 
-        for (auto i : *e) {
-            if (i > most)
-                most = i;
-        }
+        if (most < 0)
+            return 0;
 
         return most;
     }
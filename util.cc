@@ -69,6 +69,7 @@
 #include <stdexcept>
 
 #include "packet.h"
+#include "string_scan.h"
 
 #include <pthread.h>
 
@@ -201,10 +202,22 @@ std::string munge_to_printable(const char *in_data, unsigned int max, int nullte
 std::size_t munge_extra_space(const std::string& s, bool utf8) noexcept {
     std::size_t result = 0;
 
-    for (size_t i = 0; i < s.size(); i++) {
-        u_char c = s[i];
+    const auto data = s.data();
+    const auto len = s.length();
 
-        switch (c & 0xFF) {
+    // Only the bytes between the runs which need no escaping are examined; UTF8 keeps
+    // everything but control characters, quotes, and backslashes, otherwise only
+    // printable ascii is kept
+    auto plain_span = [utf8](const char *d, size_t l) {
+        if (utf8)
+            return json_plain_span(d, l);
+        return printable_span(d, l, "\"\\");
+    };
+
+    for (auto i = plain_span(data, len); i < len; i += 1 + plain_span(data + i + 1, len - i - 1)) {
+        u_char c = data[i];
+
+        switch (c) {
             case '"':
             case '\\':
             case '\b':
@@ -220,19 +233,13 @@ std::size_t munge_extra_space(const std::string& s, bool utf8) noexcept {
 
             default:
                 if (!utf8) {
-                    if (c >= 32 && c <= 126) {
-                        result += 1;
-                    } else {
-                        result += 3;
-                    }
+                    // from c (1 byte) to \xHH (4 bytes)
+                    result += 3;
                 } else {
-                    if (c >= 0x00 and c <= 0x1f) {
-                        // from c (1 byte) to \uxxxx (6 bytes)
-                        result += 5;
-                    }
+                    // from c (1 byte) to \uxxxx (6 bytes)
+                    result += 5;
                 }
 
-
                 break;
         }
     }
@@ -240,6 +247,20 @@ std::size_t munge_extra_space(const std::string& s, bool utf8) noexcept {
     return result;
 }
 
+const nlohmann::json& json_field(const nlohmann::json& in_json, const char *in_key) {
+    static const nlohmann::json null_json;
+
+    if (!in_json.is_object())
+        return null_json;
+
+    auto i = in_json.find(in_key);
+
+    if (i == in_json.end())
+        return null_json;
+
+    return *i;
+}
+
 std::string munge_to_printable(const std::string& s) noexcept {
     const auto utf8 = is_valid_utf8(s);
     const auto space = munge_extra_space(s, utf8);
@@ -251,8 +272,22 @@ std::string munge_to_printable(const std::string& s) noexcept {
     std::string result(s.size() + space, '\\');
     std::size_t pos = 0;
 
-    for (size_t i = 0; i < s.size(); i++) {
-        u_char c = s[i];
+    const auto data = s.data();
+    const auto len = s.length();
+    std::size_t i = 0;
+
+    while (true) {
+        // copy the run which needs no escaping whole
+        const auto run = utf8 ? json_plain_span(data + i, len - i) :
+            printable_span(data + i, len - i, "\"\\");
+        memcpy(&result[pos], data + i, run);
+        pos += run;
+        i += run;
+
+        if (i >= len)
+            break;
+
+        u_char c = data[i++];
 
         switch (c) {
             // quotation mark (0x22)
@@ -313,26 +348,18 @@ std::string munge_to_printable(const std::string& s) noexcept {
 
             default:
                 if (!utf8) {
-                    if (c >= 32 && c <= 126) {
-                        result[pos++] = c;
-                    } else {
-                        sprintf(&result[pos], "x%02X", c);
-                        pos += 4;
-                    }
+                    // print character c as \xHH
+                    sprintf(&result[pos + 1], "x%02X", c);
+                    pos += 4;
                 } else {
-
-                    if (c >= 0x00 and c <= 0x1f) {
-                        // print character c as \uxxxx
-                        sprintf(&result[pos + 1], "u%04x", int(c));
-                        pos += 6;
-                        // overwrite trailing null character
-                        result[pos] = '\\';
-                    } else {
-                        // all other characters are added as-is
-                        result[pos++] = c;
-                    }
+                    // print character c as \uxxxx
+                    sprintf(&result[pos + 1], "u%04x", int(c));
+                    pos += 6;
                 }
 
+                // overwrite trailing null character
+                result[pos] = '\\';
+
                 break;
         }
     }
@@ -403,28 +430,19 @@ int hex_str_to_uint8(const std::string& in_str, uint8_t *in_buf, int in_buflen)
 }
 
 std::string uint8_to_hex_str(uint8_t *in_buf, int in_buflen) {
-    std::string rs;
+    static const char hex_digits[] = "0123456789ABCDEF";
+
+    if (in_buflen <= 0)
+        return "";
 
-    rs.reserve(in_buflen * 2);
+    std::string rs(in_buflen * 2, '0');
 
     for (int i = 0; i < in_buflen; i++) {
-        char c = in_buf[i];
-
-        auto n = (c >> 4) & 0x0F;
-        if (n <= 9)
-            rs += '0' + n;
-        else
-            rs += 'A' + n - 10;
-
-        auto n2 = c & 0x0F;
-        if (n2 <= 9)
-            rs += '0' + n2;
-        else
-            rs += 'A' + n2 - 10;
+        rs[i * 2] = hex_digits[in_buf[i] >> 4];
+        rs[i * 2 + 1] = hex_digits[in_buf[i] & 0x0F];
     }
 
     return rs;
-
 }
 
 int x_to_i(char x) {
@@ -1171,53 +1189,48 @@ double ts_now_to_double() {
     return (double) ts.tv_sec + (double) ((double) ts.tv_usec / (double) 1000000);
 }
 
+namespace {
+    // Value of a hex digit, or -1
+    inline int hex_nibble(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 0xA;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 0xA;
+        return -1;
+    }
+}
+
 std::string hex_to_bytes(const std::string& in) {
     if (in.length() == 0)
         return "";
 
-    std::string ret;
-    ret.reserve((in.length() / 2) + 1);
-    size_t p = 0;
-
     // Prefix with a 0 if we're an odd length
-    if ((in.length() % 2) != 0) {
-        if (in[0] >= '0' && in[0] <= '9')
-            ret += in[0] - '0';
-        else if (in[0] >= 'a' && in[0] <= 'f')
-            ret += in[0] - 'a' + 0xA;
-        else if (in[0] >= 'A' && in[0] <= 'F')
-            ret += in[0] - 'A' + 0xA;
-        else
+    size_t p = in.length() % 2;
+
+    std::string ret((in.length() + 1) / 2, '\0');
+    size_t o = 0;
+
+    if (p != 0) {
+        auto b = hex_nibble(in[0]);
+
+        if (b < 0)
             return "";
 
-        p = 1;
+        ret[o++] = b;
     }
 
     // Start either at the base element or one above if we're
     // forcing a prefix of 0
     for (size_t x = p; x + 1 < in.length(); x += 2) {
-        auto b1 = '0';
-        auto b2 = '0';
-
-        if (in[x] >= '0' && in[x] <= '9')
-            b1 = in[x] - '0';
-        else if (in[x] >= 'a' && in[x] <= 'f')
-            b1 = in[x] - 'a' + 0xA;
-        else if (in[x] >= 'A' && in[x] <= 'F')
-            b1 = in[x] - 'A' + 0xA;
-        else
-            return "";
+        auto b1 = hex_nibble(in[x]);
+        auto b2 = hex_nibble(in[x + 1]);
 
-        if (in[x + 1] >= '0' && in[x + 1] <= '9')
-            b2 = in[x + 1] - '0';
-        else if (in[x + 1] >= 'a' && in[x + 1] <= 'f')
-            b2 = in[x + 1] - 'a' + 0xA;
-        else if (in[x + 1] >= 'A' && in[x + 1] <= 'F')
-            b2 = in[x + 1] - 'A' + 0xA;
-        else
+        if (b1 < 0 || b2 < 0)
             return "";
 
-        ret += (((b1 & 0xF) << 4) + (b2 & 0xF));
+        ret[o++] = (b1 << 4) | b2;
     }
 
     return ret;
@@ -1232,10 +1245,107 @@ void thread_set_process_name(const std::string& name) {
 void thread_set_process_name(const std::string& name) { }
 #endif
 
+bool parse_cpu_list(const std::string& in_list, std::vector<unsigned int>& ret_cpus) {
+    ret_cpus.clear();
+
+    for (const auto& t : str_tokenize(in_list, ",")) {
+        auto tok = str_lower(str_strip(t));
+
+        if (tok.length() == 0)
+            continue;
+
+        if (tok.find("node") == 0) {
+            // CPUs of a NUMA node are listed in sysfs in the same format
+            unsigned int node;
+
+            try {
+                node = string_to_n<unsigned int>(tok.substr(4));
+            } catch (const std::exception& e) {
+                return false;
+            }
+
+            auto nodef = 
+                fopen(fmt::format("/sys/devices/system/node/node{}/cpulist", node).c_str(), "r");
+
+            if (nodef == nullptr)
+                return false;
+
+            char buf[1024];
+            auto r = fgets(buf, sizeof(buf), nodef);
+            fclose(nodef);
+
+            if (r == nullptr)
+                return false;
+
+            std::vector<unsigned int> node_cpus;
+
+            if (!parse_cpu_list(buf, node_cpus))
+                return false;
+
+            ret_cpus.insert(ret_cpus.end(), node_cpus.begin(), node_cpus.end());
+            continue;
+        }
+
+        unsigned int first, last;
+
+        try {
+            auto dash = tok.find('-');
+
+            if (dash == std::string::npos) {
+                first = last = string_to_n<unsigned int>(tok);
+            } else {
+                first = string_to_n<unsigned int>(tok.substr(0, dash));
+                last = string_to_n<unsigned int>(tok.substr(dash + 1));
+            }
+        } catch (const std::exception& e) {
+            return false;
+        }
+
+        if (last < first)
+            return false;
+
+        for (auto c = first; c <= last; c++)
+            ret_cpus.push_back(c);
+    }
+
+    std::sort(ret_cpus.begin(), ret_cpus.end());
+    ret_cpus.erase(std::unique(ret_cpus.begin(), ret_cpus.end()), ret_cpus.end());
+
+    return true;
+}
+
+#if defined(SYS_LINUX)
+bool thread_set_cpu_affinity(const std::vector<unsigned int>& cpus) {
+    if (cpus.size() == 0)
+        return true;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (auto c : cpus) {
+        if (c >= CPU_SETSIZE)
+            return false;
+        CPU_SET(c, &set);
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#else
+bool thread_set_cpu_affinity(const std::vector<unsigned int>& cpus) {
+    return cpus.size() == 0;
+}
+#endif
+
 bool is_valid_utf8(const std::string& subject) {
     int i, ix, nb, j;
 
     for (i = 0, ix = subject.length(); i < ix; i++) {
+        // runs of ascii are always valid
+        i += ascii_span(subject.data() + i, ix - i);
+
+        if (i >= ix)
+            break;
+
         auto c = (unsigned char) subject[i];
 
         if (0x00 <= c && c <= 0x7f) {
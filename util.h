@@ -77,6 +77,10 @@ template <>struct fmt::formatter<nlohmann::json::number_unsigned_t> : fmt::ostre
 // a pure ascii string if we can't confirm that it's UTF8
 std::string munge_to_printable(const std::string& in_str) noexcept;
 
+// Look up a key in a JSON object without copying or modifying it; a missing key, or a
+// document which isn't an object, gives a null value like operator[] on a mutable one
+const nlohmann::json& json_field(const nlohmann::json& in_json, const char *in_key);
+
 std::string str_lower(const std::string& in_str);
 std::string str_upper(const std::string& in_str);
 std::string str_strip(const std::string& in_str);
@@ -387,6 +391,14 @@ std::string hex_to_bytes(const std::string& in);
 
 void thread_set_process_name(const std::string& name);
 
+// Parse a list of CPUs such as "0-3,8,10"; a NUMA node given as "nodeN" is replaced by 
+// the CPUs of that node.  Returns false if the list can't be parsed.
+bool parse_cpu_list(const std::string& in_list, std::vector<unsigned int>& ret_cpus);
+
+// Restrict the calling thread to a set of CPUs; returns false if the platform doesn't 
+// support it or the CPUs aren't available.  An empty set is ignored.
+bool thread_set_cpu_affinity(const std::vector<unsigned int>& cpus);
+
 // Closure promise; executes a function as it leaves scope
 class closure_promise {
 public: